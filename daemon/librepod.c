@@ -0,0 +1,517 @@
+/* librepod - Daemon which downloads on behalf of local librepo clients
+ * Copyright (C) 2014  Tomas Mlcoch
+ *
+ * Licensed under the GNU Lesser General Public License Version 2.1
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+/* The daemon serves the requests of lr_daemon_handle_perform() and
+ * lr_daemon_download_packages() (see librepo/daemon.h), every
+ * connection in its own thread. Handles are kept between the requests
+ * keyed by the options identifying their repository, so the next
+ * request for the repository reuses the connections, DNS cache and TLS
+ * sessions of the handle. A handle serves one request at a time, the
+ * other requests for the same repository wait for it.
+ */
+
+#define _GNU_SOURCE         // Because of struct ucred and accept4()
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <signal.h>
+#include <poll.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <glib.h>
+#include <glib/gstdio.h>
+
+#include "librepo/librepo.h"
+#include "librepo/daemon_internal.h"
+
+#define DEFAULT_MAX_HANDLES     64
+#define MAX_TARGETS             1000000 /*!< Max number of targets of a request */
+#define POLL_TIMEOUT_MS         1000    /*!< How often the termination is checked */
+
+typedef struct {
+    LrHandle *handle;   /*!< Handle of the repository */
+    GMutex lock;        /*!< Held while the handle serves a request */
+    gboolean cached;    /*!< The entry is in the cache, otherwise it is
+                             freed by the request which created it */
+} DaemonEntry;
+
+typedef struct {
+    gboolean finished;          /*!< End callback was called */
+    LrTransferStatus status;    /*!< Status passed to the end callback */
+} DaemonTargetResult;
+
+static gchar *opt_socket = NULL;
+static gint opt_max_handles = DEFAULT_MAX_HANDLES;
+
+static GOptionEntry entries[] = {
+    { "socket", 's', 0, G_OPTION_ARG_FILENAME, &opt_socket,
+      "Path of the socket (default " LR_DAEMON_SOCKET ")", "PATH" },
+    { "max-handles", 'm', 0, G_OPTION_ARG_INT, &opt_max_handles,
+      "Max number of kept handles (default 64)", "N" },
+    { NULL, 0, 0, 0, NULL, NULL, NULL },
+};
+
+/** Entries (DaemonEntry *) keyed by lr_daemon_handle_key() */
+static GHashTable *cache = NULL;
+G_LOCK_DEFINE_STATIC(cache);
+
+static volatile sig_atomic_t terminate = 0;
+
+static void
+sigterm_handler(G_GNUC_UNUSED int sig)
+{
+    terminate = 1;
+}
+
+static void
+entry_free(DaemonEntry *entry)
+{
+    lr_handle_free(entry->handle);
+    g_mutex_clear(&entry->lock);
+    g_free(entry);
+}
+
+/** Entry of the repository of the handle in the group of the request.
+ * A new entry is kept in the cache unless it is full.
+ */
+static DaemonEntry *
+entry_get(GKeyFile *request, const char *group, GError **err)
+{
+    gchar *key = lr_daemon_handle_key(request, group);
+    DaemonEntry *entry;
+
+    G_LOCK(cache);
+
+    entry = g_hash_table_lookup(cache, key);
+    if (entry) {
+        G_UNLOCK(cache);
+        g_free(key);
+        return entry;
+    }
+
+    entry = g_new0(DaemonEntry, 1);
+    g_mutex_init(&entry->lock);
+    entry->handle = lr_handle_init();
+    if (!lr_daemon_handle_from_keyfile(entry->handle, request, group,
+                                       TRUE, err)) {
+        G_UNLOCK(cache);
+        entry_free(entry);
+        g_free(key);
+        return NULL;
+    }
+
+    if (g_hash_table_size(cache) < (guint) opt_max_handles) {
+        entry->cached = TRUE;
+        g_hash_table_insert(cache, key, entry);
+    } else {
+        g_debug("%s: Cache is full, handle is not kept", __func__);
+        g_free(key);
+    }
+
+    G_UNLOCK(cache);
+    return entry;
+}
+
+static gint
+entry_cmp(gconstpointer a, gconstpointer b)
+{
+    gconstpointer x = *((DaemonEntry * const *) a);
+    gconstpointer y = *((DaemonEntry * const *) b);
+    return (x > y) - (x < y);
+}
+
+/** Lock the distinct entries, always in the same order (by address),
+ * so that two requests do not wait for each other.
+ * Returns the locked entries for entries_release().
+ */
+static GPtrArray *
+entries_lock(DaemonEntry **list, gint64 len)
+{
+    GPtrArray *locked = g_ptr_array_new();
+
+    for (gint64 x = 0; x < len; x++)
+        g_ptr_array_add(locked, list[x]);
+    g_ptr_array_sort(locked, entry_cmp);
+
+    for (guint x = 0; x < locked->len; x++) {
+        if (x > 0 && g_ptr_array_index(locked, x) == g_ptr_array_index(locked, x-1)) {
+            g_ptr_array_remove_index(locked, x--);
+            continue;
+        }
+        g_mutex_lock(&((DaemonEntry *) g_ptr_array_index(locked, x))->lock);
+    }
+
+    return locked;
+}
+
+static void
+entries_release(GPtrArray *locked)
+{
+    for (guint x = 0; x < locked->len; x++) {
+        DaemonEntry *entry = g_ptr_array_index(locked, x);
+        g_mutex_unlock(&entry->lock);
+        if (!entry->cached)
+            entry_free(entry);
+    }
+    g_ptr_array_free(locked, TRUE);
+}
+
+static void
+serve_perform(GKeyFile *request,
+              G_GNUC_UNUSED GKeyFile *response,
+              GError **err)
+{
+    gchar *group = lr_daemon_group("handle", 0);
+    DaemonEntry *entry;
+    GPtrArray *locked;
+    LrResult *result;
+
+    entry = entry_get(request, group, err);
+    if (!entry) {
+        g_free(group);
+        return;
+    }
+
+    locked = entries_lock(&entry, 1);
+    result = lr_result_init();
+
+    // The result of an update is the repository downloaded before
+    if (lr_daemon_handle_from_keyfile(entry->handle, request, group,
+                                      FALSE, err)
+        && (!g_key_file_get_boolean(request, group, "update", NULL)
+            || lr_daemon_load_result(request, group, FALSE, result, err)))
+        lr_handle_perform(entry->handle, result, err);
+
+    lr_result_free(result);
+    entries_release(locked);
+    g_free(group);
+}
+
+static int
+target_end_cb(void *data, LrTransferStatus status, G_GNUC_UNUSED const char *msg)
+{
+    DaemonTargetResult *result = data;
+    result->finished = TRUE;
+    result->status = status;
+    return LR_CB_OK;
+}
+
+static void
+serve_download(GKeyFile *request, GKeyFile *response, GError **err)
+{
+    gint64 nhandles, ntargets;
+    DaemonEntry **handle_entries;
+    DaemonTargetResult *results;
+    GPtrArray *locked = NULL;
+    GSList *targets = NULL;
+    gint64 x;
+
+    nhandles = g_key_file_get_int64(request, LR_DAEMON_REQUEST, "handles", NULL);
+    ntargets = g_key_file_get_int64(request, LR_DAEMON_REQUEST, "targets", NULL);
+    if (ntargets < 0 || ntargets > MAX_TARGETS
+        || nhandles < 0 || nhandles > ntargets) {
+        g_set_error(err, LR_PACKAGE_DOWNLOADER_ERROR, LRE_BADFUNCARG,
+                    "Bad number of handles (%" G_GINT64_FORMAT
+                    ") or targets (%" G_GINT64_FORMAT ")", nhandles, ntargets);
+        return;
+    }
+
+    handle_entries = g_new0(DaemonEntry *, nhandles);
+    results = g_new0(DaemonTargetResult, ntargets);
+
+    for (x = 0; x < nhandles; x++) {
+        gchar *group = lr_daemon_group("handle", x);
+        handle_entries[x] = entry_get(request, group, err);
+        g_free(group);
+        if (!handle_entries[x]) {
+            // Uncached entries are freed by entries_release()
+            nhandles = x;
+            goto out;
+        }
+    }
+
+    locked = entries_lock(handle_entries, nhandles);
+
+    for (x = 0; x < nhandles; x++) {
+        gchar *group = lr_daemon_group("handle", x);
+        gboolean ok = lr_daemon_handle_from_keyfile(handle_entries[x]->handle,
+                                                    request, group,
+                                                    FALSE, err);
+        g_free(group);
+        if (!ok)
+            goto out;
+    }
+
+    for (x = 0; x < ntargets; x++) {
+        gchar *group = lr_daemon_group("target", x);
+        gint64 h = g_key_file_get_int64(request, group, "handle", NULL);
+        LrPackageTarget *target = NULL;
+
+        if (h < -1 || h >= nhandles)
+            g_set_error(err, LR_PACKAGE_DOWNLOADER_ERROR, LRE_BADFUNCARG,
+                        "Bad handle of [%s] in the request", group);
+        else
+            target = lr_daemon_packagetarget_from_keyfile(
+                            h >= 0 ? handle_entries[h]->handle : NULL,
+                            request, group, target_end_cb, &results[x], err);
+        g_free(group);
+        if (!target)
+            goto out;
+        targets = g_slist_prepend(targets, target);
+    }
+    targets = g_slist_reverse(targets);
+
+    lr_download_packages(targets,
+                         g_key_file_get_integer(request, LR_DAEMON_REQUEST,
+                                                "flags", NULL),
+                         err);
+
+    x = 0;
+    for (GSList *elem = targets; elem; elem = g_slist_next(elem), x++) {
+        LrPackageTarget *target = elem->data;
+        gchar *group = lr_daemon_group("target", x);
+
+        if (target->local_path)
+            g_key_file_set_string(response, group, "local_path",
+                                  target->local_path);
+        if (target->err)
+            g_key_file_set_string(response, group, "err", target->err);
+        if (results[x].finished)
+            g_key_file_set_integer(response, group, "status",
+                                   results[x].status);
+        g_free(group);
+    }
+
+out:
+    g_slist_free_full(targets, (GDestroyNotify) lr_packagetarget_free);
+    if (locked) {
+        entries_release(locked);
+    } else {
+        // Entries were not locked yet, free the ones out of the cache
+        for (x = 0; x < nhandles; x++)
+            if (!handle_entries[x]->cached)
+                entry_free(handle_entries[x]);
+    }
+    g_free(handle_entries);
+    g_free(results);
+}
+
+/** Clients must run under the user of the daemon or as root,
+ * because the daemon writes to the paths they send */
+static gboolean
+check_peer(int fd, GError **err)
+{
+    struct ucred cred;
+    socklen_t len = sizeof(cred);
+
+    if (getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &cred, &len) < 0) {
+        g_set_error(err, LR_HANDLE_ERROR, LRE_IO,
+                    "Cannot get credentials of the client: %s",
+                    g_strerror(errno));
+        return FALSE;
+    }
+
+    if (cred.uid != 0 && cred.uid != getuid()) {
+        g_set_error(err, LR_HANDLE_ERROR, LRE_BADFUNCARG,
+                    "librepod does not serve clients of user %ld",
+                    (long) cred.uid);
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+static gpointer
+serve_connection(gpointer data)
+{
+    int fd = GPOINTER_TO_INT(data);
+    GError *tmp_err = NULL;
+    GKeyFile *request = NULL;
+    GKeyFile *response;
+    gchar *type = NULL;
+
+    response = g_key_file_new();
+
+    if (check_peer(fd, &tmp_err))
+        request = lr_daemon_receive(fd, &tmp_err);
+
+    if (request) {
+        gint version = g_key_file_get_integer(request, LR_DAEMON_REQUEST,
+                                              "version", NULL);
+        type = g_key_file_get_string(request, LR_DAEMON_REQUEST, "type", NULL);
+        g_debug("%s: Request %s (version %d)", __func__, type, version);
+
+        if (version != LR_DAEMON_VERSION)
+            g_set_error(&tmp_err, LR_HANDLE_ERROR, LRE_BADFUNCARG,
+                        "Unsupported version of the protocol: %d", version);
+        else if (!g_strcmp0(type, LR_DAEMON_TYPE_PERFORM))
+            serve_perform(request, response, &tmp_err);
+        else if (!g_strcmp0(type, LR_DAEMON_TYPE_DOWNLOAD))
+            serve_download(request, response, &tmp_err);
+        else
+            g_set_error(&tmp_err, LR_HANDLE_ERROR, LRE_BADFUNCARG,
+                        "Unknown type of the request: %s", type);
+    }
+
+    if (tmp_err)
+        g_debug("%s: Request failed: %s", __func__, tmp_err->message);
+
+    lr_daemon_set_error(response, tmp_err);
+    g_clear_error(&tmp_err);
+    if (!lr_daemon_send(fd, response, &tmp_err)) {
+        g_debug("%s: Cannot send the response: %s", __func__, tmp_err->message);
+        g_error_free(tmp_err);
+    }
+
+    close(fd);
+    g_free(type);
+    if (request)
+        g_key_file_free(request);
+    g_key_file_free(response);
+    return NULL;
+}
+
+static int
+open_socket(const char *path)
+{
+    struct sockaddr_un addr;
+    struct stat st;
+    gchar *dir;
+    int fd;
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        fprintf(stderr, "Path of the socket is too long: %s\n", path);
+        return -1;
+    }
+    strcpy(addr.sun_path, path);
+
+    dir = g_path_get_dirname(path);
+    if (g_mkdir_with_parents(dir, 0755) < 0) {
+        fprintf(stderr, "Cannot create %s: %s\n", dir, g_strerror(errno));
+        g_free(dir);
+        return -1;
+    }
+    g_free(dir);
+
+    // Socket of a previous instance
+    if (lstat(path, &st) == 0 && S_ISSOCK(st.st_mode))
+        unlink(path);
+
+    fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        perror("socket");
+        return -1;
+    }
+
+    if (bind(fd, (struct sockaddr *) &addr, sizeof(addr)) < 0
+        || chmod(path, 0600) < 0
+        || listen(fd, SOMAXCONN) < 0) {
+        fprintf(stderr, "Cannot listen on %s: %s\n", path, g_strerror(errno));
+        close(fd);
+        return -1;
+    }
+
+    return fd;
+}
+
+int
+main(int argc, char *argv[])
+{
+    GError *tmp_err = NULL;
+    GOptionContext *context;
+    GHashTableIter iter;
+    gpointer value;
+    int fd;
+
+    context = g_option_context_new("- daemon which downloads for librepo "
+                                   "clients");
+    g_option_context_add_main_entries(context, entries, NULL);
+    if (!g_option_context_parse(context, &argc, &argv, &tmp_err)) {
+        fprintf(stderr, "%s\n", tmp_err->message);
+        return EXIT_FAILURE;
+    }
+    g_option_context_free(context);
+
+    if (opt_max_handles < 0) {
+        fprintf(stderr, "Bad arguments, see --help\n");
+        return EXIT_FAILURE;
+    }
+
+    if (!opt_socket)
+        opt_socket = g_strdup(g_getenv("LIBREPO_DAEMON_SOCKET"));
+    if (!opt_socket)
+        opt_socket = g_strdup(LR_DAEMON_SOCKET);
+
+    lr_global_init();
+    cache = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+
+    signal(SIGPIPE, SIG_IGN);
+    signal(SIGTERM, sigterm_handler);
+    signal(SIGINT, sigterm_handler);
+
+    fd = open_socket(opt_socket);
+    if (fd < 0)
+        return EXIT_FAILURE;
+    g_message("Listening on %s", opt_socket);
+
+    while (!terminate) {
+        struct pollfd pfd = { fd, POLLIN, 0 };
+        int client;
+
+        if (poll(&pfd, 1, POLL_TIMEOUT_MS) <= 0)
+            continue;
+
+        client = accept4(fd, NULL, NULL, SOCK_CLOEXEC);
+        if (client < 0) {
+            if (errno != EINTR && errno != EAGAIN)
+                g_warning("accept() failed: %s", g_strerror(errno));
+            continue;
+        }
+
+        g_thread_unref(g_thread_new("librepod", serve_connection,
+                                    GINT_TO_POINTER(client)));
+    }
+
+    close(fd);
+    unlink(opt_socket);
+
+    // Handles which are idle are freed (e.g. their TLS sessions are
+    // stored), the running requests are killed by the exit
+    G_LOCK(cache);
+    g_hash_table_iter_init(&iter, cache);
+    while (g_hash_table_iter_next(&iter, NULL, &value)) {
+        DaemonEntry *entry = value;
+        if (g_mutex_trylock(&entry->lock)) {
+            g_mutex_unlock(&entry->lock);
+            g_hash_table_iter_remove(&iter);
+            entry_free(entry);
+        }
+    }
+    G_UNLOCK(cache);
+
+    g_free(opt_socket);
+    return EXIT_SUCCESS;
+}
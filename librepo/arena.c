@@ -0,0 +1,136 @@
+/* librepo - A library providing (libcURL like) API to downloading repository
+ * Copyright (C) 2014  Tomas Mlcoch
+ *
+ * Licensed under the GNU Lesser General Public License Version 2.1
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#include <glib.h>
+#include <assert.h>
+#include <string.h>
+
+#include "arena.h"
+#include "util.h"
+
+/** Alignment of the allocated memory */
+#define ARENA_ALIGN             (2 * sizeof(gpointer))
+#define ARENA_ROUND(size)       (((size) + ARENA_ALIGN - 1) & ~(ARENA_ALIGN - 1))
+
+/** Header of an allocated block of memory */
+typedef struct _LrArenaBlock {
+    struct _LrArenaBlock *prev; /*!<
+        Previously allocated block or NULL */
+} LrArenaBlock;
+
+#define BLOCK_HEADER_SIZE       ARENA_ROUND(sizeof(LrArenaBlock))
+
+struct _LrArena {
+    gsize block_size; /*!<
+        Size of the usable part of the blocks */
+    LrArenaBlock *block; /*!<
+        Current block or NULL */
+    gsize used; /*!<
+        Number of used bytes in the current block */
+    gsize size; /*!<
+        Size of the usable part of the current block */
+    GStringChunk *strings; /*!<
+        Chunk for strings (created by the first lr_arena_strdup()) */
+};
+
+LrArena *
+lr_arena_new(gsize block_size)
+{
+    LrArena *arena = lr_malloc0(sizeof(*arena));
+    arena->block_size = ARENA_ROUND(MAX(block_size, ARENA_ALIGN));
+    return arena;
+}
+
+gpointer
+lr_arena_alloc0(LrArena *arena, gsize size)
+{
+    LrArenaBlock *block;
+    char *mem;
+
+    assert(arena);
+
+    size = ARENA_ROUND(MAX(size, 1));
+
+    if (!arena->block || arena->size - arena->used < size) {
+        gsize block_size = MAX(arena->block_size, size);
+
+        if (arena->block && size > arena->block_size / 4) {
+            // Big object - keep using the current block for small ones
+            block = lr_malloc(BLOCK_HEADER_SIZE + size);
+            block->prev = arena->block->prev;
+            arena->block->prev = block;
+            mem = (char *) block + BLOCK_HEADER_SIZE;
+            memset(mem, 0, size);
+            return mem;
+        }
+
+        block = lr_malloc(BLOCK_HEADER_SIZE + block_size);
+        block->prev = arena->block;
+        arena->block = block;
+        arena->used = 0;
+        arena->size = block_size;
+    }
+
+    mem = (char *) arena->block + BLOCK_HEADER_SIZE + arena->used;
+    arena->used += size;
+    memset(mem, 0, size);
+    return mem;
+}
+
+char *
+lr_arena_strdup(LrArena *arena, const char *str)
+{
+    assert(arena);
+
+    if (!str)
+        return NULL;
+
+    if (!arena->strings)
+        arena->strings = g_string_chunk_new(arena->block_size);
+
+    return g_string_chunk_insert(arena->strings, str);
+}
+
+GSList *
+lr_arena_slist_prepend(LrArena *arena, GSList *list, gpointer data)
+{
+    GSList *node = lr_arena_new0(arena, GSList);
+    node->data = data;
+    node->next = list;
+    return node;
+}
+
+void
+lr_arena_free(LrArena *arena)
+{
+    if (!arena)
+        return;
+
+    while (arena->block) {
+        LrArenaBlock *prev = arena->block->prev;
+        lr_free(arena->block);
+        arena->block = prev;
+    }
+
+    if (arena->strings)
+        g_string_chunk_free(arena->strings);
+
+    lr_free(arena);
+}
@@ -0,0 +1,81 @@
+/* librepo - A library providing (libcURL like) API to downloading repository
+ * Copyright (C) 2014  Tomas Mlcoch
+ *
+ * Licensed under the GNU Lesser General Public License Version 2.1
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#ifndef __LR_ARENA_H__
+#define __LR_ARENA_H__
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/** Arena (block) allocator.
+ * Objects of one object graph (e.g. a parsed metalink) are allocated
+ * from big blocks of memory and strings are stored in a GStringChunk.
+ * Single objects are never freed, the whole arena is freed at once.
+ */
+typedef struct _LrArena LrArena;
+
+/** Create a new arena.
+ * @param block_size    Size of the allocated blocks of memory.
+ * @return              New arena
+ */
+LrArena *
+lr_arena_new(gsize block_size);
+
+/** Allocate zeroed memory from the arena.
+ * The memory is aligned for any type.
+ * @param arena         Arena
+ * @param size          Size of the memory
+ * @return              Pointer to the memory valid until the arena is freed
+ */
+gpointer
+lr_arena_alloc0(LrArena *arena, gsize size);
+
+/** Allocate zeroed object of the type from the arena. */
+#define lr_arena_new0(arena, type) \
+    ((type *) lr_arena_alloc0((arena), sizeof(type)))
+
+/** Copy the string to the arena.
+ * @param arena         Arena
+ * @param str           String or NULL
+ * @return              Copy of the string or NULL if str is NULL
+ */
+char *
+lr_arena_strdup(LrArena *arena, const char *str);
+
+/** Prepend the data to the list. The list node is allocated from the arena.
+ * The list must not be freed by g_slist_free() and similar functions.
+ * @param arena         Arena
+ * @param list          List
+ * @param data          Data of the new node
+ * @return              New start of the list
+ */
+GSList *
+lr_arena_slist_prepend(LrArena *arena, GSList *list, gpointer data);
+
+/** Free the arena and all the memory allocated from it.
+ * @param arena         Arena or NULL
+ */
+void
+lr_arena_free(LrArena *arena);
+
+G_END_DECLS
+
+#endif
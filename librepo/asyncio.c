@@ -0,0 +1,310 @@
+/* librepo - A library providing (libcURL like) API to downloading repository
+ * Copyright (C) 2014  Tomas Mlcoch
+ *
+ * Licensed under the GNU Lesser General Public License Version 2.1
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#define _GNU_SOURCE         // Because of SYNC_FILE_RANGE_WRITE
+
+#include <glib.h>
+#include <assert.h>
+#include <errno.h>
+#include <string.h>
+#include <fcntl.h>
+#ifdef WITH_IO_URING
+#include <liburing.h>
+#endif
+
+#include "asyncio.h"
+#include "rcodes.h"
+#include "util.h"
+
+#ifdef WITH_IO_URING
+
+struct _LrAsyncIo {
+    struct io_uring ring; /*!<
+        The io_uring instance */
+    unsigned int entries; /*!<
+        Size of the submission queue */
+    unsigned int in_flight; /*!<
+        Number of submitted operations which are not completed */
+};
+
+LrAsyncIo *
+lr_asyncio_new(unsigned int entries, GError **err)
+{
+    LrAsyncIo *aio;
+    int rc;
+
+    assert(!err || *err == NULL);
+
+    if (g_getenv("LIBREPO_DISABLE_IO_URING")) {
+        g_set_error(err, LR_DOWNLOADER_ERROR, LRE_IO,
+                    "io_uring disabled by LIBREPO_DISABLE_IO_URING");
+        return NULL;
+    }
+
+    aio = lr_malloc0(sizeof(*aio));
+    rc = io_uring_queue_init(MAX(entries, 2), &aio->ring, 0);
+    if (rc < 0) {
+        // E.g. ENOSYS on old kernels or EPERM if disabled by seccomp
+        g_set_error(err, LR_DOWNLOADER_ERROR, LRE_IO,
+                    "io_uring_queue_init() failed: %s", g_strerror(-rc));
+        lr_free(aio);
+        return NULL;
+    }
+
+    aio->entries = MAX(entries, 2);
+    return aio;
+}
+
+/** Queue a write of the rest of the data of the request.
+ * Only the write itself is queued if writeback is FALSE, otherwise
+ * a sync_file_range() linked to the write too.
+ */
+static gboolean
+queue_write(LrAsyncIo *aio, LrAsyncIoReq *req, gboolean writeback)
+{
+    struct io_uring_sqe *sqe;
+    int rc;
+
+    sqe = io_uring_get_sqe(&aio->ring);
+    if (!sqe)
+        return FALSE;
+    io_uring_prep_write(sqe, req->fd, req->buf, req->len, req->offset);
+    io_uring_sqe_set_data(sqe, req);
+    aio->in_flight++;
+
+    if (writeback) {
+        struct io_uring_sqe *sync_sqe = io_uring_get_sqe(&aio->ring);
+        if (sync_sqe) {
+            // Cancelled by the kernel if the write is short or fails
+            io_uring_sqe_set_flags(sqe, IOSQE_IO_LINK);
+            io_uring_prep_sync_file_range(sync_sqe, req->fd, req->len,
+                                          req->offset,
+                                          SYNC_FILE_RANGE_WRITE);
+            io_uring_sqe_set_data(sync_sqe, NULL);
+            aio->in_flight++;
+        }
+    }
+
+    rc = io_uring_submit(&aio->ring);
+    if (rc < 0) {
+        g_debug("%s: io_uring_submit() failed: %s", __func__, g_strerror(-rc));
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+/** Process a completion of an operation.
+ */
+static void
+handle_completion(LrAsyncIo *aio, struct io_uring_cqe *cqe)
+{
+    LrAsyncIoReq *req = io_uring_cqe_get_data(cqe);
+    int res = cqe->res;
+
+    io_uring_cqe_seen(&aio->ring, cqe);
+    aio->in_flight--;
+
+    if (!req)   // Result of a writeback is not interesting
+        return;
+
+    if (res == -EINTR || res == -EAGAIN) {
+        res = 0;
+    } else if (res < 0) {
+        req->error = -res;
+        req->pending = FALSE;
+        return;
+    } else if (res == 0) {
+        // Nothing written, do not loop forever
+        req->error = EIO;
+        req->pending = FALSE;
+        return;
+    }
+
+    req->buf += res;
+    req->len -= res;
+    req->offset += res;
+
+    if (req->len == 0) {
+        req->pending = FALSE;
+        return;
+    }
+
+    // Short write - submit the rest
+    if (!queue_write(aio, req, FALSE)) {
+        req->error = EIO;
+        req->pending = FALSE;
+    }
+}
+
+/** Wait for a completion of an operation and process it.
+ */
+static gboolean
+wait_completion(LrAsyncIo *aio, GError **err)
+{
+    struct io_uring_cqe *cqe;
+    int rc;
+
+    do {
+        rc = io_uring_wait_cqe(&aio->ring, &cqe);
+    } while (rc == -EINTR);
+
+    if (rc < 0) {
+        g_set_error(err, LR_DOWNLOADER_ERROR, LRE_IO,
+                    "io_uring_wait_cqe() failed: %s", g_strerror(-rc));
+        return FALSE;
+    }
+
+    handle_completion(aio, cqe);
+    return TRUE;
+}
+
+gboolean
+lr_asyncio_write(LrAsyncIo *aio,
+                 LrAsyncIoReq *req,
+                 int fd,
+                 const char *buf,
+                 size_t len,
+                 gint64 offset,
+                 gboolean writeback,
+                 GError **err)
+{
+    assert(aio);
+    assert(req && !req->pending);
+    assert(!err || *err == NULL);
+
+    req->fd = fd;
+    req->buf = buf;
+    req->len = len;
+    req->offset = offset;
+    req->error = 0;
+
+    if (len == 0)
+        return TRUE;
+
+    // Keep space for the operations in the rings
+    while (aio->in_flight + 2 > aio->entries)
+        if (!wait_completion(aio, err))
+            return FALSE;
+
+    req->pending = TRUE;
+    if (!queue_write(aio, req, writeback)) {
+        req->pending = FALSE;
+        g_set_error(err, LR_DOWNLOADER_ERROR, LRE_IO,
+                    "Cannot submit a write to io_uring");
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+void
+lr_asyncio_reap(LrAsyncIo *aio)
+{
+    struct io_uring_cqe *cqe;
+
+    if (!aio)
+        return;
+
+    while (aio->in_flight && io_uring_peek_cqe(&aio->ring, &cqe) == 0)
+        handle_completion(aio, cqe);
+}
+
+gboolean
+lr_asyncio_wait(LrAsyncIo *aio, LrAsyncIoReq *req, GError **err)
+{
+    assert(aio);
+    assert(req);
+    assert(!err || *err == NULL);
+
+    while (req->pending)
+        if (!wait_completion(aio, err))
+            return FALSE;
+
+    if (req->error) {
+        g_set_error(err, LR_DOWNLOADER_ERROR, LRE_IO,
+                    "write(%d) failed: %s", req->fd, g_strerror(req->error));
+        req->error = 0;
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+void
+lr_asyncio_free(LrAsyncIo *aio)
+{
+    if (!aio)
+        return;
+
+    // The kernel could still access the memory of the requests
+    while (aio->in_flight)
+        if (!wait_completion(aio, NULL))
+            break;
+
+    io_uring_queue_exit(&aio->ring);
+    lr_free(aio);
+}
+
+#else // WITH_IO_URING
+
+LrAsyncIo *
+lr_asyncio_new(G_GNUC_UNUSED unsigned int entries, GError **err)
+{
+    g_set_error(err, LR_DOWNLOADER_ERROR, LRE_IO,
+                "librepo was built without io_uring support");
+    return NULL;
+}
+
+gboolean
+lr_asyncio_write(G_GNUC_UNUSED LrAsyncIo *aio,
+                 G_GNUC_UNUSED LrAsyncIoReq *req,
+                 G_GNUC_UNUSED int fd,
+                 G_GNUC_UNUSED const char *buf,
+                 G_GNUC_UNUSED size_t len,
+                 G_GNUC_UNUSED gint64 offset,
+                 G_GNUC_UNUSED gboolean writeback,
+                 GError **err)
+{
+    g_set_error(err, LR_DOWNLOADER_ERROR, LRE_IO,
+                "librepo was built without io_uring support");
+    return FALSE;
+}
+
+void
+lr_asyncio_reap(G_GNUC_UNUSED LrAsyncIo *aio)
+{
+}
+
+gboolean
+lr_asyncio_wait(G_GNUC_UNUSED LrAsyncIo *aio,
+                LrAsyncIoReq *req,
+                G_GNUC_UNUSED GError **err)
+{
+    assert(!req->pending);
+    return TRUE;
+}
+
+void
+lr_asyncio_free(G_GNUC_UNUSED LrAsyncIo *aio)
+{
+}
+
+#endif // WITH_IO_URING
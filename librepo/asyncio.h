@@ -0,0 +1,113 @@
+/* librepo - A library providing (libcURL like) API to downloading repository
+ * Copyright (C) 2014  Tomas Mlcoch
+ *
+ * Licensed under the GNU Lesser General Public License Version 2.1
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#ifndef __LR_ASYNCIO_H__
+#define __LR_ASYNCIO_H__
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/** Asynchronous file I/O.
+ * Positioned writes are submitted to an io_uring instance and the
+ * caller continues without waiting for the disk. Completions are
+ * collected by lr_asyncio_reap() (called from the download loop) or
+ * by lr_asyncio_wait() when the written data are needed.
+ * Available only if librepo was built with liburing (WITH_IO_URING),
+ * lr_asyncio_new() fails otherwise.
+ */
+typedef struct _LrAsyncIo LrAsyncIo;
+
+/** A write submitted by lr_asyncio_write().
+ * The memory of the request and of the written data must stay valid
+ * until the request is finished (pending is FALSE).
+ */
+typedef struct {
+    gboolean pending; /*!<
+        TRUE while the write is not finished */
+    int fd; /*!<
+        File descriptor */
+    const char *buf; /*!<
+        Data not written yet */
+    size_t len; /*!<
+        Number of bytes not written yet */
+    gint64 offset; /*!<
+        Offset in the file where the buf belongs */
+    int error; /*!<
+        errno of a failed write, 0 otherwise */
+} LrAsyncIoReq;
+
+/** Create a new instance for asynchronous I/O.
+ * @param entries       Maximal number of submitted operations
+ * @param err           GError **
+ * @return              New instance or NULL if io_uring is not
+ *                      available (not built in, not supported by the
+ *                      kernel or disabled)
+ */
+LrAsyncIo *
+lr_asyncio_new(unsigned int entries, GError **err);
+
+/** Submit a positioned write. Short writes are resubmitted
+ * automatically.
+ * @param aio           Instance
+ * @param req           Request (must not be pending)
+ * @param fd            File descriptor
+ * @param buf           Data
+ * @param len           Length of the data
+ * @param offset        Offset in the file
+ * @param writeback     Start writeback of the written range
+ *                      (sync_file_range(SYNC_FILE_RANGE_WRITE))
+ * @param err           GError **
+ * @return              TRUE if the write was submitted
+ */
+gboolean
+lr_asyncio_write(LrAsyncIo *aio,
+                 LrAsyncIoReq *req,
+                 int fd,
+                 const char *buf,
+                 size_t len,
+                 gint64 offset,
+                 gboolean writeback,
+                 GError **err);
+
+/** Process completed operations without blocking.
+ * @param aio           Instance or NULL
+ */
+void
+lr_asyncio_reap(LrAsyncIo *aio);
+
+/** Wait until the request is finished.
+ * @param aio           Instance
+ * @param req           Request (need not be pending)
+ * @param err           GError **
+ * @return              FALSE if the write failed
+ */
+gboolean
+lr_asyncio_wait(LrAsyncIo *aio, LrAsyncIoReq *req, GError **err);
+
+/** Wait for all submitted operations and free the instance.
+ * @param aio           Instance or NULL
+ */
+void
+lr_asyncio_free(LrAsyncIo *aio);
+
+G_END_DECLS
+
+#endif
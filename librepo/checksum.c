@@ -18,24 +18,58 @@
  * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
  */
 
+#define _XOPEN_SOURCE   700 // Because of pread(), posix_fadvise() and st_mtim
+#define OPENSSL_SUPPRESS_DEPRECATED // Low-level digests of resumable contexts
+
 #include <glib.h>
 #include <glib/gprintf.h>
 #include <assert.h>
+#include <errno.h>
 #include <string.h>
 #include <ctype.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
 #include <unistd.h>
 #include <attr/xattr.h>
 #include <openssl/evp.h>
+#include <openssl/md5.h>
+#include <openssl/sha.h>
+#include <openssl/opensslv.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>
+#elif defined(__aarch64__) && defined(__linux__)
+#include <sys/auxv.h>
+#include <asm/hwcap.h>
+#endif
 
 #include "cleanup.h"
 #include "checksum.h"
+#include "checksum_internal.h"
+#include "checksum_index.h"
 #include "rcodes.h"
 #include "util.h"
 
-#define BUFFER_SIZE             2048
+#define BUFFER_SIZE             131072
+#define MMAP_THRESHOLD          (1024 * 1024)       /*!< Smaller files are
+                                                         read() */
+#define MMAP_WINDOW             (64 * 1024 * 1024)  /*!< Size of a part of
+                                                         the file mapped at
+                                                         once */
 #define MAX_CHECKSUM_NAME_LEN   7
+#define MD_CTX_CACHE_SIZE       8   /*!< Max number of unused digest
+                                         contexts kept per thread */
+#define DIGEST_STATE_MAGIC      0x4c524453  /*!< "LRDS" */
+
+#ifndef OPENSSL_NO_DEPRECATED_3_0
+#define WITH_DIGEST_STATE       /*!< Low-level digests (with accessible
+                                     state) are available */
+#endif
+
+#if OPENSSL_VERSION_NUMBER < 0x10100000L
+#define EVP_MD_CTX_reset        EVP_MD_CTX_cleanup
+#endif
 
 LrChecksumType
 lr_checksum_type(const char *type)
@@ -100,86 +134,979 @@ lr_checksum_type_to_str(LrChecksumType type)
     return NULL;
 }
 
-char *
-lr_checksum_fd(LrChecksumType type, int fd, GError **err)
+/** Digest engines.
+ * The digest implementations are looked up only once. With OpenSSL 3
+ * they are fetched explicitly from the default provider, which selects
+ * the code using the CPU crypto extensions (SHA-NI, ARMv8 SHA2) by
+ * itself. The implicit fetch done by EVP_DigestInit_ex() for the
+ * legacy EVP_sha256() like objects is thereby avoided on every init.
+ */
+static const EVP_MD *digests[LR_CHECKSUM_SHA512 + 1];
+
+static gpointer
+init_digests(G_GNUC_UNUSED gpointer data)
+{
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+    static const char *names[] = {
+        [LR_CHECKSUM_MD5]       = "MD5",
+        [LR_CHECKSUM_SHA1]      = "SHA1",
+        [LR_CHECKSUM_SHA224]    = "SHA224",
+        [LR_CHECKSUM_SHA256]    = "SHA256",
+        [LR_CHECKSUM_SHA384]    = "SHA384",
+        [LR_CHECKSUM_SHA512]    = "SHA512",
+    };
+
+    for (int x = LR_CHECKSUM_MD5; x <= LR_CHECKSUM_SHA512; x++) {
+        digests[x] = EVP_MD_fetch(NULL, names[x], NULL);
+        if (!digests[x])
+            g_debug("%s: Cannot fetch %s digest", __func__, names[x]);
+    }
+#endif
+
+    // Fallback to the built-in digests
+    if (!digests[LR_CHECKSUM_MD5])      digests[LR_CHECKSUM_MD5]    = EVP_md5();
+    if (!digests[LR_CHECKSUM_SHA1])     digests[LR_CHECKSUM_SHA1]   = EVP_sha1();
+    if (!digests[LR_CHECKSUM_SHA224])   digests[LR_CHECKSUM_SHA224] = EVP_sha224();
+    if (!digests[LR_CHECKSUM_SHA256])   digests[LR_CHECKSUM_SHA256] = EVP_sha256();
+    if (!digests[LR_CHECKSUM_SHA384])   digests[LR_CHECKSUM_SHA384] = EVP_sha384();
+    if (!digests[LR_CHECKSUM_SHA512])   digests[LR_CHECKSUM_SHA512] = EVP_sha512();
+
+    g_debug("%s: CPU SHA extensions: %s", __func__,
+            lr_checksum_cpu_acceleration() ? lr_checksum_cpu_acceleration()
+                                           : "none");
+    return NULL;
+}
+
+static const EVP_MD *
+get_digest(LrChecksumType type)
+{
+    static GOnce digests_once = G_ONCE_INIT;
+
+    if ((int) type <= LR_CHECKSUM_UNKNOWN || type > LR_CHECKSUM_SHA512)
+        return NULL;
+
+    g_once(&digests_once, init_digests, NULL);
+    return digests[type];
+}
+
+const char *
+lr_checksum_cpu_acceleration(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    unsigned int eax, ebx, ecx, edx;
+
+    // CPUID.(EAX=07H, ECX=0):EBX.SHA[bit 29]
+    if (__get_cpuid_max(0, NULL) >= 7) {
+        __cpuid_count(7, 0, eax, ebx, ecx, edx);
+        if (ebx & (1u << 29))
+            return "sha-ni";
+    }
+#elif defined(__aarch64__) && defined(__linux__) && defined(HWCAP_SHA2)
+    unsigned long hwcap = getauxval(AT_HWCAP);
+
+#ifdef HWCAP_SHA512
+    if ((hwcap & HWCAP_SHA2) && (hwcap & HWCAP_SHA512))
+        return "armv8-sha2-sha512";
+#endif
+    if (hwcap & HWCAP_SHA2)
+        return "armv8-sha2";
+#endif
+    return NULL;
+}
+
+/** Unused digest contexts of the thread.
+ * Contexts of freed LrChecksumCtx are kept to be reused by the next
+ * lr_checksumctx_new() call of the same thread instead of allocating
+ * a new one for every checksum.
+ */
+typedef struct {
+    EVP_MD_CTX *ctxs[MD_CTX_CACHE_SIZE];
+    int len;
+} LrMdCtxCache;
+
+static void
+md_ctx_cache_free(gpointer data)
+{
+    LrMdCtxCache *cache = data;
+
+    for (int x = 0; x < cache->len; x++)
+        EVP_MD_CTX_destroy(cache->ctxs[x]);
+    lr_free(cache);
+}
+
+static GPrivate md_ctx_cache = G_PRIVATE_INIT(md_ctx_cache_free);
+
+static EVP_MD_CTX *
+md_ctx_get(void)
+{
+    LrMdCtxCache *cache = g_private_get(&md_ctx_cache);
+
+    if (cache && cache->len > 0)
+        return cache->ctxs[--cache->len];
+    return EVP_MD_CTX_create();
+}
+
+static void
+md_ctx_put(EVP_MD_CTX *mdctx)
+{
+    LrMdCtxCache *cache = g_private_get(&md_ctx_cache);
+
+    if (!cache) {
+        cache = lr_malloc0(sizeof(*cache));
+        g_private_set(&md_ctx_cache, cache);
+    }
+
+    if (cache->len < MD_CTX_CACHE_SIZE && EVP_MD_CTX_reset(mdctx))
+        cache->ctxs[cache->len++] = mdctx;
+    else
+        EVP_MD_CTX_destroy(mdctx);
+}
+
+struct _LrChecksumCtx {
+    LrChecksumType type; /*!<
+        Checksum type */
+    EVP_MD_CTX *ctx; /*!<
+        OpenSSL digest context or NULL if the raw state is used */
+    gboolean finished; /*!<
+        TRUE if the lr_checksumctx_final() was already called */
+#ifdef WITH_DIGEST_STATE
+    gboolean resumable; /*!<
+        TRUE if the low-level digest in raw is used instead of ctx */
+    union {
+        MD5_CTX md5;
+        SHA_CTX sha1;
+        SHA256_CTX sha256;      // Used by SHA224 too
+        SHA512_CTX sha512;      // Used by SHA384 too
+    } raw; /*!<
+        State of the low-level digest. Unlike the EVP context it can be
+        copied, so it can be saved and loaded again. */
+#endif
+};
+
+/** Header of a digest state serialized by lr_checksumctx_save() */
+typedef struct {
+    guint32 magic; /*!<
+        DIGEST_STATE_MAGIC */
+    guint32 version; /*!<
+        OPENSSL_VERSION_NUMBER (layout of the state could differ) */
+    guint32 type; /*!<
+        LrChecksumType */
+    guint32 size; /*!<
+        Size of the state which follows the header */
+} LrDigestStateHeader;
+
+#ifdef WITH_DIGEST_STATE
+
+static size_t
+raw_state_size(LrChecksumType type)
+{
+    switch (type) {
+    case LR_CHECKSUM_MD5:       return sizeof(MD5_CTX);
+    case LR_CHECKSUM_SHA1:      return sizeof(SHA_CTX);
+    case LR_CHECKSUM_SHA224:
+    case LR_CHECKSUM_SHA256:    return sizeof(SHA256_CTX);
+    case LR_CHECKSUM_SHA384:
+    case LR_CHECKSUM_SHA512:    return sizeof(SHA512_CTX);
+    case LR_CHECKSUM_UNKNOWN:
+        break;
+    }
+    return 0;
+}
+
+static int
+raw_init(LrChecksumCtx *ctx)
+{
+    switch (ctx->type) {
+    case LR_CHECKSUM_MD5:       return MD5_Init(&ctx->raw.md5);
+    case LR_CHECKSUM_SHA1:      return SHA1_Init(&ctx->raw.sha1);
+    case LR_CHECKSUM_SHA224:    return SHA224_Init(&ctx->raw.sha256);
+    case LR_CHECKSUM_SHA256:    return SHA256_Init(&ctx->raw.sha256);
+    case LR_CHECKSUM_SHA384:    return SHA384_Init(&ctx->raw.sha512);
+    case LR_CHECKSUM_SHA512:    return SHA512_Init(&ctx->raw.sha512);
+    case LR_CHECKSUM_UNKNOWN:
+        break;
+    }
+    return 0;
+}
+
+static int
+raw_update(LrChecksumCtx *ctx, const void *buf, size_t len)
+{
+    switch (ctx->type) {
+    case LR_CHECKSUM_MD5:       return MD5_Update(&ctx->raw.md5, buf, len);
+    case LR_CHECKSUM_SHA1:      return SHA1_Update(&ctx->raw.sha1, buf, len);
+    case LR_CHECKSUM_SHA224:    return SHA224_Update(&ctx->raw.sha256, buf, len);
+    case LR_CHECKSUM_SHA256:    return SHA256_Update(&ctx->raw.sha256, buf, len);
+    case LR_CHECKSUM_SHA384:    return SHA384_Update(&ctx->raw.sha512, buf, len);
+    case LR_CHECKSUM_SHA512:    return SHA512_Update(&ctx->raw.sha512, buf, len);
+    case LR_CHECKSUM_UNKNOWN:
+        break;
+    }
+    return 0;
+}
+
+static int
+raw_final(LrChecksumCtx *ctx, unsigned char *md, unsigned int *len)
+{
+    switch (ctx->type) {
+    case LR_CHECKSUM_MD5:
+        *len = MD5_DIGEST_LENGTH;
+        return MD5_Final(md, &ctx->raw.md5);
+    case LR_CHECKSUM_SHA1:
+        *len = SHA_DIGEST_LENGTH;
+        return SHA1_Final(md, &ctx->raw.sha1);
+    case LR_CHECKSUM_SHA224:
+        *len = SHA224_DIGEST_LENGTH;
+        return SHA224_Final(md, &ctx->raw.sha256);
+    case LR_CHECKSUM_SHA256:
+        *len = SHA256_DIGEST_LENGTH;
+        return SHA256_Final(md, &ctx->raw.sha256);
+    case LR_CHECKSUM_SHA384:
+        *len = SHA384_DIGEST_LENGTH;
+        return SHA384_Final(md, &ctx->raw.sha512);
+    case LR_CHECKSUM_SHA512:
+        *len = SHA512_DIGEST_LENGTH;
+        return SHA512_Final(md, &ctx->raw.sha512);
+    case LR_CHECKSUM_UNKNOWN:
+        break;
+    }
+    return 0;
+}
+
+#endif // WITH_DIGEST_STATE
+
+LrChecksumCtx *
+lr_checksumctx_new(LrChecksumType type, GError **err)
 {
-    unsigned int len;
-    ssize_t readed;
-    char buf[BUFFER_SIZE];
-    unsigned char raw_checksum[EVP_MAX_MD_SIZE];
-    char *checksum;
-    EVP_MD_CTX *ctx;
     const EVP_MD *ctx_type;
+    LrChecksumCtx *ctx;
 
-    assert(fd > -1);
     assert(!err || *err == NULL);
 
-    switch (type) {
-        case LR_CHECKSUM_MD5:       ctx_type = EVP_md5();    break;
-        case LR_CHECKSUM_SHA1:      ctx_type = EVP_sha1();   break;
-        case LR_CHECKSUM_SHA224:    ctx_type = EVP_sha224(); break;
-        case LR_CHECKSUM_SHA256:    ctx_type = EVP_sha256(); break;
-        case LR_CHECKSUM_SHA384:    ctx_type = EVP_sha384(); break;
-        case LR_CHECKSUM_SHA512:    ctx_type = EVP_sha512(); break;
-        case LR_CHECKSUM_UNKNOWN:
-        default:
-            g_debug("%s: Unknown checksum type", __func__);
-            assert(0);
-            g_set_error(err, LR_CHECKSUM_ERROR, LRE_BADFUNCARG,
-                        "Unknown checksum type: %d", type);
-            return NULL;
+    ctx_type = get_digest(type);
+    if (!ctx_type) {
+        g_debug("%s: Unknown checksum type", __func__);
+        g_set_error(err, LR_CHECKSUM_ERROR, LRE_BADFUNCARG,
+                    "Unknown checksum type: %d", type);
+        return NULL;
     }
 
-    ctx = EVP_MD_CTX_create();
-    if (!ctx) {
+    ctx = lr_malloc0(sizeof(*ctx));
+    ctx->type = type;
+    ctx->ctx = md_ctx_get();
+    if (!ctx->ctx) {
         g_set_error(err, LR_CHECKSUM_ERROR, LRE_OPENSSL,
                     "EVP_MD_CTX_create() failed");
+        lr_free(ctx);
         return NULL;
     }
 
-    if (!EVP_DigestInit_ex(ctx, ctx_type, NULL)) {
+    if (!EVP_DigestInit_ex(ctx->ctx, ctx_type, NULL)) {
         g_set_error(err, LR_CHECKSUM_ERROR, LRE_OPENSSL,
                     "EVP_DigestInit_ex() failed");
-        EVP_MD_CTX_destroy(ctx);
+        lr_checksumctx_free(ctx);
         return NULL;
     }
 
-    if (lseek(fd, 0, SEEK_SET) == -1) {
-        g_set_error(err, LR_CHECKSUM_ERROR, LRE_IO,
-                    "Cannot seek to the begin of the file. "
-                    "lseek(%d, 0, SEEK_SET) error: %s", fd, strerror(errno));
+    return ctx;
+}
+
+LrChecksumCtx *
+lr_checksumctx_new_resumable(LrChecksumType type, GError **err)
+{
+#ifdef WITH_DIGEST_STATE
+    LrChecksumCtx *ctx;
+
+    assert(!err || *err == NULL);
+
+    if (raw_state_size(type) == 0) {
+        g_debug("%s: Unknown checksum type", __func__);
+        g_set_error(err, LR_CHECKSUM_ERROR, LRE_BADFUNCARG,
+                    "Unknown checksum type: %d", type);
+        return NULL;
+    }
+
+    ctx = lr_malloc0(sizeof(*ctx));
+    ctx->type = type;
+    ctx->resumable = TRUE;
+    if (!raw_init(ctx)) {
+        g_set_error(err, LR_CHECKSUM_ERROR, LRE_OPENSSL,
+                    "Cannot initialize %s digest", lr_checksum_type_to_str(type));
+        lr_free(ctx);
         return NULL;
     }
 
-    while ((readed = read(fd, buf, BUFFER_SIZE)) > 0)
-        if (!EVP_DigestUpdate(ctx, buf, readed)) {
+    return ctx;
+#else
+    // The state of EVP contexts cannot be saved
+    return lr_checksumctx_new(type, err);
+#endif
+}
+
+gchar *
+lr_checksumctx_save(LrChecksumCtx *ctx)
+{
+#ifdef WITH_DIGEST_STATE
+    LrDigestStateHeader header;
+    size_t size;
+    guchar *data;
+    gchar *state;
+
+    assert(ctx);
+
+    if (!ctx->resumable || ctx->finished)
+        return NULL;
+
+    size = raw_state_size(ctx->type);
+    header.magic = DIGEST_STATE_MAGIC;
+    header.version = (guint32) OPENSSL_VERSION_NUMBER;
+    header.type = (guint32) ctx->type;
+    header.size = (guint32) size;
+
+    data = lr_malloc(sizeof(header) + size);
+    memcpy(data, &header, sizeof(header));
+    memcpy(data + sizeof(header), &ctx->raw, size);
+    state = g_base64_encode(data, sizeof(header) + size);
+    lr_free(data);
+
+    return state;
+#else
+    assert(ctx);
+    return NULL;
+#endif
+}
+
+LrChecksumCtx *
+lr_checksumctx_load(LrChecksumType type, const char *state, GError **err)
+{
+#ifdef WITH_DIGEST_STATE
+    LrDigestStateHeader header;
+    LrChecksumCtx *ctx;
+    guchar *data;
+    gsize len;
+    size_t size = raw_state_size(type);
+
+    assert(state);
+    assert(!err || *err == NULL);
+
+    data = g_base64_decode(state, &len);
+    if (data && len >= sizeof(header))
+        memcpy(&header, data, sizeof(header));
+
+    if (!data || size == 0
+        || len != sizeof(header) + size
+        || header.magic != DIGEST_STATE_MAGIC
+        || header.version != (guint32) OPENSSL_VERSION_NUMBER
+        || header.type != (guint32) type
+        || header.size != (guint32) size)
+    {
+        g_set_error(err, LR_CHECKSUM_ERROR, LRE_BADFUNCARG,
+                    "Invalid or incompatible %s digest state",
+                    lr_checksum_type_to_str(type));
+        g_free(data);
+        return NULL;
+    }
+
+    ctx = lr_malloc0(sizeof(*ctx));
+    ctx->type = type;
+    ctx->resumable = TRUE;
+    memcpy(&ctx->raw, data + sizeof(header), size);
+    g_free(data);
+
+    return ctx;
+#else
+    assert(state);
+    g_set_error(err, LR_CHECKSUM_ERROR, LRE_BADFUNCARG,
+                "Digest states are not supported by this OpenSSL build");
+    return NULL;
+#endif
+}
+
+LrChecksumType
+lr_checksumctx_type(LrChecksumCtx *ctx)
+{
+    assert(ctx);
+    return ctx->type;
+}
+
+gboolean
+lr_checksumctx_update(LrChecksumCtx *ctx,
+                      const void *buf,
+                      size_t len,
+                      GError **err)
+{
+    assert(ctx);
+    assert(!ctx->finished);
+    assert(!err || *err == NULL);
+
+#ifdef WITH_DIGEST_STATE
+    if (ctx->resumable) {
+        if (!raw_update(ctx, buf, len)) {
             g_set_error(err, LR_CHECKSUM_ERROR, LRE_OPENSSL,
-                        "EVP_DigestUpdate() failed");
-            return NULL;
+                        "Update of %s digest failed",
+                        lr_checksum_type_to_str(ctx->type));
+            return FALSE;
         }
+        return TRUE;
+    }
+#endif
 
-    if (readed == -1) {
-        EVP_MD_CTX_destroy(ctx);
-        g_set_error(err, LR_CHECKSUM_ERROR, LRE_IO,
-                    "read(%d) failed: %s", fd, strerror(errno));
-        return NULL;
+    if (!EVP_DigestUpdate(ctx->ctx, buf, len)) {
+        g_set_error(err, LR_CHECKSUM_ERROR, LRE_OPENSSL,
+                    "EVP_DigestUpdate() failed");
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+/** Update the checksum contexts with the first len bytes of the file
+ * or with the whole file if len is -1.
+ * Big regular files are mapped to the memory, others are read through
+ * a large buffer. File offset of the file descriptor is not changed.
+ */
+static gboolean
+checksumctxs_update_fd(LrChecksumCtx **ctxs,
+                       size_t ctxs_len,
+                       int fd,
+                       gint64 len,
+                       GError **err)
+{
+    struct stat st;
+    gint64 offset = 0;
+    gint64 size = -1;
+    char *buf;
+
+    assert(!err || *err == NULL);
+
+    if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode))
+        size = (len == -1) ? (gint64) st.st_size : MIN(len, (gint64) st.st_size);
+
+    // Map the file by parts
+    while (size >= MMAP_THRESHOLD && offset < size) {
+        size_t window = (size_t) MIN((gint64) MMAP_WINDOW, size - offset);
+        void *map = mmap(NULL, window, PROT_READ, MAP_SHARED, fd, (off_t) offset);
+        if (map == MAP_FAILED) {
+            // Fallback - read the rest of the file
+            g_debug("%s: mmap(%d) failed: %s", __func__, fd, strerror(errno));
+            break;
+        }
+
+        posix_madvise(map, window, POSIX_MADV_SEQUENTIAL);
+
+        for (size_t y = 0; y < ctxs_len; y++)
+            if (!lr_checksumctx_update(ctxs[y], map, window, err)) {
+                munmap(map, window);
+                return FALSE;
+            }
+
+        munmap(map, window);
+        offset += window;
     }
 
-    if (!EVP_DigestFinal_ex(ctx, raw_checksum, &len)) {
+    if (size >= MMAP_THRESHOLD && offset == size && (len == -1 || offset == len))
+        return TRUE;  // Whole requested part was mapped
+
+    posix_fadvise(fd, (off_t) offset, 0, POSIX_FADV_SEQUENTIAL);
+
+    buf = lr_malloc(BUFFER_SIZE);
+
+    while (len == -1 || offset < len) {
+        size_t to_read = BUFFER_SIZE;
+        if (len != -1)
+            to_read = (size_t) MIN((gint64) BUFFER_SIZE, len - offset);
+
+        ssize_t readed = pread(fd, buf, to_read, (off_t) offset);
+        if (readed == -1) {
+            if (errno == EINTR)
+                continue;
+            g_set_error(err, LR_CHECKSUM_ERROR, LRE_IO,
+                        "pread(%d) failed: %s", fd, strerror(errno));
+            lr_free(buf);
+            return FALSE;
+        }
+
+        if (readed == 0) {
+            if (len == -1)
+                break;  // End of the file
+            g_set_error(err, LR_CHECKSUM_ERROR, LRE_IO,
+                        "File is shorter (%"G_GINT64_FORMAT" bytes) than "
+                        "expected (%"G_GINT64_FORMAT" bytes)", offset, len);
+            lr_free(buf);
+            return FALSE;
+        }
+
+        for (size_t y = 0; y < ctxs_len; y++)
+            if (!lr_checksumctx_update(ctxs[y], buf, readed, err)) {
+                lr_free(buf);
+                return FALSE;
+            }
+
+        offset += readed;
+    }
+
+    lr_free(buf);
+    return TRUE;
+}
+
+gboolean
+lr_checksumctx_update_fd(LrChecksumCtx *ctx,
+                         int fd,
+                         gint64 len,
+                         GError **err)
+{
+    assert(ctx);
+    assert(fd > -1);
+    assert(!err || *err == NULL);
+
+    if (len <= 0)
+        return TRUE;
+
+    return checksumctxs_update_fd(&ctx, 1, fd, len, err);
+}
+
+static const char hex_digits[] = "0123456789abcdef";
+
+char *
+lr_checksumctx_final(LrChecksumCtx *ctx, GError **err)
+{
+    int ok;
+    unsigned int len;
+    unsigned char raw_checksum[EVP_MAX_MD_SIZE];
+    char *checksum;
+
+    assert(ctx);
+    assert(!ctx->finished);
+    assert(!err || *err == NULL);
+
+    ctx->finished = TRUE;
+
+#ifdef WITH_DIGEST_STATE
+    if (ctx->resumable)
+        ok = raw_final(ctx, raw_checksum, &len);
+    else
+#endif
+        ok = EVP_DigestFinal_ex(ctx->ctx, raw_checksum, &len);
+
+    if (!ok) {
         g_set_error(err, LR_CHECKSUM_ERROR, LRE_OPENSSL,
-                    "EVP_DigestFinal_ex() failed");
+                    "Finalization of %s digest failed",
+                    lr_checksum_type_to_str(ctx->type));
         return NULL;
     }
 
-    EVP_MD_CTX_destroy(ctx);
+    checksum = lr_malloc(sizeof(char) * (len * 2 + 1));
+    for (size_t x = 0; x < len; x++) {
+        checksum[x*2]   = hex_digits[raw_checksum[x] >> 4];
+        checksum[x*2+1] = hex_digits[raw_checksum[x] & 0x0f];
+    }
+    checksum[len*2] = '\0';
+
+    return checksum;
+}
+
+void
+lr_checksumctx_free(LrChecksumCtx *ctx)
+{
+    if (!ctx)
+        return;
+    if (ctx->ctx)
+        md_ctx_put(ctx->ctx);
+    lr_free(ctx);
+}
+
+static gboolean
+checksum_fd_multi(int fd,
+                  const LrChecksumType *types,
+                  size_t count,
+                  char **checksums,
+                  GError **err)
+{
+    gboolean ret = TRUE;
+    size_t ctxs_len = 0;
+    LrChecksumCtx **ctxs;
+    size_t *ctx_index;  // Index of context used for the type
+
+    assert(fd > -1);
+    assert(types || count == 0);
+    assert(checksums || count == 0);
+    assert(!err || *err == NULL);
+
+    for (size_t x = 0; x < count; x++)
+        checksums[x] = NULL;
+
+    if (count == 0)
+        return TRUE;
+
+    ctxs = lr_malloc0(sizeof(LrChecksumCtx *) * count);
+    ctx_index = lr_malloc0(sizeof(size_t) * count);
+
+    // Prepare one context per distinct checksum type
+    for (size_t x = 0; x < count && ret; x++) {
+        size_t y;
+
+        if (types[x] == LR_CHECKSUM_UNKNOWN) {
+            g_debug("%s: Unknown checksum type", __func__);
+            assert(0);
+        }
+
+        for (y = 0; y < ctxs_len; y++)
+            if (lr_checksumctx_type(ctxs[y]) == types[x])
+                break;
+
+        if (y == ctxs_len) {
+            ctxs[ctxs_len] = lr_checksumctx_new(types[x], err);
+            if (!ctxs[ctxs_len]) {
+                ret = FALSE;
+                break;
+            }
+            ctxs_len++;
+        }
+
+        ctx_index[x] = y;
+    }
+
+    if (ret && lseek(fd, 0, SEEK_SET) == -1) {
+        g_set_error(err, LR_CHECKSUM_ERROR, LRE_IO,
+                    "Cannot seek to the begin of the file. "
+                    "lseek(%d, 0, SEEK_SET) error: %s", fd, strerror(errno));
+        ret = FALSE;
+    }
+
+    // Read the file only once and feed all the contexts
+    if (ret)
+        ret = checksumctxs_update_fd(ctxs, ctxs_len, fd, -1, err);
+
+    // Leave the offset at the end of the file as read() would
+    if (ret)
+        lseek(fd, 0, SEEK_END);
+
+    if (ret) {
+        char **results = lr_malloc0(sizeof(char *) * ctxs_len);
+
+        for (size_t y = 0; y < ctxs_len && ret; y++) {
+            results[y] = lr_checksumctx_final(ctxs[y], err);
+            if (!results[y])
+                ret = FALSE;
+        }
+
+        for (size_t x = 0; x < count && ret; x++)
+            checksums[x] = g_strdup(results[ctx_index[x]]);
+
+        for (size_t y = 0; y < ctxs_len; y++)
+            lr_free(results[y]);
+        lr_free(results);
+    }
+
+    for (size_t y = 0; y < ctxs_len; y++)
+        lr_checksumctx_free(ctxs[y]);
+    lr_free(ctxs);
+    lr_free(ctx_index);
 
-    checksum = lr_malloc0(sizeof(char) * (len * 2 + 1));
-    for (size_t x = 0; x < len; x++)
-        sprintf(checksum+(x*2), "%02x", raw_checksum[x]);
+    return ret;
+}
+
+gboolean
+lr_checksum_fd_multi(int fd,
+                     const LrChecksumType *types,
+                     size_t count,
+                     char **checksums,
+                     GError **err)
+{
+    LrAllocTag prev_tag = lr_alloc_tag_set(LR_ALLOC_CHECKSUM);
+    gboolean ret = checksum_fd_multi(fd, types, count, checksums, err);
+    lr_alloc_tag_set(prev_tag);
+    return ret;
+}
+
+char *
+lr_checksum_fd(LrChecksumType type, int fd, GError **err)
+{
+    char *checksum = NULL;
+
+    if (!lr_checksum_fd_multi(fd, &type, 1, &checksum, err))
+        return NULL;
 
     return checksum;
 }
 
+gboolean
+lr_checksum_fd_pieces(int fd,
+                      LrChecksumType type,
+                      gint64 length,
+                      gchar **hashes,
+                      guint count,
+                      GArray *bad,
+                      GError **err)
+{
+    struct stat st;
+    gboolean ret = TRUE;
+    char *buf;
+
+    assert(fd > -1);
+    assert(length > 0);
+    assert(bad);
+    assert(!err || *err == NULL);
+
+    if (fstat(fd, &st) != 0) {
+        g_set_error(err, LR_CHECKSUM_ERROR, LRE_IO,
+                    "fstat(%d) failed: %s", fd, strerror(errno));
+        return FALSE;
+    }
+
+    if ((gint64) st.st_size <= (gint64) (count - 1) * length
+        || (gint64) st.st_size > (gint64) count * length)
+    {
+        g_set_error(err, LR_CHECKSUM_ERROR, LRE_BADFUNCARG,
+                    "Size of the file (%"G_GINT64_FORMAT" bytes) doesn't "
+                    "match %u pieces of %"G_GINT64_FORMAT" bytes",
+                    (gint64) st.st_size, count, length);
+        return FALSE;
+    }
+
+    buf = lr_malloc(BUFFER_SIZE);
+
+    for (guint i = 0; ret && i < count; i++) {
+        gint64 offset = (gint64) i * length;
+        gint64 end = MIN(offset + length, (gint64) st.st_size);
+        LrChecksumCtx *ctx = lr_checksumctx_new(type, err);
+        char *checksum;
+
+        if (!ctx) {
+            ret = FALSE;
+            break;
+        }
+
+        while (offset < end) {
+            size_t to_read = (size_t) MIN((gint64) BUFFER_SIZE, end - offset);
+            ssize_t readed = pread(fd, buf, to_read, (off_t) offset);
+            if (readed == -1 && errno == EINTR)
+                continue;
+            if (readed <= 0) {
+                g_set_error(err, LR_CHECKSUM_ERROR, LRE_IO,
+                            "pread(%d) failed: %s", fd,
+                            readed ? strerror(errno) : "Unexpected end of file");
+                ret = FALSE;
+                break;
+            }
+            if (!lr_checksumctx_update(ctx, buf, readed, err)) {
+                ret = FALSE;
+                break;
+            }
+            offset += readed;
+        }
+
+        if (ret) {
+            checksum = lr_checksumctx_final(ctx, err);
+            if (!checksum) {
+                ret = FALSE;
+            } else {
+                if (g_ascii_strcasecmp(checksum, hashes[i]))
+                    g_array_append_val(bad, i);
+                lr_free(checksum);
+            }
+        }
+
+        lr_checksumctx_free(ctx);
+    }
+
+    lr_free(buf);
+    return ret;
+}
+
+/** Prefix of names of the extended attributes with cached checksums.
+ * The name is completed by the checksum type (e.g. "user.librepo.sha256").
+ */
+#define CACHE_XATTR_PREFIX      "user.librepo."
+
+/** Key of the cached checksums - identification of the content of the file.
+ * If any of inode, size or mtime (with nanoseconds) of the file
+ * changes, the cached checksums are not valid anymore.
+ */
+static gchar *
+cache_stamp(int fd)
+{
+    struct stat st;
+
+    if (fstat(fd, &st) != 0)
+        return NULL;
+
+    return g_strdup_printf("%llu:%lld:%lld.%09ld",
+                           (unsigned long long) st.st_ino,
+                           (long long) st.st_size,
+                           (long long) st.st_mtim.tv_sec,
+                           (long) st.st_mtim.tv_nsec);
+}
+
+static gchar *
+cache_xattr_name(LrChecksumType type)
+{
+    if (type == LR_CHECKSUM_UNKNOWN)
+        return NULL;
+    return g_strconcat(CACHE_XATTR_PREFIX, lr_checksum_type_to_str(type), NULL);
+}
+
+char *
+lr_checksum_cache_get(int fd, const char *path, LrChecksumType type)
+{
+    ssize_t attr_ret;
+    _cleanup_free_ gchar *name = NULL;
+    _cleanup_free_ gchar *stamp = NULL;
+    char buf[256];
+    char *checksum;
+
+    assert(fd >= 0);
+
+    name = cache_xattr_name(type);
+    stamp = cache_stamp(fd);
+    if (!name || !stamp)
+        return NULL;
+
+    // Value is "<stamp> <checksum>"
+    attr_ret = fgetxattr(fd, name, &buf, sizeof(buf)-1);
+    if (attr_ret == -1)
+        // Not cached or the xattrs are not supported
+        return (path) ? lr_checksum_index_get(path, fd, type) : NULL;
+    buf[attr_ret] = '\0';
+
+    checksum = strchr(buf, ' ');
+    if (!checksum)
+        return NULL;
+    *checksum++ = '\0';
+
+    if (strcmp(buf, stamp)) {
+        g_debug("%s: Cached checksum [%s] is outdated", __func__, name);
+        return NULL;
+    }
+
+    g_debug("%s: Using checksum cached in xattr: [%s] %s",
+            __func__, name, checksum);
+    return g_strdup(checksum);
+}
+
+void
+lr_checksum_cache_set(int fd,
+                      const char *path,
+                      LrChecksumType type,
+                      const char *checksum)
+{
+    _cleanup_free_ gchar *name = NULL;
+    _cleanup_free_ gchar *stamp = NULL;
+    _cleanup_free_ gchar *value = NULL;
+
+    assert(fd >= 0);
+    assert(checksum);
+
+    name = cache_xattr_name(type);
+    stamp = cache_stamp(fd);
+    if (!name || !stamp)
+        return;
+
+    value = g_strconcat(stamp, " ", checksum, NULL);
+    if (fsetxattr(fd, name, value, strlen(value), 0) == -1 && path)
+        // Xattrs are probably not supported, use the sidecar index
+        lr_checksum_index_set(path, fd, type, checksum);
+}
+
+/** Verify the checksum of the file of the job.
+ */
+static void
+verify_file(LrChecksumJob *job)
+{
+    int fd = open(job->path, O_RDONLY);
+
+    if (fd == -1) {
+        job->opened = FALSE;
+        g_set_error(&job->error, LR_CHECKSUM_ERROR, LRE_IO,
+                    "Cannot open %s: %s", job->path, strerror(errno));
+        return;
+    }
+
+    job->opened = TRUE;
+    lr_checksum_fd_cmp_indexed(job->type, fd,
+                               (job->index) ? job->path : NULL,
+                               job->expected, job->caching,
+                               &job->matches, &job->error);
+    close(fd);
+}
+
+/** Shared data of the workers of ::lr_checksum_verify_files */
+typedef struct {
+    GAsyncQueue *finished; /*!<
+        Queue of finished jobs */
+    volatile gint stop; /*!<
+        Set if the remaining jobs should be skipped */
+} LrChecksumPool;
+
+static void
+verify_file_worker(gpointer data, gpointer user_data)
+{
+    LrChecksumJob *job = data;
+    LrChecksumPool *pool = user_data;
+
+    if (g_atomic_int_get(&pool->stop))
+        return;
+
+    verify_file(job);
+    g_async_queue_push(pool->finished, job);
+}
+
+void
+lr_checksum_verify_files(GSList *jobs,
+                         guint threads,
+                         LrChecksumJobCb cb,
+                         void *cbdata)
+{
+    guint count = g_slist_length(jobs);
+    GThreadPool *threadpool;
+    LrChecksumPool pool;
+    GError *tmp_err = NULL;
+
+    if (threads == 0)
+        threads = g_get_num_processors();
+    threads = MIN(threads, count);
+
+    if (threads <= 1) {
+        // Verify the files one after another by this thread
+        for (GSList *elem = jobs; elem; elem = g_slist_next(elem)) {
+            verify_file(elem->data);
+            if (!cb(elem->data, cbdata))
+                break;
+        }
+        return;
+    }
+
+    pool.finished = g_async_queue_new();
+    pool.stop = 0;
+    threadpool = g_thread_pool_new(verify_file_worker, &pool,
+                                   (gint) threads, FALSE, &tmp_err);
+    if (!threadpool) {
+        g_debug("%s: Cannot create thread pool: %s", __func__,
+                tmp_err->message);
+        g_error_free(tmp_err);
+        g_async_queue_unref(pool.finished);
+        lr_checksum_verify_files(jobs, 1, cb, cbdata);
+        return;
+    }
+
+    g_debug("%s: Verifying %u files by %u threads", __func__, count, threads);
+
+    for (GSList *elem = jobs; elem; elem = g_slist_next(elem))
+        g_thread_pool_push(threadpool, elem->data, NULL);
+
+    for (guint x = 0; x < count; x++) {
+        LrChecksumJob *job = g_async_queue_pop(pool.finished);
+        if (!cb(job, cbdata)) {
+            g_atomic_int_set(&pool.stop, 1);
+            break;
+        }
+    }
+
+    // Drop the jobs which weren't started and wait for the running ones
+    g_thread_pool_free(threadpool, TRUE, TRUE);
+    g_async_queue_unref(pool.finished);
+}
+
 gboolean
 lr_checksum_fd_cmp(LrChecksumType type,
                    int fd,
@@ -187,6 +1114,19 @@ lr_checksum_fd_cmp(LrChecksumType type,
                    gboolean caching,
                    gboolean *matches,
                    GError **err)
+{
+    return lr_checksum_fd_cmp_indexed(type, fd, NULL, expected, caching,
+                                      matches, err);
+}
+
+gboolean
+lr_checksum_fd_cmp_indexed(LrChecksumType type,
+                           int fd,
+                           const char *path,
+                           const char *expected,
+                           gboolean caching,
+                           gboolean *matches,
+                           GError **err)
 {
     _cleanup_free_ gchar *checksum = NULL;
 
@@ -203,22 +1143,10 @@ lr_checksum_fd_cmp(LrChecksumType type,
 
     if (caching) {
         // Load cached checksum if enabled and used
-        struct stat st;
-        if (fstat(fd, &st) == 0) {
-            ssize_t attr_ret;
-            _cleanup_free_ gchar *key = NULL;
-            char buf[256];
-
-            key = g_strdup_printf("user.Zif.MdChecksum[%llu]",
-                                  (unsigned long long) st.st_mtime);
-            attr_ret = fgetxattr(fd, key, &buf, 256);
-            if (attr_ret != -1) {
-                // Cached checksum found
-                g_debug("%s: Using checksum cached in xattr: [%s] %s",
-                        __func__, key, buf);
-                *matches = strcmp(expected, buf) ? FALSE : TRUE;
-                return TRUE;
-            }
+        _cleanup_free_ gchar *cached = lr_checksum_cache_get(fd, path, type);
+        if (cached) {
+            *matches = strcmp(expected, cached) ? FALSE : TRUE;
+            return TRUE;
         }
     }
 
@@ -228,16 +1156,9 @@ lr_checksum_fd_cmp(LrChecksumType type,
 
     *matches = (strcmp(expected, checksum)) ? FALSE : TRUE;
 
-    if (caching && *matches) {
-        // Store checksum as extended file attribute if caching is enabled
-        struct stat st;
-        if (fstat(fd, &st) == 0) {
-            _cleanup_free_ gchar *key = NULL;
-            key = g_strdup_printf("user.Zif.MdChecksum[%llu]",
-                                  (unsigned long long) st.st_mtime);
-            fsetxattr(fd, key, checksum, strlen(checksum)+1, 0);
-        }
-    }
+    // Remember the checksum for the next time (even if it doesn't match,
+    // it's checksum of the current content of the file)
+    lr_checksum_cache_set(fd, path, type, checksum);
 
     return TRUE;
 }
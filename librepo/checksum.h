@@ -30,6 +30,10 @@ G_BEGIN_DECLS
  *  @{
  */
 
+/** Name of the sidecar file with cached checksums of files of its
+ * directory (see LRO_CHECKSUMINDEX) */
+#define LR_CHECKSUM_INDEX_FILENAME  ".librepo-checksums"
+
 /** Enum of supported checksum types.
  * NOTE! This enum guarantee to be sorted by "hash quality"
  */
@@ -58,7 +62,90 @@ lr_checksum_type(const char *type);
 const char *
 lr_checksum_type_to_str(LrChecksumType type);
 
+/** Context for incremental checksum calculation.
+ */
+typedef struct _LrChecksumCtx LrChecksumCtx;
+
+/** Create new context for incremental checksum calculation.
+ * @param type      Checksum type
+ * @param err       GError **
+ * @return          New context or NULL on error.
+ */
+LrChecksumCtx *
+lr_checksumctx_new(LrChecksumType type, GError **err);
+
+/** Get type of checksum calculated by the context.
+ * @param ctx       Checksum context
+ * @return          Checksum type
+ */
+LrChecksumType
+lr_checksumctx_type(LrChecksumCtx *ctx);
+
+/** Update checksum with the data.
+ * @param ctx       Checksum context
+ * @param buf       Data
+ * @param len       Length of the data
+ * @param err       GError **
+ * @return          TRUE if everything is ok, FALSE if err is set.
+ */
+gboolean
+lr_checksumctx_update(LrChecksumCtx *ctx,
+                      const void *buf,
+                      size_t len,
+                      GError **err);
+
+/** Update checksum with the first len bytes of a file.
+ * File offset of the file descriptor is not changed.
+ * @param ctx       Checksum context
+ * @param fd        Opened file descriptor
+ * @param len       Number of bytes from the begin of the file to be used
+ * @param err       GError **
+ * @return          TRUE if everything is ok, FALSE if err is set.
+ */
+gboolean
+lr_checksumctx_update_fd(LrChecksumCtx *ctx,
+                         int fd,
+                         gint64 len,
+                         GError **err);
+
+/** Finish the calculation.
+ * After this call, the context cannot be updated anymore, it still
+ * has to be freed by ::lr_checksumctx_free.
+ * @param ctx       Checksum context
+ * @param err       GError **
+ * @return          Malloced checksum string or NULL on error.
+ */
+char *
+lr_checksumctx_final(LrChecksumCtx *ctx, GError **err);
+
+/** Free the checksum context.
+ * @param ctx       Checksum context
+ */
+void
+lr_checksumctx_free(LrChecksumCtx *ctx);
+
+/** Calculate several checksums for data pointed by file descriptor
+ * in a single read pass. Each checksum type is calculated only once,
+ * even if it occurs multiple times in the types array.
+ * @param fd        Opened file descriptor. Function seeks to the begin
+ *                  of the file.
+ * @param types     Array of checksum types
+ * @param count     Number of items in types
+ * @param checksums Array of count items. On success, the n-th item is
+ *                  set to malloced string with checksum of n-th type.
+ *                  On error, all items are set to NULL.
+ * @param err       GError **
+ * @return          TRUE if everything went well, FALSE otherwise
+ */
+gboolean
+lr_checksum_fd_multi(int fd,
+                     const LrChecksumType *types,
+                     size_t count,
+                     char **checksums,
+                     GError **err);
+
 /** Calculate checksum for data pointed by file descriptor.
+ * Big regular files are mapped to the memory instead of being read.
  * @param type      Checksum type
  * @param fd        Opened file descriptor. Function seeks to the begin
  *                  of the file.
@@ -73,7 +160,8 @@ lr_checksum_fd(LrChecksumType type, int fd, GError **err);
  * @param type      Checksum type
  * @param fd        File descriptor
  * @param expected  String with expected checksum value
- * @param caching   Cache/Use cached checksum value as extended file attr.
+ * @param caching   Use checksum value cached as extended file attr.
+ *                  Calculated checksum is always cached.
  * @param matches   Set pointed variable to TRUE if checksum matches.
  * @param err       GError **
  * @return          returns TRUE if error is not set and FALSE if it is
@@ -0,0 +1,308 @@
+/* librepo - A library providing (libcURL like) API to downloading repository
+ * Copyright (C) 2014  Tomas Mlcoch
+ *
+ * Licensed under the GNU Lesser General Public License Version 2.1
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#define _XOPEN_SOURCE   700 // Because of pwrite() and st_mtim
+
+#include <glib.h>
+#include <assert.h>
+#include <errno.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+#include "cleanup.h"
+#include "checksum_index.h"
+
+// Fcntl locks are owned by the process, threads of the process
+// are serialized by this lock
+static GRWLock index_lock;
+
+/** Entry of the index (points to the mapped index).
+ */
+typedef struct {
+    const char *key; /*!<
+        "<checksum type> <size> <mtime>" */
+    size_t key_len;
+    const char *checksum; /*!<
+        Checksum value */
+    size_t checksum_len;
+    const char *name; /*!<
+        Filename */
+    size_t name_len;
+} LrIndexEntry;
+
+/** Split the line of the index to the entry.
+ * @return      FALSE if the line is not a valid entry
+ */
+static gboolean
+parse_entry(const char *line, size_t len, LrIndexEntry *entry)
+{
+    const char *end = line + len;
+    const char *p = line;
+
+    // Key ends by the third space
+    for (int x = 0; x < 3; x++) {
+        p = memchr(p, ' ', end - p);
+        if (!p)
+            return FALSE;
+        p++;
+    }
+
+    entry->key = line;
+    entry->key_len = (p - 1) - line;
+    entry->checksum = p;
+
+    p = memchr(p, ' ', end - p);
+    if (!p || p == entry->checksum)
+        return FALSE;
+
+    entry->checksum_len = p - entry->checksum;
+    entry->name = p + 1;
+    entry->name_len = end - entry->name;
+
+    return entry->name_len > 0;
+}
+
+/** Return TRUE if the entry belongs to the filename and checksum type.
+ */
+static gboolean
+entry_matches(const LrIndexEntry *entry, const char *type, const char *name)
+{
+    size_t type_len = strlen(type);
+    size_t name_len = strlen(name);
+
+    return entry->key_len > type_len
+           && entry->key[type_len] == ' '
+           && !memcmp(entry->key, type, type_len)
+           && entry->name_len == name_len
+           && !memcmp(entry->name, name, name_len);
+}
+
+static gchar *
+index_path(const char *path)
+{
+    _cleanup_free_ gchar *dirname = g_path_get_dirname(path);
+    return g_build_filename(dirname, LR_CHECKSUM_INDEX_FILENAME, NULL);
+}
+
+static gchar *
+entry_key(int fd, LrChecksumType type)
+{
+    struct stat st;
+
+    if (type == LR_CHECKSUM_UNKNOWN || fstat(fd, &st) != 0)
+        return NULL;
+
+    return g_strdup_printf("%s %lld %lld.%09ld",
+                           lr_checksum_type_to_str(type),
+                           (long long) st.st_size,
+                           (long long) st.st_mtim.tv_sec,
+                           (long) st.st_mtim.tv_nsec);
+}
+
+static gboolean
+lock_index(int fd, short type)
+{
+    struct flock fl;
+
+    memset(&fl, 0, sizeof(fl));
+    fl.l_type = type;
+    fl.l_whence = SEEK_SET;
+
+    while (fcntl(fd, F_SETLKW, &fl) == -1) {
+        if (errno != EINTR) {
+            g_debug("%s: Cannot lock the checksum index: %s",
+                    __func__, g_strerror(errno));
+            return FALSE;
+        }
+    }
+
+    return TRUE;
+}
+
+/** Map the whole index. Returns NULL for an empty index or on error.
+ */
+static char *
+map_index(int fd, size_t *len)
+{
+    struct stat st;
+    void *map;
+
+    *len = 0;
+    if (fstat(fd, &st) != 0 || st.st_size == 0)
+        return NULL;
+
+    map = mmap(NULL, (size_t) st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    if (map == MAP_FAILED) {
+        g_debug("%s: Cannot map the checksum index: %s",
+                __func__, g_strerror(errno));
+        return NULL;
+    }
+
+    *len = (size_t) st.st_size;
+    return map;
+}
+
+char *
+lr_checksum_index_get(const char *path, int fd, LrChecksumType type)
+{
+    int index_fd;
+    size_t len;
+    char *map, *checksum = NULL;
+    _cleanup_free_ gchar *ipath = NULL;
+    _cleanup_free_ gchar *key = NULL;
+    _cleanup_free_ gchar *name = NULL;
+
+    assert(path);
+    assert(fd >= 0);
+
+    key = entry_key(fd, type);
+    if (!key)
+        return NULL;
+
+    ipath = index_path(path);
+    name = g_path_get_basename(path);
+
+    g_rw_lock_reader_lock(&index_lock);
+
+    index_fd = open(ipath, O_RDONLY);
+    if (index_fd == -1 || !lock_index(index_fd, F_RDLCK)) {
+        if (index_fd != -1)
+            close(index_fd);
+        g_rw_lock_reader_unlock(&index_lock);
+        return NULL;
+    }
+
+    map = map_index(index_fd, &len);
+    for (const char *line = map; line && line < map + len; ) {
+        LrIndexEntry entry;
+        const char *nl = memchr(line, '\n', (map + len) - line);
+        if (!nl)
+            break;  // Incomplete entry
+
+        if (parse_entry(line, nl - line, &entry)
+            && entry_matches(&entry, lr_checksum_type_to_str(type), name)
+            && entry.key_len == strlen(key)
+            && !memcmp(entry.key, key, entry.key_len))
+        {
+            checksum = g_strndup(entry.checksum, entry.checksum_len);
+            break;
+        }
+
+        line = nl + 1;
+    }
+
+    if (map)
+        munmap(map, len);
+    close(index_fd);  // Releases the lock
+    g_rw_lock_reader_unlock(&index_lock);
+
+    if (checksum)
+        g_debug("%s: Using checksum cached in %s: [%s] %s",
+                __func__, ipath, key, checksum);
+
+    return checksum;
+}
+
+void
+lr_checksum_index_set(const char *path,
+                      int fd,
+                      LrChecksumType type,
+                      const char *checksum)
+{
+    int index_fd;
+    size_t len;
+    char *map;
+    gboolean replaced = FALSE;
+    GString *content;
+    _cleanup_free_ gchar *ipath = NULL;
+    _cleanup_free_ gchar *key = NULL;
+    _cleanup_free_ gchar *name = NULL;
+    _cleanup_free_ gchar *new_entry = NULL;
+
+    assert(path);
+    assert(fd >= 0);
+    assert(checksum);
+
+    name = g_path_get_basename(path);
+    if (strchr(name, '\n') || !strcmp(name, LR_CHECKSUM_INDEX_FILENAME))
+        return;
+
+    key = entry_key(fd, type);
+    if (!key)
+        return;
+
+    ipath = index_path(path);
+    new_entry = g_strdup_printf("%s %s %s\n", key, checksum, name);
+
+    g_rw_lock_writer_lock(&index_lock);
+
+    index_fd = open(ipath, O_RDWR|O_CREAT, 0666);
+    if (index_fd == -1 || !lock_index(index_fd, F_WRLCK)) {
+        g_debug("%s: Cannot open %s: %s", __func__, ipath, g_strerror(errno));
+        if (index_fd != -1)
+            close(index_fd);
+        g_rw_lock_writer_unlock(&index_lock);
+        return;
+    }
+
+    // Keep all entries except the outdated one of the file
+    map = map_index(index_fd, &len);
+    content = g_string_sized_new(len + strlen(new_entry));
+    for (const char *line = map; line && line < map + len; ) {
+        LrIndexEntry entry;
+        const char *nl = memchr(line, '\n', (map + len) - line);
+        if (!nl) {
+            replaced = TRUE;  // Drop incomplete entry
+            break;
+        }
+
+        if (parse_entry(line, nl - line, &entry)
+            && entry_matches(&entry, lr_checksum_type_to_str(type), name))
+            replaced = TRUE;
+        else
+            g_string_append_len(content, line, (nl + 1) - line);
+
+        line = nl + 1;
+    }
+    if (map)
+        munmap(map, len);
+
+    if (!replaced) {
+        // Just append the new entry
+        if (pwrite(index_fd, new_entry, strlen(new_entry), (off_t) len) == -1)
+            g_debug("%s: Cannot write %s: %s", __func__, ipath,
+                    g_strerror(errno));
+    } else {
+        // Rewrite the index in place (the lock belongs to the inode)
+        g_string_append(content, new_entry);
+        if (pwrite(index_fd, content->str, content->len, 0) == -1
+            || ftruncate(index_fd, (off_t) content->len) == -1)
+            g_debug("%s: Cannot write %s: %s", __func__, ipath,
+                    g_strerror(errno));
+    }
+
+    g_string_free(content, TRUE);
+    close(index_fd);  // Releases the lock
+    g_rw_lock_writer_unlock(&index_lock);
+}
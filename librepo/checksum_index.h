@@ -0,0 +1,68 @@
+/* librepo - A library providing (libcURL like) API to downloading repository
+ * Copyright (C) 2014  Tomas Mlcoch
+ *
+ * Licensed under the GNU Lesser General Public License Version 2.1
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#ifndef __LR_CHECKSUM_INDEX_H__
+#define __LR_CHECKSUM_INDEX_H__
+
+#include <glib.h>
+
+#include "checksum.h"
+
+G_BEGIN_DECLS
+
+/** Sidecar checksum index.
+ * Checksums of files of a directory are cached in the
+ * LR_CHECKSUM_INDEX_FILENAME file of the directory. It is used instead
+ * of extended file attributes on filesystems which don't support them
+ * (see LRO_CHECKSUMINDEX).
+ *
+ * Every line of the index is one entry:
+ * "<checksum type> <size> <mtime sec>.<mtime nsec> <checksum> <filename>"
+ * An entry is valid only as long as the size and mtime of the file
+ * are unchanged. There is at most one entry per filename and checksum
+ * type. The index is locked (fcntl) while it is read or updated, so
+ * it could be shared by concurrent processes.
+ */
+
+/** Load the checksum of the file from the index of its directory.
+ * @param path      Path to the file
+ * @param fd        Opened file descriptor of the same file
+ * @param type      Checksum type
+ * @return          Malloced checksum string or NULL if not cached.
+ */
+char *
+lr_checksum_index_get(const char *path, int fd, LrChecksumType type);
+
+/** Store the checksum of the file to the index of its directory.
+ * Errors are silently ignored (e.g. when the directory is not writable).
+ * @param path      Path to the file
+ * @param fd        Opened file descriptor of the same file
+ * @param type      Checksum type
+ * @param checksum  Checksum of the file
+ */
+void
+lr_checksum_index_set(const char *path,
+                      int fd,
+                      LrChecksumType type,
+                      const char *checksum);
+
+G_END_DECLS
+
+#endif
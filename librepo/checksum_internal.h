@@ -0,0 +1,190 @@
+/* librepo - A library providing (libcURL like) API to downloading repository
+ * Copyright (C) 2014  Tomas Mlcoch
+ *
+ * Licensed under the GNU Lesser General Public License Version 2.1
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#ifndef __LR_CHECKSUM_INTERNAL_H__
+#define __LR_CHECKSUM_INTERNAL_H__
+
+#include <glib.h>
+
+#include "checksum.h"
+
+G_BEGIN_DECLS
+
+/** Name of the CPU extension accelerating SHA digests
+ * (e.g. "sha-ni", "armv8-sha2") or NULL if none was detected.
+ * OpenSSL uses the extensions by itself, this is informative only.
+ */
+const char *
+lr_checksum_cpu_acceleration(void);
+
+/** Store the checksum of the file as an extended file attribute.
+ * Every checksum type has its own attribute. The cached value is used
+ * by ::lr_checksum_fd_cmp with caching enabled.
+ * Errors are silently ignored (e.g. when the filesystem doesn't
+ * support extended attributes).
+ * @param fd        Opened file descriptor
+ * @param path      Path to the file if the sidecar checksum index should
+ *                  be used when xattrs are not supported (see
+ *                  LRO_CHECKSUMINDEX) or NULL
+ * @param type      Checksum type
+ * @param checksum  Checksum of the file
+ */
+void
+lr_checksum_cache_set(int fd,
+                      const char *path,
+                      LrChecksumType type,
+                      const char *checksum);
+
+/** Load the checksum of the file cached by ::lr_checksum_cache_set.
+ * The cached value is valid only as long as the inode, size and mtime
+ * (including nanoseconds) of the file are unchanged.
+ * The content of the file is not read.
+ * @param fd        Opened file descriptor
+ * @param path      Path to the file if the sidecar checksum index should
+ *                  be consulted when the checksum is not in xattrs or NULL
+ * @param type      Checksum type
+ * @return          Malloced checksum string or NULL if not cached.
+ */
+char *
+lr_checksum_cache_get(int fd, const char *path, LrChecksumType type);
+
+/** Same as ::lr_checksum_fd_cmp, but the sidecar checksum index
+ * of the directory of the path is used as a fallback cache.
+ * @param path      Path to the file of the fd or NULL (no index is used)
+ */
+gboolean
+lr_checksum_fd_cmp_indexed(LrChecksumType type,
+                           int fd,
+                           const char *path,
+                           const char *expected,
+                           gboolean caching,
+                           gboolean *matches,
+                           GError **err);
+
+/** Create a checksum context whose state can be saved by
+ * ::lr_checksumctx_save and loaded by ::lr_checksumctx_load later,
+ * e.g. to continue checksumming of a partially downloaded file without
+ * reading the already downloaded part again.
+ * If the OpenSSL build doesn't provide the low-level digests, a common
+ * context (whose state cannot be saved) is returned.
+ * @param type      Checksum type
+ * @param err       GError **
+ * @return          New checksum context or NULL
+ */
+LrChecksumCtx *
+lr_checksumctx_new_resumable(LrChecksumType type, GError **err);
+
+/** Serialize the state of a context created by
+ * ::lr_checksumctx_new_resumable or ::lr_checksumctx_load.
+ * The state is valid only for the same OpenSSL version.
+ * @param ctx       Checksum context (not finalized)
+ * @return          Malloced base64 string or NULL if the state of the
+ *                  context cannot be saved
+ */
+gchar *
+lr_checksumctx_save(LrChecksumCtx *ctx);
+
+/** Create a checksum context from the state saved by
+ * ::lr_checksumctx_save.
+ * @param type      Checksum type (must match the saved state)
+ * @param state     Saved state
+ * @param err       GError **
+ * @return          New checksum context or NULL if the state is invalid
+ *                  or incompatible
+ */
+LrChecksumCtx *
+lr_checksumctx_load(LrChecksumType type, const char *state, GError **err);
+
+/** Verify checksums of the pieces of the file.
+ * The file is split into count pieces of the length, the last piece
+ * could be shorter.
+ * @param fd        Opened file descriptor
+ * @param type      Checksum type of the pieces
+ * @param length    Length of a piece
+ * @param hashes    Expected checksums of the pieces (count items)
+ * @param count     Number of the pieces
+ * @param bad       GArray of guint where indexes of the pieces which
+ *                  don't match are appended
+ * @param err       GError **
+ * @return          FALSE if the file cannot be read or its size
+ *                  doesn't match the pieces
+ */
+gboolean
+lr_checksum_fd_pieces(int fd,
+                      LrChecksumType type,
+                      gint64 length,
+                      gchar **hashes,
+                      guint count,
+                      GArray *bad,
+                      GError **err);
+
+/** Verification of a checksum of a file by ::lr_checksum_verify_files */
+typedef struct {
+    const char *path; /*!<
+        Path to the file */
+    LrChecksumType type; /*!<
+        Checksum type */
+    const char *expected; /*!<
+        Expected checksum value */
+    gboolean caching; /*!<
+        See ::lr_checksum_fd_cmp */
+    gboolean index; /*!<
+        Use the sidecar checksum index (see LRO_CHECKSUMINDEX) */
+    void *userdata; /*!<
+        Data of the caller */
+
+    // Items filled by the verification
+
+    gboolean opened; /*!<
+        FALSE if the file cannot be opened */
+    gboolean matches; /*!<
+        TRUE if the checksum matches */
+    GError *error; /*!<
+        Error (the file cannot be opened or checksumed) or NULL.
+        Must be freed by the caller. */
+} LrChecksumJob;
+
+/** Called for every finished ::LrChecksumJob.
+ * @param job       Finished job
+ * @param cbdata    User data
+ * @return          FALSE to stop the verification. Jobs which weren't
+ *                  started yet are skipped then.
+ */
+typedef gboolean (*LrChecksumJobCb)(LrChecksumJob *job, void *cbdata);
+
+/** Verify checksums of independent files by a pool of worker threads.
+ * The callback is always called from the calling thread, in order in which
+ * the jobs are finished. With one thread, the files are verified by
+ * the calling thread in order of the list.
+ * @param jobs      List of ::LrChecksumJob
+ * @param threads   Maximal number of threads, 0 means the number
+ *                  of available processors
+ * @param cb        Callback called for every finished job
+ * @param cbdata    User data for the callback
+ */
+void
+lr_checksum_verify_files(GSList *jobs,
+                         guint threads,
+                         LrChecksumJobCb cb,
+                         void *cbdata);
+
+G_END_DECLS
+
+#endif
@@ -0,0 +1,675 @@
+/* librepo - A library providing (libcURL like) API to downloading repository
+ * Copyright (C) 2014  Tomas Mlcoch
+ *
+ * Licensed under the GNU Lesser General Public License Version 2.1
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#define _GNU_SOURCE         // Because of MSG_NOSIGNAL and SOCK_CLOEXEC
+
+#include <glib.h>
+#include <assert.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "rcodes.h"
+#include "util.h"
+#include "handle_internal.h"
+#include "daemon_internal.h"
+#include "cleanup.h"
+
+#define MAX_HEADER          24  /*!< Max length of the header of a message */
+
+/** Options identifying the repository, the other options of the handle
+ * are options of the request */
+static const char *repo_keys[] = {
+    "urls",
+    "mirrorlisturl",
+    "metalinkurl",
+    "repotype",
+    "fastestmirror",
+    "fastestmirrorcache",
+    "useragent",
+    NULL,
+};
+
+int
+lr_daemon_connect(const char *socket_path, GError **err)
+{
+    struct sockaddr_un addr;
+    int fd;
+
+    assert(!err || *err == NULL);
+
+    if (!socket_path)
+        socket_path = g_getenv("LIBREPO_DAEMON_SOCKET");
+    if (!socket_path)
+        socket_path = LR_DAEMON_SOCKET;
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (strlen(socket_path) >= sizeof(addr.sun_path)) {
+        g_set_error(err, LR_HANDLE_ERROR, LRE_BADFUNCARG,
+                    "Path of the socket is too long: %s", socket_path);
+        return -1;
+    }
+    strcpy(addr.sun_path, socket_path);
+
+    fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        g_set_error(err, LR_HANDLE_ERROR, LRE_IO,
+                    "socket() failed: %s", g_strerror(errno));
+        return -1;
+    }
+
+    if (connect(fd, (struct sockaddr *) &addr, sizeof(addr)) < 0) {
+        g_set_error(err, LR_HANDLE_ERROR, LRE_IO,
+                    "Cannot connect to librepod at %s: %s",
+                    socket_path, g_strerror(errno));
+        close(fd);
+        return -1;
+    }
+
+    return fd;
+}
+
+static gboolean
+send_all(int fd, const char *buf, gsize len, GError **err)
+{
+    while (len > 0) {
+        ssize_t rc = send(fd, buf, len, MSG_NOSIGNAL);
+        if (rc < 0 && errno == EINTR)
+            continue;
+        if (rc < 0) {
+            g_set_error(err, LR_HANDLE_ERROR, LRE_IO,
+                        "send() failed: %s", g_strerror(errno));
+            return FALSE;
+        }
+        buf += rc;
+        len -= rc;
+    }
+
+    return TRUE;
+}
+
+/** Read exactly len bytes. Returns 0 on success, 1 if the connection
+ * was closed before the first byte and -1 on an error. */
+static int
+recv_all(int fd, char *buf, gsize len, GError **err)
+{
+    gsize done = 0;
+
+    while (done < len) {
+        ssize_t rc = recv(fd, buf + done, len - done, 0);
+        if (rc < 0 && errno == EINTR)
+            continue;
+        if (rc < 0) {
+            g_set_error(err, LR_HANDLE_ERROR, LRE_IO,
+                        "recv() failed: %s", g_strerror(errno));
+            return -1;
+        }
+        if (rc == 0) {
+            g_set_error(err, LR_HANDLE_ERROR, LRE_IO,
+                        "Connection closed by the peer");
+            return done ? -1 : 1;
+        }
+        done += rc;
+    }
+
+    return 0;
+}
+
+gboolean
+lr_daemon_send(int fd, GKeyFile *msg, GError **err)
+{
+    _cleanup_free_ gchar *data = NULL;
+    _cleanup_free_ gchar *header = NULL;
+    gsize len;
+
+    assert(msg);
+    assert(!err || *err == NULL);
+
+    data = g_key_file_to_data(msg, &len, NULL);
+    if (len > LR_DAEMON_MAX_MESSAGE) {
+        g_set_error(err, LR_HANDLE_ERROR, LRE_BADFUNCARG,
+                    "Message is too big (%" G_GSIZE_FORMAT " bytes)", len);
+        return FALSE;
+    }
+
+    header = g_strdup_printf("%" G_GSIZE_FORMAT "\n", len);
+    return send_all(fd, header, strlen(header), err)
+           && send_all(fd, data, len, err);
+}
+
+GKeyFile *
+lr_daemon_receive(int fd, GError **err)
+{
+    char header[MAX_HEADER + 1];
+    _cleanup_free_ gchar *data = NULL;
+    GKeyFile *msg;
+    gchar *end;
+    guint64 len;
+    gsize x;
+
+    assert(!err || *err == NULL);
+
+    for (x = 0; x < MAX_HEADER; x++) {
+        if (recv_all(fd, header + x, 1, err))
+            return NULL;
+        if (header[x] == '\n')
+            break;
+    }
+    header[x] = '\0';
+
+    len = g_ascii_strtoull(header, &end, 10);
+    if (x == MAX_HEADER || x == 0 || *end != '\0'
+        || len > LR_DAEMON_MAX_MESSAGE) {
+        g_set_error(err, LR_HANDLE_ERROR, LRE_IO,
+                    "Bad header of a message: \"%s\"", header);
+        return NULL;
+    }
+
+    data = g_malloc(len + 1);
+    if (recv_all(fd, data, len, err))
+        return NULL;
+    data[len] = '\0';
+
+    msg = g_key_file_new();
+    if (!g_key_file_load_from_data(msg, data, len, G_KEY_FILE_NONE, err)) {
+        g_key_file_free(msg);
+        return NULL;
+    }
+
+    return msg;
+}
+
+gchar *
+lr_daemon_group(const char *prefix, gint64 index)
+{
+    return g_strdup_printf("%s %" G_GINT64_FORMAT, prefix, index);
+}
+
+static void
+set_string(GKeyFile *msg, const char *group, const char *key, const char *value)
+{
+    if (value)
+        g_key_file_set_string(msg, group, key, value);
+}
+
+/** String or NULL if the key is missing */
+static gchar *
+get_string(GKeyFile *msg, const char *group, const char *key)
+{
+    return g_key_file_get_string(msg, group, key, NULL);
+}
+
+static void
+set_list(GKeyFile *msg, const char *group, const char *key, char **list)
+{
+    if (list)
+        g_key_file_set_string_list(msg, group, key,
+                                   (const gchar * const *) list,
+                                   g_strv_length(list));
+}
+
+/** List or NULL if the key is missing */
+static gchar **
+get_list(GKeyFile *msg, const char *group, const char *key)
+{
+    gchar **list;
+    gsize len;
+
+    if (!g_key_file_has_key(msg, group, key, NULL))
+        return NULL;
+    list = g_key_file_get_string_list(msg, group, key, &len, NULL);
+    return list ? list : g_new0(gchar *, 1);
+}
+
+/** Check that the handle needs no option which lr_daemon_handle_to_keyfile()
+ * doesn't forward to librepod, the daemon would silently download
+ * without it otherwise.
+ */
+static gboolean
+check_forwarded_options(LrHandle *handle, GError **err)
+{
+    const struct {
+        gboolean set;
+        const char *option;
+    } options[] = {
+        { handle->userpwd,                      "LRO_USERPWD" },
+        { handle->proxy,                        "LRO_PROXY" },
+        { handle->proxyuserpwd,                 "LRO_PROXYUSERPWD" },
+        { handle->proxies != NULL,              "LRO_PROXIES" },
+        { !handle->sslverifypeer,               "LRO_SSLVERIFYPEER" },
+        { !handle->sslverifyhost,               "LRO_SSLVERIFYHOST" },
+        { handle->urlvars != NULL,              "LRO_VARSUB" },
+        { handle->gnupghomedir != NULL,         "LRO_GNUPGHOMEDIR" },
+        { handle->gpgbackend != LRO_GPGBACKEND_DEFAULT, "LRO_GPGBACKEND" },
+        { handle->ignoremissing,                "LRO_IGNOREMISSING" },
+        { FALSE,                                NULL },
+    };
+
+    for (int x = 0; options[x].option; x++) {
+        if (options[x].set) {
+            g_set_error(err, LR_HANDLE_ERROR, LRE_BADFUNCARG,
+                        "%s is not supported by librepod", options[x].option);
+            return FALSE;
+        }
+    }
+
+    return TRUE;
+}
+
+void
+lr_daemon_handle_to_keyfile(LrHandle *handle, GKeyFile *msg, const char *group)
+{
+    assert(handle);
+
+    set_list(msg, group, "urls", handle->urls);
+    set_string(msg, group, "mirrorlisturl", handle->mirrorlisturl);
+    set_string(msg, group, "metalinkurl", handle->metalinkurl);
+    g_key_file_set_integer(msg, group, "repotype", handle->repotype);
+    g_key_file_set_boolean(msg, group, "fastestmirror", handle->fastestmirror);
+    set_string(msg, group, "fastestmirrorcache", handle->fastestmirrorcache);
+    set_string(msg, group, "useragent", handle->useragent);
+
+    set_string(msg, group, "destdir", handle->destdir);
+    g_key_file_set_boolean(msg, group, "update", handle->update);
+    g_key_file_set_boolean(msg, group, "checksum",
+                           handle->checks & LR_CHECK_CHECKSUM);
+    g_key_file_set_boolean(msg, group, "gpgcheck",
+                           handle->checks & LR_CHECK_GPG);
+    set_list(msg, group, "yumdlist", handle->yumdlist);
+    set_list(msg, group, "yumblist", handle->yumblist);
+}
+
+gchar *
+lr_daemon_handle_key(GKeyFile *msg, const char *group)
+{
+    GString *key = g_string_new(NULL);
+
+    for (const char **name = repo_keys; *name; name++) {
+        _cleanup_free_ gchar *value = g_key_file_get_value(msg, group,
+                                                           *name, NULL);
+        g_string_append_printf(key, "%s=%s\n", *name, value ? value : "");
+    }
+
+    return g_string_free(key, FALSE);
+}
+
+gboolean
+lr_daemon_handle_from_keyfile(LrHandle *handle,
+                              GKeyFile *msg,
+                              const char *group,
+                              gboolean repo,
+                              GError **err)
+{
+    _cleanup_strv_free_ gchar **yumdlist = NULL;
+    _cleanup_strv_free_ gchar **yumblist = NULL;
+    _cleanup_free_ gchar *destdir = NULL;
+    gboolean ret = TRUE;
+
+    assert(handle);
+    assert(!err || *err == NULL);
+
+    if (!g_key_file_has_group(msg, group)) {
+        g_set_error(err, LR_HANDLE_ERROR, LRE_BADFUNCARG,
+                    "Missing group [%s] in the request", group);
+        return FALSE;
+    }
+
+    if (repo) {
+        _cleanup_strv_free_ gchar **urls = get_list(msg, group, "urls");
+        _cleanup_free_ gchar *mirrorlisturl = get_string(msg, group, "mirrorlisturl");
+        _cleanup_free_ gchar *metalinkurl = get_string(msg, group, "metalinkurl");
+        _cleanup_free_ gchar *cache = get_string(msg, group, "fastestmirrorcache");
+        _cleanup_free_ gchar *useragent = get_string(msg, group, "useragent");
+        LrRepotype repotype = g_key_file_get_integer(msg, group,
+                                                     "repotype", NULL);
+        long fastestmirror = g_key_file_get_boolean(msg, group,
+                                                    "fastestmirror", NULL);
+
+        ret = lr_handle_setopt(handle, err, LRO_URLS, urls)
+              && lr_handle_setopt(handle, err, LRO_MIRRORLISTURL, mirrorlisturl)
+              && lr_handle_setopt(handle, err, LRO_METALINKURL, metalinkurl)
+              && lr_handle_setopt(handle, err, LRO_REPOTYPE, repotype)
+              && lr_handle_setopt(handle, err, LRO_FASTESTMIRROR, fastestmirror)
+              && lr_handle_setopt(handle, err, LRO_FASTESTMIRRORCACHE, cache)
+              // NULL would remove the default User-Agent of librepo
+              && (!useragent
+                  || lr_handle_setopt(handle, err, LRO_USERAGENT, useragent));
+        if (!ret)
+            return FALSE;
+    }
+
+    // Options of the request are (re)set always, the handle is reused
+    destdir = get_string(msg, group, "destdir");
+    yumdlist = get_list(msg, group, "yumdlist");
+    yumblist = get_list(msg, group, "yumblist");
+
+    return lr_handle_setopt(handle, err, LRO_DESTDIR, destdir)
+           && lr_handle_setopt(handle, err, LRO_UPDATE,
+                  (long) g_key_file_get_boolean(msg, group, "update", NULL))
+           && lr_handle_setopt(handle, err, LRO_CHECKSUM,
+                  (long) g_key_file_get_boolean(msg, group, "checksum", NULL))
+           && lr_handle_setopt(handle, err, LRO_GPGCHECK,
+                  (long) g_key_file_get_boolean(msg, group, "gpgcheck", NULL))
+           && lr_handle_setopt(handle, err, LRO_YUMDLIST, yumdlist)
+           && lr_handle_setopt(handle, err, LRO_YUMBLIST, yumblist);
+}
+
+void
+lr_daemon_packagetarget_to_keyfile(LrPackageTarget *target,
+                                   gint64 handle_index,
+                                   GKeyFile *msg,
+                                   const char *group)
+{
+    assert(target);
+
+    g_key_file_set_int64(msg, group, "handle", handle_index);
+    set_string(msg, group, "relative_url", target->relative_url);
+    set_string(msg, group, "dest", target->dest);
+    g_key_file_set_integer(msg, group, "checksum_type", target->checksum_type);
+    set_string(msg, group, "checksum", target->checksum);
+    g_key_file_set_int64(msg, group, "expectedsize", target->expectedsize);
+    set_string(msg, group, "base_url", target->base_url);
+    g_key_file_set_boolean(msg, group, "resume", target->resume);
+    g_key_file_set_int64(msg, group, "byterangestart", target->byterangestart);
+    g_key_file_set_int64(msg, group, "byterangeend", target->byterangeend);
+    g_key_file_set_integer(msg, group, "priority", target->priority);
+}
+
+LrPackageTarget *
+lr_daemon_packagetarget_from_keyfile(LrHandle *handle,
+                                     GKeyFile *msg,
+                                     const char *group,
+                                     LrEndCb endcb,
+                                     void *cbdata,
+                                     GError **err)
+{
+    _cleanup_free_ gchar *relative_url = NULL;
+    _cleanup_free_ gchar *dest = NULL;
+    _cleanup_free_ gchar *checksum = NULL;
+    _cleanup_free_ gchar *base_url = NULL;
+
+    assert(!err || *err == NULL);
+
+    relative_url = get_string(msg, group, "relative_url");
+    if (!relative_url) {
+        g_set_error(err, LR_PACKAGE_DOWNLOADER_ERROR, LRE_BADFUNCARG,
+                    "Missing relative_url of [%s] in the request", group);
+        return NULL;
+    }
+    dest = get_string(msg, group, "dest");
+    checksum = get_string(msg, group, "checksum");
+    base_url = get_string(msg, group, "base_url");
+
+    return lr_packagetarget_new_v4(handle, relative_url, dest,
+            g_key_file_get_integer(msg, group, "checksum_type", NULL),
+            checksum,
+            g_key_file_get_int64(msg, group, "expectedsize", NULL),
+            base_url,
+            g_key_file_get_boolean(msg, group, "resume", NULL),
+            NULL, cbdata, endcb, NULL,
+            g_key_file_get_int64(msg, group, "byterangestart", NULL),
+            g_key_file_get_int64(msg, group, "byterangeend", NULL),
+            g_key_file_get_integer(msg, group, "priority", NULL),
+            err);
+}
+
+void
+lr_daemon_set_error(GKeyFile *msg, const GError *error)
+{
+    g_key_file_set_boolean(msg, LR_DAEMON_RESPONSE, "ok", error == NULL);
+    if (!error)
+        return;
+
+    g_key_file_set_string(msg, LR_DAEMON_RESPONSE, "domain",
+                          g_quark_to_string(error->domain));
+    g_key_file_set_integer(msg, LR_DAEMON_RESPONSE, "code", error->code);
+    g_key_file_set_string(msg, LR_DAEMON_RESPONSE, "message", error->message);
+}
+
+/** Set the error of the response to err and return FALSE, or TRUE
+ * if the response is ok */
+static gboolean
+response_ok(GKeyFile *response, GError **err)
+{
+    _cleanup_free_ gchar *domain = NULL;
+    _cleanup_free_ gchar *message = NULL;
+
+    if (g_key_file_get_boolean(response, LR_DAEMON_RESPONSE, "ok", NULL))
+        return TRUE;
+
+    domain = get_string(response, LR_DAEMON_RESPONSE, "domain");
+    message = get_string(response, LR_DAEMON_RESPONSE, "message");
+    g_set_error(err,
+                domain ? g_quark_from_string(domain) : LR_HANDLE_ERROR,
+                g_key_file_get_integer(response, LR_DAEMON_RESPONSE,
+                                       "code", NULL),
+                "%s", message ? message : "Unknown error of librepod");
+    return FALSE;
+}
+
+gboolean
+lr_daemon_load_result(GKeyFile *msg,
+                      const char *group,
+                      gboolean update,
+                      LrResult *result,
+                      GError **err)
+{
+    _cleanup_free_ gchar *destdir = get_string(msg, group, "destdir");
+    _cleanup_strv_free_ gchar **yumdlist = get_list(msg, group, "yumdlist");
+    _cleanup_strv_free_ gchar **yumblist = get_list(msg, group, "yumblist");
+    LrRepotype repotype = g_key_file_get_integer(msg, group, "repotype", NULL);
+    LrHandle *handle;
+    gboolean ret;
+
+    assert(!err || *err == NULL);
+
+    if (!destdir) {
+        g_set_error(err, LR_HANDLE_ERROR, LRE_BADFUNCARG,
+                    "No LRO_DESTDIR to load the repository from");
+        return FALSE;
+    }
+
+    char *urls[] = { destdir, NULL };
+    handle = lr_handle_init();
+    ret = lr_handle_setopt(handle, err, LRO_URLS, urls)
+          && lr_handle_setopt(handle, err, LRO_LOCAL, 1L)
+          && lr_handle_setopt(handle, err, LRO_REPOTYPE, repotype)
+          && lr_handle_setopt(handle, err, LRO_CHECKSUM, 0L)
+          && lr_handle_setopt(handle, err, LRO_UPDATE, (long) update)
+          && lr_handle_setopt(handle, err, LRO_YUMDLIST, yumdlist)
+          && lr_handle_setopt(handle, err, LRO_YUMBLIST, yumblist)
+          && lr_handle_perform(handle, result, err);
+    lr_handle_free(handle);
+
+    return ret;
+}
+
+/** Send the request to the daemon and return its response */
+static GKeyFile *
+lr_daemon_request(const char *socket_path, GKeyFile *request, GError **err)
+{
+    GKeyFile *response;
+    int fd;
+
+    fd = lr_daemon_connect(socket_path, err);
+    if (fd < 0)
+        return NULL;
+
+    if (!lr_daemon_send(fd, request, err)) {
+        close(fd);
+        return NULL;
+    }
+
+    response = lr_daemon_receive(fd, err);
+    close(fd);
+    return response;
+}
+
+static GKeyFile *
+lr_daemon_request_new(const char *type, gint64 handles, gint64 targets)
+{
+    GKeyFile *request = g_key_file_new();
+
+    g_key_file_set_integer(request, LR_DAEMON_REQUEST, "version",
+                           LR_DAEMON_VERSION);
+    g_key_file_set_string(request, LR_DAEMON_REQUEST, "type", type);
+    g_key_file_set_int64(request, LR_DAEMON_REQUEST, "handles", handles);
+    g_key_file_set_int64(request, LR_DAEMON_REQUEST, "targets", targets);
+    return request;
+}
+
+gboolean
+lr_daemon_handle_perform(const char *socket_path,
+                         LrHandle *handle,
+                         LrResult *result,
+                         GError **err)
+{
+    _cleanup_free_ gchar *group = lr_daemon_group("handle", 0);
+    GKeyFile *request, *response;
+    gboolean ret;
+
+    assert(handle);
+    assert(result);
+    assert(!err || *err == NULL);
+
+    if (handle->local)
+        return lr_handle_perform(handle, result, err);
+
+    if (!handle->destdir) {
+        g_set_error(err, LR_HANDLE_ERROR, LRE_BADFUNCARG,
+                    "LRO_DESTDIR is required to perform the handle "
+                    "by librepod");
+        return FALSE;
+    }
+
+    if (!check_forwarded_options(handle, err))
+        return FALSE;
+
+    request = lr_daemon_request_new(LR_DAEMON_TYPE_PERFORM, 1, 0);
+    lr_daemon_handle_to_keyfile(handle, request, group);
+
+    response = lr_daemon_request(socket_path, request, err);
+    ret = response
+          && response_ok(response, err)
+          && lr_daemon_load_result(request, group, handle->update,
+                                   result, err);
+
+    g_key_file_free(request);
+    if (response)
+        g_key_file_free(response);
+    return ret;
+}
+
+gboolean
+lr_daemon_download_packages(const char *socket_path,
+                            GSList *targets,
+                            LrPackageDownloadFlag flags,
+                            GError **err)
+{
+    GHashTable *handles;
+    GKeyFile *request, *response;
+    gint64 index = 0;
+    gboolean ret;
+
+    assert(!err || *err == NULL);
+
+    if (!targets)
+        return TRUE;
+
+    for (GSList *elem = targets; elem; elem = g_slist_next(elem)) {
+        LrPackageTarget *target = elem->data;
+        if (target->handle && !check_forwarded_options(target->handle, err))
+            return FALSE;
+    }
+
+    // Index of every handle, a handle is sent once for all its targets
+    handles = g_hash_table_new(g_direct_hash, g_direct_equal);
+    request = lr_daemon_request_new(LR_DAEMON_TYPE_DOWNLOAD, 0,
+                                    g_slist_length(targets));
+    g_key_file_set_integer(request, LR_DAEMON_REQUEST, "flags", flags);
+
+    for (GSList *elem = targets; elem; elem = g_slist_next(elem), index++) {
+        LrPackageTarget *target = elem->data;
+        _cleanup_free_ gchar *group = lr_daemon_group("target", index);
+        gint64 handle_index = -1;
+
+        if (target->handle) {
+            gpointer value;
+            if (g_hash_table_lookup_extended(handles, target->handle,
+                                             NULL, &value)) {
+                handle_index = GPOINTER_TO_SIZE(value);
+            } else {
+                _cleanup_free_ gchar *handle_group = NULL;
+                handle_index = g_hash_table_size(handles);
+                handle_group = lr_daemon_group("handle", handle_index);
+                lr_daemon_handle_to_keyfile(target->handle, request,
+                                            handle_group);
+                g_hash_table_insert(handles, target->handle,
+                                    GSIZE_TO_POINTER(handle_index));
+            }
+        }
+
+        lr_daemon_packagetarget_to_keyfile(target, handle_index,
+                                           request, group);
+    }
+
+    g_key_file_set_int64(request, LR_DAEMON_REQUEST, "handles",
+                         g_hash_table_size(handles));
+    g_hash_table_destroy(handles);
+
+    response = lr_daemon_request(socket_path, request, err);
+    g_key_file_free(request);
+    if (!response)
+        return FALSE;
+
+    // Results of the targets are sent also if the download failed
+    index = 0;
+    for (GSList *elem = targets; elem; elem = g_slist_next(elem), index++) {
+        LrPackageTarget *target = elem->data;
+        _cleanup_free_ gchar *group = lr_daemon_group("target", index);
+        _cleanup_free_ gchar *local_path = NULL;
+        _cleanup_free_ gchar *target_err = NULL;
+
+        if (!g_key_file_has_group(response, group))
+            continue;
+
+        local_path = get_string(response, group, "local_path");
+        target_err = get_string(response, group, "err");
+
+        target->local_path = lr_string_chunk_insert(target->chunk, local_path);
+        target->err = lr_string_chunk_insert(target->chunk, target_err);
+
+        // Status is sent only for the targets which were finished
+        if (target->endcb && g_key_file_has_key(response, group, "status", NULL))
+            target->endcb(target->cbdata,
+                          g_key_file_get_integer(response, group,
+                                                 "status", NULL),
+                          target_err);
+    }
+
+    ret = response_ok(response, err);
+    g_key_file_free(response);
+    return ret;
+}
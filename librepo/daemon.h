@@ -0,0 +1,105 @@
+/* librepo - A library providing (libcURL like) API to downloading repository
+ * Copyright (C) 2014  Tomas Mlcoch
+ *
+ * Licensed under the GNU Lesser General Public License Version 2.1
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#ifndef __LR_DAEMON_H__
+#define __LR_DAEMON_H__
+
+#include <glib.h>
+
+#include "handle.h"
+#include "result.h"
+#include "package_downloader.h"
+
+G_BEGIN_DECLS
+
+/** \defgroup   daemon    Client of the librepod daemon
+ *  \addtogroup daemon
+ *  @{
+ */
+
+/** librepod is a long-running process which downloads on behalf of
+ * short-lived local clients. It keeps a handle for every repository
+ * between the requests, so the connections, the DNS cache and the TLS
+ * sessions (the curl share of the handle) and the loaded mirrors are
+ * warm for the next client.
+ *
+ * The functions below mirror lr_handle_perform() and
+ * lr_download_packages(). The configuration of the handles and the
+ * targets is sent to the daemon, which downloads the files to their
+ * destinations itself, so the daemon must be able to write to them.
+ * The daemon serves only clients running under its own user (or root).
+ *
+ * Only the options which identify the repository (LRO_URLS,
+ * LRO_MIRRORLISTURL, LRO_METALINKURL, LRO_REPOTYPE, LRO_FASTESTMIRROR,
+ * LRO_FASTESTMIRRORCACHE, LRO_USERAGENT) and the options of the request
+ * (LRO_DESTDIR, LRO_UPDATE, LRO_CHECKSUM, LRO_GPGCHECK, LRO_YUMDLIST,
+ * LRO_YUMBLIST) are sent, the other options of the handle are ignored.
+ * Progress and mirror failure callbacks are not called, end callbacks
+ * of the package targets are called when the whole download is over.
+ */
+
+/** Default path of the socket of the daemon. The LIBREPO_DAEMON_SOCKET
+ * environment variable overrides it. */
+#define LR_DAEMON_SOCKET        "/run/librepo/librepod.sock"
+
+/** Perform the handle by the daemon.
+ * The metadata are downloaded to LRO_DESTDIR of the handle (it must
+ * be set) and then loaded into the result locally.
+ * Handles of local repositories (LRO_LOCAL) are performed directly.
+ * Only the repository (URLs, type, fastest mirror, User-Agent) and
+ * the request options (LRO_DESTDIR, LRO_UPDATE, checks, LRO_YUMDLIST,
+ * LRO_YUMBLIST) are forwarded to the daemon, a handle with credentials,
+ * proxies, disabled SSL verification, LRO_VARSUB, LRO_GNUPGHOMEDIR,
+ * LRO_GPGBACKEND or LRO_IGNOREMISSING fails with LRE_BADFUNCARG.
+ * @param socket_path   Path of the socket of the daemon or NULL
+ *                      for the default
+ * @param handle        Handle
+ * @param result        Result
+ * @param err           GError **
+ * @return              TRUE if everything is ok, FALSE if err is set
+ */
+gboolean
+lr_daemon_handle_perform(const char *socket_path,
+                         LrHandle *handle,
+                         LrResult *result,
+                         GError **err);
+
+/** Download the LrPackageTargets by the daemon.
+ * Like lr_download_packages(), the local_path and err of the targets
+ * are set after the download. The handles of the targets are limited
+ * like in lr_daemon_handle_perform().
+ * @param socket_path   Path of the socket of the daemon or NULL
+ *                      for the default
+ * @param targets       GSList of LrPackageTargets
+ * @param flags         Bitfield with flags for download
+ * @param err           GError **
+ * @return              TRUE if everything is ok, FALSE if err is set
+ */
+gboolean
+lr_daemon_download_packages(const char *socket_path,
+                            GSList *targets,
+                            LrPackageDownloadFlag flags,
+                            GError **err);
+
+/** @} */
+
+G_END_DECLS
+
+#endif
@@ -0,0 +1,176 @@
+/* librepo - A library providing (libcURL like) API to downloading repository
+ * Copyright (C) 2014  Tomas Mlcoch
+ *
+ * Licensed under the GNU Lesser General Public License Version 2.1
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#ifndef __LR_DAEMON_INTERNAL_H__
+#define __LR_DAEMON_INTERNAL_H__
+
+#include <glib.h>
+
+#include "daemon.h"
+
+G_BEGIN_DECLS
+
+/** Protocol between the clients and librepod.
+ * A message is a key file preceded by its length in decimal and
+ * a newline. The client sends one request and the daemon answers
+ * with one response on the same connection.
+ *
+ * Request:  [request] version, type ("perform" or "download"),
+ *           flags, handles, targets
+ *           [handle N] options of the N-th handle
+ *           [target N] the N-th package target, handle is the index
+ *           of its handle or -1
+ * Response: [response] ok, domain, code, message (if not ok)
+ *           [target N] err, local_path and status (if the target
+ *           was finished) of the N-th target
+ */
+
+#define LR_DAEMON_VERSION           1   /*!< Version of the protocol */
+#define LR_DAEMON_MAX_MESSAGE       (64 * 1024 * 1024) /*!< Max size of a message */
+
+#define LR_DAEMON_REQUEST           "request"
+#define LR_DAEMON_RESPONSE          "response"
+#define LR_DAEMON_TYPE_PERFORM      "perform"
+#define LR_DAEMON_TYPE_DOWNLOAD     "download"
+
+/** Connect to the socket of the daemon.
+ * @param socket_path   Path of the socket or NULL for the default
+ * @param err           GError **
+ * @return              Connected socket or -1
+ */
+int
+lr_daemon_connect(const char *socket_path, GError **err);
+
+/** Send a message.
+ * @param fd            Socket
+ * @param msg           Message
+ * @param err           GError **
+ * @return              TRUE if the message was sent
+ */
+gboolean
+lr_daemon_send(int fd, GKeyFile *msg, GError **err);
+
+/** Receive a message.
+ * @param fd            Socket
+ * @param err           GError **
+ * @return              Message or NULL (also if the connection is closed)
+ */
+GKeyFile *
+lr_daemon_receive(int fd, GError **err);
+
+/** Name of the group of the N-th handle or target of a message.
+ * @param prefix        "handle" or "target"
+ * @param index         Index
+ * @return              Newly allocated name of the group
+ */
+gchar *
+lr_daemon_group(const char *prefix, gint64 index);
+
+/** Store the options of the handle to the group of the message.
+ * @param handle        Handle
+ * @param msg           Message
+ * @param group         Group
+ */
+void
+lr_daemon_handle_to_keyfile(LrHandle *handle,
+                            GKeyFile *msg,
+                            const char *group);
+
+/** Identity of the repository of the handle stored in the group.
+ * Requests with the same identity could be served by the same handle.
+ * @param msg           Message
+ * @param group         Group
+ * @return              Newly allocated key
+ */
+gchar *
+lr_daemon_handle_key(GKeyFile *msg, const char *group);
+
+/** Set the options of the handle stored in the group.
+ * @param handle        Handle
+ * @param msg           Message
+ * @param group         Group
+ * @param repo          Set the options identifying the repository
+ *                      (otherwise only the options of the request are set)
+ * @param err           GError **
+ * @return              TRUE if all options were set
+ */
+gboolean
+lr_daemon_handle_from_keyfile(LrHandle *handle,
+                              GKeyFile *msg,
+                              const char *group,
+                              gboolean repo,
+                              GError **err);
+
+/** Store the package target to the group of the message.
+ * @param target        Target
+ * @param handle_index  Index of the handle of the target or -1
+ * @param msg           Message
+ * @param group         Group
+ */
+void
+lr_daemon_packagetarget_to_keyfile(LrPackageTarget *target,
+                                   gint64 handle_index,
+                                   GKeyFile *msg,
+                                   const char *group);
+
+/** Create a package target stored in the group of the message.
+ * @param handle        Handle of the target or NULL
+ * @param msg           Message
+ * @param group         Group
+ * @param endcb         End callback
+ * @param cbdata        User data of the callback
+ * @param err           GError **
+ * @return              New target or NULL
+ */
+LrPackageTarget *
+lr_daemon_packagetarget_from_keyfile(LrHandle *handle,
+                                     GKeyFile *msg,
+                                     const char *group,
+                                     LrEndCb endcb,
+                                     void *cbdata,
+                                     GError **err);
+
+/** Store the error to the response, ok is TRUE if the error is NULL.
+ * @param msg           Message
+ * @param error         Error or NULL
+ */
+void
+lr_daemon_set_error(GKeyFile *msg, const GError *error);
+
+/** Load the repository downloaded to the directory into the result.
+ * The handle of the request is performed as LRO_LOCAL repository
+ * without checks of the files (the daemon did them).
+ * @param msg           Request
+ * @param group         Group of the handle of the request
+ * @param update        Update the result (see LRO_UPDATE)
+ * @param result        Result
+ * @param err           GError **
+ * @return              TRUE if the repository was loaded
+ */
+gboolean
+lr_daemon_load_result(GKeyFile *msg,
+                      const char *group,
+                      gboolean update,
+                      LrResult *result,
+                      GError **err);
+
+G_END_DECLS
+
+#endif
@@ -0,0 +1,388 @@
+/* librepo - A library providing (libcURL like) API to downloading repository
+ * Copyright (C) 2014  Tomas Mlcoch
+ *
+ * Licensed under the GNU Lesser General Public License Version 2.1
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#define _XOPEN_SOURCE   500 // Because of pread()
+
+#include <glib.h>
+#include <assert.h>
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <zlib.h>
+#include <bzlib.h>
+#include <lzma.h>
+
+#include "rcodes.h"
+#include "util.h"
+#include "decompressor.h"
+
+#define MAGIC_LEN           6
+#define BUFFER_SIZE         65536
+
+typedef enum {
+    LR_DC_DETECTING, /*!< Not enough data to detect the compression */
+    LR_DC_PLAIN,     /*!< Data are not compressed */
+    LR_DC_GZIP,
+    LR_DC_BZIP2,
+    LR_DC_XZ,
+} LrDecompressorType;
+
+struct _LrDecompressor {
+    int fd; /*!<
+        Output file descriptor */
+    LrDecompressorType type; /*!<
+        Detected compression */
+    unsigned char magic[MAGIC_LEN]; /*!<
+        Beginning of the data used to detect the compression */
+    size_t magic_len; /*!<
+        Number of bytes in the magic */
+    gint64 consumed; /*!<
+        Number of compressed bytes passed to the decompressor */
+    gboolean stream_end; /*!<
+        TRUE if the end of the compressed stream was reached and no
+        data followed after it (yet) */
+    char *outbuf; /*!<
+        Buffer for the decompressed data */
+    z_stream zs;
+    bz_stream bzs;
+    lzma_stream xzs;
+};
+
+LrDecompressor *
+lr_decompressor_new(int fd)
+{
+    LrDecompressor *dc = lr_malloc0(sizeof(*dc));
+    lzma_stream xzs = LZMA_STREAM_INIT;
+
+    dc->fd = fd;
+    dc->type = LR_DC_DETECTING;
+    dc->outbuf = lr_malloc(BUFFER_SIZE);
+    dc->xzs = xzs;
+    return dc;
+}
+
+gint64
+lr_decompressor_consumed(LrDecompressor *dc)
+{
+    return dc->consumed;
+}
+
+void
+lr_decompressor_free(LrDecompressor *dc)
+{
+    if (!dc)
+        return;
+
+    if (dc->type == LR_DC_GZIP)
+        inflateEnd(&dc->zs);
+    else if (dc->type == LR_DC_BZIP2)
+        BZ2_bzDecompressEnd(&dc->bzs);
+    else if (dc->type == LR_DC_XZ)
+        lzma_end(&dc->xzs);
+
+    lr_free(dc->outbuf);
+    lr_free(dc);
+}
+
+static gboolean
+write_out(LrDecompressor *dc, const char *buf, size_t len, GError **err)
+{
+    while (len > 0) {
+        ssize_t written = write(dc->fd, buf, len);
+        if (written == -1) {
+            if (errno == EINTR)
+                continue;
+            g_debug("%s: Cannot write decompressed data: %s",
+                    __func__, g_strerror(errno));
+            g_set_error(err, LR_DOWNLOADER_ERROR, LRE_IO,
+                        "Cannot write decompressed data: %s",
+                        g_strerror(errno));
+            return FALSE;
+        }
+        buf += written;
+        len -= written;
+    }
+
+    return TRUE;
+}
+
+static gboolean
+decompression_error(const char *method, int code, GError **err)
+{
+    g_debug("%s: %s decompression error (%d)", __func__, method, code);
+    g_set_error(err, LR_DOWNLOADER_ERROR, LRE_DECOMPRESSION,
+                "%s decompression error (%d)", method, code);
+    return FALSE;
+}
+
+/** Select the compression according the magic and init the decompression.
+ */
+static gboolean
+detect_compression(LrDecompressor *dc, GError **err)
+{
+    const unsigned char *m = dc->magic;
+    size_t len = dc->magic_len;
+    int rc;
+
+    if (len >= 2 && m[0] == 0x1f && m[1] == 0x8b) {
+        dc->type = LR_DC_GZIP;
+        // 15 - Max window size, +16 - Decode only gzip format
+        rc = inflateInit2(&dc->zs, 15 + 16);
+        if (rc != Z_OK) {
+            dc->type = LR_DC_PLAIN;
+            return decompression_error("gzip", rc, err);
+        }
+    } else if (len >= 3 && m[0] == 'B' && m[1] == 'Z' && m[2] == 'h') {
+        dc->type = LR_DC_BZIP2;
+        rc = BZ2_bzDecompressInit(&dc->bzs, 0, 0);
+        if (rc != BZ_OK) {
+            dc->type = LR_DC_PLAIN;
+            return decompression_error("bzip2", rc, err);
+        }
+    } else if (len >= 6 && !memcmp(m, "\xfd" "7zXZ\0", 6)) {
+        dc->type = LR_DC_XZ;
+        rc = lzma_stream_decoder(&dc->xzs, UINT64_MAX, LZMA_CONCATENATED);
+        if (rc != LZMA_OK) {
+            dc->type = LR_DC_PLAIN;
+            return decompression_error("xz", rc, err);
+        }
+    } else {
+        dc->type = LR_DC_PLAIN;
+    }
+
+    return TRUE;
+}
+
+static gboolean
+decompress_gzip(LrDecompressor *dc, const char *buf, size_t len, GError **err)
+{
+    z_stream *zs = &dc->zs;
+
+    zs->next_in = (Bytef *) buf;
+    zs->avail_in = len;
+
+    while (zs->avail_in > 0) {
+        int rc;
+
+        if (dc->stream_end) {
+            // Concatenated gzip members
+            inflateReset(zs);
+            dc->stream_end = FALSE;
+        }
+
+        zs->next_out = (Bytef *) dc->outbuf;
+        zs->avail_out = BUFFER_SIZE;
+        rc = inflate(zs, Z_NO_FLUSH);
+        if (rc != Z_OK && rc != Z_STREAM_END && rc != Z_BUF_ERROR)
+            return decompression_error("gzip", rc, err);
+        if (!write_out(dc, dc->outbuf, BUFFER_SIZE - zs->avail_out, err))
+            return FALSE;
+        if (rc == Z_STREAM_END)
+            dc->stream_end = TRUE;
+    }
+
+    return TRUE;
+}
+
+static gboolean
+decompress_bzip2(LrDecompressor *dc, const char *buf, size_t len, GError **err)
+{
+    bz_stream *bzs = &dc->bzs;
+
+    bzs->next_in = (char *) buf;
+    bzs->avail_in = len;
+
+    while (bzs->avail_in > 0) {
+        int rc;
+
+        if (dc->stream_end) {
+            // Concatenated bzip2 streams
+            BZ2_bzDecompressEnd(bzs);
+            rc = BZ2_bzDecompressInit(bzs, 0, 0);
+            if (rc != BZ_OK)
+                return decompression_error("bzip2", rc, err);
+            dc->stream_end = FALSE;
+        }
+
+        bzs->next_out = dc->outbuf;
+        bzs->avail_out = BUFFER_SIZE;
+        rc = BZ2_bzDecompress(bzs);
+        if (rc != BZ_OK && rc != BZ_STREAM_END)
+            return decompression_error("bzip2", rc, err);
+        if (!write_out(dc, dc->outbuf, BUFFER_SIZE - bzs->avail_out, err))
+            return FALSE;
+        if (rc == BZ_STREAM_END)
+            dc->stream_end = TRUE;
+    }
+
+    return TRUE;
+}
+
+static gboolean
+decompress_xz(LrDecompressor *dc,
+              const char *buf,
+              size_t len,
+              lzma_action action,
+              GError **err)
+{
+    lzma_stream *xzs = &dc->xzs;
+
+    xzs->next_in = (const uint8_t *) buf;
+    xzs->avail_in = len;
+
+    while (xzs->avail_in > 0 || (action == LZMA_FINISH && !dc->stream_end)) {
+        lzma_ret rc;
+
+        xzs->next_out = (uint8_t *) dc->outbuf;
+        xzs->avail_out = BUFFER_SIZE;
+        rc = lzma_code(xzs, action);
+        if (rc == LZMA_BUF_ERROR && action == LZMA_FINISH)
+            break;  // Truncated data
+        if (rc != LZMA_OK && rc != LZMA_STREAM_END)
+            return decompression_error("xz", rc, err);
+        if (!write_out(dc, dc->outbuf, BUFFER_SIZE - xzs->avail_out, err))
+            return FALSE;
+        if (rc == LZMA_STREAM_END)
+            dc->stream_end = TRUE;
+    }
+
+    return TRUE;
+}
+
+static gboolean
+decompress(LrDecompressor *dc, const char *buf, size_t len, GError **err)
+{
+    switch (dc->type) {
+    case LR_DC_PLAIN:
+        return write_out(dc, buf, len, err);
+    case LR_DC_GZIP:
+        return decompress_gzip(dc, buf, len, err);
+    case LR_DC_BZIP2:
+        return decompress_bzip2(dc, buf, len, err);
+    case LR_DC_XZ:
+        return decompress_xz(dc, buf, len, LZMA_RUN, err);
+    default:
+        assert(0);
+        return FALSE;
+    }
+}
+
+/** Detect the compression from the collected magic and
+ * pass the magic to the decompression.
+ */
+static gboolean
+flush_magic(LrDecompressor *dc, GError **err)
+{
+    if (!detect_compression(dc, err))
+        return FALSE;
+    return decompress(dc, (const char *) dc->magic, dc->magic_len, err);
+}
+
+gboolean
+lr_decompressor_write(LrDecompressor *dc,
+                      const char *buf,
+                      size_t len,
+                      GError **err)
+{
+    assert(dc);
+    assert(!err || *err == NULL);
+
+    dc->consumed += len;
+
+    if (dc->type == LR_DC_DETECTING) {
+        size_t missing = MAGIC_LEN - dc->magic_len;
+        size_t to_copy = MIN(missing, len);
+
+        memcpy(dc->magic + dc->magic_len, buf, to_copy);
+        dc->magic_len += to_copy;
+        buf += to_copy;
+        len -= to_copy;
+
+        if (dc->magic_len < MAGIC_LEN)
+            return TRUE;
+
+        if (!flush_magic(dc, err))
+            return FALSE;
+    }
+
+    if (len == 0)
+        return TRUE;
+
+    return decompress(dc, buf, len, err);
+}
+
+gboolean
+lr_decompressor_finish(LrDecompressor *dc, GError **err)
+{
+    assert(dc);
+    assert(!err || *err == NULL);
+
+    if (dc->type == LR_DC_DETECTING && !flush_magic(dc, err))
+        return FALSE;
+
+    if (dc->type == LR_DC_XZ && !decompress_xz(dc, NULL, 0, LZMA_FINISH, err))
+        return FALSE;
+
+    if (dc->type != LR_DC_PLAIN && !dc->stream_end) {
+        g_debug("%s: Unexpected end of compressed data", __func__);
+        g_set_error(err, LR_DOWNLOADER_ERROR, LRE_DECOMPRESSION,
+                    "Unexpected end of compressed data");
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+gboolean
+lr_decompress_fd(int in_fd, int out_fd, GError **err)
+{
+    gboolean ret = TRUE;
+    off_t offset = 0;
+    char *buf = lr_malloc(BUFFER_SIZE);
+    LrDecompressor *dc = lr_decompressor_new(out_fd);
+
+    assert(!err || *err == NULL);
+
+    while (ret) {
+        ssize_t len = pread(in_fd, buf, BUFFER_SIZE, offset);
+        if (len == -1) {
+            if (errno == EINTR)
+                continue;
+            g_debug("%s: Cannot read compressed data: %s",
+                    __func__, g_strerror(errno));
+            g_set_error(err, LR_DOWNLOADER_ERROR, LRE_IO,
+                        "Cannot read compressed data: %s",
+                        g_strerror(errno));
+            ret = FALSE;
+            break;
+        }
+        if (len == 0)
+            break;
+        offset += len;
+        ret = lr_decompressor_write(dc, buf, len, err);
+    }
+
+    if (ret)
+        ret = lr_decompressor_finish(dc, err);
+
+    lr_decompressor_free(dc);
+    lr_free(buf);
+    return ret;
+}
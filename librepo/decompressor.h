@@ -0,0 +1,88 @@
+/* librepo - A library providing (libcURL like) API to downloading repository
+ * Copyright (C) 2014  Tomas Mlcoch
+ *
+ * Licensed under the GNU Lesser General Public License Version 2.1
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#ifndef __LR_DECOMPRESSOR_H__
+#define __LR_DECOMPRESSOR_H__
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/** Streaming decompressor.
+ * Compression (gzip, bzip2, xz) is detected from the first bytes
+ * of the data. Data which are not compressed by any of the supported
+ * methods are written out unchanged.
+ */
+typedef struct _LrDecompressor LrDecompressor;
+
+/** Create a new decompressor.
+ * @param fd        File descriptor where the decompressed data are written.
+ *                  The descriptor is not closed by the decompressor.
+ * @return          New decompressor
+ */
+LrDecompressor *
+lr_decompressor_new(int fd);
+
+/** Decompress a next chunk of the compressed data.
+ * @param dc        Decompressor
+ * @param buf       Compressed data
+ * @param len       Length of the data
+ * @param err       GError **
+ * @return          TRUE if everything is ok, FALSE if err is set.
+ */
+gboolean
+lr_decompressor_write(LrDecompressor *dc,
+                      const char *buf,
+                      size_t len,
+                      GError **err);
+
+/** Finish the decompression. Fails if the compressed stream is incomplete.
+ * @param dc        Decompressor
+ * @param err       GError **
+ * @return          TRUE if everything is ok, FALSE if err is set.
+ */
+gboolean
+lr_decompressor_finish(LrDecompressor *dc, GError **err);
+
+/** Number of compressed bytes passed to the decompressor so far.
+ * @param dc        Decompressor
+ * @return          Number of bytes
+ */
+gint64
+lr_decompressor_consumed(LrDecompressor *dc);
+
+/** Free the decompressor.
+ * @param dc        Decompressor
+ */
+void
+lr_decompressor_free(LrDecompressor *dc);
+
+/** Decompress whole content of the in_fd (from its beginning) to the out_fd.
+ * @param in_fd     File descriptor with the compressed data
+ * @param out_fd    File descriptor where the decompressed data are written
+ * @param err       GError **
+ * @return          TRUE if everything is ok, FALSE if err is set.
+ */
+gboolean
+lr_decompress_fd(int in_fd, int out_fd, GError **err);
+
+G_END_DECLS
+
+#endif
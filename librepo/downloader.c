@@ -18,7 +18,8 @@
  * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
  */
 
-#define _XOPEN_SOURCE   500 // Because of fdopen() and ftruncate()
+#define _GNU_SOURCE         // Because of fallocate() and sync_file_range()
+#define _XOPEN_SOURCE   500 // Because of fdopen(), ftruncate() and pwrite()
 
 #include <glib.h>
 #include <assert.h>
@@ -26,20 +27,51 @@
 #include <unistd.h>
 #include <string.h>
 #include <errno.h>
+#include <signal.h>
+#include <time.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/ioctl.h>
 #include <fcntl.h>
 #include <curl/curl.h>
+#ifdef __linux__
+#include <linux/fs.h>       // Because of FICLONE
+#endif
+
+// syncfs() is available since glibc 2.14
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 14))
+#define LR_HAVE_SYNCFS
+#endif
 
+#include "asyncio.h"
 #include "downloader.h"
+#include "downloader_internal.h"
 #include "rcodes.h"
 #include "util.h"
 #include "downloadtarget.h"
 #include "downloadtarget_internal.h"
 #include "handle.h"
 #include "handle_internal.h"
+#include "mirrorhealth.h"
+#include "mirrorregistry_internal.h"
+#include "multipart.h"
+#include "probes.h"
+#include "resumejournal.h"
 #include "cleanup.h"
 #include "url_substitution.h"
+#include "checksum.h"
+#include "checksum_internal.h"
+#include "decompressor.h"
+
+#if LR_CURL_VERSION_CHECK(7, 16, 0)
+// curl_multi_socket_action() and CURLMOPT_TIMERFUNCTION are available
+#define LR_SOCKET_ENGINE
+#include <poll.h>
+#ifdef __linux__
+#define LR_USE_EPOLL
+#include <sys/epoll.h>
+#endif
+#endif
 
 volatile sig_atomic_t lr_interrupt = 0;
 
@@ -49,11 +81,59 @@ lr_sigint_handler(G_GNUC_UNUSED int sig)
     lr_interrupt = 1;
 }
 
+// The SIGINT handler is process-wide, concurrent downloads which
+// want to be interruptible share it
+G_LOCK_DEFINE_STATIC(sigint_handler);
+static guint sigint_handler_users = 0;
+static struct sigaction sigint_handler_old;
+
+gboolean
+lr_sigint_handler_setup(void)
+{
+    gboolean ret = TRUE;
+
+    G_LOCK(sigint_handler);
+    if (sigint_handler_users == 0) {
+        struct sigaction sigact;
+        g_debug("%s: Using own SIGINT handler", __func__);
+        memset(&sigact, 0, sizeof(sigact));
+        sigemptyset(&sigact.sa_mask);
+        sigact.sa_handler = lr_sigint_handler;
+        sigaddset(&sigact.sa_mask, SIGINT);
+        // As lr_download_packages() always did, interrupted syscalls of
+        // the other threads are restarted, the download loops notice
+        // lr_interrupt within their wait timeout (at most 1s) anyway
+        sigact.sa_flags = SA_RESTART;
+        if (sigaction(SIGINT, &sigact, &sigint_handler_old) == -1)
+            ret = FALSE;
+    }
+    if (ret)
+        sigint_handler_users++;
+    G_UNLOCK(sigint_handler);
+
+    return ret;
+}
+
+void
+lr_sigint_handler_restore(void)
+{
+    G_LOCK(sigint_handler);
+    assert(sigint_handler_users > 0);
+    if (--sigint_handler_users == 0) {
+        g_debug("%s: Restoring an old SIGINT handler", __func__);
+        sigaction(SIGINT, &sigint_handler_old, NULL);
+    }
+    G_UNLOCK(sigint_handler);
+}
+
 typedef enum {
     LR_DS_WAITING, /*!<
         The target is waiting to be processed. */
     LR_DS_RUNNING, /*!<
         The transfer is running. */
+    LR_DS_VERIFYING, /*!<
+        The transfer is finished and the checksum of the downloaded
+        file is being calculated by the verifier. */
     LR_DS_FINISHED, /*!<
         The transfer is successfully finished. */
     LR_DS_FAILED, /*!<
@@ -78,22 +158,209 @@ typedef struct {
     GSList *lrmirrors; /*!<
         List of LrMirrors created from the handle internal mirrorlist
         (could be NULL) */
+    GSList *cachemirrors; /*!<
+        List of LrMirrors of the LRO_CACHESOURCES of the handle
+        (could be NULL) */
+    LrInternalMirrorlist *cachelist; /*!<
+        Internal mirrors of the cachemirrors */
 } LrHandleMirrors;
 
+/** Token bucket shared by all transfers which limits their total speed.
+ * Every transfer takes tokens (bytes) from the bucket before it writes
+ * received data. If the bucket is empty, the transfer is paused until
+ * the bucket is refilled. Tokens not used by slow transfers are left
+ * to the other transfers.
+ */
+typedef struct _LrBandwidthLimiter {
+    gint64 max_speed; /*!<
+        Maximal total speed in bytes per sec */
+    gdouble tokens; /*!<
+        Number of bytes which could be received now. Could be negative
+        if the last transfer received more data than was available. */
+    gint64 last_refill; /*!<
+        Monotonic time (usec) of the last refill of the bucket */
+    guint paused_transfers; /*!<
+        Number of transfers paused because of empty bucket */
+    struct _LrBandwidthLimiter *shared; /*!<
+        Limiter of all shards of a sharded download whose bucket is used
+        instead of the own one (see LRO_DOWNLOADSHARDS) or NULL */
+    GMutex *lock; /*!<
+        Lock of the bucket if the limiter is shared by the shards,
+        NULL otherwise */
+} LrBandwidthLimiter;
+
 typedef struct {
     LrInternalMirror *mirror; /*!<
         Mirror */
+    guint index; /*!<
+        Ordinal number of the mirror in the list of LrMirrors of its
+        handle. Used as an index to the LrTarget's tried_mirrors bitset. */
     int running_transfers; /*!<
         How many transfers from this mirror are currently in progres. */
     int successful_transfers; /*!<
         How many transfers was finished successfully from the mirror. */
     int failed_transfers; /*!<
         How many transfers failed. */
+    gboolean multiplexed; /*!<
+        TRUE if the mirror negotiated HTTP/2 and transfers from it
+        are multiplexed over shared connections. */
+    gdouble speed; /*!<
+        Exponentially weighted moving average of throughput of transfers
+        from the mirror (bytes/sec) or 0.0 if unknown. */
+    gdouble ttfb; /*!<
+        Exponentially weighted moving average of time to first byte
+        of transfers from the mirror (sec). */
+    int allowed_transfers; /*!<
+        Current maximal number of transfers from the mirror if
+        LRO_ADAPTIVEDOWNLOADSPERMIRROR is enabled. 0 if not set yet. */
+    gboolean growing; /*!<
+        TRUE if the allowed_transfers were increased last time. */
+    gdouble level_speed; /*!<
+        Sum of throughputs of transfers finished with the current
+        allowed_transfers divided by their number and multiplied by
+        the number of running transfers (bytes/sec). */
+    int level_samples; /*!<
+        Number of transfers finished with the current allowed_transfers */
+    gdouble prev_level_speed; /*!<
+        Total throughput measured with the previous allowed_transfers */
+    gboolean cache; /*!<
+        TRUE if the mirror is a cache source (LRO_CACHESOURCES). It is
+        not in the lrmirrors, its misses are not counted as failures
+        and its tries are not counted to the num_of_tried_mirrors. */
+    guint64 downloaded_bytes; /*!<
+        Number of bytes received by all finished transfers from
+        the mirror (see LRI_STATS) */
+    gdouble transfer_time; /*!<
+        Sum of the total times of finished transfers (sec) */
+    int retries; /*!<
+        How many finished transfers were of a target which had been
+        tried from another mirror before. */
+    gdouble prior_successful; /*!<
+        Decayed number of successful transfers from the host of the mirror
+        in the previous runs (see LRO_MIRRORHEALTHCACHE) */
+    gdouble prior_failed; /*!<
+        Decayed number of failed transfers in the previous runs */
+    char *last_error; /*!<
+        Message of the last failed transfer or NULL */
+    int consecutive_failures; /*!<
+        Number of failed transfers since the last successful one */
+    guint breaker_trips; /*!<
+        How many times the circuit breaker opened since the last
+        successful transfer (see LRO_MIRRORBREAKER) */
+    gint64 breaker_until; /*!<
+        Monotonic time (usec) until which the circuit breaker is open.
+        0 if the breaker is closed. */
+    gboolean breaker_probing; /*!<
+        TRUE if the breaker is half-open and the probe transfer
+        was started */
+    guint64 metrics_bytes; /*!<
+        Number of bytes received from the mirror at the last call
+        of the LRO_METRICSCB */
+    gint *shard_transfers; /*!<
+        Number of running transfers from the mirror in all shards
+        of a sharded download (owned by the LrShardGroup) or NULL */
+    guint idle_connections; /*!<
+        Number of connections to the mirror released by successfully
+        finished transfers and not used by a new transfer yet
+        (see LRO_CONNECTIONAFFINITY) */
+    gint64 idle_since; /*!<
+        Monotonic time (usec) when the last connection was released */
 } LrMirror;
 
-typedef struct {
+/** State of a running (or just finished) transfer of a target.
+ * It is allocated when the transfer is prepared and freed together with
+ * the file of the transfer, so the targets which are waiting (often
+ * the most of them) stay small.
+ */
+typedef struct _LrTransfer {
+    char errorbuffer[CURL_ERROR_SIZE]; /*!<
+        Error buffer used in curl handle */
+    LrHeaderCbState headercb_state; /*!<
+        State of the header callback for current transfer */
+    gchar *headercb_interrupt_reason; /*!<
+        Reason why was the transfer interrupted */
+    gboolean range_requested; /*!<
+        The byte range of the target was requested from the server
+        (only the range is sent, the connection stays reusable) */
+    gboolean encoding_requested; /*!<
+        A compressed transfer was negotiated by Accept-Encoding
+        (see LrDownloadTarget.contentencoding) */
+    gboolean content_encoded; /*!<
+        The response is compressed (Content-Encoding), curl decodes it */
+    gint64 content_length; /*!<
+        Content-Length of the response if encoding_requested. It is
+        checked at the end of the headers unless the response is encoded,
+        then it is the size of the encoded data. */
+    gboolean writecb_required_range_written; /*!<
+        If a byte range was specified to download and the
+        range was downloaded, it is TRUE. Otherwise FALSE. */
+    char *writebuf; /*!<
+        Buffer for downloaded data which are written out by positioned
+        writes. NULL if the data are written through the f. */
+    size_t writebuf_size; /*!<
+        Size of the writebuf. */
+    size_t writebuf_used; /*!<
+        Number of bytes currently stored in the writebuf. */
+    gint64 write_offset; /*!<
+        Offset in the file where the data from writebuf belong. */
+    gboolean early_writeback; /*!<
+        See LRO_EARLYWRITEBACK */
+    LrAsyncIo *aio; /*!<
+        If set, the writebuf is written asynchronously (see LRO_IOURING)
+        and a new one is filled meanwhile */
+    char *writebuf_pending; /*!<
+        Buffer which is being written by the write_req (or was written
+        by it). Used only with aio. */
+    LrAsyncIoReq write_req; /*!<
+        Asynchronous write of the writebuf_pending */
+    gboolean verify_pieces; /*!<
+        TRUE if the pieces of the target (LrDownloadTarget.pieces)
+        are verified on the fly from the data written by lr_writecb() */
+    LrChecksumCtx *piece_ctx; /*!<
+        Checksum of the current piece or NULL if no data of the piece
+        were written yet */
+    guint piece_index; /*!<
+        Index of the current piece */
+    gint64 piece_done; /*!<
+        Number of bytes of the current piece written so far */
+    gchar *url; /*!<
+        URL of the transfer if the target uses a resume journal
+        (see LRO_RESUMEJOURNAL), NULL otherwise */
+    LrResumeJournal *journal; /*!<
+        Journal of the partial file the transfer continues or NULL */
+    gboolean if_range; /*!<
+        The rest of the file was requested with If-Range, the server
+        sends the whole file if it was changed */
+    LrMultipart *multipart; /*!<
+        Parser of the multipart/byteranges response to the request
+        of a batch of byte ranges (see LRO_MAXRANGESPERREQUEST) or NULL */
+    gboolean batch_started; /*!<
+        The response to the request of the batch was already checked
+        by lr_writecb_batch() */
+    gboolean batch_whole; /*!<
+        The server ignored the ranges of the batch and sends the whole
+        object, the transfer is interrupted after the batch_end */
+    gint64 batch_offset; /*!<
+        Offset in the object of the next byte of a response to the batch
+        which is not a multipart one */
+    gint64 batch_end; /*!<
+        The last byte of the object wanted by the batch */
+    gint64 batch_range_start; /*!<
+        The first byte of the Content-Range of the last response
+        to the batch or -1 */
+    LrProxyPool *proxypool; /*!<
+        Pool of the proxy of the transfer (see LRO_PROXIES) or NULL */
+    LrProxy *proxy; /*!<
+        Proxy of the transfer acquired from the proxypool or NULL */
+} LrTransfer;
+
+typedef struct _LrTarget {
     LrDownloadState state; /*!<
         State of the download (transfer). */
+    LrBandwidthLimiter *limiter; /*!<
+        Limiter of the total speed of transfers or NULL */
+    gboolean paused; /*!<
+        TRUE if the transfer is paused by the limiter */
     LrDownloadTarget *target; /*!<
         Download target */
     LrMirror *mirror; /*!<
@@ -114,11 +381,16 @@ typedef struct {
     FILE *f; /*!<
         fdopened file descriptor from LrDownloadTarget and used
         in curl_handle. */
-    char errorbuffer[CURL_ERROR_SIZE]; /*!<
-        Error buffer used in curl handle */
-    GSList *tried_mirrors; /*!<
-        List of already tried mirrors (LrMirror *).
+    struct _LrTransfer *transfer; /*!<
+        State of the current transfer of the target or NULL if the
+        target is not transferred (waiting targets don't carry it). */
+    guint32 *tried_mirrors; /*!<
+        Bitset of already tried mirrors indexed by LrMirror's index.
         This mirrors won't be tried again. */
+    guint tried_mirrors_words; /*!<
+        Number of allocated words of the tried_mirrors bitset */
+    guint num_of_tried_mirrors; /*!<
+        How many times a download of the target was tried */
     gint64 original_offset; /*!<
         If resume is enabled, this is the specified offset where to resume
         the downloading. If resume is not enabled, then value is -1. */
@@ -126,22 +398,311 @@ typedef struct {
         List of all available mirors (LrMirror *).
         This list is generated from LrHandle related to this target
         and is common for all targets that uses the handle. */
+    GSList *cachemirrors; /*!<
+        List of the cache sources (LrMirror *) tried before the lrmirrors
+        if the target uses them. Common for all targets of the handle. */
     LrHandle *handle; /*!<
         LrHandle associated with this target */
-    LrHeaderCbState headercb_state; /*!<
-        State of the header callback for current transfer */
-    gchar *headercb_interrupt_reason; /*!<
-        Reason why was the transfer interrupted */
+    struct curl_slist *curl_headers; /*!<
+        Extra headers of the current transfer (a conditional request)
+        or NULL */
+    gchar *etag; /*!<
+        ETag of the response of a conditional request (or of a transfer
+        with a resume journal) or NULL */
+    gint64 lastmodified; /*!<
+        Last-Modified (Unix time) of the response of a conditional
+        request or -1 */
+    gboolean notmodified; /*!<
+        The server answered the conditional request by 304 Not Modified */
     gint64 writecb_recieved; /*!<
         Total number of bytes recieved by the write function
         during the current transfer. */
-    gboolean writecb_required_range_written; /*!<
-        If a byte range was specified to download and the
-        range was downloaded, it is TRUE. Otherwise FALSE. */
     LrCbReturnCode cb_return_code; /*!<
         Last cb return code. */
+    gboolean endcb_queued; /*!<
+        The end callback of the target was queued for the end callback
+        threads and didn't return yet (see LRO_ENDCBTHREADS) */
+    GSList *checksum_ctxs; /*!<
+        List of LrStreamChecksum - checksums calculated on the fly
+        from the data written by lr_writecb(). NULL if the checksums are
+        not calculated during the transfer (e.g. a byte range is
+        downloaded) and they have to be calculated from the file. */
+    gint64 checksum_ctxs_len; /*!<
+        Number of bytes (including the already existing beginning of
+        the file) used to calculate checksum_ctxs. */
+    struct _LrTarget *parent; /*!<
+        If the target is a segment of a segmented target, this is
+        the LrTarget of the whole file. NULL otherwise. */
+    GSList *segments; /*!<
+        List of segments (LrTarget *) if the target was split
+        into segments. Its state is LR_DS_RUNNING until all the segments
+        are finished. */
+    gboolean segmentation_tried; /*!<
+        TRUE if the target was already split into segments. If the
+        segmented download fails, the target is downloaded as a whole. */
+    gint64 segment_start; /*!<
+        Offset of the first byte of the segment. */
+    gint64 segment_end; /*!<
+        Offset of the last byte of the segment. */
+    gint64 segment_written; /*!<
+        Number of bytes of the segment written during the current
+        transfer. */
+    struct _LrTarget *hedge; /*!<
+        Hedged request (LrTarget *) for the rest of the file if it was
+        started for this target (see LRO_HEDGEDDOWNLOADS), NULL otherwise */
+    struct _LrTarget *hedged; /*!<
+        If the target is a hedged request, this is the LrTarget of
+        the file whose rest is downloaded by the request. NULL otherwise.
+        The range of the request is set by segment_start and segment_end. */
+    gboolean hedge_tried; /*!<
+        TRUE if a hedged request was already started for the target */
+    gint64 queued_at; /*!<
+        Monotonic time (usec) when the target was queued the last time */
+    gint64 transfer_start; /*!<
+        Monotonic time (usec) when the current transfer started */
+    gboolean resume_from_offset; /*!<
+        TRUE if the transfer continues from the original_offset, because
+        the previous transfer was too slow (see LRO_LOWSPEEDRESUME) */
+    guint64 queue_seq; /*!<
+        Sequence number of the target. Used to keep order of targets
+        which are equal by the LrDownloadOrder. */
+    GSequenceIter *queue_iter; /*!<
+        Position of the target in the queue of waiting targets or NULL
+        if the target is not waiting. */
+    guint running_index; /*!<
+        Position of the target in LrDownload.running_transfers
+        if the target is transferred */
+    gint64 progress_interval; /*!<
+        See LRO_PROGRESSINTERVAL (usec) */
+    gint64 last_progress; /*!<
+        Monotonic time (usec) of the last call of the progress callback */
+    double progress_total; /*!<
+        Total size reported by the last progress tick */
+    double progress_now; /*!<
+        Downloaded size reported by the last progress tick */
+    int memfd; /*!<
+        In-memory file of a target without fd and fn or -1.
+        Valid only for targets which are not segments or hedged
+        requests, use target_fd(). */
+    gchar *partfn; /*!<
+        Temporary file the target with fn is downloaded to
+        (LRO_ATOMICDOWNLOAD) or NULL. Valid only for targets which
+        are not segments or hedged requests, use target_fn(). */
+    LrDecompressor *decompressor; /*!<
+        Decompressor of the data written by lr_writecb() to the
+        decompressfd of the target. NULL if the data are not decompressed
+        during the transfer and they have to be decompressed from the file. */
+    gboolean streaming; /*!<
+        TRUE if the data written by lr_writecb() are passed to the datacb
+        of the target. */
+    GSList *duplicates; /*!<
+        Targets (LrTarget *) of the same file which get a copy of
+        the file of this target instead of their own download. */
+    struct _LrTarget *original; /*!<
+        If the target is a duplicate, this is the LrTarget whose file
+        it gets. The duplicate is not queued and stays LR_DS_WAITING
+        until the original is finished. NULL otherwise. */
+    GArray *bad_pieces; /*!<
+        Indexes (guint) of the pieces of the target which didn't match
+        during the last transfer (see LrDownloadTarget.pieces) or NULL */
+    gboolean repair_tried; /*!<
+        TRUE if the damaged pieces of the target were already downloaded
+        again. If the repaired file doesn't match, the target is
+        downloaded as a whole. */
+    gint64 journal_offset; /*!<
+        Number of bytes of the partial file recorded by its saved resume
+        journal (see LRO_RESUMEJOURNAL) or 0 if no journal was saved */
+    GSList *outputs; /*!<
+        States (LrTargetOutput) of the additional outputs of the target
+        (LrDownloadTarget.outputs) or NULL */
+    GSList *range_batch; /*!<
+        Targets (LrTarget *) whose byte ranges of the same object are
+        requested together with the range of this target by its current
+        transfer (see LRO_MAXRANGESPERREQUEST) or NULL */
+    struct _LrTarget *batch_leader; /*!<
+        If the range of the target is requested by the transfer of another
+        target, this is the target. The target is not queued and stays
+        LR_DS_WAITING until the transfer is finished. NULL otherwise. */
+    gboolean proxy_retry; /*!<
+        The last transfer failed because of its proxy (see LRO_PROXIES),
+        the target is tried again from the same mirror */
 } LrTarget;
 
+typedef struct {
+    GSList *checksums; /*!<
+        Expected checksums (LrDownloadTargetChecksum owned by
+        LrDownloadTarget) of the type calculated by the ctx */
+    LrChecksumCtx *ctx; /*!<
+        Context of checksum calculated on the fly */
+} LrStreamChecksum;
+
+typedef struct {
+    LrDownloadTargetOutput *output; /*!<
+        Output (owned by LrDownloadTarget) */
+    int fd; /*!<
+        Opened file of a LR_OUTPUT_FN output or -1 */
+    GByteArray *data; /*!<
+        Data collected for a LR_OUTPUT_MEMORY output */
+    gboolean streaming; /*!<
+        TRUE if the data written by lr_writecb() are passed to
+        the output */
+    gboolean stopped; /*!<
+        The callback of a LR_OUTPUT_CB output doesn't want more data */
+    gint64 written; /*!<
+        Number of bytes passed to the output since it was started */
+} LrTargetOutput;
+
+/** Checksum verification of a downloaded file done by the verifier
+ * out of the download loop.
+ */
+typedef struct {
+    LrTarget *target; /*!<
+        Target in the LR_DS_VERIFYING state */
+    int fd; /*!<
+        File descriptor of the downloaded file */
+    gboolean assembled; /*!<
+        TRUE if the file was downloaded by parts (see
+        finish_assembled_target()). The fd is owned by the verification
+        then, otherwise it belongs to the still open file of the target. */
+    gchar *effective_url; /*!<
+        Effective URL of the transfer or NULL */
+    gboolean check_pieces; /*!<
+        If TRUE and the checksum doesn't match, the pieces of the file
+        are verified to find the damaged ones (see bad_pieces) */
+
+    // Items filled by the verifier
+
+    gint64 start; /*!<
+        Monotonic time (usec) when the verification started */
+    gint64 end; /*!<
+        Monotonic time (usec) when the verification finished */
+
+    gboolean ret; /*!<
+        FALSE if the checksum couldn't be calculated (see err) */
+    gboolean matches; /*!<
+        TRUE if a checksum matches */
+    GError *err; /*!<
+        Error of the checksum calculation */
+    GArray *bad_pieces; /*!<
+        Indexes (guint) of the damaged pieces or NULL if the pieces
+        were not verified */
+} LrVerification;
+
+/** Call of the end callback of a finished target by the end callback
+ * threads out of the download loop (see LRO_ENDCBTHREADS).
+ */
+typedef struct {
+    LrTarget *target; /*!<
+        Finished or failed target */
+    LrTransferStatus status; /*!<
+        Status passed to the callback */
+    gchar *msg; /*!<
+        Message passed to the callback or NULL */
+    int ret; /*!<
+        Return value of the callback (filled by the thread) */
+} LrEndCbCall;
+
+/** Data shared by the shards of a sharded download (see
+ * LRO_DOWNLOADSHARDS). Every shard is a LrDownload with its own
+ * download loop, run by its own thread.
+ */
+typedef struct {
+    GMutex lock; /*!<
+        Lock of the targets, the mirror_transfers, the failure and of
+        the handles while a shard merges its statistics to them */
+    GSList *targets; /*!<
+        Targets (LrDownloadTarget *) not taken by any shard yet
+        (the list is owned by the caller of lr_download()) */
+    GHashTable *mirror_transfers; /*!<
+        Running transfers (gint *) of all shards by the URL
+        of the mirror */
+    GMutex limiter_lock; /*!<
+        Lock of the limiter */
+    LrBandwidthLimiter limiter; /*!<
+        Limiter of the total speed of all shards (see LRO_MAXSPEED) */
+    guint shards; /*!<
+        Number of the shards */
+    int max_parallel_connections; /*!<
+        LRO_MAXPARALLELDOWNLOADS split among the shards */
+    gint64 start_time; /*!<
+        Monotonic time (usec) when the shards were started */
+    gint failed; /*!<
+        TRUE (set atomically) when a shard failed, the other shards
+        are interrupted then */
+    guint failed_shard; /*!<
+        Index of the first failed shard, its error is returned */
+    GMutex cb_lock; /*!<
+        Lock which serializes the callbacks called by the shards */
+    GAsyncQueue *endcb_calls; /*!<
+        Calls of the end callbacks (LrShardEndCall *) made by the thread
+        which called lr_download(), NULL if they are made by the shards
+        (see LRO_SHARDENDCB). A pointer to the group itself marks
+        a finished shard. */
+    GMutex call_lock; /*!<
+        Lock of the done flags of the calls */
+    GCond call_cond; /*!<
+        Signalled when a call of an end callback is done */
+    GHashTable *handles; /*!<
+        Set of the handles (LrHandle *) whose statistics the shards
+        updated */
+} LrShardGroup;
+
+/** Shard of a sharded download */
+typedef struct {
+    LrShardGroup *group; /*!<
+        Group of the shard */
+    guint index; /*!<
+        Ordinal number of the shard */
+    gboolean failfast; /*!<
+        Fail fast */
+    GThread *thread; /*!<
+        Thread which runs the shard */
+    gboolean ret; /*!<
+        Result of the shard */
+    GError *err; /*!<
+        Error of the shard if it failed */
+} LrShard;
+
+/** Callbacks of a target of a sharded download. They are replaced
+ * in the LrDownloadTarget by the shard_*cb() functions, which call them
+ * serialized (see LrShardGroup.cb_lock).
+ */
+typedef struct {
+    LrShardGroup *group; /*!<
+        Group of the shards */
+    void *cbdata; /*!<
+        Original cbdata of the target */
+    LrProgressCb progresscb; /*!<
+        Original progresscb of the target */
+    LrEndCb endcb; /*!<
+        Original endcb of the target */
+    LrMirrorFailureCb mirrorfailurecb; /*!<
+        Original mirrorfailurecb of the target */
+    LrDataCb datacb; /*!<
+        Original datacb of the target */
+} LrShardCallbackData;
+
+/** State of the tuning of the number of parallel transfers
+ * (see LRO_AUTOTUNEPARALLELDOWNLOADS). */
+typedef struct {
+    gboolean enabled; /*!<
+        TRUE if the number of parallel transfers is tuned */
+    int allowed; /*!<
+        Current number of parallel transfers (1 to the maximal number
+        of parallel downloads) */
+    gboolean growing; /*!<
+        TRUE if the last change of the allowed increased it */
+    gint64 level_start; /*!<
+        Monotonic time (usec) when the allowed was set */
+    guint64 level_bytes; /*!<
+        Number of bytes received by the transfers finished since
+        the level_start */
+    int level_samples; /*!<
+        Number of transfers finished since the level_start */
+    gdouble prev_level_speed; /*!<
+        Total throughput measured with the previous allowed */
+} LrAutotune;
+
 typedef struct {
 
     // Configuration
@@ -149,37 +710,214 @@ typedef struct {
     gboolean failfast; /*!<
         Fail fast */
 
+    LrShard *shard; /*!<
+        Shard of a sharded download this download is, or NULL */
+
     int max_parallel_connections; /*!<
         Maximal number of parallel downloads. */
 
     int max_connection_per_host; /*!<
         Maximal number of connections per host. -1 means no limit. */
 
+    gboolean adaptive_connections; /*!<
+        See LRO_ADAPTIVEDOWNLOADSPERMIRROR */
+
+    gboolean hedged_downloads; /*!<
+        See LRO_HEDGEDDOWNLOADS */
+
+    long critical_slots; /*!<
+        See LRO_CRITICALSLOTS */
+
+    gboolean low_speed_resume; /*!<
+        See LRO_LOWSPEEDRESUME */
+
     int max_mirrors_to_try; /*!<
         Maximal number of mirrors to try. Number <= 0 means no limit. */
 
     gint64 max_speed; /*!<
         Maximal speed in bytes per sec */
 
+    LrBandwidthLimiter limiter; /*!<
+        Limiter of the total speed (used if max_speed is set) */
+
     long allowed_mirror_failures; /*!<
         See LRO_ALLOWEDMIRRORFAILURES */
 
+    long mirror_breaker; /*!<
+        See LRO_MIRRORBREAKER */
+
     long adaptivemirrorsorting; /*!<
         See LRO_ADAPTIVEMIRRORSORTING */
 
+    gboolean http2; /*!<
+        See LRO_HTTP2 */
+
+    long max_streams_per_mirror; /*!<
+        See LRO_MAXSTREAMSPERMIRROR */
+
+    long max_segments; /*!<
+        See LRO_MAXSEGMENTS */
+
+    gint64 min_segment_size; /*!<
+        See LRO_MINSEGMENTSIZE */
+
+    long max_ranges_per_request; /*!<
+        See LRO_MAXRANGESPERREQUEST */
+
+    gboolean connection_affinity; /*!<
+        See LRO_CONNECTIONAFFINITY */
+
+    LrAutotune autotune; /*!<
+        See LRO_AUTOTUNEPARALLELDOWNLOADS */
+
+    gboolean deadlines; /*!<
+        TRUE if a target has a deadline (LrDownloadTarget.deadline) */
+
+    gboolean deadline_at_risk; /*!<
+        TRUE if a target with a deadline cannot start or is not expected
+        to finish in time. No background targets are started then. */
+
+    gint cancellations; /*!<
+        Value of lr_downloadtarget_cancellations when the targets were
+        checked for cancellation the last time */
+
+    gboolean cancel_check; /*!<
+        TRUE if the targets have to be checked for cancellation even if
+        no target was cancelled since the last check */
+
+    long write_buffer_size; /*!<
+        See LRO_WRITEBUFFERSIZE */
+
+    gboolean preallocate; /*!<
+        See LRO_PREALLOCATE */
+
+    gboolean early_writeback; /*!<
+        See LRO_EARLYWRITEBACK */
+
+    gboolean iouring; /*!<
+        See LRO_IOURING */
+
+    gboolean local_hardlink; /*!<
+        See LRO_LOCALHARDLINK */
+
+    LrDurability durability; /*!<
+        See LRO_DURABILITY */
+
+    gboolean atomic_download; /*!<
+        See LRO_ATOMICDOWNLOAD */
+
+    LrDownloadOrder download_order; /*!<
+        See LRO_DOWNLOADORDER */
+
+    gint64 progress_interval; /*!<
+        See LRO_PROGRESSINTERVAL (usec) */
+
+    LrMultiProgressCb multi_progresscb; /*!<
+        See LRO_MULTIPROGRESSCB */
+
+    void *multi_progresscb_data; /*!<
+        See LRO_PROGRESSDATA */
+
+    gint64 metrics_interval; /*!<
+        See LRO_METRICSINTERVAL (usec) */
+
+    LrMetricsCb metricscb; /*!<
+        See LRO_METRICSCB */
+
+    void *metricscb_data; /*!<
+        See LRO_PROGRESSDATA */
+
     // Data
 
+    gint64 start_time; /*!<
+        Monotonic time (usec) of the lr_download_init() */
+
+    gint64 breaker_wakeup; /*!<
+        Monotonic time (usec) when the first open circuit breaker
+        which holds a waiting target becomes half-open. 0 if no target
+        waits for a breaker. */
+
+    gint64 last_multi_progress; /*!<
+        Monotonic time (usec) of the last call of the multi_progresscb */
+
+    gint64 last_metrics; /*!<
+        Monotonic time (usec) of the last call of the metricscb */
+
+    guint transfer_errors[LRE_UNKNOWNERROR+1]; /*!<
+        Number of failed transfers by their LrRc (see LRO_METRICSCB) */
+
+    GThreadPool *verifier; /*!<
+        Threads which verify checksums of downloaded files, so the
+        download loop isn't blocked by the hashing. NULL if the pool
+        couldn't be created, the files are verified by the download
+        loop then. */
+
+    GAsyncQueue *verified; /*!<
+        Queue of finished verifications (LrVerification *) */
+
+    guint verifying_transfers; /*!<
+        Number of targets in the LR_DS_VERIFYING state */
+
+    GThreadPool *endcb_pool; /*!<
+        Threads which call the end callbacks of the finished targets
+        (see LRO_ENDCBTHREADS). NULL if the end callbacks are called
+        by the download loop. */
+
+    GAsyncQueue *endcb_returned; /*!<
+        Queue of returned end callbacks (LrEndCbCall *) */
+
+    guint endcb_calls; /*!<
+        Number of end callbacks queued or running in the endcb_pool */
+
+    guint endcb_queue_size; /*!<
+        See LRO_ENDCBQUEUESIZE */
+
+    LrAsyncIo *aio; /*!<
+        Asynchronous writes of the downloaded data (see LRO_IOURING).
+        NULL if disabled or not available. */
+
     CURLM *multi_handle; /*!<
         Curl Multi handle */
 
     GSList *handle_mirrors; /*!<
         All mirrors (list of pointers to LrHandleMirrors structures) */
 
-    GSList *targets; /*!<
-        List of all targets (list of pointers to LrTarget stuctures) */
+    GPtrArray *targets; /*!<
+        All targets (pointers to LrTarget stuctures) */
+
+    GPtrArray *running_transfers; /*!<
+        Running transfers (pointers to LrTarget structures) in no
+        particular order, see add_running_transfer() */
+
+    guint critical_transfers; /*!<
+        Number of running transfers of LR_PRIORITYCLASS_CRITICAL
+        targets */
+
+    GSequence *waiting_targets; /*!<
+        Queue of waiting targets (LrTarget *) sorted by download_order */
+
+    guint64 next_queue_seq; /*!<
+        Sequence number for the next new target */
+
+    GHashTable *coalesced; /*!<
+        Targets (LrTarget *) by their URL and checksums, the later
+        targets of the same file become its duplicates */
+
+    LrTargetSourceCb sourcecb; /*!<
+        Source of the next targets (lr_download_stream()) or NULL
+        if there are no more targets to pull */
 
-    GSList *running_transfers; /*!<
-        List of running transfers (list of pointer to LrTarget structures) */
+    LrTargetReleaseCb releasecb; /*!<
+        Called for the pulled targets when they are done or NULL */
+
+    void *sourcecb_data; /*!<
+        User data for the sourcecb and the releasecb */
+
+    guint live_targets; /*!<
+        Number of targets in the targets list */
+
+    guint retire_at; /*!<
+        Done targets are released when there is so many live_targets */
 
 } LrDownload;
 
@@ -196,8 +934,8 @@ typedef struct {
  * | CURLM *multi_handle          |  |   | LrHandle *handle  |
  * |                              |  |   | GSList *lrmirrors --\
  * | GSList *handle_mirrors      ---/    +-------------------+ |
- * | GSList *targets             --\                           |
- * | GSList *running_transfers   ---\                          |
+ * | GPtrArray *targets          --\                           |
+ * | GPtrArray *running_transfers---\                          |
  * +------------------------------+  |                         |
  *                                   |                         |
  *   /------------------------------/                          |
@@ -230,7 +968,7 @@ typedef struct {
  *       | LrMirror *mirror          -------/      | LrChecksumType checks..  |
  *       | CURL *curl_handle          |-+          | char *checksum           |
  *       | FILE *f                    |            | int resume               |
- *       | GSList *tried_mirrors      |            | LrProgressCb progresscb  |
+ *       | guint32 *tried_mirrors     |            | LrProgressCb progresscb  |
  *       | gint64 original_offset     |            | void *cbdata             |
  *       | GSlist *lrmirrors         ---\          | GStringChunk *chunk      |
  *       +----------------------------+  |         | int rcode                |
@@ -239,15 +977,68 @@ typedef struct {
  */
 
 
+static void
+seed_mirror_health(long mode, LrHandle *handle, GSList *lrmirrors);
+
+/** Return the number of running transfers of all shards from the mirror
+ * with the url. The counter is created if it doesn't exist yet.
+ */
+static gint *
+shard_mirror_transfers(LrShardGroup *group, const char *url)
+{
+    gint *transfers;
+
+    g_mutex_lock(&group->lock);
+    transfers = g_hash_table_lookup(group->mirror_transfers, url);
+    if (!transfers) {
+        transfers = g_new0(gint, 1);
+        g_hash_table_insert(group->mirror_transfers, g_strdup(url), transfers);
+    }
+    g_mutex_unlock(&group->lock);
+
+    return transfers;
+}
+
+/** Lock the callbacks of a shard, so they are not called concurrently
+ * with the callbacks of other shards.
+ */
+static void
+shard_callbacks_lock(LrDownload *dd)
+{
+    if (dd->shard)
+        g_mutex_lock(&dd->shard->group->cb_lock);
+}
+
+static void
+shard_callbacks_unlock(LrDownload *dd)
+{
+    if (dd->shard)
+        g_mutex_unlock(&dd->shard->group->cb_lock);
+}
+
+/** Return the cbdata of the target as set by the user.
+ */
+static void *
+target_cbdata(LrDownload *dd, LrDownloadTarget *dtarget)
+{
+    if (dd->shard)
+        return ((LrShardCallbackData *) dtarget->cbdata)->cbdata;
+    return dtarget->cbdata;
+}
+
 /** Create GSList of LrMirrors (if it doesn't exist) for a handle.
  * If the list already exists (if more targets use the same handle)
  * then just set the list to the current target.
  * If the list doesn't exist yet, create it then create a mapping between
  * the list and the handle (LrHandleMirrors) and set the list to
- * the current target.
+ * the current target. A new list is ranked (and sorted if the mode
+ * of LRO_ADAPTIVEMIRRORSORTING is set) by the mirror health store.
  */
 static GSList *
-lr_prepare_lrmirrors(GSList *list, LrTarget *target)
+lr_prepare_lrmirrors(GSList *list,
+                     LrTarget *target,
+                     long sorting,
+                     LrShardGroup *group)
 {
     LrHandle *handle = target->handle;
 
@@ -256,11 +1047,13 @@ lr_prepare_lrmirrors(GSList *list, LrTarget *target)
         if (handle_mirrors->handle == handle) {
             // List of LrMirrors for this handle is already created
             target->lrmirrors = handle_mirrors->lrmirrors;
+            target->cachemirrors = handle_mirrors->cachemirrors;
             return list;
         }
     }
 
     GSList *lrmirrors = NULL;
+    guint index = 0;
 
     if (handle && handle->internal_mirrorlist) {
         g_debug("%s: Preparing internal mirror list for handle id: %p", __func__, handle);
@@ -280,656 +1073,724 @@ lr_prepare_lrmirrors(GSList *list, LrTarget *target)
 
             LrMirror *mirror = lr_malloc0(sizeof(*mirror));
             mirror->mirror = imirror;
+            mirror->index = index++;
+            if (group)
+                mirror->shard_transfers = shard_mirror_transfers(group,
+                                                                 imirror->url);
             lrmirrors = g_slist_append(lrmirrors, mirror);
         }
     }
 
+    if (handle)
+        seed_mirror_health(sorting, handle, lrmirrors);
+
     LrHandleMirrors *handle_mirrors = lr_malloc0(sizeof(*handle_mirrors));
     handle_mirrors->handle = handle;
     handle_mirrors->lrmirrors = lrmirrors;
 
+    // Cache sources get the indexes after the mirrors
+    for (int x = 0; handle && handle->cachesources
+                    && handle->cachesources[x]; x++)
+        handle_mirrors->cachelist = lr_lrmirrorlist_append_url(
+                                            handle_mirrors->cachelist,
+                                            handle->cachesources[x],
+                                            handle->urlvars);
+
+    for (GSList *elem = handle_mirrors->cachelist;
+         elem;
+         elem = g_slist_next(elem))
+    {
+        LrInternalMirror *imirror = elem->data;
+
+        g_debug("%s: Cache source: %s", __func__, imirror->url);
+
+        LrMirror *mirror = lr_malloc0(sizeof(*mirror));
+        mirror->mirror = imirror;
+        mirror->index = index++;
+        mirror->cache = TRUE;
+        if (group)
+            mirror->shard_transfers = shard_mirror_transfers(group,
+                                                             imirror->url);
+        handle_mirrors->cachemirrors = g_slist_append(
+                                            handle_mirrors->cachemirrors,
+                                            mirror);
+    }
+
     target->lrmirrors = lrmirrors;
+    target->cachemirrors = handle_mirrors->cachemirrors;
     list = g_slist_append(list, handle_mirrors);
 
     return list;
 }
 
-
-/** Progress callback for CURL handles.
- * progress callback set by the user of librepo.
+/** Return TRUE (and set the err) if the download was interrupted
+ * by SIGINT, if any handle used by the targets was cancelled or if
+ * another shard of a sharded download failed.
+ * Every handle has exactly one record in dd->handle_mirrors.
  */
-static int
-lr_progresscb(void *ptr,
-              double total_to_download,
-              double now_downloaded,
-              G_GNUC_UNUSED double total_to_upload,
-              G_GNUC_UNUSED double now_uploaded)
+static gboolean
+download_interrupted(LrDownload *dd, GError **err)
 {
-    int ret = LR_CB_OK;
-    LrTarget *target = ptr;
-
-    assert(target);
-    assert(target->target);
-
-    if (target->state != LR_DS_RUNNING)
-        return ret;
-    if (!target->target->progresscb)
-        return ret;
+    if (lr_interrupt) {
+        g_set_error(err, LR_DOWNLOADER_ERROR, LRE_INTERRUPTED,
+                    "Interrupted by signal");
+        return TRUE;
+    }
 
-    ret = target->target->progresscb(target->target->cbdata,
-                                     total_to_download,
-                                     now_downloaded);
+    if (dd->shard && g_atomic_int_get(&dd->shard->group->failed)) {
+        g_set_error(err, LR_DOWNLOADER_ERROR, LRE_INTERRUPTED,
+                    "Interrupted by an error of another shard");
+        return TRUE;
+    }
 
-    target->cb_return_code = ret;
+    for (GSList *elem = dd->handle_mirrors; elem; elem = g_slist_next(elem)) {
+        LrHandleMirrors *handle_mirrors = elem->data;
+        if (handle_mirrors->handle
+            && g_atomic_int_get(&handle_mirrors->handle->cancelled))
+        {
+            g_set_error(err, LR_DOWNLOADER_ERROR, LRE_CANCELLED,
+                        "Cancelled by lr_handle_cancel()");
+            return TRUE;
+        }
+    }
 
-    return ret;
+    return FALSE;
 }
 
-#define STRLEN(s) (sizeof(s)/sizeof(s[0]) - 1)
-
 
-/** Header callback for CURL handles.
- * It parses HTTP and FTP headers and try to find length of the content
- * (file size of the target). If the size is different then the expected
- * size, then the transfer is interrupted.
- * This callback is used only if the expected size is specified.
+/** Return TRUE if the mirror was already tried for the target.
  */
-static size_t
-lr_headercb(void *ptr, size_t size, size_t nmemb, void *userdata)
+static gboolean
+mirror_tried(LrTarget *target, LrMirror *mirror)
 {
-    assert(userdata);
+    guint word = mirror->index / 32;
 
-    size_t ret = size * nmemb;
-    LrTarget *lrtarget = userdata;
-    LrHeaderCbState state = lrtarget->headercb_state;
+    if (word >= target->tried_mirrors_words)
+        return FALSE;
+    return (target->tried_mirrors[word] >> (mirror->index % 32)) & 1;
+}
 
-    if (state == LR_HCS_DONE || state == LR_HCS_INTERRUPTED) {
-        // Nothing to do
-        return ret;
+/** Note a try of the download of the target from the mirror.
+ * The mirror could be NULL if a base URL was used.
+ */
+static void
+mark_mirror_tried(LrTarget *target, LrMirror *mirror)
+{
+    if (!mirror || !mirror->cache)
+        target->num_of_tried_mirrors++;
+
+    if (!mirror)
+        return;
+
+    guint word = mirror->index / 32;
+
+    if (word >= target->tried_mirrors_words) {
+        // Make room for all mirrors of the target at once
+        guint words = MAX(word + 1,
+                          (g_slist_length(target->lrmirrors)
+                           + g_slist_length(target->cachemirrors) + 31) / 32);
+        target->tried_mirrors = lr_realloc(target->tried_mirrors,
+                                           words * sizeof(guint32));
+        memset(target->tried_mirrors + target->tried_mirrors_words, 0,
+               (words - target->tried_mirrors_words) * sizeof(guint32));
+        target->tried_mirrors_words = words;
     }
 
-    char *header = g_strstrip(g_strndup(ptr, size*nmemb));
-    gint64 expected = lrtarget->target->expectedsize;
-
-    if (state == LR_HCS_DEFAULT) {
-        if (lrtarget->protocol == LR_PROTOCOL_HTTP
-            && g_str_has_prefix(header, "HTTP/")) {
-            // Header of a HTTP protocol
-            if (g_strrstr(header, "200")) {
-                lrtarget->headercb_state = LR_HCS_HTTP_STATE_OK;
-            } else {
-                // Do nothing (do not change the state)
-                // in case of redirection, 200 OK still could come
-                g_debug("%s: Non OK HTTP header status: %s", __func__, header);
-            }
-        } else if (lrtarget->protocol == LR_PROTOCOL_FTP) {
-            // Headers of a FTP protocol
-            if (g_str_has_prefix(header, "213 ")) {
-                // Code 213 shoud keep the file size
-                gint64 content_length = g_ascii_strtoll(header+4, NULL, 0);
+    target->tried_mirrors[word] |= (guint32) 1 << (mirror->index % 32);
+}
 
-                g_debug("%s: Server returned size: \"%s\" "
-                        "(converted %"G_GINT64_FORMAT"/%"G_GINT64_FORMAT
-                        " expected)",
-                        __func__, header+4, content_length, expected);
+/** Forget a try of the download of the target from the mirror,
+ * so it could be tried again.
+ */
+static void
+unmark_mirror_tried(LrTarget *target, LrMirror *mirror)
+{
+    if ((!mirror || !mirror->cache) && target->num_of_tried_mirrors > 0)
+        target->num_of_tried_mirrors--;
 
-                // Compare expected size and size reported by a FTP server
-                if (content_length > 0 && content_length != expected) {
-                    g_debug("%s: Size doesn't match (%"G_GINT64_FORMAT
-                            " != %"G_GINT64_FORMAT")",
-                            __func__, content_length, expected);
-                    lrtarget->headercb_state = LR_HCS_INTERRUPTED;
-                    lrtarget->headercb_interrupt_reason = g_strdup_printf(
-                        "FTP server reports size: %"G_GINT64_FORMAT" "
-                        "via 213 code, but expected size is: %"G_GINT64_FORMAT,
-                        content_length, expected);
-                    ret++;  // Return error value
-                } else {
-                    lrtarget->headercb_state = LR_HCS_DONE;
-                }
-            } else if (g_str_has_prefix(header, "150")) {
-                // Code 150 shoud keep the file size
-                // TODO: See parse150 in /usr/lib64/python2.7/ftplib.py
-            }
-        }
-    }
+    if (!mirror)
+        return;
 
-    if (state == LR_HCS_HTTP_STATE_OK) {
-        if (g_str_has_prefix(header, "Content-Length: ")) {
-            // Content-Length header found
-            char *content_length_str = header + STRLEN("Content-Length: ");
-            gint64 content_length = g_ascii_strtoll(content_length_str,
-                                                    NULL, 0);
-            g_debug("%s: Server returned Content-Length: \"%s\" "
-                    "(converted %"G_GINT64_FORMAT"/%"G_GINT64_FORMAT" expected)",
-                    __func__, content_length_str, content_length, expected);
+    guint word = mirror->index / 32;
 
-            // Compare expected size and size reported by a HTTP server
-            if (content_length > 0 && content_length != expected) {
-                g_debug("%s: Size doesn't match (%"G_GINT64_FORMAT
-                        " != %"G_GINT64_FORMAT")",
-                        __func__, content_length, expected);
-                lrtarget->headercb_state = LR_HCS_INTERRUPTED;
-                lrtarget->headercb_interrupt_reason = g_strdup_printf(
-                    "Server reports Content-Length: %"G_GINT64_FORMAT" but "
-                    "expected size is: %"G_GINT64_FORMAT,
-                    content_length, expected);
-                ret++;  // Return error value
-            } else {
-                lrtarget->headercb_state = LR_HCS_DONE;
-            }
-        }
-    }
+    if (word < target->tried_mirrors_words)
+        target->tried_mirrors[word] &= ~((guint32) 1 << (mirror->index % 32));
+}
 
-    g_free(header);
+/** Return TRUE if the transfer of the target downloads only a range
+ * (segment_start - segment_end) of the file - it is a segment
+ * or a hedged request.
+ */
+static gboolean
+is_range_transfer(const LrTarget *target)
+{
+    return target->parent || target->hedged;
+}
 
-    return ret;
+/** Return number of bytes which are downloaded by the transfer of
+ * the target or 0 if unknown.
+ */
+static gint64
+transfer_size(const LrTarget *target)
+{
+    if (is_range_transfer(target))
+        return target->segment_end - target->segment_start + 1;
+    return target->target->expectedsize;
 }
 
+/** Return the time (sec) left until the deadline of the target.
+ */
+static gdouble
+deadline_left(const LrDownloadTarget *dtarget)
+{
+    return dtarget->deadline - g_get_real_time() / (gdouble) G_USEC_PER_SEC;
+}
 
-/** Write callback for CURL handles.
- * This callback handles situation when an user wants only specified
- * byte range of the target file.
+/** Return TRUE if the target has a deadline which already passed.
  */
-size_t
-lr_writecb(char *ptr, size_t size, size_t nmemb, void *userdata)
+static gboolean
+deadline_passed(const LrDownloadTarget *dtarget)
 {
-    size_t cur_written_expected = nmemb;
-    size_t cur_written;
-    LrTarget *target = (LrTarget *) userdata;
-    gint64 all = size * nmemb;  // Total number of bytes from curl
-    gint64 range_start = target->target->byterangestart;
-    gint64 range_end = target->target->byterangeend;
+    return dtarget->deadline > 0.0 && deadline_left(dtarget) <= 0.0;
+}
 
-    if (range_start <= 0 && range_end <= 0) {
-        // Write everything curl give to you
-        target->writecb_recieved += all;
-        return fwrite(ptr, size, nmemb, target->f);
+/** Return rank of the priority class, targets with lower rank go first.
+ */
+static int
+priority_class_rank(LrPriorityClass priorityclass)
+{
+    switch (priorityclass) {
+    case LR_PRIORITYCLASS_CRITICAL:
+        return 0;
+    case LR_PRIORITYCLASS_BACKGROUND:
+        return 2;
+    default:
+        return 1;
     }
+}
 
-    /* Deal with situation when user wants only specific byte range of the
-     * target file, and write only the range.
-     */
-
-    gint64 cur_range_start = target->writecb_recieved;
-    gint64 cur_range_end = cur_range_start + all;
+/** Compare waiting targets by the download order.
+ * Targets with a deadline go first (earliest deadline first),
+ * then the targets by their priority class.
+ */
+static gint
+compare_waiting_targets(gconstpointer a, gconstpointer b, gpointer user_data)
+{
+    const LrTarget *ta = a;
+    const LrTarget *tb = b;
+    const LrDownload *dd = user_data;
+    gdouble deadline_a = ta->target->deadline;
+    gdouble deadline_b = tb->target->deadline;
+
+    if (deadline_a != deadline_b) {
+        if (deadline_a <= 0.0)
+            return 1;
+        if (deadline_b <= 0.0)
+            return -1;
+        return (deadline_a < deadline_b) ? -1 : 1;
+    }
 
-    target->writecb_recieved += all;
+    int rank_a = priority_class_rank(ta->target->priorityclass);
+    int rank_b = priority_class_rank(tb->target->priorityclass);
+    if (rank_a != rank_b)
+        return (rank_a < rank_b) ? -1 : 1;
 
-    if (target->target->byterangestart > 0) {
-        // If byterangestart is specified, then CURLOPT_RESUME_FROM_LARGE
-        // is used by default
-        cur_range_start += target->target->byterangestart;
-        cur_range_end   += target->target->byterangestart;
-    } else if (target->original_offset > 0) {
-        cur_range_start += target->original_offset;
-        cur_range_end   += target->original_offset;
+    if (dd->download_order == LR_DOWNLOADORDER_LARGESTFIRST ||
+        dd->download_order == LR_DOWNLOADORDER_SMALLESTFIRST)
+    {
+        gint64 size_a = transfer_size(ta);
+        gint64 size_b = transfer_size(tb);
+
+        if (size_a != size_b) {
+            // Targets with unknown size are the last ones
+            if (size_a <= 0)
+                return 1;
+            if (size_b <= 0)
+                return -1;
+            if (dd->download_order == LR_DOWNLOADORDER_LARGESTFIRST)
+                return (size_a > size_b) ? -1 : 1;
+            return (size_a < size_b) ? -1 : 1;
+        }
+    } else if (dd->download_order == LR_DOWNLOADORDER_PRIORITY) {
+        if (ta->target->priority != tb->target->priority)
+            return (ta->target->priority > tb->target->priority) ? -1 : 1;
     }
 
-    if (cur_range_end < range_start)
-        // The wanted byte range doesn't start yet
-        return nmemb;
-
-    if (range_end != 0 && cur_range_start > range_end) {
-        // The wanted byte range is over
-        // Return zero that will lead to transfer abortion
-        // with error code CURLE_WRITE_ERROR
-        target->writecb_required_range_written = TRUE;
+    // Keep order of the list of targets
+    if (ta->queue_seq == tb->queue_seq)
         return 0;
-    }
+    return (ta->queue_seq < tb->queue_seq) ? -1 : 1;
+}
 
-    size = 1;
-    nmemb = all;
+/** Set the target waiting and add it to the queue of waiting targets.
+ */
+static void
+queue_target(LrDownload *dd, LrTarget *target)
+{
+    target->state = LR_DS_WAITING;
+    if (target->queue_iter)
+        return;  // Already queued
+    target->queued_at = g_get_monotonic_time();
+    target->queue_iter = g_sequence_insert_sorted(dd->waiting_targets,
+                                                  target,
+                                                  compare_waiting_targets,
+                                                  dd);
+}
 
-    if (cur_range_start >= range_start) {
-        // Write the current curl passed range from the start
-        ;
-    } else {
-        // Find the right starting offset
-        gint64 offset = range_start - cur_range_start;
-        assert(offset > 0);
-        ptr += offset;
-        // Corret the length appropriately
-        nmemb = all - offset;
-    }
+/** Remove the target from the queue of waiting targets.
+ */
+static void
+dequeue_target(LrTarget *target)
+{
+    if (!target->queue_iter)
+        return;
+    g_sequence_remove(target->queue_iter);
+    target->queue_iter = NULL;
+}
 
-    if (range_end != 0) {
-        // End range is specified
+/** Add the target to the running transfers.
+ */
+static void
+add_running_transfer(LrDownload *dd, LrTarget *target)
+{
+    target->running_index = dd->running_transfers->len;
+    g_ptr_array_add(dd->running_transfers, target);
+    if (target->target->priorityclass == LR_PRIORITYCLASS_CRITICAL)
+        dd->critical_transfers++;
+}
 
-        if (cur_range_end <= range_end) {
-            // Write the current curl passed range to the end
-            ;
-        } else {
-            // Find the length of the new sequence
-            gint64 offset = cur_range_end - range_end;
-            assert(offset > 0);
-            // Corret the length appropriately
-            nmemb -= (offset - 1);
-        }
-    }
+/** Remove the target from the running transfers in O(1),
+ * the last running transfer takes its place.
+ */
+static void
+remove_running_transfer(LrDownload *dd, LrTarget *target)
+{
+    GPtrArray *running = dd->running_transfers;
+    guint index = target->running_index;
 
-    assert(nmemb > 0);
-    cur_written = fwrite(ptr, size, nmemb, target->f);
-    if (cur_written != nmemb) {
-        g_debug("%s: Error while writting out file: %s",
-                __func__, strerror(errno));
-        return 0; // There was an error
-    }
+    assert(index < running->len);
+    assert(g_ptr_array_index(running, index) == target);
 
-    return cur_written_expected;
+    g_ptr_array_remove_index_fast(running, index);
+    if (index < running->len)
+        ((LrTarget *) g_ptr_array_index(running, index))->running_index = index;
+    if (target->target->priorityclass == LR_PRIORITYCLASS_CRITICAL)
+        dd->critical_transfers--;
 }
 
+/** Wait until asynchronous write of the data of the transfer
+ * is finished. Result of the write is ignored.
+ */
+static void
+wait_transfer_writes(LrTransfer *transfer)
+{
+    if (transfer && transfer->aio && transfer->write_req.pending)
+        lr_asyncio_wait(transfer->aio, &transfer->write_req, NULL);
+}
 
-/** Select a suitable mirror
+/** Free the state of the transfer of the target.
+ * Content of the write buffer is discarded.
  */
-static gboolean
-select_suitable_mirror(LrDownload *dd,
-                       LrTarget *target,
-                       LrMirror **selected_mirror,
-                       GError **err)
+static void
+free_transfer(LrTarget *target)
 {
+    LrTransfer *transfer = target->transfer;
+
+    if (!transfer)
+        return;
+
+    // The kernel could still read the pending buffer
+    wait_transfer_writes(transfer);
+
+    if (transfer->proxy)
+        lr_proxypool_release(transfer->proxypool, transfer->proxy,
+                             LR_PROXYPOOL_NEUTRAL, NULL,
+                             g_get_monotonic_time());
+
+    g_free(transfer->headercb_interrupt_reason);
+    lr_checksumctx_free(transfer->piece_ctx);
+    g_free(transfer->url);
+    lr_resume_journal_clear(transfer->journal);
+    lr_free(transfer->journal);
+    lr_free(transfer->writebuf);
+    lr_free(transfer->writebuf_pending);
+    lr_multipart_free(transfer->multipart);
+    lr_free(transfer);
+    target->transfer = NULL;
+}
 
-    gboolean at_least_one_suitable_mirror_found = FALSE;
-    //  ^^^ This variable is used to indentify that all possible mirrors
-    // were already tried and the transfer shoud be marked as failed.
+/** Free the hedged request which is not running.
+ */
+static void
+free_hedge(LrTarget *hedge)
+{
+    assert(hedge->hedged);
+    assert(!hedge->curl_handle);
+
+    hedge->hedged->hedge = NULL;
+    dequeue_target(hedge);
+    free_transfer(hedge);
+    lr_free(hedge->tried_mirrors);
+    lr_free(hedge);
+}
 
-    assert(dd);
-    assert(target);
-    assert(selected_mirror);
-    assert(!err || *err == NULL);
+/** Return the file the target with fn is written to. It is the fn or
+ * its temporary file (LRO_ATOMICDOWNLOAD) which is shared with
+ * the segments and the hedged request of the target.
+ */
+static const char *
+target_fn(LrTarget *target)
+{
+    LrTarget *owner = target;
 
-    *selected_mirror = NULL;
+    if (target->parent)
+        owner = target->parent;
+    else if (target->hedged)
+        owner = target->hedged;
 
-    // Iterate over mirror for the target
-    for (GSList *elem = target->lrmirrors; elem; elem = g_slist_next(elem)) {
-        LrMirror *c_mirror = elem->data;
-        gchar *mirrorurl = c_mirror->mirror->url; // shortcut
+    return (owner->partfn) ? owner->partfn : target->target->fn;
+}
 
-        if (g_slist_find(target->tried_mirrors, c_mirror)) {
-            // This mirror was already tried for this target
-            continue;
-        }
+/** Number of bytes after which the resume journal of a transfer
+ * is updated */
+#define LR_RESUME_JOURNAL_INTERVAL      (4 * 1024 * 1024)
 
-        if (c_mirror->mirror->protocol == LR_PROTOCOL_RSYNC) {
-            // Skip rsync mirrors
-            g_debug("%s: Skipping rsync url: %s", __func__, mirrorurl);
-            continue;
-        }
+/** Return TRUE if the partial file of the target is described by
+ * a resume journal (see LRO_RESUMEJOURNAL). Only whole files with fn
+ * which are resumed and are not requested conditionally use it.
+ */
+static gboolean
+journal_enabled(const LrTarget *target)
+{
+    const LrDownloadTarget *dtarget = target->target;
 
-        if (c_mirror->successful_transfers == 0 &&
-            dd->allowed_mirror_failures > 0 &&
-            c_mirror->failed_transfers >= dd->allowed_mirror_failures)
-        {
-            // Skip bad mirrors
-            g_debug("%s: Skipping bad mirror (%d failures and no success): %s",
-                    __func__, c_mirror->failed_transfers, mirrorurl);
-            continue;
-        }
+    return target->handle && target->handle->resumejournal
+           && dtarget->fn && dtarget->resume
+           && !dtarget->conditional
+           && dtarget->byterangestart <= 0 && dtarget->byterangeend <= 0
+           && !is_range_transfer(target);
+}
 
-        at_least_one_suitable_mirror_found = TRUE;
+/** Remove the resume journal of the target if it uses one.
+ */
+static void
+remove_target_journal(LrTarget *target)
+{
+    if (!journal_enabled(target))
+        return;
 
-        // Number of transfers which are downloading from the mirror
-        // should always be lower or equal than maximum allowed number
-        // of connection to a single host.
-        assert(dd->max_connection_per_host == -1 ||
-               c_mirror->running_transfers <= dd->max_connection_per_host);
+    _cleanup_free_ gchar *path = lr_resume_journal_path(target_fn(target));
+    if (unlink(path) == -1 && errno != ENOENT)
+        g_debug("%s: Cannot remove %s: %s", __func__, path, g_strerror(errno));
+    target->journal_offset = 0;
+}
 
-        // Check number of connections to the mirror
-        if (dd->max_connection_per_host != -1 &&
-            c_mirror->running_transfers >= dd->max_connection_per_host)
-        {
-            continue;
-        }
+/** Move the finished file of the target from its temporary file
+ * to the fn (LRO_ATOMICDOWNLOAD). Readers of the fn see either
+ * the previous file or the whole new one.
+ */
+static gboolean
+commit_target_file(LrTarget *target, GError **err)
+{
+    assert(!err || *err == NULL);
 
-        // This mirror looks suitable - use it
-        *selected_mirror = c_mirror;
+    if (!target->partfn)
         return TRUE;
+
+    if (rename(target->partfn, target->target->fn) == -1) {
+        g_set_error(err, LR_DOWNLOADER_ERROR, LRE_IO,
+                    "Cannot rename %s to %s: %s", target->partfn,
+                    target->target->fn, g_strerror(errno));
+        return FALSE;
     }
 
-    if (!at_least_one_suitable_mirror_found) {
-        // No suitable mirror even exists => Set transfer as failed
-        g_debug("%s: All mirrors were tried without success", __func__);
-        target->state = LR_DS_FAILED;
+    g_debug("%s: %s renamed to %s", __func__, target->partfn,
+            target->target->fn);
+    return TRUE;
+}
 
-        lr_downloadtarget_set_error(target->target, LRE_NOURL,
-                    "Cannot download, all mirrors were already tried "
-                    "without success");
+/** Flush the directory to the disk, so new entries of files are durable.
+ * @return      0 on success, -1 on error (errno is set)
+ */
+static int
+sync_directory(const char *dir)
+{
+    int fd, rc;
+
+    fd = open(dir, O_RDONLY|O_DIRECTORY);
+    if (fd == -1)
+        return -1;
+    rc = fsync(fd);
+    close(fd);
+    return rc;
+}
 
+/** Flush the file of the finished target and its directory
+ * to the disk (LR_DURABILITY_STRICT).
+ */
+static gboolean
+sync_target_file(LrDownloadTarget *dtarget, GError **err)
+{
+    int fd, rc;
 
-        // Call end callback
-        LrEndCb end_cb =  target->target->endcb;
-        if (end_cb) {
-            int ret = end_cb(target->target->cbdata,
-                             LR_TRANSFER_ERROR,
-                             "No more mirrors to try - All mirrors "
-                             "were already tried without success");
-            if (ret == LR_CB_ERROR) {
-                target->cb_return_code = LR_CB_ERROR;
-                g_debug("%s: Downloading was aborted by LR_CB_ERROR "
-                        "from end callback", __func__);
-                g_set_error(err, LR_DOWNLOADER_ERROR, LRE_CBINTERRUPTED,
-                        "Interupted by LR_CB_ERROR from end callback");
-                return FALSE;
-            }
-        }
+    assert(!err || *err == NULL);
 
-        if (dd->failfast) {
-            // Fail immediately
-            g_set_error(err, LR_DOWNLOADER_ERROR, LRE_NOURL,
-                        "Cannot download %s: All mirrors were tried",
-                        target->target->path);
-            return FALSE;
-        }
+    if (dtarget->fd != -1) {
+        // The directory of the file is unknown
+        rc = fsync(dtarget->fd);
+    } else if (dtarget->fn) {
+        _cleanup_free_ gchar *dir = g_path_get_dirname(dtarget->fn);
+        fd = open(dtarget->fn, O_RDONLY);
+        rc = (fd == -1) ? -1 : fsync(fd);
+        if (fd != -1)
+            close(fd);
+        if (rc == 0)
+            rc = sync_directory(dir);
+    } else {
+        return TRUE;  // Downloaded into memory
+    }
+
+    if (rc == -1) {
+        g_set_error(err, LR_DOWNLOADER_ERROR, LRE_IO,
+                    "Cannot sync %s: %s", dtarget->path, g_strerror(errno));
+        return FALSE;
     }
 
     return TRUE;
 }
 
+/** Flush the filesystem of the file to the disk, unless it was
+ * already synced (its device is in the devs). Without syncfs()
+ * just the file is synced.
+ * @return      0 on success, -1 on error (errno is set)
+ */
+static int
+sync_filesystem_of(int fd, GArray *devs)
+{
+#ifdef LR_HAVE_SYNCFS
+    struct stat st;
+
+    if (fstat(fd, &st) == -1)
+        return -1;
 
-/** Select next target
+    for (guint x = 0; x < devs->len; x++)
+        if (g_array_index(devs, dev_t, x) == st.st_dev)
+            return 0;
+
+    g_array_append_val(devs, st.st_dev);
+    return syncfs(fd);
+#else
+    (void) devs;
+    return fsync(fd);
+#endif
+}
+
+/** Flush the files of the finished targets (LrTarget *) to
+ * the disk at once (LR_DURABILITY_BATCH). Every filesystem with
+ * a finished file is synced just once, then the directories of the files
+ * are synced.
  */
 static gboolean
-select_next_target(LrDownload *dd,
-                   LrTarget **selected_target,
-                   char **selected_full_url,
-                   GError **err)
+sync_finished_targets(GPtrArray *targets, GError **err)
 {
-    assert(dd);
-    assert(selected_target);
-    assert(selected_full_url);
+    _cleanup_hashtable_unref_ GHashTable *dirs = NULL;
+    _cleanup_array_unref_ GArray *devs = NULL;
+    GHashTableIter iter;
+    gpointer dir;
+    guint synced = 0;
+
     assert(!err || *err == NULL);
 
-    *selected_target = NULL;
-    *selected_full_url = NULL;
+    dirs = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+    devs = g_array_new(FALSE, FALSE, sizeof(dev_t));
 
-    for (GSList *elem = dd->targets; elem; elem = g_slist_next(elem)) {
-        LrTarget *target = elem->data;
-        LrMirror *mirror = NULL;
-        char *full_url = NULL;
-        int complete_url_in_path = 0;
+    for (guint x = 0; x < targets->len; x++) {
+        LrTarget *target = g_ptr_array_index(targets, x);
+        LrDownloadTarget *dtarget = target->target;
+        int fd, rc;
 
-        if (target->state != LR_DS_WAITING)  // Pick only waiting targets
+        if (target->state != LR_DS_FINISHED || target->parent)
             continue;
 
-        // Determine if path is a complete URL
+        if (dtarget->fd != -1)
+            fd = dtarget->fd;
+        else if (dtarget->fn)
+            fd = open(dtarget->fn, O_RDONLY);
+        else
+            continue;  // Downloaded into memory
 
-        complete_url_in_path = strstr(target->target->path, "://") ? 1 : 0;
+        rc = (fd == -1) ? -1 : sync_filesystem_of(fd, devs);
+        if (fd != -1 && fd != dtarget->fd)
+            close(fd);
 
-        // Sanity check
+        if (rc == -1) {
+            g_set_error(err, LR_DOWNLOADER_ERROR, LRE_IO,
+                        "Cannot sync %s: %s", dtarget->path,
+                        g_strerror(errno));
+            return FALSE;
+        }
 
-        if (!target->target->baseurl
-            && !target->lrmirrors
-            && !complete_url_in_path)
-        {
-            // Used relative path with empty internal mirrorlist
-            // and no basepath specified!
-            g_debug("%s: Empty mirrorlist and no basepath specified", __func__);
-            g_set_error(err, LR_DOWNLOADER_ERROR, LRE_NOURL,
-                        "Empty mirrorlist and no basepath specified!");
+        if (dtarget->fd == -1)
+            g_hash_table_add(dirs, g_path_get_dirname(dtarget->fn));
+        synced++;
+    }
+
+    g_hash_table_iter_init(&iter, dirs);
+    while (g_hash_table_iter_next(&iter, &dir, NULL)) {
+        if (sync_directory(dir) == -1) {
+            g_set_error(err, LR_DOWNLOADER_ERROR, LRE_IO,
+                        "Cannot sync directory %s: %s", (char *) dir,
+                        g_strerror(errno));
             return FALSE;
         }
+    }
 
-        g_debug("%s: Selecting mirror for: %s", __func__, target->target->path);
+    g_debug("%s: %u files on %u filesystems synced", __func__, synced,
+            devs->len);
 
-        // Prepare full target URL
+    return TRUE;
+}
 
-        if (complete_url_in_path) {
-            // Path is a complete URL (do not use mirror nor base URL)
-            full_url = g_strdup(target->target->path);
-        } else if (target->target->baseurl) {
-            // Base URL is specified
-            full_url = lr_pathconcat(target->target->baseurl,
-                                     target->target->path,
-                                     NULL);
-        } else {
-            // Find a suitable mirror
-            if (!select_suitable_mirror(dd, target, &mirror , err))
-                return FALSE;
-
-            if (mirror) {
-                // A mirror was found
-                full_url = lr_pathconcat(mirror->mirror->url,
-                                         target->target->path,
-                                         NULL);
-            } else {
-                // No free mirror
-                g_debug("%s: Currently there is no free mirror for: %s",
-                        __func__, target->target->path);
-            }
-        }
-
-        if (full_url) {  // A waiting target found
-            target->mirror = mirror;  // Note: mirror is NULL if baseurl is used
-
-            *selected_target = target;
-            *selected_full_url = full_url;
-
-            return TRUE;
-        }
-    }
-
-    // No suitable target found
-    return TRUE;
-}
-
-
-/** Prepares next transfer
+/** Make the dst file a copy of the finished src file. A reflink is
+ * used if the filesystem supports it. The copy is not a hardlink, because
+ * the files are independent targets which could be modified separately.
  */
 static gboolean
-prepare_next_transfer(LrDownload *dd, gboolean *candidatefound, GError **err)
+copy_target_file(LrDownloadTarget *src,
+                 LrTarget *dst_target,
+                 GError **err)
 {
-    LrTarget *target;
-    char *full_url = NULL;
-    LrProtocol protocol = LR_PROTOCOL_OTHER;
-    gboolean ret;
-
-    assert(dd);
-    assert(!err || *err == NULL);
-
-    *candidatefound = FALSE;
-
-    ret = select_next_target(dd, &target, &full_url, err);
-    if (!ret)  // Error
-        return FALSE;
-
-    if (!target)  // Nothing to do
-        return TRUE;
-
-    *candidatefound = TRUE;
-
-    g_debug("%s: URL: %s", __func__, full_url);
-
-    protocol = lr_detect_protocol(full_url);
-
-    // Prepare CURL easy handle
-    CURLcode c_rc;
-    CURL *h;
-    if (target->handle)
-        h = curl_easy_duphandle(target->handle->curl_handle);
-    else
-        h = lr_get_curl_handle();
-    if (!h) {
-        // Something went wrong
-        g_set_error(err, LR_DOWNLOADER_ERROR, LRE_CURL,
-                    "curl_easy_duphandle() call failed");
-        return FALSE;
-    }
-
-    // Set URL
-    c_rc = curl_easy_setopt(h, CURLOPT_URL, full_url);
-    if (c_rc != CURLE_OK) {
-        g_set_error(err, LR_DOWNLOADER_ERROR, LRE_CURL,
-                    "curl_easy_setopt(h, CURLOPT_URL, %s) failed: %s",
-                    full_url, curl_easy_strerror(c_rc));
-        lr_free(full_url);
-        curl_easy_cleanup(h);
+    LrDownloadTarget *dst = dst_target->target;
+    const char *dst_fn = target_fn(dst_target);
+    struct stat src_st, dst_st;
+    int src_fd, dst_fd;
+    int rc = -1;
+
+    src_fd = (src->fn) ? open(src->fn, O_RDONLY) : src->fd;
+    if (src_fd == -1) {
+        g_set_error(err, LR_DOWNLOADER_ERROR, LRE_IO,
+                    "Cannot open %s: %s", src->fn, g_strerror(errno));
         return FALSE;
     }
 
-    // Set error buffer
-    target->errorbuffer[0] = '\0';
-    c_rc = curl_easy_setopt(h, CURLOPT_ERRORBUFFER, target->errorbuffer);
-    if (c_rc != CURLE_OK) {
-        g_set_error(err, LR_DOWNLOADER_ERROR, LRE_CURL,
-                    "curl_easy_setopt(h, CURLOPT_ERRORBUFFER, %s) failed: %s",
-                    full_url, curl_easy_strerror(c_rc));
-        lr_free(full_url);
-        curl_easy_cleanup(h);
+    dst_fd = (dst->fn) ? open(dst_fn, O_WRONLY|O_CREAT, 0666) : dst->fd;
+    if (dst_fd == -1) {
+        g_set_error(err, LR_DOWNLOADER_ERROR, LRE_IO,
+                    "Cannot open %s: %s", dst_fn, g_strerror(errno));
+        if (src->fn)
+            close(src_fd);
         return FALSE;
     }
 
-    lr_free(full_url);
-
-    // Prepare FILE
-    int fd;
-
-    if (target->target->fd != -1) {
-        // Use supplied filedescriptor
-        fd = dup(target->target->fd);
-        if (fd == -1) {
-            g_set_error(err, LR_DOWNLOADER_ERROR, LRE_IO,
-                        "dup(%d) failed: %s",
-                        target->target->fd, strerror(errno));
-            curl_easy_cleanup(h);
-            return FALSE;
-        }
+    if (fstat(src_fd, &src_st) == 0 && fstat(dst_fd, &dst_st) == 0
+        && src_st.st_dev == dst_st.st_dev && src_st.st_ino == dst_st.st_ino)
+    {
+        // Both targets are the same file
+        rc = 0;
     } else {
-        // Use supplied filename
-        int open_flags = O_CREAT|O_TRUNC|O_RDWR;
-        if (target->target->resume)
-            open_flags &= ~O_TRUNC;
-
-        fd = open(target->target->fn, open_flags, 0666);
-        if (fd < 0) {
-            g_set_error(err, LR_DOWNLOADER_ERROR, LRE_IO,
-                        "Cannot open %s: %s",
-                        target->target->fn, strerror(errno));
-            curl_easy_cleanup(h);
-            return FALSE;
-        }
+#ifdef FICLONE
+        rc = ioctl(dst_fd, FICLONE, src_fd);
+#endif
+        if (rc == -1 && ftruncate(dst_fd, 0) == 0)
+            rc = lr_copy_content(src_fd, dst_fd);
     }
 
-    FILE *f = fdopen(fd, "w+b");
-    if (!f) {
+    if (rc == -1)
         g_set_error(err, LR_DOWNLOADER_ERROR, LRE_IO,
-                    "fdopen(%d) failed: %s",
-                    fd, strerror(errno));
-        curl_easy_cleanup(h);
-        return FALSE;
-    }
-
-    target->f = f;
-    target->writecb_recieved = 0;
-    target->writecb_required_range_written = FALSE;
-
-    // Resume - set offset to resume incomplete download
-    if (target->target->resume) {
-        if (target->original_offset == -1) {
-            // Determine offset
-            fseek(f, 0L, SEEK_END);
-            gint64 determined_offset = ftell(f);
-            if (determined_offset == -1) {
-                // An error while determining offset =>
-                // Download the whole file again
-                determined_offset = 0;
-            }
-            target->original_offset = determined_offset;
-        }
-
-        gint64 used_offset = target->original_offset;
-        g_debug("%s: Used offset for download resume: %"G_GINT64_FORMAT,
-                __func__, used_offset);
-
-        c_rc = curl_easy_setopt(h, CURLOPT_RESUME_FROM_LARGE,
-                                (curl_off_t) used_offset);
-        if (c_rc != CURLE_OK) {
-            g_set_error(err, LR_DOWNLOADER_ERROR, LRE_CURL,
-                        "curl_easy_setopt(h, LR_DOWNLOADER_ERROR, %"
-                        G_GINT64_FORMAT") failed: %s",
-                        used_offset, curl_easy_strerror(c_rc));
-            fclose(f);
-            curl_easy_cleanup(h);
-            return FALSE;
-        }
-    }
-
-    if (target->target->byterangestart > 0) {
-        assert(!target->target->resume);
-        g_debug("%s: byterangestart is specified -> resume is set to %"
-                G_GINT64_FORMAT, __func__, target->target->byterangestart);
-        c_rc = curl_easy_setopt(h, CURLOPT_RESUME_FROM_LARGE,
-                                (curl_off_t) target->target->byterangestart);
-    }
+                    "Cannot copy the downloaded %s: %s", src->path,
+                    g_strerror(errno));
 
-    // Prepare progress callback
-    target->cb_return_code = LR_CB_OK;
-    if (target->target->progresscb) {
-        curl_easy_setopt(h, CURLOPT_PROGRESSFUNCTION, lr_progresscb);
-        curl_easy_setopt(h, CURLOPT_NOPROGRESS, 0);
-        curl_easy_setopt(h, CURLOPT_PROGRESSDATA, target);
-    }
+    // Leave offsets of the file descriptors at the end of the files
+    // as regular download does
+    if (src->fn)
+        close(src_fd);
+    else
+        lseek(src_fd, 0, SEEK_END);
+    if (dst->fn)
+        close(dst_fd);
+    else
+        lseek(dst_fd, 0, SEEK_END);
 
-    // Prepare header callback
-    if (target->target->expectedsize > 0) {
-        curl_easy_setopt(h, CURLOPT_HEADERFUNCTION, lr_headercb);
-        curl_easy_setopt(h, CURLOPT_HEADERDATA, target);
-    }
+    return rc == 0;
+}
 
-    // Prepare write callback
-    curl_easy_setopt(h, CURLOPT_WRITEFUNCTION, lr_writecb);
-    curl_easy_setopt(h, CURLOPT_WRITEDATA, target);
+/** Call the end callback (GFunc of the end callback threads).
+ */
+static void
+call_queued_endcb(gpointer data, gpointer user_data)
+{
+    LrEndCbCall *call = data;
+    LrDownloadTarget *dtarget = call->target->target;
+    GAsyncQueue *returned = user_data;
 
-    // Add the new handle to the curl multi handle
-    curl_multi_add_handle(dd->multi_handle, h);
+    call->ret = dtarget->endcb(dtarget->cbdata, call->status, call->msg);
+    g_async_queue_push(returned, call);
+}
 
-    // Set the state of transfer as running
-    target->state = LR_DS_RUNNING;
+/** Call the end callback of the finished or failed target.
+ * With end callback threads the call is only queued and LR_CB_OK is
+ * returned, its return value is evaluated by check_returned_endcbs().
+ * Everything the callback could read from the target has to be set
+ * before.
+ */
+static int
+call_endcb(LrDownload *dd,
+           LrTarget *target,
+           LrTransferStatus status,
+           const char *msg)
+{
+    LrDownloadTarget *dtarget = target->target;
 
-    // Set the state of header callback for this transfer
-    target->headercb_state = LR_HCS_DEFAULT;
-    g_free(target->headercb_interrupt_reason);
-    target->headercb_interrupt_reason = NULL;
+    if (!dtarget->endcb)
+        return LR_CB_OK;
 
-    // Set protocol of the target
-    target->protocol = protocol;
+    if (!dd->endcb_pool)
+        return dtarget->endcb(dtarget->cbdata, status, msg);
 
-    // Save curl handle for the current transfer
-    target->curl_handle = h;
+    LrEndCbCall *call = lr_malloc0(sizeof(*call));
+    call->target = target;
+    call->status = status;
+    call->msg = g_strdup(msg);
 
-    // Add the transfer to the list of running transfers
-    dd->running_transfers = g_slist_append(dd->running_transfers, target);
+    target->endcb_queued = TRUE;
+    dd->endcb_calls++;
+    g_thread_pool_push(dd->endcb_pool, call, NULL);
+    return LR_CB_OK;
+}
 
-    return TRUE;
+/** Free the returned call of the end callback.
+ */
+static void
+free_endcb_call(LrEndCbCall *call)
+{
+    call->target->endcb_queued = FALSE;
+    g_free(call->msg);
+    lr_free(call);
 }
 
+/** Evaluate the end callbacks returned meanwhile.
+ */
 static gboolean
-set_max_speeds_to_transfers(LrDownload *dd, GError **err)
+check_returned_endcbs(LrDownload *dd, GError **err)
 {
-    guint length;
-    gint64 single_target_speed;
+    LrEndCbCall *call;
 
     assert(!err || *err == NULL);
 
-    if (!dd->max_speed)  // Nothing to do
-        return TRUE;
+    while ((call = g_async_queue_try_pop(dd->endcb_returned))) {
+        LrTarget *target = call->target;
+        int ret = call->ret;
 
-    length = g_slist_length(dd->running_transfers);
-    if (!length)  // Nothing to do
-        return TRUE;
+        dd->endcb_calls--;
+        free_endcb_call(call);
 
-    // Calculate a max speed (rounded up) per target
-    single_target_speed = (dd->max_speed + (length - 1)) / length;
-
-    for (GSList *elem = dd->running_transfers; elem; elem = g_slist_next(elem)) {
-        LrTarget *ltarget = elem->data;
-        CURL *curl_handle = ltarget->curl_handle;
-        CURLcode code = curl_easy_setopt(curl_handle,
-                                         CURLOPT_MAX_RECV_SPEED_LARGE,
-                                         (curl_off_t) single_target_speed);
-        if (code != CURLE_OK) {
-            g_set_error(err, LR_DOWNLOADER_ERROR, LRE_CURLSETOPT,
-                        "Cannot set CURLOPT_MAX_RECV_SPEED_LARGE option: %s",
-                        curl_easy_strerror(code));
+        if (ret == LR_CB_ERROR) {
+            target->cb_return_code = LR_CB_ERROR;
+            g_debug("%s: Downloading was aborted by LR_CB_ERROR "
+                    "from end callback of %s", __func__,
+                    target->target->path);
+            g_set_error(err, LR_DOWNLOADER_ERROR, LRE_CBINTERRUPTED,
+                        "Interupted by LR_CB_ERROR from end callback");
             return FALSE;
         }
     }
@@ -937,884 +1798,8635 @@ set_max_speeds_to_transfers(LrDownload *dd, GError **err)
     return TRUE;
 }
 
+/** The end callbacks don't keep up with the download, no new transfers
+ * are started until some of them return (see LRO_ENDCBQUEUESIZE).
+ */
 static gboolean
-prepare_next_transfers(LrDownload *dd, GError **err)
+endcb_backlog(LrDownload *dd)
 {
-    guint length = g_slist_length(dd->running_transfers);
-    guint free_slots = dd->max_parallel_connections - length;
+    return dd->endcb_pool && dd->endcb_calls >= dd->endcb_queue_size;
+}
 
-    assert(!err || *err == NULL);
+/** Finish the duplicate by a copy of the file of the finished target.
+ */
+static gboolean
+finish_duplicate(LrDownload *dd,
+                 LrTarget *target,
+                 LrTarget *duplicate,
+                 GError **err)
+{
+    LrDownloadTarget *dtarget = duplicate->target;
+    GError *tmp_err = NULL;
 
-    gboolean candidatefound = TRUE;
-    while (free_slots > 0 && candidatefound) {
-        gboolean ret = prepare_next_transfer(dd, &candidatefound, err);
-        if (!ret)
+    g_debug("%s: %s is a copy of %s", __func__, dtarget->path,
+            target->target->path);
+
+    if (!copy_target_file(target->target, duplicate, &tmp_err)
+        || !commit_target_file(duplicate, &tmp_err)
+        || (dd->durability == LR_DURABILITY_STRICT
+            && !sync_target_file(dtarget, &tmp_err))) {
+        duplicate->state = LR_DS_FAILED;
+        lr_downloadtarget_set_error(dtarget, tmp_err->code,
+                                    "Download failed: %s", tmp_err->message);
+
+        if (call_endcb(dd, duplicate, LR_TRANSFER_ERROR,
+                       tmp_err->message) == LR_CB_ERROR)
+            duplicate->cb_return_code = LR_CB_ERROR;
+
+        if (dd->failfast || duplicate->cb_return_code == LR_CB_ERROR) {
+            g_propagate_error(err, tmp_err);
             return FALSE;
-        free_slots--;
+        }
+        g_error_free(tmp_err);
+        return TRUE;
     }
 
-    // Set maximal speed for each target
-    if (dd->max_speed)
-        if (!set_max_speeds_to_transfers(dd, err))
-            return FALSE;
+    duplicate->state = LR_DS_FINISHED;
+    lr_downloadtarget_set_error(dtarget, LRE_OK, NULL);
+    lr_downloadtarget_set_usedmirror(dtarget, target->target->usedmirror);
+    lr_downloadtarget_set_effectiveurl(dtarget, target->target->effectiveurl);
+
+    // Call end callback
+    if (call_endcb(dd, duplicate, LR_TRANSFER_SUCCESSFUL,
+                   NULL) == LR_CB_ERROR)
+    {
+        duplicate->cb_return_code = LR_CB_ERROR;
+        g_debug("%s: Downloading was aborted by LR_CB_ERROR "
+                "from end callback", __func__);
+        g_set_error(err, LR_DOWNLOADER_ERROR, LRE_CBINTERRUPTED,
+                    "Interupted by LR_CB_ERROR from end callback");
+        return FALSE;
+    }
 
     return TRUE;
 }
 
-
-/** Check the finished transfer
- * Evaluate CURL return code and status code of protocol if needed.
+/** Finish the duplicates of the target which was just finished or failed.
+ * Duplicates of a finished target get a copy of its file. Duplicates of
+ * a failed target are downloaded on their own (they could have other
+ * mirrors), the first of them is queued and the others become its
+ * duplicates. On error the rest of the duplicates stays unfinished.
  */
 static gboolean
-check_finished_transfer_status(CURLMsg *msg,
-                               LrTarget *target,
-                               gboolean *fatal_error,
-                               GError **transfer_err,
-                               GError **err)
+finish_duplicates(LrDownload *dd, LrTarget *target, GError **err)
 {
-    long code = 0;
-    char *effective_url = NULL;
+    GSList *duplicates = target->duplicates;
+    LrTarget *next_original = NULL;
+    gboolean ret = TRUE;
 
-    assert(msg);
-    assert(target);
-    assert(!transfer_err || *transfer_err == NULL);
-    assert(!err || *err == NULL);
+    target->duplicates = NULL;
 
-    *fatal_error = FALSE;
+    for (GSList *elem = duplicates; elem && ret; elem = g_slist_next(elem)) {
+        LrTarget *duplicate = elem->data;
+        duplicate->original = NULL;
 
-    curl_easy_getinfo(msg->easy_handle,
-                      CURLINFO_EFFECTIVE_URL,
-                      &effective_url);
+        if (target->state == LR_DS_FINISHED) {
+            ret = finish_duplicate(dd, target, duplicate, err);
+        } else if (!next_original) {
+            next_original = duplicate;
+            queue_target(dd, duplicate);
+        } else {
+            duplicate->original = next_original;
+            next_original->duplicates = g_slist_append(next_original->duplicates,
+                                                       duplicate);
+        }
+    }
 
-    if (msg->data.result != CURLE_OK) {
-        // There was an error that is reported by CURLcode
+    g_slist_free(duplicates);
+    return ret;
+}
 
-        if (msg->data.result == CURLE_WRITE_ERROR &&
-            target->writecb_required_range_written)
-        {
-            // Download was interrupted by writecb because
-            // user want only specified byte range of the
-            // target and the range was already downloaded
-            g_debug("%s: Transfer was interrupted by writecb() "
-                    "because the required range "
-                    "(%"G_GINT64_FORMAT"-%"G_GINT64_FORMAT") "
-                    "was downloaded.", __func__,
-                    target->target->byterangestart,
-                    target->target->byterangeend);
-        } else if (target->headercb_state == LR_HCS_INTERRUPTED) {
-            // Download was interrupted by header callback
-            g_set_error(transfer_err, LR_DOWNLOADER_ERROR, LRE_CURL,
-                        "Interrupted by header callback: %s",
-                        target->headercb_interrupt_reason);
-        } else {
-            // There was a CURL error
+/** Progress callback for CURL handles.
+ * progress callback set by the user of librepo.
+ */
+static int
+lr_progresscb(void *ptr,
+              double total_to_download,
+              double now_downloaded,
+              G_GNUC_UNUSED double total_to_upload,
+              G_GNUC_UNUSED double now_uploaded)
+{
+    int ret = LR_CB_OK;
+    LrTarget *target = ptr;
+    LrTarget *progress_target;
+
+    assert(target);
+    assert(target->target);
+
+    if (target->state != LR_DS_RUNNING)
+        return ret;
+
+    if (target->parent) {
+        // Report progress of the whole segmented target
+        total_to_download = (double) target->target->expectedsize;
+        now_downloaded = 0.0;
+        for (GSList *elem = target->parent->segments;
+             elem;
+             elem = g_slist_next(elem))
+        {
+            LrTarget *segment = elem->data;
+            now_downloaded += (double) segment->segment_written;
+        }
+    }
+
+    // Segments share the progress of the whole target
+    progress_target = (target->parent) ? target->parent : target;
+    progress_target->progress_total = total_to_download;
+    progress_target->progress_now = now_downloaded;
+
+    if (!target->target->progresscb)
+        return ret;
+
+    // Skip too frequent ticks, but never the final one
+    if (target->progress_interval > 0
+        && (total_to_download <= 0.0 || now_downloaded < total_to_download))
+    {
+        gint64 now = g_get_monotonic_time();
+        if (now - progress_target->last_progress < target->progress_interval)
+            return ret;
+        progress_target->last_progress = now;
+    }
+
+    ret = target->target->progresscb(target->target->cbdata,
+                                     total_to_download,
+                                     now_downloaded);
+
+    target->cb_return_code = ret;
+
+    return ret;
+}
+
+#define STRLEN(s) (sizeof(s)/sizeof(s[0]) - 1)
+
+
+/** Header callback for CURL handles.
+ * It parses HTTP and FTP headers and try to find length of the content
+ * (file size of the target). If the size is different then the expected
+ * size, then the transfer is interrupted.
+ * This callback is used only if the expected size is specified
+ * or if the target is conditional (then it also picks up the ETag).
+ */
+static size_t
+lr_headercb(void *ptr, size_t size, size_t nmemb, void *userdata)
+{
+    assert(userdata);
+
+    size_t ret = size * nmemb;
+    LrTarget *lrtarget = userdata;
+    LrHeaderCbState state = lrtarget->transfer->headercb_state;
+
+    if ((state == LR_HCS_DONE || state == LR_HCS_INTERRUPTED)
+        && !lrtarget->target->conditional && !lrtarget->transfer->url) {
+        // Nothing to do
+        return ret;
+    }
+
+    char *header = g_strstrip(g_strndup(ptr, size*nmemb));
+    gint64 expected = lrtarget->target->expectedsize;
+
+    if ((lrtarget->target->conditional || lrtarget->transfer->url)
+        && lrtarget->protocol == LR_PROTOCOL_HTTP) {
+        // Remember the ETag of the last response (not of redirections)
+        if (g_str_has_prefix(header, "HTTP/")) {
+            g_free(lrtarget->etag);
+            lrtarget->etag = NULL;
+        } else if (!g_ascii_strncasecmp(header, "ETag:", STRLEN("ETag:"))) {
+            g_free(lrtarget->etag);
+            lrtarget->etag = g_strdup(g_strchug(header + STRLEN("ETag:")));
+        }
+    }
+
+    if (expected <= 0) {
+        // Only the validators are wanted
+        g_free(header);
+        return ret;
+    }
+
+    if (state == LR_HCS_DEFAULT) {
+        if (lrtarget->protocol == LR_PROTOCOL_HTTP
+            && g_str_has_prefix(header, "HTTP/")) {
+            // Header of a HTTP protocol
+            if (g_strrstr(header, "200")) {
+                lrtarget->transfer->headercb_state = LR_HCS_HTTP_STATE_OK;
+            } else {
+                // Do nothing (do not change the state)
+                // in case of redirection, 200 OK still could come
+                g_debug("%s: Non OK HTTP header status: %s", __func__, header);
+            }
+        } else if (lrtarget->protocol == LR_PROTOCOL_FTP) {
+            // Headers of a FTP protocol
+            if (g_str_has_prefix(header, "213 ")) {
+                // Code 213 shoud keep the file size
+                gint64 content_length = g_ascii_strtoll(header+4, NULL, 0);
+
+                g_debug("%s: Server returned size: \"%s\" "
+                        "(converted %"G_GINT64_FORMAT"/%"G_GINT64_FORMAT
+                        " expected)",
+                        __func__, header+4, content_length, expected);
+
+                // Compare expected size and size reported by a FTP server
+                if (content_length > 0 && content_length != expected) {
+                    g_debug("%s: Size doesn't match (%"G_GINT64_FORMAT
+                            " != %"G_GINT64_FORMAT")",
+                            __func__, content_length, expected);
+                    lrtarget->transfer->headercb_state = LR_HCS_INTERRUPTED;
+                    lrtarget->transfer->headercb_interrupt_reason = g_strdup_printf(
+                        "FTP server reports size: %"G_GINT64_FORMAT" "
+                        "via 213 code, but expected size is: %"G_GINT64_FORMAT,
+                        content_length, expected);
+                    ret++;  // Return error value
+                } else {
+                    lrtarget->transfer->headercb_state = LR_HCS_DONE;
+                }
+            } else if (g_str_has_prefix(header, "150")) {
+                // Code 150 shoud keep the file size
+                // TODO: See parse150 in /usr/lib64/python2.7/ftplib.py
+            }
+        }
+    }
+
+    if (state == LR_HCS_HTTP_STATE_OK) {
+        LrTransfer *transfer = lrtarget->transfer;
+        gint64 content_length = 0;
+        gboolean check = FALSE;
+
+        if (g_str_has_prefix(header, "Content-Length: ")) {
+            // Content-Length header found
+            char *content_length_str = header + STRLEN("Content-Length: ");
+            content_length = g_ascii_strtoll(content_length_str, NULL, 0);
+            g_debug("%s: Server returned Content-Length: \"%s\" "
+                    "(converted %"G_GINT64_FORMAT"/%"G_GINT64_FORMAT" expected)",
+                    __func__, content_length_str, content_length, expected);
+
+            // It could be the size of the encoded data,
+            // then wait for the Content-Encoding
+            if (transfer->encoding_requested)
+                transfer->content_length = content_length;
+            else
+                check = TRUE;
+        } else if (transfer->encoding_requested
+                   && !g_ascii_strncasecmp(header, "Content-Encoding:",
+                                           STRLEN("Content-Encoding:"))) {
+            const char *coding = g_strchug(header + STRLEN("Content-Encoding:"));
+            if (g_ascii_strcasecmp(coding, "identity")) {
+                // The decoded data are checked by lr_writecb()
+                g_debug("%s: Content is encoded: %s", __func__, coding);
+                transfer->content_encoded = TRUE;
+                transfer->headercb_state = LR_HCS_DONE;
+            }
+        } else if (transfer->encoding_requested && !*header) {
+            // End of the headers, the content is not encoded
+            content_length = transfer->content_length;
+            check = TRUE;
+        }
+
+        // Compare expected size and size reported by a HTTP server
+        if (check && content_length > 0 && content_length != expected) {
+            g_debug("%s: Size doesn't match (%"G_GINT64_FORMAT
+                    " != %"G_GINT64_FORMAT")",
+                    __func__, content_length, expected);
+            transfer->headercb_state = LR_HCS_INTERRUPTED;
+            transfer->headercb_interrupt_reason = g_strdup_printf(
+                "Server reports Content-Length: %"G_GINT64_FORMAT" but "
+                "expected size is: %"G_GINT64_FORMAT,
+                content_length, expected);
+            ret++;  // Return error value
+        } else if (check) {
+            transfer->headercb_state = LR_HCS_DONE;
+        }
+    }
+
+    g_free(header);
+
+    return ret;
+}
+
+/** Header callback of a transfer of a batch of byte ranges.
+ * It remembers the start of the Content-Range of the last response
+ * (not of redirections), which is sent if the server sends only
+ * one range instead of a multipart/byteranges response.
+ */
+static size_t
+lr_headercb_batch(void *ptr, size_t size, size_t nmemb, void *userdata)
+{
+    assert(userdata);
+
+    size_t ret = size * nmemb;
+    LrTarget *target = userdata;
+    _cleanup_free_ gchar *header = g_strstrip(g_strndup(ptr, ret));
+    gint64 start, end;
+
+    if (g_str_has_prefix(header, "HTTP/"))
+        target->transfer->batch_range_start = -1;
+    else if (!g_ascii_strncasecmp(header, "Content-Range:",
+                                  STRLEN("Content-Range:"))
+             && lr_multipart_parse_content_range(
+                        header + STRLEN("Content-Range:"), &start, &end))
+        target->transfer->batch_range_start = start;
+
+    return ret;
+}
+
+
+/** Free checksums calculated on the fly for the target.
+ */
+static void
+free_transfer_checksums(LrTarget *target)
+{
+    for (GSList *elem = target->checksum_ctxs; elem; elem = g_slist_next(elem)) {
+        LrStreamChecksum *stream_checksum = elem->data;
+        lr_checksumctx_free(stream_checksum->ctx);
+        g_slist_free(stream_checksum->checksums);
+        lr_free(stream_checksum);
+    }
+    g_slist_free(target->checksum_ctxs);
+    target->checksum_ctxs = NULL;
+    target->checksum_ctxs_len = 0;
+}
+
+/** Prepare checksums calculated on the fly from the downloaded data.
+ * If the file already has some content (resumed download), the content
+ * is used to seed the checksums. If the checksums cannot be calculated
+ * on the fly, they will be calculated from the file after the transfer.
+ */
+static void
+prepare_transfer_checksums(LrTarget *target)
+{
+    gint64 offset;
+    GError *tmp_err = NULL;
+
+    free_transfer_checksums(target);
+
+    if (target->target->byterangestart > 0 || target->target->byterangeend > 0)
+        // Only a part of the file is downloaded
+        return;
+
+    if (is_range_transfer(target))
+        // Segments are written out of order, checksums of the whole
+        // file are calculated when all the segments are finished
+        return;
+
+    offset = ftell(target->f);
+    if (offset == -1)
+        return;
+
+    for (GSList *elem = target->target->checksums; elem; elem = g_slist_next(elem)) {
+        LrDownloadTargetChecksum *chksum = elem->data;
+        LrStreamChecksum *stream_checksum = NULL;
+        if (!chksum || !chksum->value || chksum->type == LR_CHECKSUM_UNKNOWN)
+            continue;  // Bad checksum
+
+        // Alternative checksums of the same type share one context
+        for (GSList *e = target->checksum_ctxs; e; e = g_slist_next(e)) {
+            LrStreamChecksum *sc = e->data;
+            if (lr_checksumctx_type(sc->ctx) == chksum->type) {
+                stream_checksum = sc;
+                break;
+            }
+        }
+
+        if (stream_checksum) {
+            stream_checksum->checksums = g_slist_append(
+                                            stream_checksum->checksums,
+                                            chksum);
+            continue;
+        }
+
+        LrChecksumCtx *ctx = NULL;
+        gboolean from_journal = FALSE;
+        LrResumeJournal *journal = target->transfer->journal;
+        if (journal && journal->offset == offset && journal->states[chksum->type]) {
+            // Continue from the state saved in the resume journal
+            ctx = lr_checksumctx_load(chksum->type,
+                                      journal->states[chksum->type], &tmp_err);
+            if (ctx) {
+                g_debug("%s: %s checksum continues from the journal", __func__,
+                        lr_checksum_type_to_str(chksum->type));
+                from_journal = TRUE;
+            } else {
+                g_debug("%s: %s", __func__, tmp_err->message);
+                g_clear_error(&tmp_err);
+            }
+        }
+
+        if (!ctx && target->transfer->url)
+            // The state will be saved to the resume journal
+            ctx = lr_checksumctx_new_resumable(chksum->type, &tmp_err);
+        else if (!ctx)
+            ctx = lr_checksumctx_new(chksum->type, &tmp_err);
+
+        if (ctx && offset > 0 && !from_journal)
+            // Use already existing content of the file
+            if (!lr_checksumctx_update_fd(ctx, fileno(target->f), offset, &tmp_err)) {
+                lr_checksumctx_free(ctx);
+                ctx = NULL;
+            }
+
+        if (!ctx) {
+            g_debug("%s: Cannot calculate checksum on the fly: %s",
+                    __func__, tmp_err->message);
+            g_clear_error(&tmp_err);
+            free_transfer_checksums(target);
+            return;
+        }
+
+        stream_checksum = lr_malloc0(sizeof(*stream_checksum));
+        stream_checksum->checksums = g_slist_append(NULL, chksum);
+        stream_checksum->ctx = ctx;
+        target->checksum_ctxs = g_slist_append(target->checksum_ctxs,
+                                               stream_checksum);
+    }
+
+    target->checksum_ctxs_len = offset;
+}
+
+/** Update checksums calculated on the fly with the written data.
+ */
+static void
+update_transfer_checksums(LrTarget *target, const char *ptr, size_t len)
+{
+    GError *tmp_err = NULL;
+
+    for (GSList *elem = target->checksum_ctxs; elem; elem = g_slist_next(elem)) {
+        LrStreamChecksum *stream_checksum = elem->data;
+        if (!lr_checksumctx_update(stream_checksum->ctx, ptr, len, &tmp_err)) {
+            // Fallback - checksums will be calculated from the file
+            g_debug("%s: Cannot update checksum: %s", __func__,
+                    tmp_err->message);
+            g_error_free(tmp_err);
+            free_transfer_checksums(target);
+            return;
+        }
+    }
+
+    target->checksum_ctxs_len += len;
+}
+
+/** Stop the verification of the pieces during the transfer.
+ * The damaged pieces found so far are forgotten, the file will be
+ * verified by its checksums only.
+ */
+static void
+stop_transfer_pieces(LrTarget *target)
+{
+    LrTransfer *transfer = target->transfer;
+
+    transfer->verify_pieces = FALSE;
+    lr_checksumctx_free(transfer->piece_ctx);
+    transfer->piece_ctx = NULL;
+    if (target->bad_pieces)
+        g_array_set_size(target->bad_pieces, 0);
+}
+
+/** Prepare verification of the pieces (LrDownloadTarget.pieces) on the
+ * fly from the downloaded data. Only a transfer of the whole file from
+ * its beginning is verified.
+ */
+static void
+prepare_transfer_pieces(LrTarget *target)
+{
+    LrTransfer *transfer = target->transfer;
+
+    transfer->verify_pieces = FALSE;
+    lr_checksumctx_free(transfer->piece_ctx);
+    transfer->piece_ctx = NULL;
+    transfer->piece_index = 0;
+    transfer->piece_done = 0;
+
+    if (target->bad_pieces)
+        g_array_set_size(target->bad_pieces, 0);
+
+    if (!target->target->pieces || target->target->pieces->count == 0)
+        return;
+
+    if (target->target->byterangestart > 0
+        || target->target->byterangeend > 0
+        || is_range_transfer(target))
+        return;
+
+    if (ftell(target->f) != 0)
+        // The resumed file is verified by its checksums only
+        return;
+
+    if (!target->bad_pieces)
+        target->bad_pieces = g_array_new(FALSE, FALSE, sizeof(guint));
+
+    transfer->verify_pieces = TRUE;
+}
+
+/** Compare the checksum of the just finished piece.
+ * @return      FALSE if the checksum cannot be calculated
+ */
+static gboolean
+check_transfer_piece(LrTarget *target)
+{
+    LrTransfer *transfer = target->transfer;
+    LrDownloadTargetPieces *pieces = target->target->pieces;
+    _cleanup_free_ gchar *checksum = NULL;
+    GError *tmp_err = NULL;
+
+    checksum = lr_checksumctx_final(transfer->piece_ctx, &tmp_err);
+    lr_checksumctx_free(transfer->piece_ctx);
+    transfer->piece_ctx = NULL;
+
+    if (!checksum) {
+        g_debug("%s: %s", __func__, tmp_err->message);
+        g_error_free(tmp_err);
+        return FALSE;
+    }
+
+    if (g_ascii_strcasecmp(checksum, pieces->hashes[transfer->piece_index])) {
+        g_debug("%s: Piece %u of %s doesn't match", __func__,
+                transfer->piece_index, target->target->path);
+        g_array_append_val(target->bad_pieces, transfer->piece_index);
+    }
+
+    transfer->piece_index++;
+    transfer->piece_done = 0;
+    return TRUE;
+}
+
+/** Update the checksums of the pieces with the written data.
+ */
+static void
+update_transfer_pieces(LrTarget *target, const char *ptr, size_t len)
+{
+    LrTransfer *transfer = target->transfer;
+    LrDownloadTargetPieces *pieces = target->target->pieces;
+    GError *tmp_err = NULL;
+
+    if (!transfer->verify_pieces)
+        return;
+
+    while (len > 0) {
+        if (transfer->piece_index >= pieces->count) {
+            g_debug("%s: %s is longer than its pieces", __func__,
+                    target->target->path);
+            stop_transfer_pieces(target);
+            return;
+        }
+
+        if (!transfer->piece_ctx) {
+            transfer->piece_ctx = lr_checksumctx_new(pieces->type, &tmp_err);
+            if (!transfer->piece_ctx) {
+                g_debug("%s: Cannot verify pieces: %s", __func__,
+                        tmp_err->message);
+                g_error_free(tmp_err);
+                stop_transfer_pieces(target);
+                return;
+            }
+        }
+
+        size_t part = (size_t) MIN((gint64) len,
+                                   pieces->length - transfer->piece_done);
+        if (!lr_checksumctx_update(transfer->piece_ctx, ptr, part, &tmp_err)) {
+            g_debug("%s: Cannot verify pieces: %s", __func__,
+                    tmp_err->message);
+            g_error_free(tmp_err);
+            stop_transfer_pieces(target);
+            return;
+        }
+
+        ptr += part;
+        len -= part;
+        transfer->piece_done += part;
+
+        if (transfer->piece_done == pieces->length
+            && !check_transfer_piece(target))
+        {
+            stop_transfer_pieces(target);
+            return;
+        }
+    }
+}
+
+/** Check the last (shorter) piece after the transfer finished.
+ * If the downloaded data don't fit the pieces, the verification
+ * of the pieces is stopped.
+ */
+static void
+finish_transfer_pieces(LrTarget *target)
+{
+    LrTransfer *transfer = target->transfer;
+
+    if (!transfer->verify_pieces)
+        return;
+
+    if (transfer->piece_ctx && !check_transfer_piece(target)) {
+        stop_transfer_pieces(target);
+        return;
+    }
+
+    if (transfer->piece_index != target->target->pieces->count) {
+        g_debug("%s: %s is shorter than its pieces", __func__,
+                target->target->path);
+        stop_transfer_pieces(target);
+    }
+}
+
+/** Prepare decompression of the data during the transfer
+ * (see LrDownloadTarget.decompressfd). Only a transfer of the whole file
+ * from its beginning could be decompressed on the fly, in other cases
+ * the data will be decompressed from the file after the transfer.
+ */
+static void
+prepare_transfer_decompression(LrTarget *target)
+{
+    int fd = target->target->decompressfd;
+
+    lr_decompressor_free(target->decompressor);
+    target->decompressor = NULL;
+
+    if (fd == -1)
+        return;
+
+    if (target->target->byterangestart > 0 || target->target->byterangeend > 0)
+        return;
+
+    if (is_range_transfer(target))
+        return;
+
+    if (ftell(target->f) != 0)
+        // Resumed transfer
+        return;
+
+    if (ftruncate(fd, 0) == -1 || lseek(fd, 0, SEEK_SET) == -1) {
+        g_debug("%s: Cannot truncate file for decompressed data: %s",
+                __func__, strerror(errno));
+        return;
+    }
+
+    target->decompressor = lr_decompressor_new(fd);
+}
+
+/** Decompress the data written by the transfer.
+ */
+static void
+update_transfer_decompression(LrTarget *target, const char *ptr, size_t len)
+{
+    GError *tmp_err = NULL;
+
+    if (!target->decompressor)
+        return;
+
+    if (!lr_decompressor_write(target->decompressor, ptr, len, &tmp_err)) {
+        // Fallback - data will be decompressed from the file
+        g_debug("%s: Cannot decompress data on the fly: %s", __func__,
+                tmp_err->message);
+        g_error_free(tmp_err);
+        lr_decompressor_free(target->decompressor);
+        target->decompressor = NULL;
+    }
+}
+
+/** Prepare passing of the data to the datacb of the target during
+ * the transfer. Only a transfer of the whole file from its beginning
+ * is passed (the same as for the decompression).
+ */
+static void
+prepare_transfer_streaming(LrTarget *target)
+{
+    LrDownloadTarget *dtarget = target->target;
+
+    target->streaming = FALSE;
+
+    if (!dtarget->datacb)
+        return;
+
+    if (dtarget->byterangestart > 0 || dtarget->byterangeend > 0)
+        return;
+
+    if (is_range_transfer(target))
+        return;
+
+    if (ftell(target->f) != 0)
+        // Resumed transfer
+        return;
+
+    target->streaming = (dtarget->datacb(dtarget->cbdata, NULL, 0) == LR_CB_OK);
+}
+
+/** Pass the data written by the transfer to the datacb of the target.
+ */
+static void
+update_transfer_streaming(LrTarget *target, const char *ptr, size_t len)
+{
+    LrDownloadTarget *dtarget = target->target;
+
+    if (!target->streaming || len == 0)
+        return;
+
+    if (dtarget->datacb(dtarget->cbdata, ptr, len) != LR_CB_OK) {
+        g_debug("%s: Data callback of %s stopped the streaming",
+                __func__, dtarget->path);
+        target->streaming = FALSE;
+    }
+}
+
+/** File descriptor of a LR_OUTPUT_FD or LR_OUTPUT_FN output.
+ */
+static int
+output_fd(LrTargetOutput *out)
+{
+    return (out->output->type == LR_OUTPUT_FD) ? out->output->fd : out->fd;
+}
+
+/** Start passing of the data to the output from their beginning.
+ * Files are truncated, the buffer is emptied and the callback is told
+ * to discard the data it got before.
+ * @return      FALSE if the output cannot be written
+ */
+static gboolean
+start_target_output(LrTargetOutput *out)
+{
+    LrDownloadTargetOutput *output = out->output;
+    int fd;
+
+    out->written = 0;
+
+    switch (output->type) {
+    case LR_OUTPUT_FN:
+        if (out->fd == -1)
+            out->fd = open(output->fn, O_CREAT|O_TRUNC|O_WRONLY|O_CLOEXEC,
+                           0666);
+        /* fall through */
+    case LR_OUTPUT_FD:
+        fd = output_fd(out);
+        return fd != -1 && ftruncate(fd, 0) != -1
+               && lseek(fd, 0, SEEK_SET) != -1;
+    case LR_OUTPUT_MEMORY:
+        if (out->data)
+            g_byte_array_set_size(out->data, 0);
+        else
+            out->data = g_byte_array_new();
+        return TRUE;
+    case LR_OUTPUT_CB:
+        out->stopped = (output->cb(output->cbdata, NULL, 0) != LR_CB_OK);
+        return !out->stopped;
+    }
+
+    return FALSE;
+}
+
+/** Pass the data to the output.
+ * @return      FALSE if the data cannot be written (errno is set)
+ *              or the callback stopped
+ */
+static gboolean
+write_target_output(LrTargetOutput *out, const char *ptr, size_t len)
+{
+    LrDownloadTargetOutput *output = out->output;
+    size_t done = 0;
+
+    switch (output->type) {
+    case LR_OUTPUT_FD:
+    case LR_OUTPUT_FN:
+        while (done < len) {
+            ssize_t written = write(output_fd(out), ptr + done, len - done);
+            if (written == -1 && errno == EINTR)
+                continue;
+            if (written == -1)
+                return FALSE;
+            done += written;
+        }
+        break;
+    case LR_OUTPUT_MEMORY:
+        g_byte_array_append(out->data, (const guint8 *) ptr, (guint) len);
+        break;
+    case LR_OUTPUT_CB:
+        if (output->cb(output->cbdata, ptr, len) != LR_CB_OK) {
+            out->stopped = TRUE;
+            return FALSE;
+        }
+        break;
+    }
+
+    out->written += len;
+    return TRUE;
+}
+
+/** Prepare passing of the data to the additional outputs of the target
+ * during the transfer. Only a transfer of the whole file from its
+ * beginning is passed (the same as for the decompression), the other
+ * outputs get the data from the file by finish_target_outputs().
+ */
+static void
+prepare_transfer_outputs(LrTarget *target)
+{
+    gboolean whole_file = !is_range_transfer(target)
+                          && ftell(target->f) == 0;
+
+    for (GSList *elem = target->outputs; elem; elem = g_slist_next(elem)) {
+        LrTargetOutput *out = elem->data;
+        out->streaming = whole_file && start_target_output(out);
+    }
+}
+
+/** Pass the data written by the transfer to the additional outputs.
+ */
+static void
+update_transfer_outputs(LrTarget *target, const char *ptr, size_t len)
+{
+    if (len == 0)
+        return;
+
+    for (GSList *elem = target->outputs; elem; elem = g_slist_next(elem)) {
+        LrTargetOutput *out = elem->data;
+        if (out->streaming && !write_target_output(out, ptr, len)) {
+            g_debug("%s: Output of %s gets the data from the file: %s",
+                    __func__, target->target->path,
+                    out->stopped ? "stopped by callback" : g_strerror(errno));
+            out->streaming = FALSE;
+        }
+    }
+}
+
+/** Pass the written data to everything which consumes them during
+ * the transfer: the checksums, the pieces, the decompression,
+ * the streaming and the additional outputs.
+ */
+static void
+digest_written_data(LrTarget *target, const char *ptr, size_t len)
+{
+    if (len == 0)
+        return;
+
+    if (target->checksum_ctxs)
+        update_transfer_checksums(target, ptr, len);
+    update_transfer_pieces(target, ptr, len);
+    update_transfer_decompression(target, ptr, len);
+    update_transfer_streaming(target, ptr, len);
+    update_transfer_outputs(target, ptr, len);
+}
+
+/** Return file descriptor of the file the target is written to.
+ * Targets without fd and fn are downloaded into an in-memory file
+ * which is created by the first call and shared with the segments
+ * and the hedged request of the target. Return -1 on error.
+ */
+static int
+target_fd(LrTarget *target)
+{
+    LrTarget *owner = target;
+
+    if (target->target->fd != -1)
+        return target->target->fd;
+
+    assert(!target->target->fn);
+
+    if (target->parent)
+        owner = target->parent;
+    else if (target->hedged)
+        owner = target->hedged;
+
+    if (owner->memfd == -1)
+        owner->memfd = lr_getmemfile();
+
+    return owner->memfd;
+}
+
+/** Copy content of the in-memory file of the target to its data.
+ */
+static gboolean
+load_target_data(LrTarget *target, GError **err)
+{
+    struct stat st;
+    GByteArray *data;
+    gsize offset = 0;
+
+    assert(!err || *err == NULL);
+
+    if (target->target->fd != -1 || target->target->fn)
+        return TRUE;
+
+    int fd = target_fd(target);
+    if (fd == -1 || fstat(fd, &st) == -1) {
+        g_set_error(err, LR_DOWNLOADER_ERROR, LRE_IO,
+                    "Cannot stat in-memory file of %s: %s",
+                    target->target->path, strerror(errno));
+        return FALSE;
+    }
+
+    data = g_byte_array_sized_new((guint) st.st_size);
+    g_byte_array_set_size(data, (guint) st.st_size);
+    while (offset < data->len) {
+        ssize_t len = pread(fd, data->data + offset, data->len - offset,
+                            (off_t) offset);
+        if (len <= 0) {
+            g_set_error(err, LR_DOWNLOADER_ERROR, LRE_IO,
+                        "Cannot read in-memory file of %s: %s",
+                        target->target->path,
+                        (len == 0) ? "Unexpected EOF" : strerror(errno));
+            g_byte_array_unref(data);
+            return FALSE;
+        }
+        offset += len;
+    }
+
+    if (target->target->data)
+        g_byte_array_unref(target->target->data);
+    target->target->data = data;
+
+    return TRUE;
+}
+
+/** Finish decompression of the downloaded target to its decompressfd.
+ * If the whole file was not decompressed during the transfer
+ * (segmented or resumed download, ...), it is decompressed from the file.
+ */
+static gboolean
+finish_decompression(LrTarget *target, GError **err)
+{
+    int fd;
+    struct stat st;
+    gboolean ret;
+    int out_fd = target->target->decompressfd;
+    LrDecompressor *dc = target->decompressor;
+
+    assert(!err || *err == NULL);
+
+    target->decompressor = NULL;
+
+    if (out_fd == -1)
+        return TRUE;
+
+    if (target->target->fn)
+        fd = open(target_fn(target), O_RDONLY);
+    else
+        fd = dup(target_fd(target));
+
+    if (fd < 0 || fstat(fd, &st) == -1) {
+        g_set_error(err, LR_DOWNLOADER_ERROR, LRE_IO,
+                    "Cannot open %s: %s", target->target->path,
+                    strerror(errno));
+        if (fd >= 0)
+            close(fd);
+        lr_decompressor_free(dc);
+        return FALSE;
+    }
+
+    if (dc && lr_decompressor_consumed(dc) != (gint64) st.st_size) {
+        // Not all the data were decompressed during the transfer
+        lr_decompressor_free(dc);
+        dc = NULL;
+    }
+
+    if (dc) {
+        ret = lr_decompressor_finish(dc, err);
+        lr_decompressor_free(dc);
+    } else {
+        g_debug("%s: Decompressing %s from the file", __func__,
+                target->target->path);
+        if (ftruncate(out_fd, 0) == -1 || lseek(out_fd, 0, SEEK_SET) == -1) {
+            g_set_error(err, LR_DOWNLOADER_ERROR, LRE_IO,
+                        "Cannot truncate file for decompressed data of %s: %s",
+                        target->target->path, strerror(errno));
+            close(fd);
+            return FALSE;
+        }
+        ret = lr_decompress_fd(fd, out_fd, err);
+    }
+
+    close(fd);
+
+    if (!ret)
+        g_prefix_error(err, "Cannot decompress %s: ", target->target->path);
+
+    return ret;
+}
+
+/** Size of the buffer used to pass the downloaded file to the memory
+ * and callback outputs */
+#define LR_OUTPUT_BUFFER_SIZE           131072
+
+/** Finish the additional outputs of the downloaded target.
+ * Outputs which didn't get the whole file during the transfer
+ * (segmented, resumed or repaired download, ...) get it from the file.
+ * Files are copied inside of the kernel if possible.
+ */
+static gboolean
+finish_target_outputs(LrTarget *target, GError **err)
+{
+    int fd;
+    struct stat st;
+    char *buf = NULL;
+    gboolean ret = TRUE;
+
+    assert(!err || *err == NULL);
+
+    if (!target->outputs)
+        return TRUE;
+
+    if (target->target->fn)
+        fd = open(target_fn(target), O_RDONLY);
+    else
+        fd = dup(target_fd(target));
+
+    if (fd < 0 || fstat(fd, &st) == -1) {
+        g_set_error(err, LR_DOWNLOADER_ERROR, LRE_IO,
+                    "Cannot open %s: %s", target->target->path,
+                    strerror(errno));
+        if (fd >= 0)
+            close(fd);
+        return FALSE;
+    }
+
+    for (GSList *elem = target->outputs; elem && ret; elem = g_slist_next(elem)) {
+        LrTargetOutput *out = elem->data;
+        LrDownloadTargetOutput *output = out->output;
+
+        if (out->streaming && out->written == (gint64) st.st_size
+            && !target->repair_tried)
+            ;   // The whole file was passed during the transfer
+        else if (output->type == LR_OUTPUT_CB && out->stopped)
+            ;   // The callback doesn't want the data
+        else if (!start_target_output(out)) {
+            if (!out->stopped) {
+                g_set_error(err, LR_DOWNLOADER_ERROR, LRE_IO,
+                            "Cannot write output %s of %s: %s",
+                            output->fn ? output->fn : "", target->target->path,
+                            g_strerror(errno));
+                ret = FALSE;
+            }
+        } else if (output->type == LR_OUTPUT_FD || output->type == LR_OUTPUT_FN) {
+            g_debug("%s: Copying %s to its output", __func__,
+                    target->target->path);
+            if (lr_copy_content(fd, output_fd(out)) == -1) {
+                g_set_error(err, LR_DOWNLOADER_ERROR, LRE_IO,
+                            "Cannot copy %s to output %s: %s",
+                            target->target->path,
+                            output->fn ? output->fn : "", g_strerror(errno));
+                ret = FALSE;
+            }
+        } else {
+            off_t offset = 0;
+            ssize_t len;
+
+            if (!buf)
+                buf = lr_malloc(LR_OUTPUT_BUFFER_SIZE);
+            while ((len = pread(fd, buf, LR_OUTPUT_BUFFER_SIZE, offset)) > 0
+                   && write_target_output(out, buf, (size_t) len))
+                offset += len;
+
+            if (len == -1) {
+                g_set_error(err, LR_DOWNLOADER_ERROR, LRE_IO,
+                            "Cannot read %s: %s", target->target->path,
+                            g_strerror(errno));
+                ret = FALSE;
+            }
+        }
+
+        out->streaming = FALSE;
+
+        if (out->fd != -1) {
+            close(out->fd);
+            out->fd = -1;
+        }
+
+        if (ret && output->type == LR_OUTPUT_MEMORY) {
+            if (output->data)
+                g_byte_array_unref(output->data);
+            output->data = out->data;
+            out->data = NULL;
+        }
+    }
+
+    close(fd);
+    lr_free(buf);
+
+    if (!target->target->fn)
+        // Leave offset of the file descriptor at the end of the file
+        // as regular download does
+        lseek(target_fd(target), 0, SEEK_END);
+
+    return ret;
+}
+
+/** Free the states of the additional outputs of the target.
+ */
+static void
+free_target_outputs(LrTarget *target)
+{
+    for (GSList *elem = target->outputs; elem; elem = g_slist_next(elem)) {
+        LrTargetOutput *out = elem->data;
+        if (out->fd != -1)
+            close(out->fd);
+        if (out->data)
+            g_byte_array_unref(out->data);
+        lr_free(out);
+    }
+    g_slist_free(target->outputs);
+    target->outputs = NULL;
+}
+
+/** Reserve disk space for len bytes of the file from the offset.
+ * Size of the file is not changed. Errors are not fatal, the space
+ * will be simply allocated during writing.
+ */
+static void
+preallocate_file(int fd, gint64 offset, gint64 len)
+{
+    if (len <= 0)
+        return;
+
+#ifdef FALLOC_FL_KEEP_SIZE
+    if (fallocate(fd, FALLOC_FL_KEEP_SIZE, (off_t) offset, (off_t) len) == -1)
+        g_debug("%s: fallocate(%d) failed: %s", __func__, fd, strerror(errno));
+#else
+    (void) fd;
+    (void) offset;
+    g_debug("%s: Preallocation is not supported", __func__);
+#endif
+}
+
+/** Write data to the file at the current write offset of the target.
+ */
+static gboolean
+write_at_offset(LrTarget *target, const char *ptr, size_t len, GError **err)
+{
+    LrTransfer *transfer = target->transfer;
+    int fd = fileno(target->f);
+    gint64 start = transfer->write_offset;
+
+    assert(!err || *err == NULL);
+
+    while (len > 0) {
+        ssize_t written = pwrite(fd, ptr, len, (off_t) transfer->write_offset);
+        if (written == -1) {
+            g_set_error(err, LR_DOWNLOADER_ERROR, LRE_IO,
+                        "pwrite(%d) failed: %s", fd, strerror(errno));
+            return FALSE;
+        }
+        ptr += written;
+        len -= written;
+        transfer->write_offset += written;
+    }
+
+#ifdef SYNC_FILE_RANGE_WRITE
+    if (transfer->early_writeback && transfer->write_offset > start)
+        // Only initiate the writeback, do not wait for it
+        sync_file_range(fd, (off_t) start,
+                        (off_t) (transfer->write_offset - start),
+                        SYNC_FILE_RANGE_WRITE);
+#else
+    (void) start;
+#endif
+
+    return TRUE;
+}
+
+/** Alignment (in bytes) of the offsets in the file at which the blocks
+ * of the write buffer are written out */
+#define LR_WRITEBUFFER_ALIGNMENT        4096
+
+/** Submit asynchronous write of the content of the write buffer and swap
+ * the buffers, so the next data could be stored while the disk is busy.
+ * Only the previous write of the target is waited for (if still pending).
+ * The block is digested while the disk writes it.
+ */
+static gboolean
+submit_write_buffer(LrTarget *target, GError **err)
+{
+    LrTransfer *transfer = target->transfer;
+    size_t used = transfer->writebuf_used;
+    char *buf;
+
+    assert(transfer->aio);
+
+    if (!lr_asyncio_wait(transfer->aio, &transfer->write_req, err))
+        return FALSE;
+
+    buf = transfer->writebuf;
+    transfer->writebuf = transfer->writebuf_pending;
+    transfer->writebuf_pending = buf;
+    transfer->writebuf_used = 0;
+
+    if (!lr_asyncio_write(transfer->aio, &transfer->write_req,
+                          fileno(target->f), buf, used,
+                          transfer->write_offset, transfer->early_writeback,
+                          err))
+        return FALSE;
+
+    transfer->write_offset += used;
+    digest_written_data(target, buf, used);
+    return TRUE;
+}
+
+/** Write out content of the write buffer of the target.
+ * With asynchronous writes, wait until all the data are written.
+ */
+static gboolean
+flush_write_buffer(LrTarget *target, GError **err)
+{
+    LrTransfer *transfer = target->transfer;
+    size_t used = transfer->writebuf_used;
+
+    if (transfer->aio) {
+        if (!submit_write_buffer(target, err))
+            return FALSE;
+        return lr_asyncio_wait(transfer->aio, &transfer->write_req, err);
+    }
+
+    transfer->writebuf_used = 0;
+    if (!write_at_offset(target, transfer->writebuf, used, err))
+        return FALSE;
+    digest_written_data(target, transfer->writebuf, used);
+    return TRUE;
+}
+
+/** Return number of bytes which fill the write buffer of the target.
+ * If the data of the buffer don't start at an aligned offset of
+ * the file (a resumed transfer), the block is shortened, so the next
+ * blocks start at aligned offsets.
+ */
+static size_t
+write_buffer_limit(LrTransfer *transfer)
+{
+    size_t misalignment = (size_t) (transfer->write_offset
+                                    % LR_WRITEBUFFER_ALIGNMENT);
+
+    if (transfer->writebuf_size <= LR_WRITEBUFFER_ALIGNMENT)
+        return transfer->writebuf_size;
+    return transfer->writebuf_size - misalignment;
+}
+
+/** Store data to the write buffer of the target.
+ * The buffer is written out (and its data are digested, see
+ * digest_written_data()) when it is full, so the small chunks from curl
+ * are processed in whole blocks. Data which doesn't fit into an empty
+ * buffer are written directly.
+ */
+static gboolean
+buffered_write(LrTarget *target, const char *ptr, size_t len)
+{
+    LrTransfer *transfer = target->transfer;
+    gboolean ret = TRUE;
+    GError *tmp_err = NULL;
+
+    while (ret && len > 0) {
+        size_t limit = write_buffer_limit(transfer);
+
+        if (transfer->writebuf_used == 0 && len >= transfer->writebuf_size
+            && !transfer->aio)
+        {
+            // Write big chunks directly
+            ret = write_at_offset(target, ptr, len, &tmp_err);
+            if (ret)
+                digest_written_data(target, ptr, len);
+            break;
+        }
+
+        size_t to_copy = MIN(len, limit - transfer->writebuf_used);
+        memcpy(transfer->writebuf + transfer->writebuf_used, ptr, to_copy);
+        transfer->writebuf_used += to_copy;
+        ptr += to_copy;
+        len -= to_copy;
+
+        if (transfer->writebuf_used == limit)
+            ret = transfer->aio ? submit_write_buffer(target, &tmp_err)
+                                : flush_write_buffer(target, &tmp_err);
+    }
+
+    if (!ret) {
+        g_debug("%s: Error while writting out file: %s",
+                __func__, tmp_err->message);
+        g_error_free(tmp_err);
+    }
+
+    return ret;
+}
+
+/** Save the resume journal of the running transfer of the target.
+ * The data received so far are written out first, so the journal
+ * never covers more than the file contains. The checksum states are
+ * saved only if the checksums were calculated from all the data.
+ */
+static void
+save_transfer_journal(LrTarget *target)
+{
+    LrTransfer *transfer = target->transfer;
+    LrResumeJournal journal = { 0 };
+    long filetime = -1;
+    GError *tmp_err = NULL;
+
+    if (!transfer || !transfer->url || !target->f)
+        return;
+
+    if (transfer->writebuf ? !flush_write_buffer(target, NULL)
+                           : fflush(target->f) != 0)
+        return;
+
+    journal.offset = MAX(target->original_offset, 0) + target->writecb_recieved;
+    if (journal.offset <= 0)
+        return;
+
+    journal.url = g_strdup(transfer->url);
+    journal.etag = g_strdup(target->etag);
+    if (target->curl_handle
+        && curl_easy_getinfo(target->curl_handle, CURLINFO_FILETIME,
+                             &filetime) == CURLE_OK && filetime > 0)
+        journal.lastmodified = filetime;
+
+    if (target->checksum_ctxs && target->checksum_ctxs_len == journal.offset)
+        for (GSList *elem = target->checksum_ctxs; elem; elem = g_slist_next(elem)) {
+            LrStreamChecksum *stream_checksum = elem->data;
+            LrChecksumType type = lr_checksumctx_type(stream_checksum->ctx);
+            journal.states[type] = lr_checksumctx_save(stream_checksum->ctx);
+        }
+
+    _cleanup_free_ gchar *path = lr_resume_journal_path(target_fn(target));
+    if (lr_resume_journal_save(path, &journal, &tmp_err)) {
+        target->journal_offset = journal.offset;
+    } else {
+        g_debug("%s: Cannot save %s: %s", __func__, path, tmp_err->message);
+        g_error_free(tmp_err);
+    }
+
+    lr_resume_journal_clear(&journal);
+}
+
+/** Save the resume journal if enough data were received since it was
+ * saved the last time.
+ */
+static void
+update_transfer_journal(LrTarget *target)
+{
+    gint64 offset;
+
+    if (!target->transfer->url)
+        return;
+
+    offset = MAX(target->original_offset, 0) + target->writecb_recieved;
+    if (offset - target->journal_offset >= LR_RESUME_JOURNAL_INTERVAL)
+        save_transfer_journal(target);
+}
+
+/** Load the resume journal of the partial file of the target to its
+ * transfer. The data after the offset of the journal (written after
+ * its last update) are dropped if truncate is TRUE, otherwise
+ * the journal has to match the size of the file exactly.
+ * @return      Offset where the transfer continues
+ */
+static gint64
+load_transfer_journal(LrTarget *target, int fd, gint64 size, gboolean truncate)
+{
+    LrResumeJournal *journal = lr_malloc0(sizeof(*journal));
+    _cleanup_free_ gchar *path = lr_resume_journal_path(target_fn(target));
+
+    if (!lr_resume_journal_load(path, journal)
+        || journal->offset > size
+        || (journal->offset < size && !truncate)
+        || (journal->offset < size && ftruncate(fd, journal->offset) == -1))
+    {
+        g_debug("%s: Journal %s cannot be used", __func__, path);
+        lr_resume_journal_clear(journal);
+        lr_free(journal);
+        unlink(path);  // The next journal is written from scratch
+        return size;
+    }
+
+    g_debug("%s: Resuming %s from %"G_GINT64_FORMAT" bytes "
+            "(%"G_GINT64_FORMAT" bytes in the file)", __func__,
+            target_fn(target), journal->offset, size);
+
+    target->journal_offset = journal->offset;
+    target->transfer->journal = journal;
+    return journal->offset;
+}
+
+/** Request the rest of the file by "If-Range", so the server sends
+ * the whole file if the object was changed since the journal of
+ * the transfer was saved. Only a journal of the same URL with a strong
+ * validator could be used.
+ * @return      FALSE if the If-Range cannot be used
+ */
+static gboolean
+prepare_if_range_request(LrTarget *target, CURL *h, gint64 offset)
+{
+    static const char *days[] = { "Sun", "Mon", "Tue", "Wed", "Thu",
+                                  "Fri", "Sat" };
+    static const char *months[] = { "Jan", "Feb", "Mar", "Apr", "May", "Jun",
+                                    "Jul", "Aug", "Sep", "Oct", "Nov", "Dec" };
+    LrTransfer *transfer = target->transfer;
+    LrResumeJournal *journal = transfer->journal;
+    _cleanup_free_ gchar *header = NULL;
+    _cleanup_free_ gchar *range = NULL;
+
+    if (!journal || journal->offset != offset
+        || g_strcmp0(journal->url, transfer->url))
+        return FALSE;
+
+    if (target->target->expectedsize > 0
+        && offset >= target->target->expectedsize)
+        // Let curl handle the 416 response to a complete file
+        return FALSE;
+
+    if (journal->etag && !g_str_has_prefix(journal->etag, "W/")) {
+        header = g_strconcat("If-Range: ", journal->etag, NULL);
+    } else if (journal->lastmodified > 0) {
+        // HTTP-date (RFC 7231), names must not be localized
+        time_t t = (time_t) journal->lastmodified;
+        struct tm tm;
+        if (!gmtime_r(&t, &tm))
+            return FALSE;
+        header = g_strdup_printf("If-Range: %s, %02d %s %04d %02d:%02d:%02d GMT",
+                                 days[tm.tm_wday], tm.tm_mday,
+                                 months[tm.tm_mon], tm.tm_year + 1900,
+                                 tm.tm_hour, tm.tm_min, tm.tm_sec);
+    } else {
+        return FALSE;
+    }
+
+    // Unlike CURLOPT_RESUME_FROM_LARGE, a 200 response is not an error
+    range = g_strdup_printf("%"G_GINT64_FORMAT"-", offset);
+    if (curl_easy_setopt(h, CURLOPT_RANGE, range) != CURLE_OK)
+        return FALSE;
+
+    curl_slist_free_all(target->curl_headers);
+    target->curl_headers = curl_slist_append(NULL, header);
+    curl_easy_setopt(h, CURLOPT_HTTPHEADER, target->curl_headers);
+    transfer->if_range = TRUE;
+
+    g_debug("%s: %s (range %s)", __func__, header, range);
+    return TRUE;
+}
+
+/** Check the response of an If-Range request. If the server sends
+ * the whole file (the object was changed), the partial file and its
+ * journal are dropped and the transfer continues from the beginning.
+ * @return      FALSE if the file cannot be truncated
+ */
+static gboolean
+check_if_range_response(LrTarget *target)
+{
+    LrTransfer *transfer = target->transfer;
+    long code = 0;
+
+    transfer->if_range = FALSE;
+
+    curl_easy_getinfo(target->curl_handle, CURLINFO_RESPONSE_CODE, &code);
+    if (code != 200)
+        return TRUE;
+
+    g_debug("%s: %s was changed on the server, downloading it again",
+            __func__, target->target->path);
+
+    if (ftruncate(fileno(target->f), 0) == -1
+        || fseek(target->f, 0L, SEEK_SET) != 0)
+    {
+        transfer->headercb_state = LR_HCS_INTERRUPTED;
+        transfer->headercb_interrupt_reason = g_strdup_printf(
+            "Cannot truncate the changed file: %s", g_strerror(errno));
+        return FALSE;
+    }
+
+    target->original_offset = 0;
+    transfer->write_offset = 0;
+    remove_target_journal(target);
+    lr_resume_journal_clear(transfer->journal);
+    lr_free(transfer->journal);
+    transfer->journal = NULL;
+
+    // Everything what depends on the beginning of the file starts again
+    prepare_transfer_checksums(target);
+    prepare_transfer_pieces(target);
+    prepare_transfer_decompression(target);
+    prepare_transfer_streaming(target);
+    prepare_transfer_outputs(target);
+
+    return TRUE;
+}
+
+/** Close the file of the target and free data related to the transfer.
+ * Content of the write buffer is discarded.
+ */
+static void
+close_transfer_file(LrTarget *target)
+{
+    wait_transfer_writes(target->transfer);
+    fclose(target->f);
+    target->f = NULL;
+    free_transfer_checksums(target);
+    lr_decompressor_free(target->decompressor);
+    target->decompressor = NULL;
+    free_transfer(target);
+}
+
+/** Maximal time (msec) the bucket of the limiter could be filled for.
+ * It limits the burst after a period of inactivity. */
+#define LR_BANDWIDTH_BURST_MS           100
+
+/** Maximal time (msec) of waiting for events while some transfers are
+ * paused by the limiter. */
+#define LR_BANDWIDTH_TICK_MS            20
+
+/** Add tokens for the time elapsed since the last refill.
+ */
+static void
+bandwidth_limiter_refill(LrBandwidthLimiter *limiter)
+{
+    gint64 now = g_get_monotonic_time();
+    gdouble capacity = limiter->max_speed * (LR_BANDWIDTH_BURST_MS / 1000.0);
+
+    limiter->tokens += limiter->max_speed
+                       * ((now - limiter->last_refill) / 1000000.0);
+    if (limiter->tokens > capacity)
+        limiter->tokens = capacity;
+    limiter->last_refill = now;
+}
+
+/** Take tokens for the received data from the bucket.
+ * Return FALSE if the bucket is empty and the transfer has to wait.
+ */
+static gboolean
+bandwidth_limiter_take(LrBandwidthLimiter *limiter, gint64 bytes)
+{
+    LrBandwidthLimiter *bucket = limiter->shared ? limiter->shared : limiter;
+    gboolean available;
+
+    if (bucket->lock)
+        g_mutex_lock(bucket->lock);
+    bandwidth_limiter_refill(bucket);
+    available = bucket->tokens > 0.0;
+    if (available)
+        bucket->tokens -= bytes;
+    if (bucket->lock)
+        g_mutex_unlock(bucket->lock);
+
+    return available;
+}
+
+/** Return TRUE if the bucket (refilled now) is not empty.
+ */
+static gboolean
+bandwidth_limiter_available(LrBandwidthLimiter *limiter)
+{
+    LrBandwidthLimiter *bucket = limiter->shared ? limiter->shared : limiter;
+    gboolean available;
+
+    if (bucket->lock)
+        g_mutex_lock(bucket->lock);
+    bandwidth_limiter_refill(bucket);
+    available = bucket->tokens > 0.0;
+    if (bucket->lock)
+        g_mutex_unlock(bucket->lock);
+
+    return available;
+}
+
+/** Resume transfers paused by the limiter if the bucket is not empty.
+ */
+static void
+resume_paused_transfers(LrDownload *dd)
+{
+    if (!dd->limiter.paused_transfers)
+        return;
+
+    if (!bandwidth_limiter_available(&dd->limiter))
+        return;
+
+    for (guint x = 0; x < dd->running_transfers->len; x++) {
+        LrTarget *target = g_ptr_array_index(dd->running_transfers, x);
+        if (!target->paused)
+            continue;
+        // Note: The write callback could be called (and the transfer
+        // paused again) directly from the curl_easy_pause()
+        target->paused = FALSE;
+        dd->limiter.paused_transfers--;
+        curl_easy_pause(target->curl_handle, CURLPAUSE_CONT);
+    }
+}
+
+/** Write data of a segment to its position in the file.
+ * The transfer is interrupted if the server doesn't respect
+ * the requested range.
+ */
+static size_t
+lr_writecb_segment(char *ptr, size_t size, size_t nmemb, LrTarget *target)
+{
+    gint64 all = size * nmemb;  // Total number of bytes from curl
+    gint64 length = target->segment_end - target->segment_start + 1;
+    int fd = fileno(target->f);
+
+    if (target->writecb_recieved == 0 && target->protocol == LR_PROTOCOL_HTTP) {
+        // Check that server sends only the requested range
+        long code = 0;
+        curl_easy_getinfo(target->curl_handle, CURLINFO_RESPONSE_CODE, &code);
+        if (code != 206) {
+            target->transfer->headercb_state = LR_HCS_INTERRUPTED;
+            target->transfer->headercb_interrupt_reason = g_strdup_printf(
+                "Server doesn't support byte ranges (status code: %ld)",
+                code);
+            return 0;
+        }
+    }
+
+    if (target->writecb_recieved + all > length) {
+        target->transfer->headercb_state = LR_HCS_INTERRUPTED;
+        target->transfer->headercb_interrupt_reason = g_strdup_printf(
+            "Server sent more data than the requested range "
+            "(%"G_GINT64_FORMAT"-%"G_GINT64_FORMAT")",
+            target->segment_start, target->segment_end);
+        return 0;
+    }
+
+    while (all > 0) {
+        off_t offset = (off_t) (target->segment_start + target->writecb_recieved);
+        ssize_t written = pwrite(fd, ptr, all, offset);
+        if (written == -1) {
+            g_debug("%s: Error while writting out file: %s",
+                    __func__, strerror(errno));
+            return 0;
+        }
+        ptr += written;
+        all -= written;
+        target->writecb_recieved += written;
+        target->segment_written += written;
+    }
+
+    return nmemb;
+}
+
+/** Write the data which belong to the byte range of the target
+ * to its file. The range is written sequentially: data of the range
+ * which were already written are skipped and data after a gap are
+ * ignored (the range is not complete then).
+ */
+static gboolean
+write_range_data(LrTarget *target, gint64 offset, const char *ptr, size_t len)
+{
+    gint64 start = MAX(target->target->byterangestart, 0);
+    gint64 end = target->target->byterangeend;
+    gint64 next = start + target->writecb_recieved;
+    gint64 ptr_end = offset + (gint64) len - 1;
+
+    if (next > end || next < offset || next > ptr_end)
+        return TRUE;  // Nothing which could be written
+
+    size_t count = (size_t) (MIN(end, ptr_end) - next + 1);
+    if (fwrite(ptr + (next - offset), 1, count, target->f) != count) {
+        g_debug("%s: Error while writting out file: %s",
+                __func__, strerror(errno));
+        return FALSE;
+    }
+
+    target->writecb_recieved += count;
+    return TRUE;
+}
+
+/** Return TRUE if the whole byte range of the target was written.
+ */
+static gboolean
+range_written(LrTarget *target)
+{
+    gint64 start = MAX(target->target->byterangestart, 0);
+    return target->writecb_recieved == target->target->byterangeend - start + 1;
+}
+
+/** Write the data from the offset of the object to the files of all
+ * targets of the batch of byte ranges (LrMultipartDataCb).
+ */
+static gboolean
+write_batch_data(void *userdata, gint64 offset, const char *ptr, size_t len)
+{
+    LrTarget *target = userdata;
+
+    if (!write_range_data(target, offset, ptr, len))
+        return FALSE;
+
+    for (GSList *elem = target->range_batch; elem; elem = g_slist_next(elem))
+        if (!write_range_data(elem->data, offset, ptr, len))
+            return FALSE;
+
+    return TRUE;
+}
+
+/** Write data of a response to the request of a batch of byte ranges.
+ * The response is a multipart/byteranges one, a single range (if
+ * the server merged the ranges) or the whole object (if the server
+ * ignored them).
+ */
+static size_t
+lr_writecb_batch(char *ptr, size_t size, size_t nmemb, LrTarget *target)
+{
+    LrTransfer *transfer = target->transfer;
+    size_t all = size * nmemb;  // Total number of bytes from curl
+
+    if (!transfer->batch_started) {
+        long code = 0;
+        char *content_type = NULL;
+        _cleanup_free_ gchar *boundary = NULL;
+
+        transfer->batch_started = TRUE;
+        curl_easy_getinfo(target->curl_handle, CURLINFO_RESPONSE_CODE, &code);
+        curl_easy_getinfo(target->curl_handle, CURLINFO_CONTENT_TYPE,
+                          &content_type);
+        if (code == 206 && content_type)
+            boundary = lr_multipart_boundary(content_type);
+
+        if (boundary) {
+            transfer->multipart = lr_multipart_new(boundary,
+                                                   write_batch_data,
+                                                   target);
+        } else if (code == 206 && transfer->batch_range_start >= 0) {
+            transfer->batch_offset = transfer->batch_range_start;
+        } else if (code == 200) {
+            g_debug("%s: Server ignored the byte ranges, the beginning "
+                    "of the object up to %"G_GINT64_FORMAT" is used",
+                    __func__, transfer->batch_end);
+            transfer->batch_offset = 0;
+            transfer->batch_whole = TRUE;
+        } else {
+            transfer->headercb_state = LR_HCS_INTERRUPTED;
+            transfer->headercb_interrupt_reason = g_strdup_printf(
+                "Unexpected response to a request of byte ranges "
+                "(status code: %ld)", code);
+            return 0;
+        }
+    }
+
+    if (transfer->multipart) {
+        GError *tmp_err = NULL;
+
+        if (!lr_multipart_feed(transfer->multipart, ptr, all, &tmp_err)) {
+            transfer->headercb_state = LR_HCS_INTERRUPTED;
+            transfer->headercb_interrupt_reason = g_strdup(tmp_err->message);
+            g_error_free(tmp_err);
+            return 0;
+        }
+        return nmemb;
+    }
+
+    if (!write_batch_data(target, transfer->batch_offset, ptr, all))
+        return 0;
+    transfer->batch_offset += all;
+
+    if (transfer->batch_whole && transfer->batch_offset > transfer->batch_end) {
+        // All the ranges were received, abort the transfer
+        // with error code CURLE_WRITE_ERROR
+        transfer->writecb_required_range_written = TRUE;
+        return 0;
+    }
+
+    return nmemb;
+}
+
+/** Write callback for CURL handles.
+ * This callback handles situation when an user wants only specified
+ * byte range of the target file.
+ */
+size_t
+lr_writecb(char *ptr, size_t size, size_t nmemb, void *userdata)
+{
+    size_t cur_written_expected = nmemb;
+    size_t cur_written;
+    LrTarget *target = (LrTarget *) userdata;
+    gint64 all = size * nmemb;  // Total number of bytes from curl
+    gint64 range_start = target->target->byterangestart;
+    gint64 range_end = target->target->byterangeend;
+
+    if (target->limiter && !bandwidth_limiter_take(target->limiter, all)) {
+        // Wait until the bucket of the limiter is refilled
+        target->paused = TRUE;
+        target->limiter->paused_transfers++;
+        return CURL_WRITEFUNC_PAUSE;
+    }
+
+    if (is_range_transfer(target))
+        return lr_writecb_segment(ptr, size, nmemb, target);
+
+    if (target->range_batch)
+        return lr_writecb_batch(ptr, size, nmemb, target);
+
+    if (target->transfer->range_requested && target->writecb_recieved == 0) {
+        // The data are expected to start at the byterangestart
+        long code = 0;
+        curl_easy_getinfo(target->curl_handle, CURLINFO_RESPONSE_CODE, &code);
+        if (code != 206) {
+            target->transfer->headercb_state = LR_HCS_INTERRUPTED;
+            target->transfer->headercb_interrupt_reason = g_strdup_printf(
+                "Server doesn't support byte ranges (status code: %ld)",
+                code);
+            return 0;
+        }
+    }
+
+    if (target->transfer->if_range && !check_if_range_response(target))
+        return 0;
+
+    if (target->transfer->content_encoded
+        && target->target->expectedsize > 0
+        && target->writecb_recieved + all > target->target->expectedsize)
+    {
+        // The size of the decoded data is not known from the headers
+        target->transfer->headercb_state = LR_HCS_INTERRUPTED;
+        target->transfer->headercb_interrupt_reason = g_strdup_printf(
+            "Decoded data are bigger than the expected size: %"
+            G_GINT64_FORMAT, target->target->expectedsize);
+        return 0;
+    }
+
+    if (range_start <= 0 && range_end <= 0 && target->transfer->writebuf) {
+        // Write everything curl give to you through the write buffer,
+        // the data are digested when the buffer is written out
+        target->writecb_recieved += all;
+        if (!buffered_write(target, ptr, all))
+            return 0;
+        update_transfer_journal(target);
+        return nmemb;
+    }
+
+    if (range_start <= 0 && range_end <= 0) {
+        // Write everything curl give to you
+        target->writecb_recieved += all;
+        cur_written = fwrite(ptr, size, nmemb, target->f);
+        digest_written_data(target, ptr, cur_written * size);
+        update_transfer_journal(target);
+        return cur_written;
+    }
+
+    /* Deal with situation when user wants only specific byte range of the
+     * target file, and write only the range.
+     */
+
+    gint64 cur_range_start = target->writecb_recieved;
+    gint64 cur_range_end = cur_range_start + all;
+
+    target->writecb_recieved += all;
+
+    if (target->target->byterangestart > 0) {
+        // If byterangestart is specified, then CURLOPT_RESUME_FROM_LARGE
+        // is used by default
+        cur_range_start += target->target->byterangestart;
+        cur_range_end   += target->target->byterangestart;
+    } else if (target->original_offset > 0) {
+        cur_range_start += target->original_offset;
+        cur_range_end   += target->original_offset;
+    }
+
+    if (cur_range_end < range_start)
+        // The wanted byte range doesn't start yet
+        return nmemb;
+
+    if (range_end != 0 && cur_range_start > range_end) {
+        // The wanted byte range is over
+        // Return zero that will lead to transfer abortion
+        // with error code CURLE_WRITE_ERROR
+        target->transfer->writecb_required_range_written = TRUE;
+        return 0;
+    }
+
+    size = 1;
+    nmemb = all;
+
+    if (cur_range_start >= range_start) {
+        // Write the current curl passed range from the start
+        ;
+    } else {
+        // Find the right starting offset
+        gint64 offset = range_start - cur_range_start;
+        assert(offset > 0);
+        ptr += offset;
+        // Corret the length appropriately
+        nmemb = all - offset;
+    }
+
+    if (range_end != 0) {
+        // End range is specified
+
+        if (cur_range_end <= range_end) {
+            // Write the current curl passed range to the end
+            ;
+        } else {
+            // Find the length of the new sequence
+            gint64 offset = cur_range_end - range_end;
+            assert(offset > 0);
+            // Corret the length appropriately
+            nmemb -= (offset - 1);
+        }
+    }
+
+    assert(nmemb > 0);
+    cur_written = fwrite(ptr, size, nmemb, target->f);
+    if (cur_written != nmemb) {
+        g_debug("%s: Error while writting out file: %s",
+                __func__, strerror(errno));
+        return 0; // There was an error
+    }
+
+    return cur_written_expected;
+}
+
+
+static gboolean
+finish_segmented_target(LrDownload *dd, LrTarget *target, GError **err);
+
+/** Return maximal number of transfers from the mirror.
+ * -1 means no limit.
+ */
+static int
+mirror_max_transfers(LrDownload *dd, LrMirror *mirror)
+{
+    if (dd->max_connection_per_host == -1)
+        return -1;
+    if (dd->adaptive_connections && mirror->allowed_transfers > 0)
+        return mirror->allowed_transfers;
+    return dd->max_connection_per_host;
+}
+
+/** Return number of running transfers from the mirror. For a sharded
+ * download these are the transfers of all shards, so the limits of
+ * the mirror are shared by them. (Shards which check the limit at once
+ * could exceed it by a transfer each.)
+ */
+static int
+mirror_running_transfers(LrMirror *mirror)
+{
+    if (mirror->shard_transfers)
+        return g_atomic_int_get(mirror->shard_transfers);
+    return mirror->running_transfers;
+}
+
+/** Count a started (step 1) or a stopped (step -1) transfer
+ * from the mirror.
+ */
+static void
+step_running_transfers(LrMirror *mirror, int step)
+{
+    mirror->running_transfers += step;
+    if (mirror->shard_transfers)
+        g_atomic_int_add(mirror->shard_transfers, step);
+}
+
+/** Return TRUE if the mirror is currently used by a segment of the target.
+ */
+static gboolean
+mirror_used_by_segments(LrTarget *target, LrMirror *mirror)
+{
+    for (GSList *elem = target->segments; elem; elem = g_slist_next(elem)) {
+        LrTarget *segment = elem->data;
+        if (segment->state == LR_DS_RUNNING && segment->mirror == mirror)
+            return TRUE;
+    }
+
+    return FALSE;
+}
+
+/** Return number of segments the target should be split into.
+ * Only a target with known size, which is downloaded from mirrors
+ * as a whole, could be split.
+ */
+static gint64
+segments_count(LrDownload *dd, LrTarget *target)
+{
+    gint64 count;
+    gint64 mirrors = 0;
+    LrDownloadTarget *dtarget = target->target;
+
+    if (dd->max_segments < 2 || is_range_transfer(target)
+        || target->segmentation_tried)
+        return 0;
+
+    if (dtarget->expectedsize <= 0
+        || dtarget->resume
+        || dtarget->byterangestart > 0
+        || dtarget->byterangeend > 0
+        || dtarget->baseurl
+        || dtarget->samemirror
+        || (dtarget->cachesources && target->cachemirrors)
+        || strstr(dtarget->path, "://"))
+        return 0;
+
+    for (GSList *elem = target->lrmirrors; elem; elem = g_slist_next(elem)) {
+        LrMirror *mirror = elem->data;
+        // Files on local mirrors are copied as a whole
+        if (mirror->mirror->protocol != LR_PROTOCOL_RSYNC
+            && mirror->mirror->protocol != LR_PROTOCOL_FILE)
+            mirrors++;
+    }
+
+    count = MIN(dd->max_segments, dtarget->expectedsize / dd->min_segment_size);
+    count = MIN(count, mirrors);
+
+    return count;
+}
+
+/** Split the target into segments which are downloaded in parallel.
+ * The file is truncated to its expected size and each segment
+ * writes its part of the file directly to its position.
+ * If the file cannot be prepared, the target is downloaded as a whole.
+ */
+static gboolean
+split_target_into_segments(LrDownload *dd, LrTarget *target, GError **err)
+{
+    int rc;
+    gint64 count = segments_count(dd, target);
+    gint64 size = target->target->expectedsize;
+    gint64 segment_size = size / count;
+
+    assert(!err || *err == NULL);
+    assert(count > 1);
+
+    target->segmentation_tried = TRUE;
+
+    if (target->target->fn) {
+        int fd = open(target_fn(target), O_CREAT|O_TRUNC|O_RDWR, 0666);
+        if (fd < 0) {
+            g_set_error(err, LR_DOWNLOADER_ERROR, LRE_IO,
+                        "Cannot open %s: %s",
+                        target_fn(target), strerror(errno));
+            return FALSE;
+        }
+        rc = ftruncate(fd, (off_t) size);
+        if (rc == 0 && dd->preallocate)
+            preallocate_file(fd, 0, size);
+        close(fd);
+    } else if (lseek(target_fd(target), 0, SEEK_CUR) != 0) {
+        // Segments are written from the beginning of the file
+        g_debug("%s: File descriptor is not at the beginning of the file, "
+                "%s won't be split", __func__, target->target->path);
+        return TRUE;
+    } else {
+        rc = ftruncate(target_fd(target), (off_t) size);
+        if (rc == 0 && dd->preallocate)
+            preallocate_file(target_fd(target), 0, size);
+    }
+
+    if (rc == -1) {
+        g_debug("%s: Cannot preallocate %s (%s), it won't be split",
+                __func__, target->target->path, strerror(errno));
+        return TRUE;
+    }
+
+    g_debug("%s: Splitting %s into %"G_GINT64_FORMAT" segments",
+            __func__, target->target->path, count);
+
+    for (gint64 x = 0; x < count; x++) {
+        LrTarget *segment = lr_malloc0(sizeof(*segment));
+        segment->queue_seq       = dd->next_queue_seq++;
+        segment->target          = target->target;
+        segment->original_offset = -1;
+        segment->lrmirrors       = target->lrmirrors;
+        segment->handle          = target->handle;
+        segment->limiter         = target->limiter;
+        segment->parent          = target;
+        segment->segment_start   = x * segment_size;
+        segment->segment_end     = (x == count - 1) ? size - 1
+                                   : (x + 1) * segment_size - 1;
+        target->segments = g_slist_append(target->segments, segment);
+        g_ptr_array_add(dd->targets, segment);
+        queue_target(dd, segment);
+    }
+
+    target->state = LR_DS_RUNNING;
+
+    return TRUE;
+}
+
+
+/** Return the first element of the mirrors of the target. The cache
+ * sources are tried before the mirrors if the target uses them.
+ */
+static GSList *
+first_mirror(LrTarget *target)
+{
+    if (target->target->cachesources && target->cachemirrors)
+        return target->cachemirrors;
+    return target->lrmirrors;
+}
+
+/** Return the element of the mirrors of the target after the elem.
+ */
+static GSList *
+next_mirror(LrTarget *target, GSList *elem)
+{
+    LrMirror *mirror = elem->data;
+
+    if (!elem->next && mirror->cache)
+        return target->lrmirrors;  // The last cache source was passed
+    return elem->next;
+}
+
+/** Min and max time for which the circuit breaker of a mirror opens
+ * (see LRO_MIRRORBREAKER) in usec. The time doubles with every opening.
+ */
+#define LR_BREAKER_BACKOFF_MIN          (1 * G_USEC_PER_SEC)
+#define LR_BREAKER_BACKOFF_MAX          (60 * G_USEC_PER_SEC)
+
+/** Return TRUE if the circuit breaker of the mirror doesn't allow
+ * a transfer now. The time when the breaker becomes half-open is
+ * noted to the dd->breaker_wakeup, so the download waits for it.
+ */
+static gboolean
+breaker_is_open(LrDownload *dd, LrMirror *mirror, gint64 now)
+{
+    if (!mirror->breaker_until)
+        return FALSE;  // Closed
+
+    if (mirror->breaker_probing)
+        return TRUE;  // Half-open, the result of the probe is awaited
+
+    if (now >= mirror->breaker_until)
+        return FALSE;  // Half-open, a probe is allowed
+
+    if (!dd->breaker_wakeup || mirror->breaker_until < dd->breaker_wakeup)
+        dd->breaker_wakeup = mirror->breaker_until;
+    return TRUE;
+}
+
+/** The mirror was selected for a transfer. */
+static void
+breaker_selected(LrMirror *mirror)
+{
+    if (mirror->breaker_until) {
+        g_debug("%s: Probing mirror %s", __func__, mirror->mirror->url);
+        mirror->breaker_probing = TRUE;
+    }
+}
+
+/** Open the circuit breaker of the mirror if the failed transfer was
+ * the probe or if it was one too many.
+ */
+static void
+breaker_failure(LrDownload *dd, LrMirror *mirror)
+{
+    mirror->consecutive_failures++;
+
+    if (dd->mirror_breaker <= 0)
+        return;
+
+    if (!mirror->breaker_probing
+        && (mirror->breaker_until
+            || mirror->consecutive_failures < dd->mirror_breaker))
+        return;
+
+    gint64 backoff = LR_BREAKER_BACKOFF_MIN << MIN(mirror->breaker_trips, 16);
+    backoff = MIN(backoff, LR_BREAKER_BACKOFF_MAX);
+    mirror->breaker_trips++;
+    mirror->breaker_until = g_get_monotonic_time() + backoff;
+    mirror->breaker_probing = FALSE;
+    g_debug("%s: Mirror %s is not used for %.1f s (%d failures in a row)",
+            __func__, mirror->mirror->url,
+            backoff / (gdouble) G_USEC_PER_SEC, mirror->consecutive_failures);
+}
+
+/** Close the circuit breaker of the mirror. */
+static void
+breaker_success(LrMirror *mirror)
+{
+    if (mirror->breaker_until)
+        g_debug("%s: Mirror %s works again", __func__, mirror->mirror->url);
+    mirror->consecutive_failures = 0;
+    mirror->breaker_trips = 0;
+    mirror->breaker_until = 0;
+    mirror->breaker_probing = FALSE;
+}
+
+/** Cap the wait of the download loop (ms, -1 for infinity) by the time
+ * when a target waiting for a circuit breaker could continue.
+ */
+static long
+breaker_wait_ms(LrDownload *dd, long wait_ms)
+{
+    if (!dd->breaker_wakeup)
+        return wait_ms;
+
+    gint64 left = (dd->breaker_wakeup - g_get_monotonic_time() + 999) / 1000;
+    left = MAX(left, 0);
+    return (wait_ms < 0 || left < wait_ms) ? (long) left : wait_ms;
+}
+
+/** Select a suitable mirror
+ */
+/** Maximal size of a target whose mirror is selected by the idle
+ * connections (see LRO_CONNECTIONAFFINITY). A larger target is
+ * downloaded from the best mirror, the handshakes don't matter. */
+#define LR_AFFINITY_MAX_SIZE            (1024 * 1024)
+
+/** Time (usec) after which an idle connection is not expected to be
+ * open anymore, servers close idle keep-alive connections soon */
+#define LR_AFFINITY_IDLE_TIMEOUT        (5 * G_USEC_PER_SEC)
+
+/** Note the connection to the mirror released by a successfully finished
+ * transfer. It stays in the connection cache of the handle and a next
+ * transfer from the mirror reuses it (see LRO_CONNECTIONAFFINITY).
+ */
+static void
+release_idle_connection(LrDownload *dd, LrMirror *mirror)
+{
+    if (!dd->connection_affinity || !mirror)
+        return;
+
+    mirror->idle_connections++;
+    mirror->idle_since = g_get_monotonic_time();
+}
+
+/** Return TRUE if the mirror has an idle connection which is probably
+ * still open.
+ */
+static gboolean
+idle_connection_available(LrMirror *mirror, gint64 now)
+{
+    if (mirror->idle_connections > 0
+        && now - mirror->idle_since > LR_AFFINITY_IDLE_TIMEOUT)
+        mirror->idle_connections = 0;  // Closed by the server meanwhile
+
+    return mirror->idle_connections > 0;
+}
+
+/** Note the use of an idle connection of the mirror by a new transfer.
+ */
+static void
+take_idle_connection(LrMirror *mirror)
+{
+    if (mirror->idle_connections > 0)
+        mirror->idle_connections--;
+}
+
+/** Return TRUE if the mirror of the target is selected preferably
+ * by the idle connections of the mirrors.
+ */
+static gboolean
+connection_affinity(LrDownload *dd, LrTarget *target)
+{
+    return dd->connection_affinity
+           && !target->parent
+           && !target->hedged
+           && target->target->expectedsize <= LR_AFFINITY_MAX_SIZE;
+}
+
+static gboolean
+select_suitable_mirror(LrDownload *dd,
+                       LrTarget *target,
+                       LrMirror **selected_mirror,
+                       GError **err)
+{
+
+    gboolean at_least_one_suitable_mirror_found = FALSE;
+    //  ^^^ This variable is used to indentify that all possible mirrors
+    // were already tried and the transfer shoud be marked as failed.
+    LrMirror *busy_mirror = NULL;
+    //  ^^^ Suitable mirror already used by another segment of the target
+    LrMirror *cold_mirror = NULL;
+    //  ^^^ Suitable mirror without an idle connection
+    gboolean affinity = connection_affinity(dd, target);
+    gint64 now = g_get_monotonic_time();
+
+    assert(dd);
+    assert(target);
+    assert(selected_mirror);
+    assert(!err || *err == NULL);
+
+    *selected_mirror = NULL;
+
+    // Iterate over mirror for the target
+    for (GSList *elem = first_mirror(target);
+         elem;
+         elem = next_mirror(target, elem))
+    {
+        LrMirror *c_mirror = elem->data;
+        gchar *mirrorurl = c_mirror->mirror->url; // shortcut
+
+        if (mirror_tried(target, c_mirror)) {
+            // This mirror was already tried for this target
+            continue;
+        }
+
+        if (c_mirror->mirror->protocol == LR_PROTOCOL_RSYNC) {
+            // Skip rsync mirrors
+            g_debug("%s: Skipping rsync url: %s", __func__, mirrorurl);
+            continue;
+        }
+
+        if (c_mirror->successful_transfers == 0 &&
+            dd->allowed_mirror_failures > 0 &&
+            c_mirror->failed_transfers >= dd->allowed_mirror_failures)
+        {
+            // Skip bad mirrors
+            g_debug("%s: Skipping bad mirror (%d failures and no success): %s",
+                    __func__, c_mirror->failed_transfers, mirrorurl);
+            continue;
+        }
+
+        at_least_one_suitable_mirror_found = TRUE;
+
+        if (breaker_is_open(dd, c_mirror, now)) {
+            // The mirror is expected to work again later
+            continue;
+        }
+
+        // Maximal number of transfers from the mirror. For multiplexed
+        // (HTTP/2) mirrors the limit of connections is multiplied
+        // by the number of streams allowed per connection.
+        int max_transfers = mirror_max_transfers(dd, c_mirror);
+        if (max_transfers != -1 && c_mirror->multiplexed)
+            max_transfers *= dd->max_streams_per_mirror;
+
+        // Number of transfers which are downloading from the mirror
+        // should always be lower or equal than maximum allowed number
+        // of transfers from a single host. (The adaptive number of
+        // transfers could be decreased while transfers are running.)
+        assert(max_transfers == -1 || dd->adaptive_connections ||
+               c_mirror->running_transfers <= max_transfers);
+
+        // Check number of transfers from the mirror
+        if (max_transfers != -1 &&
+            mirror_running_transfers(c_mirror) >= max_transfers)
+        {
+            continue;
+        }
+
+        if (target->parent && mirror_used_by_segments(target->parent, c_mirror)) {
+            // Prefer mirrors which are not used by other segments
+            if (!busy_mirror)
+                busy_mirror = c_mirror;
+            continue;
+        }
+
+        if (affinity && !idle_connection_available(c_mirror, now)) {
+            // Prefer a mirror whose connection is open already
+            if (!cold_mirror)
+                cold_mirror = c_mirror;
+            continue;
+        }
+
+        // This mirror looks suitable - use it
+        breaker_selected(c_mirror);
+        take_idle_connection(c_mirror);
+        *selected_mirror = c_mirror;
+        return TRUE;
+    }
+
+    if (cold_mirror) {
+        breaker_selected(cold_mirror);
+        *selected_mirror = cold_mirror;
+        return TRUE;
+    }
+
+    if (busy_mirror) {
+        breaker_selected(busy_mirror);
+        *selected_mirror = busy_mirror;
+        return TRUE;
+    }
+
+    if (!at_least_one_suitable_mirror_found && target->hedged) {
+        // No other mirror for the hedged request => Drop the request
+        g_debug("%s: No mirror for hedged request for %s", __func__,
+                target->target->path);
+        target->state = LR_DS_FAILED;
+        return TRUE;
+    }
+
+    if (!at_least_one_suitable_mirror_found && target->parent) {
+        // No suitable mirror for the segment => Set segment as failed
+        g_debug("%s: All mirrors were tried for segment "
+                "%"G_GINT64_FORMAT"-%"G_GINT64_FORMAT" of %s", __func__,
+                target->segment_start, target->segment_end,
+                target->target->path);
+        target->state = LR_DS_FAILED;
+        return finish_segmented_target(dd, target->parent, err);
+    }
+
+    if (!at_least_one_suitable_mirror_found) {
+        // No suitable mirror even exists => Set transfer as failed
+        g_debug("%s: All mirrors were tried without success", __func__);
+        target->state = LR_DS_FAILED;
+
+        lr_downloadtarget_set_error(target->target, LRE_NOURL,
+                    "Cannot download, all mirrors were already tried "
+                    "without success");
+
+
+        // Call end callback
+        if (call_endcb(dd, target, LR_TRANSFER_ERROR,
+                       "No more mirrors to try - All mirrors "
+                       "were already tried without success") == LR_CB_ERROR)
+        {
+            target->cb_return_code = LR_CB_ERROR;
+            g_debug("%s: Downloading was aborted by LR_CB_ERROR "
+                    "from end callback", __func__);
+            g_set_error(err, LR_DOWNLOADER_ERROR, LRE_CBINTERRUPTED,
+                    "Interupted by LR_CB_ERROR from end callback");
+            return FALSE;
+        }
+
+        if (dd->failfast) {
+            // Fail immediately
+            g_set_error(err, LR_DOWNLOADER_ERROR, LRE_NOURL,
+                        "Cannot download %s: All mirrors were tried",
+                        target->target->path);
+            return FALSE;
+        }
+
+        return finish_duplicates(dd, target, err);
+    }
+
+    return TRUE;
+}
+
+
+/** Fail the waiting target which cannot be downloaded.
+ */
+static gboolean
+fail_waiting_target(LrDownload *dd,
+                    LrTarget *target,
+                    LrRc rc,
+                    const char *msg,
+                    GError **err)
+{
+    g_debug("%s: %s: %s", __func__, target->target->path, msg);
+    target->state = LR_DS_FAILED;
+    lr_downloadtarget_set_error(target->target, rc, "%s", msg);
+
+    if (call_endcb(dd, target, LR_TRANSFER_ERROR, msg) == LR_CB_ERROR) {
+        target->cb_return_code = LR_CB_ERROR;
+        g_debug("%s: Downloading was aborted by LR_CB_ERROR "
+                "from end callback", __func__);
+        g_set_error(err, LR_DOWNLOADER_ERROR, LRE_CBINTERRUPTED,
+                "Interupted by LR_CB_ERROR from end callback");
+        return FALSE;
+    }
+
+    // A cancelled target doesn't stop the others
+    if (dd->failfast && rc != LRE_CANCELLED) {
+        g_set_error(err, LR_DOWNLOADER_ERROR, rc,
+                    "Cannot download %s: %s", target->target->path, msg);
+        return FALSE;
+    }
+
+    return finish_duplicates(dd, target, err);
+}
+
+/** Select the mirror of the target the target is pinned to
+ * (LrDownloadTarget.samemirror). The selected mirror is NULL if
+ * the target has to wait.
+ */
+static gboolean
+select_same_mirror(LrDownload *dd,
+                   LrTarget *target,
+                   LrMirror **selected_mirror,
+                   GError **err)
+{
+    LrTarget *lead = NULL;
+
+    *selected_mirror = NULL;
+
+    for (guint x = 0; x < dd->targets->len; x++) {
+        LrTarget *candidate = g_ptr_array_index(dd->targets, x);
+        if (candidate->target == target->target->samemirror) {
+            lead = candidate;
+            break;
+        }
+    }
+
+    if (!lead || (lead->state != LR_DS_WAITING && !lead->mirror))
+        // Not in this download or downloaded from its baseurl
+        return select_suitable_mirror(dd, target, selected_mirror, err);
+
+    if (lead->state == LR_DS_WAITING)
+        return TRUE;
+
+    if (lead->state == LR_DS_FAILED)
+        return fail_waiting_target(dd, target, LRE_NOURL,
+                                   "Download of the target it is pinned "
+                                   "to failed", err);
+
+    if (mirror_tried(target, lead->mirror))
+        return fail_waiting_target(dd, target, LRE_NOURL,
+                                   "Download from the mirror of the target "
+                                   "it is pinned to failed", err);
+
+    int max_transfers = mirror_max_transfers(dd, lead->mirror);
+    if (max_transfers != -1 && lead->mirror->multiplexed)
+        max_transfers *= dd->max_streams_per_mirror;
+    if (max_transfers != -1
+        && mirror_running_transfers(lead->mirror) >= max_transfers)
+        return TRUE;
+
+    *selected_mirror = lead->mirror;
+    return TRUE;
+}
+
+static gboolean
+free_slot_available(LrDownload *dd);
+
+/** Select next target
+ */
+static gboolean
+select_next_target(LrDownload *dd,
+                   LrTarget **selected_target,
+                   char **selected_full_url,
+                   GError **err)
+{
+    assert(dd);
+    assert(selected_target);
+    assert(selected_full_url);
+    assert(!err || *err == NULL);
+
+    *selected_target = NULL;
+    *selected_full_url = NULL;
+
+    // Only a slot reserved for the critical targets is free
+    gboolean reserved_only = !free_slot_available(dd);
+
+    GSequenceIter *iter = g_sequence_get_begin_iter(dd->waiting_targets);
+    while (!g_sequence_iter_is_end(iter)) {
+        LrTarget *target = g_sequence_get(iter);
+        LrMirror *mirror = NULL;
+        char *full_url = NULL;
+        int complete_url_in_path = 0;
+
+        iter = g_sequence_iter_next(iter);
+
+        assert(target->state == LR_DS_WAITING);
+
+        if (dd->deadline_at_risk && dd->running_transfers->len
+            && target->target->priorityclass == LR_PRIORITYCLASS_BACKGROUND)
+            continue;  // Leave the bandwidth to the target with a deadline
+
+        if (reserved_only
+            && target->target->priorityclass != LR_PRIORITYCLASS_CRITICAL) {
+            // Critical targets without a deadline are queued before
+            // this one
+            if (target->target->deadline <= 0.0)
+                break;
+            continue;
+        }
+
+        if (segments_count(dd, target) > 1) {
+            // Split the target, its segments are picked instead
+            if (!split_target_into_segments(dd, target, err))
+                return FALSE;
+            if (target->state != LR_DS_WAITING) {
+                // Segments were queued - start from the beginning
+                dequeue_target(target);
+                return select_next_target(dd, selected_target,
+                                          selected_full_url, err);
+            }
+        }
+
+        // Determine if path is a complete URL
+
+        complete_url_in_path = strstr(target->target->path, "://") ? 1 : 0;
+
+        // Sanity check
+
+        if (!target->target->baseurl
+            && !target->lrmirrors
+            && !complete_url_in_path)
+        {
+            // Used relative path with empty internal mirrorlist
+            // and no basepath specified!
+            g_debug("%s: Empty mirrorlist and no basepath specified", __func__);
+            g_set_error(err, LR_DOWNLOADER_ERROR, LRE_NOURL,
+                        "Empty mirrorlist and no basepath specified!");
+            return FALSE;
+        }
+
+        g_debug("%s: Selecting mirror for: %s", __func__, target->target->path);
+
+        // Prepare full target URL
+
+        if (complete_url_in_path) {
+            // Path is a complete URL (do not use mirror nor base URL)
+            full_url = g_strdup(target->target->path);
+        } else if (target->target->baseurl) {
+            // Base URL is specified
+            full_url = lr_pathconcat(target->target->baseurl,
+                                     target->target->path,
+                                     NULL);
+        } else {
+            // Find a suitable mirror
+            gboolean has_duplicates = (target->duplicates != NULL);
+            if (target->target->samemirror && !target->parent
+                && !target->hedged) {
+                if (!select_same_mirror(dd, target, &mirror, err))
+                    return FALSE;
+            } else if (!select_suitable_mirror(dd, target, &mirror , err)) {
+                return FALSE;
+            }
+
+            if (target->state != LR_DS_WAITING)
+                // All mirrors were tried
+                dequeue_target(target);
+
+            if (target->state == LR_DS_FAILED && has_duplicates) {
+                // Duplicates of the target were queued instead of it
+                // - start from the beginning
+                return select_next_target(dd, selected_target,
+                                          selected_full_url, err);
+            }
+
+            if (target->hedged && target->state == LR_DS_FAILED) {
+                free_hedge(target);
+                continue;
+            }
+
+            if (target->parent && target->parent->state == LR_DS_WAITING) {
+                // Segmented download failed and the whole target
+                // is waiting again - start from the beginning
+                return select_next_target(dd, selected_target,
+                                          selected_full_url, err);
+            }
+
+            if (mirror) {
+                // A mirror was found
+                full_url = lr_pathconcat(mirror->mirror->url,
+                                         target->target->path,
+                                         NULL);
+            } else {
+                // No free mirror
+                g_debug("%s: Currently there is no free mirror for: %s",
+                        __func__, target->target->path);
+            }
+        }
+
+        if (full_url) {  // A waiting target found
+            target->mirror = mirror;  // Note: mirror is NULL if baseurl is used
+            dequeue_target(target);
+
+            *selected_target = target;
+            *selected_full_url = full_url;
+
+            return TRUE;
+        }
+    }
+
+    // No suitable target found
+    return TRUE;
+}
+
+
+static gboolean
+local_transfer_possible(LrTarget *target, const char *full_url);
+
+static gboolean
+local_transfer(LrDownload *dd,
+               LrTarget *target,
+               const char *full_url,
+               GError **err);
+
+/** Prepares next transfer
+ */
+/** Make the request of the transfer conditional on the validators
+ * of the local copy of the target (see LrDownloadTarget.conditional).
+ */
+static void
+prepare_conditional_request(LrTarget *target, CURL *h)
+{
+    LrDownloadTarget *dtarget = target->target;
+
+    g_free(target->etag);
+    target->etag = NULL;
+    target->lastmodified = -1;
+    target->notmodified = FALSE;
+    curl_slist_free_all(target->curl_headers);
+    target->curl_headers = NULL;
+
+    if (dtarget->etag) {
+        _cleanup_free_ gchar *header = g_strconcat("If-None-Match: ",
+                                                   dtarget->etag, NULL);
+        target->curl_headers = curl_slist_append(NULL, header);
+        curl_easy_setopt(h, CURLOPT_HTTPHEADER, target->curl_headers);
+    }
+
+    if (dtarget->lastmodified > 0) {
+        curl_easy_setopt(h, CURLOPT_TIMECONDITION,
+                         (long) CURL_TIMECOND_IFMODSINCE);
+        curl_easy_setopt(h, CURLOPT_TIMEVALUE, (long) dtarget->lastmodified);
+    }
+
+    // Get the Last-Modified of the response
+    curl_easy_setopt(h, CURLOPT_FILETIME, 1L);
+
+    g_debug("%s: Conditional request for %s (ETag: %s, Last-Modified: %"
+            G_GINT64_FORMAT")", __func__, dtarget->path,
+            dtarget->etag ? dtarget->etag : "none", dtarget->lastmodified);
+}
+
+/** Open the file the transfer of the target writes to.
+ * @return          fdopened file or NULL on error
+ */
+static FILE *
+open_transfer_file(LrTarget *target, GError **err)
+{
+    int fd;
+
+    assert(!err || *err == NULL);
+
+    if (!target->target->fn) {
+        // Use supplied filedescriptor (or the in-memory file)
+        fd = dup(target_fd(target));
+        if (fd == -1) {
+            g_set_error(err, LR_DOWNLOADER_ERROR, LRE_IO,
+                        "dup(%d) failed: %s",
+                        target_fd(target), strerror(errno));
+            return NULL;
+        }
+    } else {
+        // Use supplied filename (or its temporary file)
+        int open_flags = O_CREAT|O_TRUNC|O_RDWR;
+        if (target->target->resume || target->resume_from_offset
+            || is_range_transfer(target))
+            open_flags &= ~O_TRUNC;
+
+        fd = open(target_fn(target), open_flags, 0666);
+        if (fd < 0) {
+            g_set_error(err, LR_DOWNLOADER_ERROR, LRE_IO,
+                        "Cannot open %s: %s",
+                        target_fn(target), strerror(errno));
+            return NULL;
+        }
+    }
+
+    FILE *f = fdopen(fd, "w+b");
+    if (!f) {
+        g_set_error(err, LR_DOWNLOADER_ERROR, LRE_IO,
+                    "fdopen(%d) failed: %s",
+                    fd, strerror(errno));
+        close(fd);
+        return NULL;
+    }
+
+    return f;
+}
+
+/** Return the key of the object the byte range of the target is
+ * downloaded from or NULL if the range couldn't be requested together
+ * with other ranges (see LRO_MAXRANGESPERREQUEST). Only ranges which
+ * are just written to the file, without any other processing of
+ * the data during or after the transfer, are batched.
+ */
+static gchar *
+range_batch_key(LrTarget *target)
+{
+    LrDownloadTarget *dtarget = target->target;
+
+    if (dtarget->byterangeend <= 0
+        || dtarget->byterangestart > dtarget->byterangeend
+        || is_range_transfer(target)
+        || target->hedged
+        || target->original
+        || target->duplicates
+        || dtarget->resume
+        || target->resume_from_offset
+        || dtarget->checksums
+        || dtarget->pieces
+        || dtarget->decompressfd >= 0
+        || dtarget->datacb
+        || dtarget->outputs
+        || dtarget->conditional
+        || dtarget->samemirror
+        || dtarget->deadline > 0.0
+        || g_atomic_int_get(&dtarget->cancelled))
+        return NULL;
+
+    if (dtarget->baseurl)
+        return g_strdup_printf("%p:%s/%s", (void *) dtarget->handle,
+                               dtarget->baseurl, dtarget->path);
+    return g_strdup_printf("%p:%s", (void *) dtarget->handle, dtarget->path);
+}
+
+static gint
+compare_range_starts(gconstpointer a, gconstpointer b)
+{
+    gint64 start_a = MAX(((LrTarget *) a)->target->byterangestart, 0);
+    gint64 start_b = MAX(((LrTarget *) b)->target->byterangestart, 0);
+
+    if (start_a == start_b)
+        return 0;
+    return (start_a < start_b) ? -1 : 1;
+}
+
+/** Take waiting targets whose byte ranges of the same object could be
+ * requested together with the range of the target, open their files and
+ * request all the ranges by the curl handle of the target.
+ * @return          TRUE if a batch of ranges was requested, FALSE if
+ *                  only the range of the target should be requested
+ */
+static gboolean
+prepare_range_batch(LrDownload *dd, LrTarget *target, CURL *h)
+{
+    LrTransfer *transfer = target->transfer;
+    _cleanup_free_ gchar *key = NULL;
+    GSequenceIter *iter;
+    long count = 1;
+
+    if (dd->max_ranges_per_request < 2 || !(key = range_batch_key(target)))
+        return FALSE;
+
+    transfer->batch_end = target->target->byterangeend;
+    iter = g_sequence_get_begin_iter(dd->waiting_targets);
+    while (!g_sequence_iter_is_end(iter)
+           && count < dd->max_ranges_per_request)
+    {
+        LrTarget *member = g_sequence_get(iter);
+        GError *tmp_err = NULL;
+
+        iter = g_sequence_iter_next(iter);
+
+        if (member == target
+            || (target->mirror && mirror_tried(member, target->mirror)))
+            continue;
+
+        _cleanup_free_ gchar *member_key = range_batch_key(member);
+        if (!member_key || strcmp(key, member_key))
+            continue;
+
+        member->f = open_transfer_file(member, &tmp_err);
+        if (!member->f) {
+            // It is downloaded on its own
+            g_debug("%s: %s", __func__, tmp_err->message);
+            g_error_free(tmp_err);
+            continue;
+        }
+
+        dequeue_target(member);
+        member->batch_leader = target;
+        member->writecb_recieved = 0;
+        target->range_batch = g_slist_insert_sorted(target->range_batch,
+                                                    member,
+                                                    compare_range_starts);
+        transfer->batch_end = MAX(transfer->batch_end,
+                                  member->target->byterangeend);
+        count++;
+    }
+
+    if (!target->range_batch)
+        return FALSE;
+
+    GSList *all = g_slist_insert_sorted(g_slist_copy(target->range_batch),
+                                        target, compare_range_starts);
+    GString *ranges = g_string_new(NULL);
+    for (GSList *elem = all; elem; elem = g_slist_next(elem)) {
+        LrDownloadTarget *dtarget = ((LrTarget *) elem->data)->target;
+        g_string_append_printf(ranges, "%s%"G_GINT64_FORMAT"-%"G_GINT64_FORMAT,
+                               (elem == all) ? "" : ",",
+                               MAX(dtarget->byterangestart, 0),
+                               dtarget->byterangeend);
+    }
+    g_slist_free(all);
+
+    g_debug("%s: %ld byte ranges of %s are requested at once: %s",
+            __func__, count, target->target->path, ranges->str);
+    curl_easy_setopt(h, CURLOPT_RANGE, ranges->str);
+    g_string_free(ranges, TRUE);
+
+    transfer->batch_range_start = -1;
+    return TRUE;
+}
+
+/** Close the files of the targets of the batch of byte ranges requested
+ * by the target and detach them from it.
+ * @return          List of the targets (LrTarget *)
+ */
+static GSList *
+detach_range_batch(LrTarget *target)
+{
+    GSList *batch = target->range_batch;
+
+    target->range_batch = NULL;
+    for (GSList *elem = batch; elem; elem = g_slist_next(elem)) {
+        LrTarget *member = elem->data;
+        fclose(member->f);
+        member->f = NULL;
+        member->batch_leader = NULL;
+    }
+
+    return batch;
+}
+
+/** Return TRUE if a compressed transfer of the target could be
+ * negotiated (see LrDownloadTarget.contentencoding).
+ */
+static gboolean
+transfer_encoding_possible(LrTarget *target, LrProtocol protocol)
+{
+    LrDownloadTarget *dtarget = target->target;
+
+    return dtarget->contentencoding
+           && target->handle && target->handle->acceptencoding
+           && protocol == LR_PROTOCOL_HTTP
+           && !is_range_transfer(target)
+           && !target->range_batch
+           && !dtarget->resume
+           && !target->resume_from_offset
+           && dtarget->byterangestart <= 0
+           && dtarget->byterangeend <= 0;
+}
+
+static gboolean
+prepare_next_transfer(LrDownload *dd, gboolean *candidatefound, GError **err)
+{
+    LrTarget *target;
+    char *full_url = NULL;
+    LrProtocol protocol = LR_PROTOCOL_OTHER;
+    gboolean ret;
+
+    assert(dd);
+    assert(!err || *err == NULL);
+
+    *candidatefound = FALSE;
+
+    ret = select_next_target(dd, &target, &full_url, err);
+    if (!ret)  // Error
+        return FALSE;
+
+    if (!target)  // Nothing to do
+        return TRUE;
+
+    *candidatefound = TRUE;
+
+    g_debug("%s: URL: %s", __func__, full_url);
+
+    if (local_transfer_possible(target, full_url)) {
+        // The file is on a local (or mounted) filesystem, copy it
+        ret = local_transfer(dd, target, full_url, err);
+        lr_free(full_url);
+        return ret;
+    }
+
+    protocol = lr_detect_protocol(full_url);
+
+    // Prepare CURL easy handle
+    CURLcode c_rc;
+    CURL *h;
+    if (target->handle) {
+        CURL *handle_curl = lr_handle_curl(target->handle);
+        h = handle_curl ? curl_easy_duphandle(handle_curl) : NULL;
+    } else {
+        h = lr_get_curl_handle();
+    }
+    if (!h) {
+        // Something went wrong
+        g_set_error(err, LR_DOWNLOADER_ERROR, LRE_CURL,
+                    "curl_easy_duphandle() call failed");
+        return FALSE;
+    }
+
+    // Reuse DNS cache, SSL sessions and connections of the handle,
+    // each shard keeps its own connections (the duplicated handle
+    // mustn't keep the share of the handle then)
+    if (target->handle && dd->shard)
+        curl_easy_setopt(h, CURLOPT_SHARE,
+                         lr_handle_curl_shard_share(target->handle));
+    else if (target->handle && target->handle->curl_share)
+        curl_easy_setopt(h, CURLOPT_SHARE, target->handle->curl_share);
+
+    // Set URL
+    c_rc = curl_easy_setopt(h, CURLOPT_URL, full_url);
+    if (c_rc != CURLE_OK) {
+        g_set_error(err, LR_DOWNLOADER_ERROR, LRE_CURL,
+                    "curl_easy_setopt(h, CURLOPT_URL, %s) failed: %s",
+                    full_url, curl_easy_strerror(c_rc));
+        lr_free(full_url);
+        curl_easy_cleanup(h);
+        return FALSE;
+    }
+
+    // Allocate the state of the transfer, waiting targets don't need it
+    free_transfer(target);
+    target->transfer = lr_malloc0(sizeof(LrTransfer));
+
+    // Set error buffer
+    c_rc = curl_easy_setopt(h, CURLOPT_ERRORBUFFER, target->transfer->errorbuffer);
+    if (c_rc != CURLE_OK) {
+        g_set_error(err, LR_DOWNLOADER_ERROR, LRE_CURL,
+                    "curl_easy_setopt(h, CURLOPT_ERRORBUFFER, %s) failed: %s",
+                    full_url, curl_easy_strerror(c_rc));
+        lr_free(full_url);
+        curl_easy_cleanup(h);
+        return FALSE;
+    }
+
+    if (journal_enabled(target)) {
+        // Validators of the object are recorded to the resume journal
+        target->transfer->url = g_strdup(full_url);
+        g_free(target->etag);
+        target->etag = NULL;
+        curl_easy_setopt(h, CURLOPT_FILETIME, 1L);
+    }
+
+    lr_free(full_url);
+
+    // A cache source which doesn't answer quickly is skipped
+    if (target->mirror && target->mirror->cache && target->handle)
+        curl_easy_setopt(h, CURLOPT_CONNECTTIMEOUT_MS,
+                         target->handle->cachesourcetimeout);
+
+    // Prepare FILE
+    FILE *f = open_transfer_file(target, err);
+    if (!f) {
+        curl_easy_cleanup(h);
+        return FALSE;
+    }
+
+    int fd = fileno(f);
+    target->f = f;
+    target->writecb_recieved = 0;
+    target->transfer->writecb_required_range_written = FALSE;
+    target->segment_written = 0;
+
+    if (is_range_transfer(target)) {
+        // Download only the segment
+        _cleanup_free_ gchar *range = NULL;
+        range = g_strdup_printf("%"G_GINT64_FORMAT"-%"G_GINT64_FORMAT,
+                                target->segment_start, target->segment_end);
+        g_debug("%s: Downloading segment %s", __func__, range);
+        c_rc = curl_easy_setopt(h, CURLOPT_RANGE, range);
+        if (c_rc != CURLE_OK) {
+            g_set_error(err, LR_DOWNLOADER_ERROR, LRE_CURL,
+                        "curl_easy_setopt(h, CURLOPT_RANGE, %s) failed: %s",
+                        range, curl_easy_strerror(c_rc));
+            fclose(f);
+            curl_easy_cleanup(h);
+            return FALSE;
+        }
+    }
+
+    // Resume - set offset to resume incomplete download
+    if (target->target->resume || target->resume_from_offset) {
+        if (target->original_offset == -1) {
+            // Determine offset
+            fseek(f, 0L, SEEK_END);
+            gint64 determined_offset = ftell(f);
+            if (determined_offset == -1) {
+                // An error while determining offset =>
+                // Download the whole file again
+                determined_offset = 0;
+            }
+            if (target->transfer->url && determined_offset > 0)
+                determined_offset = load_transfer_journal(target, fd,
+                                                          determined_offset,
+                                                          TRUE);
+            target->original_offset = determined_offset;
+        } else if (target->transfer->url && target->original_offset > 0) {
+            // The data of the previous transfer are kept
+            load_transfer_journal(target, fd, target->original_offset, FALSE);
+        }
+
+        gint64 used_offset = target->original_offset;
+        g_debug("%s: Used offset for download resume: %"G_GINT64_FORMAT,
+                __func__, used_offset);
+
+        // Write the data after the already downloaded content
+        fseek(f, (long) used_offset, SEEK_SET);
+
+        if (protocol == LR_PROTOCOL_HTTP && used_offset > 0
+            && prepare_if_range_request(target, h, used_offset))
+            c_rc = CURLE_OK;
+        else
+            c_rc = curl_easy_setopt(h, CURLOPT_RESUME_FROM_LARGE,
+                                    (curl_off_t) used_offset);
+        if (c_rc != CURLE_OK) {
+            g_set_error(err, LR_DOWNLOADER_ERROR, LRE_CURL,
+                        "curl_easy_setopt(h, LR_DOWNLOADER_ERROR, %"
+                        G_GINT64_FORMAT") failed: %s",
+                        used_offset, curl_easy_strerror(c_rc));
+            fclose(f);
+            curl_easy_cleanup(h);
+            return FALSE;
+        }
+    }
+
+    // Spread the transfers over the proxies of the pool
+    if (target->handle && target->handle->proxypool) {
+        LrProxy *proxy = lr_proxypool_acquire(target->handle->proxypool,
+                                              g_get_monotonic_time());
+        g_debug("%s: Proxy: %s", __func__, proxy->url);
+        curl_easy_setopt(h, CURLOPT_PROXY, proxy->url);
+        target->transfer->proxypool = target->handle->proxypool;
+        target->transfer->proxy = proxy;
+    }
+
+    target->transfer->range_requested = FALSE;
+    if (protocol == LR_PROTOCOL_HTTP && prepare_range_batch(dd, target, h)) {
+        // Ranges of other targets of the same object come together
+        // with the range of the target
+        target->transfer->range_requested = TRUE;
+    } else if (target->target->byterangeend > 0
+               && protocol == LR_PROTOCOL_HTTP) {
+        // Request just the range instead of interrupting the transfer
+        // after the range, so the connection can be reused
+        _cleanup_free_ gchar *range = NULL;
+        range = g_strdup_printf("%"G_GINT64_FORMAT"-%"G_GINT64_FORMAT,
+                                MAX(target->target->byterangestart, 0),
+                                target->target->byterangeend);
+        g_debug("%s: byte range is specified -> requesting %s",
+                __func__, range);
+        c_rc = curl_easy_setopt(h, CURLOPT_RANGE, range);
+        target->transfer->range_requested = TRUE;
+    } else if (target->target->byterangestart > 0) {
+        assert(!target->target->resume);
+        g_debug("%s: byterangestart is specified -> resume is set to %"
+                G_GINT64_FORMAT, __func__, target->target->byterangestart);
+        c_rc = curl_easy_setopt(h, CURLOPT_RESUME_FROM_LARGE,
+                                (curl_off_t) target->target->byterangestart);
+    }
+
+    // Prepare output of the downloaded data
+    if (!is_range_transfer(target) && target->target->byterangestart <= 0
+        && target->target->byterangeend <= 0)
+    {
+        gint64 offset = ftell(f);
+
+        if (dd->preallocate && offset != -1)
+            preallocate_file(fd, offset,
+                             target->target->expectedsize - offset);
+
+        if ((dd->write_buffer_size > 0 || dd->aio) && offset != -1) {
+            target->transfer->writebuf_size = (dd->write_buffer_size > 0)
+                    ? (size_t) dd->write_buffer_size
+                    : LRO_IOURING_WRITEBUFFERSIZE;
+            target->transfer->writebuf = lr_malloc(target->transfer->writebuf_size);
+            target->transfer->writebuf_used = 0;
+            target->transfer->write_offset = offset;
+            target->transfer->early_writeback = dd->early_writeback;
+            if (dd->aio) {
+                target->transfer->aio = dd->aio;
+                target->transfer->writebuf_pending =
+                        lr_malloc(target->transfer->writebuf_size);
+            }
+        }
+    }
+
+    // Compressed transfer of an uncompressed file
+    if (transfer_encoding_possible(target, protocol)
+        && curl_easy_setopt(h, CURLOPT_ACCEPT_ENCODING, "") == CURLE_OK)
+        target->transfer->encoding_requested = TRUE;
+
+    // Prepare checksums calculated during the transfer
+    prepare_transfer_checksums(target);
+
+    // Prepare verification of the pieces during the transfer
+    prepare_transfer_pieces(target);
+
+    // Prepare decompression of the data during the transfer
+    prepare_transfer_decompression(target);
+
+    // Prepare passing of the data to the data callback
+    prepare_transfer_streaming(target);
+
+    // Prepare passing of the data to the additional outputs
+    prepare_transfer_outputs(target);
+
+    // The transfer is stopped by curl when the deadline passes
+    if (target->target->deadline > 0.0)
+        curl_easy_setopt(h, CURLOPT_TIMEOUT_MS,
+                         MAX((long) (deadline_left(target->target) * 1000.0)
+                             + 1, 1L));
+
+    // Prepare progress callback
+    target->cb_return_code = LR_CB_OK;
+    if ((target->target->progresscb || dd->multi_progresscb)
+        && !target->hedged)
+    {
+        curl_easy_setopt(h, CURLOPT_PROGRESSFUNCTION, lr_progresscb);
+        curl_easy_setopt(h, CURLOPT_NOPROGRESS, 0);
+        curl_easy_setopt(h, CURLOPT_PROGRESSDATA, target);
+    }
+
+    // Prepare conditional request
+    if (target->target->conditional && protocol == LR_PROTOCOL_HTTP
+        && !is_range_transfer(target)
+        && target->target->byterangestart <= 0
+        && target->target->byterangeend <= 0)
+        prepare_conditional_request(target, h);
+
+    // Prepare header callback
+    // (Content-Length of a segment is not the size of the whole file)
+    if (target->range_batch) {
+        curl_easy_setopt(h, CURLOPT_HEADERFUNCTION, lr_headercb_batch);
+        curl_easy_setopt(h, CURLOPT_HEADERDATA, target);
+    } else if ((target->target->expectedsize > 0 || target->target->conditional
+         || target->transfer->url)
+        && !is_range_transfer(target)) {
+        curl_easy_setopt(h, CURLOPT_HEADERFUNCTION, lr_headercb);
+        curl_easy_setopt(h, CURLOPT_HEADERDATA, target);
+    }
+
+    // Prepare write callback
+    curl_easy_setopt(h, CURLOPT_WRITEFUNCTION, lr_writecb);
+    curl_easy_setopt(h, CURLOPT_WRITEDATA, target);
+
+    // The target is found by its easy handle when the transfer finishes
+    curl_easy_setopt(h, CURLOPT_PRIVATE, target);
+
+    // Add the new handle to the curl multi handle
+    curl_multi_add_handle(dd->multi_handle, h);
+
+    // Set the state of transfer as running
+    target->state = LR_DS_RUNNING;
+
+    // Set protocol of the target
+    target->protocol = protocol;
+
+    // Save curl handle for the current transfer
+    target->curl_handle = h;
+    target->transfer_start = g_get_monotonic_time();
+    LR_PROBE3(transfer__start, target, target->target->path,
+              target->mirror ? target->mirror->mirror->url : NULL);
+    if (target->handle && target->queued_at)
+        lr_trace_async_span(target->handle->trace, "download", "queue wait",
+                            target->queued_at, target->transfer_start,
+                            "path", target->target->path,
+                            NULL);
+
+    // Add the transfer to the list of running transfers
+    add_running_transfer(dd, target);
+    if (target->mirror)
+        step_running_transfers(target->mirror, 1);
+
+    return TRUE;
+}
+
+/** Stop the running transfer of the target.
+ * Data received so far are written out.
+ */
+static void
+cancel_transfer(LrDownload *dd, LrTarget *target)
+{
+    assert(target->state == LR_DS_RUNNING);
+    assert(target->curl_handle);
+
+    curl_multi_remove_handle(dd->multi_handle, target->curl_handle);
+    save_transfer_journal(target);
+    curl_easy_cleanup(target->curl_handle);
+    target->curl_handle = NULL;
+    if (target->transfer->writebuf)
+        flush_write_buffer(target, NULL);
+    close_transfer_file(target);
+    if (target->paused) {
+        target->paused = FALSE;
+        dd->limiter.paused_transfers--;
+    }
+
+    remove_running_transfer(dd, target);
+    if (target->mirror)
+        step_running_transfers(target->mirror, -1);
+}
+
+/** Cancel the hedged request of the target.
+ */
+static void
+stop_hedge(LrDownload *dd, LrTarget *target)
+{
+    LrTarget *hedge = target->hedge;
+
+    g_debug("%s: Cancelling hedged request for %s", __func__,
+            target->target->path);
+
+    if (hedge->state == LR_DS_RUNNING)
+        cancel_transfer(dd, hedge);
+    free_hedge(hedge);
+}
+
+/** Minimal time (sec) the transfer has to run before it is judged
+ * by LRO_HEDGEDDOWNLOADS */
+#define LR_HEDGE_MIN_ELAPSED            1.0
+
+/** Minimal expected remaining time (sec) of a transfer to start
+ * a hedged request for it */
+#define LR_HEDGE_MIN_ETA                5.0
+
+/** Return the running transfer which is expected to finish as the last
+ * one and which could be hedged. NULL if there is no such transfer.
+ */
+static LrTarget *
+find_straggler(LrDownload *dd)
+{
+    LrTarget *straggler = NULL;
+    gdouble straggler_eta = LR_HEDGE_MIN_ETA;
+    gint64 now = g_get_monotonic_time();
+
+    for (guint x = 0; x < dd->running_transfers->len; x++) {
+        LrTarget *target = g_ptr_array_index(dd->running_transfers, x);
+        LrDownloadTarget *dtarget = target->target;
+
+        if (is_range_transfer(target) || target->hedge_tried || !target->mirror)
+            continue;
+        if (dtarget->expectedsize <= 0 || dtarget->byterangestart > 0
+            || dtarget->byterangeend > 0 || dtarget->samemirror)
+            continue;
+        if (!target->lrmirrors || !target->lrmirrors->next)
+            continue;  // No other mirror
+
+        gdouble elapsed = (now - target->transfer_start) / 1000000.0;
+        if (elapsed < LR_HEDGE_MIN_ELAPSED)
+            continue;  // Too early to judge
+
+        gint64 position = MAX(target->original_offset, 0)
+                          + target->writecb_recieved;
+        gdouble speed = target->writecb_recieved / elapsed;
+        gdouble eta = (speed > 0.0)
+                      ? (dtarget->expectedsize - position) / speed
+                      : G_MAXDOUBLE;
+
+        if (eta > straggler_eta) {
+            straggler = target;
+            straggler_eta = eta;
+        }
+    }
+
+    if (straggler)
+        g_debug("%s: %s is expected to finish in %.1f s", __func__,
+                straggler->target->path, straggler_eta);
+
+    return straggler;
+}
+
+/** Queue a hedged request for the rest of the file of the target.
+ */
+static void
+queue_hedge(LrDownload *dd, LrTarget *target)
+{
+    gint64 position = MAX(target->original_offset, 0)
+                      + target->writecb_recieved;
+
+    LrTarget *hedge = lr_malloc0(sizeof(*hedge));
+    hedge->queue_seq       = dd->next_queue_seq++;
+    hedge->target          = target->target;
+    hedge->original_offset = -1;
+    hedge->lrmirrors       = target->lrmirrors;
+    hedge->handle          = target->handle;
+    hedge->limiter         = target->limiter;
+    hedge->hedged          = target;
+    hedge->segment_start   = position;
+    hedge->segment_end     = target->target->expectedsize - 1;
+
+    // Use a different mirror than the target
+    for (GSList *elem = target->lrmirrors; elem; elem = g_slist_next(elem)) {
+        LrMirror *mirror = elem->data;
+        if (mirror == target->mirror || mirror_tried(target, mirror))
+            mark_mirror_tried(hedge, mirror);
+    }
+
+    // Both requests write to the file, checksums calculated
+    // during the transfer of the target cannot be used anymore
+    free_transfer_checksums(target);
+
+    target->hedge = hedge;
+    target->hedge_tried = TRUE;
+    queue_target(dd, hedge);
+
+    g_debug("%s: Hedged request for %s from offset %"G_GINT64_FORMAT,
+            __func__, target->target->path, position);
+}
+
+/** Return number of connections used by running transfers.
+ * Transfers from multiplexed (HTTP/2) mirrors share connections,
+ * each connection carries up to max_streams_per_mirror transfers.
+ */
+static guint
+used_connections(LrDownload *dd)
+{
+    guint connections = 0;
+
+    for (guint x = 0; x < dd->running_transfers->len; x++) {
+        LrTarget *target = g_ptr_array_index(dd->running_transfers, x);
+        if (!target->mirror || !target->mirror->multiplexed)
+            connections++;
+    }
+
+    for (GSList *elem = dd->handle_mirrors; elem; elem = g_slist_next(elem)) {
+        LrHandleMirrors *handle_mirrors = elem->data;
+        GSList *lists[] = { handle_mirrors->lrmirrors,
+                            handle_mirrors->cachemirrors };
+        for (guint x = 0; x < G_N_ELEMENTS(lists); x++) {
+            for (GSList *el = lists[x]; el; el = g_slist_next(el)) {
+                LrMirror *mirror = el->data;
+                if (mirror->multiplexed && mirror->running_transfers > 0)
+                    connections += (mirror->running_transfers - 1)
+                                   / dd->max_streams_per_mirror + 1;
+            }
+        }
+    }
+
+    return connections;
+}
+
+/** Return the number of parallel transfers allowed right now.
+ */
+static int
+parallel_limit(LrDownload *dd)
+{
+    if (dd->autotune.enabled)
+        return dd->autotune.allowed;
+    return dd->max_parallel_connections;
+}
+
+/** Return TRUE if another transfer could be started.
+ */
+static gboolean
+free_slot_available(LrDownload *dd)
+{
+    if (dd->http2)
+        return used_connections(dd) < (guint) parallel_limit(dd);
+    return dd->running_transfers->len < (guint) parallel_limit(dd);
+}
+
+/** Return TRUE if a transfer of a critical target could be started
+ * in one of the slots reserved beyond the parallel limit
+ * (LRO_CRITICALSLOTS). The slots are used only while the other
+ * targets are running, the critical targets take the free slots
+ * otherwise.
+ */
+static gboolean
+reserved_slot_available(LrDownload *dd)
+{
+    guint running = dd->running_transfers->len;
+    guint used = dd->http2 ? used_connections(dd) : running;
+
+    if (dd->critical_slots <= 0
+        || dd->critical_transfers >= (guint) dd->critical_slots
+        || running <= dd->critical_transfers)
+        return FALSE;
+    return used < (guint) (parallel_limit(dd) + dd->critical_slots);
+}
+
+static gboolean
+pull_targets(LrDownload *dd, gboolean *pulled, GError **err);
+
+static gboolean
+can_resume_transfer(LrTarget *target);
+
+static gboolean
+truncate_transfer_file(LrTarget *target, GError **err);
+
+/** Minimal time (sec) the transfer of a target with a deadline has to run
+ * before its expected completion time is compared with the deadline */
+#define LR_DEADLINE_MIN_ELAPSED         1.0
+
+/** Return TRUE if the running transfer of the target with a deadline
+ * is not expected to finish in time.
+ */
+static gboolean
+transfer_misses_deadline(LrTarget *target, gint64 now)
+{
+    LrDownloadTarget *dtarget = target->target;
+    gint64 size = transfer_size(target);
+
+    if (dtarget->deadline <= 0.0 || size <= 0
+        || dtarget->byterangestart > 0 || dtarget->byterangeend > 0)
+        return FALSE;
+
+    gdouble elapsed = (now - target->transfer_start) / 1000000.0;
+    if (elapsed < LR_DEADLINE_MIN_ELAPSED)
+        return FALSE;  // Too early to judge
+
+    gint64 left = size - target->writecb_recieved;
+    if (!is_range_transfer(target))
+        left -= MAX(target->original_offset, 0);
+    gdouble speed = target->writecb_recieved / elapsed;
+
+    return speed <= 0.0 || left / speed > deadline_left(dtarget);
+}
+
+/** Return TRUE if the running transfer could be stopped in favour
+ * of a target with a deadline.
+ */
+static gboolean
+transfer_preemptible(LrTarget *target)
+{
+    return target->target->priorityclass == LR_PRIORITYCLASS_BACKGROUND
+           && !is_range_transfer(target)
+           && !target->hedge
+           && !target->range_batch;
+}
+
+/** Stop the transfer of the background target and queue it again.
+ * It continues from the downloaded data if possible.
+ */
+static gboolean
+preempt_transfer(LrDownload *dd, LrTarget *target, GError **err)
+{
+    gboolean resume = can_resume_transfer(target);
+
+    g_debug("%s: Stopping transfer of %s", __func__, target->target->path);
+
+    cancel_transfer(dd, target);
+    queue_target(dd, target);
+
+    if (!resume)
+        return truncate_transfer_file(target, err);
+
+    target->original_offset = MAX(target->original_offset, 0)
+                              + target->writecb_recieved;
+    target->resume_from_offset = TRUE;
+    return TRUE;
+}
+
+/** Fail the waiting targets whose deadline passed and stop
+ * the background transfers if a target with a deadline is at risk
+ * (see LrDownloadTarget.deadline).
+ */
+static gboolean
+check_deadlines(LrDownload *dd, GError **err)
+{
+    GPtrArray *expired = g_ptr_array_new();
+    gboolean waiting = FALSE;
+    gboolean at_risk;
+    gint64 now = g_get_monotonic_time();
+
+    // Targets with a deadline are at the beginning of the queue
+    GSequenceIter *iter = g_sequence_get_begin_iter(dd->waiting_targets);
+    for (; !g_sequence_iter_is_end(iter); iter = g_sequence_iter_next(iter)) {
+        LrTarget *target = g_sequence_get(iter);
+        if (target->target->deadline <= 0.0)
+            break;
+        if (target->hedged)
+            continue;  // The hedged target is stopped at the deadline
+        if (deadline_passed(target->target))
+            g_ptr_array_add(expired, target);
+        else
+            waiting = TRUE;
+    }
+
+    for (guint x = 0; x < expired->len; x++) {
+        LrTarget *target = g_ptr_array_index(expired, x);
+        LrTarget *parent = target->parent;
+        gboolean ret;
+
+        dequeue_target(target);
+        if (parent) {
+            // The whole target fails when it is waiting again
+            target->state = LR_DS_FAILED;
+            ret = (parent->state == LR_DS_WAITING)
+                  || finish_segmented_target(dd, parent, err);
+        } else {
+            ret = fail_waiting_target(dd, target, LRE_DEADLINE,
+                                      "Deadline passed", err);
+        }
+
+        if (!ret) {
+            g_ptr_array_free(expired, TRUE);
+            return FALSE;
+        }
+    }
+    g_ptr_array_free(expired, TRUE);
+
+    at_risk = waiting && !free_slot_available(dd);
+    for (guint x = 0; !at_risk && x < dd->running_transfers->len; x++)
+        at_risk = transfer_misses_deadline(
+                        g_ptr_array_index(dd->running_transfers, x), now);
+
+    if (at_risk != dd->deadline_at_risk)
+        g_debug("%s: A deadline is %s", __func__,
+                at_risk ? "at risk" : "safe");
+    dd->deadline_at_risk = at_risk;
+    if (!at_risk)
+        return TRUE;
+
+    for (guint x = 0; x < dd->running_transfers->len;) {
+        LrTarget *target = g_ptr_array_index(dd->running_transfers, x);
+        if (!transfer_preemptible(target)) {
+            x++;
+            continue;
+        }
+        // The last running transfer takes place of the stopped one
+        if (!preempt_transfer(dd, target, err))
+            return FALSE;
+    }
+
+    return TRUE;
+}
+
+/** Stop the waiting or running target cancelled by
+ * lr_downloadtarget_cancel() and fail it.
+ */
+static gboolean
+cancel_target(LrDownload *dd, LrTarget *target, GError **err)
+{
+    g_debug("%s: Cancelling %s", __func__, target->target->path);
+
+    if (target->original) {
+        // The duplicate doesn't wait for the file of the original
+        LrTarget *original = target->original;
+        original->duplicates = g_slist_remove(original->duplicates, target);
+        target->original = NULL;
+    }
+
+    for (GSList *elem = target->segments; elem; elem = g_slist_next(elem)) {
+        LrTarget *segment = elem->data;
+        if (segment->hedge)
+            stop_hedge(dd, segment);
+        if (segment->state == LR_DS_RUNNING && segment->curl_handle)
+            cancel_transfer(dd, segment);
+        dequeue_target(segment);
+        if (segment->state == LR_DS_WAITING || segment->state == LR_DS_RUNNING)
+            segment->state = LR_DS_FAILED;
+    }
+
+    if (target->hedge)
+        stop_hedge(dd, target);
+    if (target->state == LR_DS_RUNNING && target->curl_handle)
+        cancel_transfer(dd, target);
+    dequeue_target(target);
+
+    return fail_waiting_target(dd, target, LRE_CANCELLED,
+                               "Cancelled by lr_downloadtarget_cancel()",
+                               err);
+}
+
+/** Cancel the targets cancelled by lr_downloadtarget_cancel() since
+ * the last check. Targets whose byte range is requested by a running
+ * multi-range request are checked again after it finishes.
+ */
+static gboolean
+cancel_targets(LrDownload *dd, GError **err)
+{
+    dd->cancellations = g_atomic_int_get(&lr_downloadtarget_cancellations);
+    dd->cancel_check = FALSE;
+
+    for (guint x = 0; x < dd->targets->len; x++) {
+        LrTarget *target = g_ptr_array_index(dd->targets, x);
+
+        if (target->parent
+            || (target->state != LR_DS_WAITING
+                && target->state != LR_DS_RUNNING)
+            || !g_atomic_int_get(&target->target->cancelled))
+            continue;
+
+        if (target->batch_leader || target->range_batch) {
+            dd->cancel_check = TRUE;
+            continue;
+        }
+
+        if (!cancel_target(dd, target, err))
+            return FALSE;
+    }
+
+    return TRUE;
+}
+
+static gboolean
+prepare_next_transfers(LrDownload *dd, GError **err)
+{
+    assert(!err || *err == NULL);
+
+    gboolean candidatefound = TRUE;
+    gboolean pulled;
+    gboolean backlog = endcb_backlog(dd);
+
+    // Noted again by the targets which still wait for a circuit breaker
+    dd->breaker_wakeup = 0;
+
+    // Nothing is pulled while the end callbacks don't keep up
+    if (!backlog && !pull_targets(dd, &pulled, err))
+        return FALSE;
+
+    if ((dd->cancel_check
+         || g_atomic_int_get(&lr_downloadtarget_cancellations)
+            != dd->cancellations)
+        && !cancel_targets(dd, err))
+        return FALSE;
+
+    if (dd->deadlines && !check_deadlines(dd, err))
+        return FALSE;
+
+    if (backlog) {
+        // The finished files would pile up, wait for the end callbacks
+        g_debug("%s: %u end callbacks pending, no new transfers",
+                __func__, dd->endcb_calls);
+        return TRUE;
+    }
+
+    if (dd->http2) {
+        // Number of transfers is limited by number of connections
+        while (candidatefound &&
+               (used_connections(dd) < (guint) parallel_limit(dd)
+                || reserved_slot_available(dd)))
+        {
+            if (!prepare_next_transfer(dd, &candidatefound, err))
+                return FALSE;
+            // The waiting targets are used up, try the source
+            if (!candidatefound && free_slot_available(dd)
+                && !pull_targets(dd, &candidatefound, err))
+                return FALSE;
+        }
+    } else {
+        // Targets copied from local mirrors don't take a slot
+        while (candidatefound
+               && (free_slot_available(dd) || reserved_slot_available(dd))) {
+            gboolean ret = prepare_next_transfer(dd, &candidatefound, err);
+            if (!ret)
+                return FALSE;
+            // The waiting targets are used up, try the source
+            // (only for a free slot, the reserved ones are not for it)
+            if (!candidatefound && free_slot_available(dd)
+                && !pull_targets(dd, &candidatefound, err))
+                return FALSE;
+        }
+    }
+
+    // Hedge stragglers if there is nothing else to download
+    if (dd->hedged_downloads) {
+        LrTarget *straggler;
+        while (g_sequence_get_length(dd->waiting_targets) == 0
+               && free_slot_available(dd)
+               && (straggler = find_straggler(dd)))
+        {
+            queue_hedge(dd, straggler);
+            if (!prepare_next_transfer(dd, &candidatefound, err))
+                return FALSE;
+        }
+    }
+
+    return TRUE;
+}
+
+
+/** Check the finished transfer
+ * Evaluate CURL return code and status code of protocol if needed.
+ */
+static gboolean
+check_finished_transfer_status(CURLMsg *msg,
+                               LrTarget *target,
+                               gboolean *fatal_error,
+                               GError **transfer_err,
+                               GError **err)
+{
+    long code = 0;
+    char *effective_url = NULL;
+    LrTransferStats *stats;
+
+    assert(msg);
+    assert(target);
+    assert(!transfer_err || *transfer_err == NULL);
+    assert(!err || *err == NULL);
+
+    *fatal_error = FALSE;
+
+    curl_easy_getinfo(msg->easy_handle,
+                      CURLINFO_EFFECTIVE_URL,
+                      &effective_url);
+
+    // Timing of the transfer
+    stats = &target->target->stats;
+    curl_easy_getinfo(msg->easy_handle, CURLINFO_NAMELOOKUP_TIME,
+                      &stats->namelookup_time);
+    curl_easy_getinfo(msg->easy_handle, CURLINFO_CONNECT_TIME,
+                      &stats->connect_time);
+    curl_easy_getinfo(msg->easy_handle, CURLINFO_APPCONNECT_TIME,
+                      &stats->appconnect_time);
+    curl_easy_getinfo(msg->easy_handle, CURLINFO_STARTTRANSFER_TIME,
+                      &stats->starttransfer_time);
+    curl_easy_getinfo(msg->easy_handle, CURLINFO_TOTAL_TIME,
+                      &stats->total_time);
+    curl_easy_getinfo(msg->easy_handle, CURLINFO_SPEED_DOWNLOAD,
+                      &stats->speed_download);
+    stats->attempts++;
+
+    LR_PROBE3(transfer__done, target, target->target->path,
+              (long) msg->data.result);
+
+    if (msg->data.result != CURLE_OK) {
+        // There was an error that is reported by CURLcode
+
+        if (msg->data.result == CURLE_WRITE_ERROR &&
+            target->transfer->writecb_required_range_written)
+        {
+            // Download was interrupted by writecb because
+            // user want only specified byte range of the
+            // target and the range was already downloaded
+            g_debug("%s: Transfer was interrupted by writecb() "
+                    "because the required range "
+                    "(%"G_GINT64_FORMAT"-%"G_GINT64_FORMAT") "
+                    "was downloaded.", __func__,
+                    target->target->byterangestart,
+                    target->target->byterangeend);
+        } else if (msg->data.result == CURLE_OPERATION_TIMEDOUT
+                   && deadline_passed(target->target)) {
+            // Stopped at the deadline, another mirror cannot help
+            g_set_error(transfer_err, LR_DOWNLOADER_ERROR, LRE_DEADLINE,
+                        "Deadline passed for %s", effective_url);
+            *fatal_error = TRUE;
+        } else if (target->transfer->headercb_state == LR_HCS_INTERRUPTED) {
+            // Download was interrupted by header callback
+            g_set_error(transfer_err, LR_DOWNLOADER_ERROR, LRE_CURL,
+                        "Interrupted by header callback: %s",
+                        target->transfer->headercb_interrupt_reason);
+        } else {
+            // There was a CURL error
             g_set_error(transfer_err, LR_DOWNLOADER_ERROR, LRE_CURL,
                         "Curl error: %s for %s [%s]",
                         curl_easy_strerror(msg->data.result),
                         effective_url,
-                        target->errorbuffer);
+                        target->transfer->errorbuffer);
+
+            switch (msg->data.result) {
+            case CURLE_ABORTED_BY_CALLBACK:
+            case CURLE_BAD_FUNCTION_ARGUMENT:
+            case CURLE_CONV_REQD:
+            case CURLE_COULDNT_RESOLVE_PROXY:
+            case CURLE_FILESIZE_EXCEEDED:
+            case CURLE_INTERFACE_FAILED:
+#if LR_CURL_VERSION_CHECK(7, 21, 5)
+            case CURLE_NOT_BUILT_IN:
+#endif
+            case CURLE_OUT_OF_MEMORY:
+            case CURLE_RECV_ERROR:
+            case CURLE_SEND_ERROR:
+            case CURLE_SSL_CACERT_BADFILE:
+            case CURLE_SSL_CRL_BADFILE:
+            case CURLE_WRITE_ERROR:
+                // Fatal error
+                g_debug("%s: Fatal error - Curl code %d: %s",
+                        __func__, msg->data.result,
+                        curl_easy_strerror(msg->data.result));
+                *fatal_error = TRUE;
+            default:
+                // Other error are not considered fatal
+                break;
+            }
+        }
+
+        return TRUE;
+    }
+
+    if (target->transfer->content_encoded
+        && target->target->expectedsize > 0
+        && target->writecb_recieved != target->target->expectedsize)
+    {
+        g_set_error(transfer_err, LR_DOWNLOADER_ERROR, LRE_CURL,
+                    "Size of the decoded data (%"G_GINT64_FORMAT") of %s "
+                    "doesn't match the expected size (%"G_GINT64_FORMAT")",
+                    target->writecb_recieved, effective_url,
+                    target->target->expectedsize);
+        return TRUE;
+    }
+
+    // Validators of the response to a conditional request
+    if (target->target->conditional) {
+        long filetime = -1;
+        curl_easy_getinfo(msg->easy_handle, CURLINFO_FILETIME, &filetime);
+        target->lastmodified = (gint64) filetime;
+    }
+
+    // curl return code is CURLE_OK but we need to check status code
+    curl_easy_getinfo(msg->easy_handle, CURLINFO_RESPONSE_CODE, &code);
+    if (code) {
+        // Check status codes for some protocols
+        if (effective_url && g_str_has_prefix(effective_url, "http")) {
+            // Check HTTP(S) code
+            if (code == 304 && target->target->conditional) {
+                // Answer to a conditional request, the local copy is valid
+                g_debug("%s: Not modified: %s", __func__, effective_url);
+                target->notmodified = TRUE;
+            } else if (code/100 != 2) {
+                g_set_error(transfer_err,
+                            LR_DOWNLOADER_ERROR,
+                            LRE_BADSTATUS,
+                            "Status code: %ld for %s", code, effective_url);
+            }
+        } else if (effective_url) {
+            // Check FTP
+            if (code/100 != 2) {
+                g_set_error(transfer_err,
+                            LR_DOWNLOADER_ERROR,
+                            LRE_BADSTATUS,
+                            "Status code: %ld for %s", code, effective_url);
+            }
+        } else {
+            // Other protocols
+            g_set_error(transfer_err,
+                        LR_DOWNLOADER_ERROR,
+                        LRE_BADSTATUS,
+                        "Status code: %ld for %s", code, effective_url);
+        }
+    }
+
+    return TRUE;
+}
+
+
+/** Path used for the sidecar checksum index of the downloaded file
+ * or NULL if the index is not used (see LRO_CHECKSUMINDEX).
+ */
+static const char *
+checksum_index_path(LrTarget *target)
+{
+    if (!target->handle || !target->handle->checksumindex)
+        return NULL;
+    return target->target->fn;
+}
+
+/** Check checksums calculated on the fly during the transfer.
+ * @return      FALSE if the checksums cannot be used (they were not
+ *              calculated or the file contains some other data) and
+ *              the checksums must be calculated from the file.
+ */
+static gboolean
+check_streamed_checksums(LrTarget *target,
+                         int fd,
+                         gboolean *matches)
+{
+    struct stat st;
+
+    if (!target->checksum_ctxs)
+        return FALSE;
+
+    if (fstat(fd, &st) != 0 || st.st_size != target->checksum_ctxs_len) {
+        g_debug("%s: File size doesn't match the number of checksumed "
+                "bytes, checksums will be calculated from the file",
+                __func__);
+        return FALSE;
+    }
+
+    *matches = FALSE;
+    for (GSList *elem = target->checksum_ctxs; elem; elem = g_slist_next(elem)) {
+        LrStreamChecksum *stream_checksum = elem->data;
+        GError *tmp_err = NULL;
+        _cleanup_free_ gchar *checksum = NULL;
+
+        checksum = lr_checksumctx_final(stream_checksum->ctx, &tmp_err);
+        if (!checksum) {
+            g_debug("%s: %s", __func__, tmp_err->message);
+            g_error_free(tmp_err);
+            return FALSE;
+        }
+
+        lr_checksum_cache_set(fd, checksum_index_path(target),
+                              lr_checksumctx_type(stream_checksum->ctx),
+                              checksum);
+
+        for (GSList *e = stream_checksum->checksums; e; e = g_slist_next(e)) {
+            LrDownloadTargetChecksum *chksum = e->data;
+            if (!strcmp(checksum, chksum->value)) {
+                *matches = TRUE;
+                break;
+            }
+        }
+
+        if (*matches)
+            break;
+    }
+
+    return TRUE;
+}
+
+static gboolean
+check_file_checksums(int fd,
+                     const char *index_path,
+                     GSList *checksums,
+                     gboolean *matches,
+                     GError **err)
+{
+    guint count = 0;
+    guint to_calculate = 0;
+    gboolean ret = TRUE;
+    LrDownloadTargetChecksum **valid;
+    LrChecksumType *types;
+    char **calculated;
+
+    *matches = TRUE;
+
+    valid = lr_malloc0(sizeof(*valid) * g_slist_length(checksums));
+    for (GSList *elem = checksums; elem; elem = g_slist_next(elem)) {
+        LrDownloadTargetChecksum *chksum = elem->data;
+        if (!chksum || !chksum->value || chksum->type == LR_CHECKSUM_UNKNOWN)
+            continue;  // Bad checksum
+        valid[count++] = chksum;
+    }
+
+    if (count == 0) {
+        // No usable checksum - suppose it's ok
+        lr_free(valid);
+        return TRUE;
+    }
+
+    *matches = FALSE;
+
+    // Use the cached checksums, only the types which are not cached
+    // have to be calculated from the file
+    types = lr_malloc0(sizeof(*types) * count);
+    calculated = lr_malloc0(sizeof(*calculated) * count);
+    for (guint x = 0; x < count; x++) {
+        gboolean known = FALSE;
+        _cleanup_free_ gchar *cached = lr_checksum_cache_get(fd, index_path,
+                                                             valid[x]->type);
+        if (cached) {
+            if (!strcmp(cached, valid[x]->value)) {
+                *matches = TRUE;
+                break;
+            }
+            continue;
+        }
+
+        // Alternative checksums of the same type are calculated once
+        for (guint y = 0; y < to_calculate && !known; y++)
+            known = (types[y] == valid[x]->type);
+        if (!known)
+            types[to_calculate++] = valid[x]->type;
+    }
+
+    if (!*matches && to_calculate > 0) {
+        // Calculate all the checksum types in one pass over the file
+        LR_PROBE2(checksum__start, fd, to_calculate);
+        ret = lr_checksum_fd_multi(fd, types, to_calculate, calculated, err);
+
+        for (guint x = 0; ret && x < to_calculate; x++)
+            lr_checksum_cache_set(fd, index_path, types[x], calculated[x]);
+
+        for (guint x = 0; ret && x < count && !*matches; x++) {
+            for (guint y = 0; y < to_calculate; y++) {
+                if (types[y] != valid[x]->type
+                    || strcmp(calculated[y], valid[x]->value))
+                    continue;
+
+                // At least one checksum matches
+                g_debug("%s: Checksum (%s) %s is OK", __func__,
+                        lr_checksum_type_to_str(valid[x]->type),
+                        valid[x]->value);
+                *matches = TRUE;
+                break;
+            }
+        }
+    }
+
+    if (to_calculate > 0)
+        LR_PROBE3(checksum__done, fd, ret, *matches);
+
+    for (guint x = 0; x < to_calculate; x++)
+        lr_free(calculated[x]);
+    lr_free(calculated);
+    lr_free(types);
+    lr_free(valid);
+
+    return ret;
+}
+
+/** Set the transfer_err about checksums of the downloaded file
+ * which don't match.
+ */
+static void
+set_checksum_mismatch_error(GSList *checksums, GError **transfer_err)
+{
+    gchar *expected = g_strdup("");
+
+    // Prepare pretty messages with list of expected checksums
+    for (GSList *elem = checksums; elem; elem = g_slist_next(elem)) {
+        gchar *tmp = NULL;
+        LrDownloadTargetChecksum *chksum = elem->data;
+        if (!chksum || !chksum->value || chksum->type == LR_CHECKSUM_UNKNOWN)
+            continue;  // Bad checksum
+
+        const gchar *chtype_str = lr_checksum_type_to_str(chksum->type);
+        tmp = g_strconcat(expected, chksum->value, "(",
+                          chtype_str ? chtype_str : "UNKNOWN",
+                          ") ", NULL);
+        free(expected);
+        expected = tmp;
+    }
+
+    // Set error message
+    g_set_error(transfer_err,
+            LR_DOWNLOADER_ERROR,
+            LRE_BADCHECKSUM,
+            "Downloading successful, but checksum doesn't match. "
+            "Expected: %s", expected);
+    g_free(expected);
+}
+
+/** Maximal time (msec) of waiting for events while some files are
+ * verified, so the finished verifications are picked up in time. */
+#define LR_VERIFICATION_TICK_MS         20
+
+/** Return TRUE if the damaged pieces of the target could be downloaded
+ * again by byte ranges (see repair_target_pieces()).
+ */
+static gboolean
+pieces_repairable(LrTarget *target)
+{
+    LrDownloadTarget *dtarget = target->target;
+
+    if (!dtarget->pieces || dtarget->pieces->count == 0
+        || target->repair_tried
+        || is_range_transfer(target))
+        return FALSE;
+
+    // The data callback already got the damaged data
+    if (dtarget->datacb)
+        return FALSE;
+
+    return !(dtarget->baseurl
+             || dtarget->samemirror
+             || dtarget->byterangestart > 0
+             || dtarget->byterangeend > 0
+             || strstr(dtarget->path, "://"));
+}
+
+/** Calculate checksums of the downloaded file (GFunc of the verifier).
+ * Only the verification is touched here, the target (and its
+ * checksums) are not modified until the verification is finished.
+ */
+static void
+verify_downloaded_file(gpointer data, gpointer user_data)
+{
+    LrVerification *verification = data;
+    LrTarget *target = verification->target;
+    GAsyncQueue *verified = user_data;
+
+    // Runs in a verifier thread, which has its own allocation tag
+    lr_alloc_tag_set(LR_ALLOC_CHECKSUM);
+
+    verification->start = g_get_monotonic_time();
+    verification->ret = check_file_checksums(verification->fd,
+                                             checksum_index_path(target),
+                                             target->target->checksums,
+                                             &verification->matches,
+                                             &verification->err);
+
+    if (verification->ret && !verification->matches
+        && verification->check_pieces)
+    {
+        // Find the damaged pieces, so only they are downloaded again
+        LrDownloadTargetPieces *pieces = target->target->pieces;
+        GError *tmp_err = NULL;
+
+        verification->bad_pieces = g_array_new(FALSE, FALSE, sizeof(guint));
+        if (!lr_checksum_fd_pieces(verification->fd, pieces->type,
+                                   pieces->length, pieces->hashes,
+                                   pieces->count, verification->bad_pieces,
+                                   &tmp_err))
+        {
+            g_debug("%s: Cannot verify pieces of %s: %s", __func__,
+                    target->target->path, tmp_err->message);
+            g_error_free(tmp_err);
+            g_array_free(verification->bad_pieces, TRUE);
+            verification->bad_pieces = NULL;
+        }
+    }
+
+    verification->end = g_get_monotonic_time();
+    g_async_queue_push(verified, verification);
+}
+
+/** Hand the downloaded file of the target over to the verifier.
+ * The target is in the LR_DS_VERIFYING state until the verification
+ * is picked up by check_verified_targets().
+ */
+static void
+start_verification(LrDownload *dd,
+                   LrTarget *target,
+                   int fd,
+                   gboolean assembled,
+                   const char *effective_url)
+{
+    LrVerification *verification = lr_malloc0(sizeof(*verification));
+
+    verification->target = target;
+    verification->fd = fd;
+    verification->assembled = assembled;
+    verification->effective_url = g_strdup(effective_url);
+    verification->check_pieces = pieces_repairable(target);
+
+    target->state = LR_DS_VERIFYING;
+    dd->verifying_transfers++;
+
+    if (dd->verifier) {
+        g_debug("%s: Verifying %s", __func__, target->target->path);
+        g_thread_pool_push(dd->verifier, verification, NULL);
+    } else {
+        // No threads available, verify the file right now
+        verify_downloaded_file(verification, dd->verified);
+    }
+}
+
+/** Free the verification (and close its fd if it owns it).
+ */
+static void
+free_verification(LrVerification *verification)
+{
+    if (verification->assembled)
+        close(verification->fd);
+    g_clear_error(&verification->err);
+    g_free(verification->effective_url);
+    if (verification->bad_pieces)
+        g_array_free(verification->bad_pieces, TRUE);
+    lr_free(verification);
+}
+
+
+/** Truncate file - Used to remove downloaded garbage (error html pages, etc.)
+ */
+static gboolean
+truncate_transfer_file(LrTarget *target, GError **err)
+{
+    off_t original_offset = 0;  // Truncate whole file by default
+    int rc;
+
+    assert(!err || *err == NULL);
+
+    if (target->original_offset > -1)
+        // If resume is enabled -> truncate file to its original position
+        original_offset = target->original_offset;
+
+    if (target->target->fn)  // Truncate by filename
+        rc = truncate(target_fn(target), original_offset);
+    else  // Truncate by file descriptor number
+        rc = ftruncate(target_fd(target), original_offset);
+
+    if (rc == -1) {
+        g_set_error(err, LR_DOWNLOADER_ERROR, LRE_IO,
+                    "ftruncate() failed: %s", strerror(errno));
+        return FALSE;
+    }
+
+    if (!target->target->fn) {
+        // In case fd is used, seek to the original offset
+        if (lseek(target_fd(target), original_offset, SEEK_SET) == -1) {
+            g_set_error(err, LR_DOWNLOADER_ERROR, LRE_IO,
+                        "lseek() failed: %s", strerror(errno));
+            return FALSE;
+        }
+    }
+
+    if (target->journal_offset != original_offset)
+        // The journal doesn't describe the truncated file
+        remove_target_journal(target);
+
+    return TRUE;
+}
+
+
+/** Weight of a new sample in the moving averages of mirror statistics */
+#define MIRROR_STATS_EWMA_WEIGHT        0.3
+
+/** Size of a transfer used to compare expected completion times of mirrors */
+#define MIRROR_STATS_REFERENCE_SIZE     (1024 * 1024)
+
+/** Relative change of a total throughput from a mirror which is
+ * considered significant by LRO_ADAPTIVEDOWNLOADSPERMIRROR */
+#define MIRROR_CONNECTIONS_GAIN         0.1
+
+/** Get throughput (bytes/sec) and time to first byte (sec) of the just
+ * finished transfer. Return FALSE if there is nothing to measure.
+ */
+static gboolean
+transfer_speed(CURL *curl_handle, gdouble *speed, gdouble *ttfb)
+{
+    double size = 0.0;
+    double start = 0.0;
+    double total = 0.0;
+
+    curl_easy_getinfo(curl_handle, CURLINFO_SIZE_DOWNLOAD, &size);
+    curl_easy_getinfo(curl_handle, CURLINFO_STARTTRANSFER_TIME, &start);
+    curl_easy_getinfo(curl_handle, CURLINFO_TOTAL_TIME, &total);
+
+    if (size <= 0.0 || total <= start)
+        return FALSE;
+
+    *speed = size / (total - start);
+    *ttfb = start;
+    return TRUE;
+}
+
+/** Add the just finished (successfully or not) transfer to the totals
+ * of its mirror which are reported by LRI_STATS.
+ */
+static void
+record_transfer_stats(LrTarget *target, CURL *curl_handle)
+{
+    LrMirror *mirror = target->mirror;
+    double size = 0.0;
+    double total = 0.0;
+
+    if (!mirror)
+        return;
+
+    curl_easy_getinfo(curl_handle, CURLINFO_SIZE_DOWNLOAD, &size);
+    curl_easy_getinfo(curl_handle, CURLINFO_TOTAL_TIME, &total);
+
+    if (size > 0.0)
+        mirror->downloaded_bytes += (guint64) size;
+    if (total > 0.0)
+        mirror->transfer_time += total;
+    if (target->num_of_tried_mirrors > 1)
+        mirror->retries++;
+}
+
+/** Update throughput and time to first byte averages of the mirror
+ * by the statistics of the just finished transfer.
+ */
+static void
+update_mirror_speed(LrMirror *mirror, CURL *curl_handle)
+{
+    gdouble speed, ttfb;
+
+    if (!transfer_speed(curl_handle, &speed, &ttfb))
+        return;  // Nothing to measure
+
+    if (mirror->speed <= 0.0) {
+        // First sample
+        mirror->speed = speed;
+        mirror->ttfb = ttfb;
+    } else {
+        mirror->speed += MIRROR_STATS_EWMA_WEIGHT * (speed - mirror->speed);
+        mirror->ttfb += MIRROR_STATS_EWMA_WEIGHT * (ttfb - mirror->ttfb);
+    }
+
+    g_debug("%s: Mirror %s: %.0f B/s, TTFB %.3f s (avg: %.0f B/s, %.3f s)",
+            __func__, mirror->mirror->url, speed, ttfb,
+            mirror->speed, mirror->ttfb);
+}
+
+/** Change the allowed number of transfers from the mirror by the step.
+ */
+static void
+step_mirror_connections(LrDownload *dd, LrMirror *mirror, int step)
+{
+    int allowed = mirror->allowed_transfers + step;
+
+    allowed = CLAMP(allowed, 1, dd->max_parallel_connections);
+    mirror->growing = (step > 0);
+    mirror->prev_level_speed = mirror->level_speed;
+    mirror->level_speed = 0.0;
+    mirror->level_samples = 0;
+
+    if (allowed != mirror->allowed_transfers)
+        g_debug("%s: Mirror %s: %d -> %d transfers", __func__,
+                mirror->mirror->url, mirror->allowed_transfers, allowed);
+    mirror->allowed_transfers = allowed;
+}
+
+/** Adjust the allowed number of transfers from the mirror.
+ * The total throughput from the mirror is measured for each allowed
+ * number of transfers. The number grows as long as the total throughput
+ * grows and it is decreased when the mirror is saturated (throughput
+ * doesn't grow anymore) or throttles (throughput falls).
+ * A failed transfer decreases the number immediately.
+ * @param dd            Download data
+ * @param mirror        Mirror of the just finished transfer
+ * @param curl_handle   Curl handle of the transfer or NULL if it failed
+ */
+static void
+update_mirror_connections(LrDownload *dd, LrMirror *mirror, CURL *curl_handle)
+{
+    gdouble speed, ttfb;
+
+    if (!dd->adaptive_connections || dd->max_connection_per_host == -1)
+        return;
+
+    if (mirror->allowed_transfers == 0)
+        mirror->allowed_transfers = MIN(dd->max_connection_per_host,
+                                        dd->max_parallel_connections);
+
+    if (!curl_handle) {
+        // Failed transfer
+        step_mirror_connections(dd, mirror, -1);
+        return;
+    }
+
+    if (!transfer_speed(curl_handle, &speed, &ttfb))
+        return;  // Nothing to measure
+
+    // Estimate total throughput from the mirror
+    int transfers = MAX(mirror->running_transfers, 1);
+    mirror->level_speed += (speed * transfers - mirror->level_speed)
+                           / ++mirror->level_samples;
+
+    if (mirror->level_samples < mirror->allowed_transfers)
+        return;  // Not enough samples yet
+
+    gdouble prev = mirror->prev_level_speed;
+    gdouble level = mirror->level_speed;
+
+    if (prev <= 0.0 || level > prev * (1.0 + MIRROR_CONNECTIONS_GAIN)) {
+        // Throughput grows - go on
+        int step = (prev <= 0.0 || mirror->growing) ? 1 : -1;
+        step_mirror_connections(dd, mirror, step);
+    } else if (level < prev * (1.0 - MIRROR_CONNECTIONS_GAIN)) {
+        // Throughput falls - turn back
+        step_mirror_connections(dd, mirror, mirror->growing ? -1 : 1);
+    } else if (mirror->growing) {
+        // Mirror is saturated - use less transfers
+        step_mirror_connections(dd, mirror, -1);
+    } else {
+        // Stay at the current level and measure it again
+        mirror->prev_level_speed = level;
+        mirror->level_speed = 0.0;
+        mirror->level_samples = 0;
+    }
+}
+
+/** Number of parallel transfers the tuning starts with
+ * (see LRO_AUTOTUNEPARALLELDOWNLOADS) */
+#define LR_AUTOTUNE_START               2
+
+/** Relative change of the total throughput which is considered
+ * significant by LRO_AUTOTUNEPARALLELDOWNLOADS */
+#define LR_AUTOTUNE_GAIN                0.1
+
+/** Minimal time (usec) the total throughput is measured for */
+#define LR_AUTOTUNE_MIN_LEVEL_TIME      (500 * 1000)
+
+/** Start the tuning of the number of parallel transfers.
+ * @param dd            Download data
+ * @param start         Number to start with or 0 for the default
+ */
+static void
+start_autotune(LrDownload *dd, int start)
+{
+    LrAutotune *autotune = &dd->autotune;
+
+    autotune->enabled = TRUE;
+    autotune->allowed = CLAMP((start > 0) ? start : LR_AUTOTUNE_START,
+                              1, dd->max_parallel_connections);
+    autotune->growing = TRUE;
+    autotune->level_start = g_get_monotonic_time();
+    autotune->level_bytes = 0;
+    autotune->level_samples = 0;
+    autotune->prev_level_speed = 0.0;
+}
+
+/** Change the allowed number of parallel transfers by the step.
+ */
+static void
+step_autotune(LrDownload *dd, int step, gdouble level_speed)
+{
+    LrAutotune *autotune = &dd->autotune;
+    int allowed = CLAMP(autotune->allowed + step,
+                        1, dd->max_parallel_connections);
+
+    if (allowed != autotune->allowed)
+        g_debug("%s: %d -> %d parallel transfers (%.0f B/s)", __func__,
+                autotune->allowed, allowed, level_speed);
+
+    autotune->growing = (step > 0);
+    autotune->allowed = allowed;
+    autotune->prev_level_speed = level_speed;
+    autotune->level_start = g_get_monotonic_time();
+    autotune->level_bytes = 0;
+    autotune->level_samples = 0;
+}
+
+/** Tune the number of parallel transfers by the just finished transfer.
+ * The total throughput is measured for each number of transfers. The
+ * number grows as long as the total throughput grows, it is decreased
+ * when the throughput doesn't grow anymore (the link is saturated) or
+ * falls. A timed out transfer means congestion, the number is
+ * decreased immediately.
+ * @param dd            Download data
+ * @param curl_handle   Curl handle of the transfer
+ * @param timeout       TRUE if the transfer timed out
+ */
+static void
+update_autotune(LrDownload *dd, CURL *curl_handle, gboolean timeout)
+{
+    LrAutotune *autotune = &dd->autotune;
+    gdouble size = 0.0;
+
+    if (!autotune->enabled)
+        return;
+
+    if (timeout) {
+        step_autotune(dd, -1, 0.0);
+        return;
+    }
+
+    curl_easy_getinfo(curl_handle, CURLINFO_SIZE_DOWNLOAD, &size);
+    autotune->level_bytes += (guint64) MAX(size, 0.0);
+    autotune->level_samples++;
+
+    gint64 elapsed = g_get_monotonic_time() - autotune->level_start;
+    if (autotune->level_samples < autotune->allowed
+        || elapsed < LR_AUTOTUNE_MIN_LEVEL_TIME)
+        return;  // Not enough samples yet
+
+    gdouble prev = autotune->prev_level_speed;
+    gdouble level = autotune->level_bytes * (gdouble) G_USEC_PER_SEC / elapsed;
+
+    if (prev <= 0.0 || level > prev * (1.0 + LR_AUTOTUNE_GAIN)) {
+        // Throughput grows - go on
+        step_autotune(dd, (prev <= 0.0 || autotune->growing) ? 1 : -1, level);
+    } else if (level < prev * (1.0 - LR_AUTOTUNE_GAIN)) {
+        // Throughput falls - turn back
+        step_autotune(dd, autotune->growing ? -1 : 1, level);
+    } else if (autotune->growing) {
+        // Plateau - the previous number was as good
+        step_autotune(dd, -1, level);
+    } else {
+        // Stay at the current number and measure it again
+        step_autotune(dd, 0, level);
+    }
+}
+
+/** Return expected completion time of a transfer of
+ * MIRROR_STATS_REFERENCE_SIZE bytes from the mirror or -1.0 if
+ * it cannot be determined (e.g. when is too early).
+ * The time is prolonged according to the error rate of the mirror.
+ */
+static gdouble
+mirror_expected_time(LrMirror *mirror)
+{
+    gdouble successful = mirror->successful_transfers + mirror->prior_successful;
+    gdouble failed = mirror->failed_transfers + mirror->prior_failed;
+
+    if (mirror->speed <= 0.0) {
+        if (successful < 1.0 && failed >= 3.0)
+            return G_MAXDOUBLE;  // Mirror which only fails
+        return -1.0;  // Do not judge too early
+    }
+
+    gdouble time = mirror->ttfb + MIRROR_STATS_REFERENCE_SIZE / mirror->speed;
+    gdouble success_rate = (successful + 1) / (successful + failed + 1);
+
+    return time / success_rate;
+}
+
+/** Sort mirrors by the cost (lower is better).
+ * Mirrors which cannot be judged yet (negative cost) keep their positions,
+ * the other mirrors are sorted among the positions they occupy.
+ * @param mirrors   GSList of mirrors (order of list elements won't be changed,
+ *                  only data pointers)
+ * @param cost      Cost of the mirror
+ */
+static void
+sort_mirrors_by_cost(GSList *mirrors, gdouble (*cost)(LrMirror *))
+{
+    guint count = 0;
+    guint length = g_slist_length(mirrors);
+    GSList **elems = lr_malloc0(length * sizeof(GSList *));
+    LrMirror **ranked = lr_malloc0(length * sizeof(LrMirror *));
+    gdouble *times = lr_malloc0(length * sizeof(gdouble));
+
+    for (GSList *elem = mirrors; elem; elem = g_slist_next(elem)) {
+        LrMirror *mirror = elem->data;
+        gdouble time = cost(mirror);
+        if (time < 0.0)
+            continue;
+
+        // Insertion sort - it is stable and the list is usually
+        // almost sorted
+        guint x = count;
+        while (x > 0 && times[x-1] > time) {
+            ranked[x] = ranked[x-1];
+            times[x] = times[x-1];
+            x--;
+        }
+        ranked[x] = mirror;
+        times[x] = time;
+        elems[count] = elem;
+        count++;
+    }
+
+    for (guint x = 0; x < count; x++)
+        elems[x]->data = ranked[x];
+
+    lr_free(elems);
+    lr_free(ranked);
+    lr_free(times);
+}
+
+/** Return mirror rank or -1.0 if the rank cannot be determined
+ * (e.g. when is too early)
+ * Rank is currently just success rate for the mirror
+ */
+static gdouble
+mirror_rank(LrMirror *mirror)
+{
+    gdouble rank = -1.0;
+
+    // Transfers of the previous runs count too
+    gdouble successful = mirror->successful_transfers + mirror->prior_successful;
+    gdouble failed = mirror->failed_transfers + mirror->prior_failed;
+    gdouble finished_transfers = successful + failed;
+
+    if (finished_transfers < 3.0)
+        return rank; // Do not judge too early
+
+    rank = successful / finished_transfers;
+
+    return rank;
+}
+
+/** Cost of the mirror for sort_mirrors_by_cost() by its error rate.
+ */
+static gdouble
+mirror_error_rate(LrMirror *mirror)
+{
+    gdouble rank = mirror_rank(mirror);
+    return rank < 0.0 ? -1.0 : 1.0 - rank;
+}
+
+/** Rank the new mirrors of the handle by the results of the previous
+ * runs (see LRO_MIRRORHEALTHCACHE) and sort them, so the first transfers
+ * already go to the good ones. The store is shared by the handles of
+ * the process (see lr_mirrorregistry_get_health()).
+ * @param mode      Mode of sorting (LrAdaptiveMirrorSorting)
+ * @param handle    Handle
+ * @param lrmirrors GSList of mirrors of the handle
+ */
+static void
+seed_mirror_health(long mode, LrHandle *handle, GSList *lrmirrors)
+{
+    if (!handle->mirrorhealthcache || !mode || !lrmirrors)
+        return;  // The ranks are used only by the adaptive sorting
+
+    gint64 now = g_get_real_time() / G_USEC_PER_SEC;
+
+    for (GSList *elem = lrmirrors; elem; elem = g_slist_next(elem)) {
+        LrMirror *mirror = elem->data;
+        LrMirrorHealth health;
+
+        if (!lr_mirrorregistry_get_health(handle->mirrorhealthcache,
+                                          mirror->mirror->host, now, &health))
+            continue;
+
+        mirror->prior_successful = health.successful;
+        mirror->prior_failed = health.failed;
+        if (mode == LR_ADAPTIVEMIRRORSORTING_THROUGHPUT) {
+            mirror->speed = health.speed;
+            mirror->ttfb = health.ttfb;
+        }
+        g_debug("%s: Mirror %s: s: %.1f f: %.1f speed: %.0f ttfb: %.3f%s%s",
+                __func__, mirror->mirror->url, health.successful,
+                health.failed, health.speed, health.ttfb,
+                health.lasterror ? " last error: " : "",
+                health.lasterror ? health.lasterror : "");
+        lr_mirrorhealth_clear(&health);
+    }
+
+    if (mode == LR_ADAPTIVEMIRRORSORTING_THROUGHPUT)
+        sort_mirrors_by_cost(lrmirrors, mirror_expected_time);
+    else
+        sort_mirrors_by_cost(lrmirrors, mirror_error_rate);
+}
+
+/** Add the transfers of the download to the mirror health stores
+ * of the handles (see LRO_MIRRORHEALTHCACHE). The stores are written
+ * periodically (see lr_mirrorregistry_flush_health()), errors are only
+ * logged.
+ */
+static void
+record_mirror_health(LrDownload *dd)
+{
+    gint64 now = g_get_real_time() / G_USEC_PER_SEC;
+
+    for (GSList *elem = dd->handle_mirrors; elem; elem = g_slist_next(elem)) {
+        LrHandleMirrors *handle_mirrors = elem->data;
+        LrHandle *handle = handle_mirrors->handle;
+        gboolean recorded = FALSE;
+
+        if (!handle || !handle->mirrorhealthcache)
+            continue;
+
+        for (GSList *el = handle_mirrors->lrmirrors; el; el = g_slist_next(el)) {
+            LrMirror *mirror = el->data;
+            LrMirrorHealth delta = { 0 };
+
+            if (!mirror->successful_transfers && !mirror->failed_transfers)
+                continue;  // Not used
+
+            delta.successful = mirror->successful_transfers;
+            delta.failed = mirror->failed_transfers;
+            delta.speed = mirror->speed;
+            if (delta.speed <= 0.0 && mirror->transfer_time > 0.0)
+                delta.speed = mirror->downloaded_bytes / mirror->transfer_time;
+            delta.ttfb = mirror->ttfb;
+            delta.lasterror = mirror->last_error;
+            lr_mirrorregistry_record_health(handle->mirrorhealthcache,
+                                            mirror->mirror->host, now, &delta);
+            recorded = TRUE;
+        }
+
+        if (!recorded)
+            continue;
+
+        GError *tmp_err = NULL;
+        if (!lr_mirrorregistry_flush_health(handle->mirrorhealthcache, FALSE,
+                                            &tmp_err)) {
+            g_debug("%s: Cannot write %s: %s", __func__,
+                    handle->mirrorhealthcache, tmp_err->message);
+            g_error_free(tmp_err);
+        }
+    }
+}
+
+
+/** Sort mirrors. Penalize the error ones.
+ * With LR_ADAPTIVEMIRRORSORTING_ERRORRATE only move the current
+ * finished mirror forward or backward by one position.
+ * @param mode      Mode of sorting (LrAdaptiveMirrorSorting)
+ * @param mirrors   GSList of mirrors (order of list elements won't be changed,
+ *                  only data pointers)
+ * @param mirror    Mirror of just finished transfer
+ * @param success   Was download from the mirror successful
+ */
+static gboolean
+sort_mirrors(long mode, GSList *mirrors, LrMirror *mirror, gboolean success)
+{
+    GSList *elem = mirrors;
+    GSList *prev = NULL;
+    GSList *next = NULL;
+    gdouble rank_cur;
+
+    assert(mirrors);
+    assert(mirror);
+
+    if (mirror->cache)
+        return TRUE;  // Cache sources don't affect the order of mirrors
+
+    for (; elem && elem->data != mirror; elem = g_slist_next(elem))
+        prev = elem;
+
+    assert(elem);  // Mirror should always exists in the list of mirrors
+
+    next = elem->next;
+
+    if (mode == LR_ADAPTIVEMIRRORSORTING_THROUGHPUT) {
+        sort_mirrors_by_cost(mirrors, mirror_expected_time);
+        LR_PROBE1(mirror__sorted, mirror->mirror->url);
+        goto exit;
+    }
+
+    if (!success && !next)
+        goto exit; // Penalization not needed - Mirror is already the last one
+    if (success && !prev)
+        goto exit; // Bonus not needed - Mirror is already the first one
+
+    // Calculate ranks
+    rank_cur  = mirror_rank(mirror);
+    if (rank_cur < 0.0)
+        goto exit; // Too early to judge
+
+
+    if (!success) {
+        // Penalize
+        gdouble rank_next = mirror_rank(next->data);
+        if (rank_next < 0.0 || rank_next > rank_cur) {
+            elem->data = next->data;
+            next->data = (gpointer) mirror;
+            g_debug("%s: Mirror %s was penalized", __func__, mirror->mirror->url);
+            LR_PROBE3(mirror__penalized, mirror->mirror->url,
+                      (long) (rank_cur * 1000), (long) (rank_next * 1000));
+        }
+    } else {
+        // Bonus
+        gdouble rank_prev = mirror_rank(prev->data);
+        if (rank_prev < rank_cur) {
+            elem->data = prev->data;
+            prev->data = mirror;
+            g_debug("%s: Mirror %s was awarded", __func__, mirror->mirror->url);
+            LR_PROBE3(mirror__awarded, mirror->mirror->url,
+                      (long) (rank_cur * 1000), (long) (rank_prev * 1000));
+        }
+    }
+
+exit:
+    if (g_getenv("LIBREPO_DEBUG_ADAPTIVEMIRRORSORTING")) {
+        // Debug
+        g_debug("%s: Updated order of mirrors (for %p):", __func__, mirrors);
+        for (GSList *elem = mirrors; elem; elem = g_slist_next(elem)) {
+            LrMirror *m = elem->data;
+            g_debug(" %s (s: %d f: %d speed: %.0f ttfb: %.3f)",
+                    m->mirror->url, m->successful_transfers,
+                    m->failed_transfers, m->speed, m->ttfb);
+        }
+    }
+
+    return TRUE;
+}
+
+
+static gboolean
+finish_assembled_target(LrDownload *dd,
+                        LrTarget *target,
+                        gboolean failed,
+                        GError **err);
+
+static gboolean
+complete_assembled_target(LrDownload *dd,
+                          LrTarget *target,
+                          gboolean failed,
+                          GError **err);
+
+/** Finish the segmented target if all its segments are finished.
+ * See finish_assembled_target().
+ */
+static gboolean
+finish_segmented_target(LrDownload *dd, LrTarget *target, GError **err)
+{
+    gboolean failed = FALSE;
+
+    assert(target->segments);
+    assert(!err || *err == NULL);
+
+    for (GSList *elem = target->segments; elem; elem = g_slist_next(elem)) {
+        LrTarget *segment = elem->data;
+        if (segment->state == LR_DS_WAITING || segment->state == LR_DS_RUNNING)
+            return TRUE;  // Not finished yet
+        if (segment->state == LR_DS_FAILED)
+            failed = TRUE;
+    }
+
+    return finish_assembled_target(dd, target, failed, err);
+}
+
+/** Finish the target whose file was downloaded by parts (segments or
+ * the target and its hedged request).
+ * If the parts were downloaded, the checksum of the whole file
+ * is verified by the verifier and the target is completed by
+ * complete_assembled_target() then.
+ */
+static gboolean
+finish_assembled_target(LrDownload *dd,
+                        LrTarget *target,
+                        gboolean failed,
+                        GError **err)
+{
+    int fd;
+
+    assert(!err || *err == NULL);
+
+    if (failed)
+        return complete_assembled_target(dd, target, TRUE, err);
+
+    // Check checksum of the whole file
+    if (target->target->fn)
+        fd = open(target_fn(target), O_RDONLY);
+    else
+        fd = dup(target_fd(target));
+
+    if (fd < 0) {
+        g_set_error(err, LR_DOWNLOADER_ERROR, LRE_IO,
+                    "Cannot open %s: %s", target->target->path,
+                    strerror(errno));
+        return FALSE;
+    }
+
+    start_verification(dd, target, fd, TRUE, NULL);
+    return TRUE;
+}
+
+/** Complete the target downloaded by parts.
+ * If any part failed or the checksum doesn't match (failed is TRUE),
+ * the target becomes waiting again and it is downloaded as a whole.
+ */
+static gboolean
+complete_assembled_target(LrDownload *dd,
+                          LrTarget *target,
+                          gboolean failed,
+                          GError **err)
+{
+    assert(!err || *err == NULL);
+
+    if (failed) {
+        // Download the file as a whole
+        g_debug("%s: Download of %s by parts failed - downloading "
+                "it as a whole", __func__, target->target->path);
+        queue_target(dd, target);
+        lr_downloadtarget_set_usedmirror(target->target, NULL);
+        lr_downloadtarget_set_effectiveurl(target->target, NULL);
+        return truncate_transfer_file(target, err);
+    }
+
+    if (!target->target->fn)
+        // Leave offset of the file descriptor at the end of the file
+        // as regular download does
+        lseek(target_fd(target), 0, SEEK_END);
+
+    g_debug("%s: Download of %s by parts finished", __func__,
+            target->target->path);
+
+    if (!load_target_data(target, err))
+        return FALSE;
+
+    if (!finish_decompression(target, err))
+        return FALSE;
+
+    if (!finish_target_outputs(target, err))
+        return FALSE;
+
+    if (!commit_target_file(target, err))
+        return FALSE;
+
+    target->state = LR_DS_FINISHED;
+    lr_downloadtarget_set_error(target->target, LRE_OK, NULL);
+
+    // Call end callback
+    if (call_endcb(dd, target, LR_TRANSFER_SUCCESSFUL, NULL) == LR_CB_ERROR) {
+        target->cb_return_code = LR_CB_ERROR;
+        g_debug("%s: Downloading was aborted by LR_CB_ERROR "
+                "from end callback", __func__);
+        g_set_error(err, LR_DOWNLOADER_ERROR, LRE_CBINTERRUPTED,
+                    "Interupted by LR_CB_ERROR from end callback");
+        return FALSE;
+    }
+
+    return finish_duplicates(dd, target, err);
+}
+
+/** Return the mirror the part of the assembled target at the offset
+ * was downloaded from.
+ */
+static LrMirror *
+assembled_part_mirror(LrTarget *target, gint64 offset)
+{
+    for (GSList *elem = target->segments; elem; elem = g_slist_next(elem)) {
+        LrTarget *segment = elem->data;
+        if (offset >= segment->segment_start && offset <= segment->segment_end)
+            return segment->mirror;
+    }
+
+    return target->mirror;
+}
+
+/** Download the damaged pieces of the target again instead of the whole
+ * file. Adjacent pieces are joined into one segment, the segments are
+ * downloaded by byte ranges into the already complete file from other
+ * mirrors than the ones the damaged pieces came from. The whole file
+ * is verified when all the segments are finished (see
+ * finish_segmented_target()), if it still doesn't match, it is
+ * downloaded as a whole.
+ * @param bad       Indexes of the damaged pieces in ascending order
+ * @param assembled TRUE if the file was downloaded by parts
+ */
+static gboolean
+repair_target_pieces(LrDownload *dd,
+                     LrTarget *target,
+                     GArray *bad,
+                     gboolean assembled,
+                     GError **err)
+{
+    struct stat st;
+    int rc;
+    gint64 length = target->target->pieces->length;
+    GSList *segments = NULL;
+
+    assert(bad && bad->len > 0);
+    assert(!err || *err == NULL);
+
+    if (target->target->fn)
+        rc = stat(target_fn(target), &st);
+    else
+        rc = fstat(target_fd(target), &st);
+
+    if (rc == -1) {
+        g_set_error(err, LR_DOWNLOADER_ERROR, LRE_IO,
+                    "Cannot stat %s: %s", target->target->path,
+                    strerror(errno));
+        return FALSE;
+    }
+
+    target->repair_tried = TRUE;
+    target->segmentation_tried = TRUE;
+
+    g_debug("%s: %u pieces of %s are damaged - downloading them again",
+            __func__, bad->len, target->target->path);
+
+    for (guint x = 0; x < bad->len; x++) {
+        guint first = g_array_index(bad, guint, x);
+        guint last = first;
+        while (x + 1 < bad->len && g_array_index(bad, guint, x + 1) == last + 1)
+            last = g_array_index(bad, guint, ++x);
+
+        LrTarget *segment = lr_malloc0(sizeof(*segment));
+        segment->queue_seq       = dd->next_queue_seq++;
+        segment->target          = target->target;
+        segment->original_offset = -1;
+        segment->lrmirrors       = target->lrmirrors;
+        segment->handle          = target->handle;
+        segment->limiter         = target->limiter;
+        segment->parent          = target;
+        segment->segment_start   = (gint64) first * length;
+        segment->segment_end     = MIN((gint64) (last + 1) * length,
+                                       (gint64) st.st_size) - 1;
+
+        // Do not download the pieces from the mirror which damaged them
+        LrMirror *bad_mirror = assembled
+                ? assembled_part_mirror(target, segment->segment_start)
+                : target->mirror;
+        if (bad_mirror)
+            mark_mirror_tried(segment, bad_mirror);
+
+        segments = g_slist_append(segments, segment);
+        g_ptr_array_add(dd->targets, segment);
+        queue_target(dd, segment);
+    }
+
+    // Segments of a previous split stay in dd->targets
+    g_slist_free(target->segments);
+    target->segments = segments;
+    target->state = LR_DS_RUNNING;
+
+    return TRUE;
+}
+
+/** Evaluate just finished transfer of a segment.
+ * A failed segment is retried from another mirror.
+ * The transfer_err is always consumed.
+ */
+static gboolean
+check_finished_segment(LrDownload *dd,
+                       LrTarget *segment,
+                       GError *transfer_err,
+                       gboolean fatal_error,
+                       const char *effective_url,
+                       GError **err)
+{
+    LrTarget *target = segment->parent;
+    gint64 length = segment->segment_end - segment->segment_start + 1;
+
+    assert(target);
+    assert(!err || *err == NULL);
+
+    if (!transfer_err && segment->segment_written != length)
+        g_set_error(&transfer_err, LR_DOWNLOADER_ERROR, LRE_CURL,
+                    "Segment %"G_GINT64_FORMAT"-%"G_GINT64_FORMAT" is "
+                    "incomplete (%"G_GINT64_FORMAT" bytes downloaded)",
+                    segment->segment_start, segment->segment_end,
+                    segment->segment_written);
+
+    if (transfer_err) {
+        guint num_of_tried_mirrors = segment->num_of_tried_mirrors;
+
+        g_debug("%s: Error during transfer of segment: %s",
+                __func__, transfer_err->message);
+
+        // Update mirror statistics (a missed deadline is not its failure)
+        if (segment->mirror && transfer_err->code != LRE_DEADLINE) {
+            segment->mirror->failed_transfers++;
+            g_free(segment->mirror->last_error);
+            segment->mirror->last_error = g_strdup(transfer_err->message);
+            breaker_failure(dd, segment->mirror);
+            if (dd->adaptivemirrorsorting)
+                sort_mirrors(dd->adaptivemirrorsorting, segment->lrmirrors,
+                             segment->mirror, FALSE);
+        }
+
+        // Call mirrorfailure callback
+        LrMirrorFailureCb mf_cb = target->target->mirrorfailurecb;
+        if (mf_cb && transfer_err->code != LRE_DEADLINE) {
+            int rc = mf_cb(target->target->cbdata,
+                           transfer_err->message,
+                           effective_url);
+            if (rc == LR_CB_ABORT) {
+                fatal_error = TRUE;
+            } else if (rc == LR_CB_ERROR) {
+                fatal_error = TRUE;
+                segment->cb_return_code = LR_CB_ERROR;
+            }
+        }
+
+        g_error_free(transfer_err);
+        segment->segment_written = 0;
+
+        if (segment->cb_return_code == LR_CB_ERROR) {
+            g_debug("%s: Downloading was aborted by LR_CB_ERROR", __func__);
+            g_set_error(err, LR_DOWNLOADER_ERROR, LRE_CBINTERRUPTED,
+                        "Downloading was aborted by LR_CB_ERROR");
+            return FALSE;
+        }
+
+        if (!fatal_error &&
+            (dd->max_mirrors_to_try <= 0 ||
+             num_of_tried_mirrors < dd->max_mirrors_to_try))
+        {
+            // Try another mirror
+            queue_target(dd, segment);
+            return TRUE;
+        }
+
+        segment->state = LR_DS_FAILED;
+    } else {
+        segment->state = LR_DS_FINISHED;
+
+        if (segment == target->segments->data && !target->repair_tried) {
+            // Report the mirror of the first segment
+            if (segment->mirror)
+                lr_downloadtarget_set_usedmirror(target->target,
+                                                 segment->mirror->mirror->url);
+            lr_downloadtarget_set_effectiveurl(target->target, effective_url);
+        }
+
+        // Update mirror statistics
+        if (segment->mirror) {
+            segment->mirror->successful_transfers++;
+            breaker_success(segment->mirror);
+            if (dd->adaptivemirrorsorting)
+                sort_mirrors(dd->adaptivemirrorsorting, segment->lrmirrors,
+                             segment->mirror, TRUE);
+        }
+    }
+
+    return finish_segmented_target(dd, target, err);
+}
+
+/** Return TRUE if the interrupted transfer of the target could continue
+ * from the already downloaded data (see LRO_LOWSPEEDRESUME).
+ */
+static gboolean
+can_resume_transfer(LrTarget *target)
+{
+    if (is_range_transfer(target))
+        return FALSE;
+    if (target->target->byterangestart > 0 || target->target->byterangeend > 0)
+        return FALSE;
+    return target->writecb_recieved > 0;
+}
+
+/** Evaluate just finished hedged request.
+ * If the request was successful, it wins: the transfer of the target
+ * is cancelled and the target is finished. A failed request is dropped
+ * and its target goes on. The transfer_err is always consumed.
+ */
+static gboolean
+check_finished_hedge(LrDownload *dd,
+                     LrTarget *hedge,
+                     GError *transfer_err,
+                     const char *effective_url,
+                     GError **err)
+{
+    LrTarget *target = hedge->hedged;
+    LrMirror *mirror = hedge->mirror;
+    gint64 length = hedge->segment_end - hedge->segment_start + 1;
+
+    assert(target);
+    assert(!err || *err == NULL);
+
+    if (!transfer_err && hedge->segment_written != length)
+        g_set_error(&transfer_err, LR_DOWNLOADER_ERROR, LRE_CURL,
+                    "Hedged request is incomplete (%"G_GINT64_FORMAT
+                    " bytes downloaded)", hedge->segment_written);
+
+    if (transfer_err) {
+        g_debug("%s: Hedged request for %s failed: %s", __func__,
+                target->target->path, transfer_err->message);
+        g_error_free(transfer_err);
+
+        // Update mirror statistics
+        if (mirror) {
+            mirror->failed_transfers++;
+            breaker_failure(dd, mirror);
+            if (dd->adaptivemirrorsorting)
+                sort_mirrors(dd->adaptivemirrorsorting, hedge->lrmirrors,
+                             mirror, FALSE);
+        }
+
+        free_hedge(hedge);
+        return TRUE;
+    }
+
+    g_debug("%s: Hedged request for %s finished first", __func__,
+            target->target->path);
+
+    // Update mirror statistics
+    if (mirror) {
+        mirror->successful_transfers++;
+        breaker_success(mirror);
+        if (dd->adaptivemirrorsorting)
+            sort_mirrors(dd->adaptivemirrorsorting, hedge->lrmirrors,
+                         mirror, TRUE);
+    }
+
+    free_hedge(hedge);
+    cancel_transfer(dd, target);
+
+    target->mirror = mirror;
+    if (mirror)
+        lr_downloadtarget_set_usedmirror(target->target, mirror->mirror->url);
+    lr_downloadtarget_set_effectiveurl(target->target, effective_url);
+
+    return finish_assembled_target(dd, target, FALSE, err);
+}
+
+/** Call the LRO_MULTIPROGRESSCB with progress of all running targets.
+ * The callback is called at most once per LRO_PROGRESSINTERVAL.
+ */
+static gboolean
+report_progress(LrDownload *dd, GError **err)
+{
+    int rc;
+    gint64 now;
+    GArray *progress;
+
+    if (!dd->multi_progresscb)
+        return TRUE;
+
+    now = g_get_monotonic_time();
+    if (dd->progress_interval > 0
+        && now - dd->last_multi_progress < dd->progress_interval)
+        return TRUE;
+
+    progress = g_array_new(FALSE, FALSE, sizeof(LrTargetProgress));
+    for (guint x = 0; x < dd->targets->len; x++) {
+        LrTarget *target = g_ptr_array_index(dd->targets, x);
+        LrTargetProgress item;
+
+        // Segments are reported as a part of the whole target
+        if (target->parent || target->state != LR_DS_RUNNING)
+            continue;
+
+        item.path              = target->target->path;
+        item.cbdata            = target_cbdata(dd, target->target);
+        item.total_to_download = target->progress_total;
+        item.now_downloaded    = target->progress_now;
+        g_array_append_val(progress, item);
+    }
+
+    if (progress->len == 0) {
+        g_array_free(progress, TRUE);
+        return TRUE;
+    }
+
+    dd->last_multi_progress = now;
+    shard_callbacks_lock(dd);
+    rc = dd->multi_progresscb(dd->multi_progresscb_data,
+                              (LrTargetProgress *) progress->data,
+                              progress->len);
+    shard_callbacks_unlock(dd);
+    g_array_free(progress, TRUE);
+
+    if (rc != LR_CB_OK) {
+        g_set_error(err, LR_DOWNLOADER_ERROR, LRE_CBINTERRUPTED,
+                    "Interrupted by LRO_MULTIPROGRESSCB callback");
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+/** Count the failed transfer to the errors reported by the LRO_METRICSCB.
+ */
+static void
+count_transfer_error(LrDownload *dd, const GError *transfer_err)
+{
+    if (!transfer_err)
+        return;
+
+    int code = transfer_err->code;
+    if (code < 0 || code > LRE_UNKNOWNERROR)
+        code = LRE_UNKNOWNERROR;
+    dd->transfer_errors[code]++;
+}
+
+/** Add metrics of the mirrors (only of the used ones) to the array.
+ */
+static void
+append_mirror_metrics(GArray *mirrors,
+                      GSList *lrmirrors,
+                      GPtrArray *running,
+                      gdouble elapsed)
+{
+    for (GSList *elem = lrmirrors; elem; elem = g_slist_next(elem)) {
+        LrMirror *mirror = elem->data;
+        LrMirrorMetrics item;
+        guint64 bytes = mirror->downloaded_bytes;
+
+        // Data received by the running transfers so far
+        for (guint x = 0; x < running->len; x++) {
+            LrTarget *target = g_ptr_array_index(running, x);
+            if (target->mirror == mirror && target->writecb_recieved > 0)
+                bytes += (guint64) target->writecb_recieved;
+        }
+
+        if (!bytes && !mirror->running_transfers
+            && !mirror->successful_transfers && !mirror->failed_transfers)
+            continue;
+
+        item.url        = mirror->mirror->url;
+        item.running    = (guint) mirror->running_transfers;
+        item.bytes      = bytes;
+        item.speed      = (elapsed > 0 && bytes > mirror->metrics_bytes)
+                          ? (bytes - mirror->metrics_bytes) / elapsed : 0.0;
+        item.successful = (guint) mirror->successful_transfers;
+        item.failed     = (guint) mirror->failed_transfers;
+        g_array_append_val(mirrors, item);
+
+        mirror->metrics_bytes = bytes;
+    }
+}
+
+/** Call the LRO_METRICSCB with metrics of the download.
+ * The callback is called at most once per LRO_METRICSINTERVAL.
+ */
+static gboolean
+report_metrics(LrDownload *dd, GError **err)
+{
+    int rc;
+    gint64 now;
+    gdouble elapsed;
+    GArray *mirrors;
+    LrMetrics metrics;
+
+    if (!dd->metricscb)
+        return TRUE;
+
+    now = g_get_monotonic_time();
+    if (now - dd->last_metrics < dd->metrics_interval)
+        return TRUE;
+
+    elapsed = (now - dd->last_metrics) / 1000000.0;
+    dd->last_metrics = now;
+
+    mirrors = g_array_new(FALSE, FALSE, sizeof(LrMirrorMetrics));
+    for (GSList *elem = dd->handle_mirrors; elem; elem = g_slist_next(elem)) {
+        LrHandleMirrors *hm = elem->data;
+        append_mirror_metrics(mirrors, hm->lrmirrors,
+                              dd->running_transfers, elapsed);
+        append_mirror_metrics(mirrors, hm->cachemirrors,
+                              dd->running_transfers, elapsed);
+    }
+
+    metrics.running         = dd->running_transfers->len;
+    metrics.queued          = (guint) g_sequence_get_length(dd->waiting_targets);
+    metrics.verifying       = dd->verifying_transfers;
+    metrics.bytes           = 0;
+    metrics.speed           = 0.0;
+    for (guint x = 0; x < mirrors->len; x++) {
+        LrMirrorMetrics *item = &g_array_index(mirrors, LrMirrorMetrics, x);
+        metrics.bytes += item->bytes;
+        metrics.speed += item->speed;
+    }
+    metrics.errors          = dd->transfer_errors;
+    metrics.errors_count    = G_N_ELEMENTS(dd->transfer_errors);
+    metrics.mirrors         = (LrMirrorMetrics *) mirrors->data;
+    metrics.mirrors_count   = mirrors->len;
+
+    shard_callbacks_lock(dd);
+    rc = dd->metricscb(dd->metricscb_data, &metrics);
+    shard_callbacks_unlock(dd);
+    g_array_free(mirrors, TRUE);
+
+    if (rc != LR_CB_OK) {
+        g_set_error(err, LR_DOWNLOADER_ERROR, LRE_CBINTERRUPTED,
+                    "Interrupted by LRO_METRICSCB callback");
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+/** Remove the finished transfer of the target from the multi handle
+ * and free its slot (connection to the mirror), so the next transfer
+ * could be started. The file of the target stays open.
+ */
+static void
+remove_transfer(LrDownload *dd, LrTarget *target)
+{
+    curl_multi_remove_handle(dd->multi_handle, target->curl_handle);
+    curl_easy_cleanup(target->curl_handle);
+    target->curl_handle = NULL;
+    if (target->paused) {
+        target->paused = FALSE;
+        dd->limiter.paused_transfers--;
+    }
+
+    remove_running_transfer(dd, target);
+    mark_mirror_tried(target, target->mirror);
+
+    if (target->mirror)
+        step_running_transfers(target->mirror, -1);
+}
+
+/** Pass the validators of the successful conditional request
+ * to the LrDownloadTarget. A 304 response keeps the validators
+ * of the local copy unless the server sent new ones.
+ */
+static void
+set_target_validators(LrTarget *target)
+{
+    LrDownloadTarget *dtarget = target->target;
+
+    dtarget->notmodified = target->notmodified;
+
+    if (target->etag)
+        dtarget->etag = g_string_chunk_insert(dtarget->chunk, target->etag);
+    else if (!target->notmodified)
+        dtarget->etag = NULL;
+
+    if (target->lastmodified > 0)
+        dtarget->lastmodified = target->lastmodified;
+    else if (!target->notmodified)
+        dtarget->lastmodified = 0;
+}
+
+/** Evaluate the finished (and verified) transfer of the target.
+ * On error the target is retried from another mirror or it fails.
+ * The transfer_err is always consumed.
+ * @return      FALSE if the whole downloading has to be interrupted
+ *              (err is set)
+ */
+static gboolean
+finish_transfer(LrDownload *dd,
+                LrTarget *target,
+                GError *transfer_err,
+                gboolean fatal_error,
+                gboolean resume,
+                const char *effective_url,
+                GError **err)
+{
+    GError *fail_fast_error = NULL;
+
+    assert(!err || *err == NULL);
+
+    if (!transfer_err && (!commit_target_file(target, &transfer_err)
+                          || (dd->durability == LR_DURABILITY_STRICT
+                              && !sync_target_file(target->target,
+                                                   &transfer_err))))
+        fatal_error = TRUE;
+
+    if (transfer_err) {  // There was an error during transfer
+        int complete_url_in_path = strstr(target->target->path, "://") ? 1 : 0;
+        guint num_of_tried_mirrors = target->num_of_tried_mirrors;
+
+        gboolean cache_miss = FALSE;
+        gboolean deadline = (transfer_err->code == LRE_DEADLINE);
+
+        g_debug("%s: Error during transfer: %s", __func__, transfer_err->message);
+
+        if (transfer_err->code == LRE_BADCHECKSUM)
+            // Do not resume the broken file from the journal
+            remove_target_journal(target);
+
+        if (target->proxy_retry && !fatal_error) {
+            // Only the proxy failed, try the mirror again through
+            // another proxy of the pool
+            g_debug("%s: Proxy failed - Try another proxy", __func__);
+            target->proxy_retry = FALSE;
+            unmark_mirror_tried(target, target->mirror);
+            queue_target(dd, target);
+            g_error_free(transfer_err);
+            return truncate_transfer_file(target, err);
+        }
+        target->proxy_retry = FALSE;
+
+        // Update mirror statistics
+        if (target->mirror && target->mirror->cache
+            && transfer_err->code == LRE_BADSTATUS)
+        {
+            // The cache source doesn't have the target, it is not its fault
+            g_debug("%s: Cache miss - Try the next source", __func__);
+            cache_miss = TRUE;
+        } else if (target->mirror && !deadline) {
+            // Note: A missed deadline is not a failure of the mirror
+            target->mirror->failed_transfers++;
+            g_free(target->mirror->last_error);
+            target->mirror->last_error = g_strdup(transfer_err->message);
+            breaker_failure(dd, target->mirror);
+            if (dd->adaptivemirrorsorting)
+                sort_mirrors(dd->adaptivemirrorsorting, target->lrmirrors,
+                             target->mirror, FALSE);
+        }
+
+        // Call mirrorfailure callback
+        LrMirrorFailureCb mf_cb =  target->target->mirrorfailurecb;
+        if (mf_cb && !cache_miss && !deadline) {
+            int rc = mf_cb(target->target->cbdata,
+                           transfer_err->message,
+                           effective_url);
+            if (rc == LR_CB_ABORT) {
+                // User wants to abort this download, so make the error fatal
+                fatal_error = TRUE;
+            } else if (rc == LR_CB_ERROR) {
+                gchar *original_err_msg = g_strdup(transfer_err->message);
+                g_clear_error(&transfer_err);
+                g_debug("%s: Downloading was aborted by LR_CB_ERROR from "
+                        "mirror failure callback. Original error was: "
+                        "%s", __func__, original_err_msg);
+                g_set_error(&transfer_err, LR_DOWNLOADER_ERROR, LRE_CBINTERRUPTED,
+                            "Downloading was aborted by LR_CB_ERROR from "
+                            "mirror failure callback. Original error was: "
+                            "%s", original_err_msg);
+                g_free(original_err_msg);
+                fatal_error = TRUE;
+                target->cb_return_code = LR_CB_ERROR;
+            }
+        }
+
+        if (!fatal_error &&
+            !complete_url_in_path &&
+            !target->target->baseurl &&
+            (dd->max_mirrors_to_try <= 0 ||
+             num_of_tried_mirrors < dd->max_mirrors_to_try))
+        {
+            // Try another mirror
+            g_debug("%s: Ignore error - Try another mirror", __func__);
+            queue_target(dd, target);
+            g_error_free(transfer_err);  // Ignore the error
+
+            if (resume) {
+                // Keep the data downloaded from the slow mirror
+                target->original_offset = MAX(target->original_offset, 0)
+                                          + target->writecb_recieved;
+                target->resume_from_offset = TRUE;
+                g_debug("%s: Download will continue from offset %"
+                        G_GINT64_FORMAT, __func__,
+                        target->original_offset);
+            }
+
+            // Truncate file - remove downloaded garbage (error html page etc.)
+            if (!truncate_transfer_file(target, err))
+                return FALSE;
+        } else {
+            // No more mirrors to try or baseurl used or fatal error
+            g_debug("%s: No more retries (tried: %d)",
+                    __func__, num_of_tried_mirrors);
+            target->state = LR_DS_FAILED;
+            lr_downloadtarget_set_error(target->target,
+                                        transfer_err->code,
+                                        "Download failed: %s",
+                                        transfer_err->message);
+
+            // Call end callback
+            if (call_endcb(dd, target, LR_TRANSFER_ERROR,
+                           transfer_err->message) == LR_CB_ERROR)
+            {
+                target->cb_return_code = LR_CB_ERROR;
+                g_debug("%s: Downloading was aborted by LR_CB_ERROR "
+                        "from end callback", __func__);
+            }
+            if (dd->failfast) {
+                // Fail fast is enabled, fail on any error
+                g_propagate_error(&fail_fast_error, transfer_err);
+            } else if (target->cb_return_code == LR_CB_ERROR) {
+                // Callback returned LR_CB_ERROR, abort the downloading
+                g_debug("%s: Downloading was aborted by LR_CB_ERROR", __func__);
+                g_propagate_error(&fail_fast_error, transfer_err);
+            } else {
+                // Fail fast is disabled and callback doesn't repor serious
+                // error, so this download is aborted, but other download
+                // can continue (do not abort whole downloading)
+                g_error_free(transfer_err);
+            }
+        }
+
+    } else {
+        // No error encountered, transfer finished successfully
+        target->state = LR_DS_FINISHED;
+        lr_downloadtarget_set_error(target->target, LRE_OK, NULL);
+        if (target->mirror)
+            lr_downloadtarget_set_usedmirror(target->target,
+                                             target->mirror->mirror->url);
+        lr_downloadtarget_set_effectiveurl(target->target,
+                                           effective_url);
+        if (target->target->conditional)
+            set_target_validators(target);
+
+        // Call end callback
+        if (call_endcb(dd, target, LR_TRANSFER_SUCCESSFUL,
+                       NULL) == LR_CB_ERROR)
+        {
+            target->cb_return_code = LR_CB_ERROR;
+            g_debug("%s: Downloading was aborted by LR_CB_ERROR "
+                    "from end callback", __func__);
+            g_set_error(&fail_fast_error, LR_DOWNLOADER_ERROR,
+                        LRE_CBINTERRUPTED,
+                        "Interupted by LR_CB_ERROR from end callback");
+        }
+
+
+        // Update mirror statistics
+        if (target->mirror) {
+            target->mirror->successful_transfers++;
+            breaker_success(target->mirror);
+            if (dd->adaptivemirrorsorting)
+                sort_mirrors(dd->adaptivemirrorsorting, target->lrmirrors,
+                             target->mirror, TRUE);
+        }
+    }
+
+    if (fail_fast_error) {
+        // Interrupt whole downloading
+        // A fatal error occured or interrupted by callback
+        g_propagate_error(err, fail_fast_error);
+        return FALSE;
+    }
+
+    if (target->state == LR_DS_FINISHED || target->state == LR_DS_FAILED)
+        return finish_duplicates(dd, target, err);
+
+    return TRUE;
+}
+
+/** Finish the target whose byte range was downloaded by the transfer
+ * of the batch of the target.
+ */
+static gboolean
+finish_batch_member(LrDownload *dd,
+                    LrTarget *target,
+                    LrTarget *member,
+                    const char *effective_url,
+                    GError **err)
+{
+    LrDownloadTarget *dtarget = member->target;
+    GError *tmp_err = NULL;
+
+    g_debug("%s: Range of %s was downloaded together with %s", __func__,
+            dtarget->path, target->target->path);
+
+    if (!load_target_data(member, &tmp_err)
+        || !commit_target_file(member, &tmp_err)
+        || (dd->durability == LR_DURABILITY_STRICT
+            && !sync_target_file(dtarget, &tmp_err))) {
+        member->state = LR_DS_FAILED;
+        lr_downloadtarget_set_error(dtarget, tmp_err->code,
+                                    "Download failed: %s", tmp_err->message);
+
+        if (call_endcb(dd, member, LR_TRANSFER_ERROR,
+                       tmp_err->message) == LR_CB_ERROR)
+            member->cb_return_code = LR_CB_ERROR;
+        if (dd->failfast || member->cb_return_code == LR_CB_ERROR) {
+            g_propagate_error(err, tmp_err);
+            return FALSE;
+        }
+        g_error_free(tmp_err);
+        return TRUE;
+    }
+
+    member->state = LR_DS_FINISHED;
+    member->mirror = target->mirror;
+    lr_downloadtarget_set_error(dtarget, LRE_OK, NULL);
+    if (target->mirror)
+        lr_downloadtarget_set_usedmirror(dtarget, target->mirror->mirror->url);
+    lr_downloadtarget_set_effectiveurl(dtarget, effective_url);
+
+    // Call end callback
+    if (call_endcb(dd, member, LR_TRANSFER_SUCCESSFUL, NULL) == LR_CB_ERROR)
+    {
+        member->cb_return_code = LR_CB_ERROR;
+        g_debug("%s: Downloading was aborted by LR_CB_ERROR "
+                "from end callback", __func__);
+        g_set_error(err, LR_DOWNLOADER_ERROR, LRE_CBINTERRUPTED,
+                    "Interupted by LR_CB_ERROR from end callback");
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+/** Finish the targets of the batch of byte ranges requested by the just
+ * finished transfer of the target. Targets whose ranges were received
+ * are finished, the others are queued again and downloaded on their own.
+ * The transfer of the target fails if its own range was not received.
+ * Must be called before the file of the target is closed.
+ */
+static gboolean
+finish_range_batch(LrDownload *dd,
+                   LrTarget *target,
+                   const char *effective_url,
+                   GError **transfer_err,
+                   GError **err)
+{
+    LrTransfer *transfer = target->transfer;
+    gboolean failed = (*transfer_err != NULL);
+    gboolean ret = TRUE;
+
+    if (!failed && transfer->multipart
+        && !lr_multipart_finish(transfer->multipart, transfer_err))
+        failed = TRUE;
+    if (!failed && !range_written(target))
+        g_set_error(transfer_err, LR_DOWNLOADER_ERROR, LRE_BADSTATUS,
+                    "Server didn't send the requested byte range "
+                    "%"G_GINT64_FORMAT"-%"G_GINT64_FORMAT" of %s",
+                    MAX(target->target->byterangestart, 0),
+                    target->target->byterangeend, effective_url);
+
+    GSList *batch = detach_range_batch(target);
+    for (GSList *elem = batch; elem; elem = g_slist_next(elem)) {
+        LrTarget *member = elem->data;
+
+        if (ret && !failed && range_written(member)) {
+            ret = finish_batch_member(dd, target, member, effective_url, err);
+            continue;
+        }
+
+        g_debug("%s: Range of %s was not received", __func__,
+                member->target->path);
+        queue_target(dd, member);
+        if (ret && member->writecb_recieved > 0)
+            // Remove the incomplete range
+            ret = truncate_transfer_file(member, err);
+    }
+    g_slist_free(batch);
+
+    return ret;
+}
+
+/** Return TRUE if the target could be copied from the local file of
+ * the full_url instead of a transfer. Only a target which ends up as
+ * the whole file without any side effect of the transfer is copied.
+ */
+static gboolean
+local_transfer_possible(LrTarget *target, const char *full_url)
+{
+    LrDownloadTarget *dtarget = target->target;
+
+    if (!g_str_has_prefix(full_url, "file:///"))
+        return FALSE;
+
+    if ((dtarget->fd < 0 && !dtarget->fn)   // Downloaded into memory
+        || is_range_transfer(target)
+        || dtarget->resume
+        || target->resume_from_offset
+        || dtarget->byterangestart > 0
+        || dtarget->byterangeend > 0
+        || dtarget->decompressfd >= 0
+        || dtarget->datacb
+        || dtarget->outputs
+        || dtarget->conditional)
+        return FALSE;
+
+    // Data of a target downloaded to a file descriptor are written from
+    // its current offset, only an empty file is copied
+    if (!dtarget->fn && lseek(dtarget->fd, 0, SEEK_CUR) != 0)
+        return FALSE;
+
+    return TRUE;
+}
+
+/** Replace the fn by a hardlink of the path.
+ */
+static gboolean
+link_local_file(const char *path, const char *fn)
+{
+    if (unlink(fn) == -1 && errno != ENOENT) {
+        g_debug("%s: Cannot remove %s: %s", __func__, fn, g_strerror(errno));
+        return FALSE;
+    }
+
+    if (link(path, fn) == -1) {
+        g_debug("%s: Cannot hardlink %s to %s: %s", __func__,
+                path, fn, g_strerror(errno));
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+/** Download the target from a local (file://) mirror without curl.
+ * The file is hardlinked (LRO_LOCALHARDLINK), reflinked or copied
+ * inside of the kernel by lr_copy_content() and the target is
+ * evaluated as if its transfer finished.
+ * @return      FALSE if the whole downloading has to be interrupted
+ *              (err is set)
+ */
+static gboolean
+local_transfer(LrDownload *dd,
+               LrTarget *target,
+               const char *full_url,
+               GError **err)
+{
+    LrDownloadTarget *dtarget = target->target;
+    const char *fn = target_fn(target);
+    GError *transfer_err = NULL;
+    gboolean fatal_error = FALSE;
+    gboolean linked = FALSE;
+    gint64 start = g_get_monotonic_time();
+    struct stat src_st, dst_st;
+    int src_fd, fd = -1;
+    _cleanup_free_ gchar *path = NULL;
+
+    assert(!err || *err == NULL);
+
+    path = g_uri_unescape_string(full_url + STRLEN("file://"), NULL);
+    if (!path)
+        path = g_strdup(full_url + STRLEN("file://"));
+
+    g_debug("%s: Copying %s", __func__, path);
+
+    target->state = LR_DS_RUNNING;
+    target->protocol = LR_PROTOCOL_FILE;
+    target->cb_return_code = LR_CB_OK;
+    dtarget->stats.attempts++;
+
+    src_fd = open(path, O_RDONLY);
+    if (src_fd == -1 || fstat(src_fd, &src_st) == -1) {
+        g_set_error(&transfer_err, LR_DOWNLOADER_ERROR, LRE_IO,
+                    "Cannot open %s: %s", path, g_strerror(errno));
+        goto transfer_error;
+    }
+
+    if (!S_ISREG(src_st.st_mode)) {
+        g_set_error(&transfer_err, LR_DOWNLOADER_ERROR, LRE_IO,
+                    "%s is not a regular file", path);
+        goto transfer_error;
+    }
+
+    if (dtarget->expectedsize > 0 && src_st.st_size != dtarget->expectedsize) {
+        g_set_error(&transfer_err, LR_DOWNLOADER_ERROR, LRE_IO,
+                    "File size of %s (%"G_GINT64_FORMAT") doesn't match "
+                    "the expected size (%"G_GINT64_FORMAT")", path,
+                    (gint64) src_st.st_size, dtarget->expectedsize);
+        goto transfer_error;
+    }
+
+    if (dtarget->fn) {
+        if (stat(fn, &dst_st) == 0
+            && dst_st.st_dev == src_st.st_dev
+            && dst_st.st_ino == src_st.st_ino)
+            // The target is the file already (hardlinked before),
+            // it mustn't be truncated
+            linked = TRUE;
+        else if (dd->local_hardlink)
+            linked = link_local_file(path, fn);
+
+        // The hardlinked file is only read, the repository could be
+        // read-only
+        fd = open(fn, linked ? O_RDONLY : O_CREAT|O_TRUNC|O_RDWR, 0666);
+    } else {
+        fd = dup(dtarget->fd);
+    }
+
+    if (fd == -1) {
+        g_set_error(&transfer_err, LR_DOWNLOADER_ERROR, LRE_IO,
+                    "Cannot open %s: %s", dtarget->path, g_strerror(errno));
+        fatal_error = TRUE;
+        goto transfer_error;
+    }
+
+    if (!linked) {
+        int rc = -1;
+#ifdef FICLONE
+        rc = ioctl(fd, FICLONE, src_fd);
+#endif
+        if (rc == -1 && ftruncate(fd, 0) == 0)
+            rc = lr_copy_content(src_fd, fd);
+        if (rc == -1) {
+            g_set_error(&transfer_err, LR_DOWNLOADER_ERROR, LRE_IO,
+                        "Cannot copy %s: %s", path, g_strerror(errno));
+            close(fd);
+            fatal_error = TRUE;
+            goto transfer_error;
+        }
+    }
+
+    // Leave the offset at the end of the file as a transfer does
+    lseek(fd, 0, SEEK_END);
+
+    target->f = fdopen(fd, linked ? "rb" : "w+b");
+    if (!target->f) {
+        g_set_error(&transfer_err, LR_DOWNLOADER_ERROR, LRE_IO,
+                    "fdopen(%d) failed: %s", fd, g_strerror(errno));
+        close(fd);
+        fatal_error = TRUE;
+        goto transfer_error;
+    }
+
+    target->writecb_recieved = (gint64) src_st.st_size;
+    dtarget->stats.total_time = (g_get_monotonic_time() - start) / 1000000.0;
+    if (dtarget->stats.total_time > 0.0)
+        dtarget->stats.speed_download = src_st.st_size
+                                        / dtarget->stats.total_time;
+
+    // The only (and final) tick of the progress
+    lr_progresscb(target, (double) src_st.st_size,
+                  (double) src_st.st_size, 0.0, 0.0);
+    if (target->cb_return_code != LR_CB_OK) {
+        g_set_error(&transfer_err, LR_DOWNLOADER_ERROR, LRE_CBINTERRUPTED,
+                    "Interrupted by the progress callback");
+        fatal_error = TRUE;
+        goto transfer_error;
+    }
+
+    close(src_fd);
+    mark_mirror_tried(target, target->mirror);
+
+    if (dtarget->checksums) {
+        // Checksums are calculated by the verifier as for a transfer
+        start_verification(dd, target, fileno(target->f), FALSE, full_url);
+        return TRUE;
+    }
+
+    close_transfer_file(target);
+    return finish_transfer(dd, target, NULL, FALSE, FALSE, full_url, err);
+
+transfer_error:
+    if (src_fd != -1)
+        close(src_fd);
+    mark_mirror_tried(target, target->mirror);
+    if (target->f)
+        close_transfer_file(target);
+
+    if (!fatal_error && dtarget->fn) {
+        // The target is truncated before the next try, it has to exist
+        // and it mustn't be a hardlink of a file of the repository
+        unlink(fn);
+        fd = open(fn, O_CREAT|O_WRONLY, 0666);
+        if (fd != -1)
+            close(fd);
+    }
+
+    count_transfer_error(dd, transfer_err);
+    return finish_transfer(dd, target, transfer_err, fatal_error, FALSE,
+                           full_url, err);
+}
+
+/** Evaluate the verifications finished by the verifier.
+ */
+static gboolean
+check_verified_targets(LrDownload *dd, GError **err)
+{
+    LrVerification *verification;
+
+    assert(!err || *err == NULL);
+
+    while ((verification = g_async_queue_try_pop(dd->verified))) {
+        LrTarget *target = verification->target;
+        GError *transfer_err = NULL;
+        gboolean fatal_error = FALSE;
+        gboolean ret;
+
+        assert(target->state == LR_DS_VERIFYING);
+        dd->verifying_transfers--;
+
+        if (target->handle)
+            lr_trace_async_span(target->handle->trace, "download", "verify",
+                                verification->start, verification->end,
+                                "path", target->target->path,
+                                "matches", verification->matches ? "1" : "0",
+                                "error", verification->err ?
+                                         verification->err->message : NULL,
+                                NULL);
+
+        if (!verification->ret) {
+            // The target is reported as unfinished by lr_download_cleanup()
+            if (verification->assembled)
+                g_propagate_prefixed_error(err, verification->err,
+                        "Download of %s by parts was successful but error "
+                        "encountered while checksuming: ",
+                        target->target->path);
+            else
+                g_propagate_prefixed_error(err, verification->err,
+                        "Downloading from %s was successful but error "
+                        "encountered while checksuming: ",
+                        verification->effective_url);
+            verification->err = NULL;
+            free_verification(verification);
+            return FALSE;
+        }
+
+        if (!verification->matches && verification->bad_pieces
+            && verification->bad_pieces->len > 0)
+        {
+            // Download only the damaged pieces again
+            if (!verification->assembled) {
+                close_transfer_file(target);
+                if (target->mirror)
+                    lr_downloadtarget_set_usedmirror(target->target,
+                                                     target->mirror->mirror->url);
+                lr_downloadtarget_set_effectiveurl(target->target,
+                                                   verification->effective_url);
+            }
+            ret = repair_target_pieces(dd, target, verification->bad_pieces,
+                                       verification->assembled, err);
+            free_verification(verification);
+            if (!ret)
+                return FALSE;
+            continue;
+        }
+
+        if (verification->assembled) {
+            if (!verification->matches)
+                g_debug("%s: Checksum of %s downloaded by parts doesn't "
+                        "match", __func__, target->target->path);
+            ret = complete_assembled_target(dd, target,
+                                            !verification->matches, err);
+            free_verification(verification);
+            if (!ret)
+                return FALSE;
+            continue;
+        }
+
+        if (!verification->matches) {
+            // Checksum doesn't match
+            set_checksum_mismatch_error(target->target->checksums,
+                                        &transfer_err);
+        } else if (!load_target_data(target, &transfer_err)
+                   || !finish_decompression(target, &transfer_err)
+                   || !finish_target_outputs(target, &transfer_err)) {
+            fatal_error = TRUE;
+        }
+
+        close_transfer_file(target);
+
+        if (target->mirror && transfer_err)
+            update_mirror_connections(dd, target->mirror, NULL);
+        count_transfer_error(dd, transfer_err);
+
+        ret = finish_transfer(dd, target, transfer_err, fatal_error, FALSE,
+                              verification->effective_url, err);
+        free_verification(verification);
+        if (!ret)
+            return FALSE;
+    }
+
+    return TRUE;
+}
+
+/** Write the span of the finished transfer of the target to the trace
+ * of its handle (see LRO_TRACEFILE).
+ */
+static void
+trace_transfer(LrTarget *target,
+               const char *effective_url,
+               const GError *transfer_err)
+{
+    if (!target->handle || !target->handle->trace)
+        return;
+
+    const char *kind = "transfer";
+    if (target->parent)
+        kind = "segment";
+    else if (target->hedged)
+        kind = "hedge";
+
+    gchar bytes[32];
+    g_snprintf(bytes, sizeof(bytes), "%" G_GINT64_FORMAT,
+               target->writecb_recieved);
+
+    lr_trace_async_span(target->handle->trace, "download", kind,
+                        target->transfer_start, g_get_monotonic_time(),
+                        "path", target->target->path,
+                        "mirror", target->mirror ?
+                                  target->mirror->mirror->url : NULL,
+                        "url", effective_url,
+                        "bytes", bytes,
+                        "error", transfer_err ? transfer_err->message : NULL,
+                        NULL);
+}
+
+/** Return TRUE if the transfer failed because of its proxy: the proxy
+ * couldn't be resolved or connected or the handshake with it failed.
+ */
+static gboolean
+proxy_failed(CURLMsg *msg)
+{
+    gdouble pretransfer_time = 0.0;
+
+    switch (msg->data.result) {
+    case CURLE_COULDNT_RESOLVE_PROXY:
+    case CURLE_COULDNT_CONNECT:  // The connection goes to the proxy
+#if LR_CURL_VERSION_CHECK(7, 73, 0)
+    case CURLE_PROXY:
+#endif
+        return TRUE;
+
+    case CURLE_OPERATION_TIMEDOUT:
+        // Timed out before the request could be sent
+        curl_easy_getinfo(msg->easy_handle, CURLINFO_PRETRANSFER_TIME,
+                          &pretransfer_time);
+        return pretransfer_time <= 0.0;
+
+    default:
+        return FALSE;
+    }
+}
+
+/** Return the proxy of the finished transfer to its pool with
+ * the outcome of the transfer.
+ * @return          TRUE if the transfer failed because of the proxy
+ */
+static gboolean
+release_transfer_proxy(LrTarget *target,
+                       CURLMsg *msg,
+                       const GError *transfer_err)
+{
+    LrTransfer *transfer = target->transfer;
+    LrProxyOutcome outcome = LR_PROXYPOOL_NEUTRAL;
+    long code = 0;
+
+    if (!transfer->proxy)
+        return FALSE;
+
+    curl_easy_getinfo(msg->easy_handle, CURLINFO_RESPONSE_CODE, &code);
+
+    if (transfer_err && proxy_failed(msg))
+        outcome = LR_PROXYPOOL_FAILURE;
+    else if (msg->data.result == CURLE_OK || code > 0)
+        outcome = LR_PROXYPOOL_SUCCESS;
+
+    lr_proxypool_release(transfer->proxypool, transfer->proxy, outcome,
+                         transfer_err ? transfer_err->message : NULL,
+                         g_get_monotonic_time());
+    transfer->proxy = NULL;
+
+    return outcome == LR_PROXYPOOL_FAILURE;
+}
+
+static gboolean
+check_transfer_statuses(LrDownload *dd, GError **err)
+{
+    assert(dd);
+    assert(!err || *err == NULL);
+
+    int msgs_in_queue;
+    CURLMsg *msg;
+
+    // Transfers paused by the limiter could continue if the bucket
+    // was refilled meanwhile
+    resume_paused_transfers(dd);
+
+    if (!report_progress(dd, err) || !report_metrics(dd, err))
+        return FALSE;
+
+    while ((msg = curl_multi_info_read(dd->multi_handle, &msgs_in_queue))) {
+        LrTarget *target = NULL;
+        char *effective_url = NULL;
+        int fd;
+        gboolean matches = TRUE;
+        GError *transfer_err = NULL;
+        gboolean ret;
+        gboolean fatal_error = FALSE;
+        gboolean resume = FALSE;
+
+        if (msg->msg != CURLMSG_DONE) {
+            // We are only interested in messages about finished transfers
+            continue;
+        }
+
+        // The target of this curl easy handle (see prepare_next_transfer)
+        curl_easy_getinfo(msg->easy_handle, CURLINFO_PRIVATE,
+                          (char **) &target);
+
+        assert(target);  // Each easy handle used in the multi handle
+                         // should always belong to some target from
+                         // the running_transfers list
+        assert(target->curl_handle == msg->easy_handle);
+
+        curl_easy_getinfo(msg->easy_handle,
+                          CURLINFO_EFFECTIVE_URL,
+                          &effective_url);
+
+        effective_url = g_strdup(effective_url); // Make the effetive url
+                                                  // persistent to survive
+                                                  // the curl_easy_cleanup()
+
+        g_debug("%s: Transfer finished: %s (Effective url: %s)",
+                __func__, target->target->path, effective_url);
+
+        record_transfer_stats(target, msg->easy_handle);
+
+        if (target->hedge)
+            // The first finished request wins, the other one is cancelled
+            stop_hedge(dd, target);
+
+        //
+        // Check status of finished transfer
+        //
+        ret = check_finished_transfer_status(msg, target, &fatal_error,
+                                             &transfer_err, err);
+        if (!ret)  // Error
+            return FALSE;
+
+        trace_transfer(target, effective_url, transfer_err);
+
+        // A failed proxy of the pool is not a failure of the mirror,
+        // the target is tried again through another proxy
+        if (release_transfer_proxy(target, msg, transfer_err)
+            && !target->parent && !target->hedged
+            && lr_proxypool_available(target->transfer->proxypool,
+                                      g_get_monotonic_time())) {
+            fatal_error = FALSE;
+            target->proxy_retry = TRUE;
+        }
+
+        // A too slow transfer could continue from another mirror
+        if (transfer_err && dd->low_speed_resume
+            && msg->data.result == CURLE_OPERATION_TIMEDOUT
+            && can_resume_transfer(target))
+            resume = TRUE;
+
+        // A timed out transfer is a sign of congestion
+        if (transfer_err && msg->data.result == CURLE_OPERATION_TIMEDOUT
+            && transfer_err->code != LRE_DEADLINE)
+            update_autotune(dd, NULL, TRUE);
+
+        if (transfer_err)  // Transfer was unsuccessful
+            goto transfer_error;
+
+        if (target->mirror &&
+            dd->adaptivemirrorsorting == LR_ADAPTIVEMIRRORSORTING_THROUGHPUT)
+            update_mirror_speed(target->mirror, msg->easy_handle);
+
+        if (target->mirror)
+            update_mirror_connections(dd, target->mirror, msg->easy_handle);
+
+        // The keep-alive connection could be used by the next transfer
+        release_idle_connection(dd, target->mirror);
+
+        update_autotune(dd, msg->easy_handle, FALSE);
+
+#if LR_CURL_VERSION_CHECK(7, 50, 0)
+        // Check if the mirror negotiated a multiplexing capable protocol
+        if (dd->http2 && target->mirror && !target->mirror->multiplexed) {
+            long http_version = CURL_HTTP_VERSION_NONE;
+            curl_easy_getinfo(msg->easy_handle, CURLINFO_HTTP_VERSION,
+                              &http_version);
+            if (http_version == CURL_HTTP_VERSION_2_0) {
+                g_debug("%s: Mirror %s supports HTTP/2 multiplexing",
+                        __func__, target->mirror->mirror->url);
+                target->mirror->multiplexed = TRUE;
+            }
+        }
+#endif
+
+        if (is_range_transfer(target))  // Checksum of a file downloaded
+            goto transfer_error;        // by parts is checked at the end
+
+        if (target->notmodified)        // Nothing was downloaded, the local
+            goto transfer_error;        // copy of the target is valid
+
+        //
+        // Write out rest of the data
+        //
+        if (target->transfer->writebuf) {
+            if (!flush_write_buffer(target, &transfer_err)) {
+                fatal_error = TRUE;
+                goto transfer_error;
+            }
+            // Set the offset as if the data were written through the f
+            lseek(fileno(target->f), (off_t) target->transfer->write_offset, SEEK_SET);
+        }
+
+        //
+        // Checksum checking
+        //
+        finish_transfer_pieces(target);
+        fflush(target->f);
+        fd = fileno(target->f);
+        if (check_streamed_checksums(target, fd, &matches)) {
+            // Checksums calculated during the transfer were used
+            g_debug("%s: Checksum calculated during the transfer %s",
+                    __func__, matches ? "is OK" : "doesn't match");
+        } else if (target->target->checksums) {
+            // Checksums have to be calculated from the file. Do not block
+            // the other transfers by it, the slot is freed right now and
+            // the target is finished by check_verified_targets().
+            remove_transfer(dd, target);
+            start_verification(dd, target, fd, FALSE, effective_url);
+            lr_free(effective_url);
+            continue;
+        }
+
+        // Damaged pieces of a file which doesn't match (or which can be
+        // verified only by its pieces) are downloaded again
+        if ((!matches || !target->target->checksums)
+            && target->bad_pieces && target->bad_pieces->len > 0
+            && pieces_repairable(target))
+        {
+            remove_transfer(dd, target);
+            close_transfer_file(target);
+            if (target->mirror)
+                lr_downloadtarget_set_usedmirror(target->target,
+                                                 target->mirror->mirror->url);
+            lr_downloadtarget_set_effectiveurl(target->target, effective_url);
+            ret = repair_target_pieces(dd, target, target->bad_pieces,
+                                       FALSE, err);
+            lr_free(effective_url);
+            if (!ret)
+                return FALSE;
+            continue;
+        }
+
+        if (!matches) {  // Checksum doesn't match
+            set_checksum_mismatch_error(target->target->checksums,
+                                        &transfer_err);
+            goto transfer_error;
+        }
+
+        //
+        // Copy data of a target downloaded into memory
+        //
+        if (!load_target_data(target, &transfer_err)) {
+            fatal_error = TRUE;
+            goto transfer_error;
+        }
+
+        //
+        // Decompression
+        //
+        if (!finish_decompression(target, &transfer_err)) {
+            fatal_error = TRUE;
+            goto transfer_error;
+        }
+
+        //
+        // Additional outputs
+        //
+        if (!finish_target_outputs(target, &transfer_err)) {
+            fatal_error = TRUE;
+            goto transfer_error;
+        }
+
+        //
+        // Any other checks should go here
+        //
+
+transfer_error:
+
+        //
+        // Cleanup
+        //
+        remove_transfer(dd, target);
+        if (resume && target->transfer->writebuf && !flush_write_buffer(target, NULL))
+            resume = FALSE;
+        if (resume)
+            // The next transfer continues from the checksum states
+            save_transfer_journal(target);
+        if (target->range_batch
+            && !finish_range_batch(dd, target, effective_url,
+                                   &transfer_err, err)) {
+            g_clear_error(&transfer_err);
+            close_transfer_file(target);
+            lr_free(effective_url);
+            return FALSE;
+        }
+        close_transfer_file(target);
+
+        if (target->mirror && transfer_err)
+            update_mirror_connections(dd, target->mirror, NULL);
+        count_transfer_error(dd, transfer_err);
+
+        if (target->parent) {
+            ret = check_finished_segment(dd, target, transfer_err,
+                                         fatal_error, effective_url, err);
+            lr_free(effective_url);
+            if (!ret)
+                return FALSE;
+            continue;
+        }
+
+        if (target->hedged) {
+            ret = check_finished_hedge(dd, target, transfer_err,
+                                       effective_url, err);
+            lr_free(effective_url);
+            if (!ret)
+                return FALSE;
+            continue;
+        }
+
+        ret = finish_transfer(dd, target, transfer_err, fatal_error, resume,
+                              effective_url, err);
+        lr_free(effective_url);
+        if (!ret)
+            return FALSE;
+    }
+
+    // Files verified meanwhile (or right now if there is no verifier)
+    if (!check_verified_targets(dd, err))
+        return FALSE;
+
+    // End callbacks returned meanwhile free the queue for new transfers
+    if (!check_returned_endcbs(dd, err))
+        return FALSE;
+
+    // At this point, after handles of finished transfers were removed
+    // from the multi_handle, we could add new waiting transfers.
+    return prepare_next_transfers(dd, err);
+}
+
+static gboolean
+lr_perform_select(LrDownload *dd, GError **err)
+{
+    CURLMcode cm_rc;    // CurlM_ReturnCode
+    int still_running;
+
+    assert(dd);
+    assert(!err || *err == NULL);
+
+    do { // Before version 7.20.0 CURLM_CALL_MULTI_PERFORM can appear
+        cm_rc = curl_multi_perform(dd->multi_handle, &still_running);
+    } while (cm_rc == CURLM_CALL_MULTI_PERFORM);
+
+    if (cm_rc != CURLM_OK) {
+        g_set_error(err, LR_DOWNLOADER_ERROR, LRE_CURLM,
+                    "curl_multi_perform() error: %s",
+                    curl_multi_strerror(cm_rc));
+        return FALSE;
+    }
+
+    if (download_interrupted(dd, err)) {
+        // Check interrupt after each call of curl_multi_perform
+        return FALSE;
+    }
+
+    while (dd->running_transfers->len || dd->verifying_transfers
+           || dd->endcb_calls || dd->breaker_wakeup) {
+        int rc;
+        int maxfd = -1;
+        long curl_timeout = -1;
+        struct timeval timeout;
+        fd_set fdread, fdwrite, fdexcep;
+
+        LR_PROBE2(perform__loop, dd->running_transfers->len,
+                  dd->verifying_transfers);
+
+        FD_ZERO(&fdread);
+        FD_ZERO(&fdwrite);
+        FD_ZERO(&fdexcep);
+
+        // Set suitable timeout to play around with
+        timeout.tv_sec  = 1;
+        timeout.tv_usec = 0;
+
+        cm_rc = curl_multi_timeout(dd->multi_handle, &curl_timeout);
+        if (cm_rc != CURLM_OK) {
+            g_set_error(err, LR_DOWNLOADER_ERROR, LRE_CURLM,
+                        "curl_multi_timeout() error: %s",
+                        curl_multi_strerror(cm_rc));
+            return FALSE;
+        }
+
+        if (curl_timeout >= 0) {
+            timeout.tv_sec = curl_timeout / 1000;
+            if (timeout.tv_sec > 1)
+                timeout.tv_sec = 1;
+            else
+                timeout.tv_usec = (curl_timeout % 1000) * 1000;
+        }
+
+        if (dd->limiter.paused_transfers &&
+            (timeout.tv_sec > 0
+             || timeout.tv_usec > LR_BANDWIDTH_TICK_MS * 1000))
+        {
+            // Paused transfers have to be resumed in time
+            timeout.tv_sec = 0;
+            timeout.tv_usec = LR_BANDWIDTH_TICK_MS * 1000;
+        }
+
+        if ((dd->verifying_transfers || dd->endcb_calls) &&
+            (timeout.tv_sec > 0
+             || timeout.tv_usec > LR_VERIFICATION_TICK_MS * 1000))
+        {
+            // Finished verifications (and returned end callbacks)
+            // have to be picked up in time
+            timeout.tv_sec = 0;
+            timeout.tv_usec = LR_VERIFICATION_TICK_MS * 1000;
+        }
+
+        // Targets waiting for a circuit breaker have to be started in time
+        long timeout_ms = timeout.tv_sec * 1000 + timeout.tv_usec / 1000;
+        long breaker_ms = breaker_wait_ms(dd, timeout_ms);
+        if (breaker_ms < timeout_ms) {
+            timeout.tv_sec = breaker_ms / 1000;
+            timeout.tv_usec = (breaker_ms % 1000) * 1000;
+        }
+
+        // Get file descriptors from the transfers
+        cm_rc = curl_multi_fdset(dd->multi_handle, &fdread, &fdwrite,
+                                 &fdexcep, &maxfd);
+        if (cm_rc != CURLM_OK) {
+            g_set_error(err, LR_DOWNLOADER_ERROR, LRE_CURLM,
+                        "curl_multi_fdset() error: %s",
+                        curl_multi_strerror(cm_rc));
+            return FALSE;
+        }
+
+        rc = select(maxfd+1, &fdread, &fdwrite, &fdexcep, &timeout);
+        if (rc < 0) {
+            if (errno == EINTR) {
+                g_debug("%s: select() interrupted by signal", __func__);
+                //goto retry;
+            } else {
+                g_set_error(err, LR_DOWNLOADER_ERROR, LRE_SELECT,
+                            "select() error: %s", strerror(errno));
+                return FALSE;
+            }
+        }
+
+        // This do-while loop is important. Because if curl_multi_perform sets
+        // still_running to 0, we need to check if there are any next
+        // transfers available (we need to call check_transfer_statuses).
+        // Because if there will be no next transfers available and the
+        // curl multi handle is empty (all transfers already
+        // finished - this is what still_running == 0 means),
+        // then the next iteration of main downloding loop cause a 1sec
+        // waiting on the select() call.
+        // Pick up finished asynchronous writes
+        lr_asyncio_reap(dd->aio);
+
+        do {
+            // Check if any handle finished and potentialy add one or more
+            // waiting downloads to the multi_handle.
+            rc = check_transfer_statuses(dd, err);
+            if (!rc)
+                return FALSE;
+
+            if (download_interrupted(dd, err)) {
+                return FALSE;
+            }
+
+            // Do curl_multi_perform()
+            do { // Before version 7.20.0 CURLM_CALL_MULTI_PERFORM can appear
+                cm_rc = curl_multi_perform(dd->multi_handle, &still_running);
+                if (download_interrupted(dd, err)) {
+                    // Check interrupt after each call of curl_multi_perform
+                    return FALSE;
+                }
+            } while (cm_rc == CURLM_CALL_MULTI_PERFORM);
+
+            if (cm_rc != CURLM_OK) {
+                g_set_error(err, LR_DOWNLOADER_ERROR, LRE_CURLM,
+                            "curl_multi_perform() error: %s",
+                            curl_multi_strerror(cm_rc));
+                return FALSE;
+            }
+        } while (still_running == 0 && dd->running_transfers->len);
+    }
+
+    return check_transfer_statuses(dd, err);
+}
+
+#ifdef LR_SOCKET_ENGINE
+
+/** State of the event driven (curl_multi_socket_action) download loop.
+ */
+typedef struct {
+    CURLM *multi_handle; /*!<
+        Curl Multi handle */
+    gint64 timer_expires; /*!<
+        Monotonic time (in us) when curl wants to be called back on
+        timeout, as requested via CURLMOPT_TIMERFUNCTION. -1 means that
+        curl doesn't need to be called back on timeout. */
+#ifdef LR_USE_EPOLL
+    gboolean use_epoll; /*!<
+        If FALSE, the sockets are watched by poll() instead of epoll
+        (forced by LIBREPO_DEBUG_POLLLOOP) */
+    int epoll_fd; /*!<
+        epoll instance with all sockets currently watched by curl */
+#endif
+    GArray *pollfds; /*!<
+        Array of struct pollfd with all sockets currently watched by curl
+        (without epoll) */
+} LrSocketLoop;
+
+#ifdef LR_USE_EPOLL
+#define LR_SOCKET_LOOP_MAX_EVENTS   64
+#endif
+
+#ifdef LR_USE_EPOLL
+/** Watch the socket for curl by epoll (see lr_socketcb()).
+ */
+static int
+lr_socketcb_epoll(LrSocketLoop *loop,
+                  curl_socket_t s,
+                  int what,
+                  void *socketp)
+{
+    struct epoll_event ev;
+
+    if (what == CURL_POLL_REMOVE) {
+        // Socket could be already closed here, ignore ENOENT/EBADF
+        epoll_ctl(loop->epoll_fd, EPOLL_CTL_DEL, s, NULL);
+        return 0;
+    }
+
+    memset(&ev, 0, sizeof(ev));
+    ev.data.fd = s;
+    if (what & CURL_POLL_IN)
+        ev.events |= EPOLLIN;
+    if (what & CURL_POLL_OUT)
+        ev.events |= EPOLLOUT;
+
+    if (socketp) {
+        // Socket is already watched, just update the events
+        if (epoll_ctl(loop->epoll_fd, EPOLL_CTL_MOD, s, &ev) == 0)
+            return 0;
+        if (errno != ENOENT) {
+            g_debug("%s: epoll_ctl(EPOLL_CTL_MOD) error: %s",
+                    __func__, strerror(errno));
+            return -1;
+        }
+        // Curl reused the socket number, add it again
+    }
+
+    if (epoll_ctl(loop->epoll_fd, EPOLL_CTL_ADD, s, &ev) != 0) {
+        g_debug("%s: epoll_ctl(EPOLL_CTL_ADD) error: %s",
+                __func__, strerror(errno));
+        return -1;
+    }
+
+    // Mark the socket as watched
+    curl_multi_assign(loop->multi_handle, s, loop);
+    return 0;
+}
+#endif
+
+/** Curl socket callback (CURLMOPT_SOCKETFUNCTION).
+ * Curl tells us which socket it wants to be watched and for what events.
+ */
+static int
+lr_socketcb(G_GNUC_UNUSED CURL *easy,
+            curl_socket_t s,
+            int what,
+            void *userp,
+            void *socketp)
+{
+    LrSocketLoop *loop = userp;
+    guint x;
+    struct pollfd *pfd = NULL;
+
+#ifdef LR_USE_EPOLL
+    if (loop->use_epoll)
+        return lr_socketcb_epoll(loop, s, what, socketp);
+#else
+    (void) socketp;
+#endif
+
+    for (x = 0; x < loop->pollfds->len; x++) {
+        struct pollfd *cur = &g_array_index(loop->pollfds, struct pollfd, x);
+        if (cur->fd == s) {
+            pfd = cur;
+            break;
+        }
+    }
+
+    if (what == CURL_POLL_REMOVE) {
+        if (pfd)
+            g_array_remove_index_fast(loop->pollfds, x);
+        return 0;
+    }
+
+    if (!pfd) {
+        struct pollfd new_pfd;
+        memset(&new_pfd, 0, sizeof(new_pfd));
+        new_pfd.fd = s;
+        g_array_append_val(loop->pollfds, new_pfd);
+        pfd = &g_array_index(loop->pollfds, struct pollfd,
+                             loop->pollfds->len - 1);
+    }
+
+    pfd->events = 0;
+    if (what & CURL_POLL_IN)
+        pfd->events |= POLLIN;
+    if (what & CURL_POLL_OUT)
+        pfd->events |= POLLOUT;
+
+    return 0;
+}
+
+/** Curl timer callback (CURLMOPT_TIMERFUNCTION).
+ * Curl tells us when it wants to be called back with CURL_SOCKET_TIMEOUT.
+ */
+static int
+lr_timercb(G_GNUC_UNUSED CURLM *multi, long timeout_ms, void *userp)
+{
+    LrSocketLoop *loop = userp;
+    loop->timer_expires = timeout_ms < 0 ? -1
+                          : g_get_monotonic_time() + timeout_ms * 1000;
+    return 0;
+}
+
+/** Return TRUE if the timer requested by curl has expired.
+ */
+static gboolean
+lr_timer_expired(LrSocketLoop *loop)
+{
+    return loop->timer_expires >= 0
+           && g_get_monotonic_time() >= loop->timer_expires;
+}
+
+/** Return the time (in ms) left until the timer requested by curl
+ * expires, but at most max_ms.
+ */
+static int
+lr_timer_wait_ms(LrSocketLoop *loop, int max_ms)
+{
+    gint64 left_us;
+
+    if (loop->timer_expires < 0)
+        return max_ms;
+    left_us = loop->timer_expires - g_get_monotonic_time();
+    if (left_us <= 0)
+        return 0;
+    // Round up, not to wake up just before the expiration
+    return (int) MIN((left_us + 999) / 1000, (gint64) max_ms);
+}
+
+/** Call curl_multi_socket_action() for the socket.
+ */
+static gboolean
+lr_socket_action(LrSocketLoop *loop,
+                 curl_socket_t s,
+                 int ev_bitmask,
+                 GError **err)
+{
+    CURLMcode cm_rc;
+    int still_running;
+
+    do { // Before version 7.20.0 CURLM_CALL_MULTI_PERFORM can appear
+        cm_rc = curl_multi_socket_action(loop->multi_handle, s,
+                                         ev_bitmask, &still_running);
+    } while (cm_rc == CURLM_CALL_MULTI_PERFORM);
+
+    if (cm_rc != CURLM_OK) {
+        g_set_error(err, LR_DOWNLOADER_ERROR, LRE_CURLM,
+                    "curl_multi_socket_action() error: %s",
+                    curl_multi_strerror(cm_rc));
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+/** Event driven variant of the main download loop.
+ * Instead of rebuilding fd_sets and doing select() in every iteration
+ * (which is limited by FD_SETSIZE and costs O(maxfd)), only sockets
+ * reported by curl via CURLMOPT_SOCKETFUNCTION are watched
+ * by epoll (or poll() on systems without epoll, or if forced by
+ * LIBREPO_DEBUG_POLLLOOP) and the loop sleeps exactly as long as curl
+ * requested via CURLMOPT_TIMERFUNCTION.
+ */
+static gboolean
+lr_perform_socket(LrDownload *dd, GError **err)
+{
+    gboolean ret = FALSE;
+    LrSocketLoop loop;
+
+    assert(dd);
+    assert(!err || *err == NULL);
+
+    loop.multi_handle = dd->multi_handle;
+    // Handles were already added - start immediately
+    loop.timer_expires = g_get_monotonic_time();
+#ifdef LR_USE_EPOLL
+    loop.use_epoll = !g_getenv("LIBREPO_DEBUG_POLLLOOP");
+    loop.epoll_fd = -1;
+    if (loop.use_epoll) {
+        loop.epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+        if (loop.epoll_fd == -1) {
+            g_set_error(err, LR_DOWNLOADER_ERROR, LRE_SELECT,
+                        "epoll_create1() error: %s", strerror(errno));
+            return FALSE;
+        }
+    }
+#endif
+    loop.pollfds = g_array_new(FALSE, FALSE, sizeof(struct pollfd));
+
+    curl_multi_setopt(dd->multi_handle, CURLMOPT_SOCKETFUNCTION, lr_socketcb);
+    curl_multi_setopt(dd->multi_handle, CURLMOPT_SOCKETDATA, &loop);
+    curl_multi_setopt(dd->multi_handle, CURLMOPT_TIMERFUNCTION, lr_timercb);
+    curl_multi_setopt(dd->multi_handle, CURLMOPT_TIMERDATA, &loop);
+
+    while (dd->running_transfers->len || dd->verifying_transfers
+           || dd->endcb_calls || dd->breaker_wakeup) {
+        int rc;
+        int wait_ms;
+        gboolean use_epoll = FALSE;
+
+        LR_PROBE2(perform__loop, dd->running_transfers->len,
+                  dd->verifying_transfers);
+
+        // Never sleep longer than 1s, to keep progress callbacks and
+        // interrupt checks at least as responsive as before
+        wait_ms = lr_timer_wait_ms(&loop, 1000);
+
+        // Paused transfers have to be resumed in time
+        if (dd->limiter.paused_transfers && wait_ms > LR_BANDWIDTH_TICK_MS)
+            wait_ms = LR_BANDWIDTH_TICK_MS;
+
+        // Finished verifications (and returned end callbacks) have to be
+        // picked up in time
+        if ((dd->verifying_transfers || dd->endcb_calls)
+            && wait_ms > LR_VERIFICATION_TICK_MS)
+            wait_ms = LR_VERIFICATION_TICK_MS;
+
+        // Targets waiting for a circuit breaker have to be started in time
+        wait_ms = (int) breaker_wait_ms(dd, wait_ms);
+
+#ifdef LR_USE_EPOLL
+        struct epoll_event events[LR_SOCKET_LOOP_MAX_EVENTS];
+        use_epoll = loop.use_epoll;
+        if (use_epoll)
+            rc = epoll_wait(loop.epoll_fd, events,
+                            LR_SOCKET_LOOP_MAX_EVENTS, wait_ms);
+        else
+#endif
+            rc = poll((struct pollfd *) loop.pollfds->data,
+                      loop.pollfds->len, wait_ms);
+        if (rc < 0) {
+            if (errno == EINTR) {
+                g_debug("%s: Waiting for events interrupted by signal",
+                        __func__);
+                rc = 0;
+            } else {
+                g_set_error(err, LR_DOWNLOADER_ERROR, LRE_SELECT,
+                            "%s error: %s",
+                            use_epoll ? "epoll_wait()" : "poll()",
+                            strerror(errno));
+                goto lr_perform_socket_cleanup;
+            }
+        }
+
+        if (download_interrupted(dd, err)) {
+            goto lr_perform_socket_cleanup;
+        }
+
+        if (rc == 0) {
+            // Timeout (or no activity) - let curl handle its timers,
+            // if the wait wasn't just capped before they expire
+            if (lr_timer_expired(&loop)) {
+                loop.timer_expires = -1;
+                if (!lr_socket_action(&loop, CURL_SOCKET_TIMEOUT, 0, err))
+                    goto lr_perform_socket_cleanup;
+            }
+        } else if (use_epoll) {
+#ifdef LR_USE_EPOLL
+            for (int x = 0; x < rc; x++) {
+                int ev_bitmask = 0;
+                if (events[x].events & EPOLLIN)
+                    ev_bitmask |= CURL_CSELECT_IN;
+                if (events[x].events & EPOLLOUT)
+                    ev_bitmask |= CURL_CSELECT_OUT;
+                if (events[x].events & (EPOLLERR|EPOLLHUP))
+                    ev_bitmask |= CURL_CSELECT_ERR;
+                if (!lr_socket_action(&loop, events[x].data.fd,
+                                      ev_bitmask, err))
+                    goto lr_perform_socket_cleanup;
+            }
+#endif
+        } else {
+            // The callback may modify the array, work on its copy
+            guint len = loop.pollfds->len;
+            struct pollfd *pfds = g_memdup(loop.pollfds->data,
+                                           len * sizeof(struct pollfd));
+            for (guint x = 0; x < len; x++) {
+                int ev_bitmask = 0;
+                if (!pfds[x].revents)
+                    continue;
+                if (pfds[x].revents & POLLIN)
+                    ev_bitmask |= CURL_CSELECT_IN;
+                if (pfds[x].revents & POLLOUT)
+                    ev_bitmask |= CURL_CSELECT_OUT;
+                if (pfds[x].revents & (POLLERR|POLLHUP|POLLNVAL))
+                    ev_bitmask |= CURL_CSELECT_ERR;
+                if (!lr_socket_action(&loop, pfds[x].fd, ev_bitmask, err)) {
+                    g_free(pfds);
+                    goto lr_perform_socket_cleanup;
+                }
+            }
+            g_free(pfds);
+        }
+
+        // Curl could also want to handle its timers which have
+        // expired while we were processing the socket events
+        if (rc > 0 && lr_timer_expired(&loop)) {
+            loop.timer_expires = -1;
+            if (!lr_socket_action(&loop, CURL_SOCKET_TIMEOUT, 0, err))
+                goto lr_perform_socket_cleanup;
+        }
+
+        if (download_interrupted(dd, err)) {
+            goto lr_perform_socket_cleanup;
+        }
+
+        // Pick up finished asynchronous writes, so the buffers are free
+        // before the transfers need them again
+        lr_asyncio_reap(dd->aio);
+
+        // Check if any handle finished and potentialy add one or more
+        // waiting downloads to the multi_handle. Newly added handles
+        // set the curl timer to 0, so they are started in the next
+        // iteration without waiting.
+        if (!check_transfer_statuses(dd, err))
+            goto lr_perform_socket_cleanup;
+    }
+
+    ret = check_transfer_statuses(dd, err);
+
+lr_perform_socket_cleanup:
+
+    // Transfers which are still running (on error) are removed from
+    // the multi handle by the caller, callbacks cannot be called anymore
+    curl_multi_setopt(dd->multi_handle, CURLMOPT_SOCKETFUNCTION, NULL);
+    curl_multi_setopt(dd->multi_handle, CURLMOPT_SOCKETDATA, NULL);
+    curl_multi_setopt(dd->multi_handle, CURLMOPT_TIMERFUNCTION, NULL);
+    curl_multi_setopt(dd->multi_handle, CURLMOPT_TIMERDATA, NULL);
+
+#ifdef LR_USE_EPOLL
+    if (loop.epoll_fd != -1)
+        close(loop.epoll_fd);
+#endif
+    g_array_free(loop.pollfds, TRUE);
+
+    return ret;
+}
+
+#endif // LR_SOCKET_ENGINE
+
+static gboolean
+lr_perform(LrDownload *dd, GError **err)
+{
+#ifdef LR_SOCKET_ENGINE
+    // Old select() based loop could be forced for debugging purposes
+    if (!g_getenv("LIBREPO_DEBUG_SELECTLOOP"))
+        return lr_perform_socket(dd, err);
+#endif
+    return lr_perform_select(dd, err);
+}
+
+/** Keys of the file of the target in LrDownload.coalesced: its full URL
+ * and its checksums. Only targets which end up as a whole file without
+ * any side effect of the transfer are coalesced.
+ */
+static GSList *
+coalescing_keys(LrDownloadTarget *dtarget)
+{
+    GSList *keys = NULL;
+
+    if ((dtarget->fd < 0 && !dtarget->fn)   // Downloaded into memory
+        || dtarget->byterangestart > 0
+        || dtarget->byterangeend > 0
+        || dtarget->decompressfd >= 0
+        || dtarget->datacb
+        || dtarget->outputs
+        || dtarget->conditional
+        || dtarget->samemirror
+        || dtarget->deadline > 0.0)
+        return NULL;
+
+    if (dtarget->baseurl)
+        keys = g_slist_prepend(keys, g_strconcat("url:", dtarget->baseurl,
+                                                 "/", dtarget->path, NULL));
+    else if (strstr(dtarget->path, "://"))
+        keys = g_slist_prepend(keys, g_strconcat("url:", dtarget->path, NULL));
+    else  // Path relative to the mirrors of the handle
+        keys = g_slist_prepend(keys, g_strdup_printf("mirrors:%p:%s",
+                                                     (void *) dtarget->handle,
+                                                     dtarget->path));
+
+    for (GSList *elem = dtarget->checksums; elem; elem = g_slist_next(elem)) {
+        LrDownloadTargetChecksum *checksum = elem->data;
+        if (checksum->type == LR_CHECKSUM_UNKNOWN || !checksum->value)
+            continue;
+        _cleanup_free_ gchar *value = g_ascii_strdown(checksum->value, -1);
+        keys = g_slist_prepend(keys, g_strdup_printf("checksum:%s:%s",
+                                    lr_checksum_type_to_str(checksum->type),
+                                    value));
+    }
+
+    return keys;
+}
+
+/** Make the target a duplicate of an unfinished target of the same file
+ * (the same URL or checksum) if there is one.
+ * @return          TRUE if the target is a duplicate and mustn't be queued
+ */
+static gboolean
+coalesce_target(LrDownload *dd, LrTarget *target)
+{
+    GSList *keys = coalescing_keys(target->target);
+    LrTarget *original = NULL;
+
+    for (GSList *elem = keys; elem && !original; elem = g_slist_next(elem)) {
+        LrTarget *candidate = g_hash_table_lookup(dd->coalesced, elem->data);
+        if (candidate
+            && candidate->state != LR_DS_FINISHED
+            && candidate->state != LR_DS_FAILED)
+            original = candidate;
+    }
+
+    if (original) {
+        g_debug("%s: %s is downloaded only once for %s", __func__,
+                target->target->path, original->target->path);
+        target->original = original;
+        original->duplicates = g_slist_append(original->duplicates, target);
+        g_slist_free_full(keys, g_free);
+        return TRUE;
+    }
+
+    // The table owns the keys
+    for (GSList *elem = keys; elem; elem = g_slist_next(elem))
+        g_hash_table_replace(dd->coalesced, elem->data, target);
+    g_slist_free(keys);
+    return FALSE;
+}
+
+/** Add the target to the download data and queue it.
+ * A duplicate of another target is not queued (see coalesce_target()).
+ */
+static void
+lr_download_add_target(LrDownload *dd, LrDownloadTarget *dtarget)
+{
+    assert(dtarget);
+    assert(dtarget->path);
+    assert((dtarget->fd > 0 && !dtarget->fn) || dtarget->fd < 0);
+    g_debug("%s: Target: %s (%s)", __func__,
+            dtarget->path,
+            (dtarget->baseurl) ? dtarget->baseurl : "-");
+
+    LrTarget *target = lr_malloc0(sizeof(*target));
+    target->queue_seq       = dd->next_queue_seq++;
+    target->target          = dtarget;
+    target->original_offset = -1;
+    target->memfd           = -1;
+    if (dtarget->fn && dd->atomic_download)
+        target->partfn      = g_strconcat(dtarget->fn, ".part", NULL);
+    target->target->rcode   = LRE_UNFINISHED;
+    target->target->err     = "Not finished";
+    memset(&target->target->stats, 0, sizeof(target->target->stats));
+    target->handle          = dtarget->handle;
+    target->limiter         = (dd->max_speed) ? &dd->limiter : NULL;
+    target->progress_interval = dd->progress_interval;
+    if (dtarget->byterangestart <= 0 && dtarget->byterangeend <= 0)
+        for (GSList *elem = dtarget->outputs; elem; elem = g_slist_next(elem)) {
+            LrTargetOutput *out = lr_malloc0(sizeof(*out));
+            out->output = elem->data;
+            out->fd = -1;
+            target->outputs = g_slist_append(target->outputs, out);
+        }
+    g_ptr_array_add(dd->targets, target);
+    dd->live_targets++;
+    if (dtarget->deadline > 0.0)
+        dd->deadlines = TRUE;
+    if (g_atomic_int_get(&dtarget->cancelled))
+        dd->cancel_check = TRUE;
+    // Add list of handle internal mirrors to dd->handle_mirrors
+    // if doesn't exists yet and set the list reference
+    // to the target.
+    dd->handle_mirrors = lr_prepare_lrmirrors(dd->handle_mirrors, target,
+                                              dd->adaptivemirrorsorting,
+                                              dd->shard ? dd->shard->group
+                                                        : NULL);
+    if (!coalesce_target(dd, target))
+        queue_target(dd, target);
+}
+
+/** Free the target when the download doesn't need it anymore.
+ * The file of an unsuccessful target is removed if it didn't exist
+ * before or its original content was overwritten. A target pulled
+ * from the source of the download is released (see lr_download_stream()).
+ */
+static void
+free_target(LrDownload *dd, LrTarget *target)
+{
+    assert(target->curl_handle == NULL);
+    assert(target->f == NULL);
+
+    // Segments share the file with the whole target
+    if (target->state != LR_DS_FINISHED && !target->parent) {
+        if ((!target->target->resume || target->original_offset == 0)
+            && target->journal_offset == 0) {
+            // Remove target file if the file doesn't
+            // exist before or was empty or was overwritten
+            // (unless a resume journal was saved for it)
+            if (target->target->fn) {
+                // We can remove only files that were specified by fn
+                // (the fn itself is kept if its temporary file is used)
+                if (unlink(target_fn(target)) != 0) {
+                    g_debug("%s: Error while removing: %s",
+                            __func__, strerror(errno));
+                }
+            }
+        }
+    }
+
+    // Only a partial file needs its resume journal
+    if (target->state == LR_DS_FINISHED && !target->parent)
+        remove_target_journal(target);
+
+    if (target->hedge)
+        free_hedge(target->hedge);
+    if (!target->parent && target->memfd != -1)
+        close(target->memfd);
+    lr_free(target->tried_mirrors);
+    g_slist_free(target->segments);
+    g_slist_free(target->duplicates);
+    if (target->bad_pieces)
+        g_array_free(target->bad_pieces, TRUE);
+    free_target_outputs(target);
+    curl_slist_free_all(target->curl_headers);
+    g_free(target->etag);
+    g_free(target->partfn);
+    free_transfer(target);
+    if (dd->releasecb && !target->parent)
+        dd->releasecb(dd->sourcecb_data, target->target);
+    lr_free(target);
+}
+
+/** The target is finished or failed and nothing runs for it. */
+static gboolean
+target_done(LrTarget *target)
+{
+    return (target->state == LR_DS_FINISHED || target->state == LR_DS_FAILED)
+           && !target->curl_handle
+           && !target->f
+           && !target->queue_iter
+           && !target->endcb_queued;
+}
+
+/** The target is done together with its segments and duplicates,
+ * it could be released.
+ */
+static gboolean
+target_retirable(LrTarget *target)
+{
+    if (target->parent || target->original || target->hedge)
+        return FALSE;
+
+    if (!target_done(target))
+        return FALSE;
+
+    for (GSList *elem = target->segments; elem; elem = g_slist_next(elem))
+        if (!target_done(elem->data))
+            return FALSE;
+
+    for (GSList *elem = target->duplicates; elem; elem = g_slist_next(elem))
+        if (!target_done(elem->data))
+            return FALSE;
+
+    return TRUE;
+}
+
+/** Minimal number of targets of a streamed download
+ * before the done ones are released.
+ */
+#define LR_RETIRE_MIN_TARGETS           64
+
+/** Release the done targets of a streamed download (lr_download_stream()),
+ * so the download of a huge number of targets holds only a window of them.
+ * The list of targets is walked only when it has doubled since the last
+ * walk, so it costs O(1) per target.
+ */
+static gboolean
+retire_done_targets(LrDownload *dd, GError **err)
+{
+    GPtrArray *kept, *done;
+
+    assert(!err || *err == NULL);
+
+    if (dd->live_targets < dd->retire_at)
+        return TRUE;
+
+    kept = g_ptr_array_sized_new(dd->targets->len);
+    done = g_ptr_array_new();
+
+    for (guint x = 0; x < dd->targets->len; x++) {
+        LrTarget *target = g_ptr_array_index(dd->targets, x);
+        LrTarget *owner = target;
+
+        // Segments and duplicates go together with their target
+        if (target->parent)
+            owner = target->parent;
+        else if (target->original)
+            owner = target->original;
+
+        g_ptr_array_add(target_retirable(owner) ? done : kept, target);
+    }
+
+    if (dd->durability == LR_DURABILITY_BATCH
+        && !sync_finished_targets(done, err))
+    {
+        g_ptr_array_free(done, TRUE);
+        g_ptr_array_free(kept, TRUE);
+        return FALSE;
+    }
+
+    g_ptr_array_free(dd->targets, TRUE);
+    dd->targets = kept;
+
+    for (guint x = 0; x < done->len; x++) {
+        LrTarget *target = g_ptr_array_index(done, x);
+
+        if (!target->parent && !target->original) {
+            // Later targets of the same file are not its duplicates
+            GSList *keys = coalescing_keys(target->target);
+            for (GSList *el = keys; el; el = g_slist_next(el))
+                if (g_hash_table_lookup(dd->coalesced, el->data) == target)
+                    g_hash_table_remove(dd->coalesced, el->data);
+            g_slist_free_full(keys, g_free);
+        }
+
+        free_target(dd, target);
+        dd->live_targets--;
+    }
+
+    g_debug("%s: %u targets released, %u kept", __func__,
+            done->len, dd->live_targets);
+    g_ptr_array_free(done, TRUE);
+
+    dd->retire_at = MAX(2 * dd->live_targets, LR_RETIRE_MIN_TARGETS);
+    return TRUE;
+}
+
+/** Pull the next targets from the source of a streamed download
+ * (lr_download_stream()) until as many of them wait as transfers could
+ * run at once. Done targets are released first.
+ * @param pulled    Set to TRUE if a target was pulled
+ * @return          FALSE on error
+ */
+static gboolean
+pull_targets(LrDownload *dd, gboolean *pulled, GError **err)
+{
+    guint readahead = (guint) MAX(dd->max_parallel_connections, 1);
+
+    assert(!err || *err == NULL);
 
-            switch (msg->data.result) {
-            case CURLE_ABORTED_BY_CALLBACK:
-            case CURLE_BAD_FUNCTION_ARGUMENT:
-            case CURLE_CONV_REQD:
-            case CURLE_COULDNT_RESOLVE_PROXY:
-            case CURLE_FILESIZE_EXCEEDED:
-            case CURLE_INTERFACE_FAILED:
-#if LR_CURL_VERSION_CHECK(7, 21, 5)
-            case CURLE_NOT_BUILT_IN:
+    *pulled = FALSE;
+
+    if (!dd->sourcecb)
+        return TRUE;
+
+    if (!retire_done_targets(dd, err))
+        return FALSE;
+
+    while (g_sequence_get_length(dd->waiting_targets) < readahead) {
+        LrDownloadTarget *dtarget = dd->sourcecb(dd->sourcecb_data);
+        if (!dtarget) {
+            g_debug("%s: No more targets", __func__);
+            dd->sourcecb = NULL;
+            break;
+        }
+        lr_download_add_target(dd, dtarget);
+        *pulled = TRUE;
+    }
+
+    return TRUE;
+}
+
+/** Maximal number of operations submitted to the io_uring of a download
+ * (see LRO_IOURING), more writes wait for the completion of others. */
+#define LR_ASYNCIO_MAX_ENTRIES          4096
+
+/** Prepare download data and the queue of targets.
+ * On failure nothing is allocated and the download data must not
+ * be cleaned up.
+ */
+static gboolean
+lr_download_init(LrDownload *dd,
+                 GSList *targets,
+                 gboolean failfast,
+                 LrShard *shard,
+                 GError **err)
+{
+    assert(dd);
+    assert(targets);
+    assert(!err || *err == NULL);
+
+    // Downloader configuration is taken from the handle of the first
+    // target (see lr_download())
+    LrHandle *lr_handle = ((LrDownloadTarget *) targets->data)->handle;
+
+    // Prepare download data
+    dd->failfast = failfast;
+    dd->shard = shard;
+
+    if (lr_handle) {
+        dd->max_parallel_connections = lr_handle->maxparalleldownloads;
+        dd->max_connection_per_host = lr_handle->maxdownloadspermirror;
+        dd->adaptive_connections = lr_handle->adaptivedownloadspermirror;
+        dd->hedged_downloads = lr_handle->hedgeddownloads;
+        dd->critical_slots = lr_handle->criticalslots;
+        dd->low_speed_resume = lr_handle->lowspeedresume;
+        dd->max_mirrors_to_try = lr_handle->maxmirrortries;
+        dd->max_speed = lr_handle->maxspeed;
+        dd->allowed_mirror_failures = lr_handle->allowed_mirror_failures;
+        dd->mirror_breaker = lr_handle->mirrorbreaker;
+        dd->adaptivemirrorsorting = lr_handle->adaptivemirrorsorting;
+        dd->http2 = lr_handle->http2;
+        dd->max_streams_per_mirror = lr_handle->maxstreamspermirror;
+        dd->max_segments = lr_handle->maxsegments;
+        dd->min_segment_size = lr_handle->minsegmentsize;
+        dd->max_ranges_per_request = lr_handle->maxrangesperrequest;
+        dd->connection_affinity = lr_handle->connectionaffinity;
+        dd->write_buffer_size = lr_handle->writebuffersize;
+        dd->preallocate = lr_handle->preallocate;
+        dd->early_writeback = lr_handle->earlywriteback;
+        dd->iouring = lr_handle->iouring;
+        dd->local_hardlink = lr_handle->localhardlink;
+        dd->durability = lr_handle->durability;
+        dd->atomic_download = lr_handle->atomicdownload;
+        dd->download_order = lr_handle->downloadorder;
+        dd->progress_interval = (gint64) lr_handle->progressinterval * 1000;
+        dd->multi_progresscb = lr_handle->multiprogresscb;
+        dd->multi_progresscb_data = lr_handle->user_data;
+        dd->metrics_interval = (gint64) lr_handle->metricsinterval * 1000;
+        dd->metricscb = lr_handle->metricscb;
+        dd->metricscb_data = lr_handle->user_data;
+    } else {
+        // No handle, this is allowed when a complete URL is passed
+        // via relative_url param.
+        dd->max_parallel_connections = LRO_MAXPARALLELDOWNLOADS_DEFAULT;
+        dd->max_connection_per_host = LRO_MAXDOWNLOADSPERMIRROR_DEFAULT;
+        dd->adaptive_connections = LRO_ADAPTIVEDOWNLOADSPERMIRROR_DEFAULT;
+        dd->hedged_downloads = LRO_HEDGEDDOWNLOADS_DEFAULT;
+        dd->critical_slots = LRO_CRITICALSLOTS_DEFAULT;
+        dd->low_speed_resume = LRO_LOWSPEEDRESUME_DEFAULT;
+        dd->max_mirrors_to_try = LRO_MAXMIRRORTRIES_DEFAULT;
+        dd->max_speed = LRO_MAXSPEED_DEFAULT;
+        dd->allowed_mirror_failures = LRO_ALLOWEDMIRRORFAILURES_DEFAULT;
+        dd->mirror_breaker = LRO_MIRRORBREAKER_DEFAULT;
+        dd->adaptivemirrorsorting = LRO_ADAPTIVEMIRRORSORTING_DEFAULT;
+        dd->http2 = LRO_HTTP2_DEFAULT;
+        dd->max_streams_per_mirror = LRO_MAXSTREAMSPERMIRROR_DEFAULT;
+        dd->max_segments = LRO_MAXSEGMENTS_DEFAULT;
+        dd->min_segment_size = LRO_MINSEGMENTSIZE_DEFAULT;
+        dd->max_ranges_per_request = LRO_MAXRANGESPERREQUEST_DEFAULT;
+        dd->connection_affinity = LRO_CONNECTIONAFFINITY_DEFAULT;
+        dd->write_buffer_size = LRO_WRITEBUFFERSIZE_DEFAULT;
+        dd->preallocate = LRO_PREALLOCATE_DEFAULT;
+        dd->early_writeback = LRO_EARLYWRITEBACK_DEFAULT;
+        dd->iouring = LRO_IOURING_DEFAULT;
+        dd->local_hardlink = LRO_LOCALHARDLINK_DEFAULT;
+        dd->durability = LRO_DURABILITY_DEFAULT;
+        dd->atomic_download = LRO_ATOMICDOWNLOAD_DEFAULT;
+        dd->download_order = LRO_DOWNLOADORDER_DEFAULT;
+        dd->progress_interval = (gint64) LRO_PROGRESSINTERVAL_DEFAULT * 1000;
+        dd->multi_progresscb = NULL;
+        dd->multi_progresscb_data = NULL;
+        dd->metrics_interval = (gint64) LRO_METRICSINTERVAL_DEFAULT * 1000;
+        dd->metricscb = NULL;
+        dd->metricscb_data = NULL;
+    }
+
+    // Every shard gets its part of the parallel connections
+    if (shard) {
+        LrShardGroup *group = shard->group;
+        dd->max_parallel_connections =
+                group->max_parallel_connections / (int) group->shards
+                + (shard->index < group->max_parallel_connections
+                                  % group->shards ? 1 : 0);
+    }
+
+    // The tuning continues from the number chosen by the previous download
+    dd->autotune.enabled = FALSE;
+    if (lr_handle && lr_handle->autotuneparalleldownloads && !shard
+        && dd->max_parallel_connections > 1)
+        start_autotune(dd, lr_handle->autotuned_downloads);
+
+    dd->last_multi_progress = 0;
+    memset(dd->transfer_errors, 0, sizeof(dd->transfer_errors));
+
+    dd->multi_handle = curl_multi_init();
+    if (!dd->multi_handle) {
+        // Something went wrong
+        g_set_error(err, LR_DOWNLOADER_ERROR, LRE_CURLM,
+                    "curl_multi_init() call failed");
+        return FALSE;
+    }
+
+    // Prepare verifier of checksums of downloaded files
+    GError *tmp_err = NULL;
+    guint verifier_threads = (lr_handle) ? (guint) lr_handle->checksumthreads
+                                         : LRO_CHECKSUMTHREADS_DEFAULT;
+    if (verifier_threads == 0)
+        verifier_threads = g_get_num_processors();
+    dd->verified = g_async_queue_new();
+    dd->verifying_transfers = 0;
+    dd->verifier = g_thread_pool_new(verify_downloaded_file, dd->verified,
+                                     (gint) verifier_threads, FALSE, &tmp_err);
+    if (!dd->verifier) {
+        g_debug("%s: Cannot create verifier threads, files will be "
+                "verified by the download loop: %s", __func__,
+                tmp_err->message);
+        g_clear_error(&tmp_err);
+    }
+
+    // Prepare threads for the end callbacks of the finished targets
+    guint endcb_threads = (lr_handle) ? (guint) lr_handle->endcbthreads
+                                      : LRO_ENDCBTHREADS_DEFAULT;
+    dd->endcb_returned = g_async_queue_new();
+    dd->endcb_calls = 0;
+    dd->endcb_queue_size = (lr_handle) ? (guint) lr_handle->endcbqueuesize
+                                       : LRO_ENDCBQUEUESIZE_DEFAULT;
+    dd->endcb_pool = NULL;
+    if (endcb_threads > 0) {
+        dd->endcb_pool = g_thread_pool_new(call_queued_endcb,
+                                           dd->endcb_returned,
+                                           (gint) endcb_threads, FALSE,
+                                           &tmp_err);
+        if (!dd->endcb_pool) {
+            g_debug("%s: Cannot create end callback threads, end callbacks "
+                    "will be called by the download loop: %s", __func__,
+                    tmp_err->message);
+            g_clear_error(&tmp_err);
+        }
+    }
+
+    // Prepare asynchronous writes, every transfer has at most one write
+    // (and one writeback) in flight
+    dd->aio = NULL;
+    if (dd->iouring) {
+        guint entries = 2 * (guint) MAX(dd->max_parallel_connections, 1) + 2;
+        dd->aio = lr_asyncio_new(MIN(entries, LR_ASYNCIO_MAX_ENTRIES),
+                                 &tmp_err);
+        if (!dd->aio) {
+            g_debug("%s: Data will be written synchronously: %s",
+                    __func__, tmp_err->message);
+            g_clear_error(&tmp_err);
+        }
+    }
+
+#if LR_CURL_VERSION_CHECK(7, 43, 0)
+    if (dd->http2)
+        curl_multi_setopt(dd->multi_handle, CURLMOPT_PIPELINING,
+                          CURLPIPE_MULTIPLEX);
 #endif
-            case CURLE_OUT_OF_MEMORY:
-            case CURLE_RECV_ERROR:
-            case CURLE_SEND_ERROR:
-            case CURLE_SSL_CACERT_BADFILE:
-            case CURLE_SSL_CRL_BADFILE:
-            case CURLE_WRITE_ERROR:
-                // Fatal error
-                g_debug("%s: Fatal error - Curl code %d: %s",
-                        __func__, msg->data.result,
-                        curl_easy_strerror(msg->data.result));
-                *fatal_error = TRUE;
-            default:
-                // Other error are not considered fatal
-                break;
+
+    // Prepare limiter of the total speed
+    dd->limiter.max_speed = dd->max_speed;
+    dd->limiter.tokens = 0.0;
+    dd->limiter.last_refill = g_get_monotonic_time();
+    dd->limiter.paused_transfers = 0;
+    dd->limiter.shared = (shard) ? &shard->group->limiter : NULL;
+    dd->limiter.lock = NULL;
+
+    dd->start_time = g_get_monotonic_time();
+    dd->breaker_wakeup = 0;
+    dd->deadlines = FALSE;
+    dd->deadline_at_risk = FALSE;
+    dd->cancellations = g_atomic_int_get(&lr_downloadtarget_cancellations);
+    dd->cancel_check = FALSE;
+    dd->last_metrics = dd->start_time;
+
+    // Prepare list of LrTargets and LrHandleMirrors
+    dd->handle_mirrors = NULL;
+    dd->targets = g_ptr_array_new();
+    dd->running_transfers = g_ptr_array_new();
+    dd->waiting_targets = g_sequence_new(NULL);
+    dd->next_queue_seq = 0;
+    dd->coalesced = g_hash_table_new_full(g_str_hash, g_str_equal,
+                                          g_free, NULL);
+    dd->sourcecb = NULL;
+    dd->releasecb = NULL;
+    dd->sourcecb_data = NULL;
+    dd->live_targets = 0;
+    dd->retire_at = LR_RETIRE_MIN_TARGETS;
+    for (GSList *elem = targets; elem; elem = g_slist_next(elem))
+        lr_download_add_target(dd, elem->data);
+
+    return TRUE;
+}
+
+static void
+free_mirror(LrMirror *mirror)
+{
+    if (!mirror)
+        return;
+    g_free(mirror->last_error);
+    lr_free(mirror);
+}
+
+/** Add the statistics of the mirrors used by the download to
+ * the statistics of their handles (see LRI_STATS).
+ */
+static void
+merge_handle_stats(LrDownload *dd)
+{
+    gdouble elapsed = (g_get_monotonic_time() - dd->start_time)
+                      / (gdouble) G_USEC_PER_SEC;
+
+    for (GSList *elem = dd->handle_mirrors; elem; elem = g_slist_next(elem)) {
+        LrHandleMirrors *handle_mirrors = elem->data;
+        LrHandle *handle = handle_mirrors->handle;
+        GSList *lists[] = { handle_mirrors->lrmirrors,
+                            handle_mirrors->cachemirrors };
+        gboolean used = FALSE;
+
+        if (!handle)
+            continue;
+
+        for (guint i = 0; i < G_N_ELEMENTS(lists); i++) {
+            for (GSList *el = lists[i]; el; el = g_slist_next(el)) {
+                LrMirror *mirror = el->data;
+                LrMirrorStats *stats;
+
+                if (!mirror->successful_transfers && !mirror->failed_transfers)
+                    continue;  // Not used
+
+                stats = lr_handle_stats_mirror(handle, mirror->mirror->url);
+                stats->bytes += mirror->downloaded_bytes;
+                stats->time += mirror->transfer_time;
+                stats->successful += mirror->successful_transfers;
+                stats->failed += mirror->failed_transfers;
+                stats->retries += mirror->retries;
+                stats->speed = stats->time > 0.0 ?
+                               stats->bytes / stats->time : 0.0;
+
+                handle->stats->bytes += mirror->downloaded_bytes;
+                handle->stats->successful += mirror->successful_transfers;
+                handle->stats->failed += mirror->failed_transfers;
+                handle->stats->retries += mirror->retries;
+                used = TRUE;
             }
         }
 
-        return TRUE;
+        if (dd->autotune.enabled) {
+            handle->autotuned_downloads = dd->autotune.allowed;
+            if (used)
+                handle->stats->parallel_downloads = dd->autotune.allowed;
+        }
+
+        if (!used)
+            continue;
+
+        if (dd->shard) {
+            // The wall clock time of the shards is added by lr_download()
+            g_hash_table_add(dd->shard->group->handles, handle);
+        } else {
+            handle->stats->time += elapsed;
+            handle->stats->speed = handle->stats->time > 0.0 ?
+                               handle->stats->bytes / handle->stats->time : 0.0;
+        }
+        lr_handle_stats_alloc_update(handle);
     }
+}
 
-    // curl return code is CURLE_OK but we need to check status code
-    curl_easy_getinfo(msg->easy_handle, CURLINFO_RESPONSE_CODE, &code);
-    if (code) {
-        // Check status codes for some protocols
-        if (effective_url && g_str_has_prefix(effective_url, "http")) {
-            // Check HTTP(S) code
-            if (code/100 != 2) {
-                g_set_error(transfer_err,
-                            LR_DOWNLOADER_ERROR,
-                            LRE_BADSTATUS,
-                            "Status code: %ld for %s", code, effective_url);
+/** Write the span of the whole download to the traces of the handles
+ * of the targets (see LRO_TRACEFILE).
+ */
+static void
+trace_download(LrDownload *dd, gboolean ret)
+{
+    gint64 end = g_get_monotonic_time();
+
+    for (GSList *elem = dd->handle_mirrors; elem; elem = g_slist_next(elem)) {
+        LrHandle *handle = ((LrHandleMirrors *) elem->data)->handle;
+        if (handle)
+            lr_trace_span(handle->trace, "download", "download",
+                          dd->start_time, end,
+                          "status", ret ? "ok" : "failed",
+                          NULL);
+    }
+}
+
+/** Stop transfers still in progress (if tmp_err is set) and free
+ * all the download data. The tmp_err is propagated to the err.
+ */
+static gboolean
+lr_download_cleanup(LrDownload *dd,
+                    gboolean ret,
+                    GError *tmp_err,
+                    GError **err)
+{
+    LrVerification *verification;
+    LrEndCbCall *call;
+
+    assert(dd);
+    assert(!err || *err == NULL);
+
+    // Stop the verifier, on error the running verifications are not
+    // needed anymore and the queued ones are dropped
+    if (dd->verifier)
+        g_thread_pool_free(dd->verifier, TRUE, TRUE);
+    while ((verification = g_async_queue_try_pop(dd->verified)))
+        free_verification(verification);
+    g_async_queue_unref(dd->verified);
+
+    // The targets are finished already, so even on error the queued end
+    // callbacks are called (the unfinished targets are reported below
+    // by the calling thread when all of them returned)
+    if (dd->endcb_pool) {
+        g_thread_pool_free(dd->endcb_pool, FALSE, TRUE);
+        dd->endcb_pool = NULL;
+    }
+    while ((call = g_async_queue_try_pop(dd->endcb_returned))) {
+        dd->endcb_calls--;
+        free_endcb_call(call);
+    }
+    g_async_queue_unref(dd->endcb_returned);
+
+    if (tmp_err) {
+        // If there was an error, stop all transfers that are in progress.
+        g_debug("%s: Error while downloading: %s", __func__, tmp_err->message);
+
+        for (guint x = 0; x < dd->running_transfers->len; x++) {
+            LrTarget *target = g_ptr_array_index(dd->running_transfers, x);
+
+            curl_multi_remove_handle(dd->multi_handle, target->curl_handle);
+            // The partial file could be resumed later
+            save_transfer_journal(target);
+            curl_easy_cleanup(target->curl_handle);
+            target->curl_handle = NULL;
+            close_transfer_file(target);
+            // Ranges requested together with the target stay unfinished
+            g_slist_free(detach_range_batch(target));
+            if (target->mirror)
+                step_running_transfers(target->mirror, -1);
+
+            if (target->hedged) {
+                // Hedged request is not a target
+                free_hedge(target);
+                continue;
             }
-        } else if (effective_url) {
-            // Check FTP
-            if (code/100 != 2) {
-                g_set_error(transfer_err,
-                            LR_DOWNLOADER_ERROR,
-                            LRE_BADSTATUS,
-                            "Status code: %ld for %s", code, effective_url);
+
+            if (target->parent)
+                // Segmented target is reported below
+                continue;
+
+            // Call end callback
+            LrEndCb end_cb =  target->target->endcb;
+            if (end_cb) {
+                gchar *msg = g_strdup_printf("Not finished - interrupted by "
+                                             "error: %s", tmp_err->message);
+                end_cb(target->target->cbdata, LR_TRANSFER_ERROR, msg);
+                // No need to check end_cb return value, because there
+                // already was an error
+                g_free(msg);
             }
-        } else {
-            // Other protocols
-            g_set_error(transfer_err,
-                        LR_DOWNLOADER_ERROR,
-                        LRE_BADSTATUS,
-                        "Status code: %ld for %s", code, effective_url);
+
+            lr_downloadtarget_set_error(target->target, LRE_UNFINISHED,
+                    "Not finished - interrupted by error: %s",
+                    tmp_err->message);
+        }
+
+        g_ptr_array_set_size(dd->running_transfers, 0);
+
+        // Report targets whose verification wasn't finished
+        for (guint x = 0; x < dd->targets->len; x++) {
+            LrTarget *target = g_ptr_array_index(dd->targets, x);
+
+            if (target->state != LR_DS_VERIFYING)
+                continue;
+
+            // File of an assembled target is closed already
+            if (target->f)
+                close_transfer_file(target);
+
+            LrEndCb end_cb =  target->target->endcb;
+            if (end_cb) {
+                gchar *msg = g_strdup_printf("Not finished - interrupted by "
+                                             "error: %s", tmp_err->message);
+                end_cb(target->target->cbdata, LR_TRANSFER_ERROR, msg);
+                g_free(msg);
+            }
+
+            lr_downloadtarget_set_error(target->target, LRE_UNFINISHED,
+                    "Not finished - interrupted by error: %s",
+                    tmp_err->message);
+        }
+
+        // Report unfinished segmented targets
+        for (guint x = 0; x < dd->targets->len; x++) {
+            LrTarget *target = g_ptr_array_index(dd->targets, x);
+
+            if (!target->segments || target->state != LR_DS_RUNNING)
+                continue;
+
+            LrEndCb end_cb =  target->target->endcb;
+            if (end_cb) {
+                gchar *msg = g_strdup_printf("Not finished - interrupted by "
+                                             "error: %s", tmp_err->message);
+                end_cb(target->target->cbdata, LR_TRANSFER_ERROR, msg);
+                g_free(msg);
+            }
+
+            lr_downloadtarget_set_error(target->target, LRE_UNFINISHED,
+                    "Not finished - interrupted by error: %s",
+                    tmp_err->message);
         }
+
+        g_propagate_error(err, tmp_err);
     }
 
-    return TRUE;
+    assert(dd->running_transfers->len == 0);
+
+    // Targets finished before an error are synced too
+    if (dd->durability == LR_DURABILITY_BATCH) {
+        GError *sync_err = NULL;
+        if (!sync_finished_targets(dd->targets, &sync_err)) {
+            if (ret) {
+                g_propagate_error(err, sync_err);
+                ret = FALSE;
+            } else {
+                g_error_free(sync_err);
+            }
+        }
+    }
+
+    curl_multi_cleanup(dd->multi_handle);
+    lr_asyncio_free(dd->aio);
+
+    // The shards of a sharded download update the same handles
+    if (dd->shard)
+        g_mutex_lock(&dd->shard->group->lock);
+    merge_handle_stats(dd);
+    record_mirror_health(dd);
+    trace_download(dd, ret);
+    if (dd->shard)
+        g_mutex_unlock(&dd->shard->group->lock);
+
+    // Clean up dd->handle_mirrors
+    for (GSList *elem = dd->handle_mirrors; elem; elem = g_slist_next(elem)) {
+        LrHandleMirrors *handle_mirrors = elem->data;
+        g_slist_free_full(handle_mirrors->lrmirrors,
+                          (GDestroyNotify) free_mirror);
+        g_slist_free_full(handle_mirrors->cachemirrors,
+                          (GDestroyNotify) free_mirror);
+        lr_lrmirrorlist_free(handle_mirrors->cachelist);
+        lr_free(handle_mirrors);
+    }
+    g_slist_free(dd->handle_mirrors);
+
+    // Clean up targets
+    for (guint x = 0; x < dd->targets->len; x++)
+        free_target(dd, g_ptr_array_index(dd->targets, x));
+    g_ptr_array_free(dd->targets, TRUE);
+    g_ptr_array_free(dd->running_transfers, TRUE);
+    g_sequence_free(dd->waiting_targets);
+    g_hash_table_destroy(dd->coalesced);
+
+    return ret;
 }
 
+/** Call of an end callback of a target of a sharded download made
+ * by the thread which called lr_download() (see LRO_SHARDENDCB).
+ */
+typedef struct {
+    LrShardCallbackData *cbdata; /*!<
+        Callbacks of the target */
+    LrTransferStatus status; /*!<
+        Status of the transfer */
+    const char *msg; /*!<
+        Message of the transfer or NULL */
+    int ret; /*!<
+        Return value of the callback */
+    gboolean done; /*!<
+        TRUE when the callback returned */
+} LrShardEndCall;
+
+static int
+shard_progresscb(void *data, double total_to_download, double now_downloaded)
+{
+    LrShardCallbackData *cbdata = data;
+    int ret;
 
-static gboolean
-check_finished_trasfer_checksum(int fd,
-                                GSList *checksums,
-                                gboolean *checksum_matches,
-                                GError **transfer_err,
-                                GError **err)
+    g_mutex_lock(&cbdata->group->cb_lock);
+    ret = cbdata->progresscb(cbdata->cbdata, total_to_download,
+                             now_downloaded);
+    g_mutex_unlock(&cbdata->group->cb_lock);
+    return ret;
+}
+
+static int
+shard_mirrorfailurecb(void *data, const char *msg, const char *url)
+{
+    LrShardCallbackData *cbdata = data;
+    int ret;
+
+    g_mutex_lock(&cbdata->group->cb_lock);
+    ret = cbdata->mirrorfailurecb(cbdata->cbdata, msg, url);
+    g_mutex_unlock(&cbdata->group->cb_lock);
+    return ret;
+}
+
+static int
+shard_datacb(void *data, const char *ptr, size_t len)
+{
+    LrShardCallbackData *cbdata = data;
+    int ret;
+
+    g_mutex_lock(&cbdata->group->cb_lock);
+    ret = cbdata->datacb(cbdata->cbdata, ptr, len);
+    g_mutex_unlock(&cbdata->group->cb_lock);
+    return ret;
+}
+
+static int
+shard_endcb(void *data, LrTransferStatus status, const char *msg)
+{
+    LrShardCallbackData *cbdata = data;
+    LrShardGroup *group = cbdata->group;
+    int ret;
+
+    if (!group->endcb_calls) {
+        g_mutex_lock(&group->cb_lock);
+        ret = cbdata->endcb(cbdata->cbdata, status, msg);
+        g_mutex_unlock(&group->cb_lock);
+        return ret;
+    }
+
+    // Called by the caller of lr_download(), the shard waits for it
+    LrShardEndCall call = { cbdata, status, msg, LR_CB_OK, FALSE };
+    g_async_queue_push(group->endcb_calls, &call);
+    g_mutex_lock(&group->call_lock);
+    while (!call.done)
+        g_cond_wait(&group->call_cond, &group->call_lock);
+    g_mutex_unlock(&group->call_lock);
+
+    return call.ret;
+}
+
+/** Return the next target not taken by any shard or NULL
+ * (LrTargetSourceCb of the shards).
+ */
+static LrDownloadTarget *
+shard_next_target(void *data)
+{
+    LrShardGroup *group = data;
+    LrDownloadTarget *dtarget = NULL;
+
+    g_mutex_lock(&group->lock);
+    if (group->targets) {
+        dtarget = group->targets->data;
+        group->targets = g_slist_next(group->targets);
+    }
+    g_mutex_unlock(&group->lock);
+
+    return dtarget;
+}
+
+/** Note the failure of the shard, the other shards are interrupted.
+ */
+static void
+shard_failed(LrShard *shard)
+{
+    LrShardGroup *group = shard->group;
+
+    g_mutex_lock(&group->lock);
+    if (!group->failed) {
+        group->failed_shard = shard->index;
+        g_atomic_int_set(&group->failed, TRUE);
+    }
+    g_mutex_unlock(&group->lock);
+}
+
+/** Download loop of a shard. The shard pulls the targets from
+ * the group as lr_download_stream() does from its source.
+ */
+static gpointer
+shard_thread(gpointer data)
 {
-    gboolean matches = TRUE;
+    LrShard *shard = data;
+    LrShardGroup *group = shard->group;
+    LrDownload dd;
+    LrDownloadTarget *first;
+    GSList *targets;
+    GError *tmp_err = NULL;
+    gboolean ret;
 
-    for (GSList *elem = checksums; elem; elem = g_slist_next(elem)) {
-        LrDownloadTargetChecksum *chksum = elem->data;
-        if (!chksum || !chksum->value || chksum->type == LR_CHECKSUM_UNKNOWN)
-            continue;  // Bad checksum
+    lr_alloc_tag_set(LR_ALLOC_DOWNLOADER);
 
-        lseek(fd, 0, SEEK_SET);
-        gboolean ret = lr_checksum_fd_cmp(chksum->type,
-                                          fd,
-                                          chksum->value,
-                                          1,
-                                          &matches,
-                                          err);
-        if (!ret)
-            return FALSE;
+    first = shard_next_target(group);
+    if (!first) {
+        // The other shards took all the targets
+        shard->ret = TRUE;
+        goto done;
+    }
 
-        if (matches) {
-            // At least one checksum matches
-            g_debug("%s: Checksum (%s) %s is OK", __func__,
-                    lr_checksum_type_to_str(chksum->type),
-                    chksum->value);
-            break;
-        }
+    targets = g_slist_prepend(NULL, first);
+    ret = lr_download_init(&dd, targets, shard->failfast, shard, &shard->err);
+    g_slist_free(targets);
+    if (!ret) {
+        shard->ret = FALSE;
+        shard_failed(shard);
+        goto done;
     }
 
-    *checksum_matches = matches;
+    dd.sourcecb = shard_next_target;
+    dd.sourcecb_data = group;
 
-    if (!matches) {
-        // Checksums doesn't match
-        gchar *expected = g_strdup("");
+    ret = FALSE;
+    if (!download_interrupted(&dd, &tmp_err)
+        && prepare_next_transfers(&dd, &tmp_err))
+    {
+        g_debug("%s: Shard %u: Downloading started", __func__, shard->index);
+        ret = lr_perform(&dd, &tmp_err);
+    }
 
-        // Prepare pretty messages with list of expected checksums
-        for (GSList *elem = checksums; elem; elem = g_slist_next(elem)) {
-            gchar *tmp = NULL;
-            LrDownloadTargetChecksum *chksum = elem->data;
-            if (!chksum || !chksum->value || chksum->type == LR_CHECKSUM_UNKNOWN)
-                continue;  // Bad checksum
+    assert(ret || tmp_err);
 
-            const gchar *chtype_str = lr_checksum_type_to_str(chksum->type);
-            tmp = g_strconcat(expected, chksum->value, "(",
-                              chtype_str ? chtype_str : "UNKNOWN",
-                              ") ", NULL);
-            free(expected);
-            expected = tmp;
-        }
+    // Stop the other shards before the transfers of this one are
+    // cleaned up
+    if (!ret)
+        shard_failed(shard);
 
-        // Set error message
-        g_set_error(transfer_err,
-                LR_DOWNLOADER_ERROR,
-                LRE_BADCHECKSUM,
-                "Downloading successful, but checksum doesn't match. "
-                "Expected: %s", expected);
-        g_free(expected);
-    }
+    shard->ret = lr_download_cleanup(&dd, ret, tmp_err, &shard->err);
+    if (!shard->ret)
+        shard_failed(shard);
 
-    return TRUE;
+done:
+    if (group->endcb_calls)
+        g_async_queue_push(group->endcb_calls, group);
+    return NULL;
 }
 
-
-/** Truncate file - Used to remove downloaded garbage (error html pages, etc.)
+/** Check if the targets depend on each other: a target is pinned to
+ * the mirror of another one (LrDownloadTarget.samemirror) or two targets
+ * get the same file (see coalesce_target()). Such targets have to be
+ * downloaded by one download loop.
  */
 static gboolean
-truncate_transfer_file(LrTarget *target, GError **err)
+targets_related(GSList *targets)
 {
-    off_t original_offset = 0;  // Truncate whole file by default
-    int rc;
+    gboolean related = FALSE;
+    GHashTable *dtargets = g_hash_table_new(g_direct_hash, g_direct_equal);
+    GHashTable *keys = g_hash_table_new_full(g_str_hash, g_str_equal,
+                                             g_free, NULL);
 
-    assert(!err || *err == NULL);
-
-    if (target->original_offset > -1)
-        // If resume is enabled -> truncate file to its original position
-        original_offset = target->original_offset;
+    for (GSList *elem = targets; elem; elem = g_slist_next(elem))
+        g_hash_table_add(dtargets, elem->data);
 
-    if (target->target->fn)  // Truncate by filename
-        rc = truncate(target->target->fn, original_offset);
-    else  // Truncate by file descriptor number
-        rc = ftruncate(target->target->fd, original_offset);
+    for (GSList *elem = targets; elem && !related; elem = g_slist_next(elem)) {
+        LrDownloadTarget *dtarget = elem->data;
 
-    if (rc == -1) {
-        g_set_error(err, LR_DOWNLOADER_ERROR, LRE_IO,
-                    "ftruncate() failed: %s", strerror(errno));
-        return FALSE;
-    }
+        if (dtarget->samemirror
+            && g_hash_table_contains(dtargets, dtarget->samemirror)) {
+            related = TRUE;
+            break;
+        }
 
-    if (!target->target->fn) {
-        // In case fd is used, seek to the original offset
-        if (lseek(target->target->fd, original_offset, SEEK_SET) == -1) {
-            g_set_error(err, LR_DOWNLOADER_ERROR, LRE_IO,
-                        "lseek() failed: %s", strerror(errno));
-            return FALSE;
+        GSList *dkeys = coalescing_keys(dtarget);
+        for (GSList *el = dkeys; el; el = g_slist_next(el)) {
+            if (!related && !g_hash_table_add(keys, el->data))
+                related = TRUE;
+            else if (related)
+                g_free(el->data);
         }
+        g_slist_free(dkeys);
     }
 
-    return TRUE;
+    g_hash_table_destroy(keys);
+    g_hash_table_destroy(dtargets);
+    return related;
 }
 
-
-/** Return mirror rank or -1.0 if the rank cannot be determined
- * (e.g. when is too early)
- * Rank is currently just success rate for the mirror
+/** Return the number of shards of the download of the targets.
  */
-static gdouble
-mirror_rank(LrMirror *mirror)
+static guint
+download_shards(LrHandle *handle, GSList *targets)
 {
-    gdouble rank = -1.0;
+    guint shards = (guint) handle->downloadshards;
+    guint count = 0;
 
-    int successful = mirror->successful_transfers;
-    int failed = mirror->failed_transfers;
-    int finished_transfers = successful + failed;
+    if (shards == 0)
+        shards = g_get_num_processors();
+    shards = MIN(shards, (guint) handle->maxparalleldownloads);
 
-    if (finished_transfers < 3)
-        return rank; // Do not judge too early
+    // Every shard needs a target at least
+    for (GSList *elem = targets; elem && count < shards; elem = g_slist_next(elem))
+        count++;
 
-    rank = successful / (double) finished_transfers;
+    if (count > 1 && targets_related(targets)) {
+        g_debug("%s: The targets depend on each other, no sharding",
+                __func__);
+        return 1;
+    }
 
-    return rank;
+    return count;
 }
 
-
-/** Sort mirrors. Penalize the error ones.
- * In fact only move the current finished mirror forward or backward
- * by one position.
- * @param mirrors   GSList of mirrors (order of list elements won't be changed,
- *                  only data pointers)
- * @param mirror    Mirror of just finished transfer
- * @param success   Was download from the mirror successful
+/** Download the targets by the shards (see LRO_DOWNLOADSHARDS).
+ * The configuration is taken from the handle of the first target.
  */
 static gboolean
-sort_mirrors(GSList *mirrors, LrMirror *mirror, gboolean success)
+download_sharded(GSList *targets,
+                 guint shards,
+                 gboolean failfast,
+                 GError **err)
 {
-    GSList *elem = mirrors;
-    GSList *prev = NULL;
-    GSList *next = NULL;
-    gdouble rank_cur;
+    gboolean ret = TRUE;
+    LrHandle *handle = ((LrDownloadTarget *) targets->data)->handle;
+    guint count = g_slist_length(targets);
+    guint started = 0;
+    LrShardGroup group;
+    LrShard *shard_array;
+    LrShardCallbackData *cbdata;
+    GError *tmp_err = NULL;
+    guint x;
+
+    g_debug("%s: Downloading %u targets by %u shards", __func__,
+            count, shards);
+
+    g_mutex_init(&group.lock);
+    group.targets = targets;
+    group.mirror_transfers = g_hash_table_new_full(g_str_hash, g_str_equal,
+                                                   g_free, g_free);
+    g_mutex_init(&group.limiter_lock);
+    group.limiter.max_speed = handle->maxspeed;
+    group.limiter.tokens = 0.0;
+    group.limiter.last_refill = g_get_monotonic_time();
+    group.limiter.paused_transfers = 0;
+    group.limiter.shared = NULL;
+    group.limiter.lock = &group.limiter_lock;
+    group.shards = shards;
+    group.max_parallel_connections = (int) handle->maxparalleldownloads;
+    group.start_time = g_get_monotonic_time();
+    group.failed = FALSE;
+    group.failed_shard = 0;
+    g_mutex_init(&group.cb_lock);
+    group.endcb_calls = (handle->shardendcb) ? g_async_queue_new() : NULL;
+    g_mutex_init(&group.call_lock);
+    g_cond_init(&group.call_cond);
+    group.handles = g_hash_table_new(g_direct_hash, g_direct_equal);
+
+    // "Inject" the serialized callbacks to the targets
+    cbdata = lr_malloc0(sizeof(*cbdata) * count);
+    x = 0;
+    for (GSList *elem = targets; elem; elem = g_slist_next(elem), x++) {
+        LrDownloadTarget *dtarget = elem->data;
 
-    assert(mirrors);
-    assert(mirror);
+        cbdata[x].group             = &group;
+        cbdata[x].cbdata            = dtarget->cbdata;
+        cbdata[x].progresscb        = dtarget->progresscb;
+        cbdata[x].endcb             = dtarget->endcb;
+        cbdata[x].mirrorfailurecb   = dtarget->mirrorfailurecb;
+        cbdata[x].datacb            = dtarget->datacb;
+
+        dtarget->cbdata = &cbdata[x];
+        dtarget->progresscb = (dtarget->progresscb) ? shard_progresscb : NULL;
+        dtarget->endcb = (dtarget->endcb) ? shard_endcb : NULL;
+        dtarget->mirrorfailurecb = (dtarget->mirrorfailurecb)
+                                   ? shard_mirrorfailurecb : NULL;
+        dtarget->datacb = (dtarget->datacb) ? shard_datacb : NULL;
+    }
 
-    for (; elem && elem->data != mirror; elem = g_slist_next(elem))
-        prev = elem;
+    shard_array = lr_malloc0(sizeof(*shard_array) * shards);
+    for (x = 0; x < shards; x++) {
+        shard_array[x].group = &group;
+        shard_array[x].index = x;
+        shard_array[x].failfast = failfast;
+    }
 
-    assert(elem);  // Mirror should always exists in the list of mirrors
+    for (x = 0; x < shards; x++) {
+        shard_array[x].thread = g_thread_try_new("librepo-shard",
+                                                 shard_thread,
+                                                 &shard_array[x],
+                                                 &tmp_err);
+        if (!shard_array[x].thread) {
+            g_debug("%s: Cannot create thread of shard %u: %s",
+                    __func__, x, tmp_err->message);
+            g_clear_error(&tmp_err);
+            break;
+        }
+        started++;
+    }
 
-    next = elem->next;
+    if (started == 0) {
+        // Download by the calling thread then
+        group.shards = 1;
+        if (group.endcb_calls) {
+            g_async_queue_unref(group.endcb_calls);
+            group.endcb_calls = NULL;
+        }
+        shard_thread(&shard_array[0]);
+    }
 
-    if (!success && !next)
-        goto exit; // Penalization not needed - Mirror is already the last one
-    if (success && !prev)
-        goto exit; // Bonus not needed - Mirror is already the first one
+    // Call the end callbacks until all the shards are finished
+    for (guint running = started; group.endcb_calls && running > 0;) {
+        gpointer item = g_async_queue_pop(group.endcb_calls);
+        LrShardEndCall *call = item;
+        int rc;
 
-    // Calculate ranks
-    rank_cur  = mirror_rank(mirror);
-    if (rank_cur < 0.0)
-        goto exit; // Too early to judge
+        if (item == &group) {
+            running--;
+            continue;
+        }
 
+        // The other callbacks of the shards still run meanwhile
+        g_mutex_lock(&group.cb_lock);
+        rc = call->cbdata->endcb(call->cbdata->cbdata, call->status,
+                                 call->msg);
+        g_mutex_unlock(&group.cb_lock);
+        g_mutex_lock(&group.call_lock);
+        call->ret = rc;
+        call->done = TRUE;
+        g_cond_broadcast(&group.call_cond);
+        g_mutex_unlock(&group.call_lock);
+    }
 
-    if (!success) {
-        // Penalize
-        gdouble rank_next = mirror_rank(next->data);
-        if (rank_next < 0.0 || rank_next > rank_cur) {
-            elem->data = next->data;
-            next->data = (gpointer) mirror;
-            g_debug("%s: Mirror %s was penalized", __func__, mirror->mirror->url);
-        }
-    } else {
-        // Bonus
-        gdouble rank_prev = mirror_rank(prev->data);
-        if (rank_prev < rank_cur) {
-            elem->data = prev->data;
-            prev->data = mirror;
-            g_debug("%s: Mirror %s was awarded", __func__, mirror->mirror->url);
-        }
+    for (x = 0; x < started; x++)
+        g_thread_join(shard_array[x].thread);
+
+    // Remove the injected callbacks
+    x = 0;
+    for (GSList *elem = targets; elem; elem = g_slist_next(elem), x++) {
+        LrDownloadTarget *dtarget = elem->data;
+        dtarget->cbdata = cbdata[x].cbdata;
+        dtarget->progresscb = cbdata[x].progresscb;
+        dtarget->endcb = cbdata[x].endcb;
+        dtarget->mirrorfailurecb = cbdata[x].mirrorfailurecb;
+        dtarget->datacb = cbdata[x].datacb;
     }
+    lr_free(cbdata);
 
-exit:
-    if (g_getenv("LIBREPO_DEBUG_ADAPTIVEMIRRORSORTING")) {
-        // Debug
-        g_debug("%s: Updated order of mirrors (for %p):", __func__, mirrors);
-        for (GSList *elem = mirrors; elem; elem = g_slist_next(elem)) {
-            LrMirror *m = elem->data;
-            g_debug(" %s (s: %d f: %d)", m->mirror->url,
-                   m->successful_transfers, m->failed_transfers);
-        }
+    // Targets which no shard took before a failure
+    for (GSList *elem = group.targets; elem; elem = g_slist_next(elem)) {
+        LrDownloadTarget *dtarget = elem->data;
+        dtarget->rcode = LRE_UNFINISHED;
+        dtarget->err = "Not finished";
     }
 
-    return TRUE;
-}
+    // The shards run at once, their wall clock time is counted once
+    gdouble elapsed = (g_get_monotonic_time() - group.start_time)
+                      / (gdouble) G_USEC_PER_SEC;
+    GHashTableIter iter;
+    gpointer key;
+    g_hash_table_iter_init(&iter, group.handles);
+    while (g_hash_table_iter_next(&iter, &key, NULL)) {
+        LrStats *stats = ((LrHandle *) key)->stats;
+        stats->time += elapsed;
+        stats->speed = stats->time > 0.0 ? stats->bytes / stats->time : 0.0;
+    }
 
+    // The error of the first failed shard is returned
+    if (group.failed) {
+        ret = FALSE;
+        g_propagate_error(err, shard_array[group.failed_shard].err);
+        shard_array[group.failed_shard].err = NULL;
+    }
+    for (x = 0; x < shards; x++)
+        g_clear_error(&shard_array[x].err);
+
+    lr_free(shard_array);
+    g_hash_table_destroy(group.handles);
+    g_cond_clear(&group.call_cond);
+    g_mutex_clear(&group.call_lock);
+    if (group.endcb_calls)
+        g_async_queue_unref(group.endcb_calls);
+    g_mutex_clear(&group.cb_lock);
+    g_mutex_clear(&group.limiter_lock);
+    g_hash_table_destroy(group.mirror_transfers);
+    g_mutex_clear(&group.lock);
 
-static gboolean
-check_transfer_statuses(LrDownload *dd, GError **err)
+    return ret;
+}
+
+gboolean
+lr_download(GSList *targets,
+            gboolean failfast,
+            GError **err)
 {
-    assert(dd);
-    assert(!err || *err == NULL);
+    gboolean ret = FALSE;
+    LrDownload dd;             // dd stands for Download Data
+    LrAllocTag prev_tag;
+    GError *tmp_err = NULL;
 
-    int msgs_in_queue;
-    CURLMsg *msg;
+    assert(!err || *err == NULL);
 
-    while ((msg = curl_multi_info_read(dd->multi_handle, &msgs_in_queue))) {
-        LrTarget *target = NULL;
-        char *effective_url = NULL;
-        int fd;
-        gboolean matches = TRUE;
-        GError *transfer_err = NULL;
-        GError *tmp_err = NULL;
-        gboolean ret;
-        gboolean fatal_error = FALSE;
-        GError *fail_fast_error = NULL;
+    if (lr_interrupt) {
+        g_set_error(err, LR_DOWNLOADER_ERROR, LRE_INTERRUPTED,
+                    "Interrupted by signal");
+        return FALSE;
+    }
 
-        if (msg->msg != CURLMSG_DONE) {
-            // We are only interested in messages about finished transfers
-            continue;
-        }
+    if (!targets) {
+        g_debug("%s: No targets", __func__);
+        return TRUE;
+    }
 
-        // Find the target with this curl easy handle
-        for (GSList *elem = dd->running_transfers; elem; elem = g_slist_next(elem)) {
-            LrTarget *ltarget = elem->data;
-            if (ltarget->curl_handle == msg->easy_handle)
-                target = ltarget;
-        }
+    prev_tag = lr_alloc_tag_set(LR_ALLOC_DOWNLOADER);
 
-        assert(target);  // Each easy handle used in the multi handle
-                         // should always belong to some target from
-                         // the running_transfers list
+    // As the rest of the configuration, the number of shards is taken
+    // from the handle of the first target (see lr_download())
+    LrHandle *lr_handle = ((LrDownloadTarget *) targets->data)->handle;
+    guint shards = (lr_handle) ? download_shards(lr_handle, targets) : 1;
+    if (shards > 1) {
+        ret = download_sharded(targets, shards, failfast, err);
+        lr_alloc_tag_set(prev_tag);
+        return ret;
+    }
 
-        curl_easy_getinfo(msg->easy_handle,
-                          CURLINFO_EFFECTIVE_URL,
-                          &effective_url);
+    if (!lr_download_init(&dd, targets, failfast, NULL, err)) {
+        lr_alloc_tag_set(prev_tag);
+        return FALSE;
+    }
 
-        effective_url = g_strdup(effective_url); // Make the effetive url
-                                                  // persistent to survive
-                                                  // the curl_easy_cleanup()
+    // Prepare the first set of transfers
+    if (!download_interrupted(&dd, &tmp_err)
+        && prepare_next_transfers(&dd, &tmp_err))
+    {
+        // Perform!
+        g_debug("%s: Downloading started", __func__);
+        ret = lr_perform(&dd, &tmp_err);
+    }
 
-        g_debug("%s: Transfer finished: %s (Effective url: %s)",
-                __func__, target->target->path, effective_url);
+    assert(ret || tmp_err);
 
-        //
-        // Check status of finished transfer
-        //
-        ret = check_finished_transfer_status(msg, target, &fatal_error,
-                                             &transfer_err, err);
-        if (!ret)  // Error
-            return FALSE;
+    ret = lr_download_cleanup(&dd, ret, tmp_err, err);
+    lr_alloc_tag_set(prev_tag);
+    return ret;
+}
 
-        if (transfer_err)  // Transfer was unsuccessful
-            goto transfer_error;
+gboolean
+lr_download_stream(LrTargetSourceCb sourcecb,
+                   LrTargetReleaseCb releasecb,
+                   void *cbdata,
+                   gboolean failfast,
+                   GError **err)
+{
+    gboolean ret = FALSE;
+    LrDownload dd;             // dd stands for Download Data
+    LrDownloadTarget *first;
+    GSList *targets;
+    LrAllocTag prev_tag;
+    GError *tmp_err = NULL;
 
-        //
-        // Checksum checking
-        //
-        fflush(target->f);
-        fd = fileno(target->f);
-        ret = check_finished_trasfer_checksum(fd,
-                                              target->target->checksums,
-                                              &matches,
-                                              &transfer_err,
-                                              &tmp_err);
-        if (!ret) { // Error
-            g_propagate_prefixed_error(err, tmp_err, "Downloading from %s"
-                    "was successful but error encountered while "
-                    "checksuming: ", effective_url);
-            return FALSE;
-        }
+    assert(sourcecb);
+    assert(!err || *err == NULL);
 
-        if (transfer_err)  // Checksum doesn't match
-            goto transfer_error;
+    if (lr_interrupt) {
+        g_set_error(err, LR_DOWNLOADER_ERROR, LRE_INTERRUPTED,
+                    "Interrupted by signal");
+        return FALSE;
+    }
 
-        //
-        // Any other checks should go here
-        //
+    // The first target sets up the download
+    first = sourcecb(cbdata);
+    if (!first) {
+        g_debug("%s: No targets", __func__);
+        return TRUE;
+    }
 
-transfer_error:
+    prev_tag = lr_alloc_tag_set(LR_ALLOC_DOWNLOADER);
 
-        //
-        // Cleanup
-        //
-        curl_multi_remove_handle(dd->multi_handle, target->curl_handle);
-        curl_easy_cleanup(target->curl_handle);
-        target->curl_handle = NULL;
-        g_free(target->headercb_interrupt_reason);
-        target->headercb_interrupt_reason = NULL;
-        fclose(target->f);
-        target->f = NULL;
-
-        dd->running_transfers = g_slist_remove(dd->running_transfers,
-                                               (gconstpointer) target);
-        target->tried_mirrors = g_slist_append(target->tried_mirrors,
-                                               target->mirror);
-
-        if (transfer_err) {  // There was an error during transfer
-            int complete_url_in_path = strstr(target->target->path, "://") ? 1 : 0;
-            guint num_of_tried_mirrors = g_slist_length(target->tried_mirrors);
-
-            g_debug("%s: Error during transfer: %s", __func__, transfer_err->message);
-
-            // Update mirror statistics
-            if (target->mirror) {
-                target->mirror->failed_transfers++;
-                if (dd->adaptivemirrorsorting)
-                    sort_mirrors(target->lrmirrors, target->mirror, FALSE);
-            }
+    targets = g_slist_prepend(NULL, first);
+    ret = lr_download_init(&dd, targets, failfast, NULL, err);
+    g_slist_free(targets);
+    if (!ret) {
+        if (releasecb)
+            releasecb(cbdata, first);
+        lr_alloc_tag_set(prev_tag);
+        return FALSE;
+    }
 
-            // Call mirrorfailure callback
-            LrMirrorFailureCb mf_cb =  target->target->mirrorfailurecb;
-            if (mf_cb) {
-                int rc = mf_cb(target->target->cbdata,
-                               transfer_err->message,
-                               effective_url);
-                if (rc == LR_CB_ABORT) {
-                    // User wants to abort this download, so make the error fatal
-                    fatal_error = TRUE;
-                } else if (rc == LR_CB_ERROR) {
-                    gchar *original_err_msg = g_strdup(transfer_err->message);
-                    g_clear_error(&transfer_err);
-                    g_debug("%s: Downloading was aborted by LR_CB_ERROR from "
-                            "mirror failure callback. Original error was: "
-                            "%s", __func__, original_err_msg);
-                    g_set_error(&transfer_err, LR_DOWNLOADER_ERROR, LRE_CBINTERRUPTED,
-                                "Downloading was aborted by LR_CB_ERROR from "
-                                "mirror failure callback. Original error was: "
-                                "%s", original_err_msg);
-                    g_free(original_err_msg);
-                    fatal_error = TRUE;
-                    target->cb_return_code = LR_CB_ERROR;
-                }
-            }
+    dd.sourcecb = sourcecb;
+    dd.releasecb = releasecb;
+    dd.sourcecb_data = cbdata;
 
-            if (!fatal_error &&
-                !complete_url_in_path &&
-                !target->target->baseurl &&
-                (dd->max_mirrors_to_try <= 0 ||
-                 num_of_tried_mirrors < dd->max_mirrors_to_try))
-            {
-                // Try another mirror
-                g_debug("%s: Ignore error - Try another mirror", __func__);
-                target->state = LR_DS_WAITING;
-                g_error_free(transfer_err);  // Ignore the error
+    // Prepare the first set of transfers
+    ret = FALSE;
+    if (!download_interrupted(&dd, &tmp_err)
+        && prepare_next_transfers(&dd, &tmp_err))
+    {
+        // Perform!
+        g_debug("%s: Downloading started", __func__);
+        ret = lr_perform(&dd, &tmp_err);
+    }
 
-                // Truncate file - remove downloaded garbage (error html page etc.)
-                if (!truncate_transfer_file(target, err))
-                    return FALSE;
-            } else {
-                // No more mirrors to try or baseurl used or fatal error
-                g_debug("%s: No more retries (tried: %d)",
-                        __func__, num_of_tried_mirrors);
-                target->state = LR_DS_FAILED;
-
-                // Call end callback
-                LrEndCb end_cb =  target->target->endcb;
-                if (end_cb) {
-                    int rc = end_cb(target->target->cbdata,
-                                    LR_TRANSFER_ERROR,
-                                    transfer_err->message);
-                    if (rc == LR_CB_ERROR) {
-                        target->cb_return_code = LR_CB_ERROR;
-                        g_debug("%s: Downloading was aborted by LR_CB_ERROR "
-                                "from end callback", __func__);
-                    }
-                }
+    assert(ret || tmp_err);
 
-                lr_downloadtarget_set_error(target->target,
-                                            transfer_err->code,
-                                            "Download failed: %s",
-                                            transfer_err->message);
-                if (dd->failfast) {
-                    // Fail fast is enabled, fail on any error
-                    g_propagate_error(&fail_fast_error, transfer_err);
-                } else if (target->cb_return_code == LR_CB_ERROR) {
-                    // Callback returned LR_CB_ERROR, abort the downloading
-                    g_debug("%s: Downloading was aborted by LR_CB_ERROR", __func__);
-                    g_propagate_error(&fail_fast_error, transfer_err);
-                } else {
-                    // Fail fast is disabled and callback doesn't repor serious
-                    // error, so this download is aborted, but other download
-                    // can continue (do not abort whole downloading)
-                    g_error_free(transfer_err);
-                }
-            }
+    ret = lr_download_cleanup(&dd, ret, tmp_err, err);
+    lr_alloc_tag_set(prev_tag);
+    return ret;
+}
 
-        } else {
-            // No error encountered, transfer finished successfully
-            target->state = LR_DS_FINISHED;
-            lr_downloadtarget_set_error(target->target, LRE_OK, NULL);
-            if (target->mirror)
-                lr_downloadtarget_set_usedmirror(target->target,
-                                                 target->mirror->mirror->url);
-            lr_downloadtarget_set_effectiveurl(target->target,
-                                               effective_url);
+struct _LrDownloadAsync {
+    LrDownload dd; /*!<
+        Download data of the ongoing download */
+    gboolean empty; /*!<
+        No targets were passed, there is nothing to download or clean up */
+    gboolean finished; /*!<
+        Download is finished (successfully or not) */
+    gboolean failfast; /*!<
+        See lr_download(), used when the first target is added
+        to an empty download */
+    GError *error; /*!<
+        Error that stopped the download */
+    GThread *owner; /*!<
+        Thread which started the download */
+    gboolean busy; /*!<
+        The download is advanced by the owner right now, so the targets
+        added by its callbacks have to wait in the added */
+    GMutex lock; /*!<
+        Protects the added */
+    GSList *added; /*!<
+        Targets (LrDownloadTarget *) added by lr_download_async_add()
+        from another thread or from a callback of the download, they are
+        added by the next lr_download_async_step() */
+};
+
+/** Nothing is downloaded nor verified by the download anymore
+ * and all the end callbacks returned. */
+static gboolean
+async_download_done(LrDownloadAsync *ctx)
+{
+    return !ctx->dd.running_transfers->len && !ctx->dd.verifying_transfers
+           && !ctx->dd.endcb_calls && !ctx->dd.breaker_wakeup;
+}
 
-            // Call end callback
-            LrEndCb end_cb = target->target->endcb;
-            if (end_cb) {
-                int rc = end_cb(target->target->cbdata,
-                                LR_TRANSFER_SUCCESSFUL,
-                                NULL);
-                if (rc == LR_CB_ERROR) {
-                    target->cb_return_code = LR_CB_ERROR;
-                    g_debug("%s: Downloading was aborted by LR_CB_ERROR "
-                            "from end callback", __func__);
-                    g_set_error(&fail_fast_error, LR_DOWNLOADER_ERROR,
-                                LRE_CBINTERRUPTED,
-                                "Interupted by LR_CB_ERROR from end callback");
-                }
-            }
+/** Free the context. The targets which weren't added are marked
+ * as unfinished.
+ */
+static void
+async_free(LrDownloadAsync *ctx)
+{
+    for (GSList *elem = ctx->added; elem; elem = g_slist_next(elem))
+        lr_downloadtarget_set_error(elem->data, LRE_UNFINISHED,
+                                    "Added after the download was finished");
+    g_slist_free(ctx->added);
+    g_mutex_clear(&ctx->lock);
+    lr_free(ctx);
+}
 
-            // Update mirror statistics
-            if (target->mirror) {
-                target->mirror->successful_transfers++;
-                if (dd->adaptivemirrorsorting)
-                    sort_mirrors(target->lrmirrors, target->mirror, TRUE);
-            }
-        }
+LrDownloadAsync *
+lr_download_async_start(GSList *targets,
+                        gboolean failfast,
+                        GError **err)
+{
+    GError *tmp_err = NULL;
 
-        lr_free(effective_url);
+    assert(!err || *err == NULL);
 
-        if (fail_fast_error) {
-            // Interrupt whole downloading
-            // A fatal error occured or interrupted by callback
-            g_propagate_error(err, fail_fast_error);
-            return FALSE;
-        }
+    if (lr_interrupt) {
+        g_set_error(err, LR_DOWNLOADER_ERROR, LRE_INTERRUPTED,
+                    "Interrupted by signal");
+        return NULL;
     }
 
-    // At this point, after handles of finished transfers were removed
-    // from the multi_handle, we could add new waiting transfers.
-    return prepare_next_transfers(dd, err);
-}
+    LrDownloadAsync *ctx = lr_malloc0(sizeof(*ctx));
+    ctx->failfast = failfast;
+    ctx->owner = g_thread_self();
+    g_mutex_init(&ctx->lock);
 
+    if (!targets) {
+        g_debug("%s: No targets", __func__);
+        ctx->empty = TRUE;
+        ctx->finished = TRUE;
+        return ctx;
+    }
 
-static gboolean
-lr_perform(LrDownload *dd, GError **err)
-{
-    CURLMcode cm_rc;    // CurlM_ReturnCode
-    int still_running;
+    if (!lr_download_init(&ctx->dd, targets, failfast, NULL, err)) {
+        g_mutex_clear(&ctx->lock);
+        lr_free(ctx);
+        return NULL;
+    }
 
-    assert(dd);
-    assert(!err || *err == NULL);
+    // Prepare the first set of transfers
+    ctx->busy = TRUE;
+    if (download_interrupted(&ctx->dd, &tmp_err)
+        || !prepare_next_transfers(&ctx->dd, &tmp_err))
+    {
+        lr_download_cleanup(&ctx->dd, FALSE, tmp_err, err);
+        async_free(ctx);
+        return NULL;
+    }
+    ctx->busy = FALSE;
 
-    do { // Before version 7.20.0 CURLM_CALL_MULTI_PERFORM can appear
-        cm_rc = curl_multi_perform(dd->multi_handle, &still_running);
-    } while (cm_rc == CURLM_CALL_MULTI_PERFORM);
+    g_debug("%s: Downloading started", __func__);
+    ctx->finished = async_download_done(ctx);
+    return ctx;
+}
 
-    if (cm_rc != CURLM_OK) {
-        g_set_error(err, LR_DOWNLOADER_ERROR, LRE_CURLM,
-                    "curl_multi_perform() error: %s",
-                    curl_multi_strerror(cm_rc));
+/** Add the target to the download right now.
+ */
+static gboolean
+async_add_target(LrDownloadAsync *ctx,
+                 LrDownloadTarget *target,
+                 GError **err)
+{
+    if (ctx->error) {
+        g_propagate_error(err, g_error_copy(ctx->error));
         return FALSE;
     }
 
-    if (lr_interrupt) {
-        // Check interrupt after each call of curl_multi_perform
-        g_set_error(err, LR_DOWNLOADER_ERROR, LRE_INTERRUPTED,
-                    "Interrupted by signal");
+    if (ctx->empty) {
+        // The first target sets up the download
+        GSList *targets = g_slist_prepend(NULL, target);
+        gboolean ret = lr_download_init(&ctx->dd, targets, ctx->failfast,
+                                        NULL, err);
+        g_slist_free(targets);
+        if (!ret)
+            return FALSE;
+        ctx->empty = FALSE;
+    } else {
+        lr_download_add_target(&ctx->dd, target);
+    }
+
+    if (download_interrupted(&ctx->dd, &ctx->error)
+        || !prepare_next_transfers(&ctx->dd, &ctx->error))
+    {
+        ctx->finished = TRUE;
+        g_propagate_error(err, g_error_copy(ctx->error));
         return FALSE;
     }
 
-    while (dd->running_transfers) {
-        int rc;
-        int maxfd = -1;
-        long curl_timeout = -1;
-        struct timeval timeout;
-        fd_set fdread, fdwrite, fdexcep;
+    ctx->finished = async_download_done(ctx);
+    return TRUE;
+}
 
-        FD_ZERO(&fdread);
-        FD_ZERO(&fdwrite);
-        FD_ZERO(&fdexcep);
+/** Add the targets which wait in the added. The targets added meanwhile
+ * by the callbacks are added too. The ctx has to be busy.
+ */
+static gboolean
+async_add_pending(LrDownloadAsync *ctx, GError **err)
+{
+    gboolean ret = TRUE;
 
-        // Set suitable timeout to play around with
-        timeout.tv_sec  = 1;
-        timeout.tv_usec = 0;
+    assert(ctx->busy);
 
-        cm_rc = curl_multi_timeout(dd->multi_handle, &curl_timeout);
-        if (cm_rc != CURLM_OK) {
-            g_set_error(err, LR_DOWNLOADER_ERROR, LRE_CURLM,
-                        "curl_multi_timeout() error: %s",
-                        curl_multi_strerror(cm_rc));
-            return FALSE;
-        }
+    while (ret) {
+        LrDownloadTarget *target = NULL;
 
-        if (curl_timeout >= 0) {
-            timeout.tv_sec = curl_timeout / 1000;
-            if (timeout.tv_sec > 1)
-                timeout.tv_sec = 1;
-            else
-                timeout.tv_usec = (curl_timeout % 1000) * 1000;
+        g_mutex_lock(&ctx->lock);
+        if (ctx->added) {
+            target = ctx->added->data;
+            ctx->added = g_slist_delete_link(ctx->added, ctx->added);
         }
+        g_mutex_unlock(&ctx->lock);
 
-        // Get file descriptors from the transfers
-        cm_rc = curl_multi_fdset(dd->multi_handle, &fdread, &fdwrite,
-                                 &fdexcep, &maxfd);
-        if (cm_rc != CURLM_OK) {
-            g_set_error(err, LR_DOWNLOADER_ERROR, LRE_CURLM,
-                        "curl_multi_fdset() error: %s",
-                        curl_multi_strerror(cm_rc));
-            return FALSE;
-        }
+        if (!target)
+            break;
+        ret = async_add_target(ctx, target, err);
+    }
 
-        rc = select(maxfd+1, &fdread, &fdwrite, &fdexcep, &timeout);
-        if (rc < 0) {
-            if (errno == EINTR) {
-                g_debug("%s: select() interrupted by signal", __func__);
-                //goto retry;
-            } else {
-                g_set_error(err, LR_DOWNLOADER_ERROR, LRE_SELECT,
-                            "select() error: %s", strerror(errno));
-                return FALSE;
-            }
-        }
+    return ret;
+}
 
-        // This do-while loop is important. Because if curl_multi_perform sets
-        // still_running to 0, we need to check if there are any next
-        // transfers available (we need to call check_transfer_statuses).
-        // Because if there will be no next transfers available and the
-        // curl multi handle is empty (all transfers already
-        // finished - this is what still_running == 0 means),
-        // then the next iteration of main downloding loop cause a 1sec
-        // waiting on the select() call.
-        do {
-            // Check if any handle finished and potentialy add one or more
-            // waiting downloads to the multi_handle.
-            rc = check_transfer_statuses(dd, err);
-            if (!rc)
-                return FALSE;
+/** Add the targets which wait in the added during a step,
+ * an error stops the download.
+ */
+static void
+async_step_add_pending(LrDownloadAsync *ctx)
+{
+    GError *tmp_err = NULL;
 
-            if (lr_interrupt) {
-                g_set_error(err, LR_DOWNLOADER_ERROR, LRE_INTERRUPTED,
-                            "Interrupted by signal");
-                return FALSE;
-            }
+    if (ctx->error || async_add_pending(ctx, &tmp_err))
+        return;
 
-            // Do curl_multi_perform()
-            do { // Before version 7.20.0 CURLM_CALL_MULTI_PERFORM can appear
-                cm_rc = curl_multi_perform(dd->multi_handle, &still_running);
-                if (lr_interrupt) {
-                    // Check interrupt after each call of curl_multi_perform
-                    g_set_error(err, LR_DOWNLOADER_ERROR, LRE_INTERRUPTED,
-                                "Interrupted by signal");
-                    return FALSE;
-                }
-            } while (cm_rc == CURLM_CALL_MULTI_PERFORM);
+    // The error is in ctx->error already unless the setup of an empty
+    // download failed
+    if (ctx->error)
+        g_error_free(tmp_err);
+    else
+        ctx->error = tmp_err;
+    ctx->finished = TRUE;
+}
 
-            if (cm_rc != CURLM_OK) {
-                g_set_error(err, LR_DOWNLOADER_ERROR, LRE_CURLM,
-                            "curl_multi_perform() error: %s",
-                            curl_multi_strerror(cm_rc));
-                return FALSE;
-            }
-        } while (still_running == 0 && dd->running_transfers);
-    }
+/** Return TRUE if some targets wait in the added or some were cancelled
+ * since the last check, so the download has to be advanced right now.
+ */
+static gboolean
+async_work_pending(LrDownloadAsync *ctx)
+{
+    gboolean pending;
 
-    return check_transfer_statuses(dd, err);
+    g_mutex_lock(&ctx->lock);
+    pending = (ctx->added != NULL);
+    g_mutex_unlock(&ctx->lock);
+
+    return pending
+           || (!ctx->empty
+               && g_atomic_int_get(&lr_downloadtarget_cancellations)
+                  != ctx->dd.cancellations);
 }
 
 gboolean
-lr_download(GSList *targets,
-            gboolean failfast,
-            GError **err)
+lr_download_async_add(LrDownloadAsync *ctx,
+                      LrDownloadTarget *target,
+                      GError **err)
 {
-    gboolean ret = FALSE;
-    LrDownload dd;             // dd stands for Download Data
-    GError *tmp_err = NULL;
-
+    assert(ctx);
+    assert(target);
     assert(!err || *err == NULL);
 
-    if (lr_interrupt) {
-        g_set_error(err, LR_DOWNLOADER_ERROR, LRE_INTERRUPTED,
-                    "Interrupted by signal");
-        return FALSE;
-    }
-
-    if (!targets) {
-        g_debug("%s: No targets", __func__);
+    if (g_thread_self() != ctx->owner || ctx->busy) {
+        // Added by the next lr_download_async_step()
+        g_mutex_lock(&ctx->lock);
+        ctx->added = g_slist_append(ctx->added, target);
+        g_mutex_unlock(&ctx->lock);
         return TRUE;
     }
 
-    // XXX: Downloader configuration (max parallel connections etc.)
-    // is taken from the handle of the first target.
-    LrHandle *lr_handle = ((LrDownloadTarget *) targets->data)->handle;
+    ctx->busy = TRUE;
+    gboolean ret = async_add_target(ctx, target, err)
+                   && async_add_pending(ctx, err);
+    ctx->busy = FALSE;
+    return ret;
+}
 
-    // Prepare download data
-    dd.failfast = failfast;
+gboolean
+lr_download_async_fdset(LrDownloadAsync *ctx,
+                        fd_set *read_fd_set,
+                        fd_set *write_fd_set,
+                        fd_set *exc_fd_set,
+                        int *max_fd,
+                        long *timeout_ms,
+                        GError **err)
+{
+    CURLMcode cm_rc;
+    long curl_timeout = -1;
 
-    if (lr_handle) {
-        dd.max_parallel_connections = lr_handle->maxparalleldownloads;
-        dd.max_connection_per_host = lr_handle->maxdownloadspermirror;
-        dd.max_mirrors_to_try = lr_handle->maxmirrortries;
-        dd.max_speed = lr_handle->maxspeed;
-        dd.allowed_mirror_failures = lr_handle->allowed_mirror_failures;
-        dd.adaptivemirrorsorting = lr_handle->adaptivemirrorsorting;
-    } else {
-        // No handle, this is allowed when a complete URL is passed
-        // via relative_url param.
-        dd.max_parallel_connections = LRO_MAXPARALLELDOWNLOADS_DEFAULT;
-        dd.max_connection_per_host = LRO_MAXDOWNLOADSPERMIRROR_DEFAULT;
-        dd.max_mirrors_to_try = LRO_MAXMIRRORTRIES_DEFAULT;
-        dd.max_speed = LRO_MAXSPEED_DEFAULT;
-        dd.allowed_mirror_failures = LRO_ALLOWEDMIRRORFAILURES_DEFAULT;
-        dd.adaptivemirrorsorting = LRO_ADAPTIVEMIRRORSORTING_DEFAULT;
+    assert(ctx);
+    assert(max_fd);
+    assert(timeout_ms);
+    assert(!err || *err == NULL);
+
+    *max_fd = -1;
+    *timeout_ms = 0;
+
+    if (ctx->finished || async_work_pending(ctx))
+        return TRUE;
+
+    cm_rc = curl_multi_fdset(ctx->dd.multi_handle, read_fd_set,
+                             write_fd_set, exc_fd_set, max_fd);
+    if (cm_rc != CURLM_OK) {
+        g_set_error(err, LR_DOWNLOADER_ERROR, LRE_CURLM,
+                    "curl_multi_fdset() error: %s",
+                    curl_multi_strerror(cm_rc));
+        return FALSE;
     }
 
-    dd.multi_handle = curl_multi_init();
-    if (!dd.multi_handle) {
-        // Something went wrong
+    cm_rc = curl_multi_timeout(ctx->dd.multi_handle, &curl_timeout);
+    if (cm_rc != CURLM_OK) {
         g_set_error(err, LR_DOWNLOADER_ERROR, LRE_CURLM,
-                    "curl_multi_init() call failed");
+                    "curl_multi_timeout() error: %s",
+                    curl_multi_strerror(cm_rc));
         return FALSE;
     }
 
-    // Prepare list of LrTargets and LrHandleMirrors
-    dd.handle_mirrors = NULL;
-    dd.targets = NULL;
-    for (GSList *elem = targets; elem; elem = g_slist_next(elem)) {
-        LrDownloadTarget *dtarget = elem->data;
+    // Wait at most 1 sec, the same as the select() based loop does,
+    // so that progress callbacks and the lr_interrupt are served in time
+    if (curl_timeout < 0 || curl_timeout > 1000)
+        curl_timeout = 1000;
 
-        assert(dtarget);
-        assert(dtarget->path);
-        assert((dtarget->fd > 0 && !dtarget->fn) || (dtarget->fd < 0 && dtarget->fn));
-        g_debug("%s: Target: %s (%s)", __func__,
-                dtarget->path,
-                (dtarget->baseurl) ? dtarget->baseurl : "-");
-
-        LrTarget *target = lr_malloc0(sizeof(*target));
-        target->state           = LR_DS_WAITING;
-        target->target          = dtarget;
-        target->original_offset = -1;
-        target->target->rcode   = LRE_UNFINISHED;
-        target->target->err     = "Not finished";
-        target->handle          = dtarget->handle;
-        dd.targets = g_slist_append(dd.targets, target);
-        // Add list of handle internal mirrors to dd.handle_mirrors
-        // if doesn't exists yet and set the list reference
-        // to the target.
-        dd.handle_mirrors = lr_prepare_lrmirrors(dd.handle_mirrors, target);
-    }
-
-    dd.running_transfers = NULL;
+    // Paused transfers have to be resumed in time
+    if (ctx->dd.limiter.paused_transfers && curl_timeout > LR_BANDWIDTH_TICK_MS)
+        curl_timeout = LR_BANDWIDTH_TICK_MS;
 
-    // Prepare the first set of transfers
-    if (!prepare_next_transfers(&dd, &tmp_err))
-        goto lr_download_cleanup;
+    // Finished verifications (and returned end callbacks) have to be
+    // picked up in time
+    if ((ctx->dd.verifying_transfers || ctx->dd.endcb_calls)
+        && curl_timeout > LR_VERIFICATION_TICK_MS)
+        curl_timeout = LR_VERIFICATION_TICK_MS;
 
-    // Perform!
-    g_debug("%s: Downloading started", __func__);
-    ret = lr_perform(&dd, &tmp_err);
+    // Targets waiting for a circuit breaker have to be started in time
+    curl_timeout = breaker_wait_ms(&ctx->dd, curl_timeout);
 
-    assert(ret || tmp_err);
+    *timeout_ms = curl_timeout;
+    return TRUE;
+}
 
-lr_download_cleanup:
+gboolean
+lr_download_async_step(LrDownloadAsync *ctx,
+                       gboolean *finished,
+                       GError **err)
+{
+    CURLMcode cm_rc;    // CurlM_ReturnCode
+    int still_running;
 
-    if (tmp_err) {
-        // If there was an error, stop all transfers that are in progress.
-        g_debug("%s: Error while downloading: %s", __func__, tmp_err->message);
+    assert(ctx);
+    assert(!err || *err == NULL);
 
-        for (GSList *elem = dd.running_transfers; elem; elem = g_slist_next(elem)){
-            LrTarget *target = elem->data;
+    // Targets added meanwhile could resume a finished download
+    ctx->busy = TRUE;
+    async_step_add_pending(ctx);
 
-            curl_multi_remove_handle(dd.multi_handle, target->curl_handle);
-            curl_easy_cleanup(target->curl_handle);
-            target->curl_handle = NULL;
-            fclose(target->f);
-            target->f = NULL;
-            g_free(target->headercb_interrupt_reason);
-            target->headercb_interrupt_reason = NULL;
+    if (ctx->finished)
+        goto lr_download_async_step_done;
 
-            // Call end callback
-            LrEndCb end_cb =  target->target->endcb;
-            if (end_cb) {
-                gchar *msg = g_strdup_printf("Not finished - interrupted by "
-                                             "error: %s", tmp_err->message);
-                end_cb(target->target->cbdata, LR_TRANSFER_ERROR, msg);
-                // No need to check end_cb return value, because there
-                // already was an error
-                g_free(msg);
-            }
+    do {
+        do { // Before version 7.20.0 CURLM_CALL_MULTI_PERFORM can appear
+            cm_rc = curl_multi_perform(ctx->dd.multi_handle, &still_running);
+        } while (cm_rc == CURLM_CALL_MULTI_PERFORM);
 
-            lr_downloadtarget_set_error(target->target, LRE_UNFINISHED,
-                    "Not finished - interrupted by error: %s",
-                    tmp_err->message);
+        if (cm_rc != CURLM_OK) {
+            g_set_error(&ctx->error, LR_DOWNLOADER_ERROR, LRE_CURLM,
+                        "curl_multi_perform() error: %s",
+                        curl_multi_strerror(cm_rc));
+            break;
         }
 
-        g_slist_free(dd.running_transfers);
-        dd.running_transfers = NULL;
+        if (download_interrupted(&ctx->dd, &ctx->error)) {
+            break;
+        }
 
-        g_propagate_error(err, tmp_err);
-    }
+        // Check if any handle finished and potentialy add one or more
+        // waiting downloads to the multi_handle.
+        if (!check_transfer_statuses(&ctx->dd, &ctx->error))
+            break;
 
-    assert(dd.running_transfers == NULL);
+        // Repeat while the multi handle is empty but new transfers were
+        // added, otherwise the caller would wait for nothing
+    } while (still_running == 0 && ctx->dd.running_transfers->len);
 
-    curl_multi_cleanup(dd.multi_handle);
+    // Targets added by the callbacks during the step
+    async_step_add_pending(ctx);
 
-    // Clean up dd.handle_mirrors
-    for (GSList *elem = dd.handle_mirrors; elem; elem = g_slist_next(elem)) {
-        LrHandleMirrors *handle_mirrors = elem->data;
-        for (GSList *el = handle_mirrors->lrmirrors; el; el = g_slist_next(el)) {
-            LrMirror *mirror = el->data;
-            lr_free(mirror);
-        }
-        g_slist_free(handle_mirrors->lrmirrors);
-        lr_free(handle_mirrors);
+    if (ctx->error || async_download_done(ctx))
+        ctx->finished = TRUE;
+
+lr_download_async_step_done:
+    ctx->busy = FALSE;
+
+    if (finished)
+        *finished = ctx->finished;
+
+    if (ctx->error) {
+        g_propagate_error(err, g_error_copy(ctx->error));
+        return FALSE;
     }
-    g_slist_free(dd.handle_mirrors);
 
-    // Clean up targets
-    for (GSList *elem = dd.targets; elem; elem = g_slist_next(elem)) {
-        LrTarget *target = elem->data;
-        assert(target->curl_handle == NULL);
-        assert(target->f == NULL);
-
-        // Remove file created for the target if download was
-        // unsuccessful and the file doesn't exists before or
-        // its original content was overwritten
-        if (target->state != LR_DS_FINISHED) {
-            if (!target->target->resume || target->original_offset == 0) {
-                // Remove target file if the file doesn't
-                // exist before or was empty or was overwritten
-                if (target->target->fn) {
-                    // We can remove only files that were specified by fn
-                    if (unlink(target->target->fn) != 0) {
-                        g_debug("%s: Error while removing: %s",
-                                __func__, strerror(errno));
-                    }
-                }
-            }
-        }
+    return TRUE;
+}
+
+gboolean
+lr_download_async_finish(LrDownloadAsync *ctx, GError **err)
+{
+    gboolean ret;
+    GError *tmp_err;
+
+    assert(!err || *err == NULL);
+
+    if (!ctx)
+        return TRUE;
 
-        g_slist_free(target->tried_mirrors);
-        lr_free(target);
+    if (ctx->empty) {
+        async_free(ctx);
+        return TRUE;
     }
-    g_slist_free(dd.targets);
 
+    tmp_err = ctx->error;
+    if (!ctx->finished && !tmp_err)
+        g_set_error(&tmp_err, LR_DOWNLOADER_ERROR, LRE_INTERRUPTED,
+                    "Download was cancelled");
+
+    ret = (tmp_err == NULL);
+    ret = lr_download_cleanup(&ctx->dd, ret, tmp_err, err);
+    async_free(ctx);
     return ret;
 }
 
@@ -1887,6 +10499,8 @@ typedef struct {
     double downloaded;  /*!< Currently downloaded bytes of target */
     double total;       /*!< Total size of the target */
     void *userdata;     /*!< User data related to the target */
+    LrHandle *handle;   /*!< Handle of the target */
+    LrEndCb endcb;      /*!< End callback of the target */
     LrSharedCallbackData *sharedcbdata; /*!< Shared cb data */
 } LrCallbackData;
 
@@ -1922,6 +10536,8 @@ lr_multi_progress_func(void* ptr,
 
     for (GSList *elem = shared_cbdata->singlecbdata; elem; elem = g_slist_next(elem)) {
         LrCallbackData *singlecbdata = elem->data;
+        if (singlecbdata->handle != cbdata->handle)
+            continue;  // Target of another repository
         totalsize += singlecbdata->total;
         downloaded += singlecbdata->downloaded;
     }
@@ -1943,6 +10559,13 @@ lr_multi_mf_func(void *ptr, const char *msg, const char *url)
     return shared_cbdata->mfcb(cbdata->userdata, msg, url);
 }
 
+static int
+lr_multi_end_func(void *ptr, LrTransferStatus status, const char *msg)
+{
+    LrCallbackData *cbdata = ptr;
+    return cbdata->endcb(cbdata->userdata, status, msg);
+}
+
 gboolean
 lr_download_single_cb(GSList *targets,
                       gboolean failfast,
@@ -1967,10 +10590,13 @@ lr_download_single_cb(GSList *targets,
         lrcbdata->downloaded        = 0.0;
         lrcbdata->total             = 0.0;
         lrcbdata->userdata          = target->cbdata;
+        lrcbdata->handle            = target->handle;
+        lrcbdata->endcb             = target->endcb;
         lrcbdata->sharedcbdata      = &shared_cbdata;
 
         target->progresscb      = (cb) ? lr_multi_progress_func : NULL;
         target->mirrorfailurecb = (mfcb) ? lr_multi_mf_func : NULL;
+        target->endcb           = (target->endcb) ? lr_multi_end_func : NULL;
         target->cbdata          = lrcbdata;
 
         shared_cbdata.singlecbdata = g_slist_append(shared_cbdata.singlecbdata,
@@ -1986,6 +10612,7 @@ lr_download_single_cb(GSList *targets,
         target->cbdata = cbdata->userdata;
         target->progresscb = NULL;
         target->mirrorfailurecb = NULL;
+        target->endcb = cbdata->endcb;
         lr_free(cbdata);
     }
     g_slist_free(shared_cbdata.singlecbdata);
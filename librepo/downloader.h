@@ -22,6 +22,7 @@
 #define __LR_DOWNLOADER_H__
 
 #include <glib.h>
+#include <sys/select.h>
 
 #include "handle.h"
 #include "downloadtarget.h"
@@ -34,6 +35,17 @@ G_BEGIN_DECLS
  */
 
 /** Global variable signalizing if SIGINT was catched.
+ * It is process-wide and it stops all running downloads. To stop only
+ * some of the concurrent downloads use ::lr_handle_cancel instead.
+ *
+ * Thread safety: Downloads with different handles could run in
+ * parallel from different threads (::lr_download, ::lr_handle_perform,
+ * ::lr_download_packages, ...). One handle or target must not be
+ * used by more threads at once. Only ::lr_handle_cancel,
+ * ::lr_downloadtarget_cancel and ::lr_download_async_add could be called
+ * while another thread downloads with the handle or the target.
+ * The SIGINT handler (LRO_INTERRUPTIBLE) is installed once for all
+ * concurrent downloads which request it.
  */
 extern volatile sig_atomic_t lr_interrupt;
 
@@ -44,6 +56,12 @@ void
 lr_sigint_handler(int sig);
 
 /** Main download function.
+ * The configuration of the whole download (LRO_MAXPARALLELDOWNLOADS,
+ * LRO_MAXSPEED, LRO_DOWNLOADSHARDS and the other options which aren't
+ * bound to a mirror) is taken from the handle of the first target.
+ * The handles of the other targets provide only their mirrors and
+ * the options of their transfers, so targets of handles with different
+ * download configurations should be downloaded by separate calls.
  * @param targets   GSList with one or more ::LrDownloadTarget.
  *                  Could be NULL. Then return immediately with LRE_OK
  *                  return code.
@@ -60,6 +78,136 @@ lr_sigint_handler(int sig);
 gboolean
 lr_download(GSList *targets, gboolean failfast, GError **err);
 
+/** Source of the targets of ::lr_download_stream.
+ * @param cbdata    User data passed to ::lr_download_stream
+ * @return          Next ::LrDownloadTarget or NULL if there are no more
+ *                  targets
+ */
+typedef LrDownloadTarget *(*LrTargetSourceCb)(void *cbdata);
+
+/** Called by ::lr_download_stream when the downloader doesn't use
+ * the target anymore. The target is done (check its rcode) and
+ * the callback may free it.
+ * @param cbdata    User data passed to ::lr_download_stream
+ * @param target    The target
+ */
+typedef void (*LrTargetReleaseCb)(void *cbdata, LrDownloadTarget *target);
+
+/** Download targets pulled from a source. Unlike ::lr_download, the list
+ * of all targets doesn't have to be built in advance. The next targets
+ * are pulled from the sourcecb when transfer slots are freed, only a few
+ * of them wait for a slot. Finished targets are passed to the releasecb
+ * during the download, so a download of millions of files doesn't hold
+ * all of them. Use ::lr_downloadtarget_new_pooled for such targets.
+ * Downloader configuration is taken from the handle of the first target.
+ * More targets of the same file are downloaded only once as by
+ * ::lr_download, but only the targets which weren't released yet
+ * are matched. The same applies to LrDownloadTarget.samemirror,
+ * a target pinned to a released target is downloaded from any mirror.
+ * @param sourcecb  Source of the targets.
+ * @param releasecb Called for every pulled target when it is done,
+ *                  at the latest before the function returns.
+ * @param cbdata    User data for the callbacks.
+ * @param failfast  See ::lr_download.
+ * @param err       GError **
+ * @return          See ::lr_download.
+ */
+gboolean
+lr_download_stream(LrTargetSourceCb sourcecb,
+                   LrTargetReleaseCb releasecb,
+                   void *cbdata,
+                   gboolean failfast,
+                   GError **err);
+
+/** Context of a non-blocking download started by
+ * ::lr_download_async_start.
+ */
+typedef struct _LrDownloadAsync LrDownloadAsync;
+
+/** Start a non-blocking download. Unlike ::lr_download this function
+ * only prepares the first set of transfers and returns. The download
+ * is driven by the caller's event loop: watch the file descriptors from
+ * ::lr_download_async_fdset and call ::lr_download_async_step whenever
+ * any of them is ready or the timeout expires.
+ * @param targets   GSList with one or more ::LrDownloadTarget.
+ *                  Could be NULL. Then the returned context is
+ *                  already finished.
+ * @param failfast  See ::lr_download.
+ * @param err       GError **
+ * @return          Download context or NULL (then err is set).
+ *                  The context has to be freed by
+ *                  ::lr_download_async_finish.
+ */
+LrDownloadAsync *
+lr_download_async_start(GSList *targets, gboolean failfast, GError **err);
+
+/** Add a target to a download started by ::lr_download_async_start.
+ * The target is queued after the targets already passed, a finished
+ * download is resumed. The download configuration is taken from the
+ * first target, so adding to an empty download sets it up.
+ * It could be called from any thread and from the callbacks of
+ * the download. Then the target is added by the next
+ * ::lr_download_async_step (::lr_download_async_fdset returns zero
+ * timeout meanwhile) and errors are reported by the step. A target
+ * added after the last step is marked as unfinished by
+ * ::lr_download_async_finish. Running targets are cancelled by
+ * ::lr_downloadtarget_cancel.
+ * @param ctx       Download context.
+ * @param target    ::LrDownloadTarget, it has to live until
+ *                  ::lr_download_async_finish.
+ * @param err       GError **
+ * @return          If FALSE then err is set and the download is
+ *                  stopped. Call ::lr_download_async_finish anyway.
+ */
+gboolean
+lr_download_async_add(LrDownloadAsync *ctx,
+                      LrDownloadTarget *target,
+                      GError **err);
+
+/** Get file descriptors and the timeout the caller should wait for.
+ * Semantics are the same as of curl_multi_fdset().
+ * @param ctx           Download context.
+ * @param read_fd_set   Set of fds to be watched for reading.
+ * @param write_fd_set  Set of fds to be watched for writing.
+ * @param exc_fd_set    Set of fds to be watched for exceptions.
+ * @param max_fd        Highest fd that was set or -1 if none.
+ *                      Even with -1 the caller has to call
+ *                      ::lr_download_async_step after the timeout.
+ * @param timeout_ms    Max time in milliseconds to wait before the next
+ *                      call of ::lr_download_async_step.
+ * @param err           GError **
+ * @return              If FALSE then err is set.
+ */
+gboolean
+lr_download_async_fdset(LrDownloadAsync *ctx,
+                        fd_set *read_fd_set,
+                        fd_set *write_fd_set,
+                        fd_set *exc_fd_set,
+                        int *max_fd,
+                        long *timeout_ms,
+                        GError **err);
+
+/** Advance the download. Never blocks.
+ * @param ctx       Download context.
+ * @param finished  Set to TRUE when there is nothing more to download.
+ *                  Could be NULL.
+ * @param err       GError **
+ * @return          If FALSE then err is set and the download is
+ *                  stopped. Call ::lr_download_async_finish anyway.
+ */
+gboolean
+lr_download_async_step(LrDownloadAsync *ctx, gboolean *finished, GError **err);
+
+/** Finish the download and free the context. If the download is not
+ * finished yet, all transfers in progress are cancelled and the
+ * targets are marked as unfinished.
+ * @param ctx       Download context.
+ * @param err       GError **
+ * @return          The same as the return value of ::lr_download.
+ */
+gboolean
+lr_download_async_finish(LrDownloadAsync *ctx, GError **err);
+
 /** Wrapper over ::lr_download that takes only single ::LrDownloadTarget.
  * Note: failfast is TRUE, so if download failed, then this function returns
  * FALSE (There is no need to check status of download itself).
@@ -84,7 +232,9 @@ gboolean
 lr_download_url(LrHandle *handle, const char *url, int fd, GError **err);
 
 /** Wrapper over the ::lr_download that calculate collective statistics of
- * all downloads and repord them via callback. Note: All callbacks and
+ * all downloads and repord them via callback. The statistics are collective
+ * for the targets with the same handle (e.g. when more repositories
+ * are downloaded together). Note: All callbacks and
  * userdata setted in targets will be replaced and don't be used.
  * @param targets   See ::lr_download
  * @param failfast  See ::lr_download
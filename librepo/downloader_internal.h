@@ -0,0 +1,44 @@
+/* librepo - A library providing (libcURL like) API to downloading repository
+ * Copyright (C) 2014  Tomas Mlcoch
+ *
+ * Licensed under the GNU Lesser General Public License Version 2.1
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#ifndef __LR_DOWNLOADER_INTERNAL_H__
+#define __LR_DOWNLOADER_INTERNAL_H__
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/** Install the librepo SIGINT handler (::lr_sigint_handler).
+ * Calls could be nested and could come from several threads at once,
+ * the handler is installed by the first call and the original one
+ * is restored by the last matching ::lr_sigint_handler_restore.
+ * @return          FALSE if sigaction() failed.
+ */
+gboolean
+lr_sigint_handler_setup(void);
+
+/** Counterpart of the successful ::lr_sigint_handler_setup.
+ */
+void
+lr_sigint_handler_restore(void);
+
+G_END_DECLS
+
+#endif
@@ -47,6 +47,80 @@ lr_downloadtargetchecksum_free(LrDownloadTargetChecksum *dtch)
     g_free(dtch);
 }
 
+LrDownloadTargetPieces *
+lr_downloadtargetpieces_new(LrChecksumType type,
+                            gint64 length,
+                            GSList *hashes)
+{
+    LrDownloadTargetPieces *dtp = lr_malloc0(sizeof(*dtp));
+    dtp->type = type;
+    dtp->length = length;
+    dtp->count = g_slist_length(hashes);
+    dtp->hashes = lr_malloc0(sizeof(gchar *) * (dtp->count + 1));
+    guint i = 0;
+    for (GSList *elem = hashes; elem; elem = g_slist_next(elem))
+        dtp->hashes[i++] = g_strdup(elem->data);
+    return dtp;
+}
+
+void
+lr_downloadtargetpieces_free(LrDownloadTargetPieces *dtp)
+{
+    if (!dtp) return;
+    g_strfreev(dtp->hashes);
+    g_free(dtp);
+}
+
+static LrDownloadTargetOutput *
+downloadtargetoutput_new(LrDownloadTargetOutputType type)
+{
+    LrDownloadTargetOutput *dto = lr_malloc0(sizeof(*dto));
+    dto->type = type;
+    dto->fd = -1;
+    return dto;
+}
+
+LrDownloadTargetOutput *
+lr_downloadtargetoutput_new_fd(int fd)
+{
+    LrDownloadTargetOutput *dto = downloadtargetoutput_new(LR_OUTPUT_FD);
+    dto->fd = fd;
+    return dto;
+}
+
+LrDownloadTargetOutput *
+lr_downloadtargetoutput_new_fn(const char *fn)
+{
+    LrDownloadTargetOutput *dto = downloadtargetoutput_new(LR_OUTPUT_FN);
+    dto->fn = g_strdup(fn);
+    return dto;
+}
+
+LrDownloadTargetOutput *
+lr_downloadtargetoutput_new_memory(void)
+{
+    return downloadtargetoutput_new(LR_OUTPUT_MEMORY);
+}
+
+LrDownloadTargetOutput *
+lr_downloadtargetoutput_new_cb(LrDataCb cb, void *cbdata)
+{
+    LrDownloadTargetOutput *dto = downloadtargetoutput_new(LR_OUTPUT_CB);
+    dto->cb = cb;
+    dto->cbdata = cbdata;
+    return dto;
+}
+
+void
+lr_downloadtargetoutput_free(LrDownloadTargetOutput *dto)
+{
+    if (!dto) return;
+    g_free(dto->fn);
+    if (dto->data)
+        g_byte_array_unref(dto->data);
+    g_free(dto);
+}
+
 LrDownloadTarget *
 lr_downloadtarget_new(LrHandle *handle,
                       const char *path,
@@ -63,13 +137,38 @@ lr_downloadtarget_new(LrHandle *handle,
                       void *userdata,
                       gint64 byterangestart,
                       gint64 byterangeend)
+{
+    return lr_downloadtarget_new_pooled(NULL, handle, path, baseurl, fd, fn,
+                                        possiblechecksums, expectedsize,
+                                        resume, progresscb, cbdata, endcb,
+                                        mirrorfailurecb, userdata,
+                                        byterangestart, byterangeend);
+}
+
+LrDownloadTarget *
+lr_downloadtarget_new_pooled(GStringChunk *pool,
+                             LrHandle *handle,
+                             const char *path,
+                             const char *baseurl,
+                             int fd,
+                             const char *fn,
+                             GSList *possiblechecksums,
+                             gint64 expectedsize,
+                             gboolean resume,
+                             LrProgressCb progresscb,
+                             void *cbdata,
+                             LrEndCb endcb,
+                             LrMirrorFailureCb mirrorfailurecb,
+                             void *userdata,
+                             gint64 byterangestart,
+                             gint64 byterangeend)
 {
     LrDownloadTarget *target;
     _cleanup_free_ gchar *final_path = NULL;
     _cleanup_free_ gchar *final_baseurl = NULL;
 
     assert(path);
-    assert((fd > 0 && !fn) || (fd < 0 && fn));
+    assert((fd > 0 && !fn) || fd < 0);
 
     if (byterangestart && resume) {
         g_debug("%s: Cannot specify byterangestart and set resume to TRUE "
@@ -90,7 +189,8 @@ lr_downloadtarget_new(LrHandle *handle,
     target = lr_malloc0(sizeof(*target));
 
     target->handle          = handle;
-    target->chunk           = g_string_chunk_new(0);
+    target->chunk           = (pool) ? pool : g_string_chunk_new(0);
+    target->pooledchunk     = (pool != NULL);
     target->path            = g_string_chunk_insert(target->chunk, final_path);
     target->baseurl         = lr_string_chunk_insert(target->chunk, final_baseurl);
     target->fd              = fd;
@@ -106,6 +206,7 @@ lr_downloadtarget_new(LrHandle *handle,
     target->userdata        = userdata;
     target->byterangestart  = byterangestart;
     target->byterangeend    = byterangeend;
+    target->decompressfd    = -1;
 
     return target;
 }
@@ -118,10 +219,27 @@ lr_downloadtarget_free(LrDownloadTarget *target)
 
     g_slist_free_full(target->checksums,
                       (GDestroyNotify) lr_downloadtargetchecksum_free);
-    g_string_chunk_free(target->chunk);
+    lr_downloadtargetpieces_free(target->pieces);
+    g_slist_free_full(target->outputs,
+                      (GDestroyNotify) lr_downloadtargetoutput_free);
+    if (!target->pooledchunk)
+        g_string_chunk_free(target->chunk);
+    if (target->data)
+        g_byte_array_unref(target->data);
     lr_free(target);
 }
 
+volatile gint lr_downloadtarget_cancellations = 0;
+
+void
+lr_downloadtarget_cancel(LrDownloadTarget *target)
+{
+    assert(target);
+
+    g_atomic_int_set(&target->cancelled, 1);
+    g_atomic_int_inc(&lr_downloadtarget_cancellations);
+}
+
 void
 lr_downloadtarget_set_error(LrDownloadTarget *target,
                             LrRc code,
@@ -48,9 +48,97 @@ lr_downloadtargetchecksum_new(LrChecksumType type, const gchar *value);
 void
 lr_downloadtargetchecksum_free(LrDownloadTargetChecksum *dtch);
 
-/** Single download target
+/** Checksums of the pieces of a target (e.g. from <pieces> element
+ * of a metalink). The target is split into pieces of the length,
+ * the last piece could be shorter.
+ */
+typedef struct {
+    LrChecksumType type;    /*!< Checksum type of the pieces */
+    gint64 length;          /*!< Length of a piece */
+    guint count;            /*!< Number of the pieces */
+    gchar **hashes;         /*!< Checksums of the pieces (count items) */
+} LrDownloadTargetPieces;
+
+/** Create new LrDownloadTargetPieces object.
+ * @param type      Checksum type
+ * @param length    Length of a piece
+ * @param hashes    GSList of checksums (gchar *) in order of the pieces.
+ *                  The values will be stduped.
+ */
+LrDownloadTargetPieces *
+lr_downloadtargetpieces_new(LrChecksumType type,
+                            gint64 length,
+                            GSList *hashes);
+
+/** Free LrDownloadTargetPieces object.
+ * @param dtp       LrDownloadTargetPieces object
+ */
+void
+lr_downloadtargetpieces_free(LrDownloadTargetPieces *dtp);
+
+/** Type of an additional output of a target */
+typedef enum {
+    LR_OUTPUT_FD,       /*!< Opened file descriptor */
+    LR_OUTPUT_FN,       /*!< File, created or truncated */
+    LR_OUTPUT_MEMORY,   /*!< Memory buffer (GByteArray) */
+    LR_OUTPUT_CB,       /*!< Data callback (LrDataCb) */
+} LrDownloadTargetOutputType;
+
+/** Additional output of a target (see LrDownloadTarget.outputs).
+ * The output gets the same data as the fd or fn of the target.
  */
 typedef struct {
+    LrDownloadTargetOutputType type; /*!<
+        Type of the output */
+    int fd; /*!<
+        File descriptor of a LR_OUTPUT_FD output or -1. The data are
+        written from its beginning, the file is truncated. */
+    char *fn; /*!<
+        Path of a LR_OUTPUT_FN output or NULL */
+    LrDataCb cb; /*!<
+        Callback of a LR_OUTPUT_CB output or NULL. It is called with
+        NULL data when the data start again (see LrDataCb). */
+    void *cbdata; /*!<
+        User data of the cb */
+    GByteArray *data; /*!<
+        Data of a LR_OUTPUT_MEMORY output. Filled by the downloader
+        only if the transfer was successful (before the endcb
+        of the target is called). */
+} LrDownloadTargetOutput;
+
+/** Create new output to an opened file descriptor.
+ * @param fd        File descriptor (not closed by the downloader)
+ */
+LrDownloadTargetOutput *
+lr_downloadtargetoutput_new_fd(int fd);
+
+/** Create new output to a file.
+ * @param fn        Path to the file. This value will be stduped.
+ */
+LrDownloadTargetOutput *
+lr_downloadtargetoutput_new_fn(const char *fn);
+
+/** Create new output to memory.
+ */
+LrDownloadTargetOutput *
+lr_downloadtargetoutput_new_memory(void);
+
+/** Create new output to a data callback.
+ * @param cb        Callback
+ * @param cbdata    User data of the callback
+ */
+LrDownloadTargetOutput *
+lr_downloadtargetoutput_new_cb(LrDataCb cb, void *cbdata);
+
+/** Free LrDownloadTargetOutput object.
+ * @param dto       LrDownloadTargetOutput object
+ */
+void
+lr_downloadtargetoutput_free(LrDownloadTargetOutput *dto);
+
+/** Single download target
+ */
+typedef struct _LrDownloadTarget {
 
     LrHandle *handle; /*!<
         Handle */
@@ -64,7 +152,8 @@ typedef struct {
 
     int fd; /*!<
         Opened file descriptor where data will be written or -1.
-        Note: Only one, fd or fn, is set simultaneously. */
+        Note: Only one, fd or fn, is set simultaneously.
+        If none of them is set, the data are downloaded into memory. */
 
     char *fn; /*!<
         Filename where data will be written or NULL.
@@ -104,14 +193,128 @@ typedef struct {
     GStringChunk *chunk; /*!<
         Chunk for strings used in this structure. */
 
+    gboolean pooledchunk; /*!<
+        The chunk is a pool shared with other targets
+        (see lr_downloadtarget_new_pooled), it is not freed
+        with the target. */
+
     gint64 byterangestart; /*!<
         Download only specified range of bytes. */
 
     gint64 byterangeend; /*!<
         Download only specified range of bytes. */
 
+    gint priority; /*!<
+        Priority of the target. Targets with higher priority are
+        downloaded first if LRO_DOWNLOADORDER is LR_DOWNLOADORDER_PRIORITY.
+        0 is default. */
+
+    int decompressfd; /*!<
+        Opened file descriptor where the decompressed data are written
+        or -1 (default). The compression (gzip, bzip2, xz) is detected
+        from the content, uncompressed data are copied unchanged.
+        The data are decompressed while they are downloaded if possible.
+        Checksums are always checked on the downloaded (compressed) data
+        and the data are written to fd or fn as well. */
+
+    LrDataCb datacb; /*!<
+        Called with the data as they are downloaded (with cbdata)
+        or NULL (default). Only a transfer of the whole file from its
+        beginning is passed to the callback. Segmented, resumed
+        and byte range transfers are not, so the callback may not get
+        all the data of the target. Compare the length of the passed
+        data with the size of the downloaded file. */
+
+    gboolean conditional; /*!<
+        If TRUE, the target is downloaded by a conditional HTTP request
+        (If-None-Match and If-Modified-Since) with the validators etag
+        and lastmodified of a local copy of the file. If the server
+        answers 304 Not Modified, nothing is written to fd or fn,
+        checksums are not checked and notmodified is set. The validators
+        are replaced by the ones of the response. Use an empty file
+        for the target, the local copy is kept by the caller.
+        Ignored for byte ranges and protocols other than HTTP(S). */
+
+    char *etag; /*!<
+        ETag of the local copy of a conditional target or NULL.
+        After the download, ETag of the response. */
+
+    gint64 lastmodified; /*!<
+        Last modification time (Unix time) of the local copy of
+        a conditional target or 0. After the download, Last-Modified
+        of the response (0 if unknown). */
+
+    struct _LrDownloadTarget *samemirror; /*!<
+        NULL (default) or another target of the same download. The target
+        is downloaded only from the mirror the other target is (or was)
+        downloaded from, it waits until the other target has selected
+        a mirror. No other mirror is tried, if the download from this
+        mirror fails, the target fails. If the other target moves to
+        another mirror after its failure, the target follows it only if
+        it hasn't been downloaded yet, compare the usedmirror of both
+        targets. Ignored if baseurl is set. */
+
+    gboolean cachesources; /*!<
+        If TRUE, the target is tried from the LRO_CACHESOURCES of its
+        handle before the mirrors. Use it only for the targets whose
+        content is verified by a checksum (e.g. packages). FALSE is
+        default. Ignored if baseurl is set. */
+
+    LrDownloadTargetPieces *pieces; /*!<
+        NULL (default) or checksums of the pieces of the target.
+        Freed by lr_downloadtarget_free. The pieces are verified while
+        a whole file is downloaded, if some of them are damaged and
+        the target has no baseurl, only the damaged pieces are
+        downloaded again from other mirrors (by byte ranges) instead
+        of the whole file. The checksums of the target are checked
+        after the repair as usual. */
+
+    GSList *outputs; /*!<
+        NULL (default) or GSList of LrDownloadTargetOutput. Every output
+        gets a copy of the data of the target. The data of a whole file
+        are passed to the outputs while they are written by the transfer,
+        so they go through the memory only once. If it is not possible
+        (segmented, resumed or repaired download, a write to an output
+        failed), the outputs get the data from the downloaded file
+        before the endcb is called. After a failed transfer the outputs
+        are written again, only the content after a successful download
+        is valid. Ignored for a target with a byte range (byterangestart,
+        byterangeend). Freed by lr_downloadtarget_free. */
+
+    gdouble deadline; /*!<
+        0 (default) or time (Unix time with fractions of a second) by
+        which the target has to be downloaded. Waiting targets with
+        a deadline are started first, earliest deadline first, before
+        the LRO_DOWNLOADORDER applies. When a target with a deadline
+        cannot start or is not expected to finish in time, transfers of
+        LR_PRIORITYCLASS_BACKGROUND targets are stopped (and started
+        again later) and no new ones are started. When the deadline
+        passes, the target fails with LRE_DEADLINE. */
+
+    LrPriorityClass priorityclass; /*!<
+        LR_PRIORITYCLASS_NORMAL (default), LR_PRIORITYCLASS_CRITICAL
+        targets are started before the normal ones (and could use
+        the slots of LRO_CRITICALSLOTS) and LR_PRIORITYCLASS_BACKGROUND
+        targets after them. See also deadline. */
+
+    gboolean contentencoding; /*!<
+        FALSE (default) or TRUE if the file is not compressed and it
+        could be transferred compressed if LRO_ACCEPTENCODING of
+        the handle is enabled. The data are decoded during the transfer,
+        the checksums and the expectedsize apply to the decoded data.
+        A transfer of a byte range, a resumed one or a transfer by parts
+        is not compressed. */
+
+    volatile gint cancelled; /*!<
+        Set by lr_downloadtarget_cancel(), accessed only by
+        g_atomic_int_*() */
+
     // Items filled by downloader
 
+    gboolean notmodified; /*!<
+        The conditional target was not modified since its local copy
+        (the server answered 304), nothing was downloaded. */
+
     char *usedmirror; /*!<
         Used mirror. Filled only if transfer was successfull. */
 
@@ -124,6 +327,15 @@ typedef struct {
     char *err; /*!<
         NULL or error message */
 
+    GByteArray *data; /*!<
+        Downloaded data of a target without fd and fn. Filled only if
+        transfer was successfull (before the endcb is called). */
+
+    LrTransferStats stats; /*!<
+        Timing of the last transfer and number of transfers of the target.
+        For a target downloaded by parts, the timing is of the last
+        finished part. */
+
     // Other items
 
     void *userdata; /*!<
@@ -138,7 +350,9 @@ typedef struct {
  * @param baseurl           Base URL for relative path specified in path param
  * @param fd                Opened file descriptor where data will be written
  *                          or -1.
- *                          Note: Set this or fn, no both!
+ *                          Note: Set this or fn, no both! If none of them
+ *                          is set, the data are downloaded into memory
+ *                          (see the data member).
  * @param fn                Filename where data will be written or NULL.
  *                          Note: Set this or fd, no both!
  * @param possiblechecksums NULL or GSList with pointers to
@@ -195,12 +409,58 @@ lr_downloadtarget_new(LrHandle *handle,
                       gint64 byterangestart,
                       gint64 byterangeend);
 
+/** Create new empty ::LrDownloadTarget whose strings are stored in
+ * a chunk shared with other targets instead of a chunk of its own.
+ * A chunk per target is an allocation of its own which is too much
+ * for a huge number of small targets (see ::lr_download_stream).
+ * The pool is not freed with the targets, it must outlive all targets
+ * which use it and it must not be used by more threads at once.
+ * Strings of the targets are freed with the pool only, so use a new
+ * pool for a batch of targets time to time when they are created
+ * on the fly.
+ * @param pool              Shared chunk for the strings of the target
+ * @return                  New allocated target
+ * See ::lr_downloadtarget_new for the other params.
+ */
+LrDownloadTarget *
+lr_downloadtarget_new_pooled(GStringChunk *pool,
+                             LrHandle *handle,
+                             const char *path,
+                             const char *baseurl,
+                             int fd,
+                             const char *fn,
+                             GSList *possiblechecksums,
+                             gint64 expectedsize,
+                             gboolean resume,
+                             LrProgressCb progresscb,
+                             void *cbdata,
+                             LrEndCb endcb,
+                             LrMirrorFailureCb mirrorfailurecb,
+                             void *userdata,
+                             gint64 byterangestart,
+                             gint64 byterangeend);
+
 /** Free a ::LrDownloadTarget element and its content.
  * @param target        Target to free.
  */
 void
 lr_downloadtarget_free(LrDownloadTarget *target);
 
+/** Cancel the download of the target. It could be called from any
+ * thread and from the callbacks of the running download. A waiting
+ * target is not started, a running transfer of the target is stopped
+ * (the partial file is kept, so a later download of the target could
+ * resume it). The target fails with LRE_CANCELLED, its endcb is called
+ * with LR_TRANSFER_ERROR. Other targets continue even with failfast.
+ * A target whose data are already being verified, whose byte range is
+ * in flight in a multi-range request (LRO_MAXRANGESPERREQUEST) or
+ * which is already finished is not affected. A cancelled target cannot
+ * be downloaded anymore.
+ * @param target        Target to cancel.
+ */
+void
+lr_downloadtarget_cancel(LrDownloadTarget *target);
+
 G_END_DECLS
 
 #endif
@@ -28,6 +28,12 @@
 
 G_BEGIN_DECLS
 
+/** Number of calls of ::lr_downloadtarget_cancel in the process,
+ * accessed only by g_atomic_int_*(). Running downloads look for
+ * the cancelled targets when it changes.
+ */
+extern volatile gint lr_downloadtarget_cancellations;
+
 /** Helper function to comfortable setting of error to the ::LrDownloadTarget.
  */
 void
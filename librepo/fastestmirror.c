@@ -18,42 +18,119 @@
  * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
  */
 
+#define _XOPEN_SOURCE   700 // Because of mmap() and fchmod()
+
 #include <assert.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <float.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
 #include <curl/curl.h>
+#include <glib/gstdio.h>
 
 #include "util.h"
 #include "handle_internal.h"
 #include "rcodes.h"
 #include "fastestmirror.h"
 #include "fastestmirror_internal.h"
+#include "mirrorregistry_internal.h"
+#include "preresolve.h"
+#include "probes.h"
 
 #define LENGT_OF_MEASUREMENT        2.0    // Number of seconds (float point!)
 #define HALF_OF_SECOND_IN_MICROS    500000
+#define PROBE_REFERENCE_SIZE        (1024 * 1024) // Size of a download used
+                                                  // to compute the score
+#define PROBE_MIN_TRANSFER_TIME     0.001  // Lower bound of the probe
+                                           // transfer time (seconds)
+#define GROUP_RESOLVE_TIMEOUT       2      // Max wait for the resolution
+                                           // of the hosts (seconds)
 
-#define CACHE_GROUP_METADATA    ":_librepo_:"   // Group with metadata
-#define CACHE_KEY_TS            "ts"            // Timestamp
-#define CACHE_KEY_CONNECTTIME   "connectime"    // Time of reponse
-#define CACHE_KEY_VERSION       "version"       // Version of cache format
-
-#define CACHE_VERSION   1   // Current version of cache format
+#define CACHE_MAGIC     "LRFM"  // Magic of the cache file
+#define CACHE_VERSION   3       // Current version of cache format
 
 #define CACHE_RECORD_MAX_AGE    (LRO_FASTESTMIRRORMAXAGE_DEFAULT * 6)
 
+/** Binary cache file:
+ *  - LrFastestMirrorCacheHeader
+ *  - LrFastestMirrorCacheRecord records[nrecords]
+ *  - guint32 buckets[nbuckets] - open addressing hash table of the urls,
+ *    0 is an empty bucket, other values are indexes of records + 1
+ *  - string table with the zero terminated urls
+ *
+ * The file is mapped and used without any parsing. The records which
+ * are too old are skipped by the lookups and dropped by the next write.
+ * The byte order is native, a file from a machine with a different
+ * byte order looks like a file of an unknown version.
+ */
+typedef struct {
+    char magic[4];          /*!< CACHE_MAGIC */
+    guint32 version;        /*!< CACHE_VERSION */
+    guint32 nrecords;       /*!< Number of records */
+    guint32 nbuckets;       /*!< Number of hash buckets (power of two) */
+    guint64 strings_len;    /*!< Length of the string table */
+} LrFastestMirrorCacheHeader;
+
+struct _LrFastestMirrorCacheRecord {
+    gint64 ts;              /*!< Timestamp of the measurement */
+    double connecttime;     /*!< Plain connect time */
+    double ttfb;            /*!< Time to the first byte of the probe */
+    double throughput;      /*!< Throughput of the probe (bytes/s) */
+    guint32 url_offset;     /*!< Offset of the url in the string table */
+    guint32 url_len;        /*!< Length of the url */
+    guint32 flags;          /*!< CACHE_RECORD_* flags */
+    guint32 reserved;
+};
+
+#define CACHE_RECORD_PROBED     (1 << 0)    // Measured by a probe, ttfb
+                                            // and throughput are valid
+#define CACHE_RECORD_UNMEASURED  (1 << 1)   // The mirror wasn't measured,
+                                            // measure it next time
+#define CACHE_RECORD_PROBING    (1 << 2)    // A process is measuring the
+                                            // mirror right now (a claim)
+
+#define CACHE_LOCK_SUFFIX       ".lock" // Lock file of the cache
+#define CACHE_CLAIM_MAX_AGE     10      // Older claims are abandoned (seconds)
+#define CLAIM_WAIT_TIME         (LENGT_OF_MEASUREMENT + 1.0) // Max wait for
+                                        // results of the other processes
+#define CLAIM_POLL_INTERVAL     100000  // Microseconds
+
+/** Serializes the cache updates within the process, the fcntl() lock
+ * of the lock file serializes them between the processes.
+ */
+static GMutex cache_mutex;
+
+/** Mapped cache file.
+ */
 typedef struct {
+    void *map;
+    gsize map_len;
+    const LrFastestMirrorCacheHeader *hdr;
+    const LrFastestMirrorCacheRecord *records;
+    const guint32 *buckets;
+    const char *strings;
+} LrFastestMirrorCacheFile;
+
+struct _LrFastestMirrorCache {
     gchar *path;
-    GKeyFile *keyfile;
-} LrFastestMirrorCache;
+    LrFastestMirrorCacheFile file;  /*!< Cache as it was loaded */
+    GHashTable *updates;    /*!< url -> LrFastestMirrorCacheRecord
+                                 (url_* members are not used) */
+    gint64 current_time;    /*!< Time of the cache loading */
+};
 
 static LrFastestMirror *
 lr_lrfastestmirror_new()
 {
     LrFastestMirror *mirror = g_new0(LrFastestMirror, 1);
     mirror->plain_connect_time = 0.0;
+    mirror->ttfb = -1.0;
+    mirror->throughput = -1.0;
     mirror->cached = FALSE;
     return mirror;
 }
@@ -68,13 +145,147 @@ lr_lrfastestmirror_free(LrFastestMirror *mirror)
     g_free(mirror);
 }
 
+/** FNV-1a hash. It is a part of the cache format, it must not change.
+ */
+static guint32
+cache_hash(const char *str, gsize len)
+{
+    guint32 hash = 2166136261u;
+    for (gsize x = 0; x < len; x++) {
+        hash ^= (unsigned char) str[x];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+static void
+cache_file_unmap(LrFastestMirrorCacheFile *file)
+{
+    if (file->map)
+        munmap(file->map, file->map_len);
+    memset(file, 0, sizeof(*file));
+}
+
+/** Map the cache file and check its layout.
+ * @param msg       Set to a reason of the failure, NULL if the file
+ *                  doesn't exist
+ * @return          TRUE if the file was mapped
+ */
 static gboolean
+cache_file_map(const char *path,
+               LrFastestMirrorCacheFile *file,
+               const char **msg)
+{
+    struct stat st;
+    LrFastestMirrorCacheHeader hdr;
+    guint64 expected_len;
+    int fd;
+
+    memset(file, 0, sizeof(*file));
+    *msg = NULL;
+
+    fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        if (errno != ENOENT)
+            *msg = "Cannot open the cache";
+        return FALSE;
+    }
+
+    if (fstat(fd, &st) != 0 || (gsize) st.st_size < sizeof(hdr)) {
+        close(fd);
+        *msg = "File is not a fastestmirror cache";
+        return FALSE;
+    }
+
+    file->map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (file->map == MAP_FAILED) {
+        file->map = NULL;
+        *msg = "Cannot map the cache";
+        return FALSE;
+    }
+    file->map_len = st.st_size;
+
+    memcpy(&hdr, file->map, sizeof(hdr));
+    if (memcmp(hdr.magic, CACHE_MAGIC, sizeof(hdr.magic))) {
+        // The old GKeyFile based cache starts with the "[:_librepo_:]" group
+        *msg = (((char *) file->map)[0] == '[')
+               ? "Old version of cache format"
+               : "File is not a fastestmirror cache";
+        cache_file_unmap(file);
+        return FALSE;
+    }
+
+    if (hdr.version != CACHE_VERSION) {
+        g_debug("%s: Old cache version %d vs %d",
+                __func__, hdr.version, CACHE_VERSION);
+        *msg = "Old version of cache format";
+        cache_file_unmap(file);
+        return FALSE;
+    }
+
+    expected_len = sizeof(hdr)
+                   + (guint64) hdr.nrecords * sizeof(LrFastestMirrorCacheRecord)
+                   + (guint64) hdr.nbuckets * sizeof(guint32)
+                   + hdr.strings_len;
+    if (expected_len != (guint64) st.st_size
+        || (hdr.nbuckets & (hdr.nbuckets - 1))
+        || (hdr.nrecords && hdr.nbuckets <= hdr.nrecords))
+    {
+        *msg = "Corrupted cache";
+        cache_file_unmap(file);
+        return FALSE;
+    }
+
+    file->hdr = file->map;
+    file->records = (const LrFastestMirrorCacheRecord *) (file->hdr + 1);
+    file->buckets = (const guint32 *) (file->records + hdr.nrecords);
+    file->strings = (const char *) (file->buckets + hdr.nbuckets);
+
+    return TRUE;
+}
+
+/** Find the url in the mapped cache file.
+ */
+static const LrFastestMirrorCacheRecord *
+cache_file_lookup(const LrFastestMirrorCacheFile *file, const char *url)
+{
+    gsize len;
+    guint32 mask, pos;
+
+    if (!file->map || !file->hdr->nbuckets)
+        return NULL;
+
+    len = strlen(url);
+    mask = file->hdr->nbuckets - 1;
+    pos = cache_hash(url, len) & mask;
+
+    for (guint32 probe = 0; probe <= mask; probe++, pos = (pos + 1) & mask) {
+        guint32 idx = file->buckets[pos];
+        const LrFastestMirrorCacheRecord *rec;
+
+        if (idx == 0 || idx > file->hdr->nrecords)
+            return NULL;
+
+        rec = &file->records[idx - 1];
+        if (rec->url_len == len
+            && (guint64) rec->url_offset + len < file->hdr->strings_len
+            && !memcmp(file->strings + rec->url_offset, url, len))
+            return rec;
+    }
+
+    return NULL;
+}
+
+gboolean
 lr_fastestmirrorcache_load(LrFastestMirrorCache **cache,
                            gchar *path,
                            LrFastestMirrorCb cb,
                            void *cbdata,
                            GError **err)
 {
+    const char *msg;
+
     assert(cache);
     assert(!err || *err == NULL);
 
@@ -86,206 +297,606 @@ lr_fastestmirrorcache_load(LrFastestMirrorCache **cache,
 
     cb(cbdata, LR_FMSTAGE_CACHELOADING, path);
 
-    GKeyFile *keyfile = g_key_file_new();
-
     *cache = lr_malloc0(sizeof(LrFastestMirrorCache));
     (*cache)->path = g_strdup(path);
-    (*cache)->keyfile = keyfile;
-
-    if (!g_file_test(path, G_FILE_TEST_EXISTS)) {
+    (*cache)->updates = g_hash_table_new_full(g_str_hash, g_str_equal,
+                                              g_free, g_free);
+    (*cache)->current_time = g_get_real_time() / 1000000;
+
+    if (cache_file_map(path, &(*cache)->file, &msg)) {
+        g_debug("%s: Loaded: %u records",
+                __func__, (*cache)->file.hdr->nrecords);
+        cb(cbdata, LR_FMSTAGE_CACHELOADINGSTATUS, NULL);
+    } else if (msg) {
+        g_debug("%s: Cannot use fastestmirror cache %s: %s",
+                __func__, path, msg);
+        cb(cbdata, LR_FMSTAGE_CACHELOADINGSTATUS, (void *) msg);
+    } else {
         // Cache file doesn't exist
         cb(cbdata, LR_FMSTAGE_CACHELOADINGSTATUS,
            "Cache doesn't exist");
-    } else {
-        // Cache exists, try to load it
-
-        gboolean something_wrong = FALSE;
-        GError *tmp_err = NULL;
-        gboolean ret = g_key_file_load_from_file(keyfile,
-                                                 path,
-                                                 G_KEY_FILE_NONE,
-                                                 &tmp_err);
-        if (!ret) {
-            // Cannot parse cache file
-            char *msg = g_strdup_printf("Cannot parse fastestmirror "
-                                        "cache %s: %s", path, tmp_err->message);
-            g_debug("%s: %s", __func__, msg);
-            cb(cbdata, LR_FMSTAGE_CACHELOADINGSTATUS, msg);
-            something_wrong = TRUE;
-            g_free(msg);
-            g_error_free(tmp_err);
-        } else {
-            // File parsed successfully
-            if (!g_key_file_has_group(keyfile, CACHE_GROUP_METADATA)) {
-                // Not a fastestmirror cache
-                g_debug("%s: File %s is not a fastestmirror cache file",
-                          __func__, path);
-                cb(cbdata, LR_FMSTAGE_CACHELOADINGSTATUS,
-                   "File is not a fastestmirror cache");
-                something_wrong = TRUE;
-            } else {
-                int version = (int) g_key_file_get_integer(keyfile,
-                                                           CACHE_GROUP_METADATA,
-                                                           CACHE_KEY_VERSION,
-                                                           NULL);
-                if (version != CACHE_VERSION) {
-                    g_debug("%s: Old cache version %d vs %d",
-                            __func__, version, CACHE_VERSION);
-                    cb(cbdata, LR_FMSTAGE_CACHELOADINGSTATUS,
-                       "Old version of cache format");
-                    something_wrong = TRUE;
-                }
-            }
-        }
+    }
 
-        if (something_wrong) {
-            // Reinit keyfile
-            g_key_file_free(keyfile);
-            keyfile = g_key_file_new();
-            (*cache)->keyfile = keyfile;
-        } else {
-            gsize len;
-            gchar **array = g_key_file_get_groups(keyfile, &len);
-            g_debug("%s: Loaded: %"G_GSIZE_FORMAT" records", __func__, len);
-
-            // Remove really outdated records
-            gint64 current_time = g_get_real_time() / 1000000;
-            char **group, *groupname;
-            for (group=array; groupname=*group, groupname; group++) {
-                if (g_str_has_prefix(groupname, ":_"))
-                    continue;
-
-                gint64 ts = g_key_file_get_int64(keyfile,
-                                                 groupname,
-                                                 CACHE_KEY_TS,
-                                                 NULL);
-                if (ts < (current_time - CACHE_RECORD_MAX_AGE)) {
-                    // Record is too old, remove it
-                    g_debug("%s: Removing too old record from cache: %s "
-                            "(ts: %"G_GINT64_FORMAT")",
-                            __func__, groupname, ts);
-                    g_key_file_remove_group(keyfile, groupname, NULL);
-                }
-            }
-            g_strfreev(array);
+    return TRUE;
+}
 
-            cb(cbdata, LR_FMSTAGE_CACHELOADINGSTATUS, NULL);
-        }
+/** Find the record of the url.
+ * @return          The record or NULL if there is no record of the url
+ *                  or the record is too old.
+ */
+const LrFastestMirrorCacheRecord *
+lr_fastestmirrorcache_lookup(LrFastestMirrorCache *cache, gchar *url)
+{
+    const LrFastestMirrorCacheRecord *rec;
+
+    if (!cache || !url)
+        return NULL;
+
+    rec = g_hash_table_lookup(cache->updates, url);
+    if (!rec)
+        rec = cache_file_lookup(&cache->file, url);
+    if (!rec)
+        return NULL;
+
+    if (rec->ts < (cache->current_time - CACHE_RECORD_MAX_AGE)) {
+        // Record is too old, it will be dropped by the next write
+        g_debug("%s: Too old record in cache: %s (ts: %"G_GINT64_FORMAT")",
+                __func__, url, rec->ts);
+        return NULL;
     }
 
-    // Set version of cache format
-    g_key_file_set_integer(keyfile,
-                           CACHE_GROUP_METADATA,
-                           CACHE_KEY_VERSION,
-                           CACHE_VERSION);
+    return rec;
+}
+
+void
+lr_fastestmirrorcache_update(LrFastestMirrorCache *cache,
+                             LrFastestMirror *mirror,
+                             gint64 ts,
+                             guint32 flags)
+{
+    if (!cache || !mirror->url)
+        return;
 
-    return TRUE;
+    LrFastestMirrorCacheRecord *rec = g_new0(LrFastestMirrorCacheRecord, 1);
+    rec->ts = ts;
+    rec->connecttime = mirror->plain_connect_time;
+    rec->ttfb = mirror->ttfb;
+    rec->throughput = mirror->throughput;
+    rec->flags = flags;
+    g_hash_table_replace(cache->updates, g_strdup(mirror->url), rec);
 }
 
-static gboolean
-lr_fastestmirrorcache_lookup(LrFastestMirrorCache *cache,
-                             gchar *url,
-                             gint64 *ts,
-                             double *connecttime)
+/** Note the measurement of the url taken from the registry of the process.
+ */
+static void
+cache_update_registered(LrFastestMirrorCache *cache,
+                        const char *url,
+                        const LrMirrorMeasurement *measurement)
 {
-    if (!cache || !cache->keyfile || !url)
-        return FALSE;
+    if (!cache)
+        return;
 
-    GKeyFile *keyfile = cache->keyfile;
+    LrFastestMirrorCacheRecord *rec = g_new0(LrFastestMirrorCacheRecord, 1);
+    rec->ts = measurement->ts;
+    rec->connecttime = measurement->connecttime;
+    rec->ttfb = measurement->probed ? measurement->ttfb : -1.0;
+    rec->throughput = measurement->probed ? measurement->throughput : -1.0;
+    rec->flags = measurement->probed ? CACHE_RECORD_PROBED : 0;
+    g_hash_table_replace(cache->updates, g_strdup(url), rec);
+}
 
-    if (!g_key_file_has_group(keyfile, url))
-        return FALSE;
+/** Store the measurement of the mirror to the registry of the process.
+ */
+static void
+registry_update(const char *url,
+                const LrFastestMirrorCacheRecord *rec)
+{
+    LrMirrorMeasurement measurement;
+
+    measurement.ts = rec->ts;
+    measurement.connecttime = rec->connecttime;
+    measurement.ttfb = rec->ttfb;
+    measurement.throughput = rec->throughput;
+    measurement.probed = (rec->flags & CACHE_RECORD_PROBED) != 0;
+    lr_mirrorregistry_set_measurement(url, &measurement);
+}
 
-    gint64 l_ts;
-    double l_connecttime;
-    GError *tmp_err = NULL;
+/** Add the record to the merged records, a newer record wins.
+ */
+static void
+cache_merge_record(GHashTable *merged,
+                   const char *url,
+                   const LrFastestMirrorCacheRecord *rec,
+                   gint64 min_ts)
+{
+    LrFastestMirrorCacheRecord *old;
 
-    // Get timestamp
-    l_ts = g_key_file_get_int64(keyfile, url, CACHE_KEY_TS, &tmp_err);
-    if (tmp_err) {
-        g_error_free(tmp_err);
-        return FALSE;
-    }
+    if (rec->ts < min_ts)
+        return;  // Too old
 
-    // Get connect time
-    l_connecttime = (double) g_key_file_get_double(keyfile,
-                                                   url,
-                                                   CACHE_KEY_CONNECTTIME,
-                                                   &tmp_err);
-    if (tmp_err) {
-        g_error_free(tmp_err);
-        return FALSE;
+    old = g_hash_table_lookup(merged, url);
+    if (old && old->ts > rec->ts)
+        return;
+    if (old && (rec->flags & CACHE_RECORD_UNMEASURED)
+        && !(old->flags & (CACHE_RECORD_UNMEASURED | CACHE_RECORD_PROBING)))
+        return;  // Keep the last measurement
+
+    g_hash_table_replace(merged, (gpointer) url, (gpointer) rec);
+}
+
+/** Take the exclusive lock of the cache.
+ * @return          Descriptor of the lock file (-1 if the file cannot be
+ *                  locked, the cache is used without the lock then)
+ */
+static int
+cache_lock(LrFastestMirrorCache *cache)
+{
+    struct flock fl;
+    gchar *lockpath;
+    int fd;
+
+    g_mutex_lock(&cache_mutex);
+
+    lockpath = g_strconcat(cache->path, CACHE_LOCK_SUFFIX, NULL);
+    fd = open(lockpath, O_RDWR | O_CREAT, 0644);
+    if (fd == -1) {
+        g_debug("%s: Cannot open %s: %s", __func__, lockpath, g_strerror(errno));
+        g_free(lockpath);
+        return -1;
     }
+    g_free(lockpath);
 
-    *ts = l_ts;
-    *connecttime = l_connecttime;
+    memset(&fl, 0, sizeof(fl));
+    fl.l_type = F_WRLCK;
+    fl.l_whence = SEEK_SET;
 
-    return TRUE;
+    while (fcntl(fd, F_SETLKW, &fl) == -1) {
+        if (errno != EINTR) {
+            g_debug("%s: Cannot lock the cache: %s", __func__, g_strerror(errno));
+            close(fd);
+            return -1;
+        }
+    }
+
+    return fd;
 }
 
 static void
-lr_fastestmirrorcache_update(LrFastestMirrorCache *cache,
-                             gchar *url,
-                             gint64 ts,
-                             double connecttime)
+cache_unlock(int fd)
 {
-    if (!cache || !cache->keyfile || !url)
-        return;
-
-    GKeyFile *keyfile = cache->keyfile;
-
-    g_key_file_set_int64(keyfile, url, CACHE_KEY_TS, ts);
-    g_key_file_set_double(keyfile, url, CACHE_KEY_CONNECTTIME, connecttime);
+    if (fd != -1)
+        close(fd);  // Releases the lock
+    g_mutex_unlock(&cache_mutex);
 }
 
+/** Merge the updates with the current content of the file and replace it.
+ * Must be called with the cache locked.
+ */
 static gboolean
-lr_fastestmirrorcache_write(LrFastestMirrorCache *cache, GError **err)
+cache_write_locked(LrFastestMirrorCache *cache, GError **err)
 {
+    LrFastestMirrorCacheFile current;
+    LrFastestMirrorCacheHeader hdr;
+    GHashTable *merged;
+    GHashTableIter iter;
+    gpointer key, value;
+    GString *records, *strings;
+    guint32 *buckets;
+    const char *msg;
+    gchar *tmppath;
+    gboolean ret = TRUE;
+    int fd;
+
     assert(!err || *err == NULL);
 
-    if (!cache || !cache->keyfile)
-        return TRUE;
+    // Merge the updates with the current content of the file,
+    // it could be updated by another process meanwhile
+    if (!cache_file_map(cache->path, &current, &msg))
+        memset(&current, 0, sizeof(current));
+
+    gint64 min_ts = cache->current_time - CACHE_RECORD_MAX_AGE;
+    merged = g_hash_table_new(g_str_hash, g_str_equal);
+    for (guint32 x = 0; current.map && x < current.hdr->nrecords; x++) {
+        const LrFastestMirrorCacheRecord *rec = &current.records[x];
+        if ((guint64) rec->url_offset + rec->url_len >= current.hdr->strings_len
+            || current.strings[rec->url_offset + rec->url_len] != '\0')
+            continue;  // Invalid record
+        cache_merge_record(merged, current.strings + rec->url_offset,
+                           rec, min_ts);
+    }
 
-    // Gen cache content
-    GError *tmp_err = NULL;
-    gchar *content = g_key_file_to_data(cache->keyfile, NULL, &tmp_err);
-    if (tmp_err) {
-        g_propagate_error(err, tmp_err);
-        return FALSE;
+    g_hash_table_iter_init(&iter, cache->updates);
+    while (g_hash_table_iter_next(&iter, &key, &value))
+        cache_merge_record(merged, key, value, min_ts);
+
+    // Serialize
+    memset(&hdr, 0, sizeof(hdr));
+    memcpy(hdr.magic, CACHE_MAGIC, sizeof(hdr.magic));
+    hdr.version = CACHE_VERSION;
+    hdr.nrecords = g_hash_table_size(merged);
+    hdr.nbuckets = 0;
+    if (hdr.nrecords) {
+        hdr.nbuckets = 4;
+        while (hdr.nbuckets < hdr.nrecords * 2)
+            hdr.nbuckets *= 2;
     }
 
-    // Write cache
-    FILE *f = fopen(cache->path, "w");
-    if (!f) {
+    records = g_string_sized_new(hdr.nrecords * sizeof(LrFastestMirrorCacheRecord));
+    strings = g_string_new(NULL);
+    buckets = g_new0(guint32, hdr.nbuckets ? hdr.nbuckets : 1);
+
+    guint32 idx = 0;
+    g_hash_table_iter_init(&iter, merged);
+    while (g_hash_table_iter_next(&iter, &key, &value)) {
+        const LrFastestMirrorCacheRecord *src = value;
+        LrFastestMirrorCacheRecord rec;
+        gsize len = strlen(key);
+        guint32 mask = hdr.nbuckets - 1;
+        guint32 pos = cache_hash(key, len) & mask;
+
+        rec = *src;
+        rec.url_offset = strings->len;
+        rec.url_len = len;
+        g_string_append_len(strings, key, len + 1);
+        g_string_append_len(records, (const char *) &rec, sizeof(rec));
+
+        while (buckets[pos])
+            pos = (pos + 1) & mask;
+        buckets[pos] = ++idx;
+    }
+    hdr.strings_len = strings->len;
+
+    // Write to a temporary file and replace the cache atomically
+    tmppath = g_strconcat(cache->path, ".XXXXXX", NULL);
+    fd = g_mkstemp(tmppath);
+    if (fd < 0) {
         g_set_error(err, LR_FASTESTMIRROR_ERROR, LRE_IO,
-                    "Cannot open %s: %s", cache->path, strerror(errno));
-        return FALSE;
+                    "Cannot create %s: %s", tmppath, g_strerror(errno));
+        ret = FALSE;
+    } else {
+        gboolean ok = fchmod(fd, 0644) == 0
+            && write(fd, &hdr, sizeof(hdr)) == (ssize_t) sizeof(hdr)
+            && write(fd, records->str, records->len) == (ssize_t) records->len
+            && write(fd, buckets, hdr.nbuckets * sizeof(guint32))
+                    == (ssize_t) (hdr.nbuckets * sizeof(guint32))
+            && write(fd, strings->str, strings->len) == (ssize_t) strings->len;
+        ok = (close(fd) == 0) && ok;
+
+        if (!ok || rename(tmppath, cache->path) != 0) {
+            g_set_error(err, LR_FASTESTMIRROR_ERROR, LRE_IO,
+                        "Cannot write %s: %s", cache->path, g_strerror(errno));
+            unlink(tmppath);
+            ret = FALSE;
+        } else {
+            g_debug("%s: Written %u records", __func__, hdr.nrecords);
+        }
     }
 
-    fputs(content, f);
-    fclose(f);
-    g_free(content);
+    g_free(tmppath);
+    g_free(buckets);
+    g_string_free(strings, TRUE);
+    g_string_free(records, TRUE);
+    g_hash_table_destroy(merged);
+    cache_file_unmap(&current);
 
-    return TRUE;
+    return ret;
+}
+
+gboolean
+lr_fastestmirrorcache_write(LrFastestMirrorCache *cache, GError **err)
+{
+    gboolean ret;
+    int lockfd;
+
+    assert(!err || *err == NULL);
+
+    if (!cache || g_hash_table_size(cache->updates) == 0)
+        return TRUE;    // Nothing has changed
+
+    lockfd = cache_lock(cache);
+    ret = cache_write_locked(cache, err);
+    cache_unlock(lockfd);
+
+    return ret;
+}
+
+/** Reload the cache file (the file could be replaced by another process
+ * since it was loaded).
+ */
+static void
+cache_reload(LrFastestMirrorCache *cache)
+{
+    LrFastestMirrorCacheFile current;
+    const char *msg;
+
+    if (!cache_file_map(cache->path, &current, &msg))
+        memset(&current, 0, sizeof(current));
+    cache_file_unmap(&cache->file);
+    cache->file = current;
+}
+
+/** Claim the mirrors which are going to be measured, so that other
+ * processes with the same cache don't measure them at the same time.
+ * The claims are written to the cache file under its lock, after
+ * the file is reloaded:
+ *  - Mirrors which got a fresh record by another process meanwhile
+ *    are taken from the cache and not measured.
+ *  - Mirrors claimed by another process are not measured, they are
+ *    returned in the list of mirrors to wait for (see
+ *    lr_fastestmirrorcache_wait()).
+ *  - Other mirrors get our claim.
+ * @return          List of LrFastestMirror claimed by other processes
+ */
+static GSList *
+lr_fastestmirrorcache_claim(LrFastestMirrorCache *cache,
+                            GSList *mirrors,
+                            gint64 maxage,
+                            gboolean probe)
+{
+    GSList *waiting = NULL;
+    int lockfd;
+
+    if (!cache)
+        return NULL;
+
+    lockfd = cache_lock(cache);
+    cache_reload(cache);
+
+    gint64 now = g_get_real_time() / 1000000;
+    for (GSList *elem = mirrors; elem; elem = g_slist_next(elem)) {
+        LrFastestMirror *mirror = elem->data;
+        const LrFastestMirrorCacheRecord *rec;
+
+        if (!mirror->curl)
+            continue;   // Already known
+
+        rec = cache_file_lookup(&cache->file, mirror->url);
+        if (rec && (rec->flags & CACHE_RECORD_PROBING)) {
+            if (rec->ts >= (now - CACHE_CLAIM_MAX_AGE)) {
+                g_debug("%s: Measured by another process: %s",
+                        __func__, mirror->url);
+                curl_easy_cleanup(mirror->curl);
+                mirror->curl = NULL;
+                mirror->unmeasured = TRUE;
+                mirror->plain_connect_time = -1.0;
+                mirror->cached = TRUE;
+                waiting = g_slist_prepend(waiting, mirror);
+                continue;
+            }
+        } else if (rec
+                   && !(rec->flags & CACHE_RECORD_UNMEASURED)
+                   && rec->ts >= (now - maxage)
+                   && (!probe || (rec->flags & CACHE_RECORD_PROBED))) {
+            g_debug("%s: Refreshed by another process: %s",
+                    __func__, mirror->url);
+            curl_easy_cleanup(mirror->curl);
+            mirror->curl = NULL;
+            mirror->unmeasured = FALSE;
+            mirror->plain_connect_time = rec->connecttime;
+            if (probe) {
+                mirror->ttfb = rec->ttfb;
+                mirror->throughput = rec->throughput;
+            }
+            mirror->cached = TRUE;
+            continue;
+        }
+
+        LrFastestMirrorCacheRecord *claim = g_new0(LrFastestMirrorCacheRecord, 1);
+        claim->ts = now;
+        claim->connecttime = -1.0;
+        claim->ttfb = -1.0;
+        claim->throughput = -1.0;
+        claim->flags = CACHE_RECORD_PROBING;
+        g_hash_table_replace(cache->updates, g_strdup(mirror->url), claim);
+    }
+
+    if (g_hash_table_size(cache->updates) > 0)
+        cache_write_locked(cache, NULL);
+    cache_unlock(lockfd);
+
+    return waiting;
 }
 
+/** Wait (at most CLAIM_WAIT_TIME) for the results of the mirrors
+ * measured by other processes. Mirrors without results stay unmeasured.
+ */
 static void
+lr_fastestmirrorcache_wait(LrFastestMirrorCache *cache,
+                           GSList *waiting,
+                           gboolean probe)
+{
+    GTimer *timer = g_timer_new();
+
+    while (waiting) {
+        GSList *pending = NULL;
+
+        cache_reload(cache);
+        for (GSList *elem = waiting; elem; elem = g_slist_next(elem)) {
+            LrFastestMirror *mirror = elem->data;
+            const LrFastestMirrorCacheRecord *rec;
+
+            rec = cache_file_lookup(&cache->file, mirror->url);
+            if (rec && (rec->flags & CACHE_RECORD_PROBING)) {
+                pending = g_slist_prepend(pending, mirror);
+                continue;
+            }
+
+            if (rec && !(rec->flags & CACHE_RECORD_UNMEASURED)) {
+                mirror->unmeasured = FALSE;
+                mirror->plain_connect_time = rec->connecttime;
+                if (probe && (rec->flags & CACHE_RECORD_PROBED)) {
+                    mirror->ttfb = rec->ttfb;
+                    mirror->throughput = rec->throughput;
+                }
+            }
+        }
+
+        g_slist_free(waiting);
+        waiting = pending;
+
+        if (waiting) {
+            if (g_timer_elapsed(timer, NULL) >= CLAIM_WAIT_TIME) {
+                g_debug("%s: Results of %d mirrors were not received",
+                        __func__, g_slist_length(waiting));
+                g_slist_free(waiting);
+                break;
+            }
+            g_usleep(CLAIM_POLL_INTERVAL);
+        }
+    }
+
+    g_timer_destroy(timer);
+}
+
+void
 lr_fastestmirrorcache_free(LrFastestMirrorCache *cache)
 {
     if (!cache)
         return;
 
     g_free(cache->path);
-    g_key_file_free(cache->keyfile);
+    cache_file_unmap(&cache->file);
+    g_hash_table_destroy(cache->updates);
     g_free(cache);
 }
 
+/** State of a measurement of a mirror.
+ */
+typedef struct {
+    LrFastestMirror *mirror;
+    gboolean started;       /*!< Was the transfer started? */
+    gboolean delayed;       /*!< Was the transfer waiting for a free slot? */
+    double start_time;      /*!< Start of the transfer since the start
+                                 of the measurement */
+    gsize downloaded;       /*!< Bytes of the probe received */
+    gboolean done;          /*!< Has the transfer finished? */
+    CURLcode result;        /*!< Result of the finished transfer */
+} LrFastestMirrorProbe;
+
+static size_t
+probe_write_cb(G_GNUC_UNUSED char *ptr, size_t size, size_t nmemb, void *userdata)
+{
+    LrFastestMirrorProbe *mprobe = userdata;
+    size_t len = size * nmemb;
+
+    mprobe->downloaded += len;
+    if (mprobe->downloaded > LR_FASTESTMIRROR_PROBE_SIZE)
+        return 0;   // Server ignored the range, we have enough data
+
+    return len;
+}
+
+/** Set ttfb and throughput of the probed mirror.
+ * @param namelookup_time   Name lookup time of the transfer
+ * @param elapsed_time      How long the transfer runs, used for
+ *                          transfers which didn't finish in time
+ */
+static void
+lr_fastestmirror_probe_result(LrFastestMirrorProbe *mprobe,
+                              double namelookup_time,
+                              double elapsed_time)
+{
+    LrFastestMirror *mirror = mprobe->mirror;
+    double starttransfer_time, total_time, transfer_time;
+
+    mirror->ttfb = -1.0;
+    mirror->throughput = -1.0;
+
+    if (mprobe->done
+        && mprobe->result != CURLE_OK
+        && !(mprobe->result == CURLE_WRITE_ERROR
+             && mprobe->downloaded > LR_FASTESTMIRROR_PROBE_SIZE))
+    {
+        g_debug("%s: Probe of %s failed: %s", __func__, mirror->url,
+                curl_easy_strerror(mprobe->result));
+        return;
+    }
+
+    curl_easy_getinfo(mirror->curl, CURLINFO_STARTTRANSFER_TIME,
+                      &starttransfer_time);
+    if (mprobe->downloaded == 0 || starttransfer_time == 0.0) {
+        g_debug("%s: Probe of %s received no data", __func__, mirror->url);
+        return;
+    }
+
+    if (mprobe->done)
+        curl_easy_getinfo(mirror->curl, CURLINFO_TOTAL_TIME, &total_time);
+    else
+        total_time = elapsed_time;
+
+    transfer_time = MAX(total_time - starttransfer_time,
+                        PROBE_MIN_TRANSFER_TIME);
+    mirror->ttfb = starttransfer_time - namelookup_time;
+    mirror->throughput = (double) mprobe->downloaded / transfer_time;
+
+    g_debug("%s: %s: ttfb %f throughput %.0f B/s", __func__, mirror->url,
+            mirror->ttfb, mirror->throughput);
+}
+
+/** Settings of a measurement. They are copied from the handle,
+ * so the measurement can also run without it in a background thread
+ * (see lr_fastestmirror_refresh_start()).
+ */
+typedef struct {
+    CURL *curl;             /*!< Template of the curl handles or NULL */
+    CURLSH *share;          /*!< Share of the handle or NULL */
+    gchar *cachepath;       /*!< LRO_FASTESTMIRRORCACHE */
+    gchar *probe;           /*!< LRO_FASTESTMIRRORPROBE */
+    gint64 maxage;          /*!< LRO_FASTESTMIRRORMAXAGE */
+    long concurrency;       /*!< LRO_FASTESTMIRRORCONCURRENCY */
+    long goodcount;         /*!< LRO_FASTESTMIRRORGOODCOUNT */
+    gboolean async;         /*!< LRO_FASTESTMIRRORASYNC */
+    gboolean owned;         /*!< Are curl and the strings owned? */
+} LrFastestMirrorConfig;
+
+/** Init the config by (borrowed) settings of the handle.
+ */
+static void
+lr_fastestmirror_config_init(LrFastestMirrorConfig *config, LrHandle *handle)
+{
+    memset(config, 0, sizeof(*config));
+    config->maxage = LRO_FASTESTMIRRORMAXAGE_DEFAULT;
+    config->concurrency = LRO_FASTESTMIRRORCONCURRENCY_DEFAULT;
+    config->goodcount = LRO_FASTESTMIRRORGOODCOUNT_DEFAULT;
+
+    if (!handle)
+        return;
+
+    config->curl = lr_handle_curl(handle);
+    config->share = handle->curl_share;
+    config->cachepath = handle->fastestmirrorcache;
+    config->probe = handle->fastestmirrorprobe;
+    config->maxage = (gint64) handle->fastestmirrormaxage;
+    config->concurrency = handle->fastestmirrorconcurrency;
+    config->goodcount = handle->fastestmirrorgoodcount;
+    config->async = handle->fastestmirrorasync;
+}
+
+static void
+lr_fastestmirror_config_clear(LrFastestMirrorConfig *config)
+{
+    if (config->owned) {
+        if (config->curl)
+            curl_easy_cleanup(config->curl);
+        g_free(config->cachepath);
+        g_free(config->probe);
+    }
+    memset(config, 0, sizeof(*config));
+}
+
 /** Create list of LrFastestMirror based on input list of URLs.
+ * Results measured by the other handles of the process (see
+ * lr_mirrorregistry_get_measurement()) are used like the records
+ * of the cache if they are newer, and they are added to the cache.
+ * @param stale_urls    If not NULL, the mirrors with too old records
+ *                      in the cache use the records and their urls
+ *                      (copies) are prepended to the list
  */
 static gboolean
-lr_fastestmirror_prepare(LrHandle *handle,
+lr_fastestmirror_prepare(const LrFastestMirrorConfig *config,
                          GSList *in_list,
                          GSList **out_list,
+                         GSList **stale_urls,
                          LrFastestMirrorCache *cache,
                          GError **err)
 {
@@ -299,11 +910,12 @@ lr_fastestmirror_prepare(LrHandle *handle,
         return TRUE;
     }
 
-    gint64 maxage = LRO_FASTESTMIRRORMAXAGE_DEFAULT;
+    gint64 maxage = config->maxage;
     gint64 current_time = g_get_real_time() / 1000000;
+    const char *probe = config->probe;
+    char range[32];
 
-    if (handle)
-        maxage = (gint64) handle->fastestmirrormaxage;
+    g_snprintf(range, sizeof(range), "0-%d", LR_FASTESTMIRROR_PROBE_SIZE - 1);
 
     for (GSList *elem = in_list; elem; elem = g_slist_next(elem)) {
         gchar *url = elem->data;
@@ -312,30 +924,71 @@ lr_fastestmirror_prepare(LrHandle *handle,
 
         // TODO: For prefixed by "file://" - set plain_connect_time to zero
 
-        // Try to find item in the cache
-        gint64 ts;
-        double connecttime;
-        if (lr_fastestmirrorcache_lookup(cache, url, &ts, &connecttime)) {
-            if (ts >= (current_time - maxage)) {
+        // Try to find item in the registry and in the cache
+        const LrFastestMirrorCacheRecord *rec;
+        LrFastestMirrorCacheRecord registered;
+        LrMirrorMeasurement measurement;
+        gboolean from_registry = FALSE;
+        gboolean unmeasured = FALSE;
+        rec = lr_fastestmirrorcache_lookup(cache, url);
+        if (lr_mirrorregistry_get_measurement(url, &measurement)
+            && (!rec || rec->ts < measurement.ts
+                || (rec->flags & (CACHE_RECORD_UNMEASURED | CACHE_RECORD_PROBING))))
+        {
+            memset(&registered, 0, sizeof(registered));
+            registered.ts = measurement.ts;
+            registered.connecttime = measurement.connecttime;
+            registered.ttfb = measurement.ttfb;
+            registered.throughput = measurement.throughput;
+            registered.flags = measurement.probed ? CACHE_RECORD_PROBED : 0;
+            rec = &registered;
+            from_registry = TRUE;
+        }
+        if (rec) {
+            if (rec->flags & CACHE_RECORD_UNMEASURED) {
+                g_debug("%s: Not measured last time: %s", __func__, url);
+                unmeasured = TRUE;
+            } else if (rec->flags & CACHE_RECORD_PROBING) {
+                g_debug("%s: Being measured by another process: %s",
+                        __func__, url);
+            } else if (probe && !(rec->flags & CACHE_RECORD_PROBED)) {
+                g_debug("%s: Cached record was not probed: %s", __func__, url);
+            } else if (rec->ts < (current_time - maxage) && !stale_urls) {
+                g_debug("%s: Cached connect time too old: %s", __func__, url);
+            } else {
+                if (rec->ts < (current_time - maxage)) {
+                    // Use the stale record now, refresh it later
+                    g_debug("%s: Using stale cached record: %s",
+                            __func__, url);
+                    *stale_urls = g_slist_prepend(*stale_urls, g_strdup(url));
+                }
+
                 // Use cached entry
-                g_debug("%s: Using cached connect time for: %s (%f)",
-                        __func__, url, connecttime);
+                g_debug("%s: Using %s connect time for: %s (%f)", __func__,
+                        from_registry ? "registered" : "cached",
+                        url, rec->connecttime);
+                if (from_registry)
+                    cache_update_registered(cache, url, &measurement);
+                else
+                    registry_update(url, rec);
                 LrFastestMirror *mirror = lr_lrfastestmirror_new();
                 mirror->url = url;
                 mirror->curl = NULL;
-                mirror->plain_connect_time = connecttime;
+                mirror->plain_connect_time = rec->connecttime;
+                if (probe) {
+                    mirror->ttfb = rec->ttfb;
+                    mirror->throughput = rec->throughput;
+                }
                 mirror->cached = TRUE;
                 list = g_slist_append(list, mirror);
                 continue;
-            } else {
-                g_debug("%s: Cached connect time too old: %s", __func__, url);
             }
         } else {
             g_debug("%s: Not found in cache: %s", __func__, url);
         }
 
-        if (handle)
-            curlh = curl_easy_duphandle(handle->curl_handle);
+        if (config->curl)
+            curlh = curl_easy_duphandle(config->curl);
         else
             curlh = lr_get_curl_handle();
 
@@ -346,11 +999,30 @@ lr_fastestmirror_prepare(LrHandle *handle,
             break;
         }
 
+        // Always measure a new connection, a reused one would spoil
+        // the measurement. But do it within the share of the handle,
+        // the following downloads then get the DNS records, TLS sessions
+        // and (for the probes) the connections of the mirrors for free.
+        // Connect-only connections are never reused by libcurl, they
+        // are closed with their easy handles.
+        if (config->share)
+            curl_easy_setopt(curlh, CURLOPT_SHARE, config->share);
+        curl_easy_setopt(curlh, CURLOPT_FRESH_CONNECT, 1L);
+
         LrFastestMirror *mirror = lr_lrfastestmirror_new();
         mirror->url = url;
         mirror->curl = curlh;
+        mirror->unmeasured = unmeasured;  // Will be measured first
 
-        curlcode = curl_easy_setopt(curlh, CURLOPT_URL, url);
+        list = g_slist_append(list, mirror);
+
+        if (probe) {
+            gchar *probe_url = lr_pathconcat(url, probe, NULL);
+            curlcode = curl_easy_setopt(curlh, CURLOPT_URL, probe_url);
+            lr_free(probe_url);
+        } else {
+            curlcode = curl_easy_setopt(curlh, CURLOPT_URL, url);
+        }
         if (curlcode != CURLE_OK) {
             g_set_error(err, LR_FASTESTMIRROR_ERROR, LRE_CURL,
                         "curl_easy_setopt(_, CURLOPT_URL, %s) failed: %s",
@@ -359,6 +1031,16 @@ lr_fastestmirror_prepare(LrHandle *handle,
             break;
         }
 
+        if (probe) {
+            // Download only the beginning of the object, the write
+            // callback stops servers which don't support the ranges
+            curl_easy_setopt(curlh, CURLOPT_RANGE, range);
+            curl_easy_setopt(curlh, CURLOPT_FAILONERROR, 1L);
+            curl_easy_setopt(curlh, CURLOPT_NOBODY, 0L);
+            curl_easy_setopt(curlh, CURLOPT_WRITEFUNCTION, probe_write_cb);
+            continue;
+        }
+
         curlcode = curl_easy_setopt(curlh, CURLOPT_CONNECT_ONLY, 1);
         if (curlcode != CURLE_OK) {
             g_set_error(err, LR_FASTESTMIRROR_ERROR, LRE_CURL,
@@ -367,8 +1049,6 @@ lr_fastestmirror_prepare(LrHandle *handle,
             ret = FALSE;
             break;
         }
-
-        list = g_slist_append(list, mirror);
     }
 
     if (ret) {
@@ -382,12 +1062,134 @@ lr_fastestmirror_prepare(LrHandle *handle,
     return ret;
 }
 
+/** Estimated time of a download of PROBE_REFERENCE_SIZE bytes from
+ * the probed mirror or a negative value if the mirror wasn't probed.
+ */
+static double
+lr_fastestmirror_score(const LrFastestMirror *mirror)
+{
+    if (mirror->ttfb < 0.0 || mirror->throughput <= 0.0)
+        return -1.0;
+    return mirror->ttfb + PROBE_REFERENCE_SIZE / mirror->throughput;
+}
+
+/** Value the mirrors are sorted by, negative if the mirror has no
+ * usable measurement.
+ */
+static double
+lr_fastestmirror_metric(const LrFastestMirror *mirror, gboolean probe)
+{
+    if (mirror->unmeasured || mirror->plain_connect_time < 0.0)
+        return -1.0;
+    return probe ? lr_fastestmirror_score(mirror) : mirror->plain_connect_time;
+}
+
+/** Add the value to the ascending array of the best values,
+ * keep at most k values.
+ */
+static void
+best_values_add(GArray *best, guint k, double value)
+{
+    guint x = 0;
+
+    while (x < best->len && g_array_index(best, double, x) <= value)
+        x++;
+    if (x >= k)
+        return;
+
+    g_array_insert_val(best, x, value);
+    if (best->len > k)
+        g_array_set_size(best, k);
+}
+
+/** Can any of the running measurements beat the already known best
+ * mirrors? A transfer which hasn't received any data yet has its connect
+ * time (or the time to the first byte) at least as long as it runs.
+ */
+static gboolean
+lr_fastestmirror_can_beat(LrFastestMirrorProbe *probes,
+                          long nprobes,
+                          double worst_good,
+                          double elapsed_time)
+{
+    for (long x = 0; x < nprobes; x++) {
+        LrFastestMirrorProbe *mprobe = &probes[x];
+
+        if (!mprobe->started || mprobe->done)
+            continue;
+        if (mprobe->downloaded > 0
+            || (elapsed_time - mprobe->start_time) <= worst_good)
+            return TRUE;
+    }
+
+    return FALSE;
+}
+
+/** Fill the results of the measurement of the mirror.
+ */
+static void
+lr_fastestmirror_measured(LrFastestMirrorProbe *mprobe,
+                          gboolean probe,
+                          double elapsed_time)
+{
+    LrFastestMirror *mirror = mprobe->mirror;
+    CURL *curl = mirror->curl;
+
+    // Calculate plain_connect_time
+    char *effective_url;
+    curl_easy_getinfo(curl, CURLINFO_EFFECTIVE_URL, &effective_url);
+
+    if (!effective_url) {
+        // No effective url is most likely an error
+        mirror->plain_connect_time = -1.0;
+    } else if (g_str_has_prefix(effective_url, "file://")) {
+        // Local directories are considered to be the best mirrors
+        mirror->plain_connect_time = 0.0;
+        if (probe) {
+            mirror->ttfb = 0.0;
+            mirror->throughput = G_MAXDOUBLE;
+        }
+    } else {
+        // Get connect time
+        double namelookup_time;
+        double connect_time;
+        double plain_connect_time;
+        curl_easy_getinfo(curl, CURLINFO_NAMELOOKUP_TIME, &namelookup_time);
+        curl_easy_getinfo(curl, CURLINFO_CONNECT_TIME, &connect_time);
+
+        if (connect_time == 0.0) {
+            // Zero connect time is most likely an error
+            plain_connect_time = -1.0;
+        } else {
+            plain_connect_time = connect_time - namelookup_time;
+        }
+
+        mirror->plain_connect_time = plain_connect_time;
+        //g_debug("%s: name_lookup: %3.6f connect_time:  %3.6f (%3.6f) | %s",
+        //        __func__, namelookup_time, connect_time,
+        //        mirror->plain_connect_time, mirror->url);
+
+        if (probe && plain_connect_time >= 0.0)
+            lr_fastestmirror_probe_result(mprobe, namelookup_time,
+                                          elapsed_time - mprobe->start_time);
+    }
+
+    LR_PROBE2(fastestmirror__result, mirror->url,
+              mirror->plain_connect_time < 0.0 ? -1L
+                : (long) (mirror->plain_connect_time * G_USEC_PER_SEC));
+}
+
 static gboolean
 lr_fastestmirror_perform(GSList *list,
+                         gboolean probe,
+                         long concurrency,
+                         long goodcount,
                          LrFastestMirrorCb cb,
                          void *cbdata,
                          GError **err)
 {
+    gboolean ret = TRUE;
+
     assert(!err || *err == NULL);
 
     if (!list)
@@ -400,24 +1202,51 @@ lr_fastestmirror_perform(GSList *list,
         return FALSE;
     }
 
-    // Add curl easy handles to multi handle
+    // Prepare the queue of measurements, the mirrors which were
+    // not measured last time go first. Results of the cached mirrors
+    // are the initial best values.
     long handles_added = 0;
-    for (GSList *elem = list; elem; elem = g_slist_next(elem)) {
-        LrFastestMirror *mirror = elem->data;
-        if (mirror->curl) {
-            curl_multi_add_handle(multihandle, mirror->curl);
+    LrFastestMirrorProbe *probes = g_new0(LrFastestMirrorProbe,
+                                          g_slist_length(list));
+    GArray *best = g_array_new(FALSE, FALSE, sizeof(double));
+    for (int pass = 0; pass < 2; pass++) {
+        for (GSList *elem = list; elem; elem = g_slist_next(elem)) {
+            LrFastestMirror *mirror = elem->data;
+
+            if (!mirror->curl) {
+                if (pass == 0 && goodcount > 0
+                    && lr_fastestmirror_metric(mirror, probe) >= 0.0)
+                    best_values_add(best, goodcount,
+                                    lr_fastestmirror_metric(mirror, probe));
+                continue;
+            }
+
+            if (mirror->unmeasured != (pass == 0))
+                continue;
+
+            LrFastestMirrorProbe *mprobe = &probes[handles_added];
+            mprobe->mirror = mirror;
+            mirror->unmeasured = FALSE;
+            curl_easy_setopt(mirror->curl, CURLOPT_PRIVATE, mprobe);
+            if (probe)
+                curl_easy_setopt(mirror->curl, CURLOPT_WRITEDATA, mprobe);
             handles_added++;
         }
     }
 
     if (handles_added == 0) {
+        g_array_free(best, TRUE);
+        g_free(probes);
         curl_multi_cleanup(multihandle);
         return TRUE;
     }
 
     cb(cbdata, LR_FMSTAGE_DETECTION, (void *) &handles_added);
 
-    int still_running;
+    int still_running = 0;
+    long next = 0;          // Next measurement to start
+    long running = 0;       // Number of running measurements
+    gboolean early_stop = FALSE;
     gdouble elapsed_time = 0.0;
     GTimer *timer = g_timer_new();
     g_timer_start(timer);
@@ -429,6 +1258,18 @@ lr_fastestmirror_perform(GSList *list,
         long curl_timeout = -1;
         fd_set fdread, fdwrite, fdexcep;
 
+        // Start measurements up to the concurrency limit
+        while (next < handles_added
+               && (concurrency <= 0 || running < concurrency))
+        {
+            LrFastestMirrorProbe *mprobe = &probes[next++];
+            mprobe->started = TRUE;
+            mprobe->delayed = (elapsed_time > 0.0);
+            mprobe->start_time = elapsed_time;
+            curl_multi_add_handle(multihandle, mprobe->mirror->curl);
+            running++;
+        }
+
         FD_ZERO(&fdread);
         FD_ZERO(&fdwrite);
         FD_ZERO(&fdexcep);
@@ -442,8 +1283,8 @@ lr_fastestmirror_perform(GSList *list,
             g_set_error(err, LR_FASTESTMIRROR_ERROR, LRE_CURLM,
                         "curl_multi_timeout() error: %s",
                         curl_multi_strerror(cm_rc));
-            curl_multi_cleanup(multihandle);
-            return FALSE;
+            ret = FALSE;
+            break;
         }
 
         // Set timeout to a reasonable value
@@ -466,7 +1307,8 @@ lr_fastestmirror_perform(GSList *list,
             g_set_error(err, LR_FASTESTMIRROR_ERROR, LRE_CURLM,
                         "curl_multi_fdset() error: %s",
                         curl_multi_strerror(cm_rc));
-            return FALSE;
+            ret = FALSE;
+            break;
         }
 
         rc = select(maxfd+1, &fdread, &fdwrite, &fdexcep, &timeout);
@@ -476,7 +1318,8 @@ lr_fastestmirror_perform(GSList *list,
             } else {
                 g_set_error(err, LR_FASTESTMIRROR_ERROR, LRE_SELECT,
                             "select() error: %s", strerror(errno));
-                return FALSE;
+                ret = FALSE;
+                break;
             }
         }
 
@@ -485,56 +1328,81 @@ lr_fastestmirror_perform(GSList *list,
         // Break loop after some reasonable amount of time
         elapsed_time = g_timer_elapsed(timer, NULL);
 
-    } while(still_running && elapsed_time < LENGT_OF_MEASUREMENT);
+        // Process the finished measurements
+        CURLMsg *msg;
+        int msgs_left;
+        while ((msg = curl_multi_info_read(multihandle, &msgs_left))) {
+            LrFastestMirrorProbe *mprobe = NULL;
+            if (msg->msg != CURLMSG_DONE)
+                continue;
+            curl_easy_getinfo(msg->easy_handle, CURLINFO_PRIVATE, &mprobe);
+            if (!mprobe)
+                continue;
+
+            mprobe->done = TRUE;
+            mprobe->result = msg->data.result;
+            running--;
 
-    g_timer_destroy(timer);
+            lr_fastestmirror_measured(mprobe, probe, elapsed_time);
+            double metric = lr_fastestmirror_metric(mprobe->mirror, probe);
+            if (goodcount > 0 && metric >= 0.0)
+                best_values_add(best, goodcount, metric);
+        }
 
-    // Remove curl easy handles from multi handle
-    // and calculate plain_connect_time
-    for (GSList *elem = list; elem; elem = g_slist_next(elem)) {
-        LrFastestMirror *mirror = elem->data;
-        CURL *curl = mirror->curl;
+        // Stop if enough good mirrors are known and the running
+        // measurements cannot beat them
+        if (goodcount > 0
+            && best->len >= (guint) goodcount
+            && !lr_fastestmirror_can_beat(probes, handles_added,
+                                          g_array_index(best, double,
+                                                        best->len - 1),
+                                          elapsed_time))
+        {
+            g_debug("%s: %ld good mirrors found, stopping the measurement "
+                    "after %f s", __func__, goodcount, elapsed_time);
+            early_stop = TRUE;
+            break;
+        }
+
+    } while((still_running || next < handles_added)
+            && elapsed_time < LENGT_OF_MEASUREMENT);
+
+    g_timer_destroy(timer);
 
-        if (!curl)
+    // Remove curl easy handles from multi handle and calculate
+    // results of the unfinished measurements.
+    // Mirrors which didn't get a fair chance (they were not started,
+    // the measurement was stopped early or they waited for a free slot)
+    // are marked as unmeasured.
+    for (long x = 0; x < handles_added; x++) {
+        LrFastestMirrorProbe *mprobe = &probes[x];
+        LrFastestMirror *mirror = mprobe->mirror;
+
+        if (!mprobe->started) {
+            mirror->unmeasured = TRUE;
+            mirror->plain_connect_time = -1.0;
             continue;
+        }
 
         // Remove handle
-        curl_multi_remove_handle(multihandle, curl);
+        curl_multi_remove_handle(multihandle, mirror->curl);
 
-        // Calculate plain_connect_time
-        char *effective_url;
-        curl_easy_getinfo(curl, CURLINFO_EFFECTIVE_URL, &effective_url);
+        if (!ret || mprobe->done)
+            continue;
 
-        if (!effective_url) {
-            // No effective url is most likely an error
+        lr_fastestmirror_measured(mprobe, probe, elapsed_time);
+        if (lr_fastestmirror_metric(mirror, probe) < 0.0
+            && (early_stop || mprobe->delayed))
+        {
+            mirror->unmeasured = TRUE;
             mirror->plain_connect_time = -1.0;
-        } else if (g_str_has_prefix(effective_url, "file://")) {
-            // Local directories are considered to be the best mirrors
-            mirror->plain_connect_time = 0.0;
-        } else {
-            // Get connect time
-            double namelookup_time;
-            double connect_time;
-            double plain_connect_time;
-            curl_easy_getinfo(curl, CURLINFO_NAMELOOKUP_TIME, &namelookup_time);
-            curl_easy_getinfo(curl, CURLINFO_CONNECT_TIME, &connect_time);
-
-            if (connect_time == 0.0) {
-                // Zero connect time is most likely an error
-                plain_connect_time = -1.0;
-            } else {
-                plain_connect_time = connect_time - namelookup_time;
-            }
-
-            mirror->plain_connect_time = plain_connect_time;
-            //g_debug("%s: name_lookup: %3.6f connect_time:  %3.6f (%3.6f) | %s",
-            //        __func__, namelookup_time, connect_time,
-            //        mirror->plain_connect_time, mirror->url);
         }
     }
 
+    g_array_free(best, TRUE);
+    g_free(probes);
     curl_multi_cleanup(multihandle);
-    return TRUE;
+    return ret;
 }
 
 static void
@@ -546,6 +1414,17 @@ null_cb(G_GNUC_UNUSED void *clientp,
 }
 
 
+static gint
+cmp_doubles(double a, double b)
+{
+    if (a < b)
+        return -1;
+    else if (a == b)
+        return 0;
+    else
+        return 1;
+}
+
 static gint
 cmp_fastestmirrors(gconstpointer a,
                    gconstpointer b)
@@ -555,6 +1434,16 @@ cmp_fastestmirrors(gconstpointer a,
     double a_ct = a_mirror->plain_connect_time;
     double b_ct = b_mirror->plain_connect_time;
 
+    // Unmeasured mirrors go after the measured ones
+    // but before the unreachable ones
+    if (a_mirror->unmeasured || b_mirror->unmeasured) {
+        if (a_mirror->unmeasured && b_mirror->unmeasured)
+            return 0;
+        if (a_mirror->unmeasured)
+            return (b_ct < 0.0) ? -1 : 1;
+        return (a_ct < 0.0) ? 1 : -1;
+    }
+
     if (a_ct < 0.0 && b_ct < 0.0)
         return 0;
     if (a_ct < 0.0)
@@ -562,14 +1451,206 @@ cmp_fastestmirrors(gconstpointer a,
     if (b_ct < 0.0)
         return -1;
 
-    if (a_ct < b_ct)
+    // Successfully probed mirrors go first, sorted by the score
+    double a_score = lr_fastestmirror_score(a_mirror);
+    double b_score = lr_fastestmirror_score(b_mirror);
+
+    if (a_score >= 0.0 && b_score >= 0.0)
+        return cmp_doubles(a_score, b_score);
+    if (a_score >= 0.0)
         return -1;
-    else if (a_ct == b_ct)
-        return 0;
-    else
+    if (b_score >= 0.0)
         return 1;
+
+    return cmp_doubles(a_ct, b_ct);
+}
+
+
+/** Measure the mirrors (those without usable cache records),
+ * sort them and update the cache.
+ */
+static gboolean
+lr_fastestmirror_measure(const LrFastestMirrorConfig *config,
+                         LrFastestMirrorCache *cache,
+                         GSList *inlist,
+                         GSList **outlist,
+                         GSList **stale_urls,
+                         LrFastestMirrorCb cb,
+                         void *cbdata,
+                         GError **err)
+{
+    gboolean ret;
+    gboolean probe = config->probe != NULL;
+
+    // Prepare list of LrFastestMirror elements
+    GSList *lrfastestmirrors;
+    ret = lr_fastestmirror_prepare(config, inlist, &lrfastestmirrors,
+                                   stale_urls, cache, err);
+    if (!ret) {
+        cb(cbdata, LR_FMSTAGE_STATUS, "Error while lr_fastestmirror_prepare()");
+        g_debug("%s: Error while lr_fastestmirror_prepare()", __func__);
+        return FALSE;
+    }
+
+    // Don't measure the mirrors other processes sharing the cache
+    // measure right now or measured meanwhile
+    GSList *waiting = lr_fastestmirrorcache_claim(cache, lrfastestmirrors,
+                                                  config->maxage, probe);
+
+    ret = lr_fastestmirror_perform(lrfastestmirrors, probe,
+                                   config->concurrency, config->goodcount,
+                                   cb, cbdata, err);
+    if (!ret) {
+        cb(cbdata, LR_FMSTAGE_STATUS, "Error while detection");
+        g_debug("%s: Error while lr_fastestmirror_perform()", __func__);
+        // Release our claims
+        gint64 ts = g_get_real_time() / 1000000;
+        for (GSList *elem = lrfastestmirrors; elem; elem = g_slist_next(elem)) {
+            LrFastestMirror *mirror = elem->data;
+            if (mirror->cached == FALSE)
+                lr_fastestmirrorcache_update(cache, mirror, ts,
+                                             CACHE_RECORD_UNMEASURED);
+        }
+        lr_fastestmirrorcache_write(cache, NULL);
+        g_slist_free(waiting);
+        g_slist_free_full(lrfastestmirrors,
+                          (GDestroyNotify)lr_lrfastestmirror_free);
+        return FALSE;
+    }
+
+    lr_fastestmirrorcache_wait(cache, waiting, probe);
+
+    cb(cbdata, LR_FMSTAGE_FINISHING, NULL);
+
+    // Sort the mirrors by the connection time or by the probe score
+    lrfastestmirrors = g_slist_sort(lrfastestmirrors, cmp_fastestmirrors);
+
+    // Update cache and the registry of the process
+    gint64 ts = g_get_real_time() / 1000000; // TimeStamp
+    for (GSList *elem = lrfastestmirrors; elem; elem = g_slist_next(elem)) {
+        LrFastestMirror *mirror = elem->data;
+        if (mirror->cached == FALSE) {
+            guint32 flags = 0;
+            if (mirror->unmeasured)
+                flags = CACHE_RECORD_UNMEASURED;
+            else if (probe)
+                flags = CACHE_RECORD_PROBED;
+            lr_fastestmirrorcache_update(cache, mirror, ts, flags);
+
+            if (!mirror->unmeasured) {
+                LrMirrorMeasurement measurement;
+                measurement.ts = ts;
+                measurement.connecttime = mirror->plain_connect_time;
+                measurement.ttfb = mirror->ttfb;
+                measurement.throughput = mirror->throughput;
+                measurement.probed = probe;
+                lr_mirrorregistry_set_measurement(mirror->url, &measurement);
+            }
+        }
+    }
+
+    lr_fastestmirrorcache_write(cache, NULL);
+
+    *outlist = lrfastestmirrors;
+
+    return TRUE;
+}
+
+/** Background refresh of stale cache records.
+ */
+typedef struct {
+    LrFastestMirrorConfig config;   /*!< Owned copy of the settings */
+    GSList *urls;                   /*!< Urls to measure (owned) */
+    gint *running;                  /*!< Cleared when the refresh ends */
+} LrFastestMirrorRefresh;
+
+static gpointer
+lr_fastestmirror_refresh_thread(gpointer data)
+{
+    LrFastestMirrorRefresh *refresh = data;
+    LrFastestMirrorCache *cache = NULL;
+    GSList *mirrors = NULL;
+    GError *tmp_err = NULL;
+
+    lr_fastestmirrorcache_load(&cache, refresh->config.cachepath,
+                               null_cb, NULL, NULL);
+    if (!lr_fastestmirror_measure(&refresh->config, cache, refresh->urls,
+                                  &mirrors, NULL, null_cb, NULL, &tmp_err))
+    {
+        g_debug("%s: Refresh failed: %s", __func__, tmp_err->message);
+        g_error_free(tmp_err);
+    }
+
+    g_debug("%s: Refreshed %d mirrors", __func__, g_slist_length(mirrors));
+    g_slist_free_full(mirrors, (GDestroyNotify)lr_lrfastestmirror_free);
+    lr_fastestmirrorcache_free(cache);
+    lr_fastestmirror_config_clear(&refresh->config);
+    g_slist_free_full(refresh->urls, g_free);
+    g_atomic_int_set(refresh->running, 0);
+    g_free(refresh);
+
+    return NULL;
+}
+
+/** Start a background refresh of the urls (the list is taken over).
+ * The thread doesn't use the share of the handle (it has no locking)
+ * and it is joined by lr_fastestmirror_refresh_join().
+ */
+static void
+lr_fastestmirror_refresh_start(LrHandle *handle,
+                               const LrFastestMirrorConfig *config,
+                               GSList *urls)
+{
+    GError *tmp_err = NULL;
+
+    if (handle->fastestmirrorthread) {
+        if (g_atomic_int_get(&handle->fastestmirrorthread_running)) {
+            g_debug("%s: Previous refresh is still running", __func__);
+            g_slist_free_full(urls, g_free);
+            return;
+        }
+        lr_fastestmirror_refresh_join(handle);
+    }
+
+    LrFastestMirrorRefresh *refresh = g_new0(LrFastestMirrorRefresh, 1);
+    refresh->config = *config;
+    refresh->config.curl = config->curl ? curl_easy_duphandle(config->curl) : NULL;
+    refresh->config.share = NULL;
+    refresh->config.cachepath = g_strdup(config->cachepath);
+    refresh->config.probe = g_strdup(config->probe);
+    refresh->config.async = FALSE;
+    refresh->config.owned = TRUE;
+    refresh->urls = urls;
+    refresh->running = &handle->fastestmirrorthread_running;
+
+    g_atomic_int_set(refresh->running, 1);
+    handle->fastestmirrorthread = g_thread_try_new("lr_fastestmirror",
+                                                   lr_fastestmirror_refresh_thread,
+                                                   refresh,
+                                                   &tmp_err);
+    if (!handle->fastestmirrorthread) {
+        g_debug("%s: Cannot start the refresh: %s", __func__, tmp_err->message);
+        g_error_free(tmp_err);
+        g_atomic_int_set(refresh->running, 0);
+        lr_fastestmirror_config_clear(&refresh->config);
+        g_slist_free_full(refresh->urls, g_free);
+        g_free(refresh);
+        return;
+    }
+
+    g_debug("%s: Refreshing %d stale mirrors in background",
+            __func__, g_slist_length(urls));
 }
 
+void
+lr_fastestmirror_refresh_join(LrHandle *handle)
+{
+    if (!handle || !handle->fastestmirrorthread)
+        return;
+
+    g_thread_join(handle->fastestmirrorthread);
+    handle->fastestmirrorthread = NULL;
+}
 
 gboolean
 lr_fastestmirror_detailed(LrHandle *handle,
@@ -579,12 +1660,13 @@ lr_fastestmirror_detailed(LrHandle *handle,
 {
     assert(!err || *err == NULL);
 
-    char *fastestmirrorcache = NULL;
+    LrFastestMirrorConfig config;
     LrFastestMirrorCb cb = null_cb;
     void *cbdata = NULL;
 
+    lr_fastestmirror_config_init(&config, handle);
+
     if (handle) {
-        fastestmirrorcache = handle->fastestmirrorcache;
         if (handle->fastestmirrorcb)
             cb = handle->fastestmirrorcb;
         cbdata = handle->fastestmirrordata;
@@ -602,7 +1684,7 @@ lr_fastestmirror_detailed(LrHandle *handle,
     gboolean ret;
     LrFastestMirrorCache *cache = NULL;
     ret = lr_fastestmirrorcache_load(&cache,
-                                     fastestmirrorcache,
+                                     config.cachepath,
                                      cb,
                                      cbdata,
                                      err);
@@ -611,51 +1693,59 @@ lr_fastestmirror_detailed(LrHandle *handle,
         return FALSE;
     }
 
-    // Prepare list of LrFastestMirror elements
-    GSList *lrfastestmirrors;
-    ret = lr_fastestmirror_prepare(handle, inlist, &lrfastestmirrors, cache, err);
-    if (!ret) {
-        cb(cbdata, LR_FMSTAGE_STATUS, "Error while lr_fastestmirror_prepare()");
-        g_debug("%s: Error while lr_fastestmirror_prepare()", __func__);
-        lr_fastestmirrorcache_free(cache);
-        return FALSE;
-    }
+    // Stale records are served right away and refreshed in background
+    // in the async mode (it makes sense only with a cache)
+    GSList *stale_urls = NULL;
+    gboolean async = config.async && cache;
 
-    ret = lr_fastestmirror_perform(lrfastestmirrors, cb, cbdata, err);
+    ret = lr_fastestmirror_measure(&config, cache, inlist, outlist,
+                                   async ? &stale_urls : NULL,
+                                   cb, cbdata, err);
+    lr_fastestmirrorcache_free(cache);
     if (!ret) {
-        cb(cbdata, LR_FMSTAGE_STATUS, "Error while detection");
-        g_debug("%s: Error while lr_fastestmirror_perform()", __func__);
-        g_slist_free_full(lrfastestmirrors,
-                          (GDestroyNotify)lr_lrfastestmirror_free);
-        lr_fastestmirrorcache_free(cache);
+        g_slist_free_full(stale_urls, g_free);
         return FALSE;
     }
 
-    cb(cbdata, LR_FMSTAGE_FINISHING, NULL);
+    if (stale_urls)
+        lr_fastestmirror_refresh_start(handle, &config, stale_urls);
 
-    // Sort the mirrors by the connection time
-    lrfastestmirrors = g_slist_sort(lrfastestmirrors, cmp_fastestmirrors);
+    cb(cbdata, LR_FMSTAGE_STATUS, NULL);
 
-    // Update cache
-    gint64 ts = g_get_real_time() / 1000000; // TimeStamp
-    for (GSList *elem = lrfastestmirrors; elem; elem = g_slist_next(elem)) {
-        LrFastestMirror *mirror = elem->data;
-        if (mirror->cached == FALSE) {
-            lr_fastestmirrorcache_update(cache,
-                                         mirror->url,
-                                         ts,
-                                         mirror->plain_connect_time);
-        }
+    return TRUE;
+}
+
+gboolean
+lr_fastestmirror_refresh(LrHandle *handle, GSList *urls, GError **err)
+{
+    LrFastestMirrorConfig config;
+    LrFastestMirrorCache *cache = NULL;
+    GSList *mirrors = NULL;
+    gboolean ret;
+
+    assert(!err || *err == NULL);
+
+    lr_fastestmirror_config_init(&config, handle);
+    if (!config.cachepath) {
+        g_debug("%s: No fastestmirror cache, nothing to refresh", __func__);
+        return TRUE;
     }
 
-    lr_fastestmirrorcache_write(cache, NULL);
-    lr_fastestmirrorcache_free(cache);
+    if (!urls)
+        return TRUE;
 
-    *outlist = lrfastestmirrors;
+    ret = lr_fastestmirrorcache_load(&cache, config.cachepath,
+                                     null_cb, NULL, err);
+    if (!ret)
+        return FALSE;
 
-    cb(cbdata, LR_FMSTAGE_STATUS, NULL);
+    ret = lr_fastestmirror_measure(&config, cache, urls, &mirrors, NULL,
+                                   null_cb, NULL, err);
 
-    return TRUE;
+    g_slist_free_full(mirrors, (GDestroyNotify)lr_lrfastestmirror_free);
+    lr_fastestmirrorcache_free(cache);
+
+    return ret;
 }
 
 
@@ -691,18 +1781,119 @@ lr_fastestmirror(LrHandle *handle,
     return TRUE;
 }
 
+/** Add the registered measurements of the urls to the cache file
+ * (a cache of a handle other than the one which measured them).
+ * Errors are only logged.
+ */
+static void
+lr_fastestmirror_store_registered(gchar *path, GSList *urls)
+{
+    LrFastestMirrorCache *cache = NULL;
+    GError *tmp_err = NULL;
+
+    lr_fastestmirrorcache_load(&cache, path, null_cb, NULL, NULL);
+
+    for (GSList *elem = urls; elem; elem = g_slist_next(elem)) {
+        const LrFastestMirrorCacheRecord *rec;
+        LrMirrorMeasurement measurement;
+
+        if (!lr_mirrorregistry_get_measurement(elem->data, &measurement))
+            continue;
+        rec = lr_fastestmirrorcache_lookup(cache, elem->data);
+        if (!rec || rec->ts < measurement.ts)
+            cache_update_registered(cache, elem->data, &measurement);
+    }
+
+    g_debug("%s: Storing %u measurements to %s", __func__,
+            g_hash_table_size(cache->updates), path);
+    if (!lr_fastestmirrorcache_write(cache, &tmp_err)) {
+        g_debug("%s: Cannot write %s: %s", __func__, path, tmp_err->message);
+        g_error_free(tmp_err);
+    }
+    lr_fastestmirrorcache_free(cache);
+}
+
 gboolean
 lr_fastestmirror_sort_internalmirrorlist(LrHandle *handle,
                                          GError **err)
 {
     assert(!err || *err == NULL);
+    gint64 start = g_get_monotonic_time();
     GSList *list = g_slist_prepend(NULL, handle);
     gboolean ret = lr_fastestmirror_sort_internalmirrorlists(list, err);
     g_slist_free(list);
 
+    lr_trace_span(handle->trace, "handle", "fastestmirror",
+                  start, g_get_monotonic_time(),
+                  "error", (!ret && err && *err) ? (*err)->message : NULL,
+                  NULL);
+
     return ret;
 }
 
+/** Group the hosts served by the same server. Connect times of hosts
+ * with the same address are the same, the probes of them also need
+ * the same scheme (e.g. http and https of a host are probed
+ * separately). Hosts of a CDN are grouped by the edge they resolve to.
+ * @param hosts     Hosts (URLs without path) in the mirrorlist order
+ * @return          Table: the first host of a group -> GSList of
+ *                  the other hosts of the group (borrowed strings),
+ *                  every host is in exactly one group
+ */
+static GHashTable *
+lr_fastestmirror_group_hosts(LrHandle *handle,
+                             GPtrArray *hosts,
+                             gboolean probe)
+{
+    GHashTable *groups = g_hash_table_new_full(g_str_hash, g_str_equal,
+                                               NULL,
+                                               (GDestroyNotify) g_slist_free);
+    GHashTable *addresses = lr_preresolve_addresses(handle, hosts,
+                                                    GROUP_RESOLVE_TIMEOUT);
+    GHashTable *leaders = g_hash_table_new_full(g_str_hash, g_str_equal,
+                                                g_free, NULL);
+
+    for (guint x = 0; x < hosts->len; x++) {
+        gchar *host = g_ptr_array_index(hosts, x);
+        gchar **addrs = g_hash_table_lookup(addresses, host);
+
+        if (!addrs) {
+            // Not resolved, measured alone
+            g_hash_table_insert(groups, host, NULL);
+            continue;
+        }
+
+        // The lowest address identifies the server, the addresses of
+        // a host name are the same whatever its alias is
+        gchar *key;
+        if (probe)
+            key = g_strdup_printf("%.*s%s",
+                                  (int) (strstr(host, "://") - host + 3),
+                                  host, addrs[0]);
+        else
+            key = g_strdup(addrs[0]);
+
+        gchar *leader = g_hash_table_lookup(leaders, key);
+        if (!leader) {
+            g_hash_table_insert(leaders, key, host);
+            g_hash_table_insert(groups, host, NULL);
+            continue;
+        }
+
+        g_debug("%s: %s is measured by %s (%s)", __func__, host, leader, key);
+        GSList *members = g_hash_table_lookup(groups, leader);
+        if (members)
+            members = g_slist_append(members, host);  // The head is kept
+        else
+            g_hash_table_insert(groups, leader, g_slist_append(NULL, host));
+        g_free(key);
+    }
+
+    g_hash_table_destroy(leaders);
+    g_hash_table_destroy(addresses);
+    return groups;
+}
+
 gboolean
 lr_fastestmirror_sort_internalmirrorlists(GSList *handles,
                                           GError **err)
@@ -719,49 +1910,70 @@ lr_fastestmirror_sort_internalmirrorlists(GSList *handles,
                                             // test is used from the first
                                             // handle
 
-    // Prepare list of hosts
+    // Prepare list of hosts (host -> url of its first mirror)
     gchar *fastestmirrorcache = main_handle->fastestmirrorcache;
-    GHashTable *hosts_ht = g_hash_table_new_full(g_str_hash,
-                                                 g_str_equal,
-                                                 g_free,
-                                                 NULL);
+    gboolean probe = main_handle->fastestmirrorprobe != NULL;
+    GHashTable *hosts_ht = g_hash_table_new(g_str_hash, g_str_equal);
+    GPtrArray *hosts = g_ptr_array_new();   // In the mirrorlist order
+    GPtrArray *other_caches = g_ptr_array_new(); // Caches of the other
+                                            // handles, they get the results
+                                            // from the registry
 
     for (GSList *ehandle = handles; ehandle; ehandle = g_slist_next(ehandle)) {
         LrHandle *handle = ehandle->data;
         GSList *mirrors = handle->internal_mirrorlist;
         for (GSList *elem = mirrors; elem; elem = g_slist_next(elem)) {
             LrInternalMirror *imirror = elem->data;
-            gchar *host = lr_url_without_path(imirror->url);
-            g_hash_table_insert(hosts_ht, host, NULL);
+            if (!g_hash_table_contains(hosts_ht, imirror->host)) {
+                g_hash_table_insert(hosts_ht, imirror->host, imirror->url);
+                g_ptr_array_add(hosts, imirror->host);
+            }
         }
 
-        // Cache related warning
-        if (fastestmirrorcache) {
-            if (handle->fastestmirrorcache
-                && g_strcmp0(fastestmirrorcache, handle->fastestmirrorcache))
-                g_warning("%s: Multiple fastestmirror caches are specified! "
-                          "Used one is %s (%s is ignored)", __func__,
-                          fastestmirrorcache, handle->fastestmirrorcache);
-        } else {
-            if (handle->fastestmirrorcache)
-                g_warning("%s: First handle doesn't have a fastestmirror "
-                          "cache specified but other one has: %s",
-                          __func__, handle->fastestmirrorcache);
+        // The measurement uses the cache of the first handle,
+        // the other caches are updated after it
+        if (handle->fastestmirrorcache
+            && g_strcmp0(fastestmirrorcache, handle->fastestmirrorcache))
+        {
+            gboolean known = FALSE;
+            for (guint x = 0; x < other_caches->len && !known; x++)
+                known = !g_strcmp0(g_ptr_array_index(other_caches, x),
+                                   handle->fastestmirrorcache);
+            if (!known) {
+                g_debug("%s: Results are stored also to %s", __func__,
+                        handle->fastestmirrorcache);
+                g_ptr_array_add(other_caches, handle->fastestmirrorcache);
+            }
         }
     }
 
-    GList *tmp_list_of_urls = g_hash_table_get_keys(hosts_ht);
+    // Only one host of the hosts served by the same server is measured
+    GHashTable *groups = NULL;
+    if (hosts->len > 1)
+        groups = lr_fastestmirror_group_hosts(main_handle, hosts, probe);
+
+    // The probe needs a full url of a mirror, a plain connect
+    // to the host is enough otherwise
     GSList *list_of_urls = NULL;
     int number_of_mirrors = 0;
-    for (GList *elem = tmp_list_of_urls; elem; elem = g_list_next(elem)) {
-        list_of_urls = g_slist_prepend(list_of_urls, elem->data);
+    for (guint x = 0; groups && x < hosts->len; x++) {
+        gchar *host = g_ptr_array_index(hosts, x);
+        if (!g_hash_table_contains(groups, host))
+            continue;
+        list_of_urls = g_slist_prepend(list_of_urls,
+                                       probe ? g_hash_table_lookup(hosts_ht, host)
+                                             : host);
         number_of_mirrors++;
     }
-    g_list_free(tmp_list_of_urls);
+    list_of_urls = g_slist_reverse(list_of_urls);
+    g_ptr_array_free(hosts, TRUE);
 
     if (number_of_mirrors <= 1) {
         // Nothing to do
         g_slist_free(list_of_urls);
+        g_ptr_array_free(other_caches, TRUE);
+        if (groups)
+            g_hash_table_destroy(groups);
         g_hash_table_destroy(hosts_ht);
         g_timer_destroy(timer);
         return TRUE;
@@ -774,11 +1986,40 @@ lr_fastestmirror_sort_internalmirrorlists(GSList *handles,
     if (!ret) {
         g_debug("%s: lr_fastestmirror failed", __func__);
         g_slist_free(list_of_urls);
+        g_ptr_array_free(other_caches, TRUE);
+        g_hash_table_destroy(groups);
         g_hash_table_destroy(hosts_ht);
         g_timer_destroy(timer);
         return FALSE;
     }
 
+    for (guint x = 0; x < other_caches->len; x++)
+        lr_fastestmirror_store_registered(g_ptr_array_index(other_caches, x),
+                                          list_of_urls);
+    g_ptr_array_free(other_caches, TRUE);
+
+    if (probe) {
+        // Convert the sorted mirror urls back to the hosts
+        for (GSList *elem = list_of_urls; elem; elem = g_slist_next(elem)) {
+            gchar *host = lr_url_without_path(elem->data);
+            gpointer orig_host = NULL;
+            g_hash_table_lookup_extended(hosts_ht, host, &orig_host, NULL);
+            elem->data = orig_host;
+            g_free(host);
+        }
+    }
+
+    // The other hosts of a group follow the measured one
+    for (GSList *elem = list_of_urls; elem; elem = g_slist_next(elem)) {
+        GSList *members = g_hash_table_lookup(groups, elem->data);
+        for (GSList *m = members; m; m = g_slist_next(m)) {
+            list_of_urls = g_slist_insert_before(list_of_urls,
+                                                 g_slist_next(elem),
+                                                 m->data);
+            elem = g_slist_next(elem);
+        }
+    }
+
     // Apply sorted order to each handle
     for (GSList *ehandle = handles; ehandle; ehandle = g_slist_next(ehandle)) {
         LrHandle *handle = ehandle->data;
@@ -788,8 +2029,7 @@ lr_fastestmirror_sort_internalmirrorlists(GSList *handles,
             gchar *host = elem->data;
             for (GSList *ime = mirrors; ime; ime = g_slist_next(ime)) {
                 LrInternalMirror *im = ime->data;
-                gchar *im_host = lr_url_without_path(im->url);
-                if (!g_strcmp0(im_host, host)) {
+                if (!g_strcmp0(im->host, host)) {
                     new_list = g_slist_prepend(new_list, im);
                     // XXX: Maybe convert GSList to GList to make
                     // this delete more efficient
@@ -815,6 +2055,7 @@ lr_fastestmirror_sort_internalmirrorlists(GSList *handles,
     }
 
     g_slist_free(list_of_urls);
+    g_hash_table_destroy(groups);
     g_hash_table_destroy(hosts_ht);
 
     g_timer_stop(timer);
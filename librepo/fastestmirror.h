@@ -36,6 +36,13 @@ typedef struct {
     CURL *curl;                 // Curl handle or NULL
     double plain_connect_time;  // Mirror connect time (<0.0 if connection was unsuccessfull)
     gboolean cached;            // Was connect time load from cache?
+    double ttfb;                // Time to the first byte of the probe
+                                // (<0.0 if not probed or the probe failed)
+    double throughput;          // Throughput of the probe in bytes/s
+                                // (<0.0 if not probed or the probe failed)
+    gboolean unmeasured;        // The mirror wasn't measured in time (see
+                                // LRO_FASTESTMIRRORCONCURRENCY), its
+                                // plain_connect_time is -1.0
 } LrFastestMirror;
 
 
@@ -71,6 +78,22 @@ lr_fastestmirror_detailed(LrHandle *handle,
                           GSList **outlist,
                           GError **err);
 
+/** Measure the mirrors again and update the fastestmirror cache
+ * (LRO_FASTESTMIRRORCACHE) of the handle. It is what runs in the
+ * background with LRO_FASTESTMIRRORASYNC, it can be called by the user
+ * e.g. when the system is idle. Mirrors with fresh enough records in
+ * the cache (LRO_FASTESTMIRRORMAXAGE) are not measured.
+ * @param handle    Handle with the fastestmirror settings
+ * @param urls      List of urls (char *)
+ * @param err       GError **
+ * @return          FALSE on error, TRUE otherwise (also when
+ *                  there is no cache to refresh)
+ */
+gboolean
+lr_fastestmirror_refresh(LrHandle *handle,
+                         GSList *urls,
+                         GError **err);
+
 
 G_END_DECLS
 
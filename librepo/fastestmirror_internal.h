@@ -24,9 +24,48 @@
 #include <glib.h>
 
 #include "handle.h"
+#include "fastestmirror.h"
 
 G_BEGIN_DECLS
 
+/** Loaded cache of the measurements (see LRO_FASTESTMIRRORCACHE) */
+typedef struct _LrFastestMirrorCache LrFastestMirrorCache;
+
+/** Measurement of a mirror stored in the cache */
+typedef struct _LrFastestMirrorCacheRecord LrFastestMirrorCacheRecord;
+
+/** Load (map) the cache file. A missing or unusable file is not an error,
+ * the cache is empty then. *cache is NULL if the path is NULL.
+ */
+gboolean
+lr_fastestmirrorcache_load(LrFastestMirrorCache **cache,
+                           gchar *path,
+                           LrFastestMirrorCb cb,
+                           void *cbdata,
+                           GError **err);
+
+/** Find the record of the url. NULL if there is none or it is too old.
+ */
+const LrFastestMirrorCacheRecord *
+lr_fastestmirrorcache_lookup(LrFastestMirrorCache *cache, gchar *url);
+
+/** Note the measurement of the mirror, it is stored by the next
+ * lr_fastestmirrorcache_write().
+ */
+void
+lr_fastestmirrorcache_update(LrFastestMirrorCache *cache,
+                             LrFastestMirror *mirror,
+                             gint64 ts,
+                             guint32 flags);
+
+/** Merge the updates with the current cache file and write it.
+ */
+gboolean
+lr_fastestmirrorcache_write(LrFastestMirrorCache *cache, GError **err);
+
+void
+lr_fastestmirrorcache_free(LrFastestMirrorCache *cache);
+
 gboolean
 lr_fastestmirror_sort_internalmirrorlist(LrHandle *handle,
                                          GError **err);
@@ -38,6 +77,12 @@ gboolean
 lr_fastestmirror_sort_internalmirrorlists(GSList *handles,
                                           GError **err);
 
+/** Wait for the background refresh of the fastestmirror cache
+ * (see LRO_FASTESTMIRRORASYNC) started by the handle, if any.
+ */
+void
+lr_fastestmirror_refresh_join(LrHandle *handle);
+
 G_END_DECLS
 
 #endif
@@ -31,32 +31,57 @@
 #include "rcodes.h"
 #include "util.h"
 #include "gpg.h"
+#include "gpg_internal.h"
+
+#ifdef ENABLE_BUILTIN_GPG
+#define LR_GPGBACKEND_DEFAULT_BACKEND   LR_GPGBACKEND_BUILTIN
+#else
+#define LR_GPGBACKEND_DEFAULT_BACKEND   LR_GPGBACKEND_GPGME
+#endif
+
+/** Verifier of signatures with a keyring. */
+struct _LrGpgVerifier {
+    char *home_dir; /*!<
+        Configuration directory or NULL */
+    GSList *contexts; /*!<
+        Idle contexts of the keyring. A context cannot be used by more
+        threads simultaneously, another one is created for a check
+        running in parallel. */
+    GMutex lock; /*!<
+        Lock of the contexts */
+};
+
+/** Verifiers of lr_gpg_check_signature_fd(), one per home_dir
+ * (NULL is ""), they live until the end of the process. */
+static GHashTable *verifiers = NULL;
+G_LOCK_DEFINE_STATIC(verifiers);
+
+static gpointer
+gpg_init_once(G_GNUC_UNUSED gpointer data)
+{
+    gpgme_check_version(NULL);
+    return GINT_TO_POINTER(gpgme_engine_check_version(GPGME_PROTOCOL_OpenPGP));
+}
 
-gboolean
-lr_gpg_check_signature_fd(int signature_fd,
-                          int data_fd,
-                          const char *home_dir,
-                          GError **err)
+/** Create a context for the home_dir. The engine is checked only once
+ * per process.
+ */
+static gpgme_ctx_t
+gpg_context_new(const char *home_dir, GError **err)
 {
+    static GOnce init = G_ONCE_INIT;
     gpgme_error_t gpgerr;
     gpgme_ctx_t context;
-    gpgme_data_t signature_data;
-    gpgme_data_t data_data;
-    gpgme_verify_result_t result;
-    gpgme_signature_t sig;
-
-    assert(!err || *err == NULL);
 
     // Initialization
-    gpgme_check_version(NULL);
-    gpgerr = gpgme_engine_check_version(GPGME_PROTOCOL_OpenPGP);
+    gpgerr = GPOINTER_TO_INT(g_once(&init, gpg_init_once, NULL));
     if (gpgerr != GPG_ERR_NO_ERROR) {
         g_debug("%s: gpgme_engine_check_version: %s",
                  __func__, gpgme_strerror(gpgerr));
         g_set_error(err, LR_GPG_ERROR, LRE_GPGNOTSUPPORTED,
                     "gpgme_engine_check_version() error: %s",
                     gpgme_strerror(gpgerr));
-        return FALSE;
+        return NULL;
     }
 
     gpgerr = gpgme_new(&context);
@@ -64,7 +89,7 @@ lr_gpg_check_signature_fd(int signature_fd,
         g_debug("%s: gpgme_new: %s", __func__, gpgme_strerror(gpgerr));
         g_set_error(err, LR_GPG_ERROR, LRE_GPGERROR,
                     "gpgme_new() error: %s", gpgme_strerror(gpgerr));
-        return FALSE;
+        return NULL;
     }
 
     gpgerr = gpgme_set_protocol(context, GPGME_PROTOCOL_OpenPGP);
@@ -73,7 +98,7 @@ lr_gpg_check_signature_fd(int signature_fd,
         g_set_error(err, LR_GPG_ERROR, LRE_GPGERROR,
                     "gpgme_set_protocol() error: %s", gpgme_strerror(gpgerr));
         gpgme_release(context);
-        return FALSE;
+        return NULL;
     }
 
     if (home_dir) {
@@ -86,12 +111,59 @@ lr_gpg_check_signature_fd(int signature_fd,
                         "gpgme_ctx_set_engine_info() error: %s",
                         gpgme_strerror(gpgerr));
             gpgme_release(context);
-            return FALSE;
+            return NULL;
         }
     }
 
     gpgme_set_armor(context, 1);
 
+    return context;
+}
+
+LrGpgVerifier *
+lr_gpg_verifier_new(const char *home_dir, GError **err)
+{
+    LrGpgVerifier *verifier;
+    gpgme_ctx_t context;
+
+    assert(!err || *err == NULL);
+
+    context = gpg_context_new(home_dir, err);
+    if (!context)
+        return NULL;
+
+    verifier = lr_malloc0(sizeof(*verifier));
+    verifier->home_dir = g_strdup(home_dir);
+    verifier->contexts = g_slist_prepend(NULL, context);
+    g_mutex_init(&verifier->lock);
+    return verifier;
+}
+
+void
+lr_gpg_verifier_free(LrGpgVerifier *verifier)
+{
+    if (!verifier)
+        return;
+    g_slist_free_full(verifier->contexts, (GDestroyNotify) gpgme_release);
+    g_mutex_clear(&verifier->lock);
+    g_free(verifier->home_dir);
+    lr_free(verifier);
+}
+
+/** Check the signature by the context.
+ */
+static gboolean
+context_check_signature_fd(gpgme_ctx_t context,
+                           int signature_fd,
+                           int data_fd,
+                           GError **err)
+{
+    gpgme_error_t gpgerr;
+    gpgme_data_t signature_data;
+    gpgme_data_t data_data;
+    gpgme_verify_result_t result;
+    gpgme_signature_t sig;
+
     gpgerr = gpgme_data_new_from_fd(&signature_data, signature_fd);
     if (gpgerr != GPG_ERR_NO_ERROR) {
         g_debug("%s: gpgme_data_new_from_fd: %s",
@@ -99,7 +171,6 @@ lr_gpg_check_signature_fd(int signature_fd,
         g_set_error(err, LR_GPG_ERROR, LRE_GPGERROR,
                     "gpgme_data_new_from_fd(_, %d) error: %s",
                     signature_fd, gpgme_strerror(gpgerr));
-        gpgme_release(context);
         return FALSE;
     }
 
@@ -111,7 +182,6 @@ lr_gpg_check_signature_fd(int signature_fd,
                     "gpgme_data_new_from_fd(_, %d) error: %s",
                     data_fd, gpgme_strerror(gpgerr));
         gpgme_data_release(signature_data);
-        gpgme_release(context);
         return FALSE;
     }
 
@@ -123,7 +193,6 @@ lr_gpg_check_signature_fd(int signature_fd,
         g_debug("%s: gpgme_op_verify: %s", __func__, gpgme_strerror(gpgerr));
         g_set_error(err, LR_GPG_ERROR, LRE_GPGERROR,
                     "gpgme_op_verify() error: %s", gpgme_strerror(gpgerr));
-        gpgme_release(context);
         return FALSE;
     }
 
@@ -133,7 +202,6 @@ lr_gpg_check_signature_fd(int signature_fd,
         g_set_error(err, LR_GPG_ERROR, LRE_GPGERROR,
                     "gpgme_op_verify_result() error: %s",
                     gpgme_strerror(gpgerr));
-        gpgme_release(context);
         return FALSE;
     }
 
@@ -143,7 +211,6 @@ lr_gpg_check_signature_fd(int signature_fd,
         g_debug("%s: signature verify error (no signatures)", __func__);
         g_set_error(err, LR_GPG_ERROR, LRE_BADGPG,
                     "Signature verify error - no signatures");
-        gpgme_release(context);
         return FALSE;
     }
 
@@ -154,22 +221,128 @@ lr_gpg_check_signature_fd(int signature_fd,
             (sig->summary & GPGME_SIGSUM_GREEN) ||  // Valid
             (sig->summary == 0 && sig->status == GPG_ERR_NO_ERROR)) // Valid but key is not certified with a trusted signature
         {
-            gpgme_release(context);
             return TRUE;
         }
     }
 
-    gpgme_release(context);
     g_debug("%s: Bad GPG signature", __func__);
     g_set_error(err, LR_GPG_ERROR, LRE_BADGPG, "Bad GPG signature");
     return FALSE;
 }
 
 gboolean
-lr_gpg_check_signature(const char *signature_fn,
-                       const char *data_fn,
-                       const char *home_dir,
-                       GError **err)
+lr_gpg_verifier_check_signature_fd(LrGpgVerifier *verifier,
+                                   int signature_fd,
+                                   int data_fd,
+                                   GError **err)
+{
+    gboolean ret;
+    gpgme_ctx_t context = NULL;
+
+    assert(verifier);
+    assert(!err || *err == NULL);
+
+    // Take an idle context or create a new one
+    g_mutex_lock(&verifier->lock);
+    if (verifier->contexts) {
+        context = verifier->contexts->data;
+        verifier->contexts = g_slist_delete_link(verifier->contexts,
+                                                 verifier->contexts);
+    }
+    g_mutex_unlock(&verifier->lock);
+
+    if (!context) {
+        context = gpg_context_new(verifier->home_dir, err);
+        if (!context)
+            return FALSE;
+    }
+
+    ret = context_check_signature_fd(context, signature_fd, data_fd, err);
+
+    g_mutex_lock(&verifier->lock);
+    verifier->contexts = g_slist_prepend(verifier->contexts, context);
+    g_mutex_unlock(&verifier->lock);
+
+    return ret;
+}
+
+/** Check the signature by GPGME with the cached verifier of the home_dir.
+ */
+static gboolean
+gpgme_check_signature_fd(int signature_fd,
+                         int data_fd,
+                         const char *home_dir,
+                         GError **err)
+{
+    LrGpgVerifier *verifier;
+    const char *key = home_dir ? home_dir : "";
+
+    assert(!err || *err == NULL);
+
+    G_LOCK(verifiers);
+    if (!verifiers)
+        verifiers = g_hash_table_new_full(g_str_hash, g_str_equal, g_free,
+                                          (GDestroyNotify) lr_gpg_verifier_free);
+    verifier = g_hash_table_lookup(verifiers, key);
+    if (!verifier) {
+        verifier = lr_gpg_verifier_new(home_dir, err);
+        if (verifier)
+            g_hash_table_insert(verifiers, g_strdup(key), verifier);
+    }
+    G_UNLOCK(verifiers);
+
+    if (!verifier)
+        return FALSE;
+
+    return lr_gpg_verifier_check_signature_fd(verifier, signature_fd,
+                                              data_fd, err);
+}
+
+gboolean
+lr_gpg_check_signature_fd_v2(int signature_fd,
+                             int data_fd,
+                             const char *home_dir,
+                             LrGpgBackend backend,
+                             GError **err)
+{
+    assert(!err || *err == NULL);
+
+    if (backend == LR_GPGBACKEND_DEFAULT)
+        backend = LR_GPGBACKEND_DEFAULT_BACKEND;
+
+    if (backend == LR_GPGBACKEND_BUILTIN) {
+        switch (lr_gpg_builtin_check_signature_fd(signature_fd, data_fd,
+                                                  home_dir, err)) {
+        case LR_GPG_BUILTIN_VALID:
+            return TRUE;
+        case LR_GPG_BUILTIN_BAD:
+            return FALSE;
+        case LR_GPG_BUILTIN_UNKNOWN:
+            g_debug("%s: Signature cannot be verified in-process, "
+                    "using GPGME", __func__);
+            break;
+        }
+    }
+
+    return gpgme_check_signature_fd(signature_fd, data_fd, home_dir, err);
+}
+
+gboolean
+lr_gpg_check_signature_fd(int signature_fd,
+                          int data_fd,
+                          const char *home_dir,
+                          GError **err)
+{
+    return lr_gpg_check_signature_fd_v2(signature_fd, data_fd, home_dir,
+                                        LR_GPGBACKEND_DEFAULT, err);
+}
+
+gboolean
+lr_gpg_check_signature_v2(const char *signature_fn,
+                          const char *data_fn,
+                          const char *home_dir,
+                          LrGpgBackend backend,
+                          GError **err)
 {
     gboolean ret;
     int signature_fd, data_fd;
@@ -197,7 +370,8 @@ lr_gpg_check_signature(const char *signature_fn,
         return FALSE;
     }
 
-    ret = lr_gpg_check_signature_fd(signature_fd, data_fd, home_dir, err);
+    ret = lr_gpg_check_signature_fd_v2(signature_fd, data_fd, home_dir,
+                                       backend, err);
 
     close(signature_fd);
     close(data_fd);
@@ -205,6 +379,130 @@ lr_gpg_check_signature(const char *signature_fn,
     return ret;
 }
 
+gboolean
+lr_gpg_check_signature(const char *signature_fn,
+                       const char *data_fn,
+                       const char *home_dir,
+                       GError **err)
+{
+    return lr_gpg_check_signature_v2(signature_fn, data_fn, home_dir,
+                                     LR_GPGBACKEND_DEFAULT, err);
+}
+
+/** Verify the job.
+ */
+static void
+gpg_job_verify(LrGpgJob *job)
+{
+    job->valid = lr_gpg_check_signature_v2(job->signature_fn,
+                                           job->data_fn,
+                                           job->home_dir,
+                                           job->backend,
+                                           &job->error);
+}
+
+struct _LrGpgBatch {
+    GThreadPool *pool; /*!<
+        Worker threads or NULL (jobs are verified by lr_gpg_batch_push) */
+    GAsyncQueue *finished; /*!<
+        Finished jobs */
+    guint pending; /*!<
+        Number of the jobs which weren't popped yet */
+};
+
+static void
+gpg_batch_worker(gpointer data, gpointer user_data)
+{
+    LrGpgJob *job = data;
+    LrGpgBatch *batch = user_data;
+
+    gpg_job_verify(job);
+    g_async_queue_push(batch->finished, job);
+}
+
+LrGpgBatch *
+lr_gpg_batch_new(guint threads)
+{
+    LrGpgBatch *batch = lr_malloc0(sizeof(*batch));
+    GError *tmp_err = NULL;
+
+    if (threads == 0)
+        threads = g_get_num_processors();
+
+    batch->finished = g_async_queue_new();
+    if (threads > 1) {
+        batch->pool = g_thread_pool_new(gpg_batch_worker, batch,
+                                        (gint) threads, FALSE, &tmp_err);
+        if (!batch->pool) {
+            g_debug("%s: Cannot create thread pool: %s", __func__,
+                    tmp_err->message);
+            g_error_free(tmp_err);
+        }
+    }
+
+    return batch;
+}
+
+void
+lr_gpg_batch_push(LrGpgBatch *batch, LrGpgJob *job)
+{
+    assert(batch);
+    assert(job);
+
+    job->valid = FALSE;
+    job->error = NULL;
+    batch->pending++;
+
+    if (!batch->pool || !g_thread_pool_push(batch->pool, job, NULL))
+        gpg_batch_worker(job, batch);
+}
+
+LrGpgJob *
+lr_gpg_batch_pop(LrGpgBatch *batch)
+{
+    assert(batch);
+
+    if (!batch->pending)
+        return NULL;
+
+    batch->pending--;
+    return g_async_queue_pop(batch->finished);
+}
+
+void
+lr_gpg_batch_free(LrGpgBatch *batch)
+{
+    if (!batch)
+        return;
+
+    // Wait for the running jobs
+    if (batch->pool)
+        g_thread_pool_free(batch->pool, FALSE, TRUE);
+    g_async_queue_unref(batch->finished);
+    lr_free(batch);
+}
+
+void
+lr_gpg_check_signatures(GSList *jobs, guint threads)
+{
+    guint count = g_slist_length(jobs);
+    LrGpgBatch *batch;
+
+    if (threads == 0)
+        threads = g_get_num_processors();
+    threads = MIN(threads, count);
+
+    g_debug("%s: Verifying %u signatures by %u threads",
+            __func__, count, threads);
+
+    batch = lr_gpg_batch_new(threads);
+    for (GSList *elem = jobs; elem; elem = g_slist_next(elem))
+        lr_gpg_batch_push(batch, elem->data);
+    while (lr_gpg_batch_pop(batch))
+        ;
+    lr_gpg_batch_free(batch);
+}
+
 gboolean
 lr_gpg_import_key(const char *key_fn, const char *home_dir, GError **err)
 {
@@ -215,49 +513,9 @@ lr_gpg_import_key(const char *key_fn, const char *home_dir, GError **err)
 
     assert(!err || *err == NULL);
 
-    // Initialization
-    gpgme_check_version(NULL);
-    gpgerr = gpgme_engine_check_version(GPGME_PROTOCOL_OpenPGP);
-    if (gpgerr != GPG_ERR_NO_ERROR) {
-        g_debug("%s: gpgme_engine_check_version: %s",
-                 __func__, gpgme_strerror(gpgerr));
-        g_set_error(err, LR_GPG_ERROR, LRE_GPGNOTSUPPORTED,
-                    "gpgme_engine_check_version() error: %s",
-                    gpgme_strerror(gpgerr));
-        return FALSE;
-    }
-
-    gpgerr = gpgme_new(&context);
-    if (gpgerr != GPG_ERR_NO_ERROR) {
-        g_debug("%s: gpgme_new: %s", __func__, gpgme_strerror(gpgerr));
-        g_set_error(err, LR_GPG_ERROR, LRE_GPGERROR,
-                    "gpgme_new() error: %s", gpgme_strerror(gpgerr));
-        return FALSE;
-    }
-
-    gpgerr = gpgme_set_protocol(context, GPGME_PROTOCOL_OpenPGP);
-    if (gpgerr != GPG_ERR_NO_ERROR) {
-        g_debug("%s: gpgme_set_protocol: %s", __func__, gpgme_strerror(gpgerr));
-        g_set_error(err, LR_GPG_ERROR, LRE_GPGERROR,
-                    "gpgme_set_protocol() error: %s", gpgme_strerror(gpgerr));
-        gpgme_release(context);
+    context = gpg_context_new(home_dir, err);
+    if (!context)
         return FALSE;
-    }
-
-    if (home_dir) {
-        gpgerr = gpgme_ctx_set_engine_info(context, GPGME_PROTOCOL_OpenPGP,
-                                        NULL, home_dir);
-        if (gpgerr != GPG_ERR_NO_ERROR) {
-            g_debug("%s: gpgme_ctx_set_engine_info: %s", __func__, gpgme_strerror(gpgerr));
-            g_set_error(err, LR_GPG_ERROR, LRE_GPGERROR,
-                        "gpgme_ctx_set_engine_info() error: %s",
-                        gpgme_strerror(gpgerr));
-            gpgme_release(context);
-            return FALSE;
-        }
-    }
-
-    gpgme_set_armor(context, 1);
 
     // Key import
 
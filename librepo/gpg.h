@@ -23,6 +23,8 @@
 
 #include <glib.h>
 
+#include "types.h"
+
 G_BEGIN_DECLS
 
 /** \defgroup   gpg GPG signature verification
@@ -30,7 +32,47 @@ G_BEGIN_DECLS
  *  @{
  */
 
+/** Verifier of detached signatures with the keyring of a configuration
+ * directory. The engine is initialized and the context is set up once,
+ * so it is cheaper to reuse a verifier than to check every signature
+ * from scratch. A verifier can be used by more threads, every check
+ * running in parallel gets its own context.
+ */
+typedef struct _LrGpgVerifier LrGpgVerifier;
+
+/** Create a new verifier.
+ * @param home_dir      Configuration directory of OpenPGP engine
+ *                      (e.g. "/home/user/.gnupg/"), if NULL default
+ *                      config directory is used.
+ * @param err           GError **
+ * @return              New verifier or NULL (err is set)
+ */
+LrGpgVerifier *
+lr_gpg_verifier_new(const char *home_dir, GError **err);
+
+/** Check detached signature of data by the verifier.
+ * Keys imported to the keyring meanwhile are used.
+ * @param verifier      Verifier
+ * @param signature_fd  File descriptor of signature file.
+ * @param data_fd       File descriptor of data to verify.
+ * @param err           GError **
+ * @return              returns TRUE if error is not set and FALSE if it is.
+ */
+gboolean
+lr_gpg_verifier_check_signature_fd(LrGpgVerifier *verifier,
+                                   int signature_fd,
+                                   int data_fd,
+                                   GError **err);
+
+/** Free the verifier.
+ * @param verifier      Verifier or NULL
+ */
+void
+lr_gpg_verifier_free(LrGpgVerifier *verifier);
+
 /** Check detached signature of data.
+ * A verifier of the home_dir is created by the first check and it is
+ * reused by the next checks with the same home_dir.
  * @param signature_fd  File descriptor of signature file.
  * @param data_fd       File descriptor of data to verify.
  * @param home_dir      Configuration directory of OpenPGP engine
@@ -60,6 +102,109 @@ lr_gpg_check_signature(const char *signature_fn,
                        const char *home_dir,
                        GError **err);
 
+/** Same as lr_gpg_check_signature_fd() but the implementation which
+ * verifies the signature is selected.
+ * @param signature_fd  File descriptor of signature file.
+ * @param data_fd       File descriptor of data to verify.
+ * @param home_dir      Configuration directory of OpenPGP engine
+ *                      (e.g. "/home/user/.gnupg/"), if NULL default
+ *                      config directory is used.
+ * @param backend       Backend. LR_GPGBACKEND_BUILTIN reads the public
+ *                      keys from the keyring files of the home_dir and
+ *                      verifies v4 RSA and Ed25519 signatures in-process,
+ *                      other signatures (unknown or expiring keys, ...)
+ *                      are verified by GPGME.
+ * @param err           GError **
+ * @return              returns TRUE if error is not set and FALSE if it is.
+ */
+gboolean
+lr_gpg_check_signature_fd_v2(int signature_fd,
+                             int data_fd,
+                             const char *home_dir,
+                             LrGpgBackend backend,
+                             GError **err);
+
+/** Same as lr_gpg_check_signature() but the implementation which
+ * verifies the signature is selected.
+ * For params see lr_gpg_check_signature_fd_v2().
+ */
+gboolean
+lr_gpg_check_signature_v2(const char *signature_fn,
+                          const char *data_fn,
+                          const char *home_dir,
+                          LrGpgBackend backend,
+                          GError **err);
+
+/** Verification of a detached signature by ::lr_gpg_check_signatures
+ * or ::LrGpgBatch */
+typedef struct {
+    const char *signature_fn; /*!<
+        Filename (path) of signature file */
+    const char *data_fn; /*!<
+        Filename (path) of data to verify */
+    const char *home_dir; /*!<
+        Configuration directory of OpenPGP engine or NULL */
+    LrGpgBackend backend; /*!<
+        Implementation used to verify the signature */
+    void *userdata; /*!<
+        Data of the caller */
+
+    // Items filled by the verification
+
+    gboolean valid; /*!<
+        TRUE if the signature is valid */
+    GError *error; /*!<
+        Error (why the signature isn't valid) or NULL.
+        Must be freed by the caller. */
+} LrGpgJob;
+
+/** Verifications of detached signatures by a pool of worker threads.
+ * The verifications of the pushed jobs start immediately, so they run
+ * while the caller does something else (e.g. downloads other files).
+ * The verifiers (see ::LrGpgVerifier) of the home_dirs are shared
+ * by the threads.
+ */
+typedef struct _LrGpgBatch LrGpgBatch;
+
+/** Create a new batch.
+ * @param threads       Maximal number of threads, 0 means the number
+ *                      of available processors. With one thread, the jobs
+ *                      are verified by lr_gpg_batch_push().
+ * @return              New batch
+ */
+LrGpgBatch *
+lr_gpg_batch_new(guint threads);
+
+/** Start the verification of the job.
+ * The job must not be touched until it is returned by lr_gpg_batch_pop().
+ * @param batch         Batch
+ * @param job           Job
+ */
+void
+lr_gpg_batch_push(LrGpgBatch *batch, LrGpgJob *job);
+
+/** Wait for the next finished job (in order in which they are finished).
+ * @param batch         Batch
+ * @return              Finished job or NULL if all pushed jobs were popped
+ */
+LrGpgJob *
+lr_gpg_batch_pop(LrGpgBatch *batch);
+
+/** Wait for the running verifications and free the batch.
+ * @param batch         Batch or NULL
+ */
+void
+lr_gpg_batch_free(LrGpgBatch *batch);
+
+/** Verify detached signatures of independent files by a pool of worker
+ * threads. The results are stored to the jobs.
+ * @param jobs          List of ::LrGpgJob
+ * @param threads       Maximal number of threads, 0 means the number
+ *                      of available processors
+ */
+void
+lr_gpg_check_signatures(GSList *jobs, guint threads);
+
 /** Import key into the keyring.
  * @param key_fn        Filename (path) of key file.
  * @param home_dir      Configuration directory of OpenPGP engine
@@ -0,0 +1,1053 @@
+/* librepo - A library providing (libcURL like) API to downloading repository
+ * Copyright (C) 2012  Tomas Mlcoch
+ *
+ * Licensed under the GNU Lesser General Public License Version 2.1
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+/* In-process verification of detached OpenPGP signatures (RFC 4880).
+ * Only v4 binary and text signatures made by v4 RSA and Ed25519 primary
+ * keys are verified, everything else is left to GPGME. */
+
+#define _GNU_SOURCE
+#include <assert.h>
+#include <glib.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <openssl/evp.h>
+#include <openssl/opensslv.h>
+#include <openssl/rsa.h>
+#include <openssl/bn.h>
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+#include <openssl/core_names.h>
+#include <openssl/param_build.h>
+#endif
+
+#include "rcodes.h"
+#include "util.h"
+#include "gpg_internal.h"
+
+#if OPENSSL_VERSION_NUMBER < 0x10100000L
+#define EVP_MD_CTX_new          EVP_MD_CTX_create
+#define EVP_MD_CTX_free         EVP_MD_CTX_destroy
+#endif
+
+#define MAX_SIGNATURE_SIZE      (1024 * 1024)   /*!< Bigger signature files
+                                                     are left to GPGME */
+#define MAX_SIGNATURES          16
+#define HASH_BUFFER_SIZE        65536
+
+/* Packet tags */
+#define PGP_TAG_SIGNATURE       2
+#define PGP_TAG_PUBLIC_KEY      6
+#define PGP_TAG_PUBLIC_SUBKEY   14
+
+/* Public key algorithms */
+#define PGP_ALGO_RSA            1
+#define PGP_ALGO_RSA_SIGN       3
+#define PGP_ALGO_EDDSA          22
+
+/* Signature subpackets */
+#define PGP_SUB_CREATION        2
+#define PGP_SUB_EXPIRATION      3
+#define PGP_SUB_KEY_EXPIRATION  9
+#define PGP_SUB_ISSUER          16
+#define PGP_SUB_KEY_FLAGS       27
+#define PGP_SUB_ISSUER_FPR      33
+
+/* Key flags */
+#define PGP_KEY_FLAG_SIGN       0x02
+
+/* Signature types */
+#define PGP_SIG_BINARY          0x00
+#define PGP_SIG_TEXT            0x01
+#define PGP_SIG_SUBKEY_BINDING  0x18
+#define PGP_SIG_DIRECT_KEY      0x1F
+#define PGP_SIG_KEY_REVOCATION  0x20
+#define PGP_SIG_SUBKEY_REVOCATION 0x28
+
+static const guchar ed25519_oid[] = {
+    0x2B, 0x06, 0x01, 0x04, 0x01, 0xDA, 0x47, 0x0F, 0x01
+};
+
+/** Public key from the keyring */
+typedef struct {
+    guchar fingerprint[20]; /*!<
+        Version 4 fingerprint */
+    guchar keyid[8]; /*!<
+        Key ID (the low 64 bits of the fingerprint) */
+    int algo; /*!<
+        Public key algorithm */
+    EVP_PKEY *pkey; /*!<
+        The key or NULL if its algorithm is not supported */
+    gboolean unusable; /*!<
+        The key is (or may be) revoked or it expires, GPGME decides */
+} LrPgpKey;
+
+/** Stamp of a keyring file, the keys are loaded again if it changes */
+typedef struct {
+    gboolean exists;
+    dev_t dev;
+    ino_t ino;
+    off_t size;
+    struct timespec mtime;
+} LrPgpStamp;
+
+/** Public keys of a configuration directory */
+typedef struct {
+    gint refcount;
+    LrPgpStamp stamps[2]; /*!<
+        pubring.kbx and pubring.gpg */
+    GSList *keys; /*!<
+        List of LrPgpKey */
+} LrPgpKeyring;
+
+/** Parsed signature packet */
+typedef struct {
+    int sigtype;
+    int pubalgo;
+    int hashalgo;
+    const guchar *hashed; /*!<
+        Hashed part of the packet (from its beginning) */
+    gsize hashedlen;
+    guchar issuer[8];
+    gboolean has_issuer;
+    gboolean key_expiration; /*!<
+        Key expiration time subpacket is present */
+    gboolean has_key_flags; /*!<
+        Key flags subpacket is present (see key_flags) */
+    guchar key_flags; /*!<
+        First octet of the key flags */
+    gboolean unknown; /*!<
+        Expiring signature or unknown critical subpacket */
+    const guchar *left16;
+    const guchar *mpi[2];
+    gsize mpilen[2];
+} LrPgpSig;
+
+/** Keyrings of the configuration directories */
+static GHashTable *keyrings = NULL;
+G_LOCK_DEFINE_STATIC(keyrings);
+
+static guint32
+be32(const guchar *p)
+{
+    return ((guint32) p[0] << 24) | ((guint32) p[1] << 16)
+           | ((guint32) p[2] << 8) | (guint32) p[3];
+}
+
+/** Take the next packet from the buffer.
+ * @return          FALSE at the end or if the packet is malformed
+ */
+static gboolean
+pgp_packet(const guchar **p,
+           gsize *left,
+           int *tag,
+           const guchar **body,
+           gsize *len)
+{
+    const guchar *q;
+    gsize l, n;
+    guchar b;
+
+    if (*left == 0)
+        return FALSE;
+
+    b = (*p)[0];
+    if (!(b & 0x80))
+        return FALSE;
+
+    q = *p + 1;
+    l = *left - 1;
+
+    if (b & 0x40) {
+        // New format
+        *tag = b & 0x3f;
+        if (l < 1)
+            return FALSE;
+        if (q[0] < 192) {
+            n = q[0];
+            q += 1;
+            l -= 1;
+        } else if (q[0] < 224) {
+            if (l < 2)
+                return FALSE;
+            n = ((gsize) (q[0] - 192) << 8) + q[1] + 192;
+            q += 2;
+            l -= 2;
+        } else if (q[0] == 255) {
+            if (l < 5)
+                return FALSE;
+            n = be32(q + 1);
+            q += 5;
+            l -= 5;
+        } else {
+            return FALSE;  // Partial body lengths
+        }
+    } else {
+        // Old format
+        int lentype = b & 0x03;
+        *tag = (b >> 2) & 0x0f;
+        if (lentype == 3) {
+            n = l;  // Indeterminate length
+        } else {
+            gsize bytes = (gsize) 1 << lentype;
+            if (l < bytes)
+                return FALSE;
+            n = 0;
+            for (gsize i = 0; i < bytes; i++)
+                n = (n << 8) | q[i];
+            q += bytes;
+            l -= bytes;
+        }
+    }
+
+    if (n > l)
+        return FALSE;
+
+    *body = q;
+    *len = n;
+    *p = q + n;
+    *left = l - n;
+    return TRUE;
+}
+
+/** Take the next multiprecision integer from the buffer.
+ */
+static gboolean
+pgp_mpi(const guchar **p, gsize *left, const guchar **mpi, gsize *len)
+{
+    gsize bytes;
+
+    if (*left < 2)
+        return FALSE;
+
+    bytes = ((((gsize) (*p)[0] << 8) | (*p)[1]) + 7) / 8;
+    if (*left - 2 < bytes)
+        return FALSE;
+
+    *mpi = *p + 2;
+    *len = bytes;
+    *p += 2 + bytes;
+    *left -= 2 + bytes;
+    return TRUE;
+}
+
+/** Go through the subpackets of a signature.
+ * @param hashed    The subpackets are from the hashed area
+ * @return          FALSE if the subpackets are malformed
+ */
+static gboolean
+pgp_subpackets(const guchar *p, gsize left, gboolean hashed, LrPgpSig *sig)
+{
+    while (left) {
+        gsize len, hdr;
+        int type;
+        gboolean critical;
+        const guchar *data;
+
+        if (p[0] < 192) {
+            len = p[0];
+            hdr = 1;
+        } else if (p[0] < 255) {
+            if (left < 2)
+                return FALSE;
+            len = ((gsize) (p[0] - 192) << 8) + p[1] + 192;
+            hdr = 2;
+        } else {
+            if (left < 5)
+                return FALSE;
+            len = be32(p + 1);
+            hdr = 5;
+        }
+
+        if (len == 0 || len > left - hdr)
+            return FALSE;
+
+        type = p[hdr] & 0x7f;
+        critical = p[hdr] & 0x80;
+        data = p + hdr + 1;
+        len -= 1;
+
+        switch (type) {
+        case PGP_SUB_CREATION:
+            break;
+        case PGP_SUB_KEY_FLAGS:
+            if (hashed && len >= 1) {
+                sig->key_flags = data[0];
+                sig->has_key_flags = TRUE;
+            }
+            break;
+        case PGP_SUB_EXPIRATION:
+            if (hashed && len == 4 && be32(data) != 0)
+                sig->unknown = TRUE;
+            break;
+        case PGP_SUB_KEY_EXPIRATION:
+            if (hashed && len == 4 && be32(data) != 0)
+                sig->key_expiration = TRUE;
+            break;
+        case PGP_SUB_ISSUER:
+            if (len == 8 && !sig->has_issuer) {
+                memcpy(sig->issuer, data, 8);
+                sig->has_issuer = TRUE;
+            }
+            break;
+        case PGP_SUB_ISSUER_FPR:
+            // Version 4 fingerprint (20 bytes), the key ID is its tail
+            if (len == 21 && data[0] == 4 && !sig->has_issuer) {
+                memcpy(sig->issuer, data + 1 + 12, 8);
+                sig->has_issuer = TRUE;
+            }
+            break;
+        default:
+            if (critical)
+                sig->unknown = TRUE;
+        }
+
+        p += hdr + 1 + len;
+        left -= hdr + 1 + len;
+    }
+
+    return TRUE;
+}
+
+/** Parse a version 4 signature packet.
+ * @return          FALSE if it is malformed or of another version
+ */
+static gboolean
+pgp_signature(const guchar *body, gsize len, LrPgpSig *sig)
+{
+    const guchar *p;
+    gsize hashedlen, unhashedlen, left;
+    int mpis;
+
+    memset(sig, 0, sizeof(*sig));
+
+    if (len < 6 || body[0] != 4)
+        return FALSE;
+
+    sig->sigtype = body[1];
+    sig->pubalgo = body[2];
+    sig->hashalgo = body[3];
+
+    hashedlen = ((gsize) body[4] << 8) | body[5];
+    if (len < 6 + hashedlen + 2)
+        return FALSE;
+    sig->hashed = body;
+    sig->hashedlen = 6 + hashedlen;
+    if (!pgp_subpackets(body + 6, hashedlen, TRUE, sig))
+        return FALSE;
+
+    p = body + 6 + hashedlen;
+    unhashedlen = ((gsize) p[0] << 8) | p[1];
+    if (len < 6 + hashedlen + 2 + unhashedlen + 2)
+        return FALSE;
+    if (!pgp_subpackets(p + 2, unhashedlen, FALSE, sig))
+        return FALSE;
+
+    sig->left16 = p + 2 + unhashedlen;
+    p = sig->left16 + 2;
+    left = len - (p - body);
+
+    if (sig->pubalgo == PGP_ALGO_RSA || sig->pubalgo == PGP_ALGO_RSA_SIGN)
+        mpis = 1;
+    else if (sig->pubalgo == PGP_ALGO_EDDSA)
+        mpis = 2;
+    else
+        return TRUE;  // Unknown algorithm, left to GPGME
+
+    for (int i = 0; i < mpis; i++)
+        if (!pgp_mpi(&p, &left, &sig->mpi[i], &sig->mpilen[i]))
+            return FALSE;
+
+    return TRUE;
+}
+
+static EVP_PKEY *
+rsa_pkey(const guchar *n, gsize nlen, const guchar *e, gsize elen)
+{
+    EVP_PKEY *pkey = NULL;
+    BIGNUM *bn_n = BN_bin2bn(n, (int) nlen, NULL);
+    BIGNUM *bn_e = BN_bin2bn(e, (int) elen, NULL);
+
+    if (!bn_n || !bn_e)
+        goto exit;
+
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+    OSSL_PARAM_BLD *bld = OSSL_PARAM_BLD_new();
+    OSSL_PARAM *params = NULL;
+    EVP_PKEY_CTX *ctx = EVP_PKEY_CTX_new_from_name(NULL, "RSA", NULL);
+
+    if (bld && ctx
+        && OSSL_PARAM_BLD_push_BN(bld, OSSL_PKEY_PARAM_RSA_N, bn_n)
+        && OSSL_PARAM_BLD_push_BN(bld, OSSL_PKEY_PARAM_RSA_E, bn_e)
+        && (params = OSSL_PARAM_BLD_to_param(bld))
+        && EVP_PKEY_fromdata_init(ctx) == 1
+        && EVP_PKEY_fromdata(ctx, &pkey, EVP_PKEY_PUBLIC_KEY, params) != 1)
+        pkey = NULL;
+
+    OSSL_PARAM_free(params);
+    OSSL_PARAM_BLD_free(bld);
+    EVP_PKEY_CTX_free(ctx);
+#else
+    RSA *rsa = RSA_new();
+    if (rsa && RSA_set0_key(rsa, bn_n, bn_e, NULL)) {
+        bn_n = bn_e = NULL;  // Owned by the rsa
+        pkey = EVP_PKEY_new();
+        if (pkey && !EVP_PKEY_assign_RSA(pkey, rsa)) {
+            EVP_PKEY_free(pkey);
+            pkey = NULL;
+        }
+        if (pkey)
+            rsa = NULL;  // Owned by the pkey
+    }
+    RSA_free(rsa);
+#endif
+
+exit:
+    BN_free(bn_n);
+    BN_free(bn_e);
+    return pkey;
+}
+
+static void
+pgp_key_free(LrPgpKey *key)
+{
+    EVP_PKEY_free(key->pkey);
+    lr_free(key);
+}
+
+/** Parse a version 4 public key (or subkey) packet.
+ * @return          New key (its pkey is NULL if the algorithm is not
+ *                  supported) or NULL if it cannot be parsed
+ */
+static LrPgpKey *
+pgp_key(const guchar *body, gsize len)
+{
+    LrPgpKey *key;
+    guchar header[3];
+    guchar fingerprint[EVP_MAX_MD_SIZE];
+    unsigned int fingerprintlen = 0;
+    const guchar *p;
+    gsize left;
+    EVP_MD_CTX *ctx;
+
+    if (len < 6 || len > 0xffff || body[0] != 4)
+        return NULL;
+
+    p = body + 6;
+    left = len - 6;
+
+    // Fingerprint is SHA1 of the packet with a two-octet length header
+    header[0] = 0x99;
+    header[1] = (len >> 8) & 0xff;
+    header[2] = len & 0xff;
+    ctx = EVP_MD_CTX_new();
+    if (!ctx
+        || !EVP_DigestInit_ex(ctx, EVP_sha1(), NULL)
+        || !EVP_DigestUpdate(ctx, header, sizeof(header))
+        || !EVP_DigestUpdate(ctx, body, len)
+        || !EVP_DigestFinal_ex(ctx, fingerprint, &fingerprintlen)
+        || fingerprintlen != 20)
+    {
+        EVP_MD_CTX_free(ctx);
+        return NULL;
+    }
+    EVP_MD_CTX_free(ctx);
+
+    key = lr_malloc0(sizeof(*key));
+    memcpy(key->fingerprint, fingerprint, 20);
+    memcpy(key->keyid, fingerprint + 12, 8);
+    key->algo = body[5];
+
+    if (key->algo == PGP_ALGO_RSA || key->algo == PGP_ALGO_RSA_SIGN) {
+        const guchar *n, *e;
+        gsize nlen, elen;
+        if (pgp_mpi(&p, &left, &n, &nlen) && pgp_mpi(&p, &left, &e, &elen))
+            key->pkey = rsa_pkey(n, nlen, e, elen);
+    }
+#ifdef EVP_PKEY_ED25519
+    else if (key->algo == PGP_ALGO_EDDSA && left > 0) {
+        gsize oidlen = p[0];
+        const guchar *point;
+        gsize pointlen;
+
+        if (left > oidlen
+            && oidlen == sizeof(ed25519_oid)
+            && !memcmp(p + 1, ed25519_oid, oidlen))
+        {
+            p += 1 + oidlen;
+            left -= 1 + oidlen;
+            // Native point format: 0x40 followed by the 32 bytes
+            if (pgp_mpi(&p, &left, &point, &pointlen)
+                && pointlen == 33 && point[0] == 0x40)
+                key->pkey = EVP_PKEY_new_raw_public_key(EVP_PKEY_ED25519,
+                                                        NULL, point + 1, 32);
+        }
+    }
+#endif
+
+    return key;
+}
+
+/** Add the keys from a stream of packets (a keyring or a keyblock).
+ * The signatures are not verified, the keyring is trusted. They are only
+ * checked for revocations, expirations and key flags, keys which have
+ * them (or whose key flags don't allow signing) are left to GPGME.
+ * Subkeys are always left to GPGME, a signing subkey is valid only with
+ * a primary key binding signature (0x19) made by the subkey, which is
+ * not verified here.
+ */
+static void
+keyring_add_packets(LrPgpKeyring *keyring, const guchar *p, gsize left)
+{
+    LrPgpKey *primary = NULL;
+    LrPgpKey *last = NULL;
+    GSList *block = NULL;
+    const guchar *body;
+    gsize len;
+    int tag;
+
+    while (pgp_packet(&p, &left, &tag, &body, &len)) {
+        if (tag == PGP_TAG_PUBLIC_KEY || tag == PGP_TAG_PUBLIC_SUBKEY) {
+            LrPgpKey *key = pgp_key(body, len);
+            if (tag == PGP_TAG_PUBLIC_KEY) {
+                // The beginning of the next keyblock
+                g_slist_free(block);
+                block = NULL;
+                primary = key;
+            } else if (key) {
+                key->unusable = TRUE;
+            }
+            last = key;
+            if (key) {
+                block = g_slist_prepend(block, key);
+                keyring->keys = g_slist_prepend(keyring->keys, key);
+            }
+        } else if (tag == PGP_TAG_SIGNATURE) {
+            LrPgpSig sig;
+            if (!pgp_signature(body, len, &sig)) {
+                // The revocations and expirations cannot be checked
+                if (last)
+                    last->unusable = TRUE;
+                continue;
+            }
+
+            if (sig.sigtype == PGP_SIG_KEY_REVOCATION) {
+                // The whole keyblock
+                for (GSList *elem = block; elem; elem = g_slist_next(elem))
+                    ((LrPgpKey *) elem->data)->unusable = TRUE;
+            } else if (sig.sigtype == PGP_SIG_SUBKEY_REVOCATION
+                       || (sig.sigtype == PGP_SIG_SUBKEY_BINDING
+                           && sig.key_expiration)) {
+                if (last && last != primary)
+                    last->unusable = TRUE;
+            } else if ((sig.sigtype >= 0x10 && sig.sigtype <= 0x13)
+                       || sig.sigtype == PGP_SIG_DIRECT_KEY) {
+                if (sig.key_expiration) {
+                    for (GSList *elem = block; elem; elem = g_slist_next(elem))
+                        ((LrPgpKey *) elem->data)->unusable = TRUE;
+                } else if (primary && sig.has_key_flags
+                           && !(sig.key_flags & PGP_KEY_FLAG_SIGN)
+                           && (!sig.has_issuer
+                               || !memcmp(sig.issuer, primary->keyid, 8))) {
+                    // The self-signature doesn't allow signing
+                    primary->unusable = TRUE;
+                }
+            }
+        }
+    }
+
+    g_slist_free(block);
+}
+
+/** Add the keys from a keybox file (pubring.kbx of GnuPG 2.1+).
+ */
+static void
+keyring_add_keybox(LrPgpKeyring *keyring, const guchar *data, gsize len)
+{
+    gsize pos = 0;
+
+    while (len - pos >= 16) {
+        const guchar *blob = data + pos;
+        gsize bloblen = be32(blob);
+
+        if (bloblen < 16 || bloblen > len - pos)
+            break;
+
+        // Blob type 2 is an OpenPGP keyblock
+        if (blob[4] == 2) {
+            gsize offset = be32(blob + 8);
+            gsize blocklen = be32(blob + 12);
+            if (offset <= bloblen && blocklen <= bloblen - offset)
+                keyring_add_packets(keyring, blob + offset, blocklen);
+        }
+
+        pos += bloblen;
+    }
+}
+
+static void
+keyring_stamp(const char *path, LrPgpStamp *stamp)
+{
+    struct stat buf;
+
+    memset(stamp, 0, sizeof(*stamp));
+    if (stat(path, &buf) == -1)
+        return;
+
+    stamp->exists = TRUE;
+    stamp->dev = buf.st_dev;
+    stamp->ino = buf.st_ino;
+    stamp->size = buf.st_size;
+    stamp->mtime = buf.st_mtim;
+}
+
+static gboolean
+keyring_stamps_equal(const LrPgpStamp *a, const LrPgpStamp *b)
+{
+    for (int i = 0; i < 2; i++)
+        if (a[i].exists != b[i].exists
+            || a[i].dev != b[i].dev
+            || a[i].ino != b[i].ino
+            || a[i].size != b[i].size
+            || a[i].mtime.tv_sec != b[i].mtime.tv_sec
+            || a[i].mtime.tv_nsec != b[i].mtime.tv_nsec)
+            return FALSE;
+    return TRUE;
+}
+
+static void
+keyring_unref(LrPgpKeyring *keyring)
+{
+    if (!keyring || !g_atomic_int_dec_and_test(&keyring->refcount))
+        return;
+    g_slist_free_full(keyring->keys, (GDestroyNotify) pgp_key_free);
+    lr_free(keyring);
+}
+
+/** Get the keyring of the home_dir, it is loaded again if its files
+ * changed (a key was imported).
+ * @return          Referenced keyring or NULL if there is none
+ */
+static LrPgpKeyring *
+keyring_get(const char *home_dir)
+{
+    static const char *names[2] = { "pubring.kbx", "pubring.gpg" };
+    LrPgpKeyring *keyring;
+    LrPgpStamp stamps[2];
+    gchar *paths[2];
+    gchar *dir;
+
+    if (home_dir)
+        dir = g_strdup(home_dir);
+    else if (g_getenv("GNUPGHOME"))
+        dir = g_strdup(g_getenv("GNUPGHOME"));
+    else
+        dir = g_build_filename(g_get_home_dir(), ".gnupg", NULL);
+
+    for (int i = 0; i < 2; i++) {
+        paths[i] = g_build_filename(dir, names[i], NULL);
+        keyring_stamp(paths[i], &stamps[i]);
+    }
+
+    G_LOCK(keyrings);
+    if (!keyrings)
+        keyrings = g_hash_table_new_full(g_str_hash, g_str_equal, g_free,
+                                         (GDestroyNotify) keyring_unref);
+    keyring = g_hash_table_lookup(keyrings, dir);
+    if (keyring && keyring_stamps_equal(keyring->stamps, stamps)) {
+        g_atomic_int_inc(&keyring->refcount);
+        G_UNLOCK(keyrings);
+        goto exit;
+    }
+    G_UNLOCK(keyrings);
+
+    keyring = NULL;
+    if (!stamps[0].exists && !stamps[1].exists)
+        goto exit;
+
+    keyring = lr_malloc0(sizeof(*keyring));
+    keyring->refcount = 2;  // The cache and the caller
+    memcpy(keyring->stamps, stamps, sizeof(stamps));
+
+    for (int i = 0; i < 2; i++) {
+        gchar *contents = NULL;
+        gsize len = 0;
+
+        if (!stamps[i].exists
+            || !g_file_get_contents(paths[i], &contents, &len, NULL))
+            continue;
+
+        if (i == 0)
+            keyring_add_keybox(keyring, (guchar *) contents, len);
+        else
+            keyring_add_packets(keyring, (guchar *) contents, len);
+        g_free(contents);
+    }
+
+    g_debug("%s: %u keys loaded from %s", __func__,
+            g_slist_length(keyring->keys), dir);
+
+    G_LOCK(keyrings);
+    g_hash_table_replace(keyrings, g_strdup(dir), keyring);
+    G_UNLOCK(keyrings);
+
+exit:
+    for (int i = 0; i < 2; i++)
+        g_free(paths[i]);
+    g_free(dir);
+    return keyring;
+}
+
+/** Find the key by its key ID.
+ * The same key could be in both the keyring files, its unusable copy
+ * is returned then.
+ * @return          The key or NULL if there is none or the key ID is
+ *                  ambiguous (more keys have it), GPGME decides then
+ */
+static LrPgpKey *
+keyring_find(LrPgpKeyring *keyring, const guchar *keyid)
+{
+    LrPgpKey *found = NULL;
+
+    for (GSList *elem = keyring->keys; elem; elem = g_slist_next(elem)) {
+        LrPgpKey *key = elem->data;
+        if (memcmp(key->keyid, keyid, 8))
+            continue;
+        if (found && memcmp(found->fingerprint, key->fingerprint, 20)) {
+            g_debug("%s: Key ID is ambiguous", __func__);
+            return NULL;
+        }
+        if (!found || key->unusable)
+            found = key;
+    }
+    return found;
+}
+
+/** Decode the ASCII armor.
+ * @return          Decoded data or NULL
+ */
+static guchar *
+pgp_dearmor(const gchar *text, gsize len, gsize *outlen)
+{
+    const gchar *end = text + len;
+    const gchar *p = g_strstr_len(text, len, "-----BEGIN PGP ");
+    gchar *base64;
+    gsize n = 0;
+    gboolean blank = FALSE;
+
+    if (!p)
+        return NULL;
+
+    // Skip the armor header line and the armor headers
+    while (p < end && !blank) {
+        const gchar *eol = memchr(p, '\n', end - p);
+        if (!eol)
+            return NULL;
+        p = eol + 1;
+        blank = TRUE;
+        for (const gchar *c = p; c < end && *c != '\n'; c++)
+            if (!g_ascii_isspace(*c))
+                blank = FALSE;
+    }
+
+    base64 = g_malloc(end - p + 1);
+    while (p < end && *p != '=' && *p != '-') {
+        const gchar *eol = memchr(p, '\n', end - p);
+        if (!eol)
+            eol = end;
+        for (; p < eol; p++)
+            if (g_ascii_isalnum(*p) || *p == '+' || *p == '/' || *p == '=')
+                base64[n++] = *p;
+        p = (eol < end) ? eol + 1 : end;
+    }
+    base64[n] = '\0';
+
+    if (n == 0) {
+        g_free(base64);
+        return NULL;
+    }
+
+    // Checksum line (=XXXX) is not decoded, the signature is verified
+    guchar *data = g_base64_decode(base64, outlen);
+    g_free(base64);
+    return data;
+}
+
+static const EVP_MD *
+pgp_md(int hashalgo)
+{
+    switch (hashalgo) {
+    case 2:  return EVP_sha1();
+    case 8:  return EVP_sha256();
+    case 9:  return EVP_sha384();
+    case 10: return EVP_sha512();
+    case 11: return EVP_sha224();
+    default: return NULL;
+    }
+}
+
+/** Compute the digest of the data and of the hashed part
+ * of the signature.
+ */
+static gboolean
+pgp_digest(int data_fd,
+           off_t offset,
+           const LrPgpSig *sig,
+           const EVP_MD *md,
+           guchar *digest,
+           unsigned int *digestlen)
+{
+    EVP_MD_CTX *ctx = EVP_MD_CTX_new();
+    guchar *buf = lr_malloc(HASH_BUFFER_SIZE);
+    guchar *crlf = NULL;
+    guchar trailer[6];
+    gboolean ret = FALSE;
+    gboolean cr = FALSE;
+    ssize_t n;
+
+    if (!ctx || !EVP_DigestInit_ex(ctx, md, NULL))
+        goto exit;
+
+    if (sig->sigtype == PGP_SIG_TEXT)
+        crlf = lr_malloc(HASH_BUFFER_SIZE * 2);
+
+    while ((n = pread(data_fd, buf, HASH_BUFFER_SIZE, offset)) > 0) {
+        offset += n;
+        if (!crlf) {
+            if (!EVP_DigestUpdate(ctx, buf, n))
+                goto exit;
+            continue;
+        }
+
+        // Text signature is made over the data with CRLF line endings
+        gsize m = 0;
+        for (ssize_t i = 0; i < n; i++) {
+            if (buf[i] == '\n' && !cr)
+                crlf[m++] = '\r';
+            crlf[m++] = buf[i];
+            cr = (buf[i] == '\r');
+        }
+        if (!EVP_DigestUpdate(ctx, crlf, m))
+            goto exit;
+    }
+    if (n < 0)
+        goto exit;
+
+    // The hashed part of the packet and the v4 trailer
+    trailer[0] = 4;
+    trailer[1] = 0xff;
+    trailer[2] = (sig->hashedlen >> 24) & 0xff;
+    trailer[3] = (sig->hashedlen >> 16) & 0xff;
+    trailer[4] = (sig->hashedlen >> 8) & 0xff;
+    trailer[5] = sig->hashedlen & 0xff;
+
+    ret = EVP_DigestUpdate(ctx, sig->hashed, sig->hashedlen)
+          && EVP_DigestUpdate(ctx, trailer, sizeof(trailer))
+          && EVP_DigestFinal_ex(ctx, digest, digestlen);
+
+exit:
+    EVP_MD_CTX_free(ctx);
+    lr_free(buf);
+    lr_free(crlf);
+    return ret;
+}
+
+/** Copy the MPI to out right-aligned (with leading zeros).
+ */
+static gboolean
+pad_mpi(const guchar *mpi, gsize len, guchar *out, gsize outlen)
+{
+    if (len > outlen)
+        return FALSE;
+    memset(out, 0, outlen - len);
+    memcpy(out + outlen - len, mpi, len);
+    return TRUE;
+}
+
+static gboolean
+pgp_verify(const LrPgpKey *key,
+           const LrPgpSig *sig,
+           const EVP_MD *md,
+           const guchar *digest,
+           unsigned int digestlen)
+{
+    gboolean ret = FALSE;
+
+    if (key->algo == PGP_ALGO_RSA || key->algo == PGP_ALGO_RSA_SIGN) {
+        gsize size = (gsize) EVP_PKEY_size(key->pkey);
+        guchar *signature = lr_malloc(size);
+        EVP_PKEY_CTX *ctx = EVP_PKEY_CTX_new(key->pkey, NULL);
+
+        ret = ctx
+              && pad_mpi(sig->mpi[0], sig->mpilen[0], signature, size)
+              && EVP_PKEY_verify_init(ctx) == 1
+              && EVP_PKEY_CTX_set_rsa_padding(ctx, RSA_PKCS1_PADDING) == 1
+              && EVP_PKEY_CTX_set_signature_md(ctx, md) == 1
+              && EVP_PKEY_verify(ctx, signature, size,
+                                 digest, digestlen) == 1;
+
+        EVP_PKEY_CTX_free(ctx);
+        lr_free(signature);
+    }
+#ifdef EVP_PKEY_ED25519
+    else if (key->algo == PGP_ALGO_EDDSA) {
+        // The digest is signed, the signature is R and S
+        guchar signature[64];
+        EVP_MD_CTX *ctx = EVP_MD_CTX_new();
+
+        ret = ctx
+              && pad_mpi(sig->mpi[0], sig->mpilen[0], signature, 32)
+              && pad_mpi(sig->mpi[1], sig->mpilen[1], signature + 32, 32)
+              && EVP_DigestVerifyInit(ctx, NULL, NULL, NULL, key->pkey) == 1
+              && EVP_DigestVerify(ctx, signature, sizeof(signature),
+                                  digest, digestlen) == 1;
+
+        EVP_MD_CTX_free(ctx);
+    }
+#endif
+
+    return ret;
+}
+
+/** Verify the signature by the keyring.
+ */
+static LrGpgBuiltinResult
+pgp_check_signature(LrPgpKeyring *keyring,
+                    const LrPgpSig *sig,
+                    int data_fd,
+                    off_t offset)
+{
+    guchar digest[EVP_MAX_MD_SIZE];
+    unsigned int digestlen = 0;
+    const EVP_MD *md = pgp_md(sig->hashalgo);
+    LrPgpKey *key;
+
+    if (sig->unknown
+        || !md
+        || !sig->has_issuer
+        || (sig->sigtype != PGP_SIG_BINARY && sig->sigtype != PGP_SIG_TEXT)
+        || !sig->mpi[0])
+        return LR_GPG_BUILTIN_UNKNOWN;
+
+    key = keyring_find(keyring, sig->issuer);
+    if (!key || !key->pkey || key->unusable
+        || (key->algo == PGP_ALGO_EDDSA) != (sig->pubalgo == PGP_ALGO_EDDSA))
+        return LR_GPG_BUILTIN_UNKNOWN;
+
+    if (!pgp_digest(data_fd, offset, sig, md, digest, &digestlen))
+        return LR_GPG_BUILTIN_UNKNOWN;
+
+    if (digest[0] != sig->left16[0] || digest[1] != sig->left16[1])
+        return LR_GPG_BUILTIN_BAD;
+
+    return pgp_verify(key, sig, md, digest, digestlen)
+           ? LR_GPG_BUILTIN_VALID : LR_GPG_BUILTIN_BAD;
+}
+
+LrGpgBuiltinResult
+lr_gpg_builtin_check_signature_fd(int signature_fd,
+                                  int data_fd,
+                                  const char *home_dir,
+                                  GError **err)
+{
+    LrGpgBuiltinResult ret = LR_GPG_BUILTIN_UNKNOWN;
+    LrPgpKeyring *keyring = NULL;
+    LrPgpSig sigs[MAX_SIGNATURES];
+    guint count = 0;
+    gboolean bad = FALSE;
+    guchar *buf, *dearmored = NULL;
+    off_t sig_offset, data_offset;
+    gsize len = 0;
+    ssize_t n;
+    const guchar *p, *body;
+    gsize left, bodylen;
+    int tag;
+
+    assert(!err || *err == NULL);
+
+    // The fds are read by pread(), so their positions are kept for GPGME
+    sig_offset = lseek(signature_fd, 0, SEEK_CUR);
+    data_offset = lseek(data_fd, 0, SEEK_CUR);
+    if (sig_offset == -1 || data_offset == -1)
+        return LR_GPG_BUILTIN_UNKNOWN;
+
+    buf = lr_malloc(MAX_SIGNATURE_SIZE + 1);
+    while (len <= MAX_SIGNATURE_SIZE
+           && (n = pread(signature_fd, buf + len, MAX_SIGNATURE_SIZE + 1 - len,
+                         sig_offset + len)) > 0)
+        len += n;
+    if (len == 0 || len > MAX_SIGNATURE_SIZE)
+        goto exit;
+
+    p = buf;
+    left = len;
+    if (!(buf[0] & 0x80)) {
+        dearmored = pgp_dearmor((gchar *) buf, len, &left);
+        if (!dearmored)
+            goto exit;
+        p = dearmored;
+    }
+
+    // Detached signature is a sequence of signature packets
+    while (left && count < MAX_SIGNATURES) {
+        if (!pgp_packet(&p, &left, &tag, &body, &bodylen)
+            || tag != PGP_TAG_SIGNATURE
+            || !pgp_signature(body, bodylen, &sigs[count]))
+            goto exit;
+        count++;
+    }
+    if (left || count == 0)
+        goto exit;
+
+    keyring = keyring_get(home_dir);
+    if (!keyring)
+        goto exit;
+
+    // Example of signature usage could be found in gpg.c, one valid
+    // signature is enough
+    ret = LR_GPG_BUILTIN_BAD;
+    for (guint i = 0; i < count; i++) {
+        LrGpgBuiltinResult res = pgp_check_signature(keyring, &sigs[i],
+                                                     data_fd, data_offset);
+        if (res == LR_GPG_BUILTIN_VALID) {
+            ret = LR_GPG_BUILTIN_VALID;
+            break;
+        }
+        if (res == LR_GPG_BUILTIN_UNKNOWN)
+            ret = LR_GPG_BUILTIN_UNKNOWN;
+        else
+            bad = TRUE;
+    }
+
+    if (ret == LR_GPG_BUILTIN_BAD) {
+        g_debug("%s: Bad GPG signature", __func__);
+        g_set_error(err, LR_GPG_ERROR, LRE_BADGPG, "Bad GPG signature");
+    } else if (ret == LR_GPG_BUILTIN_UNKNOWN && bad) {
+        g_debug("%s: Some signatures are bad, the rest is left to GPGME",
+                __func__);
+    }
+
+exit:
+    keyring_unref(keyring);
+    g_free(dearmored);
+    lr_free(buf);
+    return ret;
+}
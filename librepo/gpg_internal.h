@@ -0,0 +1,57 @@
+/* librepo - A library providing (libcURL like) API to downloading repository
+ * Copyright (C) 2012  Tomas Mlcoch
+ *
+ * Licensed under the GNU Lesser General Public License Version 2.1
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#ifndef __LR_GPG_INTERNAL_H__
+#define __LR_GPG_INTERNAL_H__
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/** Result of the in-process verification */
+typedef enum {
+    LR_GPG_BUILTIN_VALID,   /*!< A signature is valid */
+    LR_GPG_BUILTIN_BAD,     /*!< No signature is valid (err is set) */
+    LR_GPG_BUILTIN_UNKNOWN, /*!< Cannot be decided in-process (unknown key,
+                                 algorithm, subkey, expiring or revoked
+                                 key, ...),
+                                 GPGME has to be used */
+} LrGpgBuiltinResult;
+
+/** Verify detached signature of data in-process (by OpenSSL) with
+ * the public keys of the keyring (pubring.kbx or pubring.gpg) of
+ * the home_dir. Only what can be decided for sure is decided, everything
+ * else is left to GPGME. The positions of the fds are kept.
+ * @param signature_fd  File descriptor of signature file.
+ * @param data_fd       File descriptor of data to verify.
+ * @param home_dir      Configuration directory of OpenPGP engine or NULL
+ *                      ($GNUPGHOME or ~/.gnupg)
+ * @param err           GError **
+ * @return              Result of the verification
+ */
+LrGpgBuiltinResult
+lr_gpg_builtin_check_signature_fd(int signature_fd,
+                                  int data_fd,
+                                  const char *home_dir,
+                                  GError **err);
+
+G_END_DECLS
+
+#endif
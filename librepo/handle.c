@@ -45,7 +45,13 @@
 #include "yum_internal.h"
 #include "url_substitution.h"
 #include "downloader.h"
+#include "downloader_internal.h"
 #include "fastestmirror_internal.h"
+#include "mirrorregistry_internal.h"
+#include "parsecache.h"
+#include "mirrorlistcache.h"
+#include "preresolve.h"
+#include "tlssessioncache.h"
 #include "cleanup.h"
 
 CURL *
@@ -66,6 +72,106 @@ lr_get_curl_handle()
     return h;
 }
 
+/** Locks of the data shared by the curl share handles. The share of
+ * a handle is used by more threads at once, e.g. by the shards of
+ * a download (see LRO_DOWNLOADSHARDS) or by lr_handles_perform().
+ */
+static GMutex curl_share_locks[CURL_LOCK_DATA_LAST];
+
+static void
+lr_curl_share_lock(G_GNUC_UNUSED CURL *handle,
+                   curl_lock_data data,
+                   G_GNUC_UNUSED curl_lock_access access,
+                   G_GNUC_UNUSED void *userptr)
+{
+    g_mutex_lock(&curl_share_locks[data]);
+}
+
+static void
+lr_curl_share_unlock(G_GNUC_UNUSED CURL *handle,
+                     curl_lock_data data,
+                     G_GNUC_UNUSED void *userptr)
+{
+    g_mutex_unlock(&curl_share_locks[data]);
+}
+
+CURLSH *
+lr_get_curl_share(gboolean connections)
+{
+    CURLSH *sh;
+
+    lr_global_init();
+
+    sh = curl_share_init();
+    if (!sh)
+        return NULL;
+
+    curl_share_setopt(sh, CURLSHOPT_LOCKFUNC, lr_curl_share_lock);
+    curl_share_setopt(sh, CURLSHOPT_UNLOCKFUNC, lr_curl_share_unlock);
+
+    curl_share_setopt(sh, CURLSHOPT_SHARE, CURL_LOCK_DATA_DNS);
+    curl_share_setopt(sh, CURLSHOPT_SHARE, CURL_LOCK_DATA_SSL_SESSION);
+#if LR_CURL_VERSION_CHECK(7, 57, 0)
+    if (connections)
+        curl_share_setopt(sh, CURLSHOPT_SHARE, CURL_LOCK_DATA_CONNECT);
+#endif
+    return sh;
+}
+
+/** Lock of the lazy creation of the curl handles, the shards of
+ * a download (see LRO_DOWNLOADSHARDS) could ask for the handle at once.
+ */
+G_LOCK_DEFINE_STATIC(curl_handle);
+
+CURL *
+lr_handle_curl(LrHandle *handle)
+{
+    CURL *curl;
+
+    G_LOCK(curl_handle);
+
+    curl = handle->curl_handle;
+    if (!curl) {
+        curl = lr_get_curl_handle();
+        if (curl) {
+            handle->curl_handle = curl;
+            handle->curl_share = lr_get_curl_share(TRUE);
+            if (handle->curl_share)
+                curl_easy_setopt(curl, CURLOPT_SHARE, handle->curl_share);
+            // Sessions are imported to the share of the curl handle
+            lr_tlssessioncache_import(handle);
+        }
+    }
+
+    G_UNLOCK(curl_handle);
+
+    return curl;
+}
+
+CURLSH *
+lr_handle_curl_shard_share(LrHandle *handle)
+{
+    CURLSH *sh;
+
+    G_LOCK(curl_handle);
+
+    sh = handle->curl_shard_share;
+    if (!sh)
+        sh = handle->curl_shard_share = lr_get_curl_share(FALSE);
+
+    G_UNLOCK(curl_handle);
+
+    return sh;
+}
+
+/** curl_easy_setopt() on the curl handle of the handle, the curl handle
+ * is created by the first call.
+ */
+#define lr_handle_curl_setopt(handle, option, value) \
+    (lr_handle_curl(handle) \
+     ? curl_easy_setopt((handle)->curl_handle, option, value) \
+     : CURLE_FAILED_INIT)
+
 void
 lr_handle_free_list(char ***list)
 {
@@ -87,16 +193,17 @@ LrHandle *
 lr_handle_init()
 {
     LrHandle *handle;
-    CURL *curl = lr_get_curl_handle();
 
-    if (!curl)
-        return NULL;
+    // Curl is initialized only by the first operation which needs it
+    // (see lr_handle_curl()), local repositories don't need it at all
+    lr_global_init_logging();
 
     handle = lr_malloc0(sizeof(LrHandle));
-    handle->curl_handle = curl;
     handle->fastestmirrormaxage = LRO_FASTESTMIRRORMAXAGE_DEFAULT;
     handle->mirrorlist_fd = -1;
+    handle->mirrorlist_prefetch_fd = -1;
     handle->metalink_fd = -1;
+    handle->metalink_prefetch_fd = -1;
     handle->checks |= LR_CHECK_CHECKSUM;
     handle->maxparalleldownloads = LRO_MAXPARALLELDOWNLOADS_DEFAULT;
     handle->maxdownloadspermirror = LRO_MAXDOWNLOADSPERMIRROR_DEFAULT;
@@ -107,6 +214,52 @@ lr_handle_init()
     handle->allowed_mirror_failures = LRO_ALLOWEDMIRRORFAILURES_DEFAULT;
     handle->adaptivemirrorsorting = LRO_ADAPTIVEMIRRORSORTING_DEFAULT;
     handle->gnupghomedir = g_strdup(LRO_GNUPGHOMEDIR_DEFAULT);
+    handle->http2 = LRO_HTTP2_DEFAULT;
+    handle->maxstreamspermirror = LRO_MAXSTREAMSPERMIRROR_DEFAULT;
+    handle->maxsegments = LRO_MAXSEGMENTS_DEFAULT;
+    handle->minsegmentsize = LRO_MINSEGMENTSIZE_DEFAULT;
+    handle->writebuffersize = LRO_WRITEBUFFERSIZE_DEFAULT;
+    handle->preallocate = LRO_PREALLOCATE_DEFAULT;
+    handle->earlywriteback = LRO_EARLYWRITEBACK_DEFAULT;
+    handle->downloadorder = LRO_DOWNLOADORDER_DEFAULT;
+    handle->adaptivedownloadspermirror = LRO_ADAPTIVEDOWNLOADSPERMIRROR_DEFAULT;
+    handle->hedgeddownloads = LRO_HEDGEDDOWNLOADS_DEFAULT;
+    handle->lowspeedresume = LRO_LOWSPEEDRESUME_DEFAULT;
+    handle->progressinterval = LRO_PROGRESSINTERVAL_DEFAULT;
+    handle->yumkeepcompressed = LRO_YUMKEEPCOMPRESSED_DEFAULT;
+    handle->checksumthreads = LRO_CHECKSUMTHREADS_DEFAULT;
+    handle->checksumindex = LRO_CHECKSUMINDEX_DEFAULT;
+    handle->parsecache = LRO_PARSECACHE_DEFAULT;
+    handle->metalinkmaxurls = LRO_METALINKMAXURLS_DEFAULT;
+    handle->fastestmirrorconcurrency = LRO_FASTESTMIRRORCONCURRENCY_DEFAULT;
+    handle->fastestmirrorgoodcount = LRO_FASTESTMIRRORGOODCOUNT_DEFAULT;
+    handle->fastestmirrorasync = LRO_FASTESTMIRRORASYNC_DEFAULT;
+    handle->conditionalget = LRO_CONDITIONALGET_DEFAULT;
+    handle->lazychecksum = LRO_LAZYCHECKSUM_DEFAULT;
+    handle->mirrorlistcachettl = LRO_MIRRORLISTCACHETTL_DEFAULT;
+    handle->preresolve = LRO_PRERESOLVE_DEFAULT;
+    handle->preresolvecachettl = LRO_PRERESOLVECACHETTL_DEFAULT;
+    handle->packagestoremaxsize = LRO_PACKAGESTOREMAXSIZE_DEFAULT;
+    handle->cachesourcetimeout = LRO_CACHESOURCETIMEOUT_DEFAULT;
+    handle->localhardlink = LRO_LOCALHARDLINK_DEFAULT;
+    handle->durability = LRO_DURABILITY_DEFAULT;
+    handle->atomicdownload = LRO_ATOMICDOWNLOAD_DEFAULT;
+    handle->gpgbackend = LRO_GPGBACKEND_DEFAULT;
+    handle->mirrorbreaker = LRO_MIRRORBREAKER_DEFAULT;
+    handle->traceformat = LRO_TRACEFORMAT_DEFAULT;
+    handle->metricsinterval = LRO_METRICSINTERVAL_DEFAULT;
+    handle->downloadshards = LRO_DOWNLOADSHARDS_DEFAULT;
+    handle->shardendcb = LRO_SHARDENDCB_DEFAULT;
+    handle->iouring = LRO_IOURING_DEFAULT;
+    handle->resumejournal = LRO_RESUMEJOURNAL_DEFAULT;
+    handle->maxrangesperrequest = LRO_MAXRANGESPERREQUEST_DEFAULT;
+    handle->connectionaffinity = LRO_CONNECTIONAFFINITY_DEFAULT;
+    handle->autotuneparalleldownloads = LRO_AUTOTUNEPARALLELDOWNLOADS_DEFAULT;
+    handle->acceptencoding = LRO_ACCEPTENCODING_DEFAULT;
+    handle->criticalslots = LRO_CRITICALSLOTS_DEFAULT;
+    handle->recvbuffersize = LRO_RECVBUFFERSIZE_DEFAULT;
+    handle->endcbthreads = LRO_ENDCBTHREADS_DEFAULT;
+    handle->endcbqueuesize = LRO_ENDCBQUEUESIZE_DEFAULT;
 
     return handle;
 }
@@ -116,14 +269,36 @@ lr_handle_free(LrHandle *handle)
 {
     if (!handle)
         return;
+    // The background fastestmirror refresh uses copies of the settings
+    lr_fastestmirror_refresh_join(handle);
+    // Sessions are taken from the share of the curl handle
+    lr_tlssessioncache_export(handle);
     if (handle->curl_handle)
         curl_easy_cleanup(handle->curl_handle);
+    // Share could be cleaned up only after all easy handles which use it
+    if (handle->curl_share)
+        curl_share_cleanup(handle->curl_share);
+    if (handle->curl_shard_share)
+        curl_share_cleanup(handle->curl_shard_share);
+    // The list is used by the curl handle
+    if (handle->resolve)
+        curl_slist_free_all(handle->resolve);
     if (handle->mirrorlist_fd != -1)
         close(handle->mirrorlist_fd);
     if (handle->metalink_fd != -1)
         close(handle->metalink_fd);
+    if (handle->mirrorlist_prefetch_fd != -1)
+        close(handle->mirrorlist_prefetch_fd);
+    if (handle->metalink_prefetch_fd != -1)
+        close(handle->metalink_prefetch_fd);
     lr_handle_free_list(&handle->urls);
     lr_free(handle->fastestmirrorcache);
+    lr_free(handle->fastestmirrorprobe);
+    lr_free(handle->yumreusedir);
+    lr_free(handle->mirrorlistcache);
+    lr_free(handle->preresolvecache);
+    lr_free(handle->tlssessioncache);
+    lr_free(handle->packagestore);
     lr_free(handle->mirrorlist);
     lr_free(handle->mirrorlisturl);
     lr_free(handle->metalinkurl);
@@ -136,13 +311,131 @@ lr_handle_free(LrHandle *handle)
     lr_lrmirrorlist_free(handle->metalink_mirrors);
     lr_lrmirrorlist_free(handle->mirrors);
     lr_metalink_free(handle->metalink);
+    if (handle->yumdlist_set)
+        g_hash_table_destroy(handle->yumdlist_set);
+    if (handle->yumblist_set)
+        g_hash_table_destroy(handle->yumblist_set);
+    if (handle->yumdecompress_set)
+        g_hash_table_destroy(handle->yumdecompress_set);
     lr_handle_free_list(&handle->yumdlist);
     lr_handle_free_list(&handle->yumblist);
+    lr_handle_free_list(&handle->yumdecompress);
+    lr_handle_free_list(&handle->cachesources);
+    lr_handle_free_list(&handle->proxies);
+    lr_proxypool_free(handle->proxypool);
     lr_urlvars_free(handle->urlvars);
     lr_free(handle->gnupghomedir);
+    lr_mirrorregistry_release_health(handle->mirrorhealthcache);
+    lr_free(handle->mirrorhealthcache);
+    lr_trace_close(handle->trace);
+    lr_free(handle->tracefile);
+    lr_stats_free(handle->stats);
     lr_free(handle);
 }
 
+static void
+lr_mirrorstats_free(LrMirrorStats *mirror)
+{
+    if (!mirror)
+        return;
+    lr_free(mirror->url);
+    lr_free(mirror);
+}
+
+void
+lr_stats_free(LrStats *stats)
+{
+    if (!stats)
+        return;
+    g_slist_free_full(stats->mirrors, (GDestroyNotify) lr_mirrorstats_free);
+    lr_free(stats);
+}
+
+static LrStats *
+lr_stats_copy(LrStats *stats)
+{
+    LrStats *copy = lr_malloc0(sizeof(*copy));
+
+    if (!stats)
+        return copy;
+
+    *copy = *stats;
+    copy->mirrors = NULL;
+    for (GSList *elem = stats->mirrors; elem; elem = g_slist_next(elem)) {
+        LrMirrorStats *mirror = lr_malloc(sizeof(*mirror));
+        *mirror = *((LrMirrorStats *) elem->data);
+        mirror->url = g_strdup(mirror->url);
+        copy->mirrors = g_slist_prepend(copy->mirrors, mirror);
+    }
+    copy->mirrors = g_slist_reverse(copy->mirrors);
+    return copy;
+}
+
+void
+lr_handle_stats_reset(LrHandle *handle)
+{
+    lr_stats_free(handle->stats);
+    handle->stats = NULL;
+    lr_alloc_stats_get(&handle->alloc_start, NULL);
+}
+
+void
+lr_handle_stats_alloc_update(LrHandle *handle)
+{
+    LrAllocStats now;
+
+    if (!handle->stats)
+        return;
+
+    lr_alloc_stats_get(&now, NULL);
+    // The counters could be reset by lr_alloc_stats_reset() meanwhile
+    if (now.count < handle->alloc_start.count)
+        handle->alloc_start = (LrAllocStats) { 0 };
+    handle->stats->allocations = now.count - handle->alloc_start.count;
+    handle->stats->allocated_bytes = now.bytes - handle->alloc_start.bytes;
+}
+
+LrMirrorStats *
+lr_handle_stats_mirror(LrHandle *handle, const char *url)
+{
+    LrMirrorStats *mirror;
+
+    if (!handle->stats)
+        handle->stats = lr_malloc0(sizeof(LrStats));
+
+    for (GSList *elem = handle->stats->mirrors; elem; elem = g_slist_next(elem)) {
+        mirror = elem->data;
+        if (!g_strcmp0(mirror->url, url))
+            return mirror;
+    }
+
+    mirror = lr_malloc0(sizeof(*mirror));
+    mirror->url = g_strdup(url);
+    handle->stats->mirrors = g_slist_append(handle->stats->mirrors, mirror);
+    return mirror;
+}
+
+/** Finish the current trace file and create the LRO_TRACEFILE
+ * (if it is set) in the LRO_TRACEFORMAT.
+ */
+static gboolean
+lr_handle_open_trace(LrHandle *handle, GError **err)
+{
+    lr_trace_close(handle->trace);
+    handle->trace = NULL;
+
+    if (!handle->tracefile)
+        return TRUE;
+
+    handle->trace = lr_trace_open(handle->tracefile, handle->traceformat, err);
+    if (!handle->trace) {
+        lr_free(handle->tracefile);
+        handle->tracefile = NULL;
+        return FALSE;
+    }
+    return TRUE;
+}
+
 typedef enum {
     LR_REMOTESOURCE_URLS,
     LR_REMOTESOURCE_MIRRORLIST,
@@ -196,7 +489,6 @@ lr_handle_setopt(LrHandle *handle,
     gboolean ret = TRUE;
     va_list arg;
     CURLcode c_rc = CURLE_OK;
-    CURL *c_h;
 
     assert(!err || *err == NULL);
 
@@ -210,8 +502,6 @@ lr_handle_setopt(LrHandle *handle,
         return FALSE;
     }
 
-    c_h = handle->curl_handle;
-
     va_start(arg, option);
 
     switch (option) {
@@ -263,21 +553,29 @@ lr_handle_setopt(LrHandle *handle,
 
     case LRO_HTTPAUTH:
         if (va_arg(arg, long) ==  1)
-            c_rc = curl_easy_setopt(c_h, CURLOPT_HTTPAUTH, CURLAUTH_ANY);
+            c_rc = lr_handle_curl_setopt(handle, CURLOPT_HTTPAUTH, CURLAUTH_ANY);
         else
-            c_rc = curl_easy_setopt(c_h, CURLOPT_HTTPAUTH, CURLAUTH_BASIC);
+            c_rc = lr_handle_curl_setopt(handle, CURLOPT_HTTPAUTH,
+                                         CURLAUTH_BASIC);
         break;
 
-    case LRO_USERPWD:
-        c_rc = curl_easy_setopt(c_h, CURLOPT_USERPWD, va_arg(arg, char *));
+    case LRO_USERPWD: {
+        char *userpwd = va_arg(arg, char *);
+        handle->userpwd = userpwd != NULL;
+        c_rc = lr_handle_curl_setopt(handle, CURLOPT_USERPWD, userpwd);
         break;
+    }
 
-    case LRO_PROXY:
-        c_rc = curl_easy_setopt(c_h, CURLOPT_PROXY, va_arg(arg, char *));
+    case LRO_PROXY: {
+        char *proxy = va_arg(arg, char *);
+        handle->proxy = proxy != NULL;
+        c_rc = lr_handle_curl_setopt(handle, CURLOPT_PROXY, proxy);
         break;
+    }
 
     case LRO_PROXYPORT: {
-        c_rc = curl_easy_setopt(c_h, CURLOPT_PROXYPORT,va_arg(arg, long));
+        c_rc = lr_handle_curl_setopt(handle, CURLOPT_PROXYPORT,
+                                     va_arg(arg, long));
         break;
     }
 
@@ -297,21 +595,28 @@ lr_handle_setopt(LrHandle *handle,
                     "Bad LRO_PROXYTYPE value");
             ret = FALSE;
         } else {
-            c_rc = curl_easy_setopt(c_h, CURLOPT_PROXYTYPE, curl_proxy);
+            c_rc = lr_handle_curl_setopt(handle, CURLOPT_PROXYTYPE,
+                                         curl_proxy);
         }
         break;
     }
 
     case LRO_PROXYAUTH:
         if (va_arg(arg, long) == 1)
-            c_rc = curl_easy_setopt(c_h, CURLOPT_PROXYAUTH, CURLAUTH_ANY);
+            c_rc = lr_handle_curl_setopt(handle, CURLOPT_PROXYAUTH,
+                                         CURLAUTH_ANY);
         else
-            c_rc = curl_easy_setopt(c_h, CURLOPT_PROXYAUTH, CURLAUTH_BASIC);
+            c_rc = lr_handle_curl_setopt(handle, CURLOPT_PROXYAUTH,
+                                         CURLAUTH_BASIC);
         break;
 
-    case LRO_PROXYUSERPWD:
-        c_rc = curl_easy_setopt(c_h, CURLOPT_PROXYUSERPWD, va_arg(arg, char *));
+    case LRO_PROXYUSERPWD: {
+        char *proxyuserpwd = va_arg(arg, char *);
+        handle->proxyuserpwd = proxyuserpwd != NULL;
+        c_rc = lr_handle_curl_setopt(handle, CURLOPT_PROXYUSERPWD,
+                                     proxyuserpwd);
         break;
+    }
 
     case LRO_PROGRESSCB:
         handle->user_cb = va_arg(arg, LrProgressCb);
@@ -354,7 +659,8 @@ lr_handle_setopt(LrHandle *handle,
         break;
 
     case LRO_CONNECTTIMEOUT:
-        c_rc = curl_easy_setopt(c_h, CURLOPT_CONNECTTIMEOUT, va_arg(arg, long));
+        c_rc = lr_handle_curl_setopt(handle, CURLOPT_CONNECTTIMEOUT,
+                                     va_arg(arg, long));
         break;
 
     case LRO_IGNOREMISSING:
@@ -369,7 +675,7 @@ lr_handle_setopt(LrHandle *handle,
         char *useragent = va_arg(arg, char *);
         if (handle->useragent) lr_free(handle->useragent);
         handle->useragent = g_strdup(useragent);
-        c_rc = curl_easy_setopt(c_h, CURLOPT_USERAGENT, useragent);
+        c_rc = lr_handle_curl_setopt(handle, CURLOPT_USERAGENT, useragent);
         break;
     }
 
@@ -389,20 +695,35 @@ lr_handle_setopt(LrHandle *handle,
 
     case LRO_URLS:
     case LRO_YUMDLIST:
-    case LRO_YUMBLIST: {
+    case LRO_YUMBLIST:
+    case LRO_YUMDECOMPRESS:
+    case LRO_CACHESOURCES: {
         int size = 0;
         char **list = va_arg(arg, char **);
         char ***handle_list = NULL;
+        GHashTable **handle_set = NULL;
 
         if (option == LRO_URLS) {
             handle_list = &handle->urls;
             lr_handle_remote_sources_changed(handle, LR_REMOTESOURCE_URLS);
         } else if (option == LRO_YUMDLIST) {
             handle_list = &handle->yumdlist;
-        } else {
+            handle_set = &handle->yumdlist_set;
+        } else if (option == LRO_YUMBLIST) {
             handle_list = &handle->yumblist;
+            handle_set = &handle->yumblist_set;
+        } else if (option == LRO_YUMDECOMPRESS) {
+            handle_list = &handle->yumdecompress;
+            handle_set = &handle->yumdecompress_set;
+        } else {
+            handle_list = &handle->cachesources;
         }
 
+        // The set references strings of the list, drop it first
+        if (handle_set && *handle_set) {
+            g_hash_table_destroy(*handle_set);
+            *handle_set = NULL;
+        }
         lr_handle_free_list(handle_list);
         if (!list)
             break;
@@ -421,6 +742,14 @@ lr_handle_setopt(LrHandle *handle,
         *handle_list = lr_malloc0(size * sizeof(char *));
         for (int x = 0; x < size; x++)
             (*handle_list)[x] = g_strdup(list[x]);
+
+        if (handle_set) {
+            *handle_set = g_hash_table_new(g_str_hash, g_str_equal);
+            for (int x = 0; (*handle_list)[x]; x++)
+                g_hash_table_insert(*handle_set,
+                                    (*handle_list)[x],
+                                    (*handle_list)[x]);
+        }
         break;
     }
 
@@ -524,7 +853,7 @@ lr_handle_setopt(LrHandle *handle,
                         "Value of LRO_LOWSPEEDTIME is too low.");
             ret = FALSE;
         } else {
-            curl_easy_setopt(c_h, CURLOPT_LOW_SPEED_TIME, val_long);
+            lr_handle_curl_setopt(handle, CURLOPT_LOW_SPEED_TIME, val_long);
         }
 
         break;
@@ -543,7 +872,7 @@ lr_handle_setopt(LrHandle *handle,
                         val_long, handle->maxspeed);
             ret = FALSE;
         } else {
-            curl_easy_setopt(c_h, CURLOPT_LOW_SPEED_LIMIT, val_long);
+            lr_handle_curl_setopt(handle, CURLOPT_LOW_SPEED_LIMIT, val_long);
             handle->lowspeedlimit = val_long;
         }
 
@@ -555,12 +884,14 @@ lr_handle_setopt(LrHandle *handle,
 
     case LRO_SSLVERIFYPEER:
         handle->sslverifypeer = va_arg(arg, long) ? 1 : 0;
-        c_rc = curl_easy_setopt(c_h, CURLOPT_SSL_VERIFYPEER, handle->sslverifypeer);
+        c_rc = lr_handle_curl_setopt(handle, CURLOPT_SSL_VERIFYPEER,
+                                     handle->sslverifypeer);
         break;
 
     case LRO_SSLVERIFYHOST:
         handle->sslverifyhost = va_arg(arg, long) ? 2 : 0;
-        c_rc = curl_easy_setopt(c_h, CURLOPT_SSL_VERIFYPEER, handle->sslverifyhost);
+        c_rc = lr_handle_curl_setopt(handle, CURLOPT_SSL_VERIFYPEER,
+                                     handle->sslverifyhost);
         break;
 
     case LRO_IPRESOLVE: {
@@ -578,7 +909,7 @@ lr_handle_setopt(LrHandle *handle,
             ret = FALSE;
         } else {
             handle->ipresolve = lr_type;
-            c_rc = curl_easy_setopt(c_h, CURLOPT_IPRESOLVE, type);
+            c_rc = lr_handle_curl_setopt(handle, CURLOPT_IPRESOLVE, type);
         }
         break;
     }
@@ -598,157 +929,688 @@ lr_handle_setopt(LrHandle *handle,
         break;
     }
 
-    default:
-        g_set_error(err, LR_HANDLE_ERROR, LRE_BADOPTARG,
-                    "Unknown option");
-        ret = FALSE;
-        break;
-    };
-
-    /* Handle CURL error return code */
-    if (ret == TRUE && c_rc != CURLE_OK) {
-        ret = FALSE;
-        switch (c_rc) {
-        case CURLE_FAILED_INIT:
+    case LRO_HTTP2:
+        handle->http2 = va_arg(arg, long) ? 1 : 0;
+#if LR_CURL_VERSION_CHECK(7, 47, 0)
+        c_rc = lr_handle_curl_setopt(handle, CURLOPT_HTTP_VERSION,
+                                     handle->http2 ? CURL_HTTP_VERSION_2TLS
+                                                   : CURL_HTTP_VERSION_NONE);
+        if (c_rc == CURLE_OK)
+            // Rather wait for multiplexing than open a new connection
+            c_rc = lr_handle_curl_setopt(handle, CURLOPT_PIPEWAIT,
+                                         (long) handle->http2);
+#else
+        if (handle->http2) {
             g_set_error(err, LR_HANDLE_ERROR, LRE_CURLSETOPT,
-                        "curl_easy_setopt error: %s",
-                        curl_easy_strerror(c_rc));
-            break;
-        default:
-            g_set_error(err, LR_HANDLE_ERROR, LRE_CURL,
-                        "curl error: %s",
-                        curl_easy_strerror(c_rc));
-            break;
-        };
-    }
+                        "LRO_HTTP2 requires curl >= 7.47.0");
+            ret = FALSE;
+        }
+#endif
+        break;
 
-    va_end(arg);
-    return ret;
-}
+    case LRO_MAXSTREAMSPERMIRROR:
+        val_long = va_arg(arg, long);
 
-/*
- * Internal mirrorlist stuff
- */
+        if (val_long < LRO_MAXSTREAMSPERMIRROR_MIN) {
+            g_set_error(err, LR_HANDLE_ERROR, LRE_BADOPTARG,
+                        "Value of LRO_MAXSTREAMSPERMIRROR is too low.");
+            ret = FALSE;
+        } else {
+            handle->maxstreamspermirror = val_long;
+        }
 
-static gboolean
-lr_handle_prepare_urls(LrHandle *handle, GError **err)
-{
-    assert(!handle->urls_mirrors);
+        break;
 
-    int x = 0;
-    while (handle->urls[x]) {
-        gchar *url = handle->urls[x];
-        gchar *final_url = NULL;
+    case LRO_MAXSEGMENTS:
+        val_long = va_arg(arg, long);
 
-        if (strstr(url, "://")) {
-            // Base URL has specified protocol
-            final_url = g_strdup(url);
+        if (val_long < LRO_MAXSEGMENTS_MIN) {
+            g_set_error(err, LR_HANDLE_ERROR, LRE_BADOPTARG,
+                        "Value of LRO_MAXSEGMENTS is too low.");
+            ret = FALSE;
         } else {
-            // No protocol specified - if local path => prepend file://
-            if (url[0] == '/') {
-                // Base URL is absolute path
-                final_url = g_strconcat("file://", url, NULL);
-            } else {
-                // Base URL is relative path
-                char *resolved_path = realpath(url, NULL);
-                if (!resolved_path) {
-                    g_debug("%s: realpath: %s", __func__, strerror(errno));
-                    g_set_error(err, LR_HANDLE_ERROR, LRE_BADURL,
-                                "realpath(%s) error: %s",
-                                url, strerror(errno));
-                    return FALSE;
-                }
-                final_url = g_strconcat("file://", resolved_path, NULL);
-                free(resolved_path);
-            }
+            handle->maxsegments = val_long;
         }
 
-        if (final_url) {
-            handle->urls_mirrors = lr_lrmirrorlist_append_url(
-                                                handle->urls_mirrors,
-                                                final_url,
-                                                handle->urlvars);
-            lr_free(final_url);
+        break;
+
+    case LRO_MINSEGMENTSIZE:
+        val_gint64 = va_arg(arg, gint64);
+        if (val_gint64 <= 0) {
+            g_set_error(err, LR_HANDLE_ERROR, LRE_BADOPTARG,
+                        "Bad value of LRO_MINSEGMENTSIZE");
+            ret = FALSE;
+            break;
         }
+        handle->minsegmentsize = val_gint64;
+        break;
 
-        x++;
-    }
+    case LRO_WRITEBUFFERSIZE:
+        val_long = va_arg(arg, long);
 
-    return TRUE;
-}
+        if (val_long < 0) {
+            g_set_error(err, LR_HANDLE_ERROR, LRE_BADOPTARG,
+                        "Value of LRO_WRITEBUFFERSIZE cannot be negative.");
+            ret = FALSE;
+        } else {
+            handle->writebuffersize = val_long;
+        }
 
-static gboolean
-lr_handle_prepare_mirrorlist(LrHandle *handle, gchar *localpath, GError **err)
-{
-    assert(handle->mirrorlist_fd == -1);
-    assert(!handle->mirrorlist_mirrors);
+        break;
 
-    int fd = -1;
+    case LRO_PREALLOCATE:
+        handle->preallocate = va_arg(arg, long) ? 1 : 0;
+        break;
 
-    // Get file descriptor with content
+    case LRO_EARLYWRITEBACK:
+        handle->earlywriteback = va_arg(arg, long) ? 1 : 0;
+        break;
 
-    if (!localpath && !handle->mirrorlisturl) {
-        // Nothing to do
-        return TRUE;
-    } else if (localpath && !handle->mirrorlisturl) {
-        // Just try to use mirrorlist of the local repository
-        gchar *path = lr_pathconcat(localpath, "mirrorlist", NULL);
-        if (g_file_test(path, G_FILE_TEST_IS_REGULAR)) {
-            g_debug("%s: Local mirrorlist found at %s", __func__, path);
-            fd = open(path, O_RDONLY);
-            if (fd < 0) {
-                g_set_error(err, LR_HANDLE_ERROR, LRE_IO,
-                            "Cannot open %s: %s",
-                            path, strerror(errno));
-                g_free(path);
-                return FALSE;
-            }
-            g_free(path);
-        } else {
-            // No local mirrorlist
-            g_free(path);
-            return TRUE;
+    case LRO_DOWNLOADORDER: {
+        LrDownloadOrder order = va_arg(arg, LrDownloadOrder);
+        switch (order) {
+            case LR_DOWNLOADORDER_FIFO:
+            case LR_DOWNLOADORDER_LARGESTFIRST:
+            case LR_DOWNLOADORDER_SMALLESTFIRST:
+            case LR_DOWNLOADORDER_PRIORITY:
+                handle->downloadorder = order;
+                break;
+            default:
+                g_set_error(err, LR_HANDLE_ERROR, LRE_BADOPTARG,
+                        "Bad LRO_DOWNLOADORDER value");
+                ret = FALSE;
+                break;
         }
-    } else if (handle->mirrorlisturl) {
-        // Download remote mirrorlist
-        _cleanup_free_ gchar *url = NULL;
+        break;
+    }
 
-        fd = lr_gettmpfile();
-        if (fd < 0) {
-            g_debug("%s: Cannot create a temporary file", __func__);
-            g_set_error(err, LR_HANDLE_ERROR, LRE_IO,
-                        "Cannot create a temporary file");
-            return FALSE;
-        }
+    case LRO_ADAPTIVEDOWNLOADSPERMIRROR:
+        handle->adaptivedownloadspermirror = va_arg(arg, long) ? 1 : 0;
+        break;
 
-        url = lr_prepend_url_protocol(handle->mirrorlisturl);
-        if (!lr_download_url(handle, url, fd, err)) {
-            close(fd);
-            return FALSE;
-        }
+    case LRO_HEDGEDDOWNLOADS:
+        handle->hedgeddownloads = va_arg(arg, long) ? 1 : 0;
+        break;
 
-        if (lseek(fd, 0, SEEK_SET) != 0) {
-            g_debug("%s: Seek error: %s", __func__, strerror(errno));
-            g_set_error(err, LR_HANDLE_ERROR, LRE_IO,
-                        "lseek(%d, 0, SEEK_SET) error: %s",
-                        fd, strerror(errno));
-            close(fd);
-            return FALSE;
+    case LRO_LOWSPEEDRESUME:
+        handle->lowspeedresume = va_arg(arg, long) ? 1 : 0;
+        break;
+
+    case LRO_PROGRESSINTERVAL:
+        val_long = va_arg(arg, long);
+
+        if (val_long < LRO_PROGRESSINTERVAL_MIN) {
+            g_set_error(err, LR_HANDLE_ERROR, LRE_BADOPTARG,
+                        "Value of LRO_PROGRESSINTERVAL is too low.");
+            ret = FALSE;
+        } else {
+            handle->progressinterval = val_long;
         }
-    }
 
-    assert(fd >= 0);
+        break;
 
-    // Parse the file descriptor content
+    case LRO_MULTIPROGRESSCB:
+        handle->multiprogresscb = va_arg(arg, LrMultiProgressCb);
+        break;
 
-    g_debug("%s: Parsing mirrorlist", __func__);
+    case LRO_METRICSCB:
+        handle->metricscb = va_arg(arg, LrMetricsCb);
+        break;
 
-    LrMirrorlist *ml = lr_mirrorlist_init();
-    gboolean ret = lr_mirrorlist_parse_file(ml, fd, err);
-    if (!ret) {
-        g_debug("%s: Error while parsing mirrorlist", __func__);
-        close(fd);
-        lr_mirrorlist_free(ml);
+    case LRO_METRICSINTERVAL:
+        val_long = va_arg(arg, long);
+
+        if (val_long < LRO_METRICSINTERVAL_MIN) {
+            g_set_error(err, LR_HANDLE_ERROR, LRE_BADOPTARG,
+                        "Value of LRO_METRICSINTERVAL is too low.");
+            ret = FALSE;
+        } else {
+            handle->metricsinterval = val_long;
+        }
+        break;
+
+    case LRO_DOWNLOADSHARDS:
+        val_long = va_arg(arg, long);
+
+        if (val_long < LRO_DOWNLOADSHARDS_MIN ||
+            val_long > LRO_DOWNLOADSHARDS_MAX) {
+            g_set_error(err, LR_HANDLE_ERROR, LRE_BADOPTARG,
+                        "Bad value of LRO_DOWNLOADSHARDS.");
+            ret = FALSE;
+        } else {
+            handle->downloadshards = val_long;
+        }
+        break;
+
+    case LRO_SHARDENDCB:
+        handle->shardendcb = va_arg(arg, long) ? 1 : 0;
+        break;
+
+    case LRO_IOURING:
+        handle->iouring = va_arg(arg, long) ? 1 : 0;
+        break;
+
+    case LRO_RESUMEJOURNAL:
+        handle->resumejournal = va_arg(arg, long) ? 1 : 0;
+        break;
+
+    case LRO_MAXRANGESPERREQUEST:
+        val_long = va_arg(arg, long);
+
+        if (val_long < LRO_MAXRANGESPERREQUEST_MIN) {
+            g_set_error(err, LR_HANDLE_ERROR, LRE_BADOPTARG,
+                        "Value of LRO_MAXRANGESPERREQUEST is too low.");
+            ret = FALSE;
+        } else {
+            handle->maxrangesperrequest = val_long;
+        }
+
+        break;
+
+    case LRO_CONNECTIONAFFINITY:
+        handle->connectionaffinity = va_arg(arg, long) ? 1 : 0;
+        break;
+
+    case LRO_AUTOTUNEPARALLELDOWNLOADS:
+        handle->autotuneparalleldownloads = va_arg(arg, long) ? 1 : 0;
+        break;
+
+    case LRO_ACCEPTENCODING:
+        handle->acceptencoding = va_arg(arg, long) ? 1 : 0;
+        break;
+
+    case LRO_CRITICALSLOTS:
+        val_long = va_arg(arg, long);
+
+        if (val_long < LRO_CRITICALSLOTS_MIN) {
+            g_set_error(err, LR_HANDLE_ERROR, LRE_BADOPTARG,
+                        "Value of LRO_CRITICALSLOTS is too low.");
+            ret = FALSE;
+        } else {
+            handle->criticalslots = val_long;
+        }
+        break;
+
+    case LRO_PROXIES: {
+        char **list = va_arg(arg, char **);
+        LrProxyPool *pool = NULL;
+
+        if (list && *list) {
+            pool = lr_proxypool_new(list, err);
+            if (!pool) {
+                ret = FALSE;
+                break;
+            }
+        }
+
+        lr_handle_free_list(&handle->proxies);
+        lr_proxypool_free(handle->proxypool);
+        handle->proxies = pool ? lr_strv_dup(list) : NULL;
+        handle->proxypool = pool;
+        break;
+    }
+
+    case LRO_RECVBUFFERSIZE:
+        val_long = va_arg(arg, long);
+
+        if (val_long < 0) {
+            g_set_error(err, LR_HANDLE_ERROR, LRE_BADOPTARG,
+                        "Value of LRO_RECVBUFFERSIZE cannot be negative.");
+            ret = FALSE;
+        } else if (val_long > LRO_RECVBUFFERSIZE_MAX) {
+            g_set_error(err, LR_HANDLE_ERROR, LRE_BADOPTARG,
+                        "Value of LRO_RECVBUFFERSIZE is too high.");
+            ret = FALSE;
+        } else {
+            // 0 resets the buffer to the default size of libcurl
+            c_rc = lr_handle_curl_setopt(handle, CURLOPT_BUFFERSIZE, val_long);
+            handle->recvbuffersize = val_long;
+        }
+
+        break;
+
+    case LRO_ENDCBTHREADS:
+        val_long = va_arg(arg, long);
+
+        if (val_long < LRO_ENDCBTHREADS_MIN) {
+            g_set_error(err, LR_HANDLE_ERROR, LRE_BADOPTARG,
+                        "Value of LRO_ENDCBTHREADS is too low.");
+            ret = FALSE;
+        } else {
+            handle->endcbthreads = val_long;
+        }
+
+        break;
+
+    case LRO_ENDCBQUEUESIZE:
+        val_long = va_arg(arg, long);
+
+        if (val_long < LRO_ENDCBQUEUESIZE_MIN) {
+            g_set_error(err, LR_HANDLE_ERROR, LRE_BADOPTARG,
+                        "Value of LRO_ENDCBQUEUESIZE is too low.");
+            ret = FALSE;
+        } else {
+            handle->endcbqueuesize = val_long;
+        }
+
+        break;
+
+    case LRO_YUMKEEPCOMPRESSED:
+        handle->yumkeepcompressed = va_arg(arg, long) ? 1 : 0;
+        break;
+
+    case LRO_CHECKSUMTHREADS:
+        val_long = va_arg(arg, long);
+
+        if (val_long < LRO_CHECKSUMTHREADS_MIN) {
+            g_set_error(err, LR_HANDLE_ERROR, LRE_BADOPTARG,
+                        "Value of LRO_CHECKSUMTHREADS is too low.");
+            ret = FALSE;
+        } else {
+            handle->checksumthreads = val_long;
+        }
+
+        break;
+
+    case LRO_CHECKSUMINDEX:
+        handle->checksumindex = va_arg(arg, long) ? 1 : 0;
+        break;
+
+    case LRO_PARSECACHE:
+        handle->parsecache = va_arg(arg, long) ? 1 : 0;
+        break;
+
+    case LRO_METALINKMAXURLS:
+        val_long = va_arg(arg, long);
+
+        if (val_long < LRO_METALINKMAXURLS_MIN) {
+            g_set_error(err, LR_HANDLE_ERROR, LRE_BADOPTARG,
+                        "Value of LRO_METALINKMAXURLS is too low.");
+            ret = FALSE;
+        } else {
+            handle->metalinkmaxurls = val_long;
+        }
+
+        break;
+
+    case LRO_FASTESTMIRRORPROBE: {
+        char *fastestmirrorprobe = va_arg(arg, char *);
+        if (handle->fastestmirrorprobe) lr_free(handle->fastestmirrorprobe);
+        handle->fastestmirrorprobe = g_strdup(fastestmirrorprobe);
+        break;
+    }
+
+    case LRO_FASTESTMIRRORCONCURRENCY:
+        val_long = va_arg(arg, long);
+
+        if (val_long < LRO_FASTESTMIRRORCONCURRENCY_MIN) {
+            g_set_error(err, LR_HANDLE_ERROR, LRE_BADOPTARG,
+                        "Value of LRO_FASTESTMIRRORCONCURRENCY is too low.");
+            ret = FALSE;
+        } else {
+            handle->fastestmirrorconcurrency = val_long;
+        }
+
+        break;
+
+    case LRO_FASTESTMIRRORGOODCOUNT:
+        val_long = va_arg(arg, long);
+
+        if (val_long < LRO_FASTESTMIRRORGOODCOUNT_MIN) {
+            g_set_error(err, LR_HANDLE_ERROR, LRE_BADOPTARG,
+                        "Value of LRO_FASTESTMIRRORGOODCOUNT is too low.");
+            ret = FALSE;
+        } else {
+            handle->fastestmirrorgoodcount = val_long;
+        }
+
+        break;
+
+    case LRO_FASTESTMIRRORASYNC:
+        handle->fastestmirrorasync = va_arg(arg, long) ? 1 : 0;
+        break;
+
+    case LRO_CONDITIONALGET:
+        handle->conditionalget = va_arg(arg, long) ? 1 : 0;
+        break;
+
+    case LRO_YUMREUSEDIR: {
+        char *yumreusedir = va_arg(arg, char *);
+        if (handle->yumreusedir) lr_free(handle->yumreusedir);
+        handle->yumreusedir = g_strdup(yumreusedir);
+        break;
+    }
+
+    case LRO_YUMRECORDCB:
+        handle->yumrecordcb = va_arg(arg, LrYumRecordCb);
+        break;
+
+    case LRO_LAZYCHECKSUM:
+        handle->lazychecksum = va_arg(arg, long) ? 1 : 0;
+        break;
+
+    case LRO_MIRRORLISTCACHE:
+    {
+        char *dir = va_arg(arg, char *);
+        if (handle->mirrorlistcache) lr_free(handle->mirrorlistcache);
+        handle->mirrorlistcache = g_strdup(dir);
+        break;
+    }
+
+    case LRO_MIRRORLISTCACHETTL:
+        val_long = va_arg(arg, long);
+
+        if (val_long < 0) {
+            g_set_error(err, LR_HANDLE_ERROR, LRE_BADOPTARG,
+                        "Value of LRO_MIRRORLISTCACHETTL is too low.");
+            ret = FALSE;
+        } else {
+            handle->mirrorlistcachettl = val_long;
+        }
+        break;
+
+    case LRO_PRERESOLVE:
+        handle->preresolve = va_arg(arg, long) ? 1 : 0;
+        break;
+
+    case LRO_PRERESOLVECACHE:
+    {
+        char *path = va_arg(arg, char *);
+        if (handle->preresolvecache) lr_free(handle->preresolvecache);
+        handle->preresolvecache = g_strdup(path);
+        break;
+    }
+
+    case LRO_PRERESOLVECACHETTL:
+        val_long = va_arg(arg, long);
+
+        if (val_long < 0) {
+            g_set_error(err, LR_HANDLE_ERROR, LRE_BADOPTARG,
+                        "Value of LRO_PRERESOLVECACHETTL is too low.");
+            ret = FALSE;
+        } else {
+            handle->preresolvecachettl = val_long;
+        }
+        break;
+
+    case LRO_TLSSESSIONCACHE:
+    {
+        char *path = va_arg(arg, char *);
+        if (handle->tlssessioncache) lr_free(handle->tlssessioncache);
+        handle->tlssessioncache = g_strdup(path);
+        lr_tlssessioncache_import(handle);
+        break;
+    }
+
+    case LRO_PACKAGESTORE:
+        if (handle->packagestore) lr_free(handle->packagestore);
+        handle->packagestore = g_strdup(va_arg(arg, char *));
+        break;
+
+    case LRO_MIRRORHEALTHCACHE:
+        lr_mirrorregistry_release_health(handle->mirrorhealthcache);
+        if (handle->mirrorhealthcache) lr_free(handle->mirrorhealthcache);
+        handle->mirrorhealthcache = g_strdup(va_arg(arg, char *));
+        lr_mirrorregistry_use_health(handle->mirrorhealthcache);
+        break;
+
+    case LRO_MIRRORBREAKER:
+        val_long = va_arg(arg, long);
+
+        if (val_long < 0) {
+            g_set_error(err, LR_HANDLE_ERROR, LRE_BADOPTARG,
+                        "Value of LRO_MIRRORBREAKER is too low.");
+            ret = FALSE;
+        } else {
+            handle->mirrorbreaker = val_long;
+        }
+        break;
+
+    case LRO_TRACEFILE:
+        if (handle->tracefile) lr_free(handle->tracefile);
+        handle->tracefile = g_strdup(va_arg(arg, char *));
+        ret = lr_handle_open_trace(handle, err);
+        break;
+
+    case LRO_TRACEFORMAT: {
+        LrTraceFormat traceformat = va_arg(arg, LrTraceFormat);
+        switch (traceformat) {
+            case LR_TRACE_CHROME:
+            case LR_TRACE_JSONLINES:
+                handle->traceformat = traceformat;
+                if (handle->trace)
+                    ret = lr_handle_open_trace(handle, err);
+                break;
+            default:
+                g_set_error(err, LR_HANDLE_ERROR, LRE_BADOPTARG,
+                        "Bad LRO_TRACEFORMAT value");
+                ret = FALSE;
+                break;
+        }
+        break;
+    }
+
+    case LRO_PACKAGESTOREMAXSIZE:
+        val_gint64 = va_arg(arg, gint64);
+        if (val_gint64 < 0) {
+            g_set_error(err, LR_HANDLE_ERROR, LRE_BADOPTARG,
+                        "Bad value of LRO_PACKAGESTOREMAXSIZE");
+            ret = FALSE;
+            break;
+        }
+        handle->packagestoremaxsize = val_gint64;
+        break;
+
+    case LRO_CACHESOURCETIMEOUT:
+        val_long = va_arg(arg, long);
+
+        if (val_long <= 0) {
+            g_set_error(err, LR_HANDLE_ERROR, LRE_BADOPTARG,
+                        "Value of LRO_CACHESOURCETIMEOUT is too low.");
+            ret = FALSE;
+        } else {
+            handle->cachesourcetimeout = val_long;
+        }
+
+        break;
+
+    case LRO_LOCALHARDLINK:
+        handle->localhardlink = va_arg(arg, long) ? 1 : 0;
+        break;
+
+    case LRO_DURABILITY: {
+        LrDurability durability = va_arg(arg, LrDurability);
+        switch (durability) {
+            case LR_DURABILITY_NONE:
+            case LR_DURABILITY_BATCH:
+            case LR_DURABILITY_STRICT:
+                handle->durability = durability;
+                break;
+            default:
+                g_set_error(err, LR_HANDLE_ERROR, LRE_BADOPTARG,
+                        "Bad LRO_DURABILITY value");
+                ret = FALSE;
+                break;
+        }
+        break;
+    }
+
+    case LRO_ATOMICDOWNLOAD:
+        handle->atomicdownload = va_arg(arg, long) ? 1 : 0;
+        break;
+
+    case LRO_GPGBACKEND: {
+        LrGpgBackend gpgbackend = va_arg(arg, LrGpgBackend);
+        switch (gpgbackend) {
+            case LR_GPGBACKEND_DEFAULT:
+            case LR_GPGBACKEND_GPGME:
+            case LR_GPGBACKEND_BUILTIN:
+                handle->gpgbackend = gpgbackend;
+                break;
+            default:
+                g_set_error(err, LR_HANDLE_ERROR, LRE_BADOPTARG,
+                        "Bad LRO_GPGBACKEND value");
+                ret = FALSE;
+                break;
+        }
+        break;
+    }
+
+    default:
+        g_set_error(err, LR_HANDLE_ERROR, LRE_BADOPTARG,
+                    "Unknown option");
+        ret = FALSE;
+        break;
+    };
+
+    /* Handle CURL error return code */
+    if (ret == TRUE && c_rc != CURLE_OK) {
+        ret = FALSE;
+        switch (c_rc) {
+        case CURLE_FAILED_INIT:
+            g_set_error(err, LR_HANDLE_ERROR, LRE_CURLSETOPT,
+                        "curl_easy_setopt error: %s",
+                        curl_easy_strerror(c_rc));
+            break;
+        default:
+            g_set_error(err, LR_HANDLE_ERROR, LRE_CURL,
+                        "curl error: %s",
+                        curl_easy_strerror(c_rc));
+            break;
+        };
+    }
+
+    va_end(arg);
+    return ret;
+}
+
+/*
+ * Internal mirrorlist stuff
+ */
+
+static gboolean
+lr_handle_prepare_urls(LrHandle *handle, GError **err)
+{
+    assert(!handle->urls_mirrors);
+
+    int x = 0;
+    while (handle->urls[x]) {
+        gchar *url = handle->urls[x];
+        gchar *final_url = NULL;
+
+        if (strstr(url, "://")) {
+            // Base URL has specified protocol
+            final_url = g_strdup(url);
+        } else {
+            // No protocol specified - if local path => prepend file://
+            if (url[0] == '/') {
+                // Base URL is absolute path
+                final_url = g_strconcat("file://", url, NULL);
+            } else {
+                // Base URL is relative path
+                char *resolved_path = realpath(url, NULL);
+                if (!resolved_path) {
+                    g_debug("%s: realpath: %s", __func__, strerror(errno));
+                    g_set_error(err, LR_HANDLE_ERROR, LRE_BADURL,
+                                "realpath(%s) error: %s",
+                                url, strerror(errno));
+                    return FALSE;
+                }
+                final_url = g_strconcat("file://", resolved_path, NULL);
+                free(resolved_path);
+            }
+        }
+
+        if (final_url) {
+            handle->urls_mirrors = lr_lrmirrorlist_append_url(
+                                                handle->urls_mirrors,
+                                                final_url,
+                                                handle->urlvars);
+            lr_free(final_url);
+        }
+
+        x++;
+    }
+
+    return TRUE;
+}
+
+static gboolean
+lr_handle_prepare_mirrorlist(LrHandle *handle, gchar *localpath, GError **err)
+{
+    assert(handle->mirrorlist_fd == -1);
+    assert(!handle->mirrorlist_mirrors);
+
+    int fd = -1;
+
+    // Get file descriptor with content
+
+    if (!localpath && !handle->mirrorlisturl) {
+        // Nothing to do
+        return TRUE;
+    } else if (localpath && !handle->mirrorlisturl) {
+        // Just try to use mirrorlist of the local repository
+        gchar *path = lr_pathconcat(localpath, "mirrorlist", NULL);
+        if (g_file_test(path, G_FILE_TEST_IS_REGULAR)) {
+            g_debug("%s: Local mirrorlist found at %s", __func__, path);
+            fd = open(path, O_RDONLY);
+            if (fd < 0) {
+                g_set_error(err, LR_HANDLE_ERROR, LRE_IO,
+                            "Cannot open %s: %s",
+                            path, strerror(errno));
+                g_free(path);
+                return FALSE;
+            }
+            g_free(path);
+        } else {
+            // No local mirrorlist
+            g_free(path);
+            return TRUE;
+        }
+    } else if (handle->mirrorlist_prefetch_fd != -1) {
+        // Remote mirrorlist was already downloaded
+        fd = handle->mirrorlist_prefetch_fd;
+        handle->mirrorlist_prefetch_fd = -1;
+    } else if (handle->mirrorlisturl) {
+        // Download remote mirrorlist
+        _cleanup_free_ gchar *url = NULL;
+
+        fd = lr_getmemfile();
+        if (fd < 0) {
+            g_debug("%s: Cannot create a temporary file", __func__);
+            g_set_error(err, LR_HANDLE_ERROR, LRE_IO,
+                        "Cannot create a temporary file");
+            return FALSE;
+        }
+
+        url = lr_prepend_url_protocol(handle->mirrorlisturl);
+        if (!lr_mirrorlistcache_fetch(handle, url, fd, err)) {
+            close(fd);
+            return FALSE;
+        }
+
+        if (lseek(fd, 0, SEEK_SET) != 0) {
+            g_debug("%s: Seek error: %s", __func__, strerror(errno));
+            g_set_error(err, LR_HANDLE_ERROR, LRE_IO,
+                        "lseek(%d, 0, SEEK_SET) error: %s",
+                        fd, strerror(errno));
+            close(fd);
+            return FALSE;
+        }
+    }
+
+    assert(fd >= 0);
+
+    // Parse the file descriptor content
+
+    g_debug("%s: Parsing mirrorlist", __func__);
+
+    LrMirrorlist *ml = lr_mirrorlist_init();
+    gboolean ret = lr_mirrorlist_parse_file(ml, fd, err);
+    if (!ret) {
+        g_debug("%s: Error while parsing mirrorlist", __func__);
+        close(fd);
+        lr_mirrorlist_free(ml);
         return FALSE;
     }
 
@@ -779,6 +1641,115 @@ lr_handle_prepare_mirrorlist(LrHandle *handle, gchar *localpath, GError **err)
     return TRUE;
 }
 
+/** Metalink parsed while it is being downloaded */
+typedef struct {
+    const char *filename; /*!<
+        File to look for in the metalink */
+    unsigned int maxurls; /*!<
+        See LRO_METALINKMAXURLS */
+    LrMetalink *metalink; /*!<
+        Metalink filled by the parser */
+    LrMetalinkParser *parser; /*!<
+        Parser of the current transfer or NULL */
+    gint64 fed; /*!<
+        Number of bytes passed to the parser */
+} LrMetalinkStream;
+
+static void
+metalink_stream_clear(LrMetalinkStream *stream)
+{
+    lr_metalink_parser_free(stream->parser);
+    lr_metalink_free(stream->metalink);
+    stream->parser = NULL;
+    stream->metalink = NULL;
+    stream->fed = 0;
+}
+
+static int
+metalink_stream_datacb(void *clientp, const char *data, size_t len)
+{
+    LrMetalinkStream *stream = clientp;
+    GError *tmp_err = NULL;
+
+    if (!data) {
+        // A new transfer - start from scratch
+        metalink_stream_clear(stream);
+        stream->metalink = lr_metalink_init();
+        stream->parser = lr_metalink_parser_new(stream->metalink,
+                                                stream->filename,
+                                                lr_xml_parser_warning_logger,
+                                                "Metalink xml parser");
+        lr_metalink_parser_set_maxurls(stream->parser, stream->maxurls);
+        return LR_CB_OK;
+    }
+
+    if (!lr_metalink_parser_feed(stream->parser, data, len, &tmp_err)) {
+        g_debug("%s: Cannot parse metalink on the fly: %s",
+                __func__, tmp_err->message);
+        g_error_free(tmp_err);
+        metalink_stream_clear(stream);
+        return LR_CB_ERROR;
+    }
+
+    stream->fed += len;
+    return LR_CB_OK;
+}
+
+/** Download the metalink to the fd and parse it during the download.
+ * @return      The parsed metalink (NULL if the metalink was not
+ *              completely parsed during the download and it has to be
+ *              parsed from the fd or if err is set)
+ */
+static LrMetalink *
+lr_handle_download_metalink(LrHandle *handle,
+                            const char *url,
+                            int fd,
+                            const char *filename,
+                            GError **err)
+{
+    gboolean ret;
+    struct stat st;
+    LrDownloadTarget *target;
+    LrMetalinkStream stream = { filename, handle->metalinkmaxurls,
+                                NULL, NULL, 0 };
+    GError *tmp_err = NULL;
+
+    target = lr_downloadtarget_new(handle,
+                                   url, NULL, fd, NULL,
+                                   NULL, 0, 0, NULL, &stream,
+                                   NULL, NULL, NULL, 0, 0);
+    target->datacb = metalink_stream_datacb;
+    target->contentencoding = TRUE;
+
+    ret = lr_download_target(target, &tmp_err);
+    lr_downloadtarget_free(target);
+
+    if (!ret) {
+        g_propagate_error(err, tmp_err);
+        metalink_stream_clear(&stream);
+        return NULL;
+    }
+
+    if (stream.parser
+        && fstat(fd, &st) == 0
+        && stream.fed == (gint64) st.st_size)
+    {
+        if (lr_metalink_parser_finish(stream.parser, &tmp_err)) {
+            LrMetalink *ml = stream.metalink;
+            g_debug("%s: Metalink parsed during the download", __func__);
+            stream.metalink = NULL;
+            metalink_stream_clear(&stream);
+            return ml;
+        }
+        g_debug("%s: Metalink parsing failed: %s", __func__, tmp_err->message);
+        g_error_free(tmp_err);
+    }
+
+    // Not all data were parsed (e.g. resumed transfer), parse the file
+    metalink_stream_clear(&stream);
+    return NULL;
+}
+
 static gboolean
 lr_handle_prepare_metalink(LrHandle *handle, gchar *localpath, GError **err)
 {
@@ -787,6 +1758,16 @@ lr_handle_prepare_metalink(LrHandle *handle, gchar *localpath, GError **err)
     assert(!handle->metalink);
 
     int fd = -1;
+    LrMetalink *ml = NULL;
+    GError *tmp_err = NULL;
+    _cleanup_free_ gchar *local_metalink = NULL;
+    gchar *metalink_file = "";
+    gchar *metalink_suffix = NULL;
+
+    if (handle->repotype == LR_YUMREPO) {
+        metalink_file = "repomd.xml";
+        metalink_suffix = "repodata/repomd.xml";
+    }
 
     // Get file descriptor with content
 
@@ -806,17 +1787,21 @@ lr_handle_prepare_metalink(LrHandle *handle, gchar *localpath, GError **err)
                 g_free(path);
                 return FALSE;
             }
-            g_free(path);
+            local_metalink = path;
         } else {
             // No local metalink
             g_free(path);
             return TRUE;
         }
+    } else if (handle->metalink_prefetch_fd != -1) {
+        // Remote metalink was already downloaded
+        fd = handle->metalink_prefetch_fd;
+        handle->metalink_prefetch_fd = -1;
     } else if (handle->metalinkurl) {
         // Download remote metalink
         _cleanup_free_ gchar *url = NULL;
 
-        fd = lr_gettmpfile();
+        fd = lr_getmemfile();
         if (fd < 0) {
             g_debug("%s: Cannot create a temporary file", __func__);
             g_set_error(err, LR_HANDLE_ERROR, LRE_IO,
@@ -825,7 +1810,14 @@ lr_handle_prepare_metalink(LrHandle *handle, gchar *localpath, GError **err)
         }
 
         url = lr_prepend_url_protocol(handle->metalinkurl);
-        if (!lr_download_url(handle, url, fd, err)) {
+        if (handle->mirrorlistcache)
+            // The metalink is parsed from the fd
+            lr_mirrorlistcache_fetch(handle, url, fd, &tmp_err);
+        else
+            ml = lr_handle_download_metalink(handle, url, fd, metalink_file,
+                                             &tmp_err);
+        if (tmp_err) {
+            g_propagate_error(err, tmp_err);
             close(fd);
             return FALSE;
         }
@@ -836,6 +1828,7 @@ lr_handle_prepare_metalink(LrHandle *handle, gchar *localpath, GError **err)
                         "lseek(%d, 0, SEEK_SET) error: %s",
                         fd, strerror(errno));
             close(fd);
+            lr_metalink_free(ml);
             return FALSE;
         }
     }
@@ -844,27 +1837,38 @@ lr_handle_prepare_metalink(LrHandle *handle, gchar *localpath, GError **err)
 
     // Parse the file descriptor content
 
-    g_debug("%s: Parsing metalink.xml", __func__);
-
-    gchar *metalink_file = "";
-    gchar *metalink_suffix = NULL;
-    if (handle->repotype == LR_YUMREPO) {
-        metalink_file = "repomd.xml";
-        metalink_suffix = "repodata/repomd.xml";
+    if (!ml && local_metalink && handle->parsecache) {
+        ml = lr_metalink_init();
+        if (!lr_parsecache_load_metalink(ml, metalink_file,
+                                         handle->metalinkmaxurls,
+                                         local_metalink, fd)) {
+            lr_metalink_free(ml);
+            ml = NULL;
+        }
     }
 
-    LrMetalink *ml = lr_metalink_init();
-    gboolean ret = lr_metalink_parse_file(ml,
-                                          fd,
-                                          metalink_file,
-                                          lr_xml_parser_warning_logger,
-                                          "Metalink xml parser",
-                                          err);
-    if (!ret) {
-        g_debug("%s: Error while parsing metalink", __func__);
-        close(fd);
-        lr_metalink_free(ml);
-        return FALSE;
+    if (!ml) {
+        g_debug("%s: Parsing metalink.xml", __func__);
+
+        ml = lr_metalink_init();
+        gboolean ret = lr_metalink_parse_file_maxurls(ml,
+                                              fd,
+                                              metalink_file,
+                                              handle->metalinkmaxurls,
+                                              lr_xml_parser_warning_logger,
+                                              "Metalink xml parser",
+                                              err);
+        if (!ret) {
+            g_debug("%s: Error while parsing metalink", __func__);
+            close(fd);
+            lr_metalink_free(ml);
+            return FALSE;
+        }
+
+        if (local_metalink && handle->parsecache)
+            lr_parsecache_store_metalink(ml, metalink_file,
+                                         handle->metalinkmaxurls,
+                                         local_metalink, fd);
     }
 
     if (!ml->urls) {
@@ -894,16 +1898,13 @@ lr_handle_prepare_metalink(LrHandle *handle, gchar *localpath, GError **err)
     return TRUE;
 }
 
-gboolean
-lr_handle_prepare_internal_mirrorlist(LrHandle *handle,
-                                      gboolean usefastestmirror,
-                                      GError **err)
+static gboolean
+prepare_internal_mirrorlist(LrHandle *handle,
+                            gboolean usefastestmirror,
+                            GError **err)
 {
     assert(!err || *err == NULL);
 
-    if (handle->internal_mirrorlist)
-        return TRUE;  // Internal mirrorlist already exists
-
     // Create internal mirrorlist
 
     g_debug("%s: Preparing internal mirrorlist", __func__);
@@ -978,6 +1979,15 @@ lr_handle_prepare_internal_mirrorlist(LrHandle *handle,
                                                 handle->internal_mirrorlist,
                                                 handle->metalink_mirrors);
 
+    // The same mirror is often listed by more sources (e.g. LRO_URLS
+    // and the metalink), try it only once
+    handle->internal_mirrorlist = lr_lrmirrorlist_remove_duplicates(
+                                                handle->internal_mirrorlist);
+
+    // Resolve the hosts before the mirrors are contacted by
+    // the fastestmirror or by the downloader (LRO_PRERESOLVE)
+    lr_preresolve_hosts(handle);
+
     // If enabled, sort internal mirrorlist by the connection
     // speed (the LRO_FASTESTMIRROR option)
     if (usefastestmirror) {
@@ -1006,14 +2016,50 @@ lr_handle_prepare_internal_mirrorlist(LrHandle *handle,
 }
 
 gboolean
-lr_handle_perform(LrHandle *handle, LrResult *result, GError **err)
+lr_handle_prepare_internal_mirrorlist(LrHandle *handle,
+                                      gboolean usefastestmirror,
+                                      GError **err)
 {
-    int ret = TRUE;
-    GError *tmp_err = NULL;
+    if (handle->internal_mirrorlist)
+        return TRUE;  // Internal mirrorlist already exists
 
+    gint64 start = g_get_monotonic_time();
+    gboolean ret = prepare_internal_mirrorlist(handle, usefastestmirror, err);
+
+    if (handle->trace) {
+        gchar *mirrors = g_strdup_printf("%u",
+                            g_slist_length(handle->internal_mirrorlist));
+        lr_trace_span(handle->trace, "handle", "prepare mirrors",
+                      start, g_get_monotonic_time(),
+                      "mirrors", mirrors,
+                      "error", (!ret && err && *err) ? (*err)->message : NULL,
+                      NULL);
+        g_free(mirrors);
+    }
+
+    return ret;
+}
+
+void
+lr_handle_cancel(LrHandle *handle)
+{
     assert(handle);
-    assert(!err || *err == NULL);
+    g_atomic_int_set(&handle->cancelled, 1);
+}
+
+void
+lr_handle_reset_cancel(LrHandle *handle)
+{
+    assert(handle);
+    g_atomic_int_set(&handle->cancelled, 0);
+}
 
+/** Check the handle before the perform and setup its destination
+ * directory.
+ */
+static gboolean
+lr_handle_prepare_perform(LrHandle *handle, LrResult *result, GError **err)
+{
     if (!result) {
         g_set_error(err, LR_HANDLE_ERROR, LRE_BADFUNCARG,
                     "No result argument passed");
@@ -1032,6 +2078,14 @@ lr_handle_perform(LrHandle *handle, LrResult *result, GError **err)
         return FALSE;
     }
 
+    if (g_atomic_int_get(&handle->cancelled)) {
+        g_set_error(err, LR_HANDLE_ERROR, LRE_CANCELLED,
+                    "Handle was cancelled");
+        return FALSE;
+    }
+
+    lr_handle_stats_reset(handle);
+
     /* Setup destination directory */
     if (handle->update) {
         if (!result->destdir) {
@@ -1050,20 +2104,25 @@ lr_handle_perform(LrHandle *handle, LrResult *result, GError **err)
         }
     }
 
-    g_debug("%s: Using dir: %s", __func__, handle->destdir);
+    g_debug("%s: Using dir: %s", __func__, handle->destdir);
+    return TRUE;
+}
+
+static gboolean
+handle_perform(LrHandle *handle, LrResult *result, GError **err)
+{
+    int ret = TRUE;
+    GError *tmp_err = NULL;
+
+    assert(handle);
+    assert(!err || *err == NULL);
+
+    if (!lr_handle_prepare_perform(handle, result, err))
+        return FALSE;
 
-    struct sigaction old_sigact;
     if (handle->interruptible) {
         /* Setup sighandler */
-        struct sigaction sigact;
-        g_debug("%s: Using own SIGINT handler", __func__);
-        memset(&sigact, 0, sizeof(old_sigact));
-        memset(&sigact, 0, sizeof(sigact));
-        sigemptyset(&sigact.sa_mask);
-        sigact.sa_handler = lr_sigint_handler;
-        sigaddset(&sigact.sa_mask, SIGINT);
-        sigact.sa_flags = 0;
-        if (sigaction(SIGINT, &sigact, &old_sigact) == -1) {
+        if (!lr_sigint_handler_setup()) {
             g_set_error(err, LR_HANDLE_ERROR, LRE_SIGACTION,
                         "sigaction(SIGINT,,) error");
             return FALSE;
@@ -1077,6 +2136,8 @@ lr_handle_perform(LrHandle *handle, LrResult *result, GError **err)
         g_debug("Cannot prepare internal mirrorlist: %s", tmp_err->message);
         g_propagate_prefixed_error(err, tmp_err,
                                    "Cannot prepare internal mirrorlist: ");
+        if (handle->interruptible)
+            lr_sigint_handler_restore();
         return FALSE;
     }
 
@@ -1086,10 +2147,16 @@ lr_handle_perform(LrHandle *handle, LrResult *result, GError **err)
     } else {
         /* Do the other stuff */
         switch (handle->repotype) {
-        case LR_YUMREPO:
+        case LR_YUMREPO: {
+            gint64 start = g_get_monotonic_time();
             g_debug("%s: Downloading/Locating yum repo", __func__);
             ret = lr_yum_perform(handle, result, &tmp_err);
+            lr_trace_span(handle->trace, "handle", "perform",
+                          start, g_get_monotonic_time(),
+                          "error", tmp_err ? tmp_err->message : NULL,
+                          NULL);
             break;
+        }
         default:
             g_debug("%s: Bad repo type", __func__);
             assert(0);
@@ -1102,8 +2169,7 @@ lr_handle_perform(LrHandle *handle, LrResult *result, GError **err)
 
     if (handle->interruptible) {
         /* Restore signal handler */
-        g_debug("%s: Restoring an old SIGINT handler", __func__);
-        sigaction(SIGINT, &old_sigact, NULL);
+        lr_sigint_handler_restore();
 
         if (lr_interrupt) {
             g_set_error(err, LR_HANDLE_ERROR, LRE_INTERRUPTED,
@@ -1121,6 +2187,290 @@ lr_handle_perform(LrHandle *handle, LrResult *result, GError **err)
     return ret;
 }
 
+gboolean
+lr_handle_perform(LrHandle *handle, LrResult *result, GError **err)
+{
+    LrAllocTag prev_tag = lr_alloc_tag_set(LR_ALLOC_HANDLE);
+    gboolean ret = handle_perform(handle, result, err);
+    lr_alloc_tag_set(prev_tag);
+    return ret;
+}
+
+/** Prepare a target which downloads the mirrorlist or metalink of the
+ * handle to a new temporary file.
+ */
+static LrDownloadTarget *
+lr_handle_prefetch_target(LrHandle *handle, const char *url, GSList **targets)
+{
+    _cleanup_free_ gchar *full_url = NULL;
+    LrDownloadTarget *target;
+    int fd;
+
+    fd = lr_getmemfile();
+    if (fd < 0)
+        return NULL;  // The file is downloaded later by the handle itself
+
+    full_url = lr_prepend_url_protocol(url);
+    target = lr_downloadtarget_new(handle,
+                                   full_url, NULL, fd, NULL,
+                                   NULL, 0, 0, NULL, NULL,
+                                   NULL, NULL, NULL, 0, 0);
+    target->contentencoding = TRUE;
+    target->priorityclass = LR_PRIORITYCLASS_CRITICAL;
+    *targets = g_slist_prepend(*targets, target);
+    return target;
+}
+
+/** Evaluate the prefetch target.
+ * @return      The fd with the downloaded file or -1
+ */
+static int
+lr_handle_prefetch_finish(LrDownloadTarget *target,
+                          const GError *download_err,
+                          GError **err)
+{
+    int fd = target->fd;
+
+    if (download_err || target->err) {
+        if (download_err)
+            g_set_error(err, download_err->domain, download_err->code,
+                        "Cannot prepare internal mirrorlist: %s",
+                        download_err->message);
+        else
+            g_set_error(err, LR_DOWNLOADER_ERROR, target->rcode,
+                        "Cannot prepare internal mirrorlist: %s",
+                        target->err);
+        close(fd);
+        return -1;
+    }
+
+    lseek(fd, 0, SEEK_SET);
+    return fd;
+}
+
+/** Download mirrorlists and metalinks of all the handles by a single
+ * download (see lr_handle_prepare_mirrorlist()
+ * and lr_handle_prepare_metalink()).
+ */
+static void
+lr_handles_prefetch_mirrorlists(LrHandle **handles,
+                                GError **errors,
+                                guint count)
+{
+    GSList *targets = NULL;
+    LrDownloadTarget **ml_targets = g_new0(LrDownloadTarget *, count);
+    LrDownloadTarget **mk_targets = g_new0(LrDownloadTarget *, count);
+    GError *tmp_err = NULL;
+
+    for (guint i = 0; i < count; i++) {
+        LrHandle *handle = handles[i];
+        if (errors[i] || handle->internal_mirrorlist)
+            continue;
+        if (handle->mirrorlistcache)
+            continue;  // Fetched (or revalidated) through the cache
+        if (handle->mirrorlisturl && !handle->mirrorlist_mirrors
+            && handle->mirrorlist_prefetch_fd == -1)
+            ml_targets[i] = lr_handle_prefetch_target(handle,
+                                                      handle->mirrorlisturl,
+                                                      &targets);
+        if (handle->metalinkurl && !handle->metalink_mirrors
+            && handle->metalink_prefetch_fd == -1)
+            mk_targets[i] = lr_handle_prefetch_target(handle,
+                                                      handle->metalinkurl,
+                                                      &targets);
+    }
+
+    if (targets) {
+        g_debug("%s: Downloading %u mirrorlist(s)/metalink(s)",
+                __func__, g_slist_length(targets));
+        lr_download(targets, FALSE, &tmp_err);
+    }
+
+    for (guint i = 0; i < count; i++) {
+        if (ml_targets[i])
+            handles[i]->mirrorlist_prefetch_fd = lr_handle_prefetch_finish(
+                                        ml_targets[i],
+                                        tmp_err,
+                                        errors[i] ? NULL : &errors[i]);
+        if (mk_targets[i])
+            handles[i]->metalink_prefetch_fd = lr_handle_prefetch_finish(
+                                        mk_targets[i],
+                                        tmp_err,
+                                        errors[i] ? NULL : &errors[i]);
+    }
+
+    g_clear_error(&tmp_err);
+    g_slist_free_full(targets, (GDestroyNotify) lr_downloadtarget_free);
+    g_free(ml_targets);
+    g_free(mk_targets);
+}
+
+static gboolean
+handles_perform(GSList *handles,
+                GSList *results,
+                GSList **errors,
+                GError **err)
+{
+    guint count = g_slist_length(handles);
+    guint failed = 0;
+    gboolean interruptible = FALSE;
+    LrHandle **handle_array;
+    LrResult **result_array;
+    GError **error_array;
+    GError *first_err = NULL;
+
+    assert(!err || *err == NULL);
+    assert(!errors || *errors == NULL);
+
+    if (count != g_slist_length(results)) {
+        g_set_error(err, LR_HANDLE_ERROR, LRE_BADFUNCARG,
+                    "Number of handles and results differ");
+        return FALSE;
+    }
+
+    handle_array = g_new0(LrHandle *, count);
+    result_array = g_new0(LrResult *, count);
+    error_array = g_new0(GError *, count);
+
+    for (guint i = 0; i < count; i++) {
+        handle_array[i] = handles->data;
+        result_array[i] = results->data;
+        handles = g_slist_next(handles);
+        results = g_slist_next(results);
+
+        if (!handle_array[i]) {
+            g_set_error(&error_array[i], LR_HANDLE_ERROR, LRE_BADFUNCARG,
+                        "No handle passed");
+            continue;
+        }
+
+        if (lr_handle_prepare_perform(handle_array[i], result_array[i],
+                                      &error_array[i])
+            && handle_array[i]->interruptible)
+            interruptible = TRUE;
+    }
+
+    if (interruptible) {
+        /* Setup sighandler */
+        if (!lr_sigint_handler_setup()) {
+            g_set_error(err, LR_HANDLE_ERROR, LRE_SIGACTION,
+                        "sigaction(SIGINT,,) error");
+            for (guint i = 0; i < count; i++)
+                g_clear_error(&error_array[i]);
+            g_free(handle_array);
+            g_free(result_array);
+            g_free(error_array);
+            return FALSE;
+        }
+    }
+
+    // Mirrorlists and metalinks
+    lr_handles_prefetch_mirrorlists(handle_array, error_array, count);
+
+    for (guint i = 0; i < count; i++) {
+        GError *tmp_err = NULL;
+        if (error_array[i])
+            continue;
+        if (!lr_handle_prepare_internal_mirrorlist(handle_array[i],
+                                                   handle_array[i]->fastestmirror,
+                                                   &tmp_err)) {
+            g_debug("Cannot prepare internal mirrorlist: %s", tmp_err->message);
+            g_propagate_prefixed_error(&error_array[i], tmp_err,
+                                       "Cannot prepare internal mirrorlist: ");
+        }
+    }
+
+    // Repositories (only LR_YUMREPO is accepted by the checks)
+    LrHandle **yum_handles = g_new0(LrHandle *, count);
+    LrResult **yum_results = g_new0(LrResult *, count);
+    GError **yum_errors = g_new0(GError *, count);
+    guint *yum_indexes = g_new0(guint, count);
+    guint yum_count = 0;
+
+    for (guint i = 0; i < count; i++) {
+        if (error_array[i] || handle_array[i]->fetchmirrors)
+            continue;
+        yum_handles[yum_count] = handle_array[i];
+        yum_results[yum_count] = result_array[i];
+        yum_indexes[yum_count] = i;
+        yum_count++;
+    }
+
+    if (yum_count > 0) {
+        gint64 start = g_get_monotonic_time();
+        g_debug("%s: Downloading/Locating %u yum repo(s)", __func__, yum_count);
+        lr_yum_perform_many(yum_handles, yum_results, yum_errors, yum_count);
+        gint64 end = g_get_monotonic_time();
+        for (guint i = 0; i < yum_count; i++)
+            lr_trace_span(yum_handles[i]->trace, "handle", "perform",
+                          start, end,
+                          "error", yum_errors[i] ? yum_errors[i]->message : NULL,
+                          NULL);
+    }
+
+    for (guint i = 0; i < yum_count; i++)
+        error_array[yum_indexes[i]] = yum_errors[i];
+
+    g_free(yum_handles);
+    g_free(yum_results);
+    g_free(yum_errors);
+    g_free(yum_indexes);
+
+    if (interruptible) {
+        /* Restore signal handler */
+        lr_sigint_handler_restore();
+
+        if (lr_interrupt) {
+            g_set_error(err, LR_HANDLE_ERROR, LRE_INTERRUPTED,
+                        "Librepo was interrupted by a signal");
+            for (guint i = 0; i < count; i++)
+                g_clear_error(&error_array[i]);
+            g_free(handle_array);
+            g_free(result_array);
+            g_free(error_array);
+            return FALSE;
+        }
+    }
+
+    for (guint i = 0; i < count; i++) {
+        if (error_array[i]) {
+            failed++;
+            if (!first_err)
+                first_err = error_array[i];
+        }
+    }
+
+    if (first_err)
+        g_set_error(err, first_err->domain, first_err->code,
+                    "%u of %u repositories failed, the first error: %s",
+                    failed, count, first_err->message);
+
+    for (guint i = count; i > 0; i--) {
+        if (errors)
+            *errors = g_slist_prepend(*errors, error_array[i-1]);
+        else
+            g_clear_error(&error_array[i-1]);
+    }
+
+    g_free(handle_array);
+    g_free(result_array);
+    g_free(error_array);
+
+    return failed == 0;
+}
+
+gboolean
+lr_handles_perform(GSList *handles,
+                   GSList *results,
+                   GSList **errors,
+                   GError **err)
+{
+    LrAllocTag prev_tag = lr_alloc_tag_set(LR_ALLOC_HANDLE);
+    gboolean ret = handles_perform(handles, results, errors, err);
+    lr_alloc_tag_set(prev_tag);
+    return ret;
+}
+
 gboolean
 lr_handle_getinfo(LrHandle *handle,
                   GError **err,
@@ -1198,7 +2548,10 @@ lr_handle_getinfo(LrHandle *handle,
 
     case LRI_URLS:
     case LRI_YUMDLIST:
-    case LRI_YUMBLIST: {
+    case LRI_YUMBLIST:
+    case LRI_YUMDECOMPRESS:
+    case LRI_CACHESOURCES:
+    case LRI_PROXIES: {
         char **source_list;
         char ***strlist = va_arg(arg, char ***);
 
@@ -1206,8 +2559,14 @@ lr_handle_getinfo(LrHandle *handle,
             source_list = handle->urls;
         else if (option == LRI_YUMDLIST)
             source_list = handle->yumdlist;
-        else
+        else if (option == LRI_YUMBLIST)
             source_list = handle->yumblist;
+        else if (option == LRI_YUMDECOMPRESS)
+            source_list = handle->yumdecompress;
+        else if (option == LRI_CACHESOURCES)
+            source_list = handle->cachesources;
+        else
+            source_list = handle->proxies;
 
         if (!source_list) {
             *strlist = NULL;
@@ -1314,6 +2673,276 @@ lr_handle_getinfo(LrHandle *handle,
         *str = handle->gnupghomedir;
         break;
 
+    case LRI_HTTP2:
+        lnum = va_arg(arg, long *);
+        *lnum = (long) handle->http2;
+        break;
+
+    case LRI_MAXSTREAMSPERMIRROR:
+        lnum = va_arg(arg, long *);
+        *lnum = handle->maxstreamspermirror;
+        break;
+
+    case LRI_MAXSEGMENTS:
+        lnum = va_arg(arg, long *);
+        *lnum = handle->maxsegments;
+        break;
+
+    case LRI_WRITEBUFFERSIZE:
+        lnum = va_arg(arg, long *);
+        *lnum = handle->writebuffersize;
+        break;
+
+    case LRI_PREALLOCATE:
+        lnum = va_arg(arg, long *);
+        *lnum = (long) handle->preallocate;
+        break;
+
+    case LRI_EARLYWRITEBACK:
+        lnum = va_arg(arg, long *);
+        *lnum = (long) handle->earlywriteback;
+        break;
+
+    case LRI_DOWNLOADORDER: {
+        LrDownloadOrder *order = va_arg(arg, LrDownloadOrder *);
+        *order = handle->downloadorder;
+        break;
+    }
+
+    case LRI_ADAPTIVEDOWNLOADSPERMIRROR:
+        lnum = va_arg(arg, long *);
+        *lnum = (long) handle->adaptivedownloadspermirror;
+        break;
+
+    case LRI_HEDGEDDOWNLOADS:
+        lnum = va_arg(arg, long *);
+        *lnum = (long) handle->hedgeddownloads;
+        break;
+
+    case LRI_LOWSPEEDRESUME:
+        lnum = va_arg(arg, long *);
+        *lnum = (long) handle->lowspeedresume;
+        break;
+
+    case LRI_PROGRESSINTERVAL:
+        lnum = va_arg(arg, long *);
+        *lnum = handle->progressinterval;
+        break;
+
+    case LRI_YUMKEEPCOMPRESSED:
+        lnum = va_arg(arg, long *);
+        *lnum = (long) handle->yumkeepcompressed;
+        break;
+
+    case LRI_CHECKSUMTHREADS:
+        lnum = va_arg(arg, long *);
+        *lnum = handle->checksumthreads;
+        break;
+
+    case LRI_CHECKSUMINDEX:
+        lnum = va_arg(arg, long *);
+        *lnum = (long) handle->checksumindex;
+        break;
+
+    case LRI_PARSECACHE:
+        lnum = va_arg(arg, long *);
+        *lnum = (long) handle->parsecache;
+        break;
+
+    case LRI_METALINKMAXURLS:
+        lnum = va_arg(arg, long *);
+        *lnum = handle->metalinkmaxurls;
+        break;
+
+    case LRI_FASTESTMIRRORPROBE:
+        str = va_arg(arg, char **);
+        *str = handle->fastestmirrorprobe;
+        break;
+
+    case LRI_FASTESTMIRRORCONCURRENCY:
+        lnum = va_arg(arg, long *);
+        *lnum = handle->fastestmirrorconcurrency;
+        break;
+
+    case LRI_FASTESTMIRRORGOODCOUNT:
+        lnum = va_arg(arg, long *);
+        *lnum = handle->fastestmirrorgoodcount;
+        break;
+
+    case LRI_FASTESTMIRRORASYNC:
+        lnum = va_arg(arg, long *);
+        *lnum = (long) handle->fastestmirrorasync;
+        break;
+
+    case LRI_CONDITIONALGET:
+        lnum = va_arg(arg, long *);
+        *lnum = (long) handle->conditionalget;
+        break;
+
+    case LRI_YUMREUSEDIR:
+        str = va_arg(arg, char **);
+        *str = handle->yumreusedir;
+        break;
+
+    case LRI_LAZYCHECKSUM:
+        lnum = va_arg(arg, long *);
+        *lnum = (long) handle->lazychecksum;
+        break;
+
+    case LRI_MIRRORLISTCACHE:
+        str = va_arg(arg, char **);
+        *str = handle->mirrorlistcache;
+        break;
+
+    case LRI_MIRRORLISTCACHETTL:
+        lnum = va_arg(arg, long *);
+        *lnum = handle->mirrorlistcachettl;
+        break;
+
+    case LRI_PRERESOLVE:
+        lnum = va_arg(arg, long *);
+        *lnum = (long) handle->preresolve;
+        break;
+
+    case LRI_PRERESOLVECACHE:
+        str = va_arg(arg, char **);
+        *str = handle->preresolvecache;
+        break;
+
+    case LRI_PRERESOLVECACHETTL:
+        lnum = va_arg(arg, long *);
+        *lnum = handle->preresolvecachettl;
+        break;
+
+    case LRI_TLSSESSIONCACHE:
+        str = va_arg(arg, char **);
+        *str = handle->tlssessioncache;
+        break;
+
+    case LRI_PACKAGESTORE:
+        str = va_arg(arg, char **);
+        *str = handle->packagestore;
+        break;
+
+    case LRI_MIRRORHEALTHCACHE:
+        str = va_arg(arg, char **);
+        *str = handle->mirrorhealthcache;
+        break;
+
+    case LRI_MIRRORBREAKER:
+        lnum = va_arg(arg, long *);
+        *lnum = handle->mirrorbreaker;
+        break;
+
+    case LRI_TRACEFILE:
+        str = va_arg(arg, char **);
+        *str = handle->tracefile;
+        break;
+
+    case LRI_METRICSINTERVAL:
+        lnum = va_arg(arg, long *);
+        *lnum = handle->metricsinterval;
+        break;
+
+    case LRI_DOWNLOADSHARDS:
+        lnum = va_arg(arg, long *);
+        *lnum = handle->downloadshards;
+        break;
+
+    case LRI_SHARDENDCB:
+        lnum = va_arg(arg, long *);
+        *lnum = (long) handle->shardendcb;
+        break;
+
+    case LRI_IOURING:
+        lnum = va_arg(arg, long *);
+        *lnum = (long) handle->iouring;
+        break;
+
+    case LRI_RESUMEJOURNAL:
+        lnum = va_arg(arg, long *);
+        *lnum = (long) handle->resumejournal;
+        break;
+
+    case LRI_MAXRANGESPERREQUEST:
+        lnum = va_arg(arg, long *);
+        *lnum = handle->maxrangesperrequest;
+        break;
+
+    case LRI_CONNECTIONAFFINITY:
+        lnum = va_arg(arg, long *);
+        *lnum = (long) handle->connectionaffinity;
+        break;
+
+    case LRI_AUTOTUNEPARALLELDOWNLOADS:
+        lnum = va_arg(arg, long *);
+        *lnum = (long) handle->autotuneparalleldownloads;
+        break;
+
+    case LRI_ACCEPTENCODING:
+        lnum = va_arg(arg, long *);
+        *lnum = (long) handle->acceptencoding;
+        break;
+
+    case LRI_CRITICALSLOTS:
+        lnum = va_arg(arg, long *);
+        *lnum = handle->criticalslots;
+        break;
+
+    case LRI_RECVBUFFERSIZE:
+        lnum = va_arg(arg, long *);
+        *lnum = handle->recvbuffersize;
+        break;
+
+    case LRI_ENDCBTHREADS:
+        lnum = va_arg(arg, long *);
+        *lnum = handle->endcbthreads;
+        break;
+
+    case LRI_ENDCBQUEUESIZE:
+        lnum = va_arg(arg, long *);
+        *lnum = handle->endcbqueuesize;
+        break;
+
+    case LRI_TRACEFORMAT: {
+        LrTraceFormat *traceformat = va_arg(arg, LrTraceFormat *);
+        *traceformat = handle->traceformat;
+        break;
+    }
+
+    case LRI_CACHESOURCETIMEOUT:
+        lnum = va_arg(arg, long *);
+        *lnum = handle->cachesourcetimeout;
+        break;
+
+    case LRI_LOCALHARDLINK:
+        lnum = va_arg(arg, long *);
+        *lnum = (long) handle->localhardlink;
+        break;
+
+    case LRI_DURABILITY: {
+        LrDurability *durability = va_arg(arg, LrDurability *);
+        *durability = handle->durability;
+        break;
+    }
+
+    case LRI_ATOMICDOWNLOAD:
+        lnum = va_arg(arg, long *);
+        *lnum = (long) handle->atomicdownload;
+        break;
+
+    case LRI_GPGBACKEND: {
+        LrGpgBackend *gpgbackend = va_arg(arg, LrGpgBackend *);
+        *gpgbackend = handle->gpgbackend;
+        break;
+    }
+
+    case LRI_STATS: {
+        LrStats **stats = va_arg(arg, LrStats **);
+        *stats = lr_stats_copy(handle->stats);
+        break;
+    }
+
     default:
         rc = FALSE;
         g_set_error(err, LR_HANDLE_ERROR, LRE_UNKNOWNOPT,
@@ -37,12 +37,64 @@ G_BEGIN_DECLS
  */
 typedef struct _LrHandle LrHandle;
 
+/** Statistics of the transfers from a mirror (see LRI_STATS) */
+typedef struct {
+    char *url; /*!<
+        URL of the mirror */
+    guint64 bytes; /*!<
+        Number of bytes downloaded from the mirror */
+    gdouble time; /*!<
+        Total time of the transfers from the mirror (sec) */
+    guint successful; /*!<
+        Number of successful transfers */
+    guint failed; /*!<
+        Number of failed transfers */
+    guint retries; /*!<
+        Number of transfers of targets which failed on another mirror
+        before */
+    gdouble speed; /*!<
+        Average speed of the transfers (bytes / time), 0.0 if unknown */
+} LrMirrorStats;
+
+/** Statistics of the downloads of the last operation (see LRI_STATS) */
+typedef struct {
+    guint64 bytes; /*!<
+        Number of bytes downloaded from all mirrors */
+    gdouble time; /*!<
+        Wall clock time of the downloads (sec) */
+    guint successful; /*!<
+        Number of successful transfers */
+    guint failed; /*!<
+        Number of failed transfers */
+    guint retries; /*!<
+        Number of retried transfers */
+    gdouble speed; /*!<
+        Effective speed (bytes / time), 0.0 if unknown */
+    guint64 allocations; /*!<
+        Number of allocations of librepo (of all threads) since the
+        beginning of the operation, 0 if the accounting is disabled
+        (see lr_alloc_accounting()) */
+    guint64 allocated_bytes; /*!<
+        Number of bytes allocated by librepo since the beginning of
+        the operation */
+    guint parallel_downloads; /*!<
+        Number of parallel downloads chosen at the end of the last
+        download (see LRO_AUTOTUNEPARALLELDOWNLOADS), 0 if the number
+        was not tuned */
+    GSList *mirrors; /*!<
+        List of LrMirrorStats in order in which the mirrors were
+        first used */
+} LrStats;
+
 /** LRO_FASTESTMIRRORMAXAGE default value */
 #define LRO_FASTESTMIRRORMAXAGE_DEFAULT     2592000 // 30 days
 
 /** LRO_FASTESTMIRRORMAXAGE minimal allowed value */
 #define LRO_FASTESTMIRRORMAXAGE_MIN         0
 
+/** Number of bytes downloaded from each mirror by LRO_FASTESTMIRRORPROBE */
+#define LR_FASTESTMIRROR_PROBE_SIZE         65536
+
 /** LRO_PROXYPORT default value */
 #define LRO_PROXYPORT_DEFAULT               1080
 
@@ -95,11 +147,205 @@ typedef struct _LrHandle LrHandle;
 #define LRO_ALLOWEDMIRRORFAILURES_DEFAULT   4
 
 /** LRO_ADAPTIVEMIRRORSORTING */
-#define LRO_ADAPTIVEMIRRORSORTING_DEFAULT   1
+#define LRO_ADAPTIVEMIRRORSORTING_DEFAULT   LR_ADAPTIVEMIRRORSORTING_ERRORRATE
 
 /** LRO_GNUPGHOMEDIR */
 #define LRO_GNUPGHOMEDIR_DEFAULT            NULL
 
+/** LRO_HTTP2 default value */
+#define LRO_HTTP2_DEFAULT                   0
+
+/** LRO_MAXSTREAMSPERMIRROR default value */
+#define LRO_MAXSTREAMSPERMIRROR_DEFAULT     16
+
+/** LRO_MAXSTREAMSPERMIRROR minimal allowed value */
+#define LRO_MAXSTREAMSPERMIRROR_MIN         1
+
+/** LRO_MAXSEGMENTS default value */
+#define LRO_MAXSEGMENTS_DEFAULT             1
+
+/** LRO_MAXSEGMENTS minimal allowed value */
+#define LRO_MAXSEGMENTS_MIN                 1
+
+/** LRO_MINSEGMENTSIZE default value (16 MiB) */
+#define LRO_MINSEGMENTSIZE_DEFAULT          G_GINT64_CONSTANT(16777216)
+
+/** LRO_WRITEBUFFERSIZE default value (0 == use stdio) */
+#define LRO_WRITEBUFFERSIZE_DEFAULT         0
+
+/** LRO_PREALLOCATE default value */
+#define LRO_PREALLOCATE_DEFAULT             0
+
+/** LRO_EARLYWRITEBACK default value */
+#define LRO_EARLYWRITEBACK_DEFAULT          0
+
+/** LRO_DOWNLOADORDER default value */
+#define LRO_DOWNLOADORDER_DEFAULT           LR_DOWNLOADORDER_FIFO
+
+/** LRO_ADAPTIVEDOWNLOADSPERMIRROR default value */
+#define LRO_ADAPTIVEDOWNLOADSPERMIRROR_DEFAULT 0
+
+/** LRO_HEDGEDDOWNLOADS default value */
+#define LRO_HEDGEDDOWNLOADS_DEFAULT         0
+
+/** LRO_LOWSPEEDRESUME default value */
+#define LRO_LOWSPEEDRESUME_DEFAULT          0
+
+/** LRO_PROGRESSINTERVAL default value */
+#define LRO_PROGRESSINTERVAL_DEFAULT        0
+
+/** LRO_PROGRESSINTERVAL minimal allowed value */
+#define LRO_PROGRESSINTERVAL_MIN            0
+
+/** LRO_YUMKEEPCOMPRESSED default value */
+#define LRO_YUMKEEPCOMPRESSED_DEFAULT       1
+
+/** LRO_CHECKSUMTHREADS default value */
+#define LRO_CHECKSUMTHREADS_DEFAULT         1
+
+/** LRO_CHECKSUMTHREADS minimal allowed value */
+#define LRO_CHECKSUMTHREADS_MIN             0
+
+/** LRO_CHECKSUMINDEX default value */
+#define LRO_CHECKSUMINDEX_DEFAULT           0
+
+/** LRO_PARSECACHE default value */
+#define LRO_PARSECACHE_DEFAULT              0
+
+/** Suffix of the LRO_PARSECACHE files, e.g. "repomd.xml.lrcache" */
+#define LR_PARSECACHE_SUFFIX                ".lrcache"
+
+/** LRO_METALINKMAXURLS default value */
+#define LRO_METALINKMAXURLS_DEFAULT         0
+
+/** LRO_METALINKMAXURLS minimal allowed value */
+#define LRO_METALINKMAXURLS_MIN             0
+
+/** LRO_FASTESTMIRRORCONCURRENCY default value */
+#define LRO_FASTESTMIRRORCONCURRENCY_DEFAULT 32
+
+/** LRO_FASTESTMIRRORCONCURRENCY minimal allowed value */
+#define LRO_FASTESTMIRRORCONCURRENCY_MIN    0
+
+/** LRO_FASTESTMIRRORGOODCOUNT default value */
+#define LRO_FASTESTMIRRORGOODCOUNT_DEFAULT  0
+
+/** LRO_FASTESTMIRRORGOODCOUNT minimal allowed value */
+#define LRO_FASTESTMIRRORGOODCOUNT_MIN      0
+
+/** LRO_FASTESTMIRRORASYNC default value */
+#define LRO_FASTESTMIRRORASYNC_DEFAULT      0
+
+/** LRO_CONDITIONALGET default value */
+#define LRO_CONDITIONALGET_DEFAULT          0
+
+/** Suffix of the files with validators of LRO_CONDITIONALGET,
+ * e.g. "repomd.xml.validators" */
+#define LR_VALIDATORS_SUFFIX                ".validators"
+
+/** LRO_LAZYCHECKSUM default value */
+#define LRO_LAZYCHECKSUM_DEFAULT            0
+
+/** LRO_MIRRORLISTCACHETTL default value */
+#define LRO_MIRRORLISTCACHETTL_DEFAULT      3600 // 1 hour
+
+/** LRO_PRERESOLVE default value */
+#define LRO_PRERESOLVE_DEFAULT              0
+
+/** LRO_PRERESOLVECACHETTL default value */
+#define LRO_PRERESOLVECACHETTL_DEFAULT      300
+
+/** LRO_PACKAGESTOREMAXSIZE default value (0 == unlimited size) */
+#define LRO_PACKAGESTOREMAXSIZE_DEFAULT     G_GINT64_CONSTANT(0)
+
+/** LRO_CACHESOURCETIMEOUT default value */
+#define LRO_CACHESOURCETIMEOUT_DEFAULT      1000
+
+/** LRO_LOCALHARDLINK default value */
+#define LRO_LOCALHARDLINK_DEFAULT           0
+
+/** LRO_DURABILITY default value */
+#define LRO_DURABILITY_DEFAULT              LR_DURABILITY_NONE
+
+/** LRO_ATOMICDOWNLOAD default value */
+#define LRO_ATOMICDOWNLOAD_DEFAULT          0
+
+/** LRO_GPGBACKEND default value */
+#define LRO_GPGBACKEND_DEFAULT              LR_GPGBACKEND_DEFAULT
+
+/** LRO_MIRRORBREAKER default value */
+#define LRO_MIRRORBREAKER_DEFAULT           0
+
+/** LRO_TRACEFORMAT default value */
+#define LRO_TRACEFORMAT_DEFAULT             LR_TRACE_CHROME
+
+/** LRO_METRICSINTERVAL default value */
+#define LRO_METRICSINTERVAL_DEFAULT         1000
+
+/** LRO_METRICSINTERVAL minimal allowed value */
+#define LRO_METRICSINTERVAL_MIN             1
+
+/** LRO_DOWNLOADSHARDS default value */
+#define LRO_DOWNLOADSHARDS_DEFAULT          1
+
+/** LRO_DOWNLOADSHARDS minimal allowed value */
+#define LRO_DOWNLOADSHARDS_MIN              0
+
+/** LRO_DOWNLOADSHARDS maximal allowed value */
+#define LRO_DOWNLOADSHARDS_MAX              64
+
+/** LRO_SHARDENDCB default value */
+#define LRO_SHARDENDCB_DEFAULT              0
+
+/** LRO_IOURING default value */
+#define LRO_IOURING_DEFAULT                 0
+
+/** Size of the write buffer used by LRO_IOURING if LRO_WRITEBUFFERSIZE
+ * is not set */
+#define LRO_IOURING_WRITEBUFFERSIZE         131072
+
+/** LRO_RESUMEJOURNAL default value */
+#define LRO_RESUMEJOURNAL_DEFAULT           0
+
+/** LRO_MAXRANGESPERREQUEST default value */
+#define LRO_MAXRANGESPERREQUEST_DEFAULT     1
+
+/** LRO_MAXRANGESPERREQUEST minimal allowed value */
+#define LRO_MAXRANGESPERREQUEST_MIN         1
+
+/** LRO_CONNECTIONAFFINITY default value */
+#define LRO_CONNECTIONAFFINITY_DEFAULT      0
+
+/** LRO_AUTOTUNEPARALLELDOWNLOADS default value */
+#define LRO_AUTOTUNEPARALLELDOWNLOADS_DEFAULT 0
+
+/** LRO_ACCEPTENCODING default value */
+#define LRO_ACCEPTENCODING_DEFAULT          0
+
+/** LRO_CRITICALSLOTS default value */
+#define LRO_CRITICALSLOTS_DEFAULT           0
+
+/** LRO_CRITICALSLOTS minimal allowed value */
+#define LRO_CRITICALSLOTS_MIN               0
+
+/** LRO_RECVBUFFERSIZE default value (0 == default of libcurl) */
+#define LRO_RECVBUFFERSIZE_DEFAULT          0
+
+/** LRO_RECVBUFFERSIZE maximal allowed value (10 MiB, see CURLOPT_BUFFERSIZE) */
+#define LRO_RECVBUFFERSIZE_MAX              10485760
+
+/** LRO_ENDCBTHREADS default value (end callbacks are called inline) */
+#define LRO_ENDCBTHREADS_DEFAULT            0
+
+/** LRO_ENDCBTHREADS minimal allowed value */
+#define LRO_ENDCBTHREADS_MIN                0
+
+/** LRO_ENDCBQUEUESIZE default value */
+#define LRO_ENDCBQUEUESIZE_DEFAULT          16
+
+/** LRO_ENDCBQUEUESIZE minimal allowed value */
+#define LRO_ENDCBQUEUESIZE_MIN              1
+
 
 /** Handle options for the ::lr_handle_setopt function. */
 typedef enum {
@@ -152,7 +398,9 @@ typedef enum {
 
     LRO_MAXSPEED,  /*!< (gint64)
         Maximum download speed in bytes per second. Default is 0 = unlimited
-        download speed. */
+        download speed. The limit applies to all parallel downloads
+        together, bandwidth not used by slow downloads is used by
+        the other downloads. */
 
     LRO_DESTDIR,  /*!< (char *)
         Where to save downloaded files */
@@ -174,7 +422,9 @@ typedef enum {
         If true, Librepo setups its own signal handler for SIGTERM and stops
         downloading if SIGTERM is catched. In this case current operation
         could return any kind of error code. Handle which operation was
-        interrupted shoud never be used again! */
+        interrupted shoud never be used again! The signal stops all
+        running downloads in the process, see lr_handle_cancel()
+        for stopping a download of the single handle. */
 
     LRO_USERAGENT,  /*!< (char *)
         String for  User-Agent: header in the http request sent to
@@ -192,7 +442,10 @@ typedef enum {
         Maximum number of parallel downloads. */
 
     LRO_MAXDOWNLOADSPERMIRROR,  /*!< (long)
-        Maximum number of parallel downloads per mirror. */
+        Maximum number of parallel downloads per mirror. Default is
+        LRO_MAXDOWNLOADSPERMIRROR_DEFAULT, the same as the default of
+        LRO_MAXPARALLELDOWNLOADS, so it limits the downloads only if
+        LRO_MAXPARALLELDOWNLOADS is raised. */
 
     LRO_VARSUB,  /*!< (LrUrlVars *)
         Variables and its substitutions for repo URL.
@@ -204,16 +457,30 @@ typedef enum {
 
     LRO_FASTESTMIRROR, /*!< (long 1 or 0)
         Sort the internal mirrorlist, after it is constructed, by the
-        determined connection speed.
-        Disabled by default. */
+        determined connection speed. Hosts which resolve to the same
+        address (the same scheme too with LRO_FASTESTMIRRORPROBE)
+        are measured only once and sorted together. The results are
+        shared by all handles of the process (see mirrorregistry.h),
+        a mirror measured by any of them is not measured again within
+        LRO_FASTESTMIRRORMAXAGE. Disabled by default. */
 
     LRO_FASTESTMIRRORCACHE, /*!< (char *)
         Path to the fastestmirror's cache file.
         Used when LRO_FASTESTMIRROR is enabled.
-        If it doesn't exists, it will be created. */
+        If it doesn't exists, it will be created. The cache is a binary
+        file which is memory mapped, updates are merged with its current
+        content and the file is replaced atomically. A cache of an older
+        format is ignored and rewritten. The cache can be shared by
+        concurrent processes: updates are serialized by an advisory lock
+        of the "<cache>.lock" file and mirrors measured by another process
+        at the same time are not measured again, their results are
+        awaited instead. Results measured by other handles of the process
+        are added to the cache when the handle uses them. */
 
     LRO_FASTESTMIRRORMAXAGE, /*< (long)
         Maximum age of a record in cache (seconds).
+        With LRO_FASTESTMIRRORASYNC it is a soft limit, older records
+        are still used (up to 180 days) and refreshed in background.
         Default: 2592000 (30 days). */
 
     LRO_FASTESTMIRRORCB, /* (LrFastestMirrorCb)
@@ -283,15 +550,524 @@ typedef enum {
         will be 3, even if this option was set to 1.
         Set -1 or 0 to disable this option */
 
-    LRO_ADAPTIVEMIRRORSORTING, /*!< (long 1 or 0)
+    LRO_ADAPTIVEMIRRORSORTING, /*!< (long - LrAdaptiveMirrorSorting)
         If enabled, internal list of mirrors for each handle is
         re-sorted after each finished transfer.
-        The the sorting is based on mirror
-        error rate etc. */
+        LR_ADAPTIVEMIRRORSORTING_ERRORRATE (1, default) moves the mirror
+        of the finished transfer by one position according to its
+        error rate.
+        LR_ADAPTIVEMIRRORSORTING_THROUGHPUT (2) tracks moving averages
+        of throughput and time to first byte of mirrors and sorts
+        the mirrors by expected completion time of a transfer.
+        Set 0 (LR_ADAPTIVEMIRRORSORTING_NONE) to disable this option. */
 
     LRO_GNUPGHOMEDIR, /*!< (char *)
         Configuration directory for GNUPG (a directory with keyring) */
 
+    LRO_HTTP2, /*!< (long 1 or 0)
+        If enabled, try to negotiate HTTP/2 (for https mirrors) and
+        multiplex parallel transfers from a mirror over a single
+        connection. For mirrors which negotiated HTTP/2, the
+        LRO_MAXDOWNLOADSPERMIRROR and LRO_MAXPARALLELDOWNLOADS
+        limits count connections and each connection
+        carries up to LRO_MAXSTREAMSPERMIRROR transfers.
+        Disabled by default. */
+
+    LRO_MAXSTREAMSPERMIRROR, /*!< (long)
+        Maximum number of parallel transfers (streams) multiplexed over
+        a single connection to a mirror which negotiated HTTP/2.
+        Used only when LRO_HTTP2 is enabled. */
+
+    LRO_MAXSEGMENTS, /*!< (long)
+        Maximum number of segments a single target could be split into.
+        Segments of a target with known expected size are downloaded
+        in parallel from different mirrors into one file and the
+        checksum of the whole file is verified at the end.
+        Only targets which are downloaded via mirrors, are not resumed
+        and are not limited by a byte range are split.
+        1 (default) disables segmented downloading. */
+
+    LRO_MINSEGMENTSIZE, /*!< (gint64)
+        Minimal size of a segment (in bytes). A target is split into
+        as many segments (up to LRO_MAXSEGMENTS) as the size allows. */
+
+    LRO_WRITEBUFFERSIZE, /*!< (long)
+        Size (in bytes) of a buffer used for writing of downloaded data.
+        If set, data of each transfer are collected in the buffer and
+        written by positioned writes (pwrite()) when the buffer is
+        full. The blocks are written at offsets aligned to 4 KiB and
+        the data are digested (checksums calculated on the fly,
+        decompression, streaming) block by block. 0 (default) means
+        that data are written through stdio with its default
+        buffering. */
+
+    LRO_PREALLOCATE, /*!< (long 1 or 0)
+        Preallocate disk space for targets with known expected size to
+        avoid fragmentation of the files. The size of the file is
+        not changed by the preallocation. Supported only on Linux. */
+
+    LRO_EARLYWRITEBACK, /*!< (long 1 or 0)
+        Start writeback of data to the disk (sync_file_range())
+        every time the write buffer is written out, so dirty pages
+        don't pile up when many transfers write at once.
+        Used only with LRO_WRITEBUFFERSIZE. Supported only on Linux. */
+
+    LRO_DOWNLOADORDER, /*!< (LrDownloadOrder)
+        Order in which waiting targets are downloaded.
+        LR_DOWNLOADORDER_FIFO (default) keeps order of the list of targets,
+        LR_DOWNLOADORDER_LARGESTFIRST minimizes total time of downloading,
+        LR_DOWNLOADORDER_SMALLESTFIRST gives quick feedback and
+        LR_DOWNLOADORDER_PRIORITY uses priority of targets (targets with
+        the same priority are downloaded in order of the list).
+        Targets with unknown size are downloaded as the last ones by
+        LR_DOWNLOADORDER_LARGESTFIRST and LR_DOWNLOADORDER_SMALLESTFIRST. */
+
+    LRO_ADAPTIVEDOWNLOADSPERMIRROR, /*!< (long 1 or 0)
+        If enabled, the number of parallel downloads from each mirror
+        is adjusted according to the observed throughput of the mirror.
+        It starts at LRO_MAXDOWNLOADSPERMIRROR and grows while adding
+        downloads increases the total throughput from the mirror and
+        shrinks when the mirror is saturated or the downloads fail.
+        LRO_MAXPARALLELDOWNLOADS still limits the total number
+        of downloads. This option has no effect if
+        LRO_MAXDOWNLOADSPERMIRROR is -1. */
+
+    LRO_HEDGEDDOWNLOADS, /*!< (long 1 or 0)
+        If enabled, when there are no more waiting targets and some
+        download slots are free, a download which is expected to finish
+        late (straggler) gets a second request for the rest of the file
+        from another mirror. The request which finishes first wins and
+        the other one is cancelled. Only targets with known expected
+        size are hedged. */
+
+    LRO_LOWSPEEDRESUME, /*!< (long 1 or 0)
+        If enabled, a download aborted because its speed was under
+        LRO_LOWSPEEDLIMIT for LRO_LOWSPEEDTIME seconds continues from
+        another mirror from the already downloaded data instead of
+        from the beginning. Segments of segmented downloads and
+        byte range downloads are always restarted. */
+
+    LRO_PROGRESSINTERVAL, /*!< (long)
+        Minimal time in milliseconds between two calls of the progress
+        callback of a target (and of the LRO_MULTIPROGRESSCB). The
+        final call, when the whole target is downloaded, is never
+        skipped. 0 means that every progress tick of curl is reported. */
+
+    LRO_MULTIPROGRESSCB, /*!< (LrMultiProgressCb)
+        Aggregated progress callback. It is called at most once per
+        LRO_PROGRESSINTERVAL with the progress of all running targets
+        of the download. This callback gets the user data setted by
+        LRO_PROGRESSDATA. It is used by all downloads whose first target
+        uses the handle. */
+
+    LRO_YUMDECOMPRESS, /*!< (char ** NULL-terminated)
+        Decompress specified records from repomd (e.g. ["primary",
+        "filelists", NULL]) while they are downloaded. Decompressed file
+        is stored next to the downloaded one, without the compression
+        suffix (.gz, .bz2, .xz). Checksum is checked on the downloaded
+        (compressed) file. See LRO_YUMKEEPCOMPRESSED.
+        Note: Last element of the list must be NULL! */
+
+    LRO_YUMKEEPCOMPRESSED, /*!< (long 1 or 0)
+        If disabled, the downloaded compressed files of records from
+        LRO_YUMDECOMPRESS are removed after the decompression and
+        only the decompressed files are kept (and listed in the result).
+        Enabled by default. */
+
+    LRO_CHECKSUMTHREADS, /*!< (long)
+        Number of threads used to verify checksums of files by
+        lr_check_packages() and of local repositories (LRO_LOCAL).
+        0 means the number of available processors. Default is 1 -
+        files are verified one after another by the calling thread.
+        Downloaded files whose checksums couldn't be calculated during
+        the transfer are always verified out of the download loop,
+        by this number of threads. */
+
+    LRO_CHECKSUMINDEX, /*!< (long 1 or 0)
+        If enabled, checksums of files are also cached in a sidecar index
+        file (see LR_CHECKSUM_INDEX_FILENAME) in the directory of the file
+        when the filesystem doesn't support extended attributes
+        (e.g. NFS or overlayfs). Disabled by default. */
+
+    LRO_PARSECACHE, /*!< (long 1 or 0)
+        If enabled, repomd.xml and metalink.xml of repositories are
+        loaded from a binary cache of their parsed content instead of
+        being parsed again, if the cache is up to date. The cache is
+        written next to the XML file (see LR_PARSECACHE_SUFFIX) when
+        the XML is parsed. Disabled by default. */
+
+    LRO_METALINKMAXURLS, /*!< (long)
+        Maximal number of URLs (mirrors) parsed from a metalink.
+        Further url elements of the metalink are skipped, the order
+        of the URLs in the metalink is kept. 0 means no limit (default). */
+
+    LRO_FASTESTMIRRORPROBE, /*!< (char *)
+        Path of an object relative to the mirror URL (e.g.
+        "repodata/repomd.xml") which is used to probe the mirrors
+        when LRO_FASTESTMIRROR is enabled. If set, the first
+        LR_FASTESTMIRROR_PROBE_SIZE bytes of the object are downloaded
+        from each mirror and the mirrors are sorted by a score combined
+        from the time to the first byte and the throughput of the probe.
+        Connections of the finished probes are left in the connection
+        cache of the handle and reused by the following downloads.
+        If NULL (default), only the connect time is measured. */
+
+    LRO_FASTESTMIRRORCONCURRENCY, /*!< (long)
+        Maximal number of mirrors measured at the same time by
+        the fastestmirror. Further mirrors are measured as the
+        running measurements finish. Mirrors which are not measured
+        within the time limit of the measurement are sorted after
+        the measured ones and they are marked in the fastestmirror
+        cache to be measured next time. 0 means no limit.
+        Default: 32 */
+
+    LRO_FASTESTMIRRORGOODCOUNT, /*!< (long)
+        Stop the fastestmirror measurement as soon as this number
+        of mirrors (including the ones from the cache) was measured
+        successfully and none of the running measurements can beat
+        them any more. The mirrors which were not measured are marked
+        in the fastestmirror cache to be measured next time.
+        0 means measure all mirrors (default). */
+
+    LRO_FASTESTMIRRORASYNC, /*!< (long 1 or 0)
+        Serve the records of the fastestmirror cache (LRO_FASTESTMIRRORCACHE)
+        older than LRO_FASTESTMIRRORMAXAGE right away and measure the
+        mirrors again in a background thread, while the downloads run.
+        LRO_FASTESTMIRRORMAXAGE is then a soft expiry of the records,
+        only mirrors without a usable record are measured before the
+        download. The background thread is joined by lr_handle_free().
+        See also lr_fastestmirror_refresh(). Disabled by default. */
+
+    LRO_CONDITIONALGET, /*!< (long 1 or 0)
+        If enabled, validators (ETag, Last-Modified) of the downloaded
+        repomd.xml are stored next to it (see LR_VALIDATORS_SUFFIX) and
+        when the repository is downloaded to the same destdir again,
+        repomd.xml is requested by a conditional HTTP request.
+        If the server answers 304 Not Modified, the local repomd.xml
+        is used instead. A local repomd.xml which doesn't match
+        the checksums from the metalink is always downloaded again.
+        Disabled by default. */
+
+    LRO_YUMREUSEDIR, /*!< (char *)
+        Directory with a previous download of the repository (e.g. its
+        previous destdir). Files of the metadata records which have the
+        checksum from the new repomd.xml are hardlinked (or copied)
+        from it instead of being downloaded. Files already present
+        in the destdir (LRO_UPDATE) are reused the same way even
+        without this option. The checksums are usually known from
+        the checksum cache, so the check is cheap. NULL by default. */
+
+    LRO_YUMRECORDCB, /*!< (LrYumRecordCb)
+        Callback called as soon as the file of a metadata record
+        (e.g. primary) is downloaded and its checksum is verified,
+        while the other records may still be downloading. It is called
+        for reused files too. This callback gets the user data setted
+        by LRO_PROGRESSDATA. With LRO_ENDCBTHREADS it is called from
+        those threads. */
+
+    LRO_LAZYCHECKSUM, /*!< (long 1 or 0)
+        If enabled and a local repository is located (LRO_LOCAL with
+        LRO_CHECKSUM), checksums of the metadata files are not verified by
+        lr_handle_perform(). Every file is verified when its path is
+        obtained by lr_yum_repo_path_verified() for the first time, so only
+        the files which are really used are read. Disabled by default. */
+
+    LRO_MIRRORLISTCACHE, /*!< (char *)
+        Directory of a cache of the downloaded mirrorlists and metalinks
+        (LRO_MIRRORLISTURL, LRO_METALINKURL) shared by all handles.
+        The files are keyed by the URL. A file fetched less than
+        LRO_MIRRORLISTCACHETTL seconds ago is used without any network
+        access, an older one is revalidated by a conditional HTTP
+        request. If the server cannot be reached, an outdated file is
+        used. NULL (default) disables the cache. */
+
+    LRO_MIRRORLISTCACHETTL, /*!< (long)
+        Age in seconds after which a file of the LRO_MIRRORLISTCACHE
+        is revalidated. 0 means that the file is revalidated every time.
+        Default is LRO_MIRRORLISTCACHETTL_DEFAULT. */
+
+    LRO_PRERESOLVE, /*!< (long 1 or 0)
+        Resolve all distinct hosts of the mirrors concurrently when the
+        internal mirrorlist is prepared and pass the addresses to curl,
+        so the first transfers don't wait for DNS lookups one by one.
+        Hosts are not resolved when a proxy is used. Default is 0. */
+
+    LRO_PRERESOLVECACHE, /*!< (char *)
+        File where the addresses resolved by LRO_PRERESOLVE are kept.
+        Addresses resolved less than LRO_PRERESOLVECACHETTL seconds ago
+        are used without a lookup. NULL (default) disables the cache. */
+
+    LRO_PRERESOLVECACHETTL, /*!< (long)
+        Age in seconds after which addresses in the LRO_PRERESOLVECACHE
+        are resolved again. Default is LRO_PRERESOLVECACHETTL_DEFAULT. */
+
+    LRO_TLSSESSIONCACHE, /*!< (char *)
+        File where TLS sessions are kept across processes. The sessions
+        are loaded when the option is set and stored (merged with the
+        sessions stored by other processes) when the handle is freed,
+        so the following runs can resume them instead of doing full
+        handshakes. The file keeps at most 256 sessions, the expired ones
+        are dropped. Requires curl >= 8.12, the option is ignored
+        otherwise. NULL (default) disables the cache. */
+
+    LRO_PACKAGESTORE, /*!< (char *)
+        Directory of a content-addressed store of packages shared by
+        all repositories and destinations. A package target with a known
+        checksum is taken from the store (by a reflink, a hardlink or
+        a copy) instead of the download, a downloaded package is put to
+        the store. Files hardlinked from the store must not be modified
+        in place, a modified file is detected by its checksum and
+        removed from the store. NULL (default) disables the store. */
+
+    LRO_PACKAGESTOREMAXSIZE, /*!< (gint64)
+        Maximal size of the LRO_PACKAGESTORE in bytes. The least
+        recently used packages are removed from the store after
+        the downloads which made it bigger. 0 (default) means unlimited. */
+
+    LRO_CACHESOURCES, /*!< (char ** NULL-terminated)
+        Ordered list of base URLs of cache sources (e.g. HTTP caches or
+        peers in the local network) which are tried before the mirrors
+        for the packages downloaded by lr_download_packages(). A package
+        which is missing in a cache (an error status) is downloaded from
+        the next source or from the mirrors, the misses are not counted
+        as failures (LRO_ALLOWEDMIRRORFAILURES) nor tries
+        (LRO_MAXMIRRORTRIES). Metadata are never downloaded from the
+        cache sources and the sources don't affect the ranking of
+        the mirrors. NULL (default) disables the cache sources. */
+
+    LRO_CACHESOURCETIMEOUT, /*!< (long)
+        Max time in miliseconds for the connection phase of a transfer
+        from a cache source (LRO_CACHESOURCES). A cache which doesn't
+        answer in time is skipped like a miss. Default is 1000. */
+
+    LRO_LOCALHARDLINK, /*!< (long 1 or 0)
+        Targets downloaded from local (file://) mirrors are hardlinked
+        from the repository instead of copied, if they are on the same
+        filesystem. The downloaded file is then the same file as the
+        one in the repository, so it must not be modified. Used only
+        for targets downloaded to a filename. 0 (default) means that
+        the files are copied (reflinked if the filesystem supports it). */
+
+    LRO_DURABILITY, /*!< (LrDurability)
+        How the downloaded files are made durable (flushed to the disk).
+        LR_DURABILITY_NONE (default) leaves it to the kernel, after
+        a crash a file could be incomplete although its download was
+        reported as successful. LR_DURABILITY_BATCH syncs all files
+        finished by lr_download() at its end, every filesystem once by
+        syncfs(), and then the directories of the files.
+        LR_DURABILITY_STRICT syncs every file and its directory before
+        the target is reported as finished (the end callback is
+        called), that is slow for a lot of small files. */
+
+    LRO_ATOMICDOWNLOAD, /*!< (long 1 or 0)
+        Targets with a filename (fn) are downloaded to a temporary file
+        fn.part, which is renamed to fn only after the download is
+        finished and its checksum is verified. Readers never see
+        a partially downloaded file and a failed download keeps
+        the previous content of fn. Resumed downloads continue from
+        the fn.part. 0 (default) means that fn is written directly. */
+
+    LRO_GPGBACKEND, /*!< (LrGpgBackend)
+        Implementation which verifies the GPG signatures of repomd.xml.
+        LR_GPGBACKEND_BUILTIN verifies the signatures in-process with
+        the keys of the keyring files in LRO_GNUPGHOMEDIR (no gpg
+        process is started), the signatures it cannot decide (unknown
+        algorithms, revoked or expiring keys, ...) are verified by
+        LR_GPGBACKEND_GPGME. LR_GPGBACKEND_DEFAULT (default) is chosen
+        at build time. */
+
+    LRO_MIRRORHEALTHCACHE, /*!< (char *)
+        File where the health of the mirrors is kept across runs.
+        Decayed numbers of successful and failed transfers, average
+        throughput and time to first byte and the last error are
+        recorded per host at the end of every download and they seed
+        the ranks used by LRO_ADAPTIVEMIRRORSORTING, so the mirrors are
+        sorted well from the first transfer. The store is loaded once per
+        process and shared by the handles, the results are written to
+        the file at most every LR_MIRRORREGISTRY_FLUSH_INTERVAL seconds
+        (see lr_mirrorregistry_flush()). NULL (default) disables
+        the store. */
+
+    LRO_MIRRORBREAKER, /*!< (long)
+        Number of consecutive failed transfers from a mirror after which
+        the mirror is not used (its circuit breaker opens) for a backoff
+        time. The backoff starts at 1 second and doubles every time
+        the breaker opens again, up to 1 minute. After the backoff
+        a single probe transfer is allowed: if it succeeds the mirror is
+        used normally again, if it fails the breaker opens again.
+        The targets wait for the mirror if there is no other one to try.
+        0 (default) disables the breakers. */
+
+    LRO_TRACEFILE, /*!< (char *)
+        File to which the spans of the work of the handle are written:
+        preparation of the mirrors, fastestmirror, the queue wait,
+        the transfer (with its mirror) and the checksum verification
+        of every target and the GPG checks. The file is created
+        (truncated) when the option is set and it is finished when
+        the handle is freed or the option is set again. NULL (default)
+        disables the tracing. */
+
+    LRO_TRACEFORMAT, /*!< (LrTraceFormat)
+        Format of the LRO_TRACEFILE. LR_TRACE_CHROME (default) is
+        a JSON array of Chrome trace events (Perfetto, chrome://tracing),
+        LR_TRACE_JSONLINES writes a JSON object per line and span.
+        If a trace file is open, it is created again in the new format. */
+
+    LRO_METRICSCB, /*!< (LrMetricsCb)
+        Metrics callback. It is called once per LRO_METRICSINTERVAL
+        during the downloads whose first target uses the handle
+        with gauges (running transfers, queued targets, files waiting
+        for the checksum verification, speed per mirror) and counters
+        (received bytes, transfers per mirror, failed transfers by
+        their LrRc code). This callback gets the user data setted by
+        LRO_PROGRESSDATA. NULL (default) disables it. */
+
+    LRO_METRICSINTERVAL, /*!< (long)
+        Time in milliseconds between two calls of the LRO_METRICSCB
+        (default 1000). */
+
+    LRO_DOWNLOADSHARDS, /*!< (long)
+        Number of threads (shards) of lr_download() whose first target
+        uses the handle. Every shard has its own curl multi handle and
+        pulls the targets from the shared list when it has a free slot.
+        LRO_MAXPARALLELDOWNLOADS is split among the shards, the limits
+        of LRO_MAXDOWNLOADSPERMIRROR and LRO_MAXSPEED are shared by them.
+        The callbacks of the targets, LRO_MULTIPROGRESSCB and
+        LRO_METRICSCB (which report the transfers of a shard) are called
+        from the shards, but never concurrently. A download with a target
+        pinned to the mirror of another of its targets
+        (LrDownloadTarget.samemirror) or with identical targets is not
+        sharded. The shards share the DNS cache and SSL sessions, but
+        every shard has its own connections.
+        0 means the number of available processors. Default is 1 -
+        everything is done by the calling thread. */
+
+    LRO_SHARDENDCB, /*!< (long 1 or 0)
+        If enabled, the end callbacks of the targets of a sharded download
+        (see LRO_DOWNLOADSHARDS) are called from the thread which called
+        lr_download(). The shard waits for the result of the callback.
+        Disabled by default. */
+
+    LRO_IOURING, /*!< (long 1 or 0)
+        Write the downloaded data asynchronously via io_uring, so the
+        download loop doesn't wait for the disk. Every transfer uses two
+        write buffers (of LRO_WRITEBUFFERSIZE, 128 KiB if not set), one
+        is filled while the other is being written. Supported only on
+        Linux if librepo was built with liburing. If io_uring is not
+        available, the data are written by pwrite(). Disabled
+        by default. */
+
+    LRO_RESUMEJOURNAL, /*!< (long 1 or 0)
+        Keep a journal next to the partially downloaded files which are
+        resumed (see LRO_RESUME and the resume argument of
+        lr_downloadtarget_new()). The journal records the URL, ETag and
+        Last-Modified of the object, the number of downloaded bytes and
+        the states of the checksums. A resumed HTTP transfer from the
+        same URL sends If-Range, so the download is restarted from
+        the beginning if the object on the server was changed, and the
+        checksums continue from the saved states instead of reading
+        the downloaded part again. A partial file whose journal was
+        saved is kept if the download fails, so it could be resumed
+        later. Disabled by default. */
+
+    LRO_MAXRANGESPERREQUEST, /*!< (long)
+        Maximum number of byte ranges fetched by a single HTTP request.
+        Waiting targets limited by a byte range (see byterangestart and
+        byterangeend of LrDownloadTarget) which are downloaded from
+        the same URL are batched into one multi-range request and the
+        parts of the multipart/byteranges response are written into
+        the files of the targets. Targets with checksums, resumed
+        targets and targets with a data callback are never batched.
+        If the server ignores the ranges and sends the whole object,
+        the beginning of the object up to the end of the last range
+        is used. 1 (default) disables batching. */
+
+    LRO_CONNECTIONAFFINITY, /*!< (long 1 or 0)
+        Prefer mirrors whose connections were just released by finished
+        transfers when a mirror is selected for a small target (up to
+        1 MiB or of unknown size). The next waiting targets go to the
+        host whose keep-alive connection is still open, instead of the
+        first suitable mirror, so they don't pay for a new connection
+        (TCP and TLS handshakes). Disabled by default. */
+
+    LRO_AUTOTUNEPARALLELDOWNLOADS, /*!< (long 1 or 0)
+        Tune the number of parallel downloads during the download
+        instead of using LRO_MAXPARALLELDOWNLOADS as it is. The download
+        starts with 2 transfers (or with the number chosen by the previous
+        download with the handle) and the number grows while the total
+        throughput grows. It is decreased when the throughput stops
+        growing or falls and after a transfer timed out. The number stays
+        between 1 and LRO_MAXPARALLELDOWNLOADS, the chosen one is in
+        the parallel_downloads of LRI_STATS. Disabled by default. */
+
+    LRO_ACCEPTENCODING, /*!< (long 1 or 0)
+        Negotiate a compressed transfer (Accept-Encoding with all
+        the encodings supported by libcurl, e.g. gzip, zstd, br) of
+        the uncompressed metadata files: repomd.xml and its signature,
+        mirrorlists and metalinks (LrDownloadTarget.contentencoding).
+        The data are decoded during the transfer, so the checksums and
+        the expected size are checked on the decoded data. The expected
+        size of repomd.xml is then taken from the metalink, if it has
+        no alternates. Disabled by default. */
+
+    LRO_CRITICALSLOTS, /*!< (long)
+        Number of transfers of LR_PRIORITYCLASS_CRITICAL targets
+        (metadata of repositories) which could run beyond
+        LRO_MAXPARALLELDOWNLOADS while the other targets take all
+        the slots, so the critical targets don't wait for the end of
+        long transfers of packages in the same download. The other
+        targets use all the LRO_MAXPARALLELDOWNLOADS slots. Waiting
+        critical targets always start before the other ones.
+        0 (default) disables the extra slots. */
+
+    LRO_PROXIES, /*!< (char ** NULL-terminated)
+        Pool of proxies used instead of LRO_PROXY by the transfers of
+        the downloads. An item is "PROXY" or "PROXY WEIGHT" where PROXY
+        has the format of LRO_PROXY (LRO_PROXYPORT, LRO_PROXYTYPE and
+        the other proxy options apply to all proxies) and WEIGHT is
+        a non-negative integer (default 1). A transfer goes through
+        the healthy proxy with the lowest number of running transfers
+        relative to its weight, ties are resolved by the order of
+        the list, so a lightly loaded pool keeps reusing the keep-alive
+        connections of the first proxies. Proxies with the weight 0 are
+        backups, used only if no other proxy is healthy. A proxy which
+        cannot be resolved or connected is not used for a backoff time
+        (1 second doubled after every failed probe, up to 1 minute) and
+        the target is tried again from the same mirror through another
+        proxy, which doesn't count as a failure of the mirror.
+        The fastest mirror measurement uses LRO_PROXY.
+        NULL (default) disables the pool. */
+
+    LRO_RECVBUFFERSIZE, /*!< (long)
+        Size (in bytes) of the receive buffer of the transfers
+        (CURLOPT_BUFFERSIZE). It is the maximal size of the chunks
+        of data the write callback gets from libcurl, bigger buffer
+        means less callbacks on fast links. With LRO_WRITEBUFFERSIZE
+        the chunks are collected into blocks of the write buffer and
+        the checksums, the decompression and the other consumers of
+        the data process whole blocks. Values under 1024 are rounded
+        up by libcurl. 0 (default) means the default of libcurl
+        (16 KiB). Maximum is LRO_RECVBUFFERSIZE_MAX. */
+
+    LRO_ENDCBTHREADS, /*!< (long)
+        Number of threads which call the end callbacks of the targets.
+        0 (default) means the end callbacks are called by the download
+        loop as soon as the targets are finished, so a slow callback
+        (signature check, unpacking, indexing) stalls all the transfers.
+        Otherwise the finished targets are queued for these threads and
+        the download continues meanwhile. lr_download() returns after all
+        the queued callbacks were called. The callbacks are called from
+        the threads concurrently, they must be thread safe then. A return
+        value of LR_CB_ERROR interrupts the download as usual, only the
+        targets finished meanwhile are not interrupted anymore. */
+
+    LRO_ENDCBQUEUESIZE, /*!< (long)
+        Maximal number of finished targets whose end callbacks are queued
+        or running (see LRO_ENDCBTHREADS). When the queue is full, no new
+        transfers are started until a callback returns, so the finished
+        files don't pile up when the processing is slower than the
+        download. Default is LRO_ENDCBQUEUESIZE_DEFAULT. */
+
     LRO_SENTINEL,    /*!< Sentinel */
 
 } LrHandleOption; /*!< Handle config options */
@@ -347,6 +1123,68 @@ typedef enum {
     LRI_ALLOWEDMIRRORFAILURES,  /*!< (long *) */
     LRI_ADAPTIVEMIRRORSORTING,  /*!< (long *) */
     LRI_GNUPGHOMEDIR,           /*!< (char **) */
+    LRI_HTTP2,                  /*!< (long *) */
+    LRI_MAXSTREAMSPERMIRROR,    /*!< (long *) */
+    LRI_MAXSEGMENTS,            /*!< (long *) */
+    LRI_WRITEBUFFERSIZE,        /*!< (long *) */
+    LRI_PREALLOCATE,            /*!< (long *) */
+    LRI_EARLYWRITEBACK,         /*!< (long *) */
+    LRI_DOWNLOADORDER,          /*!< (LrDownloadOrder *) */
+    LRI_ADAPTIVEDOWNLOADSPERMIRROR, /*!< (long *) */
+    LRI_HEDGEDDOWNLOADS,        /*!< (long *) */
+    LRI_LOWSPEEDRESUME,         /*!< (long *) */
+    LRI_PROGRESSINTERVAL,       /*!< (long *) */
+    LRI_YUMDECOMPRESS,          /*!< (char ***) */
+    LRI_YUMKEEPCOMPRESSED,      /*!< (long *) */
+    LRI_CHECKSUMTHREADS,        /*!< (long *) */
+    LRI_CHECKSUMINDEX,          /*!< (long *) */
+    LRI_PARSECACHE,             /*!< (long *) */
+    LRI_METALINKMAXURLS,        /*!< (long *) */
+    LRI_FASTESTMIRRORPROBE,     /*!< (char **) */
+    LRI_FASTESTMIRRORCONCURRENCY, /*!< (long *) */
+    LRI_FASTESTMIRRORGOODCOUNT, /*!< (long *) */
+    LRI_FASTESTMIRRORASYNC,     /*!< (long *) */
+    LRI_CONDITIONALGET,         /*!< (long *) */
+    LRI_YUMREUSEDIR,            /*!< (char **) */
+    LRI_LAZYCHECKSUM,           /*!< (long *) */
+    LRI_MIRRORLISTCACHE,        /*!< (char **) */
+    LRI_MIRRORLISTCACHETTL,     /*!< (long *) */
+    LRI_PRERESOLVE,             /*!< (long *) */
+    LRI_PRERESOLVECACHE,        /*!< (char **) */
+    LRI_PRERESOLVECACHETTL,     /*!< (long *) */
+    LRI_TLSSESSIONCACHE,        /*!< (char **) */
+    LRI_PACKAGESTORE,           /*!< (char **) */
+    LRI_CACHESOURCES,           /*!< (char ***) */
+    LRI_CACHESOURCETIMEOUT,     /*!< (long *) */
+    LRI_LOCALHARDLINK,          /*!< (long *) */
+    LRI_DURABILITY,             /*!< (LrDurability *) */
+    LRI_ATOMICDOWNLOAD,         /*!< (long *) */
+    LRI_GPGBACKEND,             /*!< (LrGpgBackend *) */
+    LRI_STATS,                  /*!< (LrStats **)
+        Statistics of the transfers from the mirrors of the handle since
+        the beginning of the last lr_handle_perform(),
+        lr_handles_perform() or lr_download_packages(). Other downloads
+        with the handle (e.g. lr_download_url()) are added to them.
+        Transfers of targets with a full URL or a baseurl are not counted.
+        NOTE: The returned copy must be freed by lr_stats_free()! */
+    LRI_MIRRORHEALTHCACHE,      /*!< (char **) */
+    LRI_MIRRORBREAKER,          /*!< (long *) */
+    LRI_TRACEFILE,              /*!< (char **) */
+    LRI_TRACEFORMAT,            /*!< (LrTraceFormat *) */
+    LRI_METRICSINTERVAL,        /*!< (long *) */
+    LRI_DOWNLOADSHARDS,         /*!< (long *) */
+    LRI_SHARDENDCB,             /*!< (long *) */
+    LRI_IOURING,                /*!< (long *) */
+    LRI_RESUMEJOURNAL,          /*!< (long *) */
+    LRI_MAXRANGESPERREQUEST,    /*!< (long *) */
+    LRI_CONNECTIONAFFINITY,     /*!< (long *) */
+    LRI_AUTOTUNEPARALLELDOWNLOADS,/*!< (long *) */
+    LRI_ACCEPTENCODING,         /*!< (long *) */
+    LRI_CRITICALSLOTS,          /*!< (long *) */
+    LRI_PROXIES,                /*!< (char ***) */
+    LRI_RECVBUFFERSIZE,         /*!< (long *) */
+    LRI_ENDCBTHREADS,           /*!< (long *) */
+    LRI_ENDCBQUEUESIZE,         /*!< (long *) */
     LRI_SENTINEL,
 } LrHandleInfoOption; /*!< Handle info options */
 
@@ -375,6 +1213,12 @@ lr_handle_setopt(LrHandle *handle,
                  LrHandleOption option,
                  ...);
 
+/** Free statistics returned by LRI_STATS.
+ * @param stats         Statistics or NULL
+ */
+void
+lr_stats_free(LrStats *stats);
+
 /** Get information from handle.
  * Most of returned pointers point directly to the handle internal
  * values and therefore you should assume that they are only valid until
@@ -403,6 +1247,44 @@ lr_handle_getinfo(LrHandle *handle,
 gboolean
 lr_handle_perform(LrHandle *handle, LrResult *result, GError **err);
 
+/** Perform repodata download or location of several handles together.
+ * It is like lr_handle_perform() called for every handle, but all the
+ * mirrorlists and metalinks, then all the repomd.xml files and then all
+ * the metadata files are downloaded by one download each. The maximal
+ * number of parallel connections of the first handle and the per mirror
+ * limits apply to all the repositories together.
+ * @param handles       List of handles (LrHandle *).
+ * @param results       List of results (LrResult *) in the same order.
+ * @param errors        Location for a list of errors (GError *, NULL for
+ *                      successful repositories) in the order of the
+ *                      handles or NULL.
+ * @param err           GError **
+ * @return              TRUE if all the repositories are ok, FALSE if
+ *                      err is set.
+ */
+gboolean
+lr_handles_perform(GSList *handles,
+                   GSList *results,
+                   GSList **errors,
+                   GError **err);
+
+/** Cancel all operations of the handle. Unlike SIGINT handling enabled
+ * by LRO_INTERRUPTIBLE this affects only downloads which use the handle.
+ * This function could be called from any thread (but not from a signal
+ * handler). The running operations end with LRE_CANCELLED as soon as
+ * possible and the new ones fail immediately until
+ * ::lr_handle_reset_cancel is called.
+ * @param handle        Librepo handle.
+ */
+void
+lr_handle_cancel(LrHandle *handle);
+
+/** Make the cancelled handle usable again.
+ * @param handle        Librepo handle.
+ */
+void
+lr_handle_reset_cancel(LrHandle *handle);
+
 /** @} */
 
 G_END_DECLS
@@ -27,7 +27,10 @@
 #include "types.h"
 #include "handle.h"
 #include "lrmirrorlist.h"
+#include "proxypool.h"
+#include "trace.h"
 #include "url_substitution.h"
+#include "util.h"
 
 G_BEGIN_DECLS
 
@@ -36,7 +39,19 @@ G_BEGIN_DECLS
 struct _LrHandle {
 
     CURL *curl_handle; /*!<
-        CURL handle */
+        CURL handle or NULL, it's created by the first operation which
+        needs it (see lr_handle_curl()) */
+
+    CURLSH *curl_share; /*!<
+        CURL share handle. DNS cache, SSL sessions and (if supported
+        by curl) connection cache are shared by all transfers
+        performed by the handle (even across lr_download() calls). */
+
+    CURLSH *curl_shard_share; /*!<
+        CURL share handle of the transfers of the shards
+        (see LRO_DOWNLOADSHARDS) or NULL. The shards run in several
+        threads and curl doesn't support a connection cache shared
+        between them, so only DNS cache and SSL sessions are shared. */
 
     int update; /*!<
         Just update existing repo */
@@ -77,6 +92,10 @@ struct _LrHandle {
     int mirrorlist_fd; /*!<
         Raw downloaded mirrorlist file */
 
+    int mirrorlist_prefetch_fd; /*!<
+        Mirrorlist downloaded by lr_handles_perform() together with
+        the mirrorlists of the other handles or -1 */
+
     LrInternalMirrorlist *mirrorlist_mirrors; /*!<
         Mirrors from mirrorlist */
 
@@ -88,6 +107,10 @@ struct _LrHandle {
     int metalink_fd; /*!<
         Raw downloaded metalink file */
 
+    int metalink_prefetch_fd; /*!<
+        Metalink downloaded by lr_handles_perform() together with
+        the metalinks of the other handles or -1 */
+
     LrInternalMirrorlist *metalink_mirrors; /*!<
         Mirrors from metalink */
 
@@ -127,6 +150,9 @@ struct _LrHandle {
     int interruptible; /*!<
         Setup own SIGTERM handler*/
 
+    volatile gint cancelled; /*!<
+        Set by lr_handle_cancel(), accessed only by g_atomic_int_*() */
+
     char **yumdlist; /*!<
         Repomd data typenames to download NULL - Download all
         yumdlist[0] = NULL - Only repomd.xml */
@@ -180,6 +206,236 @@ struct _LrHandle {
 
     gchar *gnupghomedir; /*!<
         GNUPG home dir. */
+
+    int http2; /*!<
+        Use HTTP/2 with multiplexing if the server supports it */
+
+    long maxstreamspermirror; /*!<
+        Maximal number of parallel streams per HTTP/2 connection */
+
+    long maxsegments; /*!<
+        Maximal number of segments a single target could be
+        split to and downloaded from different mirrors in parallel. */
+
+    gint64 minsegmentsize; /*!<
+        Minimal size of a segment in bytes. */
+
+    long writebuffersize; /*!<
+        Size of buffer for writing of downloaded data (0 == stdio) */
+
+    int preallocate; /*!<
+        Preallocate space for targets with known size */
+
+    int earlywriteback; /*!<
+        Start writeback of written data immediately */
+
+    LrDownloadOrder downloadorder; /*!<
+        Order in which targets are downloaded */
+
+    int adaptivedownloadspermirror; /*!<
+        See LRO_ADAPTIVEDOWNLOADSPERMIRROR */
+
+    int hedgeddownloads; /*!<
+        See LRO_HEDGEDDOWNLOADS */
+
+    int lowspeedresume; /*!<
+        See LRO_LOWSPEEDRESUME */
+
+    long progressinterval; /*!<
+        See LRO_PROGRESSINTERVAL */
+
+    LrMultiProgressCb multiprogresscb; /*!<
+        See LRO_MULTIPROGRESSCB */
+
+    char **yumdecompress; /*!<
+        Repomd data typenames which are decompressed during download.
+        NULL - Nothing is decompressed */
+
+    GHashTable *yumdlist_set; /*!<
+        Names from the yumdlist for fast lookups. NULL if yumdlist is NULL.
+        The keys are owned by the list. */
+
+    GHashTable *yumblist_set; /*!<
+        Names from the yumblist. NULL if yumblist is NULL. */
+
+    GHashTable *yumdecompress_set; /*!<
+        Names from the yumdecompress. NULL if yumdecompress is NULL. */
+
+    int yumkeepcompressed; /*!<
+        See LRO_YUMKEEPCOMPRESSED */
+
+    long checksumthreads; /*!<
+        See LRO_CHECKSUMTHREADS */
+
+    int checksumindex; /*!<
+        See LRO_CHECKSUMINDEX */
+
+    int parsecache; /*!<
+        See LRO_PARSECACHE */
+
+    long metalinkmaxurls; /*!<
+        See LRO_METALINKMAXURLS */
+
+    char * fastestmirrorprobe; /*!<
+        Path of the object used to probe the mirrors or NULL */
+
+    long fastestmirrorconcurrency; /*!<
+        Max number of simultaneous fastestmirror measurements */
+
+    long fastestmirrorgoodcount; /*!<
+        Number of good mirrors after which the measurement can stop */
+
+    gboolean fastestmirrorasync; /*!<
+        Serve stale fastestmirror records and refresh them in background */
+
+    GThread *fastestmirrorthread; /*!<
+        Background refresh of the stale fastestmirror records or NULL */
+
+    gint fastestmirrorthread_running; /*!<
+        Is the fastestmirrorthread still measuring? (atomic) */
+
+    gboolean conditionalget; /*!<
+        Download repomd.xml by a conditional request */
+
+    char * yumreusedir; /*!<
+        Previous destdir with metadata files which can be reused */
+
+    LrYumRecordCb yumrecordcb; /*!<
+        See LRO_YUMRECORDCB */
+
+    gboolean lazychecksum; /*!<
+        Verify files of a local repository on the first access */
+
+    char * mirrorlistcache; /*!<
+        Directory of the cache of mirrorlists and metalinks */
+
+    long mirrorlistcachettl; /*!<
+        Max age of a file in the LRO_MIRRORLISTCACHE in seconds */
+
+    gboolean preresolve; /*!<
+        Resolve hosts of the mirrors in advance */
+
+    char * preresolvecache; /*!<
+        File with the results of LRO_PRERESOLVE */
+
+    long preresolvecachettl; /*!<
+        Max age of addresses in the LRO_PRERESOLVECACHE in seconds */
+
+    gboolean proxy; /*!<
+        Is a proxy set by LRO_PROXY? */
+
+    gboolean userpwd; /*!<
+        Is a user and password set by LRO_USERPWD? */
+
+    gboolean proxyuserpwd; /*!<
+        Is a user and password set by LRO_PROXYUSERPWD? */
+
+    char **proxies; /*!<
+        See LRO_PROXIES */
+
+    LrProxyPool *proxypool; /*!<
+        Pool of the LRO_PROXIES or NULL */
+
+    struct curl_slist *resolve; /*!<
+        Addresses resolved by LRO_PRERESOLVE (CURLOPT_RESOLVE of
+        the curl_handle) */
+
+    char * tlssessioncache; /*!<
+        File with the TLS sessions of the handle */
+
+    char * packagestore; /*!<
+        Content-addressed store of the downloaded packages or NULL */
+
+    gint64 packagestoremaxsize; /*!<
+        Max size of the LRO_PACKAGESTORE in bytes (0 == unlimited) */
+
+    char ** cachesources; /*!<
+        NULL-terminated list of URLs of the cache sources or NULL */
+
+    long cachesourcetimeout; /*!<
+        Connect timeout of the cache sources in miliseconds */
+
+    int localhardlink; /*!<
+        Hardlink targets from local (file://) mirrors */
+
+    LrDurability durability; /*!<
+        Durability of the downloaded files */
+
+    int atomicdownload; /*!<
+        Download targets to fn.part and rename them when finished */
+
+    LrGpgBackend gpgbackend; /*!<
+        Implementation which verifies the GPG signatures */
+
+    char *mirrorhealthcache; /*!<
+        Path to the mirror health store or NULL */
+
+    long mirrorbreaker; /*!<
+        Consecutive failures which open the circuit breaker of a mirror,
+        0 if disabled */
+
+    char *tracefile; /*!<
+        Path to the trace file or NULL */
+
+    LrTraceFormat traceformat; /*!<
+        Format of the trace file */
+
+    LrTrace *trace; /*!<
+        Open trace file or NULL if the tracing is disabled */
+
+    LrMetricsCb metricscb; /*!<
+        See LRO_METRICSCB */
+
+    long metricsinterval; /*!<
+        See LRO_METRICSINTERVAL (msec) */
+
+    long downloadshards; /*!<
+        See LRO_DOWNLOADSHARDS */
+
+    int shardendcb; /*!<
+        See LRO_SHARDENDCB */
+
+    int iouring; /*!<
+        See LRO_IOURING */
+
+    int resumejournal; /*!<
+        See LRO_RESUMEJOURNAL */
+
+    long maxrangesperrequest; /*!<
+        See LRO_MAXRANGESPERREQUEST */
+
+    int connectionaffinity; /*!<
+        See LRO_CONNECTIONAFFINITY */
+
+    int autotuneparalleldownloads; /*!<
+        See LRO_AUTOTUNEPARALLELDOWNLOADS */
+
+    int acceptencoding; /*!<
+        See LRO_ACCEPTENCODING */
+
+    long criticalslots; /*!<
+        See LRO_CRITICALSLOTS */
+
+    long recvbuffersize; /*!<
+        See LRO_RECVBUFFERSIZE */
+
+    long endcbthreads; /*!<
+        See LRO_ENDCBTHREADS */
+
+    long endcbqueuesize; /*!<
+        See LRO_ENDCBQUEUESIZE */
+
+    int autotuned_downloads; /*!<
+        Number of parallel downloads chosen by the last download with
+        LRO_AUTOTUNEPARALLELDOWNLOADS or 0. The next download starts
+        with it. */
+
+    LrStats *stats; /*!<
+        Statistics of the downloads since the beginning of the last
+        operation (see LRI_STATS) */
+
+    LrAllocStats alloc_start; /*!<
+        Allocation counters at the beginning of the last operation */
 };
 
 /** Return new CURL easy handle with some default options setted.
@@ -187,6 +443,31 @@ struct _LrHandle {
 CURL *
 lr_get_curl_handle();
 
+/** Return new CURL share handle which shares DNS cache, SSL sessions
+ * and optionally connection cache (if supported by curl).
+ * @param connections       Share the connection cache too.
+ */
+CURLSH *
+lr_get_curl_share(gboolean connections);
+
+/** Return the CURL handle of the handle. The handle (together with
+ * its share and curl itself) is created by the first call, so no
+ * library startup cost is paid by the operations which don't transfer
+ * anything (e.g. LRO_LOCAL).
+ * @param handle            Librepo handle.
+ * @return                  CURL handle or NULL if it cannot be created
+ */
+CURL *
+lr_handle_curl(LrHandle *handle);
+
+/** Return the CURL share handle of the transfers of the shards
+ * (see LrHandle.curl_shard_share), it's created by the first call.
+ * @param handle            Librepo handle.
+ * @return                  CURL share handle or NULL
+ */
+CURLSH *
+lr_handle_curl_shard_share(LrHandle *handle);
+
 /**
  * Create (if do not exists) internal mirrorlist. Insert baseurl (if
  * specified) and download, parse and insert mirrors from mirrorlist url.
@@ -200,6 +481,28 @@ lr_handle_prepare_internal_mirrorlist(LrHandle *handle,
                                       gboolean usefastestmirror,
                                       GError **err);
 
+/** Drop the collected statistics of the handle. Called at the beginning
+ * of every operation which resets LRI_STATS.
+ * @param handle            Librepo handle.
+ */
+void
+lr_handle_stats_reset(LrHandle *handle);
+
+/** Return statistics of the mirror with the url. The entry is created
+ * (and appended to the list of the mirrors) if it does not exist yet.
+ * @param handle            Librepo handle.
+ * @param url               URL of the mirror.
+ * @return                  Statistics owned by the handle.
+ */
+LrMirrorStats *
+lr_handle_stats_mirror(LrHandle *handle, const char *url);
+
+/** Update the allocation statistics of the handle (if it has any
+ * statistics) by the allocations since the beginning of the operation.
+ * @param handle            Librepo handle.
+ */
+void
+lr_handle_stats_alloc_update(LrHandle *handle);
 
 G_END_DECLS
 
@@ -24,11 +24,14 @@
 #include <glib.h>
 
 #include "checksum.h"
+#include "daemon.h"
 #include "fastestmirror.h"
 #include "gpg.h"
 #include "handle.h"
 #include "metalink.h"
+#include "mirrorregistry.h"
 #include "package_downloader.h"
+#include "primary.h"
 #include "rcodes.h"
 #include "repomd.h"
 #include "repoutil_yum.h"
@@ -39,6 +42,7 @@
 #include "version.h"
 #include "xmlparser.h"
 #include "yum.h"
+#include "yumsync.h"
 
 // Low level downloading interface
 // (API could be changed significantly between two versions)
@@ -46,12 +46,13 @@ lr_detect_protocol(const char *url)
 }
 
 static LrInternalMirror *
-lr_lrmirror_new(const char *url, LrUrlVars *urlvars)
+lr_lrmirror_new(const char *url, LrUrlVarsTable *urlvars)
 {
     LrInternalMirror *mirror;
 
     mirror = lr_malloc0(sizeof(*mirror));
-    mirror->url = lr_url_substitute(url, urlvars);
+    mirror->url = lr_url_substitute_table(url, urlvars);
+    mirror->host = lr_url_without_path(mirror->url);
     return mirror;
 }
 
@@ -60,6 +61,7 @@ lr_lrmirror_free(void *data)
 {
     LrInternalMirror *mirror = data;
     lr_free(mirror->url);
+    lr_free(mirror->host);
     lr_free(mirror);
 }
 
@@ -80,7 +82,9 @@ lr_lrmirrorlist_append_url(LrInternalMirrorlist *list,
     if (!url || !strlen(url))
         return list;
 
-    LrInternalMirror *mirror = lr_lrmirror_new(url, urlvars);
+    LrUrlVarsTable *table = lr_urlvars_table_new(urlvars);
+    LrInternalMirror *mirror = lr_lrmirror_new(url, table);
+    lr_urlvars_table_free(table);
     mirror->preference = 100;
     mirror->protocol = lr_detect_protocol(mirror->url);
 
@@ -97,21 +101,27 @@ lr_lrmirrorlist_append_mirrorlist(LrInternalMirrorlist *list,
     if (!mirrorlist || !mirrorlist->urls)
         return list;
 
+    // Index the variables once for all the urls
+    LrUrlVarsTable *table = lr_urlvars_table_new(urlvars);
+    LrInternalMirrorlist *new_mirrors = NULL;
+
     for (GSList *elem = mirrorlist->urls; elem; elem = g_slist_next(elem)) {
         char *url = elem->data;
 
         if (!url || !strlen(url))
             continue;
 
-        LrInternalMirror *mirror = lr_lrmirror_new(url, urlvars);
+        LrInternalMirror *mirror = lr_lrmirror_new(url, table);
         mirror->preference = 100;
         mirror->protocol = lr_detect_protocol(mirror->url);
-        list = g_slist_append(list, mirror);
+        new_mirrors = g_slist_prepend(new_mirrors, mirror);
 
         //g_debug("%s: Appending URL: %s", __func__, mirror->url);
     }
 
-    return list;
+    lr_urlvars_table_free(table);
+
+    return g_slist_concat(list, g_slist_reverse(new_mirrors));
 }
 
 LrInternalMirrorlist *
@@ -128,6 +138,10 @@ lr_lrmirrorlist_append_metalink(LrInternalMirrorlist *list,
     if (suffix)
         suffix_len = strlen(suffix);
 
+    // Index the variables once for all the urls
+    LrUrlVarsTable *table = lr_urlvars_table_new(urlvars);
+    LrInternalMirrorlist *new_mirrors = NULL;
+
     for (GSList *elem = metalink->urls; elem; elem = g_slist_next(elem)) {
         LrMetalinkUrl *metalinkurl = elem->data;
         assert(metalinkurl);
@@ -153,22 +167,26 @@ lr_lrmirrorlist_append_metalink(LrInternalMirrorlist *list,
         if (!url_copy)
             url_copy = g_strdup(url);
 
-        LrInternalMirror *mirror = lr_lrmirror_new(url_copy, urlvars);
+        LrInternalMirror *mirror = lr_lrmirror_new(url_copy, table);
         mirror->preference = metalinkurl->preference;
         mirror->protocol = lr_detect_protocol(mirror->url);
         lr_free(url_copy);
-        list = g_slist_append(list, mirror);
+        new_mirrors = g_slist_prepend(new_mirrors, mirror);
 
         //g_debug("%s: Appending URL: %s", __func__, mirror->url);
     }
 
-    return list;
+    lr_urlvars_table_free(table);
+
+    return g_slist_concat(list, g_slist_reverse(new_mirrors));
 }
 
 LrInternalMirrorlist *
 lr_lrmirrorlist_append_lrmirrorlist(LrInternalMirrorlist *list,
                                     LrInternalMirrorlist *other)
 {
+    LrInternalMirrorlist *new_mirrors = NULL;
+
     if (!other)
         return list;
 
@@ -179,11 +197,58 @@ lr_lrmirrorlist_append_lrmirrorlist(LrInternalMirrorlist *list,
         LrInternalMirror *mirror = lr_lrmirror_new(oth->url, NULL);
         mirror->preference = oth->preference;
         mirror->protocol = oth->protocol;
-        list = g_slist_append(list, mirror);
+        new_mirrors = g_slist_prepend(new_mirrors, mirror);
         //g_debug("%s: Appending URL: %s", __func__, mirror->url);
     }
 
-    return list;
+    return g_slist_concat(list, g_slist_reverse(new_mirrors));
+}
+
+/** Return a normalized form of the url of the mirror.
+ * Scheme and host are lowercased and trailing slashes are removed.
+ */
+static gchar *
+lr_lrmirror_normalized_url(LrInternalMirror *mirror)
+{
+    size_t host_len = strlen(mirror->host);
+    size_t len = strlen(mirror->url);
+
+    while (len > host_len && mirror->url[len-1] == '/')
+        len--;
+
+    gchar *host = g_ascii_strdown(mirror->host, host_len);
+    gchar *normalized = g_strconcat(host, mirror->url + host_len, NULL);
+    normalized[len] = '\0';
+    g_free(host);
+
+    return normalized;
+}
+
+LrInternalMirrorlist *
+lr_lrmirrorlist_remove_duplicates(LrInternalMirrorlist *list)
+{
+    GHashTable *seen = g_hash_table_new_full(g_str_hash, g_str_equal,
+                                             g_free, NULL);
+    LrInternalMirrorlist *unique = NULL;
+
+    for (LrInternalMirrorlist *elem = list; elem; elem = g_slist_next(elem)) {
+        LrInternalMirror *mirror = elem->data;
+        gchar *normalized = lr_lrmirror_normalized_url(mirror);
+
+        if (g_hash_table_contains(seen, normalized)) {
+            g_debug("%s: Skipping duplicate mirror: %s", __func__, mirror->url);
+            g_free(normalized);
+            lr_lrmirror_free(mirror);
+        } else {
+            g_hash_table_add(seen, normalized);
+            unique = g_slist_prepend(unique, mirror);
+        }
+    }
+
+    g_slist_free(list);
+    g_hash_table_destroy(seen);
+
+    return g_slist_reverse(unique);
 }
 
 LrInternalMirror *
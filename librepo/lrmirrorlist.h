@@ -42,6 +42,8 @@ typedef struct {
     char *url;           /*!< URL of the mirror */
     int preference;      /*!< Integer number 1-100 - higher is better */
     LrProtocol protocol; /*!< Protocol of this mirror */
+    char *host;          /*!< URL without path (lr_url_without_path()),
+                              mirrors with the same host are one server */
 } LrInternalMirror;
 
 typedef GSList LrInternalMirrorlist;
@@ -97,6 +99,15 @@ LrInternalMirrorlist *
 lr_lrmirrorlist_append_lrmirrorlist(LrInternalMirrorlist *list,
                                     LrInternalMirrorlist *other);
 
+/** Remove mirrors with an equivalent URL, the first occurrence is kept.
+ * URLs are compared with case insensitive scheme and host and without
+ * trailing slashes.
+ * @param list          a LrInternalMirrorlist
+ * @return              the new start of the LrInternalMirrorlist
+ */
+LrInternalMirrorlist *
+lr_lrmirrorlist_remove_duplicates(LrInternalMirrorlist *list);
+
 /** Return mirror on the given position.
  * @param list          a LrInternalMirrorlist
  * @param nth           the position of the mirror
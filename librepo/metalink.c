@@ -26,35 +26,39 @@
 #include <unistd.h>
 #include <expat.h>
 
+#include "arena.h"
 #include "rcodes.h"
 #include "util.h"
 #include "metalink.h"
 #include "xmlparser_internal.h"
 
-/** TODO:
- * - (?) Use GStringChunk
- */
-
 #define CHUNK_SIZE              8192
 #define CONTENT_REALLOC_STEP    256
+#define ARENA_BLOCK_SIZE        8192
 
-/* Metalink object manipulation helpers */
+/* Metalink object manipulation helpers
+ *
+ * All the content of the metalink object is allocated from its arena.
+ * Lists are built by prepending and reversed by lr_metalink_finalize()
+ * when the parsing is done.
+ */
 
 static LrMetalinkHash *
 lr_new_metalinkhash(LrMetalink *m)
 {
     assert(m);
-    LrMetalinkHash *hash = lr_malloc0(sizeof(*hash));
-    m->hashes = g_slist_append(m->hashes, hash);
+    LrMetalinkHash *hash = lr_arena_new0(m->arena, LrMetalinkHash);
+    m->hashes = lr_arena_slist_prepend(m->arena, m->hashes, hash);
     return hash;
 }
 
 static LrMetalinkHash *
-lr_new_metalinkalternate_hash(LrMetalinkAlternate *ma)
+lr_new_metalinkalternate_hash(LrMetalink *m, LrMetalinkAlternate *ma)
 {
+    assert(m);
     assert(ma);
-    LrMetalinkHash *hash = lr_malloc0(sizeof(*hash));
-    ma->hashes = g_slist_append(ma->hashes, hash);
+    LrMetalinkHash *hash = lr_arena_new0(m->arena, LrMetalinkHash);
+    ma->hashes = lr_arena_slist_prepend(m->arena, ma->hashes, hash);
     return hash;
 }
 
@@ -62,53 +66,65 @@ static LrMetalinkUrl *
 lr_new_metalinkurl(LrMetalink *m)
 {
     assert(m);
-    LrMetalinkUrl *url = lr_malloc0(sizeof(*url));
-    m->urls = g_slist_append(m->urls, url);
+    LrMetalinkUrl *url = lr_arena_new0(m->arena, LrMetalinkUrl);
+    m->urls = lr_arena_slist_prepend(m->arena, m->urls, url);
     return url;
 }
 
-static LrMetalinkAlternate *
-lr_new_metalinkalternate(LrMetalink *m)
+static LrMetalinkPieces *
+lr_new_metalinkpieces(LrMetalink *m)
 {
     assert(m);
-    LrMetalinkAlternate *alternate = lr_malloc0(sizeof(*alternate));
-    m->alternates = g_slist_append(m->alternates, alternate);
-    return alternate;
+    LrMetalinkPieces *pieces = lr_arena_new0(m->arena, LrMetalinkPieces);
+    m->pieces = lr_arena_slist_prepend(m->arena, m->pieces, pieces);
+    return pieces;
 }
 
-static void
-lr_free_metalinkhash(LrMetalinkHash *metalinkhash)
+static LrMetalinkAlternate *
+lr_new_metalinkalternate(LrMetalink *m)
 {
-    if (!metalinkhash) return;
-    lr_free(metalinkhash->type);
-    lr_free(metalinkhash->value);
-    lr_free(metalinkhash);
+    assert(m);
+    LrMetalinkAlternate *alternate = lr_arena_new0(m->arena, LrMetalinkAlternate);
+    m->alternates = lr_arena_slist_prepend(m->arena, m->alternates, alternate);
+    return alternate;
 }
 
+/** Restore the document order of the lists built during the parsing.
+ */
 static void
-lr_free_metalinkurl(LrMetalinkUrl *metalinkurl)
+lr_metalink_finalize(LrMetalink *m)
 {
-    if (!metalinkurl) return;
-    lr_free(metalinkurl->protocol);
-    lr_free(metalinkurl->type);
-    lr_free(metalinkurl->location);
-    lr_free(metalinkurl->url);
-    lr_free(metalinkurl);
-}
+    m->hashes = g_slist_reverse(m->hashes);
+    m->urls = g_slist_reverse(m->urls);
+    m->alternates = g_slist_reverse(m->alternates);
+    for (GSList *elem = m->alternates; elem; elem = g_slist_next(elem)) {
+        LrMetalinkAlternate *ma = elem->data;
+        ma->hashes = g_slist_reverse(ma->hashes);
+    }
 
-static void
-lr_free_metalinkalternate(LrMetalinkAlternate *metalinkalternate)
-{
-    if (!metalinkalternate) return;
-    g_slist_free_full(metalinkalternate->hashes,
-                      (GDestroyNotify)lr_free_metalinkhash);
-    lr_free(metalinkalternate);
+    // Drop the invalid pieces elements (their nodes belong to the arena,
+    // they are only unlinked)
+    GSList *pieces = NULL;
+    GSList *elem = m->pieces;
+    while (elem) {
+        GSList *next = g_slist_next(elem);
+        LrMetalinkPieces *mp = elem->data;
+        if (mp->length > 0 && mp->count > 0) {
+            mp->hashes = g_slist_reverse(mp->hashes);
+            elem->next = pieces;
+            pieces = elem;
+        }
+        elem = next;
+    }
+    m->pieces = pieces;
 }
 
 LrMetalink *
 lr_metalink_init()
 {
-    return lr_malloc0(sizeof(LrMetalink));
+    LrMetalink *metalink = lr_malloc0(sizeof(LrMetalink));
+    metalink->arena = lr_arena_new(ARENA_BLOCK_SIZE);
+    return metalink;
 }
 
 void
@@ -117,13 +133,7 @@ lr_metalink_free(LrMetalink *metalink)
     if (!metalink)
         return;
 
-    lr_free(metalink->filename);
-    g_slist_free_full(metalink->hashes,
-                      (GDestroyNotify)lr_free_metalinkhash);
-    g_slist_free_full(metalink->urls,
-                      (GDestroyNotify)lr_free_metalinkurl);
-    g_slist_free_full(metalink->alternates,
-                      (GDestroyNotify)lr_free_metalinkalternate);
+    lr_arena_free(metalink->arena);
     lr_free(metalink);
 }
 
@@ -138,6 +148,8 @@ typedef enum {
     STATE_SIZE,
     STATE_VERIFICATION,
     STATE_HASH,
+    STATE_PIECES,
+    STATE_PIECE_HASH,
     STATE_ALTERNATES,
     STATE_ALTERNATE,
     STATE_ALTERNATE_TIMESTAMP,
@@ -160,6 +172,8 @@ static LrStatesSwitch stateswitches[] = {
     { STATE_FILE,       "mm0:alternates",   STATE_ALTERNATES,              0 },
     { STATE_FILE,       "resources",        STATE_RESOURCES,               0 },
     { STATE_VERIFICATION, "hash",           STATE_HASH,                    1 },
+    { STATE_VERIFICATION, "pieces",         STATE_PIECES,                  0 },
+    { STATE_PIECES,     "hash",             STATE_PIECE_HASH,              1 },
     { STATE_ALTERNATES, "mm0:alternate",    STATE_ALTERNATE,               0 },
     { STATE_ALTERNATE,  "mm0:timestamp",    STATE_ALTERNATE_TIMESTAMP,     1 },
     { STATE_ALTERNATE,  "size",             STATE_ALTERNATE_SIZE,          1 },
@@ -236,7 +250,7 @@ lr_metalink_start_handler(void *pdata, const char *element, const char **attr)
             pd->ignore = 0;
             pd->found = 1;
         }
-        pd->metalink->filename = g_strdup(name);
+        pd->metalink->filename = lr_arena_strdup(pd->metalink->arena, name);
         break;
     }
     case STATE_TIMESTAMP:
@@ -276,7 +290,7 @@ lr_metalink_start_handler(void *pdata, const char *element, const char **attr)
             break;
         }
         mh = lr_new_metalinkhash(pd->metalink);
-        mh->type = g_strdup(type);
+        mh->type = lr_arena_strdup(pd->metalink->arena, type);
         pd->metalinkhash = mh;
         break;
     }
@@ -295,12 +309,60 @@ lr_metalink_start_handler(void *pdata, const char *element, const char **attr)
                               "hash element doesn't have attribute \"type\"");
             break;
         }
-        mh = lr_new_metalinkalternate_hash(pd->metalinkalternate);
-        mh->type = g_strdup(type);
+        mh = lr_new_metalinkalternate_hash(pd->metalink, pd->metalinkalternate);
+        mh->type = lr_arena_strdup(pd->metalink->arena, type);
         pd->metalinkhash = mh;
         break;
     }
 
+    case STATE_PIECES: {
+        assert(pd->metalink);
+        assert(!pd->metalinkpieces);
+
+        LrMetalinkPieces *mp;
+        const char *type = lr_find_attr("type", attr);
+        const char *length = lr_find_attr("length", attr);
+        if (!type || !length) {
+            // Pieces cannot be used without these -> skip them
+            lr_xml_parser_warning(pd, LR_XML_WARNING_MISSINGATTR,
+                    "pieces element doesn't have attribute \"%s\"",
+                    type ? "length" : "type");
+            break;
+        }
+        gint64 len = lr_xml_parser_strtoll(pd, length, 0);
+        if (len <= 0) {
+            lr_xml_parser_warning(pd, LR_XML_WARNING_BADATTRVAL,
+                    "Bad value (\"%s\") of \"length\" attribute in pieces "
+                    "element", length);
+            break;
+        }
+        mp = lr_new_metalinkpieces(pd->metalink);
+        mp->type = lr_arena_strdup(pd->metalink->arena, type);
+        mp->length = len;
+        pd->metalinkpieces = mp;
+        break;
+    }
+
+    case STATE_PIECE_HASH: {
+        assert(pd->metalink);
+
+        if (!pd->metalinkpieces)
+            break;  // Skipped pieces
+
+        // The hashes have to be in order of the pieces
+        const char *piece = lr_find_attr("piece", attr);
+        if (piece && lr_xml_parser_strtoll(pd, piece, 0)
+                        != (long long) pd->metalinkpieces->count) {
+            lr_xml_parser_warning(pd, LR_XML_WARNING_BADATTRVAL,
+                    "Unexpected value (\"%s\") of \"piece\" attribute in "
+                    "hash element (expected %u), pieces are ignored",
+                    piece, pd->metalinkpieces->count);
+            pd->metalinkpieces->count = 0;  // Dropped by finalization
+            pd->metalinkpieces = NULL;
+        }
+        break;
+    }
+
     case STATE_RESOURCES:
         break;
 
@@ -311,13 +373,21 @@ lr_metalink_start_handler(void *pdata, const char *element, const char **attr)
 
         const char *val;
         assert(!pd->metalinkurl);
+
+        if (pd->maxurls && pd->nurls >= pd->maxurls) {
+            // Skip the url (see LRO_METALINKMAXURLS)
+            pd->docontent = 0;
+            break;
+        }
+
+        pd->nurls++;
         LrMetalinkUrl *url = lr_new_metalinkurl(pd->metalink);
         if ((val = lr_find_attr("protocol", attr)))
-            url->protocol = g_strdup(val);
+            url->protocol = lr_arena_strdup(pd->metalink->arena, val);
         if ((val = lr_find_attr("type", attr)))
-            url->type = g_strdup(val);
+            url->type = lr_arena_strdup(pd->metalink->arena, val);
         if ((val = lr_find_attr("location", attr)))
-            url->location = g_strdup(val);
+            url->location = lr_arena_strdup(pd->metalink->arena, val);
         if ((val = lr_find_attr("preference", attr))) {
             long long ll_val = lr_xml_parser_strtoll(pd, val, 0);
             if (ll_val < 0 || ll_val > 100) {
@@ -365,10 +435,16 @@ lr_metalink_end_handler(void *pdata, G_GNUC_UNUSED const char *element)
     }
 
     switch (state) {
+    case STATE_FILE:
+        // The wanted file is complete, the rest of the document
+        // is not needed
+        if (!pd->ignore)
+            lr_xml_parser_stop(pd);
+        break;
+
     case STATE_START:
     case STATE_METALINK:
     case STATE_FILES:
-    case STATE_FILE:
     case STATE_VERIFICATION:
     case STATE_ALTERNATES:
     case STATE_ALTERNATE_VERIFICATION:
@@ -377,6 +453,22 @@ lr_metalink_end_handler(void *pdata, G_GNUC_UNUSED const char *element)
     case STATE_RESOURCES:
         break;
 
+    case STATE_PIECES:
+        pd->metalinkpieces = NULL;
+        break;
+
+    case STATE_PIECE_HASH:
+        assert(pd->metalink);
+
+        if (!pd->metalinkpieces)
+            break;
+
+        pd->metalinkpieces->hashes = lr_arena_slist_prepend(
+                    pd->metalink->arena, pd->metalinkpieces->hashes,
+                    lr_arena_strdup(pd->metalink->arena, pd->content));
+        pd->metalinkpieces->count++;
+        break;
+
     case STATE_TIMESTAMP:
         assert(pd->metalink);
         assert(!pd->metalinkurl);
@@ -402,7 +494,7 @@ lr_metalink_end_handler(void *pdata, G_GNUC_UNUSED const char *element)
             break;
         }
 
-        pd->metalinkhash->value = g_strdup(pd->content);
+        pd->metalinkhash->value = lr_arena_strdup(pd->metalink->arena, pd->content);
         pd->metalinkhash = NULL;
         break;
 
@@ -440,16 +532,20 @@ lr_metalink_end_handler(void *pdata, G_GNUC_UNUSED const char *element)
             break;
         }
 
-        pd->metalinkhash->value = g_strdup(pd->content);
+        pd->metalinkhash->value = lr_arena_strdup(pd->metalink->arena, pd->content);
         pd->metalinkhash = NULL;
         break;
 
     case STATE_URL:
         assert(pd->metalink);
-        assert(pd->metalinkurl);
         assert(!pd->metalinkhash);
 
-        pd->metalinkurl->url = g_strdup(pd->content);
+        if (!pd->metalinkurl) {
+            // Skipped url
+            break;
+        }
+
+        pd->metalinkurl->url = lr_arena_strdup(pd->metalink->arena, pd->content);
         pd->metalinkurl = NULL;
         break;
 
@@ -460,6 +556,57 @@ lr_metalink_end_handler(void *pdata, G_GNUC_UNUSED const char *element)
     return;
 }
 
+/** Create and setup XML parser and its data for the metalink parsing.
+ */
+static LrParserData *
+metalink_parser_data_new(XML_Parser *parser,
+                         LrMetalink *metalink,
+                         const char *filename,
+                         LrXmlParserWarningCb warningcb,
+                         void *warningcb_data)
+{
+    LrParserData *pd;
+
+    *parser = XML_ParserCreate(NULL);
+    XML_SetElementHandler(*parser, lr_metalink_start_handler, lr_metalink_end_handler);
+    XML_SetCharacterDataHandler(*parser, lr_char_handler);
+
+    pd = lr_xml_parser_data_new(NUMSTATES);
+    pd->parser = parser;
+    pd->state = STATE_START;
+    pd->metalink = metalink;
+    pd->filename = (char *) filename;
+    pd->ignore = 1;
+    pd->found = 0;
+    pd->warningcb = warningcb;
+    pd->warningcb_data = warningcb_data;
+    for (LrStatesSwitch *sw = stateswitches; sw->from != NUMSTATES; sw++) {
+        if (!pd->swtab[sw->from])
+            pd->swtab[sw->from] = sw;
+        pd->sbtab[sw->to] = sw->from;
+    }
+
+    XML_SetUserData(*parser, pd);
+
+    return pd;
+}
+
+/** Check of results of the finished parsing.
+ */
+static gboolean
+metalink_parser_check(LrParserData *pd, GError **err)
+{
+    lr_metalink_finalize(pd->metalink);
+
+    if (!pd->found) {
+        g_set_error(err, LR_METALINK_ERROR, LRE_MLBAD,
+                    "file \"%s\" was not found in metalink", pd->filename);
+        return FALSE; // The wanted file was not found in metalink
+    }
+
+    return TRUE;
+}
+
 gboolean
 lr_metalink_parse_file(LrMetalink *metalink,
                        int fd,
@@ -467,6 +614,19 @@ lr_metalink_parse_file(LrMetalink *metalink,
                        LrXmlParserWarningCb warningcb,
                        void *warningcb_data,
                        GError **err)
+{
+    return lr_metalink_parse_file_maxurls(metalink, fd, filename, 0,
+                                          warningcb, warningcb_data, err);
+}
+
+gboolean
+lr_metalink_parse_file_maxurls(LrMetalink *metalink,
+                               int fd,
+                               const char *filename,
+                               unsigned int maxurls,
+                               LrXmlParserWarningCb warningcb,
+                               void *warningcb_data,
+                               GError **err)
 {
     gboolean ret = TRUE;
     LrParserData *pd;
@@ -478,28 +638,13 @@ lr_metalink_parse_file(LrMetalink *metalink,
     assert(filename);
     assert(!err || *err == NULL);
 
-    // Init
-
-    parser = XML_ParserCreate(NULL);
-    XML_SetElementHandler(parser, lr_metalink_start_handler, lr_metalink_end_handler);
-    XML_SetCharacterDataHandler(parser, lr_char_handler);
+    LrAllocTag prev_tag = lr_alloc_tag_set(LR_ALLOC_METADATA);
 
-    pd = lr_xml_parser_data_new(NUMSTATES);
-    pd->parser = &parser;
-    pd->state = STATE_START;
-    pd->metalink = metalink;
-    pd->filename = (char *) filename;
-    pd->ignore = 1;
-    pd->found = 0;
-    pd->warningcb = warningcb;
-    pd->warningcb_data = warningcb_data;
-    for (LrStatesSwitch *sw = stateswitches; sw->from != NUMSTATES; sw++) {
-        if (!pd->swtab[sw->from])
-            pd->swtab[sw->from] = sw;
-        pd->sbtab[sw->to] = sw->from;
-    }
+    // Init
 
-    XML_SetUserData(parser, pd);
+    pd = metalink_parser_data_new(&parser, metalink, filename,
+                                  warningcb, warningcb_data);
+    pd->maxurls = maxurls;
 
     // Parsing
 
@@ -509,14 +654,135 @@ lr_metalink_parse_file(LrMetalink *metalink,
 
     // Clean up
 
-    if (!pd->found) {
-        g_set_error(err, LR_METALINK_ERROR, LRE_MLBAD,
-                    "file \"%s\" was not found in metalink", filename);
-        ret = FALSE; // The wanted file was not found in metalink
-    }
+    if (!metalink_parser_check(pd, tmp_err ? NULL : err))
+        ret = FALSE;
 
     lr_xml_parser_data_free(pd);
     XML_ParserFree(parser);
 
+    lr_alloc_tag_set(prev_tag);
+    return ret;
+}
+
+gboolean
+lr_metalink_parse_buffer(LrMetalink *metalink,
+                         const char *buf,
+                         size_t len,
+                         const char *filename,
+                         LrXmlParserWarningCb warningcb,
+                         void *warningcb_data,
+                         GError **err)
+{
+    gboolean ret;
+    LrMetalinkParser *parser;
+
+    assert(metalink);
+    assert(buf || len == 0);
+    assert(filename);
+    assert(!err || *err == NULL);
+
+    parser = lr_metalink_parser_new(metalink, filename,
+                                    warningcb, warningcb_data);
+    ret = lr_metalink_parser_feed(parser, buf, len, err)
+          && lr_metalink_parser_finish(parser, err);
+    lr_metalink_parser_free(parser);
+
     return ret;
 }
+
+struct _LrMetalinkParser {
+    XML_Parser parser; /*!<
+        Expat parser */
+    LrParserData *pd; /*!<
+        Parser data */
+    char *filename; /*!<
+        Name of the wanted file */
+    gboolean failed; /*!<
+        Parsing already failed */
+    gboolean finished; /*!<
+        lr_metalink_parser_finish() was already called */
+};
+
+LrMetalinkParser *
+lr_metalink_parser_new(LrMetalink *metalink,
+                       const char *filename,
+                       LrXmlParserWarningCb warningcb,
+                       void *warningcb_data)
+{
+    LrMetalinkParser *mp;
+
+    assert(metalink);
+    assert(filename);
+
+    mp = lr_malloc0(sizeof(*mp));
+    mp->filename = g_strdup(filename);
+    mp->pd = metalink_parser_data_new(&mp->parser, metalink, mp->filename,
+                                      warningcb, warningcb_data);
+    return mp;
+}
+
+void
+lr_metalink_parser_set_maxurls(LrMetalinkParser *mp, unsigned int maxurls)
+{
+    assert(mp);
+    mp->pd->maxurls = maxurls;
+}
+
+gboolean
+lr_metalink_parser_feed(LrMetalinkParser *mp,
+                        const char *buf,
+                        size_t len,
+                        GError **err)
+{
+    assert(mp);
+    assert(!mp->failed);
+    assert(!mp->finished);
+    assert(!err || *err == NULL);
+
+    if (len == 0)
+        return TRUE;
+
+    if (!lr_xml_parser_generic_buffer(mp->parser, mp->pd, buf, len, FALSE, err))
+        mp->failed = TRUE;
+
+    return !mp->failed;
+}
+
+gboolean
+lr_metalink_parser_finish(LrMetalinkParser *mp, GError **err)
+{
+    GError *tmp_err = NULL;
+
+    assert(mp);
+    assert(!mp->failed);
+    assert(!mp->finished);
+    assert(!err || *err == NULL);
+
+    mp->finished = TRUE;
+
+    if (!lr_xml_parser_generic_buffer(mp->parser, mp->pd, "", 0, TRUE, &tmp_err)) {
+        lr_metalink_finalize(mp->pd->metalink);
+        g_propagate_error(err, tmp_err);
+        mp->failed = TRUE;
+        return FALSE;
+    }
+
+    if (!metalink_parser_check(mp->pd, err)) {
+        mp->failed = TRUE;
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+void
+lr_metalink_parser_free(LrMetalinkParser *mp)
+{
+    if (!mp)
+        return;
+
+    lr_xml_parser_data_free(mp->pd);
+    XML_ParserFree(mp->parser);
+    g_free(mp->filename);
+    lr_free(mp);
+}
@@ -46,6 +46,16 @@ typedef struct {
     char *url;          /*!< URL to the target file */
 } LrMetalinkUrl;
 
+/** Hashes of the pieces of the metalink target file.
+ * The file is split into pieces of the length, the last piece
+ * could be shorter. */
+typedef struct {
+    char *type;     /*!< Type of the hashes (e.g. "sha1", "sha256", ...) */
+    gint64 length;  /*!< Length of a piece */
+    guint count;    /*!< Number of the pieces */
+    GSList *hashes; /*!< List of hash values (char *) in order of the pieces */
+} LrMetalinkPieces;
+
 /** Alternate */
 typedef struct {
     gint64 timestamp; /*!< File timestamp */
@@ -61,6 +71,8 @@ typedef struct {
     GSList *hashes;   /*!< List of pointers to LrMetalinkHashes (could be NULL) */
     GSList *urls;     /*!< List of pointers to LrMetalinkUrls (could be NULL) */
     GSList *alternates; /*!< List of pointers to LrMetalinkAlternates (could be NULL) */
+    GSList *pieces;   /*!< List of pointers to LrMetalinkPieces (could be NULL) */
+    struct _LrArena *arena; /*!< Allocator of the whole content (internal) */
 } LrMetalink;
 
 /** Create new empty metalink object.
@@ -70,6 +82,8 @@ LrMetalink *
 lr_metalink_init();
 
 /** Parse metalink file.
+ * The parsing stops after the element of the wanted file,
+ * the rest of the document is not parsed.
  * @param metalink          Metalink object.
  * @param fd                File descriptor.
  * @param filename          File to look for in metalink file.
@@ -86,6 +100,103 @@ lr_metalink_parse_file(LrMetalink *metalink,
                        void *warningcb_data,
                        GError **err);
 
+/** Parse metalink file, but keep at most maxurls URLs.
+ * Next url elements are skipped (see LRO_METALINKMAXURLS).
+ * @param metalink          Metalink object.
+ * @param fd                File descriptor.
+ * @param filename          File to look for in metalink file.
+ * @param maxurls           Max number of URLs, 0 means no limit.
+ * @param warningcb         ::LrXmlParserWarningCb function or NULL
+ * @param warningcb_data    Warning callback data or NULL
+ * @param err               GError **
+ * @return                  TRUE if everything is ok, FALSE if err is set.
+ */
+gboolean
+lr_metalink_parse_file_maxurls(LrMetalink *metalink,
+                               int fd,
+                               const char *filename,
+                               unsigned int maxurls,
+                               LrXmlParserWarningCb warningcb,
+                               void *warningcb_data,
+                               GError **err);
+
+/** Parse metalink from memory.
+ * @param metalink          Metalink object.
+ * @param buf               Content of the metalink file.
+ * @param len               Length of the content.
+ * @param filename          File to look for in metalink file.
+ * @param warningcb         ::LrXmlParserWarningCb function or NULL
+ * @param warningcb_data    Warning callback data or NULL
+ * @param err               GError **
+ * @return                  TRUE if everything is ok, FALSE if err is set.
+ */
+gboolean
+lr_metalink_parse_buffer(LrMetalink *metalink,
+                         const char *buf,
+                         size_t len,
+                         const char *filename,
+                         LrXmlParserWarningCb warningcb,
+                         void *warningcb_data,
+                         GError **err);
+
+/** Incremental (push) metalink parser.
+ * The metalink is passed to the parser by parts as they come
+ * (e.g. while it is being downloaded) by ::lr_metalink_parser_feed.
+ */
+typedef struct _LrMetalinkParser LrMetalinkParser;
+
+/** Create a new incremental metalink parser.
+ * @param metalink          Metalink object which is filled by the parser.
+ * @param filename          File to look for in metalink file.
+ * @param warningcb         ::LrXmlParserWarningCb function or NULL
+ * @param warningcb_data    Warning callback data or NULL
+ * @return                  New parser
+ */
+LrMetalinkParser *
+lr_metalink_parser_new(LrMetalink *metalink,
+                       const char *filename,
+                       LrXmlParserWarningCb warningcb,
+                       void *warningcb_data);
+
+/** Keep at most maxurls URLs, next url elements are skipped.
+ * Must be called before the first ::lr_metalink_parser_feed.
+ * @param parser            Metalink parser.
+ * @param maxurls           Max number of URLs, 0 means no limit (default).
+ */
+void
+lr_metalink_parser_set_maxurls(LrMetalinkParser *parser,
+                               unsigned int maxurls);
+
+/** Parse a next part of the metalink.
+ * Data which follow the element of the wanted file are ignored.
+ * After an error the parser could be only freed.
+ * @param parser            Metalink parser.
+ * @param buf               Next part of the metalink.
+ * @param len               Length of the part.
+ * @param err               GError **
+ * @return                  TRUE if everything is ok, FALSE if err is set.
+ */
+gboolean
+lr_metalink_parser_feed(LrMetalinkParser *parser,
+                        const char *buf,
+                        size_t len,
+                        GError **err);
+
+/** Finish the parsing. Fails if the metalink ends before the end
+ * of the element of the wanted file or it doesn't contain the file.
+ * @param parser            Metalink parser.
+ * @param err               GError **
+ * @return                  TRUE if everything is ok, FALSE if err is set.
+ */
+gboolean
+lr_metalink_parser_finish(LrMetalinkParser *parser, GError **err);
+
+/** Free the parser. The metalink object is not freed.
+ * @param parser            Metalink parser.
+ */
+void
+lr_metalink_parser_free(LrMetalinkParser *parser);
+
 /** Free metalink object and all its content.
  * @param metalink      Metalink object.
  */
@@ -0,0 +1,181 @@
+/* librepo - A library providing (libcURL like) API to downloading repository
+ * Copyright (C) 2014  Tomas Mlcoch
+ *
+ * Licensed under the GNU Lesser General Public License Version 2.1
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#include <glib.h>
+#include <assert.h>
+#include <math.h>
+#include <string.h>
+
+#include "mirrorhealth.h"
+#include "cleanup.h"
+
+#define HEALTH_SUCCESSFUL       "successful"
+#define HEALTH_FAILED           "failed"
+#define HEALTH_SPEED            "speed"
+#define HEALTH_TTFB             "ttfb"
+#define HEALTH_UPDATED          "updated"
+#define HEALTH_LASTERROR        "lasterror"
+#define HEALTH_LASTERRORTIME    "lasterrortime"
+
+/** Weight of a run in the moving averages */
+#define HEALTH_EWMA_WEIGHT      0.5
+
+/** Groups of a key file cannot contain brackets (IPv6 addresses)
+ * and control characters.
+ */
+static gboolean
+host_is_valid(const char *host)
+{
+    if (!host || !*host)
+        return FALSE;
+    for (const char *c = host; *c; c++)
+        if (*c == '[' || *c == ']' || g_ascii_iscntrl(*c))
+            return FALSE;
+    return TRUE;
+}
+
+static gdouble
+get_double(GKeyFile *store, const char *host, const char *key)
+{
+    gdouble val = g_key_file_get_double(store, host, key, NULL);
+    return (isfinite(val) && val > 0.0) ? val : 0.0;
+}
+
+/** Multiplier of the counts recorded at the time updated */
+static gdouble
+decay(gint64 updated, gint64 now)
+{
+    if (updated >= now)
+        return 1.0;
+    return exp2(-(now - updated) / (gdouble) LR_MIRRORHEALTH_HALF_LIFE);
+}
+
+GKeyFile *
+lr_mirrorhealth_load(const char *path)
+{
+    GError *tmp_err = NULL;
+    GKeyFile *store = g_key_file_new();
+
+    if (path && !g_key_file_load_from_file(store, path, G_KEY_FILE_NONE,
+                                           &tmp_err)) {
+        g_debug("%s: Store %s not loaded: %s", __func__, path,
+                tmp_err->message);
+        g_error_free(tmp_err);
+    }
+
+    return store;
+}
+
+gboolean
+lr_mirrorhealth_lookup(GKeyFile *store,
+                       const char *host,
+                       gint64 now,
+                       LrMirrorHealth *health)
+{
+    memset(health, 0, sizeof(*health));
+
+    if (!host_is_valid(host) || !g_key_file_has_group(store, host))
+        return FALSE;
+
+    gint64 updated = g_key_file_get_int64(store, host, HEALTH_UPDATED, NULL);
+    gdouble factor = decay(updated, now);
+
+    health->successful = get_double(store, host, HEALTH_SUCCESSFUL) * factor;
+    health->failed = get_double(store, host, HEALTH_FAILED) * factor;
+    health->speed = get_double(store, host, HEALTH_SPEED);
+    health->ttfb = get_double(store, host, HEALTH_TTFB);
+    health->lasterror = g_key_file_get_string(store, host,
+                                              HEALTH_LASTERROR, NULL);
+    health->lasterrortime = g_key_file_get_int64(store, host,
+                                                 HEALTH_LASTERRORTIME, NULL);
+    return TRUE;
+}
+
+void
+lr_mirrorhealth_record(GKeyFile *store,
+                       const char *host,
+                       gint64 now,
+                       const LrMirrorHealth *delta)
+{
+    LrMirrorHealth health;
+
+    if (!host_is_valid(host))
+        return;
+
+    lr_mirrorhealth_lookup(store, host, now, &health);
+
+    health.successful += delta->successful;
+    health.failed += delta->failed;
+    if (delta->speed > 0.0)
+        health.speed = health.speed > 0.0
+            ? health.speed + HEALTH_EWMA_WEIGHT * (delta->speed - health.speed)
+            : delta->speed;
+    if (delta->ttfb > 0.0)
+        health.ttfb = health.ttfb > 0.0
+            ? health.ttfb + HEALTH_EWMA_WEIGHT * (delta->ttfb - health.ttfb)
+            : delta->ttfb;
+
+    g_key_file_set_double(store, host, HEALTH_SUCCESSFUL, health.successful);
+    g_key_file_set_double(store, host, HEALTH_FAILED, health.failed);
+    g_key_file_set_double(store, host, HEALTH_SPEED, health.speed);
+    g_key_file_set_double(store, host, HEALTH_TTFB, health.ttfb);
+    g_key_file_set_int64(store, host, HEALTH_UPDATED, now);
+    if (delta->lasterror) {
+        // The message is stored on a single line
+        _cleanup_free_ gchar *msg = g_strdelimit(g_strdup(delta->lasterror),
+                                                 "\r\n", ' ');
+        g_key_file_set_string(store, host, HEALTH_LASTERROR, msg);
+        g_key_file_set_int64(store, host, HEALTH_LASTERRORTIME, now);
+    }
+
+    lr_mirrorhealth_clear(&health);
+}
+
+gboolean
+lr_mirrorhealth_save(GKeyFile *store,
+                     const char *path,
+                     gint64 now,
+                     GError **err)
+{
+    gsize len;
+
+    assert(!err || *err == NULL);
+
+    gchar **hosts = g_key_file_get_groups(store, NULL);
+    for (gchar **host = hosts; *host; host++) {
+        gint64 updated = g_key_file_get_int64(store, *host,
+                                              HEALTH_UPDATED, NULL);
+        if (now - updated > LR_MIRRORHEALTH_MAX_AGE)
+            g_key_file_remove_group(store, *host, NULL);
+    }
+    g_strfreev(hosts);
+
+    _cleanup_free_ gchar *data = g_key_file_to_data(store, &len, NULL);
+    return g_file_set_contents(path, data, (gssize) len, err);
+}
+
+void
+lr_mirrorhealth_clear(LrMirrorHealth *health)
+{
+    if (!health)
+        return;
+    g_free(health->lasterror);
+    memset(health, 0, sizeof(*health));
+}
@@ -0,0 +1,109 @@
+/* librepo - A library providing (libcURL like) API to downloading repository
+ * Copyright (C) 2014  Tomas Mlcoch
+ *
+ * Licensed under the GNU Lesser General Public License Version 2.1
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#ifndef __LR_MIRRORHEALTH_H__
+#define __LR_MIRRORHEALTH_H__
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/** Health of the mirrors across runs (see LRO_MIRRORHEALTHCACHE).
+ * The key file has a group per host of the mirrors
+ * (LrInternalMirror.host) with the numbers of successful and failed
+ * transfers, which are halved every LR_MIRRORHEALTH_HALF_LIFE seconds,
+ * moving averages of the throughput and the time to first byte, and
+ * the last error. Hosts not updated for LR_MIRRORHEALTH_MAX_AGE seconds
+ * are dropped.
+ */
+
+/** Seconds after which the recorded transfers count half */
+#define LR_MIRRORHEALTH_HALF_LIFE   (24 * 60 * 60)
+
+/** Seconds after which a host is forgotten */
+#define LR_MIRRORHEALTH_MAX_AGE     (30 * 24 * 60 * 60)
+
+/** Health of a host */
+typedef struct {
+    gdouble successful; /*!< Decayed number of successful transfers */
+    gdouble failed;     /*!< Decayed number of failed transfers */
+    gdouble speed;      /*!< Throughput (bytes/sec) or 0.0 if unknown */
+    gdouble ttfb;       /*!< Time to first byte (sec) or 0.0 if unknown */
+    gchar *lasterror;   /*!< The last error or NULL */
+    gint64 lasterrortime; /*!< Unix time of the lasterror */
+} LrMirrorHealth;
+
+/** Load the store. A missing or broken file gives an empty store.
+ * @param path      Path to the store
+ * @return          New GKeyFile
+ */
+GKeyFile *
+lr_mirrorhealth_load(const char *path);
+
+/** Get the health of the host decayed to the time now.
+ * @param store     Store
+ * @param host      Host of the mirror
+ * @param now       Unix time
+ * @param health    Filled record, must be cleared by lr_mirrorhealth_clear()
+ * @return          FALSE if nothing is known about the host
+ */
+gboolean
+lr_mirrorhealth_lookup(GKeyFile *store,
+                       const char *host,
+                       gint64 now,
+                       LrMirrorHealth *health);
+
+/** Add the transfers of a run to the health of the host.
+ * The counts are added to the decayed ones, the non-zero speed and ttfb
+ * are samples for the moving averages and the non-NULL lasterror
+ * replaces the stored one.
+ * @param store     Store
+ * @param host      Host of the mirror
+ * @param now       Unix time
+ * @param delta     Results of the run
+ */
+void
+lr_mirrorhealth_record(GKeyFile *store,
+                       const char *host,
+                       gint64 now,
+                       const LrMirrorHealth *delta);
+
+/** Drop the outdated hosts and write the store atomically.
+ * @param store     Store
+ * @param path      Path to the store
+ * @param now       Unix time
+ * @param err       GError **
+ * @return          TRUE if the store was written
+ */
+gboolean
+lr_mirrorhealth_save(GKeyFile *store,
+                     const char *path,
+                     gint64 now,
+                     GError **err);
+
+/** Free the content of the record.
+ * @param health    Record
+ */
+void
+lr_mirrorhealth_clear(LrMirrorHealth *health);
+
+G_END_DECLS
+
+#endif
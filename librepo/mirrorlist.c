@@ -18,13 +18,16 @@
  * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
  */
 
-#define _POSIX_SOURCE
+#define _XOPEN_SOURCE   500 // Because of mmap()
 
 #include <errno.h>
 #include <assert.h>
 #include <stdio.h>
 #include <string.h>
 #include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
 
 #include "rcodes.h"
 #include "util.h"
@@ -48,8 +51,88 @@ lr_mirrorlist_free(LrMirrorlist *mirrorlist)
     lr_free(mirrorlist);
 }
 
-gboolean
-lr_mirrorlist_parse_file(LrMirrorlist *mirrorlist, int fd, GError **err)
+/** Parse one line of the mirrorlist (without the trailing newline).
+ */
+static void
+parse_line(LrMirrorlist *mirrorlist, const char *p, size_t l)
+{
+    /* Skip leading white characters */
+    while (l > 0 && (*p == ' ' || *p == '\t')) {
+        p++;
+        l--;
+    }
+
+    if (!l || *p == '#')
+        return;  /* End of string or comment */
+
+    /* Remove trailing white characters */
+    while (l > 0 && (p[l-1] == ' ' || p[l-1] == '\n' || p[l-1] == '\t'))
+        l--;
+
+    if (!l)
+        return;
+
+    /* Append URL */
+    if (g_strstr_len(p, l, "://") || p[0] == '/')
+        mirrorlist->urls = g_slist_append(mirrorlist->urls, g_strndup(p, l));
+}
+
+/** Parse all complete lines of the data.
+ * @return      Number of parsed bytes. The rest of the data is
+ *              an incomplete last line.
+ */
+static size_t
+parse_lines(LrMirrorlist *mirrorlist, const char *buf, size_t len)
+{
+    const char *p = buf, *end = buf + len;
+
+    while (p < end) {
+        const char *eol = memchr(p, '\n', end - p);
+        if (!eol)
+            break;
+        parse_line(mirrorlist, p, eol - p);
+        p = eol + 1;
+    }
+
+    return p - buf;
+}
+
+/** Parse the mirrorlist file through its memory map.
+ * @return      FALSE if the file cannot be mapped.
+ */
+static gboolean
+parse_mmap(LrMirrorlist *mirrorlist, int fd)
+{
+    struct stat st;
+    off_t offset;
+    const char *map;
+    size_t len, parsed;
+
+    if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode))
+        return FALSE;
+
+    offset = lseek(fd, 0, SEEK_CUR);
+    if (offset == (off_t) -1 || offset >= st.st_size)
+        return FALSE;
+
+    map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (map == MAP_FAILED) {
+        g_debug("%s: mmap(%d) failed: %s", __func__, fd, strerror(errno));
+        return FALSE;
+    }
+
+    len = st.st_size - offset;
+    parsed = parse_lines(mirrorlist, map + offset, len);
+    if (parsed < len)  // Last line without newline
+        parse_line(mirrorlist, map + offset + parsed, len - parsed);
+
+    munmap((void *) map, st.st_size);
+    lseek(fd, 0, SEEK_END);
+    return TRUE;
+}
+
+static gboolean
+mirrorlist_parse_file(LrMirrorlist *mirrorlist, int fd, GError **err)
 {
     FILE *f;
     int fd_dup;
@@ -59,6 +142,8 @@ lr_mirrorlist_parse_file(LrMirrorlist *mirrorlist, int fd, GError **err)
     assert(fd >= 0);
     assert(!err || *err == NULL);
 
+    if (parse_mmap(mirrorlist, fd))
+        return TRUE;
 
     fd_dup = dup(fd);
     if (fd_dup == -1) {
@@ -75,31 +160,114 @@ lr_mirrorlist_parse_file(LrMirrorlist *mirrorlist, int fd, GError **err)
         return FALSE;
     }
 
-    while ((p = fgets(buf, BUF_LEN, f))) {
-        int l;
+    while ((p = fgets(buf, BUF_LEN, f)))
+        parse_line(mirrorlist, p, strlen(p));
 
-        /* Skip leading white characters */
-        while (*p == ' ' || *p == '\t')
-            p++;
+    fclose(f);
 
-        if (!*p || *p == '#')
-            continue;  /* End of string or comment */
+    return TRUE;
+}
 
-        l = strlen(p);
-        /* Remove trailing white characters */
-        while (l > 0 && (p[l-1] == ' ' || p[l-1] == '\n' || p[l-1] == '\t'))
-            l--;
-        p[l] = '\0';
+gboolean
+lr_mirrorlist_parse_file(LrMirrorlist *mirrorlist, int fd, GError **err)
+{
+    LrAllocTag prev_tag = lr_alloc_tag_set(LR_ALLOC_METADATA);
+    gboolean ret = mirrorlist_parse_file(mirrorlist, fd, err);
+    lr_alloc_tag_set(prev_tag);
+    return ret;
+}
+
+gboolean
+lr_mirrorlist_parse_buffer(LrMirrorlist *mirrorlist,
+                           const char *buf,
+                           size_t len,
+                           GError **err)
+{
+    size_t parsed;
+
+    assert(mirrorlist);
+    assert(buf || len == 0);
+    assert(!err || *err == NULL);
+
+    parsed = parse_lines(mirrorlist, buf, len);
+    if (parsed < len)  // Last line without newline
+        parse_line(mirrorlist, buf + parsed, len - parsed);
+
+    return TRUE;
+}
+
+struct _LrMirrorlistParser {
+    LrMirrorlist *mirrorlist; /*!<
+        Mirrorlist filled by the parser */
+    GString *line; /*!<
+        Incomplete last line of the already fed data */
+};
+
+LrMirrorlistParser *
+lr_mirrorlist_parser_new(LrMirrorlist *mirrorlist)
+{
+    LrMirrorlistParser *mp;
+
+    assert(mirrorlist);
+
+    mp = lr_malloc0(sizeof(*mp));
+    mp->mirrorlist = mirrorlist;
+    mp->line = g_string_new(NULL);
+    return mp;
+}
+
+gboolean
+lr_mirrorlist_parser_feed(LrMirrorlistParser *mp,
+                          const char *buf,
+                          size_t len,
+                          GError **err)
+{
+    const char *eol;
 
-        if (!l)
-            continue;
+    assert(mp);
+    assert(buf || len == 0);
+    assert(!err || *err == NULL);
 
-        /* Append URL */
-        if (p[0] != '\0' && (strstr(p, "://") || p[0] == '/'))
-            mirrorlist->urls = g_slist_append(mirrorlist->urls, g_strdup(p));
+    if (mp->line->len > 0) {
+        // Complete the line from the previous part
+        eol = memchr(buf, '\n', len);
+        if (!eol) {
+            g_string_append_len(mp->line, buf, len);
+            return TRUE;
+        }
+        g_string_append_len(mp->line, buf, eol - buf);
+        parse_line(mp->mirrorlist, mp->line->str, mp->line->len);
+        g_string_truncate(mp->line, 0);
+        len -= eol + 1 - buf;
+        buf = eol + 1;
     }
 
-    fclose(f);
+    size_t parsed = parse_lines(mp->mirrorlist, buf, len);
+    g_string_append_len(mp->line, buf + parsed, len - parsed);
 
     return TRUE;
 }
+
+gboolean
+lr_mirrorlist_parser_finish(LrMirrorlistParser *mp, GError **err)
+{
+    assert(mp);
+    assert(!err || *err == NULL);
+
+    if (mp->line->len > 0) {
+        parse_line(mp->mirrorlist, mp->line->str, mp->line->len);
+        g_string_truncate(mp->line, 0);
+    }
+
+    return TRUE;
+}
+
+void
+lr_mirrorlist_parser_free(LrMirrorlistParser *mp)
+{
+    if (!mp)
+        return;
+
+    g_string_free(mp->line, TRUE);
+    lr_free(mp);
+}
@@ -52,6 +52,64 @@ lr_mirrorlist_init();
 gboolean
 lr_mirrorlist_parse_file(LrMirrorlist *mirrorlist, int fd, GError **err);
 
+/**
+ * Parse mirrorlist from memory.
+ * @param mirrorlist    Mirrorlist object.
+ * @param buf           Content of the mirrorlist.
+ * @param len           Length of the content.
+ * @param err           GError **
+ * @return              TRUE if everything is ok, FALSE if err is set.
+ */
+gboolean
+lr_mirrorlist_parse_buffer(LrMirrorlist *mirrorlist,
+                           const char *buf,
+                           size_t len,
+                           GError **err);
+
+/** Incremental (push) mirrorlist parser.
+ * The mirrorlist is passed to the parser by parts as they come
+ * by ::lr_mirrorlist_parser_feed.
+ */
+typedef struct _LrMirrorlistParser LrMirrorlistParser;
+
+/**
+ * Create a new incremental mirrorlist parser.
+ * @param mirrorlist    Mirrorlist object which is filled by the parser.
+ * @return              New parser
+ */
+LrMirrorlistParser *
+lr_mirrorlist_parser_new(LrMirrorlist *mirrorlist);
+
+/**
+ * Parse a next part of the mirrorlist.
+ * @param parser        Mirrorlist parser.
+ * @param buf           Next part of the mirrorlist.
+ * @param len           Length of the part.
+ * @param err           GError **
+ * @return              TRUE if everything is ok, FALSE if err is set.
+ */
+gboolean
+lr_mirrorlist_parser_feed(LrMirrorlistParser *parser,
+                          const char *buf,
+                          size_t len,
+                          GError **err);
+
+/**
+ * Finish the parsing (the last line doesn't need to end by a newline).
+ * @param parser        Mirrorlist parser.
+ * @param err           GError **
+ * @return              TRUE if everything is ok, FALSE if err is set.
+ */
+gboolean
+lr_mirrorlist_parser_finish(LrMirrorlistParser *parser, GError **err);
+
+/**
+ * Free the parser. The mirrorlist object is not freed.
+ * @param parser        Mirrorlist parser.
+ */
+void
+lr_mirrorlist_parser_free(LrMirrorlistParser *parser);
+
 /**
  * Free mirrorlist and all its content.
  * @param mirrorlist    Mirrorlist object.
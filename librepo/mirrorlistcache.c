@@ -0,0 +1,272 @@
+/* librepo - A library providing (libcURL like) API to downloading repository
+ * Copyright (C) 2014  Tomas Mlcoch
+ *
+ * Licensed under the GNU Lesser General Public License Version 2.1
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#define _XOPEN_SOURCE   500 // Because of ftruncate()
+
+#include <glib.h>
+#include <glib/gstdio.h>
+#include <assert.h>
+#include <errno.h>
+#include <string.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include "handle_internal.h"
+#include "downloader.h"
+#include "util.h"
+#include "mirrorlistcache.h"
+#include "cleanup.h"
+
+#define INFO_GROUP  "cache"
+
+/** Record of a cached URL (the content of the key file).
+ */
+typedef struct {
+    gchar *path;            /*!< Path to the cached content */
+    gchar *info;            /*!< Path to the key file */
+    gboolean cached;        /*!< The cached content exists */
+    gint64 fetched;         /*!< Time of the last download/revalidation */
+    gchar *etag;            /*!< ETag or NULL */
+    gint64 lastmodified;    /*!< Last-Modified (Unix time) or 0 */
+} LrMirrorlistCacheEntry;
+
+static void
+entry_load(LrHandle *handle, const char *url, LrMirrorlistCacheEntry *entry)
+{
+    _cleanup_free_ gchar *name = NULL;
+    _cleanup_free_ gchar *cached_url = NULL;
+    GKeyFile *keyfile;
+
+    memset(entry, 0, sizeof(*entry));
+
+    name = g_compute_checksum_for_string(G_CHECKSUM_SHA256, url, -1);
+    entry->path = lr_pathconcat(handle->mirrorlistcache, name, NULL);
+    entry->info = g_strconcat(entry->path, LR_MIRRORLISTCACHE_INFO_SUFFIX, NULL);
+
+    if (!g_file_test(entry->path, G_FILE_TEST_IS_REGULAR))
+        return;
+
+    keyfile = g_key_file_new();
+    if (g_key_file_load_from_file(keyfile, entry->info, G_KEY_FILE_NONE, NULL)) {
+        cached_url = g_key_file_get_string(keyfile, INFO_GROUP, "url", NULL);
+        entry->fetched = g_key_file_get_int64(keyfile, INFO_GROUP,
+                                              "fetched", NULL);
+        entry->etag = g_key_file_get_string(keyfile, INFO_GROUP,
+                                            "etag", NULL);
+        entry->lastmodified = g_key_file_get_int64(keyfile, INFO_GROUP,
+                                                   "lastmodified", NULL);
+    }
+    g_key_file_free(keyfile);
+
+    // Content without the key file is not usable
+    entry->cached = (cached_url && !strcmp(cached_url, url));
+}
+
+static void
+entry_clear(LrMirrorlistCacheEntry *entry)
+{
+    g_free(entry->path);
+    g_free(entry->info);
+    g_free(entry->etag);
+    memset(entry, 0, sizeof(*entry));
+}
+
+static gboolean
+entry_is_fresh(LrHandle *handle, const LrMirrorlistCacheEntry *entry)
+{
+    gint64 age = (gint64) time(NULL) - entry->fetched;
+    return entry->cached && age >= 0 && age < handle->mirrorlistcachettl;
+}
+
+/** Write the key file of the entry. Errors are only logged.
+ */
+static void
+entry_store_info(const char *url, const LrMirrorlistCacheEntry *entry)
+{
+    _cleanup_free_ gchar *data = NULL;
+    GError *tmp_err = NULL;
+    GKeyFile *keyfile;
+    gsize len;
+
+    keyfile = g_key_file_new();
+    g_key_file_set_string(keyfile, INFO_GROUP, "url", url);
+    g_key_file_set_int64(keyfile, INFO_GROUP, "fetched", entry->fetched);
+    if (entry->etag)
+        g_key_file_set_string(keyfile, INFO_GROUP, "etag", entry->etag);
+    if (entry->lastmodified > 0)
+        g_key_file_set_int64(keyfile, INFO_GROUP, "lastmodified",
+                             entry->lastmodified);
+    data = g_key_file_to_data(keyfile, &len, NULL);
+    g_key_file_free(keyfile);
+
+    if (!g_file_set_contents(entry->info, data, (gssize) len, &tmp_err)) {
+        g_debug("%s: Cannot store %s: %s", __func__, entry->info,
+                tmp_err->message);
+        g_error_free(tmp_err);
+    }
+}
+
+/** Copy the cached content to the fd.
+ */
+static gboolean
+entry_copy_to(const LrMirrorlistCacheEntry *entry, int fd)
+{
+    int rc;
+    int cached_fd = open(entry->path, O_RDONLY);
+    if (cached_fd == -1)
+        return FALSE;
+
+    rc = ftruncate(fd, 0);
+    if (rc == 0)
+        rc = lr_copy_content(cached_fd, fd);
+    close(cached_fd);
+    lseek(fd, 0, SEEK_SET);
+    return rc == 0;
+}
+
+/** Replace the cached content by the content of the fd.
+ * Errors are only logged.
+ */
+static gboolean
+entry_store(const char *dir, const LrMirrorlistCacheEntry *entry, int fd)
+{
+    _cleanup_free_ gchar *tmp_path = g_strconcat(entry->path, ".XXXXXX", NULL);
+    int rc;
+    int tmp_fd;
+
+    if (g_mkdir_with_parents(dir, 0755) == -1) {
+        g_debug("%s: Cannot create %s: %s", __func__, dir, strerror(errno));
+        return FALSE;
+    }
+
+    tmp_fd = g_mkstemp(tmp_path);
+    if (tmp_fd == -1) {
+        g_debug("%s: Cannot create %s: %s", __func__, tmp_path, strerror(errno));
+        return FALSE;
+    }
+
+    rc = lr_copy_content(fd, tmp_fd);
+    close(tmp_fd);
+    lseek(fd, 0, SEEK_SET);
+    if (rc != 0 || rename(tmp_path, entry->path) == -1) {
+        g_debug("%s: Cannot store %s: %s", __func__, entry->path, strerror(errno));
+        unlink(tmp_path);
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+gboolean
+lr_mirrorlistcache_fetch(LrHandle *handle,
+                         const char *url,
+                         int fd,
+                         GError **err)
+{
+    gboolean ret;
+    LrMirrorlistCacheEntry entry;
+    LrDownloadTarget *target;
+    GError *tmp_err = NULL;
+
+    assert(!err || *err == NULL);
+
+    if (!handle->mirrorlistcache) {
+        target = lr_downloadtarget_new(handle,
+                                       url, NULL, fd, NULL,
+                                       NULL, 0, 0, NULL, NULL,
+                                       NULL, NULL, NULL, 0, 0);
+        target->contentencoding = TRUE;
+        ret = lr_download_target(target, err);
+        lr_downloadtarget_free(target);
+        lseek(fd, 0, SEEK_SET);
+        return ret;
+    }
+
+    entry_load(handle, url, &entry);
+
+    if (entry_is_fresh(handle, &entry) && entry_copy_to(&entry, fd)) {
+        g_debug("%s: Using cached %s", __func__, url);
+        entry_clear(&entry);
+        return TRUE;
+    }
+
+    target = lr_downloadtarget_new(handle,
+                                   url, NULL, fd, NULL,
+                                   NULL, 0, 0, NULL, NULL,
+                                   NULL, NULL, NULL, 0, 0);
+    target->contentencoding = TRUE;
+    if (entry.cached) {
+        // Revalidate the outdated copy
+        target->conditional = TRUE;
+        target->etag = entry.etag;
+        target->lastmodified = entry.lastmodified;
+    }
+
+    ret = lr_download_target(target, &tmp_err);
+    lseek(fd, 0, SEEK_SET);
+
+    if (!ret) {
+        if (entry.cached && entry_copy_to(&entry, fd)) {
+            // Better an outdated list of mirrors than none
+            g_debug("%s: Using outdated cached %s: %s",
+                    __func__, url, tmp_err->message);
+            g_error_free(tmp_err);
+            lr_downloadtarget_free(target);
+            entry_clear(&entry);
+            return TRUE;
+        }
+        g_propagate_error(err, tmp_err);
+        lr_downloadtarget_free(target);
+        entry_clear(&entry);
+        return FALSE;
+    }
+
+    if (target->notmodified) {
+        g_debug("%s: Cached %s was not modified", __func__, url);
+        if (!entry_copy_to(&entry, fd)) {
+            g_set_error(err, LR_HANDLE_ERROR, LRE_IO,
+                        "Cannot copy cached %s: %s",
+                        entry.path, strerror(errno));
+            lr_downloadtarget_free(target);
+            entry_clear(&entry);
+            return FALSE;
+        }
+    } else if (!entry_store(handle->mirrorlistcache, &entry, fd)) {
+        // The file is downloaded, only the cache is not updated
+        lr_downloadtarget_free(target);
+        entry_clear(&entry);
+        return TRUE;
+    }
+
+    // The target may still point to the old ETag
+    gchar *etag = g_strdup(target->etag);
+    g_free(entry.etag);
+    entry.etag = etag;
+    entry.lastmodified = target->lastmodified;
+    entry.fetched = (gint64) time(NULL);
+    entry_store_info(url, &entry);
+
+    lr_downloadtarget_free(target);
+    entry_clear(&entry);
+    return TRUE;
+}
@@ -0,0 +1,60 @@
+/* librepo - A library providing (libcURL like) API to downloading repository
+ * Copyright (C) 2014  Tomas Mlcoch
+ *
+ * Licensed under the GNU Lesser General Public License Version 2.1
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#ifndef __LR_MIRRORLISTCACHE_H__
+#define __LR_MIRRORLISTCACHE_H__
+
+#include <glib.h>
+
+#include "handle.h"
+
+G_BEGIN_DECLS
+
+/** Cache of the downloaded mirrorlists and metalinks (see
+ * LRO_MIRRORLISTCACHE). Every URL has two files in the cache directory
+ * named by the SHA-256 of the URL: the content and the
+ * "<name>LR_MIRRORLISTCACHE_INFO_SUFFIX" key file with the URL, the time
+ * of the last fetch and the validators (ETag, Last-Modified) for the
+ * revalidation. The content is replaced atomically, so the cache can be
+ * shared by concurrent processes.
+ */
+
+/** Suffix of the key files of the cache */
+#define LR_MIRRORLISTCACHE_INFO_SUFFIX  ".info"
+
+/** Get the mirrorlist or metalink from the URL to the fd. If the cache
+ * is enabled, a fresh cached copy is used instead of the download and
+ * an outdated one is revalidated. Without the cache it is just
+ * downloaded. See LRO_ACCEPTENCODING for a compressed transfer.
+ * @param handle    Handle
+ * @param url       URL of the mirrorlist or metalink
+ * @param fd        Empty file, its offset is 0 after the call
+ * @param err       GError **
+ * @return          TRUE if the fd contains the file
+ */
+gboolean
+lr_mirrorlistcache_fetch(LrHandle *handle,
+                         const char *url,
+                         int fd,
+                         GError **err);
+
+G_END_DECLS
+
+#endif
@@ -0,0 +1,334 @@
+/* librepo - A library providing (libcURL like) API to downloading repository
+ * Copyright (C) 2014  Tomas Mlcoch
+ *
+ * Licensed under the GNU Lesser General Public License Version 2.1
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#include <glib.h>
+#include <assert.h>
+#include <string.h>
+
+#include "mirrorregistry.h"
+#include "mirrorregistry_internal.h"
+
+/** Results of a run which were not written to the store yet */
+typedef struct {
+    gchar *host;
+    gint64 now;
+    LrMirrorHealth delta;
+} LrHealthRecord;
+
+/** Mirror health store of a LRO_MIRRORHEALTHCACHE */
+typedef struct {
+    gchar *path;            /*!< Path to the file */
+    GKeyFile *store;        /*!< The file as it was loaded the last time
+                                 with the results recorded since then */
+    GPtrArray *pending;     /*!< LrHealthRecords not written to the file */
+    gint64 flushed;         /*!< Monotonic time of the last write or 0 */
+} LrHealthStore;
+
+/** Key (host or url of a mirror) -> LrMirrorMeasurement */
+static GHashTable *measurements = NULL;
+
+/** Path -> LrHealthStore */
+static GHashTable *health_stores = NULL;
+
+/** Path -> number of the handles (GUINT_TO_POINTER) whose
+ * LRO_MIRRORHEALTHCACHE it is */
+static GHashTable *health_users = NULL;
+
+G_LOCK_DEFINE_STATIC(registry);
+
+static void
+health_record_free(LrHealthRecord *record)
+{
+    g_free(record->host);
+    lr_mirrorhealth_clear(&record->delta);
+    g_free(record);
+}
+
+static void
+health_store_free(LrHealthStore *store)
+{
+    g_free(store->path);
+    g_key_file_free(store->store);
+    g_ptr_array_free(store->pending, TRUE);
+    g_free(store);
+}
+
+/** Get the store of the path, it is loaded if it's not known yet.
+ * Must be called with the registry locked.
+ */
+static LrHealthStore *
+health_store_get(const char *path)
+{
+    LrHealthStore *store;
+
+    if (!health_stores)
+        health_stores = g_hash_table_new_full(g_str_hash, g_str_equal, NULL,
+                                              (GDestroyNotify) health_store_free);
+
+    store = g_hash_table_lookup(health_stores, path);
+    if (store)
+        return store;
+
+    store = g_new0(LrHealthStore, 1);
+    store->path = g_strdup(path);
+    store->store = lr_mirrorhealth_load(path);
+    store->pending = g_ptr_array_new_with_free_func(
+                                    (GDestroyNotify) health_record_free);
+    g_hash_table_insert(health_stores, store->path, store);
+    return store;
+}
+
+/** Write the pending results of the store. Results which cannot be
+ * written are dropped. Must be called with the registry locked.
+ */
+static gboolean
+health_store_flush(LrHealthStore *store, gboolean force, GError **err)
+{
+    gint64 monotonic = g_get_monotonic_time();
+    gboolean ret;
+
+    assert(!err || *err == NULL);
+
+    if (store->pending->len == 0)
+        return TRUE;
+
+    if (!force && store->flushed
+        && monotonic - store->flushed
+               < LR_MIRRORREGISTRY_FLUSH_INTERVAL * G_USEC_PER_SEC)
+        return TRUE;  // Written recently, the results wait for the next flush
+
+    // Reloaded now, the other processes could update it meanwhile
+    GKeyFile *current = lr_mirrorhealth_load(store->path);
+    for (guint x = 0; x < store->pending->len; x++) {
+        LrHealthRecord *record = g_ptr_array_index(store->pending, x);
+        lr_mirrorhealth_record(current, record->host, record->now,
+                               &record->delta);
+    }
+
+    g_debug("%s: Writing %u results to %s", __func__, store->pending->len,
+            store->path);
+    ret = lr_mirrorhealth_save(current, store->path,
+                               g_get_real_time() / G_USEC_PER_SEC, err);
+
+    g_key_file_free(store->store);
+    store->store = current;
+    g_ptr_array_set_size(store->pending, 0);
+    store->flushed = monotonic;
+
+    return ret;
+}
+
+gboolean
+lr_mirrorregistry_get_measurement(const char *key,
+                                  LrMirrorMeasurement *measurement)
+{
+    LrMirrorMeasurement *registered = NULL;
+
+    G_LOCK(registry);
+    if (measurements && key)
+        registered = g_hash_table_lookup(measurements, key);
+    if (registered)
+        *measurement = *registered;
+    G_UNLOCK(registry);
+
+    return registered != NULL;
+}
+
+void
+lr_mirrorregistry_set_measurement(const char *key,
+                                  const LrMirrorMeasurement *measurement)
+{
+    LrMirrorMeasurement *registered;
+
+    if (!key)
+        return;
+
+    G_LOCK(registry);
+
+    if (!measurements)
+        measurements = g_hash_table_new_full(g_str_hash, g_str_equal,
+                                             g_free, g_free);
+
+    registered = g_hash_table_lookup(measurements, key);
+    if (!registered || registered->ts <= measurement->ts) {
+        LrMirrorMeasurement *copy = g_new(LrMirrorMeasurement, 1);
+        *copy = *measurement;
+        g_hash_table_replace(measurements, g_strdup(key), copy);
+    }
+
+    G_UNLOCK(registry);
+}
+
+gboolean
+lr_mirrorregistry_get_health(const char *path,
+                             const char *host,
+                             gint64 now,
+                             LrMirrorHealth *health)
+{
+    gboolean ret;
+
+    G_LOCK(registry);
+    ret = lr_mirrorhealth_lookup(health_store_get(path)->store, host, now,
+                                 health);
+    G_UNLOCK(registry);
+
+    return ret;
+}
+
+void
+lr_mirrorregistry_record_health(const char *path,
+                                const char *host,
+                                gint64 now,
+                                const LrMirrorHealth *delta)
+{
+    LrHealthRecord *record = g_new0(LrHealthRecord, 1);
+
+    record->host = g_strdup(host);
+    record->now = now;
+    record->delta = *delta;
+    record->delta.lasterror = g_strdup(delta->lasterror);
+
+    G_LOCK(registry);
+    LrHealthStore *store = health_store_get(path);
+    lr_mirrorhealth_record(store->store, host, now, delta);
+    g_ptr_array_add(store->pending, record);
+    G_UNLOCK(registry);
+}
+
+gboolean
+lr_mirrorregistry_flush_health(const char *path,
+                               gboolean force,
+                               GError **err)
+{
+    LrHealthStore *store = NULL;
+    gboolean ret = TRUE;
+
+    assert(!err || *err == NULL);
+
+    G_LOCK(registry);
+    if (health_stores)
+        store = g_hash_table_lookup(health_stores, path);
+    if (store)
+        ret = health_store_flush(store, force, err);
+    G_UNLOCK(registry);
+
+    return ret;
+}
+
+void
+lr_mirrorregistry_use_health(const char *path)
+{
+    if (!path)
+        return;
+
+    G_LOCK(registry);
+    if (!health_users)
+        health_users = g_hash_table_new_full(g_str_hash, g_str_equal,
+                                             g_free, NULL);
+    guint users = GPOINTER_TO_UINT(g_hash_table_lookup(health_users, path));
+    g_hash_table_replace(health_users, g_strdup(path),
+                         GUINT_TO_POINTER(users + 1));
+    G_UNLOCK(registry);
+}
+
+void
+lr_mirrorregistry_release_health(const char *path)
+{
+    LrHealthStore *store = NULL;
+    GError *tmp_err = NULL;
+    guint users;
+
+    if (!path)
+        return;
+
+    G_LOCK(registry);
+
+    users = health_users
+            ? GPOINTER_TO_UINT(g_hash_table_lookup(health_users, path))
+            : 0;
+    if (users > 1) {
+        g_hash_table_replace(health_users, g_strdup(path),
+                             GUINT_TO_POINTER(users - 1));
+        G_UNLOCK(registry);
+        return;
+    }
+
+    if (health_users)
+        g_hash_table_remove(health_users, path);
+
+    // The last handle is gone, nobody would flush the results later
+    if (health_stores)
+        store = g_hash_table_lookup(health_stores, path);
+    if (store && !health_store_flush(store, TRUE, &tmp_err)) {
+        g_debug("%s: Cannot write %s: %s", __func__, path, tmp_err->message);
+        g_error_free(tmp_err);
+    }
+
+    G_UNLOCK(registry);
+}
+
+gboolean
+lr_mirrorregistry_flush(GError **err)
+{
+    GHashTableIter iter;
+    gpointer value;
+    gboolean ret = TRUE;
+
+    assert(!err || *err == NULL);
+
+    G_LOCK(registry);
+    if (health_stores) {
+        g_hash_table_iter_init(&iter, health_stores);
+        while (g_hash_table_iter_next(&iter, NULL, &value)) {
+            GError *tmp_err = NULL;
+            if (!health_store_flush(value, TRUE, &tmp_err)) {
+                g_debug("%s: %s", __func__, tmp_err->message);
+                if (ret)
+                    g_propagate_error(err, tmp_err);
+                else
+                    g_error_free(tmp_err);
+                ret = FALSE;
+            }
+        }
+    }
+    G_UNLOCK(registry);
+
+    return ret;
+}
+
+void
+lr_mirrorregistry_clear(void)
+{
+    GError *tmp_err = NULL;
+
+    if (!lr_mirrorregistry_flush(&tmp_err)) {
+        g_debug("%s: Cannot flush the registry: %s", __func__, tmp_err->message);
+        g_error_free(tmp_err);
+    }
+
+    G_LOCK(registry);
+    if (measurements)
+        g_hash_table_destroy(measurements);
+    if (health_stores)
+        g_hash_table_destroy(health_stores);
+    measurements = NULL;
+    health_stores = NULL;
+    G_UNLOCK(registry);
+}
@@ -0,0 +1,71 @@
+/* librepo - A library providing (libcURL like) API to downloading repository
+ * Copyright (C) 2014  Tomas Mlcoch
+ *
+ * Licensed under the GNU Lesser General Public License Version 2.1
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#ifndef __LR_MIRRORREGISTRY_H__
+#define __LR_MIRRORREGISTRY_H__
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/** \defgroup   mirrorregistry    Process-wide registry of mirror data
+ *  \addtogroup mirrorregistry
+ *  @{
+ */
+
+/** All handles of the process share a registry of what is known about
+ * the mirrors, keyed by their hosts:
+ *  - Results of the fastest mirror measurements. A handle uses
+ *    the results measured by any other handle of the process (if they
+ *    are fresh enough for its LRO_FASTESTMIRRORMAXAGE) instead of
+ *    measuring the mirrors again, and the results are written to its
+ *    LRO_FASTESTMIRRORCACHE too.
+ *  - Health of the mirrors of every LRO_MIRRORHEALTHCACHE. The store is
+ *    loaded once and the results of the downloads are collected in
+ *    memory. The first results go to the file immediately, the later
+ *    ones at most once per LR_MIRRORREGISTRY_FLUSH_INTERVAL seconds
+ *    (merged with the changes of the other processes), when the last
+ *    handle using the store is freed, or by lr_mirrorregistry_flush().
+ * The registry is thread-safe and lives until the end of the process.
+ */
+
+/** Seconds between writes of a mirror health store */
+#define LR_MIRRORREGISTRY_FLUSH_INTERVAL    60
+
+/** Write all the collected mirror health data to their stores.
+ * Long-running processes should call it before they exit.
+ * @param err           GError **
+ * @return              TRUE if all the stores were written
+ */
+gboolean
+lr_mirrorregistry_flush(GError **err);
+
+/** Flush the registry (errors are only logged) and forget everything
+ * in it, the next handles measure the mirrors and load the stores
+ * again (e.g. after a change of the network).
+ */
+void
+lr_mirrorregistry_clear(void);
+
+/** @} */
+
+G_END_DECLS
+
+#endif
@@ -0,0 +1,120 @@
+/* librepo - A library providing (libcURL like) API to downloading repository
+ * Copyright (C) 2014  Tomas Mlcoch
+ *
+ * Licensed under the GNU Lesser General Public License Version 2.1
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#ifndef __LR_MIRRORREGISTRY_INTERNAL_H__
+#define __LR_MIRRORREGISTRY_INTERNAL_H__
+
+#include <glib.h>
+
+#include "mirrorregistry.h"
+#include "mirrorhealth.h"
+
+G_BEGIN_DECLS
+
+/** Result of a fastest mirror measurement */
+typedef struct {
+    gint64 ts;              /*!< Unix time of the measurement */
+    double connecttime;     /*!< Plain connect time (<0.0 if unreachable) */
+    double ttfb;            /*!< Time to the first byte of the probe */
+    double throughput;      /*!< Throughput of the probe (bytes/s) */
+    gboolean probed;        /*!< Measured by a probe, ttfb and throughput
+                                 are valid */
+} LrMirrorMeasurement;
+
+/** Get the last measurement of the mirror.
+ * @param key           Host of the mirror (url of the mirror
+ *                      with LRO_FASTESTMIRRORPROBE)
+ * @param measurement   Filled measurement
+ * @return              FALSE if the mirror wasn't measured
+ */
+gboolean
+lr_mirrorregistry_get_measurement(const char *key,
+                                  LrMirrorMeasurement *measurement);
+
+/** Store the measurement of the mirror if it is newer than
+ * the registered one.
+ * @param key           Host of the mirror (url of the mirror
+ *                      with LRO_FASTESTMIRRORPROBE)
+ * @param measurement   Measurement
+ */
+void
+lr_mirrorregistry_set_measurement(const char *key,
+                                  const LrMirrorMeasurement *measurement);
+
+/** Get the health of the host from the store (see lr_mirrorhealth_lookup()).
+ * The store is loaded from the path when it is used for the first time.
+ * @param path          Path to the store (LRO_MIRRORHEALTHCACHE)
+ * @param host          Host of the mirror
+ * @param now           Unix time
+ * @param health        Filled record, must be cleared by lr_mirrorhealth_clear()
+ * @return              FALSE if nothing is known about the host
+ */
+gboolean
+lr_mirrorregistry_get_health(const char *path,
+                             const char *host,
+                             gint64 now,
+                             LrMirrorHealth *health);
+
+/** Add the results of a run to the health of the host in the store
+ * (see lr_mirrorhealth_record()). They are written to the file by
+ * the next flush of the store.
+ * @param path          Path to the store (LRO_MIRRORHEALTHCACHE)
+ * @param host          Host of the mirror
+ * @param now           Unix time
+ * @param delta         Results of the run
+ */
+void
+lr_mirrorregistry_record_health(const char *path,
+                                const char *host,
+                                gint64 now,
+                                const LrMirrorHealth *delta);
+
+/** Write the collected results to the store. The file is loaded again
+ * and the results are added to it, so the changes of the other
+ * processes are kept.
+ * @param path          Path to the store (LRO_MIRRORHEALTHCACHE)
+ * @param force         Write even if the store was written less than
+ *                      LR_MIRRORREGISTRY_FLUSH_INTERVAL seconds ago
+ * @param err           GError **
+ * @return              TRUE if the store was written or there was no
+ *                      reason to write it
+ */
+gboolean
+lr_mirrorregistry_flush_health(const char *path,
+                               gboolean force,
+                               GError **err);
+
+/** Note a handle which uses the store (its LRO_MIRRORHEALTHCACHE).
+ * @param path          Path to the store or NULL
+ */
+void
+lr_mirrorregistry_use_health(const char *path);
+
+/** Note that a handle doesn't use the store anymore (see
+ * lr_mirrorregistry_use_health()). When the last one is gone,
+ * the pending results are written (errors are only logged).
+ * @param path          Path to the store or NULL
+ */
+void
+lr_mirrorregistry_release_health(const char *path);
+
+G_END_DECLS
+
+#endif
@@ -0,0 +1,321 @@
+/* librepo - A library providing (libcURL like) API to downloading repository
+ * Copyright (C) 2014  Tomas Mlcoch
+ *
+ * Licensed under the GNU Lesser General Public License Version 2.1
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#define _GNU_SOURCE         // Because of memmem()
+
+#include <glib.h>
+#include <assert.h>
+#include <string.h>
+
+#include "multipart.h"
+#include "rcodes.h"
+#include "util.h"
+#include "cleanup.h"
+
+/** Maximal length of a line of the headers of a part */
+#define LR_MULTIPART_MAX_LINE   8192
+
+typedef enum {
+    LR_MP_PREAMBLE,     /*!< Before the first delimiter */
+    LR_MP_DELIMITER,    /*!< Right after a delimiter */
+    LR_MP_HEADERS,      /*!< Headers of a part */
+    LR_MP_DATA,         /*!< Data of a part */
+    LR_MP_EPILOGUE,     /*!< After the close delimiter */
+} LrMultipartState;
+
+struct _LrMultipart {
+    gchar *delimiter; /*!<
+        CRLF, "--" and the boundary */
+    gsize delimiter_len; /*!<
+        Length of the delimiter */
+    LrMultipartDataCb cb; /*!<
+        Callback for the data */
+    void *cbdata; /*!<
+        User data of the callback */
+    LrMultipartState state; /*!<
+        State of the parser */
+    GByteArray *buf; /*!<
+        Data which are not parsed yet (a part of a line or data which
+        could be the beginning of a delimiter) */
+    gboolean has_range; /*!<
+        Content-Range of the current part was found */
+    gint64 offset; /*!<
+        Offset of the next data of the current part in the file */
+    gint64 end; /*!<
+        The last byte of the current part */
+};
+
+gchar *
+lr_multipart_boundary(const char *content_type)
+{
+    const char *param;
+    const char *end;
+
+    if (!content_type
+        || g_ascii_strncasecmp(content_type, "multipart/byteranges",
+                               strlen("multipart/byteranges")))
+        return NULL;
+
+    for (param = strchr(content_type, ';'); param; param = strchr(param, ';')) {
+        param++;
+        while (*param == ' ' || *param == '\t')
+            param++;
+        if (g_ascii_strncasecmp(param, "boundary=", strlen("boundary=")))
+            continue;
+
+        param += strlen("boundary=");
+        if (*param == '"') {
+            param++;
+            end = strchr(param, '"');
+            if (!end)
+                return NULL;
+        } else {
+            end = param + strcspn(param, "; \t\r\n");
+        }
+
+        return (end > param) ? g_strndup(param, end - param) : NULL;
+    }
+
+    return NULL;
+}
+
+gboolean
+lr_multipart_parse_content_range(const char *value,
+                                 gint64 *start,
+                                 gint64 *end)
+{
+    char *endptr;
+
+    while (*value == ' ' || *value == '\t')
+        value++;
+    if (g_ascii_strncasecmp(value, "bytes", strlen("bytes")))
+        return FALSE;
+    value += strlen("bytes");
+    while (*value == ' ' || *value == '\t')
+        value++;
+
+    if (!g_ascii_isdigit(*value))
+        return FALSE;
+    *start = g_ascii_strtoll(value, &endptr, 10);
+    if (*endptr != '-' || !g_ascii_isdigit(endptr[1]))
+        return FALSE;
+    *end = g_ascii_strtoll(endptr + 1, &endptr, 10);
+    if (*endptr != '/')
+        return FALSE;
+
+    return *start <= *end;
+}
+
+LrMultipart *
+lr_multipart_new(const char *boundary, LrMultipartDataCb cb, void *cbdata)
+{
+    LrMultipart *mp;
+
+    assert(boundary);
+    assert(cb);
+
+    mp = lr_malloc0(sizeof(*mp));
+    mp->delimiter = g_strconcat("\r\n--", boundary, NULL);
+    mp->delimiter_len = strlen(mp->delimiter);
+    mp->cb = cb;
+    mp->cbdata = cbdata;
+    mp->state = LR_MP_PREAMBLE;
+    mp->buf = g_byte_array_new();
+    // The first delimiter could be at the very beginning of the body
+    g_byte_array_append(mp->buf, (const guint8 *) "\r\n", 2);
+    return mp;
+}
+
+/** Pass the data of the current part to the callback.
+ */
+static gboolean
+emit_data(LrMultipart *mp, const guint8 *data, gsize len, GError **err)
+{
+    if (len == 0)
+        return TRUE;
+
+    if (mp->offset + (gint64) len - 1 > mp->end) {
+        g_set_error(err, LR_DOWNLOADER_ERROR, LRE_BADSTATUS,
+                    "Part of the multipart response is longer than its "
+                    "Content-Range");
+        return FALSE;
+    }
+
+    if (!mp->cb(mp->cbdata, mp->offset, (const char *) data, len)) {
+        g_set_error(err, LR_DOWNLOADER_ERROR, LRE_IO,
+                    "Data of the multipart response cannot be written");
+        return FALSE;
+    }
+
+    mp->offset += len;
+    return TRUE;
+}
+
+/** Parse as much of the buffered data as possible.
+ */
+static gboolean
+parse_buffer(LrMultipart *mp, GError **err)
+{
+    for (;;) {
+        const guint8 *data = mp->buf->data;
+        gsize len = mp->buf->len;
+        const guint8 *found;
+        gsize used;
+
+        switch (mp->state) {
+        case LR_MP_PREAMBLE:
+        case LR_MP_DATA:
+            found = memmem(data, len, mp->delimiter, mp->delimiter_len);
+            if (found)
+                used = found - data;
+            else    // The end of the data could be a part of a delimiter
+                used = (len >= mp->delimiter_len)
+                       ? len - mp->delimiter_len + 1 : 0;
+
+            if (mp->state == LR_MP_DATA && !emit_data(mp, data, used, err))
+                return FALSE;
+
+            if (!found) {
+                g_byte_array_remove_range(mp->buf, 0, used);
+                return TRUE;
+            }
+
+            if (mp->state == LR_MP_DATA && mp->offset != mp->end + 1) {
+                g_set_error(err, LR_DOWNLOADER_ERROR, LRE_BADSTATUS,
+                            "Part of the multipart response is shorter "
+                            "than its Content-Range");
+                return FALSE;
+            }
+
+            g_byte_array_remove_range(mp->buf, 0, used + mp->delimiter_len);
+            mp->state = LR_MP_DELIMITER;
+            break;
+
+        case LR_MP_DELIMITER:
+            if (len < 2)
+                return TRUE;
+
+            if (data[0] == '-' && data[1] == '-') {
+                // Close delimiter
+                mp->state = LR_MP_EPILOGUE;
+                break;
+            }
+
+            // Transport padding is ignored up to the end of the line
+            found = memmem(data, len, "\r\n", 2);
+            if (!found)
+                goto incomplete_line;
+
+            g_byte_array_remove_range(mp->buf, 0, found - data + 2);
+            mp->has_range = FALSE;
+            mp->state = LR_MP_HEADERS;
+            break;
+
+        case LR_MP_HEADERS:
+            found = memmem(data, len, "\r\n", 2);
+            if (!found)
+                goto incomplete_line;
+
+            used = found - data;
+            if (used == 0) {
+                // End of the headers
+                if (!mp->has_range) {
+                    g_set_error(err, LR_DOWNLOADER_ERROR, LRE_BADSTATUS,
+                                "Part of the multipart response has no "
+                                "Content-Range");
+                    return FALSE;
+                }
+                g_byte_array_remove_range(mp->buf, 0, 2);
+                mp->state = LR_MP_DATA;
+                break;
+            }
+
+            if (!g_ascii_strncasecmp((const char *) data, "Content-Range:",
+                                     strlen("Content-Range:"))) {
+                _cleanup_free_ gchar *value = g_strndup(
+                        (const char *) data + strlen("Content-Range:"),
+                        used - strlen("Content-Range:"));
+                if (!lr_multipart_parse_content_range(value, &mp->offset,
+                                                      &mp->end)) {
+                    g_set_error(err, LR_DOWNLOADER_ERROR, LRE_BADSTATUS,
+                                "Bad Content-Range of a part of the "
+                                "multipart response: %s", value);
+                    return FALSE;
+                }
+                mp->has_range = TRUE;
+            }
+
+            g_byte_array_remove_range(mp->buf, 0, used + 2);
+            break;
+
+        case LR_MP_EPILOGUE:
+            g_byte_array_set_size(mp->buf, 0);
+            return TRUE;
+        }
+    }
+
+incomplete_line:
+    if (mp->buf->len > LR_MULTIPART_MAX_LINE) {
+        g_set_error(err, LR_DOWNLOADER_ERROR, LRE_BADSTATUS,
+                    "Too long line in the headers of a part of "
+                    "the multipart response");
+        return FALSE;
+    }
+    return TRUE;
+}
+
+gboolean
+lr_multipart_feed(LrMultipart *mp, const char *data, size_t len, GError **err)
+{
+    assert(mp);
+    assert(!err || *err == NULL);
+
+    if (mp->state == LR_MP_EPILOGUE)
+        return TRUE;
+
+    g_byte_array_append(mp->buf, (const guint8 *) data, (guint) len);
+    return parse_buffer(mp, err);
+}
+
+gboolean
+lr_multipart_finish(LrMultipart *mp, GError **err)
+{
+    assert(mp);
+    assert(!err || *err == NULL);
+
+    if (mp->state != LR_MP_EPILOGUE) {
+        g_set_error(err, LR_DOWNLOADER_ERROR, LRE_BADSTATUS,
+                    "Multipart response is incomplete");
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+void
+lr_multipart_free(LrMultipart *mp)
+{
+    if (!mp)
+        return;
+
+    g_byte_array_free(mp->buf, TRUE);
+    g_free(mp->delimiter);
+    lr_free(mp);
+}
@@ -0,0 +1,104 @@
+/* librepo - A library providing (libcURL like) API to downloading repository
+ * Copyright (C) 2014  Tomas Mlcoch
+ *
+ * Licensed under the GNU Lesser General Public License Version 2.1
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#ifndef __LR_MULTIPART_H__
+#define __LR_MULTIPART_H__
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/** Parser of a multipart/byteranges response (RFC 7233) to a request
+ * of more byte ranges at once. The body is fed by parts as it comes
+ * from the server, the data of every part are passed to the callback
+ * together with their offset in the file (from the Content-Range of
+ * the part).
+ */
+typedef struct _LrMultipart LrMultipart;
+
+/** Callback for the data of the parts.
+ * @param userdata      User data
+ * @param offset        Offset of the data in the file
+ * @param data          Data
+ * @param len           Length of the data
+ * @return              FALSE stops the parsing with an error
+ */
+typedef gboolean (*LrMultipartDataCb)(void *userdata,
+                                      gint64 offset,
+                                      const char *data,
+                                      size_t len);
+
+/** Return the boundary from the value of a Content-Type header.
+ * @param content_type  Value of Content-Type, e.g.
+ *                      "multipart/byteranges; boundary=THIS_STRING"
+ * @return              Malloced boundary or NULL if the content type
+ *                      is not multipart/byteranges or has no boundary
+ */
+gchar *
+lr_multipart_boundary(const char *content_type);
+
+/** Parse the value of a Content-Range header ("bytes 0-499/1234").
+ * @param value         Value of the header
+ * @param start         The first byte of the range
+ * @param end           The last byte of the range
+ * @return              FALSE if the value is not a satisfied byte range
+ */
+gboolean
+lr_multipart_parse_content_range(const char *value,
+                                 gint64 *start,
+                                 gint64 *end);
+
+/** Create a new parser.
+ * @param boundary      Boundary of the parts (see lr_multipart_boundary())
+ * @param cb            Callback for the data of the parts
+ * @param cbdata        User data of the callback
+ * @return              New parser
+ */
+LrMultipart *
+lr_multipart_new(const char *boundary, LrMultipartDataCb cb, void *cbdata);
+
+/** Parse a next part of the body.
+ * @param mp            Parser
+ * @param data          Data
+ * @param len           Length of the data
+ * @param err           GError **
+ * @return              FALSE if the body is malformed or the callback
+ *                      stopped the parsing
+ */
+gboolean
+lr_multipart_feed(LrMultipart *mp, const char *data, size_t len, GError **err);
+
+/** Check that the whole body was parsed (up to the close delimiter).
+ * @param mp            Parser
+ * @param err           GError **
+ * @return              TRUE if the body is complete
+ */
+gboolean
+lr_multipart_finish(LrMultipart *mp, GError **err);
+
+/** Free the parser.
+ * @param mp            Parser or NULL
+ */
+void
+lr_multipart_free(LrMultipart *mp);
+
+G_END_DECLS
+
+#endif
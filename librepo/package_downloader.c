@@ -26,6 +26,8 @@
 #include <string.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/statvfs.h>
+#include <sys/select.h>
 #include <unistd.h>
 #include <fcntl.h>
 
@@ -34,10 +36,36 @@
 #include "package_downloader.h"
 #include "handle_internal.h"
 #include "downloader.h"
+#include "downloader_internal.h"
+#include "checksum_internal.h"
 #include "fastestmirror_internal.h"
+#include "packagestore.h"
+#include "cleanup.h"
 
 /* Do NOT use resume on successfully downloaded files - download will fail */
 
+/** Size of the string chunk of a target. It holds the strings of the
+ * target and its local path (at most dest + basename of relative_url),
+ * so that the chunk allocates a single block.
+ */
+static gsize
+packagetarget_chunk_size(const char *relative_url,
+                         const char *dest,
+                         const char *checksum,
+                         const char *base_url)
+{
+    gsize size = 2 * (strlen(relative_url) + 1);
+
+    if (dest)
+        size += 2 * (strlen(dest) + 1) + 1;
+    if (checksum)
+        size += strlen(checksum) + 1;
+    if (base_url)
+        size += strlen(base_url) + 1;
+
+    return size;
+}
+
 LrPackageTarget *
 lr_packagetarget_new(LrHandle *handle,
                      const char *relative_url,
@@ -63,7 +91,10 @@ lr_packagetarget_new(LrHandle *handle,
         return NULL;
     }
 
-    target->chunk = g_string_chunk_new(16);
+    target->chunk = g_string_chunk_new(packagetarget_chunk_size(relative_url,
+                                                                dest,
+                                                                checksum,
+                                                                base_url));
 
     target->handle = handle;
     target->relative_url = lr_string_chunk_insert(target->chunk, relative_url);
@@ -159,6 +190,79 @@ lr_packagetarget_new_v3(LrHandle *handle,
     return target;
 }
 
+LrPackageTarget *
+lr_packagetarget_new_v4(LrHandle *handle,
+                        const char *relative_url,
+                        const char *dest,
+                        LrChecksumType checksum_type,
+                        const char *checksum,
+                        gint64 expectedsize,
+                        const char *base_url,
+                        gboolean resume,
+                        LrProgressCb progresscb,
+                        void *cbdata,
+                        LrEndCb endcb,
+                        LrMirrorFailureCb mirrorfailurecb,
+                        gint64 byterangestart,
+                        gint64 byterangeend,
+                        gint priority,
+                        GError **err)
+{
+    LrPackageTarget *target;
+
+    target = lr_packagetarget_new_v3(handle,
+                                     relative_url,
+                                     dest,
+                                     checksum_type,
+                                     checksum,
+                                     expectedsize,
+                                     base_url,
+                                     resume,
+                                     progresscb,
+                                     cbdata,
+                                     endcb,
+                                     mirrorfailurecb,
+                                     byterangestart,
+                                     byterangeend,
+                                     err);
+
+    if (!target)
+        return NULL;
+
+    target->priority = priority;
+
+    return target;
+}
+
+gboolean
+lr_packagetarget_set_delta(LrPackageTarget *target,
+                           const char *delta_url,
+                           LrChecksumType checksum_type,
+                           const char *checksum,
+                           gint64 expectedsize,
+                           const char *base,
+                           GError **err)
+{
+    assert(target);
+    assert(delta_url);
+    assert(!err || *err == NULL);
+
+    if (target->byterangestart > 0 || target->byterangeend > 0) {
+        g_set_error(err, LR_PACKAGE_DOWNLOADER_ERROR, LRE_BADFUNCARG,
+                    "Package target %s with a byte range cannot be "
+                    "reconstructed from a delta", target->relative_url);
+        return FALSE;
+    }
+
+    target->delta_url = lr_string_chunk_insert(target->chunk, delta_url);
+    target->delta_checksum_type = checksum_type;
+    target->delta_checksum = lr_string_chunk_insert(target->chunk, checksum);
+    target->delta_size = expectedsize;
+    target->delta_base = lr_string_chunk_insert(target->chunk, base);
+
+    return TRUE;
+}
+
 void
 lr_packagetarget_free(LrPackageTarget *target)
 {
@@ -166,6 +270,825 @@ lr_packagetarget_free(LrPackageTarget *target)
     g_free(target);
 }
 
+/** Download targets (LrDownloadTarget *) of the package targets
+ * (LrPackageTarget *) which are downloaded right now, so that
+ * lr_packagetarget_cancel() reaches them from any thread */
+G_LOCK_DEFINE_STATIC(downloads);
+static GHashTable *downloads = NULL;
+
+/** Set the download target the package target is downloaded by
+ * or NULL when its download is over. The download target of a package
+ * target which was already cancelled is cancelled right away.
+ */
+static void
+packagetarget_set_download(LrPackageTarget *packagetarget,
+                           LrDownloadTarget *downloadtarget)
+{
+    G_LOCK(downloads);
+
+    if (downloadtarget) {
+        if (!downloads)
+            downloads = g_hash_table_new(g_direct_hash, g_direct_equal);
+        g_hash_table_insert(downloads, packagetarget, downloadtarget);
+        if (g_atomic_int_get(&packagetarget->cancelled))
+            lr_downloadtarget_cancel(downloadtarget);
+    } else if (downloads) {
+        g_hash_table_remove(downloads, packagetarget);
+        if (!g_hash_table_size(downloads)) {
+            g_hash_table_destroy(downloads);
+            downloads = NULL;
+        }
+    }
+
+    G_UNLOCK(downloads);
+}
+
+void
+lr_packagetarget_cancel(LrPackageTarget *target)
+{
+    LrDownloadTarget *downloadtarget;
+
+    assert(target);
+
+    G_LOCK(downloads);
+
+    g_atomic_int_set(&target->cancelled, 1);
+    downloadtarget = downloads ? g_hash_table_lookup(downloads, target) : NULL;
+    if (downloadtarget)
+        lr_downloadtarget_cancel(downloadtarget);
+
+    G_UNLOCK(downloads);
+}
+
+/** Interval of checking of the finished pre-flight checks and package
+ * reconstructions while downloading (in miliseconds) */
+#define LR_PREFLIGHT_TICK_MS    100
+
+/** Suffix of the downloaded delta RPMs */
+#define LR_DELTA_SUFFIX         ".drpm"
+
+/** Set the local_path of the target from its dest and relative_url.
+ */
+static void
+packagetarget_set_local_path(LrPackageTarget *packagetarget)
+{
+    gchar *local_path;
+
+    // Prepare destination filename
+    if (packagetarget->dest) {
+        if (g_file_test(packagetarget->dest, G_FILE_TEST_IS_DIR)) {
+            // Dir specified
+            gchar *file_basename = g_path_get_basename(packagetarget->relative_url);
+            local_path = g_build_filename(packagetarget->dest,
+                                          file_basename,
+                                          NULL);
+            g_free(file_basename);
+        } else {
+            local_path = g_strdup(packagetarget->dest);
+        }
+    } else {
+        // No destination path specified
+        local_path = g_path_get_basename(packagetarget->relative_url);
+    }
+
+    packagetarget->local_path = g_string_chunk_insert(packagetarget->chunk,
+                                                      local_path);
+    g_free(local_path);
+}
+
+/** Mark the target as already downloaded and call its end callback.
+ */
+static void
+packagetarget_already_downloaded(LrPackageTarget *packagetarget)
+{
+    packagetarget->err = g_string_chunk_insert(packagetarget->chunk,
+                                               "Already downloaded");
+
+    // Call end callback
+    LrEndCb end_cb = packagetarget->endcb;
+    if (end_cb)
+        end_cb(packagetarget->cbdata,
+               LR_TRANSFER_ALREDYEXISTS,
+               "Already downloaded");
+}
+
+/** Can the target be taken from and put to the LRO_PACKAGESTORE?
+ */
+static gboolean
+packagetarget_storable(LrPackageTarget *packagetarget)
+{
+    return packagetarget->handle
+           && packagetarget->handle->packagestore
+           && packagetarget->checksum
+           && packagetarget->checksum_type != LR_CHECKSUM_UNKNOWN
+           && packagetarget->byterangestart <= 0
+           && packagetarget->byterangeend <= 0;
+}
+
+/** Take the target from the LRO_PACKAGESTORE and call its end callback.
+ * @return          TRUE if the target was in the store
+ */
+static gboolean
+packagetarget_from_store(LrPackageTarget *packagetarget)
+{
+    if (!packagetarget_storable(packagetarget)
+        || !lr_packagestore_get(packagetarget->handle->packagestore,
+                                packagetarget->checksum_type,
+                                packagetarget->checksum,
+                                packagetarget->local_path))
+        return FALSE;
+
+    packagetarget->err = NULL;
+
+    // Call end callback
+    LrEndCb end_cb = packagetarget->endcb;
+    if (end_cb)
+        end_cb(packagetarget->cbdata, LR_TRANSFER_SUCCESSFUL, NULL);
+
+    return TRUE;
+}
+
+typedef struct _LrPackageDownload LrPackageDownload;
+
+/** State of a target before its download. */
+typedef struct {
+    LrPackageTarget *packagetarget; /*!<
+        The target */
+    gint64 realsize; /*!<
+        Size of the existing file or -1 */
+    gboolean doresume; /*!<
+        Resume the download of the existing file */
+    LrChecksumJob job; /*!<
+        Check of the checksum of the existing file */
+    LrPackageDownload *pd; /*!<
+        Download of the target */
+    LrDownloadTarget *delta_target; /*!<
+        Download of the delta of the target or NULL */
+    gchar *delta_path; /*!<
+        Local path of the delta or NULL */
+    gboolean delta_downloaded; /*!<
+        The delta was downloaded, set by its end callback */
+    gboolean delta_failed; /*!<
+        The delta cannot be used, the whole package is downloaded */
+    gboolean rebuilt; /*!<
+        The package was reconstructed from the delta */
+    GError *rebuild_error; /*!<
+        Error of the reconstruction or NULL */
+    gboolean done; /*!<
+        The reconstructed package was reported as downloaded */
+} LrPreflight;
+
+/** Download of the packages by the async download API (used if some
+ * targets are added to the download while it is running).
+ */
+struct _LrPackageDownload {
+    LrDownloadAsync *ctx; /*!<
+        The download */
+    GSList *downloadtargets; /*!<
+        All LrDownloadTarget of the download, their userdata
+        are the LrPreflight */
+    GSList *sorted; /*!<
+        Handles with the internal mirrorlist sorted by the fastest mirror */
+    GAsyncQueue *deltas; /*!<
+        LrPreflight whose delta download ended, the end callbacks may
+        run in the LRO_ENDCBTHREADS threads, so they are evaluated by
+        the download loop */
+    GSList *fallbacks; /*!<
+        LrPreflight whose delta failed, the whole packages are
+        going to be downloaded */
+    GThreadPool *rebuilder; /*!<
+        Threads reconstructing the packages from the deltas or NULL */
+    GAsyncQueue *rebuilt; /*!<
+        Finished reconstructions (LrPreflight) */
+    guint rebuilding; /*!<
+        Number of the unfinished reconstructions */
+};
+
+/** Checks of the existing files which run in a thread, so the targets
+ * known to be missing are downloaded meanwhile.
+ */
+typedef struct {
+    GSList *jobs; /*!<
+        LrChecksumJob of the existing files */
+    guint threads; /*!<
+        Number of the checksum threads */
+    GAsyncQueue *checked; /*!<
+        Finished jobs, the LrPreflightChecks itself marks the end */
+    gint stop; /*!<
+        Set to skip the jobs which weren't started yet */
+} LrPreflightChecks;
+
+static gboolean
+preflight_job_cb(LrChecksumJob *job, void *cbdata)
+{
+    LrPreflightChecks *checks = cbdata;
+    g_async_queue_push(checks->checked, job);
+    return !g_atomic_int_get(&checks->stop) && !lr_interrupt;
+}
+
+static gpointer
+preflight_checks_thread(gpointer data)
+{
+    LrPreflightChecks *checks = data;
+    lr_checksum_verify_files(checks->jobs, checks->threads,
+                             preflight_job_cb, checks);
+    g_async_queue_push(checks->checked, checks);  // The end of the checks
+    return NULL;
+}
+
+/** Decide about the target after the check of its existing file.
+ * @param checked   Was the checksum of the existing file checked?
+ * @return          TRUE if the target has to be downloaded
+ */
+static gboolean
+preflight_finish(LrPreflight *preflight, gboolean checked)
+{
+    LrPackageTarget *packagetarget = preflight->packagetarget;
+    LrChecksumJob *job = &preflight->job;
+
+    if (checked && job->opened && !job->error) {
+        if (job->matches) {
+            // Checksum calculation was ok and checksum matches
+            g_debug("%s: Package %s is already downloaded (checksum matches)",
+                    __func__, packagetarget->local_path);
+            if (packagetarget_storable(packagetarget))
+                lr_packagestore_put(packagetarget->handle->packagestore,
+                                    packagetarget->checksum_type,
+                                    packagetarget->checksum,
+                                    packagetarget->local_path);
+            packagetarget_already_downloaded(packagetarget);
+            return FALSE;
+        }
+
+        // Checksum calculation was ok but checksum doesn't match
+        if (preflight->realsize != -1
+            && preflight->realsize == packagetarget->expectedsize)
+            // File size is the same as the expected one
+            // Don't try to resume
+            preflight->doresume = FALSE;
+    }
+
+    if (preflight->doresume
+        && preflight->realsize != -1
+        && preflight->realsize == packagetarget->expectedsize)
+    {
+        // File's size matches the expected one, the resume is enabled and
+        // no checksum is known => expect that the file is
+        // the one the user wants
+        g_debug("%s: Package %s is already downloaded (size matches)",
+                __func__, packagetarget->local_path);
+        packagetarget_already_downloaded(packagetarget);
+        return FALSE;
+    }
+
+    // The same package could be downloaded for another destination
+    if (packagetarget_from_store(packagetarget))
+        return FALSE;
+
+    return TRUE;
+}
+
+/** Reconstruct the package from the downloaded delta by LR_APPLYDELTARPM
+ * and check its checksum. The delta is removed.
+ */
+static gboolean
+rebuild_package(LrPreflight *preflight, GError **err)
+{
+    LrPackageTarget *packagetarget = preflight->packagetarget;
+    _cleanup_free_ gchar *tmp_path = NULL;
+    _cleanup_free_ gchar *errout = NULL;
+    const gchar *argv[6];
+    gboolean matches = FALSE;
+    gboolean ret = FALSE;
+    gint status;
+    int i = 0;
+    int fd;
+
+    tmp_path = g_strconcat(packagetarget->local_path, ".XXXXXX", NULL);
+    fd = g_mkstemp(tmp_path);
+    if (fd == -1) {
+        g_set_error(err, LR_PACKAGE_DOWNLOADER_ERROR, LRE_CANNOTCREATETMP,
+                    "Cannot create %s: %s", tmp_path, g_strerror(errno));
+        unlink(preflight->delta_path);
+        return FALSE;
+    }
+    close(fd);
+
+    argv[i++] = LR_APPLYDELTARPM;
+    if (packagetarget->delta_base) {
+        argv[i++] = "-r";
+        argv[i++] = packagetarget->delta_base;
+    }
+    argv[i++] = preflight->delta_path;
+    argv[i++] = tmp_path;
+    argv[i] = NULL;
+
+    if (!g_spawn_sync(NULL, (gchar **) argv, NULL,
+                      G_SPAWN_SEARCH_PATH | G_SPAWN_STDOUT_TO_DEV_NULL,
+                      NULL, NULL, NULL, &errout, &status, err))
+        goto rebuild_package_done;
+
+    if (!g_spawn_check_exit_status(status, NULL)) {
+        g_set_error(err, LR_PACKAGE_DOWNLOADER_ERROR, LRE_UNKNOWNERROR,
+                    "%s failed: %s", LR_APPLYDELTARPM,
+                    errout ? g_strstrip(errout) : "");
+        goto rebuild_package_done;
+    }
+
+    if (packagetarget->checksum
+        && packagetarget->checksum_type != LR_CHECKSUM_UNKNOWN)
+    {
+        fd = open(tmp_path, O_RDONLY);
+        if (fd == -1) {
+            g_set_error(err, LR_PACKAGE_DOWNLOADER_ERROR, LRE_IO,
+                        "Cannot open %s: %s", tmp_path, g_strerror(errno));
+            goto rebuild_package_done;
+        }
+
+        ret = lr_checksum_fd_cmp(packagetarget->checksum_type, fd,
+                                 packagetarget->checksum, FALSE,
+                                 &matches, err);
+        close(fd);
+        if (ret && !matches) {
+            g_set_error(err, LR_PACKAGE_DOWNLOADER_ERROR, LRE_BADCHECKSUM,
+                        "Package reconstructed from the delta doesn't "
+                        "match the checksum");
+            ret = FALSE;
+        }
+        if (!ret)
+            goto rebuild_package_done;
+    }
+
+    ret = (rename(tmp_path, packagetarget->local_path) == 0);
+    if (!ret)
+        g_set_error(err, LR_PACKAGE_DOWNLOADER_ERROR, LRE_IO,
+                    "Cannot rename %s to %s: %s", tmp_path,
+                    packagetarget->local_path, g_strerror(errno));
+
+rebuild_package_done:
+    if (!ret)
+        unlink(tmp_path);
+    unlink(preflight->delta_path);
+    return ret;
+}
+
+static void
+rebuild_thread(gpointer data, gpointer user_data)
+{
+    LrPreflight *preflight = data;
+    LrPackageDownload *pd = user_data;
+
+    preflight->rebuilt = rebuild_package(preflight, &preflight->rebuild_error);
+    g_async_queue_push(pd->rebuilt, preflight);
+}
+
+static int
+delta_progresscb(void *data, double total_to_download, double now_downloaded)
+{
+    LrPackageTarget *packagetarget = ((LrPreflight *) data)->packagetarget;
+    return packagetarget->progresscb(packagetarget->cbdata,
+                                     total_to_download,
+                                     now_downloaded);
+}
+
+static int
+delta_mirrorfailurecb(void *data, const char *msg, const char *url)
+{
+    LrPackageTarget *packagetarget = ((LrPreflight *) data)->packagetarget;
+    return packagetarget->mirrorfailurecb(packagetarget->cbdata, msg, url);
+}
+
+/** End callback of the download of a delta. It may run in a thread of
+ * LRO_ENDCBTHREADS, so the delta is only passed to the download loop,
+ * see delta_finished().
+ */
+static int
+delta_endcb(void *data, LrTransferStatus status, const char *msg)
+{
+    LrPreflight *preflight = data;
+    LrPackageTarget *packagetarget = preflight->packagetarget;
+
+    if (status != LR_TRANSFER_SUCCESSFUL
+        && g_atomic_int_get(&packagetarget->cancelled))
+    {
+        // The whole package is not downloaded instead
+        LrEndCb end_cb = packagetarget->endcb;
+        return end_cb ? end_cb(packagetarget->cbdata, status, msg) : LR_CB_OK;
+    }
+
+    if (status != LR_TRANSFER_SUCCESSFUL)
+        g_debug("%s: Delta of %s cannot be downloaded: %s", __func__,
+                packagetarget->local_path, msg);
+
+    preflight->delta_downloaded = (status == LR_TRANSFER_SUCCESSFUL);
+    g_async_queue_push(preflight->pd->deltas, preflight);
+    return LR_CB_OK;
+}
+
+/** Evaluate the ended download of a delta. The reconstruction of
+ * a downloaded delta is started, the package of a failed one is going
+ * to be downloaded.
+ */
+static void
+delta_finished(LrPackageDownload *pd, LrPreflight *preflight)
+{
+    GError *tmp_err = NULL;
+
+    if (!preflight->delta_downloaded) {
+        pd->fallbacks = g_slist_append(pd->fallbacks, preflight);
+        return;
+    }
+
+    pd->rebuilding++;
+    if (!pd->rebuilder || !g_thread_pool_push(pd->rebuilder, preflight,
+                                              &tmp_err))
+    {
+        if (tmp_err) {
+            g_debug("%s: Cannot start reconstruction in a thread: %s",
+                    __func__, tmp_err->message);
+            g_error_free(tmp_err);
+        }
+        rebuild_thread(preflight, pd);
+    }
+}
+
+/** Evaluate the finished reconstruction of the package.
+ * A package which couldn't be reconstructed is going to be downloaded.
+ */
+static gboolean
+rebuild_finished(LrPackageDownload *pd, LrPreflight *preflight, GError **err)
+{
+    LrPackageTarget *packagetarget = preflight->packagetarget;
+
+    pd->rebuilding--;
+
+    if (!preflight->rebuilt) {
+        g_debug("%s: Package %s cannot be reconstructed from the delta: %s",
+                __func__, packagetarget->local_path,
+                preflight->rebuild_error->message);
+        g_clear_error(&preflight->rebuild_error);
+        pd->fallbacks = g_slist_append(pd->fallbacks, preflight);
+        return TRUE;
+    }
+
+    g_debug("%s: Package %s reconstructed from the delta", __func__,
+            packagetarget->local_path);
+    preflight->done = TRUE;
+
+    // Call end callback
+    LrEndCb end_cb = packagetarget->endcb;
+    if (end_cb && end_cb(packagetarget->cbdata, LR_TRANSFER_SUCCESSFUL,
+                         NULL) == LR_CB_ERROR)
+    {
+        g_set_error(err, LR_PACKAGE_DOWNLOADER_ERROR, LRE_CBINTERRUPTED,
+                    "Interupted by LR_CB_ERROR from end callback");
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+/** Space needed by the targets on a filesystem. */
+typedef struct {
+    dev_t dev; /*!<
+        The filesystem */
+    gchar *dir; /*!<
+        Directory of a target on the filesystem */
+    gint64 needed; /*!<
+        Bytes needed by the targets */
+} LrFilesystemSpace;
+
+/** Space needed by the download of the target. The existing file is
+ * replaced (or resumed), so its size is already taken.
+ */
+static gint64
+preflight_needed_space(LrPreflight *preflight)
+{
+    LrPackageTarget *packagetarget = preflight->packagetarget;
+    gint64 needed = packagetarget->expectedsize;
+    struct stat buf;
+
+    if (needed <= 0
+        || packagetarget->byterangestart > 0
+        || packagetarget->byterangeend > 0)
+        return 0;  // Cannot be estimated
+
+    if (packagetarget->delta_url && packagetarget->delta_size > 0)
+        needed += packagetarget->delta_size;
+
+    if (stat(packagetarget->local_path, &buf) == 0 && S_ISREG(buf.st_mode))
+        needed -= buf.st_size;
+
+    return MAX(needed, 0);
+}
+
+/** Check that the filesystems of the targets which may have to be
+ * downloaded have enough free space for all of them.
+ * @param preflights    GSList of LrPreflight
+ * @return              FALSE if some filesystem is too small (err is set)
+ */
+static gboolean
+preflight_check_space(GSList *preflights, GError **err)
+{
+    GArray *filesystems = g_array_new(FALSE, FALSE, sizeof(LrFilesystemSpace));
+    gboolean ret = TRUE;
+
+    for (GSList *elem = preflights; elem; elem = g_slist_next(elem)) {
+        LrPreflight *preflight = elem->data;
+        gint64 needed = preflight_needed_space(preflight);
+        gchar *dir;
+        struct stat buf;
+        guint i;
+
+        if (!needed)
+            continue;
+
+        dir = g_path_get_dirname(preflight->packagetarget->local_path);
+        if (stat(dir, &buf) == -1) {
+            // Missing directory fails later with a better message
+            g_free(dir);
+            continue;
+        }
+
+        for (i = 0; i < filesystems->len; i++) {
+            LrFilesystemSpace *fs = &g_array_index(filesystems,
+                                                   LrFilesystemSpace, i);
+            if (fs->dev == buf.st_dev) {
+                fs->needed += needed;
+                break;
+            }
+        }
+
+        if (i < filesystems->len) {
+            g_free(dir);
+        } else {
+            LrFilesystemSpace fs = { buf.st_dev, dir, needed };
+            g_array_append_val(filesystems, fs);
+        }
+    }
+
+    for (guint i = 0; i < filesystems->len; i++) {
+        LrFilesystemSpace *fs = &g_array_index(filesystems,
+                                               LrFilesystemSpace, i);
+        struct statvfs vfs;
+        gint64 available;
+
+        if (ret && statvfs(fs->dir, &vfs) == 0) {
+            available = (gint64) vfs.f_bavail * (gint64) vfs.f_frsize;
+            g_debug("%s: %s: %" G_GINT64_FORMAT " bytes needed, %"
+                    G_GINT64_FORMAT " available", __func__, fs->dir,
+                    fs->needed, available);
+            if (fs->needed > available) {
+                g_set_error(err, LR_PACKAGE_DOWNLOADER_ERROR, LRE_NOSPACE,
+                            "Not enough free space in %s: %" G_GINT64_FORMAT
+                            " bytes needed, %" G_GINT64_FORMAT " available",
+                            fs->dir, fs->needed, available);
+                ret = FALSE;
+            }
+        }
+
+        g_free(fs->dir);
+    }
+
+    g_array_free(filesystems, TRUE);
+    return ret;
+}
+
+/** Prepare the internal mirrorlist of the handle of the target
+ * and the download target. The delta of the target is downloaded
+ * instead of the package if it is set and didn't fail yet.
+ * @return          New download target or NULL (err is set)
+ */
+static LrDownloadTarget *
+preflight_downloadtarget(LrPreflight *preflight, GError **err)
+{
+    LrPackageTarget *packagetarget = preflight->packagetarget;
+    LrDownloadTarget *downloadtarget;
+
+    if (packagetarget->handle) {
+        if (!lr_handle_prepare_internal_mirrorlist(packagetarget->handle,
+                                                   FALSE,
+                                                   err))
+            return NULL;
+    }
+
+    GSList *checksums = NULL;
+    LrDownloadTargetChecksum *checksum;
+
+    if (packagetarget->delta_url && !preflight->delta_failed) {
+        checksum = lr_downloadtargetchecksum_new(
+                                        packagetarget->delta_checksum_type,
+                                        packagetarget->delta_checksum);
+        checksums = g_slist_prepend(checksums, checksum);
+
+        if (!preflight->delta_path)
+            preflight->delta_path = g_strconcat(packagetarget->local_path,
+                                                LR_DELTA_SUFFIX, NULL);
+
+        downloadtarget = lr_downloadtarget_new(packagetarget->handle,
+                                               packagetarget->delta_url,
+                                               packagetarget->base_url,
+                                               -1,
+                                               preflight->delta_path,
+                                               checksums,
+                                               packagetarget->delta_size,
+                                               FALSE,
+                                               packagetarget->progresscb ?
+                                                    delta_progresscb : NULL,
+                                               preflight,
+                                               delta_endcb,
+                                               packagetarget->mirrorfailurecb ?
+                                                    delta_mirrorfailurecb : NULL,
+                                               preflight,
+                                               0,
+                                               0);
+        downloadtarget->priority = packagetarget->priority;
+        downloadtarget->deadline = packagetarget->deadline;
+        downloadtarget->priorityclass = packagetarget->priorityclass;
+        downloadtarget->cachesources = TRUE;
+        preflight->delta_target = downloadtarget;
+        packagetarget_set_download(packagetarget, downloadtarget);
+        return downloadtarget;
+    }
+
+    checksum = lr_downloadtargetchecksum_new(packagetarget->checksum_type,
+                                             packagetarget->checksum);
+    checksums = g_slist_prepend(checksums, checksum);
+
+    downloadtarget = lr_downloadtarget_new(packagetarget->handle,
+                                           packagetarget->relative_url,
+                                           packagetarget->base_url,
+                                           -1,
+                                           packagetarget->local_path,
+                                           checksums,
+                                           packagetarget->expectedsize,
+                                           preflight->doresume,
+                                           packagetarget->progresscb,
+                                           packagetarget->cbdata,
+                                           packagetarget->endcb,
+                                           packagetarget->mirrorfailurecb,
+                                           preflight,
+                                           packagetarget->byterangestart,
+                                           packagetarget->byterangeend);
+    downloadtarget->priority = packagetarget->priority;
+    downloadtarget->deadline = packagetarget->deadline;
+    downloadtarget->priorityclass = packagetarget->priorityclass;
+    downloadtarget->cachesources = TRUE;
+    packagetarget_set_download(packagetarget, downloadtarget);
+
+    return downloadtarget;
+}
+
+/** Add the target to the running download.
+ */
+static gboolean
+preflight_add(LrPackageDownload *pd, LrPreflight *preflight, GError **err)
+{
+    LrHandle *handle = preflight->packagetarget->handle;
+    LrDownloadTarget *downloadtarget;
+
+    downloadtarget = preflight_downloadtarget(preflight, err);
+    if (!downloadtarget)
+        return FALSE;
+    pd->downloadtargets = g_slist_prepend(pd->downloadtargets, downloadtarget);
+
+    // Handle which wasn't needed by the targets known to be missing
+    if (handle && handle->fastestmirror && !g_slist_find(pd->sorted, handle)) {
+        pd->sorted = g_slist_prepend(pd->sorted, handle);
+        if (!lr_fastestmirror_sort_internalmirrorlist(handle, err))
+            return FALSE;
+    }
+
+    return lr_download_async_add(pd->ctx, downloadtarget, err);
+}
+
+/** Download the targets of the pd while the existing files of other
+ * targets are checked and the packages are reconstructed from the
+ * downloaded deltas. The checked targets which have to be downloaded
+ * and the packages whose delta failed are added to the download
+ * as soon as possible.
+ */
+static gboolean
+download_async(LrPackageDownload *pd,
+               GSList *jobs,
+               guint threads,
+               gboolean failfast,
+               GError **err)
+{
+    LrPreflightChecks checks = { jobs, threads, NULL, 0 };
+    gboolean checking = (jobs != NULL);
+    gboolean finished = FALSE;
+    GThread *thread = NULL;
+    GError *tmp_err = NULL;
+    gpointer item;
+
+    pd->ctx = lr_download_async_start(pd->downloadtargets, failfast, err);
+    if (!pd->ctx)
+        return FALSE;
+
+    checks.checked = g_async_queue_new();
+    if (checking) {
+        thread = g_thread_try_new("librepo-preflight",
+                                  preflight_checks_thread,
+                                  &checks, &tmp_err);
+        if (!thread) {
+            g_debug("%s: Cannot create thread, files are checked first: %s",
+                    __func__, tmp_err->message);
+            g_clear_error(&tmp_err);
+            preflight_checks_thread(&checks);
+        }
+    }
+
+    while (checking || pd->rebuilding || pd->fallbacks || !finished) {
+        // Add the checked targets which have to be downloaded
+        while (checking && (item = g_async_queue_try_pop(checks.checked))) {
+            if (item == &checks) {
+                checking = FALSE;
+                break;
+            }
+
+            LrPreflight *preflight = ((LrChecksumJob *) item)->userdata;
+            if (preflight_finish(preflight, TRUE)
+                && !preflight_add(pd, preflight, &tmp_err))
+                break;
+        }
+
+        while (!tmp_err && (item = g_async_queue_try_pop(pd->rebuilt)))
+            if (!rebuild_finished(pd, item, &tmp_err))
+                break;
+
+        // Download the whole packages whose delta failed
+        while (!tmp_err && pd->fallbacks) {
+            LrPreflight *preflight = pd->fallbacks->data;
+            pd->fallbacks = g_slist_delete_link(pd->fallbacks, pd->fallbacks);
+            preflight->delta_failed = TRUE;
+            preflight_add(pd, preflight, &tmp_err);
+        }
+
+        if (tmp_err || !lr_download_async_step(pd->ctx, &finished, &tmp_err))
+            break;
+
+        while (pd->deltas && (item = g_async_queue_try_pop(pd->deltas)))
+            delta_finished(pd, item);
+
+        if (pd->fallbacks)
+            continue;  // Some deltas failed during the step
+
+        if (finished) {
+            // Nothing is downloaded, wait for the checks or reconstructions
+            GAsyncQueue *queue = checking ? checks.checked : pd->rebuilt;
+            item = (checking || pd->rebuilding)
+                   ? g_async_queue_timeout_pop(queue,
+                                               LR_PREFLIGHT_TICK_MS * 1000)
+                   : NULL;
+            if (item)
+                g_async_queue_push_front(queue, item);
+            continue;
+        }
+
+        fd_set fdread, fdwrite, fdexcep;
+        int maxfd = -1;
+        long timeout_ms = 0;
+        struct timeval timeout;
+
+        FD_ZERO(&fdread);
+        FD_ZERO(&fdwrite);
+        FD_ZERO(&fdexcep);
+
+        if (!lr_download_async_fdset(pd->ctx, &fdread, &fdwrite, &fdexcep,
+                                     &maxfd, &timeout_ms, &tmp_err))
+            break;
+
+        // Don't let the finished checks and reconstructions wait for too long
+        if ((checking || pd->rebuilding) && timeout_ms > LR_PREFLIGHT_TICK_MS)
+            timeout_ms = LR_PREFLIGHT_TICK_MS;
+
+        timeout.tv_sec = timeout_ms / 1000;
+        timeout.tv_usec = (timeout_ms % 1000) * 1000;
+        if (select(maxfd + 1, &fdread, &fdwrite, &fdexcep, &timeout) < 0
+            && errno != EINTR)
+        {
+            g_set_error(&tmp_err, LR_PACKAGE_DOWNLOADER_ERROR, LRE_SELECT,
+                        "select() error: %s", strerror(errno));
+            break;
+        }
+    }
+
+    // On error the checks which weren't started are skipped
+    g_atomic_int_set(&checks.stop, 1);
+    if (thread)
+        g_thread_join(thread);
+    g_async_queue_unref(checks.checked);
+
+    if (tmp_err) {
+        lr_download_async_finish(pd->ctx, NULL);
+        g_propagate_error(err, tmp_err);
+        return FALSE;
+    }
+
+    return lr_download_async_finish(pd->ctx, err);
+}
+
 gboolean
 lr_download_packages(GSList *targets,
                      LrPackageDownloadFlag flags,
@@ -173,9 +1096,8 @@ lr_download_packages(GSList *targets,
 {
     gboolean ret;
     gboolean failfast = flags & LR_PACKAGEDOWNLOAD_FAILFAST;
-    struct sigaction old_sigact;
-    GSList *downloadtargets = NULL;
     gboolean interruptible = FALSE;
+    gboolean deltas = FALSE;
 
     assert(!err || *err == NULL);
 
@@ -210,57 +1132,52 @@ lr_download_packages(GSList *targets,
         }
     }
 
+    // Statistics (LRI_STATS) describe only this download
+    for (GSList *elem = targets; elem; elem = g_slist_next(elem)) {
+        LrPackageTarget *packagetarget = elem->data;
+        if (packagetarget->handle)
+            lr_handle_stats_reset(packagetarget->handle);
+    }
+
     // Setup sighandler
     if (interruptible) {
-        struct sigaction sigact;
-        g_debug("%s: Using own SIGINT handler", __func__);
-        memset(&sigact, 0, sizeof(old_sigact));
-        memset(&sigact, 0, sizeof(sigact));
-        sigemptyset(&sigact.sa_mask);
-        sigact.sa_handler = lr_sigint_handler;
-        sigaddset(&sigact.sa_mask, SIGINT);
-        sigact.sa_flags = SA_RESTART;
-        if (sigaction(SIGINT, &sigact, &old_sigact) == -1) {
+        if (!lr_sigint_handler_setup()) {
             g_set_error(err, LR_PACKAGE_DOWNLOADER_ERROR, LRE_SIGACTION,
                         "Cannot set Librepo SIGINT handler");
             return FALSE;
         }
     }
 
-    // List of handles for fastest mirror resolving
-    GSList *fmr_handles = NULL;
+    // Download of the targets
+    LrPackageDownload pd = { 0 };
+    // Pre-flight states of the targets
+    guint count = g_slist_length(targets);
+    LrPreflight *preflights = lr_malloc0(sizeof(*preflights) * count);
+    // Checks of the existing files
+    GSList *jobs = NULL;
+    // Targets which are known to be missing
+    GSList *missing = NULL;
+    // Handles with a size limited package store which was extended
+    GSList *evict_handles = NULL;
+    guint i = 0;
 
     // Prepare targets
-    for (GSList *elem = targets; elem; elem = g_slist_next(elem)) {
-        gchar *local_path;
+    for (GSList *elem = targets; elem; elem = g_slist_next(elem), i++) {
         LrPackageTarget *packagetarget = elem->data;
-        LrDownloadTarget *downloadtarget;
-        gint64 realsize = -1;
-        gboolean doresume = packagetarget->resume;
-
-        // Prepare destination filename
-        if (packagetarget->dest) {
-            if (g_file_test(packagetarget->dest, G_FILE_TEST_IS_DIR)) {
-                // Dir specified
-                gchar *file_basename = g_path_get_basename(packagetarget->relative_url);
-                local_path = g_build_filename(packagetarget->dest,
-                                              file_basename,
-                                              NULL);
-                g_free(file_basename);
-            } else {
-                local_path = g_strdup(packagetarget->dest);
-            }
-        } else {
-            // No destination path specified
-            local_path = g_path_get_basename(packagetarget->relative_url);
-        }
+        LrPreflight *preflight = &preflights[i];
+
+        preflight->packagetarget = packagetarget;
+        preflight->pd = &pd;
+        preflight->realsize = -1;
+        preflight->doresume = packagetarget->resume;
+
+        if (packagetarget->delta_url)
+            deltas = TRUE;
 
-        packagetarget->local_path = g_string_chunk_insert(packagetarget->chunk,
-                                                          local_path);
-        g_free(local_path);
+        packagetarget_set_local_path(packagetarget);
 
         // Check expected size and real size if the file exists
-        if (doresume
+        if (preflight->doresume
             && g_access(packagetarget->local_path, R_OK) == 0
             && packagetarget->expectedsize > 0)
         {
@@ -269,15 +1186,16 @@ lr_download_packages(GSList *targets,
                 g_set_error(err, LR_PACKAGE_DOWNLOADER_ERROR, LRE_IO,
                         "Cannot stat %s: %s", packagetarget->local_path,
                         strerror(errno));
-                return FALSE;
+                ret = FALSE;
+                goto cleanup;
             }
 
-            realsize = buf.st_size;
+            preflight->realsize = buf.st_size;
 
-            if (packagetarget->expectedsize < realsize)
+            if (packagetarget->expectedsize < preflight->realsize)
                 // Existing file is bigger then the one that is expected,
                 // disable resuming
-                doresume = FALSE;
+                preflight->doresume = FALSE;
         }
 
         if (g_access(packagetarget->local_path, R_OK) == 0
@@ -288,136 +1206,185 @@ lr_download_packages(GSList *targets,
              * download the file again.
              * Moreover, if the resume is enabled and the file is already
              * completely downloaded, then the download is going to fail.
+             * The checksums are checked in parallel with the download
+             * of the missing targets.
              */
-            int fd_r = open(packagetarget->local_path, O_RDONLY);
-            if (fd_r != -1) {
-                gboolean matches;
-                ret = lr_checksum_fd_cmp(packagetarget->checksum_type,
-                                         fd_r,
-                                         packagetarget->checksum,
-                                         1,
-                                         &matches,
-                                         NULL);
-                close(fd_r);
-                if (ret && matches) {
-                    // Checksum calculation was ok and checksum matches
-                    g_debug("%s: Package %s is already downloaded (checksum matches)",
-                            __func__, packagetarget->local_path);
-
-                    packagetarget->err = g_string_chunk_insert(
-                                                packagetarget->chunk,
-                                                "Already downloaded");
-
-                    // Call end callback
-                    LrEndCb end_cb = packagetarget->endcb;
-                    if (end_cb)
-                        end_cb(packagetarget->cbdata,
-                               LR_TRANSFER_ALREDYEXISTS,
-                               "Already downloaded");
-
-                    continue;
-                } else if (ret) {
-                    // Checksum calculation was ok but checksum doesn't match
-                    if (realsize != -1 && realsize == packagetarget->expectedsize)
-                        // File size is the same as the expected one
-                        // Don't try to resume
-                        doresume = FALSE;
-                }
-            }
+            LrChecksumJob *job = &preflight->job;
+            job->path       = packagetarget->local_path;
+            job->type       = packagetarget->checksum_type;
+            job->expected   = packagetarget->checksum;
+            job->caching    = TRUE;
+            job->index      = packagetarget->handle
+                              && packagetarget->handle->checksumindex;
+            job->userdata   = preflight;
+            jobs = g_slist_prepend(jobs, job);
+            continue;
         }
 
-        if (doresume && realsize != -1 && realsize == packagetarget->expectedsize) {
-            // File's size matches the expected one, the resume is enabled and
-            // no checksum is known => expect that the file is
-            // the one the user wants
-            g_debug("%s: Package %s is already downloaded (size matches)",
-                    __func__, packagetarget->local_path);
-
-            packagetarget->err = g_string_chunk_insert(
-                                        packagetarget->chunk,
-                                        "Already downloaded");
+        if (preflight_finish(preflight, FALSE))
+            missing = g_slist_prepend(missing, preflight);
+    }
 
-            // Call end callback
-            LrEndCb end_cb = packagetarget->endcb;
-            if (end_cb)
-                end_cb(packagetarget->cbdata,
-                       LR_TRANSFER_ALREDYEXISTS,
-                       "Already downloaded");
+    jobs = g_slist_reverse(jobs);
+    missing = g_slist_reverse(missing);
+
+    // The existing files which don't match may have to be downloaded too
+    GSList *downloads = g_slist_copy(missing);
+    for (GSList *elem = jobs; elem; elem = g_slist_next(elem))
+        downloads = g_slist_prepend(downloads,
+                                    ((LrChecksumJob *) elem->data)->userdata);
+    ret = preflight_check_space(downloads, err);
+    g_slist_free(downloads);
+    if (!ret)
+        goto cleanup;
+
+    for (GSList *elem = missing; elem; elem = g_slist_next(elem)) {
+        LrPreflight *preflight = elem->data;
+        LrHandle *handle = preflight->packagetarget->handle;
+        LrDownloadTarget *downloadtarget;
 
-            continue;
+        downloadtarget = preflight_downloadtarget(preflight, err);
+        if (!downloadtarget) {
+            ret = FALSE;
+            goto cleanup;
         }
 
-        if (packagetarget->handle) {
-            ret = lr_handle_prepare_internal_mirrorlist(packagetarget->handle,
-                                                        FALSE,
-                                                        err);
-            if (!ret)
-                goto cleanup;
+        if (handle && handle->fastestmirror
+            && !g_slist_find(pd.sorted, handle))
+            pd.sorted = g_slist_prepend(pd.sorted, handle);
 
-            if (packagetarget->handle->fastestmirror) {
-                if (!g_slist_find(fmr_handles, packagetarget->handle))
-                    fmr_handles = g_slist_prepend(fmr_handles,
-                                                  packagetarget->handle);
-            }
-        }
+        pd.downloadtargets = g_slist_prepend(pd.downloadtargets,
+                                             downloadtarget);
+    }
 
-        GSList *checksums = NULL;
-        LrDownloadTargetChecksum *checksum;
-        checksum = lr_downloadtargetchecksum_new(packagetarget->checksum_type,
-                                                 packagetarget->checksum);
-        checksums = g_slist_prepend(checksums, checksum);
+    pd.downloadtargets = g_slist_reverse(pd.downloadtargets);
 
-        downloadtarget = lr_downloadtarget_new(packagetarget->handle,
-                                               packagetarget->relative_url,
-                                               packagetarget->base_url,
-                                               -1,
-                                               packagetarget->local_path,
-                                               checksums,
-                                               packagetarget->expectedsize,
-                                               doresume,
-                                               packagetarget->progresscb,
-                                               packagetarget->cbdata,
-                                               packagetarget->endcb,
-                                               packagetarget->mirrorfailurecb,
-                                               packagetarget,
-                                               packagetarget->byterangestart,
-                                               packagetarget->byterangeend);
-
-        downloadtargets = g_slist_append(downloadtargets, downloadtarget);
+    // Do Fastest Mirror resolving for all handles in one shot
+    if (pd.sorted) {
+        pd.sorted = g_slist_reverse(pd.sorted);
+        ret = lr_fastestmirror_sort_internalmirrorlists(pd.sorted, err);
+        if (!ret)
+            goto cleanup;
     }
 
-    // Do Fastest Mirror resolving for all handles in one shot
-    if (fmr_handles) {
-        fmr_handles = g_slist_reverse(fmr_handles);
-        ret = lr_fastestmirror_sort_internalmirrorlists(fmr_handles, err);
-        g_slist_free(fmr_handles);
+    // Start downloading
+    if (!jobs && !deltas) {
+        ret = lr_download(pd.downloadtargets, failfast, err);
+    } else {
+        LrHandle *first = ((LrPackageTarget *) targets->data)->handle;
+        guint threads = first ? (guint) first->checksumthreads
+                              : LRO_CHECKSUMTHREADS_DEFAULT;
+
+        if (deltas) {
+            GError *tmp_err = NULL;
+            pd.deltas = g_async_queue_new();
+            pd.rebuilt = g_async_queue_new();
+            pd.rebuilder = g_thread_pool_new(rebuild_thread, &pd,
+                                             (gint) g_get_num_processors(),
+                                             FALSE, &tmp_err);
+            if (!pd.rebuilder) {
+                g_debug("%s: Cannot create threads, packages are "
+                        "reconstructed in the main thread: %s",
+                        __func__, tmp_err->message);
+                g_clear_error(&tmp_err);
+            }
+        }
 
-        if (!ret) {
-            return FALSE;
+        // A failed delta is replaced by the whole package, so the fail
+        // fast with deltas is decided after the download
+        ret = download_async(&pd, jobs, threads, failfast && !deltas, err);
+
+        if (pd.rebuilder)
+            g_thread_pool_free(pd.rebuilder, FALSE, TRUE);
+        if (pd.rebuilt) {
+            // Reconstructions finished after an error of the download
+            LrPreflight *preflight;
+            while ((preflight = g_async_queue_try_pop(pd.rebuilt)))
+                g_clear_error(&preflight->rebuild_error);
+            g_async_queue_unref(pd.rebuilt);
         }
+        if (pd.deltas)
+            g_async_queue_unref(pd.deltas);
     }
 
-    // Start downloading
-    ret = lr_download(downloadtargets, failfast, err);
-
 cleanup:
 
     // Copy download statuses from downloadtargets to targets
-    for (GSList *elem = downloadtargets; elem; elem = g_slist_next(elem)) {
+    for (GSList *elem = pd.downloadtargets; elem; elem = g_slist_next(elem)) {
         LrDownloadTarget *downloadtarget = elem->data;
-        LrPackageTarget *packagetarget = downloadtarget->userdata;
+        LrPreflight *preflight = downloadtarget->userdata;
+        LrPackageTarget *packagetarget = preflight->packagetarget;
+        gboolean downloaded = (downloadtarget->rcode == LRE_OK);
+
+        // The download target is freed below
+        packagetarget_set_download(packagetarget, NULL);
+
+        if (downloadtarget == preflight->delta_target) {
+            if (preflight->delta_failed)
+                continue;  // The whole package was downloaded instead
+            downloaded = preflight->done;
+        }
+
         if (downloadtarget->err)
             packagetarget->err = g_string_chunk_insert(packagetarget->chunk,
                                                        downloadtarget->err);
+        else if (!downloaded)
+            packagetarget->err = g_string_chunk_insert(packagetarget->chunk,
+                                                       "Not finished");
+        packagetarget->stats = downloadtarget->stats;
+
+        if (!downloaded && failfast && deltas && ret) {
+            g_set_error(err, LR_PACKAGE_DOWNLOADER_ERROR, LRE_UNFINISHED,
+                        "Cannot download %s: %s",
+                        packagetarget->relative_url, packagetarget->err);
+            ret = FALSE;
+        }
+
+        // Put the downloaded packages to the store
+        if (downloaded && packagetarget_storable(packagetarget))
+        {
+            LrHandle *handle = packagetarget->handle;
+            lr_packagestore_put(handle->packagestore,
+                                packagetarget->checksum_type,
+                                packagetarget->checksum,
+                                packagetarget->local_path);
+            if (handle->packagestoremaxsize > 0
+                && !g_slist_find(evict_handles, handle))
+                evict_handles = g_slist_prepend(evict_handles, handle);
+        }
+    }
+
+    // Keep the stores in their size limits
+    for (GSList *elem = evict_handles; elem; elem = g_slist_next(elem)) {
+        LrHandle *handle = elem->data;
+        lr_packagestore_evict(handle->packagestore,
+                              handle->packagestoremaxsize);
     }
+    g_slist_free(evict_handles);
 
     // Free downloadtargets list
-    g_slist_free_full(downloadtargets, (GDestroyNotify)lr_downloadtarget_free);
+    g_slist_free_full(pd.downloadtargets,
+                      (GDestroyNotify)lr_downloadtarget_free);
+
+    for (i = 0; i < count; i++) {
+        LrPreflight *preflight = &preflights[i];
+        g_clear_error(&preflight->job.error);
+        g_clear_error(&preflight->rebuild_error);
+        if (preflight->delta_path) {
+            // Remove the delta whose reconstruction wasn't started
+            unlink(preflight->delta_path);
+            g_free(preflight->delta_path);
+        }
+    }
+    lr_free(preflights);
+    g_slist_free(jobs);
+    g_slist_free(missing);
+    g_slist_free(pd.sorted);
+    g_slist_free(pd.fallbacks);
 
     // Restore original signal handler
     if (interruptible) {
-        g_debug("%s: Restoring an old SIGINT handler", __func__);
-        sigaction(SIGINT, &old_sigact, NULL);
+        lr_sigint_handler_restore();
         if (lr_interrupt) {
             if (err && *err != NULL)
                 g_clear_error(err);
@@ -430,6 +1397,225 @@ cleanup:
     return ret;
 }
 
+/** Target of a LrPackageDownloadIter, its callbacks are replaced
+ * during the download. */
+typedef struct {
+    LrPackageDownloadIter *iter; /*!<
+        The iterator */
+    LrPackageTarget *packagetarget; /*!<
+        The target */
+    LrProgressCb progresscb; /*!<
+        Original progress callback */
+    LrEndCb endcb; /*!<
+        Original end callback */
+    LrMirrorFailureCb mirrorfailurecb; /*!<
+        Original mirror failure callback */
+    void *cbdata; /*!<
+        Original callback data */
+    LrTransferStatus status; /*!<
+        Status passed to the end callback */
+    gboolean finished; /*!<
+        The end callback was called (set by the download thread) */
+    gboolean returned; /*!<
+        The target was returned by lr_packagedownloaditer_next() */
+} LrIterTarget;
+
+struct _LrPackageDownloadIter {
+    GSList *targets; /*!<
+        Targets of the download */
+    LrPackageDownloadFlag flags; /*!<
+        Flags of the download */
+    LrIterTarget *itertargets; /*!<
+        Array of the targets */
+    guint count; /*!<
+        Number of the targets */
+    GAsyncQueue *finished; /*!<
+        Finished targets (LrIterTarget), the iterator itself marks
+        the end of the download */
+    GThread *thread; /*!<
+        Thread of the download */
+    gboolean ret; /*!<
+        Return value of lr_download_packages() */
+    GError *error; /*!<
+        Error of lr_download_packages() or NULL */
+    gboolean ended; /*!<
+        The end of the download was taken from the queue */
+    guint leftover; /*!<
+        Index of the next target which may be left over after the end */
+};
+
+static int
+iter_progresscb(void *data, double total_to_download, double now_downloaded)
+{
+    LrIterTarget *itertarget = data;
+    return itertarget->progresscb(itertarget->cbdata,
+                                  total_to_download,
+                                  now_downloaded);
+}
+
+static int
+iter_mirrorfailurecb(void *data, const char *msg, const char *url)
+{
+    LrIterTarget *itertarget = data;
+    return itertarget->mirrorfailurecb(itertarget->cbdata, msg, url);
+}
+
+static int
+iter_endcb(void *data, LrTransferStatus status, const char *msg)
+{
+    LrIterTarget *itertarget = data;
+    int rc = LR_CB_OK;
+
+    if (itertarget->endcb)
+        rc = itertarget->endcb(itertarget->cbdata, status, msg);
+
+    if (!itertarget->finished) {
+        itertarget->finished = TRUE;
+        itertarget->status = status;
+        g_async_queue_push(itertarget->iter->finished, itertarget);
+    }
+
+    return rc;
+}
+
+/** Restore the original callbacks of the targets.
+ */
+static void
+iter_restore_callbacks(LrPackageDownloadIter *iter)
+{
+    for (guint i = 0; i < iter->count; i++) {
+        LrIterTarget *itertarget = &iter->itertargets[i];
+        LrPackageTarget *packagetarget = itertarget->packagetarget;
+        packagetarget->progresscb = itertarget->progresscb;
+        packagetarget->endcb = itertarget->endcb;
+        packagetarget->mirrorfailurecb = itertarget->mirrorfailurecb;
+        packagetarget->cbdata = itertarget->cbdata;
+    }
+}
+
+static gpointer
+iter_download_thread(gpointer data)
+{
+    LrPackageDownloadIter *iter = data;
+
+    iter->ret = lr_download_packages(iter->targets, iter->flags,
+                                     &iter->error);
+    iter_restore_callbacks(iter);
+
+    g_async_queue_push(iter->finished, iter);  // The end of the download
+    return NULL;
+}
+
+LrPackageDownloadIter *
+lr_download_packages_iter(GSList *targets,
+                          LrPackageDownloadFlag flags,
+                          GError **err)
+{
+    LrPackageDownloadIter *iter;
+    GError *tmp_err = NULL;
+    guint i = 0;
+
+    assert(!err || *err == NULL);
+
+    iter = lr_malloc0(sizeof(*iter));
+    iter->targets = targets;
+    iter->flags = flags;
+    iter->count = g_slist_length(targets);
+    iter->itertargets = lr_malloc0(sizeof(LrIterTarget) * iter->count);
+    iter->finished = g_async_queue_new();
+
+    for (GSList *elem = targets; elem; elem = g_slist_next(elem), i++) {
+        LrPackageTarget *packagetarget = elem->data;
+        LrIterTarget *itertarget = &iter->itertargets[i];
+
+        itertarget->iter = iter;
+        itertarget->packagetarget = packagetarget;
+        itertarget->progresscb = packagetarget->progresscb;
+        itertarget->endcb = packagetarget->endcb;
+        itertarget->mirrorfailurecb = packagetarget->mirrorfailurecb;
+        itertarget->cbdata = packagetarget->cbdata;
+
+        packagetarget->progresscb = itertarget->progresscb ?
+                                    iter_progresscb : NULL;
+        packagetarget->endcb = iter_endcb;
+        packagetarget->mirrorfailurecb = itertarget->mirrorfailurecb ?
+                                         iter_mirrorfailurecb : NULL;
+        packagetarget->cbdata = itertarget;
+    }
+
+    iter->thread = g_thread_try_new("librepo-packages",
+                                    iter_download_thread,
+                                    iter, &tmp_err);
+    if (!iter->thread) {
+        g_set_error(err, LR_PACKAGE_DOWNLOADER_ERROR, LRE_UNKNOWNERROR,
+                    "Cannot create download thread: %s", tmp_err->message);
+        g_error_free(tmp_err);
+        iter_restore_callbacks(iter);
+        lr_packagedownloaditer_free(iter);
+        return NULL;
+    }
+
+    return iter;
+}
+
+LrPackageTarget *
+lr_packagedownloaditer_next(LrPackageDownloadIter *iter,
+                            LrTransferStatus *status,
+                            GError **err)
+{
+    assert(iter);
+    assert(!err || *err == NULL);
+
+    while (!iter->ended) {
+        LrIterTarget *itertarget;
+        gpointer item = g_async_queue_pop(iter->finished);
+
+        if (item == iter) {
+            iter->ended = TRUE;
+            break;
+        }
+
+        itertarget = item;
+        itertarget->returned = TRUE;
+        if (status)
+            *status = itertarget->status;
+        return itertarget->packagetarget;
+    }
+
+    // Targets which weren't finished (the download failed)
+    while (iter->leftover < iter->count) {
+        LrIterTarget *itertarget = &iter->itertargets[iter->leftover++];
+        if (itertarget->returned)
+            continue;
+        itertarget->returned = TRUE;
+        if (status)
+            *status = LR_TRANSFER_ERROR;
+        return itertarget->packagetarget;
+    }
+
+    if (!iter->ret && iter->error) {
+        g_propagate_error(err, iter->error);
+        iter->error = NULL;
+    }
+
+    return NULL;
+}
+
+void
+lr_packagedownloaditer_free(LrPackageDownloadIter *iter)
+{
+    if (!iter)
+        return;
+
+    if (iter->thread)
+        g_thread_join(iter->thread);
+
+    g_async_queue_unref(iter->finished);
+    g_clear_error(&iter->error);
+    lr_free(iter->itertargets);
+    lr_free(iter);
+}
+
 gboolean
 lr_download_package(LrHandle *handle,
                     const char *relative_url,
@@ -471,6 +1657,53 @@ lr_download_package(LrHandle *handle,
 }
 
 
+/** Data for the check_package_job_cb */
+typedef struct {
+    gboolean failfast; /*!<
+        Stop on the first file which doesn't match */
+    GError **err; /*!<
+        Error of lr_check_packages */
+    gboolean ret; /*!<
+        Result of lr_check_packages */
+} LrCheckPackagesData;
+
+static gboolean
+check_package_job_cb(LrChecksumJob *job, void *cbdata)
+{
+    LrCheckPackagesData *data = cbdata;
+    LrPackageTarget *packagetarget = job->userdata;
+
+    if (!job->opened) {
+        // Cannot open the file
+        packagetarget->err = g_string_chunk_insert(packagetarget->chunk,
+                               "Cannot be opened");
+        if (data->failfast) {
+            data->ret = FALSE;
+            g_set_error(data->err, LR_PACKAGE_DOWNLOADER_ERROR, LRE_IO,
+                        "Cannot open %s", packagetarget->local_path);
+            return FALSE;
+        }
+    } else if (!job->error && job->matches) {
+        // Checksum is ok
+        packagetarget->err = NULL;
+        g_debug("%s: Package %s is already downloaded (checksum matches)",
+                __func__, packagetarget->local_path);
+    } else {
+        // Checksum doesn't match or checksuming error
+        packagetarget->err = g_string_chunk_insert(packagetarget->chunk,
+                                                   "Checksum of doesn't match");
+        if (data->failfast) {
+            data->ret = FALSE;
+            g_set_error(data->err, LR_PACKAGE_DOWNLOADER_ERROR,
+                        LRE_BADCHECKSUM,
+                        "File with nonmatching checksum found");
+            return FALSE;
+        }
+    }
+
+    return !lr_interrupt;
+}
+
 gboolean
 lr_check_packages(GSList *targets,
                   LrPackageCheckFlag flags,
@@ -478,7 +1711,6 @@ lr_check_packages(GSList *targets,
 {
     gboolean ret = TRUE;
     gboolean failfast = flags & LR_PACKAGECHECK_FAILFAST;
-    struct sigaction old_sigact;
     gboolean interruptible = FALSE;
 
     assert(!err || *err == NULL);
@@ -506,84 +1738,31 @@ lr_check_packages(GSList *targets,
 
     // Setup sighandler
     if (interruptible) {
-        g_debug("%s: Using own SIGINT handler", __func__);
-        struct sigaction sigact;
-        sigact.sa_handler = lr_sigint_handler;
-        sigaddset(&sigact.sa_mask, SIGINT);
-        sigact.sa_flags = SA_RESTART;
-        if (sigaction(SIGINT, &sigact, &old_sigact) == -1) {
+        if (!lr_sigint_handler_setup()) {
             g_set_error(err, LR_PACKAGE_DOWNLOADER_ERROR, LRE_SIGACTION,
                         "Cannot set Librepo SIGINT handler");
             return FALSE;
         }
     }
 
+    GSList *jobs = NULL;
+    LrPackageTarget *first = targets->data;
+
     for (GSList *elem = targets; elem; elem = g_slist_next(elem)) {
-        gchar *local_path;
         LrPackageTarget *packagetarget = elem->data;
 
-        // Prepare destination filename
-        if (packagetarget->dest) {
-            if (g_file_test(packagetarget->dest, G_FILE_TEST_IS_DIR)) {
-                // Dir specified
-                gchar *file_basename = g_path_get_basename(packagetarget->relative_url);
-                local_path = g_build_filename(packagetarget->dest,
-                                              file_basename,
-                                              NULL);
-                g_free(file_basename);
-            } else {
-                local_path = g_strdup(packagetarget->dest);
-            }
-        } else {
-            // No destination path specified
-            local_path = g_path_get_basename(packagetarget->relative_url);
-        }
-
-        packagetarget->local_path = g_string_chunk_insert(packagetarget->chunk,
-                                                          local_path);
+        packagetarget_set_local_path(packagetarget);
 
         if (g_access(packagetarget->local_path, R_OK) == 0) {
-            // If the file exists check its checksum
-            int fd_r = open(packagetarget->local_path, O_RDONLY);
-            if (fd_r != -1) {
-                // File was successfully opened
-                gboolean matches;
-                ret = lr_checksum_fd_cmp(packagetarget->checksum_type,
-                                         fd_r,
-                                         packagetarget->checksum,
-                                         1,
-                                         &matches,
-                                         NULL);
-                close(fd_r);
-                if (ret && matches) {
-                    // Checksum is ok
-                    packagetarget->err = NULL;
-                    g_debug("%s: Package %s is already downloaded (checksum matches)",
-                            __func__, packagetarget->local_path);
-                } else {
-                    // Checksum doesn't match or checksuming error
-                    packagetarget->err = g_string_chunk_insert(
-                                                packagetarget->chunk,
-                                                "Checksum of doesn't match");
-                    if (failfast) {
-                        ret = FALSE;
-                        g_set_error(err, LR_PACKAGE_DOWNLOADER_ERROR,
-                                    LRE_BADCHECKSUM,
-                                    "File with nonmatching checksum found");
-                        break;
-                    }
-                }
-            } else {
-                // Cannot open the file
-                packagetarget->err = g_string_chunk_insert(packagetarget->chunk,
-                                       "Cannot be opened");
-                if (failfast) {
-                    ret = FALSE;
-                    g_set_error(err, LR_PACKAGE_DOWNLOADER_ERROR, LRE_IO,
-                                "Cannot open %s", packagetarget->local_path);
-                    break;
-                }
-            }
+            // If the file exists its checksum will be checked
+            LrChecksumJob *job = lr_malloc0(sizeof(*job));
+            job->path       = packagetarget->local_path;
+            job->type       = packagetarget->checksum_type;
+            job->expected   = packagetarget->checksum;
+            job->caching    = TRUE;
+            job->index      = packagetarget->handle->checksumindex;
+            job->userdata   = packagetarget;
+            jobs = g_slist_prepend(jobs, job);
         } else {
             // File doesn't exists
             packagetarget->err = g_string_chunk_insert(packagetarget->chunk,
@@ -597,10 +1776,27 @@ lr_check_packages(GSList *targets,
         }
     }
 
+    if (ret && jobs) {
+        // Checksums of the existing files
+        LrCheckPackagesData data = { failfast, err, TRUE };
+        jobs = g_slist_reverse(jobs);
+        lr_checksum_verify_files(jobs,
+                                 (guint) first->handle->checksumthreads,
+                                 check_package_job_cb,
+                                 &data);
+        ret = data.ret;
+    }
+
+    for (GSList *elem = jobs; elem; elem = g_slist_next(elem)) {
+        LrChecksumJob *job = elem->data;
+        g_clear_error(&job->error);
+        lr_free(job);
+    }
+    g_slist_free(jobs);
+
     // Restore original signal handler
     if (interruptible) {
-        g_debug("%s: Restoring an old SIGINT handler", __func__);
-        sigaction(SIGINT, &old_sigact, NULL);
+        lr_sigint_handler_restore();
         if (lr_interrupt) {
             if (err && *err != NULL)
                 g_clear_error(err);
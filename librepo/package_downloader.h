@@ -120,6 +120,38 @@ typedef struct {
     gint64 byterangeend; /*!<
         Download only specified range of bytes. */
 
+    gint priority; /*!<
+        Priority of the target (see LRO_DOWNLOADORDER). */
+
+    gdouble deadline; /*!<
+        Deadline of the download of the target or 0
+        (see LrDownloadTarget.deadline). */
+
+    LrPriorityClass priorityclass; /*!<
+        Priority class of the target
+        (see LrDownloadTarget.priorityclass). */
+
+    char *delta_url; /*!<
+        Relative part of URL of a delta RPM or NULL
+        (see lr_packagetarget_set_delta()) */
+
+    LrChecksumType delta_checksum_type; /*!<
+        Checksum type of the delta */
+
+    char *delta_checksum; /*!<
+        Expected checksum value of the delta */
+
+    gint64 delta_size; /*!<
+        Expected size of the delta */
+
+    char *delta_base; /*!<
+        Old version of the package the delta applies to or NULL
+        if it applies to the installed package */
+
+    volatile gint cancelled; /*!<
+        Set by lr_packagetarget_cancel(), accessed only by
+        g_atomic_int_*() */
+
     // Will be filled by ::lr_download_packages()
 
     char *local_path; /*!<
@@ -131,6 +163,9 @@ typedef struct {
     GStringChunk *chunk; /*!<
         String chunk */
 
+    LrTransferStats stats; /*!<
+        Timing of the download (see LrDownloadTarget.stats) */
+
 } LrPackageTarget;
 
 /** Create new LrPackageTarget object.
@@ -244,12 +279,78 @@ lr_packagetarget_new_v3(LrHandle *handle,
                         gint64 byterangeend,
                         GError **err);
 
+/** Create new LrPackageTarget object.
+ * Almost same as lr_packagetarget_new_v3() except this function
+ * could set a priority of the package.
+ * For params see lr_packagetarget_new_v3().
+ * @param priority          Priority of the target. Targets with higher
+ *                          priority are downloaded first if the
+ *                          LRO_DOWNLOADORDER of the handle is
+ *                          LR_DOWNLOADORDER_PRIORITY. 0 is default.
+ * @return                  Newly allocated LrPackageTarget or NULL on error
+ */
+LrPackageTarget *
+lr_packagetarget_new_v4(LrHandle *handle,
+                        const char *relative_url,
+                        const char *dest,
+                        LrChecksumType checksum_type,
+                        const char *checksum,
+                        gint64 expectedsize,
+                        const char *base_url,
+                        gboolean resume,
+                        LrProgressCb progresscb,
+                        void *cbdata,
+                        LrEndCb endcb,
+                        LrMirrorFailureCb mirrorfailurecb,
+                        gint64 byterangestart,
+                        gint64 byterangeend,
+                        gint priority,
+                        GError **err);
+
+/** Let the package be built from a delta RPM instead of the download
+ * of the whole package. The delta is downloaded (from the same mirrors
+ * or base URL as the package) and the package is reconstructed from it
+ * by LR_APPLYDELTARPM in a pool of threads while other packages are
+ * downloaded. If the delta cannot be downloaded or applied, or the
+ * reconstructed package doesn't match the checksum of the target,
+ * the whole package is downloaded instead.
+ * @param target            LrPackageTarget object
+ * @param delta_url         Relative part of URL of the delta.
+ * @param checksum_type     Checksum type of the delta or LR_CHECKSUM_UNKNOWN.
+ * @param checksum          Expected checksum of the delta or NULL.
+ * @param expectedsize      Expected size of the delta or 0.
+ * @param base              Path to the old version of the package the delta
+ *                          applies to or NULL if it applies to the package
+ *                          installed in the system.
+ * @param err               GError **
+ * @return                  TRUE if everything is ok, FALSE if err is set.
+ */
+gboolean
+lr_packagetarget_set_delta(LrPackageTarget *target,
+                           const char *delta_url,
+                           LrChecksumType checksum_type,
+                           const char *checksum,
+                           gint64 expectedsize,
+                           const char *base,
+                           GError **err);
+
 /** Free ::LrPackageTarget object.
  * @param target        LrPackageTarget object
  */
 void
 lr_packagetarget_free(LrPackageTarget *target);
 
+/** Cancel the download of the package. It could be called from any
+ * thread and from the callbacks of the running ::lr_download_packages.
+ * The package (or its delta) is not downloaded or its transfer is
+ * stopped, see ::lr_downloadtarget_cancel. Its endcb is called with
+ * LR_TRANSFER_ERROR and its err is set. A package which is already
+ * downloaded or reconstructed from the delta is not affected.
+ * @param target        LrPackageTarget object
+ */
+void
+lr_packagetarget_cancel(LrPackageTarget *target);
+
 /** Available flags for package downloader */
 typedef enum {
     LR_PACKAGEDOWNLOAD_FAILFAST    = 1 << 0, /*!<
@@ -262,7 +363,15 @@ typedef enum {
         PackageTarget objects). */
 } LrPackageDownloadFlag;
 
+/** Program which reconstructs a package from a delta RPM.
+ * It is called as "applydeltarpm [-r base] delta package". */
+#define LR_APPLYDELTARPM        "applydeltarpm"
+
 /** Download all LrPackageTargets at the targets GSList.
+ * Before any download starts, the free space of the filesystems of
+ * the destinations is compared with the expected sizes of the targets
+ * which have to be downloaded and the function fails with LRE_NOSPACE
+ * if some of them is too small.
  * @param targets           GSList where each element is a ::LrPackageTarget
  *                          object
  * @param flags             Bitfield with flags to download
@@ -274,6 +383,56 @@ lr_download_packages(GSList *targets,
                      LrPackageDownloadFlag flags,
                      GError **err);
 
+/** Download of packages which returns the targets in the order
+ * they are finished (see lr_download_packages_iter()).
+ */
+typedef struct _LrPackageDownloadIter LrPackageDownloadIter;
+
+/** Start lr_download_packages() in a thread and return an iterator
+ * over the targets in the order they are finished. The targets can be
+ * processed while the others are still downloaded.
+ * The callbacks of the targets are called from the download thread.
+ * The targets (and the list) must not be modified or freed until
+ * the iterator is freed.
+ * @param targets           GSList where each element is a ::LrPackageTarget
+ *                          object
+ * @param flags             Bitfield with flags to download
+ * @param err               GError **
+ * @return                  New iterator or NULL if the download thread
+ *                          cannot be started (err is set)
+ */
+LrPackageDownloadIter *
+lr_download_packages_iter(GSList *targets,
+                          LrPackageDownloadFlag flags,
+                          GError **err);
+
+/** Wait for the next finished target.
+ * Every target is returned exactly once. Targets which weren't finished
+ * because the download failed are returned after the end of the
+ * download with LR_TRANSFER_ERROR.
+ * Note: The err and stats of the targets are filled when the whole
+ * download ends, use the status to check the result of a target before.
+ * @param iter              Iterator
+ * @param status            Status of the target (as passed to its end
+ *                          callback) or NULL
+ * @param err               GError **
+ * @return                  Finished target or NULL if all targets were
+ *                          returned. If lr_download_packages() failed,
+ *                          err is set.
+ */
+LrPackageTarget *
+lr_packagedownloaditer_next(LrPackageDownloadIter *iter,
+                            LrTransferStatus *status,
+                            GError **err);
+
+/** Wait for the end of the download and free the iterator.
+ * Use lr_handle_cancel() on the handles of the targets to stop
+ * the download early.
+ * @param iter              Iterator or NULL
+ */
+void
+lr_packagedownloaditer_free(LrPackageDownloadIter *iter);
+
 typedef enum {
     LR_PACKAGECHECK_FAILFAST    = 1 << 0, /*!<
         If TRUE, then whole check is stoped immediately when any
@@ -0,0 +1,268 @@
+/* librepo - A library providing (libcURL like) API to downloading repository
+ * Copyright (C) 2014  Tomas Mlcoch
+ *
+ * Licensed under the GNU Lesser General Public License Version 2.1
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#define _XOPEN_SOURCE   700 // Because of futimens() and st_atim
+
+#include <glib.h>
+#include <glib/gstdio.h>
+#include <errno.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/ioctl.h>
+#ifdef __linux__
+#include <linux/fs.h>   // Because of FICLONE
+#endif
+
+#include "util.h"
+#include "checksum.h"
+#include "packagestore.h"
+#include "cleanup.h"
+
+/** Path of the package with the checksum in the store or NULL if the
+ * checksum is not usable as a file name.
+ */
+static gchar *
+entry_path(const char *dir, LrChecksumType type, const char *checksum)
+{
+    _cleanup_free_ gchar *name = NULL;
+    gchar prefix[3];
+
+    if (type == LR_CHECKSUM_UNKNOWN || !checksum || strlen(checksum) < 2)
+        return NULL;
+
+    for (const char *c = checksum; *c; c++)
+        if (!g_ascii_isxdigit(*c))
+            return NULL;
+
+    name = g_ascii_strdown(checksum, -1);
+    g_strlcpy(prefix, name, sizeof(prefix));
+    return lr_pathconcat(dir, lr_checksum_type_to_str(type), prefix, name, NULL);
+}
+
+/** Replace the dst by a file with the content of the src. A reflink
+ * is tried first (the files share the data, but not the modifications),
+ * then a hardlink and then a copy.
+ */
+static gboolean
+file_clone(const char *src, const char *dst)
+{
+    _cleanup_free_ gchar *tmp_path = g_strconcat(dst, ".XXXXXX", NULL);
+    struct stat st;
+    int src_fd, fd;
+    int rc = -1;
+
+    src_fd = open(src, O_RDONLY);
+    if (src_fd == -1)
+        return FALSE;
+
+    fd = (fstat(src_fd, &st) == 0) ? g_mkstemp(tmp_path) : -1;
+    if (fd == -1) {
+        g_debug("%s: Cannot create %s: %s", __func__, tmp_path, strerror(errno));
+        close(src_fd);
+        return FALSE;
+    }
+
+#ifdef FICLONE
+    rc = ioctl(fd, FICLONE, src_fd);
+#endif
+    if (rc == -1) {
+        close(fd);
+        fd = -1;
+        unlink(tmp_path);
+        rc = link(src, tmp_path);
+    }
+    if (rc == -1) {
+        fd = open(tmp_path, O_WRONLY|O_CREAT|O_EXCL, st.st_mode & 0777);
+        rc = (fd == -1) ? -1 : lr_copy_content(src_fd, fd);
+    }
+    // The mkstemp() creates the file with 0600
+    if (rc == 0 && fd != -1)
+        rc = fchmod(fd, st.st_mode & 0777);
+
+    if (fd != -1)
+        close(fd);
+    close(src_fd);
+
+    if (rc == -1 || rename(tmp_path, dst) == -1) {
+        g_debug("%s: Cannot clone %s to %s: %s", __func__, src, dst,
+                strerror(errno));
+        unlink(tmp_path);
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+/** Check the stored file and mark it as used now.
+ * A file which doesn't match its checksum is removed.
+ */
+static gboolean
+entry_use(const char *path, LrChecksumType type, const char *checksum)
+{
+    struct timespec times[2] = {{ 0, UTIME_NOW }, { 0, UTIME_OMIT }};
+    GError *tmp_err = NULL;
+    gboolean matches = FALSE;
+    int fd;
+
+    fd = open(path, O_RDONLY);
+    if (fd == -1)
+        return FALSE;
+
+    if (!lr_checksum_fd_cmp(type, fd, checksum, TRUE, &matches, &tmp_err)) {
+        g_debug("%s: Cannot check %s: %s", __func__, path, tmp_err->message);
+        g_error_free(tmp_err);
+    } else if (!matches) {
+        g_debug("%s: %s doesn't match its checksum, removing", __func__, path);
+        unlink(path);
+    } else if (futimens(fd, times) == -1) {
+        // Only the order of the eviction is affected
+        g_debug("%s: Cannot set atime of %s: %s", __func__, path,
+                strerror(errno));
+    }
+
+    close(fd);
+    return matches;
+}
+
+gboolean
+lr_packagestore_get(const char *dir,
+                    LrChecksumType type,
+                    const char *checksum,
+                    const char *dest)
+{
+    _cleanup_free_ gchar *path = entry_path(dir, type, checksum);
+
+    if (!path || !entry_use(path, type, checksum))
+        return FALSE;
+
+    if (!file_clone(path, dest))
+        return FALSE;
+
+    g_debug("%s: %s taken from the store", __func__, dest);
+    return TRUE;
+}
+
+void
+lr_packagestore_put(const char *dir,
+                    LrChecksumType type,
+                    const char *checksum,
+                    const char *path)
+{
+    _cleanup_free_ gchar *entry = entry_path(dir, type, checksum);
+    _cleanup_free_ gchar *entry_dir = NULL;
+
+    if (!entry)
+        return;
+
+    if (entry_use(entry, type, checksum))
+        return;  // Already stored
+
+    entry_dir = g_path_get_dirname(entry);
+    if (g_mkdir_with_parents(entry_dir, 0755) == -1) {
+        g_debug("%s: Cannot create %s: %s", __func__, entry_dir,
+                strerror(errno));
+        return;
+    }
+
+    if (file_clone(path, entry))
+        g_debug("%s: %s stored as %s", __func__, path, entry);
+}
+
+/** File of the store considered for the eviction */
+typedef struct {
+    gchar *path;
+    gint64 size;
+    gint64 atime;
+} LrPackageStoreFile;
+
+static gint
+file_cmp_atime(gconstpointer a, gconstpointer b)
+{
+    const LrPackageStoreFile *fa = a, *fb = b;
+    if (fa->atime != fb->atime)
+        return (fa->atime < fb->atime) ? -1 : 1;
+    return 0;
+}
+
+/** Append the regular files of the dir (depth levels deep) to files.
+ */
+static void
+collect_files(const char *dir, int depth, GArray *files, gint64 *total)
+{
+    const gchar *name;
+    GDir *gdir = g_dir_open(dir, 0, NULL);
+    if (!gdir)
+        return;
+
+    while ((name = g_dir_read_name(gdir))) {
+        gchar *path = g_build_filename(dir, name, NULL);
+        struct stat st;
+
+        if (lstat(path, &st) == -1) {
+            g_free(path);
+            continue;
+        }
+
+        if (depth > 0 && S_ISDIR(st.st_mode)) {
+            collect_files(path, depth - 1, files, total);
+            g_free(path);
+        } else if (depth == 0 && S_ISREG(st.st_mode)) {
+            LrPackageStoreFile file = { path, (gint64) st.st_size,
+                                        (gint64) st.st_atim.tv_sec };
+            g_array_append_val(files, file);
+            *total += file.size;
+        } else {
+            g_free(path);
+        }
+    }
+
+    g_dir_close(gdir);
+}
+
+void
+lr_packagestore_evict(const char *dir, gint64 maxsize)
+{
+    GArray *files;
+    gint64 total = 0;
+
+    if (maxsize <= 0)
+        return;
+
+    files = g_array_new(FALSE, FALSE, sizeof(LrPackageStoreFile));
+    collect_files(dir, 2, files, &total);
+
+    if (total > maxsize) {
+        g_array_sort(files, file_cmp_atime);
+        for (guint i = 0; i < files->len && total > maxsize; i++) {
+            LrPackageStoreFile *file = &g_array_index(files, LrPackageStoreFile, i);
+            if (unlink(file->path) == 0) {
+                g_debug("%s: Evicted %s", __func__, file->path);
+                total -= file->size;
+            }
+        }
+    }
+
+    for (guint i = 0; i < files->len; i++)
+        g_free(g_array_index(files, LrPackageStoreFile, i).path);
+    g_array_free(files, TRUE);
+}
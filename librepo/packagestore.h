@@ -0,0 +1,80 @@
+/* librepo - A library providing (libcURL like) API to downloading repository
+ * Copyright (C) 2014  Tomas Mlcoch
+ *
+ * Licensed under the GNU Lesser General Public License Version 2.1
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#ifndef __LR_PACKAGESTORE_H__
+#define __LR_PACKAGESTORE_H__
+
+#include <glib.h>
+
+#include "handle.h"
+#include "checksum.h"
+
+G_BEGIN_DECLS
+
+/** Content-addressed store of the downloaded packages (see
+ * LRO_PACKAGESTORE). A package is stored as
+ * "<store>/<checksum type>/<first two digits>/<checksum>", so the same
+ * package from different repositories or for different destinations
+ * is downloaded only once. Files are put to and taken from the store by
+ * a reflink if the filesystem supports it, by a hardlink otherwise and
+ * by a copy as the last resort. The checksum of a stored file is
+ * verified (with the xattr cache) before every use, a file modified
+ * through a hardlink is removed from the store. The time of the last
+ * use is the access time of the file, the least recently used files
+ * are evicted when the store is bigger than LRO_PACKAGESTOREMAXSIZE.
+ * Errors are only logged, the store is just an optimization.
+ */
+
+/** Materialize the package with the checksum from the store to the dest.
+ * @param dir       Store directory
+ * @param type      Checksum type
+ * @param checksum  Checksum (hex)
+ * @param dest      Destination path, an existing file is replaced
+ * @return          TRUE if the package was in the store
+ */
+gboolean
+lr_packagestore_get(const char *dir,
+                    LrChecksumType type,
+                    const char *checksum,
+                    const char *dest);
+
+/** Put the downloaded package with the checksum to the store.
+ * @param dir       Store directory
+ * @param type      Checksum type
+ * @param checksum  Checksum (hex) of the file
+ * @param path      Path of the downloaded package
+ */
+void
+lr_packagestore_put(const char *dir,
+                    LrChecksumType type,
+                    const char *checksum,
+                    const char *path);
+
+/** Remove the least recently used packages until the size of the store
+ * is at most maxsize bytes.
+ * @param dir       Store directory
+ * @param maxsize   Maximal size in bytes, 0 means unlimited
+ */
+void
+lr_packagestore_evict(const char *dir, gint64 maxsize);
+
+G_END_DECLS
+
+#endif
@@ -0,0 +1,631 @@
+/* librepo - A library providing (libcURL like) API to downloading repository
+ * Copyright (C) 2014  Tomas Mlcoch
+ *
+ * Licensed under the GNU Lesser General Public License Version 2.1
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#define _XOPEN_SOURCE   700 // Because of st_mtim
+
+#include <glib.h>
+#include <glib/gstdio.h>
+#include <assert.h>
+#include <errno.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <zlib.h>
+
+#include "arena.h"
+#include "handle.h"
+#include "util.h"
+#include "parsecache.h"
+
+#define PARSECACHE_MAGIC        "LRPC"
+#define PARSECACHE_VERSION      2
+#define PARSECACHE_NULL         G_MAXUINT32
+
+typedef enum {
+    LR_PARSECACHE_REPOMD = 1,
+    LR_PARSECACHE_METALINK,
+} LrParseCacheKind;
+
+/** Header of the cache file. Followed by the payload.
+ */
+typedef struct {
+    char magic[4];          /*!< PARSECACHE_MAGIC */
+    guint32 version;        /*!< PARSECACHE_VERSION */
+    guint32 kind;           /*!< LrParseCacheKind */
+    guint32 crc;            /*!< CRC32 of the payload */
+    guint64 payload_len;    /*!< Length of the payload */
+    guint64 xml_size;       /*!< Size of the XML file */
+    gint64 xml_mtime_sec;   /*!< Mtime of the XML file */
+    gint64 xml_mtime_nsec;
+    guint64 xml_ino;        /*!< Inode of the XML file */
+} LrParseCacheHeader;
+
+/** Reader of the payload. All reads are bounds checked, after the first
+ * failed read the reader is marked as bad and returns only zeros and NULLs.
+ */
+typedef struct {
+    const char *data;
+    gsize len;
+    gsize pos;
+    gboolean bad;
+} LrParseCacheReader;
+
+static char *
+cache_path(const char *path)
+{
+    return g_strconcat(path, LR_PARSECACHE_SUFFIX, NULL);
+}
+
+static void
+header_init(LrParseCacheHeader *hdr, LrParseCacheKind kind, struct stat *st)
+{
+    memset(hdr, 0, sizeof(*hdr));
+    memcpy(hdr->magic, PARSECACHE_MAGIC, sizeof(hdr->magic));
+    hdr->version = PARSECACHE_VERSION;
+    hdr->kind = kind;
+    hdr->xml_size = (guint64) st->st_size;
+    hdr->xml_mtime_sec = (gint64) st->st_mtim.tv_sec;
+    hdr->xml_mtime_nsec = (gint64) st->st_mtim.tv_nsec;
+    hdr->xml_ino = (guint64) st->st_ino;
+}
+
+/* Writer */
+
+static void
+write_u32(GString *out, guint32 val)
+{
+    g_string_append_len(out, (const char *) &val, sizeof(val));
+}
+
+static void
+write_i64(GString *out, gint64 val)
+{
+    g_string_append_len(out, (const char *) &val, sizeof(val));
+}
+
+/** Write length, the string and its terminating zero,
+ * so the loaded strings could be used directly from the mapped file.
+ */
+static void
+write_str(GString *out, const char *str)
+{
+    if (!str) {
+        write_u32(out, PARSECACHE_NULL);
+        return;
+    }
+
+    size_t len = strlen(str);
+    write_u32(out, (guint32) len);
+    g_string_append_len(out, str, len + 1);
+}
+
+/** Write the payload with the header to a temporary file
+ * and rename it to the cache path.
+ */
+static void
+cache_write(const char *path, int fd, LrParseCacheKind kind, GString *payload)
+{
+    struct stat st;
+    LrParseCacheHeader hdr;
+    char *cachepath, *tmppath;
+    int cfd;
+    gboolean ok;
+
+    if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode))
+        return;
+
+    header_init(&hdr, kind, &st);
+    hdr.payload_len = payload->len;
+    hdr.crc = crc32(crc32(0L, Z_NULL, 0),
+                    (const Bytef *) payload->str,
+                    (uInt) payload->len);
+
+    cachepath = cache_path(path);
+    tmppath = g_strconcat(cachepath, ".XXXXXX", NULL);
+    cfd = g_mkstemp(tmppath);
+    if (cfd < 0) {
+        g_debug("%s: Cannot create %s: %s", __func__, tmppath, g_strerror(errno));
+        g_free(tmppath);
+        g_free(cachepath);
+        return;
+    }
+
+    ok = fchmod(cfd, 0644) == 0
+         && write(cfd, &hdr, sizeof(hdr)) == (ssize_t) sizeof(hdr)
+         && write(cfd, payload->str, payload->len) == (ssize_t) payload->len;
+    ok = (close(cfd) == 0) && ok;
+
+    if (ok && rename(tmppath, cachepath) == 0) {
+        g_debug("%s: Parse cache %s written", __func__, cachepath);
+    } else {
+        g_debug("%s: Cannot write %s: %s", __func__, cachepath, g_strerror(errno));
+        unlink(tmppath);
+    }
+
+    g_free(tmppath);
+    g_free(cachepath);
+}
+
+/* Reader */
+
+static gboolean
+read_raw(LrParseCacheReader *r, void *dst, gsize len)
+{
+    if (r->bad || r->len - r->pos < len) {
+        r->bad = TRUE;
+        memset(dst, 0, len);
+        return FALSE;
+    }
+
+    memcpy(dst, r->data + r->pos, len);
+    r->pos += len;
+    return TRUE;
+}
+
+static guint32
+read_u32(LrParseCacheReader *r)
+{
+    guint32 val;
+    read_raw(r, &val, sizeof(val));
+    return val;
+}
+
+static gint64
+read_i64(LrParseCacheReader *r)
+{
+    gint64 val;
+    read_raw(r, &val, sizeof(val));
+    return val;
+}
+
+static const char *
+read_str(LrParseCacheReader *r)
+{
+    const char *str;
+    guint32 len = read_u32(r);
+
+    if (r->bad || len == PARSECACHE_NULL)
+        return NULL;
+
+    if (r->len - r->pos <= len || r->data[r->pos + len] != '\0') {
+        r->bad = TRUE;
+        return NULL;
+    }
+
+    str = r->data + r->pos;
+    r->pos += (gsize) len + 1;
+    return str;
+}
+
+/** Read number of items of a list. Every item takes at least one byte,
+ * so a count higher than the rest of the payload is invalid.
+ */
+static guint32
+read_count(LrParseCacheReader *r)
+{
+    guint32 count = read_u32(r);
+
+    if (count > r->len - r->pos) {
+        r->bad = TRUE;
+        return 0;
+    }
+
+    return count;
+}
+
+/** Map the cache of the XML file and check it.
+ * @return      Mapped cache (to be freed by munmap()) or NULL
+ */
+static void *
+cache_map(const char *path,
+          int fd,
+          LrParseCacheKind kind,
+          const char *key,
+          gsize *map_len,
+          LrParseCacheReader *reader)
+{
+    struct stat st, cst;
+    LrParseCacheHeader hdr, expected;
+    char *cachepath;
+    void *map;
+    int cfd;
+
+    if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode))
+        return NULL;
+
+    cachepath = cache_path(path);
+    cfd = open(cachepath, O_RDONLY);
+    if (cfd < 0) {
+        g_free(cachepath);
+        return NULL;
+    }
+
+    if (fstat(cfd, &cst) != 0
+        || (gsize) cst.st_size < sizeof(hdr)
+        || (guint64) cst.st_size - sizeof(hdr) > G_MAXUINT32)
+    {
+        close(cfd);
+        g_free(cachepath);
+        return NULL;
+    }
+
+    map = mmap(NULL, cst.st_size, PROT_READ, MAP_PRIVATE, cfd, 0);
+    close(cfd);
+    if (map == MAP_FAILED) {
+        g_debug("%s: mmap(%s): %s", __func__, cachepath, g_strerror(errno));
+        g_free(cachepath);
+        return NULL;
+    }
+
+    memcpy(&hdr, map, sizeof(hdr));
+    header_init(&expected, kind, &st);
+    expected.crc = hdr.crc;
+    expected.payload_len = (guint64) cst.st_size - sizeof(hdr);
+
+    if (memcmp(&hdr, &expected, sizeof(hdr))) {
+        g_debug("%s: Parse cache %s is outdated", __func__, cachepath);
+        goto error;
+    }
+
+    reader->data = (const char *) map + sizeof(hdr);
+    reader->len = hdr.payload_len;
+    reader->pos = 0;
+    reader->bad = FALSE;
+
+    if (crc32(crc32(0L, Z_NULL, 0),
+              (const Bytef *) reader->data,
+              (uInt) reader->len) != hdr.crc)
+    {
+        g_debug("%s: Parse cache %s is corrupted", __func__, cachepath);
+        goto error;
+    }
+
+    if (g_strcmp0(read_str(reader), key)) {
+        g_debug("%s: Parse cache %s is for a different file", __func__, cachepath);
+        goto error;
+    }
+
+    g_free(cachepath);
+    *map_len = cst.st_size;
+    return map;
+
+error:
+    munmap(map, cst.st_size);
+    g_free(cachepath);
+    return NULL;
+}
+
+/* Repomd */
+
+static void
+write_str_list(GString *out, GSList *list)
+{
+    write_u32(out, g_slist_length(list));
+    for (GSList *elem = list; elem; elem = g_slist_next(elem))
+        write_str(out, elem->data);
+}
+
+void
+lr_parsecache_store_repomd(LrYumRepoMd *repomd, const char *path, int fd)
+{
+    GString *out = g_string_sized_new(4096);
+
+    assert(repomd);
+    assert(path);
+
+    write_str(out, "");
+    write_str(out, repomd->revision);
+    write_str(out, repomd->repoid);
+    write_str(out, repomd->repoid_type);
+    write_str_list(out, repomd->repo_tags);
+    write_str_list(out, repomd->content_tags);
+
+    write_u32(out, g_slist_length(repomd->distro_tags));
+    for (GSList *elem = repomd->distro_tags; elem; elem = g_slist_next(elem)) {
+        LrYumDistroTag *distrotag = elem->data;
+        write_str(out, distrotag->cpeid);
+        write_str(out, distrotag->tag);
+    }
+
+    write_u32(out, g_slist_length(repomd->records));
+    for (GSList *elem = repomd->records; elem; elem = g_slist_next(elem)) {
+        LrYumRepoMdRecord *record = elem->data;
+        write_str(out, record->type);
+        write_str(out, record->location_href);
+        write_str(out, record->location_base);
+        write_str(out, record->checksum);
+        write_str(out, record->checksum_type);
+        write_str(out, record->checksum_open);
+        write_str(out, record->checksum_open_type);
+        write_i64(out, record->timestamp);
+        write_i64(out, record->size);
+        write_i64(out, record->size_open);
+        write_i64(out, record->db_version);
+        write_str(out, record->header_checksum);
+        write_str(out, record->header_checksum_type);
+        write_i64(out, record->size_header);
+    }
+
+    cache_write(path, fd, LR_PARSECACHE_REPOMD, out);
+    g_string_free(out, TRUE);
+}
+
+static GSList *
+read_str_list(LrParseCacheReader *r, LrArena *arena, GStringChunk *chunk)
+{
+    GSList *list = NULL;
+    guint32 count = read_count(r);
+
+    for (guint32 x = 0; x < count && !r->bad; x++)
+        list = lr_arena_slist_prepend(arena, list,
+                    lr_string_chunk_insert(chunk, read_str(r)));
+
+    return g_slist_reverse(list);
+}
+
+static gboolean
+read_repomd(LrParseCacheReader *r, LrYumRepoMd *repomd)
+{
+    guint32 count;
+
+    repomd->revision = lr_string_chunk_insert(repomd->chunk, read_str(r));
+    repomd->repoid = lr_string_chunk_insert(repomd->chunk, read_str(r));
+    repomd->repoid_type = lr_string_chunk_insert(repomd->chunk, read_str(r));
+    repomd->repo_tags = read_str_list(r, repomd->arena, repomd->chunk);
+    repomd->content_tags = read_str_list(r, repomd->arena, repomd->chunk);
+
+    count = read_count(r);
+    for (guint32 x = 0; x < count && !r->bad; x++) {
+        LrYumDistroTag *distrotag = lr_arena_new0(repomd->arena, LrYumDistroTag);
+        distrotag->cpeid = lr_string_chunk_insert(repomd->chunk, read_str(r));
+        distrotag->tag = lr_string_chunk_insert(repomd->chunk, read_str(r));
+        repomd->distro_tags = lr_arena_slist_prepend(repomd->arena,
+                                                     repomd->distro_tags,
+                                                     distrotag);
+    }
+    repomd->distro_tags = g_slist_reverse(repomd->distro_tags);
+
+    count = read_count(r);
+    for (guint32 x = 0; x < count && !r->bad; x++) {
+        LrYumRepoMdRecord *record = lr_arena_new0(repomd->arena,
+                                                  LrYumRepoMdRecord);
+        record->chunk = repomd->chunk;
+        record->type = lr_string_chunk_insert(record->chunk, read_str(r));
+        record->location_href = lr_string_chunk_insert(record->chunk, read_str(r));
+        record->location_base = lr_string_chunk_insert(record->chunk, read_str(r));
+        record->checksum = lr_string_chunk_insert(record->chunk, read_str(r));
+        record->checksum_type = lr_string_chunk_insert(record->chunk, read_str(r));
+        record->checksum_open = lr_string_chunk_insert(record->chunk, read_str(r));
+        record->checksum_open_type = lr_string_chunk_insert(record->chunk, read_str(r));
+        record->timestamp = read_i64(r);
+        record->size = read_i64(r);
+        record->size_open = read_i64(r);
+        record->db_version = (int) read_i64(r);
+        record->header_checksum = lr_string_chunk_insert(record->chunk, read_str(r));
+        record->header_checksum_type = lr_string_chunk_insert(record->chunk, read_str(r));
+        record->size_header = read_i64(r);
+        repomd->records = lr_arena_slist_prepend(repomd->arena,
+                                                 repomd->records,
+                                                 record);
+    }
+    repomd->records = g_slist_reverse(repomd->records);
+
+    // Index the first record of every type, as the parser does
+    for (GSList *elem = repomd->records; elem && !r->bad; elem = g_slist_next(elem)) {
+        LrYumRepoMdRecord *record = elem->data;
+        if (record->type
+            && !g_hash_table_lookup(repomd->record_index, record->type))
+            g_hash_table_insert(repomd->record_index, record->type, record);
+    }
+
+    return !r->bad && r->pos == r->len;
+}
+
+gboolean
+lr_parsecache_load_repomd(LrYumRepoMd *repomd, const char *path, int fd)
+{
+    LrParseCacheReader reader;
+    LrYumRepoMd *tmp, swap;
+    gboolean ret;
+    gsize map_len;
+    void *map;
+
+    assert(repomd);
+    assert(path);
+
+    map = cache_map(path, fd, LR_PARSECACHE_REPOMD, "", &map_len, &reader);
+    if (!map)
+        return FALSE;
+
+    // Load to a temporary object, so the repomd is unchanged on error
+    tmp = lr_yum_repomd_init();
+    ret = read_repomd(&reader, tmp);
+    munmap(map, map_len);
+
+    if (ret) {
+        g_debug("%s: Repomd loaded from the parse cache", __func__);
+        swap = *repomd;
+        *repomd = *tmp;
+        *tmp = swap;
+    } else {
+        g_debug("%s: Invalid parse cache of %s", __func__, path);
+    }
+
+    lr_yum_repomd_free(tmp);
+    return ret;
+}
+
+/* Metalink */
+
+static void
+write_hashes(GString *out, GSList *hashes)
+{
+    write_u32(out, g_slist_length(hashes));
+    for (GSList *elem = hashes; elem; elem = g_slist_next(elem)) {
+        LrMetalinkHash *hash = elem->data;
+        write_str(out, hash->type);
+        write_str(out, hash->value);
+    }
+}
+
+void
+lr_parsecache_store_metalink(LrMetalink *metalink,
+                             const char *filename,
+                             unsigned int maxurls,
+                             const char *path,
+                             int fd)
+{
+    GString *out = g_string_sized_new(16384);
+
+    assert(metalink);
+    assert(filename);
+    assert(path);
+
+    write_str(out, filename);
+    write_u32(out, maxurls);
+    write_str(out, metalink->filename);
+    write_i64(out, metalink->timestamp);
+    write_i64(out, metalink->size);
+    write_hashes(out, metalink->hashes);
+
+    write_u32(out, g_slist_length(metalink->urls));
+    for (GSList *elem = metalink->urls; elem; elem = g_slist_next(elem)) {
+        LrMetalinkUrl *url = elem->data;
+        write_str(out, url->protocol);
+        write_str(out, url->type);
+        write_str(out, url->location);
+        write_i64(out, url->preference);
+        write_str(out, url->url);
+    }
+
+    write_u32(out, g_slist_length(metalink->alternates));
+    for (GSList *elem = metalink->alternates; elem; elem = g_slist_next(elem)) {
+        LrMetalinkAlternate *alternate = elem->data;
+        write_i64(out, alternate->timestamp);
+        write_i64(out, alternate->size);
+        write_hashes(out, alternate->hashes);
+    }
+
+    cache_write(path, fd, LR_PARSECACHE_METALINK, out);
+    g_string_free(out, TRUE);
+}
+
+static GSList *
+read_hashes(LrParseCacheReader *r, LrArena *arena)
+{
+    GSList *list = NULL;
+    guint32 count = read_count(r);
+
+    for (guint32 x = 0; x < count && !r->bad; x++) {
+        LrMetalinkHash *hash = lr_arena_new0(arena, LrMetalinkHash);
+        hash->type = lr_arena_strdup(arena, read_str(r));
+        hash->value = lr_arena_strdup(arena, read_str(r));
+        list = lr_arena_slist_prepend(arena, list, hash);
+    }
+
+    return g_slist_reverse(list);
+}
+
+static gboolean
+read_metalink(LrParseCacheReader *r, LrMetalink *metalink, guint32 maxurls)
+{
+    LrArena *arena = metalink->arena;
+    guint32 count;
+
+    if (read_u32(r) != maxurls) {
+        g_debug("%s: Parse cache was written with a different URL limit",
+                __func__);
+        return FALSE;
+    }
+
+    metalink->filename = lr_arena_strdup(arena, read_str(r));
+    metalink->timestamp = read_i64(r);
+    metalink->size = read_i64(r);
+    metalink->hashes = read_hashes(r, arena);
+
+    count = read_count(r);
+    for (guint32 x = 0; x < count && !r->bad; x++) {
+        LrMetalinkUrl *url = lr_arena_new0(arena, LrMetalinkUrl);
+        url->protocol = lr_arena_strdup(arena, read_str(r));
+        url->type = lr_arena_strdup(arena, read_str(r));
+        url->location = lr_arena_strdup(arena, read_str(r));
+        url->preference = (int) read_i64(r);
+        url->url = lr_arena_strdup(arena, read_str(r));
+        metalink->urls = lr_arena_slist_prepend(arena, metalink->urls, url);
+    }
+    metalink->urls = g_slist_reverse(metalink->urls);
+
+    count = read_count(r);
+    for (guint32 x = 0; x < count && !r->bad; x++) {
+        LrMetalinkAlternate *alternate = lr_arena_new0(arena, LrMetalinkAlternate);
+        alternate->timestamp = read_i64(r);
+        alternate->size = read_i64(r);
+        alternate->hashes = read_hashes(r, arena);
+        metalink->alternates = lr_arena_slist_prepend(arena,
+                                                      metalink->alternates,
+                                                      alternate);
+    }
+    metalink->alternates = g_slist_reverse(metalink->alternates);
+
+    return !r->bad && r->pos == r->len;
+}
+
+gboolean
+lr_parsecache_load_metalink(LrMetalink *metalink,
+                            const char *filename,
+                            unsigned int maxurls,
+                            const char *path,
+                            int fd)
+{
+    LrParseCacheReader reader;
+    LrMetalink *tmp, swap;
+    gboolean ret;
+    gsize map_len;
+    void *map;
+
+    assert(metalink);
+    assert(filename);
+    assert(path);
+
+    map = cache_map(path, fd, LR_PARSECACHE_METALINK, filename,
+                    &map_len, &reader);
+    if (!map)
+        return FALSE;
+
+    // Load to a temporary object, so the metalink is unchanged on error
+    tmp = lr_metalink_init();
+    ret = read_metalink(&reader, tmp, maxurls);
+    munmap(map, map_len);
+
+    if (ret) {
+        g_debug("%s: Metalink loaded from the parse cache", __func__);
+        swap = *metalink;
+        *metalink = *tmp;
+        *tmp = swap;
+    } else {
+        g_debug("%s: Invalid parse cache of %s", __func__, path);
+    }
+
+    lr_metalink_free(tmp);
+    return ret;
+}
@@ -0,0 +1,94 @@
+/* librepo - A library providing (libcURL like) API to downloading repository
+ * Copyright (C) 2014  Tomas Mlcoch
+ *
+ * Licensed under the GNU Lesser General Public License Version 2.1
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#ifndef __LR_PARSECACHE_H__
+#define __LR_PARSECACHE_H__
+
+#include <glib.h>
+
+#include "metalink.h"
+#include "repomd.h"
+
+G_BEGIN_DECLS
+
+/** Binary cache of parsed repomd.xml and metalink.xml (see LRO_PARSECACHE).
+ * The parsed object is serialized to the "<xml path>LR_PARSECACHE_SUFFIX"
+ * file. The cache is valid only as long as the size, mtime and inode of
+ * the XML file are the same as when the cache was written. The content
+ * of the cache is protected by a CRC32, the whole cache is loaded by
+ * a single mmap().
+ *
+ * The cache uses the native byte order, a cache written on a machine
+ * with a different byte order is refused as a cache of unknown version.
+ */
+
+/** Load the repomd from the cache of the XML file.
+ * @param repomd    Empty repomd object (from lr_yum_repomd_init())
+ * @param path      Path to the repomd.xml
+ * @param fd        Opened file descriptor of the repomd.xml
+ * @return          TRUE if the repomd was loaded, FALSE if there is
+ *                  no valid cache (the repomd is unchanged).
+ */
+gboolean
+lr_parsecache_load_repomd(LrYumRepoMd *repomd, const char *path, int fd);
+
+/** Write cache of the repomd parsed from the XML file.
+ * Errors are silently ignored (e.g. when the directory is not writable).
+ * @param repomd    Repomd object parsed from the file
+ * @param path      Path to the repomd.xml
+ * @param fd        Opened file descriptor of the repomd.xml
+ */
+void
+lr_parsecache_store_repomd(LrYumRepoMd *repomd, const char *path, int fd);
+
+/** Load the metalink from the cache of the XML file.
+ * @param metalink  Empty metalink object (from lr_metalink_init())
+ * @param filename  File which was looked for in the metalink
+ * @param maxurls   Max number of URLs the metalink was parsed with
+ * @param path      Path to the metalink.xml
+ * @param fd        Opened file descriptor of the metalink.xml
+ * @return          TRUE if the metalink was loaded, FALSE if there is
+ *                  no valid cache (the metalink is unchanged).
+ */
+gboolean
+lr_parsecache_load_metalink(LrMetalink *metalink,
+                            const char *filename,
+                            unsigned int maxurls,
+                            const char *path,
+                            int fd);
+
+/** Write cache of the metalink parsed from the XML file.
+ * Errors are silently ignored (e.g. when the directory is not writable).
+ * @param metalink  Metalink object parsed from the file
+ * @param filename  File which was looked for in the metalink
+ * @param maxurls   Max number of URLs the metalink was parsed with
+ * @param path      Path to the metalink.xml
+ * @param fd        Opened file descriptor of the metalink.xml
+ */
+void
+lr_parsecache_store_metalink(LrMetalink *metalink,
+                             const char *filename,
+                             unsigned int maxurls,
+                             const char *path,
+                             int fd);
+
+G_END_DECLS
+
+#endif
@@ -0,0 +1,506 @@
+/* librepo - A library providing (libcURL like) API to downloading repository
+ * Copyright (C) 2014  Tomas Mlcoch
+ *
+ * Licensed under the GNU Lesser General Public License Version 2.1
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#define _POSIX_C_SOURCE 200112L // Because of getaddrinfo()
+
+#include <glib.h>
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <netdb.h>
+#include <curl/curl.h>
+
+#include "handle_internal.h"
+#include "lrmirrorlist.h"
+#include "util.h"
+#include "preresolve.h"
+#include "cleanup.h"
+
+#define LR_PRERESOLVE_TIMEOUT   10  // Max wait for the lookups in seconds
+#define LR_PRERESOLVE_THREADS   16  // Max number of concurrent lookups
+
+#define CACHE_ADDRESSES         "addresses"
+#define CACHE_RESOLVED          "resolved"
+
+/** Lookup of a host. Once pushed to the thread pool, the job is owned
+ * by the pool and then by the finished queue, so a lookup which didn't
+ * finish in time doesn't have to be waited for.
+ */
+typedef struct {
+    gchar *host;            /*!< Host name */
+    gchar *key;             /*!< "host:port" */
+    int family;             /*!< AF_UNSPEC, AF_INET or AF_INET6 */
+    gint64 deadline;        /*!< Monotonic time, not started lookups
+                                 are skipped after it */
+    GPtrArray *addresses;   /*!< Resolved addresses (gchar *) or NULL */
+    GAsyncQueue *finished;  /*!< Queue of the finished jobs */
+} LrResolveJob;
+
+static void
+lr_resolve_job_free(gpointer data)
+{
+    LrResolveJob *job = data;
+
+    if (!job)
+        return;
+
+    g_free(job->host);
+    g_free(job->key);
+    if (job->addresses)
+        g_ptr_array_free(job->addresses, TRUE);
+    if (job->finished)
+        g_async_queue_unref(job->finished);
+    lr_free(job);
+}
+
+/** Get the host name and the port from the URL without path
+ * (LrInternalMirror.host).
+ * @return          FALSE if there is nothing to resolve
+ */
+static gboolean
+lr_preresolve_parse_host(const char *url, gchar **host, long *port)
+{
+    long default_port;
+
+    if (g_str_has_prefix(url, "https://"))
+        default_port = 443;
+    else if (g_str_has_prefix(url, "http://"))
+        default_port = 80;
+    else if (g_str_has_prefix(url, "ftp://"))
+        default_port = 21;
+    else
+        return FALSE;  // Local files, rsync, ...
+
+    const char *str = strstr(url, "://") + 3;
+
+    // Skip user and password
+    const char *at = strrchr(str, '@');
+    if (at)
+        str = at + 1;
+
+    if (*str == '[')
+        return FALSE;  // IPv6 address
+
+    const char *colon = strchr(str, ':');
+    gsize len = colon ? (gsize) (colon - str) : strlen(str);
+    if (!len)
+        return FALSE;
+
+    *port = default_port;
+    if (colon) {
+        char *end;
+        *port = strtol(colon + 1, &end, 10);
+        if (*end != '\0' || *port <= 0 || *port > 65535)
+            return FALSE;
+    }
+
+    *host = g_strndup(str, len);
+    if (g_hostname_is_ip_address(*host)) {
+        g_free(*host);
+        *host = NULL;
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+static void
+lr_preresolve_worker(gpointer data, G_GNUC_UNUSED gpointer user_data)
+{
+    LrResolveJob *job = data;
+    GAsyncQueue *finished = job->finished;
+
+    if (g_get_monotonic_time() < job->deadline) {
+        struct addrinfo hints, *res = NULL;
+
+        memset(&hints, 0, sizeof(hints));
+        hints.ai_family = job->family;
+        hints.ai_socktype = SOCK_STREAM;
+
+        int rc = getaddrinfo(job->host, NULL, &hints, &res);
+        if (rc != 0) {
+            g_debug("%s: Cannot resolve %s: %s", __func__, job->host,
+                    gai_strerror(rc));
+        } else {
+            job->addresses = g_ptr_array_new_with_free_func(g_free);
+            for (struct addrinfo *ai = res; ai; ai = ai->ai_next) {
+                char buf[INET6_ADDRSTRLEN];
+                const void *addr;
+
+                if (ai->ai_family == AF_INET)
+                    addr = &((struct sockaddr_in *) ai->ai_addr)->sin_addr;
+                else if (ai->ai_family == AF_INET6)
+                    addr = &((struct sockaddr_in6 *) ai->ai_addr)->sin6_addr;
+                else
+                    continue;
+
+                if (!inet_ntop(ai->ai_family, addr, buf, sizeof(buf)))
+                    continue;
+
+                // getaddrinfo() returns an address for every socket type
+                gboolean present = FALSE;
+                for (guint i = 0; i < job->addresses->len && !present; i++)
+                    present = !strcmp(g_ptr_array_index(job->addresses, i), buf);
+                if (!present)
+                    g_ptr_array_add(job->addresses, g_strdup(buf));
+            }
+            freeaddrinfo(res);
+        }
+    }
+
+    // The job belongs to the queue now
+    job->finished = NULL;
+    g_async_queue_push(finished, job);
+    g_async_queue_unref(finished);
+}
+
+/** Run the lookups concurrently until they finish or the deadline
+ * passes. The jobs are not owned by the caller anymore.
+ * @return          Array of the finished jobs
+ */
+static GPtrArray *
+lr_preresolve_run(GPtrArray *jobs, gint64 deadline)
+{
+    GPtrArray *done = g_ptr_array_new_with_free_func(lr_resolve_job_free);
+    GError *tmp_err = NULL;
+
+    if (!jobs->len)
+        return done;
+
+    guint threads = MIN(jobs->len, LR_PRERESOLVE_THREADS);
+    GThreadPool *pool = g_thread_pool_new(lr_preresolve_worker, NULL,
+                                          (gint) threads, FALSE, &tmp_err);
+    if (!pool) {
+        g_debug("%s: Cannot create thread pool: %s", __func__,
+                tmp_err->message);
+        g_error_free(tmp_err);
+        for (guint i = 0; i < jobs->len; i++)
+            lr_resolve_job_free(g_ptr_array_index(jobs, i));
+        return done;
+    }
+
+    g_debug("%s: Resolving %u hosts by %u threads", __func__,
+            jobs->len, threads);
+
+    GAsyncQueue *finished = g_async_queue_new_full(lr_resolve_job_free);
+    for (guint i = 0; i < jobs->len; i++) {
+        LrResolveJob *job = g_ptr_array_index(jobs, i);
+        job->finished = g_async_queue_ref(finished);
+        g_thread_pool_push(pool, job, NULL);
+    }
+
+    for (guint i = 0; i < jobs->len; i++) {
+        gint64 timeout = deadline - g_get_monotonic_time();
+        LrResolveJob *job = NULL;
+        if (timeout > 0)
+            job = g_async_queue_timeout_pop(finished, (guint64) timeout);
+        if (!job) {
+            g_debug("%s: Timeout, %u hosts are left to curl",
+                    __func__, jobs->len - i);
+            break;
+        }
+        g_ptr_array_add(done, job);
+    }
+
+    // Don't wait for the lookups which are still running,
+    // the jobs which weren't started are skipped
+    g_thread_pool_free(pool, FALSE, FALSE);
+    g_async_queue_unref(finished);
+
+    return done;
+}
+
+/** Address family of the lookups by LRO_IPRESOLVE of the handle.
+ */
+static int
+lr_preresolve_family(LrHandle *handle)
+{
+    if (handle && handle->ipresolve == LR_IPRESOLVE_V4)
+        return AF_INET;
+    if (handle && handle->ipresolve == LR_IPRESOLVE_V6)
+        return AF_INET6;
+    return AF_UNSPEC;
+}
+
+/** Append "host:port:addr[,addr]..." for CURLOPT_RESOLVE.
+ */
+static struct curl_slist *
+lr_preresolve_append(struct curl_slist *list,
+                     const char *key,
+                     gchar **addresses,
+                     guint count)
+{
+    GString *entry = g_string_new(NULL);
+    guint used = 0;
+
+#if LR_CURL_VERSION_CHECK(7, 75, 0)
+    // The entry times out in the DNS cache as a resolved one
+    g_string_append_c(entry, '+');
+#endif
+    g_string_append_printf(entry, "%s:", key);
+
+    for (guint i = 0; i < count; i++) {
+        const char *addr = addresses[i];
+#if LR_CURL_VERSION_CHECK(7, 59, 0)
+        if (used)
+            g_string_append_c(entry, ',');
+        if (strchr(addr, ':'))
+            g_string_append_printf(entry, "[%s]", addr);
+        else
+            g_string_append(entry, addr);
+        used++;
+#else
+        // Only a single IPv4 address is supported
+        if (strchr(addr, ':'))
+            continue;
+        g_string_append(entry, addr);
+        used++;
+        break;
+#endif
+    }
+
+    if (used) {
+        g_debug("%s: %s", __func__, entry->str);
+        list = curl_slist_append(list, entry->str);
+    }
+
+    g_string_free(entry, TRUE);
+    return list;
+}
+
+void
+lr_preresolve_hosts(LrHandle *handle)
+{
+    assert(handle);
+
+    if (!handle->preresolve || handle->proxy || handle->proxypool)
+        return;
+
+    int family = lr_preresolve_family(handle);
+    gint64 now = g_get_real_time() / G_USEC_PER_SEC;
+    gint64 deadline = g_get_monotonic_time()
+                      + LR_PRERESOLVE_TIMEOUT * G_USEC_PER_SEC;
+    GHashTable *keys = g_hash_table_new_full(g_str_hash, g_str_equal,
+                                             g_free, NULL);
+    GPtrArray *jobs = g_ptr_array_new();
+    struct curl_slist *resolve = NULL;
+
+    // Load the cache
+    GKeyFile *cache = NULL;
+    gboolean cache_changed = FALSE;
+    if (handle->preresolvecache) {
+        GError *tmp_err = NULL;
+        cache = g_key_file_new();
+        if (!g_key_file_load_from_file(cache, handle->preresolvecache,
+                                       G_KEY_FILE_NONE, &tmp_err)) {
+            g_debug("%s: Cache %s not loaded: %s", __func__,
+                    handle->preresolvecache, tmp_err->message);
+            g_clear_error(&tmp_err);
+        }
+    }
+
+    // Distinct hosts of the mirrors
+    for (LrInternalMirrorlist *elem = handle->internal_mirrorlist;
+         elem;
+         elem = g_slist_next(elem))
+    {
+        LrInternalMirror *mirror = elem->data;
+        gchar *host = NULL;
+        long port;
+
+        if (!lr_preresolve_parse_host(mirror->host, &host, &port))
+            continue;
+
+        gchar *key = g_strdup_printf("%s:%ld", host, port);
+        if (g_hash_table_contains(keys, key)) {
+            g_free(key);
+            g_free(host);
+            continue;
+        }
+        g_hash_table_add(keys, key);
+
+        // Fresh addresses from the cache
+        if (cache && g_key_file_has_group(cache, key)) {
+            gint64 resolved = g_key_file_get_int64(cache, key,
+                                                   CACHE_RESOLVED, NULL);
+            gsize count = 0;
+            gchar **addresses = g_key_file_get_string_list(cache, key,
+                                                           CACHE_ADDRESSES,
+                                                           &count, NULL);
+            gboolean fresh = addresses && count
+                             && now - resolved < handle->preresolvecachettl;
+            if (fresh)
+                resolve = lr_preresolve_append(resolve, key, addresses, count);
+            g_strfreev(addresses);
+            if (fresh) {
+                g_free(host);
+                continue;
+            }
+        }
+
+        LrResolveJob *job = lr_malloc0(sizeof(*job));
+        job->host = host;
+        job->key = g_strdup(key);
+        job->family = family;
+        job->deadline = deadline;
+        g_ptr_array_add(jobs, job);
+    }
+
+    GPtrArray *done = lr_preresolve_run(jobs, deadline);
+    for (guint i = 0; i < done->len; i++) {
+        LrResolveJob *job = g_ptr_array_index(done, i);
+
+        if (!job->addresses || !job->addresses->len)
+            continue;
+
+        gchar **addresses = (gchar **) job->addresses->pdata;
+        guint count = job->addresses->len;
+        resolve = lr_preresolve_append(resolve, job->key, addresses, count);
+        if (cache) {
+            g_key_file_remove_group(cache, job->key, NULL);
+            g_key_file_set_string_list(cache, job->key, CACHE_ADDRESSES,
+                                       (const gchar * const *) addresses,
+                                       count);
+            g_key_file_set_int64(cache, job->key, CACHE_RESOLVED, now);
+            cache_changed = TRUE;
+        }
+    }
+    g_ptr_array_free(done, TRUE);
+
+    // Store the cache
+    if (cache_changed) {
+        GError *tmp_err = NULL;
+        gsize len;
+        _cleanup_free_ gchar *data = g_key_file_to_data(cache, &len, NULL);
+        if (!g_file_set_contents(handle->preresolvecache, data, len, &tmp_err)) {
+            g_debug("%s: Cannot write %s: %s", __func__,
+                    handle->preresolvecache, tmp_err->message);
+            g_error_free(tmp_err);
+        }
+    }
+
+    if (cache)
+        g_key_file_free(cache);
+    g_ptr_array_free(jobs, TRUE);
+    g_hash_table_destroy(keys);
+
+    // Replace the addresses of the previous preparation
+    CURL *curl = lr_handle_curl(handle);
+    if (curl)
+        curl_easy_setopt(curl, CURLOPT_RESOLVE, resolve);
+    if (handle->resolve)
+        curl_slist_free_all(handle->resolve);
+    handle->resolve = resolve;
+}
+
+static gint
+cmp_addresses(gconstpointer a, gconstpointer b)
+{
+    return strcmp(*(const gchar * const *) a, *(const gchar * const *) b);
+}
+
+GHashTable *
+lr_preresolve_addresses(LrHandle *handle, GPtrArray *urls, guint timeout)
+{
+    GHashTable *result = g_hash_table_new_full(g_str_hash, g_str_equal,
+                                               g_free,
+                                               (GDestroyNotify) g_strfreev);
+
+    if (handle && (handle->proxy || handle->proxypool))
+        return result;  // The addresses of the mirrors are not used
+
+    int family = lr_preresolve_family(handle);
+    gint64 deadline = g_get_monotonic_time()
+                      + (gint64) timeout * G_USEC_PER_SEC;
+    GHashTable *names = g_hash_table_new_full(g_str_hash, g_str_equal,
+                                              g_free, NULL);
+    GPtrArray *jobs = g_ptr_array_new();
+
+    // Every host name is resolved once, whatever the scheme and port
+    for (guint i = 0; i < urls->len; i++) {
+        gchar *host = NULL;
+        long port;
+
+        if (!lr_preresolve_parse_host(g_ptr_array_index(urls, i), &host, &port))
+            continue;
+
+        if (g_hash_table_contains(names, host)) {
+            g_free(host);
+            continue;
+        }
+        g_hash_table_add(names, g_strdup(host));
+
+        LrResolveJob *job = lr_malloc0(sizeof(*job));
+        job->host = host;
+        job->key = g_strdup_printf("%s:%ld", host, port);
+        job->family = family;
+        job->deadline = deadline;
+        g_ptr_array_add(jobs, job);
+    }
+
+    // Host name -> sorted addresses
+    GHashTable *resolved = g_hash_table_new_full(g_str_hash, g_str_equal,
+                                                 NULL,
+                                                 (GDestroyNotify) g_strfreev);
+    GPtrArray *done = lr_preresolve_run(jobs, deadline);
+    for (guint i = 0; i < done->len; i++) {
+        LrResolveJob *job = g_ptr_array_index(done, i);
+
+        if (!job->addresses || !job->addresses->len)
+            continue;
+
+        GPtrArray *addresses = job->addresses;
+        job->addresses = NULL;
+        g_ptr_array_sort(addresses, cmp_addresses);
+        g_ptr_array_set_free_func(addresses, NULL);
+        g_ptr_array_add(addresses, NULL);
+
+        gpointer name = NULL;
+        g_hash_table_lookup_extended(names, job->host, &name, NULL);
+        g_hash_table_insert(resolved, name,
+                            g_ptr_array_free(addresses, FALSE));
+    }
+    g_ptr_array_free(done, TRUE);
+    g_ptr_array_free(jobs, TRUE);
+
+    for (guint i = 0; i < urls->len; i++) {
+        const char *url = g_ptr_array_index(urls, i);
+        gchar *host = NULL;
+        long port;
+
+        if (!lr_preresolve_parse_host(url, &host, &port))
+            continue;
+
+        gchar **addresses = g_hash_table_lookup(resolved, host);
+        if (addresses && !g_hash_table_contains(result, url))
+            g_hash_table_insert(result, g_strdup(url),
+                                g_strdupv(addresses));
+        g_free(host);
+    }
+
+    g_hash_table_destroy(resolved);
+    g_hash_table_destroy(names);
+
+    return result;
+}
@@ -0,0 +1,62 @@
+/* librepo - A library providing (libcURL like) API to downloading repository
+ * Copyright (C) 2014  Tomas Mlcoch
+ *
+ * Licensed under the GNU Lesser General Public License Version 2.1
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#ifndef __LR_PRERESOLVE_H__
+#define __LR_PRERESOLVE_H__
+
+#include <glib.h>
+
+#include "handle.h"
+
+G_BEGIN_DECLS
+
+/** Resolution of the hosts of the mirrors in advance (see LRO_PRERESOLVE).
+ * All distinct hosts of the internal mirrorlist are resolved concurrently
+ * and the addresses are passed to the curl handle of the handle by
+ * CURLOPT_RESOLVE, so they are in the DNS cache before the first transfer
+ * starts. The optional LRO_PRERESOLVECACHE key file has a group per
+ * "host:port" with the "addresses" and the time when they were "resolved".
+ */
+
+/** Resolve the hosts of the internal mirrorlist of the handle.
+ * Hosts which cannot be resolved are left to curl, so a failure
+ * is not an error.
+ * @param handle        Handle with prepared internal mirrorlist
+ */
+void
+lr_preresolve_hosts(LrHandle *handle);
+
+/** Resolve the hosts of the URLs concurrently, e.g. to find
+ * the mirrors served by the same server.
+ * @param handle        Handle (LRO_IPRESOLVE and LRO_PROXY are used)
+ *                      or NULL
+ * @param urls          URLs without path (LrInternalMirror.host)
+ * @param timeout       Max wait for the lookups in seconds
+ * @return              New table: URL -> NULL terminated sorted array
+ *                      of the addresses (gchar **) of its host. Only
+ *                      the resolved hosts are present, the table is
+ *                      empty if a proxy is used.
+ */
+GHashTable *
+lr_preresolve_addresses(LrHandle *handle, GPtrArray *urls, guint timeout);
+
+G_END_DECLS
+
+#endif
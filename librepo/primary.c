@@ -0,0 +1,303 @@
+/* librepo - A library providing (libcURL like) API to downloading repository
+ * Copyright (C) 2014  Tomas Mlcoch
+ *
+ * Licensed under the GNU Lesser General Public License Version 2.1
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#include <glib.h>
+#include <assert.h>
+#include <string.h>
+#include <expat.h>
+
+#include "xmlparser_internal.h"
+#include "rcodes.h"
+#include "util.h"
+#include "primary.h"
+
+// primary.xml parser
+
+typedef enum {
+    STATE_START,
+    STATE_METADATA,
+    STATE_PACKAGE,
+    STATE_CHECKSUM,
+    STATE_SIZE,
+    STATE_LOCATION,
+    NUMSTATES
+} LrPrimaryState;
+
+/* NOTE: Same states in the first column must be together!!!
+ * Only the elements needed to download the packages are listed,
+ * all other elements of a package are silently skipped. */
+static LrStatesSwitch stateswitches[] = {
+    { STATE_START,      "metadata",         STATE_METADATA,     0 },
+    { STATE_METADATA,   "package",          STATE_PACKAGE,      0 },
+    { STATE_PACKAGE,    "checksum",         STATE_CHECKSUM,     1 },
+    { STATE_PACKAGE,    "size",             STATE_SIZE,         0 },
+    { STATE_PACKAGE,    "location",         STATE_LOCATION,     0 },
+    { NUMSTATES,        NULL,               NUMSTATES,          0 }
+};
+
+static void
+lr_yum_package_free(LrYumPackage *package)
+{
+    if (!package)
+        return;
+    g_free(package->location_href);
+    g_free(package->location_base);
+    g_free(package->checksum);
+    g_free(package->checksum_type);
+    lr_free(package);
+}
+
+static void XMLCALL
+lr_start_handler(void *pdata, const char *element, const char **attr)
+{
+    LrParserData *pd = pdata;
+    LrStatesSwitch *sw;
+
+    if (pd->err)
+        return; // There was an error -> do nothing
+
+    if (pd->depth != pd->statedepth) {
+        // We are inside of unknown element
+        pd->depth++;
+        return;
+    }
+    pd->depth++;
+
+    if (!pd->swtab[pd->state]) {
+        // Current element should not have any sub elements
+        return;
+    }
+
+    // Find current state by its name
+    for (sw = pd->swtab[pd->state]; sw->from == pd->state; sw++)
+        if (!strcmp(element, sw->ename))
+            break;
+    if (sw->from != pd->state) {
+        // No state for current element (unknown element)
+        // Most of the elements of a package are not interesting for us
+        if (pd->state != STATE_PACKAGE)
+            lr_xml_parser_warning(pd, LR_XML_WARNING_UNKNOWNTAG,
+                                  "Unknown element \"%s\"", element);
+        return;
+    }
+
+    // Update parser data
+    pd->state = sw->to;
+    pd->docontent = sw->docontent;
+    pd->statedepth = pd->depth;
+    pd->lcontent = 0;
+    pd->content[0] = '\0';
+
+    const char *val;
+
+    switch(pd->state) {
+    case STATE_START:
+        break;
+
+    case STATE_METADATA:
+        pd->primaryfound = TRUE;
+        break;
+
+    case STATE_PACKAGE:
+        assert(!pd->package);
+
+        pd->package = lr_malloc0(sizeof(*pd->package));
+        pd->package->size = -1;
+        break;
+
+    case STATE_CHECKSUM:
+        assert(pd->package);
+
+        val = lr_find_attr("type", attr);
+        if (!val) {
+            lr_xml_parser_warning(pd, LR_XML_WARNING_MISSINGATTR,
+                    "Missing attribute \"type\" of a checksum element");
+            break;
+        }
+
+        g_free(pd->package->checksum_type);
+        pd->package->checksum_type = g_strdup(val);
+        break;
+
+    case STATE_SIZE:
+        assert(pd->package);
+
+        val = lr_find_attr("package", attr);
+        if (val)
+            pd->package->size = lr_xml_parser_strtoll(pd, val, 0);
+        break;
+
+    case STATE_LOCATION:
+        assert(pd->package);
+
+        val = lr_find_attr("href", attr);
+        if (val) {
+            g_free(pd->package->location_href);
+            pd->package->location_href = g_strdup(val);
+        } else {
+            lr_xml_parser_warning(pd, LR_XML_WARNING_MISSINGATTR,
+                    "Missing attribute \"href\" of a location element");
+        }
+
+        val = lr_find_attr("xml:base", attr);
+        if (val) {
+            g_free(pd->package->location_base);
+            pd->package->location_base = g_strdup(val);
+        }
+        break;
+
+    default:
+        break;
+    }
+}
+
+static void XMLCALL
+lr_end_handler(void *pdata, G_GNUC_UNUSED const char *element)
+{
+    LrParserData *pd = pdata;
+    unsigned int state = pd->state;
+
+    if (pd->err)
+        return; // There was an error -> do nothing
+
+    if (pd->depth != pd->statedepth) {
+        // Back from the unknown state
+        pd->depth--;
+        return;
+    }
+
+    pd->depth--;
+    pd->statedepth--;
+    pd->state = pd->sbtab[pd->state];
+    pd->docontent = 0;
+
+    switch (state) {
+    case STATE_START:
+    case STATE_METADATA:
+        break;
+
+    case STATE_PACKAGE: {
+        LrYumPackage *package = pd->package;
+        assert(package);
+        pd->package = NULL;
+
+        if (!package->location_href) {
+            lr_xml_parser_warning(pd, LR_XML_WARNING_MISSINGVAL,
+                    "Package without location skipped");
+        } else if (pd->packagecb(package, pd->packagecb_data) != LR_CB_OK) {
+            g_set_error(&pd->err, LR_XML_PARSER_ERROR, LRE_CBINTERRUPTED,
+                        "Parsing interrupted by user callback");
+        }
+
+        lr_yum_package_free(package);
+        break;
+    }
+
+    case STATE_CHECKSUM:
+        assert(pd->package);
+
+        g_free(pd->package->checksum);
+        pd->package->checksum = g_strdup(pd->content);
+        break;
+
+    case STATE_SIZE:
+    case STATE_LOCATION:
+    default:
+        break;
+    }
+}
+
+/** Create and setup XML parser and its data for the primary parsing.
+ */
+static LrParserData *
+primary_parser_data_new(XML_Parser *parser,
+                        LrYumPackageCb packagecb,
+                        void *packagecb_data,
+                        LrXmlParserWarningCb warningcb,
+                        void *warningcb_data)
+{
+    LrParserData *pd;
+
+    *parser = XML_ParserCreate(NULL);
+    XML_SetElementHandler(*parser, lr_start_handler, lr_end_handler);
+    XML_SetCharacterDataHandler(*parser, lr_char_handler);
+
+    pd = lr_xml_parser_data_new(NUMSTATES);
+    pd->parser = parser;
+    pd->state = STATE_START;
+    pd->packagecb = packagecb;
+    pd->packagecb_data = packagecb_data;
+    pd->warningcb = warningcb;
+    pd->warningcb_data = warningcb_data;
+    for (LrStatesSwitch *sw = stateswitches; sw->from != NUMSTATES; sw++) {
+        if (!pd->swtab[sw->from])
+            pd->swtab[sw->from] = sw;
+        pd->sbtab[sw->to] = sw->from;
+    }
+
+    XML_SetUserData(*parser, pd);
+
+    return pd;
+}
+
+gboolean
+lr_yum_primary_parse_file(int fd,
+                          LrYumPackageCb packagecb,
+                          void *packagecb_data,
+                          LrXmlParserWarningCb warningcb,
+                          void *warningcb_data,
+                          GError **err)
+{
+    gboolean ret = TRUE;
+    LrParserData *pd;
+    XML_Parser parser;
+    GError *tmp_err = NULL;
+
+    assert(fd >= 0);
+    assert(packagecb);
+    assert(!err || *err == NULL);
+
+    // Init
+
+    pd = primary_parser_data_new(&parser, packagecb, packagecb_data,
+                                 warningcb, warningcb_data);
+
+    // Parsing
+
+    ret = lr_xml_parser_generic(parser, pd, fd, &tmp_err);
+    if (tmp_err)
+        g_propagate_error(err, tmp_err);
+
+    // Check of results
+
+    if (ret && !pd->primaryfound) {
+        g_set_error(err, LR_XML_PARSER_ERROR, LRE_XMLPARSER,
+                    "Element <metadata> was not found - Bad primary file");
+        ret = FALSE;
+    }
+
+    // Clean up
+
+    lr_yum_package_free(pd->package);
+    lr_xml_parser_data_free(pd);
+    XML_ParserFree(parser);
+
+    return ret;
+}
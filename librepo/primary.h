@@ -0,0 +1,78 @@
+/* librepo - A library providing (libcURL like) API to downloading repository
+ * Copyright (C) 2014  Tomas Mlcoch
+ *
+ * Licensed under the GNU Lesser General Public License Version 2.1
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#ifndef __LR_PRIMARY_H__
+#define __LR_PRIMARY_H__
+
+#include <glib.h>
+
+#include "xmlparser.h"
+#include "types.h"
+
+G_BEGIN_DECLS
+
+/** \defgroup   primary       Primary (primary.xml) parser
+ *  \addtogroup primary
+ *  @{
+ */
+
+/** Package from the primary metadata.
+ * Only the information needed to download the package is parsed. */
+typedef struct {
+    char *location_href;    /*!< Location href attribute */
+    char *location_base;    /*!< Location base attribute or NULL */
+    char *checksum;         /*!< Checksum value or NULL */
+    char *checksum_type;    /*!< Type of checksum or NULL */
+    gint64 size;            /*!< Size of the package or -1 */
+} LrYumPackage;
+
+/** Callback called for every parsed package.
+ * @param package   Package, valid only during the call
+ * @param cbdata    User data
+ * @return          See LrCbReturnCode codes, a code other than
+ *                  LR_CB_OK stops the parsing with an error.
+ */
+typedef int (*LrYumPackageCb)(const LrYumPackage *package, void *cbdata);
+
+/** Parse the uncompressed primary.xml from the current offset of the fd.
+ * The packages are passed to the callback one by one as they are
+ * parsed, so the memory usage does not depend on the size of
+ * the repository.
+ * @param fd                File descriptor
+ * @param packagecb         Callback called for every package
+ * @param packagecb_data    User data for the packagecb
+ * @param warningcb         Callback for warnings or NULL
+ * @param warningcb_data    User data for the warningcb
+ * @param err               GError **
+ * @return                  TRUE if everything is ok, FALSE if err is set.
+ */
+gboolean
+lr_yum_primary_parse_file(int fd,
+                          LrYumPackageCb packagecb,
+                          void *packagecb_data,
+                          LrXmlParserWarningCb warningcb,
+                          void *warningcb_data,
+                          GError **err);
+
+/** @} */
+
+G_END_DECLS
+
+#endif
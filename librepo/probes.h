@@ -0,0 +1,74 @@
+/* librepo - A library providing (libcURL like) API to downloading repository
+ * Copyright (C) 2014  Tomas Mlcoch
+ *
+ * Licensed under the GNU Lesser General Public License Version 2.1
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#ifndef __LR_PROBES_H__
+#define __LR_PROBES_H__
+
+/** Static probes (USDT) of the "librepo" provider for SystemTap,
+ * bpftrace, perf, ... They are compiled in only with ENABLE_USDT,
+ * otherwise the macros (and their arguments) are dropped. An enabled
+ * probe which is not attached costs a nop. The arguments are integers
+ * and pointers (strings are char *), they must be cheap to evaluate.
+ *
+ * Probes:
+ *  transfer__start(LrTarget *, char *path, char *mirror)
+ *      A transfer was added to the multi handle (prepare_next_transfer).
+ *  transfer__done(LrTarget *, char *path, long curlcode)
+ *      A transfer finished (check_finished_transfer_status).
+ *  mirror__penalized(char *url, long rank, long rank_next)
+ *  mirror__awarded(char *url, long rank, long rank_prev)
+ *      The mirror moved in the list of mirrors (sort_mirrors), the ranks
+ *      are in thousandths.
+ *  mirror__sorted(char *url)
+ *      The mirrors were sorted by expected time after a transfer
+ *      from the mirror (LR_ADAPTIVEMIRRORSORTING_THROUGHPUT).
+ *  checksum__start(int fd, unsigned types)
+ *  checksum__done(int fd, int ret, int matches)
+ *      Checksums of a downloaded file are calculated.
+ *  fastestmirror__result(char *url, long connect_usec)
+ *      The connect time measured by the fastestmirror, -1 on error.
+ *  perform__loop(unsigned running, unsigned verifying)
+ *      An iteration of the download loop (lr_perform_select() or
+ *      lr_perform_socket()).
+ */
+
+#ifdef ENABLE_USDT
+
+#include <sys/sdt.h>
+
+#define LR_PROBE1(name, a1) \
+    DTRACE_PROBE1(librepo, name, a1)
+#define LR_PROBE2(name, a1, a2) \
+    DTRACE_PROBE2(librepo, name, a1, a2)
+#define LR_PROBE3(name, a1, a2, a3) \
+    DTRACE_PROBE3(librepo, name, a1, a2, a3)
+#define LR_PROBE4(name, a1, a2, a3, a4) \
+    DTRACE_PROBE4(librepo, name, a1, a2, a3, a4)
+
+#else
+
+#define LR_PROBE1(name, a1)                 do {} while (0)
+#define LR_PROBE2(name, a1, a2)             do {} while (0)
+#define LR_PROBE3(name, a1, a2, a3)         do {} while (0)
+#define LR_PROBE4(name, a1, a2, a3, a4)     do {} while (0)
+
+#endif
+
+#endif
@@ -0,0 +1,248 @@
+/* librepo - A library providing (libcURL like) API to downloading repository
+ * Copyright (C) 2014  Tomas Mlcoch
+ *
+ * Licensed under the GNU Lesser General Public License Version 2.1
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#include <glib.h>
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "rcodes.h"
+#include "util.h"
+#include "proxypool.h"
+#include "cleanup.h"
+
+struct _LrProxyPool {
+    GMutex lock;        /*!< Lock of the proxies */
+    GPtrArray *proxies; /*!< LrProxy *s in the order of LRO_PROXIES */
+};
+
+static void
+lr_proxy_free(LrProxy *proxy)
+{
+    g_free(proxy->url);
+    g_free(proxy->lasterror);
+    lr_free(proxy);
+}
+
+LrProxyPool *
+lr_proxypool_new(char **proxies, GError **err)
+{
+    LrProxyPool *pool;
+
+    assert(!err || *err == NULL);
+
+    pool = lr_malloc0(sizeof(*pool));
+    g_mutex_init(&pool->lock);
+    pool->proxies = g_ptr_array_new_with_free_func((GDestroyNotify) lr_proxy_free);
+
+    for (char **entry = proxies; entry && *entry; entry++) {
+        _cleanup_strv_free_ gchar **parts = NULL;
+        gchar *url = NULL, *weight = NULL;
+        guint64 val = 1;
+
+        parts = g_strsplit_set(*entry, " \t", 0);
+        for (gchar **part = parts; *part; part++) {
+            if (!**part)
+                continue;
+            if (!url) {
+                url = *part;
+            } else if (!weight) {
+                weight = *part;
+            } else {
+                url = NULL;  // Too many parts
+                break;
+            }
+        }
+
+        if (weight) {
+            char *end = NULL;
+            val = g_ascii_strtoull(weight, &end, 10);
+            if (!end || *end || val > G_MAXUINT)
+                url = NULL;
+        }
+
+        if (!url) {
+            g_set_error(err, LR_HANDLE_ERROR, LRE_BADOPTARG,
+                        "Bad proxy \"%s\" (use \"PROXY\" or \"PROXY WEIGHT\")",
+                        *entry);
+            lr_proxypool_free(pool);
+            return NULL;
+        }
+
+        LrProxy *proxy = lr_malloc0(sizeof(*proxy));
+        proxy->url = g_strdup(url);
+        proxy->weight = (guint) val;
+        g_ptr_array_add(pool->proxies, proxy);
+    }
+
+    if (pool->proxies->len == 0) {
+        g_set_error(err, LR_HANDLE_ERROR, LRE_BADOPTARG,
+                    "No proxy specified");
+        lr_proxypool_free(pool);
+        return NULL;
+    }
+
+    return pool;
+}
+
+void
+lr_proxypool_free(LrProxyPool *pool)
+{
+    if (!pool)
+        return;
+    g_ptr_array_free(pool->proxies, TRUE);
+    g_mutex_clear(&pool->lock);
+    lr_free(pool);
+}
+
+/** Return TRUE if the proxy could get a transfer now. */
+static gboolean
+proxy_healthy(LrProxy *proxy, gint64 now)
+{
+    if (!proxy->until)
+        return TRUE;
+    // After the backoff only a single probe is allowed
+    return now >= proxy->until && !proxy->probing;
+}
+
+LrProxy *
+lr_proxypool_acquire(LrProxyPool *pool, gint64 now)
+{
+    LrProxy *best = NULL;
+    gdouble best_load = 0.0;
+
+    assert(pool);
+
+    g_mutex_lock(&pool->lock);
+
+    // The least loaded healthy proxy relative to its weight
+    for (guint i = 0; i < pool->proxies->len; i++) {
+        LrProxy *proxy = g_ptr_array_index(pool->proxies, i);
+        if (!proxy->weight || !proxy_healthy(proxy, now))
+            continue;
+        gdouble load = (proxy->running + 1) / (gdouble) proxy->weight;
+        if (!best || load < best_load) {
+            best = proxy;
+            best_load = load;
+        }
+    }
+
+    // The least loaded healthy backup
+    if (!best) {
+        for (guint i = 0; i < pool->proxies->len; i++) {
+            LrProxy *proxy = g_ptr_array_index(pool->proxies, i);
+            if (proxy->weight || !proxy_healthy(proxy, now))
+                continue;
+            if (!best || proxy->running < best->running)
+                best = proxy;
+        }
+    }
+
+    // Nothing is healthy, the proxy which recovers first is tried
+    if (!best) {
+        for (guint i = 0; i < pool->proxies->len; i++) {
+            LrProxy *proxy = g_ptr_array_index(pool->proxies, i);
+            if (!best || proxy->until < best->until)
+                best = proxy;
+        }
+    }
+
+    assert(best);
+
+    if (best->until && now >= best->until && !best->probing) {
+        g_debug("%s: Probing proxy %s", __func__, best->url);
+        best->probing = TRUE;
+    }
+
+    best->running++;
+
+    g_mutex_unlock(&pool->lock);
+
+    return best;
+}
+
+void
+lr_proxypool_release(LrProxyPool *pool,
+                     LrProxy *proxy,
+                     LrProxyOutcome outcome,
+                     const char *error,
+                     gint64 now)
+{
+    assert(pool);
+    assert(proxy);
+
+    g_mutex_lock(&pool->lock);
+
+    assert(proxy->running > 0);
+    proxy->running--;
+
+    switch (outcome) {
+    case LR_PROXYPOOL_SUCCESS:
+        proxy->successful++;
+        if (proxy->until)
+            g_debug("%s: Proxy %s works again", __func__, proxy->url);
+        proxy->trips = 0;
+        proxy->until = 0;
+        proxy->probing = FALSE;
+        break;
+
+    case LR_PROXYPOOL_FAILURE:
+        proxy->failed++;
+        if (error) {
+            g_free(proxy->lasterror);
+            proxy->lasterror = g_strdup(error);
+        }
+        if (proxy->until && !proxy->probing)
+            break;  // Already backing off
+        gint64 backoff = LR_PROXYPOOL_BACKOFF_MIN << MIN(proxy->trips, 16);
+        backoff = MIN(backoff, LR_PROXYPOOL_BACKOFF_MAX);
+        proxy->trips++;
+        proxy->until = now + backoff;
+        proxy->probing = FALSE;
+        g_debug("%s: Proxy %s is not used for %.1f s: %s", __func__,
+                proxy->url, backoff / (gdouble) G_USEC_PER_SEC,
+                error ? error : "");
+        break;
+
+    case LR_PROXYPOOL_NEUTRAL:
+    default:
+        // Another probe could be done
+        if (!proxy->running)
+            proxy->probing = FALSE;
+        break;
+    }
+
+    g_mutex_unlock(&pool->lock);
+}
+
+gboolean
+lr_proxypool_available(LrProxyPool *pool, gint64 now)
+{
+    gboolean available = FALSE;
+
+    assert(pool);
+
+    g_mutex_lock(&pool->lock);
+    for (guint i = 0; !available && i < pool->proxies->len; i++)
+        available = proxy_healthy(g_ptr_array_index(pool->proxies, i), now);
+    g_mutex_unlock(&pool->lock);
+
+    return available;
+}
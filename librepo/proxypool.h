@@ -0,0 +1,120 @@
+/* librepo - A library providing (libcURL like) API to downloading repository
+ * Copyright (C) 2014  Tomas Mlcoch
+ *
+ * Licensed under the GNU Lesser General Public License Version 2.1
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#ifndef __LR_PROXYPOOL_H__
+#define __LR_PROXYPOOL_H__
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/** Pool of proxies of a handle (see LRO_PROXIES).
+ * Every transfer goes through the healthy proxy with the lowest number
+ * of running transfers relative to its weight. Ties are resolved by
+ * the order of the proxies, so a lightly loaded pool keeps using
+ * the same proxy and its keep-alive connections. Proxies with
+ * the weight 0 are backups used only when no weighted proxy is healthy.
+ * A proxy which failed (it couldn't be resolved or connected) is not
+ * used for a backoff time which starts at LR_PROXYPOOL_BACKOFF_MIN and
+ * doubles up to LR_PROXYPOOL_BACKOFF_MAX. After the backoff a single
+ * probe transfer is allowed. The pool is thread safe.
+ */
+
+/** First backoff of a failed proxy (usec) */
+#define LR_PROXYPOOL_BACKOFF_MIN    (1 * G_USEC_PER_SEC)
+
+/** Max backoff of a failed proxy (usec) */
+#define LR_PROXYPOOL_BACKOFF_MAX    (60 * G_USEC_PER_SEC)
+
+/** Outcome of a transfer through a proxy */
+typedef enum {
+    LR_PROXYPOOL_NEUTRAL, /*!<
+        Nothing is known about the proxy (e.g. the transfer was cancelled) */
+    LR_PROXYPOOL_SUCCESS, /*!<
+        The proxy forwarded the request */
+    LR_PROXYPOOL_FAILURE, /*!<
+        The proxy couldn't be used */
+} LrProxyOutcome;
+
+/** Proxy of the pool */
+typedef struct {
+    gchar *url;             /*!< Proxy (CURLOPT_PROXY) */
+    guint weight;           /*!< Weight, 0 for a backup proxy */
+    guint running;          /*!< Running transfers through the proxy */
+    guint64 successful;     /*!< Successful transfers */
+    guint64 failed;         /*!< Failed transfers */
+    guint trips;            /*!< Consecutive backoffs */
+    gint64 until;           /*!< Monotonic time of the end of the
+                                 backoff or 0 if the proxy is healthy */
+    gboolean probing;       /*!< The probe after the backoff is running */
+    gchar *lasterror;       /*!< The last error or NULL */
+} LrProxy;
+
+typedef struct _LrProxyPool LrProxyPool;
+
+/** Create the pool.
+ * @param proxies   NULL-terminated list of proxies in the format
+ *                  "PROXY" or "PROXY WEIGHT" (the default weight is 1)
+ * @param err       GError **
+ * @return          New pool or NULL
+ */
+LrProxyPool *
+lr_proxypool_new(char **proxies, GError **err);
+
+/** Free the pool.
+ * @param pool      Pool or NULL
+ */
+void
+lr_proxypool_free(LrProxyPool *pool);
+
+/** Select a proxy for a new transfer.
+ * If no proxy is healthy, the one whose backoff ends first is used.
+ * @param pool      Pool
+ * @param now       Monotonic time
+ * @return          Proxy, it must be released by lr_proxypool_release()
+ */
+LrProxy *
+lr_proxypool_acquire(LrProxyPool *pool, gint64 now);
+
+/** Release the proxy of a finished transfer.
+ * @param pool      Pool
+ * @param proxy     Proxy returned by lr_proxypool_acquire()
+ * @param outcome   Outcome of the transfer
+ * @param error     Error of the failed transfer or NULL
+ * @param now       Monotonic time
+ */
+void
+lr_proxypool_release(LrProxyPool *pool,
+                     LrProxy *proxy,
+                     LrProxyOutcome outcome,
+                     const char *error,
+                     gint64 now);
+
+/** Return TRUE if a proxy of the pool could be used without waiting
+ * for the end of its backoff.
+ * @param pool      Pool
+ * @param now       Monotonic time
+ */
+gboolean
+lr_proxypool_available(LrProxyPool *pool, gint64 now);
+
+G_END_DECLS
+
+#endif
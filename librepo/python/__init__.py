@@ -132,8 +132,8 @@ Version contants
 
 .. data:: LRO_MAXSPEED
 
-    *Long or None*. Set maximal allowed speed per download in bytes per second.
-    0 = unlimited speed - the default value.
+    *Long or None*. Set maximal allowed speed of all parallel downloads
+    together in bytes per second. 0 = unlimited speed - the default value.
 
 .. data:: LRO_DESTDIR
 
@@ -186,6 +186,8 @@ Version contants
 .. data:: LRO_MAXDOWNLOADSPERMIRROR
 
     *Integer or None*. Maximum number of parallel downloads per mirror.
+    The default (3) limits the downloads only if
+    :data:`.LRO_MAXPARALLELDOWNLOADS` is raised.
     ``None`` sets default value.
 
 .. data:: LRO_VARSUB
@@ -198,6 +200,10 @@ Version contants
 
     *Boolean*. If True, internal mirrorlist is sorted
     by the determined connection speed, after it is constructed.
+    Hosts which resolve to the same address (and use the same scheme
+    if :data:`.LRO_FASTESTMIRRORPROBE` is set) are measured only once.
+    The results are shared by all handles of the process, a mirror
+    measured by one of them is not measured again by the others.
 
 .. data:: LRO_FASTESTMIRRORCACHE
 
@@ -306,12 +312,452 @@ Version contants
 
     *Integer or None* If enabled, internal list of mirrors for each
     handle is re-sorted after each finished transfer.
-    The the sorting is based on mirror error rate etc.
+    See :ref:`adaptivemirrorsorting-label`.
 
 .. data:: LRO_GNUPGHOMEDIR
 
     *String or None* set own GNUPG configuration directory (a dir with keyring).
 
+.. data:: LRO_HTTP2
+
+    *Boolean* If enabled, try to negotiate HTTP/2 and multiplex
+    parallel transfers from a mirror over a single connection.
+    For mirrors which negotiated HTTP/2 the :data:`.LRO_MAXDOWNLOADSPERMIRROR`
+    and :data:`.LRO_MAXPARALLELDOWNLOADS` count connections and each
+    connection carries up to :data:`.LRO_MAXSTREAMSPERMIRROR` transfers.
+
+.. data:: LRO_MAXSTREAMSPERMIRROR
+
+    *Integer or None* Maximum number of parallel transfers (streams)
+    multiplexed over a single connection to a mirror which negotiated
+    HTTP/2. Used only when :data:`.LRO_HTTP2` is enabled.
+
+.. data:: LRO_MAXSEGMENTS
+
+    *Integer or None* Maximum number of segments a single target
+    could be split into. Segments of a target with known expected size
+    are downloaded in parallel from different mirrors and the checksum
+    of the whole file is verified at the end. 1 (default) disables
+    segmented downloading.
+
+.. data:: LRO_MINSEGMENTSIZE
+
+    *Integer or None* Minimal size of a segment in bytes.
+    A target is split into as many segments (up to :data:`.LRO_MAXSEGMENTS`)
+    as its size allows.
+
+.. data:: LRO_WRITEBUFFERSIZE
+
+    *Integer or None* Size (in bytes) of a buffer used for writing
+    of downloaded data by positioned writes. The data are written out
+    and digested (checksums, decompression, streaming) in whole blocks
+    of the buffer. 0 (default) means that data are written through
+    stdio with its default buffering.
+
+.. data:: LRO_PREALLOCATE
+
+    *Boolean* Preallocate disk space for targets with known expected
+    size. The size of the file is not changed by the preallocation.
+    Supported only on Linux.
+
+.. data:: LRO_EARLYWRITEBACK
+
+    *Boolean* Start writeback of data to the disk every time
+    the write buffer is written out. Used only with
+    :data:`.LRO_WRITEBUFFERSIZE`. Supported only on Linux.
+
+.. data:: LRO_DOWNLOADORDER
+
+    *Integer or None* Order in which waiting targets are downloaded.
+    See :ref:`downloadorder-label`.
+
+.. data:: LRO_ADAPTIVEDOWNLOADSPERMIRROR
+
+    *Boolean* If enabled, the number of parallel downloads from each
+    mirror is adjusted according to the observed throughput of the mirror.
+    It starts at :data:`.LRO_MAXDOWNLOADSPERMIRROR`, grows while adding
+    downloads increases the total throughput from the mirror and shrinks
+    when the mirror is saturated or the downloads fail.
+    :data:`.LRO_MAXPARALLELDOWNLOADS` still limits the total number of
+    downloads.
+
+.. data:: LRO_HEDGEDDOWNLOADS
+
+    *Boolean* If enabled, when there are no more waiting targets and
+    some download slots are free, a download which is expected to finish
+    late gets a second request for the rest of the file from another
+    mirror. The request which finishes first wins and the other one
+    is cancelled. Only targets with known expected size are hedged.
+
+.. data:: LRO_LOWSPEEDRESUME
+
+    *Boolean* If enabled, a download aborted because its speed was under
+    :data:`.LRO_LOWSPEEDLIMIT` for :data:`.LRO_LOWSPEEDTIME` seconds
+    continues from another mirror from the already downloaded data instead
+    of from the beginning.
+
+.. data:: LRO_PROGRESSINTERVAL
+
+    *Integer or None* Minimal time in milliseconds between two calls
+    of a progress callback. The final call is never skipped. Default is 0,
+    every progress tick is reported.
+
+.. data:: LRO_MULTIPROGRESSCB
+
+    *Function or None* Aggregated progress callback. It is called at
+    most once per :data:`.LRO_PROGRESSINTERVAL` with *user_data*
+    (see :data:`.LRO_PROGRESSDATA`) and a list of
+    *(path, total_to_download, downloaded)* tuples of all running targets.
+    It can return :ref:`callbacks-return-values` like the progress callback.
+
+.. data:: LRO_YUMDECOMPRESS
+
+    *List of strings*. Records from repomd which are decompressed
+    while they are downloaded (e.g. ``["primary", "filelists"]``).
+    The decompressed file is stored next to the downloaded one, without
+    the compression suffix (.gz, .bz2, .xz). Checksum is checked on the
+    downloaded (compressed) file. See :data:`.LRO_YUMKEEPCOMPRESSED`.
+
+.. data:: LRO_YUMKEEPCOMPRESSED
+
+    *Boolean* If disabled, the downloaded compressed files of records
+    from :data:`.LRO_YUMDECOMPRESS` are removed after the decompression and
+    only the decompressed files are kept. Enabled by default.
+
+.. data:: LRO_CHECKSUMTHREADS
+
+    *Integer or None* Number of threads used to verify checksums of files
+    of local repositories (and by lr_check_packages() of the C API).
+    0 means the number of available processors. Default is 1.
+    Downloaded files whose checksums couldn't be calculated during
+    the transfer are verified by this number of threads out of the
+    download loop.
+
+.. data:: LRO_CHECKSUMINDEX
+
+    *Boolean* If enabled, checksums of files are also cached in a sidecar
+    index file in the directory of the file when the filesystem doesn't
+    support extended attributes (e.g. NFS or overlayfs). Disabled by default.
+
+.. data:: LRO_PARSECACHE
+
+    *Boolean* If enabled, repomd.xml and metalink.xml are loaded from
+    a binary cache of their parsed content, written next to the XML
+    file, when the cache is up to date. Disabled by default.
+
+.. data:: LRO_METALINKMAXURLS
+
+    *Integer or None* Maximal number of URLs (mirrors) parsed from
+    a metalink. Further url elements are skipped. 0 or None means
+    no limit (default).
+
+.. data:: LRO_FASTESTMIRRORPROBE
+
+    *String or None*. Path of an object relative to the mirror URL
+    (e.g. "repodata/repomd.xml") used to probe the mirrors when
+    :data:`.LRO_FASTESTMIRROR` is enabled. The mirrors are then sorted by
+    a score combined from the time to the first byte and the throughput
+    of a short ranged download of the object instead of the plain
+    connect time. If None (default), only the connect time is measured.
+
+.. data:: LRO_FASTESTMIRRORCONCURRENCY
+
+    *Integer or None*. Maximal number of mirrors measured at the same
+    time by the fastestmirror. Mirrors which don't get measured in time
+    are sorted after the measured ones and measured next time (when
+    :data:`.LRO_FASTESTMIRRORCACHE` is used). 0 means no limit.
+    None sets the default value (32).
+
+.. data:: LRO_FASTESTMIRRORGOODCOUNT
+
+    *Integer or None*. Stop the fastestmirror measurement as soon as
+    this number of mirrors was measured successfully and none of the
+    running measurements can beat them. The rest of the mirrors is
+    measured next time (when :data:`.LRO_FASTESTMIRRORCACHE` is used).
+    0 or None means measure all mirrors (default).
+
+.. data:: LRO_FASTESTMIRRORASYNC
+
+    *Boolean*. Serve the records of the fastestmirror cache older than
+    :data:`.LRO_FASTESTMIRRORMAXAGE` right away and measure the mirrors
+    again in a background thread while the downloads run. Disabled by
+    default.
+
+.. data:: LRO_CONDITIONALGET
+
+    *Boolean*. Store validators (ETag, Last-Modified) of the downloaded
+    repomd.xml next to it and request it by a conditional HTTP request
+    when the repository is downloaded to the same destdir again.
+    Disabled by default.
+
+.. data:: LRO_YUMREUSEDIR
+
+    *String or None*. Directory with a previous download of the repository.
+    Files of the metadata records with the checksums from the new repomd.xml
+    are hardlinked (or copied) from it instead of being downloaded.
+
+.. data:: LRO_YUMRECORDCB
+
+    *Function or None* Callback called with *user_data*
+    (see :data:`.LRO_PROGRESSDATA`), the metadata type and the path
+    as soon as the file of a metadata record is downloaded and verified,
+    while the other records may still be downloading.
+    See :ref:`callback-yumrecordcb-label`.
+
+.. data:: LRO_LAZYCHECKSUM
+
+    *Boolean*. Don't verify checksums of the files of a local repository
+    (:data:`.LRO_LOCAL`) during the :meth:`~.Handle.perform`, every file
+    is verified when it's obtained by :meth:`~.Result.yum_repo_path`
+    for the first time. Disabled by default.
+
+.. data:: LRO_MIRRORLISTCACHE
+
+    *String or None*. Directory of a cache of the downloaded mirrorlists
+    and metalinks shared by all handles. A file fetched less than
+    :data:`.LRO_MIRRORLISTCACHETTL` seconds ago is used without any network
+    access, an older one is revalidated by a conditional request.
+    *None* (default) disables the cache.
+
+.. data:: LRO_MIRRORLISTCACHETTL
+
+    *Integer*. Age in seconds after which a file of the
+    :data:`.LRO_MIRRORLISTCACHE` is revalidated. Default is 3600.
+
+.. data:: LRO_PRERESOLVE
+
+    *Boolean*. Resolve all distinct hosts of the mirrors concurrently
+    when the internal mirrorlist is prepared, so the first transfers
+    don't wait for DNS lookups one by one. Hosts are not resolved
+    when a proxy is used. Default is *False*.
+
+.. data:: LRO_PRERESOLVECACHE
+
+    *String or None*. File where the addresses resolved by
+    :data:`.LRO_PRERESOLVE` are kept. Addresses resolved less than
+    :data:`.LRO_PRERESOLVECACHETTL` seconds ago are used without a lookup.
+    *None* (default) disables the cache.
+
+.. data:: LRO_PRERESOLVECACHETTL
+
+    *Integer*. Age in seconds after which addresses in the
+    :data:`.LRO_PRERESOLVECACHE` are resolved again. Default is 300.
+
+.. data:: LRO_TLSSESSIONCACHE
+
+    *String or None*. File where TLS sessions are kept across processes.
+    The sessions are loaded when the option is set and stored when
+    the handle is freed, so the following runs can resume them instead
+    of doing full handshakes. Requires curl >= 8.12.
+    *None* (default) disables the cache.
+
+.. data:: LRO_PACKAGESTORE
+
+    *String or None*. Directory of a content-addressed store of
+    packages shared by all repositories and destinations. Packages
+    with a known checksum are taken from the store instead of
+    downloading them, downloaded packages are added to the store.
+
+.. data:: LRO_PACKAGESTOREMAXSIZE
+
+    *Integer or None*. Maximal size of the store of packages
+    (see :data:`.LRO_PACKAGESTORE`) in bytes. The least recently
+    used packages are removed when the store is bigger.
+    0 (default) means unlimited.
+
+.. data:: LRO_CACHESOURCES
+
+    *List of strings*. Base URLs of cache sources (LAN caches or peers)
+    tried in the order before the mirrors for the packages downloaded by
+    :func:`~librepo.download_packages`. A miss falls through to the next
+    source or to the mirrors and it isn't counted as a mirror failure.
+    Metadata are always downloaded from the mirrors.
+
+.. data:: LRO_CACHESOURCETIMEOUT
+
+    *Integer* Max time in miliseconds for the connection phase of
+    a transfer from a cache source. Default is 1000.
+
+.. data:: LRO_LOCALHARDLINK
+
+    *Boolean*. Hardlink targets downloaded from local (file://)
+    mirrors instead of copying them, if they are on the same filesystem.
+    The downloaded files must not be modified then. Used only for
+    targets downloaded to a filename.
+
+.. data:: LRO_DURABILITY
+
+    *Integer*. How the downloaded files are made durable
+    (flushed to the disk). See :ref:`durability-label`.
+
+.. data:: LRO_ATOMICDOWNLOAD
+
+    *Boolean*. Download targets to ``fn.part`` and rename them to
+    ``fn`` only after they are finished and verified, so readers never see
+    a partial file and a failed download keeps the previous ``fn``.
+
+.. data:: LRO_GPGBACKEND
+
+    *Integer*. Implementation which verifies GPG signatures of
+    repomd.xml. See :ref:`gpgbackend-label`.
+
+.. data:: LRO_MIRRORHEALTHCACHE
+
+    *String or None*. File where the health of the mirrors (decayed
+    success rates, throughput, the last error) is kept across runs.
+    It seeds the ranks used by :data:`.LRO_ADAPTIVEMIRRORSORTING`, so
+    the mirrors are sorted well from the first transfer. The store is
+    shared by the handles of the process and written at most once a
+    minute, see :func:`mirrorregistry_flush`.
+    *None* (default) disables the store.
+
+.. data:: LRO_MIRRORBREAKER
+
+    *Integer or None*. Number of consecutive failed transfers from
+    a mirror after which the mirror is not used for a backoff time
+    (1 second, doubled every time the mirror fails again, up to
+    1 minute). Then a single probe transfer decides whether the mirror
+    is used again. 0 (default) disables it.
+
+.. data:: LRO_TRACEFILE
+
+    *String or None*. File to which timed spans of the work of the handle
+    are written (preparation of the mirrors, fastestmirror, queue wait,
+    transfer and verification of every target, GPG checks). The file is
+    created when the option is set and finished when the handle is
+    freed. Load it into Perfetto to see the queueing and stragglers.
+    *None* (default) disables the tracing.
+
+.. data:: LRO_TRACEFORMAT
+
+    *Integer or None*. Format of the :data:`.LRO_TRACEFILE`.
+    See :ref:`traceformat-label`.
+
+.. data:: LRO_METRICSCB
+
+    *Function or None* Metrics callback for monitoring systems. It is
+    called from the download loop at most once per
+    :data:`.LRO_METRICSINTERVAL` with *user_data*
+    (see :data:`.LRO_PROGRESSDATA`) and a dict of metrics of the download
+    (running transfers, queued targets, throughput of every used mirror,
+    errors by their code, ...). See :ref:`callback-metricscb-label`.
+
+.. data:: LRO_METRICSINTERVAL
+
+    *Integer or None* Minimal time in milliseconds between two calls
+    of the :data:`.LRO_METRICSCB`. Default is 1000.
+
+.. data:: LRO_DOWNLOADSHARDS
+
+    *Integer or None* Number of threads (shards) which download
+    the targets of :meth:`~.Handle.perform` or
+    :func:`~librepo.download_packages` whose first target uses the handle.
+    Every shard has its own download loop and takes the next target when
+    it has a free slot. :data:`.LRO_MAXPARALLELDOWNLOADS` is split among
+    the shards, :data:`.LRO_MAXDOWNLOADSPERMIRROR` and
+    :data:`.LRO_MAXSPEED` are shared by them. Callbacks are called from
+    the shards, but never concurrently. A download with identical targets
+    or targets pinned to the mirror of another target is not sharded.
+    Every shard has its own connections. 0 means the number of available
+    processors. Default is 1 (no sharding).
+
+.. data:: LRO_SHARDENDCB
+
+    *Boolean* If *True*, the end callbacks of the targets of a sharded
+    download (see :data:`.LRO_DOWNLOADSHARDS`) are called from the thread
+    which started the download. Default is *False*.
+
+.. data:: LRO_IOURING
+
+    *Boolean* If *True*, downloaded data are written asynchronously
+    via io_uring (Linux only, librepo has to be built with liburing),
+    so the download loop doesn't wait for the disk. Two write buffers
+    of :data:`.LRO_WRITEBUFFERSIZE` (128 KiB if not set) are used
+    by every transfer. If io_uring is not available, data are written
+    synchronously. Default is *False*.
+
+.. data:: LRO_RESUMEJOURNAL
+
+    *Boolean* If *True*, a journal (with the URL, ETag, Last-Modified,
+    number of downloaded bytes and checksum states) is kept next to
+    the partially downloaded files which are resumed. A resumed HTTP
+    download from the same URL is restarted if the object on the server
+    was changed (If-Range) and checksums continue from the saved states
+    instead of reading the downloaded data again. Default is *False*.
+
+.. data:: LRO_MAXRANGESPERREQUEST
+
+    *Integer* Maximum number of byte ranges fetched by a single HTTP
+    request. Waiting targets limited by a byte range which are downloaded
+    from the same URL (and have no checksums, no data callback and are
+    not resumed) are batched into one multi-range request. If the server
+    sends the whole object instead, only its beginning up to the end of
+    the last range is downloaded. Default is 1 (no batching).
+
+.. data:: LRO_CONNECTIONAFFINITY
+
+    *Boolean* If *True*, small targets (up to 1 MiB or of unknown size)
+    are preferably downloaded from the mirrors whose keep-alive
+    connections were just released by finished transfers, so they
+    don't pay for new connections. Default is *False*.
+
+.. data:: LRO_AUTOTUNEPARALLELDOWNLOADS
+
+    *Boolean* If *True*, the number of parallel downloads is tuned
+    during the download: it starts low, grows while the total
+    throughput grows and drops when the throughput stops growing or
+    falls or when a transfer times out. It never exceeds
+    :data:`.LRO_MAXPARALLELDOWNLOADS`. The chosen number is
+    the *parallel_downloads* of :data:`.LRI_STATS`. Default is *False*.
+
+.. data:: LRO_ACCEPTENCODING
+
+    *Boolean* If *True*, the uncompressed metadata files (repomd.xml
+    and its signature, mirrorlists and metalinks) are requested
+    compressed (gzip, zstd, br, whatever libcurl supports) and
+    decoded during the transfer. Checksums and expected sizes apply
+    to the decoded data. The expected size of repomd.xml is then
+    the size from the metalink, if it has no alternates. Default is
+    *False*.
+
+.. data:: LRO_CRITICALSLOTS
+
+    *Integer* Number of transfers of critical targets (repository
+    metadata, see :ref:`priorityclass-label`) which could run beyond
+    :data:`.LRO_MAXPARALLELDOWNLOADS` while package downloads take
+    all the slots, so metadata never wait for the end of large
+    packages downloaded by the same download. Default is *0*
+    (no extra slots).
+
+.. data:: LRO_PROXIES
+
+    *List of strings* or *None*. Pool of proxies used by the transfers
+    instead of :data:`.LRO_PROXY`. An item is ``"PROXY"`` or
+    ``"PROXY WEIGHT"`` (default weight is 1). Transfers are spread over
+    the healthy proxies by their weights, proxies with the weight 0 are
+    backups. A proxy which cannot be connected is skipped for a backoff
+    time and the target is tried again through another proxy.
+
+.. data:: LRO_RECVBUFFERSIZE
+
+    *Integer* Size (in bytes) of the receive buffer of the transfers,
+    i.e. the maximal size of the chunks of data passed from libcurl.
+    Bigger buffer means less callbacks on fast links. Default is *0*
+    (the default of libcurl, 16 KiB), maximum is 10 MiB.
+
+.. data:: LRO_ENDCBTHREADS
+
+    *Integer* Number of threads which call the end callbacks of the
+    targets, so the download continues while the finished files are
+    processed. Default is *0* - the callbacks are called by the download
+    loop itself. The callbacks are called concurrently from the threads.
+
+.. data:: LRO_ENDCBQUEUESIZE
+
+    *Integer* Maximal number of finished targets whose end callbacks are
+    queued or running (see :data:`.LRO_ENDCBTHREADS`). No new transfers
+    are started while the queue is full. Default is *16*.
+
 .. _handle-info-options-label:
 
 :class:`~.Handle` info options
@@ -348,6 +794,76 @@ Version contants
 .. data:: LRI_ALLOWEDMIRRORFAILURES
 .. data:: LRI_ADAPTIVEMIRRORSORTING
 .. data:: LRI_GNUPGHOMEDIR
+.. data:: LRI_HTTP2
+.. data:: LRI_MAXSTREAMSPERMIRROR
+.. data:: LRI_MAXSEGMENTS
+.. data:: LRI_WRITEBUFFERSIZE
+.. data:: LRI_PREALLOCATE
+.. data:: LRI_EARLYWRITEBACK
+.. data:: LRI_DOWNLOADORDER
+.. data:: LRI_ADAPTIVEDOWNLOADSPERMIRROR
+.. data:: LRI_HEDGEDDOWNLOADS
+.. data:: LRI_LOWSPEEDRESUME
+.. data:: LRI_PROGRESSINTERVAL
+.. data:: LRI_YUMDECOMPRESS
+.. data:: LRI_YUMKEEPCOMPRESSED
+.. data:: LRI_CHECKSUMTHREADS
+.. data:: LRI_CHECKSUMINDEX
+.. data:: LRI_PARSECACHE
+.. data:: LRI_METALINKMAXURLS
+.. data:: LRI_FASTESTMIRRORPROBE
+.. data:: LRI_FASTESTMIRRORCONCURRENCY
+.. data:: LRI_FASTESTMIRRORGOODCOUNT
+.. data:: LRI_FASTESTMIRRORASYNC
+.. data:: LRI_CONDITIONALGET
+.. data:: LRI_YUMREUSEDIR
+.. data:: LRI_LAZYCHECKSUM
+.. data:: LRI_MIRRORLISTCACHE
+.. data:: LRI_MIRRORLISTCACHETTL
+.. data:: LRI_PRERESOLVE
+.. data:: LRI_PRERESOLVECACHE
+.. data:: LRI_PRERESOLVECACHETTL
+.. data:: LRI_TLSSESSIONCACHE
+.. data:: LRI_PACKAGESTORE
+.. data:: LRI_CACHESOURCES
+.. data:: LRI_CACHESOURCETIMEOUT
+.. data:: LRI_LOCALHARDLINK
+.. data:: LRI_DURABILITY
+.. data:: LRI_ATOMICDOWNLOAD
+.. data:: LRI_GPGBACKEND
+.. data:: LRI_STATS
+
+    Statistics of the downloads since the beginning of the last
+    :meth:`~.Handle.perform` or :func:`~librepo.download_packages`
+    as a dict with keys *bytes*, *time*, *successful*, *failed*,
+    *retries*, *speed*, *allocations*, *allocated_bytes*,
+    *parallel_downloads* and *mirrors*. The *parallel_downloads* is
+    the number chosen by :data:`.LRO_AUTOTUNEPARALLELDOWNLOADS` (0 if it
+    is disabled). The *mirrors* is a list of dicts with the same keys
+    (except *allocations*, *allocated_bytes*, *parallel_downloads* and
+    *mirrors*) plus *url*. Transfers
+    of targets with a full URL or a baseurl are not counted.
+    The allocations are counted only if :func:`alloc_accounting` is
+    enabled.
+
+.. data:: LRI_MIRRORHEALTHCACHE
+.. data:: LRI_MIRRORBREAKER
+.. data:: LRI_TRACEFILE
+.. data:: LRI_TRACEFORMAT
+.. data:: LRI_METRICSINTERVAL
+.. data:: LRI_DOWNLOADSHARDS
+.. data:: LRI_SHARDENDCB
+.. data:: LRI_IOURING
+.. data:: LRI_RESUMEJOURNAL
+.. data:: LRI_MAXRANGESPERREQUEST
+.. data:: LRI_CONNECTIONAFFINITY
+.. data:: LRI_AUTOTUNEPARALLELDOWNLOADS
+.. data:: LRI_ACCEPTENCODING
+.. data:: LRI_CRITICALSLOTS
+.. data:: LRI_PROXIES
+.. data:: LRI_RECVBUFFERSIZE
+.. data:: LRI_ENDCBTHREADS
+.. data:: LRI_ENDCBQUEUESIZE
 
 .. _proxy-type-label:
 
@@ -379,6 +895,121 @@ Supported IP resolving
 
     Resolve to IPv6 addresses.
 
+.. _downloadorder-label:
+
+Supported download orders
+-------------------------
+
+.. data:: DOWNLOADORDER_FIFO
+
+    Default value, targets are downloaded in order of the list of targets.
+
+.. data:: DOWNLOADORDER_LARGESTFIRST
+
+    The largest targets are downloaded first. This minimizes total
+    time of downloading.
+
+.. data:: DOWNLOADORDER_SMALLESTFIRST
+
+    The smallest targets are downloaded first.
+
+.. data:: DOWNLOADORDER_PRIORITY
+
+    Targets with higher priority are downloaded first.
+
+.. _priorityclass-label:
+
+Priority classes of targets
+---------------------------
+
+.. data:: PRIORITYCLASS_NORMAL
+
+    Default value.
+
+.. data:: PRIORITYCLASS_CRITICAL
+
+    Targets are downloaded before the normal ones and they could use
+    the extra slots of :data:`.LRO_CRITICALSLOTS`. Repository metadata
+    downloaded by :class:`.Handle` are critical.
+
+.. data:: PRIORITYCLASS_BACKGROUND
+
+    Best-effort prefetch. Targets are downloaded after the normal ones
+    and their transfers are stopped while a target with a deadline
+    is at risk of missing it.
+
+.. _adaptivemirrorsorting-label:
+
+Supported adaptive mirror sorting modes
+---------------------------------------
+
+.. data:: ADAPTIVEMIRRORSORTING_NONE
+
+    Mirrors are not re-sorted.
+
+.. data:: ADAPTIVEMIRRORSORTING_ERRORRATE
+
+    Default value, a mirror is moved forward or backward by one position
+    according to its error rate.
+
+.. data:: ADAPTIVEMIRRORSORTING_THROUGHPUT
+
+    Mirrors are re-sorted by expected completion time of a transfer,
+    which is based on measured throughput, time to first byte
+    and error rate of the mirrors.
+
+.. _durability-label:
+
+Supported durability modes
+--------------------------
+
+.. data:: DURABILITY_NONE
+
+    Default value, the downloaded files are not synced to the disk.
+
+.. data:: DURABILITY_BATCH
+
+    All files finished by a download are synced at its end.
+    Every filesystem is synced just once.
+
+.. data:: DURABILITY_STRICT
+
+    Every file is synced before its target is reported as finished.
+
+.. _gpgbackend-label:
+
+GPG backends
+------------
+
+.. data:: GPGBACKEND_DEFAULT
+
+    Default value, the backend chosen at build time.
+
+.. data:: GPGBACKEND_GPGME
+
+    Signatures are verified by GPGME (gpg engine).
+
+.. data:: GPGBACKEND_BUILTIN
+
+    Signatures are verified in-process with the keys of the keyring
+    in :data:`.LRO_GNUPGHOMEDIR`. Signatures which cannot be decided
+    in-process (unknown algorithms, revoked or expiring keys, ...) are
+    verified by GPGME.
+
+.. _traceformat-label:
+
+Trace formats
+-------------
+
+.. data:: TRACE_CHROME
+
+    Default value, a JSON array of Chrome trace events
+    (Perfetto, chrome://tracing).
+
+.. data:: TRACE_JSONLINES
+
+    A JSON object per line and span.
+
 .. _repotype-constants-label:
 
 Repo type constants
@@ -620,6 +1251,22 @@ LibRepo Error codes.
 
     (35) Interrupted by user cb.
 
+.. data:: LRE_CANCELLED
+
+    (38) Cancelled by :meth:`~.Handle.cancel`.
+
+.. data:: LRE_DECOMPRESSION
+
+    (39) Downloaded data cannot be decompressed.
+
+.. data:: LRE_NOSPACE
+
+    (40) Not enough free disk space for the packages.
+
+.. data:: LRE_DEADLINE
+
+    (41) The target wasn't downloaded by its deadline.
+
 .. data:: LRE_UNKNOWNERROR
 
     An unknown error.
@@ -646,6 +1293,14 @@ LibRepo Result options for use in :meth:`~.Result.getinfo` method.
     Return the highest timestamp from all records in the repomd.
     See: http://yum.baseurl.org/gitweb?p=yum.git;a=commitdiff;h=59d3d67f
 
+.. data:: LRR_YUM_REPOMD_DIFF
+
+    Return a dict with lists of the types of the records which were
+    ``added``, ``removed`` and ``changed`` (checksum, size
+    or timestamp) against the previous repomd.xml in the destination
+    directory (or in :data:`.LRO_YUMREUSEDIR`) or None if there was
+    no previous repomd.xml.
+
 .. _endcb-statuses-label:
 
 Transfer statuses for endcb of :class:`~.PackageTarget`
@@ -683,6 +1338,55 @@ Callback frequently called during a download.
 :downloaded: Currently downloaded size (in bytes).
 :returns: This callback can return values from :ref:`callbacks-return-values`
 
+.. _callback-multiprogresscb-label:
+
+Aggregated progress callback - multiprogresscb
+----------------------------------------------
+
+``multiprogresscb(userdata, progress)``
+
+Callback called at most once per :data:`.LRO_PROGRESSINTERVAL`
+with the progress of all running targets.
+
+:userdata: User specified data or *None*
+:progress: List of *(path, totalsize, downloaded)* tuples.
+:returns: This callback can return values from :ref:`callbacks-return-values`
+
+.. _callback-metricscb-label:
+
+Metrics callback - metricscb
+----------------------------
+
+``metricscb(userdata, metrics)``
+
+Callback called at most once per :data:`.LRO_METRICSINTERVAL`
+during the download. Counters are totals since the beginning
+of the download, gauges are current values.
+
+:userdata: User specified data or *None*
+:metrics: Dict with keys *running* (running transfers), *queued*
+    (targets waiting for a transfer), *verifying* (files waiting
+    for the checksum verification), *bytes* (received from the mirrors),
+    *speed* (bytes per second since the previous call), *errors*
+    (dict of the failed transfers by their :ref:`error-codes-label`)
+    and *mirrors* (list of dicts with keys *url*, *running*, *bytes*,
+    *speed*, *successful* and *failed* of the used mirrors).
+:returns: This callback can return values from :ref:`callbacks-return-values`
+
+.. _callback-yumrecordcb-label:
+
+Metadata record callback - yumrecordcb
+--------------------------------------
+
+``yumrecordcb(userdata, metadata, path)``
+
+Callback called when the file of a metadata record is ready.
+
+:userdata: User specified data or *None*
+:metadata: Metadata type (e.g. "primary")
+:path: Path to the file
+:returns: This callback can return values from :ref:`callbacks-return-values`
+
 .. _callback-endcb-label:
 
 End callback - endcb
@@ -835,6 +1539,66 @@ LRO_IPRESOLVE               = _librepo.LRO_IPRESOLVE
 LRO_ALLOWEDMIRRORFAILURES   = _librepo.LRO_ALLOWEDMIRRORFAILURES
 LRO_ADAPTIVEMIRRORSORTING   = _librepo.LRO_ADAPTIVEMIRRORSORTING
 LRO_GNUPGHOMEDIR            = _librepo.LRO_GNUPGHOMEDIR
+LRO_HTTP2                   = _librepo.LRO_HTTP2
+LRO_MAXSTREAMSPERMIRROR     = _librepo.LRO_MAXSTREAMSPERMIRROR
+LRO_MAXSEGMENTS             = _librepo.LRO_MAXSEGMENTS
+LRO_MINSEGMENTSIZE          = _librepo.LRO_MINSEGMENTSIZE
+LRO_WRITEBUFFERSIZE         = _librepo.LRO_WRITEBUFFERSIZE
+LRO_PREALLOCATE             = _librepo.LRO_PREALLOCATE
+LRO_EARLYWRITEBACK          = _librepo.LRO_EARLYWRITEBACK
+LRO_DOWNLOADORDER           = _librepo.LRO_DOWNLOADORDER
+LRO_ADAPTIVEDOWNLOADSPERMIRROR = _librepo.LRO_ADAPTIVEDOWNLOADSPERMIRROR
+LRO_HEDGEDDOWNLOADS         = _librepo.LRO_HEDGEDDOWNLOADS
+LRO_LOWSPEEDRESUME          = _librepo.LRO_LOWSPEEDRESUME
+LRO_PROGRESSINTERVAL        = _librepo.LRO_PROGRESSINTERVAL
+LRO_MULTIPROGRESSCB         = _librepo.LRO_MULTIPROGRESSCB
+LRO_YUMDECOMPRESS           = _librepo.LRO_YUMDECOMPRESS
+LRO_YUMKEEPCOMPRESSED       = _librepo.LRO_YUMKEEPCOMPRESSED
+LRO_CHECKSUMTHREADS         = _librepo.LRO_CHECKSUMTHREADS
+LRO_CHECKSUMINDEX           = _librepo.LRO_CHECKSUMINDEX
+LRO_PARSECACHE              = _librepo.LRO_PARSECACHE
+LRO_METALINKMAXURLS         = _librepo.LRO_METALINKMAXURLS
+LRO_FASTESTMIRRORPROBE      = _librepo.LRO_FASTESTMIRRORPROBE
+LRO_FASTESTMIRRORCONCURRENCY = _librepo.LRO_FASTESTMIRRORCONCURRENCY
+LRO_FASTESTMIRRORGOODCOUNT  = _librepo.LRO_FASTESTMIRRORGOODCOUNT
+LRO_FASTESTMIRRORASYNC      = _librepo.LRO_FASTESTMIRRORASYNC
+LRO_CONDITIONALGET          = _librepo.LRO_CONDITIONALGET
+LRO_YUMREUSEDIR             = _librepo.LRO_YUMREUSEDIR
+LRO_YUMRECORDCB             = _librepo.LRO_YUMRECORDCB
+LRO_LAZYCHECKSUM            = _librepo.LRO_LAZYCHECKSUM
+LRO_MIRRORLISTCACHE         = _librepo.LRO_MIRRORLISTCACHE
+LRO_MIRRORLISTCACHETTL      = _librepo.LRO_MIRRORLISTCACHETTL
+LRO_PRERESOLVE              = _librepo.LRO_PRERESOLVE
+LRO_PRERESOLVECACHE         = _librepo.LRO_PRERESOLVECACHE
+LRO_PRERESOLVECACHETTL      = _librepo.LRO_PRERESOLVECACHETTL
+LRO_TLSSESSIONCACHE         = _librepo.LRO_TLSSESSIONCACHE
+LRO_PACKAGESTORE            = _librepo.LRO_PACKAGESTORE
+LRO_PACKAGESTOREMAXSIZE     = _librepo.LRO_PACKAGESTOREMAXSIZE
+LRO_CACHESOURCES            = _librepo.LRO_CACHESOURCES
+LRO_CACHESOURCETIMEOUT      = _librepo.LRO_CACHESOURCETIMEOUT
+LRO_LOCALHARDLINK           = _librepo.LRO_LOCALHARDLINK
+LRO_DURABILITY              = _librepo.LRO_DURABILITY
+LRO_ATOMICDOWNLOAD          = _librepo.LRO_ATOMICDOWNLOAD
+LRO_GPGBACKEND              = _librepo.LRO_GPGBACKEND
+LRO_MIRRORHEALTHCACHE       = _librepo.LRO_MIRRORHEALTHCACHE
+LRO_MIRRORBREAKER           = _librepo.LRO_MIRRORBREAKER
+LRO_TRACEFILE               = _librepo.LRO_TRACEFILE
+LRO_TRACEFORMAT             = _librepo.LRO_TRACEFORMAT
+LRO_METRICSCB               = _librepo.LRO_METRICSCB
+LRO_METRICSINTERVAL         = _librepo.LRO_METRICSINTERVAL
+LRO_DOWNLOADSHARDS          = _librepo.LRO_DOWNLOADSHARDS
+LRO_SHARDENDCB              = _librepo.LRO_SHARDENDCB
+LRO_IOURING                 = _librepo.LRO_IOURING
+LRO_RESUMEJOURNAL           = _librepo.LRO_RESUMEJOURNAL
+LRO_MAXRANGESPERREQUEST     = _librepo.LRO_MAXRANGESPERREQUEST
+LRO_CONNECTIONAFFINITY      = _librepo.LRO_CONNECTIONAFFINITY
+LRO_AUTOTUNEPARALLELDOWNLOADS = _librepo.LRO_AUTOTUNEPARALLELDOWNLOADS
+LRO_ACCEPTENCODING          = _librepo.LRO_ACCEPTENCODING
+LRO_CRITICALSLOTS           = _librepo.LRO_CRITICALSLOTS
+LRO_PROXIES                 = _librepo.LRO_PROXIES
+LRO_RECVBUFFERSIZE          = _librepo.LRO_RECVBUFFERSIZE
+LRO_ENDCBTHREADS            = _librepo.LRO_ENDCBTHREADS
+LRO_ENDCBQUEUESIZE          = _librepo.LRO_ENDCBQUEUESIZE
 LRO_SENTINEL                = _librepo.LRO_SENTINEL
 
 ATTR_TO_LRO = {
@@ -883,6 +1647,66 @@ ATTR_TO_LRO = {
     "allowedmirrorfailures":LRO_ALLOWEDMIRRORFAILURES,
     "adaptivemirrorsorting":LRO_ADAPTIVEMIRRORSORTING,
     "gnupghomedir":         LRO_GNUPGHOMEDIR,
+    "http2":                LRO_HTTP2,
+    "maxstreamspermirror":  LRO_MAXSTREAMSPERMIRROR,
+    "maxsegments":          LRO_MAXSEGMENTS,
+    "minsegmentsize":       LRO_MINSEGMENTSIZE,
+    "writebuffersize":      LRO_WRITEBUFFERSIZE,
+    "preallocate":          LRO_PREALLOCATE,
+    "earlywriteback":       LRO_EARLYWRITEBACK,
+    "downloadorder":        LRO_DOWNLOADORDER,
+    "adaptivedownloadspermirror": LRO_ADAPTIVEDOWNLOADSPERMIRROR,
+    "hedgeddownloads":      LRO_HEDGEDDOWNLOADS,
+    "lowspeedresume":       LRO_LOWSPEEDRESUME,
+    "progressinterval":     LRO_PROGRESSINTERVAL,
+    "multiprogresscb":      LRO_MULTIPROGRESSCB,
+    "yumdecompress":        LRO_YUMDECOMPRESS,
+    "yumkeepcompressed":    LRO_YUMKEEPCOMPRESSED,
+    "checksumthreads":      LRO_CHECKSUMTHREADS,
+    "checksumindex":        LRO_CHECKSUMINDEX,
+    "parsecache":           LRO_PARSECACHE,
+    "metalinkmaxurls":      LRO_METALINKMAXURLS,
+    "fastestmirrorprobe":   LRO_FASTESTMIRRORPROBE,
+    "fastestmirrorconcurrency":LRO_FASTESTMIRRORCONCURRENCY,
+    "fastestmirrorgoodcount":LRO_FASTESTMIRRORGOODCOUNT,
+    "fastestmirrorasync":   LRO_FASTESTMIRRORASYNC,
+    "conditionalget":       LRO_CONDITIONALGET,
+    "yumreusedir":          LRO_YUMREUSEDIR,
+    "yumrecordcb":          LRO_YUMRECORDCB,
+    "lazychecksum":         LRO_LAZYCHECKSUM,
+    "mirrorlistcache":      LRO_MIRRORLISTCACHE,
+    "mirrorlistcachettl":   LRO_MIRRORLISTCACHETTL,
+    "preresolve":           LRO_PRERESOLVE,
+    "preresolvecache":      LRO_PRERESOLVECACHE,
+    "preresolvecachettl":   LRO_PRERESOLVECACHETTL,
+    "tlssessioncache":      LRO_TLSSESSIONCACHE,
+    "packagestore":         LRO_PACKAGESTORE,
+    "packagestoremaxsize":  LRO_PACKAGESTOREMAXSIZE,
+    "cachesources":         LRO_CACHESOURCES,
+    "cachesourcetimeout":   LRO_CACHESOURCETIMEOUT,
+    "localhardlink":        LRO_LOCALHARDLINK,
+    "durability":           LRO_DURABILITY,
+    "atomicdownload":       LRO_ATOMICDOWNLOAD,
+    "gpgbackend":           LRO_GPGBACKEND,
+    "mirrorhealthcache":    LRO_MIRRORHEALTHCACHE,
+    "mirrorbreaker":        LRO_MIRRORBREAKER,
+    "tracefile":            LRO_TRACEFILE,
+    "traceformat":          LRO_TRACEFORMAT,
+    "metricscb":            LRO_METRICSCB,
+    "metricsinterval":      LRO_METRICSINTERVAL,
+    "downloadshards":       LRO_DOWNLOADSHARDS,
+    "shardendcb":           LRO_SHARDENDCB,
+    "iouring":              LRO_IOURING,
+    "resumejournal":        LRO_RESUMEJOURNAL,
+    "maxrangesperrequest":  LRO_MAXRANGESPERREQUEST,
+    "connectionaffinity":   LRO_CONNECTIONAFFINITY,
+    "autotuneparalleldownloads": LRO_AUTOTUNEPARALLELDOWNLOADS,
+    "acceptencoding":       LRO_ACCEPTENCODING,
+    "criticalslots":        LRO_CRITICALSLOTS,
+    "proxies":              LRO_PROXIES,
+    "recvbuffersize":       LRO_RECVBUFFERSIZE,
+    "endcbthreads":         LRO_ENDCBTHREADS,
+    "endcbqueuesize":       LRO_ENDCBQUEUESIZE,
 }
 
 LRI_UPDATE              = _librepo.LRI_UPDATE
@@ -913,6 +1737,62 @@ LRI_IPRESOLVE           = _librepo.LRI_IPRESOLVE
 LRI_ALLOWEDMIRRORFAILURES=_librepo.LRI_ALLOWEDMIRRORFAILURES
 LRI_ADAPTIVEMIRRORSORTING=_librepo.LRI_ADAPTIVEMIRRORSORTING
 LRI_GNUPGHOMEDIR        =_librepo.LRI_GNUPGHOMEDIR
+LRI_HTTP2               = _librepo.LRI_HTTP2
+LRI_MAXSTREAMSPERMIRROR = _librepo.LRI_MAXSTREAMSPERMIRROR
+LRI_MAXSEGMENTS         = _librepo.LRI_MAXSEGMENTS
+LRI_WRITEBUFFERSIZE     = _librepo.LRI_WRITEBUFFERSIZE
+LRI_PREALLOCATE         = _librepo.LRI_PREALLOCATE
+LRI_EARLYWRITEBACK      = _librepo.LRI_EARLYWRITEBACK
+LRI_DOWNLOADORDER       = _librepo.LRI_DOWNLOADORDER
+LRI_ADAPTIVEDOWNLOADSPERMIRROR = _librepo.LRI_ADAPTIVEDOWNLOADSPERMIRROR
+LRI_HEDGEDDOWNLOADS     = _librepo.LRI_HEDGEDDOWNLOADS
+LRI_LOWSPEEDRESUME      = _librepo.LRI_LOWSPEEDRESUME
+LRI_PROGRESSINTERVAL    = _librepo.LRI_PROGRESSINTERVAL
+LRI_YUMDECOMPRESS       = _librepo.LRI_YUMDECOMPRESS
+LRI_YUMKEEPCOMPRESSED   = _librepo.LRI_YUMKEEPCOMPRESSED
+LRI_CHECKSUMTHREADS     = _librepo.LRI_CHECKSUMTHREADS
+LRI_CHECKSUMINDEX       = _librepo.LRI_CHECKSUMINDEX
+LRI_PARSECACHE          = _librepo.LRI_PARSECACHE
+LRI_METALINKMAXURLS     = _librepo.LRI_METALINKMAXURLS
+LRI_FASTESTMIRRORPROBE  = _librepo.LRI_FASTESTMIRRORPROBE
+LRI_FASTESTMIRRORCONCURRENCY= _librepo.LRI_FASTESTMIRRORCONCURRENCY
+LRI_FASTESTMIRRORGOODCOUNT= _librepo.LRI_FASTESTMIRRORGOODCOUNT
+LRI_FASTESTMIRRORASYNC  = _librepo.LRI_FASTESTMIRRORASYNC
+LRI_CONDITIONALGET      = _librepo.LRI_CONDITIONALGET
+LRI_YUMREUSEDIR         = _librepo.LRI_YUMREUSEDIR
+LRI_LAZYCHECKSUM        = _librepo.LRI_LAZYCHECKSUM
+LRI_MIRRORLISTCACHE     = _librepo.LRI_MIRRORLISTCACHE
+LRI_MIRRORLISTCACHETTL  = _librepo.LRI_MIRRORLISTCACHETTL
+LRI_PRERESOLVE          = _librepo.LRI_PRERESOLVE
+LRI_PRERESOLVECACHE     = _librepo.LRI_PRERESOLVECACHE
+LRI_PRERESOLVECACHETTL  = _librepo.LRI_PRERESOLVECACHETTL
+LRI_TLSSESSIONCACHE     = _librepo.LRI_TLSSESSIONCACHE
+LRI_PACKAGESTORE        = _librepo.LRI_PACKAGESTORE
+LRI_CACHESOURCES        = _librepo.LRI_CACHESOURCES
+LRI_CACHESOURCETIMEOUT  = _librepo.LRI_CACHESOURCETIMEOUT
+LRI_LOCALHARDLINK       = _librepo.LRI_LOCALHARDLINK
+LRI_DURABILITY          = _librepo.LRI_DURABILITY
+LRI_ATOMICDOWNLOAD      = _librepo.LRI_ATOMICDOWNLOAD
+LRI_GPGBACKEND          = _librepo.LRI_GPGBACKEND
+LRI_STATS               = _librepo.LRI_STATS
+LRI_MIRRORHEALTHCACHE   = _librepo.LRI_MIRRORHEALTHCACHE
+LRI_MIRRORBREAKER       = _librepo.LRI_MIRRORBREAKER
+LRI_TRACEFILE           = _librepo.LRI_TRACEFILE
+LRI_TRACEFORMAT         = _librepo.LRI_TRACEFORMAT
+LRI_METRICSINTERVAL     = _librepo.LRI_METRICSINTERVAL
+LRI_DOWNLOADSHARDS      = _librepo.LRI_DOWNLOADSHARDS
+LRI_SHARDENDCB          = _librepo.LRI_SHARDENDCB
+LRI_IOURING             = _librepo.LRI_IOURING
+LRI_RESUMEJOURNAL       = _librepo.LRI_RESUMEJOURNAL
+LRI_MAXRANGESPERREQUEST = _librepo.LRI_MAXRANGESPERREQUEST
+LRI_CONNECTIONAFFINITY  = _librepo.LRI_CONNECTIONAFFINITY
+LRI_AUTOTUNEPARALLELDOWNLOADS = _librepo.LRI_AUTOTUNEPARALLELDOWNLOADS
+LRI_ACCEPTENCODING      = _librepo.LRI_ACCEPTENCODING
+LRI_CRITICALSLOTS       = _librepo.LRI_CRITICALSLOTS
+LRI_PROXIES             = _librepo.LRI_PROXIES
+LRI_RECVBUFFERSIZE      = _librepo.LRI_RECVBUFFERSIZE
+LRI_ENDCBTHREADS        = _librepo.LRI_ENDCBTHREADS
+LRI_ENDCBQUEUESIZE      = _librepo.LRI_ENDCBQUEUESIZE
 LRI_SENTINEL            = _librepo.LRI_SENTINEL
 
 ATTR_TO_LRI = {
@@ -944,6 +1824,62 @@ ATTR_TO_LRI = {
     "allowedmirrorfailures":LRI_ALLOWEDMIRRORFAILURES,
     "adaptivemirrorsorting":LRI_ADAPTIVEMIRRORSORTING,
     "gnupghomedir":         LRI_GNUPGHOMEDIR,
+    "http2":                LRI_HTTP2,
+    "maxstreamspermirror":  LRI_MAXSTREAMSPERMIRROR,
+    "maxsegments":          LRI_MAXSEGMENTS,
+    "writebuffersize":      LRI_WRITEBUFFERSIZE,
+    "preallocate":          LRI_PREALLOCATE,
+    "earlywriteback":       LRI_EARLYWRITEBACK,
+    "downloadorder":        LRI_DOWNLOADORDER,
+    "adaptivedownloadspermirror": LRI_ADAPTIVEDOWNLOADSPERMIRROR,
+    "hedgeddownloads":      LRI_HEDGEDDOWNLOADS,
+    "lowspeedresume":       LRI_LOWSPEEDRESUME,
+    "progressinterval":     LRI_PROGRESSINTERVAL,
+    "yumdecompress":        LRI_YUMDECOMPRESS,
+    "yumkeepcompressed":    LRI_YUMKEEPCOMPRESSED,
+    "checksumthreads":      LRI_CHECKSUMTHREADS,
+    "checksumindex":        LRI_CHECKSUMINDEX,
+    "parsecache":           LRI_PARSECACHE,
+    "metalinkmaxurls":      LRI_METALINKMAXURLS,
+    "fastestmirrorprobe":   LRI_FASTESTMIRRORPROBE,
+    "fastestmirrorconcurrency":LRI_FASTESTMIRRORCONCURRENCY,
+    "fastestmirrorgoodcount":LRI_FASTESTMIRRORGOODCOUNT,
+    "fastestmirrorasync":   LRI_FASTESTMIRRORASYNC,
+    "conditionalget":       LRI_CONDITIONALGET,
+    "yumreusedir":          LRI_YUMREUSEDIR,
+    "lazychecksum":         LRI_LAZYCHECKSUM,
+    "mirrorlistcache":      LRI_MIRRORLISTCACHE,
+    "mirrorlistcachettl":   LRI_MIRRORLISTCACHETTL,
+    "preresolve":           LRI_PRERESOLVE,
+    "preresolvecache":      LRI_PRERESOLVECACHE,
+    "preresolvecachettl":   LRI_PRERESOLVECACHETTL,
+    "tlssessioncache":      LRI_TLSSESSIONCACHE,
+    "packagestore":         LRI_PACKAGESTORE,
+    "cachesources":         LRI_CACHESOURCES,
+    "cachesourcetimeout":   LRI_CACHESOURCETIMEOUT,
+    "localhardlink":        LRI_LOCALHARDLINK,
+    "durability":           LRI_DURABILITY,
+    "atomicdownload":       LRI_ATOMICDOWNLOAD,
+    "gpgbackend":           LRI_GPGBACKEND,
+    "stats":                LRI_STATS,
+    "mirrorhealthcache":    LRI_MIRRORHEALTHCACHE,
+    "mirrorbreaker":        LRI_MIRRORBREAKER,
+    "tracefile":            LRI_TRACEFILE,
+    "traceformat":          LRI_TRACEFORMAT,
+    "metricsinterval":      LRI_METRICSINTERVAL,
+    "downloadshards":       LRI_DOWNLOADSHARDS,
+    "shardendcb":           LRI_SHARDENDCB,
+    "iouring":              LRI_IOURING,
+    "resumejournal":        LRI_RESUMEJOURNAL,
+    "maxrangesperrequest":  LRI_MAXRANGESPERREQUEST,
+    "connectionaffinity":   LRI_CONNECTIONAFFINITY,
+    "autotuneparalleldownloads": LRI_AUTOTUNEPARALLELDOWNLOADS,
+    "acceptencoding":       LRI_ACCEPTENCODING,
+    "criticalslots":        LRI_CRITICALSLOTS,
+    "proxies":              LRI_PROXIES,
+    "recvbuffersize":       LRI_RECVBUFFERSIZE,
+    "endcbthreads":         LRI_ENDCBTHREADS,
+    "endcbqueuesize":       LRI_ENDCBQUEUESIZE,
 }
 
 LR_CHECK_GPG        = _librepo.LR_CHECK_GPG
@@ -978,6 +1914,54 @@ LR_IPRESOLVE_WHATEVER   = _librepo.LR_IPRESOLVE_WHATEVER
 LR_IPRESOLVE_V4         = _librepo.LR_IPRESOLVE_V4
 LR_IPRESOLVE_V6         = _librepo.LR_IPRESOLVE_V6
 
+LR_DOWNLOADORDER_FIFO           = _librepo.LR_DOWNLOADORDER_FIFO
+LR_DOWNLOADORDER_LARGESTFIRST   = _librepo.LR_DOWNLOADORDER_LARGESTFIRST
+LR_DOWNLOADORDER_SMALLESTFIRST  = _librepo.LR_DOWNLOADORDER_SMALLESTFIRST
+LR_DOWNLOADORDER_PRIORITY       = _librepo.LR_DOWNLOADORDER_PRIORITY
+
+DOWNLOADORDER_FIFO           = _librepo.LR_DOWNLOADORDER_FIFO
+DOWNLOADORDER_LARGESTFIRST   = _librepo.LR_DOWNLOADORDER_LARGESTFIRST
+DOWNLOADORDER_SMALLESTFIRST  = _librepo.LR_DOWNLOADORDER_SMALLESTFIRST
+DOWNLOADORDER_PRIORITY       = _librepo.LR_DOWNLOADORDER_PRIORITY
+
+LR_PRIORITYCLASS_NORMAL         = _librepo.LR_PRIORITYCLASS_NORMAL
+LR_PRIORITYCLASS_CRITICAL       = _librepo.LR_PRIORITYCLASS_CRITICAL
+LR_PRIORITYCLASS_BACKGROUND     = _librepo.LR_PRIORITYCLASS_BACKGROUND
+
+PRIORITYCLASS_NORMAL         = _librepo.LR_PRIORITYCLASS_NORMAL
+PRIORITYCLASS_CRITICAL       = _librepo.LR_PRIORITYCLASS_CRITICAL
+PRIORITYCLASS_BACKGROUND     = _librepo.LR_PRIORITYCLASS_BACKGROUND
+
+LR_ADAPTIVEMIRRORSORTING_NONE       = _librepo.LR_ADAPTIVEMIRRORSORTING_NONE
+LR_ADAPTIVEMIRRORSORTING_ERRORRATE  = _librepo.LR_ADAPTIVEMIRRORSORTING_ERRORRATE
+LR_ADAPTIVEMIRRORSORTING_THROUGHPUT = _librepo.LR_ADAPTIVEMIRRORSORTING_THROUGHPUT
+
+LR_GPGBACKEND_DEFAULT   = _librepo.LR_GPGBACKEND_DEFAULT
+LR_GPGBACKEND_GPGME     = _librepo.LR_GPGBACKEND_GPGME
+LR_GPGBACKEND_BUILTIN   = _librepo.LR_GPGBACKEND_BUILTIN
+
+GPGBACKEND_DEFAULT   = _librepo.LR_GPGBACKEND_DEFAULT
+GPGBACKEND_GPGME     = _librepo.LR_GPGBACKEND_GPGME
+GPGBACKEND_BUILTIN   = _librepo.LR_GPGBACKEND_BUILTIN
+
+LR_TRACE_CHROME         = _librepo.LR_TRACE_CHROME
+LR_TRACE_JSONLINES      = _librepo.LR_TRACE_JSONLINES
+
+TRACE_CHROME            = _librepo.LR_TRACE_CHROME
+TRACE_JSONLINES         = _librepo.LR_TRACE_JSONLINES
+
+ADAPTIVEMIRRORSORTING_NONE       = _librepo.LR_ADAPTIVEMIRRORSORTING_NONE
+ADAPTIVEMIRRORSORTING_ERRORRATE  = _librepo.LR_ADAPTIVEMIRRORSORTING_ERRORRATE
+ADAPTIVEMIRRORSORTING_THROUGHPUT = _librepo.LR_ADAPTIVEMIRRORSORTING_THROUGHPUT
+
+LR_DURABILITY_NONE      = _librepo.LR_DURABILITY_NONE
+LR_DURABILITY_BATCH     = _librepo.LR_DURABILITY_BATCH
+LR_DURABILITY_STRICT    = _librepo.LR_DURABILITY_STRICT
+
+DURABILITY_NONE      = _librepo.LR_DURABILITY_NONE
+DURABILITY_BATCH     = _librepo.LR_DURABILITY_BATCH
+DURABILITY_STRICT    = _librepo.LR_DURABILITY_STRICT
+
 IPRESOLVE_WHATEVER   = _librepo.LR_IPRESOLVE_WHATEVER
 IPRESOLVE_V4         = _librepo.LR_IPRESOLVE_V4
 IPRESOLVE_V6         = _librepo.LR_IPRESOLVE_V6
@@ -1030,17 +2014,23 @@ LRE_OPENSSL             = _librepo.LRE_OPENSSL
 LRE_MEMORY              = _librepo.LRE_MEMORY
 LRE_XMLPARSER           = _librepo.LRE_XMLPARSER
 LRE_CBINTERRUPTED       = _librepo.LRE_CBINTERRUPTED
+LRE_CANCELLED           = _librepo.LRE_CANCELLED
+LRE_DECOMPRESSION       = _librepo.LRE_DECOMPRESSION
+LRE_NOSPACE             = _librepo.LRE_NOSPACE
+LRE_DEADLINE            = _librepo.LRE_DEADLINE
 LRE_UNKNOWNERROR        = _librepo.LRE_UNKNOWNERROR
 
 LRR_YUM_REPO        = _librepo.LRR_YUM_REPO
 LRR_YUM_REPOMD      = _librepo.LRR_YUM_REPOMD
 LRR_YUM_TIMESTAMP   = _librepo.LRR_YUM_TIMESTAMP
+LRR_YUM_REPOMD_DIFF = _librepo.LRR_YUM_REPOMD_DIFF
 LRR_SENTINEL        = _librepo.LRR_SENTINEL
 
 ATTR_TO_LRR = {
     "yum_repo":         LRR_YUM_REPO,
     "yum_repomd":       LRR_YUM_REPOMD,
     "yum_timestamp":    LRR_YUM_TIMESTAMP,
+    "yum_repomd_diff":  LRR_YUM_REPOMD_DIFF,
 }
 
 CHECKSUM_UNKNOWN    = _librepo.CHECKSUM_UNKNOWN
@@ -1098,12 +2088,20 @@ class PackageTarget(_librepo.PackageTarget):
     """
     Represent a single package that will be downloaded by
     :func:`~librepo.download_packages`.
+
+    After the download, the *local_path* and *err* attributes are set.
+    Timing of the last transfer of the package (in seconds from its start)
+    is available as *namelookup_time*, *connect_time*, *appconnect_time*,
+    *starttransfer_time* and *total_time*. *speed_download* is the average
+    speed in bytes per second and *attempts* is the number of transfers
+    (mirror attempts) of the package.
     """
 
     def __init__(self, relative_url, dest=None, checksum_type=CHECKSUM_UNKNOWN,
                  checksum=None, expectedsize=0, base_url=None, resume=False,
                  progresscb=None, cbdata=None, handle=None, endcb=None,
-                 mirrorfailurecb=None, byterangestart=0, byterangeend=0):
+                 mirrorfailurecb=None, byterangestart=0, byterangeend=0,
+                 priority=0, deadline=0, priorityclass=PRIORITYCLASS_NORMAL):
         """
         :param relative_url: Target URL. If *handle* or *base_url* specified,
             the *url* can be (and logically should be) only a relative part of path.
@@ -1127,12 +2125,79 @@ class PackageTarget(_librepo.PackageTarget):
         :param byterangeend: Stop downloading at the specified byte.
             *Note: If the byterangeend is less or equal to byterangestart,
             then it is ignored!*
+        :param priority: Priority of the target. Targets with higher
+            priority are downloaded first if :data:`.LRO_DOWNLOADORDER`
+            is :data:`.DOWNLOADORDER_PRIORITY`.
+        :param deadline: Time (as returned by :func:`time.time`) by which
+            the package has to be downloaded or 0. Packages with a deadline
+            are downloaded first, earliest deadline first. If the package
+            fails to be downloaded in time, its error is
+            :data:`.LRE_DEADLINE`.
+        :param priorityclass: :ref:`priorityclass-label`
         """
         _librepo.PackageTarget.__init__(self, handle, relative_url, dest,
                                         checksum_type, checksum, expectedsize,
                                         base_url, resume, progresscb, cbdata,
                                         endcb, mirrorfailurecb, byterangestart,
-                                        byterangeend)
+                                        byterangeend, priority, float(deadline),
+                                        priorityclass)
+
+    @classmethod
+    def bulk(cls, relative_urls, dests=None, checksum_types=CHECKSUM_UNKNOWN,
+             checksums=None, expectedsizes=None, base_url=None, handle=None):
+        """
+        Create many package targets at once. It is much faster than
+        creating the targets one by one, the native targets are built
+        in a single loop without the GIL.
+
+        Every column except *relative_urls* could be a single value
+        shared by all the targets instead of a sequence with an item
+        per target. The other attributes of the targets have their
+        default values, *endcb* could be set later.
+
+        :param relative_urls: Sequence of target URLs, see
+            :class:`PackageTarget`.
+        :param dests: Destination (or a sequence of them) or *None*.
+        :param checksum_types: :ref:`checksum-constants-label` (or a sequence
+            of them).
+        :param checksums: Sequence of expected checksums (or *None* items)
+            or *None*.
+        :param expectedsizes: Expected size (or a sequence of them) or *None*.
+        :param base_url: Base part of URL of all the targets.
+        :param handle: :class:`~librepo.Handle` of all the targets.
+        :returns: List of :class:`PackageTarget` objects.
+        """
+        return cls._bulk_new(handle, relative_urls, dests, checksum_types,
+                             checksums, expectedsizes, base_url)
+
+    def set_delta(self, delta_url, delta_checksum_type=CHECKSUM_UNKNOWN,
+                  delta_checksum=None, delta_size=0, delta_base=None):
+        """
+        Reconstruct the package from a delta RPM instead of downloading
+        the whole package. The package is rebuilt by ``applydeltarpm``
+        while other packages are downloaded. If the delta cannot be
+        downloaded or applied, the whole package is downloaded.
+
+        :param delta_url: Relative part of URL of the delta.
+        :param delta_checksum_type: :ref:`checksum-constants-label`
+        :param delta_checksum: Expected checksum of the delta.
+        :param delta_size: Expected size of the delta.
+        :param delta_base: Path to the old version of the package. If *None*
+            the delta is applied to the installed package.
+        """
+        _librepo.PackageTarget.set_delta(self, delta_url, delta_checksum_type,
+                                         delta_checksum, delta_size,
+                                         delta_base)
+
+    def cancel(self):
+        """
+        Cancel the download of the package. It could be called from
+        another thread or from a callback while :func:`download_packages`
+        runs. The package is not downloaded or its transfer is stopped,
+        its *endcb* is called with :data:`TRANSFER_ERROR` and its *err*
+        is set. A package which is already downloaded is not affected.
+        """
+        _librepo.PackageTarget.cancel(self)
 
 
 class Handle(_librepo.Handle):
@@ -1322,6 +2387,246 @@ class Handle(_librepo.Handle):
 
         See :data:`.LRO_GNUPGHOMEDIR`
 
+    .. attribute:: http2:
+
+        See :data:`.LRO_HTTP2`
+
+    .. attribute:: maxstreamspermirror:
+
+        See :data:`.LRO_MAXSTREAMSPERMIRROR`
+
+    .. attribute:: maxsegments:
+
+        See :data:`.LRO_MAXSEGMENTS`
+
+    .. attribute:: minsegmentsize:
+
+        See :data:`.LRO_MINSEGMENTSIZE`
+
+    .. attribute:: writebuffersize:
+
+        See :data:`.LRO_WRITEBUFFERSIZE`
+
+    .. attribute:: preallocate:
+
+        See :data:`.LRO_PREALLOCATE`
+
+    .. attribute:: earlywriteback:
+
+        See :data:`.LRO_EARLYWRITEBACK`
+
+    .. attribute:: downloadorder:
+
+        See :data:`.LRO_DOWNLOADORDER`
+
+    .. attribute:: adaptivedownloadspermirror:
+
+        See :data:`.LRO_ADAPTIVEDOWNLOADSPERMIRROR`
+
+    .. attribute:: hedgeddownloads:
+
+        See :data:`.LRO_HEDGEDDOWNLOADS`
+
+    .. attribute:: lowspeedresume:
+
+        See :data:`.LRO_LOWSPEEDRESUME`
+
+    .. attribute:: progressinterval:
+
+        See :data:`.LRO_PROGRESSINTERVAL`
+
+    .. attribute:: multiprogresscb:
+
+        See :data:`.LRO_MULTIPROGRESSCB`
+
+    .. attribute:: yumdecompress:
+
+        See :data:`.LRO_YUMDECOMPRESS`
+
+    .. attribute:: yumkeepcompressed:
+
+        See :data:`.LRO_YUMKEEPCOMPRESSED`
+
+    .. attribute:: checksumthreads:
+
+        See :data:`.LRO_CHECKSUMTHREADS`
+
+    .. attribute:: checksumindex:
+
+        See :data:`.LRO_CHECKSUMINDEX`
+
+    .. attribute:: parsecache:
+
+        See :data:`.LRO_PARSECACHE`
+
+    .. attribute:: metalinkmaxurls:
+
+        See :data:`.LRO_METALINKMAXURLS`
+
+    .. attribute:: fastestmirrorprobe:
+
+        See :data:`.LRO_FASTESTMIRRORPROBE`
+
+    .. attribute:: fastestmirrorconcurrency:
+
+        See :data:`.LRO_FASTESTMIRRORCONCURRENCY`
+
+    .. attribute:: fastestmirrorgoodcount:
+
+        See :data:`.LRO_FASTESTMIRRORGOODCOUNT`
+
+    .. attribute:: fastestmirrorasync:
+
+        See :data:`.LRO_FASTESTMIRRORASYNC`
+
+    .. attribute:: conditionalget:
+
+        See :data:`.LRO_CONDITIONALGET`
+
+    .. attribute:: yumreusedir:
+
+        See :data:`.LRO_YUMREUSEDIR`
+
+    .. attribute:: yumrecordcb:
+
+        See :data:`.LRO_YUMRECORDCB`
+
+    .. attribute:: lazychecksum:
+
+        See :data:`.LRO_LAZYCHECKSUM`
+
+    .. attribute:: mirrorlistcache:
+
+        See :data:`.LRO_MIRRORLISTCACHE`
+
+    .. attribute:: mirrorlistcachettl:
+
+        See :data:`.LRO_MIRRORLISTCACHETTL`
+
+    .. attribute:: preresolve:
+
+        See :data:`.LRO_PRERESOLVE`
+
+    .. attribute:: preresolvecache:
+
+        See :data:`.LRO_PRERESOLVECACHE`
+
+    .. attribute:: preresolvecachettl:
+
+        See :data:`.LRO_PRERESOLVECACHETTL`
+
+    .. attribute:: tlssessioncache:
+
+        See :data:`.LRO_TLSSESSIONCACHE`
+
+    .. attribute:: packagestore:
+
+        See :data:`.LRO_PACKAGESTORE`
+
+    .. attribute:: packagestoremaxsize:
+
+        See :data:`.LRO_PACKAGESTOREMAXSIZE`
+
+    .. attribute:: cachesources:
+
+        See :data:`.LRO_CACHESOURCES`
+
+    .. attribute:: cachesourcetimeout:
+
+        See :data:`.LRO_CACHESOURCETIMEOUT`
+
+    .. attribute:: localhardlink:
+
+        See :data:`.LRO_LOCALHARDLINK`
+
+    .. attribute:: durability:
+
+        See :data:`.LRO_DURABILITY`
+
+    .. attribute:: atomicdownload:
+
+        See :data:`.LRO_ATOMICDOWNLOAD`
+
+    .. attribute:: gpgbackend:
+
+        See :data:`.LRO_GPGBACKEND`
+
+    .. attribute:: mirrorhealthcache:
+
+        See :data:`.LRO_MIRRORHEALTHCACHE`
+
+    .. attribute:: mirrorbreaker:
+
+        See :data:`.LRO_MIRRORBREAKER`
+
+    .. attribute:: tracefile:
+
+        See :data:`.LRO_TRACEFILE`
+
+    .. attribute:: traceformat:
+
+        See :data:`.LRO_TRACEFORMAT`
+
+    .. attribute:: metricscb:
+
+        See :data:`.LRO_METRICSCB`
+
+    .. attribute:: metricsinterval:
+
+        See :data:`.LRO_METRICSINTERVAL`
+
+    .. attribute:: downloadshards:
+
+        See :data:`.LRO_DOWNLOADSHARDS`
+
+    .. attribute:: shardendcb:
+
+        See :data:`.LRO_SHARDENDCB`
+
+    .. attribute:: iouring:
+
+        See :data:`.LRO_IOURING`
+
+    .. attribute:: resumejournal:
+
+        See :data:`.LRO_RESUMEJOURNAL`
+
+    .. attribute:: maxrangesperrequest:
+
+        See :data:`.LRO_MAXRANGESPERREQUEST`
+
+    .. attribute:: connectionaffinity:
+
+        See :data:`.LRO_CONNECTIONAFFINITY`
+
+    .. attribute:: autotuneparalleldownloads:
+
+        See :data:`.LRO_AUTOTUNEPARALLELDOWNLOADS`
+
+    .. attribute:: acceptencoding:
+
+        See :data:`.LRO_ACCEPTENCODING`
+
+    .. attribute:: criticalslots:
+
+        See :data:`.LRO_CRITICALSLOTS`
+
+    .. attribute:: proxies:
+
+        See :data:`.LRO_PROXIES`
+
+    .. attribute:: recvbuffersize:
+
+        See :data:`.LRO_RECVBUFFERSIZE`
+
+    .. attribute:: endcbthreads:
+
+        See :data:`.LRO_ENDCBTHREADS`
+
+    .. attribute:: endcbqueuesize:
+
+        See :data:`.LRO_ENDCBQUEUESIZE`
+
     """
 
     def setopt(self, option, val):
@@ -1434,6 +2739,43 @@ class Handle(_librepo.Handle):
         _librepo.Handle.perform(self, result)
         return result
 
+    def perform_async(self, result=None, loop=None):
+        """
+        Non-blocking :meth:`~.Handle.perform` for asyncio. The repository
+        is downloaded by a thread of the default executor of the loop
+        (the GIL is released for the whole download), so more downloads
+        run in parallel while the loop serves other tasks. If the returned
+        future is cancelled, the handle is cancelled (see
+        :meth:`~.Handle.cancel`).
+
+        :param result: :Class:`~librepo.Result` object or *None*
+        :param loop: asyncio event loop or *None* for the current one
+        :returns: :class:`asyncio.Future` of the :Class:`~librepo.Result`
+        """
+        loop = _asyncio_loop(loop)
+        if result is None:
+            result = Result()
+        future = loop.run_in_executor(None, self.perform, result)
+        future.add_done_callback(
+            lambda future: future.cancelled() and self.cancel())
+        return future
+
+    def cancel(self):
+        """
+        Cancel operations of the handle. Could be called from another
+        thread while :meth:`~.Handle.perform` or a download runs.
+        The operations raise :class:`~librepo.LibrepoException` with
+        :data:`LRE_CANCELLED` and the handle stays cancelled until
+        :meth:`~.Handle.reset_cancel` is called.
+        """
+        _librepo.Handle.cancel(self)
+
+    def reset_cancel(self):
+        """
+        Make the cancelled handle usable again.
+        """
+        _librepo.Handle.reset_cancel(self)
+
     def new_packagetarget(self, relative_url, **kwargs):
         """
         Shortcut for creating a new :Class:`~librepo.PackageTarget` objects.
@@ -1463,6 +2805,10 @@ class Result(_librepo.Result):
     .. attribute:: yum_timestamp
 
         See: :data:`.LRR_YUM_TIMESTAMP`
+
+    .. attribute:: yum_repomd_diff
+
+        See: :data:`.LRR_YUM_REPOMD_DIFF`
     """
 
     def getinfo(self, option):
@@ -1472,6 +2818,15 @@ class Result(_librepo.Result):
         """
         return _librepo.Result.getinfo(self, option)
 
+    def yum_repo_path(self, type):
+        """Returns path of the *type* (e.g. "primary") file of the yum
+        repository or *None*. The checksum of the file is verified if it
+        wasn't verified by the :meth:`~.Handle.perform`
+        (see :data:`.LRO_LAZYCHECKSUM`), :class:`~.LibrepoException` is
+        raised when the verification fails.
+        """
+        return _librepo.Result.yum_repo_path(self, type)
+
     def __getattr__(self, attr):
         if attr not in ATTR_TO_LRR:
             raise AttributeError("'%s' object has no attribute '%s'" % \
@@ -1501,18 +2856,215 @@ def download_packages(list, failfast=False):
     """
     return _librepo.download_packages(list, failfast)
 
-def download_url(url, fd, handle=None):
+def _asyncio_loop(loop):
+    import asyncio
+    if loop is None:
+        loop = asyncio.get_event_loop()
+    return loop
+
+def _set_future_result(future, result):
+    if not future.done():
+        future.set_result(result)
+
+class _FutureEndCb(object):
+    """
+    End callback of a target of :func:`~librepo.download_packages_async`.
+    It calls the original end callback of the target and resolves
+    the future of the target in its event loop.
+    """
+
+    def __init__(self, loop, future, endcb):
+        self.loop = loop
+        self.future = future
+        self.endcb = endcb
+
+    def __call__(self, cbdata, status, msg):
+        ret = None
+        if self.endcb:
+            ret = self.endcb(cbdata, status, msg)
+        self.loop.call_soon_threadsafe(_set_future_result, self.future,
+                                       (status, msg))
+        return ret
+
+def download_packages_async(list, failfast=False, loop=None):
+    """
+    Non-blocking :func:`~librepo.download_packages` for asyncio.
+    The packages are downloaded by a thread of the default executor
+    of the loop (the GIL is released for the whole download).
+
+    Every target gets a *future* attribute, an :class:`asyncio.Future`
+    resolved with the (status, msg) of the end of its download
+    (status is one of the TRANSFER_* constants) as soon as the target
+    is done, while the other targets are still downloaded. Targets which
+    weren't finished get (:data:`TRANSFER_ERROR`, err). The end callbacks
+    of the targets are still called (from the download thread), but
+    the *endcb* attribute of a target is replaced until the download
+    finishes.
+
+    If the returned future is cancelled, the handles of the targets
+    are cancelled (see :meth:`~.Handle.cancel`).
+
+    :param list: List of :class:`~.librepo.PackageTarget` objects.
+    :param failfast: See :func:`~librepo.download_packages`.
+    :param loop: asyncio event loop or *None* for the current one
+    :returns: :class:`asyncio.Future` of the whole download (of *None*)
+    """
+    loop = _asyncio_loop(loop)
+
+    for target in list:
+        target.future = loop.create_future()
+        target.endcb = _FutureEndCb(loop, target.future, target.endcb)
+
+    def download():
+        try:
+            return download_packages(list, failfast)
+        finally:
+            for target in list:
+                target.endcb = target.endcb.endcb
+
+    def done(future):
+        if future.cancelled():
+            for handle in set(t.handle for t in list if t.handle):
+                handle.cancel()
+        for target in list:
+            _set_future_result(target.future,
+                               (TRANSFER_ERROR, target.err or "Not finished"))
+
+    future = loop.run_in_executor(None, download)
+    future.add_done_callback(done)
+    return future
+
+class _QueueEndCb(object):
+    """
+    End callback of a target of :func:`~librepo.download_packages_iter`.
+    It calls the original end callback of the target and puts the target
+    to the queue of the finished targets.
+    """
+
+    def __init__(self, queue, target, endcb):
+        self.queue = queue
+        self.target = target
+        self.endcb = endcb
+
+    def __call__(self, cbdata, status, msg):
+        ret = None
+        if self.endcb:
+            ret = self.endcb(cbdata, status, msg)
+        self.queue.put((self.target, status, msg))
+        return ret
+
+def download_packages_iter(list, failfast=False):
+    """
+    Generator version of :func:`~librepo.download_packages`.
+    The packages are downloaded by a thread (the GIL is released for
+    the whole download) and (target, status, msg) tuples of the targets
+    are yielded in the order the targets are finished, so a finished
+    package can be processed while the others are still downloaded.
+    Every target is yielded once. Targets which weren't finished are
+    yielded with :data:`TRANSFER_ERROR` after the end of the download.
+
+    The end callbacks of the targets are still called (from the download
+    thread), but the *endcb* attribute of a target is replaced until
+    the download finishes. The *err* attribute of the targets is set
+    when the whole download ends, use the status before.
+
+    If the generator is closed before all targets were yielded,
+    the handles of the targets are cancelled (see :meth:`~.Handle.cancel`).
+
+    :param list: List of :class:`~.librepo.PackageTarget` objects.
+    :param failfast: See :func:`~librepo.download_packages`.
+    :raises LibrepoException: If :func:`~librepo.download_packages` fails
+        (after all targets were yielded)
+    """
+    import threading
+    try:
+        import queue
+    except ImportError:
+        import Queue as queue
+
+    finished = queue.Queue()
+    end = object()
+    errors = []
+    returned = set()
+
+    for target in list:
+        target.endcb = _QueueEndCb(finished, target, target.endcb)
+
+    def download():
+        try:
+            download_packages(list, failfast)
+        except LibrepoException as err:
+            errors.append(err)
+        finally:
+            for target in list:
+                target.endcb = target.endcb.endcb
+            finished.put(end)
+
+    thread = threading.Thread(target=download)
+    thread.daemon = True
+    thread.start()
+
+    ended = False
+    try:
+        while True:
+            item = finished.get()
+            if item is end:
+                ended = True
+                break
+            if id(item[0]) in returned:
+                continue
+            returned.add(id(item[0]))
+            yield item
+    finally:
+        if not ended:
+            # The generator was closed, stop the download
+            for handle in set(t.handle for t in list if t.handle):
+                handle.cancel()
+        thread.join()
+
+    for target in list:
+        if id(target) not in returned:
+            returned.add(id(target))
+            yield (target, TRANSFER_ERROR, target.err or "Not finished")
+
+    if errors:
+        raise errors[0]
+
+def download_url(url, fd=None, handle=None):
     """
     Download specified URL and write it content to opened file descriptor.
 
+    If *fd* is *None*, the content is downloaded into memory and returned
+    as a read-only :class:`memoryview` of the downloaded data (they are
+    not copied, use ``bytes()`` on the view to get a copy).
+
     :param url: Target URL
     :param fd: Opened file descriptor (To get a file descriptor
-               use for example **os.open()**.
+               use for example **os.open()** or *None*.
     :param handle: :Class:`~librepo.Handle` object or *None*
-    :returns: *None*
+    :returns: *None* or :class:`memoryview` if *fd* is *None*
     """
+    if fd is None:
+        return _librepo.download_url_data(handle, url)
     return _librepo.download_url(handle, url, fd)
 
+def handles_perform(handles, results):
+    """
+    Perform :meth:`~librepo.Handle.perform` of several handles together.
+    All the mirrorlists/metalinks, then all the repomd.xml files and then
+    all the metadata files of the repositories are downloaded together,
+    the limits of parallel downloads are shared (the options of the first
+    handle are used).
+
+    :param handles: List of :class:`~librepo.Handle` objects.
+    :param results: List of :class:`~librepo.Result` objects (one for
+                    every handle).
+    :returns: List with *None* for every successful repository and
+              a tuple *(rc, msg, general_msg)* (the same as the arguments
+              of :class:`~librepo.LibrepoException`) for every failed one.
+    """
+    return _librepo.handles_perform(handles, results)
+
 def yum_repomd_get_age(result_object):
     """
     Get the highest timestamp of the repo's repomd.xml.
@@ -1522,9 +3074,54 @@ def yum_repomd_get_age(result_object):
     """
     return _librepo.yum_repomd_get_age(result_object)
 
+def alloc_accounting(enable):
+    """
+    Enable or disable the accounting of the allocations of librepo
+    (disabled by default). When enabled, the *allocations* and
+    *allocated_bytes* of :data:`LRI_STATS` are filled.
+
+    :param enable: *True* or *False*
+    :returns: *None*
+    """
+    return _librepo.alloc_accounting(enable)
+
+def alloc_stats():
+    """
+    Get the allocation counters of librepo (of all threads) since
+    the accounting was enabled for the first time.
+
+    :returns: Dict with keys *count* (number of allocations), *bytes*
+              (allocated bytes), *frees*, *live* (allocated bytes which
+              were not freed yet, an upper estimate) and *peak*
+              (maximum of the live bytes).
+    """
+    return _librepo.alloc_stats()
+
+def mirrorregistry_flush():
+    """
+    Write the mirror health data collected by the handles of the process
+    (see :data:`.LRO_MIRRORHEALTHCACHE`) to their stores. Long-running
+    processes should call it before they exit.
+
+    :returns: *None*
+    """
+    return _librepo.mirrorregistry_flush()
+
+def mirrorregistry_clear():
+    """
+    Flush and forget the fastest mirror measurements and the mirror
+    health shared by the handles of the process, the next handles
+    measure the mirrors again (e.g. after a change of the network).
+
+    :returns: *None*
+    """
+    return _librepo.mirrorregistry_clear()
+
 def set_debug_log_handler(log_function, user_data=None):
     """
-    When python debug log handler is used, the librepo is **THREAD-UNSAFE**!
+    The log_function is called with the GIL held, but it may be called
+    from any thread: downloads in other python threads and the threads
+    verifying checksums log too.
 
     :param log_function: Function that will handle the debug messages.
     :param user_data: An data you want to be passed to the log_function
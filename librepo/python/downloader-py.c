@@ -28,7 +28,6 @@
 #include "handle-py.h"
 #include "packagetarget-py.h"
 #include "exception-py.h"
-#include "globalstate-py.h" // GIL Hack
 
 void
 BeginAllowThreads(PyThreadState **state)
@@ -71,19 +70,10 @@ py_download_url(G_GNUC_UNUSED PyObject *self, PyObject *args)
         return NULL;
     }
 
-    // XXX: GIL Hack
-    int hack_rc = gil_logger_hack_begin(&state);
-    if (hack_rc == GIL_HACK_ERROR)
-        return NULL;
-
     BeginAllowThreads(&state);
     ret = lr_download_url(handle, url, fd, &tmp_err);
     EndAllowThreads(&state);
 
-    // XXX: GIL Hack
-    if (!gil_logger_hack_end(hack_rc))
-        return NULL;
-
     assert((ret && !tmp_err) || (!ret && tmp_err));
 
     if (ret)
@@ -104,3 +94,142 @@ py_download_url(G_GNUC_UNUSED PyObject *self, PyObject *args)
         RETURN_ERROR(&tmp_err, -1, NULL);
     }
 }
+
+/* Downloaded data
+ *
+ * Owner of the data of a target downloaded into memory. Python accesses
+ * them by the buffer protocol (a memoryview is returned), so the data
+ * are not copied.
+ */
+
+typedef struct {
+    PyObject_HEAD
+    GByteArray *data;
+} _DownloadedDataObject;
+
+static int
+downloadeddata_getbuffer(_DownloadedDataObject *self,
+                         Py_buffer *view,
+                         int flags)
+{
+    return PyBuffer_FillInfo(view, (PyObject *) self, self->data->data,
+                             self->data->len, 1, flags);
+}
+
+static void
+downloadeddata_dealloc(_DownloadedDataObject *o)
+{
+    if (o->data)
+        g_byte_array_unref(o->data);
+    Py_TYPE(o)->tp_free(o);
+}
+
+static PyBufferProcs downloadeddata_as_buffer = {
+#if PY_MAJOR_VERSION < 3
+    0,                                          /* bf_getreadbuffer */
+    0,                                          /* bf_getwritebuffer */
+    0,                                          /* bf_getsegcount */
+    0,                                          /* bf_getcharbuffer */
+#endif
+    (getbufferproc) downloadeddata_getbuffer,   /* bf_getbuffer */
+    0,                                          /* bf_releasebuffer */
+};
+
+PyTypeObject DownloadedData_Type = {
+    PyVarObject_HEAD_INIT(NULL, 0)
+    "_librepo.DownloadedData",      /* tp_name */
+    sizeof(_DownloadedDataObject),  /* tp_basicsize */
+    0,                              /* tp_itemsize */
+    (destructor) downloadeddata_dealloc, /* tp_dealloc */
+    0,                              /* tp_print */
+    0,                              /* tp_getattr */
+    0,                              /* tp_setattr */
+    0,                              /* tp_compare */
+    0,                              /* tp_repr */
+    0,                              /* tp_as_number */
+    0,                              /* tp_as_sequence */
+    0,                              /* tp_as_mapping */
+    0,                              /* tp_hash */
+    0,                              /* tp_call */
+    0,                              /* tp_str */
+    0,                              /* tp_getattro */
+    0,                              /* tp_setattro */
+    &downloadeddata_as_buffer,      /* tp_as_buffer */
+#if PY_MAJOR_VERSION < 3
+    Py_TPFLAGS_DEFAULT|Py_TPFLAGS_HAVE_NEWBUFFER, /* tp_flags */
+#else
+    Py_TPFLAGS_DEFAULT,             /* tp_flags */
+#endif
+    "Downloaded data",              /* tp_doc */
+};
+
+PyObject *
+py_download_url_data(G_GNUC_UNUSED PyObject *self, PyObject *args)
+{
+    gboolean ret;
+    PyObject *py_handle;
+    LrHandle *handle = NULL;
+    char *url;
+    LrDownloadTarget *target;
+    _DownloadedDataObject *data;
+    PyObject *view;
+    GError *tmp_err = NULL;
+    PyThreadState *state = NULL;
+
+    if (!PyArg_ParseTuple(args, "Os:download_url_data",
+                          &py_handle, &url))
+        return NULL;
+
+    if (HandleObject_Check(py_handle)) {
+        handle = Handle_FromPyObject(py_handle);
+    } else if (py_handle != Py_None) {
+        PyErr_SetString(PyExc_TypeError, "Only Handle or None is supported");
+        return NULL;
+    }
+
+    // Target without fd and fn is downloaded into memory
+    target = lr_downloadtarget_new(handle,
+                                   url, NULL, -1, NULL,
+                                   NULL, 0, 0, NULL, NULL,
+                                   NULL, NULL, NULL, 0, 0);
+
+    BeginAllowThreads(&state);
+    ret = lr_download_target(target, &tmp_err);
+    EndAllowThreads(&state);
+
+    assert((ret && !tmp_err) || (!ret && tmp_err));
+
+    if (!ret) {
+        lr_downloadtarget_free(target);
+
+        if (PyErr_Occurred()) {
+            // Python exception occured (in a python callback probably)
+            g_error_free(tmp_err);
+            return NULL;
+        } else if(tmp_err->code == LRE_INTERRUPTED) {
+            // Interrupted by Ctr+C
+            g_error_free(tmp_err);
+            PyErr_SetInterrupt();
+            PyErr_CheckSignals();
+            return NULL;
+        } else {
+            // Return exception created from GError
+            RETURN_ERROR(&tmp_err, -1, NULL);
+        }
+    }
+
+    data = PyObject_New(_DownloadedDataObject, &DownloadedData_Type);
+    if (!data) {
+        lr_downloadtarget_free(target);
+        return NULL;
+    }
+
+    // The data are handed over from the target to the Python object
+    data->data = target->data;
+    target->data = NULL;
+    lr_downloadtarget_free(target);
+
+    view = PyMemoryView_FromObject((PyObject *) data);
+    Py_DECREF(data);
+    return view;
+}
@@ -23,7 +23,10 @@
 
 #include "librepo/librepo.h"
 
+extern PyTypeObject DownloadedData_Type;
+
 PyObject *py_download_url(PyObject *self, PyObject *args);
+PyObject *py_download_url_data(PyObject *self, PyObject *args);
 
 void BeginAllowThreads(PyThreadState **state);
 void EndAllowThreads(PyThreadState **state);
@@ -32,7 +32,6 @@
 #include "packagedownloader-py.h"
 #include "downloader-py.h"
 
-#include "globalstate-py.h"  // GIL Hack
 
 typedef struct {
     PyObject_HEAD
@@ -43,9 +42,9 @@ typedef struct {
     PyObject *fastestmirror_cb;
     PyObject *fastestmirror_cb_data;
     PyObject *hmf_cb;
-    /* GIL stuff */
-    // See: http://docs.python.org/2/c-api/init.html#releasing-the-gil-from-extension-code
-    PyThreadState **state;
+    PyObject *multiprogress_cb;
+    PyObject *metrics_cb;
+    PyObject *yumrecord_cb;
 } _HandleObject;
 
 LrHandle *
@@ -58,14 +57,6 @@ Handle_FromPyObject(PyObject *o)
     return ((_HandleObject *)o)->handle;
 }
 
-void
-Handle_SetThreadState(PyObject *o, PyThreadState **state)
-{
-    _HandleObject *self = (_HandleObject *) o;
-    if (!self) return;
-    self->state = state;
-}
-
 static int
 check_HandleStatus(const _HandleObject *self)
 {
@@ -80,6 +71,11 @@ check_HandleStatus(const _HandleObject *self)
 
 /* Callback stuff */
 
+/* The callbacks are called while the GIL is released by the download
+ * (possibly from another thread), so they take the GIL themselves
+ * by PyGILState_Ensure() just for the Python call.
+ */
+
 static int
 progress_callback(void *data, double total_to_download, double now_downloaded)
 {
@@ -96,7 +92,7 @@ progress_callback(void *data, double total_to_download, double now_downloaded)
     else
         user_data = Py_None;
 
-    EndAllowThreads(self->state);
+    PyGILState_STATE gstate = PyGILState_Ensure();
     result = PyObject_CallFunction(self->progress_cb,
                         "(Odd)", user_data, total_to_download, now_downloaded);
 
@@ -122,7 +118,7 @@ progress_callback(void *data, double total_to_download, double now_downloaded)
     }
 
     Py_XDECREF(result);
-    BeginAllowThreads(self->state);
+    PyGILState_Release(gstate);
 
     return ret;
 }
@@ -142,6 +138,8 @@ fastestmirror_callback(void *data, LrFastestMirrorStages stage, void *ptr)
     else
         user_data = Py_None;
 
+    PyGILState_STATE gstate = PyGILState_Ensure();
+
     if (!ptr) {
         pydata = Py_None;
     } else {
@@ -159,15 +157,15 @@ fastestmirror_callback(void *data, LrFastestMirrorStages stage, void *ptr)
         }
     }
 
-    EndAllowThreads(self->state);
     result = PyObject_CallFunction(self->fastestmirror_cb,
                         "(OlO)", user_data, (long) stage, pydata);
     Py_XDECREF(result);
-    BeginAllowThreads(self->state);
 
     if (pydata != Py_None)
         Py_XDECREF(pydata);
 
+    PyGILState_Release(gstate);
+
     return;
 }
 
@@ -187,7 +185,7 @@ hmf_callback(void *data, const char *msg, const char *url, const char *metadata)
     else
         user_data = Py_None;
 
-    EndAllowThreads(self->state);
+    PyGILState_STATE gstate = PyGILState_Ensure();
     result = PyObject_CallFunction(self->hmf_cb,
                         "(Osss)", user_data, msg, url, metadata);
 
@@ -213,7 +211,221 @@ hmf_callback(void *data, const char *msg, const char *url, const char *metadata)
     }
 
     Py_XDECREF(result);
-    BeginAllowThreads(self->state);
+    PyGILState_Release(gstate);
+
+    return ret;
+}
+
+static int
+multiprogress_callback(void *data,
+                       const LrTargetProgress *progress,
+                       guint count)
+{
+    int ret = LR_CB_OK; // Assume everything will be ok
+    _HandleObject *self;
+    PyObject *user_data, *list, *result = NULL;
+
+    self = (_HandleObject *)data;
+    if (!self->multiprogress_cb)
+        return LR_CB_OK;
+
+    if (self->progress_cb_data)
+        user_data = self->progress_cb_data;
+    else
+        user_data = Py_None;
+
+    PyGILState_STATE gstate = PyGILState_Ensure();
+
+    // One Python call for all running targets
+    list = PyList_New(count);
+    for (guint i = 0; list && i < count; i++) {
+        PyObject *item = Py_BuildValue("(sdd)", progress[i].path,
+                                       progress[i].total_to_download,
+                                       progress[i].now_downloaded);
+        if (!item) {
+            Py_CLEAR(list);
+            break;
+        }
+        PyList_SET_ITEM(list, i, item);
+    }
+
+    if (list)
+        result = PyObject_CallFunction(self->multiprogress_cb,
+                            "(OO)", user_data, list);
+
+    if (!result) {
+        // Exception raised in callback leads to the abortion
+        // of whole downloading (it is considered fatal)
+        ret = LR_CB_ERROR;
+    } else {
+        if (result == Py_None) {
+            // Assume that None means that everything is ok
+            ret = LR_CB_OK;
+#if PY_MAJOR_VERSION < 3
+        } else if (PyInt_Check(result)) {
+            ret = PyInt_AS_LONG(result);
+#endif
+        } else if (PyLong_Check(result)) {
+            ret = (int) PyLong_AsLong(result);
+        } else {
+            // It's an error if result is None neither int
+            PyErr_SetString(PyExc_TypeError, "Multi progress callback must return integer number");
+            ret = LR_CB_ERROR;
+        }
+    }
+
+    Py_XDECREF(list);
+    Py_XDECREF(result);
+    PyGILState_Release(gstate);
+
+    return ret;
+}
+
+static PyObject *
+metrics_to_dict(const LrMetrics *metrics)
+{
+    PyObject *errors, *mirrors;
+
+    // Only the error codes which occurred
+    errors = PyDict_New();
+    for (guint i = 0; errors && i < metrics->errors_count; i++) {
+        if (!metrics->errors[i])
+            continue;
+        PyObject *key = PyLong_FromLong((long) i);
+        PyObject *val = PyLong_FromUnsignedLong(metrics->errors[i]);
+        if (!key || !val || PyDict_SetItem(errors, key, val) == -1)
+            Py_CLEAR(errors);
+        Py_XDECREF(key);
+        Py_XDECREF(val);
+    }
+    if (!errors)
+        return NULL;
+
+    mirrors = PyList_New(metrics->mirrors_count);
+    for (guint i = 0; mirrors && i < metrics->mirrors_count; i++) {
+        const LrMirrorMetrics *m = &metrics->mirrors[i];
+        PyObject *item = Py_BuildValue("{s:s,s:I,s:K,s:d,s:I,s:I}",
+                                       "url", m->url,
+                                       "running", m->running,
+                                       "bytes", (unsigned PY_LONG_LONG) m->bytes,
+                                       "speed", m->speed,
+                                       "successful", m->successful,
+                                       "failed", m->failed);
+        if (!item) {
+            Py_CLEAR(mirrors);
+            break;
+        }
+        PyList_SET_ITEM(mirrors, i, item);
+    }
+    if (!mirrors) {
+        Py_DECREF(errors);
+        return NULL;
+    }
+
+    return Py_BuildValue("{s:I,s:I,s:I,s:K,s:d,s:N,s:N}",
+                         "running", metrics->running,
+                         "queued", metrics->queued,
+                         "verifying", metrics->verifying,
+                         "bytes", (unsigned PY_LONG_LONG) metrics->bytes,
+                         "speed", metrics->speed,
+                         "errors", errors,
+                         "mirrors", mirrors);
+}
+
+static int
+metrics_callback(void *data, const LrMetrics *metrics)
+{
+    int ret = LR_CB_OK; // Assume everything will be ok
+    _HandleObject *self;
+    PyObject *user_data, *dict, *result = NULL;
+
+    self = (_HandleObject *)data;
+    if (!self->metrics_cb)
+        return LR_CB_OK;
+
+    if (self->progress_cb_data)
+        user_data = self->progress_cb_data;
+    else
+        user_data = Py_None;
+
+    PyGILState_STATE gstate = PyGILState_Ensure();
+
+    dict = metrics_to_dict(metrics);
+    if (dict)
+        result = PyObject_CallFunction(self->metrics_cb,
+                            "(OO)", user_data, dict);
+
+    if (!result) {
+        // Exception raised in callback leads to the abortion
+        // of whole downloading (it is considered fatal)
+        ret = LR_CB_ERROR;
+    } else {
+        if (result == Py_None) {
+            // Assume that None means that everything is ok
+            ret = LR_CB_OK;
+#if PY_MAJOR_VERSION < 3
+        } else if (PyInt_Check(result)) {
+            ret = PyInt_AS_LONG(result);
+#endif
+        } else if (PyLong_Check(result)) {
+            ret = (int) PyLong_AsLong(result);
+        } else {
+            // It's an error if result is None neither int
+            PyErr_SetString(PyExc_TypeError, "Metrics callback must return integer number");
+            ret = LR_CB_ERROR;
+        }
+    }
+
+    Py_XDECREF(dict);
+    Py_XDECREF(result);
+    PyGILState_Release(gstate);
+
+    return ret;
+}
+
+static int
+yumrecord_callback(void *data, const char *metadata, const char *path)
+{
+    int ret = LR_CB_OK; // Assume everything will be ok
+    _HandleObject *self;
+    PyObject *user_data, *result;
+
+    self = (_HandleObject *)data;
+    if (!self->yumrecord_cb)
+        return LR_CB_OK;
+
+    if (self->progress_cb_data)
+        user_data = self->progress_cb_data;
+    else
+        user_data = Py_None;
+
+    PyGILState_STATE gstate = PyGILState_Ensure();
+    result = PyObject_CallFunction(self->yumrecord_cb,
+                        "(Oss)", user_data, metadata, path);
+
+    if (!result) {
+        // Exception raised in callback leads to the abortion
+        // of whole downloading (it is considered fatal)
+        ret = LR_CB_ERROR;
+    } else {
+        if (result == Py_None) {
+            // Assume that None means that everything is ok
+            ret = LR_CB_OK;
+#if PY_MAJOR_VERSION < 3
+        } else if (PyInt_Check(result)) {
+            ret = PyInt_AS_LONG(result);
+#endif
+        } else if (PyLong_Check(result)) {
+            ret = (int) PyLong_AsLong(result);
+        } else {
+            // It's an error if result is None neither int
+            PyErr_SetString(PyExc_TypeError, "Yum record callback must return integer number");
+            ret = LR_CB_ERROR;
+        }
+    }
+
+    Py_XDECREF(result);
+    PyGILState_Release(gstate);
 
     return ret;
 }
@@ -234,7 +446,9 @@ handle_new(PyTypeObject *type,
         self->fastestmirror_cb = NULL;
         self->fastestmirror_cb_data = NULL;
         self->hmf_cb = NULL;
-        self->state = NULL;
+        self->multiprogress_cb = NULL;
+        self->metrics_cb = NULL;
+        self->yumrecord_cb = NULL;
     }
     return (PyObject *)self;
 }
@@ -266,6 +480,9 @@ handle_dealloc(_HandleObject *o)
     Py_XDECREF(o->fastestmirror_cb);
     Py_XDECREF(o->fastestmirror_cb_data);
     Py_XDECREF(o->hmf_cb);
+    Py_XDECREF(o->multiprogress_cb);
+    Py_XDECREF(o->metrics_cb);
+    Py_XDECREF(o->yumrecord_cb);
     Py_TYPE(o)->tp_free(o);
 }
 
@@ -297,6 +514,14 @@ py_setopt(_HandleObject *self, PyObject *args)
     case LRO_USERAGENT:
     case LRO_FASTESTMIRRORCACHE:
     case LRO_GNUPGHOMEDIR:
+    case LRO_FASTESTMIRRORPROBE:
+    case LRO_YUMREUSEDIR:
+    case LRO_MIRRORLISTCACHE:
+    case LRO_PRERESOLVECACHE:
+    case LRO_TLSSESSIONCACHE:
+    case LRO_PACKAGESTORE:
+    case LRO_MIRRORHEALTHCACHE:
+    case LRO_TRACEFILE:
     {
         char *str = NULL, *alloced = NULL;
 
@@ -337,6 +562,27 @@ py_setopt(_HandleObject *self, PyObject *args)
     case LRO_SSLVERIFYPEER:
     case LRO_SSLVERIFYHOST:
     case LRO_ADAPTIVEMIRRORSORTING:
+    case LRO_HTTP2:
+    case LRO_PREALLOCATE:
+    case LRO_EARLYWRITEBACK:
+    case LRO_ADAPTIVEDOWNLOADSPERMIRROR:
+    case LRO_HEDGEDDOWNLOADS:
+    case LRO_LOWSPEEDRESUME:
+    case LRO_YUMKEEPCOMPRESSED:
+    case LRO_CHECKSUMINDEX:
+    case LRO_PARSECACHE:
+    case LRO_FASTESTMIRRORASYNC:
+    case LRO_CONDITIONALGET:
+    case LRO_LAZYCHECKSUM:
+    case LRO_PRERESOLVE:
+    case LRO_LOCALHARDLINK:
+    case LRO_ATOMICDOWNLOAD:
+    case LRO_SHARDENDCB:
+    case LRO_IOURING:
+    case LRO_RESUMEJOURNAL:
+    case LRO_CONNECTIONAFFINITY:
+    case LRO_AUTOTUNEPARALLELDOWNLOADS:
+    case LRO_ACCEPTENCODING:
     {
         long d;
 
@@ -374,6 +620,21 @@ py_setopt(_HandleObject *self, PyObject *args)
     case LRO_LOWSPEEDLIMIT:
     case LRO_IPRESOLVE:
     case LRO_ALLOWEDMIRRORFAILURES:
+    case LRO_MAXSEGMENTS:
+    case LRO_WRITEBUFFERSIZE:
+    case LRO_DOWNLOADORDER:
+    case LRO_MIRRORLISTCACHETTL:
+    case LRO_PRERESOLVECACHETTL:
+    case LRO_CACHESOURCETIMEOUT:
+    case LRO_DURABILITY:
+    case LRO_GPGBACKEND:
+    case LRO_MIRRORBREAKER:
+    case LRO_TRACEFORMAT:
+    case LRO_MAXRANGESPERREQUEST:
+    case LRO_CRITICALSLOTS:
+    case LRO_RECVBUFFERSIZE:
+    case LRO_ENDCBTHREADS:
+    case LRO_ENDCBQUEUESIZE:
     {
         int badarg = 0;
         long d;
@@ -405,6 +666,51 @@ py_setopt(_HandleObject *self, PyObject *args)
             case LRO_ALLOWEDMIRRORFAILURES:
                 d = LRO_ALLOWEDMIRRORFAILURES_DEFAULT;
                 break;
+            case LRO_MAXSEGMENTS:
+                d = LRO_MAXSEGMENTS_DEFAULT;
+                break;
+            case LRO_MAXRANGESPERREQUEST:
+                d = LRO_MAXRANGESPERREQUEST_DEFAULT;
+                break;
+            case LRO_CRITICALSLOTS:
+                d = LRO_CRITICALSLOTS_DEFAULT;
+                break;
+            case LRO_RECVBUFFERSIZE:
+                d = LRO_RECVBUFFERSIZE_DEFAULT;
+                break;
+            case LRO_ENDCBTHREADS:
+                d = LRO_ENDCBTHREADS_DEFAULT;
+                break;
+            case LRO_ENDCBQUEUESIZE:
+                d = LRO_ENDCBQUEUESIZE_DEFAULT;
+                break;
+            case LRO_WRITEBUFFERSIZE:
+                d = LRO_WRITEBUFFERSIZE_DEFAULT;
+                break;
+            case LRO_DOWNLOADORDER:
+                d = LRO_DOWNLOADORDER_DEFAULT;
+                break;
+            case LRO_MIRRORLISTCACHETTL:
+                d = LRO_MIRRORLISTCACHETTL_DEFAULT;
+                break;
+            case LRO_PRERESOLVECACHETTL:
+                d = LRO_PRERESOLVECACHETTL_DEFAULT;
+                break;
+            case LRO_CACHESOURCETIMEOUT:
+                d = LRO_CACHESOURCETIMEOUT_DEFAULT;
+                break;
+            case LRO_DURABILITY:
+                d = LRO_DURABILITY_DEFAULT;
+                break;
+            case LRO_GPGBACKEND:
+                d = LRO_GPGBACKEND_DEFAULT;
+                break;
+            case LRO_MIRRORBREAKER:
+                d = LRO_MIRRORBREAKER_DEFAULT;
+                break;
+            case LRO_TRACEFORMAT:
+                d = LRO_TRACEFORMAT_DEFAULT;
+                break;
             default:
                 badarg = 1;
             }
@@ -431,6 +737,14 @@ py_setopt(_HandleObject *self, PyObject *args)
     case LRO_MAXMIRRORTRIES:
     case LRO_MAXPARALLELDOWNLOADS:
     case LRO_MAXDOWNLOADSPERMIRROR:
+    case LRO_MAXSTREAMSPERMIRROR:
+    case LRO_PROGRESSINTERVAL:
+    case LRO_METRICSINTERVAL:
+    case LRO_DOWNLOADSHARDS:
+    case LRO_CHECKSUMTHREADS:
+    case LRO_METALINKMAXURLS:
+    case LRO_FASTESTMIRRORCONCURRENCY:
+    case LRO_FASTESTMIRRORGOODCOUNT:
     {
         long d;
 
@@ -452,6 +766,22 @@ py_setopt(_HandleObject *self, PyObject *args)
                 d = LRO_MAXPARALLELDOWNLOADS_DEFAULT;
             else if (option == LRO_MAXDOWNLOADSPERMIRROR)
                 d = LRO_MAXDOWNLOADSPERMIRROR_DEFAULT;
+            else if (option == LRO_MAXSTREAMSPERMIRROR)
+                d = LRO_MAXSTREAMSPERMIRROR_DEFAULT;
+            else if (option == LRO_PROGRESSINTERVAL)
+                d = LRO_PROGRESSINTERVAL_DEFAULT;
+            else if (option == LRO_METRICSINTERVAL)
+                d = LRO_METRICSINTERVAL_DEFAULT;
+            else if (option == LRO_DOWNLOADSHARDS)
+                d = LRO_DOWNLOADSHARDS_DEFAULT;
+            else if (option == LRO_CHECKSUMTHREADS)
+                d = LRO_CHECKSUMTHREADS_DEFAULT;
+            else if (option == LRO_METALINKMAXURLS)
+                d = LRO_METALINKMAXURLS_DEFAULT;
+            else if (option == LRO_FASTESTMIRRORCONCURRENCY)
+                d = LRO_FASTESTMIRRORCONCURRENCY_DEFAULT;
+            else if (option == LRO_FASTESTMIRRORGOODCOUNT)
+                d = LRO_FASTESTMIRRORGOODCOUNT_DEFAULT;
             else
                 assert(0);
         } else {
@@ -470,6 +800,8 @@ py_setopt(_HandleObject *self, PyObject *args)
      * Options with gint64/None arguments
      */
     case LRO_MAXSPEED:
+    case LRO_MINSEGMENTSIZE:
+    case LRO_PACKAGESTOREMAXSIZE:
     {
         gint64 d;
 
@@ -483,6 +815,10 @@ py_setopt(_HandleObject *self, PyObject *args)
             /* Default options */
             if (option == LRO_MAXSPEED)
                 d = (gint64) LRO_MAXSPEED_DEFAULT;
+            else if (option == LRO_MINSEGMENTSIZE)
+                d = (gint64) LRO_MINSEGMENTSIZE_DEFAULT;
+            else if (option == LRO_PACKAGESTOREMAXSIZE)
+                d = (gint64) LRO_PACKAGESTOREMAXSIZE_DEFAULT;
             else
                 assert(0);
         } else {
@@ -502,7 +838,10 @@ py_setopt(_HandleObject *self, PyObject *args)
      */
     case LRO_URLS:
     case LRO_YUMDLIST:
-    case LRO_YUMBLIST: {
+    case LRO_YUMBLIST:
+    case LRO_YUMDECOMPRESS:
+    case LRO_CACHESOURCES:
+    case LRO_PROXIES: {
         Py_ssize_t len = 0;
 
         if (!PyList_Check(obj) && obj != Py_None) {
@@ -762,6 +1101,110 @@ py_setopt(_HandleObject *self, PyObject *args)
     }
 
 
+    case LRO_YUMRECORDCB: {
+        if (!PyCallable_Check(obj) && obj != Py_None) {
+            PyErr_SetString(PyExc_TypeError, "Only callable argument or None is supported with this option");
+            return NULL;
+        }
+
+        Py_XDECREF(self->yumrecord_cb);
+        if (obj == Py_None) {
+            // None object
+            self->yumrecord_cb = NULL;
+            res = lr_handle_setopt(self->handle,
+                                   &tmp_err,
+                                   (LrHandleOption)option,
+                                   NULL);
+            if (!res)
+                RETURN_ERROR(&tmp_err, -1, NULL);
+        } else {
+            // New callback object
+            Py_XINCREF(obj);
+            self->yumrecord_cb = obj;
+            res = lr_handle_setopt(self->handle,
+                                   &tmp_err,
+                                   (LrHandleOption)option,
+                                   yumrecord_callback);
+            if (!res)
+                RETURN_ERROR(&tmp_err, -1, NULL);
+            res = lr_handle_setopt(self->handle,
+                                   &tmp_err,
+                                   LRO_PROGRESSDATA,
+                                   self);
+        }
+        break;
+    }
+
+
+    case LRO_MULTIPROGRESSCB: {
+        if (!PyCallable_Check(obj) && obj != Py_None) {
+            PyErr_SetString(PyExc_TypeError, "Only callable argument or None is supported with this option");
+            return NULL;
+        }
+
+        Py_XDECREF(self->multiprogress_cb);
+        if (obj == Py_None) {
+            // None object
+            self->multiprogress_cb = NULL;
+            res = lr_handle_setopt(self->handle,
+                                   &tmp_err,
+                                   (LrHandleOption)option,
+                                   NULL);
+            if (!res)
+                RETURN_ERROR(&tmp_err, -1, NULL);
+        } else {
+            // New callback object
+            Py_XINCREF(obj);
+            self->multiprogress_cb = obj;
+            res = lr_handle_setopt(self->handle,
+                                   &tmp_err,
+                                   (LrHandleOption)option,
+                                   multiprogress_callback);
+            if (!res)
+                RETURN_ERROR(&tmp_err, -1, NULL);
+            res = lr_handle_setopt(self->handle,
+                                   &tmp_err,
+                                   LRO_PROGRESSDATA,
+                                   self);
+        }
+        break;
+    }
+
+    case LRO_METRICSCB: {
+        if (!PyCallable_Check(obj) && obj != Py_None) {
+            PyErr_SetString(PyExc_TypeError, "Only callable argument or None is supported with this option");
+            return NULL;
+        }
+
+        Py_XDECREF(self->metrics_cb);
+        if (obj == Py_None) {
+            // None object
+            self->metrics_cb = NULL;
+            res = lr_handle_setopt(self->handle,
+                                   &tmp_err,
+                                   (LrHandleOption)option,
+                                   NULL);
+            if (!res)
+                RETURN_ERROR(&tmp_err, -1, NULL);
+        } else {
+            // New callback object
+            Py_XINCREF(obj);
+            self->metrics_cb = obj;
+            res = lr_handle_setopt(self->handle,
+                                   &tmp_err,
+                                   (LrHandleOption)option,
+                                   metrics_callback);
+            if (!res)
+                RETURN_ERROR(&tmp_err, -1, NULL);
+            res = lr_handle_setopt(self->handle,
+                                   &tmp_err,
+                                   LRO_PROGRESSDATA,
+                                   self);
+        }
+        break;
+    }
+
+
     /*
      * Options with callback data
      */
@@ -822,6 +1265,14 @@ py_getinfo(_HandleObject *self, PyObject *args)
     case LRI_USERAGENT:
     case LRI_FASTESTMIRRORCACHE:
     case LRI_GNUPGHOMEDIR:
+    case LRI_FASTESTMIRRORPROBE:
+    case LRI_YUMREUSEDIR:
+    case LRI_MIRRORLISTCACHE:
+    case LRI_PRERESOLVECACHE:
+    case LRI_TLSSESSIONCACHE:
+    case LRI_PACKAGESTORE:
+    case LRI_MIRRORHEALTHCACHE:
+    case LRI_TRACEFILE:
         res = lr_handle_getinfo(self->handle,
                                 &tmp_err,
                                 (LrHandleInfoOption)option,
@@ -842,6 +1293,46 @@ py_getinfo(_HandleObject *self, PyObject *args)
     case LRI_SSLVERIFYHOST:
     case LRI_ALLOWEDMIRRORFAILURES:
     case LRI_ADAPTIVEMIRRORSORTING:
+    case LRI_HTTP2:
+    case LRI_MAXSTREAMSPERMIRROR:
+    case LRI_MAXSEGMENTS:
+    case LRI_WRITEBUFFERSIZE:
+    case LRI_PREALLOCATE:
+    case LRI_EARLYWRITEBACK:
+    case LRI_ADAPTIVEDOWNLOADSPERMIRROR:
+    case LRI_HEDGEDDOWNLOADS:
+    case LRI_LOWSPEEDRESUME:
+    case LRI_PROGRESSINTERVAL:
+    case LRI_YUMKEEPCOMPRESSED:
+    case LRI_CHECKSUMTHREADS:
+    case LRI_CHECKSUMINDEX:
+    case LRI_PARSECACHE:
+    case LRI_METALINKMAXURLS:
+    case LRI_FASTESTMIRRORCONCURRENCY:
+    case LRI_FASTESTMIRRORGOODCOUNT:
+    case LRI_FASTESTMIRRORASYNC:
+    case LRI_CONDITIONALGET:
+    case LRI_LAZYCHECKSUM:
+    case LRI_MIRRORLISTCACHETTL:
+    case LRI_PRERESOLVE:
+    case LRI_PRERESOLVECACHETTL:
+    case LRI_CACHESOURCETIMEOUT:
+    case LRI_LOCALHARDLINK:
+    case LRI_ATOMICDOWNLOAD:
+    case LRI_MIRRORBREAKER:
+    case LRI_METRICSINTERVAL:
+    case LRI_DOWNLOADSHARDS:
+    case LRI_SHARDENDCB:
+    case LRI_IOURING:
+    case LRI_RESUMEJOURNAL:
+    case LRI_MAXRANGESPERREQUEST:
+    case LRI_CONNECTIONAFFINITY:
+    case LRI_AUTOTUNEPARALLELDOWNLOADS:
+    case LRI_ACCEPTENCODING:
+    case LRI_CRITICALSLOTS:
+    case LRI_RECVBUFFERSIZE:
+    case LRI_ENDCBTHREADS:
+    case LRI_ENDCBQUEUESIZE:
         res = lr_handle_getinfo(self->handle,
                                 &tmp_err,
                                 (LrHandleInfoOption)option,
@@ -862,6 +1353,54 @@ py_getinfo(_HandleObject *self, PyObject *args)
         return PyLong_FromLong((long) type);
     }
 
+    /* LrDownloadOrder* option  */
+    case LRI_DOWNLOADORDER: {
+        LrDownloadOrder order;
+        res = lr_handle_getinfo(self->handle,
+                                &tmp_err,
+                                (LrHandleInfoOption)option,
+                                &order);
+        if (!res)
+            RETURN_ERROR(&tmp_err, -1, NULL);
+        return PyLong_FromLong((long) order);
+    }
+
+    /* LrDurability* option  */
+    case LRI_DURABILITY: {
+        LrDurability durability;
+        res = lr_handle_getinfo(self->handle,
+                                &tmp_err,
+                                (LrHandleInfoOption)option,
+                                &durability);
+        if (!res)
+            RETURN_ERROR(&tmp_err, -1, NULL);
+        return PyLong_FromLong((long) durability);
+    }
+
+    /* LrGpgBackend* option  */
+    case LRI_GPGBACKEND: {
+        LrGpgBackend gpgbackend;
+        res = lr_handle_getinfo(self->handle,
+                                &tmp_err,
+                                (LrHandleInfoOption)option,
+                                &gpgbackend);
+        if (!res)
+            RETURN_ERROR(&tmp_err, -1, NULL);
+        return PyLong_FromLong((long) gpgbackend);
+    }
+
+    /* LrTraceFormat* option  */
+    case LRI_TRACEFORMAT: {
+        LrTraceFormat traceformat;
+        res = lr_handle_getinfo(self->handle,
+                                &tmp_err,
+                                (LrHandleInfoOption)option,
+                                &traceformat);
+        if (!res)
+            RETURN_ERROR(&tmp_err, -1, NULL);
+        return PyLong_FromLong((long) traceformat);
+    }
+
     /* List option */
     case LRI_VARSUB: {
         LrUrlVars *vars;
@@ -904,6 +1443,9 @@ py_getinfo(_HandleObject *self, PyObject *args)
     case LRI_URLS:
     case LRI_YUMDLIST:
     case LRI_YUMBLIST:
+    case LRI_YUMDECOMPRESS:
+    case LRI_CACHESOURCES:
+    case LRI_PROXIES:
     case LRI_MIRRORS: {
         PyObject *list;
         char **strlist;
@@ -966,6 +1508,21 @@ py_getinfo(_HandleObject *self, PyObject *args)
         return py_metalink;
     }
 
+    /* LrStats* option */
+    case LRI_STATS: {
+        PyObject *py_stats;
+        LrStats *stats;
+        res = lr_handle_getinfo(self->handle,
+                                &tmp_err,
+                                (LrHandleInfoOption)option,
+                                &stats);
+        if (!res)
+            RETURN_ERROR(&tmp_err, -1, NULL);
+        py_stats = PyObject_FromStats(stats);
+        lr_stats_free(stats);
+        return py_stats;
+    }
+
     default:
         PyErr_SetString(PyExc_TypeError, "Unknown option");
         return NULL;
@@ -991,21 +1548,10 @@ py_perform(_HandleObject *self, PyObject *args)
 
     result = Result_FromPyObject(result_obj);
 
-    Handle_SetThreadState((PyObject *) self, &state);
-
-    // XXX: GIL Hack
-    int hack_rc = gil_logger_hack_begin(&state);
-    if (hack_rc == GIL_HACK_ERROR)
-        return NULL;
-
     BeginAllowThreads(&state);
     ret = lr_handle_perform(self->handle, result, &tmp_err);
     EndAllowThreads(&state);
 
-    // XXX: GIL Hack
-    if (!gil_logger_hack_end(hack_rc))
-        return NULL;
-
     assert((ret && !tmp_err) || (!ret && tmp_err));
 
     if (ret)
@@ -1048,23 +1594,12 @@ py_download_package(_HandleObject *self, PyObject *args)
     if (check_HandleStatus(self))
         return NULL;
 
-    Handle_SetThreadState((PyObject *) self, &state);
-
-    // XXX: GIL Hack
-    int hack_rc = gil_logger_hack_begin(&state);
-    if (hack_rc == GIL_HACK_ERROR)
-        return NULL;
-
     BeginAllowThreads(&state);
     ret = lr_download_package(self->handle, relative_url, dest, checksum_type,
                               checksum, (gint64) expectedsize, base_url,
                               resume, &tmp_err);
     EndAllowThreads(&state);
 
-    // XXX: GIL Hack
-    if (!gil_logger_hack_end(hack_rc))
-        return NULL;
-
     assert((ret && !tmp_err) || (!ret && tmp_err));
 
     if (!ret && tmp_err->code == LRE_INTERRUPTED) {
@@ -1093,12 +1628,123 @@ py_download_package(_HandleObject *self, PyObject *args)
     }
 }
 
+static PyObject *
+py_cancel(_HandleObject *self, G_GNUC_UNUSED PyObject *noarg)
+{
+    if (check_HandleStatus(self))
+        return NULL;
+    lr_handle_cancel(self->handle);
+    Py_RETURN_NONE;
+}
+
+static PyObject *
+py_reset_cancel(_HandleObject *self, G_GNUC_UNUSED PyObject *noarg)
+{
+    if (check_HandleStatus(self))
+        return NULL;
+    lr_handle_reset_cancel(self->handle);
+    Py_RETURN_NONE;
+}
+
+PyObject *
+py_handles_perform(G_GNUC_UNUSED PyObject *self, PyObject *args)
+{
+    gboolean ret;
+    PyObject *py_handles, *py_results, *py_errors;
+    GSList *handles = NULL, *results = NULL, *errors = NULL;
+    GError *tmp_err = NULL;
+    PyThreadState *state = NULL;
+
+    if (!PyArg_ParseTuple(args, "O!O!:handles_perform",
+                          &PyList_Type, &py_handles,
+                          &PyList_Type, &py_results))
+        return NULL;
+
+    if (PyList_Size(py_handles) != PyList_Size(py_results)) {
+        PyErr_SetString(PyExc_ValueError,
+                        "Number of handles and results differ");
+        return NULL;
+    }
+
+    // Convert python lists to GSLists
+    Py_ssize_t len = PyList_Size(py_handles);
+    for (Py_ssize_t x=0; x < len; x++) {
+        PyObject *py_handle = PyList_GetItem(py_handles, x);
+        LrHandle *handle = Handle_FromPyObject(py_handle);
+        LrResult *result = Result_FromPyObject(PyList_GetItem(py_results, x));
+        if (!handle || !result) {
+            g_slist_free(handles);
+            g_slist_free(results);
+            return NULL;
+        }
+        handles = g_slist_append(handles, handle);
+        results = g_slist_append(results, result);
+    }
+
+    Py_XINCREF(py_handles);
+    Py_XINCREF(py_results);
+
+    BeginAllowThreads(&state);
+    ret = lr_handles_perform(handles, results, &errors, &tmp_err);
+    EndAllowThreads(&state);
+
+    assert((ret && !tmp_err) || (!ret && tmp_err));
+
+    Py_XDECREF(py_handles);
+    Py_XDECREF(py_results);
+    g_slist_free(handles);
+    g_slist_free(results);
+
+    if (PyErr_Occurred()) {
+        // Python exception occured (in a python callback probably)
+        g_clear_error(&tmp_err);
+        g_slist_free_full(errors, (GDestroyNotify) g_error_free);
+        return NULL;
+    } else if (tmp_err && tmp_err->code == LRE_INTERRUPTED) {
+        // Interrupted by Ctr+C
+        g_error_free(tmp_err);
+        g_slist_free_full(errors, (GDestroyNotify) g_error_free);
+        PyErr_SetInterrupt();
+        PyErr_CheckSignals();
+        return NULL;
+    } else if (tmp_err && !errors) {
+        // Error of the whole call
+        RETURN_ERROR(&tmp_err, -1, NULL);
+    }
+
+    g_clear_error(&tmp_err);
+
+    // Errors of the repositories
+    py_errors = PyList_New(0);
+    for (GSList *elem = errors; elem; elem = g_slist_next(elem)) {
+        GError *error = elem->data;
+        PyObject *py_error;
+        if (error) {
+            py_error = Py_BuildValue("(iss)",
+                                     (int) error->code,
+                                     error->message,
+                                     lr_strerror(error->code));
+            g_error_free(error);
+        } else {
+            Py_INCREF(Py_None);
+            py_error = Py_None;
+        }
+        PyList_Append(py_errors, py_error);
+        Py_DECREF(py_error);
+    }
+    g_slist_free(errors);
+
+    return py_errors;
+}
+
 static struct
 PyMethodDef handle_methods[] = {
     { "setopt", (PyCFunction)py_setopt, METH_VARARGS, NULL },
     { "getinfo", (PyCFunction)py_getinfo, METH_VARARGS, NULL },
     { "perform", (PyCFunction)py_perform, METH_VARARGS, NULL },
     { "download_package", (PyCFunction)py_download_package, METH_VARARGS, NULL },
+    { "cancel", (PyCFunction)py_cancel, METH_NOARGS, NULL },
+    { "reset_cancel", (PyCFunction)py_reset_cancel, METH_NOARGS, NULL },
     { NULL }
 };
 
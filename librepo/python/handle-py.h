@@ -28,6 +28,7 @@ extern PyTypeObject Handle_Type;
 #define HandleObject_Check(o)   PyObject_TypeCheck(o, &Handle_Type)
 
 LrHandle *Handle_FromPyObject(PyObject *o);
-void Handle_SetThreadState(PyObject *o, PyThreadState **state);
+
+PyObject *py_handles_perform(PyObject *self, PyObject *args);
 
 #endif
@@ -30,17 +30,11 @@
 #include "result-py.h"
 #include "yum-py.h"
 #include "downloader-py.h"
-#include "globalstate-py.h" // GIL Hack
-
-volatile int global_logger = 0;
-volatile PyThreadState **global_state = NULL;
 
 PyObject *debug_cb = NULL;
 PyObject *debug_cb_data = NULL;
 gint      debug_handler_id = -1;
 
-G_LOCK_DEFINE(gil_hack_lock);
-
 void
 py_debug_cb(G_GNUC_UNUSED const gchar *log_domain,
             G_GNUC_UNUSED GLogLevelFlags log_level,
@@ -49,13 +43,13 @@ py_debug_cb(G_GNUC_UNUSED const gchar *log_domain,
 {
     PyObject *arglist, *data, *result;
 
-    if (!debug_cb)
-        return;
+    // Messages are logged from any thread, with or without the GIL
+    PyGILState_STATE gstate = PyGILState_Ensure();
 
-    // XXX: GIL Hack
-    if (global_state)
-        EndAllowThreads((PyThreadState **) global_state);
-    // XXX: End of GIL Hack
+    if (!debug_cb) {
+        PyGILState_Release(gstate);
+        return;
+    }
 
     data = (debug_cb_data) ? debug_cb_data : Py_None;
     arglist = Py_BuildValue("(sO)", message, data);
@@ -63,10 +57,7 @@ py_debug_cb(G_GNUC_UNUSED const gchar *log_domain,
     Py_DECREF(arglist);
     Py_XDECREF(result);
 
-    // XXX: GIL Hack
-    if (global_state)
-        BeginAllowThreads((PyThreadState **) global_state);
-    // XXX: End of GIL Hack
+    PyGILState_Release(gstate);
 }
 
 PyObject *
@@ -97,7 +88,6 @@ py_set_debug_log_handler(G_GNUC_UNUSED PyObject *self, PyObject *args)
     if (debug_cb) {
         debug_handler_id = g_log_set_handler("librepo", G_LOG_LEVEL_DEBUG,
                                              py_debug_cb, NULL);
-        global_logger = 1;
     } else if (debug_handler_id != -1) {
         g_log_remove_handler("librepo", debug_handler_id);
     }
@@ -105,6 +95,66 @@ py_set_debug_log_handler(G_GNUC_UNUSED PyObject *self, PyObject *args)
     Py_RETURN_NONE;
 }
 
+PyObject *
+py_alloc_accounting(G_GNUC_UNUSED PyObject *self, PyObject *args)
+{
+    PyObject *enable;
+
+    if (!PyArg_ParseTuple(args, "O:py_alloc_accounting", &enable))
+        return NULL;
+
+    lr_alloc_accounting(PyObject_IsTrue(enable) == 1);
+    Py_RETURN_NONE;
+}
+
+PyObject *
+py_alloc_stats(G_GNUC_UNUSED PyObject *self, PyObject *args)
+{
+    LrAllocStats total;
+
+    if (!PyArg_ParseTuple(args, ":py_alloc_stats"))
+        return NULL;
+
+    lr_alloc_stats_get(&total, NULL);
+    return Py_BuildValue("{s:K,s:K,s:K,s:L,s:L}",
+                         "count", (unsigned PY_LONG_LONG) total.count,
+                         "bytes", (unsigned PY_LONG_LONG) total.bytes,
+                         "frees", (unsigned PY_LONG_LONG) total.frees,
+                         "live", (PY_LONG_LONG) total.live,
+                         "peak", (PY_LONG_LONG) total.peak);
+}
+
+PyObject *
+py_mirrorregistry_flush(G_GNUC_UNUSED PyObject *self, PyObject *args)
+{
+    GError *tmp_err = NULL;
+    gboolean ret;
+
+    if (!PyArg_ParseTuple(args, ":py_mirrorregistry_flush"))
+        return NULL;
+
+    Py_BEGIN_ALLOW_THREADS
+    ret = lr_mirrorregistry_flush(&tmp_err);
+    Py_END_ALLOW_THREADS
+
+    if (!ret)
+        RETURN_ERROR(&tmp_err, -1, NULL);
+    Py_RETURN_NONE;
+}
+
+PyObject *
+py_mirrorregistry_clear(G_GNUC_UNUSED PyObject *self, PyObject *args)
+{
+    if (!PyArg_ParseTuple(args, ":py_mirrorregistry_clear"))
+        return NULL;
+
+    Py_BEGIN_ALLOW_THREADS
+    lr_mirrorregistry_clear();
+    Py_END_ALLOW_THREADS
+
+    Py_RETURN_NONE;
+}
+
 static struct PyMethodDef librepo_methods[] = {
     { "yum_repomd_get_age",     (PyCFunction)py_yum_repomd_get_age,
       METH_VARARGS, NULL },
@@ -114,6 +164,18 @@ static struct PyMethodDef librepo_methods[] = {
       METH_VARARGS, NULL },
     { "download_url",           (PyCFunction)py_download_url,
       METH_VARARGS, NULL },
+    { "download_url_data",      (PyCFunction)py_download_url_data,
+      METH_VARARGS, NULL },
+    { "handles_perform",        (PyCFunction)py_handles_perform,
+      METH_VARARGS, NULL },
+    { "alloc_accounting",       (PyCFunction)py_alloc_accounting,
+      METH_VARARGS, NULL },
+    { "alloc_stats",            (PyCFunction)py_alloc_stats,
+      METH_VARARGS, NULL },
+    { "mirrorregistry_flush",   (PyCFunction)py_mirrorregistry_flush,
+      METH_VARARGS, NULL },
+    { "mirrorregistry_clear",   (PyCFunction)py_mirrorregistry_clear,
+      METH_VARARGS, NULL },
     { NULL }
 };
 
@@ -214,9 +276,18 @@ init_librepo(void)
     Py_INCREF(&PackageTarget_Type);
     PyModule_AddObject(m, "PackageTarget", (PyObject *)&PackageTarget_Type);
 
+    // _librepo.DownloadedData (returned as memoryview only)
+    if (PyType_Ready(&DownloadedData_Type) < 0)
+        INITERROR;
+
     // Init module
     Py_AtExit(exit_librepo);
 
+#if PY_VERSION_HEX < 0x03070000
+    // Callbacks take the GIL from the threads of the downloads
+    PyEval_InitThreads();
+#endif
+
     // Module constants
 
     // Version
@@ -270,6 +341,66 @@ init_librepo(void)
     PyModule_AddIntConstant(m, "LRO_ALLOWEDMIRRORFAILURES", LRO_ALLOWEDMIRRORFAILURES);
     PyModule_AddIntConstant(m, "LRO_ADAPTIVEMIRRORSORTING", LRO_ADAPTIVEMIRRORSORTING);
     PyModule_AddIntConstant(m, "LRO_GNUPGHOMEDIR", LRO_GNUPGHOMEDIR);
+    PyModule_AddIntConstant(m, "LRO_HTTP2", LRO_HTTP2);
+    PyModule_AddIntConstant(m, "LRO_MAXSTREAMSPERMIRROR", LRO_MAXSTREAMSPERMIRROR);
+    PyModule_AddIntConstant(m, "LRO_MAXSEGMENTS", LRO_MAXSEGMENTS);
+    PyModule_AddIntConstant(m, "LRO_MINSEGMENTSIZE", LRO_MINSEGMENTSIZE);
+    PyModule_AddIntConstant(m, "LRO_WRITEBUFFERSIZE", LRO_WRITEBUFFERSIZE);
+    PyModule_AddIntConstant(m, "LRO_PREALLOCATE", LRO_PREALLOCATE);
+    PyModule_AddIntConstant(m, "LRO_EARLYWRITEBACK", LRO_EARLYWRITEBACK);
+    PyModule_AddIntConstant(m, "LRO_DOWNLOADORDER", LRO_DOWNLOADORDER);
+    PyModule_AddIntConstant(m, "LRO_ADAPTIVEDOWNLOADSPERMIRROR", LRO_ADAPTIVEDOWNLOADSPERMIRROR);
+    PyModule_AddIntConstant(m, "LRO_HEDGEDDOWNLOADS", LRO_HEDGEDDOWNLOADS);
+    PyModule_AddIntConstant(m, "LRO_LOWSPEEDRESUME", LRO_LOWSPEEDRESUME);
+    PyModule_AddIntConstant(m, "LRO_PROGRESSINTERVAL", LRO_PROGRESSINTERVAL);
+    PyModule_AddIntConstant(m, "LRO_MULTIPROGRESSCB", LRO_MULTIPROGRESSCB);
+    PyModule_AddIntConstant(m, "LRO_YUMDECOMPRESS", LRO_YUMDECOMPRESS);
+    PyModule_AddIntConstant(m, "LRO_YUMKEEPCOMPRESSED", LRO_YUMKEEPCOMPRESSED);
+    PyModule_AddIntConstant(m, "LRO_CHECKSUMTHREADS", LRO_CHECKSUMTHREADS);
+    PyModule_AddIntConstant(m, "LRO_CHECKSUMINDEX", LRO_CHECKSUMINDEX);
+    PyModule_AddIntConstant(m, "LRO_PARSECACHE", LRO_PARSECACHE);
+    PyModule_AddIntConstant(m, "LRO_METALINKMAXURLS", LRO_METALINKMAXURLS);
+    PyModule_AddIntConstant(m, "LRO_FASTESTMIRRORPROBE", LRO_FASTESTMIRRORPROBE);
+    PyModule_AddIntConstant(m, "LRO_FASTESTMIRRORCONCURRENCY", LRO_FASTESTMIRRORCONCURRENCY);
+    PyModule_AddIntConstant(m, "LRO_FASTESTMIRRORGOODCOUNT", LRO_FASTESTMIRRORGOODCOUNT);
+    PyModule_AddIntConstant(m, "LRO_FASTESTMIRRORASYNC", LRO_FASTESTMIRRORASYNC);
+    PyModule_AddIntConstant(m, "LRO_CONDITIONALGET", LRO_CONDITIONALGET);
+    PyModule_AddIntConstant(m, "LRO_YUMREUSEDIR", LRO_YUMREUSEDIR);
+    PyModule_AddIntConstant(m, "LRO_YUMRECORDCB", LRO_YUMRECORDCB);
+    PyModule_AddIntConstant(m, "LRO_LAZYCHECKSUM", LRO_LAZYCHECKSUM);
+    PyModule_AddIntConstant(m, "LRO_MIRRORLISTCACHE", LRO_MIRRORLISTCACHE);
+    PyModule_AddIntConstant(m, "LRO_MIRRORLISTCACHETTL", LRO_MIRRORLISTCACHETTL);
+    PyModule_AddIntConstant(m, "LRO_PRERESOLVE", LRO_PRERESOLVE);
+    PyModule_AddIntConstant(m, "LRO_PRERESOLVECACHE", LRO_PRERESOLVECACHE);
+    PyModule_AddIntConstant(m, "LRO_PRERESOLVECACHETTL", LRO_PRERESOLVECACHETTL);
+    PyModule_AddIntConstant(m, "LRO_TLSSESSIONCACHE", LRO_TLSSESSIONCACHE);
+    PyModule_AddIntConstant(m, "LRO_PACKAGESTORE", LRO_PACKAGESTORE);
+    PyModule_AddIntConstant(m, "LRO_PACKAGESTOREMAXSIZE", LRO_PACKAGESTOREMAXSIZE);
+    PyModule_AddIntConstant(m, "LRO_CACHESOURCES", LRO_CACHESOURCES);
+    PyModule_AddIntConstant(m, "LRO_CACHESOURCETIMEOUT", LRO_CACHESOURCETIMEOUT);
+    PyModule_AddIntConstant(m, "LRO_LOCALHARDLINK", LRO_LOCALHARDLINK);
+    PyModule_AddIntConstant(m, "LRO_DURABILITY", LRO_DURABILITY);
+    PyModule_AddIntConstant(m, "LRO_ATOMICDOWNLOAD", LRO_ATOMICDOWNLOAD);
+    PyModule_AddIntConstant(m, "LRO_GPGBACKEND", LRO_GPGBACKEND);
+    PyModule_AddIntConstant(m, "LRO_MIRRORHEALTHCACHE", LRO_MIRRORHEALTHCACHE);
+    PyModule_AddIntConstant(m, "LRO_MIRRORBREAKER", LRO_MIRRORBREAKER);
+    PyModule_AddIntConstant(m, "LRO_TRACEFILE", LRO_TRACEFILE);
+    PyModule_AddIntConstant(m, "LRO_TRACEFORMAT", LRO_TRACEFORMAT);
+    PyModule_AddIntConstant(m, "LRO_METRICSCB", LRO_METRICSCB);
+    PyModule_AddIntConstant(m, "LRO_METRICSINTERVAL", LRO_METRICSINTERVAL);
+    PyModule_AddIntConstant(m, "LRO_DOWNLOADSHARDS", LRO_DOWNLOADSHARDS);
+    PyModule_AddIntConstant(m, "LRO_SHARDENDCB", LRO_SHARDENDCB);
+    PyModule_AddIntConstant(m, "LRO_IOURING", LRO_IOURING);
+    PyModule_AddIntConstant(m, "LRO_RESUMEJOURNAL", LRO_RESUMEJOURNAL);
+    PyModule_AddIntConstant(m, "LRO_MAXRANGESPERREQUEST", LRO_MAXRANGESPERREQUEST);
+    PyModule_AddIntConstant(m, "LRO_CONNECTIONAFFINITY", LRO_CONNECTIONAFFINITY);
+    PyModule_AddIntConstant(m, "LRO_AUTOTUNEPARALLELDOWNLOADS", LRO_AUTOTUNEPARALLELDOWNLOADS);
+    PyModule_AddIntConstant(m, "LRO_ACCEPTENCODING", LRO_ACCEPTENCODING);
+    PyModule_AddIntConstant(m, "LRO_CRITICALSLOTS", LRO_CRITICALSLOTS);
+    PyModule_AddIntConstant(m, "LRO_PROXIES", LRO_PROXIES);
+    PyModule_AddIntConstant(m, "LRO_RECVBUFFERSIZE", LRO_RECVBUFFERSIZE);
+    PyModule_AddIntConstant(m, "LRO_ENDCBTHREADS", LRO_ENDCBTHREADS);
+    PyModule_AddIntConstant(m, "LRO_ENDCBQUEUESIZE", LRO_ENDCBQUEUESIZE);
     PyModule_AddIntConstant(m, "LRO_SENTINEL", LRO_SENTINEL);
 
     // Handle info options
@@ -301,6 +432,62 @@ init_librepo(void)
     PyModule_AddIntConstant(m, "LRI_ALLOWEDMIRRORFAILURES", LRI_ALLOWEDMIRRORFAILURES);
     PyModule_AddIntConstant(m, "LRI_ADAPTIVEMIRRORSORTING", LRI_ADAPTIVEMIRRORSORTING);
     PyModule_AddIntConstant(m, "LRI_GNUPGHOMEDIR", LRI_GNUPGHOMEDIR);
+    PyModule_AddIntConstant(m, "LRI_HTTP2", LRI_HTTP2);
+    PyModule_AddIntConstant(m, "LRI_MAXSTREAMSPERMIRROR", LRI_MAXSTREAMSPERMIRROR);
+    PyModule_AddIntConstant(m, "LRI_MAXSEGMENTS", LRI_MAXSEGMENTS);
+    PyModule_AddIntConstant(m, "LRI_WRITEBUFFERSIZE", LRI_WRITEBUFFERSIZE);
+    PyModule_AddIntConstant(m, "LRI_PREALLOCATE", LRI_PREALLOCATE);
+    PyModule_AddIntConstant(m, "LRI_EARLYWRITEBACK", LRI_EARLYWRITEBACK);
+    PyModule_AddIntConstant(m, "LRI_DOWNLOADORDER", LRI_DOWNLOADORDER);
+    PyModule_AddIntConstant(m, "LRI_ADAPTIVEDOWNLOADSPERMIRROR", LRI_ADAPTIVEDOWNLOADSPERMIRROR);
+    PyModule_AddIntConstant(m, "LRI_HEDGEDDOWNLOADS", LRI_HEDGEDDOWNLOADS);
+    PyModule_AddIntConstant(m, "LRI_LOWSPEEDRESUME", LRI_LOWSPEEDRESUME);
+    PyModule_AddIntConstant(m, "LRI_PROGRESSINTERVAL", LRI_PROGRESSINTERVAL);
+    PyModule_AddIntConstant(m, "LRI_YUMDECOMPRESS", LRI_YUMDECOMPRESS);
+    PyModule_AddIntConstant(m, "LRI_YUMKEEPCOMPRESSED", LRI_YUMKEEPCOMPRESSED);
+    PyModule_AddIntConstant(m, "LRI_CHECKSUMTHREADS", LRI_CHECKSUMTHREADS);
+    PyModule_AddIntConstant(m, "LRI_CHECKSUMINDEX", LRI_CHECKSUMINDEX);
+    PyModule_AddIntConstant(m, "LRI_PARSECACHE", LRI_PARSECACHE);
+    PyModule_AddIntConstant(m, "LRI_METALINKMAXURLS", LRI_METALINKMAXURLS);
+    PyModule_AddIntConstant(m, "LRI_FASTESTMIRRORPROBE", LRI_FASTESTMIRRORPROBE);
+    PyModule_AddIntConstant(m, "LRI_FASTESTMIRRORCONCURRENCY", LRI_FASTESTMIRRORCONCURRENCY);
+    PyModule_AddIntConstant(m, "LRI_FASTESTMIRRORGOODCOUNT", LRI_FASTESTMIRRORGOODCOUNT);
+    PyModule_AddIntConstant(m, "LRI_FASTESTMIRRORASYNC", LRI_FASTESTMIRRORASYNC);
+    PyModule_AddIntConstant(m, "LRI_CONDITIONALGET", LRI_CONDITIONALGET);
+    PyModule_AddIntConstant(m, "LRI_YUMREUSEDIR", LRI_YUMREUSEDIR);
+    PyModule_AddIntConstant(m, "LRI_LAZYCHECKSUM", LRI_LAZYCHECKSUM);
+    PyModule_AddIntConstant(m, "LRI_MIRRORLISTCACHE", LRI_MIRRORLISTCACHE);
+    PyModule_AddIntConstant(m, "LRI_MIRRORLISTCACHETTL", LRI_MIRRORLISTCACHETTL);
+    PyModule_AddIntConstant(m, "LRI_PRERESOLVE", LRI_PRERESOLVE);
+    PyModule_AddIntConstant(m, "LRI_PRERESOLVECACHE", LRI_PRERESOLVECACHE);
+    PyModule_AddIntConstant(m, "LRI_PRERESOLVECACHETTL", LRI_PRERESOLVECACHETTL);
+    PyModule_AddIntConstant(m, "LRI_TLSSESSIONCACHE", LRI_TLSSESSIONCACHE);
+    PyModule_AddIntConstant(m, "LRI_PACKAGESTORE", LRI_PACKAGESTORE);
+    PyModule_AddIntConstant(m, "LRI_CACHESOURCES", LRI_CACHESOURCES);
+    PyModule_AddIntConstant(m, "LRI_CACHESOURCETIMEOUT", LRI_CACHESOURCETIMEOUT);
+    PyModule_AddIntConstant(m, "LRI_LOCALHARDLINK", LRI_LOCALHARDLINK);
+    PyModule_AddIntConstant(m, "LRI_DURABILITY", LRI_DURABILITY);
+    PyModule_AddIntConstant(m, "LRI_ATOMICDOWNLOAD", LRI_ATOMICDOWNLOAD);
+    PyModule_AddIntConstant(m, "LRI_GPGBACKEND", LRI_GPGBACKEND);
+    PyModule_AddIntConstant(m, "LRI_STATS", LRI_STATS);
+    PyModule_AddIntConstant(m, "LRI_MIRRORHEALTHCACHE", LRI_MIRRORHEALTHCACHE);
+    PyModule_AddIntConstant(m, "LRI_MIRRORBREAKER", LRI_MIRRORBREAKER);
+    PyModule_AddIntConstant(m, "LRI_TRACEFILE", LRI_TRACEFILE);
+    PyModule_AddIntConstant(m, "LRI_TRACEFORMAT", LRI_TRACEFORMAT);
+    PyModule_AddIntConstant(m, "LRI_METRICSINTERVAL", LRI_METRICSINTERVAL);
+    PyModule_AddIntConstant(m, "LRI_DOWNLOADSHARDS", LRI_DOWNLOADSHARDS);
+    PyModule_AddIntConstant(m, "LRI_SHARDENDCB", LRI_SHARDENDCB);
+    PyModule_AddIntConstant(m, "LRI_IOURING", LRI_IOURING);
+    PyModule_AddIntConstant(m, "LRI_RESUMEJOURNAL", LRI_RESUMEJOURNAL);
+    PyModule_AddIntConstant(m, "LRI_MAXRANGESPERREQUEST", LRI_MAXRANGESPERREQUEST);
+    PyModule_AddIntConstant(m, "LRI_CONNECTIONAFFINITY", LRI_CONNECTIONAFFINITY);
+    PyModule_AddIntConstant(m, "LRI_AUTOTUNEPARALLELDOWNLOADS", LRI_AUTOTUNEPARALLELDOWNLOADS);
+    PyModule_AddIntConstant(m, "LRI_ACCEPTENCODING", LRI_ACCEPTENCODING);
+    PyModule_AddIntConstant(m, "LRI_CRITICALSLOTS", LRI_CRITICALSLOTS);
+    PyModule_AddIntConstant(m, "LRI_PROXIES", LRI_PROXIES);
+    PyModule_AddIntConstant(m, "LRI_RECVBUFFERSIZE", LRI_RECVBUFFERSIZE);
+    PyModule_AddIntConstant(m, "LRI_ENDCBTHREADS", LRI_ENDCBTHREADS);
+    PyModule_AddIntConstant(m, "LRI_ENDCBQUEUESIZE", LRI_ENDCBQUEUESIZE);
     PyModule_AddIntConstant(m, "LRI_SENTINEL", LRI_SENTINEL);
 
     // Check options
@@ -325,6 +512,36 @@ init_librepo(void)
     PyModule_AddIntConstant(m, "LR_IPRESOLVE_V4", LR_IPRESOLVE_V4);
     PyModule_AddIntConstant(m, "LR_IPRESOLVE_V6", LR_IPRESOLVE_V6);
 
+    // Download order
+    PyModule_AddIntConstant(m, "LR_DOWNLOADORDER_FIFO", LR_DOWNLOADORDER_FIFO);
+    PyModule_AddIntConstant(m, "LR_DOWNLOADORDER_LARGESTFIRST", LR_DOWNLOADORDER_LARGESTFIRST);
+    PyModule_AddIntConstant(m, "LR_DOWNLOADORDER_SMALLESTFIRST", LR_DOWNLOADORDER_SMALLESTFIRST);
+    PyModule_AddIntConstant(m, "LR_DOWNLOADORDER_PRIORITY", LR_DOWNLOADORDER_PRIORITY);
+
+    // Priority classes
+    PyModule_AddIntConstant(m, "LR_PRIORITYCLASS_NORMAL", LR_PRIORITYCLASS_NORMAL);
+    PyModule_AddIntConstant(m, "LR_PRIORITYCLASS_CRITICAL", LR_PRIORITYCLASS_CRITICAL);
+    PyModule_AddIntConstant(m, "LR_PRIORITYCLASS_BACKGROUND", LR_PRIORITYCLASS_BACKGROUND);
+
+    // Adaptive mirror sorting
+    PyModule_AddIntConstant(m, "LR_ADAPTIVEMIRRORSORTING_NONE", LR_ADAPTIVEMIRRORSORTING_NONE);
+    PyModule_AddIntConstant(m, "LR_ADAPTIVEMIRRORSORTING_ERRORRATE", LR_ADAPTIVEMIRRORSORTING_ERRORRATE);
+    PyModule_AddIntConstant(m, "LR_ADAPTIVEMIRRORSORTING_THROUGHPUT", LR_ADAPTIVEMIRRORSORTING_THROUGHPUT);
+
+    // Durability
+    PyModule_AddIntConstant(m, "LR_DURABILITY_NONE", LR_DURABILITY_NONE);
+    PyModule_AddIntConstant(m, "LR_DURABILITY_BATCH", LR_DURABILITY_BATCH);
+    PyModule_AddIntConstant(m, "LR_DURABILITY_STRICT", LR_DURABILITY_STRICT);
+
+    // GPG backend
+    PyModule_AddIntConstant(m, "LR_GPGBACKEND_DEFAULT", LR_GPGBACKEND_DEFAULT);
+    PyModule_AddIntConstant(m, "LR_GPGBACKEND_GPGME", LR_GPGBACKEND_GPGME);
+    PyModule_AddIntConstant(m, "LR_GPGBACKEND_BUILTIN", LR_GPGBACKEND_BUILTIN);
+
+    // Trace format
+    PyModule_AddIntConstant(m, "LR_TRACE_CHROME", LR_TRACE_CHROME);
+    PyModule_AddIntConstant(m, "LR_TRACE_JSONLINES", LR_TRACE_JSONLINES);
+
     // Return codes
     PyModule_AddIntConstant(m, "LRE_OK", LRE_OK);
     PyModule_AddIntConstant(m, "LRE_BADFUNCARG", LRE_BADFUNCARG);
@@ -362,12 +579,17 @@ init_librepo(void)
     PyModule_AddIntConstant(m, "LRE_MEMORY", LRE_MEMORY);
     PyModule_AddIntConstant(m, "LRE_XMLPARSER", LRE_XMLPARSER);
     PyModule_AddIntConstant(m, "LRE_CBINTERRUPTED", LRE_CBINTERRUPTED);
+    PyModule_AddIntConstant(m, "LRE_CANCELLED", LRE_CANCELLED);
+    PyModule_AddIntConstant(m, "LRE_DECOMPRESSION", LRE_DECOMPRESSION);
+    PyModule_AddIntConstant(m, "LRE_NOSPACE", LRE_NOSPACE);
+    PyModule_AddIntConstant(m, "LRE_DEADLINE", LRE_DEADLINE);
     PyModule_AddIntConstant(m, "LRE_UNKNOWNERROR", LRE_UNKNOWNERROR);
 
     // Result option
     PyModule_AddIntConstant(m, "LRR_YUM_REPO", LRR_YUM_REPO);
     PyModule_AddIntConstant(m, "LRR_YUM_REPOMD", LRR_YUM_REPOMD);
     PyModule_AddIntConstant(m, "LRR_YUM_TIMESTAMP", LRR_YUM_TIMESTAMP);
+    PyModule_AddIntConstant(m, "LRR_YUM_REPOMD_DIFF", LRR_YUM_REPOMD_DIFF);
     PyModule_AddIntConstant(m, "LRR_SENTINEL", LRR_SENTINEL);
 
     // Checksums
@@ -29,7 +29,6 @@
 #include "packagetarget-py.h"
 #include "exception-py.h"
 #include "downloader-py.h"
-#include "globalstate-py.h" // GIL Hack
 
 PyObject *
 py_download_packages(G_GNUC_UNUSED PyObject *self, PyObject *args)
@@ -53,7 +52,6 @@ py_download_packages(G_GNUC_UNUSED PyObject *self, PyObject *args)
         LrPackageTarget *target = PackageTarget_FromPyObject(py_packagetarget);
         if (!target)
             return NULL;
-        PackageTarget_SetThreadState(py_packagetarget, &state);
         list = g_slist_append(list, target);
     }
 
@@ -62,19 +60,10 @@ py_download_packages(G_GNUC_UNUSED PyObject *self, PyObject *args)
     if (failfast)
         flags |= LR_PACKAGEDOWNLOAD_FAILFAST;
 
-    // XXX: GIL Hack
-    int hack_rc = gil_logger_hack_begin(&state);
-    if (hack_rc == GIL_HACK_ERROR)
-        return NULL;
-
     BeginAllowThreads(&state);
     ret = lr_download_packages(list, flags, &tmp_err);
     EndAllowThreads(&state);
 
-    // XXX: GIL Hack
-    if (!gil_logger_hack_end(hack_rc))
-        return NULL;
-
     assert((ret && !tmp_err) || (!ret && tmp_err));
 
     Py_XDECREF(py_list);
@@ -41,8 +41,6 @@ typedef struct {
     PyObject *progress_cb;
     PyObject *end_cb;
     PyObject *mirrorfailure_cb;
-    /* GIL Stuff */
-    PyThreadState **state;
 } _PackageTargetObject;
 
 LrPackageTarget *
@@ -69,6 +67,11 @@ check_PackageTargetStatus(const _PackageTargetObject *self)
 
 /* Callback stuff */
 
+/* The callbacks are called while the GIL is released by the download
+ * (possibly from another thread), so they take the GIL themselves
+ * by PyGILState_Ensure() just for the Python call.
+ */
+
 static int
 packagetarget_progress_callback(void *data, double total_to_download, double now_downloaded)
 {
@@ -86,7 +89,7 @@ packagetarget_progress_callback(void *data, double total_to_download, double now
     else
         user_data = Py_None;
 
-    EndAllowThreads(self->state);
+    PyGILState_STATE gstate = PyGILState_Ensure();
     result = PyObject_CallFunction(self->progress_cb,
                         "(Odd)", user_data, total_to_download, now_downloaded);
 
@@ -112,7 +115,7 @@ packagetarget_progress_callback(void *data, double total_to_download, double now
     }
 
     Py_XDECREF(result);
-    BeginAllowThreads(self->state);
+    PyGILState_Release(gstate);
 
     return ret;
 }
@@ -136,7 +139,7 @@ packagetarget_end_callback(void *data,
     else
         user_data = Py_None;
 
-    EndAllowThreads(self->state);
+    PyGILState_STATE gstate = PyGILState_Ensure();
     result = PyObject_CallFunction(self->end_cb,
                                    "(Ois)", user_data, status, msg);
     if (!result) {
@@ -161,7 +164,7 @@ packagetarget_end_callback(void *data,
     }
 
     Py_XDECREF(result);
-    BeginAllowThreads(self->state);
+    PyGILState_Release(gstate);
 
     return ret;
 }
@@ -185,7 +188,7 @@ packagetarget_mirrorfailure_callback(void *data,
     else
         user_data = Py_None;
 
-    EndAllowThreads(self->state);
+    PyGILState_STATE gstate = PyGILState_Ensure();
     result = PyObject_CallFunction(self->mirrorfailure_cb,
                                    "(Oss)", user_data, msg, url);
 
@@ -211,27 +214,11 @@ packagetarget_mirrorfailure_callback(void *data,
     }
 
     Py_XDECREF(result);
-    BeginAllowThreads(self->state);
+    PyGILState_Release(gstate);
 
     return ret;
 }
 
-void
-PackageTarget_SetThreadState(PyObject *o, PyThreadState **state)
-{
-    _PackageTargetObject *self = (_PackageTargetObject *) o;
-    if (!self) return;
-    self->state = state;
-
-    // XXX: Little tricky (but not so much)
-    // Set the state to the depending handle as well
-    // (Needed when fastestmirrorcb is used)
-    if (self->handle) {
-        Handle_SetThreadState(self->handle, state);
-    }
-}
-
-
 /* Function on the type */
 
 static PyObject *
@@ -248,7 +235,6 @@ packagetarget_new(PyTypeObject *type,
         self->progress_cb = NULL;
         self->end_cb = NULL;
         self->mirrorfailure_cb = NULL;
-        self->state = NULL;
     }
     return (PyObject *)self;
 }
@@ -259,7 +245,8 @@ packagetarget_init(_PackageTargetObject *self,
                    PyObject *kwds G_GNUC_UNUSED)
 {
     char *relative_url, *dest, *checksum, *base_url;
-    int checksum_type, resume;
+    int checksum_type, resume, priority, priorityclass;
+    double deadline;
     PY_LONG_LONG expectedsize, byterangestart, byterangeend;
     PyObject *pyhandle, *py_progresscb, *py_cbdata;
     PyObject *py_endcb, *py_mirrorfailurecb;
@@ -271,12 +258,13 @@ packagetarget_init(_PackageTargetObject *self,
     PyObject *py_dest = NULL;
     PyObject *tmp_py_str = NULL;
 
-    if (!PyArg_ParseTuple(args, "OsOizLziOOOOLL:packagetarget_init",
+    if (!PyArg_ParseTuple(args, "OsOizLziOOOOLLidi:packagetarget_init",
                           &pyhandle, &relative_url, &py_dest, &checksum_type,
                           &checksum, &expectedsize, &base_url, &resume,
                           &py_progresscb, &py_cbdata, &py_endcb,
                           &py_mirrorfailurecb, &byterangestart,
-                          &byterangeend))
+                          &byterangeend, &priority, &deadline,
+                          &priorityclass))
         return -1;
 
     dest = PyAnyStr_AsString(py_dest, &tmp_py_str);
@@ -333,13 +321,14 @@ packagetarget_init(_PackageTargetObject *self,
         return -1;
     }
 
-    self->target = lr_packagetarget_new_v3(handle, relative_url, dest,
+    self->target = lr_packagetarget_new_v4(handle, relative_url, dest,
                                            checksum_type, checksum,
                                            (gint64) expectedsize, base_url,
                                            resume, progresscb, self, endcb,
                                            mirrorfailurecb,
                                            (gint64) byterangestart,
                                            (gint64) byterangeend,
+                                           (gint) priority,
                                            &tmp_err);
     Py_XDECREF(tmp_py_str);
 
@@ -350,6 +339,9 @@ packagetarget_init(_PackageTargetObject *self,
         g_error_free(tmp_err);
         return -1;
     }
+
+    self->target->deadline = (gdouble) deadline;
+    self->target->priorityclass = (LrPriorityClass) priorityclass;
     return 0;
 }
 
@@ -366,8 +358,271 @@ packagetarget_dealloc(_PackageTargetObject *o)
     Py_TYPE(o)->tp_free(o);
 }
 
+static PyObject *
+py_set_delta(_PackageTargetObject *self, PyObject *args)
+{
+    char *delta_url, *delta_checksum, *delta_base;
+    int delta_checksum_type;
+    PY_LONG_LONG delta_size;
+    GError *tmp_err = NULL;
+
+    if (!PyArg_ParseTuple(args, "sizLz:py_set_delta", &delta_url,
+                                                      &delta_checksum_type,
+                                                      &delta_checksum,
+                                                      &delta_size,
+                                                      &delta_base))
+        return NULL;
+    if (check_PackageTargetStatus(self))
+        return NULL;
+
+    if (!lr_packagetarget_set_delta(self->target, delta_url,
+                                    delta_checksum_type, delta_checksum,
+                                    (gint64) delta_size, delta_base,
+                                    &tmp_err))
+        RETURN_ERROR(&tmp_err, -1, NULL);
+
+    Py_RETURN_NONE;
+}
+
+static PyObject *
+py_cancel(_PackageTargetObject *self, G_GNUC_UNUSED PyObject *noarg)
+{
+    if (check_PackageTargetStatus(self))
+        return NULL;
+
+    lr_packagetarget_cancel(self->target);
+    Py_RETURN_NONE;
+}
+
+/* Bulk construction */
+
+/* Fill strs with n strings of the column. The column is None (all NULL),
+ * a single string (shared by all the targets) or a sequence of strings
+ * or Nones. Temporary objects which own the strings are appended to tmps.
+ */
+static int
+bulk_column_strings(PyObject *column,
+                    Py_ssize_t n,
+                    const char *name,
+                    char **strs,
+                    PyObject *tmps)
+{
+    PyObject *seq, *tmp_py_str = NULL;
+    char *str;
+
+    if (column == Py_None)
+        return 0;
+
+    if (PyUnicode_Check(column) || PyBytes_Check(column)) {
+        str = PyAnyStr_AsString(column, &tmp_py_str);
+        if (!str)
+            return -1;
+        if (tmp_py_str && PyList_Append(tmps, tmp_py_str)) {
+            Py_DECREF(tmp_py_str);
+            return -1;
+        }
+        Py_XDECREF(tmp_py_str);
+        for (Py_ssize_t i = 0; i < n; i++)
+            strs[i] = str;
+        return 0;
+    }
+
+    seq = PySequence_Fast(column, name);
+    if (!seq)
+        return -1;
+    if (PySequence_Fast_GET_SIZE(seq) != n) {
+        PyErr_Format(PyExc_ValueError, "%s must have %zd items", name, n);
+        Py_DECREF(seq);
+        return -1;
+    }
+
+    for (Py_ssize_t i = 0; i < n; i++) {
+        PyObject *item = PySequence_Fast_GET_ITEM(seq, i);
+
+        if (item == Py_None)
+            continue;
+
+        tmp_py_str = NULL;
+        strs[i] = PyAnyStr_AsString(item, &tmp_py_str);
+        if (!strs[i]) {
+            if (!PyErr_Occurred())
+                PyErr_Format(PyExc_TypeError,
+                             "%s must contain only strings or None", name);
+            Py_DECREF(seq);
+            return -1;
+        }
+        if (tmp_py_str && PyList_Append(tmps, tmp_py_str)) {
+            Py_DECREF(tmp_py_str);
+            Py_DECREF(seq);
+            return -1;
+        }
+        Py_XDECREF(tmp_py_str);
+    }
+
+    // The sequence owns the items (and the strings of bytes items)
+    if (PyList_Append(tmps, seq)) {
+        Py_DECREF(seq);
+        return -1;
+    }
+    Py_DECREF(seq);
+    return 0;
+}
+
+/* Fill vals with n integers of the column. The column is None (all 0),
+ * a single number (shared by all the targets) or a sequence of integers.
+ */
+static int
+bulk_column_ints(PyObject *column,
+                 Py_ssize_t n,
+                 const char *name,
+                 gint64 *vals)
+{
+    PyObject *seq;
+
+    if (column == Py_None)
+        return 0;
+
+    if (!PySequence_Check(column)) {
+        gint64 val = (gint64) PyLong_AsLongLong(column);
+        if (PyErr_Occurred())
+            return -1;
+        for (Py_ssize_t i = 0; i < n; i++)
+            vals[i] = val;
+        return 0;
+    }
+
+    seq = PySequence_Fast(column, name);
+    if (!seq)
+        return -1;
+    if (PySequence_Fast_GET_SIZE(seq) != n) {
+        PyErr_Format(PyExc_ValueError, "%s must have %zd items", name, n);
+        Py_DECREF(seq);
+        return -1;
+    }
+
+    for (Py_ssize_t i = 0; i < n; i++) {
+        vals[i] = (gint64) PyLong_AsLongLong(PySequence_Fast_GET_ITEM(seq, i));
+        if (PyErr_Occurred()) {
+            Py_DECREF(seq);
+            return -1;
+        }
+    }
+
+    Py_DECREF(seq);
+    return 0;
+}
+
+static PyObject *
+py_bulk_new(PyTypeObject *type, PyObject *args)
+{
+    PyObject *pyhandle, *py_urls, *py_dests, *py_checksum_types;
+    PyObject *py_checksums, *py_expectedsizes;
+    PyObject *urls = NULL, *tmps = NULL, *list = NULL;
+    char *base_url;
+    char **strs = NULL;
+    gint64 *vals = NULL;
+    LrPackageTarget **targets = NULL;
+    LrHandle *handle = NULL;
+    Py_ssize_t n, i;
+    gboolean failed = FALSE;
+
+    if (!PyArg_ParseTuple(args, "OOOOOOz:py_bulk_new",
+                          &pyhandle, &py_urls, &py_dests, &py_checksum_types,
+                          &py_checksums, &py_expectedsizes, &base_url))
+        return NULL;
+
+    if (pyhandle != Py_None) {
+        handle = Handle_FromPyObject(pyhandle);
+        if (!handle)
+            return NULL;
+    }
+
+    urls = PySequence_Fast(py_urls, "relative_urls must be a sequence");
+    if (!urls)
+        return NULL;
+    n = PySequence_Fast_GET_SIZE(urls);
+
+    // Columns: relative_urls, dests, checksums | checksum_types, sizes
+    strs = g_new0(char *, 3 * n);
+    vals = g_new0(gint64, 2 * n);
+    tmps = PyList_New(0);
+    if (!tmps
+        || bulk_column_strings(urls, n, "relative_urls", strs, tmps)
+        || bulk_column_strings(py_dests, n, "dests", strs + n, tmps)
+        || bulk_column_strings(py_checksums, n, "checksums", strs + 2 * n, tmps)
+        || bulk_column_ints(py_checksum_types, n, "checksum_types", vals)
+        || bulk_column_ints(py_expectedsizes, n, "expectedsizes", vals + n))
+        goto out;
+
+    for (i = 0; i < n; i++) {
+        if (!strs[i]) {
+            PyErr_SetString(PyExc_TypeError, "relative_urls must not contain None");
+            goto out;
+        }
+    }
+
+    // Only C strings are touched from now, the GIL is not needed
+    targets = g_new0(LrPackageTarget *, n);
+    Py_BEGIN_ALLOW_THREADS
+    for (i = 0; i < n; i++) {
+        targets[i] = lr_packagetarget_new_v4(handle, strs[i], strs[n + i],
+                                             (LrChecksumType) vals[i],
+                                             strs[2 * n + i], vals[n + i],
+                                             base_url, FALSE, NULL, NULL,
+                                             NULL, NULL, 0, 0, 0, NULL);
+        if (!targets[i]) {
+            failed = TRUE;
+            break;
+        }
+    }
+    Py_END_ALLOW_THREADS
+
+    if (failed) {
+        PyErr_NoMemory();
+        goto out;
+    }
+
+    list = PyList_New(n);
+    if (!list)
+        goto out;
+
+    for (i = 0; i < n; i++) {
+        _PackageTargetObject *obj;
+
+        obj = (_PackageTargetObject *) packagetarget_new(type, NULL, NULL);
+        if (!obj) {
+            Py_CLEAR(list);
+            goto out;
+        }
+        obj->target = targets[i];
+        obj->target->cbdata = obj;
+        targets[i] = NULL;
+        if (handle) {
+            obj->handle = pyhandle;
+            Py_INCREF(obj->handle);
+        }
+        PyList_SET_ITEM(list, i, (PyObject *) obj);
+    }
+
+out:
+    if (targets) {
+        for (i = 0; i < n; i++)
+            if (targets[i])
+                lr_packagetarget_free(targets[i]);
+        g_free(targets);
+    }
+    g_free(strs);
+    g_free(vals);
+    Py_XDECREF(tmps);
+    Py_DECREF(urls);
+    return list;
+}
+
 static struct
 PyMethodDef packagetarget_methods[] = {
+    { "set_delta", (PyCFunction)py_set_delta, METH_VARARGS, NULL },
+    { "cancel", (PyCFunction)py_cancel, METH_NOARGS, NULL },
+    { "_bulk_new", (PyCFunction)py_bulk_new, METH_VARARGS|METH_CLASS, NULL },
     { NULL }
 };
 
@@ -394,6 +649,16 @@ get_int(_PackageTargetObject *self, void *member_offset)
     return PyLong_FromLong((long) val);
 }
 
+static PyObject *
+get_double(_PackageTargetObject *self, void *member_offset)
+{
+    if (check_PackageTargetStatus(self))
+        return NULL;
+    LrPackageTarget *target = self->target;
+    double val = *((double *) ((size_t)target + (size_t) member_offset));
+    return PyFloat_FromDouble(val);
+}
+
 static PyObject *
 get_str(_PackageTargetObject *self, void *member_offset)
 {
@@ -450,6 +715,31 @@ get_pythonobj(_PackageTargetObject *self, void *member_offset)
     Py_RETURN_NONE;
 }
 
+static int
+set_endcb(_PackageTargetObject *self,
+          PyObject *value,
+          G_GNUC_UNUSED void *closure)
+{
+    if (check_PackageTargetStatus(self))
+        return -1;
+
+    if (value == Py_None)
+        value = NULL;
+
+    if (value && !PyCallable_Check(value)) {
+        PyErr_SetString(PyExc_TypeError, "endcb must be callable or None");
+        return -1;
+    }
+
+    // The callback is read when the download of the target starts
+    Py_XINCREF(value);
+    Py_XDECREF(self->end_cb);
+    self->end_cb = value;
+    self->target->endcb = (value) ? packagetarget_end_callback : NULL;
+
+    return 0;
+}
+
 static PyGetSetDef packagetarget_getsetters[] = {
     {"handle",        (getter)get_pythonobj, NULL, NULL, OFFSET(handle)},
     {"relative_url",  (getter)get_str,       NULL, NULL, OFFSET(relative_url)},
@@ -461,10 +751,25 @@ static PyGetSetDef packagetarget_getsetters[] = {
     {"resume",        (getter)get_int,       NULL, NULL, OFFSET(resume)},
     {"cbdata",        (getter)get_pythonobj, NULL, NULL, OFFSET(cbdata)},
     {"progresscb",    (getter)get_pythonobj, NULL, NULL, OFFSET(progresscb)},
-    {"endcb",         (getter)get_pythonobj, NULL, NULL, OFFSET(endcb)},
+    {"endcb",         (getter)get_pythonobj, (setter)set_endcb, NULL, OFFSET(endcb)},
     {"mirrorfailurecb",(getter)get_pythonobj,NULL, NULL, OFFSET(mirrorfailurecb)},
+    {"priority",      (getter)get_int,       NULL, NULL, OFFSET(priority)},
+    {"deadline",      (getter)get_double,    NULL, NULL, OFFSET(deadline)},
+    {"priorityclass", (getter)get_int,       NULL, NULL, OFFSET(priorityclass)},
+    {"delta_url",     (getter)get_str,       NULL, NULL, OFFSET(delta_url)},
+    {"delta_checksum_type",(getter)get_int,  NULL, NULL, OFFSET(delta_checksum_type)},
+    {"delta_checksum",(getter)get_str,       NULL, NULL, OFFSET(delta_checksum)},
+    {"delta_size",    (getter)get_gint64,    NULL, NULL, OFFSET(delta_size)},
+    {"delta_base",    (getter)get_str,       NULL, NULL, OFFSET(delta_base)},
     {"local_path",    (getter)get_str,       NULL, NULL, OFFSET(local_path)},
     {"err",           (getter)get_str,       NULL, NULL, OFFSET(err)},
+    {"namelookup_time",   (getter)get_double, NULL, NULL, OFFSET(stats.namelookup_time)},
+    {"connect_time",      (getter)get_double, NULL, NULL, OFFSET(stats.connect_time)},
+    {"appconnect_time",   (getter)get_double, NULL, NULL, OFFSET(stats.appconnect_time)},
+    {"starttransfer_time",(getter)get_double, NULL, NULL, OFFSET(stats.starttransfer_time)},
+    {"total_time",        (getter)get_double, NULL, NULL, OFFSET(stats.total_time)},
+    {"speed_download",    (getter)get_double, NULL, NULL, OFFSET(stats.speed_download)},
+    {"attempts",          (getter)get_int,    NULL, NULL, OFFSET(stats.attempts)},
     {NULL, NULL, NULL, NULL, NULL} /* sentinel */
 };
 
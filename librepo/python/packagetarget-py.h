@@ -28,6 +28,5 @@ extern PyTypeObject PackageTarget_Type;
 #define PackageTargetObject_Check(o)   PyObject_TypeCheck(o, &PackageTarget_Type)
 
 LrPackageTarget *PackageTarget_FromPyObject(PyObject *o);
-void PackageTarget_SetThreadState(PyObject *o, PyThreadState **state);
 
 #endif
@@ -145,6 +145,18 @@ getinfo(_ResultObject *self, PyObject *args)
         return PyObject_FromYumRepoMd(repomd);
     }
 
+    case LRR_YUM_REPOMD_DIFF: {
+        LrYumRepoMdDiff *diff;
+        GError *tmp_err = NULL;
+        res = lr_result_getinfo(self->result,
+                                &tmp_err,
+                                (LrResultInfoOption)option,
+                                &diff);
+        if (!res)
+            RETURN_ERROR(&tmp_err, -1, NULL);
+        return PyObject_FromYumRepoMdDiff(diff);
+    }
+
     case LRR_YUM_TIMESTAMP: {
         gint64 ts;
         GError *tmp_err = NULL;
@@ -169,6 +181,31 @@ getinfo(_ResultObject *self, PyObject *args)
     Py_RETURN_NONE;
 }
 
+static PyObject *
+yum_repo_path(_ResultObject *self, PyObject *args)
+{
+    char *type;
+    const char *path;
+    LrYumRepo *repo;
+    GError *tmp_err = NULL;
+
+    if (!PyArg_ParseTuple(args, "s:yum_repo_path", &type))
+        return NULL;
+    if (check_ResultStatus(self))
+        return NULL;
+
+    if (!lr_result_getinfo(self->result, &tmp_err, LRR_YUM_REPO, &repo))
+        RETURN_ERROR(&tmp_err, -1, NULL);
+    if (!repo)
+        Py_RETURN_NONE;
+
+    path = lr_yum_repo_path_verified(repo, type, &tmp_err);
+    if (tmp_err)
+        RETURN_ERROR(&tmp_err, -1, NULL);
+
+    return PyStringOrNone_FromString(path);
+}
+
 static PyObject *
 clear(_ResultObject *self, G_GNUC_UNUSED PyObject *noarg)
 {
@@ -181,6 +218,7 @@ clear(_ResultObject *self, G_GNUC_UNUSED PyObject *noarg)
 static struct
 PyMethodDef result_methods[] = {
     { "getinfo", (PyCFunction)getinfo, METH_VARARGS, NULL },
+    { "yum_repo_path", (PyCFunction)yum_repo_path, METH_VARARGS, NULL },
     { "clear", (PyCFunction)clear, METH_NOARGS, NULL },
     { NULL }
 };
@@ -184,6 +184,33 @@ PyObject_FromYumRepoMd(LrYumRepoMd *repomd)
     return dict;
 }
 
+PyObject *
+PyObject_FromYumRepoMdDiff(LrYumRepoMdDiff *diff)
+{
+    PyObject *dict;
+
+    if (!diff)
+        Py_RETURN_NONE;
+
+    if ((dict = PyDict_New()) == NULL)
+        return NULL;
+
+    const char *keys[] = { "added", "removed", "changed" };
+    GSList *lists[] = { diff->added, diff->removed, diff->changed };
+    for (size_t x = 0; x < G_N_ELEMENTS(keys); x++) {
+        PyObject *list = PyList_New(0);
+        for (GSList *elem = lists[x]; elem; elem = g_slist_next(elem)) {
+            PyObject *type = PyStringOrNone_FromString(elem->data);
+            PyList_Append(list, type);
+            Py_DECREF(type);
+        }
+        PyDict_SetItemString(dict, keys[x], list);
+        Py_DECREF(list);
+    }
+
+    return dict;
+}
+
 PyObject *
 PyObject_FromMetalink(LrMetalink *metalink)
 {
@@ -297,5 +324,105 @@ PyObject_FromMetalink(LrMetalink *metalink)
         }
     }
 
+    // Pieces
+
+    if (metalink->pieces) {
+
+        if ((sub_list = PyList_New(0)) == NULL) {
+            PyDict_Clear(dict);
+            return NULL;
+        }
+        PyDict_SetItemString(dict, "pieces", sub_list);
+
+        for (GSList *elem = metalink->pieces; elem; elem = g_slist_next(elem)) {
+            LrMetalinkPieces *mp = elem->data;
+            PyObject *udict;
+            if ((udict = PyDict_New()) == NULL) {
+                PyDict_Clear(dict);
+                return NULL;
+            }
+            PyDict_SetItemString(udict, "type",
+                PyStringOrNone_FromString(mp->type));
+            PyDict_SetItemString(udict, "length",
+                PyLong_FromLongLong((PY_LONG_LONG)mp->length));
+
+            PyObject *usub_list;
+            if ((usub_list = PyList_New(0)) == NULL) {
+                PyDict_Clear(dict);
+                return NULL;
+            }
+            PyDict_SetItemString(udict, "hashes", usub_list);
+
+            for (GSList *subelem = mp->hashes; subelem; subelem = g_slist_next(subelem))
+                PyList_Append(usub_list,
+                        PyStringOrNone_FromString(subelem->data));
+
+            PyList_Append(sub_list, udict);
+        }
+    }
+
+    return dict;
+}
+
+PyObject *
+PyObject_FromStats(LrStats *stats)
+{
+    PyObject *dict, *sub_list;
+
+    if (!stats)
+        Py_RETURN_NONE;
+
+    if ((dict = PyDict_New()) == NULL)
+        return NULL;
+
+    PyDict_SetItemString(dict, "bytes",
+            PyLong_FromUnsignedLongLong((unsigned PY_LONG_LONG) stats->bytes));
+    PyDict_SetItemString(dict, "time", PyFloat_FromDouble(stats->time));
+    PyDict_SetItemString(dict, "successful",
+            PyLong_FromLong((long) stats->successful));
+    PyDict_SetItemString(dict, "failed",
+            PyLong_FromLong((long) stats->failed));
+    PyDict_SetItemString(dict, "retries",
+            PyLong_FromLong((long) stats->retries));
+    PyDict_SetItemString(dict, "speed", PyFloat_FromDouble(stats->speed));
+    PyDict_SetItemString(dict, "allocations",
+            PyLong_FromUnsignedLongLong(
+                (unsigned PY_LONG_LONG) stats->allocations));
+    PyDict_SetItemString(dict, "allocated_bytes",
+            PyLong_FromUnsignedLongLong(
+                (unsigned PY_LONG_LONG) stats->allocated_bytes));
+    PyDict_SetItemString(dict, "parallel_downloads",
+            PyLong_FromLong((long) stats->parallel_downloads));
+
+    // Mirrors
+    if ((sub_list = PyList_New(0)) == NULL) {
+        PyDict_Clear(dict);
+        return NULL;
+    }
+    PyDict_SetItemString(dict, "mirrors", sub_list);
+
+    for (GSList *elem = stats->mirrors; elem; elem = g_slist_next(elem)) {
+        LrMirrorStats *mirror = elem->data;
+        PyObject *mdict;
+        if ((mdict = PyDict_New()) == NULL) {
+            PyDict_Clear(dict);
+            return NULL;
+        }
+        PyDict_SetItemString(mdict, "url",
+                PyStringOrNone_FromString(mirror->url));
+        PyDict_SetItemString(mdict, "bytes",
+                PyLong_FromUnsignedLongLong((unsigned PY_LONG_LONG) mirror->bytes));
+        PyDict_SetItemString(mdict, "time", PyFloat_FromDouble(mirror->time));
+        PyDict_SetItemString(mdict, "successful",
+                PyLong_FromLong((long) mirror->successful));
+        PyDict_SetItemString(mdict, "failed",
+                PyLong_FromLong((long) mirror->failed));
+        PyDict_SetItemString(mdict, "retries",
+                PyLong_FromLong((long) mirror->retries));
+        PyDict_SetItemString(mdict, "speed",
+                PyFloat_FromDouble(mirror->speed));
+        PyList_Append(sub_list, mdict);
+    }
+
     return dict;
 }
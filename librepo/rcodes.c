@@ -100,6 +100,14 @@ lr_strerror(int rc)
         return "Error in repomd.xml";
     case LRE_VALUE:
         return "Bad value (no value, unknown unit, etc.)";
+    case LRE_CANCELLED:
+        return "Cancelled";
+    case LRE_DECOMPRESSION:
+        return "Decompression error";
+    case LRE_NOSPACE:
+        return "Not enough free disk space";
+    case LRE_DEADLINE:
+        return "Deadline passed";
     }
 
     return "Unknown error";
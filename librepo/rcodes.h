@@ -114,6 +114,14 @@ typedef enum {
     LRE_VALUE, /*!<
         (37) Bad value (e.g. we are expecting bandwidth defined like '1024',
         '1k', etc., but we got something like 'asdf', '1024S', etc.) */
+    LRE_CANCELLED, /*!<
+        (38) Operation was cancelled by lr_handle_cancel() */
+    LRE_DECOMPRESSION, /*!<
+        (39) Downloaded data cannot be decompressed */
+    LRE_NOSPACE, /*!<
+        (40) Not enough free space on the disk for the downloaded data */
+    LRE_DEADLINE, /*!<
+        (41) The target wasn't downloaded by its deadline */
     LRE_UNKNOWNERROR, /*!<
         (xx) unknown error - sentinel of error codes enum */
 } LrRc; /*!< Return codes */
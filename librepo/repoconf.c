@@ -19,16 +19,51 @@
  * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
  */
 
+#define _XOPEN_SOURCE   700 // Because of st_mtim
+
 #include <assert.h>
 #include <math.h>
 #include <string.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <glib/gstdio.h>
+#include <zlib.h>
 #include "librepo.h"
 #include "repoconf.h"
 #include "cleanup.h"
 
+#define REPOCONFCACHE_MAGIC     "LRRC"
+#define REPOCONFCACHE_VERSION   1
+#define REPOCONFCACHE_NULL      G_MAXUINT32
+
+/** Contents of a lazily loaded .repo file */
+typedef struct {
+    gint refcount;
+    gchar *filename;        /*!< Path to the .repo file */
+    gchar *data;            /*!< Contents of the file */
+} LrRepoConfFileData;
+
+/** Section of a lazily loaded .repo file, not parsed yet */
+typedef struct {
+    LrRepoConfFileData *file;
+    gchar *id;              /*!< Name of the section */
+    GArray *ranges;         /*!< Offsets and lengths (gsize pairs) of the
+                                 section in the file, more than one if
+                                 the section is repeated */
+    LrYumRepoConf *conf;    /*!< Parsed by lr_yum_repoconfs_get() */
+} LrRepoConfSection;
+
 struct _LrYumRepoConfs {
     GSList *repos;
+    gboolean lazy;          /*!< Files are only indexed by
+                                 lr_yum_repoconfs_parse() */
+    GSList *sections;       /*!< Indexed LrRepoConfSection (in reverse
+                                 order), not in the repos yet */
+    GHashTable *sections_by_id; /*!< First section of every id */
 };
 
 static LrYumRepoConf *
@@ -144,38 +179,119 @@ lr_yum_repoconfs_init(void)
     return repos;
 }
 
+LrYumRepoConfs *
+lr_yum_repoconfs_init_lazy(void)
+{
+    LrYumRepoConfs *repos = lr_yum_repoconfs_init();
+    repos->lazy = TRUE;
+    repos->sections_by_id = g_hash_table_new(g_str_hash, g_str_equal);
+    return repos;
+}
+
+static void
+lr_repoconf_file_data_unref(LrRepoConfFileData *file)
+{
+    if (!file || --file->refcount > 0)
+        return;
+    g_free(file->filename);
+    g_free(file->data);
+    g_free(file);
+}
+
+static void
+lr_repoconf_section_free(LrRepoConfSection *section)
+{
+    lr_repoconf_file_data_unref(section->file);
+    g_free(section->id);
+    g_array_free(section->ranges, TRUE);
+    lr_yum_repoconf_free(section->conf);
+    g_free(section);
+}
+
 void
 lr_yum_repoconfs_free(LrYumRepoConfs *repos)
 {
     g_slist_free_full(repos->repos, (GDestroyNotify) lr_yum_repoconf_free);
+    g_slist_free_full(repos->sections, (GDestroyNotify) lr_repoconf_section_free);
+    if (repos->sections_by_id)
+        g_hash_table_destroy(repos->sections_by_id);
     g_free(repos);
 }
 
+static gboolean
+lr_repoconf_section_parse(LrRepoConfSection *section, GError **err);
+
 GSList *
-lr_yum_repoconfs_get_list(LrYumRepoConfs *repos, G_GNUC_UNUSED GError **err)
+lr_yum_repoconfs_get_list(LrYumRepoConfs *repos, GError **err)
 {
+    GSList *parsed = NULL;
+
+    assert(!err || *err == NULL);
+
+    // Parse the indexed sections
+    repos->sections = g_slist_reverse(repos->sections);
+    while (repos->sections) {
+        LrRepoConfSection *section = repos->sections->data;
+
+        if (!lr_repoconf_section_parse(section, err)) {
+            repos->sections = g_slist_reverse(repos->sections);
+            repos->repos = g_slist_concat(repos->repos,
+                                          g_slist_reverse(parsed));
+            return NULL;
+        }
+
+        parsed = g_slist_prepend(parsed, section->conf);
+        section->conf = NULL;
+        if (g_hash_table_lookup(repos->sections_by_id, section->id) == section)
+            g_hash_table_remove(repos->sections_by_id, section->id);
+        lr_repoconf_section_free(section);
+        repos->sections = g_slist_delete_link(repos->sections,
+                                              repos->sections);
+    }
+
+    repos->repos = g_slist_concat(repos->repos, g_slist_reverse(parsed));
     return repos->repos;
 }
 
+LrYumRepoConf *
+lr_yum_repoconfs_get(LrYumRepoConfs *repos, const char *id, GError **err)
+{
+    LrRepoConfSection *section;
+
+    assert(!err || *err == NULL);
+
+    for (GSList *elem = repos->repos; elem; elem = g_slist_next(elem)) {
+        LrYumRepoConf *conf = elem->data;
+        if (!g_strcmp0(conf->id, id))
+            return conf;
+    }
+
+    if (!repos->sections_by_id)
+        return NULL;
+
+    section = g_hash_table_lookup(repos->sections_by_id, id);
+    if (!section)
+        return NULL;
+
+    if (!lr_repoconf_section_parse(section, err))
+        return NULL;
+
+    return section->conf;
+}
+
 /* This function is taken from libhif
  * Original author: Richard Hughes <richard at hughsie dot com>
  */
 static GKeyFile *
-lr_load_multiline_key_file(const char *filename,
+lr_load_multiline_key_data(const char *data,
                            GError **err)
 {
     GKeyFile *file = NULL;
     gboolean ret;
-    gsize len;
     guint i;
-    _cleanup_free_ gchar *data = NULL;
     _cleanup_string_free_ GString *string = NULL;
     _cleanup_strv_free_ gchar **lines = NULL;
 
-    // load file
-    if (!g_file_get_contents (filename, &data, &len, err))
-        return NULL;
-
     // split into lines
     string = g_string_new ("");
     lines = g_strsplit (data, "\n", -1);
@@ -223,6 +339,20 @@ lr_load_multiline_key_file(const char *filename,
     return file;
 }
 
+static GKeyFile *
+lr_load_multiline_key_file(const char *filename,
+                           GError **err)
+{
+    gsize len;
+    _cleanup_free_ gchar *data = NULL;
+
+    // load file
+    if (!g_file_get_contents (filename, &data, &len, err))
+        return NULL;
+
+    return lr_load_multiline_key_data(data, err);
+}
+
 static gboolean
 lr_key_file_get_boolean(GKeyFile *keyfile,
                         const gchar *groupname,
@@ -581,6 +711,126 @@ err:
     return FALSE;
 }
 
+/** Parse the section of a lazily loaded file to section->conf.
+ */
+static gboolean
+lr_repoconf_section_parse(LrRepoConfSection *section, GError **err)
+{
+    _cleanup_string_free_ GString *data = NULL;
+    _cleanup_keyfile_free_ GKeyFile *keyfile = NULL;
+
+    if (section->conf)
+        return TRUE;
+
+    data = g_string_new(NULL);
+    for (guint i = 0; i + 1 < section->ranges->len; i += 2) {
+        gsize offset = g_array_index(section->ranges, gsize, i);
+        gsize len = g_array_index(section->ranges, gsize, i + 1);
+        g_string_append_len(data, section->file->data + offset, len);
+        if (len && section->file->data[offset + len - 1] != '\n')
+            g_string_append_c(data, '\n');
+    }
+
+    keyfile = lr_load_multiline_key_data(data->str, err);
+    if (!keyfile)
+        return FALSE;
+
+    if (!lr_yum_repoconf_parse_id(&section->conf,
+                                  section->id,
+                                  section->file->filename,
+                                  keyfile,
+                                  err))
+    {
+        if (err && !*err)
+            g_set_error(err, LR_REPOCONF_ERROR, LRE_VALUE,
+                        "Cannot parse section [%s] of %s",
+                        section->id, section->file->filename);
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+/** Index the sections of a .repo file, they are parsed on demand.
+ * The file is only split by the group lines, the keys are not touched.
+ */
+static gboolean
+lr_yum_repoconfs_index(LrYumRepoConfs *repos,
+                       const char *filename,
+                       GError **err)
+{
+    LrRepoConfFileData *file;
+    LrRepoConfSection *section = NULL;
+    GHashTable *file_sections;
+    gchar *data;
+    gsize len, pos = 0, start = 0;
+
+    if (!g_file_get_contents(filename, &data, &len, err))
+        return FALSE;
+
+    file = g_new0(LrRepoConfFileData, 1);
+    file->refcount = 1;
+    file->filename = g_strdup(filename);
+    file->data = data;
+    file_sections = g_hash_table_new(g_str_hash, g_str_equal);
+
+    while (pos <= len) {
+        const gchar *line = data + pos;
+        const gchar *eol = memchr(line, '\n', len - pos);
+        gsize linelen = eol ? (gsize) (eol - line) : len - pos;
+        gsize next = pos + linelen + 1;
+        gsize n = linelen;
+
+        while (n > 0 && g_ascii_isspace(line[n - 1]))
+            n--;
+
+        if (n >= 2 && line[0] == '[' && line[n - 1] == ']') {
+            // Group line, the previous section ends here
+            if (section) {
+                g_array_append_val(section->ranges, start);
+                gsize seclen = pos - start;
+                g_array_append_val(section->ranges, seclen);
+            }
+
+            gchar *id = g_strndup(line + 1, n - 2);
+            section = g_hash_table_lookup(file_sections, id);
+            if (section) {
+                g_free(id);
+            } else {
+                section = g_new0(LrRepoConfSection, 1);
+                section->file = file;
+                file->refcount++;
+                section->id = id;
+                section->ranges = g_array_new(FALSE, FALSE, sizeof(gsize));
+                g_hash_table_insert(file_sections, section->id, section);
+                repos->sections = g_slist_prepend(repos->sections, section);
+                if (!g_hash_table_contains(repos->sections_by_id, id))
+                    g_hash_table_insert(repos->sections_by_id, id, section);
+            }
+            start = pos;
+        } else if (!section && n > 0 && line[0] != '#') {
+            // Key before the first group, GKeyFile refuses such a file
+            g_set_error(err, G_KEY_FILE_ERROR, G_KEY_FILE_ERROR_GROUP_NOT_FOUND,
+                        "Key file %s does not start with a group", filename);
+            g_hash_table_destroy(file_sections);
+            lr_repoconf_file_data_unref(file);
+            return FALSE;
+        }
+
+        pos = next;
+    }
+
+    if (section) {
+        g_array_append_val(section->ranges, start);
+        gsize seclen = len - start;
+        g_array_append_val(section->ranges, seclen);
+    }
+
+    g_hash_table_destroy(file_sections);
+    lr_repoconf_file_data_unref(file);
+    return TRUE;
+}
+
 gboolean
 lr_yum_repoconfs_parse(LrYumRepoConfs *repos,
                        const char *filename,
@@ -590,6 +840,9 @@ lr_yum_repoconfs_parse(LrYumRepoConfs *repos,
     _cleanup_strv_free_ gchar **groups = NULL;
     _cleanup_keyfile_free_ GKeyFile *keyfile = NULL;
 
+    if (repos->lazy)
+        return lr_yum_repoconfs_index(repos, filename, err);
+
     keyfile = lr_load_multiline_key_file(filename, err);
     if (!keyfile)
         return FALSE;
@@ -635,3 +888,556 @@ lr_yum_repoconfs_load_dir(LrYumRepoConfs *repos,
 
     return TRUE;
 }
+
+/* Cache of parsed .repo files (lr_yum_repoconfs_load_dir_cached) */
+
+/** Header of the cache file. Followed by the payload: path of the
+ * directory, number of files and the files (name, stamp, number of repos
+ * and the repos).
+ */
+typedef struct {
+    char magic[4];          /*!< REPOCONFCACHE_MAGIC */
+    guint32 version;        /*!< REPOCONFCACHE_VERSION */
+    guint32 crc;            /*!< CRC32 of the payload */
+    guint32 reserved;
+    guint64 payload_len;    /*!< Length of the payload */
+} LrRepoConfCacheHeader;
+
+/** Size, mtime and inode of a .repo file */
+typedef struct {
+    guint64 size;
+    gint64 mtime_sec;
+    gint64 mtime_nsec;
+    guint64 ino;
+} LrRepoConfStamp;
+
+/** A .repo file of the directory */
+typedef struct {
+    gchar *name;            /*!< Basename of the file */
+    gchar *path;            /*!< Path of the file */
+    LrRepoConfStamp stamp;
+    GSList *repos;          /*!< Parsed (or loaded) LrYumRepoConf */
+    gboolean loaded;        /*!< Repos were loaded from the cache */
+    GError *err;            /*!< Error of the parsing */
+} LrRepoConfFile;
+
+/** Reader of the payload. All reads are bounds checked, after the first
+ * failed read the reader is marked as bad and returns only zeros and NULLs.
+ */
+typedef struct {
+    const char *data;
+    gsize len;
+    gsize pos;
+    gboolean bad;
+} LrRepoConfCacheReader;
+
+static void
+cache_write_raw(GString *out, const void *val, gsize len)
+{
+    g_string_append_len(out, (const char *) val, len);
+}
+
+static void
+cache_write_u32(GString *out, guint32 val)
+{
+    cache_write_raw(out, &val, sizeof(val));
+}
+
+static void
+cache_write_u64(GString *out, guint64 val)
+{
+    cache_write_raw(out, &val, sizeof(val));
+}
+
+static void
+cache_write_str(GString *out, const char *str)
+{
+    if (!str) {
+        cache_write_u32(out, REPOCONFCACHE_NULL);
+        return;
+    }
+
+    size_t len = strlen(str);
+    cache_write_u32(out, (guint32) len);
+    g_string_append_len(out, str, len + 1);
+}
+
+static void
+cache_write_strv(GString *out, gchar **strv)
+{
+    if (!strv) {
+        cache_write_u32(out, REPOCONFCACHE_NULL);
+        return;
+    }
+
+    cache_write_u32(out, g_strv_length(strv));
+    for (guint i = 0; strv[i]; i++)
+        cache_write_str(out, strv[i]);
+}
+
+static void
+cache_write_repoconf(GString *out, LrYumRepoConf *conf)
+{
+    cache_write_str(out, conf->id);
+    cache_write_str(out, conf->name);
+    cache_write_u32(out, conf->enabled);
+    cache_write_strv(out, conf->baseurl);
+    cache_write_str(out, conf->mirrorlist);
+    cache_write_str(out, conf->metalink);
+
+    cache_write_str(out, conf->mediaid);
+    cache_write_strv(out, conf->gpgkey);
+    cache_write_strv(out, conf->gpgcakey);
+    cache_write_strv(out, conf->exclude);
+    cache_write_strv(out, conf->include);
+
+    cache_write_u32(out, conf->fastestmirror);
+    cache_write_str(out, conf->proxy);
+    cache_write_str(out, conf->proxy_username);
+    cache_write_str(out, conf->proxy_password);
+    cache_write_str(out, conf->username);
+    cache_write_str(out, conf->password);
+
+    cache_write_u32(out, conf->gpgcheck);
+    cache_write_u32(out, conf->repo_gpgcheck);
+    cache_write_u32(out, conf->enablegroups);
+
+    cache_write_u64(out, conf->bandwidth);
+    cache_write_str(out, conf->throttle);
+    cache_write_u32(out, (guint32) conf->ip_resolve);
+
+    cache_write_u64(out, (guint64) conf->metadata_expire);
+    cache_write_u32(out, (guint32) conf->cost);
+    cache_write_u32(out, (guint32) conf->priority);
+
+    cache_write_str(out, conf->sslcacert);
+    cache_write_u32(out, conf->sslverify);
+    cache_write_str(out, conf->sslclientcert);
+    cache_write_str(out, conf->sslclientkey);
+
+    cache_write_strv(out, conf->deltarepobaseurl);
+}
+
+/** Write the cache to a temporary file and rename it to the cache path.
+ * Errors are silently ignored.
+ */
+static void
+cache_write(const char *cachepath, const char *path, GPtrArray *files)
+{
+    LrRepoConfCacheHeader hdr;
+    GString *payload = g_string_sized_new(4096);
+    gchar *tmppath;
+    gboolean ok;
+    int fd;
+
+    cache_write_str(payload, path);
+    cache_write_u32(payload, files->len);
+    for (guint i = 0; i < files->len; i++) {
+        LrRepoConfFile *file = g_ptr_array_index(files, i);
+        cache_write_str(payload, file->name);
+        cache_write_raw(payload, &file->stamp, sizeof(file->stamp));
+        cache_write_u32(payload, g_slist_length(file->repos));
+        for (GSList *elem = file->repos; elem; elem = g_slist_next(elem))
+            cache_write_repoconf(payload, elem->data);
+    }
+
+    memset(&hdr, 0, sizeof(hdr));
+    memcpy(hdr.magic, REPOCONFCACHE_MAGIC, sizeof(hdr.magic));
+    hdr.version = REPOCONFCACHE_VERSION;
+    hdr.payload_len = payload->len;
+    hdr.crc = crc32(crc32(0L, Z_NULL, 0),
+                    (const Bytef *) payload->str,
+                    (uInt) payload->len);
+
+    tmppath = g_strconcat(cachepath, ".XXXXXX", NULL);
+    fd = g_mkstemp(tmppath);
+    if (fd < 0) {
+        g_debug("%s: Cannot create %s: %s", __func__, tmppath, g_strerror(errno));
+        goto exit;
+    }
+
+    ok = fchmod(fd, 0644) == 0
+         && write(fd, &hdr, sizeof(hdr)) == (ssize_t) sizeof(hdr)
+         && write(fd, payload->str, payload->len) == (ssize_t) payload->len;
+    ok = (close(fd) == 0) && ok;
+
+    if (ok && rename(tmppath, cachepath) == 0) {
+        g_debug("%s: Repo config cache %s written", __func__, cachepath);
+    } else {
+        g_debug("%s: Cannot write %s: %s", __func__, cachepath, g_strerror(errno));
+        unlink(tmppath);
+    }
+
+exit:
+    g_free(tmppath);
+    g_string_free(payload, TRUE);
+}
+
+static gboolean
+cache_read_raw(LrRepoConfCacheReader *r, void *dst, gsize len)
+{
+    if (r->bad || r->len - r->pos < len) {
+        r->bad = TRUE;
+        memset(dst, 0, len);
+        return FALSE;
+    }
+
+    memcpy(dst, r->data + r->pos, len);
+    r->pos += len;
+    return TRUE;
+}
+
+static guint32
+cache_read_u32(LrRepoConfCacheReader *r)
+{
+    guint32 val;
+    cache_read_raw(r, &val, sizeof(val));
+    return val;
+}
+
+static guint64
+cache_read_u64(LrRepoConfCacheReader *r)
+{
+    guint64 val;
+    cache_read_raw(r, &val, sizeof(val));
+    return val;
+}
+
+/** Read a string, it points into the mapped cache.
+ */
+static const char *
+cache_read_str(LrRepoConfCacheReader *r)
+{
+    const char *str;
+    guint32 len = cache_read_u32(r);
+
+    if (r->bad || len == REPOCONFCACHE_NULL)
+        return NULL;
+
+    if (r->len - r->pos <= len || r->data[r->pos + len] != '\0') {
+        r->bad = TRUE;
+        return NULL;
+    }
+
+    str = r->data + r->pos;
+    r->pos += (gsize) len + 1;
+    return str;
+}
+
+/** Read number of items of a list. Every item takes at least one byte,
+ * so a count higher than the rest of the payload is invalid.
+ */
+static guint32
+cache_read_count(LrRepoConfCacheReader *r)
+{
+    guint32 count = cache_read_u32(r);
+
+    if (count != REPOCONFCACHE_NULL && count > r->len - r->pos) {
+        r->bad = TRUE;
+        return 0;
+    }
+
+    return count;
+}
+
+static gchar **
+cache_read_strv(LrRepoConfCacheReader *r)
+{
+    guint32 count = cache_read_count(r);
+    gchar **strv;
+
+    if (r->bad || count == REPOCONFCACHE_NULL)
+        return NULL;
+
+    strv = g_new0(gchar *, count + 1);
+    for (guint32 i = 0; i < count; i++)
+        strv[i] = g_strdup(cache_read_str(r));
+    return strv;
+}
+
+static LrYumRepoConf *
+cache_read_repoconf(LrRepoConfCacheReader *r, const char *source)
+{
+    LrYumRepoConf *conf = lr_yum_repoconf_init();
+
+    conf->_source           = g_strdup(source);
+
+    conf->id                = g_strdup(cache_read_str(r));
+    conf->name              = g_strdup(cache_read_str(r));
+    conf->enabled           = cache_read_u32(r);
+    conf->baseurl           = cache_read_strv(r);
+    conf->mirrorlist        = g_strdup(cache_read_str(r));
+    conf->metalink          = g_strdup(cache_read_str(r));
+
+    conf->mediaid           = g_strdup(cache_read_str(r));
+    conf->gpgkey            = cache_read_strv(r);
+    conf->gpgcakey          = cache_read_strv(r);
+    conf->exclude           = cache_read_strv(r);
+    conf->include           = cache_read_strv(r);
+
+    conf->fastestmirror     = cache_read_u32(r);
+    conf->proxy             = g_strdup(cache_read_str(r));
+    conf->proxy_username    = g_strdup(cache_read_str(r));
+    conf->proxy_password    = g_strdup(cache_read_str(r));
+    conf->username          = g_strdup(cache_read_str(r));
+    conf->password          = g_strdup(cache_read_str(r));
+
+    conf->gpgcheck          = cache_read_u32(r);
+    conf->repo_gpgcheck     = cache_read_u32(r);
+    conf->enablegroups      = cache_read_u32(r);
+
+    conf->bandwidth         = cache_read_u64(r);
+    conf->throttle          = g_strdup(cache_read_str(r));
+    conf->ip_resolve        = (LrIpResolveType) cache_read_u32(r);
+
+    conf->metadata_expire   = (gint64) cache_read_u64(r);
+    conf->cost              = (gint) cache_read_u32(r);
+    conf->priority          = (gint) cache_read_u32(r);
+
+    conf->sslcacert         = g_strdup(cache_read_str(r));
+    conf->sslverify         = cache_read_u32(r);
+    conf->sslclientcert     = g_strdup(cache_read_str(r));
+    conf->sslclientkey      = g_strdup(cache_read_str(r));
+
+    conf->deltarepobaseurl  = cache_read_strv(r);
+
+    if (r->bad) {
+        lr_yum_repoconf_free(conf);
+        return NULL;
+    }
+
+    return conf;
+}
+
+/** Load the repos of the unchanged files from the cache.
+ * A corrupted or outdated cache is ignored.
+ * @return      TRUE if every file in the cache was loaded (the cache
+ *              contains no removed or changed file)
+ */
+static gboolean
+cache_load(const char *cachepath, const char *path, GPtrArray *files)
+{
+    LrRepoConfCacheHeader hdr;
+    LrRepoConfCacheReader r;
+    GHashTable *by_name;
+    struct stat st;
+    void *map;
+    guint32 count, used = 0;
+    int fd;
+
+    fd = open(cachepath, O_RDONLY);
+    if (fd < 0)
+        return FALSE;
+
+    if (fstat(fd, &st) != 0
+        || (gsize) st.st_size < sizeof(hdr)
+        || (guint64) st.st_size - sizeof(hdr) > G_MAXUINT32)
+    {
+        close(fd);
+        return FALSE;
+    }
+
+    map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        g_debug("%s: mmap(%s): %s", __func__, cachepath, g_strerror(errno));
+        return FALSE;
+    }
+
+    memcpy(&hdr, map, sizeof(hdr));
+    r.data = (const char *) map + sizeof(hdr);
+    r.len = (gsize) st.st_size - sizeof(hdr);
+    r.pos = 0;
+    r.bad = FALSE;
+
+    if (memcmp(hdr.magic, REPOCONFCACHE_MAGIC, sizeof(hdr.magic))
+        || hdr.version != REPOCONFCACHE_VERSION
+        || hdr.payload_len != r.len
+        || crc32(crc32(0L, Z_NULL, 0),
+                 (const Bytef *) r.data,
+                 (uInt) r.len) != hdr.crc)
+    {
+        g_debug("%s: Repo config cache %s is corrupted or of unknown version",
+                __func__, cachepath);
+        munmap(map, st.st_size);
+        return FALSE;
+    }
+
+    if (g_strcmp0(cache_read_str(&r), path)) {
+        g_debug("%s: Repo config cache %s is for a different directory",
+                __func__, cachepath);
+        munmap(map, st.st_size);
+        return FALSE;
+    }
+
+    by_name = g_hash_table_new(g_str_hash, g_str_equal);
+    for (guint i = 0; i < files->len; i++) {
+        LrRepoConfFile *file = g_ptr_array_index(files, i);
+        g_hash_table_insert(by_name, file->name, file);
+    }
+
+    count = cache_read_count(&r);
+    for (guint32 i = 0; i < count && !r.bad; i++) {
+        const char *name = cache_read_str(&r);
+        LrRepoConfStamp stamp;
+        LrRepoConfFile *file;
+        GSList *repos = NULL;
+        guint32 repos_count;
+
+        cache_read_raw(&r, &stamp, sizeof(stamp));
+        repos_count = cache_read_count(&r);
+        file = name ? g_hash_table_lookup(by_name, name) : NULL;
+
+        for (guint32 j = 0; j < repos_count && !r.bad; j++) {
+            LrYumRepoConf *conf = cache_read_repoconf(&r, file ? file->path : NULL);
+            if (conf)
+                repos = g_slist_prepend(repos, conf);
+        }
+
+        if (r.bad || !file || file->loaded
+            || memcmp(&stamp, &file->stamp, sizeof(stamp)))
+        {
+            // Removed or changed file
+            g_slist_free_full(repos, (GDestroyNotify) lr_yum_repoconf_free);
+            continue;
+        }
+
+        file->repos = g_slist_reverse(repos);
+        file->loaded = TRUE;
+        used++;
+    }
+
+    g_hash_table_destroy(by_name);
+    munmap(map, st.st_size);
+    return !r.bad && used == count;
+}
+
+/* Parallel parsing */
+
+static void
+repoconf_file_free(LrRepoConfFile *file)
+{
+    g_free(file->name);
+    g_free(file->path);
+    g_slist_free_full(file->repos, (GDestroyNotify) lr_yum_repoconf_free);
+    g_clear_error(&file->err);
+    g_free(file);
+}
+
+/** Parse the file to its own list of repos, so more files could be
+ * parsed in parallel.
+ */
+static void
+repoconf_file_parse(LrRepoConfFile *file, G_GNUC_UNUSED gpointer user_data)
+{
+    LrYumRepoConfs *confs = lr_yum_repoconfs_init();
+
+    if (!lr_yum_repoconfs_parse(confs, file->path, &file->err) && !file->err)
+        g_set_error(&file->err, LR_REPOCONF_ERROR, LRE_VALUE,
+                    "Cannot parse %s", file->path);
+
+    file->repos = confs->repos;
+    confs->repos = NULL;
+    lr_yum_repoconfs_free(confs);
+}
+
+gboolean
+lr_yum_repoconfs_load_dir_cached(LrYumRepoConfs *repos,
+                                 const char *path,
+                                 const char *cachepath,
+                                 guint threads,
+                                 GError **err)
+{
+    const gchar *name;
+    GPtrArray *files;
+    GPtrArray *to_parse;
+    gboolean ret = TRUE;
+    gboolean changed = TRUE;
+    _cleanup_dir_close_ GDir *dir = NULL;
+
+    assert(!err || *err == NULL);
+
+    // Open dir
+    dir = g_dir_open(path, 0, err);
+    if (!dir)
+        return FALSE;
+
+    // Find all the .repo files
+    files = g_ptr_array_new_with_free_func((GDestroyNotify) repoconf_file_free);
+    while ((name = g_dir_read_name(dir))) {
+        LrRepoConfFile *file;
+        struct stat st;
+
+        if (!g_str_has_suffix(name, ".repo"))
+            continue;
+
+        file = g_new0(LrRepoConfFile, 1);
+        file->name = g_strdup(name);
+        file->path = g_build_filename(path, name, NULL);
+        if (stat(file->path, &st) == 0) {
+            file->stamp.size = (guint64) st.st_size;
+            file->stamp.mtime_sec = (gint64) st.st_mtim.tv_sec;
+            file->stamp.mtime_nsec = (gint64) st.st_mtim.tv_nsec;
+            file->stamp.ino = (guint64) st.st_ino;
+        }
+        g_ptr_array_add(files, file);
+    }
+
+    if (cachepath)
+        changed = !cache_load(cachepath, path, files);
+
+    // Parse the files which were not loaded from the cache
+    to_parse = g_ptr_array_new();
+    for (guint i = 0; i < files->len; i++) {
+        LrRepoConfFile *file = g_ptr_array_index(files, i);
+        if (!file->loaded)
+            g_ptr_array_add(to_parse, file);
+    }
+
+    if (threads == 0)
+        threads = g_get_num_processors();
+    threads = MIN(threads, to_parse->len);
+
+    g_debug("%s: %u files in %s, parsing %u by %u threads", __func__,
+            files->len, path, to_parse->len, threads);
+
+    if (threads > 1) {
+        GThreadPool *pool = g_thread_pool_new((GFunc) repoconf_file_parse,
+                                              NULL, threads, TRUE, NULL);
+        for (guint i = 0; i < to_parse->len; i++)
+            g_thread_pool_push(pool, g_ptr_array_index(to_parse, i), NULL);
+        g_thread_pool_free(pool, FALSE, TRUE);
+    } else {
+        for (guint i = 0; i < to_parse->len; i++)
+            repoconf_file_parse(g_ptr_array_index(to_parse, i), NULL);
+    }
+
+    changed = changed || to_parse->len > 0;
+    g_ptr_array_free(to_parse, TRUE);
+
+    // The repos are appended in the order of the files, the same as
+    // lr_yum_repoconfs_load_dir() stops at the first bad file
+    for (guint i = 0; i < files->len; i++) {
+        LrRepoConfFile *file = g_ptr_array_index(files, i);
+        if (file->err) {
+            g_propagate_error(err, file->err);
+            file->err = NULL;
+            ret = FALSE;
+            break;
+        }
+    }
+
+    if (ret && cachepath && changed)
+        cache_write(cachepath, path, files);
+
+    for (guint i = 0; i < files->len; i++) {
+        LrRepoConfFile *file = g_ptr_array_index(files, i);
+        if (file->err)
+            break;
+        repos->repos = g_slist_concat(repos->repos, file->repos);
+        file->repos = NULL;
+    }
+
+    g_ptr_array_free(files, TRUE);
+    return ret;
+}
@@ -96,13 +96,38 @@ lr_yum_repoconfs_init(void);
 void
 lr_yum_repoconfs_free(LrYumRepoConfs *confs);
 
+/** Return new empty LrYumRepoConfs in lazy mode.
+ * lr_yum_repoconfs_parse() and lr_yum_repoconfs_load_dir() only index
+ * the sections (repos) of the files, a section is parsed when it is
+ * requested by lr_yum_repoconfs_get() or lr_yum_repoconfs_get_list().
+ * Errors of the key conversions (e.g. bad bandwidth) are reported by them.
+ * lr_yum_repoconfs_load_dir_cached() parses the files as usual.
+ * @return          New LrYumRepoConfs
+ */
+LrYumRepoConfs *
+lr_yum_repoconfs_init_lazy(void);
+
 /** Get GSList of LrYumRepoConf from a LrYumRepoConfs.
+ * In lazy mode, all the sections not parsed yet are parsed.
  * @param confs     LrYumRepoConfs (not NULL!)
- * @return          Pointer to internal GSList in LrYumRepoConfs
+ * @param err       GError **
+ * @return          Pointer to internal GSList in LrYumRepoConfs or NULL
+ *                  if a section cannot be parsed (err is set)
  */
 GSList *
 lr_yum_repoconfs_get_list(LrYumRepoConfs *confs, GError **err);
 
+/** Get a repo by its ID. In lazy mode, only the section of the repo
+ * is parsed. If more files contain the ID, the first one is returned.
+ * @param confs     LrYumRepoConfs
+ * @param id        ID of the repo
+ * @param err       GError **
+ * @return          The repo (owned by the confs) or NULL if there is
+ *                  no such repo or it cannot be parsed (err is set)
+ */
+LrYumRepoConf *
+lr_yum_repoconfs_get(LrYumRepoConfs *confs, const char *id, GError **err);
+
 /** Parse a *.repo file
  * @param confs     LrYumRepoConfs
  * @param filename  Path to *.repo file
@@ -123,6 +148,27 @@ lr_yum_repoconfs_load_dir(LrYumRepoConfs *confs,
                           const char *path,
                           GError **err);
 
+/** Load a directory with *.repo files like lr_yum_repoconfs_load_dir(),
+ * but parse the files by more threads and keep a binary cache of the
+ * parsed repos. A file whose size, mtime and inode are the same as when
+ * the cache was written is not parsed again, its repos are loaded from
+ * the cache (mapped by a single mmap()). The cache is rewritten when
+ * a file was added, changed or removed. Errors of the cache are silently
+ * ignored, the files are parsed then.
+ * @param confs     LrYumRepoConfs
+ * @param path      Path to a directory with *.repo files
+ * @param cachepath Path to the cache file or NULL (no cache is used)
+ * @param threads   Maximal number of threads, 0 means the number
+ *                  of available processors
+ * @return          TRUE if everything is ok, FALSE if err is set.
+ */
+gboolean
+lr_yum_repoconfs_load_dir_cached(LrYumRepoConfs *confs,
+                                 const char *path,
+                                 const char *cachepath,
+                                 guint threads,
+                                 GError **err);
+
 /** Create a copy of LrYumRepoConf.
  * @param repoconf  LrYumRepoConf
  * @return          Deep copy of input LrYumRepoConf
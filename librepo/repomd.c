@@ -26,6 +26,7 @@
 #include <expat.h>
 #include <errno.h>
 
+#include "arena.h"
 #include "repomd.h"
 #include "xmlparser_internal.h"
 #include "rcodes.h"
@@ -33,32 +34,32 @@
 
 #define CHUNK_SIZE              8192
 #define CONTENT_REALLOC_STEP    256
+#define ARENA_BLOCK_SIZE        4096
 
-/* Repomd object manipulation helpers */
+/* Repomd object manipulation helpers
+ *
+ * Records, distro tags and list nodes are allocated from the arena
+ * of the repomd object, strings are stored in its chunk. Lists are built
+ * by prepending and reversed by lr_yum_repomd_finalize() when the parsing
+ * is done.
+ */
 
 static LrYumRepoMdRecord *
-lr_yum_repomdrecord_init(const char *type)
+lr_yum_repomdrecord_init(LrYumRepoMd *repomd, const char *type)
 {
-    LrYumRepoMdRecord *record = lr_malloc0(sizeof(*record));
-    record->chunk = g_string_chunk_new(128);
+    LrYumRepoMdRecord *record = lr_arena_new0(repomd->arena, LrYumRepoMdRecord);
+    record->chunk = repomd->chunk;
     record->type = lr_string_chunk_insert(record->chunk, type);
     return record;
 }
 
-static void
-lr_yum_repomdrecord_free(LrYumRepoMdRecord *rec)
-{
-    if (!rec)
-        return;
-    g_string_chunk_free(rec->chunk);
-    lr_free(rec);
-}
-
 LrYumRepoMd *
 lr_yum_repomd_init()
 {
     LrYumRepoMd *repomd = lr_malloc0(sizeof(*repomd));
-    repomd->chunk = g_string_chunk_new(32);
+    repomd->chunk = g_string_chunk_new(ARENA_BLOCK_SIZE);
+    repomd->arena = lr_arena_new(ARENA_BLOCK_SIZE);
+    repomd->record_index = g_hash_table_new(g_str_hash, g_str_equal);
     return repomd;
 }
 
@@ -67,10 +68,9 @@ lr_yum_repomd_free(LrYumRepoMd *repomd)
 {
     if (!repomd)
         return;
-    g_slist_free_full(repomd->records, (GDestroyNotify) lr_yum_repomdrecord_free);
-    g_slist_free(repomd->repo_tags);
-    g_slist_free(repomd->content_tags);
-    g_slist_free_full(repomd->distro_tags, (GDestroyNotify) g_free);
+    if (repomd->record_index)
+        g_hash_table_destroy(repomd->record_index);
+    lr_arena_free(repomd->arena);
     g_string_chunk_free(repomd->chunk);
     g_free(repomd);
 }
@@ -80,7 +80,26 @@ lr_yum_repomd_set_record(LrYumRepoMd *repomd,
                          LrYumRepoMdRecord *record)
 {
     if (!repomd || !record) return;
-    repomd->records = g_slist_append(repomd->records, record);
+    repomd->records = lr_arena_slist_prepend(repomd->arena,
+                                             repomd->records,
+                                             record);
+
+    // Keep the first record of the type, lookups by the list would
+    // find that one too
+    if (record->type
+        && !g_hash_table_lookup(repomd->record_index, record->type))
+        g_hash_table_insert(repomd->record_index, record->type, record);
+}
+
+/** Restore the document order of the lists built during the parsing.
+ */
+static void
+lr_yum_repomd_finalize(LrYumRepoMd *repomd)
+{
+    repomd->records = g_slist_reverse(repomd->records);
+    repomd->repo_tags = g_slist_reverse(repomd->repo_tags);
+    repomd->content_tags = g_slist_reverse(repomd->content_tags);
+    repomd->distro_tags = g_slist_reverse(repomd->distro_tags);
 }
 
 static void
@@ -95,7 +114,8 @@ lr_yum_repomd_add_repo_tag(LrYumRepoMd *repomd, char *tag)
 {
     assert(repomd);
     if (!tag) return;
-    repomd->repo_tags = g_slist_append(repomd->repo_tags,
+    repomd->repo_tags = lr_arena_slist_prepend(repomd->arena,
+                                repomd->repo_tags,
                                 g_string_chunk_insert(repomd->chunk, tag));
 }
 
@@ -104,7 +124,8 @@ lr_yum_repomd_add_content_tag(LrYumRepoMd *repomd, char *tag)
 {
     assert(repomd);
     if (!tag) return;
-    repomd->content_tags = g_slist_append(repomd->content_tags,
+    repomd->content_tags = lr_arena_slist_prepend(repomd->arena,
+                                repomd->content_tags,
                                 g_string_chunk_insert(repomd->chunk, tag));
 }
 
@@ -116,10 +137,12 @@ lr_yum_repomd_add_distro_tag(LrYumRepoMd *repomd,
     assert(repomd);
     if (!tag) return;
 
-    LrYumDistroTag *distrotag = lr_malloc0(sizeof(*distrotag));
+    LrYumDistroTag *distrotag = lr_arena_new0(repomd->arena, LrYumDistroTag);
     distrotag->cpeid = lr_string_chunk_insert(repomd->chunk, cpeid);
     distrotag->tag   = g_string_chunk_insert(repomd->chunk, tag);
-    repomd->distro_tags = g_slist_append(repomd->distro_tags, distrotag);
+    repomd->distro_tags = lr_arena_slist_prepend(repomd->arena,
+                                                 repomd->distro_tags,
+                                                 distrotag);
 }
 
 LrYumRepoMdRecord *
@@ -127,6 +150,10 @@ lr_yum_repomd_get_record(LrYumRepoMd *repomd, const char *type)
 {
     assert(repomd);
     assert(type);
+
+    if (repomd->record_index)
+        return g_hash_table_lookup(repomd->record_index, type);
+
     for (GSList *elem = repomd->records; elem; elem = g_slist_next(elem)) {
         LrYumRepoMdRecord *record = elem->data;
         assert(record);
@@ -160,6 +187,80 @@ lr_yum_repomd_get_highest_timestamp(LrYumRepoMd *repomd, GError **err)
     return max;
 }
 
+/** Return TRUE if the records differ in the checksum, size
+ * or timestamp.
+ */
+static gboolean
+lr_yum_repomdrecord_changed(const LrYumRepoMdRecord *old_rec,
+                            const LrYumRepoMdRecord *new_rec)
+{
+    return g_strcmp0(old_rec->checksum, new_rec->checksum)
+           || g_strcmp0(old_rec->checksum_type, new_rec->checksum_type)
+           || old_rec->size != new_rec->size
+           || old_rec->timestamp != new_rec->timestamp;
+}
+
+LrYumRepoMdDiff *
+lr_yum_repomd_diff(LrYumRepoMd *old_repomd, LrYumRepoMd *new_repomd)
+{
+    LrYumRepoMdDiff *diff = lr_malloc0(sizeof(*diff));
+
+    assert(old_repomd);
+    assert(new_repomd);
+
+    for (GSList *elem = new_repomd->records; elem; elem = g_slist_next(elem)) {
+        LrYumRepoMdRecord *record = elem->data;
+        LrYumRepoMdRecord *old_record;
+
+        if (lr_yum_repomd_get_record(new_repomd, record->type) != record)
+            continue;  // Only the first record of a type is used
+
+        old_record = lr_yum_repomd_get_record(old_repomd, record->type);
+        if (!old_record)
+            diff->added = g_slist_prepend(diff->added,
+                                          g_strdup(record->type));
+        else if (lr_yum_repomdrecord_changed(old_record, record))
+            diff->changed = g_slist_prepend(diff->changed,
+                                            g_strdup(record->type));
+    }
+
+    for (GSList *elem = old_repomd->records; elem; elem = g_slist_next(elem)) {
+        LrYumRepoMdRecord *record = elem->data;
+
+        if (lr_yum_repomd_get_record(old_repomd, record->type) == record
+            && !lr_yum_repomd_get_record(new_repomd, record->type))
+            diff->removed = g_slist_prepend(diff->removed,
+                                            g_strdup(record->type));
+    }
+
+    diff->added = g_slist_reverse(diff->added);
+    diff->removed = g_slist_reverse(diff->removed);
+    diff->changed = g_slist_reverse(diff->changed);
+
+    return diff;
+}
+
+gboolean
+lr_yum_repomd_diff_modified(const LrYumRepoMdDiff *diff, const char *type)
+{
+    assert(diff);
+    assert(type);
+
+    return g_slist_find_custom(diff->added, type, (GCompareFunc) strcmp)
+           || g_slist_find_custom(diff->changed, type, (GCompareFunc) strcmp);
+}
+
+void
+lr_yum_repomd_diff_free(LrYumRepoMdDiff *diff)
+{
+    if (!diff)
+        return;
+    g_slist_free_full(diff->added, g_free);
+    g_slist_free_full(diff->removed, g_free);
+    g_slist_free_full(diff->changed, g_free);
+    lr_free(diff);
+}
+
 // repomd.xml parser
 
 typedef enum {
@@ -179,6 +280,8 @@ typedef enum {
     STATE_SIZE,
     STATE_OPENSIZE,
     STATE_DBVERSION,
+    STATE_HEADERCHECKSUM,
+    STATE_HEADERSIZE,
     NUMSTATES
 } LrRepomdState;
 
@@ -203,6 +306,8 @@ static LrStatesSwitch stateswitches[] = {
     { STATE_DATA,       "size",             STATE_SIZE,         1 },
     { STATE_DATA,       "open-size",        STATE_OPENSIZE,     1 },
     { STATE_DATA,       "database_version", STATE_DBVERSION,    1 },
+    { STATE_DATA,       "header-checksum",  STATE_HEADERCHECKSUM, 1 },
+    { STATE_DATA,       "header-size",      STATE_HEADERSIZE,   1 },
     { NUMSTATES,        NULL,               NUMSTATES,          0 }
 };
 
@@ -291,7 +396,7 @@ lr_start_handler(void *pdata, const char *element, const char **attr)
             val = "unknown";
         }
 
-        pd->repomdrecord = lr_yum_repomdrecord_init(val);
+        pd->repomdrecord = lr_yum_repomdrecord_init(pd->repomd, val);
         lr_yum_repomd_set_record(pd->repomd, pd->repomdrecord);
         break;
 
@@ -348,10 +453,27 @@ lr_start_handler(void *pdata, const char *element, const char **attr)
                                                     val);
         break;
 
+    case STATE_HEADERCHECKSUM:
+        assert(pd->repomd);
+        assert(pd->repomdrecord);
+
+        val = lr_find_attr("type", attr);
+        if (!val) {
+            lr_xml_parser_warning(pd, LR_XML_WARNING_MISSINGATTR,
+                    "Missing attribute \"type\" of a header checksum element");
+            break;
+        }
+
+        pd->repomdrecord->header_checksum_type = g_string_chunk_insert(
+                                                    pd->repomdrecord->chunk,
+                                                    val);
+        break;
+
     case STATE_TIMESTAMP:
     case STATE_SIZE:
     case STATE_OPENSIZE:
     case STATE_DBVERSION:
+    case STATE_HEADERSIZE:
     default:
         break;
     }
@@ -487,11 +609,74 @@ lr_end_handler(void *pdata, G_GNUC_UNUSED const char *element)
         pd->repomdrecord->db_version = (int) lr_xml_parser_strtoll(pd, pd->content, 0);
         break;
 
+    case STATE_HEADERCHECKSUM:
+        assert(pd->repomd);
+        assert(pd->repomdrecord);
+
+        pd->repomdrecord->header_checksum = lr_string_chunk_insert(
+                                            pd->repomdrecord->chunk,
+                                            pd->content);
+        break;
+
+    case STATE_HEADERSIZE:
+        assert(pd->repomd);
+        assert(pd->repomdrecord);
+
+        pd->repomdrecord->size_header = lr_xml_parser_strtoll(pd, pd->content, 0);
+        break;
+
     default:
         break;
     }
 }
 
+/** Create and setup XML parser and its data for the repomd parsing.
+ */
+static LrParserData *
+repomd_parser_data_new(XML_Parser *parser,
+                       LrYumRepoMd *repomd,
+                       LrXmlParserWarningCb warningcb,
+                       void *warningcb_data)
+{
+    LrParserData *pd;
+
+    *parser = XML_ParserCreate(NULL);
+    XML_SetElementHandler(*parser, lr_start_handler, lr_end_handler);
+    XML_SetCharacterDataHandler(*parser, lr_char_handler);
+
+    pd = lr_xml_parser_data_new(NUMSTATES);
+    pd->parser = parser;
+    pd->state = STATE_START;
+    pd->repomd = repomd;
+    pd->warningcb = warningcb;
+    pd->warningcb_data = warningcb_data;
+    for (LrStatesSwitch *sw = stateswitches; sw->from != NUMSTATES; sw++) {
+        if (!pd->swtab[sw->from])
+            pd->swtab[sw->from] = sw;
+        pd->sbtab[sw->to] = sw->from;
+    }
+
+    XML_SetUserData(*parser, pd);
+
+    return pd;
+}
+
+/** Check of results of the finished parsing.
+ */
+static gboolean
+repomd_parser_check(LrParserData *pd, GError **err)
+{
+    lr_yum_repomd_finalize(pd->repomd);
+
+    if (!pd->repomdfound) {
+        g_set_error(err, LR_XML_PARSER_ERROR, LRE_REPOMDXML,
+                    "Element <repomd> was not found - Bad repomd file");
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
 gboolean
 lr_yum_repomd_parse_file(LrYumRepoMd *repomd,
                          int fd,
@@ -508,25 +693,11 @@ lr_yum_repomd_parse_file(LrYumRepoMd *repomd,
     assert(repomd);
     assert(!err || *err == NULL);
 
-    // Init
+    LrAllocTag prev_tag = lr_alloc_tag_set(LR_ALLOC_METADATA);
 
-    parser = XML_ParserCreate(NULL);
-    XML_SetElementHandler(parser, lr_start_handler, lr_end_handler);
-    XML_SetCharacterDataHandler(parser, lr_char_handler);
-
-    pd = lr_xml_parser_data_new(NUMSTATES);
-    pd->parser = &parser;
-    pd->state = STATE_START;
-    pd->repomd = repomd;
-    pd->warningcb = warningcb;
-    pd->warningcb_data = warningcb_data;
-    for (LrStatesSwitch *sw = stateswitches; sw->from != NUMSTATES; sw++) {
-        if (!pd->swtab[sw->from])
-            pd->swtab[sw->from] = sw;
-        pd->sbtab[sw->to] = sw->from;
-    }
+    // Init
 
-    XML_SetUserData(parser, pd);
+    pd = repomd_parser_data_new(&parser, repomd, warningcb, warningcb_data);
 
     // Parsing
 
@@ -536,16 +707,118 @@ lr_yum_repomd_parse_file(LrYumRepoMd *repomd,
 
     // Check of results
 
-    if (!tmp_err && !pd->repomdfound) {
+    if (!repomd_parser_check(pd, tmp_err ? NULL : err))
         ret = FALSE;
-        g_set_error(err, LR_XML_PARSER_ERROR, LRE_REPOMDXML,
-                    "Element <repomd> was not found - Bad repomd file");
-    }
 
     // Clean up
 
     lr_xml_parser_data_free(pd);
     XML_ParserFree(parser);
 
+    lr_alloc_tag_set(prev_tag);
     return ret;
 }
+
+gboolean
+lr_yum_repomd_parse_buffer(LrYumRepoMd *repomd,
+                           const char *buf,
+                           size_t len,
+                           LrXmlParserWarningCb warningcb,
+                           void *warningcb_data,
+                           GError **err)
+{
+    gboolean ret;
+    LrYumRepoMdParser *parser;
+
+    assert(repomd);
+    assert(buf || len == 0);
+    assert(!err || *err == NULL);
+
+    parser = lr_yum_repomd_parser_new(repomd, warningcb, warningcb_data);
+    ret = lr_yum_repomd_parser_feed(parser, buf, len, err)
+          && lr_yum_repomd_parser_finish(parser, err);
+    lr_yum_repomd_parser_free(parser);
+
+    return ret;
+}
+
+struct _LrYumRepoMdParser {
+    XML_Parser parser; /*!<
+        Expat parser */
+    LrParserData *pd; /*!<
+        Parser data */
+    gboolean failed; /*!<
+        Parsing already failed */
+    gboolean finished; /*!<
+        lr_yum_repomd_parser_finish() was already called */
+};
+
+LrYumRepoMdParser *
+lr_yum_repomd_parser_new(LrYumRepoMd *repomd,
+                         LrXmlParserWarningCb warningcb,
+                         void *warningcb_data)
+{
+    LrYumRepoMdParser *rp;
+
+    assert(repomd);
+
+    rp = lr_malloc0(sizeof(*rp));
+    rp->pd = repomd_parser_data_new(&rp->parser, repomd,
+                                    warningcb, warningcb_data);
+    return rp;
+}
+
+gboolean
+lr_yum_repomd_parser_feed(LrYumRepoMdParser *rp,
+                          const char *buf,
+                          size_t len,
+                          GError **err)
+{
+    assert(rp);
+    assert(!rp->failed);
+    assert(!rp->finished);
+    assert(!err || *err == NULL);
+
+    if (len == 0)
+        return TRUE;
+
+    if (!lr_xml_parser_generic_buffer(rp->parser, rp->pd, buf, len, FALSE, err))
+        rp->failed = TRUE;
+
+    return !rp->failed;
+}
+
+gboolean
+lr_yum_repomd_parser_finish(LrYumRepoMdParser *rp, GError **err)
+{
+    assert(rp);
+    assert(!rp->failed);
+    assert(!rp->finished);
+    assert(!err || *err == NULL);
+
+    rp->finished = TRUE;
+
+    if (!lr_xml_parser_generic_buffer(rp->parser, rp->pd, "", 0, TRUE, err)) {
+        lr_yum_repomd_finalize(rp->pd->repomd);
+        rp->failed = TRUE;
+        return FALSE;
+    }
+
+    if (!repomd_parser_check(rp->pd, err)) {
+        rp->failed = TRUE;
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+void
+lr_yum_repomd_parser_free(LrYumRepoMdParser *rp)
+{
+    if (!rp)
+        return;
+
+    lr_xml_parser_data_free(rp->pd);
+    XML_ParserFree(rp->parser);
+    lr_free(rp);
+}
@@ -52,8 +52,14 @@ typedef struct {
     gint64 size;                /*!< File size */
     gint64 size_open;           /*!< Size of uncompressed file */
     int db_version;             /*!< Version of database */
-
-    GStringChunk *chunk;        /*!< String chunk */
+    char *header_checksum;      /*!< Checksum of the header of a zchunk
+                                     file or NULL */
+    char *header_checksum_type; /*!< Type of checksum of the header */
+    gint64 size_header;         /*!< Size of the header of a zchunk file
+                                     (including the lead) or 0 */
+
+    GStringChunk *chunk;        /*!< String chunk (shared with the repomd
+                                     object, it is freed with the repomd) */
 } LrYumRepoMdRecord;
 
 /** Yum repomd.xml. */
@@ -66,11 +72,24 @@ typedef struct {
     GSList *distro_tags;    /*!< List of LrYumDistroTag* */
     GSList *records;        /*!< List with LrYumRepoMdRecords */
 
-    GStringChunk *chunk;    /*!< String chunk for repomd strings
-                                 (Note: LrYumRepomdRecord strings are stored
-                                 in LrYumRepomdRecord->chunk) */
+    GStringChunk *chunk;    /*!< String chunk for repomd and records strings */
+    struct _LrArena *arena; /*!< Allocator of the records, distro tags
+                                 and lists (internal) */
+    GHashTable *record_index; /*!< The first record of every type,
+                                   keyed by the type (internal) */
 } LrYumRepoMd;
 
+/** Differences between two versions of a repomd.xml.
+ * Records are identified by their type, the lists contain the types
+ * (char *, owned by the diff) in the order of the records.
+ */
+typedef struct {
+    GSList *added;      /*!< Types of the records only in the new repomd */
+    GSList *removed;    /*!< Types of the records only in the old repomd */
+    GSList *changed;    /*!< Types of the records with a different
+                             checksum, size or timestamp */
+} LrYumRepoMdDiff;
+
 /** Create new empty repomd object.
  * @return              New repomd object.
  */
@@ -98,6 +117,68 @@ lr_yum_repomd_parse_file(LrYumRepoMd *repomd,
                          void *warningcb_data,
                          GError **err);
 
+/** Parse repomd.xml from memory.
+ * @param repomd            Empty repomd object.
+ * @param buf               Content of the repomd.xml.
+ * @param len               Length of the content.
+ * @param warningcb         ::LrXmlParserWarningCb function or NULL
+ * @param warningcb_data    Warning callback data or NULL
+ * @param err               GError **
+ * @return                  TRUE if everything is ok, FALSE if err is set.
+ */
+gboolean
+lr_yum_repomd_parse_buffer(LrYumRepoMd *repomd,
+                           const char *buf,
+                           size_t len,
+                           LrXmlParserWarningCb warningcb,
+                           void *warningcb_data,
+                           GError **err);
+
+/** Incremental (push) repomd.xml parser.
+ * The repomd.xml is passed to the parser by parts as they come
+ * by ::lr_yum_repomd_parser_feed.
+ */
+typedef struct _LrYumRepoMdParser LrYumRepoMdParser;
+
+/** Create a new incremental repomd.xml parser.
+ * @param repomd            Empty repomd object which is filled by the parser.
+ * @param warningcb         ::LrXmlParserWarningCb function or NULL
+ * @param warningcb_data    Warning callback data or NULL
+ * @return                  New parser
+ */
+LrYumRepoMdParser *
+lr_yum_repomd_parser_new(LrYumRepoMd *repomd,
+                         LrXmlParserWarningCb warningcb,
+                         void *warningcb_data);
+
+/** Parse a next part of the repomd.xml.
+ * After an error the parser could be only freed.
+ * @param parser            Repomd parser.
+ * @param buf               Next part of the repomd.xml.
+ * @param len               Length of the part.
+ * @param err               GError **
+ * @return                  TRUE if everything is ok, FALSE if err is set.
+ */
+gboolean
+lr_yum_repomd_parser_feed(LrYumRepoMdParser *parser,
+                          const char *buf,
+                          size_t len,
+                          GError **err);
+
+/** Finish the parsing. Fails if the repomd.xml is incomplete.
+ * @param parser            Repomd parser.
+ * @param err               GError **
+ * @return                  TRUE if everything is ok, FALSE if err is set.
+ */
+gboolean
+lr_yum_repomd_parser_finish(LrYumRepoMdParser *parser, GError **err);
+
+/** Free the parser. The repomd object is not freed.
+ * @param parser            Repomd parser.
+ */
+void
+lr_yum_repomd_parser_free(LrYumRepoMdParser *parser);
+
 /** Get repomd record from the repomd object.
  * @param repomd        Repomd record.
  * @param type          Type of record e.g. "primary", "filelists", ...
@@ -116,6 +197,29 @@ lr_yum_repomd_get_record(LrYumRepoMd *repomd,
 gint64
 lr_yum_repomd_get_highest_timestamp(LrYumRepoMd *repomd, GError **err);
 
+/** Compare two versions of a repomd.xml.
+ * @param old_repomd    Previous repomd object.
+ * @param new_repomd    Current repomd object.
+ * @return              New diff, free it by ::lr_yum_repomd_diff_free.
+ */
+LrYumRepoMdDiff *
+lr_yum_repomd_diff(LrYumRepoMd *old_repomd, LrYumRepoMd *new_repomd);
+
+/** Return TRUE if the record of the type is added or changed, i.e. its
+ * files of the old version cannot be used.
+ * @param diff          Diff.
+ * @param type          Type of record.
+ * @return              TRUE if the record differs from the old version.
+ */
+gboolean
+lr_yum_repomd_diff_modified(const LrYumRepoMdDiff *diff, const char *type);
+
+/** Free the diff.
+ * @param diff          Diff or NULL.
+ */
+void
+lr_yum_repomd_diff_free(LrYumRepoMdDiff *diff);
+
 /** @} */
 
 G_END_DECLS
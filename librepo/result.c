@@ -45,6 +45,7 @@ lr_result_clear(LrResult *result)
     lr_free(result->destdir);
     lr_yum_repomd_free(result->yum_repomd);
     lr_yum_repo_free(result->yum_repo);
+    lr_yum_repomd_diff_free(result->yum_repomd_diff);
     memset(result, 0, sizeof(struct _LrResult));
 }
 
@@ -91,6 +92,12 @@ lr_result_getinfo(LrResult *result,
         break;
     }
 
+    case LRR_YUM_REPOMD_DIFF: {
+        LrYumRepoMdDiff **diff = va_arg(arg, LrYumRepoMdDiff **);
+        *diff = result->yum_repomd_diff;
+        break;
+    }
+
     case LRR_YUM_TIMESTAMP: {
         gint64 *ts = va_arg(arg, gint64 *);
         if (result->yum_repomd) {
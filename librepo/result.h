@@ -50,6 +50,11 @@ typedef enum {
         See: https://github.com/Tojaj/librepo/issues/25
         See: http://yum.baseurl.org/gitweb?p=yum.git;a=commitdiff;h=59d3d67f */
 
+    LRR_YUM_REPOMD_DIFF, /*!< (LrYumRepoMdDiff *)
+        Reference to ::LrYumRepoMdDiff in result - records which changed
+        against the previous repomd.xml in the destdir (or in
+        LRO_YUMREUSEDIR) of a download, NULL if there was none */
+
     LRR_SENTINEL,
 } LrResultInfoOption;
 
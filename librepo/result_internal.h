@@ -37,6 +37,9 @@ struct _LrResult {
 
     LrYumRepo      *yum_repo; /*!<
         Pointer to struct with info about yum repo */
+
+    LrYumRepoMdDiff *yum_repomd_diff; /*!<
+        Changes against the previous repomd.xml or NULL */
 };
 
 G_END_DECLS
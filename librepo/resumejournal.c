@@ -0,0 +1,125 @@
+/* librepo - A library providing (libcURL like) API to downloading repository
+ * Copyright (C) 2014  Tomas Mlcoch
+ *
+ * Licensed under the GNU Lesser General Public License Version 2.1
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#include <glib.h>
+#include <assert.h>
+#include <string.h>
+
+#include "resumejournal.h"
+#include "cleanup.h"
+
+#define JOURNAL_GROUP           "resume"
+#define JOURNAL_URL             "url"
+#define JOURNAL_ETAG            "etag"
+#define JOURNAL_LASTMODIFIED    "lastmodified"
+#define JOURNAL_OFFSET          "offset"
+
+gchar *
+lr_resume_journal_path(const char *path)
+{
+    assert(path);
+    return g_strconcat(path, LR_RESUME_JOURNAL_SUFFIX, NULL);
+}
+
+gboolean
+lr_resume_journal_load(const char *path, LrResumeJournal *journal)
+{
+    GError *tmp_err = NULL;
+
+    assert(path);
+    assert(journal);
+
+    memset(journal, 0, sizeof(*journal));
+
+    GKeyFile *store = g_key_file_new();
+    if (!g_key_file_load_from_file(store, path, G_KEY_FILE_NONE, NULL)) {
+        g_key_file_free(store);
+        return FALSE;
+    }
+
+    journal->url = g_key_file_get_string(store, JOURNAL_GROUP,
+                                         JOURNAL_URL, NULL);
+    journal->etag = g_key_file_get_string(store, JOURNAL_GROUP,
+                                          JOURNAL_ETAG, NULL);
+    journal->lastmodified = g_key_file_get_int64(store, JOURNAL_GROUP,
+                                                 JOURNAL_LASTMODIFIED, NULL);
+    journal->offset = g_key_file_get_int64(store, JOURNAL_GROUP,
+                                           JOURNAL_OFFSET, &tmp_err);
+
+    for (int type = LR_CHECKSUM_MD5; type <= LR_CHECKSUM_SHA512; type++)
+        journal->states[type] = g_key_file_get_string(store, JOURNAL_GROUP,
+                                    lr_checksum_type_to_str(type), NULL);
+
+    g_key_file_free(store);
+
+    if (tmp_err || !journal->url || journal->offset <= 0) {
+        g_debug("%s: Broken journal %s", __func__, path);
+        g_clear_error(&tmp_err);
+        lr_resume_journal_clear(journal);
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+gboolean
+lr_resume_journal_save(const char *path,
+                       const LrResumeJournal *journal,
+                       GError **err)
+{
+    gsize len;
+
+    assert(path);
+    assert(journal && journal->url);
+    assert(!err || *err == NULL);
+
+    GKeyFile *store = g_key_file_new();
+    g_key_file_set_string(store, JOURNAL_GROUP, JOURNAL_URL, journal->url);
+    if (journal->etag)
+        g_key_file_set_string(store, JOURNAL_GROUP, JOURNAL_ETAG,
+                              journal->etag);
+    if (journal->lastmodified > 0)
+        g_key_file_set_int64(store, JOURNAL_GROUP, JOURNAL_LASTMODIFIED,
+                             journal->lastmodified);
+    g_key_file_set_int64(store, JOURNAL_GROUP, JOURNAL_OFFSET,
+                         journal->offset);
+
+    for (int type = LR_CHECKSUM_MD5; type <= LR_CHECKSUM_SHA512; type++)
+        if (journal->states[type])
+            g_key_file_set_string(store, JOURNAL_GROUP,
+                                  lr_checksum_type_to_str(type),
+                                  journal->states[type]);
+
+    _cleanup_free_ gchar *data = g_key_file_to_data(store, &len, NULL);
+    g_key_file_free(store);
+    return g_file_set_contents(path, data, (gssize) len, err);
+}
+
+void
+lr_resume_journal_clear(LrResumeJournal *journal)
+{
+    if (!journal)
+        return;
+    g_free(journal->url);
+    g_free(journal->etag);
+    for (int type = LR_CHECKSUM_MD5; type <= LR_CHECKSUM_SHA512; type++)
+        g_free(journal->states[type]);
+    memset(journal, 0, sizeof(*journal));
+}
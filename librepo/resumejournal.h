@@ -0,0 +1,91 @@
+/* librepo - A library providing (libcURL like) API to downloading repository
+ * Copyright (C) 2014  Tomas Mlcoch
+ *
+ * Licensed under the GNU Lesser General Public License Version 2.1
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#ifndef __LR_RESUMEJOURNAL_H__
+#define __LR_RESUMEJOURNAL_H__
+
+#include <glib.h>
+
+#include "checksum.h"
+
+G_BEGIN_DECLS
+
+/** Journal of a partially downloaded file (see LRO_RESUMEJOURNAL).
+ * The journal is a key file stored next to the partial file. It records
+ * where the data came from, validators of the object on the server and
+ * the states of the checksums of the data downloaded so far. A resumed
+ * transfer continues the checksums from the states instead of reading
+ * the downloaded part of the file again.
+ */
+
+/** Suffix of the journal appended to the path of the partial file */
+#define LR_RESUME_JOURNAL_SUFFIX    ".resume"
+
+/** Journal of a partial download */
+typedef struct {
+    gchar *url; /*!<
+        URL the data was downloaded from */
+    gchar *etag; /*!<
+        ETag of the object or NULL */
+    gint64 lastmodified; /*!<
+        Last-Modified time (unix time) of the object or 0 if unknown */
+    gint64 offset; /*!<
+        Number of bytes of the file covered by the journal */
+    gchar *states[LR_CHECKSUM_SHA512+1]; /*!<
+        Saved digest states (see lr_checksumctx_save()) of the first
+        offset bytes indexed by LrChecksumType or NULL */
+} LrResumeJournal;
+
+/** Path of the journal of a partial file.
+ * @param path      Path to the partial file
+ * @return          Malloced path
+ */
+gchar *
+lr_resume_journal_path(const char *path);
+
+/** Load a journal.
+ * @param path      Path to the journal
+ * @param journal   Filled journal, must be cleared by
+ *                  lr_resume_journal_clear()
+ * @return          FALSE if the journal is missing or broken
+ */
+gboolean
+lr_resume_journal_load(const char *path, LrResumeJournal *journal);
+
+/** Save a journal atomically (write and rename).
+ * @param path      Path to the journal
+ * @param journal   Journal
+ * @param err       GError **
+ * @return          TRUE on success
+ */
+gboolean
+lr_resume_journal_save(const char *path,
+                       const LrResumeJournal *journal,
+                       GError **err);
+
+/** Free the content of a journal.
+ * @param journal   Journal or NULL
+ */
+void
+lr_resume_journal_clear(LrResumeJournal *journal);
+
+G_END_DECLS
+
+#endif
@@ -0,0 +1,299 @@
+/* librepo - A library providing (libcURL like) API to downloading repository
+ * Copyright (C) 2014  Tomas Mlcoch
+ *
+ * Licensed under the GNU Lesser General Public License Version 2.1
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#include <glib.h>
+#include <glib/gstdio.h>
+#include <assert.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <curl/curl.h>
+
+#include "handle_internal.h"
+#include "util.h"
+#include "tlssessioncache.h"
+#include "cleanup.h"
+
+#if LR_CURL_VERSION_CHECK(8, 12, 0)
+
+#define CACHE_KEY           "key"
+#define CACHE_SHMAC         "shmac"
+#define CACHE_DATA          "data"
+#define CACHE_VALIDUNTIL    "validuntil"
+
+/** Load the file. Missing or broken file is an empty cache.
+ */
+static GKeyFile *
+cache_load(const char *path)
+{
+    GKeyFile *cache = g_key_file_new();
+    GError *tmp_err = NULL;
+
+    if (!g_key_file_load_from_file(cache, path, G_KEY_FILE_NONE, &tmp_err)) {
+        g_debug("%s: Cache %s not loaded: %s", __func__, path, tmp_err->message);
+        g_error_free(tmp_err);
+    }
+
+    return cache;
+}
+
+static guchar *
+cache_get_data(GKeyFile *cache, const char *group, const char *key, gsize *len)
+{
+    _cleanup_free_ gchar *str = g_key_file_get_string(cache, group, key, NULL);
+
+    *len = 0;
+    if (!str)
+        return NULL;
+    return g_base64_decode(str, len);
+}
+
+static void
+cache_set_data(GKeyFile *cache,
+               const char *group,
+               const char *key,
+               const unsigned char *data,
+               gsize len)
+{
+    _cleanup_free_ gchar *str = g_base64_encode(data, len);
+    g_key_file_set_string(cache, group, key, str);
+}
+
+typedef struct {
+    gchar *group;
+    gint64 validuntil;
+} LrTlsSessionAge;
+
+static gint
+cmp_ages(gconstpointer a, gconstpointer b)
+{
+    const LrTlsSessionAge *age_a = a;
+    const LrTlsSessionAge *age_b = b;
+
+    // The longest valid first
+    if (age_a->validuntil > age_b->validuntil)
+        return -1;
+    if (age_a->validuntil < age_b->validuntil)
+        return 1;
+    return 0;
+}
+
+/** Remove expired sessions and keep at most LR_TLSSESSIONCACHE_MAX
+ * sessions which are valid for the longest time.
+ */
+static void
+cache_prune(GKeyFile *cache, gint64 now)
+{
+    gsize count = 0;
+    gchar **groups = g_key_file_get_groups(cache, &count);
+    GArray *ages = g_array_sized_new(FALSE, FALSE, sizeof(LrTlsSessionAge),
+                                     (guint) count);
+
+    for (gsize i = 0; i < count; i++) {
+        LrTlsSessionAge age = { groups[i], 0 };
+        age.validuntil = g_key_file_get_int64(cache, groups[i],
+                                              CACHE_VALIDUNTIL, NULL);
+        if (age.validuntil < now)
+            g_key_file_remove_group(cache, groups[i], NULL);
+        else
+            g_array_append_val(ages, age);
+    }
+
+    if (ages->len > LR_TLSSESSIONCACHE_MAX) {
+        g_array_sort(ages, cmp_ages);
+        for (guint i = LR_TLSSESSIONCACHE_MAX; i < ages->len; i++) {
+            LrTlsSessionAge *age = &g_array_index(ages, LrTlsSessionAge, i);
+            g_key_file_remove_group(cache, age->group, NULL);
+        }
+    }
+
+    g_array_free(ages, TRUE);
+    g_strfreev(groups);
+}
+
+/** Write the file atomically, readable only by the owner.
+ */
+static gboolean
+cache_write(GKeyFile *cache, const char *path)
+{
+    gsize len;
+    _cleanup_free_ gchar *data = g_key_file_to_data(cache, &len, NULL);
+    _cleanup_free_ gchar *tmp_path = g_strconcat(path, ".XXXXXX", NULL);
+
+    int fd = g_mkstemp(tmp_path);  // Mode 0600
+    if (fd == -1) {
+        g_debug("%s: Cannot create %s: %s", __func__, tmp_path, strerror(errno));
+        return FALSE;
+    }
+
+    gsize written = 0;
+    while (written < len) {
+        ssize_t rc = write(fd, data + written, len - written);
+        if (rc == -1 && errno == EINTR)
+            continue;
+        if (rc == -1)
+            break;
+        written += (gsize) rc;
+    }
+
+    close(fd);
+    if (written != len || rename(tmp_path, path) == -1) {
+        g_debug("%s: Cannot store %s: %s", __func__, path, strerror(errno));
+        unlink(tmp_path);
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+typedef struct {
+    GKeyFile *cache;
+    guint exported;
+} LrTlsSessionExport;
+
+static CURLcode
+export_cb(G_GNUC_UNUSED CURL *curl,
+          void *userptr,
+          const char *session_key,
+          const unsigned char *shmac,
+          size_t shmac_len,
+          const unsigned char *sdata,
+          size_t sdata_len,
+          curl_off_t valid_until,
+          G_GNUC_UNUSED int ietf_tls_id,
+          G_GNUC_UNUSED const char *alpn,
+          G_GNUC_UNUSED size_t earlydata_max)
+{
+    LrTlsSessionExport *exp = userptr;
+    gchar *group;
+
+    // Sessions are keyed by the peer (host and port) and its TLS settings
+    if (session_key)
+        group = g_compute_checksum_for_string(G_CHECKSUM_SHA256,
+                                              session_key, -1);
+    else if (shmac && shmac_len)
+        group = g_compute_checksum_for_data(G_CHECKSUM_SHA256,
+                                            shmac, shmac_len);
+    else
+        return CURLE_OK;
+
+    g_key_file_remove_group(exp->cache, group, NULL);
+    if (session_key)
+        g_key_file_set_string(exp->cache, group, CACHE_KEY, session_key);
+    if (shmac && shmac_len)
+        cache_set_data(exp->cache, group, CACHE_SHMAC, shmac, shmac_len);
+    cache_set_data(exp->cache, group, CACHE_DATA, sdata, sdata_len);
+    g_key_file_set_int64(exp->cache, group, CACHE_VALIDUNTIL,
+                         (gint64) valid_until);
+    exp->exported++;
+
+    g_free(group);
+    return CURLE_OK;
+}
+
+void
+lr_tlssessioncache_import(LrHandle *handle)
+{
+    assert(handle);
+
+    if (!handle->tlssessioncache || !handle->curl_handle)
+        return;
+
+    GKeyFile *cache = cache_load(handle->tlssessioncache);
+    gint64 now = g_get_real_time() / G_USEC_PER_SEC;
+    gsize count = 0;
+    gchar **groups = g_key_file_get_groups(cache, &count);
+    guint imported = 0;
+
+    for (gsize i = 0; i < count; i++) {
+        const char *group = groups[i];
+        gint64 validuntil = g_key_file_get_int64(cache, group,
+                                                 CACHE_VALIDUNTIL, NULL);
+        if (validuntil < now)
+            continue;  // Expired
+
+        _cleanup_free_ gchar *key = g_key_file_get_string(cache, group,
+                                                          CACHE_KEY, NULL);
+        gsize shmac_len, sdata_len;
+        _cleanup_free_ guchar *shmac = cache_get_data(cache, group,
+                                                      CACHE_SHMAC, &shmac_len);
+        _cleanup_free_ guchar *sdata = cache_get_data(cache, group,
+                                                      CACHE_DATA, &sdata_len);
+        if (!sdata || (!key && !shmac))
+            continue;
+
+        CURLcode rc = curl_easy_ssls_import(handle->curl_handle, key,
+                                            shmac, shmac_len,
+                                            sdata, sdata_len);
+        if (rc == CURLE_OK)
+            imported++;
+        else
+            g_debug("%s: Session not imported: %s", __func__,
+                    curl_easy_strerror(rc));
+    }
+
+    g_debug("%s: %u sessions imported from %s", __func__, imported,
+            handle->tlssessioncache);
+
+    g_strfreev(groups);
+    g_key_file_free(cache);
+}
+
+void
+lr_tlssessioncache_export(LrHandle *handle)
+{
+    assert(handle);
+
+    if (!handle->tlssessioncache || !handle->curl_handle)
+        return;
+
+    // Reload the file to keep sessions stored by other processes
+    LrTlsSessionExport exp = { cache_load(handle->tlssessioncache), 0 };
+
+    CURLcode rc = curl_easy_ssls_export(handle->curl_handle, export_cb, &exp);
+    if (rc != CURLE_OK)
+        g_debug("%s: Export failed: %s", __func__, curl_easy_strerror(rc));
+
+    if (exp.exported) {
+        cache_prune(exp.cache, g_get_real_time() / G_USEC_PER_SEC);
+        if (cache_write(exp.cache, handle->tlssessioncache))
+            g_debug("%s: %u sessions stored to %s", __func__, exp.exported,
+                    handle->tlssessioncache);
+    }
+
+    g_key_file_free(exp.cache);
+}
+
+#else
+
+void
+lr_tlssessioncache_import(LrHandle *handle)
+{
+    if (handle->tlssessioncache)
+        g_debug("%s: LRO_TLSSESSIONCACHE requires curl >= 8.12", __func__);
+}
+
+void
+lr_tlssessioncache_export(G_GNUC_UNUSED LrHandle *handle)
+{
+}
+
+#endif
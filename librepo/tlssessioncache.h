@@ -0,0 +1,56 @@
+/* librepo - A library providing (libcURL like) API to downloading repository
+ * Copyright (C) 2014  Tomas Mlcoch
+ *
+ * Licensed under the GNU Lesser General Public License Version 2.1
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#ifndef __LR_TLSSESSIONCACHE_H__
+#define __LR_TLSSESSIONCACHE_H__
+
+#include <glib.h>
+
+#include "handle.h"
+
+G_BEGIN_DECLS
+
+/** On-disk cache of TLS sessions (see LRO_TLSSESSIONCACHE).
+ * The sessions are imported to (and exported from) the SSL session
+ * cache of the curl share of the handle. The file is a key file with
+ * a group per session named by the SHA-256 of its key, the session
+ * data are base64 encoded. The file is readable only by its owner,
+ * because the sessions allow to resume the TLS connections.
+ */
+
+/** Max number of sessions in the file */
+#define LR_TLSSESSIONCACHE_MAX      256
+
+/** Import sessions from the LRO_TLSSESSIONCACHE file to the handle.
+ * @param handle        Handle
+ */
+void
+lr_tlssessioncache_import(LrHandle *handle);
+
+/** Store sessions of the handle to the LRO_TLSSESSIONCACHE file.
+ * Sessions already stored in the file by other processes are kept.
+ * @param handle        Handle
+ */
+void
+lr_tlssessioncache_export(LrHandle *handle);
+
+G_END_DECLS
+
+#endif
@@ -0,0 +1,256 @@
+/* librepo - A library providing (libcURL like) API to downloading repository
+ * Copyright (C) 2014  Tomas Mlcoch
+ *
+ * Licensed under the GNU Lesser General Public License Version 2.1
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#define _GNU_SOURCE
+#include <glib.h>
+#include <assert.h>
+#include <errno.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+
+#include "trace.h"
+#include "rcodes.h"
+#include "util.h"
+
+struct _LrTrace {
+    GMutex lock; /*!<
+        Spans are written by the threads of the handle one by one */
+    FILE *f; /*!<
+        Trace file */
+    LrTraceFormat format; /*!<
+        Format of the file */
+    gboolean empty; /*!<
+        TRUE if no event was written yet (no separator is needed) */
+    guint64 next_id; /*!<
+        Id of the next async span */
+    long pid; /*!<
+        Process id written to the events */
+};
+
+/** Id of the calling thread */
+static long
+thread_id(void)
+{
+#ifdef SYS_gettid
+    return (long) syscall(SYS_gettid);
+#else
+    return (long) getpid();
+#endif
+}
+
+static void
+append_json_string(GString *out, const char *str)
+{
+    g_string_append_c(out, '"');
+    for (const unsigned char *c = (const unsigned char *) str; *c; c++) {
+        switch (*c) {
+        case '"':  g_string_append(out, "\\\""); break;
+        case '\\': g_string_append(out, "\\\\"); break;
+        case '\n': g_string_append(out, "\\n"); break;
+        case '\r': g_string_append(out, "\\r"); break;
+        case '\t': g_string_append(out, "\\t"); break;
+        default:
+            if (*c < 0x20)
+                g_string_append_printf(out, "\\u%04x", *c);
+            else
+                g_string_append_c(out, *c);
+        }
+    }
+    g_string_append_c(out, '"');
+}
+
+static void
+append_args(GString *out, va_list args)
+{
+    const char *key;
+    gboolean first = TRUE;
+
+    g_string_append(out, ",\"args\":{");
+    while ((key = va_arg(args, const char *))) {
+        const char *val = va_arg(args, const char *);
+        if (!val)
+            continue;
+        if (!first)
+            g_string_append_c(out, ',');
+        append_json_string(out, key);
+        g_string_append_c(out, ':');
+        append_json_string(out, val);
+        first = FALSE;
+    }
+    g_string_append_c(out, '}');
+}
+
+/** Begin an event with the common items (without the closing brace).
+ */
+static void
+append_event(GString *out,
+             LrTrace *trace,
+             const char *cat,
+             const char *name,
+             const char *phase,
+             gint64 ts,
+             long tid)
+{
+    g_string_append(out, "{\"name\":");
+    append_json_string(out, name);
+    g_string_append(out, ",\"cat\":");
+    append_json_string(out, cat);
+    if (phase)
+        g_string_append_printf(out, ",\"ph\":\"%s\"", phase);
+    g_string_append_printf(out, ",\"ts\":%" G_GINT64_FORMAT
+                           ",\"pid\":%ld,\"tid\":%ld", ts, trace->pid, tid);
+}
+
+static void
+write_events(LrTrace *trace, GString *events)
+{
+    if (fputs(events->str, trace->f) == EOF || fflush(trace->f) == EOF)
+        g_debug("%s: Cannot write the trace: %s", __func__, g_strerror(errno));
+}
+
+static void
+trace_span(LrTrace *trace,
+           const char *cat,
+           const char *name,
+           gint64 start,
+           gint64 end,
+           gboolean async,
+           va_list args)
+{
+    GString *out = g_string_sized_new(256);
+    long tid = thread_id();
+    gint64 dur = MAX(end - start, 0);
+
+    g_mutex_lock(&trace->lock);
+
+    const char *sep = trace->empty ? "" : ",\n";
+    guint64 id = async ? ++trace->next_id : 0;
+
+    if (trace->format == LR_TRACE_JSONLINES) {
+        append_event(out, trace, cat, name, NULL, start, tid);
+        g_string_append_printf(out, ",\"dur\":%" G_GINT64_FORMAT, dur);
+        if (async)
+            g_string_append_printf(out, ",\"id\":%" G_GUINT64_FORMAT, id);
+        append_args(out, args);
+        g_string_append(out, "}\n");
+    } else if (async) {
+        // A pair of nestable async events with the same id
+        g_string_append(out, sep);
+        append_event(out, trace, cat, name, "b", start, tid);
+        g_string_append_printf(out, ",\"id\":\"0x%" G_GINT64_MODIFIER "x\"", id);
+        append_args(out, args);
+        g_string_append(out, "},\n");
+        append_event(out, trace, cat, name, "e", start + dur, tid);
+        g_string_append_printf(out, ",\"id\":\"0x%" G_GINT64_MODIFIER "x\"}", id);
+    } else {
+        // A complete event
+        g_string_append(out, sep);
+        append_event(out, trace, cat, name, "X", start, tid);
+        g_string_append_printf(out, ",\"dur\":%" G_GINT64_FORMAT, dur);
+        append_args(out, args);
+        g_string_append_c(out, '}');
+    }
+
+    write_events(trace, out);
+    trace->empty = FALSE;
+
+    g_mutex_unlock(&trace->lock);
+    g_string_free(out, TRUE);
+}
+
+LrTrace *
+lr_trace_open(const char *path, LrTraceFormat format, GError **err)
+{
+    assert(path);
+    assert(!err || *err == NULL);
+
+    FILE *f = fopen(path, "w");
+    if (!f) {
+        g_set_error(err, LR_HANDLE_ERROR, LRE_IO,
+                    "Cannot open trace file %s: %s", path, g_strerror(errno));
+        return NULL;
+    }
+
+    LrTrace *trace = lr_malloc0(sizeof(*trace));
+    g_mutex_init(&trace->lock);
+    trace->f = f;
+    trace->format = format;
+    trace->empty = TRUE;
+    trace->pid = (long) getpid();
+
+    if (format == LR_TRACE_CHROME)
+        fputs("[\n", f);
+
+    g_debug("%s: Tracing to %s", __func__, path);
+    return trace;
+}
+
+void
+lr_trace_close(LrTrace *trace)
+{
+    if (!trace)
+        return;
+
+    if (trace->format == LR_TRACE_CHROME)
+        fputs("\n]\n", trace->f);
+    if (fclose(trace->f) == EOF)
+        g_debug("%s: Cannot close the trace: %s", __func__, g_strerror(errno));
+    g_mutex_clear(&trace->lock);
+    lr_free(trace);
+}
+
+void
+lr_trace_span(LrTrace *trace,
+              const char *cat,
+              const char *name,
+              gint64 start,
+              gint64 end,
+              ...)
+{
+    va_list args;
+
+    if (!trace)
+        return;
+
+    va_start(args, end);
+    trace_span(trace, cat, name, start, end, FALSE, args);
+    va_end(args);
+}
+
+void
+lr_trace_async_span(LrTrace *trace,
+                    const char *cat,
+                    const char *name,
+                    gint64 start,
+                    gint64 end,
+                    ...)
+{
+    va_list args;
+
+    if (!trace)
+        return;
+
+    va_start(args, end);
+    trace_span(trace, cat, name, start, end, TRUE, args);
+    va_end(args);
+}
@@ -0,0 +1,92 @@
+/* librepo - A library providing (libcURL like) API to downloading repository
+ * Copyright (C) 2014  Tomas Mlcoch
+ *
+ * Licensed under the GNU Lesser General Public License Version 2.1
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#ifndef __LR_TRACE_H__
+#define __LR_TRACE_H__
+
+#include <glib.h>
+
+#include "types.h"
+
+G_BEGIN_DECLS
+
+/** Trace of the work of a handle (see LRO_TRACEFILE).
+ * Every span (a category, a name, the start and the end in monotonic
+ * time and string arguments) is written to the file as soon as it is
+ * finished. With LR_TRACE_CHROME the file is a JSON array of trace
+ * events which is terminated when the trace is closed (the viewers
+ * accept an unterminated array too), with LR_TRACE_JSONLINES every span
+ * is a JSON object on its own line.
+ */
+typedef struct _LrTrace LrTrace;
+
+/** Create (truncate) the trace file.
+ * @param path      Path to the file
+ * @param format    Format of the file
+ * @param err       GError **
+ * @return          New trace or NULL
+ */
+LrTrace *
+lr_trace_open(const char *path, LrTraceFormat format, GError **err);
+
+/** Terminate and close the trace file.
+ * @param trace     Trace or NULL
+ */
+void
+lr_trace_close(LrTrace *trace);
+
+/** Write a span of the calling thread.
+ * @param trace     Trace or NULL (nothing is written)
+ * @param cat       Category
+ * @param name      Name
+ * @param start     Monotonic time (usec) of the start
+ * @param end       Monotonic time (usec) of the end
+ * @param ...       NULL-terminated pairs of argument names and values
+ *                  (strings, NULL values are skipped)
+ */
+void
+lr_trace_span(LrTrace *trace,
+              const char *cat,
+              const char *name,
+              gint64 start,
+              gint64 end,
+              ...) G_GNUC_NULL_TERMINATED;
+
+/** Write a span which overlaps other spans of the thread (e.g. one of
+ * parallel transfers). It gets its own id, so the viewers put it on
+ * a separate track.
+ * @param trace     Trace or NULL (nothing is written)
+ * @param cat       Category
+ * @param name      Name
+ * @param start     Monotonic time (usec) of the start
+ * @param end       Monotonic time (usec) of the end
+ * @param ...       NULL-terminated pairs of argument names and values
+ */
+void
+lr_trace_async_span(LrTrace *trace,
+                    const char *cat,
+                    const char *name,
+                    gint64 start,
+                    gint64 end,
+                    ...) G_GNUC_NULL_TERMINATED;
+
+G_END_DECLS
+
+#endif
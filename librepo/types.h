@@ -64,6 +64,66 @@ typedef enum {
     LR_IPRESOLVE_V6,        /*!< Resolve to IPv6 addresses */
 } LrIpResolveType;
 
+/** Order in which targets are downloaded */
+typedef enum {
+    LR_DOWNLOADORDER_FIFO,          /*!< Default - In order of the list of targets */
+    LR_DOWNLOADORDER_LARGESTFIRST,  /*!< The largest targets first */
+    LR_DOWNLOADORDER_SMALLESTFIRST, /*!< The smallest targets first */
+    LR_DOWNLOADORDER_PRIORITY,      /*!< Targets with higher priority first */
+} LrDownloadOrder;
+
+/** Priority classes of targets */
+typedef enum {
+    LR_PRIORITYCLASS_NORMAL,        /*!< Default */
+    LR_PRIORITYCLASS_CRITICAL,      /*!< Before the normal targets */
+    LR_PRIORITYCLASS_BACKGROUND,    /*!< Best-effort prefetch, after the
+                                         normal targets */
+} LrPriorityClass;
+
+/** Timing of a transfer. All times (in seconds) are measured from the start
+ * of the last transfer of the target. */
+typedef struct {
+    double namelookup_time;     /*!< Until the name resolving was completed */
+    double connect_time;        /*!< Until the connection was established */
+    double appconnect_time;     /*!< Until the SSL/TLS handshake was
+                                     completed (0 if not used) */
+    double starttransfer_time;  /*!< Until the first byte was received */
+    double total_time;          /*!< Total time of the transfer */
+    double speed_download;      /*!< Average download speed (bytes/sec) */
+    int attempts;               /*!< Number of transfers (mirror attempts)
+                                     of the target */
+} LrTransferStats;
+
+/** Modes of adaptive mirror sorting */
+typedef enum {
+    LR_ADAPTIVEMIRRORSORTING_NONE,       /*!< Mirrors are not re-sorted */
+    LR_ADAPTIVEMIRRORSORTING_ERRORRATE,  /*!< Default - By error rate of mirrors */
+    LR_ADAPTIVEMIRRORSORTING_THROUGHPUT, /*!< By expected completion time */
+} LrAdaptiveMirrorSorting;
+
+/** Durability of the downloaded files */
+typedef enum {
+    LR_DURABILITY_NONE,     /*!< Default - Files are not synced */
+    LR_DURABILITY_BATCH,    /*!< All files are synced at the end */
+    LR_DURABILITY_STRICT,   /*!< Every file is synced when it is finished */
+} LrDurability;
+
+/** Implementation used to verify GPG signatures (LRO_GPGBACKEND) */
+typedef enum {
+    LR_GPGBACKEND_DEFAULT,  /*!< Default - Chosen at build time
+                                 (ENABLE_BUILTIN_GPG) */
+    LR_GPGBACKEND_GPGME,    /*!< GPGME (gpg engine) */
+    LR_GPGBACKEND_BUILTIN,  /*!< In-process OpenPGP verification, signatures
+                                 it cannot decide are left to GPGME */
+} LrGpgBackend;
+
+/** Format of the trace file (LRO_TRACEFORMAT) */
+typedef enum {
+    LR_TRACE_CHROME,        /*!< Default - JSON array of Chrome trace events
+                                 (Perfetto, chrome://tracing) */
+    LR_TRACE_JSONLINES,     /*!< A JSON object per line and span */
+} LrTraceFormat;
+
 /* Some common used arrays for LRO_YUMDLIST */
 
 /** Predefined value for LRO_YUMDLIST option - Download whole repo. */
@@ -102,6 +162,79 @@ typedef int (*LrProgressCb)(void *clientp,
                             double total_to_download,
                             double now_downloaded);
 
+/** Progress of a single target reported by ::LrMultiProgressCb */
+typedef struct {
+    const char *path;           /*!< Path (relative url) of the target */
+    void *cbdata;               /*!< Callback data of the target */
+    double total_to_download;   /*!< Total number of bytes to download */
+    double now_downloaded;      /*!< Number of bytes currently downloaded */
+} LrTargetProgress;
+
+/** Aggregated progress callback prototype
+ * @param clientp           Pointer to user data.
+ * @param progress          Array with progress of all running targets.
+ *                          Valid only during the call.
+ * @param count             Number of items in the progress array.
+ * @return                  See LrCbReturnCode codes. Any other value
+ *                          than LR_CB_OK stops the whole download.
+ */
+typedef int (*LrMultiProgressCb)(void *clientp,
+                                 const LrTargetProgress *progress,
+                                 guint count);
+
+/** Metrics of a mirror reported by ::LrMetricsCb */
+typedef struct {
+    const char *url;            /*!< URL of the mirror */
+    guint running;              /*!< Gauge - Running transfers */
+    guint64 bytes;              /*!< Counter - Bytes received */
+    double speed;               /*!< Gauge - Bytes per second received since
+                                     the previous call */
+    guint successful;           /*!< Counter - Successful transfers */
+    guint failed;               /*!< Counter - Failed transfers */
+} LrMirrorMetrics;
+
+/** Metrics of a download reported by ::LrMetricsCb.
+ * Counters are totals since the beginning of the download.
+ */
+typedef struct {
+    guint running;              /*!< Gauge - Running transfers */
+    guint queued;               /*!< Gauge - Targets waiting for a transfer */
+    guint verifying;            /*!< Gauge - Downloaded files waiting for
+                                     (or in) the checksum verification */
+    guint64 bytes;              /*!< Counter - Bytes received from
+                                     the mirrors */
+    double speed;               /*!< Gauge - Bytes per second received from
+                                     the mirrors since the previous call */
+    const guint *errors;        /*!< Counter - Failed transfers by the LrRc
+                                     code of their error (index) */
+    guint errors_count;         /*!< Number of items of the errors */
+    const LrMirrorMetrics *mirrors; /*!< Used mirrors */
+    guint mirrors_count;        /*!< Number of items of the mirrors */
+} LrMetrics;
+
+/** Metrics callback prototype
+ * @param clientp           Pointer to user data.
+ * @param metrics           Metrics of the download. Valid only during
+ *                          the call.
+ * @return                  See LrCbReturnCode codes. Any other value
+ *                          than LR_CB_OK stops the whole download.
+ */
+typedef int (*LrMetricsCb)(void *clientp, const LrMetrics *metrics);
+
+/** Data callback prototype
+ * @param clientp           Pointer to user data.
+ * @param data              Next part of the downloaded data or NULL
+ *                          when a new transfer of the target starts.
+ *                          The data passed by the previous calls (from
+ *                          a failed transfer) have to be discarded then.
+ * @param len               Length of the data.
+ * @return                  See LrCbReturnCode codes. Any other value
+ *                          than LR_CB_OK stops passing of the data of
+ *                          the current transfer to the callback,
+ *                          the transfer itself continues.
+ */
+typedef int (*LrDataCb)(void *clientp, const char *data, size_t len);
+
 /** Transfer status codes */
 typedef enum {
     LR_TRANSFER_SUCCESSFUL,
@@ -110,7 +243,8 @@ typedef enum {
 } LrTransferStatus;
 
 /** Called when a transfer is done (use transfer status to check
- * if successful or failed).
+ * if successful or failed). With LRO_ENDCBTHREADS it is called by
+ * the end callback threads, concurrently with the download.
  * @param clientp           Pointer to user data.
  * @param status            Transfer status
  * @param msg               Error message or NULL.
@@ -142,6 +276,17 @@ typedef int (*LrHandleMirrorFailureCb)(void *clientp,
                                        const char *url,
                                        const char *metadata);
 
+/** Callback called when the file of a repomd record is ready
+ * @param clientp           Pointer to user data.
+ * @param metadata          Metadata type "primary", etc.
+ * @param path              Path to the downloaded (or decompressed) file
+ * @return                  See LrCbReturnCode codes. LR_CB_ERROR stops
+ *                          the whole download.
+ */
+typedef int (*LrYumRecordCb)(void *clientp,
+                             const char *metadata,
+                             const char *path);
+
 typedef enum {
     LR_FMSTAGE_INIT, /*!<
         Fastest mirror detection just started.
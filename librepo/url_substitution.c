@@ -86,55 +86,197 @@ lr_urlvars_free(LrUrlVars *list)
     g_slist_free(list);
 }
 
-char *
-lr_url_substitute(const char *url, LrUrlVars *list)
+struct _LrUrlVarsTable {
+    GHashTable *vars;       /*!< Variable name -> position in the list + 1 */
+    GPtrArray *list;        /*!< Variables (LrVar) in the order of the list */
+    gsize max_len;          /*!< Length of the longest variable name */
+    gboolean *lengths;      /*!< Is there a variable with the name of
+                                 the length? (indexed 0..max_len) */
+};
+
+/** Part of a compiled url. */
+typedef struct {
+    const char *str;        /*!< Literal part or value of a variable */
+    gsize len;              /*!< Length of the str */
+} LrUrlTemplateSegment;
+
+struct _LrUrlTemplate {
+    char *url;              /*!< Copy of the url, literals point here */
+    GArray *segments;       /*!< Parts (LrUrlTemplateSegment) */
+    gsize len;              /*!< Length of the substituted url */
+};
+
+LrUrlVarsTable *
+lr_urlvars_table_new(LrUrlVars *list)
 {
-    const char *cur = url;
-    const char *p = url;
-    char *tmp_res, *res;
+    LrUrlVarsTable *table = lr_malloc0(sizeof(*table));
+    table->vars = g_hash_table_new(g_str_hash, g_str_equal);
+    table->list = g_ptr_array_new();
 
-    if (!url)
-        return NULL;
+    for (LrUrlVars *elem = list; elem; elem = g_slist_next(elem)) {
+        LrVar *var_val = elem->data;
+        if (g_hash_table_contains(table->vars, var_val->var))
+            continue;  // The first one in the list wins
+        g_ptr_array_add(table->list, var_val);
+        g_hash_table_insert(table->vars, var_val->var,
+                            GUINT_TO_POINTER(table->list->len));
+        table->max_len = MAX(table->max_len, strlen(var_val->var));
+    }
 
-    if (!list)
-        return g_strdup(url);
+    table->lengths = lr_malloc0(sizeof(gboolean) * (table->max_len + 1));
+    for (guint i = 0; i < table->list->len; i++) {
+        LrVar *var_val = g_ptr_array_index(table->list, i);
+        table->lengths[strlen(var_val->var)] = TRUE;
+    }
 
-    res = g_strdup("");
-
-    while (*cur != '\0') {
-        if (*cur == '$') {
-            if (cur-p) {
-                char *tmp = g_strndup(p, cur-p);
-                tmp_res = g_strconcat(res, tmp, NULL);
-                lr_free(tmp);
-                lr_free(res);
-                res = tmp_res;
-                p = cur;
-            }
+    return table;
+}
 
-            // Try to substitute the variable
-            for (LrUrlVars *elem = list; elem; elem = g_slist_next(elem)) {
-                LrVar *var_val = elem->data;
-                size_t len = strlen(var_val->var);
-                if (!strncmp(var_val->var, (cur+1), len)) {
-                    cur = cur + len;
-                    p = cur + 1;
-                    tmp_res = g_strconcat(res, var_val->val, NULL);
-                    lr_free(res);
-                    res = tmp_res;
-                    break;
-                }
-            }
+void
+lr_urlvars_table_free(LrUrlVarsTable *table)
+{
+    if (!table)
+        return;
+
+    g_hash_table_destroy(table->vars);
+    g_ptr_array_free(table->list, TRUE);
+    lr_free(table->lengths);
+    lr_free(table);
+}
+
+/** Find the variable which name starts at the name. If more of them
+ * match, the one which comes first in the list is used, like the first
+ * match of the sequential search in the list.
+ * @param table         a table
+ * @param name          text after the '$'
+ * @param buf           buffer of table->max_len + 1 bytes
+ * @return              the variable or NULL
+ */
+static LrVar *
+lr_urlvars_table_match(LrUrlVarsTable *table, const char *name, char *buf)
+{
+    guint best = 0;
+
+    for (gsize len = 0; len <= table->max_len; len++) {
+        if (table->lengths[len]) {
+            buf[len] = '\0';
+            guint pos = GPOINTER_TO_UINT(g_hash_table_lookup(table->vars, buf));
+            if (pos && (!best || pos < best))
+                best = pos;
         }
+        if (name[len] == '\0')
+            break;
+        buf[len] = name[len];
+    }
+
+    if (!best)
+        return NULL;
+    return g_ptr_array_index(table->list, best - 1);
+}
+
+static void
+lr_url_template_append(LrUrlTemplate *tmpl, const char *str, gsize len)
+{
+    if (!len)
+        return;
+
+    LrUrlTemplateSegment segment = { str, len };
+    g_array_append_val(tmpl->segments, segment);
+    tmpl->len += len;
+}
+
+LrUrlTemplate *
+lr_url_template_compile(const char *url, LrUrlVarsTable *table)
+{
+    assert(url);
+
+    LrUrlTemplate *tmpl = lr_malloc0(sizeof(*tmpl));
+    tmpl->url = g_strdup(url);
+    tmpl->segments = g_array_new(FALSE, FALSE, sizeof(LrUrlTemplateSegment));
+
+    const char *cur = tmpl->url;
+    const char *p = tmpl->url;
+    char *buf = NULL;
+
+    if (table && table->list->len)
+        buf = lr_malloc(table->max_len + 1);
 
-        ++cur;
+    for (; buf && *cur != '\0'; ++cur) {
+        if (*cur != '$')
+            continue;
+
+        LrVar *var_val = lr_urlvars_table_match(table, cur+1, buf);
+        if (!var_val)
+            continue;
+
+        lr_url_template_append(tmpl, p, cur-p);
+        lr_url_template_append(tmpl, var_val->val, strlen(var_val->val));
+        cur += strlen(var_val->var);
+        p = cur + 1;
     }
 
-    if (*p != '\0') {
-        tmp_res = g_strconcat(res, p, NULL);
-        lr_free(res);
-        res = tmp_res;
+    lr_url_template_append(tmpl, p, strlen(p));
+    lr_free(buf);
+
+    return tmpl;
+}
+
+char *
+lr_url_template_render(LrUrlTemplate *tmpl)
+{
+    assert(tmpl);
+
+    char *res = lr_malloc(tmpl->len + 1);
+    char *end = res;
+
+    for (guint i = 0; i < tmpl->segments->len; i++) {
+        LrUrlTemplateSegment *segment = &g_array_index(tmpl->segments,
+                                                       LrUrlTemplateSegment, i);
+        memcpy(end, segment->str, segment->len);
+        end += segment->len;
     }
+    *end = '\0';
+
+    return res;
+}
+
+void
+lr_url_template_free(LrUrlTemplate *tmpl)
+{
+    if (!tmpl)
+        return;
+
+    g_array_free(tmpl->segments, TRUE);
+    lr_free(tmpl->url);
+    lr_free(tmpl);
+}
+
+char *
+lr_url_substitute_table(const char *url, LrUrlVarsTable *table)
+{
+    if (!url)
+        return NULL;
+
+    if (!table || !table->list->len)
+        return g_strdup(url);
+
+    LrUrlTemplate *tmpl = lr_url_template_compile(url, table);
+    char *res = lr_url_template_render(tmpl);
+    lr_url_template_free(tmpl);
+    return res;
+}
+
+char *
+lr_url_substitute(const char *url, LrUrlVars *list)
+{
+    if (!url)
+        return NULL;
+
+    if (!list)
+        return g_strdup(url);
 
+    LrUrlVarsTable *table = lr_urlvars_table_new(list);
+    char *res = lr_url_substitute_table(url, table);
+    lr_urlvars_table_free(table);
     return res;
 }
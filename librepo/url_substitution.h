@@ -65,6 +65,61 @@ lr_urlvars_free(LrUrlVars *list);
 char *
 lr_url_substitute(const char *url, LrUrlVars *list);
 
+/** Variables of a LrUrlVars list indexed by their names.
+ * Use it when substituting many urls with the same variables.
+ */
+typedef struct _LrUrlVarsTable LrUrlVarsTable;
+
+/** Url compiled into a sequence of literal parts and values
+ * of variables.
+ */
+typedef struct _LrUrlTemplate LrUrlTemplate;
+
+/** Index variables of the list. The list must not be changed
+ * or freed while the table (or a template compiled with it) is used.
+ * @param list          a list of variables and its substitutions or NULL
+ * @return              a new table
+ */
+LrUrlVarsTable *
+lr_urlvars_table_new(LrUrlVars *list);
+
+/** Free the table.
+ * @param table         a table or NULL
+ */
+void
+lr_urlvars_table_free(LrUrlVarsTable *table);
+
+/** Parse the url into literal parts and variables.
+ * Variables are matched the same way as in lr_url_substitute().
+ * @param url           a url (must not be a NULL)
+ * @param table         a table of variables or NULL
+ * @return              a new template
+ */
+LrUrlTemplate *
+lr_url_template_compile(const char *url, LrUrlVarsTable *table);
+
+/** Build the substituted url. Returns a newly allocated string.
+ * @param tmpl          a template
+ * @return              a newly allocated string with substituted url
+ */
+char *
+lr_url_template_render(LrUrlTemplate *tmpl);
+
+/** Free the template.
+ * @param tmpl          a template or NULL
+ */
+void
+lr_url_template_free(LrUrlTemplate *tmpl);
+
+/** Substitute variables in the url using the table.
+ * Returns a newly allocated string.
+ * @param url           a url
+ * @param table         a table of variables or NULL
+ * @return              a newly allocated string with substituted url
+ */
+char *
+lr_url_substitute_table(const char *url, LrUrlVarsTable *table);
+
 /** @} */
 
 G_END_DECLS
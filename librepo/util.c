@@ -18,6 +18,7 @@
  * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
  */
 
+#define _GNU_SOURCE         // Because of memfd_create()
 #define _POSIX_C_SOURCE 200809L
 #define _XOPEN_SOURCE 500
 #include <glib.h>
@@ -30,16 +31,33 @@
 #include <string.h>
 #include <unistd.h>
 #include <sys/types.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#ifdef __linux__
+#include <sys/sendfile.h>
+#endif
 #include <stdarg.h>
 #include <ftw.h>
+#ifdef __GLIBC__
+#include <malloc.h>         // Because of malloc_usable_size()
+#endif
 
 #include "util.h"
+#include "cleanup.h"
 #include "version.h"
 #include "metalink.h"
 
 #define DIR_SEPARATOR   "/"
 #define ENV_DEBUG       "LIBREPO_DEBUG"
 
+// copy_file_range() is available since glibc 2.27
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 27))
+#define LR_HAVE_COPY_FILE_RANGE
+#endif
+
+/** Max length of the data copied by one in-kernel copy call */
+#define LR_COPY_CHUNK   (1 << 30)
+
 static void
 lr_log_handler(G_GNUC_UNUSED const gchar *log_domain,
                G_GNUC_UNUSED GLogLevelFlags log_level,
@@ -59,17 +77,17 @@ lr_init_debugging(void)
                                  | G_LOG_FLAG_RECURSION, lr_log_handler, NULL);
 }
 
-static gpointer
-lr_init_once_cb(gpointer user_data G_GNUC_UNUSED)
-{
 #ifdef CURL_GLOBAL_ACK_EINTR
 #define EINTR_SUPPORT " with CURL_GLOBAL_ACK_EINTR support"
-    curl_global_init(CURL_GLOBAL_ALL|CURL_GLOBAL_ACK_EINTR);
+#define LR_CURL_GLOBAL_FLAGS    (CURL_GLOBAL_ALL|CURL_GLOBAL_ACK_EINTR)
 #else
 #define EINTR_SUPPORT ""
-    curl_global_init(CURL_GLOBAL_ALL);
+#define LR_CURL_GLOBAL_FLAGS    CURL_GLOBAL_ALL
 #endif
 
+static gpointer
+lr_init_logging_once_cb(gpointer user_data G_GNUC_UNUSED)
+{
     lr_init_debugging();
     g_debug("Librepo version: %d.%d.%d%s (%s)", LR_VERSION_MAJOR,
                                                 LR_VERSION_MINOR,
@@ -80,11 +98,39 @@ lr_init_once_cb(gpointer user_data G_GNUC_UNUSED)
     return GINT_TO_POINTER(1);
 }
 
+static gpointer
+lr_init_curl_once_cb(gpointer user_data G_GNUC_UNUSED)
+{
+    gint64 start = g_get_monotonic_time();
+
+    // Initializes the TLS library too, libcurl cannot defer it
+    curl_global_init(LR_CURL_GLOBAL_FLAGS);
+
+    g_debug("%s: curl initialized in %"G_GINT64_FORMAT" us", __func__,
+            g_get_monotonic_time() - start);
+
+    return GINT_TO_POINTER(1);
+}
+
 void
-lr_global_init()
+lr_global_init_logging()
 {
     static GOnce init_once = G_ONCE_INIT;
-    g_once(&init_once, lr_init_once_cb, NULL);
+    g_once(&init_once, lr_init_logging_once_cb, NULL);
+}
+
+void
+lr_global_init_curl()
+{
+    static GOnce init_once = G_ONCE_INIT;
+    lr_global_init_logging();
+    g_once(&init_once, lr_init_curl_once_cb, NULL);
+}
+
+void
+lr_global_init()
+{
+    lr_global_init_curl();
 }
 
 /*
@@ -103,11 +149,102 @@ lr_out_of_memory()
     exit(1);
 }
 
+/** Allocation accounting (see lr_alloc_accounting()). The counters are
+ * updated by atomic operations, the allocations are made by many threads.
+ */
+typedef struct {
+    guint64 count;
+    guint64 bytes;
+    guint64 frees;
+    gint64 live;
+    gint64 peak;
+} LrAllocCounters;
+
+static gboolean alloc_accounting = FALSE;
+static LrAllocCounters alloc_tags[LR_ALLOC_SENTINEL];
+static LrAllocCounters alloc_total;
+static LrAllocHook alloc_hook = NULL;
+static void *alloc_hook_data = NULL;
+static GPrivate alloc_tag;
+
+static inline LrAllocTag
+current_alloc_tag(void)
+{
+    return (LrAllocTag) GPOINTER_TO_INT(g_private_get(&alloc_tag));
+}
+
+static inline size_t
+alloc_block_size(void *m, size_t len)
+{
+#ifdef __GLIBC__
+    return m ? malloc_usable_size(m) : 0;
+#else
+    return m ? len : 0;
+#endif
+}
+
+static void
+update_peak(gint64 *peak, gint64 live)
+{
+    gint64 old = __atomic_load_n(peak, __ATOMIC_RELAXED);
+    while (live > old
+           && !__atomic_compare_exchange_n(peak, &old, live, TRUE,
+                                           __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+        ;
+}
+
+static void
+account_counters(LrAllocCounters *c, size_t added, size_t removed,
+                 gboolean alloc)
+{
+    gint64 delta = (gint64) added - (gint64) removed;
+
+    if (alloc) {
+        __atomic_add_fetch(&c->count, 1, __ATOMIC_RELAXED);
+        __atomic_add_fetch(&c->bytes, added, __ATOMIC_RELAXED);
+    } else {
+        __atomic_add_fetch(&c->frees, 1, __ATOMIC_RELAXED);
+    }
+    if (delta > 0)
+        update_peak(&c->peak, __atomic_add_fetch(&c->live, delta,
+                                                 __ATOMIC_RELAXED));
+    else if (delta < 0)
+        __atomic_add_fetch(&c->live, delta, __ATOMIC_RELAXED);
+}
+
+/** Account an allocation (m is the new block, old is the reallocated
+ * one or NULL) or a free (m is NULL).
+ */
+static void
+account_alloc(void *m, void *old, size_t old_size, size_t len)
+{
+    LrAllocTag tag = current_alloc_tag();
+
+    if (__atomic_load_n(&alloc_accounting, __ATOMIC_RELAXED)) {
+        size_t added = alloc_block_size(m, len);
+#ifdef __GLIBC__
+        size_t removed = old_size;
+#else
+        size_t removed = 0;
+#endif
+        account_counters(&alloc_tags[tag], added, removed, m != NULL);
+        account_counters(&alloc_total, added, removed, m != NULL);
+    }
+
+    if (alloc_hook)
+        alloc_hook(alloc_hook_data, tag, m, old, len);
+}
+
+#define ALLOC_OBSERVED \
+    (alloc_hook || __atomic_load_n(&alloc_accounting, __ATOMIC_RELAXED))
+
 void *
 lr_malloc(size_t len)
 {
     void *m = malloc(len);
     if (!m) lr_out_of_memory();
+    if (ALLOC_OBSERVED)
+        account_alloc(m, NULL, 0, len);
     return m;
 }
 
@@ -116,21 +253,94 @@ lr_malloc0(size_t len)
 {
     void *m = calloc(1, len);
     if (!m) lr_out_of_memory();
+    if (ALLOC_OBSERVED)
+        account_alloc(m, NULL, 0, len);
     return m;
 }
 
 void *
 lr_realloc(void *ptr, size_t len)
 {
+    size_t old_size = ALLOC_OBSERVED ? alloc_block_size(ptr, 0) : 0;
     void *m = realloc(ptr, len);
     if (!m && len) lr_out_of_memory();
+    if (ALLOC_OBSERVED) {
+        if (m)
+            account_alloc(m, ptr, old_size, len);
+        else if (ptr)   // realloc(ptr, 0) freed the block
+            account_alloc(NULL, ptr, old_size, 0);
+    }
     return m;
 }
 
 void
 lr_free(void *m)
 {
-    if (m) free(m);
+    if (!m)
+        return;
+    if (ALLOC_OBSERVED)
+        account_alloc(NULL, m, alloc_block_size(m, 0), 0);
+    free(m);
+}
+
+void
+lr_alloc_accounting(gboolean enable)
+{
+    __atomic_store_n(&alloc_accounting, enable, __ATOMIC_RELAXED);
+}
+
+static void
+read_counters(const LrAllocCounters *c, LrAllocStats *stats)
+{
+    stats->count = __atomic_load_n(&c->count, __ATOMIC_RELAXED);
+    stats->bytes = __atomic_load_n(&c->bytes, __ATOMIC_RELAXED);
+    stats->frees = __atomic_load_n(&c->frees, __ATOMIC_RELAXED);
+    stats->live  = __atomic_load_n(&c->live, __ATOMIC_RELAXED);
+    stats->peak  = __atomic_load_n(&c->peak, __ATOMIC_RELAXED);
+}
+
+void
+lr_alloc_stats_get(LrAllocStats *total, LrAllocStats *tags)
+{
+    if (total)
+        read_counters(&alloc_total, total);
+    for (int x = 0; tags && x < LR_ALLOC_SENTINEL; x++)
+        read_counters(&alloc_tags[x], &tags[x]);
+}
+
+static void
+reset_counters(LrAllocCounters *c)
+{
+    __atomic_store_n(&c->count, 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&c->bytes, 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&c->frees, 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&c->peak, __atomic_load_n(&c->live, __ATOMIC_RELAXED),
+                     __ATOMIC_RELAXED);
+}
+
+void
+lr_alloc_stats_reset(void)
+{
+    reset_counters(&alloc_total);
+    for (int x = 0; x < LR_ALLOC_SENTINEL; x++)
+        reset_counters(&alloc_tags[x]);
+}
+
+LrAllocTag
+lr_alloc_tag_set(LrAllocTag tag)
+{
+    LrAllocTag prev = current_alloc_tag();
+
+    assert(tag < LR_ALLOC_SENTINEL);
+    g_private_set(&alloc_tag, GINT_TO_POINTER(tag));
+    return prev;
+}
+
+void
+lr_alloc_set_hook(LrAllocHook hook, void *data)
+{
+    alloc_hook_data = data;
+    alloc_hook = hook;
 }
 
 int
@@ -146,6 +356,18 @@ lr_gettmpfile()
     return fd;
 }
 
+int
+lr_getmemfile()
+{
+#ifdef MFD_CLOEXEC
+    int fd = memfd_create("librepo-tmp", MFD_CLOEXEC);
+    if (fd != -1)
+        return fd;
+    g_debug("%s: memfd_create() failed: %s", __func__, strerror(errno));
+#endif
+    return lr_gettmpfile();
+}
+
 char *
 lr_gettmpdir()
 {
@@ -278,21 +500,71 @@ lr_remove_dir(const char *path)
     return nftw(path, lr_remove_dir_cb, 64, FTW_DEPTH | FTW_PHYS);
 }
 
+/** Copy the rest of the source to the dest by a plain read()/write() loop.
+ */
+static int
+copy_content_rw(int source, int dest)
+{
+    const size_t bufsize = 128 * 1024;
+    _cleanup_free_ char *buf = lr_malloc(bufsize);
+    ssize_t size;
+
+    while ((size = read(source, buf, bufsize)) > 0) {
+        ssize_t written = 0;
+        while (written < size) {
+            ssize_t rc = write(dest, buf + written, size - written);
+            if (rc == -1) {
+                if (errno == EINTR)
+                    continue;
+                return -1;
+            }
+            written += rc;
+        }
+    }
+
+    return (size < 0) ? -1 : 0;
+}
+
 int
 lr_copy_content(int source, int dest)
 {
-    const int bufsize = 2048;
-    char buf[bufsize];
-    ssize_t size;
+    struct stat st;
+    ssize_t rc;
 
     lseek(source, 0, SEEK_SET);
     lseek(dest, 0, SEEK_SET);
 
-    while ((size = read(source, buf, bufsize)) > 0)
-        if (write(dest, buf, size) == -1)
-            return -1;
+    // The data are copied inside of the kernel if possible. Both calls
+    // use and advance the current offsets of the file descriptors, so on
+    // an unsupported combination of files the copy continues by the next
+    // method from where the previous one stopped.
+    if (fstat(source, &st) == -1 || !S_ISREG(st.st_mode))
+        return copy_content_rw(source, dest);
+
+#ifdef LR_HAVE_COPY_FILE_RANGE
+    while ((rc = copy_file_range(source, NULL, dest, NULL,
+                                 LR_COPY_CHUNK, 0)) > 0)
+        ;
+    if (rc == 0)
+        return 0;
+    if (errno != ENOSYS && errno != EXDEV && errno != EINVAL
+        && errno != EOPNOTSUPP && errno != EBADF)
+        return -1;
+    g_debug("%s: copy_file_range: %s", __func__, g_strerror(errno));
+#endif
+
+#ifdef __linux__
+    while ((rc = sendfile(dest, source, NULL, LR_COPY_CHUNK)) > 0)
+        ;
+    if (rc == 0)
+        return 0;
+    if (errno != ENOSYS && errno != EINVAL && errno != EOPNOTSUPP)
+        return -1;
+    g_debug("%s: sendfile: %s", __func__, g_strerror(errno));
+#endif
 
-    return (size < 0) ? -1 : 0;
+    (void) rc;
+    return copy_content_rw(source, dest);
 }
 
 char *
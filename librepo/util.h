@@ -51,9 +51,22 @@ G_BEGIN_DECLS
 /** Initialize librepo library.
  * This is called automatically to initialize librepo.
  * You normally don't have to call this function manually.
+ * It's the same as lr_global_init_curl().
  */
 void lr_global_init();
 
+/** Initialize the logging of librepo (LIBREPO_DEBUG environment
+ * variable). Called by lr_handle_init(), it's cheap.
+ */
+void lr_global_init_logging();
+
+/** Initialize curl (and its TLS library) and the logging.
+ * Called automatically when the first curl handle is created, it's done
+ * only once per process. Operations which don't need curl (e.g. with
+ * LRO_LOCAL) never pay for it.
+ */
+void lr_global_init_curl();
+
 /** Clean up librepo library.
 void lr_global_cleanup();
 */
@@ -87,11 +100,85 @@ void *lr_realloc(void *ptr, size_t len);
  */
 void lr_free(void *mem);
 
+/** Subsystem which made an allocation (see lr_alloc_tag_set()) */
+typedef enum {
+    LR_ALLOC_OTHER,         /*!< Not tagged */
+    LR_ALLOC_HANDLE,        /*!< Handle operations (lr_handle_perform()) */
+    LR_ALLOC_DOWNLOADER,    /*!< Downloads (lr_download(), ...) */
+    LR_ALLOC_METADATA,      /*!< Parsers of repomd, metalink and mirrorlist */
+    LR_ALLOC_CHECKSUM,      /*!< Checksums and their verification */
+    LR_ALLOC_SENTINEL,      /*!< Number of the tags */
+} LrAllocTag;
+
+/** Allocations made by lr_malloc(), lr_malloc0(), lr_realloc() and freed
+ * by lr_free() while the accounting is enabled. Bytes are the usable sizes
+ * of the blocks (with glibc, otherwise the requested sizes and the frees
+ * are not subtracted). Memory of librepo is freed by g_free() as well,
+ * so the live bytes are an upper estimate. */
+typedef struct {
+    guint64 count;      /*!< Number of allocations (reallocations too) */
+    guint64 bytes;      /*!< Total number of allocated bytes */
+    guint64 frees;      /*!< Number of frees */
+    gint64 live;        /*!< Allocated bytes which were not freed yet */
+    gint64 peak;        /*!< Maximum of the live bytes */
+} LrAllocStats;
+
+/** Allocation hook. It is called for every allocation (ptr is the new
+ * block, old_ptr is the reallocated block or NULL) and free (ptr is NULL,
+ * old_ptr is the freed block) of lr_malloc(), lr_malloc0(), lr_realloc()
+ * and lr_free(). It must be thread safe and must not allocate by these
+ * functions. */
+typedef void (*LrAllocHook)(void *data,
+                            LrAllocTag tag,
+                            void *ptr,
+                            void *old_ptr,
+                            size_t size);
+
+/** Enable or disable the allocation accounting (disabled by default).
+ * The counters are not reset.
+ * @param enable        Enable the accounting
+ */
+void lr_alloc_accounting(gboolean enable);
+
+/** Get the allocation counters.
+ * @param total         Sum of all tags (the peak is of the sum) or NULL
+ * @param tags          Array of LR_ALLOC_SENTINEL counters by the tag
+ *                      or NULL
+ */
+void lr_alloc_stats_get(LrAllocStats *total, LrAllocStats *tags);
+
+/** Reset the allocation counters, the peaks are set to the live bytes.
+ */
+void lr_alloc_stats_reset(void);
+
+/** Set the subsystem of the next allocations of the calling thread.
+ * @param tag           New tag
+ * @return              Previous tag (restore it when the subsystem
+ *                      is done)
+ */
+LrAllocTag lr_alloc_tag_set(LrAllocTag tag);
+
+/** Set the allocation hook, e.g. to account librepo allocations in
+ * the arenas of an embedder. The hook only observes the allocations,
+ * memory of librepo is freed by free() and g_free() too, so it must come
+ * from the system allocator. Set it before any other call of librepo.
+ * @param hook          Hook or NULL
+ * @param data          User data of the hook
+ */
+void lr_alloc_set_hook(LrAllocHook hook, void *data);
+
 /** Create temporary librepo file in /tmp directory.
  * @return              File descriptor.
  */
 int lr_gettmpfile();
 
+/** Create temporary librepo file which exists only in memory
+ * (memfd_create() is used if available, otherwise the file is
+ * created like by ::lr_gettmpfile).
+ * @return              File descriptor.
+ */
+int lr_getmemfile();
+
 /** Create temporary directory in /tmp directory.
  * @return              Path to directory.
  */
@@ -112,6 +199,9 @@ char *lr_pathconcat(const char *str, ...);
 int lr_remove_dir(const char *path);
 
 /** Copy content from source file descriptor to the dest file descriptor.
+ * Both files are used from their beginning. The data are copied inside
+ * of the kernel (copy_file_range(), sendfile()) if possible.
+ * Offsets of both file descriptors are left at the end of the copied data.
  * @param source        Source opened file descriptor
  * @param dest          Destination openede file descriptor
  * @return              0 on succes, -1 on error
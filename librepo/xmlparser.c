@@ -18,12 +18,17 @@
  * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
  */
 
+#define _XOPEN_SOURCE   600 // Because of posix_madvise()
+
 #include <glib.h>
 #include <glib/gprintf.h>
 #include <assert.h>
 #include <errno.h>
 #include <expat.h>
 #include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
 #include "xmlparser.h"
 #include "xmlparser_internal.h"
 #include "rcodes.h"
@@ -140,6 +145,127 @@ lr_xml_parser_strtoll(LrParserData *pd,
     return val;
 }
 
+void
+lr_xml_parser_stop(LrParserData *pd)
+{
+    assert(pd);
+    assert(pd->parser);
+
+    if (pd->stopped)
+        return;
+
+    XML_StopParser(*pd->parser, XML_FALSE);
+    pd->stopped = TRUE;
+}
+
+/** Return TRUE if the parsing failed only because it was stopped.
+ */
+static gboolean
+xml_parse_stopped(XML_Parser parser, LrParserData *pd)
+{
+    return pd->stopped && XML_GetErrorCode(parser) == XML_ERROR_ABORTED;
+}
+
+static gboolean
+xml_parse_error(XML_Parser parser, GError **err)
+{
+    g_debug("%s: Parse error at line: %d (%s)",
+                __func__,
+                (int) XML_GetCurrentLineNumber(parser),
+                (char *) XML_ErrorString(XML_GetErrorCode(parser)));
+    g_set_error(err, LR_XML_PARSER_ERROR, LRE_XMLPARSER,
+                "Parse error at line: %d (%s)",
+                (int) XML_GetCurrentLineNumber(parser),
+                (char *) XML_ErrorString(XML_GetErrorCode(parser)));
+    return FALSE;
+}
+
+gboolean
+lr_xml_parser_generic_buffer(XML_Parser parser,
+                             LrParserData *pd,
+                             const char *buf,
+                             size_t len,
+                             gboolean is_final,
+                             GError **err)
+{
+    /* Note: This function uses .err members of LrParserData! */
+
+    assert(parser);
+    assert(pd);
+    assert(buf || len == 0);
+    assert(!err || *err == NULL);
+
+    if (pd->stopped)
+        return TRUE;  // The rest of the document is not interesting
+
+    do {
+        size_t chunk = MIN(len, (size_t) XML_PARSE_CHUNK_SIZE);
+        gboolean last = is_final && chunk == len;
+
+        if (!XML_Parse(parser, buf, (int) chunk, last)) {
+            if (xml_parse_stopped(parser, pd))
+                return TRUE;
+            return xml_parse_error(parser, err);
+        }
+
+        if (pd->err) {
+            g_propagate_error(err, pd->err);
+            pd->err = NULL;
+            return FALSE;
+        }
+
+        buf += chunk;
+        len -= chunk;
+    } while (len > 0);
+
+    return TRUE;
+}
+
+/** Parse the rest of the file (from the current offset) through
+ * the memory map of the file. File offset is moved to the end of the file.
+ * @return      TRUE if the file was parsed (successfully or not - see err),
+ *              FALSE if the file cannot be mapped.
+ */
+static gboolean
+xml_parse_mmap(XML_Parser parser,
+               LrParserData *pd,
+               int fd,
+               gboolean *ret,
+               GError **err)
+{
+    struct stat st;
+    off_t offset;
+    char *map;
+
+    if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode))
+        return FALSE;
+
+    offset = lseek(fd, 0, SEEK_CUR);
+    if (offset == (off_t) -1 || offset >= st.st_size)
+        return FALSE;
+
+    map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (map == MAP_FAILED) {
+        g_debug("%s: mmap(%d) failed: %s", __func__, fd, g_strerror(errno));
+        return FALSE;
+    }
+
+    posix_madvise(map, st.st_size, POSIX_MADV_SEQUENTIAL);
+
+    *ret = lr_xml_parser_generic_buffer(parser,
+                                        pd,
+                                        map + offset,
+                                        st.st_size - offset,
+                                        TRUE,
+                                        err);
+    munmap(map, st.st_size);
+
+    // Leave the offset where read() would leave it
+    lseek(fd, 0, SEEK_END);
+
+    return TRUE;
+}
+
 gboolean
 lr_xml_parser_generic(XML_Parser parser,
                       LrParserData *pd,
@@ -155,6 +281,10 @@ lr_xml_parser_generic(XML_Parser parser,
     assert(fd >= 0);
     assert(!err || *err == NULL);
 
+    // Regular files are passed to the parser directly from the memory
+    if (xml_parse_mmap(parser, pd, fd, &ret, err))
+        return ret;
+
     while (1) {
         int len;
         void *buf = XML_GetBuffer(parser, XML_BUFFER_SIZE);
@@ -176,15 +306,12 @@ lr_xml_parser_generic(XML_Parser parser,
         }
 
         if (!XML_ParseBuffer(parser, len, len == 0)) {
-            ret = FALSE;
-            g_debug("%s: Parse error at line: %d (%s)",
-                        __func__,
-                        (int) XML_GetCurrentLineNumber(parser),
-                        (char *) XML_ErrorString(XML_GetErrorCode(parser)));
-            g_set_error(err, LR_XML_PARSER_ERROR, LRE_XMLPARSER,
-                        "Parse error at line: %d (%s)",
-                        (int) XML_GetCurrentLineNumber(parser),
-                        (char *) XML_ErrorString(XML_GetErrorCode(parser)));
+            if (xml_parse_stopped(parser, pd)) {
+                // Leave the offset where the whole parsing would leave it
+                lseek(fd, 0, SEEK_END);
+                break;
+            }
+            ret = xml_parse_error(parser, err);
             break;
         }
 
@@ -26,6 +26,7 @@
 
 #include "repomd.h"
 #include "metalink.h"
+#include "primary.h"
 
 G_BEGIN_DECLS
 
@@ -35,6 +36,9 @@ G_BEGIN_DECLS
  */
 
 #define XML_BUFFER_SIZE         8192
+#define XML_PARSE_CHUNK_SIZE    (1024 * 1024) /*!< Max length of data
+                                                   passed to XML_Parse()
+                                                   at once */
 #define CONTENT_REALLOC_STEP    256
 
 /** Structure used for elements in the state switches in XML parsers
@@ -53,6 +57,7 @@ typedef struct {
     int          statedepth; /*!< Depth of the last known state (element) */
     unsigned int state;      /*!< current state */
     GError       *err;       /*!< Error message */
+    gboolean     stopped;    /*!< Parsing was stopped by lr_xml_parser_stop() */
 
     /* Tag content related values */
 
@@ -89,6 +94,10 @@ typedef struct {
         ignore all subelements of the current file element */
     int found; /*!<
         wanted file was already parsed */
+    unsigned int maxurls; /*!<
+        max number of parsed urls, 0 - unlimited */
+    unsigned int nurls; /*!<
+        number of parsed urls */
 
     LrMetalink *metalink; /*!<
         metalink object */
@@ -98,6 +107,19 @@ typedef struct {
         Hash in progress or NULL */
     LrMetalinkAlternate *metalinkalternate; /*!<
         Alternate in progress or NULL */
+    LrMetalinkPieces *metalinkpieces; /*!<
+        Pieces in progress or NULL */
+
+    /* Primary related stuff */
+
+    gboolean primaryfound; /*!<
+        True if the <metadata> element was found */
+    LrYumPackage *package; /*!<
+        Package in progress or NULL */
+    LrYumPackageCb packagecb; /*!<
+        Callback called for every parsed package */
+    void *packagecb_data; /*!<
+        User data for the packagecb */
 
 } LrParserData;
 
@@ -150,7 +172,17 @@ lr_xml_parser_strtoll(LrParserData *pd,
                       const char *nptr,
                       unsigned int base);
 
+/** Stop the parsing. Could be called only from the parser handlers.
+ * The rest of the document is not parsed and the parsing
+ * is reported as successful.
+ */
+void
+lr_xml_parser_stop(LrParserData *pd);
+
 /** Generic parser.
+ * Parses the file from the current offset to its end. Regular files
+ * are memory mapped and the mapped data are passed to the parser
+ * without copying, other files are read by XML_BUFFER_SIZE chunks.
  */
 gboolean
 lr_xml_parser_generic(XML_Parser parser,
@@ -158,6 +190,24 @@ lr_xml_parser_generic(XML_Parser parser,
                       int fd,
                       GError **err);
 
+/** Generic parser for data in memory.
+ * Could be called repeatedly with consecutive parts of the document.
+ * @param parser    The parser
+ * @param pd        Parser data
+ * @param buf       Part of the XML document
+ * @param len       Length of the part
+ * @param is_final  TRUE if this is the last part of the document
+ * @param err       GError **
+ * @return          TRUE if everything is ok, FALSE if err is set.
+ */
+gboolean
+lr_xml_parser_generic_buffer(XML_Parser parser,
+                             LrParserData *pd,
+                             const char *buf,
+                             size_t len,
+                             gboolean is_final,
+                             GError **err);
+
 /** @} */
 
 G_END_DECLS
@@ -36,20 +36,47 @@
 #include "util.h"
 #include "metalink.h"
 #include "mirrorlist.h"
+#include "parsecache.h"
 #include "repomd.h"
 #include "downloader.h"
 #include "checksum.h"
+#include "checksum_internal.h"
+#include "decompressor.h"
 #include "handle_internal.h"
 #include "result_internal.h"
 #include "yum_internal.h"
 #include "gpg.h"
+#include "zchunk.h"
+#include "cleanup.h"
 
 /* helper functions for YumRepo manipulation */
 
+/** Expected checksum of a file of a located repository which is verified
+ * on the first access (see LRO_LAZYCHECKSUM).
+ */
+typedef struct {
+    LrChecksumType type;    /*!< Checksum type */
+    gchar *expected;        /*!< Expected checksum */
+    gboolean index;         /*!< Use the sidecar checksum index */
+} LrYumLazyChecksum;
+
+static void
+lr_yum_lazy_checksum_free(LrYumLazyChecksum *checksum)
+{
+    if (!checksum)
+        return;
+    g_free(checksum->expected);
+    lr_free(checksum);
+}
+
 LrYumRepo *
 lr_yum_repo_init()
 {
-    return lr_malloc0(sizeof(LrYumRepo));
+    LrYumRepo *repo = lr_malloc0(sizeof(LrYumRepo));
+    repo->paths_index = g_hash_table_new(g_str_hash, g_str_equal);
+    repo->unverified = g_hash_table_new_full(g_str_hash, g_str_equal, g_free,
+                                (GDestroyNotify) lr_yum_lazy_checksum_free);
+    return repo;
 }
 
 void
@@ -66,6 +93,10 @@ lr_yum_repo_free(LrYumRepo *repo)
         lr_free(yumrepopath);
     }
 
+    if (repo->paths_index)
+        g_hash_table_destroy(repo->paths_index);
+    if (repo->unverified)
+        g_hash_table_destroy(repo->unverified);
     g_slist_free(repo->paths);
     lr_free(repo->repomd);
     lr_free(repo->url);
@@ -76,19 +107,80 @@ lr_yum_repo_free(LrYumRepo *repo)
     lr_free(repo);
 }
 
-const char *
-lr_yum_repo_path(LrYumRepo *repo, const char *type)
+/** Return the first path of the type or NULL.
+ */
+static LrYumRepoPath *
+lr_yum_repo_find(LrYumRepo *repo, const char *type)
 {
-    assert(repo);
+    if (repo->paths_index)
+        return g_hash_table_lookup(repo->paths_index, type);
+
     for (GSList *elem = repo->paths; elem; elem = g_slist_next(elem)) {
         LrYumRepoPath *yumrepopath = elem->data;
         assert(yumrepopath);
         if (!strcmp(yumrepopath->type, type))
-            return yumrepopath->path;
+            return yumrepopath;
     }
     return NULL;
 }
 
+const char *
+lr_yum_repo_path(LrYumRepo *repo, const char *type)
+{
+    assert(repo);
+    LrYumRepoPath *yumrepopath = lr_yum_repo_find(repo, type);
+    return yumrepopath ? yumrepopath->path : NULL;
+}
+
+const char *
+lr_yum_repo_path_verified(LrYumRepo *repo, const char *type, GError **err)
+{
+    gboolean ret;
+    gboolean matches;
+    LrYumLazyChecksum *checksum = NULL;
+    GError *tmp_err = NULL;
+
+    assert(repo);
+    assert(!err || *err == NULL);
+
+    const char *path = lr_yum_repo_path(repo, type);
+    if (path && repo->unverified)
+        checksum = g_hash_table_lookup(repo->unverified, type);
+    if (!checksum)
+        return path;  // Already verified (or not to be verified at all)
+
+    int fd = open(path, O_RDONLY);
+    if (fd == -1) {
+        g_debug("%s: Cannot open %s", __func__, path);
+        g_set_error(err, LR_YUM_ERROR, LRE_IO,
+                    "Cannot open %s: %s", path, strerror(errno));
+        return NULL;
+    }
+
+    ret = lr_checksum_fd_cmp_indexed(checksum->type, fd,
+                                     checksum->index ? path : NULL,
+                                     checksum->expected, TRUE,
+                                     &matches, &tmp_err);
+    close(fd);
+
+    if (!ret) {
+        g_debug("%s: Checksum check %s - Error: %s",
+                __func__, path, tmp_err->message);
+        g_propagate_prefixed_error(err, tmp_err,
+                                   "Checksum error %s: ", path);
+        return NULL;
+    } else if (!matches) {
+        g_debug("%s: Checksum check %s - Mismatch", __func__, path);
+        g_set_error(err, LR_YUM_ERROR, LRE_BADCHECKSUM,
+                    "Checksum mismatch %s", path);
+        return NULL;
+    }
+
+    g_debug("%s: Checksum check %s - Passed", __func__, path);
+    g_hash_table_remove(repo->unverified, type);
+    return path;
+}
+
 /** Append path to the repository object.
  * @param repo          Yum repo object.
  * @param type          Type of file. E.g. "primary", "filelists", ...
@@ -105,6 +197,12 @@ lr_yum_repo_append(LrYumRepo *repo, const char *type, const char *path)
     yumrepopath->type = g_strdup(type);
     yumrepopath->path = g_strdup(path);
     repo->paths = g_slist_append(repo->paths, yumrepopath);
+
+    if (repo->paths_index
+        && !g_hash_table_lookup(repo->paths_index, yumrepopath->type))
+        g_hash_table_insert(repo->paths_index,
+                            yumrepopath->type,
+                            yumrepopath);
 }
 
 static void
@@ -114,15 +212,11 @@ lr_yum_repo_update(LrYumRepo *repo, const char *type, const char *path)
     assert(type);
     assert(path);
 
-    for (GSList *elem = repo->paths; elem; elem = g_slist_next(elem)) {
-        LrYumRepoPath *yumrepopath = elem->data;
-        assert(yumrepopath);
-
-        if (!strcmp(yumrepopath->type, type)) {
-            lr_free(yumrepopath->path);
-            yumrepopath->path = g_strdup(path);
-            return;
-        }
+    LrYumRepoPath *yumrepopath = lr_yum_repo_find(repo, type);
+    if (yumrepopath) {
+        lr_free(yumrepopath->path);
+        yumrepopath->path = g_strdup(path);
+        return;
     }
 
     lr_yum_repo_append(repo, type, path);
@@ -134,36 +228,53 @@ static gboolean
 lr_yum_repomd_record_enabled(LrHandle *handle, const char *type)
 {
     // Blacklist check
-    if (handle->yumblist) {
-        int x = 0;
-        while (handle->yumblist[x]) {
-            if (!strcmp(handle->yumblist[x], type))
-                return FALSE;
-            x++;
-        }
-    }
+    if (handle->yumblist_set
+        && g_hash_table_lookup(handle->yumblist_set, type))
+        return FALSE;
 
     // Whitelist check
-    if (handle->yumdlist) {
-        int x = 0;
-        while (handle->yumdlist[x]) {
-            if (!strcmp(handle->yumdlist[x], type))
-                return TRUE;
-            x++;
-        }
-        return FALSE;
-    }
+    if (handle->yumdlist_set)
+        return g_hash_table_lookup(handle->yumdlist_set, type) != NULL;
 
     return TRUE;
 }
 
+/** Return TRUE if the record should be decompressed (see LRO_YUMDECOMPRESS).
+ */
+static gboolean
+lr_yum_repomd_record_decompress(LrHandle *handle, const char *type)
+{
+    if (!handle->yumdecompress_set)
+        return FALSE;
+
+    return g_hash_table_lookup(handle->yumdecompress_set, type) != NULL;
+}
+
+/** Return malloced path of the decompressed file (the path without
+ * the compression suffix) or NULL if the path has no known compression
+ * suffix.
+ */
+static char *
+lr_yum_decompressed_path(const char *path)
+{
+    const char *suffixes[] = { ".gz", ".bz2", ".xz", NULL };
+
+    for (int x = 0; suffixes[x]; x++)
+        if (g_str_has_suffix(path, suffixes[x]))
+            return g_strndup(path, strlen(path) - strlen(suffixes[x]));
+
+    return NULL;
+}
+
 /** Mirror Failure Callback Data
  */
 typedef struct CbData_s {
     void *userdata;                 /*!< User data */
     LrProgressCb progresscb;        /*!< Progress callback */
     LrHandleMirrorFailureCb hmfcb;  /*!< Handle mirror failure callback */
+    LrYumRecordCb recordcb;         /*!< Record callback */
     char *metadata;                 /*!< "primary", "filelists", ... */
+    char *path;                     /*!< Path passed to the recordcb */
 } CbData;
 
 static CbData *cbdata_new(void *userdata,
@@ -184,14 +295,18 @@ cbdata_free(CbData *data)
 {
     if (!data) return;
     free(data->metadata);
+    g_free(data->path);
     free(data);
 }
 
+/* Targets of repositories downloaded together may be mixed with targets
+ * without the callback data (see lr_yum_perform_many) */
+
 static int
 progresscb(void *clientp, double total_to_download, double downloaded)
 {
     CbData *data = clientp;
-    if (data->progresscb)
+    if (data && data->progresscb)
         return data->progresscb(data->userdata, total_to_download, downloaded);
     return LR_CB_OK;
 }
@@ -200,122 +315,486 @@ static int
 hmfcb(void *clientp, const char *msg, const char *url)
 {
     CbData *data = clientp;
-    if (data->hmfcb)
+    if (data && data->hmfcb)
         return data->hmfcb(data->userdata, msg, url, data->metadata);
     return LR_CB_OK;
 }
 
+/** The file is verified (and decompressed) when the end callback of
+ * its target is called, so the record is reported right away.
+ * It only reads the CbData, so it may run in the LRO_ENDCBTHREADS threads.
+ */
+static int
+endcb(void *clientp, LrTransferStatus status, G_GNUC_UNUSED const char *msg)
+{
+    CbData *data = clientp;
+    if (status == LR_TRANSFER_SUCCESSFUL && data->recordcb)
+        return data->recordcb(data->userdata, data->metadata, data->path);
+    return LR_CB_OK;
+}
+
+/** Validators of the local copy of repomd.xml (see LRO_CONDITIONALGET).
+ */
+typedef struct {
+    gchar *etag;            /*!< ETag or NULL */
+    gint64 lastmodified;    /*!< Last-Modified (Unix time) or 0 */
+    gboolean notmodified;   /*!< The server answered that the repomd.xml
+                                 was not modified since the local copy */
+} LrRepomdValidators;
+
+#define VALIDATORS_GROUP    "repomd.xml"
+
+/** Load validators stored next to the repomd.xml.
+ * @return      TRUE if the repomd.xml and its validators exist
+ */
 static gboolean
-lr_yum_download_repomd(LrHandle *handle,
-                       LrMetalink *metalink,
-                       int fd,
-                       GError **err)
+lr_yum_load_validators(const char *path, LrRepomdValidators *validators)
 {
-    int ret = TRUE;
+    _cleanup_free_ gchar *vpath = g_strconcat(path, LR_VALIDATORS_SUFFIX, NULL);
+    GKeyFile *keyfile;
+
+    memset(validators, 0, sizeof(*validators));
+
+    if (!g_file_test(path, G_FILE_TEST_IS_REGULAR))
+        return FALSE;
+
+    keyfile = g_key_file_new();
+    if (g_key_file_load_from_file(keyfile, vpath, G_KEY_FILE_NONE, NULL)) {
+        validators->etag = g_key_file_get_string(keyfile, VALIDATORS_GROUP,
+                                                 "etag", NULL);
+        validators->lastmodified = g_key_file_get_int64(keyfile,
+                                                        VALIDATORS_GROUP,
+                                                        "lastmodified",
+                                                        NULL);
+    }
+    g_key_file_free(keyfile);
+
+    return validators->etag || validators->lastmodified > 0;
+}
+
+/** Store validators of the downloaded repomd.xml next to it.
+ * Errors are only logged, the next download is just unconditional.
+ */
+static void
+lr_yum_store_validators(const char *path, const LrRepomdValidators *validators)
+{
+    _cleanup_free_ gchar *vpath = g_strconcat(path, LR_VALIDATORS_SUFFIX, NULL);
+    _cleanup_free_ gchar *data = NULL;
     GError *tmp_err = NULL;
+    GKeyFile *keyfile;
+    gsize len;
 
-    assert(!err || *err == NULL);
+    if (!validators->etag && validators->lastmodified <= 0) {
+        // Server sent no validators
+        unlink(vpath);
+        return;
+    }
 
-    g_debug("%s: Downloading repomd.xml via mirrorlist", __func__);
+    keyfile = g_key_file_new();
+    if (validators->etag)
+        g_key_file_set_string(keyfile, VALIDATORS_GROUP, "etag",
+                              validators->etag);
+    if (validators->lastmodified > 0)
+        g_key_file_set_int64(keyfile, VALIDATORS_GROUP, "lastmodified",
+                             validators->lastmodified);
+    data = g_key_file_to_data(keyfile, &len, NULL);
+    g_key_file_free(keyfile);
+
+    if (!g_file_set_contents(vpath, data, (gssize) len, &tmp_err)) {
+        g_debug("%s: Cannot store validators: %s", __func__, tmp_err->message);
+        g_error_free(tmp_err);
+    }
+}
 
-    GSList *checksums = NULL;
-    if (metalink && (handle->checks & LR_CHECK_CHECKSUM)) {
-        // Select best checksum
+static void
+lr_yum_clear_validators(LrRepomdValidators *validators)
+{
+    g_free(validators->etag);
+    memset(validators, 0, sizeof(*validators));
+}
 
-        gboolean ret;
+/** Check the local repomd.xml against the checksums from the metalink.
+ * @return      FALSE if the metalink knows checksums of repomd.xml
+ *              and the local copy matches none of them
+ */
+static gboolean
+lr_yum_local_repomd_matches_metalink(LrMetalink *metalink, const char *path)
+{
+    GSList *hashes_lists = NULL;
+    gboolean known = FALSE;
+    gboolean matches = FALSE;
+    int fd;
+
+    if (!metalink)
+        return TRUE;
+
+    fd = open(path, O_RDONLY);
+    if (fd == -1)
+        return FALSE;
+
+    hashes_lists = g_slist_prepend(hashes_lists, metalink->hashes);
+    for (GSList *elem = metalink->alternates; elem; elem = g_slist_next(elem)) {
+        LrMetalinkAlternate *alt = elem->data;
+        hashes_lists = g_slist_prepend(hashes_lists, alt->hashes);
+    }
+
+    for (GSList *elem = hashes_lists; elem && !matches; elem = g_slist_next(elem)) {
         LrChecksumType ch_type;
         gchar *ch_value;
+        GError *tmp_err = NULL;
 
-        // From the metalink itself
-        ret = lr_best_checksum(metalink->hashes, &ch_type, &ch_value);
-        if (ret) {
-            LrDownloadTargetChecksum *dtch;
-            dtch = lr_downloadtargetchecksum_new(ch_type, ch_value);
-            checksums = g_slist_prepend(checksums, dtch);
-            g_debug("%s: Expected checksum for repomd.xml: (%s) %s",
-                    __func__, lr_checksum_type_to_str(ch_type), ch_value);
+        if (!lr_best_checksum(elem->data, &ch_type, &ch_value))
+            continue;
+
+        known = TRUE;
+        if (!lr_checksum_fd_cmp(ch_type, fd, ch_value, TRUE, &matches, &tmp_err)) {
+            g_debug("%s: Checksum error: %s", __func__, tmp_err->message);
+            g_clear_error(&tmp_err);
+            matches = FALSE;
         }
+    }
 
-        // From the alternates entries
-        for (GSList *elem = metalink->alternates; elem; elem = g_slist_next(elem)) {
-            LrMetalinkAlternate *alt = elem->data;
-            ret = lr_best_checksum(alt->hashes, &ch_type, &ch_value);
-            if (ret) {
-                LrDownloadTargetChecksum *dtch;
-                dtch = lr_downloadtargetchecksum_new(ch_type, ch_value);
-                checksums = g_slist_prepend(checksums, dtch);
-                g_debug("%s: Expected alternate checksum for repomd.xml: (%s) %s",
-                        __func__, lr_checksum_type_to_str(ch_type), ch_value);
+    g_slist_free(hashes_lists);
+    close(fd);
+
+    return !known || matches;
+}
+
+/** Download repomd.xml.asc again from the mirror where repomd.xml was
+ * downloaded from (if the signature in the batch came from another one).
+ */
+static gboolean
+lr_yum_download_signature(LrHandle *handle, int fd_sig, GError **err)
+{
+    _cleanup_free_ gchar *url = NULL;
+
+    if (ftruncate(fd_sig, 0) == -1 || lseek(fd_sig, 0, SEEK_SET) == -1) {
+        g_set_error(err, LR_YUM_ERROR, LRE_IO,
+                    "Cannot truncate repomd.xml.asc: %s", strerror(errno));
+        return FALSE;
+    }
+
+    url = lr_pathconcat(handle->used_mirror, "repodata/repomd.xml.asc", NULL);
+    return lr_download_url(handle, url, fd_sig, err);
+}
+
+
+/** Check that the file has the expected checksum
+ * (the checksum cache is used).
+ */
+static gboolean
+lr_yum_file_matches(LrHandle *handle,
+                    const char *path,
+                    LrChecksumType type,
+                    const char *expected)
+{
+    GError *tmp_err = NULL;
+    gboolean matches = FALSE;
+    int fd;
+
+    fd = open(path, O_RDONLY);
+    if (fd == -1)
+        return FALSE;
+
+    if (!lr_checksum_fd_cmp_indexed(type, fd,
+                                    handle->checksumindex ? path : NULL,
+                                    expected, TRUE, &matches, &tmp_err)) {
+        g_debug("%s: Cannot check %s: %s", __func__, path, tmp_err->message);
+        g_error_free(tmp_err);
+        matches = FALSE;
+    }
+
+    close(fd);
+    return matches;
+}
+
+/** Reuse an existing copy of the file at path if it has the expected
+ * checksum. The copy is either the path itself (e.g. while
+ * updating) or the href in the LRO_YUMREUSEDIR.
+ * @return      TRUE if the path contains valid content
+ */
+static gboolean
+lr_yum_reuse_file(LrHandle *handle,
+                  const char *href,
+                  const char *path,
+                  const char *checksum_type,
+                  const char *checksum)
+{
+    LrChecksumType type = lr_checksum_type(checksum_type);
+    _cleanup_free_ gchar *candidate = NULL;
+
+    if (!checksum || type == LR_CHECKSUM_UNKNOWN)
+        return FALSE;
+
+    if (lr_yum_file_matches(handle, path, type, checksum)) {
+        g_debug("%s: %s is up to date", __func__, path);
+        return TRUE;
+    }
+
+    if (!handle->yumreusedir)
+        return FALSE;
+
+    candidate = lr_pathconcat(handle->yumreusedir, href, NULL);
+    if (!strcmp(candidate, path)
+        || !lr_yum_file_matches(handle, candidate, type, checksum))
+        return FALSE;
+
+    unlink(path);
+    if (link(candidate, path) == 0) {
+        g_debug("%s: %s hardlinked from %s", __func__, path, candidate);
+        return TRUE;
+    }
+
+    // Different filesystem, copy the file
+    int in_fd = open(candidate, O_RDONLY);
+    if (in_fd == -1)
+        return FALSE;
+    int out_fd = open(path, O_CREAT|O_TRUNC|O_RDWR, 0666);
+    if (out_fd == -1) {
+        close(in_fd);
+        return FALSE;
+    }
+    int rc = lr_copy_content(in_fd, out_fd);
+    close(in_fd);
+    close(out_fd);
+    if (rc != 0) {
+        g_debug("%s: Cannot copy %s: %s", __func__, candidate, strerror(errno));
+        unlink(path);
+        return FALSE;
+    }
+
+    g_debug("%s: %s copied from %s", __func__, path, candidate);
+    return TRUE;
+}
+
+/** Reuse existing files of the record instead of downloading them.
+ * The compressed file is checked by the checksum, the decompressed file
+ * (LRO_YUMDECOMPRESS) by the checksum of the uncompressed data or it is
+ * decompressed again from the reused file.
+ * @return      TRUE if the files of the record don't have to be downloaded
+ */
+static gboolean
+lr_yum_reuse_record(LrHandle *handle,
+                    LrYumRepoMdRecord *record,
+                    const char *path,
+                    const char *decompressed_path)
+{
+    _cleanup_free_ gchar *decompressed_href = NULL;
+
+    if (decompressed_path)
+        decompressed_href = lr_yum_decompressed_path(record->location_href);
+
+    if (decompressed_path && !handle->yumkeepcompressed)
+        // Only the decompressed file is kept
+        return lr_yum_reuse_file(handle, decompressed_href, decompressed_path,
+                                 record->checksum_open_type,
+                                 record->checksum_open);
+
+    if (!lr_yum_reuse_file(handle, record->location_href, path,
+                           record->checksum_type, record->checksum))
+        return FALSE;
+
+    if (!decompressed_path
+        || lr_yum_reuse_file(handle, decompressed_href, decompressed_path,
+                             record->checksum_open_type,
+                             record->checksum_open))
+        return TRUE;
+
+    // Decompress the reused file
+    GError *tmp_err = NULL;
+    gboolean ret = FALSE;
+    int in_fd = open(path, O_RDONLY);
+    int out_fd = open(decompressed_path, O_CREAT|O_TRUNC|O_RDWR, 0666);
+    if (in_fd != -1 && out_fd != -1) {
+        ret = lr_decompress_fd(in_fd, out_fd, &tmp_err);
+        if (!ret) {
+            g_debug("%s: %s", __func__, tmp_err->message);
+            g_error_free(tmp_err);
+        }
+    }
+    if (in_fd != -1)
+        close(in_fd);
+    if (out_fd != -1)
+        close(out_fd);
+
+    return ret;
+}
+
+/** Find the newest old version of the zchunk file of the record in the
+ * destdir or in the LRO_YUMREUSEDIR. The files of the same type have
+ * the same name after the checksum prefix (e.g. "-primary.xml.zck").
+ * @return      Path to the file or NULL
+ */
+static gchar *
+lr_yum_find_zck_source(LrHandle *handle, LrYumRepoMdRecord *record)
+{
+    _cleanup_free_ gchar *dirname = g_path_get_dirname(record->location_href);
+    _cleanup_free_ gchar *basename = g_path_get_basename(record->location_href);
+    const char *suffix = strchr(basename, '-');
+    const char *roots[] = { handle->destdir, handle->yumreusedir };
+    gchar *newest = NULL;
+    time_t newest_mtime = 0;
+
+    if (!suffix)
+        suffix = basename;
+
+    for (size_t x = 0; x < G_N_ELEMENTS(roots); x++) {
+        if (!roots[x])
+            continue;
+
+        _cleanup_free_ gchar *dirpath = lr_pathconcat(roots[x], dirname, NULL);
+        GDir *dir = g_dir_open(dirpath, 0, NULL);
+        if (!dir)
+            continue;
+
+        const gchar *name;
+        while ((name = g_dir_read_name(dir))) {
+            struct stat st;
+            if (!g_str_has_suffix(name, suffix))
+                continue;
+            gchar *candidate = g_build_filename(dirpath, name, NULL);
+            if (stat(candidate, &st) == -1 || !S_ISREG(st.st_mode)
+                || (newest && st.st_mtime <= newest_mtime))
+            {
+                g_free(candidate);
+                continue;
             }
+            g_free(newest);
+            newest = candidate;
+            newest_mtime = st.st_mtime;
         }
+        g_dir_close(dir);
     }
 
-    CbData *cbdata = NULL;
-    if (handle->hmfcb) {
-        cbdata = cbdata_new(handle->user_data,
-                            NULL,
-                            handle->hmfcb,
-                            "repomd.xml");
-    }
-
-    LrDownloadTarget *target = lr_downloadtarget_new(handle,
-                                                     "repodata/repomd.xml",
-                                                     NULL,
-                                                     fd,
-                                                     NULL,
-                                                     checksums,
-                                                     0,
-                                                     0,
-                                                     NULL,
-                                                     cbdata,
-                                                     NULL,
-                                                     (cbdata) ? hmfcb : NULL,
-                                                     NULL,
-                                                     0,
-                                                     0);
-
-    ret = lr_download_target(target, &tmp_err);
-    assert((ret && !tmp_err) || (!ret && tmp_err));
-
-    if (cbdata)
-        cbdata_free(cbdata);
-
-    if (tmp_err) {
-        g_propagate_prefixed_error(err, tmp_err,
-                                   "Cannot download repomd.xml: ");
-    } else if (target->err) {
-        assert(0); // This shoud not happend since failfast sould be TRUE
-        ret = FALSE;
-        g_set_error(err, LR_DOWNLOADER_ERROR, target->rcode,
-                    "Cannot download repomd.xml: %s",target->err);
+    return newest;
+}
+
+/** Download the zchunk file of the record by chunks, reusing the chunks
+ * of an old local version. The file is assembled in a temporary file
+ * (the old version may be at the same path) and renamed to the path
+ * once its checksum is verified.
+ * @return      TRUE if the path contains the new version
+ */
+static gboolean
+lr_yum_zck_download_record(LrHandle *handle,
+                           LrYumRepoMdRecord *record,
+                           const char *path)
+{
+    LrChecksumType type = lr_checksum_type(record->checksum_type);
+    _cleanup_free_ gchar *source = NULL;
+    _cleanup_free_ gchar *tmp_path = NULL;
+    GError *tmp_err = NULL;
+    gboolean ret = FALSE;
+
+    if (!g_str_has_suffix(record->location_href, LR_ZCK_SUFFIX)
+        || record->size_header <= 0
+        || !record->checksum
+        || type == LR_CHECKSUM_UNKNOWN)
+        return FALSE;
+
+    source = lr_yum_find_zck_source(handle, record);
+    if (!source)
+        return FALSE;
+
+    int source_fd = open(source, O_RDONLY);
+    if (source_fd == -1)
+        return FALSE;
+
+    tmp_path = g_strconcat(path, ".part", NULL);
+    int fd = open(tmp_path, O_CREAT|O_TRUNC|O_RDWR, 0666);
+    if (fd == -1) {
+        close(source_fd);
+        return FALSE;
+    }
+
+    g_debug("%s: Downloading %s by chunks (old version: %s)",
+            __func__, record->location_href, source);
+
+    if (lr_zck_download(handle, record->location_href,
+                        record->location_base, record->size_header,
+                        source_fd, fd, &tmp_err)) {
+        gboolean matches = FALSE;
+        if (!lr_checksum_fd_cmp(type, fd, record->checksum,
+                                FALSE, &matches, &tmp_err)) {
+            g_debug("%s: %s", __func__, tmp_err->message);
+            g_clear_error(&tmp_err);
+        } else if (!matches) {
+            g_debug("%s: Assembled %s has a bad checksum",
+                    __func__, tmp_path);
+        } else {
+            ret = rename(tmp_path, path) == 0;
+        }
     } else {
-        // Set mirror used for download a repomd.xml to the handle
-        // TODO: Get rid of use_mirror attr
-        lr_free(handle->used_mirror);
-        handle->used_mirror = g_strdup(target->usedmirror);
+        g_debug("%s: %s", __func__, tmp_err->message);
+        g_clear_error(&tmp_err);
     }
 
-    lr_downloadtarget_free(target);
+    close(fd);
+    close(source_fd);
+    if (!ret)
+        unlink(tmp_path);
 
-    if (!ret) {
-        /* Download of repomd.xml was not successful */
-        g_debug("%s: repomd.xml download was unsuccessful", __func__);
+    return ret;
+}
+
+/** Report the file of a record which is ready without download
+ * to the LRO_YUMRECORDCB.
+ */
+static gboolean
+lr_yum_record_ready(LrHandle *handle,
+                    const char *type,
+                    const char *path,
+                    GError **err)
+{
+    if (!handle->yumrecordcb
+        || handle->yumrecordcb(handle->user_data, type, path) != LR_CB_ERROR)
+        return TRUE;
+
+    g_debug("%s: Interrupted by LR_CB_ERROR from record callback", __func__);
+    g_set_error(err, LR_YUM_ERROR, LRE_CBINTERRUPTED,
+                "Interrupted by LR_CB_ERROR from record callback");
+    return FALSE;
+}
+
+/** Targets of the metadata records of a repository.
+ */
+typedef struct {
+    GSList *targets;            /*!< Targets (LrDownloadTarget) */
+    GSList *cbdata_list;        /*!< Callback data of the targets */
+    GSList *compressed_paths;   /*!< Compressed files to remove after
+                                     the download (only the decompressed
+                                     ones are kept) */
+} LrYumRepoTargets;
+
+static void
+lr_yum_repo_targets_clear(LrYumRepoTargets *t)
+{
+    for (GSList *elem = t->targets; elem; elem = g_slist_next(elem)) {
+        LrDownloadTarget *target = elem->data;
+        close(target->fd);
+        if (target->decompressfd != -1)
+            close(target->decompressfd);
     }
 
-    return ret;
+    g_slist_free_full(t->compressed_paths, (GDestroyNotify) lr_free);
+    g_slist_free_full(t->cbdata_list, (GDestroyNotify) cbdata_free);
+    g_slist_free_full(t->targets, (GDestroyNotify) lr_downloadtarget_free);
+    memset(t, 0, sizeof(*t));
 }
 
+/** Prepare targets of the metadata records which have to be downloaded.
+ * Records whose files can be reused are finished right away, records
+ * added or changed according to the diff (if not NULL) are downloaded.
+ */
 static gboolean
-lr_yum_download_repo(LrHandle *handle,
-                     LrYumRepo *repo,
-                     LrYumRepoMd *repomd,
-                     GError **err)
+lr_yum_prepare_repo_targets(LrHandle *handle,
+                            LrYumRepo *repo,
+                            LrYumRepoMd *repomd,
+                            LrYumRepoMdDiff *diff,
+                            LrYumRepoTargets *t,
+                            GError **err)
 {
-    gboolean ret = TRUE;
     char *destdir;  /* Destination dir */
-    GSList *targets = NULL;
-    GSList *cbdata_list = NULL;
-    GError *tmp_err = NULL;
 
     destdir = handle->destdir;
     assert(destdir);
@@ -324,7 +803,9 @@ lr_yum_download_repo(LrHandle *handle,
 
     for (GSList *elem = repomd->records; elem; elem = g_slist_next(elem)) {
         int fd;
+        int decompressfd = -1;
         char *path;
+        char *decompressed_path = NULL;
         LrDownloadTarget *target;
         LrYumRepoMdRecord *record = elem->data;
         CbData *cbdata = NULL;
@@ -335,6 +816,46 @@ lr_yum_download_repo(LrHandle *handle,
             continue;
 
         path = lr_pathconcat(destdir, record->location_href, NULL);
+
+        if (lr_yum_repomd_record_decompress(handle, record->type))
+            decompressed_path = lr_yum_decompressed_path(path);
+
+        // Unchanged files don't have to be downloaded again. The files
+        // of records changed since the previous repomd.xml are the old
+        // versions, they are not even checked.
+        if ((!diff || !lr_yum_repomd_diff_modified(diff, record->type))
+            && lr_yum_reuse_record(handle, record, path, decompressed_path)) {
+            g_debug("%s: Reusing existing file(s) of %s", __func__,
+                    record->type);
+            if (decompressed_path && !handle->yumkeepcompressed)
+                lr_yum_repo_update(repo, record->type, decompressed_path);
+            else
+                lr_yum_repo_update(repo, record->type, path);
+            lr_free(path);
+            lr_free(decompressed_path);
+            if (!lr_yum_record_ready(handle, record->type,
+                                     lr_yum_repo_path(repo, record->type),
+                                     err)) {
+                lr_yum_repo_targets_clear(t);
+                return FALSE;
+            }
+            continue;
+        }
+
+        // Only the missing chunks of a zchunk file have to be downloaded
+        if (!decompressed_path
+            && lr_yum_zck_download_record(handle, record, path)) {
+            lr_yum_repo_update(repo, record->type, path);
+            lr_free(path);
+            if (!lr_yum_record_ready(handle, record->type,
+                                     lr_yum_repo_path(repo, record->type),
+                                     err)) {
+                lr_yum_repo_targets_clear(t);
+                return FALSE;
+            }
+            continue;
+        }
+
         fd = open(path, O_CREAT|O_TRUNC|O_RDWR, 0666);
         if (fd < 0) {
             g_debug("%s: Cannot create/open %s (%s)",
@@ -342,10 +863,27 @@ lr_yum_download_repo(LrHandle *handle,
             g_set_error(err, LR_YUM_ERROR, LRE_IO,
                         "Cannot create/open %s: %s", path, strerror(errno));
             lr_free(path);
-            g_slist_free_full(targets, (GDestroyNotify) lr_downloadtarget_free);
+            lr_free(decompressed_path);
+            lr_yum_repo_targets_clear(t);
             return FALSE;
         }
 
+        if (decompressed_path) {
+            decompressfd = open(decompressed_path, O_CREAT|O_TRUNC|O_RDWR, 0666);
+            if (decompressfd < 0) {
+                g_debug("%s: Cannot create/open %s (%s)",
+                        __func__, decompressed_path, strerror(errno));
+                g_set_error(err, LR_YUM_ERROR, LRE_IO,
+                            "Cannot create/open %s: %s",
+                            decompressed_path, strerror(errno));
+                close(fd);
+                lr_free(path);
+                lr_free(decompressed_path);
+                lr_yum_repo_targets_clear(t);
+                return FALSE;
+            }
+        }
+
         GSList *checksums = NULL;
         if (handle->checks & LR_CHECK_CHECKSUM) {
             // Select proper checksum type only if checksum check is enabled
@@ -356,12 +894,17 @@ lr_yum_download_repo(LrHandle *handle,
             checksums = g_slist_prepend(checksums, checksum);
         }
 
-        if (handle->user_cb || handle->hmfcb) {
+        if (handle->user_cb || handle->hmfcb || handle->yumrecordcb) {
             cbdata = cbdata_new(handle->user_data,
                                 handle->user_cb,
                                 handle->hmfcb,
                                 record->type);
-            cbdata_list = g_slist_append(cbdata_list, cbdata);
+            cbdata->recordcb = handle->yumrecordcb;
+            if (decompressed_path && !handle->yumkeepcompressed)
+                cbdata->path = g_strdup(decompressed_path);
+            else
+                cbdata->path = g_strdup(path);
+            t->cbdata_list = g_slist_append(t->cbdata_list, cbdata);
         }
 
         target = lr_downloadtarget_new(handle,
@@ -374,33 +917,48 @@ lr_yum_download_repo(LrHandle *handle,
                                        0,
                                        NULL,
                                        cbdata,
-                                       NULL,
+                                       (handle->yumrecordcb) ? endcb : NULL,
                                        NULL,
                                        NULL,
                                        0,
                                        0);
-
-        targets = g_slist_append(targets, target);
-
-        /* Because path may already exists in repo (while update) */
-        lr_yum_repo_update(repo, record->type, path);
-        lr_free(path);
+        target->decompressfd = decompressfd;
+        target->priorityclass = LR_PRIORITYCLASS_CRITICAL;
+
+        t->targets = g_slist_append(t->targets, target);
+
+        if (decompressed_path && !handle->yumkeepcompressed) {
+            // Only the decompressed file is kept
+            lr_yum_repo_update(repo, record->type, decompressed_path);
+            t->compressed_paths = g_slist_prepend(t->compressed_paths, path);
+        } else {
+            /* Because path may already exists in repo (while update) */
+            lr_yum_repo_update(repo, record->type, path);
+            lr_free(path);
+        }
+        lr_free(decompressed_path);
     }
 
-    if (!targets)
-        return TRUE;
-
-    ret = lr_download_single_cb(targets,
-                                FALSE,
-                                (cbdata_list) ? progresscb : NULL,
-                                (cbdata_list) ? hmfcb : NULL,
-                                &tmp_err);
+    return TRUE;
+}
 
-    // Error handling
+/** Evaluate the download of the targets of the records and free them.
+ * @param download_err  Error of the whole download or NULL
+ */
+static gboolean
+lr_yum_finish_repo_targets(LrYumRepoTargets *t,
+                           const GError *download_err,
+                           GError **err)
+{
+    gboolean ret = TRUE;
+    GSList *targets = t->targets;
+    GSList *compressed_paths = t->compressed_paths;
 
-    assert((ret && !tmp_err) || (!ret && tmp_err));
+    assert(!err || *err == NULL);
 
-    if (tmp_err) {
+    if (download_err) {
+        GError *tmp_err = g_error_copy(download_err);
+        ret = FALSE;
         g_propagate_prefixed_error(err, tmp_err,
                                    "Downloading error: ");
     } else {
@@ -428,6 +986,8 @@ lr_yum_download_repo(LrHandle *handle,
             }
 
             close(target->fd);
+            if (target->decompressfd != -1)
+                close(target->decompressfd);
         }
 
         if (code != LRE_OK) {
@@ -436,109 +996,463 @@ lr_yum_download_repo(LrHandle *handle,
             g_set_error(err, LR_DOWNLOADER_ERROR, code,
                         "Downloading error(s): %s", error_summary);
             g_free(error_summary);
+        } else {
+            // Remove compressed files which were decompressed
+            for (GSList *elem = compressed_paths; elem; elem = g_slist_next(elem))
+                if (unlink(elem->data) != 0)
+                    g_debug("%s: Cannot remove %s: %s", __func__,
+                            (char *) elem->data, strerror(errno));
         }
     }
 
-    g_slist_free_full(cbdata_list, (GDestroyNotify)cbdata_free);
-    g_slist_free_full(targets, (GDestroyNotify)lr_downloadtarget_free);
+    if (!download_err) {
+        // The files were closed above
+        g_slist_free_full(targets, (GDestroyNotify)lr_downloadtarget_free);
+        t->targets = NULL;
+    }
+    lr_yum_repo_targets_clear(t);
 
     return ret;
 }
 
+/** State of the download of a remote repository. The download goes
+ * by stages (repomd.xml, records), the targets of all the repositories
+ * downloaded together (see lr_yum_perform_many) are downloaded by one
+ * lr_download() in every stage.
+ */
+typedef struct {
+    LrHandle *handle;
+    LrResult *result;
+    GError *err;                    /*!< Error of the repository, the rest
+                                         of the stages is skipped */
+
+    char *path;                     /*!< Path to the repomd.xml */
+    char *tmp_path;                 /*!< Temporary file of the conditional
+                                         download of repomd.xml or NULL */
+    char *signature;                /*!< Path to the repomd.xml.asc or
+                                         NULL (no GPG check) */
+    int fd;                         /*!< repomd.xml (or tmp_path) */
+    int fd_sig;                     /*!< repomd.xml.asc or -1 */
+    gboolean conditional;           /*!< Conditional download */
+    LrRepomdValidators validators;  /*!< See LRO_CONDITIONALGET */
+    CbData *cbdata;                 /*!< Data of the repomd.xml target */
+    LrDownloadTarget *target;       /*!< repomd.xml */
+    LrDownloadTarget *sig_target;   /*!< repomd.xml.asc or NULL */
+    gboolean gpgcheck;              /*!< The gpg_job has to be verified */
+    LrGpgJob gpg_job;               /*!< Verification of repomd.xml.asc */
+
+    LrYumRepoMd *old_repomd;        /*!< Previous repomd.xml or NULL */
+
+    LrYumRepoTargets records;       /*!< Targets of the records */
+} LrYumRemote;
+
+static void
+lr_yum_remote_init(LrYumRemote *r, LrHandle *handle, LrResult *result)
+{
+    memset(r, 0, sizeof(*r));
+    r->handle = handle;
+    r->result = result;
+    r->fd = -1;
+    r->fd_sig = -1;
+}
+
+static void
+lr_yum_remote_clear(LrYumRemote *r)
+{
+    if (r->fd != -1)
+        close(r->fd);
+    if (r->fd_sig != -1)
+        close(r->fd_sig);
+    if (r->tmp_path)
+        unlink(r->tmp_path);
+    lr_free(r->path);
+    lr_free(r->tmp_path);
+    lr_free(r->signature);
+    lr_yum_clear_validators(&r->validators);
+    lr_yum_repomd_free(r->old_repomd);
+    cbdata_free(r->cbdata);
+    lr_downloadtarget_free(r->target);
+    lr_downloadtarget_free(r->sig_target);
+    lr_yum_repo_targets_clear(&r->records);
+    g_clear_error(&r->gpg_job.error);
+    g_clear_error(&r->err);
+}
+
+/** Prepare the target of repomd.xml (and of repomd.xml.asc) of the remote.
+ */
+static void
+lr_yum_remote_repomd_targets(LrYumRemote *r)
+{
+    LrHandle *handle = r->handle;
+    LrMetalink *metalink = handle->metalink;
+
+    g_debug("%s: Downloading repomd.xml via mirrorlist", __func__);
+
+    GSList *checksums = NULL;
+    gint64 expectedsize = 0;
+    if (metalink && (handle->checks & LR_CHECK_CHECKSUM)) {
+        // Select best checksum
+
+        gboolean ret;
+        LrChecksumType ch_type;
+        gchar *ch_value;
+
+        // From the metalink itself
+        ret = lr_best_checksum(metalink->hashes, &ch_type, &ch_value);
+        if (ret) {
+            LrDownloadTargetChecksum *dtch;
+            dtch = lr_downloadtargetchecksum_new(ch_type, ch_value);
+            checksums = g_slist_prepend(checksums, dtch);
+            g_debug("%s: Expected checksum for repomd.xml: (%s) %s",
+                    __func__, lr_checksum_type_to_str(ch_type), ch_value);
+        }
+
+        // From the alternates entries
+        for (GSList *elem = metalink->alternates; elem; elem = g_slist_next(elem)) {
+            LrMetalinkAlternate *alt = elem->data;
+            ret = lr_best_checksum(alt->hashes, &ch_type, &ch_value);
+            if (ret) {
+                LrDownloadTargetChecksum *dtch;
+                dtch = lr_downloadtargetchecksum_new(ch_type, ch_value);
+                checksums = g_slist_prepend(checksums, dtch);
+                g_debug("%s: Expected alternate checksum for repomd.xml: (%s) %s",
+                        __func__, lr_checksum_type_to_str(ch_type), ch_value);
+            }
+        }
+
+        // An encoded response has no usable Content-Length, the decoded
+        // data are checked against the size instead. The alternates could
+        // be of any size.
+        if (handle->acceptencoding && !metalink->alternates
+            && metalink->size > 0)
+            expectedsize = metalink->size;
+    }
+
+    if (handle->hmfcb) {
+        r->cbdata = cbdata_new(handle->user_data,
+                               NULL,
+                               handle->hmfcb,
+                               "repomd.xml");
+    }
+
+    r->target = lr_downloadtarget_new(handle,
+                                      "repodata/repomd.xml",
+                                      NULL,
+                                      r->fd,
+                                      NULL,
+                                      checksums,
+                                      expectedsize,
+                                      0,
+                                      NULL,
+                                      r->cbdata,
+                                      NULL,
+                                      (r->cbdata) ? hmfcb : NULL,
+                                      NULL,
+                                      0,
+                                      0);
+    r->target->contentencoding = TRUE;
+    r->target->priorityclass = LR_PRIORITYCLASS_CRITICAL;
+
+    if (metalink && (handle->checks & LR_CHECK_CHECKSUM)) {
+        // Damaged pieces are downloaded again instead of the whole file
+        LrMetalinkPieces *best = NULL;
+        LrChecksumType best_type = LR_CHECKSUM_UNKNOWN;
+        for (GSList *elem = metalink->pieces; elem; elem = g_slist_next(elem)) {
+            LrMetalinkPieces *pieces = elem->data;
+            LrChecksumType type = lr_checksum_type(pieces->type);
+            if (type != LR_CHECKSUM_UNKNOWN && type > best_type) {
+                best = pieces;
+                best_type = type;
+            }
+        }
+        if (best) {
+            r->target->pieces = lr_downloadtargetpieces_new(best_type,
+                                                            best->length,
+                                                            best->hashes);
+            g_debug("%s: Pieces for repomd.xml: %u x %"G_GINT64_FORMAT
+                    " bytes (%s)", __func__, best->count, best->length,
+                    best->type);
+        }
+    }
+
+    if (handle->conditionalget) {
+        // The validators of the response are stored even if the local
+        // copy cannot be used for a conditional request
+        r->target->conditional = TRUE;
+        r->target->etag = r->validators.etag;
+        r->target->lastmodified = r->validators.lastmodified;
+    }
+
+    /* Try to download the signature only from the mirror where repomd.xml
+     * itself is downloaded from. Most of yum repositories are not signed
+     * and trying every mirror for the signature is not effective, a 404
+     * doesn't tell if there is no signature or just an error on the
+     * mirror. Both files are downloaded concurrently. */
+    if (r->fd_sig != -1) {
+        r->sig_target = lr_downloadtarget_new(handle,
+                                              "repodata/repomd.xml.asc",
+                                              NULL, r->fd_sig, NULL, NULL,
+                                              0, 0, NULL, NULL, NULL, NULL,
+                                              NULL, 0, 0);
+        r->sig_target->samemirror = r->target;
+        r->sig_target->contentencoding = TRUE;
+        r->sig_target->priorityclass = LR_PRIORITYCLASS_CRITICAL;
+    }
+}
+
+/** Evaluate the download of repomd.xml (and repomd.xml.asc).
+ * @param sig_err       Set if the repomd.xml.asc couldn't be downloaded
+ */
+static gboolean
+lr_yum_remote_repomd_downloaded(LrYumRemote *r,
+                                GError **sig_err,
+                                GError **err)
+{
+    LrHandle *handle = r->handle;
+    LrDownloadTarget *target = r->target;
+    LrDownloadTarget *sig_target = r->sig_target;
+
+    if (target->err) {
+        g_debug("%s: repomd.xml download was unsuccessful", __func__);
+        g_set_error(err, LR_DOWNLOADER_ERROR, target->rcode,
+                    "Cannot download repomd.xml: %s", target->err);
+        return FALSE;
+    }
+
+    if (handle->conditionalget) {
+        g_free(r->validators.etag);
+        r->validators.etag = g_strdup(target->etag);
+        r->validators.lastmodified = target->lastmodified;
+        r->validators.notmodified = target->notmodified;
+        if (r->validators.notmodified)
+            g_debug("%s: repomd.xml was not modified", __func__);
+    }
+
+    // Set mirror used for download a repomd.xml to the handle
+    // TODO: Get rid of use_mirror attr
+    lr_free(handle->used_mirror);
+    handle->used_mirror = g_strdup(target->usedmirror);
+
+    if (sig_target) {
+        gboolean moved = sig_target->err
+                ? target->stats.attempts > 1
+                : g_strcmp0(sig_target->usedmirror, target->usedmirror) != 0;
+        if (moved) {
+            // The repomd.xml was downloaded from another mirror after
+            // a failure, download the signature from its mirror
+            g_debug("%s: Downloading repomd.xml.asc from %s again",
+                    __func__, target->usedmirror);
+            lr_yum_download_signature(handle, r->fd_sig, sig_err);
+        } else if (sig_target->err) {
+            g_set_error(sig_err, LR_DOWNLOADER_ERROR, sig_target->rcode,
+                        "%s", sig_target->err);
+        }
+    }
+
+    if (!r->conditional)
+        return TRUE;
+
+    /* The repomd.xml was downloaded by a conditional request to
+     * a temporary file which replaces the local copy, if the server
+     * answers that the repomd.xml wasn't modified, the local copy
+     * is kept */
+    close(r->fd);
+    r->fd = -1;
+
+    if (r->validators.notmodified) {
+        // Keep the local copy
+        unlink(r->tmp_path);
+        r->fd = open(r->path, O_RDWR);
+        if (r->fd == -1) {
+            g_set_error(err, LR_YUM_ERROR, LRE_IO,
+                        "Cannot open %s: %s", r->path, strerror(errno));
+            return FALSE;
+        }
+    } else {
+        if (rename(r->tmp_path, r->path) == -1) {
+            g_set_error(err, LR_YUM_ERROR, LRE_IO,
+                        "Cannot rename %s to %s: %s",
+                        r->tmp_path, r->path, strerror(errno));
+            return FALSE;
+        }
+        r->fd = open(r->path, O_RDWR);
+        if (r->fd == -1) {
+            g_set_error(err, LR_YUM_ERROR, LRE_IO,
+                        "Cannot open %s: %s", r->path, strerror(errno));
+            return FALSE;
+        }
+    }
+
+    lr_free(r->tmp_path);
+    r->tmp_path = NULL;
+    return TRUE;
+}
+
+/** Select the expected checksum of the file of the record.
+ * @param rec           Record from repomd
+ * @param path          Path to the file of the record
+ * @param checksum      Expected checksum or NULL if repomd doesn't
+ *                      contain any
+ * @param checksum_type Type of the expected checksum
+ * @param err           GError **
+ * @return              FALSE if the checksum type is unknown
+ */
 static gboolean
-lr_yum_check_checksum_of_md_record(LrYumRepoMdRecord *rec,
+lr_yum_md_record_expected_checksum(LrYumRepoMdRecord *rec,
                                    const char *path,
+                                   char **checksum,
+                                   LrChecksumType *checksum_type,
                                    GError **err)
 {
-    int fd;
     char *expected_checksum;
-    LrChecksumType checksum_type;
-    gboolean ret, matches;
-    GError *tmp_err = NULL;
+    char *checksum_type_str;
+    char *decompressed_href;
 
     assert(!err || *err == NULL);
 
-    if (!rec || !path)
-        return TRUE;
-
     expected_checksum = rec->checksum;
-    checksum_type = lr_checksum_type(rec->checksum_type);
+    checksum_type_str = rec->checksum_type;
+
+    decompressed_href = lr_yum_decompressed_path(rec->location_href);
+    if (decompressed_href && g_str_has_suffix(path, decompressed_href)) {
+        // Only the decompressed file is available (see LRO_YUMKEEPCOMPRESSED)
+        expected_checksum = rec->checksum_open;
+        checksum_type_str = rec->checksum_open_type;
+    }
+    lr_free(decompressed_href);
+
+    *checksum = expected_checksum;
+    *checksum_type = lr_checksum_type(checksum_type_str);
 
     g_debug("%s: Checking checksum of %s (expected: %s [%s])",
-                       __func__, path, expected_checksum, rec->checksum_type);
+                       __func__, path, expected_checksum, checksum_type_str);
 
     if (!expected_checksum) {
         // Empty checksum - suppose it's ok
         g_debug("%s: No checksum in repomd", __func__);
         return TRUE;
-    }
-
-    if (checksum_type == LR_CHECKSUM_UNKNOWN) {
-        g_debug("%s: Unknown checksum: %s", __func__, rec->checksum_type);
-        g_set_error(err, LR_YUM_ERROR, LRE_UNKNOWNCHECKSUM,
-                    "Unknown checksum type \"%s\" for %s",
-                    rec->checksum_type, path);
-        return FALSE;
-    }
-
-    fd = open(path, O_RDONLY);
-    if (fd < 0) {
-        g_debug("%s: Cannot open %s", __func__, path);
-        g_set_error(err, LR_YUM_ERROR, LRE_IO,
-                    "Cannot open %s: %s", path, strerror(errno));
+    }
+
+    if (*checksum_type == LR_CHECKSUM_UNKNOWN) {
+        g_debug("%s: Unknown checksum: %s", __func__, checksum_type_str);
+        g_set_error(err, LR_YUM_ERROR, LRE_UNKNOWNCHECKSUM,
+                    "Unknown checksum type \"%s\" for %s",
+                    checksum_type_str, path);
         return FALSE;
     }
 
-    ret = lr_checksum_fd_cmp(checksum_type,
-                             fd,
-                             expected_checksum,
-                             1,
-                             &matches,
-                             &tmp_err);
+    return TRUE;
+}
 
-    close(fd);
+/** Evaluate a finished verification of a repomd record.
+ * Stops the verification on the first failure.
+ */
+static gboolean
+lr_yum_check_checksum_job_cb(LrChecksumJob *job, void *cbdata)
+{
+    GError **err = cbdata;
+    const char *path = job->path;
 
-    assert(ret || tmp_err);
+    if (!job->opened) {
+        g_debug("%s: Cannot open %s", __func__, path);
+        g_set_error(err, LR_YUM_ERROR, LRE_IO, "%s", job->error->message);
+        return FALSE;
+    }
 
-    if (!ret) {
+    if (job->error) {
         // Checksum calculation error
         g_debug("%s: Checksum check %s - Error: %s",
-                __func__, path, tmp_err->message);
-        g_propagate_prefixed_error(err, tmp_err,
+                __func__, path, job->error->message);
+        g_propagate_prefixed_error(err, job->error,
                                    "Checksum error %s: ", path);
+        job->error = NULL;
         return FALSE;
-    } else if (!matches) {
+    } else if (!job->matches) {
         g_debug("%s: Checksum check %s - Mismatch", __func__, path);
         g_set_error(err, LR_YUM_ERROR, LRE_BADCHECKSUM,
                     "Checksum mismatch %s", path);
         return FALSE;
     }
 
-    g_debug("%s: Checksum check - Passed", __func__);
+    g_debug("%s: Checksum check %s - Passed", __func__, path);
 
     return TRUE;
 }
 
+/** Verify checksums of the located files of the records on the checksum
+ * worker pool (LRO_CHECKSUMTHREADS) or, with LRO_LAZYCHECKSUM, only
+ * remember the expected checksums for lr_yum_repo_path_verified().
+ */
 static gboolean
-lr_yum_check_repo_checksums(LrYumRepo *repo,
+lr_yum_check_repo_checksums(LrHandle *handle,
+                            LrYumRepo *repo,
                             LrYumRepoMd *repomd,
                             GError **err)
 {
+    gboolean ret = TRUE;
+    GSList *jobs = NULL;
+    GError *tmp_err = NULL;
+
     assert(!err || *err == NULL);
 
     for (GSList *elem = repomd->records; elem; elem = g_slist_next(elem)) {
-        gboolean ret;
+        char *checksum;
+        LrChecksumType checksum_type;
         LrYumRepoMdRecord *record = elem->data;
 
         assert(record);
 
         const char *path = lr_yum_repo_path(repo, record->type);
-        ret = lr_yum_check_checksum_of_md_record(record, path, err);
+        if (!path)
+            continue;
+
+        ret = lr_yum_md_record_expected_checksum(record, path, &checksum,
+                                                 &checksum_type, &tmp_err);
         if (!ret)
-            return FALSE;
+            break;
+        if (!checksum)
+            continue;
+
+        if (handle->lazychecksum) {
+            LrYumLazyChecksum *lazy = lr_malloc0(sizeof(*lazy));
+            lazy->type      = checksum_type;
+            lazy->expected  = g_strdup(checksum);
+            lazy->index     = handle->checksumindex;
+            g_hash_table_replace(repo->unverified, g_strdup(record->type),
+                                 lazy);
+            continue;
+        }
+
+        LrChecksumJob *job = lr_malloc0(sizeof(*job));
+        job->path       = path;
+        job->type       = checksum_type;
+        job->expected   = checksum;
+        job->caching    = TRUE;
+        job->index      = handle->checksumindex;
+        jobs = g_slist_prepend(jobs, job);
     }
 
-    return TRUE;
+    if (ret && jobs) {
+        // Files of the records are independent - verify them in parallel
+        jobs = g_slist_reverse(jobs);
+        lr_checksum_verify_files(jobs,
+                                 (guint) handle->checksumthreads,
+                                 lr_yum_check_checksum_job_cb,
+                                 &tmp_err);
+        ret = (tmp_err == NULL);
+    }
+
+    for (GSList *elem = jobs; elem; elem = g_slist_next(elem)) {
+        LrChecksumJob *job = elem->data;
+        g_clear_error(&job->error);
+        lr_free(job);
+    }
+    g_slist_free(jobs);
+
+    if (tmp_err)
+        g_propagate_error(err, tmp_err);
+
+    return ret;
 }
 
 static gboolean
@@ -612,9 +1526,16 @@ lr_yum_use_local(LrHandle *handle, LrResult *result, GError **err)
             return FALSE;
         }
 
-        g_debug("%s: Parsing repomd.xml", __func__);
-        ret = lr_yum_repomd_parse_file(repomd, fd, lr_xml_parser_warning_logger,
-                                       "Repomd xml parser", &tmp_err);
+        if (handle->parsecache && lr_parsecache_load_repomd(repomd, path, fd)) {
+            ret = TRUE;
+        } else {
+            g_debug("%s: Parsing repomd.xml", __func__);
+            ret = lr_yum_repomd_parse_file(repomd, fd,
+                                           lr_xml_parser_warning_logger,
+                                           "Repomd xml parser", &tmp_err);
+            if (ret && handle->parsecache)
+                lr_parsecache_store_repomd(repomd, path, fd);
+        }
         close(fd);
         if (!ret) {
             g_debug("%s: Parsing unsuccessful: %s", __func__, tmp_err->message);
@@ -647,10 +1568,17 @@ lr_yum_use_local(LrHandle *handle, LrResult *result, GError **err)
                 return FALSE;
             }
 
-            ret = lr_gpg_check_signature(repo->signature,
-                                         repo->repomd,
-                                         handle->gnupghomedir,
-                                         &tmp_err);
+            gint64 start = g_get_monotonic_time();
+            ret = lr_gpg_check_signature_v2(repo->signature,
+                                            repo->repomd,
+                                            handle->gnupghomedir,
+                                            handle->gpgbackend,
+                                            &tmp_err);
+            lr_trace_span(handle->trace, "gpg", "gpg check",
+                          start, g_get_monotonic_time(),
+                          "signature", repo->signature,
+                          "error", tmp_err ? tmp_err->message : NULL,
+                          NULL);
             if (!ret) {
                 g_debug("%s: repomd.xml GPG signature verification failed: %s",
                         __func__, tmp_err->message);
@@ -677,6 +1605,19 @@ lr_yum_use_local(LrHandle *handle, LrResult *result, GError **err)
             continue; /* This path already exists in repo */
 
         path = lr_pathconcat(baseurl, record->location_href, NULL);
+        if (path && access(path, F_OK) == -1
+            && lr_yum_repomd_record_decompress(handle, record->type))
+        {
+            // Only the decompressed file could be kept
+            char *decompressed_path = lr_yum_decompressed_path(path);
+            if (decompressed_path && access(decompressed_path, F_OK) == 0) {
+                lr_free(path);
+                path = decompressed_path;
+            } else {
+                lr_free(decompressed_path);
+            }
+        }
+
         if (path) {
             if (access(path, F_OK) == -1) {
                 /* A repo file is missing */
@@ -699,28 +1640,69 @@ lr_yum_use_local(LrHandle *handle, LrResult *result, GError **err)
     return TRUE;
 }
 
+/** Load the previous repomd.xml of the destdir or of the LRO_YUMREUSEDIR.
+ * @return      Parsed repomd or NULL if there is none
+ */
+static LrYumRepoMd *
+lr_yum_load_old_repomd(LrHandle *handle)
+{
+    const char *roots[] = { handle->destdir, handle->yumreusedir };
+
+    for (size_t x = 0; x < G_N_ELEMENTS(roots); x++) {
+        if (!roots[x])
+            continue;
+
+        _cleanup_free_ gchar *path = lr_pathconcat(roots[x],
+                                                   "repodata/repomd.xml",
+                                                   NULL);
+        int fd = open(path, O_RDONLY);
+        if (fd == -1)
+            continue;
+
+        GError *tmp_err = NULL;
+        LrYumRepoMd *repomd = lr_yum_repomd_init();
+        gboolean ret = TRUE;
+        if (!handle->parsecache || !lr_parsecache_load_repomd(repomd, path, fd))
+            ret = lr_yum_repomd_parse_file(repomd, fd,
+                                           lr_xml_parser_warning_logger,
+                                           "Repomd xml parser", &tmp_err);
+        close(fd);
+        if (ret) {
+            g_debug("%s: Previous repomd.xml: %s", __func__, path);
+            return repomd;
+        }
+
+        g_debug("%s: Cannot parse %s: %s", __func__, path, tmp_err->message);
+        g_error_free(tmp_err);
+        lr_yum_repomd_free(repomd);
+    }
+
+    return NULL;
+}
+
+/** Prepare the download of the remote repository: the repodata/ dir,
+ * the copies of the mirrorlist and metalink and, if the repomd.xml
+ * has to be downloaded (no LRO_UPDATE), its target(s).
+ */
 static gboolean
-lr_yum_download_remote(LrHandle *handle, LrResult *result, GError **err)
+lr_yum_remote_prepare(LrYumRemote *r, GError **err)
 {
     int rc;
-    gboolean ret = TRUE;
     int fd;
     int create_repodata_dir = 1;
     char *path_to_repodata;
-    LrYumRepo *repo;
-    LrYumRepoMd *repomd;
-    GError *tmp_err = NULL;
+    LrHandle *handle = r->handle;
+    LrYumRepo *repo = r->result->yum_repo;
 
     assert(!err || *err == NULL);
 
-    repo   = result->yum_repo;
-    repomd = result->yum_repomd;
-
     g_debug("%s: Downloading/Copying repo..", __func__);
 
     path_to_repodata = lr_pathconcat(handle->destdir, "repodata", NULL);
 
-    if (handle->update) {  /* Check if should create repodata/ subdir */
+    if (handle->update || handle->conditionalget) {
+        /* Check if should create repodata/ subdir
+         * (conditional download reuses repomd.xml of the destdir) */
         struct stat buf;
         if (stat(path_to_repodata, &buf) != -1)
             if (S_ISDIR(buf.st_mode))
@@ -742,184 +1724,392 @@ lr_yum_download_remote(LrHandle *handle, LrResult *result, GError **err)
     }
     lr_free(path_to_repodata);
 
-    if (!handle->update) {
-        char *path;
+    if (handle->update)
+        return TRUE;
 
-        /* Store mirrorlist file(s) */
-        if (handle->mirrorlist_fd != -1) {
-            char *ml_file_path = lr_pathconcat(handle->destdir,
-                                               "mirrorlist", NULL);
-            fd = open(ml_file_path, O_CREAT|O_TRUNC|O_RDWR, 0666);
-            if (fd < 0) {
-                g_debug("%s: Cannot create: %s", __func__, ml_file_path);
-                g_set_error(err, LR_YUM_ERROR, LRE_IO,
-                        "Cannot create %s: %s", ml_file_path, strerror(errno));
-                lr_free(ml_file_path);
-                return FALSE;
-            }
-            rc = lr_copy_content(handle->mirrorlist_fd, fd);
-            close(fd);
-            if (rc != 0) {
-                g_debug("%s: Cannot copy content of mirrorlist file", __func__);
-                g_set_error(err, LR_YUM_ERROR, LRE_IO,
-                        "Cannot copy content of mirrorlist file %s: %s",
-                        ml_file_path, strerror(errno));
-                lr_free(ml_file_path);
-                return FALSE;
-            }
-            repo->mirrorlist = ml_file_path;
+    /* Store mirrorlist file(s) */
+    if (handle->mirrorlist_fd != -1) {
+        char *ml_file_path = lr_pathconcat(handle->destdir,
+                                           "mirrorlist", NULL);
+        fd = open(ml_file_path, O_CREAT|O_TRUNC|O_RDWR, 0666);
+        if (fd < 0) {
+            g_debug("%s: Cannot create: %s", __func__, ml_file_path);
+            g_set_error(err, LR_YUM_ERROR, LRE_IO,
+                    "Cannot create %s: %s", ml_file_path, strerror(errno));
+            lr_free(ml_file_path);
+            return FALSE;
+        }
+        rc = lr_copy_content(handle->mirrorlist_fd, fd);
+        close(fd);
+        if (rc != 0) {
+            g_debug("%s: Cannot copy content of mirrorlist file", __func__);
+            g_set_error(err, LR_YUM_ERROR, LRE_IO,
+                    "Cannot copy content of mirrorlist file %s: %s",
+                    ml_file_path, strerror(errno));
+            lr_free(ml_file_path);
+            return FALSE;
         }
+        repo->mirrorlist = ml_file_path;
+    }
 
-        if (handle->metalink_fd != -1) {
-            char *ml_file_path = lr_pathconcat(handle->destdir,
-                                               "metalink.xml", NULL);
-            fd = open(ml_file_path, O_CREAT|O_TRUNC|O_RDWR, 0666);
-            if (fd < 0) {
-                g_debug("%s: Cannot create: %s", __func__, ml_file_path);
-                g_set_error(err, LR_YUM_ERROR, LRE_IO,
-                        "Cannot create %s: %s", ml_file_path, strerror(errno));
-                lr_free(ml_file_path);
-                return FALSE;
-            }
-            rc = lr_copy_content(handle->metalink_fd, fd);
-            close(fd);
-            if (rc != 0) {
-                g_debug("%s: Cannot copy content of metalink file", __func__);
-                g_set_error(err, LR_YUM_ERROR, LRE_IO,
-                        "Cannot copy content of metalink file %s: %s",
-                        ml_file_path, strerror(errno));
-                lr_free(ml_file_path);
-                return FALSE;
-            }
-            repo->metalink = ml_file_path;
+    if (handle->metalink_fd != -1) {
+        char *ml_file_path = lr_pathconcat(handle->destdir,
+                                           "metalink.xml", NULL);
+        fd = open(ml_file_path, O_CREAT|O_TRUNC|O_RDWR, 0666);
+        if (fd < 0) {
+            g_debug("%s: Cannot create: %s", __func__, ml_file_path);
+            g_set_error(err, LR_YUM_ERROR, LRE_IO,
+                    "Cannot create %s: %s", ml_file_path, strerror(errno));
+            lr_free(ml_file_path);
+            return FALSE;
+        }
+        rc = lr_copy_content(handle->metalink_fd, fd);
+        close(fd);
+        if (rc != 0) {
+            g_debug("%s: Cannot copy content of metalink file", __func__);
+            g_set_error(err, LR_YUM_ERROR, LRE_IO,
+                    "Cannot copy content of metalink file %s: %s",
+                    ml_file_path, strerror(errno));
+            lr_free(ml_file_path);
+            return FALSE;
         }
+        repo->metalink = ml_file_path;
+    }
 
-        /* Prepare repomd.xml file */
-        path = lr_pathconcat(handle->destdir, "/repodata/repomd.xml", NULL);
-        fd = open(path, O_CREAT|O_TRUNC|O_RDWR, 0666);
-        if (fd == -1) {
+    /* Previous version of repomd.xml to find the changed records */
+    r->old_repomd = lr_yum_load_old_repomd(handle);
+
+    /* Prepare repomd.xml file */
+    r->path = lr_pathconcat(handle->destdir, "/repodata/repomd.xml", NULL);
+
+    /* Prepare repomd.xml.asc file, it is downloaded together
+     * with the repomd.xml */
+    if (handle->checks & LR_CHECK_GPG) {
+        r->signature = lr_pathconcat(handle->destdir,
+                                     "repodata/repomd.xml.asc", NULL);
+        r->fd_sig = open(r->signature, O_CREAT|O_TRUNC|O_RDWR, 0666);
+        if (r->fd_sig == -1) {
+            g_debug("%s: Cannot open: %s", __func__, r->signature);
             g_set_error(err, LR_YUM_ERROR, LRE_IO,
-                        "Cannot open %s: %s", path, strerror(errno));
-            lr_free(path);
+                        "Cannot open %s: %s", r->signature, strerror(errno));
             return FALSE;
         }
+    }
 
-        /* Download repomd.xml */
-        ret = lr_yum_download_repomd(handle, handle->metalink, fd, err);
-        if (!ret) {
-            close(fd);
-            lr_free(path);
+    if (handle->conditionalget
+        && lr_yum_load_validators(r->path, &r->validators))
+    {
+        // Local copy out of sync with the metalink is not worth
+        // a conditional request
+        r->conditional = lr_yum_local_repomd_matches_metalink(handle->metalink,
+                                                              r->path);
+        if (!r->conditional) {
+            g_debug("%s: Local repomd.xml doesn't match the metalink",
+                    __func__);
+            lr_yum_clear_validators(&r->validators);
+        }
+    }
+
+    if (r->conditional) {
+        /* Download repomd.xml if it was modified. The new content is
+         * downloaded to a temporary file which replaces the local copy */
+        r->tmp_path = g_strconcat(r->path, ".part", NULL);
+        r->fd = open(r->tmp_path, O_CREAT|O_TRUNC|O_RDWR, 0666);
+        if (r->fd == -1) {
+            g_set_error(err, LR_YUM_ERROR, LRE_IO,
+                        "Cannot open %s: %s", r->tmp_path, strerror(errno));
+            return FALSE;
+        }
+    } else {
+        r->fd = open(r->path, O_CREAT|O_TRUNC|O_RDWR, 0666);
+        if (r->fd == -1) {
+            g_set_error(err, LR_YUM_ERROR, LRE_IO,
+                        "Cannot open %s: %s", r->path, strerror(errno));
             return FALSE;
         }
+    }
 
-        /* Check repomd.xml.asc if available.
-         * Try to download and verify GPG signature (repomd.xml.asc).
-         * Try to download only from the mirror where repomd.xml iself was
-         * downloaded. It is because most of yum repositories are not signed
-         * and try every mirror for signature is non effective.
-         * Every mirror would be tried because mirrorded_download function have
-         * no clue if 404 for repomd.xml.asc means that no signature exists or
-         * it is just error on the mirror and should try the next one.
-         **/
-        if (handle->checks & LR_CHECK_GPG) {
-            int fd_sig;
-            char *url, *signature;
+    lr_yum_remote_repomd_targets(r);
+    return TRUE;
+}
 
-            signature = lr_pathconcat(handle->destdir, "repodata/repomd.xml.asc", NULL);
-            fd_sig = open(signature, O_CREAT|O_TRUNC|O_RDWR, 0666);
-            if (fd_sig == -1) {
-                g_debug("%s: Cannot open: %s", __func__, signature);
-                g_set_error(err, LR_YUM_ERROR, LRE_IO,
-                            "Cannot open %s: %s", signature, strerror(errno));
-                close(fd);
-                lr_free(path);
-                lr_free(signature);
-                return FALSE;
-            }
+/** Evaluate the download of repomd.xml and prepare the verification
+ * of its GPG signature (see lr_yum_remote_repomd_finish()).
+ */
+static gboolean
+lr_yum_remote_repomd_check(LrYumRemote *r, GError **err)
+{
+    gboolean ret;
+    LrHandle *handle = r->handle;
+    LrYumRepo *repo = r->result->yum_repo;
+    GError *sig_err = NULL;
 
-            url = lr_pathconcat(handle->used_mirror, "repodata/repomd.xml.asc", NULL);
-            ret = lr_download_url(handle, url, fd_sig, &tmp_err);
-            lr_free(url);
-            close(fd_sig);
-            if (!ret) {
-                // Signature doesn't exist
-                g_debug("%s: GPG signature doesn't exists: %s",
-                        __func__, tmp_err->message);
-                g_set_error(err, LR_YUM_ERROR, LRE_BADGPG,
-                            "GPG verification is enabled, but GPG signature "
-                            "repomd.xml.asc is not available: %s", tmp_err->message);
-                g_clear_error(&tmp_err);
-                unlink(signature);
-                lr_free(signature);
-                return FALSE;
-            } else {
-                // Signature downloaded
-                repo->signature = g_strdup(signature);
-                ret = lr_gpg_check_signature(signature,
-                                             path,
-                                             handle->gnupghomedir,
-                                             &tmp_err);
-                if (!ret) {
-                    g_debug("%s: GPG signature verification failed: %s",
-                            __func__, tmp_err->message);
-                    g_propagate_prefixed_error(err, tmp_err,
-                            "repomd.xml GPG signature verification error: ");
-                    close(fd);
-                    lr_free(path);
-                    lr_free(signature);
-                    return FALSE;
-                }
-                g_debug("%s: GPG signature successfully verified", __func__);
-            }
-        }
+    ret = lr_yum_remote_repomd_downloaded(r, &sig_err, err);
 
-        lseek(fd, 0, SEEK_SET);
+    if (ret && handle->conditionalget)
+        lr_yum_store_validators(r->path, &r->validators);
+    if (r->fd_sig != -1) {
+        close(r->fd_sig);
+        r->fd_sig = -1;
+    }
+    if (!ret) {
+        g_clear_error(&sig_err);
+        if (r->signature)
+            unlink(r->signature);
+        return FALSE;
+    }
 
-        /* Parse repomd */
-        g_debug("%s: Parsing repomd.xml", __func__);
-        ret = lr_yum_repomd_parse_file(repomd, fd, lr_xml_parser_warning_logger,
-                                       "Repomd xml parser", &tmp_err);
-        close(fd);
-        if (!ret) {
-            g_debug("%s: Parsing unsuccessful: %s", __func__, tmp_err->message);
-            g_propagate_prefixed_error(err, tmp_err,
-                                       "repomd.xml parser error: ");
-            lr_free(path);
+    /* Verify GPG signature (repomd.xml.asc) */
+    if (handle->checks & LR_CHECK_GPG) {
+        if (sig_err) {
+            // Signature doesn't exist
+            g_debug("%s: GPG signature doesn't exists: %s",
+                    __func__, sig_err->message);
+            g_set_error(err, LR_YUM_ERROR, LRE_BADGPG,
+                        "GPG verification is enabled, but GPG signature "
+                        "repomd.xml.asc is not available: %s", sig_err->message);
+            g_clear_error(&sig_err);
+            unlink(r->signature);
             return FALSE;
+        } else {
+            // Signature downloaded, verified with the other repositories
+            repo->signature = g_strdup(r->signature);
+            r->gpgcheck = TRUE;
+            r->gpg_job.signature_fn = r->signature;
+            r->gpg_job.data_fn = r->path;
+            r->gpg_job.home_dir = handle->gnupghomedir;
+            r->gpg_job.backend = handle->gpgbackend;
         }
+    }
 
-        /* Fill result object */
-        result->destdir = g_strdup(handle->destdir);
-        repo->destdir = g_strdup(handle->destdir);
-        repo->repomd = path;
-        if (handle->used_mirror)
-            repo->url = g_strdup(handle->used_mirror);
-        else
-            repo->url = g_strdup(handle->urls[0]);
+    g_clear_error(&sig_err);
+    return TRUE;
+}
+
+/** Check the result of the GPG verification, parse the downloaded
+ * repomd.xml and fill the result.
+ */
+static gboolean
+lr_yum_remote_repomd_finish(LrYumRemote *r, GError **err)
+{
+    gboolean ret;
+    LrHandle *handle = r->handle;
+    LrResult *result = r->result;
+    LrYumRepo *repo = result->yum_repo;
+    LrYumRepoMd *repomd = result->yum_repomd;
+    GError *tmp_err = NULL;
 
-        g_debug("%s: Repomd revision: %s", repomd->revision, __func__);
+    if (r->gpgcheck) {
+        if (!r->gpg_job.valid) {
+            g_debug("%s: GPG signature verification failed: %s",
+                    __func__, r->gpg_job.error->message);
+            g_propagate_prefixed_error(err, r->gpg_job.error,
+                    "repomd.xml GPG signature verification error: ");
+            r->gpg_job.error = NULL;
+            return FALSE;
+        }
+        g_debug("%s: GPG signature successfully verified", __func__);
     }
 
-    /* Download rest of metadata files */
-    ret = lr_yum_download_repo(handle, repo, repomd, &tmp_err);
-    assert((ret && !tmp_err) || (!ret && tmp_err));
+    lseek(r->fd, 0, SEEK_SET);
 
+    /* Parse repomd */
+    g_debug("%s: Parsing repomd.xml", __func__);
+    ret = lr_yum_repomd_parse_file(repomd, r->fd, lr_xml_parser_warning_logger,
+                                   "Repomd xml parser", &tmp_err);
+    if (ret && handle->parsecache)
+        lr_parsecache_store_repomd(repomd, r->path, r->fd);
+    close(r->fd);
+    r->fd = -1;
     if (!ret) {
-        g_debug("%s: Repository download error: %s", __func__, tmp_err->message);
-        g_propagate_prefixed_error(err, tmp_err, "Yum repo downloading error: ");
+        g_debug("%s: Parsing unsuccessful: %s", __func__, tmp_err->message);
+        g_propagate_prefixed_error(err, tmp_err,
+                                   "repomd.xml parser error: ");
         return FALSE;
     }
 
+    if (r->old_repomd) {
+        lr_yum_repomd_diff_free(result->yum_repomd_diff);
+        result->yum_repomd_diff = lr_yum_repomd_diff(r->old_repomd, repomd);
+        g_debug("%s: Records added: %u, removed: %u, changed: %u", __func__,
+                g_slist_length(result->yum_repomd_diff->added),
+                g_slist_length(result->yum_repomd_diff->removed),
+                g_slist_length(result->yum_repomd_diff->changed));
+    }
+
+    /* Fill result object */
+    result->destdir = g_strdup(handle->destdir);
+    repo->destdir = g_strdup(handle->destdir);
+    repo->repomd = r->path;
+    r->path = NULL;
+    if (handle->used_mirror)
+        repo->url = g_strdup(handle->used_mirror);
+    else
+        repo->url = g_strdup(handle->urls[0]);
+
+    g_debug("%s: Repomd revision: %s", repomd->revision, __func__);
     return TRUE;
 }
 
-gboolean
-lr_yum_perform(LrHandle *handle, LrResult *result, GError **err)
+/** Set the error of the whole download to the remote.
+ */
+static void
+lr_yum_remote_set_error(LrYumRemote *r, const GError *err, const char *prefix)
 {
-    int ret = TRUE;
-    LrYumRepo *repo;
-    LrYumRepoMd *repomd;
+    GError *tmp_err = g_error_copy(err);
+    g_propagate_prefixed_error(&r->err, tmp_err, "%s", prefix);
+}
+
+/** Download the remote repositories, every stage of all the repositories
+ * is done by a single download (the targets share the mirrors and the
+ * connection limits). Errors are stored to the remotes.
+ */
+static void
+lr_yum_download_remotes(LrYumRemote *remotes, guint count)
+{
+    gboolean ret;
+    gboolean callbacks = FALSE;
+    GSList *targets = NULL;
+    GError *tmp_err = NULL;
+
+    // repomd.xml (and repomd.xml.asc) of all the repositories
+
+    for (guint i = 0; i < count; i++) {
+        LrYumRemote *r = &remotes[i];
+        if (!lr_yum_remote_prepare(r, &r->err))
+            continue;
+        if (r->sig_target)
+            targets = g_slist_prepend(targets, r->sig_target);
+        if (r->target)
+            targets = g_slist_prepend(targets, r->target);
+    }
+
+    if (targets) {
+        targets = g_slist_reverse(targets);
+        ret = lr_download(targets, FALSE, &tmp_err);
+        assert((ret && !tmp_err) || (!ret && tmp_err));
+        g_slist_free(targets);
+        targets = NULL;
+
+        for (guint i = 0; i < count; i++) {
+            LrYumRemote *r = &remotes[i];
+            if (r->err || !r->target)
+                continue;
+            if (tmp_err) {
+                if (r->signature)
+                    unlink(r->signature);
+                lr_yum_remote_set_error(r, tmp_err,
+                                        "Cannot download repomd.xml: ");
+            } else if (lr_yum_remote_repomd_check(r, &r->err)
+                       && r->gpgcheck) {
+                targets = g_slist_prepend(targets, &r->gpg_job);
+            }
+        }
+        g_clear_error(&tmp_err);
+
+        // GPG signatures of all the repositories are verified in parallel
+        gint64 start = g_get_monotonic_time();
+        lr_gpg_check_signatures(targets, 0);
+        gint64 end = g_get_monotonic_time();
+        g_slist_free(targets);
+        targets = NULL;
+
+        for (guint i = 0; i < count; i++) {
+            LrYumRemote *r = &remotes[i];
+            if (r->err || !r->target || !r->gpgcheck)
+                continue;
+            lr_trace_span(r->handle->trace, "gpg", "gpg check", start, end,
+                          "signature", r->signature,
+                          "error", r->gpg_job.valid ? NULL
+                                                    : r->gpg_job.error->message,
+                          NULL);
+        }
+
+        for (guint i = 0; i < count; i++) {
+            LrYumRemote *r = &remotes[i];
+            if (r->err || !r->target)
+                continue;
+            lr_yum_remote_repomd_finish(r, &r->err);
+        }
+    }
+
+    // Records of all the repositories
+
+    for (guint i = 0; i < count; i++) {
+        LrYumRemote *r = &remotes[i];
+        if (r->err)
+            continue;
+        if (!lr_yum_prepare_repo_targets(r->handle,
+                                         r->result->yum_repo,
+                                         r->result->yum_repomd,
+                                         r->old_repomd
+                                            ? r->result->yum_repomd_diff
+                                            : NULL,
+                                         &r->records,
+                                         &tmp_err)) {
+            g_debug("%s: Repository download error: %s",
+                    __func__, tmp_err->message);
+            g_propagate_prefixed_error(&r->err, tmp_err,
+                                       "Yum repo downloading error: ");
+            tmp_err = NULL;
+            continue;
+        }
+        targets = g_slist_concat(targets, g_slist_copy(r->records.targets));
+        if (r->records.cbdata_list)
+            callbacks = TRUE;
+    }
+
+    ret = TRUE;
+    if (targets) {
+        ret = lr_download_single_cb(targets,
+                                    FALSE,
+                                    (callbacks) ? progresscb : NULL,
+                                    (callbacks) ? hmfcb : NULL,
+                                    &tmp_err);
+        assert((ret && !tmp_err) || (!ret && tmp_err));
+        g_slist_free(targets);
+    }
+
+    for (guint i = 0; i < count; i++) {
+        LrYumRemote *r = &remotes[i];
+        if (r->err)
+            continue;
+        GError *rec_err = NULL;
+        if (!lr_yum_finish_repo_targets(&r->records, tmp_err, &rec_err)) {
+            g_debug("%s: Repository download error: %s",
+                    __func__, rec_err->message);
+            g_propagate_prefixed_error(&r->err, rec_err,
+                                       "Yum repo downloading error: ");
+        }
+    }
+    g_clear_error(&tmp_err);
+}
+
+static gboolean
+lr_yum_download_remote(LrHandle *handle, LrResult *result, GError **err)
+{
+    gboolean ret = TRUE;
+    LrYumRemote remote;
+
+    assert(!err || *err == NULL);
 
+    lr_yum_remote_init(&remote, handle, result);
+    lr_yum_download_remotes(&remote, 1);
+    if (remote.err) {
+        g_propagate_error(err, remote.err);
+        remote.err = NULL;
+        ret = FALSE;
+    }
+    lr_yum_remote_clear(&remote);
+
+    return ret;
+}
+
+/** Check the handle and prepare the result for lr_yum_perform().
+ */
+static gboolean
+lr_yum_prepare_result(LrHandle *handle, LrResult *result, GError **err)
+{
     assert(handle);
     assert(!err || *err == NULL);
 
@@ -961,6 +2151,22 @@ lr_yum_perform(LrHandle *handle, LrResult *result, GError **err)
         result->yum_repomd = lr_yum_repomd_init();
     }
 
+    return TRUE;
+}
+
+gboolean
+lr_yum_perform(LrHandle *handle, LrResult *result, GError **err)
+{
+    int ret = TRUE;
+    LrYumRepo *repo;
+    LrYumRepoMd *repomd;
+
+    assert(handle);
+    assert(!err || *err == NULL);
+
+    if (!lr_yum_prepare_result(handle, result, err))
+        return FALSE;
+
     repo   = result->yum_repo;
     repomd = result->yum_repomd;
 
@@ -972,7 +2178,7 @@ lr_yum_perform(LrHandle *handle, LrResult *result, GError **err)
             return FALSE;
 
         if (handle->checks & LR_CHECK_CHECKSUM)
-            ret = lr_yum_check_repo_checksums(repo, repomd, err);
+            ret = lr_yum_check_repo_checksums(handle, repo, repomd, err);
     } else {
         // Download remote/Duplicate local repository
         // Note: All checksums are checked while downloading
@@ -982,3 +2188,43 @@ lr_yum_perform(LrHandle *handle, LrResult *result, GError **err)
 
     return ret;
 }
+
+void
+lr_yum_perform_many(LrHandle **handles,
+                    LrResult **results,
+                    GError **errors,
+                    guint count)
+{
+    guint n = 0;
+    LrYumRemote *remotes = g_new0(LrYumRemote, count);
+    guint *indexes = g_new0(guint, count);
+
+    for (guint i = 0; i < count; i++) {
+        assert(!errors[i]);
+
+        if (handles[i]->local) {
+            // Local repositories don't download anything
+            lr_yum_perform(handles[i], results[i], &errors[i]);
+            continue;
+        }
+
+        if (!lr_yum_prepare_result(handles[i], results[i], &errors[i]))
+            continue;
+
+        lr_yum_remote_init(&remotes[n], handles[i], results[i]);
+        indexes[n] = i;
+        n++;
+    }
+
+    if (n > 0)
+        lr_yum_download_remotes(remotes, n);
+
+    for (guint i = 0; i < n; i++) {
+        errors[indexes[i]] = remotes[i].err;
+        remotes[i].err = NULL;
+        lr_yum_remote_clear(&remotes[i]);
+    }
+
+    g_free(indexes);
+    g_free(remotes);
+}
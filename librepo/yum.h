@@ -50,6 +50,11 @@ typedef struct {
                              was enabled during repo downloading) */
     char *mirrorlist;   /*!< Mirrolist filename */
     char *metalink;     /*!< Metalink filename */
+    GHashTable *paths_index; /*!< ::LrYumRepoPath*s from the paths
+                                  keyed by the type (internal) */
+    GHashTable *unverified;  /*!< Expected checksums of the paths which
+                                  were not verified yet keyed by the type
+                                  (internal, see LRO_LAZYCHECKSUM) */
 } LrYumRepo;
 
 /** Allocate new yum repo object.
@@ -72,6 +77,18 @@ lr_yum_repo_free(LrYumRepo *repo);
 const char *
 lr_yum_repo_path(LrYumRepo *repo, const char *type);
 
+/** Returns path for the file from repository, the checksum of the file
+ * is verified first if it wasn't verified during the lr_handle_perform()
+ * (see LRO_LAZYCHECKSUM). The file is verified only once.
+ * @param repo          Yum repo object.
+ * @param type          Type of path. E.g. "primary", "filelists", ...
+ * @param err           GError **
+ * @return              Path or NULL (err is set if the verification
+ *                      failed).
+ */
+const char *
+lr_yum_repo_path_verified(LrYumRepo *repo, const char *type, GError **err);
+
 /** @} */
 
 G_END_DECLS
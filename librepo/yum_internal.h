@@ -32,6 +32,21 @@ G_BEGIN_DECLS
 gboolean
 lr_yum_perform(LrHandle *handle, LrResult *result, GError **err);
 
+/** Download/locate yum repositories of several handles together.
+ * Every stage of the download (repomd.xml, metadata records) of all
+ * the remote repositories is done by a single lr_download().
+ * @param handles   Array of the handles
+ * @param results   Array of the results (the same order as the handles)
+ * @param errors    Array of NULL errors, the error of every failed
+ *                  repository is set to its item
+ * @param count     Number of the handles
+ */
+void
+lr_yum_perform_many(LrHandle **handles,
+                    LrResult **results,
+                    GError **errors,
+                    guint count);
+
 G_END_DECLS
 
 #endif
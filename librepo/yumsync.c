@@ -0,0 +1,512 @@
+/* librepo - A library providing (libcURL like) API to downloading repository
+ * Copyright (C) 2014  Tomas Mlcoch
+ *
+ * Licensed under the GNU Lesser General Public License Version 2.1
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#define _GNU_SOURCE         // Because of renameat2()
+
+#include <glib.h>
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include "rcodes.h"
+#include "util.h"
+#include "checksum_internal.h"
+#include "decompressor.h"
+#include "handle_internal.h"
+#include "package_downloader.h"
+#include "primary.h"
+#include "result.h"
+#include "yum.h"
+#include "yumsync.h"
+#include "cleanup.h"
+
+/** Package of the repository which has to be checked or downloaded */
+typedef struct {
+    char *href;             /*!< Location href (relative path in the mirror) */
+    char *base;             /*!< Location base or NULL */
+    char *dest;             /*!< Path of the package in the mirror */
+    LrChecksumType type;    /*!< Checksum type */
+    char *checksum;         /*!< Checksum or NULL */
+    gint64 size;            /*!< Size or -1 */
+} LrYumSyncPackage;
+
+/** Data of the primary parsing */
+typedef struct {
+    const char *dir;        /*!< Directory of the mirror */
+    gboolean index;         /*!< Use the sidecar checksum index */
+    GHashTable *wanted;     /*!< Hrefs of all packages of the repository */
+    GSList *jobs;           /*!< LrChecksumJobs of the present packages */
+    GSList *missing;        /*!< LrYumSyncPackages to download */
+    LrYumSyncStats *stats;  /*!< Statistics */
+    GError *err;            /*!< Error set by the package callback */
+} LrYumSyncData;
+
+static void
+lr_yum_sync_package_free(LrYumSyncPackage *package)
+{
+    if (!package)
+        return;
+    g_free(package->href);
+    g_free(package->base);
+    g_free(package->dest);
+    g_free(package->checksum);
+    lr_free(package);
+}
+
+/** Return TRUE if the href is a relative path which stays inside
+ * of the mirror.
+ */
+static gboolean
+lr_yum_sync_href_is_safe(const char *href)
+{
+    _cleanup_strv_free_ gchar **parts = NULL;
+
+    if (!*href || g_path_is_absolute(href))
+        return FALSE;
+
+    parts = g_strsplit(href, "/", 0);
+    for (gchar **part = parts; *part; part++)
+        if (!strcmp(*part, ".."))
+            return FALSE;
+
+    return TRUE;
+}
+
+static int
+lr_yum_sync_package_cb(const LrYumPackage *pkg, void *cbdata)
+{
+    LrYumSyncData *data = cbdata;
+    LrYumSyncPackage *package;
+    struct stat st;
+
+    if (!lr_yum_sync_href_is_safe(pkg->location_href)) {
+        g_set_error(&data->err, LR_YUM_ERROR, LRE_BADURL,
+                    "Location of a package points outside of the "
+                    "repository: %s", pkg->location_href);
+        return LR_CB_ERROR;
+    }
+
+    if (g_hash_table_contains(data->wanted, pkg->location_href))
+        return LR_CB_OK;  // Duplicated package
+    g_hash_table_add(data->wanted, g_strdup(pkg->location_href));
+    data->stats->packages++;
+
+    package = lr_malloc0(sizeof(*package));
+    package->href     = g_strdup(pkg->location_href);
+    package->base     = g_strdup(pkg->location_base);
+    package->dest     = g_build_filename(data->dir, pkg->location_href, NULL);
+    package->type     = pkg->checksum_type ? lr_checksum_type(pkg->checksum_type)
+                                           : LR_CHECKSUM_UNKNOWN;
+    package->checksum = g_strdup(pkg->checksum);
+    package->size     = pkg->size;
+
+    if (stat(package->dest, &st) != 0 || !S_ISREG(st.st_mode)
+        || (package->size >= 0 && st.st_size != package->size)) {
+        // Missing or changed for sure
+        data->missing = g_slist_prepend(data->missing, package);
+        return LR_CB_OK;
+    }
+
+    if (package->type == LR_CHECKSUM_UNKNOWN || !package->checksum) {
+        // Nothing more to compare
+        data->stats->unchanged++;
+        lr_yum_sync_package_free(package);
+        return LR_CB_OK;
+    }
+
+    LrChecksumJob *job = lr_malloc0(sizeof(*job));
+    job->path       = package->dest;
+    job->type       = package->type;
+    job->expected   = package->checksum;
+    job->caching    = TRUE;
+    job->index      = data->index;
+    job->userdata   = package;
+    data->jobs = g_slist_prepend(data->jobs, job);
+
+    return LR_CB_OK;
+}
+
+static gboolean
+lr_yum_sync_checksum_job_cb(G_GNUC_UNUSED LrChecksumJob *job,
+                            G_GNUC_UNUSED void *cbdata)
+{
+    return TRUE;
+}
+
+/** Parse the primary metadata and find the packages to download.
+ */
+static gboolean
+lr_yum_sync_parse_primary(const char *path,
+                          LrYumSyncData *data,
+                          GError **err)
+{
+    gboolean ret;
+    int fd, primary_fd;
+    GError *tmp_err = NULL;
+
+    fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        g_set_error(err, LR_YUM_ERROR, LRE_IO,
+                    "Cannot open %s: %s", path, g_strerror(errno));
+        return FALSE;
+    }
+
+    primary_fd = lr_gettmpfile();
+    if (primary_fd < 0) {
+        close(fd);
+        g_set_error(err, LR_YUM_ERROR, LRE_CANNOTCREATETMP,
+                    "Cannot create a temporary file");
+        return FALSE;
+    }
+
+    ret = lr_decompress_fd(fd, primary_fd, err);
+    close(fd);
+    if (ret && lseek(primary_fd, 0, SEEK_SET) == -1) {
+        g_set_error(err, LR_YUM_ERROR, LRE_IO,
+                    "lseek: %s", g_strerror(errno));
+        ret = FALSE;
+    }
+
+    if (ret) {
+        ret = lr_yum_primary_parse_file(primary_fd, lr_yum_sync_package_cb,
+                                        data, NULL, NULL, &tmp_err);
+        if (data->err) {
+            // The error of the callback is more descriptive
+            g_clear_error(&tmp_err);
+            g_propagate_error(err, data->err);
+            data->err = NULL;
+        } else if (tmp_err) {
+            g_propagate_error(err, tmp_err);
+        }
+    }
+
+    close(primary_fd);
+    return ret;
+}
+
+/** Download the missing and changed packages.
+ */
+static gboolean
+lr_yum_sync_download(LrHandle *handle,
+                     LrYumSyncData *data,
+                     GError **err)
+{
+    gboolean ret = TRUE;
+    GSList *targets = NULL;
+    GError *tmp_err = NULL;
+
+    for (GSList *elem = data->missing; elem; elem = g_slist_next(elem)) {
+        LrYumSyncPackage *package = elem->data;
+        _cleanup_free_ gchar *parent = g_path_get_dirname(package->dest);
+
+        if (g_mkdir_with_parents(parent, 0755) == -1) {
+            g_set_error(err, LR_YUM_ERROR, LRE_CANNOTCREATEDIR,
+                        "Cannot create %s: %s", parent, g_strerror(errno));
+            ret = FALSE;
+            break;
+        }
+
+        LrPackageTarget *target = lr_packagetarget_new_v4(
+                                        handle, package->href, package->dest,
+                                        package->type, package->checksum,
+                                        package->size, package->base,
+                                        FALSE, NULL, NULL, NULL, NULL,
+                                        0, 0, 0, &tmp_err);
+        if (!target) {
+            g_propagate_error(err, tmp_err);
+            ret = FALSE;
+            break;
+        }
+        targets = g_slist_prepend(targets, target);
+    }
+
+    if (ret && targets) {
+        targets = g_slist_reverse(targets);
+        ret = lr_download_packages(targets, 0, err);
+    }
+
+    if (ret) {
+        for (GSList *elem = targets; elem; elem = g_slist_next(elem)) {
+            LrPackageTarget *target = elem->data;
+            if (target->err) {
+                g_set_error(err, LR_YUM_ERROR, LRE_INCOMPLETEREPO,
+                            "Cannot download %s: %s",
+                            target->relative_url, target->err);
+                ret = FALSE;
+                break;
+            }
+            data->stats->downloaded++;
+        }
+    }
+
+    g_slist_free_full(targets, (GDestroyNotify) lr_packagetarget_free);
+    return ret;
+}
+
+/** Replace the repodata/ of the mirror by the repodata/ of the staging
+ * directory. The old repodata/ is moved to the staging directory.
+ */
+static gboolean
+lr_yum_sync_swap_repodata(const char *dir,
+                          const char *staging,
+                          GError **err)
+{
+    _cleanup_free_ gchar *repodata = g_build_filename(dir, "repodata", NULL);
+    _cleanup_free_ gchar *new_repodata = g_build_filename(staging,
+                                                          "repodata", NULL);
+    _cleanup_free_ gchar *old_repodata = g_build_filename(staging,
+                                                          "repodata.old",
+                                                          NULL);
+
+#ifdef RENAME_EXCHANGE
+    if (renameat2(AT_FDCWD, new_repodata, AT_FDCWD, repodata,
+                  RENAME_EXCHANGE) == 0)
+        return TRUE;
+    g_debug("%s: Cannot exchange %s and %s: %s (falling back to rename)",
+            __func__, new_repodata, repodata, g_strerror(errno));
+#endif
+
+    if (rename(repodata, old_repodata) == -1 && errno != ENOENT) {
+        g_set_error(err, LR_YUM_ERROR, LRE_IO,
+                    "Cannot move %s: %s", repodata, g_strerror(errno));
+        return FALSE;
+    }
+
+    if (rename(new_repodata, repodata) == -1) {
+        g_set_error(err, LR_YUM_ERROR, LRE_IO,
+                    "Cannot move %s to %s: %s", new_repodata, repodata,
+                    g_strerror(errno));
+        rename(old_repodata, repodata);
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+/** Remove the packages of the mirror which are not wanted anymore.
+ * @param dir       Directory of the mirror
+ * @param relpath   Path of the currently walked subdirectory relative
+ *                  to the mirror or NULL for the mirror itself
+ */
+static void
+lr_yum_sync_remove_stale(const char *dir,
+                         const char *relpath,
+                         GHashTable *wanted,
+                         LrYumSyncStats *stats)
+{
+    _cleanup_free_ gchar *path = NULL;
+    GDir *gdir;
+    const gchar *name;
+
+    path = relpath ? g_build_filename(dir, relpath, NULL) : g_strdup(dir);
+    gdir = g_dir_open(path, 0, NULL);
+    if (!gdir)
+        return;
+
+    while ((name = g_dir_read_name(gdir))) {
+        _cleanup_free_ gchar *rel = NULL;
+        _cleanup_free_ gchar *full = NULL;
+
+        if (!relpath && (!strcmp(name, "repodata")
+                         || g_str_has_prefix(name, LR_YUMSYNC_STAGING_PREFIX)))
+            continue;
+
+        rel = relpath ? g_strconcat(relpath, "/", name, NULL) : g_strdup(name);
+        full = g_build_filename(dir, rel, NULL);
+
+        if (g_file_test(full, G_FILE_TEST_IS_DIR)
+            && !g_file_test(full, G_FILE_TEST_IS_SYMLINK)) {
+            lr_yum_sync_remove_stale(dir, rel, wanted, stats);
+            continue;
+        }
+
+        if (!g_str_has_suffix(name, ".rpm")
+            || g_hash_table_contains(wanted, rel))
+            continue;
+
+        if (unlink(full) == -1) {
+            g_debug("%s: Cannot remove %s: %s", __func__, full,
+                    g_strerror(errno));
+            continue;
+        }
+
+        g_debug("%s: Removed stale package %s", __func__, rel);
+        stats->removed++;
+    }
+
+    g_dir_close(gdir);
+}
+
+/** Download the metadata to the staging directory.
+ * The options of the handle are restored afterwards.
+ */
+static LrResult *
+lr_yum_sync_perform(LrHandle *handle,
+                    const char *dir,
+                    const char *staging,
+                    GError **err)
+{
+    gboolean ret;
+    LrResult *result = lr_result_init();
+    _cleanup_free_ gchar *destdir = g_strdup(handle->destdir);
+    _cleanup_free_ gchar *yumreusedir = g_strdup(handle->yumreusedir);
+    long update = handle->update;
+
+    ret = lr_handle_setopt(handle, err, LRO_DESTDIR, staging)
+          && lr_handle_setopt(handle, err, LRO_UPDATE, 0L)
+          && lr_handle_setopt(handle, err, LRO_YUMREUSEDIR, dir)
+          && lr_handle_perform(handle, result, err);
+
+    lr_handle_setopt(handle, NULL, LRO_DESTDIR, destdir);
+    lr_handle_setopt(handle, NULL, LRO_UPDATE, update);
+    lr_handle_setopt(handle, NULL, LRO_YUMREUSEDIR, yumreusedir);
+
+    if (!ret) {
+        lr_result_free(result);
+        return NULL;
+    }
+
+    return result;
+}
+
+gboolean
+lr_yum_sync(LrHandle *handle,
+            const char *dir,
+            LrYumSyncFlag flags,
+            LrYumSyncStats *stats,
+            GError **err)
+{
+    gboolean ret;
+    LrResult *result = NULL;
+    LrYumRepo *repo = NULL;
+    const char *primary;
+    LrYumSyncStats tmp_stats = {0};
+    LrYumSyncData data = {0};
+    _cleanup_free_ gchar *staging = NULL;
+
+    assert(handle);
+    assert(dir);
+    assert(!err || *err == NULL);
+
+    if (handle->local) {
+        g_set_error(err, LR_YUM_ERROR, LRE_NOTLOCAL,
+                    "Local repositories cannot be synchronized");
+        return FALSE;
+    }
+
+    if (handle->repotype != LR_YUMREPO) {
+        g_set_error(err, LR_YUM_ERROR, LRE_BADOPTARG,
+                    "Only yum repositories can be synchronized");
+        return FALSE;
+    }
+
+    if (g_mkdir_with_parents(dir, 0755) == -1) {
+        g_set_error(err, LR_YUM_ERROR, LRE_CANNOTCREATEDIR,
+                    "Cannot create %s: %s", dir, g_strerror(errno));
+        return FALSE;
+    }
+
+    staging = g_build_filename(dir, LR_YUMSYNC_STAGING_PREFIX "XXXXXX", NULL);
+    if (!g_mkdtemp(staging)) {
+        g_set_error(err, LR_YUM_ERROR, LRE_CANNOTCREATEDIR,
+                    "Cannot create %s: %s", staging, g_strerror(errno));
+        return FALSE;
+    }
+
+    data.dir    = dir;
+    data.index  = handle->checksumindex;
+    data.wanted = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+    data.stats  = stats ? stats : &tmp_stats;
+    memset(data.stats, 0, sizeof(*data.stats));
+
+    // Metadata
+
+    result = lr_yum_sync_perform(handle, dir, staging, err);
+    ret = result && lr_result_getinfo(result, err, LRR_YUM_REPO, &repo);
+
+    if (ret) {
+        primary = lr_yum_repo_path_verified(repo, "primary", err);
+        if (!primary) {
+            if (err && !*err)
+                g_set_error(err, LR_YUM_ERROR, LRE_INCOMPLETEREPO,
+                            "Primary metadata were not downloaded");
+            ret = FALSE;
+        }
+    }
+
+    // Packages
+
+    if (ret)
+        ret = lr_yum_sync_parse_primary(primary, &data, err);
+
+    if (ret && data.jobs) {
+        data.jobs = g_slist_reverse(data.jobs);
+        lr_checksum_verify_files(data.jobs,
+                                 (guint) handle->checksumthreads,
+                                 lr_yum_sync_checksum_job_cb,
+                                 NULL);
+    }
+
+    for (GSList *elem = data.jobs; elem; elem = g_slist_next(elem)) {
+        LrChecksumJob *job = elem->data;
+        LrYumSyncPackage *package = job->userdata;
+
+        if (ret && job->matches) {
+            data.stats->unchanged++;
+            lr_yum_sync_package_free(package);
+        } else {
+            data.missing = g_slist_prepend(data.missing, package);
+        }
+        g_clear_error(&job->error);
+        lr_free(job);
+    }
+    g_slist_free(data.jobs);
+
+    data.missing = g_slist_reverse(data.missing);
+    g_debug("%s: %"G_GINT64_FORMAT" packages, %"G_GINT64_FORMAT" unchanged, "
+            "%u to download", __func__, data.stats->packages,
+            data.stats->unchanged, g_slist_length(data.missing));
+
+    if (ret)
+        ret = lr_yum_sync_download(handle, &data, err);
+
+    // Switch to the new metadata
+
+    if (ret)
+        ret = lr_yum_sync_swap_repodata(dir, staging, err);
+
+    if (ret && (flags & LR_YUMSYNC_DELETE))
+        lr_yum_sync_remove_stale(dir, NULL, data.wanted, data.stats);
+
+    // Clean up
+
+    g_slist_free_full(data.missing, (GDestroyNotify) lr_yum_sync_package_free);
+    g_hash_table_destroy(data.wanted);
+    lr_result_free(result);
+    lr_remove_dir(staging);
+
+    return ret;
+}
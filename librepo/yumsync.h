@@ -0,0 +1,92 @@
+/* librepo - A library providing (libcURL like) API to downloading repository
+ * Copyright (C) 2014  Tomas Mlcoch
+ *
+ * Licensed under the GNU Lesser General Public License Version 2.1
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#ifndef __LR_YUMSYNC_H__
+#define __LR_YUMSYNC_H__
+
+#include <glib.h>
+
+#include "handle.h"
+
+G_BEGIN_DECLS
+
+/** \defgroup   yumsync   Incremental mirroring of yum repositories
+ *  \addtogroup yumsync
+ *  @{
+ */
+
+/** Prefix of the staging directory created inside of the mirror */
+#define LR_YUMSYNC_STAGING_PREFIX   ".librepo-sync-"
+
+/** Flags for ::lr_yum_sync */
+typedef enum {
+    LR_YUMSYNC_DEFAULT  = 0, /*!<
+        Only download the new and changed packages */
+    LR_YUMSYNC_DELETE   = 1 << 0, /*!<
+        Remove the packages (*.rpm files) which are not listed
+        in the primary metadata of the repository anymore */
+} LrYumSyncFlag;
+
+/** Statistics of ::lr_yum_sync */
+typedef struct {
+    gint64 packages;    /*!< Number of packages in the repository */
+    gint64 unchanged;   /*!< Packages already present in the mirror */
+    gint64 downloaded;  /*!< Packages downloaded (new or changed) */
+    gint64 removed;     /*!< Stale packages removed from the mirror */
+} LrYumSyncStats;
+
+/** Synchronize a local mirror of the yum repository of the handle.
+ *
+ * The metadata are downloaded to a staging directory inside of the
+ * mirror, the unchanged metadata files are reused from the mirror
+ * (see LRO_YUMREUSEDIR). The packages listed in the new primary
+ * metadata are compared with the files of the mirror by their
+ * size and checksum (the checksum cache and the sidecar checksum
+ * index are used, see LRO_CHECKSUMINDEX), only the missing and
+ * the changed ones are downloaded. When all of them are downloaded,
+ * the repodata/ directory of the mirror is replaced by the new
+ * one at once, so the clients of the mirror never see metadata
+ * referring to packages which are not present yet.
+ *
+ * LRO_DESTDIR, LRO_UPDATE and LRO_YUMREUSEDIR of the handle are
+ * used internally and restored afterwards. Local repositories
+ * (LRO_LOCAL) are not supported.
+ *
+ * @param handle        Handle of a yum repository
+ * @param dir           Directory of the mirror, it is created if needed
+ * @param flags         Bitfield of ::LrYumSyncFlag
+ * @param stats         Statistics of the synchronization or NULL
+ * @param err           GError **
+ * @return              TRUE if everything is ok, FALSE if err is set.
+ *                      The mirror is not changed (except of already
+ *                      downloaded packages) if the synchronization fails.
+ */
+gboolean
+lr_yum_sync(LrHandle *handle,
+            const char *dir,
+            LrYumSyncFlag flags,
+            LrYumSyncStats *stats,
+            GError **err);
+
+/** @} */
+
+G_END_DECLS
+
+#endif
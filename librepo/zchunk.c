@@ -0,0 +1,471 @@
+/* librepo - A library providing (libcURL like) API to downloading repository
+ * Copyright (C) 2014  Tomas Mlcoch
+ *
+ * Licensed under the GNU Lesser General Public License Version 2.1
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#define _XOPEN_SOURCE   500 // Because of pread() and pwrite()
+
+#include <glib.h>
+#include <assert.h>
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "rcodes.h"
+#include "util.h"
+#include "downloader.h"
+#include "downloadtarget.h"
+#include "zchunk.h"
+#include "cleanup.h"
+
+#define ZCK_MAGIC               "\0ZCK1"
+#define ZCK_MAGIC_LEN           5
+
+/** Flags of the preface */
+#define ZCK_FLAG_STREAMS        (1 << 0)
+#define ZCK_FLAG_OPTIONAL       (1 << 1)
+
+/** Size of the beginning of a file read to get the header size */
+#define ZCK_LEAD_MAX            128
+
+/** Missing chunks closer than this are downloaded by one request */
+#define ZCK_RANGE_GAP           (16 * 1024)
+
+/** Max number of byte range requests of one file */
+#define ZCK_MAX_RANGES          256
+
+/** Reader of the header */
+typedef struct {
+    const unsigned char *p;
+    const unsigned char *end;
+    gboolean bad;
+} ZckReader;
+
+/** Read a compressed integer (7 bits per byte, the least significant
+ * first, the last byte has the highest bit set).
+ */
+static guint64
+read_compint(ZckReader *r)
+{
+    guint64 val = 0;
+
+    for (int shift = 0; !r->bad; shift += 7) {
+        if (r->p >= r->end || shift > 63) {
+            r->bad = TRUE;
+            break;
+        }
+        unsigned char c = *r->p++;
+        val |= (guint64) (c & 0x7f) << shift;
+        if (c & 0x80)
+            return val;
+    }
+
+    return 0;
+}
+
+static const unsigned char *
+read_bytes(ZckReader *r, gsize len)
+{
+    const unsigned char *bytes = r->p;
+
+    if (r->bad || (gsize) (r->end - r->p) < len) {
+        r->bad = TRUE;
+        return NULL;
+    }
+
+    r->p += len;
+    return bytes;
+}
+
+/** Length of the checksum of the zchunk checksum type or 0 if unknown.
+ */
+static gsize
+checksum_len(guint64 type)
+{
+    switch (type) {
+    case 0:  return 20;     // SHA-1
+    case 1:  return 32;     // SHA-256
+    case 2:  return 64;     // SHA-512
+    case 3:  return 16;     // SHA-512/128
+    default: return 0;
+    }
+}
+
+/** Read the lead, leave the reader at the beginning of the header.
+ */
+static gboolean
+read_lead(ZckReader *r, guint64 *checksum_type, gint64 *size)
+{
+    const unsigned char *magic = read_bytes(r, ZCK_MAGIC_LEN);
+    if (!magic || memcmp(magic, ZCK_MAGIC, ZCK_MAGIC_LEN))
+        return FALSE;
+
+    *checksum_type = read_compint(r);
+    guint64 header_size = read_compint(r);
+    gsize len = checksum_len(*checksum_type);
+    if (r->bad || len == 0 || header_size > G_MAXINT32)
+        return FALSE;
+
+    if (!read_bytes(r, len))    // Header checksum
+        return FALSE;
+
+    *size = (gint64) header_size;
+    return TRUE;
+}
+
+gboolean
+lr_zck_header_size(const unsigned char *buf, gsize len, gint64 *size)
+{
+    ZckReader r = { buf, buf + len, FALSE };
+    guint64 checksum_type;
+    gint64 header_size;
+
+    if (!read_lead(&r, &checksum_type, &header_size))
+        return FALSE;
+
+    *size = (gint64) (r.p - buf) + header_size;
+    return TRUE;
+}
+
+LrZckIndex *
+lr_zck_index_parse(const unsigned char *buf, gsize len, GError **err)
+{
+    ZckReader r = { buf, buf + len, FALSE };
+    guint64 checksum_type;
+    gint64 header_size;
+
+    assert(!err || *err == NULL);
+
+    if (!read_lead(&r, &checksum_type, &header_size)
+        || (gsize) (r.p - buf) + header_size > len)
+    {
+        g_set_error(err, LR_YUM_ERROR, LRE_VALUE,
+                    "Not a zchunk file or its header is incomplete");
+        return NULL;
+    }
+
+    // Size of the lead and the header
+    header_size += (gint64) (r.p - buf);
+    r.end = buf + header_size;
+
+    // Preface
+    read_bytes(&r, checksum_len(checksum_type));  // Data checksum
+    guint64 flags = read_compint(&r);
+    read_compint(&r);                               // Compression type
+    if (flags & ZCK_FLAG_OPTIONAL) {
+        guint64 count = read_compint(&r);
+        for (guint64 x = 0; x < count && !r.bad; x++) {
+            read_compint(&r);                       // Id
+            read_bytes(&r, read_compint(&r));       // Data
+        }
+    }
+
+    // Index
+    read_compint(&r);                               // Index size
+    guint64 chunk_checksum_type = read_compint(&r);
+    guint64 count = read_compint(&r);
+    gsize chunk_checksum_len = checksum_len(chunk_checksum_type);
+    if (r.bad || chunk_checksum_len == 0 || count > len) {
+        g_set_error(err, LR_YUM_ERROR, LRE_VALUE,
+                    "Unsupported or malformed zchunk header");
+        return NULL;
+    }
+
+    LrZckIndex *index = lr_malloc0(sizeof(*index));
+    index->header_size = header_size;
+    index->checksum_type = chunk_checksum_type;
+    index->chunks = g_array_sized_new(FALSE, FALSE, sizeof(LrZckChunk), count);
+    index->strings = g_string_chunk_new(count * (chunk_checksum_len * 2 + 1));
+
+    // Chunks follow right after the header
+    gint64 offset = header_size;
+    for (guint64 x = 0; x < count && !r.bad; x++) {
+        LrZckChunk chunk;
+
+        if (flags & ZCK_FLAG_STREAMS)
+            read_compint(&r);                       // Stream
+        const unsigned char *checksum = read_bytes(&r, chunk_checksum_len);
+        chunk.length = (gint64) read_compint(&r);
+        read_compint(&r);                           // Uncompressed length
+        if (r.bad)
+            break;
+
+        gchar hex[2 * 64 + 1];
+        for (gsize y = 0; y < chunk_checksum_len; y++)
+            g_snprintf(hex + 2 * y, 3, "%02x", checksum[y]);
+        chunk.checksum = g_string_chunk_insert(index->strings, hex);
+        chunk.offset = offset;
+        offset += chunk.length;
+        g_array_append_val(index->chunks, chunk);
+    }
+
+    if (r.bad) {
+        g_set_error(err, LR_YUM_ERROR, LRE_VALUE,
+                    "Malformed index in zchunk header");
+        lr_zck_index_free(index);
+        return NULL;
+    }
+
+    return index;
+}
+
+LrZckIndex *
+lr_zck_index_read(int fd, GError **err)
+{
+    unsigned char lead[ZCK_LEAD_MAX];
+    gint64 size;
+    ssize_t len;
+
+    assert(!err || *err == NULL);
+
+    len = pread(fd, lead, sizeof(lead), 0);
+    if (len < 0 || !lr_zck_header_size(lead, (gsize) len, &size)) {
+        g_set_error(err, LR_YUM_ERROR, LRE_VALUE, "Not a zchunk file");
+        return NULL;
+    }
+
+    _cleanup_free_ unsigned char *header = g_malloc((gsize) size);
+    if (pread(fd, header, (size_t) size, 0) != (ssize_t) size) {
+        g_set_error(err, LR_YUM_ERROR, LRE_IO,
+                    "Cannot read zchunk header: %s", strerror(errno));
+        return NULL;
+    }
+
+    return lr_zck_index_parse(header, (gsize) size, err);
+}
+
+void
+lr_zck_index_free(LrZckIndex *index)
+{
+    if (!index)
+        return;
+    g_array_free(index->chunks, TRUE);
+    g_string_chunk_free(index->strings);
+    lr_free(index);
+}
+
+/** Range of the new file to download.
+ */
+typedef struct {
+    gint64 start;
+    gint64 end;                 /*!< Inclusive */
+    LrDownloadTarget *target;
+} ZckRange;
+
+/** Plan ranges of the missing chunks. Chunks of the sources array which
+ * are NULL are missing. Close missing chunks are merged, the gap is
+ * doubled until there are at most ZCK_MAX_RANGES ranges.
+ */
+static GArray *
+plan_ranges(LrZckIndex *index, LrZckChunk **sources)
+{
+    GArray *ranges = g_array_new(FALSE, FALSE, sizeof(ZckRange));
+
+    for (gint64 gap = ZCK_RANGE_GAP; ; gap *= 2) {
+        g_array_set_size(ranges, 0);
+        for (guint x = 0; x < index->chunks->len; x++) {
+            LrZckChunk *chunk = &g_array_index(index->chunks, LrZckChunk, x);
+            if (sources[x] || chunk->length == 0)
+                continue;
+
+            gint64 end = chunk->offset + chunk->length - 1;
+            if (ranges->len > 0) {
+                ZckRange *last = &g_array_index(ranges, ZckRange,
+                                                ranges->len - 1);
+                if (chunk->offset - last->end - 1 <= gap) {
+                    last->end = end;
+                    continue;
+                }
+            }
+            ZckRange range = { chunk->offset, end, NULL };
+            g_array_append_val(ranges, range);
+        }
+        if (ranges->len <= ZCK_MAX_RANGES)
+            return ranges;
+    }
+}
+
+/** Find the range which contains the chunk.
+ */
+static ZckRange *
+find_range(GArray *ranges, LrZckChunk *chunk)
+{
+    for (guint x = 0; x < ranges->len; x++) {
+        ZckRange *range = &g_array_index(ranges, ZckRange, x);
+        if (chunk->offset >= range->start && chunk->offset <= range->end)
+            return range;
+    }
+    return NULL;
+}
+
+static gboolean
+write_all(int fd, const void *buf, gint64 len, gint64 offset, GError **err)
+{
+    if (pwrite(fd, buf, (size_t) len, (off_t) offset) != (ssize_t) len) {
+        g_set_error(err, LR_YUM_ERROR, LRE_IO,
+                    "Cannot write zchunk file: %s", strerror(errno));
+        return FALSE;
+    }
+    return TRUE;
+}
+
+gboolean
+lr_zck_download(LrHandle *handle,
+                const char *path,
+                const char *baseurl,
+                gint64 header_size,
+                int source_fd,
+                int fd,
+                GError **err)
+{
+    gboolean ret = FALSE;
+    LrZckIndex *old = NULL, *new = NULL;
+    LrDownloadTarget *header = NULL;
+    LrZckChunk **sources = NULL;
+    GArray *ranges = NULL;
+    GHashTable *known = NULL;
+    GSList *targets = NULL;
+    _cleanup_free_ unsigned char *buf = NULL;
+    gint64 reused = 0, downloaded = 0;
+
+    assert(!err || *err == NULL);
+
+    old = lr_zck_index_read(source_fd, err);
+    if (!old)
+        goto out;
+
+    // Header (with the index) of the new version
+    header = lr_downloadtarget_new(handle, path, baseurl, -1, NULL, NULL,
+                                   0, FALSE, NULL, NULL, NULL, NULL, NULL,
+                                   0, header_size - 1);
+    targets = g_slist_prepend(NULL, header);
+    gboolean rc = lr_download(targets, TRUE, err);
+    g_slist_free(targets);
+    targets = NULL;
+    if (!rc)
+        goto out;
+    downloaded += header->data->len;
+
+    new = lr_zck_index_parse(header->data->data, header->data->len, err);
+    if (!new)
+        goto out;
+
+    // Map the chunks of the new version to the chunks of the old one
+    known = g_hash_table_new(g_str_hash, g_str_equal);
+    if (old->checksum_type == new->checksum_type) {
+        for (guint x = 0; x < old->chunks->len; x++) {
+            LrZckChunk *chunk = &g_array_index(old->chunks, LrZckChunk, x);
+            if (chunk->length > 0)
+                g_hash_table_insert(known, chunk->checksum, chunk);
+        }
+    }
+
+    gboolean any = FALSE;
+    sources = g_new0(LrZckChunk *, new->chunks->len + 1);
+    for (guint x = 0; x < new->chunks->len; x++) {
+        LrZckChunk *chunk = &g_array_index(new->chunks, LrZckChunk, x);
+        sources[x] = g_hash_table_lookup(known, chunk->checksum);
+        if (sources[x])
+            any = TRUE;
+    }
+
+    if (!any) {
+        g_set_error(err, LR_YUM_ERROR, LRE_VALUE,
+                    "No chunk of %s can be reused", path);
+        goto out;
+    }
+
+    // Missing chunks
+    ranges = plan_ranges(new, sources);
+    for (guint x = 0; x < ranges->len; x++) {
+        ZckRange *range = &g_array_index(ranges, ZckRange, x);
+        range->target = lr_downloadtarget_new(handle, path, baseurl, -1,
+                                              NULL, NULL, 0, FALSE, NULL,
+                                              NULL, NULL, NULL, NULL,
+                                              range->start, range->end);
+        targets = g_slist_append(targets, range->target);
+    }
+
+    if (targets && !lr_download(targets, TRUE, err))
+        goto out;
+
+    // Assemble the new version
+    if (ftruncate(fd, 0) == -1) {
+        g_set_error(err, LR_YUM_ERROR, LRE_IO,
+                    "Cannot truncate zchunk file: %s", strerror(errno));
+        goto out;
+    }
+
+    if (!write_all(fd, header->data->data, new->header_size, 0, err))
+        goto out;
+
+    for (guint x = 0; x < new->chunks->len; x++) {
+        LrZckChunk *chunk = &g_array_index(new->chunks, LrZckChunk, x);
+        if (chunk->length == 0)
+            continue;
+
+        if (sources[x]) {
+            buf = g_realloc(buf, (gsize) chunk->length);
+            if (pread(source_fd, buf, (size_t) chunk->length,
+                      (off_t) sources[x]->offset) != (ssize_t) chunk->length)
+            {
+                g_set_error(err, LR_YUM_ERROR, LRE_IO,
+                            "Cannot read chunk of old zchunk file");
+                goto out;
+            }
+            if (!write_all(fd, buf, chunk->length, chunk->offset, err))
+                goto out;
+            reused += chunk->length;
+            continue;
+        }
+
+        ZckRange *range = find_range(ranges, chunk);
+        GByteArray *data = range ? range->target->data : NULL;
+        gint64 start = range ? chunk->offset - range->start : 0;
+        if (!data || start + chunk->length > (gint64) data->len) {
+            g_set_error(err, LR_YUM_ERROR, LRE_VALUE,
+                        "Incomplete chunk data of %s", path);
+            goto out;
+        }
+        if (!write_all(fd, data->data + start, chunk->length,
+                       chunk->offset, err))
+            goto out;
+    }
+
+    for (guint x = 0; x < ranges->len; x++) {
+        ZckRange *range = &g_array_index(ranges, ZckRange, x);
+        downloaded += range->end - range->start + 1;
+    }
+
+    g_debug("%s: %s: %"G_GINT64_FORMAT" bytes reused, %"G_GINT64_FORMAT
+            " bytes downloaded by %u ranges", __func__, path, reused,
+            downloaded, ranges->len);
+    ret = TRUE;
+
+out:
+    g_slist_free_full(targets, (GDestroyNotify) lr_downloadtarget_free);
+    lr_downloadtarget_free(header);
+    if (known)
+        g_hash_table_destroy(known);
+    if (ranges)
+        g_array_free(ranges, TRUE);
+    g_free(sources);
+    lr_zck_index_free(old);
+    lr_zck_index_free(new);
+    return ret;
+}
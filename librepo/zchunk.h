@@ -0,0 +1,114 @@
+/* librepo - A library providing (libcURL like) API to downloading repository
+ * Copyright (C) 2014  Tomas Mlcoch
+ *
+ * Licensed under the GNU Lesser General Public License Version 2.1
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#ifndef __LR_ZCHUNK_H__
+#define __LR_ZCHUNK_H__
+
+#include <glib.h>
+
+#include "handle.h"
+
+G_BEGIN_DECLS
+
+/** Delta download of zchunk (.zck) files.
+ * A zchunk file is a header with the index of the chunks followed by
+ * independently compressed chunks. Chunks with the same checksum are
+ * the same, so a new version of the file is assembled from the chunks
+ * of an old local version and only the missing chunks are downloaded
+ * by byte range requests. The data are not decompressed here.
+ */
+
+/** Suffix of the zchunk files */
+#define LR_ZCK_SUFFIX           ".zck"
+
+/** Chunk of a zchunk file. */
+typedef struct {
+    gint64 offset;      /*!< Offset of the chunk in the file */
+    gint64 length;      /*!< Length of the (compressed) chunk */
+    gchar *checksum;    /*!< Checksum of the chunk (hex) */
+} LrZckChunk;
+
+/** Index of the chunks from the header of a zchunk file. */
+typedef struct {
+    gint64 header_size;     /*!< Size of the lead and the header,
+                                 the data of the chunks follow */
+    guint64 checksum_type;  /*!< Type of the chunk checksums */
+    GArray *chunks;         /*!< Chunks (LrZckChunk) in the order of the
+                                 file, the first one is the dictionary */
+    GStringChunk *strings;  /*!< Storage of the checksums */
+} LrZckIndex;
+
+/** Get size of the lead and the header from the beginning of a file.
+ * @param buf       Beginning of the file
+ * @param len       Length of the buf
+ * @param size      Size of the lead and the header
+ * @return          FALSE if the buf is not a beginning of a zchunk file
+ *                  (or it is too short)
+ */
+gboolean
+lr_zck_header_size(const unsigned char *buf, gsize len, gint64 *size);
+
+/** Parse the index of the chunks from the header of a zchunk file.
+ * @param buf       Lead and header of the file
+ * @param len       Length of the buf
+ * @param err       GError **
+ * @return          New index or NULL
+ */
+LrZckIndex *
+lr_zck_index_parse(const unsigned char *buf, gsize len, GError **err);
+
+/** Read the index of the chunks from a zchunk file.
+ * @param fd        Opened zchunk file
+ * @param err       GError **
+ * @return          New index or NULL
+ */
+LrZckIndex *
+lr_zck_index_read(int fd, GError **err);
+
+/** Free the index.
+ */
+void
+lr_zck_index_free(LrZckIndex *index);
+
+/** Download a zchunk file to fd, the chunks present in the source
+ * file are copied from it. The header is downloaded first, then
+ * the missing chunks by byte range downloads. The result has to be
+ * verified by the checksum of the whole file.
+ * @param handle        Handle
+ * @param path          Path of the file (relative to the mirrors)
+ * @param baseurl       Base URL or NULL
+ * @param header_size   Size of the lead and the header (from repomd)
+ * @param source_fd     Old version of the zchunk file
+ * @param fd            Output file
+ * @param err           GError **
+ * @return              FALSE on error or if there is nothing to reuse
+ */
+gboolean
+lr_zck_download(LrHandle *handle,
+                const char *path,
+                const char *baseurl,
+                gint64 header_size,
+                int source_fd,
+                int fd,
+                GError **err);
+
+G_END_DECLS
+
+#endif
@@ -0,0 +1,137 @@
+/* Checksum throughput benchmark
+ *
+ * Usage: checksum_benchmark [size in MiB]
+ *
+ * For every checksum type reports:
+ *  - throughput of a single digest over a big memory buffer
+ *  - throughput of many small (4 KiB) digests, which is dominated by
+ *    the context setup and the hex encoding of the result
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <glib.h>
+
+#include "librepo/util.h"
+#include "librepo/checksum.h"
+#include "librepo/checksum_internal.h"
+
+#define DEFAULT_SIZE_MB     256
+#define CHUNK_SIZE          (1024 * 1024)
+#define SMALL_SIZE          4096
+
+static double
+mb_per_s(gint64 bytes, gint64 usec)
+{
+    if (usec <= 0)
+        usec = 1;
+    return ((double) bytes / (1024.0 * 1024.0)) / ((double) usec / 1e6);
+}
+
+static gboolean
+bench_big(LrChecksumType type, const char *buf, gint64 size, double *speed)
+{
+    GError *tmp_err = NULL;
+    gint64 start = g_get_monotonic_time();
+    LrChecksumCtx *ctx = lr_checksumctx_new(type, &tmp_err);
+    char *checksum;
+
+    if (!ctx)
+        goto error;
+
+    for (gint64 done = 0; done < size; done += CHUNK_SIZE)
+        if (!lr_checksumctx_update(ctx, buf, CHUNK_SIZE, &tmp_err))
+            goto error;
+
+    checksum = lr_checksumctx_final(ctx, &tmp_err);
+    if (!checksum)
+        goto error;
+
+    *speed = mb_per_s(size, g_get_monotonic_time() - start);
+    lr_free(checksum);
+    lr_checksumctx_free(ctx);
+    return TRUE;
+
+error:
+    fprintf(stderr, "%s: %s\n", lr_checksum_type_to_str(type), tmp_err->message);
+    g_error_free(tmp_err);
+    lr_checksumctx_free(ctx);
+    return FALSE;
+}
+
+static gboolean
+bench_small(LrChecksumType type, const char *buf, gint64 size, double *speed)
+{
+    GError *tmp_err = NULL;
+    gint64 start = g_get_monotonic_time();
+
+    for (gint64 done = 0; done < size; done += SMALL_SIZE) {
+        char *checksum;
+        LrChecksumCtx *ctx = lr_checksumctx_new(type, &tmp_err);
+
+        if (!ctx)
+            goto error;
+
+        if (!lr_checksumctx_update(ctx, buf + (done % CHUNK_SIZE),
+                                   SMALL_SIZE, &tmp_err)
+            || !(checksum = lr_checksumctx_final(ctx, &tmp_err)))
+        {
+            lr_checksumctx_free(ctx);
+            goto error;
+        }
+
+        lr_free(checksum);
+        lr_checksumctx_free(ctx);
+    }
+
+    *speed = mb_per_s(size, g_get_monotonic_time() - start);
+    return TRUE;
+
+error:
+    fprintf(stderr, "%s: %s\n", lr_checksum_type_to_str(type), tmp_err->message);
+    g_error_free(tmp_err);
+    return FALSE;
+}
+
+int
+main(int argc, char *argv[])
+{
+    int ret = EXIT_SUCCESS;
+    gint64 size_mb = DEFAULT_SIZE_MB;
+    gint64 size;
+    char *buf;
+    const char *accel;
+
+    if (argc > 1)
+        size_mb = g_ascii_strtoll(argv[1], NULL, 10);
+    if (size_mb <= 0) {
+        fprintf(stderr, "Usage: %s [size in MiB]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    size = size_mb * CHUNK_SIZE;
+    buf = lr_malloc(CHUNK_SIZE);
+    for (size_t x = 0; x < CHUNK_SIZE; x++)
+        buf[x] = (char) (x * 2654435761u >> 24);
+
+    accel = lr_checksum_cpu_acceleration();
+    printf("CPU SHA extensions: %s\n", accel ? accel : "none");
+    printf("Data: %" G_GINT64_FORMAT " MiB\n\n", size_mb);
+    printf("%-8s %14s %18s\n", "Type", "Big (MB/s)", "4 KiB msgs (MB/s)");
+
+    for (int type = LR_CHECKSUM_MD5; type <= LR_CHECKSUM_SHA512; type++) {
+        double big, small;
+
+        if (!bench_big(type, buf, size, &big)
+            || !bench_small(type, buf, size, &small))
+        {
+            ret = EXIT_FAILURE;
+            continue;
+        }
+
+        printf("%-8s %14.1f %18.1f\n", lr_checksum_type_to_str(type), big, small);
+    }
+
+    lr_free(buf);
+    return ret;
+}
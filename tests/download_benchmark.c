@@ -0,0 +1,647 @@
+/* Downloader benchmark against a local HTTP server
+ *
+ * Usage: download_benchmark [OPTION...]
+ *
+ * The server runs in a child process and listens on an ephemeral port
+ * of 127.0.0.1 for every mirror (--mirror LATENCY:BANDWIDTH:ERRORRATE,
+ * latency of a response in ms, bandwidth of a connection in KiB/s,
+ * 0 is unlimited, and probability of "503 Service Unavailable").
+ * An URL /<size>/<name> returns <size> bytes of a fixed pattern.
+ *
+ * Every workload runs in a child process of its own, so its CPU time
+ * and peak RSS are not mixed with the server or other workloads:
+ *  - tiny:  many (10000) tiny files
+ *  - huge:  few (4) huge files
+ *  - mixed: files of sizes from 512 B to 4 MiB
+ * and is downloaded via lr_download() and lr_download_packages().
+ *
+ * For every workload and API one JSON object per line is printed with
+ * the throughput, latency of transfers (percentiles of the total time),
+ * CPU time and peak RSS of the client. Sizes of the receive and write
+ * buffers (--recv-buffer, --write-buffer) could be compared by the CPU
+ * time of the huge workload, e.g. --recv-buffer 262144 --write-buffer
+ * 1048576 against the defaults.
+ */
+
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <signal.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <glib.h>
+#include <glib/gstdio.h>
+
+#include "librepo/librepo.h"
+#include "librepo/checksum_internal.h"
+#include "librepo/handle_internal.h"
+
+#define PATTERN_PERIOD      251
+#define CHUNK_SIZE          (16 * 1024)
+#define REQUEST_SIZE        8192
+
+typedef struct {
+    int sock;               /*!< Listening socket */
+    int port;               /*!< Port of the socket */
+    long latency_ms;        /*!< Delay of every response */
+    long bandwidth_kibps;   /*!< Speed of a connection, 0 is unlimited */
+    double error_rate;      /*!< Probability of 503 response */
+} BenchMirror;
+
+typedef struct {
+    int fd;                 /*!< Socket of the connection */
+    BenchMirror *mirror;    /*!< Mirror of the connection */
+} BenchConnection;
+
+typedef struct {
+    const char *name;
+    guint files;
+    gint64 (*size)(guint index, gint64 arg);
+    gint64 size_arg;
+} BenchWorkload;
+
+static char pattern[PATTERN_PERIOD + CHUNK_SIZE];
+
+static gchar *opt_workload = NULL;
+static gchar *opt_api = NULL;
+static gchar **opt_mirrors = NULL;
+static gint opt_files = 0;
+static gint opt_parallel = LRO_MAXPARALLELDOWNLOADS_DEFAULT;
+static gint opt_tiny_size = 1024;
+static gint opt_huge_size_mb = 128;
+static gboolean opt_checksum = TRUE;
+static gint opt_recv_buffer = LRO_RECVBUFFERSIZE_DEFAULT;
+static gint opt_write_buffer = LRO_WRITEBUFFERSIZE_DEFAULT;
+
+static GOptionEntry entries[] = {
+    { "workload", 'w', 0, G_OPTION_ARG_STRING, &opt_workload,
+      "Workload: tiny, huge, mixed or all (default)", "NAME" },
+    { "api", 'a', 0, G_OPTION_ARG_STRING, &opt_api,
+      "API: download, packages or all (default)", "NAME" },
+    { "mirror", 'm', 0, G_OPTION_ARG_STRING_ARRAY, &opt_mirrors,
+      "Profile of a mirror (repeatable, default 0:0:0)",
+      "LATENCY_MS:BANDWIDTH_KIBPS:ERROR_RATE" },
+    { "files", 'n', 0, G_OPTION_ARG_INT, &opt_files,
+      "Number of files of the workload (default by the workload)", "N" },
+    { "parallel", 'p', 0, G_OPTION_ARG_INT, &opt_parallel,
+      "LRO_MAXPARALLELDOWNLOADS", "N" },
+    { "tiny-size", 0, 0, G_OPTION_ARG_INT, &opt_tiny_size,
+      "Size of a tiny file in bytes (default 1024)", "BYTES" },
+    { "huge-size", 0, 0, G_OPTION_ARG_INT, &opt_huge_size_mb,
+      "Size of a huge file in MiB (default 128)", "MIB" },
+    { "no-checksum", 0, G_OPTION_FLAG_REVERSE, G_OPTION_ARG_NONE,
+      &opt_checksum, "Don't check SHA256 of the files", NULL },
+    { "recv-buffer", 0, 0, G_OPTION_ARG_INT, &opt_recv_buffer,
+      "LRO_RECVBUFFERSIZE (default 0, the default of libcurl)", "BYTES" },
+    { "write-buffer", 0, 0, G_OPTION_ARG_INT, &opt_write_buffer,
+      "LRO_WRITEBUFFERSIZE (default 0, stdio)", "BYTES" },
+    { NULL, 0, 0, 0, NULL, NULL, NULL },
+};
+
+static gint64
+tiny_size(G_GNUC_UNUSED guint index, gint64 arg)
+{
+    return arg;
+}
+
+static gint64
+huge_size(G_GNUC_UNUSED guint index, gint64 arg)
+{
+    return arg * 1024 * 1024;
+}
+
+static gint64
+mixed_size(guint index, G_GNUC_UNUSED gint64 arg)
+{
+    // Deterministic sizes from 512 B to 4 MiB, the small ones prevail
+    guint32 hash = index * 2654435761u;
+    guint shift = ((hash >> 8) % 14) * ((hash >> 16) % 14) / 13;
+    return ((gint64) 512 << shift) + (hash >> 24);
+}
+
+// Server
+
+static gboolean
+send_all(int fd, const char *buf, size_t len)
+{
+    while (len > 0) {
+        ssize_t sent = send(fd, buf, len, MSG_NOSIGNAL);
+        if (sent < 0) {
+            if (errno == EINTR)
+                continue;
+            return FALSE;
+        }
+        buf += sent;
+        len -= (size_t) sent;
+    }
+    return TRUE;
+}
+
+static gboolean
+send_body(int fd, BenchMirror *mirror, gint64 size)
+{
+    gint64 start = g_get_monotonic_time();
+
+    for (gint64 offset = 0; offset < size; offset += CHUNK_SIZE) {
+        size_t len = (size_t) MIN(size - offset, CHUNK_SIZE);
+        if (!send_all(fd, pattern + offset % PATTERN_PERIOD, len))
+            return FALSE;
+
+        if (mirror->bandwidth_kibps > 0) {
+            gint64 sent = offset + (gint64) len;
+            gint64 due = start + sent * 1000000 / (mirror->bandwidth_kibps * 1024);
+            gint64 now = g_get_monotonic_time();
+            if (due > now)
+                g_usleep((gulong) (due - now));
+        }
+    }
+
+    return TRUE;
+}
+
+/** Serve the requests of a (keep-alive) connection */
+static gpointer
+serve_connection(gpointer data)
+{
+    BenchConnection *conn = data;
+    int fd = conn->fd;
+    BenchMirror *mirror = conn->mirror;
+    char req[REQUEST_SIZE + 1];
+    size_t len = 0;
+    GRand *rand = g_rand_new();
+
+    for (;;) {
+        char *end;
+
+        while (!(end = g_strstr_len(req, len, "\r\n\r\n"))) {
+            ssize_t got;
+            if (len == REQUEST_SIZE)
+                goto out;
+            got = recv(fd, req + len, REQUEST_SIZE - len, 0);
+            if (got < 0 && errno == EINTR)
+                continue;
+            if (got <= 0)
+                goto out;
+            len += (size_t) got;
+            req[len] = '\0';
+        }
+
+        *end = '\0';
+        gboolean close_conn = strcasestr(req, "connection: close") != NULL;
+        gint64 size = -1;
+        char *path = strchr(req, ' ');
+        if (path && path[1] == '/')
+            size = g_ascii_strtoll(path + 2, NULL, 10);
+
+        // The next request could be in the buffer already
+        len -= (size_t) (end + 4 - req);
+        memmove(req, end + 4, len);
+        req[len] = '\0';
+
+        if (mirror->latency_ms > 0)
+            g_usleep((gulong) mirror->latency_ms * 1000);
+
+        gchar *head;
+        if (size < 0)
+            head = g_strdup("HTTP/1.1 404 Not Found\r\n"
+                            "Content-Length: 0\r\n\r\n");
+        else if (g_rand_double(rand) < mirror->error_rate)
+            head = g_strdup("HTTP/1.1 503 Service Unavailable\r\n"
+                            "Content-Length: 0\r\n\r\n");
+        else
+            head = g_strdup_printf("HTTP/1.1 200 OK\r\n"
+                                   "Content-Type: application/octet-stream\r\n"
+                                   "Content-Length: %" G_GINT64_FORMAT "\r\n"
+                                   "\r\n", size);
+
+        gboolean ok = send_all(fd, head, strlen(head));
+        if (ok && g_str_has_prefix(head, "HTTP/1.1 200"))
+            ok = send_body(fd, mirror, size);
+        g_free(head);
+
+        if (!ok || close_conn)
+            break;
+    }
+
+out:
+    g_rand_free(rand);
+    g_free(conn);
+    close(fd);
+    return NULL;
+}
+
+static gpointer
+accept_connections(gpointer data)
+{
+    BenchMirror *mirror = data;
+
+    for (;;) {
+        int fd = accept(mirror->sock, NULL, NULL);
+        if (fd < 0) {
+            if (errno == EINTR || errno == ECONNABORTED)
+                continue;
+            perror("accept");
+            return NULL;
+        }
+        BenchConnection *conn = g_new(BenchConnection, 1);
+        conn->fd = fd;
+        conn->mirror = mirror;
+        g_thread_unref(g_thread_new("connection", serve_connection, conn));
+    }
+}
+
+static void
+run_server(GPtrArray *mirrors)
+{
+    for (guint x = 0; x < mirrors->len; x++)
+        g_thread_unref(g_thread_new("mirror", accept_connections,
+                                    g_ptr_array_index(mirrors, x)));
+    for (;;)
+        pause();
+}
+
+static gboolean
+open_mirror(BenchMirror *mirror)
+{
+    struct sockaddr_in addr;
+    socklen_t addrlen = sizeof(addr);
+    int one = 1;
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = 0;
+
+    mirror->sock = socket(AF_INET, SOCK_STREAM, 0);
+    if (mirror->sock < 0
+        || setsockopt(mirror->sock, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one))
+        || bind(mirror->sock, (struct sockaddr *) &addr, sizeof(addr))
+        || listen(mirror->sock, 128)
+        || getsockname(mirror->sock, (struct sockaddr *) &addr, &addrlen))
+    {
+        perror("Cannot open a socket of the server");
+        return FALSE;
+    }
+
+    mirror->port = ntohs(addr.sin_port);
+    return TRUE;
+}
+
+static BenchMirror *
+parse_mirror(const char *profile)
+{
+    BenchMirror *mirror = g_new0(BenchMirror, 1);
+    gchar **items = g_strsplit(profile, ":", 3);
+
+    if (items[0])
+        mirror->latency_ms = (long) g_ascii_strtoll(items[0], NULL, 10);
+    if (items[0] && items[1])
+        mirror->bandwidth_kibps = (long) g_ascii_strtoll(items[1], NULL, 10);
+    if (items[0] && items[1] && items[2])
+        mirror->error_rate = g_ascii_strtod(items[2], NULL);
+    g_strfreev(items);
+
+    if (mirror->latency_ms < 0 || mirror->bandwidth_kibps < 0
+        || mirror->error_rate < 0.0 || mirror->error_rate > 1.0)
+    {
+        fprintf(stderr, "Bad profile of a mirror: %s\n", profile);
+        g_free(mirror);
+        return NULL;
+    }
+
+    return mirror;
+}
+
+// Client
+
+static gchar *
+pattern_checksum(GHashTable *checksums, gint64 size)
+{
+    gchar *checksum = g_hash_table_lookup(checksums, &size);
+    if (checksum)
+        return checksum;
+
+    GError *tmp_err = NULL;
+    LrChecksumCtx *ctx = lr_checksumctx_new(LR_CHECKSUM_SHA256, &tmp_err);
+    for (gint64 offset = 0; ctx && offset < size; offset += CHUNK_SIZE)
+        lr_checksumctx_update(ctx, pattern + offset % PATTERN_PERIOD,
+                              (size_t) MIN(size - offset, CHUNK_SIZE), NULL);
+    checksum = ctx ? lr_checksumctx_final(ctx, NULL) : NULL;
+    lr_checksumctx_free(ctx);
+    if (!checksum) {
+        fprintf(stderr, "Cannot calculate a checksum: %s\n",
+                tmp_err ? tmp_err->message : "unknown error");
+        exit(EXIT_FAILURE);
+    }
+
+    gint64 *key = g_new(gint64, 1);
+    *key = size;
+    g_hash_table_insert(checksums, key, checksum);
+    return checksum;
+}
+
+static int
+compare_doubles(gconstpointer a, gconstpointer b)
+{
+    double x = *(const double *) a, y = *(const double *) b;
+    return (x > y) - (x < y);
+}
+
+static double
+percentile(GArray *sorted, double p)
+{
+    if (sorted->len == 0)
+        return 0.0;
+    guint index = (guint) (p / 100.0 * (sorted->len - 1) + 0.5);
+    return g_array_index(sorted, double, index);
+}
+
+static void
+print_report(const BenchWorkload *workload,
+             const char *api,
+             GPtrArray *mirrors,
+             guint failed,
+             gint64 bytes,
+             gint64 wall_usec,
+             GArray *latencies)
+{
+    struct rusage usage;
+    double wall = MAX(wall_usec, 1) / 1e6;
+
+    getrusage(RUSAGE_SELF, &usage);
+    g_array_sort(latencies, compare_doubles);
+
+    printf("{\"workload\":\"%s\",\"api\":\"%s\",\"files\":%u,\"failed\":%u,"
+           "\"bytes\":%" G_GINT64_FORMAT ",\"parallel\":%d,\"checksum\":%s,"
+           "\"recv_buffer\":%d,\"write_buffer\":%d,"
+           "\"wall_s\":%.6f,\"throughput_mibps\":%.3f,\"files_per_s\":%.1f,"
+           "\"latency_ms\":{\"p50\":%.3f,\"p90\":%.3f,\"p99\":%.3f,"
+           "\"max\":%.3f},"
+           "\"cpu_user_s\":%.6f,\"cpu_sys_s\":%.6f,\"peak_rss_kib\":%ld,"
+           "\"mirrors\":[",
+           workload->name, api, workload->files, failed, bytes, opt_parallel,
+           opt_checksum ? "true" : "false", opt_recv_buffer, opt_write_buffer,
+           wall, (double) bytes / (1024.0 * 1024.0) / wall,
+           workload->files / wall,
+           percentile(latencies, 50) * 1000, percentile(latencies, 90) * 1000,
+           percentile(latencies, 99) * 1000, percentile(latencies, 100) * 1000,
+           usage.ru_utime.tv_sec + usage.ru_utime.tv_usec / 1e6,
+           usage.ru_stime.tv_sec + usage.ru_stime.tv_usec / 1e6,
+           usage.ru_maxrss);
+    for (guint x = 0; x < mirrors->len; x++) {
+        BenchMirror *mirror = g_ptr_array_index(mirrors, x);
+        printf("%s{\"latency_ms\":%ld,\"bandwidth_kibps\":%ld,"
+               "\"error_rate\":%.3f}", x ? "," : "", mirror->latency_ms,
+               mirror->bandwidth_kibps, mirror->error_rate);
+    }
+    printf("]}\n");
+    fflush(stdout);
+}
+
+static LrHandle *
+new_handle(GPtrArray *mirrors)
+{
+    LrHandle *handle = lr_handle_init();
+    char **urls = g_new0(char *, mirrors->len + 1);
+
+    for (guint x = 0; x < mirrors->len; x++) {
+        BenchMirror *mirror = g_ptr_array_index(mirrors, x);
+        urls[x] = g_strdup_printf("http://127.0.0.1:%d/", mirror->port);
+    }
+
+    lr_handle_setopt(handle, NULL, LRO_URLS, urls);
+    lr_handle_setopt(handle, NULL, LRO_REPOTYPE, LR_YUMREPO);
+    lr_handle_setopt(handle, NULL, LRO_MAXPARALLELDOWNLOADS, (long) opt_parallel);
+    lr_handle_setopt(handle, NULL, LRO_RECVBUFFERSIZE, (long) opt_recv_buffer);
+    lr_handle_setopt(handle, NULL, LRO_WRITEBUFFERSIZE, (long) opt_write_buffer);
+    g_strfreev(urls);
+    return handle;
+}
+
+static int
+run_client(const BenchWorkload *workload, const char *api, GPtrArray *mirrors)
+{
+    GError *tmp_err = NULL;
+    GSList *targets = NULL;
+    GArray *latencies = g_array_new(FALSE, FALSE, sizeof(double));
+    GHashTable *checksums = g_hash_table_new_full(g_int64_hash, g_int64_equal,
+                                                  g_free, lr_free);
+    gboolean packages = !strcmp(api, "packages");
+    LrHandle *handle = new_handle(mirrors);
+    gchar *destdir = g_dir_make_tmp("librepo-benchmark-XXXXXX", &tmp_err);
+    gint64 bytes = 0;
+    guint failed = 0;
+    gboolean ret;
+
+    if (!destdir) {
+        fprintf(stderr, "%s\n", tmp_err->message);
+        return EXIT_FAILURE;
+    }
+
+    // Mirrors are prepared before the clock starts
+    if (!lr_handle_prepare_internal_mirrorlist(handle, FALSE, &tmp_err)) {
+        fprintf(stderr, "%s\n", tmp_err->message);
+        return EXIT_FAILURE;
+    }
+
+    for (guint x = 0; x < workload->files; x++) {
+        gint64 size = workload->size(x, workload->size_arg);
+        gchar *path = g_strdup_printf("%" G_GINT64_FORMAT "/%u.bin", size, x);
+        gchar *dest = g_strdup_printf("%s/%u.bin", destdir, x);
+        gchar *checksum = opt_checksum ? pattern_checksum(checksums, size)
+                                       : NULL;
+        gpointer target;
+
+        if (packages) {
+            target = lr_packagetarget_new_v2(handle, path, dest,
+                            checksum ? LR_CHECKSUM_SHA256 : LR_CHECKSUM_UNKNOWN,
+                            checksum, size, NULL, FALSE, NULL, NULL, NULL,
+                            NULL, &tmp_err);
+            if (!target) {
+                fprintf(stderr, "%s\n", tmp_err->message);
+                return EXIT_FAILURE;
+            }
+        } else {
+            GSList *possiblechecksums = NULL;
+            if (checksum)
+                possiblechecksums = g_slist_prepend(NULL,
+                        lr_downloadtargetchecksum_new(LR_CHECKSUM_SHA256,
+                                                      checksum));
+            target = lr_downloadtarget_new(handle, path, NULL, -1, dest,
+                                           possiblechecksums, size, FALSE,
+                                           NULL, NULL, NULL, NULL, NULL,
+                                           0, 0);
+        }
+
+        targets = g_slist_prepend(targets, target);
+        g_free(path);
+        g_free(dest);
+    }
+    targets = g_slist_reverse(targets);
+
+    gint64 start = g_get_monotonic_time();
+    if (packages)
+        ret = lr_download_packages(targets, 0, &tmp_err);
+    else
+        ret = lr_download(targets, FALSE, &tmp_err);
+    gint64 wall_usec = g_get_monotonic_time() - start;
+
+    if (!ret) {
+        fprintf(stderr, "%s %s: %s\n", workload->name, api, tmp_err->message);
+        return EXIT_FAILURE;
+    }
+
+    guint index = 0;
+    for (GSList *elem = targets; elem; elem = g_slist_next(elem), index++) {
+        const char *error, *fn;
+        const LrTransferStats *stats;
+
+        if (packages) {
+            LrPackageTarget *target = elem->data;
+            error = target->err;
+            fn = target->local_path;
+            stats = &target->stats;
+        } else {
+            LrDownloadTarget *target = elem->data;
+            error = target->err;
+            fn = target->fn;
+            stats = &target->stats;
+        }
+
+        if (error) {
+            failed++;
+        } else {
+            bytes += workload->size(index, workload->size_arg);
+            g_array_append_val(latencies, stats->total_time);
+        }
+        g_unlink(fn);
+    }
+
+    print_report(workload, api, mirrors, failed, bytes, wall_usec, latencies);
+
+    g_slist_free_full(targets, packages
+                                ? (GDestroyNotify) lr_packagetarget_free
+                                : (GDestroyNotify) lr_downloadtarget_free);
+    g_rmdir(destdir);
+    g_free(destdir);
+    g_hash_table_destroy(checksums);
+    g_array_free(latencies, TRUE);
+    lr_handle_free(handle);
+    return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+static gboolean
+run_forked_client(const BenchWorkload *workload,
+                  const char *api,
+                  GPtrArray *mirrors)
+{
+    int status;
+    pid_t pid = fork();
+
+    if (pid < 0) {
+        perror("fork");
+        return FALSE;
+    }
+    if (pid == 0)
+        _exit(run_client(workload, api, mirrors));
+
+    if (waitpid(pid, &status, 0) < 0)
+        return FALSE;
+    return WIFEXITED(status) && WEXITSTATUS(status) == EXIT_SUCCESS;
+}
+
+int
+main(int argc, char *argv[])
+{
+    int ret = EXIT_SUCCESS;
+    GError *tmp_err = NULL;
+    GOptionContext *context;
+    GPtrArray *mirrors = g_ptr_array_new_with_free_func(g_free);
+    gboolean workload_found = FALSE;
+    pid_t server;
+
+    context = g_option_context_new("- benchmark of the downloader");
+    g_option_context_add_main_entries(context, entries, NULL);
+    if (!g_option_context_parse(context, &argc, &argv, &tmp_err)) {
+        fprintf(stderr, "%s\n", tmp_err->message);
+        return EXIT_FAILURE;
+    }
+    g_option_context_free(context);
+
+    if (opt_files < 0 || opt_parallel <= 0 || opt_tiny_size < 0
+        || opt_huge_size_mb < 0) {
+        fprintf(stderr, "Bad arguments, see --help\n");
+        return EXIT_FAILURE;
+    }
+
+    BenchWorkload workloads[] = {
+        { "tiny",  10000, tiny_size,  opt_tiny_size },
+        { "huge",  4,     huge_size,  opt_huge_size_mb },
+        { "mixed", 1000,  mixed_size, 0 },
+    };
+
+    for (size_t x = 0; x < CHUNK_SIZE + PATTERN_PERIOD; x++)
+        pattern[x] = (char) (x % PATTERN_PERIOD);
+
+    if (!opt_mirrors || !opt_mirrors[0])
+        g_ptr_array_add(mirrors, parse_mirror("0:0:0"));
+    for (gchar **profile = opt_mirrors; profile && *profile; profile++) {
+        BenchMirror *mirror = parse_mirror(*profile);
+        if (!mirror)
+            return EXIT_FAILURE;
+        g_ptr_array_add(mirrors, mirror);
+    }
+
+    // Sockets are opened before the fork, so the ports are known
+    for (guint x = 0; x < mirrors->len; x++)
+        if (!open_mirror(g_ptr_array_index(mirrors, x)))
+            return EXIT_FAILURE;
+
+    server = fork();
+    if (server < 0) {
+        perror("fork");
+        return EXIT_FAILURE;
+    }
+    if (server == 0)
+        run_server(mirrors);  // Never returns
+
+    for (guint x = 0; x < mirrors->len; x++)
+        close(((BenchMirror *) g_ptr_array_index(mirrors, x))->sock);
+
+    lr_global_init();
+
+    for (size_t x = 0; x < G_N_ELEMENTS(workloads); x++) {
+        BenchWorkload *workload = &workloads[x];
+
+        if (opt_workload && strcmp(opt_workload, "all")
+            && strcmp(opt_workload, workload->name))
+            continue;
+        workload_found = TRUE;
+        if (opt_files > 0)
+            workload->files = (guint) opt_files;
+
+        if ((!opt_api || !strcmp(opt_api, "all") || !strcmp(opt_api, "download"))
+            && !run_forked_client(workload, "download", mirrors))
+            ret = EXIT_FAILURE;
+        if ((!opt_api || !strcmp(opt_api, "all") || !strcmp(opt_api, "packages"))
+            && !run_forked_client(workload, "packages", mirrors))
+            ret = EXIT_FAILURE;
+    }
+
+    if (!workload_found) {
+        fprintf(stderr, "Unknown workload: %s\n", opt_workload);
+        ret = EXIT_FAILURE;
+    }
+
+    kill(server, SIGTERM);
+    waitpid(server, NULL, 0);
+    g_ptr_array_free(mirrors, TRUE);
+    return ret;
+}
@@ -0,0 +1,527 @@
+/* Microbenchmarks of the parsers, the url substitution, the checksums,
+ * the fastestmirror cache and the library startup
+ *
+ * Usage: micro_benchmark [name filter]
+ *
+ * Every benchmark runs a fixed number of iterations on synthetic data
+ * (no network) and reports the time and the number of allocations
+ * (malloc, calloc and realloc calls, only with glibc) per iteration.
+ * The startup benchmarks run every iteration in a new process (the
+ * benchmark itself with --startup), their allocations are not counted.
+ * The bytes allocated by librepo itself (lr_malloc() and friends, see
+ * lr_alloc_accounting()) per iteration are reported too.
+ * Only the benchmarks whose name contains the filter are run.
+ */
+
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/wait.h>
+#include <glib.h>
+#include <glib/gstdio.h>
+
+#include "librepo/librepo.h"
+#include "librepo/fastestmirror_internal.h"
+
+#define METALINK_URLS       10000
+#define MIRRORLIST_URLS     10000
+#define REPOMD_RECORDS      100
+#define CACHE_RECORDS       10000
+
+typedef gboolean (*BenchFunc)(gpointer data, GError **err);
+
+typedef struct {
+    const char *name;
+    guint iterations;
+    BenchFunc func;
+    gpointer data;
+} Bench;
+
+// Counting of allocations
+
+static guint64 allocations = 0;
+
+#ifdef __GLIBC__
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t nmemb, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+
+void *
+malloc(size_t size)
+{
+    __atomic_add_fetch(&allocations, 1, __ATOMIC_RELAXED);
+    return __libc_malloc(size);
+}
+
+void *
+calloc(size_t nmemb, size_t size)
+{
+    __atomic_add_fetch(&allocations, 1, __ATOMIC_RELAXED);
+    return __libc_calloc(nmemb, size);
+}
+
+void *
+realloc(void *ptr, size_t size)
+{
+    __atomic_add_fetch(&allocations, 1, __ATOMIC_RELAXED);
+    return __libc_realloc(ptr, size);
+}
+#define ALLOCATIONS_COUNTED     TRUE
+#else
+#define ALLOCATIONS_COUNTED     FALSE
+#endif
+
+// Synthetic data
+
+static int
+write_file(const char *dir, const char *name, GString *content)
+{
+    gchar *path = g_build_filename(dir, name, NULL);
+    int fd = open(path, O_RDWR|O_CREAT|O_TRUNC, 0666);
+
+    if (fd == -1 || write(fd, content->str, content->len) != (ssize_t) content->len) {
+        perror(path);
+        exit(EXIT_FAILURE);
+    }
+
+    g_free(path);
+    g_string_free(content, TRUE);
+    return fd;
+}
+
+static int
+make_repomd(const char *dir)
+{
+    GString *xml = g_string_new(
+        "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n"
+        "<repomd xmlns=\"http://linux.duke.edu/metadata/repo\" "
+        "xmlns:rpm=\"http://linux.duke.edu/metadata/rpm\">\n"
+        "  <revision>1347459931</revision>\n");
+
+    for (int x = 0; x < REPOMD_RECORDS; x++)
+        g_string_append_printf(xml,
+            "  <data type=\"record%d\">\n"
+            "    <checksum type=\"sha256\">%064x</checksum>\n"
+            "    <open-checksum type=\"sha256\">%064x</open-checksum>\n"
+            "    <location href=\"repodata/%064x-record%d.xml.gz\"/>\n"
+            "    <timestamp>1347459930</timestamp>\n"
+            "    <size>%d</size>\n"
+            "    <open-size>%d</open-size>\n"
+            "  </data>\n", x, x, x + 1, x, x, 1000 + x, 5000 + x);
+    g_string_append(xml, "</repomd>\n");
+
+    return write_file(dir, "repomd.xml", xml);
+}
+
+static int
+make_metalink(const char *dir)
+{
+    GString *xml = g_string_new(
+        "<?xml version=\"1.0\" encoding=\"utf-8\"?>\n"
+        "<metalink version=\"3.0\" xmlns=\"http://www.metalinker.org/\" "
+        "type=\"dynamic\" generator=\"mirrormanager\" "
+        "xmlns:mm0=\"http://fedorahosted.org/mirrormanager\">\n"
+        "  <files>\n"
+        "    <file name=\"repomd.xml\">\n"
+        "      <mm0:timestamp>1337942396</mm0:timestamp>\n"
+        "      <size>4309</size>\n"
+        "      <verification>\n"
+        "        <hash type=\"sha256\">0076c44aabd352da878d5c4d794901ac87f66afac869488f6a4ef166de018cdf</hash>\n"
+        "      </verification>\n"
+        "      <resources maxconnections=\"1\">\n");
+
+    for (int x = 0; x < METALINK_URLS; x++)
+        g_string_append_printf(xml,
+            "        <url protocol=\"http\" type=\"http\" location=\"US\" "
+            "preference=\"%d\">http://mirror%d.example.com/fedora/releases/"
+            "17/Everything/x86_64/os/repodata/repomd.xml</url>\n",
+            100 - x % 100, x);
+    g_string_append(xml,
+        "      </resources>\n"
+        "    </file>\n"
+        "  </files>\n"
+        "</metalink>\n");
+
+    return write_file(dir, "metalink.xml", xml);
+}
+
+static int
+make_mirrorlist(const char *dir)
+{
+    GString *list = g_string_new("# repo = fedora-17 arch = x86_64\n");
+
+    for (int x = 0; x < MIRRORLIST_URLS; x++)
+        g_string_append_printf(list, "http://mirror%d.example.com/fedora/"
+                               "linux/releases/17/Everything/x86_64/os/\n", x);
+
+    return write_file(dir, "mirrorlist", list);
+}
+
+static int
+make_data(const char *dir, const char *name, gsize size)
+{
+    GString *data = g_string_sized_new(size);
+
+    for (gsize x = 0; x < size; x++)
+        g_string_append_c(data, (char) (x * 2654435761u >> 24));
+
+    return write_file(dir, name, data);
+}
+
+static void
+noop_fastestmirror_cb(G_GNUC_UNUSED void *clientp,
+                      G_GNUC_UNUSED LrFastestMirrorStages stage,
+                      G_GNUC_UNUSED void *ptr)
+{
+}
+
+typedef struct {
+    gchar *path;
+    gchar **urls;
+} CacheData;
+
+static CacheData *
+make_fastestmirrorcache(const char *dir)
+{
+    CacheData *data = g_new0(CacheData, 1);
+    LrFastestMirrorCache *cache;
+    gint64 now = g_get_real_time() / 1000000;
+
+    data->path = g_build_filename(dir, "fastestmirror.cache", NULL);
+    data->urls = g_new0(gchar *, CACHE_RECORDS + 1);
+
+    lr_fastestmirrorcache_load(&cache, data->path, noop_fastestmirror_cb,
+                               NULL, NULL);
+    for (int x = 0; x < CACHE_RECORDS; x++) {
+        LrFastestMirror mirror = { 0 };
+        data->urls[x] = g_strdup_printf("http://mirror%d.example.com/"
+                                        "fedora/linux/", x);
+        mirror.url = data->urls[x];
+        mirror.plain_connect_time = 0.001 * (x % 100);
+        mirror.ttfb = -1.0;
+        mirror.throughput = -1.0;
+        lr_fastestmirrorcache_update(cache, &mirror, now, 0);
+    }
+    if (!lr_fastestmirrorcache_write(cache, NULL)) {
+        fprintf(stderr, "Cannot write %s\n", data->path);
+        exit(EXIT_FAILURE);
+    }
+    lr_fastestmirrorcache_free(cache);
+
+    return data;
+}
+
+// Benchmarks
+
+static gboolean
+bench_repomd(gpointer data, GError **err)
+{
+    int fd = GPOINTER_TO_INT(data);
+    LrYumRepoMd *repomd = lr_yum_repomd_init();
+
+    lseek(fd, 0, SEEK_SET);
+    gboolean ret = lr_yum_repomd_parse_file(repomd, fd, NULL, NULL, err);
+    lr_yum_repomd_free(repomd);
+    return ret;
+}
+
+static gboolean
+bench_metalink(gpointer data, GError **err)
+{
+    int fd = GPOINTER_TO_INT(data);
+    LrMetalink *metalink = lr_metalink_init();
+
+    lseek(fd, 0, SEEK_SET);
+    gboolean ret = lr_metalink_parse_file(metalink, fd, "repomd.xml",
+                                          NULL, NULL, err);
+    lr_metalink_free(metalink);
+    return ret;
+}
+
+static gboolean
+bench_mirrorlist(gpointer data, GError **err)
+{
+    int fd = GPOINTER_TO_INT(data);
+    LrMirrorlist *mirrorlist = lr_mirrorlist_init();
+
+    lseek(fd, 0, SEEK_SET);
+    gboolean ret = lr_mirrorlist_parse_file(mirrorlist, fd, err);
+    lr_mirrorlist_free(mirrorlist);
+    return ret;
+}
+
+#define SUBSTITUTION_URL \
+    "http://mirrors.example.com/$contentdir/$releasever/Everything/$basearch/os/"
+
+static gboolean
+bench_url_substitute(gpointer data, G_GNUC_UNUSED GError **err)
+{
+    char *url = lr_url_substitute(SUBSTITUTION_URL, data);
+    lr_free(url);
+    return TRUE;
+}
+
+static gboolean
+bench_url_substitute_table(gpointer data, G_GNUC_UNUSED GError **err)
+{
+    char *url = lr_url_substitute_table(SUBSTITUTION_URL, data);
+    lr_free(url);
+    return TRUE;
+}
+
+typedef struct {
+    LrChecksumType type;
+    int fd;
+} ChecksumData;
+
+static gboolean
+bench_checksum_fd(gpointer data, GError **err)
+{
+    ChecksumData *cd = data;
+    char *checksum = lr_checksum_fd(cd->type, cd->fd, err);
+    lr_free(checksum);
+    return checksum != NULL;
+}
+
+static gboolean
+bench_fastestmirrorcache(gpointer data, GError **err)
+{
+    CacheData *cd = data;
+    LrFastestMirrorCache *cache;
+
+    if (!lr_fastestmirrorcache_load(&cache, cd->path, noop_fastestmirror_cb,
+                                    NULL, err))
+        return FALSE;
+
+    // The cache is loaded to look up the mirrors
+    for (gchar **url = cd->urls; *url; url++)
+        if (!lr_fastestmirrorcache_lookup(cache, *url)) {
+            g_set_error(err, LR_FASTESTMIRROR_ERROR, LRE_UNKNOWNERROR,
+                        "%s is not in the cache", *url);
+            lr_fastestmirrorcache_free(cache);
+            return FALSE;
+        }
+
+    lr_fastestmirrorcache_free(cache);
+    return TRUE;
+}
+
+// Startup of a new process, lazy initializations are not done yet
+
+static int
+startup_child(const char *mode, const char *repo)
+{
+    GError *tmp_err = NULL;
+    gboolean ret = TRUE;
+
+    if (!strcmp(mode, "exec"))
+        return EXIT_SUCCESS;
+
+    if (!strcmp(mode, "curl")) {
+        lr_global_init_curl();
+        return EXIT_SUCCESS;
+    }
+
+    LrHandle *handle = lr_handle_init();
+    if (!strcmp(mode, "local")) {
+        // Only repomd.xml of a local repository is loaded
+        char *urls[] = { (char *) repo, NULL };
+        char *dlist[] = { NULL };
+        LrResult *result = lr_result_init();
+        lr_handle_setopt(handle, NULL, LRO_URLS, urls);
+        lr_handle_setopt(handle, NULL, LRO_REPOTYPE, LR_YUMREPO);
+        lr_handle_setopt(handle, NULL, LRO_LOCAL, 1L);
+        lr_handle_setopt(handle, NULL, LRO_YUMDLIST, dlist);
+        lr_handle_setopt(handle, NULL, LRO_CHECKSUM, 0L);
+        ret = lr_handle_perform(handle, result, &tmp_err);
+        lr_result_free(result);
+    }
+    lr_handle_free(handle);
+
+    if (!ret) {
+        fprintf(stderr, "%s\n", tmp_err->message);
+        g_error_free(tmp_err);
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
+
+typedef struct {
+    const char *mode;
+    const char *repo;
+} StartupData;
+
+static gboolean
+bench_startup(gpointer data, GError **err)
+{
+    StartupData *sd = data;
+    gchar *argv[] = { "/proc/self/exe", "--startup", (gchar *) sd->mode,
+                      (gchar *) sd->repo, NULL };
+    gint status;
+
+    if (!g_spawn_sync(NULL, argv, NULL, G_SPAWN_STDOUT_TO_DEV_NULL,
+                      NULL, NULL, NULL, NULL, &status, err))
+        return FALSE;
+
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+        g_set_error(err, LR_HANDLE_ERROR, LRE_UNKNOWNERROR,
+                    "Startup process (%s) failed", sd->mode);
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+static gboolean
+run_bench(const Bench *bench)
+{
+    GError *tmp_err = NULL;
+
+    // Warm up (page cache, lazy initializations)
+    if (!bench->func(bench->data, &tmp_err))
+        goto error;
+
+    LrAllocStats lr_start, lr_end;
+    lr_alloc_stats_get(&lr_start, NULL);
+    guint64 allocs = __atomic_load_n(&allocations, __ATOMIC_RELAXED);
+    gint64 start = g_get_monotonic_time();
+    for (guint x = 0; x < bench->iterations; x++)
+        if (!bench->func(bench->data, &tmp_err))
+            goto error;
+    gint64 usec = g_get_monotonic_time() - start;
+    allocs = __atomic_load_n(&allocations, __ATOMIC_RELAXED) - allocs;
+    lr_alloc_stats_get(&lr_end, NULL);
+
+    printf("%-32s %10u %14.1f", bench->name, bench->iterations,
+           usec * 1000.0 / bench->iterations);
+    if (ALLOCATIONS_COUNTED)
+        printf(" %12.1f", (double) allocs / bench->iterations);
+    else
+        printf(" %12s", "-");
+    printf(" %14.1f\n",
+           (double) (lr_end.bytes - lr_start.bytes) / bench->iterations);
+    return TRUE;
+
+error:
+    fprintf(stderr, "%s: %s\n", bench->name, tmp_err->message);
+    g_error_free(tmp_err);
+    return FALSE;
+}
+
+int
+main(int argc, char *argv[])
+{
+    int ret = EXIT_SUCCESS;
+    GError *tmp_err = NULL;
+    const char *filter = argc > 1 ? argv[1] : NULL;
+    static const struct { const char *name; gsize size; guint iterations; }
+        sizes[] = {
+            { "4KiB",   4 * 1024,           20000 },
+            { "1MiB",   1024 * 1024,        200 },
+            { "64MiB",  64 * 1024 * 1024,   3 },
+        };
+    static const char *startup_modes[] = { "exec", "handle", "local", "curl" };
+
+    if (argc > 3 && !strcmp(argv[1], "--startup"))
+        return startup_child(argv[2], argv[3]);
+
+    // Curl is not needed, the same as by the library itself
+    lr_global_init_logging();
+    lr_alloc_accounting(TRUE);
+
+    gchar *dir = g_dir_make_tmp("librepo-microbenchmark-XXXXXX", &tmp_err);
+    if (!dir) {
+        fprintf(stderr, "%s\n", tmp_err->message);
+        return EXIT_FAILURE;
+    }
+
+    LrUrlVars *vars = NULL;
+    vars = lr_urlvars_set(vars, "contentdir", "fedora");
+    vars = lr_urlvars_set(vars, "releasever", "17");
+    vars = lr_urlvars_set(vars, "basearch", "x86_64");
+    LrUrlVarsTable *table = lr_urlvars_table_new(vars);
+
+    GArray *benches = g_array_new(FALSE, FALSE, sizeof(Bench));
+    Bench bench;
+
+#define ADD_BENCH(n, i, f, d) do { \
+        bench.name = (n); bench.iterations = (i); \
+        bench.func = (f); bench.data = (d); \
+        g_array_append_val(benches, bench); \
+    } while (0)
+
+    ADD_BENCH("repomd_parse_file", 2000, bench_repomd,
+              GINT_TO_POINTER(make_repomd(dir)));
+    ADD_BENCH("metalink_parse_file", 20, bench_metalink,
+              GINT_TO_POINTER(make_metalink(dir)));
+    ADD_BENCH("mirrorlist_parse_file", 100, bench_mirrorlist,
+              GINT_TO_POINTER(make_mirrorlist(dir)));
+    ADD_BENCH("url_substitute", 1000000, bench_url_substitute, vars);
+    ADD_BENCH("url_substitute_table", 1000000, bench_url_substitute_table,
+              table);
+
+    for (size_t s = 0; s < G_N_ELEMENTS(sizes); s++) {
+        int fd = make_data(dir, sizes[s].name, sizes[s].size);
+        for (int type = LR_CHECKSUM_MD5; type <= LR_CHECKSUM_SHA512; type++) {
+            ChecksumData *cd = g_new(ChecksumData, 1);
+            cd->type = type;
+            cd->fd = fd;
+            ADD_BENCH(g_strdup_printf("checksum_fd/%s/%s",
+                                      lr_checksum_type_to_str(type),
+                                      sizes[s].name),
+                      sizes[s].iterations, bench_checksum_fd, cd);
+        }
+    }
+
+    ADD_BENCH("fastestmirrorcache_load", 50, bench_fastestmirrorcache,
+              make_fastestmirrorcache(dir));
+
+    gchar *startup_repo = g_build_filename(dir, "startup", NULL);
+    gchar *startup_repodata = g_build_filename(startup_repo, "repodata", NULL);
+    g_mkdir_with_parents(startup_repodata, 0755);
+    close(make_repomd(startup_repodata));
+    for (size_t m = 0; m < G_N_ELEMENTS(startup_modes); m++) {
+        StartupData *sd = g_new(StartupData, 1);
+        sd->mode = startup_modes[m];
+        sd->repo = startup_repo;
+        ADD_BENCH(g_strdup_printf("startup/%s", startup_modes[m]), 50,
+                  bench_startup, sd);
+    }
+
+    printf("%-32s %10s %14s %12s %14s\n", "Benchmark", "Iterations", "ns/op",
+           "allocs/op", "lr bytes/op");
+    for (guint x = 0; x < benches->len; x++) {
+        Bench *b = &g_array_index(benches, Bench, x);
+        if (filter && !strstr(b->name, filter))
+            continue;
+        if (!run_bench(b))
+            ret = EXIT_FAILURE;
+    }
+
+    // The data are freed with the process, only the files are removed
+    const gchar *name;
+    GDir *gdir = g_dir_open(dir, 0, NULL);
+    while (gdir && (name = g_dir_read_name(gdir))) {
+        gchar *path = g_build_filename(dir, name, NULL);
+        g_unlink(path);
+        g_free(path);
+    }
+    if (gdir)
+        g_dir_close(gdir);
+    gchar *startup_repomd = g_build_filename(startup_repodata, "repomd.xml",
+                                             NULL);
+    g_unlink(startup_repomd);
+    g_rmdir(startup_repodata);
+    g_rmdir(startup_repo);
+    g_free(startup_repomd);
+    g_free(startup_repodata);
+    g_free(startup_repo);
+    g_rmdir(dir);
+    g_free(dir);
+
+    return ret;
+}
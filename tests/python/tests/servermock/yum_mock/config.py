@@ -5,6 +5,7 @@ BADURL = "yum/badurl/"
 BADGPG = "yum/badgpg/"
 AUTHBASIC = "yum/auth_basic/"
 PARTIAL = "yum/partial/"
+BYTERANGES = "yum/byteranges/%s/"
 
 AUTH_USER = "admin"
 AUTH_PASS = "secret"
@@ -33,6 +34,8 @@ METALINK_FIRSTURLHASCORRUPTEDFILES = METALINK_DIR+"firsturlhascorruptedfiles.xml
 METALINK_VARSUB = METALINK_DIR+"varsub.xml"
 METALINK_VARSUB_LIST = [("version", "01")]
 METALINK_WITH_ALTERNATES = METALINK_DIR+"metalink_with_alternates.xml"
+METALINK_PIECESWITHCORRUPTEDFIRSTURL = METALINK_DIR+"pieceswithcorruptedfirsturl.xml"
+METALINK_ENCODED = METALINK_DIR+"encoded_%s_01.xml"
 
 MIRRORLIST_DIR = "yum/static/mirrorlist/"
 MIRRORLIST_GOOD_01 = MIRRORLIST_DIR+"good_01"
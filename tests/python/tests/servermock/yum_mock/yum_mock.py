@@ -1,4 +1,5 @@
 import os
+import gzip
 from flask import Blueprint, render_template, abort, send_file, request, Response
 from flask import current_app
 from functools import wraps
@@ -54,6 +55,28 @@ def harm_checksum(keyword, path):
         # File probably doesn't exist or we can't read it
         abort(404)
 
+@yum_mock.route('/harm_piece/<keyword>/<path:path>')
+def harm_piece(keyword, path):
+    """Replace the first byte of content of a file (from the static dir)
+    with specified keyword in the filename. Size of the file is kept,
+    only its first piece is damaged. If the filename doesn't contain
+    the keyword, content of the file is returnen unchanged."""
+
+    if "static/" not in path:
+        # Support changing only files from static directory
+        abort(400)
+    path = path[path.find("static/"):]
+
+    try:
+        with yum_mock.open_resource(path) as f:
+            data = f.read()
+            if keyword in os.path.basename(path):
+                return b"#" + data[1:]
+            return data
+    except IOError:
+        # File probably doesn't exist or we can't read it
+        abort(404)
+
 @yum_mock.route("/not_found/<keyword>/<path:path>")
 def not_found(keyword, path):
     """For each file containing keyword in the filename, http status
@@ -73,6 +96,82 @@ def not_found(keyword, path):
         # File probably doesn't exist or we can't read it
         abort(404)
 
+@yum_mock.route("/byteranges/<mode>/<path:path>")
+def byteranges(mode, path):
+    """Answer a request for several byte ranges like a server would:
+    "multipart" sends a part for each range (multipart/byteranges),
+    "merged" sends one part from the first to the last requested byte
+    and "ignore" sends the whole file with 200 (single ranges are
+    always answered)"""
+
+    if "static/" not in path:
+        abort(400)
+    path = path[path.find("static/"):]
+
+    try:
+        with yum_mock.open_resource(path) as f:
+            data = f.read()
+    except IOError:
+        # File probably doesn't exist or we can't read it
+        abort(404)
+
+    header = request.headers.get("Range", "")
+    if not header.startswith("bytes=") or (mode == "ignore" and "," in header):
+        return Response(data, content_type="application/octet-stream")
+
+    ranges = []
+    for spec in header[len("bytes="):].split(","):
+        start, end = spec.strip().split("-")
+        end = int(end) if end else len(data) - 1
+        ranges.append((int(start), min(end, len(data) - 1)))
+
+    if mode == "merged" or len(ranges) == 1:
+        start = min(start for start, _ in ranges)
+        end = max(end for _, end in ranges)
+        content_range = "bytes %d-%d/%d" % (start, end, len(data))
+        return Response(data[start:end + 1], status=206,
+                        headers={"Content-Range": content_range},
+                        content_type="application/octet-stream")
+
+    boundary = "librepo_test_boundary"
+    body = b""
+    for start, end in ranges:
+        body += ("--%s\r\n"
+                 "Content-Type: application/octet-stream\r\n"
+                 "Content-Range: bytes %d-%d/%d\r\n\r\n"
+                 % (boundary, start, end, len(data))).encode()
+        body += data[start:end + 1] + b"\r\n"
+    body += ("--%s--\r\n" % boundary).encode()
+    return Response(body, status=206,
+                    content_type="multipart/byteranges; boundary=%s" % boundary)
+
+@yum_mock.route("/encoded/<mode>/<path:path>")
+def encoded(mode, path):
+    """Send a file gzip encoded if the request accepts gzip:
+    "gzip" encodes the file as it is and "bigger" encodes it with
+    two newlines appended (like harm_checksum). Requests without
+    Accept-Encoding get the file unchanged"""
+
+    if "static/" not in path:
+        abort(400)
+    path = path[path.find("static/"):]
+
+    try:
+        with yum_mock.open_resource(path) as f:
+            data = f.read()
+    except IOError:
+        # File probably doesn't exist or we can't read it
+        abort(404)
+
+    if "gzip" not in request.headers.get("Accept-Encoding", ""):
+        return Response(data, content_type="application/octet-stream")
+
+    if mode == "bigger":
+        data += b"\n\n"
+    return Response(gzip.compress(data),
+                    headers={"Content-Encoding": "gzip"},
+                    content_type="application/octet-stream")
+
 @yum_mock.route("/badurl/<path:path>")
 def badurl(path):
     """Just return 404 for each url with this prefix"""
@@ -1,3 +1,7 @@
+import os
+import json
+import shutil
+import tempfile
 import unittest
 import librepo
 
@@ -7,6 +11,12 @@ def foo_cb(data, total_to_download, downloaded):
 def foo_hmfcb(data, msg, url, metadata):
     pass
 
+def foo_multiprogresscb(data, progress):
+    pass
+
+def foo_yumrecordcb(data, metadata, path):
+    pass
+
 class TestCaseHandle(unittest.TestCase):
 
     def test_handle_setopt_getinfo(self):
@@ -289,6 +299,9 @@ class TestCaseHandle(unittest.TestCase):
         self.assertEqual(h.adaptivemirrorsorting, 0)
         h.adaptivemirrorsorting = None
         self.assertEqual(h.adaptivemirrorsorting, 1)
+        h.adaptivemirrorsorting = librepo.ADAPTIVEMIRRORSORTING_THROUGHPUT
+        self.assertEqual(h.adaptivemirrorsorting,
+                         librepo.ADAPTIVEMIRRORSORTING_THROUGHPUT)
 
         self.assertEqual(h.gnupghomedir, None)
         h.gnupghomedir =  "/tmp/keyring"
@@ -298,6 +311,392 @@ class TestCaseHandle(unittest.TestCase):
         h.gnupghomedir =  ""
         self.assertEqual(h.gnupghomedir, "")
 
+        self.assertEqual(h.http2, 0)
+
+        self.assertEqual(h.maxstreamspermirror, 16)
+        h.maxstreamspermirror = 100
+        self.assertEqual(h.maxstreamspermirror, 100)
+        h.maxstreamspermirror = None
+        self.assertEqual(h.maxstreamspermirror, 16)
+
+        self.assertEqual(h.maxsegments, 1)
+        h.maxsegments = 4
+        self.assertEqual(h.maxsegments, 4)
+        h.maxsegments = None
+        self.assertEqual(h.maxsegments, 1)
+        h.minsegmentsize = 1048576
+
+        self.assertEqual(h.writebuffersize, 0)
+        h.writebuffersize = 1048576
+        self.assertEqual(h.writebuffersize, 1048576)
+        h.writebuffersize = None
+        self.assertEqual(h.writebuffersize, 0)
+        self.assertEqual(h.preallocate, False)
+        h.preallocate = True
+        self.assertEqual(h.preallocate, True)
+        self.assertEqual(h.earlywriteback, False)
+        h.earlywriteback = True
+        self.assertEqual(h.earlywriteback, True)
+        self.assertEqual(h.downloadorder, librepo.DOWNLOADORDER_FIFO)
+        h.downloadorder = librepo.DOWNLOADORDER_LARGESTFIRST
+        self.assertEqual(h.downloadorder, librepo.DOWNLOADORDER_LARGESTFIRST)
+
+        self.assertEqual(h.adaptivedownloadspermirror, False)
+        h.adaptivedownloadspermirror = True
+        self.assertEqual(h.adaptivedownloadspermirror, True)
+
+        self.assertEqual(h.hedgeddownloads, False)
+        h.hedgeddownloads = True
+        self.assertEqual(h.hedgeddownloads, True)
+
+        self.assertEqual(h.lowspeedresume, False)
+        h.lowspeedresume = True
+        self.assertEqual(h.lowspeedresume, True)
+
+        self.assertEqual(h.progressinterval, 0)
+        h.progressinterval = 250
+        self.assertEqual(h.progressinterval, 250)
+        h.progressinterval = None
+        self.assertEqual(h.progressinterval, 0)
+
+        self.assertEqual(h.yumdecompress, None)
+        h.yumdecompress = ["primary", "filelists"]
+        self.assertEqual(h.yumdecompress, ["primary", "filelists"])
+        h.yumdecompress = None
+        self.assertEqual(h.yumdecompress, None)
+
+        self.assertEqual(h.yumkeepcompressed, True)
+        h.yumkeepcompressed = False
+        self.assertEqual(h.yumkeepcompressed, False)
+
+        self.assertEqual(h.checksumthreads, 1)
+        h.checksumthreads = 0
+        self.assertEqual(h.checksumthreads, 0)
+        h.checksumthreads = None
+        self.assertEqual(h.checksumthreads, 1)
+
+        self.assertEqual(h.checksumindex, False)
+        h.checksumindex = True
+        self.assertEqual(h.checksumindex, True)
+
+        self.assertEqual(h.parsecache, False)
+        h.parsecache = True
+        self.assertEqual(h.parsecache, True)
+
+        self.assertEqual(h.metalinkmaxurls, 0)
+        h.metalinkmaxurls = 5
+        self.assertEqual(h.metalinkmaxurls, 5)
+        h.metalinkmaxurls = None
+        self.assertEqual(h.metalinkmaxurls, 0)
+
+    def test_handle_fastestmirrorprobe(self):
+        h = librepo.Handle()
+        self.assertEqual(h.getinfo(librepo.LRI_FASTESTMIRRORPROBE), None)
+        h.setopt(librepo.LRO_FASTESTMIRRORPROBE, "repodata/repomd.xml")
+        self.assertEqual(h.getinfo(librepo.LRI_FASTESTMIRRORPROBE),
+                         "repodata/repomd.xml")
+        h.fastestmirrorprobe = None
+        self.assertEqual(h.getinfo(librepo.LRI_FASTESTMIRRORPROBE), None)
+
+    def test_handle_fastestmirror_concurrency_and_goodcount(self):
+        h = librepo.Handle()
+        self.assertEqual(h.getinfo(librepo.LRI_FASTESTMIRRORCONCURRENCY), 32)
+        self.assertEqual(h.getinfo(librepo.LRI_FASTESTMIRRORGOODCOUNT), 0)
+        h.fastestmirrorconcurrency = 4
+        h.fastestmirrorgoodcount = 3
+        self.assertEqual(h.getinfo(librepo.LRI_FASTESTMIRRORCONCURRENCY), 4)
+        self.assertEqual(h.getinfo(librepo.LRI_FASTESTMIRRORGOODCOUNT), 3)
+        h.fastestmirrorconcurrency = None
+        self.assertEqual(h.getinfo(librepo.LRI_FASTESTMIRRORCONCURRENCY), 32)
+        self.assertRaises(librepo.LibrepoException, h.setopt,
+                          librepo.LRO_FASTESTMIRRORGOODCOUNT, -1)
+
+    def test_handle_fastestmirrorasync(self):
+        h = librepo.Handle()
+        self.assertEqual(h.getinfo(librepo.LRI_FASTESTMIRRORASYNC), 0)
+        h.fastestmirrorasync = True
+        self.assertEqual(h.getinfo(librepo.LRI_FASTESTMIRRORASYNC), 1)
+
+    def test_handle_conditionalget(self):
+        h = librepo.Handle()
+        self.assertEqual(h.getinfo(librepo.LRI_CONDITIONALGET), 0)
+        h.conditionalget = True
+        self.assertEqual(h.getinfo(librepo.LRI_CONDITIONALGET), 1)
+
+    def test_handle_yumreusedir(self):
+        h = librepo.Handle()
+        self.assertEqual(h.getinfo(librepo.LRI_YUMREUSEDIR), None)
+        h.yumreusedir = "/tmp/previous"
+        self.assertEqual(h.getinfo(librepo.LRI_YUMREUSEDIR), "/tmp/previous")
+
+    def test_handle_lazychecksum(self):
+        h = librepo.Handle()
+        self.assertEqual(h.getinfo(librepo.LRI_LAZYCHECKSUM), 0)
+        h.lazychecksum = True
+        self.assertEqual(h.getinfo(librepo.LRI_LAZYCHECKSUM), 1)
+
+    def test_handle_mirrorlistcache(self):
+        h = librepo.Handle()
+        self.assertEqual(h.getinfo(librepo.LRI_MIRRORLISTCACHE), None)
+        h.mirrorlistcache = "/tmp/mlcache"
+        self.assertEqual(h.getinfo(librepo.LRI_MIRRORLISTCACHE), "/tmp/mlcache")
+        self.assertEqual(h.getinfo(librepo.LRI_MIRRORLISTCACHETTL), 3600)
+        h.mirrorlistcachettl = 60
+        self.assertEqual(h.getinfo(librepo.LRI_MIRRORLISTCACHETTL), 60)
+        h.mirrorlistcachettl = None
+        self.assertEqual(h.getinfo(librepo.LRI_MIRRORLISTCACHETTL), 3600)
+        self.assertRaises(librepo.LibrepoException, h.setopt,
+                          librepo.LRO_MIRRORLISTCACHETTL, -1)
+
+    def test_handle_preresolve(self):
+        h = librepo.Handle()
+        self.assertFalse(h.getinfo(librepo.LRI_PRERESOLVE))
+        h.preresolve = True
+        self.assertTrue(h.getinfo(librepo.LRI_PRERESOLVE))
+        self.assertEqual(h.getinfo(librepo.LRI_PRERESOLVECACHE), None)
+        h.preresolvecache = "/tmp/dnscache"
+        self.assertEqual(h.getinfo(librepo.LRI_PRERESOLVECACHE), "/tmp/dnscache")
+        self.assertEqual(h.getinfo(librepo.LRI_PRERESOLVECACHETTL), 300)
+        h.preresolvecachettl = 60
+        self.assertEqual(h.getinfo(librepo.LRI_PRERESOLVECACHETTL), 60)
+        h.preresolvecachettl = None
+        self.assertEqual(h.getinfo(librepo.LRI_PRERESOLVECACHETTL), 300)
+        self.assertRaises(librepo.LibrepoException, h.setopt,
+                          librepo.LRO_PRERESOLVECACHETTL, -1)
+
+    def test_handle_tlssessioncache(self):
+        h = librepo.Handle()
+        self.assertEqual(h.getinfo(librepo.LRI_TLSSESSIONCACHE), None)
+        h.tlssessioncache = "/tmp/tlscache"
+        self.assertEqual(h.getinfo(librepo.LRI_TLSSESSIONCACHE), "/tmp/tlscache")
+        h.tlssessioncache = None
+        self.assertEqual(h.getinfo(librepo.LRI_TLSSESSIONCACHE), None)
+
+    def test_handle_packagestore(self):
+        h = librepo.Handle()
+        self.assertEqual(h.getinfo(librepo.LRI_PACKAGESTORE), None)
+        h.packagestore = "/tmp/packagestore"
+        self.assertEqual(h.getinfo(librepo.LRI_PACKAGESTORE), "/tmp/packagestore")
+        h.packagestore = None
+        self.assertEqual(h.getinfo(librepo.LRI_PACKAGESTORE), None)
+        h.packagestoremaxsize = 1024*1024
+        h.packagestoremaxsize = None
+        self.assertRaises(librepo.LibrepoException, h.setopt,
+                          librepo.LRO_PACKAGESTOREMAXSIZE, -1)
+
+        self.assertEqual(h.cachesources, None)
+        h.cachesources = ["http://cache.lan/fedora/"]
+        self.assertEqual(h.cachesources, ["http://cache.lan/fedora/"])
+        h.cachesources = None
+        self.assertEqual(h.cachesources, None)
+        self.assertEqual(h.cachesourcetimeout, 1000)
+        h.cachesourcetimeout = 200
+        self.assertEqual(h.cachesourcetimeout, 200)
+        h.cachesourcetimeout = None
+        self.assertEqual(h.cachesourcetimeout, 1000)
+
+        self.assertEqual(h.localhardlink, False)
+        h.localhardlink = True
+        self.assertEqual(h.localhardlink, True)
+
+        self.assertEqual(h.durability, librepo.DURABILITY_NONE)
+        h.durability = librepo.DURABILITY_BATCH
+        self.assertEqual(h.durability, librepo.DURABILITY_BATCH)
+        h.durability = None
+        self.assertEqual(h.durability, librepo.DURABILITY_NONE)
+
+        self.assertEqual(h.atomicdownload, False)
+        h.atomicdownload = True
+        self.assertEqual(h.atomicdownload, True)
+
+        self.assertEqual(h.gpgbackend, librepo.GPGBACKEND_DEFAULT)
+        h.gpgbackend = librepo.GPGBACKEND_BUILTIN
+        self.assertEqual(h.gpgbackend, librepo.GPGBACKEND_BUILTIN)
+        h.gpgbackend = None
+        self.assertEqual(h.gpgbackend, librepo.GPGBACKEND_DEFAULT)
+
+        self.assertEqual(h.stats, {"bytes": 0, "time": 0.0,
+                                   "successful": 0, "failed": 0,
+                                   "retries": 0, "speed": 0.0,
+                                   "allocations": 0,
+                                   "allocated_bytes": 0,
+                                   "parallel_downloads": 0,
+                                   "mirrors": []})
+
+    def test_handle_mirrorhealthcache(self):
+        h = librepo.Handle()
+        self.assertEqual(h.getinfo(librepo.LRI_MIRRORHEALTHCACHE), None)
+        h.mirrorhealthcache = "/tmp/mirrorhealth"
+        self.assertEqual(h.getinfo(librepo.LRI_MIRRORHEALTHCACHE), "/tmp/mirrorhealth")
+        h.mirrorhealthcache = None
+        self.assertEqual(h.getinfo(librepo.LRI_MIRRORHEALTHCACHE), None)
+
+    def test_handle_mirrorbreaker(self):
+        h = librepo.Handle()
+        self.assertEqual(h.mirrorbreaker, 0)
+        h.mirrorbreaker = 3
+        self.assertEqual(h.mirrorbreaker, 3)
+        h.mirrorbreaker = None
+        self.assertEqual(h.mirrorbreaker, 0)
+        self.assertRaises(librepo.LibrepoException, h.setopt,
+                          librepo.LRO_MIRRORBREAKER, -1)
+
+    def test_handle_tracefile(self):
+        h = librepo.Handle()
+        self.assertEqual(h.tracefile, None)
+        self.assertEqual(h.traceformat, librepo.TRACE_CHROME)
+        tmpdir = tempfile.mkdtemp(prefix="librepotest-")
+        try:
+            trace = os.path.join(tmpdir, "trace.json")
+            h.tracefile = trace
+            self.assertEqual(h.tracefile, trace)
+            self.assertTrue(os.path.isfile(trace))
+            h.traceformat = librepo.TRACE_JSONLINES
+            self.assertEqual(h.traceformat, librepo.TRACE_JSONLINES)
+            h.traceformat = None
+            self.assertEqual(h.traceformat, librepo.TRACE_CHROME)
+            h.tracefile = None
+            self.assertEqual(h.tracefile, None)
+            self.assertEqual(json.load(open(trace)), [])
+            self.assertRaises(librepo.LibrepoException, h.setopt,
+                              librepo.LRO_TRACEFILE,
+                              os.path.join(tmpdir, "missing", "trace.json"))
+            self.assertEqual(h.tracefile, None)
+        finally:
+            shutil.rmtree(tmpdir)
+
+    def test_handle_metricsinterval(self):
+        h = librepo.Handle()
+        self.assertEqual(h.metricsinterval, 1000)
+        h.metricsinterval = 200
+        self.assertEqual(h.metricsinterval, 200)
+        h.metricsinterval = None
+        self.assertEqual(h.metricsinterval, 1000)
+        self.assertRaises(librepo.LibrepoException, h.setopt,
+                          librepo.LRO_METRICSINTERVAL, 0)
+        h.metricscb = lambda data, metrics: None
+        h.metricscb = None
+
+    def test_handle_downloadshards(self):
+        h = librepo.Handle()
+        self.assertEqual(h.downloadshards, 1)
+        h.downloadshards = 4
+        self.assertEqual(h.downloadshards, 4)
+        h.downloadshards = None
+        self.assertEqual(h.downloadshards, 1)
+        self.assertRaises(librepo.LibrepoException, h.setopt,
+                          librepo.LRO_DOWNLOADSHARDS, -1)
+        self.assertRaises(librepo.LibrepoException, h.setopt,
+                          librepo.LRO_DOWNLOADSHARDS, 65)
+
+        self.assertEqual(h.shardendcb, False)
+        h.shardendcb = True
+        self.assertEqual(h.shardendcb, True)
+        h.shardendcb = False
+        self.assertEqual(h.shardendcb, False)
+
+    def test_handle_iouring(self):
+        h = librepo.Handle()
+        self.assertEqual(h.iouring, False)
+        h.iouring = True
+        self.assertEqual(h.iouring, True)
+        h.iouring = None
+        self.assertEqual(h.iouring, False)
+
+    def test_handle_resumejournal(self):
+        h = librepo.Handle()
+        self.assertEqual(h.resumejournal, False)
+        h.resumejournal = True
+        self.assertEqual(h.resumejournal, True)
+        h.resumejournal = None
+        self.assertEqual(h.resumejournal, False)
+
+    def test_handle_maxrangesperrequest(self):
+        h = librepo.Handle()
+        self.assertEqual(h.maxrangesperrequest, 1)
+        h.maxrangesperrequest = 16
+        self.assertEqual(h.maxrangesperrequest, 16)
+        h.maxrangesperrequest = None
+        self.assertEqual(h.maxrangesperrequest, 1)
+        self.assertRaises(librepo.LibrepoException, h.setopt,
+                          librepo.LRO_MAXRANGESPERREQUEST, 0)
+
+    def test_handle_connectionaffinity(self):
+        h = librepo.Handle()
+        self.assertEqual(h.connectionaffinity, False)
+        h.connectionaffinity = True
+        self.assertEqual(h.connectionaffinity, True)
+        h.connectionaffinity = None
+        self.assertEqual(h.connectionaffinity, False)
+
+    def test_handle_autotuneparalleldownloads(self):
+        h = librepo.Handle()
+        self.assertEqual(h.autotuneparalleldownloads, False)
+        h.autotuneparalleldownloads = True
+        self.assertEqual(h.autotuneparalleldownloads, True)
+        h.autotuneparalleldownloads = None
+        self.assertEqual(h.autotuneparalleldownloads, False)
+
+    def test_handle_acceptencoding(self):
+        h = librepo.Handle()
+        self.assertEqual(h.acceptencoding, False)
+        h.acceptencoding = True
+        self.assertEqual(h.acceptencoding, True)
+        h.acceptencoding = None
+        self.assertEqual(h.acceptencoding, False)
+
+    def test_handle_criticalslots(self):
+        h = librepo.Handle()
+        self.assertEqual(h.criticalslots, 0)
+        h.criticalslots = 2
+        self.assertEqual(h.criticalslots, 2)
+        h.criticalslots = None
+        self.assertEqual(h.criticalslots, 0)
+        self.assertRaises(librepo.LibrepoException, h.setopt,
+                          librepo.LRO_CRITICALSLOTS, -1)
+
+    def test_handle_proxies(self):
+        h = librepo.Handle()
+        self.assertEqual(h.proxies, None)
+        h.proxies = ["proxy1:3128 2", "proxy2:3128", "backup:3128 0"]
+        self.assertEqual(h.proxies,
+                         ["proxy1:3128 2", "proxy2:3128", "backup:3128 0"])
+        h.proxies = None
+        self.assertEqual(h.proxies, None)
+        self.assertRaises(librepo.LibrepoException, h.setopt,
+                          librepo.LRO_PROXIES, ["proxy1:3128 heavy"])
+        self.assertRaises(librepo.LibrepoException, h.setopt,
+                          librepo.LRO_PROXIES, ["proxy1:3128 1 2"])
+
+    def test_handle_recvbuffersize(self):
+        h = librepo.Handle()
+        self.assertEqual(h.recvbuffersize, 0)
+        h.recvbuffersize = 524288
+        self.assertEqual(h.recvbuffersize, 524288)
+        h.recvbuffersize = None
+        self.assertEqual(h.recvbuffersize, 0)
+        self.assertRaises(librepo.LibrepoException, h.setopt,
+                          librepo.LRO_RECVBUFFERSIZE, -1)
+        self.assertRaises(librepo.LibrepoException, h.setopt,
+                          librepo.LRO_RECVBUFFERSIZE, 20 * 1024 * 1024)
+
+    def test_handle_endcbthreads(self):
+        h = librepo.Handle()
+        self.assertEqual(h.endcbthreads, 0)
+        self.assertEqual(h.endcbqueuesize, 16)
+        h.endcbthreads = 4
+        h.endcbqueuesize = 2
+        self.assertEqual(h.endcbthreads, 4)
+        self.assertEqual(h.endcbqueuesize, 2)
+        h.endcbthreads = None
+        h.endcbqueuesize = None
+        self.assertEqual(h.endcbthreads, 0)
+        self.assertEqual(h.endcbqueuesize, 16)
+        self.assertRaises(librepo.LibrepoException, h.setopt,
+                          librepo.LRO_ENDCBTHREADS, -1)
+        self.assertRaises(librepo.LibrepoException, h.setopt,
+                          librepo.LRO_ENDCBQUEUESIZE, 0)
+
     def test_handle_setopt_none_value(self):
         """Using None in setopt."""
         h = librepo.Handle()
@@ -380,6 +779,16 @@ class TestCaseHandle(unittest.TestCase):
         h.setopt(librepo.LRO_HMFCB, None)
         h.hmfcb = None
 
+        h.setopt(librepo.LRO_MULTIPROGRESSCB, foo_multiprogresscb)
+        h.multiprogresscb = foo_multiprogresscb
+        h.setopt(librepo.LRO_MULTIPROGRESSCB, None)
+        h.multiprogresscb = None
+
+        h.setopt(librepo.LRO_YUMRECORDCB, foo_yumrecordcb)
+        h.yumrecordcb = foo_yumrecordcb
+        h.setopt(librepo.LRO_YUMRECORDCB, None)
+        h.yumrecordcb = None
+
         h.setopt(librepo.LRO_SSLVERIFYPEER, None)
         h.sslverifypeer = None
         h.setopt(librepo.LRO_SSLVERIFYHOST, None)
@@ -394,3 +803,18 @@ class TestCaseHandle(unittest.TestCase):
 
         h.setopt(librepo.LRO_GNUPGHOMEDIR, None)
         h.gnupghomedir = None
+
+    def test_handle_cancel(self):
+        h = librepo.Handle()
+        h.urls = ["http://127.0.0.1/"]
+        h.repotype = librepo.LR_YUMREPO
+
+        h.cancel()
+        try:
+            h.perform()
+        except librepo.LibrepoException as err:
+            self.assertEqual(err.args[0], librepo.LRE_CANCELLED)
+        else:
+            self.fail("Cancelled handle performed")
+
+        h.reset_cancel()
@@ -39,3 +39,5 @@ class TestCaseSanity(unittest.TestCase):
         self.assertEqual(t.cbdata, None)
         self.assertEqual(t.local_path, None)
         self.assertEqual(t.err, None)
+        self.assertEqual(t.total_time, 0.0)
+        self.assertEqual(t.attempts, 0)
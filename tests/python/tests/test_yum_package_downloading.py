@@ -1,10 +1,13 @@
 import os
+import sys
+import time
 import shutil
 import os.path
 import librepo
 import hashlib
 import unittest
 import tempfile
+import threading
 
 import tests.servermock.yum_mock.config as config
 
@@ -204,6 +207,64 @@ class TestCaseYumPackagesDownloading(TestCaseWithFlask):
         self.assertEqual(t.endcb, endcb)
         self.assertEqual(t.mirrorfailurecb, mirrorfailurecb)
 
+    def test_packagetarget_bulk(self):
+        h = librepo.Handle()
+
+        targets = librepo.PackageTarget.bulk(["foo", b"bar", u"baz"],
+                                             dests=self.tmpdir,
+                                             checksum_types=librepo.CHECKSUM_SHA256,
+                                             checksums=["aaa", None, "ccc"],
+                                             expectedsizes=[1, 2, 3],
+                                             base_url="basefoo",
+                                             handle=h)
+
+        self.assertEqual(len(targets), 3)
+        self.assertTrue(isinstance(targets[0], librepo.PackageTarget))
+        self.assertEqual([t.relative_url for t in targets], ["foo", "bar", "baz"])
+        self.assertEqual([t.dest for t in targets], [self.tmpdir] * 3)
+        self.assertEqual([t.checksum for t in targets], ["aaa", None, "ccc"])
+        self.assertEqual([t.expectedsize for t in targets], [1, 2, 3])
+        for t in targets:
+            self.assertEqual(t.checksum_type, librepo.CHECKSUM_SHA256)
+            self.assertEqual(t.base_url, "basefoo")
+            self.assertEqual(t.handle, h)
+            self.assertEqual(t.endcb, None)
+
+        self.assertEqual(librepo.PackageTarget.bulk([]), [])
+        self.assertRaises(ValueError, librepo.PackageTarget.bulk,
+                          ["foo", "bar"], dests=["a"])
+        self.assertRaises(TypeError, librepo.PackageTarget.bulk, [None])
+
+    def test_download_packages_bulk(self):
+        h = librepo.Handle()
+
+        url = "%s%s" % (self.MOCKURL, config.REPO_YUM_01_PATH)
+        h.setopt(librepo.LRO_URLS, [url])
+        h.setopt(librepo.LRO_REPOTYPE, librepo.LR_YUMREPO)
+
+        ended = []
+        pkgs = librepo.PackageTarget.bulk((p for p in [config.PACKAGE_01_01]),
+                                          dests=self.tmpdir,
+                                          handle=h)
+        pkgs[0].endcb = lambda *args: ended.append(args)
+
+        librepo.download_packages(pkgs)
+
+        self.assertTrue(pkgs[0].err is None)
+        self.assertTrue(os.path.isfile(pkgs[0].local_path))
+        self.assertEqual(len(ended), 1)
+
+    def test_download_url_into_memory(self):
+        url = "%s%s%s" % (self.MOCKURL, config.REPO_YUM_01_PATH,
+                          config.PACKAGE_01_01)
+        data = librepo.download_url(url)
+
+        self.assertTrue(isinstance(data, memoryview))
+        self.assertTrue(data.readonly)
+        self.assertEqual(hashlib.sha256(data).hexdigest(),
+                         config.PACKAGE_01_01_SHA256)
+        self.assertEqual(len(bytes(data)), len(data))
+
     def test_download_packages_00(self):
         h = librepo.Handle()
 
@@ -231,6 +292,73 @@ class TestCaseYumPackagesDownloading(TestCaseWithFlask):
         for pkg in pkgs:
             self.assertTrue(pkg.err is None)
             self.assertTrue(os.path.isfile(pkg.local_path))
+            self.assertEqual(pkg.attempts, 1)
+            self.assertTrue(pkg.total_time >= pkg.starttransfer_time)
+
+    @unittest.skipIf(sys.version_info < (3, 5), "asyncio is required")
+    def test_download_packages_async(self):
+        import asyncio
+
+        h = librepo.Handle()
+
+        url = "%s%s" % (self.MOCKURL, config.REPO_YUM_01_PATH)
+        h.setopt(librepo.LRO_URLS, [url])
+        h.setopt(librepo.LRO_REPOTYPE, librepo.LR_YUMREPO)
+
+        ended = []
+        pkgs = []
+        pkgs.append(librepo.PackageTarget(config.PACKAGE_01_01,
+                                          handle=h,
+                                          dest=self.tmpdir,
+                                          endcb=lambda *args: ended.append(args)))
+        pkgs.append(librepo.PackageTarget("foo",
+                                          handle=h,
+                                          dest=self.tmpdir))
+
+        loop = asyncio.new_event_loop()
+        try:
+            future = librepo.download_packages_async(pkgs, loop=loop)
+            statuses = loop.run_until_complete(
+                asyncio.gather(*[pkg.future for pkg in pkgs]))
+            loop.run_until_complete(future)
+        finally:
+            loop.close()
+
+        self.assertEqual(statuses[0][0], librepo.TRANSFER_SUCCESSFUL)
+        self.assertEqual(statuses[1][0], librepo.TRANSFER_ERROR)
+        self.assertTrue(os.path.isfile(pkgs[0].local_path))
+        self.assertTrue(pkgs[1].err)
+        # The original end callback is called and restored
+        self.assertEqual(len(ended), 1)
+        self.assertFalse(isinstance(pkgs[0].endcb, librepo._FutureEndCb))
+
+    def test_download_packages_iter(self):
+        h = librepo.Handle()
+
+        url = "%s%s" % (self.MOCKURL, config.REPO_YUM_01_PATH)
+        h.setopt(librepo.LRO_URLS, [url])
+        h.setopt(librepo.LRO_REPOTYPE, librepo.LR_YUMREPO)
+
+        pkgs = []
+        pkgs.append(librepo.PackageTarget(config.PACKAGE_01_01,
+                                          handle=h,
+                                          dest=self.tmpdir))
+        pkgs.append(librepo.PackageTarget("foo",
+                                          handle=h,
+                                          dest=self.tmpdir))
+
+        statuses = {}
+        for target, status, msg in librepo.download_packages_iter(pkgs):
+            self.assertFalse(target.relative_url in statuses)
+            statuses[target.relative_url] = status
+            if status == librepo.TRANSFER_SUCCESSFUL:
+                self.assertTrue(os.path.isfile(target.local_path))
+
+        self.assertEqual(statuses, {
+            config.PACKAGE_01_01: librepo.TRANSFER_SUCCESSFUL,
+            "foo": librepo.TRANSFER_ERROR})
+        self.assertTrue(pkgs[0].err is None)
+        self.assertTrue(pkgs[1].err)
 
     def test_download_packages_02(self):
         h = librepo.Handle()
@@ -400,6 +528,37 @@ class TestCaseYumPackagesDownloading(TestCaseWithFlask):
         pkg = pkgs[0]
         self.assertTrue(pkg.err)
 
+    def test_download_packages_verified_by_parts(self):
+        h = librepo.Handle()
+
+        url = "%s%s" % (self.MOCKURL, config.REPO_YUM_01_PATH)
+        h.setopt(librepo.LRO_URLS, [url])
+        h.setopt(librepo.LRO_REPOTYPE, librepo.LR_YUMREPO)
+        h.maxsegments = 4
+        h.minsegmentsize = 1024
+        h.checksumthreads = 0
+
+        baddir = os.path.join(self.tmpdir, "bad")
+        os.mkdir(baddir)
+
+        pkgs = []
+        pkgs.append(librepo.PackageTarget(config.PACKAGE_01_01,
+                                          handle=h,
+                                          dest=self.tmpdir,
+                                          checksum_type=librepo.SHA256,
+                                          checksum=config.PACKAGE_01_01_SHA256))
+        pkgs.append(librepo.PackageTarget(config.PACKAGE_01_01,
+                                          handle=h,
+                                          dest=baddir,
+                                          checksum_type=librepo.SHA256,
+                                          checksum="badchecksum"))
+
+        librepo.download_packages(pkgs)
+
+        self.assertTrue(pkgs[0].err is None)
+        self.assertTrue(os.path.isfile(pkgs[0].local_path))
+        self.assertTrue(pkgs[1].err)
+
     def test_download_packages_with_baseurl(self):
         h = librepo.Handle()
 
@@ -656,6 +815,520 @@ class TestCaseYumPackagesDownloading(TestCaseWithFlask):
         self.assertTrue(pkgs[1].err is not None)
         self.assertFalse(os.path.isfile(pkgs[1].local_path))
 
+    def test_download_packages_with_mirrorbreaker(self):
+        h = librepo.Handle()
+
+        url1 = "%s%s" % (self.MOCKURL, config.REPO_YUM_02_PATH)
+        url2 = "%s%s" % (self.MOCKURL, config.REPO_YUM_01_PATH)
+        h.setopt(librepo.LRO_URLS, [url1, url2])
+        h.setopt(librepo.LRO_REPOTYPE, librepo.LR_YUMREPO)
+        h.maxparalleldownloads = 1
+        h.allowedmirrorfailures = -1
+        h.adaptivemirrorsorting = False
+        h.mirrorbreaker = 1
+
+        # Files which the first mirror doesn't have
+        files = ["repodata/4543ad62e4d86337cd1949346f9aec976b847b58-primary.xml.gz",
+                 "repodata/aeca08fccd3c1ab831e1df1a62711a44ba1922c9-filelists.xml.gz",
+                 "repodata/a8977cdaa0b14321d9acfab81ce8a85e869eee32-other.xml.gz"]
+        pkgs = []
+        for fn in files:
+            pkgs.append(librepo.PackageTarget(fn,
+                                              handle=h,
+                                              dest=self.tmpdir))
+
+        librepo.download_packages(pkgs, failfast=True)
+
+        for pkg in pkgs:
+            self.assertTrue(pkg.err is None)
+            self.assertTrue(os.path.isfile(pkg.local_path))
+
+        # The breaker of the first mirror opened after its first failure,
+        # so the next files went to the second mirror directly
+        stats = h.stats
+        self.assertEqual(stats["successful"], len(files))
+        self.assertTrue(stats["failed"] < len(files))
+
+    def test_download_packages_with_proxies(self):
+        h = librepo.Handle()
+
+        url = "%s%s" % (self.MOCKURL, config.REPO_YUM_01_PATH)
+        h.setopt(librepo.LRO_URLS, [url])
+        h.setopt(librepo.LRO_REPOTYPE, librepo.LR_YUMREPO)
+        h.maxparalleldownloads = 1
+        # The first (preferred) proxy is down, the mock server
+        # serves the requests for itself as the second one
+        h.proxies = ["http://127.0.0.1:1 2",
+                     "http://127.0.0.1:%d" % self.PORT]
+
+        files = ["repodata/4543ad62e4d86337cd1949346f9aec976b847b58-primary.xml.gz",
+                 config.PACKAGE_01_01]
+        pkgs = []
+        for fn in files:
+            pkgs.append(librepo.PackageTarget(fn,
+                                              handle=h,
+                                              dest=self.tmpdir))
+
+        librepo.download_packages(pkgs, failfast=True)
+
+        # The only mirror was tried again through the second proxy
+        for pkg in pkgs:
+            self.assertTrue(pkg.err is None)
+            self.assertTrue(os.path.isfile(pkg.local_path))
+
+    def test_download_packages_sharded(self):
+        h = librepo.Handle()
+
+        url = "%s%s" % (self.MOCKURL, config.REPO_YUM_01_PATH)
+        h.setopt(librepo.LRO_URLS, [url])
+        h.setopt(librepo.LRO_REPOTYPE, librepo.LR_YUMREPO)
+        h.maxparalleldownloads = 4
+        h.maxdownloadspermirror = 2
+        h.downloadshards = 3
+        h.shardendcb = True
+
+        ended = []
+        def endcb(cbdata, status, msg):
+            ended.append((cbdata, threading.current_thread()))
+
+        files = ["repodata/4543ad62e4d86337cd1949346f9aec976b847b58-primary.xml.gz",
+                 "repodata/aeca08fccd3c1ab831e1df1a62711a44ba1922c9-filelists.xml.gz",
+                 "repodata/a8977cdaa0b14321d9acfab81ce8a85e869eee32-other.xml.gz",
+                 config.PACKAGE_01_01]
+        pkgs = []
+        for x, fn in enumerate(files):
+            pkgs.append(librepo.PackageTarget(fn,
+                                              handle=h,
+                                              dest=self.tmpdir,
+                                              cbdata=x,
+                                              endcb=endcb))
+
+        librepo.download_packages(pkgs, failfast=True)
+
+        for pkg in pkgs:
+            self.assertTrue(pkg.err is None)
+            self.assertTrue(os.path.isfile(pkg.local_path))
+
+        # The end callbacks got their cbdata and were called
+        # by the thread which started the download
+        self.assertEqual(sorted(cbdata for cbdata, _ in ended),
+                         list(range(len(files))))
+        for _, thread in ended:
+            self.assertEqual(thread, threading.current_thread())
+
+        stats = h.stats
+        self.assertEqual(stats["successful"], len(files))
+        self.assertEqual(stats["failed"], 0)
+        self.assertTrue(stats["time"] > 0.0)
+
+    def test_download_packages_endcbthreads(self):
+        h = librepo.Handle()
+
+        url = "%s%s" % (self.MOCKURL, config.REPO_YUM_01_PATH)
+        h.setopt(librepo.LRO_URLS, [url])
+        h.setopt(librepo.LRO_REPOTYPE, librepo.LR_YUMREPO)
+        h.endcbthreads = 2
+        h.endcbqueuesize = 1
+
+        lock = threading.Lock()
+        ended = []
+        running = [0, 0]    # Running callbacks, maximum of them
+        def endcb(cbdata, status, msg):
+            with lock:
+                running[0] += 1
+                running[1] = max(running)
+            # The file is complete when the callback is called
+            with open(os.path.join(self.tmpdir, files[cbdata]), "rb") as f:
+                size = len(f.read())
+            with lock:
+                running[0] -= 1
+                ended.append((cbdata, status, size,
+                              threading.current_thread()))
+
+        files = ["repodata/4543ad62e4d86337cd1949346f9aec976b847b58-primary.xml.gz",
+                 "repodata/aeca08fccd3c1ab831e1df1a62711a44ba1922c9-filelists.xml.gz",
+                 "repodata/a8977cdaa0b14321d9acfab81ce8a85e869eee32-other.xml.gz",
+                 config.PACKAGE_01_01]
+        pkgs = []
+        for x, fn in enumerate(files):
+            pkgs.append(librepo.PackageTarget(fn,
+                                              handle=h,
+                                              dest=self.tmpdir,
+                                              cbdata=x,
+                                              endcb=endcb))
+
+        librepo.download_packages(pkgs, failfast=True)
+
+        # All the callbacks returned before the download returned
+        self.assertEqual(sorted(cbdata for cbdata, _, _, _ in ended),
+                         list(range(len(files))))
+        for cbdata, status, size, thread in ended:
+            self.assertEqual(status, librepo.TRANSFER_SUCCESSFUL)
+            self.assertEqual(size, os.path.getsize(pkgs[cbdata].local_path))
+            self.assertNotEqual(thread, threading.current_thread())
+        self.assertTrue(running[1] <= 2)
+
+    def test_download_packages_endcbthreads_cb_error(self):
+        h = librepo.Handle()
+
+        url = "%s%s" % (self.MOCKURL, config.REPO_YUM_01_PATH)
+        h.setopt(librepo.LRO_URLS, [url])
+        h.setopt(librepo.LRO_REPOTYPE, librepo.LR_YUMREPO)
+        h.endcbthreads = 1
+        h.endcbqueuesize = 1
+        h.maxparalleldownloads = 1
+
+        pkgs = []
+        pkgs.append(librepo.PackageTarget(config.PACKAGE_01_01,
+                                          handle=h,
+                                          dest=self.tmpdir,
+                                          endcb=lambda *args: librepo.CB_ERROR))
+
+        # LR_CB_ERROR returned by the thread interrupts the download
+        self.assertRaises(librepo.LibrepoException,
+                          librepo.download_packages, pkgs, failfast=True)
+
+    def test_download_packages_endcbthreads_deltas(self):
+        """The end callbacks of the deltas run in the threads, the failed
+        deltas are replaced by the whole packages"""
+        h1 = librepo.Handle()
+        h1.setopt(librepo.LRO_URLS,
+                  ["%s%s" % (self.MOCKURL, config.REPO_YUM_01_PATH)])
+        h1.setopt(librepo.LRO_REPOTYPE, librepo.LR_YUMREPO)
+        h1.endcbthreads = 2
+        h1.endcbqueuesize = 1
+
+        h3 = librepo.Handle()
+        h3.setopt(librepo.LRO_URLS,
+                  ["%s%s" % (self.MOCKURL, config.REPO_YUM_03_PATH)])
+        h3.setopt(librepo.LRO_REPOTYPE, librepo.LR_YUMREPO)
+
+        lock = threading.Lock()
+        ended = []
+        def endcb(cbdata, status, msg):
+            with lock:
+                ended.append((cbdata, status))
+
+        pkgs = []
+        # The delta is downloaded, but it is not a delta RPM
+        pkg = librepo.PackageTarget(config.PACKAGE_01_01,
+                                    handle=h1,
+                                    dest=self.tmpdir,
+                                    checksum_type=librepo.SHA256,
+                                    checksum=config.PACKAGE_01_01_SHA256,
+                                    cbdata=0,
+                                    endcb=endcb)
+        pkg.set_delta("repodata/repomd.xml")
+        pkgs.append(pkg)
+        # The delta doesn't exist
+        pkg = librepo.PackageTarget(config.PACKAGE_03_01,
+                                    handle=h3,
+                                    dest=self.tmpdir,
+                                    cbdata=1,
+                                    endcb=endcb)
+        pkg.set_delta("missing.drpm")
+        pkgs.append(pkg)
+
+        librepo.download_packages(pkgs, failfast=True)
+
+        self.assertEqual(sorted(ended), [(0, librepo.TRANSFER_SUCCESSFUL),
+                                         (1, librepo.TRANSFER_SUCCESSFUL)])
+        for pkg in pkgs:
+            self.assertEqual(pkg.err, None)
+            self.assertTrue(os.path.isfile(pkg.local_path))
+
+    def test_download_packages_autotune(self):
+        h = librepo.Handle()
+
+        url = "%s%s" % (self.MOCKURL, config.REPO_YUM_01_PATH)
+        h.setopt(librepo.LRO_URLS, [url])
+        h.setopt(librepo.LRO_REPOTYPE, librepo.LR_YUMREPO)
+        h.maxparalleldownloads = 8
+        h.autotuneparalleldownloads = True
+
+        small = ["repodata/4543ad62e4d86337cd1949346f9aec976b847b58-primary.xml.gz",
+                 "repodata/aeca08fccd3c1ab831e1df1a62711a44ba1922c9-filelists.xml.gz",
+                 "repodata/a8977cdaa0b14321d9acfab81ce8a85e869eee32-other.xml.gz"]
+        def download(files):
+            pkgs = []
+            for x, fn in enumerate(files):
+                pkgs.append(librepo.PackageTarget(fn,
+                                                  handle=h,
+                                                  dest=os.path.join(self.tmpdir,
+                                                                    "%d" % x)))
+            librepo.download_packages(pkgs, failfast=True)
+            for pkg in pkgs:
+                self.assertTrue(pkg.err is None)
+            return h.stats["parallel_downloads"]
+
+        # Too short to measure anything, the tuning starts with 2
+        self.assertEqual(download(small), 2)
+
+        # The total throughput is capped, more transfers don't help,
+        # so the tuning turns back instead of taking all the slots
+        h.maxspeed = 2 * 1024 * 1024
+        tuned = download([config.PACKAGE_01_01] * 6)
+        self.assertTrue(1 <= tuned <= 4)
+
+        # The next download starts with the number chosen by the last one
+        h.maxspeed = 0
+        self.assertEqual(download(small), tuned)
+
+        # The number is always limited by LRO_MAXPARALLELDOWNLOADS
+        h.maxparalleldownloads = 1
+        self.assertEqual(download(small), 1)
+
+    def _download_packages_criticalslots(self, criticalslots):
+        h = librepo.Handle()
+
+        url = "%s%s" % (self.MOCKURL, config.REPO_YUM_01_PATH)
+        h.setopt(librepo.LRO_URLS, [url])
+        h.setopt(librepo.LRO_REPOTYPE, librepo.LR_YUMREPO)
+        h.maxparalleldownloads = 1
+        h.criticalslots = criticalslots
+        h.maxspeed = 512 * 1024
+
+        ended = []
+        def endcb(cbdata, status, msg):
+            ended.append(cbdata)
+
+        # The deadline puts the slow package before the critical targets
+        pkgs = [librepo.PackageTarget(config.PACKAGE_01_01,
+                                      handle=h,
+                                      dest=self.tmpdir,
+                                      cbdata="package",
+                                      endcb=endcb,
+                                      deadline=time.time() + 120)]
+        for fn in ["repodata/4543ad62e4d86337cd1949346f9aec976b847b58-primary.xml.gz",
+                   "repodata/a8977cdaa0b14321d9acfab81ce8a85e869eee32-other.xml.gz"]:
+            pkgs.append(librepo.PackageTarget(fn,
+                                              handle=h,
+                                              dest=self.tmpdir,
+                                              cbdata="critical",
+                                              endcb=endcb,
+                                              priorityclass=librepo.PRIORITYCLASS_CRITICAL))
+
+        librepo.download_packages(pkgs, failfast=True)
+        for pkg in pkgs:
+            self.assertTrue(pkg.err is None)
+        return ended
+
+    def test_download_packages_criticalslots(self):
+        # The critical targets run beside the package, one at a time
+        self.assertEqual(self._download_packages_criticalslots(1),
+                         ["critical", "critical", "package"])
+
+    def test_download_packages_without_criticalslots(self):
+        # The critical targets wait for the only slot
+        self.assertEqual(self._download_packages_criticalslots(0),
+                         ["package", "critical", "critical"])
+
+    def _download_packages_engine(self, variable):
+        # The variable is read for each download loop
+        if variable:
+            os.environ[variable] = "1"
+        try:
+            h = librepo.Handle()
+            url1 = "%s%s%s" % (self.MOCKURL, config.MISSINGFILE % "other",
+                               config.REPO_YUM_01_PATH)
+            url2 = "%s%s" % (self.MOCKURL, config.REPO_YUM_01_PATH)
+            h.setopt(librepo.LRO_URLS, [url1, url2])
+            h.setopt(librepo.LRO_REPOTYPE, librepo.LR_YUMREPO)
+            h.maxparalleldownloads = 2
+
+            pkgs = [librepo.PackageTarget(config.PACKAGE_01_01,
+                                          handle=h,
+                                          dest=self.tmpdir,
+                                          checksum_type=librepo.SHA256,
+                                          checksum=config.PACKAGE_01_01_SHA256)]
+            for fn in ["repodata/4543ad62e4d86337cd1949346f9aec976b847b58-primary.xml.gz",
+                       "repodata/aeca08fccd3c1ab831e1df1a62711a44ba1922c9-filelists.xml.gz",
+                       "repodata/a8977cdaa0b14321d9acfab81ce8a85e869eee32-other.xml.gz"]:
+                pkgs.append(librepo.PackageTarget(fn,
+                                                  handle=h,
+                                                  dest=self.tmpdir))
+
+            librepo.download_packages(pkgs, failfast=True)
+        finally:
+            if variable:
+                del os.environ[variable]
+
+        for pkg in pkgs:
+            self.assertTrue(pkg.err is None)
+            self.assertTrue(os.path.isfile(pkg.local_path))
+        # The other.xml.gz was not found on the first mirror
+        self.assertEqual(h.stats["failed"], 1)
+
+    def test_download_packages_socket_loop(self):
+        self._download_packages_engine(None)
+
+    def test_download_packages_poll_loop(self):
+        self._download_packages_engine("LIBREPO_DEBUG_POLLLOOP")
+
+    def test_download_packages_select_loop(self):
+        self._download_packages_engine("LIBREPO_DEBUG_SELECTLOOP")
+
+    def _download_packages_affinity(self, affinity):
+        """Return the number of targets downloaded from the first mirror
+        and from the second one, only the second one has the package
+        downloaded as the first target"""
+        h = librepo.Handle()
+
+        url1 = "%s%s%s" % (self.MOCKURL, config.MISSINGFILE % "filesystem",
+                           config.REPO_YUM_01_PATH)
+        url2 = "%s%s%s" % (self.MOCKURL, config.MISSINGFILE % "nomatch",
+                           config.REPO_YUM_01_PATH)
+        h.setopt(librepo.LRO_URLS, [url1, url2])
+        h.setopt(librepo.LRO_REPOTYPE, librepo.LR_YUMREPO)
+        h.maxparalleldownloads = 1
+        h.adaptivemirrorsorting = librepo.ADAPTIVEMIRRORSORTING_NONE
+        h.connectionaffinity = affinity
+
+        files = [config.PACKAGE_01_01,
+                 "repodata/4543ad62e4d86337cd1949346f9aec976b847b58-primary.xml.gz",
+                 "repodata/aeca08fccd3c1ab831e1df1a62711a44ba1922c9-filelists.xml.gz",
+                 "repodata/a8977cdaa0b14321d9acfab81ce8a85e869eee32-other.xml.gz"]
+        pkgs = []
+        for fn in files:
+            pkgs.append(librepo.PackageTarget(fn,
+                                              handle=h,
+                                              dest=self.tmpdir))
+
+        librepo.download_packages(pkgs, failfast=True)
+
+        for pkg in pkgs:
+            self.assertTrue(pkg.err is None)
+
+        successful = [0, 0]
+        for mirror in h.stats["mirrors"]:
+            if "/filesystem/" in mirror["url"]:
+                successful[0] += mirror["successful"]
+            elif "/nomatch/" in mirror["url"]:
+                successful[1] += mirror["successful"]
+        return successful
+
+    def test_download_packages_connectionaffinity(self):
+        # The small targets follow the idle connection of the package
+        self.assertEqual(self._download_packages_affinity(True), [0, 4])
+
+    def test_download_packages_no_connectionaffinity(self):
+        # The small targets go to the first mirror
+        self.assertEqual(self._download_packages_affinity(False), [3, 1])
+
+    def _download_packages_byteranges(self, mode):
+        """Download ranges of a package by one request, the server answers
+        them as described by the mode of config.BYTERANGES"""
+        h = librepo.Handle()
+
+        url = "%s%s%s" % (self.MOCKURL, config.BYTERANGES % mode,
+                          config.REPO_YUM_01_PATH)
+        h.setopt(librepo.LRO_URLS, [url])
+        h.setopt(librepo.LRO_REPOTYPE, librepo.LR_YUMREPO)
+        h.maxrangesperrequest = 3
+
+        # The whole package to compare the ranges with
+        whole = librepo.PackageTarget(config.PACKAGE_01_01,
+                                      handle=h,
+                                      dest=self.tmpdir,
+                                      checksum_type=librepo.SHA256,
+                                      checksum=config.PACKAGE_01_01_SHA256)
+        librepo.download_packages([whole], failfast=True)
+        with open(whole.local_path, "rb") as f:
+            data = f.read()
+
+        ranges = [(0, 9), (100, 149), (1000, 1099)]
+        pkgs = []
+        for x, (start, end) in enumerate(ranges):
+            pkgs.append(librepo.PackageTarget(config.PACKAGE_01_01,
+                                              handle=h,
+                                              dest=os.path.join(self.tmpdir,
+                                                                "part%d" % x),
+                                              byterangestart=start,
+                                              byterangeend=end))
+
+        librepo.download_packages(pkgs, failfast=True)
+
+        for pkg, (start, end) in zip(pkgs, ranges):
+            self.assertTrue(pkg.err is None)
+            with open(pkg.local_path, "rb") as f:
+                self.assertEqual(f.read(), data[start:end + 1])
+
+    def test_download_packages_byteranges_multipart(self):
+        self._download_packages_byteranges("multipart")
+
+    def test_download_packages_byteranges_merged(self):
+        """The server merges the ranges into one part"""
+        self._download_packages_byteranges("merged")
+
+    def test_download_packages_byteranges_ignored(self):
+        """The server ignores the ranges and sends the whole package"""
+        self._download_packages_byteranges("ignore")
+
+    def test_download_packages_iouring(self):
+        """Data are written asynchronously if io_uring is available
+        and synchronously otherwise, the result must be the same"""
+        h = librepo.Handle()
+
+        url = "%s%s" % (self.MOCKURL, config.REPO_YUM_01_PATH)
+        h.setopt(librepo.LRO_URLS, [url])
+        h.setopt(librepo.LRO_REPOTYPE, librepo.LR_YUMREPO)
+        h.iouring = True
+        h.writebuffersize = 4096    # A lot of writes in flight
+
+        pkgs = []
+        pkgs.append(librepo.PackageTarget(config.PACKAGE_01_01,
+                                          handle=h,
+                                          dest=self.tmpdir,
+                                          checksum_type=librepo.SHA256,
+                                          checksum=config.PACKAGE_01_01_SHA256))
+
+        librepo.download_packages(pkgs)
+
+        pkg = pkgs[0]
+        self.assertTrue(pkg.err is None)
+        self.assertTrue(os.path.isfile(pkg.local_path))
+        with open(pkg.local_path, "rb") as f:
+            self.assertEqual(hashlib.sha256(f.read()).hexdigest(),
+                             config.PACKAGE_01_01_SHA256)
+
+    def test_download_packages_recvbuffersize(self):
+        """Small chunks from curl are collected into blocks of the write
+        buffer, a resumed file continues at an unaligned offset"""
+        h = librepo.Handle()
+
+        url = "%s%s" % (self.MOCKURL, config.REPO_YUM_01_PATH)
+        h.setopt(librepo.LRO_URLS, [url])
+        h.setopt(librepo.LRO_REPOTYPE, librepo.LR_YUMREPO)
+        h.recvbuffersize = 1024
+        h.writebuffersize = 8192
+
+        pkgs = []
+        pkgs.append(librepo.PackageTarget(config.PACKAGE_01_01,
+                                          handle=h,
+                                          dest=self.tmpdir,
+                                          checksum_type=librepo.SHA256,
+                                          checksum=config.PACKAGE_01_01_SHA256))
+        librepo.download_packages(pkgs)
+        pkg = pkgs[0]
+        self.assertTrue(pkg.err is None)
+
+        with open(pkg.local_path, "r+b") as f:
+            f.truncate(1000)
+
+        pkgs = []
+        pkgs.append(librepo.PackageTarget(config.PACKAGE_01_01,
+                                          handle=h,
+                                          dest=self.tmpdir,
+                                          resume=True,
+                                          checksum_type=librepo.SHA256,
+                                          checksum=config.PACKAGE_01_01_SHA256))
+        librepo.download_packages(pkgs)
+        pkg = pkgs[0]
+        self.assertTrue(pkg.err is None)
+        with open(pkg.local_path, "rb") as f:
+            self.assertEqual(hashlib.sha256(f.read()).hexdigest(),
+                             config.PACKAGE_01_01_SHA256)
+
     def test_download_packages_with_resume_02(self):
         # If download that should be resumed fails,
         # the original file should not be modified or deleted
@@ -703,6 +1376,90 @@ class TestCaseYumPackagesDownloading(TestCaseWithFlask):
         fchksum_new = hashlib.md5(open(pkg.local_path, "rb").read()).hexdigest()
         self.assertEqual(fchksum, fchksum_new)
 
+    def test_download_packages_with_resume_journal(self):
+        h = librepo.Handle()
+
+        url = "%s%s" % (self.MOCKURL, config.REPO_YUM_01_PATH)
+        h.setopt(librepo.LRO_URLS, [url])
+        h.setopt(librepo.LRO_REPOTYPE, librepo.LR_YUMREPO)
+        h.resumejournal = True
+
+        fn = os.path.join(self.tmpdir, "package.rpm")
+        journal = fn + ".resume"
+
+        # Download first 10 bytes of the package
+        pkgs = [librepo.PackageTarget(config.PACKAGE_01_01,
+                                      handle=h,
+                                      dest=fn,
+                                      resume=False,
+                                      byterangeend=9)]
+        librepo.download_packages(pkgs)
+        self.assertTrue(pkgs[0].err is None)
+        self.assertEqual(os.path.getsize(fn), 10)
+        self.assertFalse(os.path.exists(journal))
+
+        # A journal which doesn't match the partial file is ignored
+        with open(journal, "w") as f:
+            f.write("[resume]\nurl=%s\noffset=1000000\n" % url)
+
+        # Resume the rest
+        pkgs = [librepo.PackageTarget(config.PACKAGE_01_01,
+                                      handle=h,
+                                      dest=fn,
+                                      resume=True,
+                                      checksum_type=librepo.SHA256,
+                                      checksum=config.PACKAGE_01_01_SHA256)]
+        librepo.download_packages(pkgs)
+        pkg = pkgs[0]
+        self.assertTrue(pkg.err is None)
+        with open(fn, "rb") as f:
+            self.assertEqual(hashlib.sha256(f.read()).hexdigest(),
+                             config.PACKAGE_01_01_SHA256)
+
+        # The journal of the finished file is removed
+        self.assertFalse(os.path.exists(journal))
+
+    def test_download_packages_http2_maxdownloadspermirror(self):
+        """The mirror doesn't negotiate HTTP/2, so its transfers are its
+        connections and LRO_MAXDOWNLOADSPERMIRROR caps them"""
+        h = librepo.Handle()
+
+        url = "%s%s" % (self.MOCKURL, config.REPO_YUM_01_PATH)
+        h.setopt(librepo.LRO_URLS, [url])
+        h.setopt(librepo.LRO_REPOTYPE, librepo.LR_YUMREPO)
+        h.http2 = True
+        h.maxparalleldownloads = 4
+        h.maxdownloadspermirror = 1
+
+        running = set()
+        maxrunning = [0]
+        def progresscb(cbdata, total, downloaded):
+            running.add(cbdata)
+            maxrunning[0] = max(maxrunning[0], len(running))
+            return librepo.CB_OK
+        def endcb(cbdata, status, msg):
+            running.discard(cbdata)
+
+        files = ["repodata/4543ad62e4d86337cd1949346f9aec976b847b58-primary.xml.gz",
+                 "repodata/aeca08fccd3c1ab831e1df1a62711a44ba1922c9-filelists.xml.gz",
+                 "repodata/a8977cdaa0b14321d9acfab81ce8a85e869eee32-other.xml.gz",
+                 config.PACKAGE_01_01]
+        pkgs = []
+        for x, fn in enumerate(files):
+            pkgs.append(librepo.PackageTarget(fn,
+                                              handle=h,
+                                              dest=self.tmpdir,
+                                              cbdata=x,
+                                              progresscb=progresscb,
+                                              endcb=endcb))
+
+        librepo.download_packages(pkgs, failfast=True)
+
+        for pkg in pkgs:
+            self.assertTrue(pkg.err is None)
+            self.assertTrue(os.path.isfile(pkg.local_path))
+        self.assertEqual(maxrunning[0], 1)
+
     def test_download_packages_mirror_penalization_01(self):
 
         # This test is useful for mirror penalization testing
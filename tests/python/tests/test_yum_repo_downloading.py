@@ -1,4 +1,6 @@
 import sys
+import json
+import hashlib
 import time
 import gpgme
 import shutil
@@ -478,6 +480,134 @@ class TestCaseYumRepoDownloading(TestCaseWithFlask):
         self.assertTrue(yum_repo)
         self.assertTrue(yum_repomd)
 
+    def test_download_repo_01_stats(self):
+        h = librepo.Handle()
+
+        url = "%s%s" % (self.MOCKURL, config.REPO_YUM_01_PATH)
+        h.setopt(librepo.LRO_URLS, [url])
+        h.setopt(librepo.LRO_REPOTYPE, librepo.LR_YUMREPO)
+        h.setopt(librepo.LRO_DESTDIR, self.tmpdir)
+        h.perform()
+
+        stats = h.getinfo(librepo.LRI_STATS)
+        self.assertTrue(stats["bytes"] > 0)
+        self.assertTrue(stats["successful"] > 0)
+        self.assertEqual(stats["failed"], 0)
+        self.assertEqual(stats["retries"], 0)
+        self.assertEqual(len(stats["mirrors"]), 1)
+        mirror = stats["mirrors"][0]
+        self.assertEqual(mirror["url"].rstrip("/"), url.rstrip("/"))
+        self.assertEqual(mirror["bytes"], stats["bytes"])
+        self.assertEqual(mirror["successful"], stats["successful"])
+
+    def test_download_repo_01_stats_allocations(self):
+        h = librepo.Handle()
+
+        url = "%s%s" % (self.MOCKURL, config.REPO_YUM_01_PATH)
+        h.setopt(librepo.LRO_URLS, [url])
+        h.setopt(librepo.LRO_REPOTYPE, librepo.LR_YUMREPO)
+        h.setopt(librepo.LRO_DESTDIR, self.tmpdir)
+        librepo.alloc_accounting(True)
+        try:
+            h.perform()
+        finally:
+            librepo.alloc_accounting(False)
+
+        stats = h.getinfo(librepo.LRI_STATS)
+        self.assertTrue(stats["allocations"] > 0)
+        self.assertTrue(stats["allocated_bytes"] > 0)
+        totals = librepo.alloc_stats()
+        self.assertTrue(totals["count"] >= stats["allocations"])
+        self.assertTrue(totals["peak"] >= totals["live"])
+
+    def test_download_repo_01_tracefile(self):
+        h = librepo.Handle()
+
+        url = "%s%s" % (self.MOCKURL, config.REPO_YUM_01_PATH)
+        trace = os.path.join(self.tmpdir, "trace.json")
+        destdir = os.path.join(self.tmpdir, "repo")
+        os.mkdir(destdir)
+        h.setopt(librepo.LRO_URLS, [url])
+        h.setopt(librepo.LRO_REPOTYPE, librepo.LR_YUMREPO)
+        h.setopt(librepo.LRO_DESTDIR, destdir)
+        h.setopt(librepo.LRO_TRACEFORMAT, librepo.TRACE_JSONLINES)
+        h.setopt(librepo.LRO_TRACEFILE, trace)
+        h.perform()
+
+        spans = [json.loads(line) for line in open(trace)]
+        names = set(span["name"] for span in spans)
+        for name in ("prepare mirrors", "queue wait", "transfer",
+                     "download", "perform"):
+            self.assertTrue(name in names, name)
+        for span in spans:
+            self.assertTrue(span["dur"] >= 0)
+            if span["name"] == "transfer":
+                self.assertEqual(span["args"]["mirror"].rstrip("/"),
+                                 url.rstrip("/"))
+                self.assertFalse("error" in span["args"])
+
+        # Chrome trace events are a valid JSON array once the file is closed
+        h.setopt(librepo.LRO_TRACEFORMAT, librepo.TRACE_CHROME)
+        h.setopt(librepo.LRO_CHECKSUM, True)
+        shutil.rmtree(destdir)
+        os.mkdir(destdir)
+        h.perform()
+        h.setopt(librepo.LRO_TRACEFILE, None)
+
+        events = json.load(open(trace))
+        phases = set(event["ph"] for event in events)
+        self.assertTrue(phases <= set(["X", "b", "e"]))
+        self.assertTrue("X" in phases)
+        self.assertTrue("b" in phases)
+
+    def test_download_repo_01_metricscb(self):
+        h = librepo.Handle()
+
+        url = "%s%s" % (self.MOCKURL, config.REPO_YUM_01_PATH)
+        calls = []
+
+        def metricscb(data, metrics):
+            calls.append(metrics)
+
+        h.setopt(librepo.LRO_URLS, [url])
+        h.setopt(librepo.LRO_REPOTYPE, librepo.LR_YUMREPO)
+        h.setopt(librepo.LRO_DESTDIR, self.tmpdir)
+        h.setopt(librepo.LRO_METRICSINTERVAL, 1)
+        h.setopt(librepo.LRO_METRICSCB, metricscb)
+        h.perform()
+
+        self.assertTrue(calls)
+        for metrics in calls:
+            for key in ("running", "queued", "verifying", "bytes", "speed"):
+                self.assertTrue(metrics[key] >= 0, key)
+            self.assertEqual(metrics["errors"], {})
+            for mirror in metrics["mirrors"]:
+                self.assertEqual(mirror["url"].rstrip("/"), url.rstrip("/"))
+                self.assertEqual(mirror["failed"], 0)
+        self.assertTrue(calls[-1]["bytes"] >= calls[0]["bytes"])
+
+    def test_download_repo_01_mirrorhealthcache(self):
+        h = librepo.Handle()
+
+        url = "%s%s" % (self.MOCKURL, config.REPO_YUM_01_PATH)
+        store = os.path.join(self.tmpdir, "mirrorhealth")
+        destdir = os.path.join(self.tmpdir, "repo")
+        os.mkdir(destdir)
+        h.setopt(librepo.LRO_URLS, [url])
+        h.setopt(librepo.LRO_REPOTYPE, librepo.LR_YUMREPO)
+        h.setopt(librepo.LRO_DESTDIR, destdir)
+        h.setopt(librepo.LRO_ADAPTIVEMIRRORSORTING,
+                 librepo.ADAPTIVEMIRRORSORTING_ERRORRATE)
+        h.setopt(librepo.LRO_MIRRORHEALTHCACHE, store)
+        h.perform()
+
+        # The host of the mirror is recorded
+        self.assertTrue(os.path.isfile(store))
+        with open(store) as f:
+            content = f.read()
+        self.assertTrue("[%s]" % self.MOCKURL.rstrip("/") in content)
+        self.assertTrue("successful=" in content)
+
     def test_download_repo_01_with_checksum_check(self):
         h = librepo.Handle()
         r = librepo.Result()
@@ -495,6 +625,38 @@ class TestCaseYumRepoDownloading(TestCaseWithFlask):
         self.assertTrue(yum_repo)
         self.assertTrue(yum_repomd)
 
+    def test_download_repo_01_mirrorhealthcache_shared(self):
+        """Handles of the process share the store, the later results
+        are written by the flush"""
+        store = os.path.join(self.tmpdir, "mirrorhealth")
+        url = "%s%s" % (self.MOCKURL, config.REPO_YUM_01_PATH)
+        host = self.MOCKURL.rstrip("/")
+
+        def successful():
+            with open(store) as f:
+                for line in f.read().split("[%s]" % host, 1)[1].splitlines():
+                    if line.startswith("successful="):
+                        return float(line.split("=", 1)[1])
+            return 0.0
+
+        for x in range(2):
+            destdir = os.path.join(self.tmpdir, "repo%d" % x)
+            os.mkdir(destdir)
+            h = librepo.Handle()
+            h.setopt(librepo.LRO_URLS, [url])
+            h.setopt(librepo.LRO_REPOTYPE, librepo.LR_YUMREPO)
+            h.setopt(librepo.LRO_DESTDIR, destdir)
+            h.setopt(librepo.LRO_MIRRORHEALTHCACHE, store)
+            h.perform()
+            if x == 0:
+                first = successful()
+                self.assertTrue(first > 0.0)
+
+        # The results of the second handle wait for the flush
+        self.assertEqual(successful(), first)
+        librepo.mirrorregistry_flush()
+        self.assertTrue(successful() > first)
+
     def test_download_corrupted_repo_01_with_checksum_check(self):
         h = librepo.Handle()
         r = librepo.Result()
@@ -550,6 +712,23 @@ class TestCaseYumRepoDownloading(TestCaseWithFlask):
         self.assertTrue(yum_repomd)
         self.assertTrue("signature" not in yum_repo or yum_repo["signature"])
 
+    def test_download_repo_with_gpg_check_sharded(self):
+        """The signature is tried only on the mirror of repomd.xml,
+        even if the download is sharded"""
+        h = librepo.Handle()
+        r = librepo.Result()
+
+        # The first mirror has no signature, the second one has
+        url = "%s%s%s" % (self.MOCKURL, config.MISSINGFILE % "asc", config.REPO_YUM_01_PATH)
+        url2 = "%s%s" % (self.MOCKURL, config.REPO_YUM_01_PATH)
+        h.setopt(librepo.LRO_URLS, [url, url2])
+        h.setopt(librepo.LRO_REPOTYPE, librepo.LR_YUMREPO)
+        h.setopt(librepo.LRO_DESTDIR, self.tmpdir)
+        h.setopt(librepo.LRO_GPGCHECK, True)
+        h.maxparalleldownloads = 2
+        h.downloadshards = 2
+        self.assertRaises(librepo.LibrepoException, h.perform, (r))
+
     def test_download_repo_01_with_missing_file(self):
         h = librepo.Handle()
         r = librepo.Result()
@@ -709,6 +888,38 @@ class TestCaseYumRepoDownloading(TestCaseWithFlask):
              'filename': 'repomd.xml'}
             )
 
+    def _download_repo_01_via_metalink_encoded(self, mode, acceptencoding):
+        h = librepo.Handle()
+        h.metalinkurl = "%s%s" % (self.MOCKURL, config.METALINK_ENCODED % mode)
+        h.repotype = librepo.LR_YUMREPO
+        h.destdir = os.path.join(self.tmpdir, "%s_%d" % (mode, acceptencoding))
+        os.mkdir(h.destdir)
+        h.checksum = True
+        h.acceptencoding = acceptencoding
+        return h.perform()
+
+    def test_download_repo_01_via_metalink_encoded(self):
+        r = self._download_repo_01_via_metalink_encoded("gzip", True)
+        yum_repo = r.getinfo(librepo.LRR_YUM_REPO)
+        self.assertEqual(yum_repo["url"],
+            "http://127.0.0.1:%d/yum/encoded/gzip/static/01/" % self.PORT)
+
+        # The decoded file is stored
+        with open(yum_repo["repomd"], "rb") as f:
+            data = f.read()
+        self.assertEqual(len(data), 2621)
+        self.assertEqual(hashlib.sha256(data).hexdigest(),
+            "bef5d33dc68f47adc7b31df448851b1e9e6bae27840f28700fff144881482a6a")
+
+    def test_download_repo_01_via_metalink_encoded_bigger(self):
+        # Without Accept-Encoding the file is sent unchanged
+        self._download_repo_01_via_metalink_encoded("bigger", False)
+
+        # The decoded data are bigger than the size from the metalink
+        self.assertRaises(librepo.LibrepoException,
+                          self._download_repo_01_via_metalink_encoded,
+                          "bigger", True)
+
     def test_download_repo_01_via_metalink_02(self):
         h = librepo.Handle()
         r = librepo.Result()
@@ -848,6 +1059,53 @@ class TestCaseYumRepoDownloading(TestCaseWithFlask):
             if yum_repo[key] and (key not in ("url", "destdir")):
                 self.assertTrue(os.path.isfile(yum_repo[key]))
 
+    def test_download_repo_01_via_metalink_badfirsthost_fastestmirror_probe(self):
+        time.sleep(0.5)
+        h = librepo.Handle()
+        r = librepo.Result()
+
+        cache = os.path.join(self.tmpdir, "fastestmirror.cache")
+
+        url = "%s%s" % (self.MOCKURL, config.METALINK_BADFIRSTHOST)
+        h.setopt(librepo.LRO_MIRRORLIST, url)
+        h.setopt(librepo.LRO_REPOTYPE, librepo.LR_YUMREPO)
+        h.setopt(librepo.LRO_DESTDIR, self.tmpdir)
+        h.setopt(librepo.LRO_FASTESTMIRROR, True)
+        h.setopt(librepo.LRO_FASTESTMIRRORCACHE, cache)
+        h.setopt(librepo.LRO_FASTESTMIRRORPROBE, "repodata/repomd.xml")
+        h.setopt(librepo.LRO_MAXMIRRORTRIES, 1)
+
+        # The probe of the first (bad) host fails, the working
+        # mirror has to be sorted to the first position
+        h.perform(r)
+
+        yum_repo   = r.getinfo(librepo.LRR_YUM_REPO)
+        self.assertTrue(yum_repo)
+        self.assertEqual(yum_repo["url"], "http://127.0.0.1:%d/yum/static/01/" % self.PORT)
+        self.assertTrue(os.path.exists(cache))
+
+    def test_download_repo_01_via_metalink_badfirsthost_fastestmirror_goodcount(self):
+        time.sleep(0.5)
+        h = librepo.Handle()
+        r = librepo.Result()
+
+        url = "%s%s" % (self.MOCKURL, config.METALINK_BADFIRSTHOST)
+        h.setopt(librepo.LRO_MIRRORLIST, url)
+        h.setopt(librepo.LRO_REPOTYPE, librepo.LR_YUMREPO)
+        h.setopt(librepo.LRO_DESTDIR, self.tmpdir)
+        h.setopt(librepo.LRO_FASTESTMIRROR, True)
+        h.setopt(librepo.LRO_FASTESTMIRRORCONCURRENCY, 1)
+        h.setopt(librepo.LRO_FASTESTMIRRORGOODCOUNT, 1)
+        h.setopt(librepo.LRO_MAXMIRRORTRIES, 1)
+
+        # Mirrors are measured one by one and the measurement stops
+        # after the first working one
+        h.perform(r)
+
+        yum_repo   = r.getinfo(librepo.LRR_YUM_REPO)
+        self.assertTrue(yum_repo)
+        self.assertEqual(yum_repo["url"], "http://127.0.0.1:%d/yum/static/01/" % self.PORT)
+
     def test_download_repo_01_via_metalink_badfirsthost_fastestmirror_with_cache(self):
         time.sleep(0.5)
         h = librepo.Handle()
@@ -876,6 +1134,8 @@ class TestCaseYumRepoDownloading(TestCaseWithFlask):
         self.assertTrue(yum_repomd)
         self.assertEqual(yum_repo["url"], "http://127.0.0.1:%d/yum/static/01/" % self.PORT)
         self.assertTrue(os.path.exists(cache))
+        with open(cache, "rb") as f:
+            self.assertEqual(f.read(4), b"LRFM")
 
         shutil.rmtree(os.path.join(self.tmpdir, "repodata"))
 
@@ -914,6 +1174,35 @@ class TestCaseYumRepoDownloading(TestCaseWithFlask):
             if yum_repo[key] and (key not in ("url", "destdir")):
                 self.assertTrue(os.path.isfile(yum_repo[key]))
 
+    def test_download_repo_01_via_metalink_with_damaged_piece(self):
+        h = librepo.Handle()
+        r = librepo.Result()
+
+        url = "%s%s" % (self.MOCKURL, config.METALINK_PIECESWITHCORRUPTEDFIRSTURL)
+        h.setopt(librepo.LRO_MIRRORLIST, url)
+        h.setopt(librepo.LRO_REPOTYPE, librepo.LR_YUMREPO)
+        h.setopt(librepo.LRO_DESTDIR, self.tmpdir)
+        h.setopt(librepo.LRO_CHECKSUM, True)
+        h.perform(r)
+
+        self.assertEqual(h.metalink["pieces"],
+            [{'type': 'sha1',
+              'length': 1024,
+              'hashes': ['7eefbd75f18120a944027575cfa2d120f0101597',
+                         'caf3d29b3098bd38854b0d8e07aa8b5025498a47',
+                         '0cde2acb4651cec56f18b7d2508392ba3f46c43c']}])
+
+        yum_repo   = r.getinfo(librepo.LRR_YUM_REPO)
+        yum_repomd = r.getinfo(librepo.LRR_YUM_REPOMD)
+
+        self.assertTrue(yum_repo)
+        self.assertTrue(yum_repomd)
+
+        # The damaged first piece was downloaded from the second mirror
+        with open(yum_repo["repomd"], "rb") as f:
+            self.assertEqual(hashlib.sha1(f.read()).hexdigest(),
+                             "75125e73304c21945257d9041a908d0d01d2ca16")
+
     def test_download_repo_01_with_baseurl_and_metalink_specified_only_fetchmirrors(self):
         h = librepo.Handle()
         r = librepo.Result()
@@ -1215,6 +1504,124 @@ class TestCaseYumRepoDownloading(TestCaseWithFlask):
             if yum_repo[key] and (key not in ("repomd", "primary", "url", "destdir", "mirrorlist")):
                 self.assertTrue(yum_repo[key] == None)
 
+    def test_download_repo_01_conditionalget(self):
+        h = librepo.Handle()
+
+        url = "%s%s" % (self.MOCKURL, config.REPO_YUM_01_PATH)
+        h.setopt(librepo.LRO_URLS, [url])
+        h.setopt(librepo.LRO_REPOTYPE, librepo.LR_YUMREPO)
+        h.setopt(librepo.LRO_DESTDIR, self.tmpdir)
+        h.setopt(librepo.LRO_YUMDLIST, [None])
+        h.setopt(librepo.LRO_CONDITIONALGET, True)
+
+        r = librepo.Result()
+        h.perform(r)
+        repomd = r.getinfo(librepo.LRR_YUM_REPOMD)
+        repomd_path = r.getinfo(librepo.LRR_YUM_REPO)["repomd"]
+        self.assertTrue(os.path.isfile(repomd_path + ".validators"))
+
+        # Download to the same destdir again, repomd.xml is not modified
+        r = librepo.Result()
+        h.perform(r)
+        self.assertEqual(r.getinfo(librepo.LRR_YUM_REPOMD), repomd)
+        self.assertTrue(os.path.isfile(repomd_path))
+        self.assertFalse(os.path.exists(repomd_path + ".part"))
+
+    def test_download_repo_01_yumreusedir(self):
+        url = "%s%s" % (self.MOCKURL, config.REPO_YUM_01_PATH)
+        previous = os.path.join(self.tmpdir, "previous")
+        current = os.path.join(self.tmpdir, "current")
+        os.mkdir(previous)
+        os.mkdir(current)
+
+        h = librepo.Handle()
+        h.setopt(librepo.LRO_URLS, [url])
+        h.setopt(librepo.LRO_REPOTYPE, librepo.LR_YUMREPO)
+        h.setopt(librepo.LRO_DESTDIR, previous)
+        h.perform(librepo.Result())
+
+        # Files of the unchanged records are hardlinked
+        h.setopt(librepo.LRO_DESTDIR, current)
+        h.setopt(librepo.LRO_YUMREUSEDIR, previous)
+        r = librepo.Result()
+        h.perform(r)
+
+        primary = r.getinfo(librepo.LRR_YUM_REPO)["primary"]
+        self.assertEqual(os.stat(primary).st_ino,
+            os.stat(primary.replace(current, previous)).st_ino)
+
+    def test_download_repo_01_repomd_diff(self):
+        url = "%s%s" % (self.MOCKURL, config.REPO_YUM_01_PATH)
+        previous = os.path.join(self.tmpdir, "previous")
+        current = os.path.join(self.tmpdir, "current")
+        os.mkdir(previous)
+        os.mkdir(current)
+
+        h = librepo.Handle()
+        h.setopt(librepo.LRO_URLS, [url])
+        h.setopt(librepo.LRO_REPOTYPE, librepo.LR_YUMREPO)
+        h.setopt(librepo.LRO_DESTDIR, previous)
+        r = librepo.Result()
+        h.perform(r)
+        self.assertEqual(r.getinfo(librepo.LRR_YUM_REPOMD_DIFF), None)
+
+        # Nothing changed since the previous download
+        h.setopt(librepo.LRO_DESTDIR, current)
+        h.setopt(librepo.LRO_YUMREUSEDIR, previous)
+        r = librepo.Result()
+        h.perform(r)
+        self.assertEqual(r.yum_repomd_diff,
+                         {"added": [], "removed": [], "changed": []})
+
+    def test_download_repo_01_yumrecordcb(self):
+        # Every record is reported once, with the path of the result
+        ready = {}
+        def cb(data, metadata, path):
+            self.assertTrue(os.path.isfile(path))
+            ready[metadata] = path
+
+        h = librepo.Handle()
+        r = librepo.Result()
+
+        url = "%s%s" % (self.MOCKURL, config.REPO_YUM_01_PATH)
+        h.setopt(librepo.LRO_URLS, [url])
+        h.setopt(librepo.LRO_REPOTYPE, librepo.LR_YUMREPO)
+        h.setopt(librepo.LRO_DESTDIR, self.tmpdir)
+        h.setopt(librepo.LRO_YUMRECORDCB, cb)
+        h.perform(r)
+
+        yum_repo = r.getinfo(librepo.LRR_YUM_REPO)
+        for metadata, path in ready.items():
+            self.assertEqual(yum_repo[metadata], path)
+        self.assertIn("primary", ready)
+
+    def test_handles_perform(self):
+        # Repositories downloaded together, a failed one doesn't
+        # affect the others
+        handles = []
+        results = []
+        for path in (config.REPO_YUM_01_PATH, config.REPO_YUM_02_PATH,
+                     config.BADURL):
+            destdir = os.path.join(self.tmpdir, str(len(handles)))
+            os.mkdir(destdir)
+            h = librepo.Handle()
+            h.setopt(librepo.LRO_URLS, ["%s%s" % (self.MOCKURL, path)])
+            h.setopt(librepo.LRO_REPOTYPE, librepo.LR_YUMREPO)
+            h.setopt(librepo.LRO_DESTDIR, destdir)
+            h.setopt(librepo.LRO_CHECKSUM, True)
+            handles.append(h)
+            results.append(librepo.Result())
+
+        errors = librepo.handles_perform(handles, results)
+
+        self.assertEqual(len(errors), 3)
+        self.assertEqual(errors[:2], [None, None])
+        self.assertTrue(errors[2])
+        for r in results[:2]:
+            yum_repo = r.getinfo(librepo.LRR_YUM_REPO)
+            self.assertTrue(os.path.isfile(yum_repo["repomd"]))
+            self.assertTrue(os.path.isfile(yum_repo["primary"]))
+
 # Base Auth test
 
     def test_download_repo_01_from_base_auth_secured_web_01(self):
@@ -1,6 +1,8 @@
 import os.path
+import sys
 import tempfile
 import shutil
+import threading
 import unittest
 import gpgme
 import librepo
@@ -238,6 +240,34 @@ class TestCaseYumRepoLocating(TestCase):
         self.assertEqual(yum_repo, yum_repo_downloaded)
         self.assertEqual(yum_repomd, yum_repomd_downloaded)
 
+    def test_locate_with_lazychecksum(self):
+        # A damaged file is reported only when it's obtained
+        repo = os.path.join(self.tmpdir, "repo")
+        shutil.copytree(REPO_YUM_01_PATH, repo)
+
+        h = librepo.Handle()
+        r = librepo.Result()
+
+        h.setopt(librepo.LRO_URLS, [repo])
+        h.setopt(librepo.LRO_REPOTYPE, librepo.LR_YUMREPO)
+        h.setopt(librepo.LRO_LOCAL, True)
+        h.setopt(librepo.LRO_CHECKSUM, True)
+        h.setopt(librepo.LRO_LAZYCHECKSUM, True)
+        h.perform(r)
+
+        other = r.getinfo(librepo.LRR_YUM_REPO)["other"]
+        with open(other, "ab") as f:
+            f.write(b"garbage")
+
+        self.assertTrue(os.path.isfile(r.yum_repo_path("primary")))
+        self.assertRaises(librepo.LibrepoException, r.yum_repo_path, "other")
+        self.assertEqual(r.yum_repo_path("foobar"), None)
+
+        # Without the lazy verification the repo is refused at once
+        h.setopt(librepo.LRO_LAZYCHECKSUM, False)
+        self.assertRaises(librepo.LibrepoException, h.perform,
+                          librepo.Result())
+
     def test_locate_with_gpgcheck_enabled_but_without_signature(self):
         # At first, download whole repository
         h = librepo.Handle()
@@ -248,3 +278,48 @@ class TestCaseYumRepoLocating(TestCase):
         h.setopt(librepo.LRO_GPGCHECK, True)
         h.setopt(librepo.LRO_LOCAL, True)
         self.assertRaises(librepo.LibrepoException, h.perform, (r))
+
+    def test_locate_in_threads_with_debug_log_handler(self):
+        # Python logger doesn't prevent downloads in parallel threads
+        messages = []
+        errors = []
+
+        def locate():
+            try:
+                h = librepo.Handle()
+                h.setopt(librepo.LRO_URLS, [REPO_YUM_01_PATH])
+                h.setopt(librepo.LRO_REPOTYPE, librepo.LR_YUMREPO)
+                h.setopt(librepo.LRO_LOCAL, True)
+                h.perform(librepo.Result())
+            except Exception as err:
+                errors.append(err)
+
+        librepo.set_debug_log_handler(lambda msg, _: messages.append(msg))
+        try:
+            threads = [threading.Thread(target=locate) for _ in range(4)]
+            for thread in threads:
+                thread.start()
+            for thread in threads:
+                thread.join()
+        finally:
+            librepo.set_debug_log_handler(None)
+
+        self.assertEqual(errors, [])
+        self.assertTrue(messages)
+
+    @unittest.skipIf(sys.version_info < (3, 5), "asyncio is required")
+    def test_locate_repo_async(self):
+        import asyncio
+
+        h = librepo.Handle()
+        h.setopt(librepo.LRO_URLS, [REPO_YUM_01_PATH])
+        h.setopt(librepo.LRO_REPOTYPE, librepo.LR_YUMREPO)
+        h.setopt(librepo.LRO_LOCAL, True)
+
+        loop = asyncio.new_event_loop()
+        try:
+            r = loop.run_until_complete(h.perform_async(loop=loop))
+        finally:
+            loop.close()
+
+        self.assertTrue(r.getinfo(librepo.LRR_YUM_REPO))
@@ -10,6 +10,8 @@
 
 #include "librepo/util.h"
 #include "librepo/checksum.h"
+#include "librepo/checksum_internal.h"
+#include "librepo/checksum_index.h"
 
 #include "fixtures.h"
 #include "testsys.h"
@@ -31,6 +33,10 @@
 #define CHKS_VAL_01_SHA384  "1f9d03f7a9fc1c22bfe114e2b58c334fcf58a07df78b4b0e942a28582ebf6489823e242492b2e0e5df1ce995e918c80d"
 #define CHKS_VAL_01_SHA512  "704861d613afe433160d9b5aa6870e0dd96f5e56c4976f1fe39f4f648e37517ad7374209034290284949b4218ab0c8d8860f941c884cad47a61f208803128049"
 
+#define CHKS_BIG_PATTERN    "0123456789abcdef"
+#define CHKS_BIG_COUNT      196609
+#define CHKS_VAL_BIG_SHA256 "695f764b9deb6ab303fc90a534d44461dca0fa1b3b3dba912dcd62788471c72d"
+
 static void
 build_test_file(const char *filename, const char *content)
 {
@@ -88,6 +94,250 @@ START_TEST(test_checksum_fd)
 }
 END_TEST
 
+START_TEST(test_checksum_fd_big)
+{
+    int fd;
+    FILE *f;
+    char *file, *checksum;
+    GError *tmp_err = NULL;
+
+    // File big enough to be mapped to the memory
+    file = lr_pathconcat(test_globals.tmpdir, "/test_checksum_big", NULL);
+    f = fopen(file, "w");
+    fail_if(!f);
+    for (int x = 0; x < CHKS_BIG_COUNT; x++)
+        fail_if(fwrite(CHKS_BIG_PATTERN, 1, 16, f) != 16);
+    fclose(f);
+
+    fd = open(file, O_RDONLY);
+    fail_if(fd < 0);
+    checksum = lr_checksum_fd(LR_CHECKSUM_SHA256, fd, &tmp_err);
+    fail_if(tmp_err);
+    fail_if(strcmp(checksum, CHKS_VAL_BIG_SHA256),
+        "Checksum is %s instead of %s", checksum, CHKS_VAL_BIG_SHA256);
+    fail_if(lseek(fd, 0, SEEK_CUR) != (off_t) CHKS_BIG_COUNT * 16);
+    lr_free(checksum);
+    close(fd);
+
+    fail_if(remove(file) != 0, "Cannot delete temporary test file");
+    lr_free(file);
+}
+END_TEST
+
+START_TEST(test_checksumctx)
+{
+    int fd;
+    char *file, *checksum;
+    LrChecksumCtx *ctx;
+    GError *tmp_err = NULL;
+
+    file = lr_pathconcat(test_globals.tmpdir, "/test_checksumctx", NULL);
+    build_test_file(file, CHKS_CONTENT_01);
+
+    // Data passed in several chunks
+    ctx = lr_checksumctx_new(LR_CHECKSUM_SHA256, &tmp_err);
+    fail_if(!ctx);
+    fail_if(tmp_err);
+    fail_if(lr_checksumctx_type(ctx) != LR_CHECKSUM_SHA256);
+    fail_if(!lr_checksumctx_update(ctx, "foo\n", 4, &tmp_err));
+    fail_if(!lr_checksumctx_update(ctx, "", 0, &tmp_err));
+    fail_if(!lr_checksumctx_update(ctx, "bar\n\n", 5, &tmp_err));
+    checksum = lr_checksumctx_final(ctx, &tmp_err);
+    fail_if(tmp_err);
+    fail_if(strcmp(checksum, CHKS_VAL_01_SHA256),
+        "Checksum is %s instead of %s", checksum, CHKS_VAL_01_SHA256);
+    lr_free(checksum);
+    lr_checksumctx_free(ctx);
+
+    // Beginning of the data taken from a file
+    fd = open(file, O_RDONLY);
+    fail_if(fd < 0);
+    ctx = lr_checksumctx_new(LR_CHECKSUM_MD5, &tmp_err);
+    fail_if(!ctx);
+    fail_if(!lr_checksumctx_update_fd(ctx, fd, 4, &tmp_err));
+    fail_if(tmp_err);
+    fail_if(lseek(fd, 0, SEEK_CUR) != 0);
+    fail_if(!lr_checksumctx_update(ctx, "bar\n\n", 5, &tmp_err));
+    checksum = lr_checksumctx_final(ctx, &tmp_err);
+    fail_if(tmp_err);
+    fail_if(strcmp(checksum, CHKS_VAL_01_MD5),
+        "Checksum is %s instead of %s", checksum, CHKS_VAL_01_MD5);
+    lr_free(checksum);
+    lr_checksumctx_free(ctx);
+
+    // File is shorter than requested
+    ctx = lr_checksumctx_new(LR_CHECKSUM_MD5, &tmp_err);
+    fail_if(!ctx);
+    fail_if(lr_checksumctx_update_fd(ctx, fd, 100, &tmp_err));
+    fail_if(!tmp_err);
+    g_error_free(tmp_err);
+    tmp_err = NULL;
+    lr_checksumctx_free(ctx);
+    close(fd);
+
+    // Unknown checksum type
+    ctx = lr_checksumctx_new(LR_CHECKSUM_UNKNOWN, &tmp_err);
+    fail_if(ctx);
+    fail_if(!tmp_err);
+    g_error_free(tmp_err);
+
+    fail_if(remove(file) != 0, "Cannot delete temporary test file");
+    lr_free(file);
+}
+END_TEST
+
+START_TEST(test_checksumctx_state)
+{
+    LrChecksumType types[] = { LR_CHECKSUM_MD5, LR_CHECKSUM_SHA1,
+                               LR_CHECKSUM_SHA224, LR_CHECKSUM_SHA256,
+                               LR_CHECKSUM_SHA384, LR_CHECKSUM_SHA512 };
+    const char *expected[] = { CHKS_VAL_01_MD5, CHKS_VAL_01_SHA1,
+                               CHKS_VAL_01_SHA224, CHKS_VAL_01_SHA256,
+                               CHKS_VAL_01_SHA384, CHKS_VAL_01_SHA512 };
+    char *state, *checksum;
+    LrChecksumCtx *ctx;
+    GError *tmp_err = NULL;
+
+    for (size_t x = 0; x < G_N_ELEMENTS(types); x++) {
+        // Checksumming interrupted after the first part of the data
+        ctx = lr_checksumctx_new_resumable(types[x], &tmp_err);
+        fail_if(!ctx);
+        fail_if(tmp_err);
+        fail_if(!lr_checksumctx_update(ctx, "foo\n", 4, &tmp_err));
+        state = lr_checksumctx_save(ctx);
+        lr_checksumctx_free(ctx);
+        if (!state)
+            continue;   // OpenSSL without the low-level digests
+
+        // And continued from the saved state
+        ctx = lr_checksumctx_load(types[x], state, &tmp_err);
+        fail_if(!ctx);
+        fail_if(tmp_err);
+        fail_if(!lr_checksumctx_update(ctx, "bar\n\n", 5, &tmp_err));
+        checksum = lr_checksumctx_final(ctx, &tmp_err);
+        fail_if(tmp_err);
+        fail_if(strcmp(checksum, expected[x]),
+            "Checksum is %s instead of %s", checksum, expected[x]);
+        lr_free(checksum);
+        lr_checksumctx_free(ctx);
+
+        // State of a different checksum type
+        ctx = lr_checksumctx_load(types[(x + 1) % G_N_ELEMENTS(types)],
+                                  state, &tmp_err);
+        fail_if(ctx);
+        fail_if(!tmp_err);
+        g_error_free(tmp_err);
+        tmp_err = NULL;
+        lr_free(state);
+    }
+
+    // Invalid state
+    ctx = lr_checksumctx_load(LR_CHECKSUM_SHA256, "Zm9vYmFy", &tmp_err);
+    fail_if(ctx);
+    fail_if(!tmp_err);
+    g_error_free(tmp_err);
+}
+END_TEST
+
+START_TEST(test_checksum_fd_multi)
+{
+    int fd;
+    char *file;
+    char *checksums[4];
+    LrChecksumType types[] = { LR_CHECKSUM_MD5,
+                               LR_CHECKSUM_SHA256,
+                               LR_CHECKSUM_MD5,
+                               LR_CHECKSUM_SHA1 };
+    GError *tmp_err = NULL;
+
+    file = lr_pathconcat(test_globals.tmpdir, "/test_checksum_fd_multi", NULL);
+    build_test_file(file, CHKS_CONTENT_01);
+    fd = open(file, O_RDONLY);
+    fail_if(fd < 0);
+
+    fail_if(!lr_checksum_fd_multi(fd, types, 4, checksums, &tmp_err));
+    fail_if(tmp_err);
+    fail_if(strcmp(checksums[0], CHKS_VAL_01_MD5));
+    fail_if(strcmp(checksums[1], CHKS_VAL_01_SHA256));
+    fail_if(strcmp(checksums[2], CHKS_VAL_01_MD5));
+    fail_if(strcmp(checksums[3], CHKS_VAL_01_SHA1));
+    for (int x = 0; x < 4; x++)
+        lr_free(checksums[x]);
+
+    // No checksum requested
+    fail_if(!lr_checksum_fd_multi(fd, NULL, 0, NULL, &tmp_err));
+    fail_if(tmp_err);
+
+    close(fd);
+    fail_if(remove(file) != 0, "Cannot delete temporary test file");
+    lr_free(file);
+}
+END_TEST
+
+static gboolean
+verify_files_cb(LrChecksumJob *job, void *cbdata)
+{
+    int *finished = cbdata;
+    (*finished)++;
+    return TRUE;
+}
+
+START_TEST(test_checksum_verify_files)
+{
+    char *file_00, *file_01, *missing;
+    LrChecksumJob jobs[3];
+    GSList *list = NULL;
+
+    file_00 = lr_pathconcat(test_globals.tmpdir, "/verify_00", NULL);
+    file_01 = lr_pathconcat(test_globals.tmpdir, "/verify_01", NULL);
+    missing = lr_pathconcat(test_globals.tmpdir, "/verify_missing", NULL);
+    build_test_file(file_00, CHKS_CONTENT_00);
+    build_test_file(file_01, CHKS_CONTENT_01);
+
+    for (int x = 0; x < 3; x++)
+        list = g_slist_append(list, &jobs[x]);
+
+    // Sequential (1 thread) and parallel (number of processors)
+    for (guint threads = 1; ; threads = 0) {
+        int finished = 0;
+
+        memset(jobs, 0, sizeof(jobs));
+        jobs[0].path = file_00;
+        jobs[0].type = LR_CHECKSUM_SHA256;
+        jobs[0].expected = CHKS_VAL_00_SHA256;
+        jobs[1].path = file_01;
+        jobs[1].type = LR_CHECKSUM_SHA256;
+        jobs[1].expected = CHKS_VAL_00_SHA256;
+        jobs[2].path = missing;
+        jobs[2].type = LR_CHECKSUM_SHA256;
+        jobs[2].expected = CHKS_VAL_00_SHA256;
+
+        lr_checksum_verify_files(list, threads, verify_files_cb, &finished);
+
+        fail_if(finished != 3);
+        fail_if(!jobs[0].opened);
+        fail_if(!jobs[0].matches);
+        fail_if(jobs[0].error);
+        fail_if(!jobs[1].opened);
+        fail_if(jobs[1].matches);
+        fail_if(jobs[1].error);
+        fail_if(jobs[2].opened);
+        fail_if(!jobs[2].error);
+        g_clear_error(&jobs[2].error);
+
+        if (threads == 0)
+            break;
+    }
+
+    g_slist_free(list);
+    fail_if(remove(file_00) != 0, "Cannot delete temporary test file");
+    fail_if(remove(file_01) != 0, "Cannot delete temporary test file");
+    lr_free(file_00);
+    lr_free(file_01);
+    lr_free(missing);
+}
+END_TEST
+
 START_TEST(test_cached_checksum)
 {
     FILE *f;
@@ -107,12 +357,7 @@ START_TEST(test_cached_checksum)
     fclose(f);
 
     // Assert no cached checksum exists
-    ret = stat(filename, &st);
-    fail_if(ret != 0);
-    key = g_strdup_printf("user.Zif.MdChecksum[%llu]",
-                          (unsigned long long) st.st_mtime);
-    attr_ret = getxattr(filename, key, &buf, sizeof(buf));
-    lr_free(key);
+    attr_ret = getxattr(filename, "user.librepo.sha256", &buf, sizeof(buf));
     fail_if(attr_ret != -1);  // Cached checksum should not exists
 
     // Calculate checksum
@@ -132,11 +377,13 @@ START_TEST(test_cached_checksum)
     // Assert cached checksum exists
     ret = stat(filename, &st);
     fail_if(ret != 0);
-    key = g_strdup_printf("user.Zif.MdChecksum[%llu]",
-                          (unsigned long long) st.st_mtime);
-    attr_ret = getxattr(filename, key, &buf, sizeof(buf));
-
-    lr_free(key);
+    key = g_strdup_printf("%llu:%lld:%lld.%09ld %s",
+                          (unsigned long long) st.st_ino,
+                          (long long) st.st_size,
+                          (long long) st.st_mtim.tv_sec,
+                          (long) st.st_mtim.tv_nsec,
+                          expected);
+    attr_ret = getxattr(filename, "user.librepo.sha256", &buf, sizeof(buf)-1);
 
     if (attr_ret == -1) {
         // Error encountered
@@ -147,12 +394,16 @@ START_TEST(test_cached_checksum)
         // Any other errno means fail
         fail_if(attr_ret == -1);
     } else {
-        fail_if(strcmp(buf, expected));
+        buf[attr_ret] = '\0';
+        fail_if(strcmp(buf, key), "Cached value is %s instead of %s", buf, key);
     }
 
-    // Calculate checksum again (cached shoud be used this time)
+    // Only the checksum of the type is cached
     fd = open(filename, O_RDONLY);
     fail_if(fd < 0);
+    fail_if(lr_checksum_cache_get(fd, NULL, LR_CHECKSUM_SHA1));
+
+    // Calculate checksum again (cached shoud be used this time)
     checksum_ret = lr_checksum_fd_cmp(LR_CHECKSUM_SHA256,
                                       fd,
                                       expected,
@@ -162,9 +413,73 @@ START_TEST(test_cached_checksum)
     fail_if(tmp_err);
     fail_if(!checksum_ret);
     fail_if(!matches);
+
+    // Cached checksum is not valid after the mtime (nanoseconds) changed
+    struct timespec times[2];
+    times[0] = st.st_atim;
+    times[1] = st.st_mtim;
+    times[1].tv_nsec = (times[1].tv_nsec + 1) % 1000000000;
+    fail_if(futimens(fd, times) != 0);
+    fail_if(lr_checksum_cache_get(fd, NULL, LR_CHECKSUM_SHA256));
     close(fd);
 
 exit_label:
+    lr_free(key);
+    lr_free(filename);
+}
+END_TEST
+
+START_TEST(test_checksum_index)
+{
+    FILE *f;
+    int fd;
+    char *filename, *indexname, *checksum;
+    char *content = NULL;
+    struct stat st;
+    struct timespec times[2];
+
+    filename = lr_pathconcat(test_globals.tmpdir, "/test_checksum_index", NULL);
+    indexname = lr_pathconcat(test_globals.tmpdir, "/",
+                              LR_CHECKSUM_INDEX_FILENAME, NULL);
+    f = fopen(filename, "w");
+    fwrite("foo\nbar\n", 1, 8, f);
+    fclose(f);
+
+    fd = open(filename, O_RDONLY);
+    fail_if(fd < 0);
+
+    // Nothing is indexed yet
+    fail_if(lr_checksum_index_get(filename, fd, LR_CHECKSUM_SHA256));
+
+    lr_checksum_index_set(filename, fd, LR_CHECKSUM_SHA256, "aaa");
+    lr_checksum_index_set(filename, fd, LR_CHECKSUM_SHA1, "bbb");
+    checksum = lr_checksum_index_get(filename, fd, LR_CHECKSUM_SHA256);
+    fail_if(g_strcmp0(checksum, "aaa"), "Indexed value is %s", checksum);
+    lr_free(checksum);
+    checksum = lr_checksum_index_get(filename, fd, LR_CHECKSUM_SHA1);
+    fail_if(g_strcmp0(checksum, "bbb"), "Indexed value is %s", checksum);
+    lr_free(checksum);
+
+    // An entry of the same file and type is replaced
+    lr_checksum_index_set(filename, fd, LR_CHECKSUM_SHA256, "ccc");
+    checksum = lr_checksum_index_get(filename, fd, LR_CHECKSUM_SHA256);
+    fail_if(g_strcmp0(checksum, "ccc"), "Indexed value is %s", checksum);
+    lr_free(checksum);
+    fail_if(!g_file_get_contents(indexname, &content, NULL, NULL));
+    fail_if(strstr(content, "aaa"));
+    g_free(content);
+
+    // The entry is not valid after the mtime changed
+    fail_if(fstat(fd, &st) != 0);
+    times[0] = st.st_atim;
+    times[1] = st.st_mtim;
+    times[1].tv_nsec = (times[1].tv_nsec + 1) % 1000000000;
+    fail_if(futimens(fd, times) != 0);
+    fail_if(lr_checksum_index_get(filename, fd, LR_CHECKSUM_SHA256));
+
+    close(fd);
+    unlink(indexname);
+    lr_free(indexname);
     lr_free(filename);
 }
 END_TEST
@@ -175,7 +490,13 @@ checksum_suite(void)
     Suite *s = suite_create("cheksum");
     TCase *tc = tcase_create("Main");
     tcase_add_test(tc, test_checksum_fd);
+    tcase_add_test(tc, test_checksum_fd_big);
+    tcase_add_test(tc, test_checksumctx);
+    tcase_add_test(tc, test_checksumctx_state);
+    tcase_add_test(tc, test_checksum_fd_multi);
+    tcase_add_test(tc, test_checksum_verify_files);
     tcase_add_test(tc, test_cached_checksum);
+    tcase_add_test(tc, test_checksum_index);
     suite_add_tcase(s, tc);
     return s;
 }
@@ -0,0 +1,195 @@
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+
+#include "testsys.h"
+#include "fixtures.h"
+#include "test_daemon.h"
+#include "librepo/rcodes.h"
+#include "librepo/handle_internal.h"
+#include "librepo/daemon_internal.h"
+
+START_TEST(test_daemon_message)
+{
+    int fds[2];
+    GError *tmp_err = NULL;
+    GKeyFile *msg, *received;
+    gchar *value;
+
+    fail_if(socketpair(AF_UNIX, SOCK_STREAM, 0, fds) != 0);
+
+    msg = g_key_file_new();
+    g_key_file_set_string(msg, "request", "type", "perform\nwith newline");
+    fail_if(!lr_daemon_send(fds[0], msg, &tmp_err));
+    fail_if(tmp_err);
+
+    received = lr_daemon_receive(fds[1], &tmp_err);
+    fail_if(!received);
+    fail_if(tmp_err);
+    value = g_key_file_get_string(received, "request", "type", NULL);
+    ck_assert_str_eq(value, "perform\nwith newline");
+    g_free(value);
+    g_key_file_free(received);
+
+    // Closed connection
+    close(fds[0]);
+    received = lr_daemon_receive(fds[1], &tmp_err);
+    fail_if(received);
+    fail_if(!tmp_err);
+    fail_if(tmp_err->code != LRE_IO);
+    g_error_free(tmp_err);
+
+    close(fds[1]);
+    g_key_file_free(msg);
+}
+END_TEST
+
+START_TEST(test_daemon_handle)
+{
+    GError *tmp_err = NULL;
+    GKeyFile *msg;
+    LrHandle *h, *h2;
+    gchar *key, *key2;
+    char *urls[] = {"http://foo/repo", NULL};
+    char *other_urls[] = {"http://bar/repo", NULL};
+    char *yumdlist[] = {NULL};
+
+    h = lr_handle_init();
+    fail_if(!lr_handle_setopt(h, NULL, LRO_URLS, urls));
+    fail_if(!lr_handle_setopt(h, NULL, LRO_REPOTYPE, LR_YUMREPO));
+    fail_if(!lr_handle_setopt(h, NULL, LRO_DESTDIR, "/tmp/a"));
+    fail_if(!lr_handle_setopt(h, NULL, LRO_YUMDLIST, yumdlist));
+
+    msg = g_key_file_new();
+    lr_daemon_handle_to_keyfile(h, msg, "handle 0");
+    key = lr_daemon_handle_key(msg, "handle 0");
+
+    // Requests of the repository differ only by the options of the request
+    fail_if(!lr_handle_setopt(h, NULL, LRO_DESTDIR, "/tmp/b"));
+    lr_daemon_handle_to_keyfile(h, msg, "handle 1");
+    key2 = lr_daemon_handle_key(msg, "handle 1");
+    ck_assert_str_eq(key, key2);
+    g_free(key2);
+
+    fail_if(!lr_handle_setopt(h, NULL, LRO_URLS, other_urls));
+    lr_daemon_handle_to_keyfile(h, msg, "handle 2");
+    key2 = lr_daemon_handle_key(msg, "handle 2");
+    fail_if(!strcmp(key, key2));
+    g_free(key2);
+    g_free(key);
+
+    h2 = lr_handle_init();
+    fail_if(!lr_daemon_handle_from_keyfile(h2, msg, "handle 0", TRUE, &tmp_err));
+    fail_if(tmp_err);
+    ck_assert_str_eq(h2->urls[0], "http://foo/repo");
+    fail_if(h2->urls[1]);
+    ck_assert_str_eq(h2->destdir, "/tmp/a");
+    fail_if(!h2->yumdlist);
+    fail_if(h2->yumdlist[0]);
+    fail_if(h2->yumblist);
+
+    fail_if(lr_daemon_handle_from_keyfile(h2, msg, "handle 9", TRUE, &tmp_err));
+    fail_if(!tmp_err);
+    g_error_free(tmp_err);
+
+    lr_handle_free(h2);
+    lr_handle_free(h);
+    g_key_file_free(msg);
+}
+END_TEST
+
+START_TEST(test_daemon_packagetarget)
+{
+    GError *tmp_err = NULL;
+    GKeyFile *msg;
+    LrPackageTarget *target, *target2;
+
+    target = lr_packagetarget_new_v4(NULL, "foo.rpm", "/tmp/dest",
+                                     LR_CHECKSUM_SHA256, "abc", 123,
+                                     "http://foo/", TRUE, NULL, NULL,
+                                     NULL, NULL, 0, 0, 5, NULL);
+    fail_if(!target);
+
+    msg = g_key_file_new();
+    lr_daemon_packagetarget_to_keyfile(target, 3, msg, "target 0");
+    fail_if(g_key_file_get_int64(msg, "target 0", "handle", NULL) != 3);
+
+    target2 = lr_daemon_packagetarget_from_keyfile(NULL, msg, "target 0",
+                                                   NULL, NULL, &tmp_err);
+    fail_if(!target2);
+    fail_if(tmp_err);
+    ck_assert_str_eq(target2->relative_url, "foo.rpm");
+    ck_assert_str_eq(target2->dest, "/tmp/dest");
+    fail_if(target2->checksum_type != LR_CHECKSUM_SHA256);
+    ck_assert_str_eq(target2->checksum, "abc");
+    fail_if(target2->expectedsize != 123);
+    ck_assert_str_eq(target2->base_url, "http://foo/");
+    fail_if(!target2->resume);
+    fail_if(target2->priority != 5);
+
+    lr_packagetarget_free(target2);
+    lr_packagetarget_free(target);
+    g_key_file_free(msg);
+}
+END_TEST
+
+START_TEST(test_daemon_no_daemon)
+{
+    GError *tmp_err = NULL;
+    LrHandle *h;
+    LrResult *r;
+    char *urls[] = {"http://foo/repo", NULL};
+    gchar *socket_path = lr_pathconcat(test_globals.tmpdir,
+                                       "no-librepod.sock", NULL);
+
+    h = lr_handle_init();
+    r = lr_result_init();
+    fail_if(!lr_handle_setopt(h, NULL, LRO_URLS, urls));
+    fail_if(!lr_handle_setopt(h, NULL, LRO_REPOTYPE, LR_YUMREPO));
+
+    // LRO_DESTDIR is required
+    fail_if(lr_daemon_handle_perform(socket_path, h, r, &tmp_err));
+    fail_if(!tmp_err);
+    fail_if(tmp_err->code != LRE_BADFUNCARG);
+    g_clear_error(&tmp_err);
+
+    fail_if(!lr_handle_setopt(h, NULL, LRO_DESTDIR, test_globals.tmpdir));
+
+    // Options which are not forwarded to the daemon are refused
+    fail_if(!lr_handle_setopt(h, NULL, LRO_IGNOREMISSING, 1L));
+    fail_if(lr_daemon_handle_perform(socket_path, h, r, &tmp_err));
+    fail_if(!tmp_err);
+    fail_if(tmp_err->code != LRE_BADFUNCARG);
+    g_clear_error(&tmp_err);
+    fail_if(!lr_handle_setopt(h, NULL, LRO_IGNOREMISSING, 0L));
+
+    fail_if(!lr_handle_setopt(h, NULL, LRO_USERPWD, "user:pass"));
+    fail_if(lr_daemon_handle_perform(socket_path, h, r, &tmp_err));
+    fail_if(!tmp_err);
+    fail_if(tmp_err->code != LRE_BADFUNCARG);
+    g_clear_error(&tmp_err);
+    fail_if(!lr_handle_setopt(h, NULL, LRO_USERPWD, NULL));
+
+    fail_if(lr_daemon_handle_perform(socket_path, h, r, &tmp_err));
+    fail_if(!tmp_err);
+    fail_if(tmp_err->code != LRE_IO);
+    g_clear_error(&tmp_err);
+
+    lr_result_free(r);
+    lr_handle_free(h);
+    lr_free(socket_path);
+}
+END_TEST
+
+Suite *
+daemon_suite(void)
+{
+    Suite *s = suite_create("daemon");
+    TCase *tc = tcase_create("Main");
+    tcase_add_test(tc, test_daemon_message);
+    tcase_add_test(tc, test_daemon_handle);
+    tcase_add_test(tc, test_daemon_packagetarget);
+    tcase_add_test(tc, test_daemon_no_daemon);
+    suite_add_tcase(s, tc);
+    return s;
+}
@@ -0,0 +1,8 @@
+#ifndef LR_TEST_DAEMON_H
+#define LR_TEST_DAEMON_H
+
+#include <check.h>
+
+Suite *daemon_suite(void);
+
+#endif
@@ -290,6 +290,1064 @@ START_TEST(test_downloader_three_files_with_error)
 }
 END_TEST
 
+START_TEST(test_downloader_async_no_list)
+{
+    gboolean ret;
+    gboolean finished = FALSE;
+    LrDownloadAsync *ctx;
+    GError *err = NULL;
+
+    ctx = lr_download_async_start(NULL, FALSE, &err);
+    fail_if(!ctx);
+    fail_if(err);
+
+    ret = lr_download_async_step(ctx, &finished, &err);
+    fail_if(!ret);
+    fail_if(err);
+    fail_if(!finished);
+
+    ret = lr_download_async_finish(ctx, &err);
+    fail_if(!ret);
+    fail_if(err);
+}
+END_TEST
+
+START_TEST(test_downloader_async_add)
+{
+    gboolean ret;
+    gboolean finished = FALSE;
+    GError *err = NULL;
+    gchar *path, *url;
+    gchar *content = NULL;
+    gsize length = 0;
+    LrDownloadTarget *t1;
+    LrDownloadAsync *ctx;
+
+    path = lr_pathconcat(test_globals.testdata_dir, "repo_yum_01",
+                         "repodata", "repomd.xml", NULL);
+    url = g_strconcat("file://", path, NULL);
+    fail_if(!g_file_get_contents(path, &content, &length, NULL));
+
+    t1 = lr_downloadtarget_new(NULL, url, NULL, -1, NULL, NULL, 0, 0,
+                               NULL, NULL, NULL, NULL, NULL, 0, 0);
+    fail_if(!t1);
+
+    // Target added to a download started without targets
+
+    ctx = lr_download_async_start(NULL, FALSE, &err);
+    fail_if(!ctx);
+    fail_if(err);
+
+    ret = lr_download_async_add(ctx, t1, &err);
+    fail_if(!ret);
+    fail_if(err);
+
+    while (!finished) {
+        int maxfd;
+        long timeout_ms;
+        struct timeval timeout;
+        fd_set fdread, fdwrite, fdexcep;
+
+        FD_ZERO(&fdread);
+        FD_ZERO(&fdwrite);
+        FD_ZERO(&fdexcep);
+
+        ret = lr_download_async_fdset(ctx, &fdread, &fdwrite, &fdexcep,
+                                      &maxfd, &timeout_ms, &err);
+        fail_if(!ret);
+        fail_if(err);
+
+        timeout.tv_sec  = timeout_ms / 1000;
+        timeout.tv_usec = (timeout_ms % 1000) * 1000;
+        select(maxfd+1, &fdread, &fdwrite, &fdexcep, &timeout);
+
+        ret = lr_download_async_step(ctx, &finished, &err);
+        fail_if(!ret);
+        fail_if(err);
+    }
+
+    ret = lr_download_async_finish(ctx, &err);
+    fail_if(!ret);
+    fail_if(err);
+
+    // Check results
+
+    fail_if(t1->err);
+    fail_if(!t1->data);
+    fail_if(t1->data->len != length);
+    fail_if(memcmp(t1->data->data, content, length));
+
+    lr_downloadtarget_free(t1);
+    g_free(content);
+    g_free(url);
+    lr_free(path);
+}
+END_TEST
+
+START_TEST(test_downloader_async_single_file)
+{
+    gboolean ret;
+    gboolean finished = FALSE;
+    GSList *list = NULL;
+    GError *err = NULL;
+    int fd1;
+    char *tmpfn1;
+    LrDownloadTarget *t1;
+    LrDownloadAsync *ctx;
+
+    // Prepare list of download targets
+
+    tmpfn1 = lr_pathconcat(test_globals.tmpdir, "async_single_file_XXXXXX", NULL);
+
+    mktemp(tmpfn1);
+    fd1 = open(tmpfn1, O_RDWR|O_CREAT|O_TRUNC, 0666);
+    lr_free(tmpfn1);
+    fail_if(fd1 < 0);
+
+    t1 = lr_downloadtarget_new(NULL, "http://seznam.cz/index.html", NULL,
+                               fd1, NULL, NULL, 0, 0, NULL, NULL, NULL,
+                               NULL, NULL, 0, 0);
+    fail_if(!t1);
+
+    list = g_slist_append(list, t1);
+
+    // Download from our own loop
+
+    ctx = lr_download_async_start(list, FALSE, &err);
+    fail_if(!ctx);
+    fail_if(err);
+
+    while (!finished) {
+        int maxfd;
+        long timeout_ms;
+        struct timeval timeout;
+        fd_set fdread, fdwrite, fdexcep;
+
+        FD_ZERO(&fdread);
+        FD_ZERO(&fdwrite);
+        FD_ZERO(&fdexcep);
+
+        ret = lr_download_async_fdset(ctx, &fdread, &fdwrite, &fdexcep,
+                                      &maxfd, &timeout_ms, &err);
+        fail_if(!ret);
+        fail_if(err);
+
+        timeout.tv_sec  = timeout_ms / 1000;
+        timeout.tv_usec = (timeout_ms % 1000) * 1000;
+        select(maxfd+1, &fdread, &fdwrite, &fdexcep, &timeout);
+
+        ret = lr_download_async_step(ctx, &finished, &err);
+        fail_if(!ret);
+        fail_if(err);
+    }
+
+    ret = lr_download_async_finish(ctx, &err);
+    fail_if(!ret);
+    fail_if(err);
+
+    // Check results
+
+    for (GSList *elem = list; elem; elem = g_slist_next(elem)) {
+            LrDownloadTarget *dtarget = elem->data;
+            if (dtarget->err) {
+                printf("Error msg: %s\n", dtarget->err);
+                ck_abort();
+            }
+    }
+
+    g_slist_free_full(list, (GDestroyNotify) lr_downloadtarget_free);
+}
+END_TEST
+
+START_TEST(test_downloader_cancelled_handle)
+{
+    gboolean ret;
+    LrHandle *handle;
+    GSList *list = NULL;
+    GError *err = NULL;
+    GError *tmp_err = NULL;
+    int fd1;
+    char *tmpfn1;
+    LrDownloadTarget *t1;
+
+    // Prepare cancelled handle
+
+    handle = lr_handle_init();
+    fail_if(handle == NULL);
+
+    char *urls[] = {"http://127.0.0.1", NULL};
+    lr_handle_setopt(handle, NULL, LRO_URLS, urls);
+    lr_handle_prepare_internal_mirrorlist(handle, FALSE, &tmp_err);
+    fail_if(tmp_err);
+    lr_handle_cancel(handle);
+
+    // Prepare list of download targets
+
+    tmpfn1 = lr_pathconcat(test_globals.tmpdir, "cancelled_XXXXXX", NULL);
+
+    mktemp(tmpfn1);
+    fd1 = open(tmpfn1, O_RDWR|O_CREAT|O_TRUNC, 0666);
+    lr_free(tmpfn1);
+    fail_if(fd1 < 0);
+
+    t1 = lr_downloadtarget_new(handle, "index.html", NULL, fd1, NULL, NULL,
+                               0, 0, NULL, NULL, NULL, NULL, NULL, 0, 0);
+    fail_if(!t1);
+
+    list = g_slist_append(list, t1);
+
+    // Download
+
+    ret = lr_download(list, FALSE, &err);
+    fail_if(ret);
+    fail_if(!err);
+    fail_if(err->code != LRE_CANCELLED);
+    g_error_free(err);
+    fail_if(t1->rcode == LRE_OK);
+
+    lr_handle_reset_cancel(handle);
+    lr_handle_free(handle);
+    g_slist_free_full(list, (GDestroyNotify) lr_downloadtarget_free);
+}
+END_TEST
+
+START_TEST(test_downloader_memory_target)
+{
+    gboolean ret;
+    GSList *list = NULL;
+    GError *err = NULL;
+    gchar *path, *url;
+    gchar *content = NULL;
+    gsize length = 0;
+    LrDownloadTarget *t1;
+
+    path = lr_pathconcat(test_globals.testdata_dir, "repo_yum_01",
+                         "repodata", "repomd.xml", NULL);
+    url = g_strconcat("file://", path, NULL);
+    fail_if(!g_file_get_contents(path, &content, &length, NULL));
+
+    // Target without fd and fn is downloaded into memory
+
+    t1 = lr_downloadtarget_new(NULL, url, NULL, -1, NULL, NULL, 0, 0,
+                               NULL, NULL, NULL, NULL, NULL, 0, 0);
+    fail_if(!t1);
+
+    list = g_slist_append(list, t1);
+
+    ret = lr_download(list, FALSE, &err);
+    fail_if(!ret);
+    fail_if(err);
+    fail_if(t1->err);
+
+    // Check results
+
+    fail_if(!t1->data);
+    fail_if(t1->data->len != length);
+    fail_if(memcmp(t1->data->data, content, length));
+    fail_if(t1->stats.attempts != 1);
+    fail_if(t1->stats.total_time < t1->stats.starttransfer_time);
+
+    g_slist_free_full(list, (GDestroyNotify) lr_downloadtarget_free);
+    g_free(content);
+    g_free(url);
+    lr_free(path);
+}
+END_TEST
+
+static int
+count_endcb(void *data,
+            LrTransferStatus status,
+            G_GNUC_UNUSED const char *msg)
+{
+    if (status == LR_TRANSFER_SUCCESSFUL)
+        (*((int *) data))++;
+    return LR_CB_OK;
+}
+
+START_TEST(test_downloader_duplicate_targets)
+{
+    gboolean ret;
+    GSList *list = NULL;
+    GError *err = NULL;
+    gchar *path, *url, *fn1, *fn2;
+    gchar *content = NULL, *content1 = NULL, *content2 = NULL;
+    int finished = 0;
+    LrDownloadTarget *t1, *t2;
+
+    path = lr_pathconcat(test_globals.testdata_dir, "repo_yum_01",
+                         "repodata", "repomd.xml", NULL);
+    url = g_strconcat("file://", path, NULL);
+    fail_if(!g_file_get_contents(path, &content, NULL, NULL));
+    fn1 = lr_pathconcat(test_globals.tmpdir, "duplicate_1", NULL);
+    fn2 = lr_pathconcat(test_globals.tmpdir, "duplicate_2", NULL);
+
+    // The same URL to two destinations
+
+    t1 = lr_downloadtarget_new(NULL, url, NULL, -1, fn1, NULL, 0, 0,
+                               NULL, &finished, count_endcb, NULL, NULL, 0, 0);
+    t2 = lr_downloadtarget_new(NULL, url, NULL, -1, fn2, NULL, 0, 0,
+                               NULL, &finished, count_endcb, NULL, NULL, 0, 0);
+    fail_if(!t1 || !t2);
+
+    list = g_slist_append(list, t1);
+    list = g_slist_append(list, t2);
+
+    ret = lr_download(list, FALSE, &err);
+    fail_if(!ret);
+    fail_if(err);
+    fail_if(t1->err);
+    fail_if(t2->err);
+
+    // Both end callbacks were called, the file was downloaded once
+
+    fail_if(finished != 2);
+    fail_if(t1->stats.attempts != 1);
+    fail_if(t2->stats.attempts != 0);
+    fail_if(!g_file_get_contents(fn1, &content1, NULL, NULL));
+    fail_if(!g_file_get_contents(fn2, &content2, NULL, NULL));
+    fail_if(strcmp(content1, content));
+    fail_if(strcmp(content2, content));
+
+    g_slist_free_full(list, (GDestroyNotify) lr_downloadtarget_free);
+    g_free(content);
+    g_free(content1);
+    g_free(content2);
+    lr_free(fn1);
+    lr_free(fn2);
+    g_free(url);
+    lr_free(path);
+}
+END_TEST
+
+START_TEST(test_downloader_cache_sources)
+{
+    gboolean ret;
+    LrHandle *handle;
+    GSList *list = NULL;
+    GError *err = NULL;
+    gchar *path, *repo, *fn, *fn2;
+    LrDownloadTarget *t1, *t2;
+
+    path = lr_pathconcat(test_globals.testdata_dir, "repo_yum_01", NULL);
+    repo = g_strconcat("file://", path, NULL);
+    fn = lr_pathconcat(test_globals.tmpdir, "cache_sources", NULL);
+    fn2 = lr_pathconcat(test_globals.tmpdir, "cache_sources_2", NULL);
+
+    // A miss in the cache falls through to the mirror and it is not
+    // counted as a try of a mirror
+
+    handle = lr_handle_init();
+    fail_if(handle == NULL);
+    char *urls[] = {repo, NULL};
+    char *caches[] = {"file:///nonexistent/cache", NULL};
+    lr_handle_setopt(handle, NULL, LRO_URLS, urls);
+    lr_handle_setopt(handle, NULL, LRO_CACHESOURCES, caches);
+    lr_handle_setopt(handle, NULL, LRO_MAXMIRRORTRIES, 1L);
+    lr_handle_prepare_internal_mirrorlist(handle, FALSE, &err);
+    fail_if(err);
+
+    t1 = lr_downloadtarget_new(handle, "repodata/repomd.xml", NULL, -1, fn,
+                               NULL, 0, 0, NULL, NULL, NULL, NULL, NULL, 0, 0);
+    fail_if(!t1);
+    t1->cachesources = TRUE;
+    list = g_slist_append(list, t1);
+
+    ret = lr_download(list, FALSE, &err);
+    fail_if(!ret);
+    fail_if(err);
+    fail_if(t1->err);
+    fail_if(!t1->usedmirror || strstr(t1->usedmirror, "cache"));
+    fail_if(t1->stats.attempts != 2);
+    g_slist_free_full(list, (GDestroyNotify) lr_downloadtarget_free);
+    list = NULL;
+    lr_handle_free(handle);
+
+    // The cache is used before the mirrors, but only by the targets
+    // which want it
+
+    handle = lr_handle_init();
+    fail_if(handle == NULL);
+    char *badurls[] = {"file:///nonexistent/mirror", NULL};
+    char *goodcaches[] = {repo, NULL};
+    lr_handle_setopt(handle, NULL, LRO_URLS, badurls);
+    lr_handle_setopt(handle, NULL, LRO_CACHESOURCES, goodcaches);
+    lr_handle_prepare_internal_mirrorlist(handle, FALSE, &err);
+    fail_if(err);
+
+    t1 = lr_downloadtarget_new(handle, "repodata/repomd.xml", NULL, -1, fn,
+                               NULL, 0, 0, NULL, NULL, NULL, NULL, NULL, 0, 0);
+    t2 = lr_downloadtarget_new(handle, "repodata/repomd.xml.asc", NULL, -1,
+                               fn2, NULL, 0, 0, NULL, NULL, NULL, NULL, NULL,
+                               0, 0);
+    fail_if(!t1 || !t2);
+    t1->cachesources = TRUE;
+    list = g_slist_append(list, t1);
+    list = g_slist_append(list, t2);
+
+    ret = lr_download(list, FALSE, &err);
+    fail_if(!ret);
+    fail_if(err);
+    fail_if(t1->err);
+    fail_if(!t1->usedmirror || strstr(t1->usedmirror, "nonexistent"));
+    fail_if(!t2->err);
+    g_slist_free_full(list, (GDestroyNotify) lr_downloadtarget_free);
+    lr_handle_free(handle);
+
+    lr_free(fn);
+    lr_free(fn2);
+    g_free(repo);
+    lr_free(path);
+}
+END_TEST
+
+static int
+final_progresscb(void *data, double total, double now)
+{
+    if (total > 0.0 && now == total)
+        (*((int *) data))++;
+    return LR_CB_OK;
+}
+
+START_TEST(test_downloader_local_copy)
+{
+    gboolean ret;
+    LrHandle *handle;
+    GSList *list = NULL;
+    GError *err = NULL;
+    gchar *path, *repo, *src, *fn;
+    gchar *content = NULL, *copied = NULL;
+    struct stat src_st, st;
+    int finished = 0;
+    LrDownloadTarget *t1;
+
+    path = lr_pathconcat(test_globals.testdata_dir, "repo_yum_01", NULL);
+    repo = g_strconcat("file://", path, NULL);
+    src = lr_pathconcat(path, "repodata", "repomd.xml", NULL);
+    fn = lr_pathconcat(test_globals.tmpdir, "local_copy", NULL);
+    fail_if(!g_file_get_contents(src, &content, NULL, NULL));
+    fail_if(stat(src, &src_st) != 0);
+
+    handle = lr_handle_init();
+    fail_if(handle == NULL);
+    char *urls[] = {repo, NULL};
+    lr_handle_setopt(handle, NULL, LRO_URLS, urls);
+    lr_handle_prepare_internal_mirrorlist(handle, FALSE, &err);
+    fail_if(err);
+
+    // The file is copied, it has the expected size and the progress
+    // callback gets the final tick
+
+    t1 = lr_downloadtarget_new(handle, "repodata/repomd.xml", NULL, -1, fn,
+                               NULL, (gint64) src_st.st_size, 0,
+                               final_progresscb, &finished, NULL, NULL,
+                               NULL, 0, 0);
+    fail_if(!t1);
+    list = g_slist_append(list, t1);
+
+    ret = lr_download(list, FALSE, &err);
+    fail_if(!ret);
+    fail_if(err);
+    fail_if(t1->err);
+    fail_if(finished != 1);
+    fail_if(t1->stats.attempts != 1);
+    fail_if(!g_file_get_contents(fn, &copied, NULL, NULL));
+    fail_if(strcmp(copied, content));
+    fail_if(stat(fn, &st) != 0);
+    fail_if(st.st_dev == src_st.st_dev && st.st_ino == src_st.st_ino);
+    g_free(copied);
+    g_slist_free_full(list, (GDestroyNotify) lr_downloadtarget_free);
+    list = NULL;
+
+    // Wrong expected size is an error of the mirror
+
+    t1 = lr_downloadtarget_new(handle, "repodata/repomd.xml", NULL, -1, fn,
+                               NULL, (gint64) src_st.st_size + 1, 0,
+                               NULL, NULL, NULL, NULL, NULL, 0, 0);
+    fail_if(!t1);
+    list = g_slist_append(list, t1);
+
+    ret = lr_download(list, FALSE, &err);
+    fail_if(!ret);
+    fail_if(err);
+    fail_if(!t1->err);
+    g_slist_free_full(list, (GDestroyNotify) lr_downloadtarget_free);
+    list = NULL;
+
+    // With LRO_LOCALHARDLINK the target is the file of the repository
+    // (if both are on the same filesystem)
+
+    lr_handle_setopt(handle, NULL, LRO_LOCALHARDLINK, 1L);
+    t1 = lr_downloadtarget_new(handle, "repodata/repomd.xml", NULL, -1, fn,
+                               NULL, 0, 0, NULL, NULL, NULL, NULL, NULL, 0, 0);
+    fail_if(!t1);
+    list = g_slist_append(list, t1);
+
+    ret = lr_download(list, FALSE, &err);
+    fail_if(!ret);
+    fail_if(err);
+    fail_if(t1->err);
+    fail_if(!g_file_get_contents(fn, &copied, NULL, NULL));
+    fail_if(strcmp(copied, content));
+    g_free(copied);
+    g_slist_free_full(list, (GDestroyNotify) lr_downloadtarget_free);
+    lr_handle_free(handle);
+
+    // The repository is untouched
+    fail_if(!g_file_get_contents(src, &copied, NULL, NULL));
+    fail_if(strcmp(copied, content));
+    g_free(copied);
+
+    unlink(fn);
+    g_free(content);
+    lr_free(fn);
+    lr_free(src);
+    g_free(repo);
+    lr_free(path);
+}
+END_TEST
+
+START_TEST(test_downloader_durability)
+{
+    gboolean ret;
+    LrHandle *handle;
+    GSList *list = NULL;
+    GError *err = NULL;
+    gchar *path, *repo, *fn, *fn2;
+    LrDurability durability;
+    LrDurability modes[] = {LR_DURABILITY_BATCH, LR_DURABILITY_STRICT};
+    LrDownloadTarget *t1, *t2;
+    int fd;
+
+    path = lr_pathconcat(test_globals.testdata_dir, "repo_yum_01", NULL);
+    repo = g_strconcat("file://", path, NULL);
+    fn = lr_pathconcat(test_globals.tmpdir, "durability", NULL);
+    fn2 = lr_pathconcat(test_globals.tmpdir, "durability_fd", NULL);
+
+    handle = lr_handle_init();
+    fail_if(handle == NULL);
+    char *urls[] = {repo, NULL};
+    lr_handle_setopt(handle, NULL, LRO_URLS, urls);
+    lr_handle_prepare_internal_mirrorlist(handle, FALSE, &err);
+    fail_if(err);
+
+    fail_if(lr_handle_setopt(handle, NULL, LRO_DURABILITY, 42));
+    fail_if(!lr_handle_getinfo(handle, NULL, LRI_DURABILITY, &durability));
+    fail_if(durability != LR_DURABILITY_NONE);
+
+    // Files downloaded to a filename and to a file descriptor
+    // are synced in both modes
+
+    for (size_t x = 0; x < G_N_ELEMENTS(modes); x++) {
+        fail_if(!lr_handle_setopt(handle, NULL, LRO_DURABILITY, modes[x]));
+
+        fd = open(fn2, O_CREAT|O_TRUNC|O_RDWR, 0666);
+        fail_if(fd < 0);
+        t1 = lr_downloadtarget_new(handle, "repodata/repomd.xml", NULL, -1,
+                                   fn, NULL, 0, 0, NULL, NULL, NULL, NULL,
+                                   NULL, 0, 0);
+        t2 = lr_downloadtarget_new(handle, "repodata/repomd.xml.asc", NULL,
+                                   fd, NULL, NULL, 0, 0, NULL, NULL, NULL,
+                                   NULL, NULL, 0, 0);
+        fail_if(!t1 || !t2);
+        list = g_slist_append(list, t1);
+        list = g_slist_append(list, t2);
+
+        ret = lr_download(list, FALSE, &err);
+        fail_if(!ret);
+        fail_if(err);
+        fail_if(t1->err);
+        fail_if(t2->err);
+        g_slist_free_full(list, (GDestroyNotify) lr_downloadtarget_free);
+        list = NULL;
+        close(fd);
+    }
+
+    lr_handle_free(handle);
+    unlink(fn);
+    unlink(fn2);
+    lr_free(fn);
+    lr_free(fn2);
+    g_free(repo);
+    lr_free(path);
+}
+END_TEST
+
+START_TEST(test_downloader_atomic_download)
+{
+    gboolean ret;
+    LrHandle *handle;
+    GSList *list = NULL;
+    GError *err = NULL;
+    gchar *path, *repo, *src, *fn, *partfn;
+    gchar *content = NULL, *downloaded = NULL;
+    LrDownloadTarget *t1;
+
+    path = lr_pathconcat(test_globals.testdata_dir, "repo_yum_01", NULL);
+    repo = g_strconcat("file://", path, NULL);
+    src = lr_pathconcat(path, "repodata", "repomd.xml", NULL);
+    fn = lr_pathconcat(test_globals.tmpdir, "atomic", NULL);
+    partfn = g_strconcat(fn, ".part", NULL);
+    fail_if(!g_file_set_contents(fn, "previous", -1, NULL));
+
+    handle = lr_handle_init();
+    fail_if(handle == NULL);
+    char *urls[] = {repo, NULL};
+    lr_handle_setopt(handle, NULL, LRO_URLS, urls);
+    lr_handle_setopt(handle, NULL, LRO_ATOMICDOWNLOAD, 1L);
+    lr_handle_prepare_internal_mirrorlist(handle, FALSE, &err);
+    fail_if(err);
+
+    // A failed download keeps the previous file
+
+    t1 = lr_downloadtarget_new(handle, "repodata/nonexistent.xml", NULL, -1,
+                               fn, NULL, 0, 0, NULL, NULL, NULL, NULL, NULL,
+                               0, 0);
+    fail_if(!t1);
+    list = g_slist_append(list, t1);
+
+    ret = lr_download(list, FALSE, &err);
+    fail_if(!ret);
+    fail_if(err);
+    fail_if(!t1->err);
+    fail_if(!g_file_get_contents(fn, &downloaded, NULL, NULL));
+    fail_if(strcmp(downloaded, "previous"));
+    fail_if(g_file_test(partfn, G_FILE_TEST_EXISTS));
+    g_free(downloaded);
+    g_slist_free_full(list, (GDestroyNotify) lr_downloadtarget_free);
+    list = NULL;
+
+    // A finished download replaces it
+
+    t1 = lr_downloadtarget_new(handle, "repodata/repomd.xml", NULL, -1,
+                               fn, NULL, 0, 0, NULL, NULL, NULL, NULL, NULL,
+                               0, 0);
+    fail_if(!t1);
+    list = g_slist_append(list, t1);
+
+    ret = lr_download(list, FALSE, &err);
+    fail_if(!ret);
+    fail_if(err);
+    fail_if(t1->err);
+    fail_if(!g_file_get_contents(t1->fn, &downloaded, NULL, NULL));
+    fail_if(!g_file_get_contents(src, &content, NULL, NULL));
+    fail_if(strcmp(downloaded, content));
+    fail_if(g_file_test(partfn, G_FILE_TEST_EXISTS));
+    g_free(downloaded);
+    g_free(content);
+    g_slist_free_full(list, (GDestroyNotify) lr_downloadtarget_free);
+    lr_handle_free(handle);
+
+    unlink(fn);
+    g_free(partfn);
+    lr_free(fn);
+    lr_free(src);
+    g_free(repo);
+    lr_free(path);
+}
+END_TEST
+
+#define STREAM_TARGETS  300
+
+typedef struct {
+    LrHandle *handle;
+    GStringChunk *pool;
+    const char *dir;
+    int pulled;
+    int released;
+    int failed;
+    int max_live;
+} StreamData;
+
+static LrDownloadTarget *
+stream_source(void *cbdata)
+{
+    StreamData *data = cbdata;
+    LrDownloadTarget *target;
+    gchar *fn;
+
+    if (data->pulled == STREAM_TARGETS)
+        return NULL;
+
+    fn = g_strdup_printf("%s/stream-%d", data->dir, data->pulled);
+    target = lr_downloadtarget_new_pooled(data->pool, data->handle,
+                                          "repodata/repomd.xml", NULL, -1,
+                                          fn, NULL, 0, 0, NULL, NULL, NULL,
+                                          NULL, NULL, 0, 0);
+    g_free(fn);
+    data->pulled++;
+    data->max_live = MAX(data->max_live, data->pulled - data->released);
+    return target;
+}
+
+static void
+stream_release(void *cbdata, LrDownloadTarget *target)
+{
+    StreamData *data = cbdata;
+
+    if (target->rcode != LRE_OK || !g_file_test(target->fn,
+                                                G_FILE_TEST_IS_REGULAR))
+        data->failed++;
+    unlink(target->fn);
+    data->released++;
+    lr_downloadtarget_free(target);
+}
+
+START_TEST(test_downloader_stream)
+{
+    gboolean ret;
+    GError *err = NULL;
+    gchar *path, *repo;
+    StreamData data = { 0 };
+
+    path = lr_pathconcat(test_globals.testdata_dir, "repo_yum_01", NULL);
+    repo = g_strconcat("file://", path, NULL);
+
+    data.handle = lr_handle_init();
+    fail_if(data.handle == NULL);
+    char *urls[] = {repo, NULL};
+    lr_handle_setopt(data.handle, NULL, LRO_URLS, urls);
+    lr_handle_prepare_internal_mirrorlist(data.handle, FALSE, &err);
+    fail_if(err);
+    data.pool = g_string_chunk_new(0);
+    data.dir = test_globals.tmpdir;
+
+    ret = lr_download_stream(stream_source, stream_release, &data,
+                             TRUE, &err);
+    fail_if(!ret);
+    fail_if(err);
+    fail_if(data.pulled != STREAM_TARGETS);
+    fail_if(data.released != STREAM_TARGETS);
+    fail_if(data.failed != 0);
+    // Done targets are released during the download
+    fail_if(data.max_live >= STREAM_TARGETS);
+
+    g_string_chunk_free(data.pool);
+    lr_handle_free(data.handle);
+    g_free(repo);
+    lr_free(path);
+}
+END_TEST
+
+START_TEST(test_downloader_decompress_target)
+{
+    gboolean ret;
+    GSList *list = NULL;
+    GError *err = NULL;
+    gchar *path, *url;
+    char buf[6];
+    int fd;
+    LrDownloadTarget *t1;
+
+    path = lr_pathconcat(test_globals.testdata_dir, "repo_yum_01",
+                         "repodata",
+                         "4543ad62e4d86337cd1949346f9aec976b847b58-primary.xml.gz",
+                         NULL);
+    url = g_strconcat("file://", path, NULL);
+    fd = lr_gettmpfile();
+    fail_if(fd < 0);
+
+    // Downloaded data are decompressed to the decompressfd
+
+    t1 = lr_downloadtarget_new(NULL, url, NULL, -1, NULL, NULL, 0, 0,
+                               NULL, NULL, NULL, NULL, NULL, 0, 0);
+    fail_if(!t1);
+    t1->decompressfd = fd;
+
+    list = g_slist_append(list, t1);
+
+    ret = lr_download(list, FALSE, &err);
+    fail_if(!ret);
+    fail_if(err);
+    fail_if(t1->err);
+
+    // Check results
+
+    fail_if(!t1->data);
+    fail_if(t1->data->len < 2);
+    fail_if(t1->data->data[0] != 0x1f || t1->data->data[1] != 0x8b);
+    fail_if(pread(fd, buf, sizeof(buf) - 1, 0) != sizeof(buf) - 1);
+    buf[sizeof(buf) - 1] = '\0';
+    ck_assert_str_eq(buf, "<?xml");
+
+    close(fd);
+    g_slist_free_full(list, (GDestroyNotify) lr_downloadtarget_free);
+    g_free(url);
+    lr_free(path);
+}
+END_TEST
+
+static int
+collect_datacb(void *data, const char *ptr, size_t len)
+{
+    GByteArray *collected = data;
+    if (!ptr)
+        g_byte_array_set_size(collected, 0);
+    else
+        g_byte_array_append(collected, (const guint8 *) ptr, len);
+    return LR_CB_OK;
+}
+
+START_TEST(test_downloader_tee_outputs)
+{
+    gboolean ret;
+    GSList *list = NULL;
+    GError *err = NULL;
+    gchar *path, *url, *fn, *outfn, *content = NULL, *teed = NULL;
+    gsize len = 0, teed_len = 0;
+    GByteArray *collected = g_byte_array_new();
+    struct stat st;
+    int fd;
+    LrDownloadTarget *t1;
+    LrDownloadTargetOutput *memory;
+
+    path = lr_pathconcat(test_globals.testdata_dir, "repo_yum_01",
+                         "repodata",
+                         "4543ad62e4d86337cd1949346f9aec976b847b58-primary.xml.gz",
+                         NULL);
+    url = g_strconcat("file://", path, NULL);
+    fn = lr_pathconcat(test_globals.tmpdir, "tee_outputs_target", NULL);
+    outfn = lr_pathconcat(test_globals.tmpdir, "tee_outputs_fn", NULL);
+    fd = lr_gettmpfile();
+    fail_if(fd < 0);
+    fail_if(!g_file_get_contents(path, &content, &len, NULL));
+
+    // Downloaded data are written to all the outputs of the target
+
+    t1 = lr_downloadtarget_new(NULL, url, NULL, -1, fn, NULL, 0, 0,
+                               NULL, NULL, NULL, NULL, NULL, 0, 0);
+    fail_if(!t1);
+    memory = lr_downloadtargetoutput_new_memory();
+    t1->outputs = g_slist_append(t1->outputs,
+                                 lr_downloadtargetoutput_new_fd(fd));
+    t1->outputs = g_slist_append(t1->outputs,
+                                 lr_downloadtargetoutput_new_fn(outfn));
+    t1->outputs = g_slist_append(t1->outputs, memory);
+    t1->outputs = g_slist_append(t1->outputs,
+                                 lr_downloadtargetoutput_new_cb(collect_datacb,
+                                                                collected));
+
+    list = g_slist_append(list, t1);
+
+    ret = lr_download(list, FALSE, &err);
+    fail_if(!ret);
+    fail_if(err);
+    fail_if(t1->err);
+
+    // Check results
+
+    fail_if(stat(fn, &st) != 0);
+    fail_if((gsize) st.st_size != len);
+    fail_if(fstat(fd, &st) != 0);
+    fail_if((gsize) st.st_size != len);
+    fail_if(!g_file_get_contents(outfn, &teed, &teed_len, NULL));
+    fail_if(teed_len != len || memcmp(teed, content, len));
+    fail_if(!memory->data);
+    fail_if(memory->data->len != len);
+    fail_if(memcmp(memory->data->data, content, len));
+    fail_if(collected->len != len);
+    fail_if(memcmp(collected->data, content, len));
+
+    close(fd);
+    unlink(fn);
+    unlink(outfn);
+    g_slist_free_full(list, (GDestroyNotify) lr_downloadtarget_free);
+    g_byte_array_unref(collected);
+    g_free(teed);
+    g_free(content);
+    lr_free(outfn);
+    lr_free(fn);
+    g_free(url);
+    lr_free(path);
+}
+END_TEST
+
+START_TEST(test_downloader_deadline)
+{
+    gboolean ret;
+    GSList *list = NULL;
+    GError *err = NULL;
+    gchar *path, *url;
+    LrDownloadTarget *t1, *t2;
+
+    path = lr_pathconcat(test_globals.testdata_dir, "repo_yum_01",
+                         "repodata", "repomd.xml", NULL);
+    url = g_strconcat("file://", path, NULL);
+
+    // A target whose deadline already passed fails,
+    // the background target is downloaded
+
+    t1 = lr_downloadtarget_new(NULL, url, NULL, -1, NULL, NULL, 0, 0,
+                               NULL, NULL, NULL, NULL, NULL, 0, 0);
+    fail_if(!t1);
+    t1->deadline = g_get_real_time() / (gdouble) G_USEC_PER_SEC - 1.0;
+
+    t2 = lr_downloadtarget_new(NULL, url, NULL, -1, NULL, NULL, 0, 0,
+                               NULL, NULL, NULL, NULL, NULL, 0, 0);
+    fail_if(!t2);
+    t2->priorityclass = LR_PRIORITYCLASS_BACKGROUND;
+
+    list = g_slist_append(list, t1);
+    list = g_slist_append(list, t2);
+
+    ret = lr_download(list, FALSE, &err);
+    fail_if(!ret);
+    fail_if(err);
+
+    // Check results
+
+    fail_if(t1->rcode != LRE_DEADLINE);
+    fail_if(!t1->err);
+    fail_if(t1->data);
+    fail_if(t2->rcode != LRE_OK);
+    fail_if(t2->err);
+    fail_if(!t2->data);
+
+    g_slist_free_full(list, (GDestroyNotify) lr_downloadtarget_free);
+    g_free(url);
+    lr_free(path);
+}
+END_TEST
+
+START_TEST(test_downloader_cancel_target)
+{
+    gboolean ret;
+    GSList *list = NULL;
+    GError *err = NULL;
+    gchar *path, *url;
+    LrDownloadTarget *t1, *t2;
+
+    path = lr_pathconcat(test_globals.testdata_dir, "repo_yum_01",
+                         "repodata", "repomd.xml", NULL);
+    url = g_strconcat("file://", path, NULL);
+
+    // The cancelled target fails, the other one is downloaded
+    // even with failfast
+
+    t1 = lr_downloadtarget_new(NULL, url, NULL, -1, NULL, NULL, 0, 0,
+                               NULL, NULL, NULL, NULL, NULL, 0, 0);
+    fail_if(!t1);
+    lr_downloadtarget_cancel(t1);
+
+    t2 = lr_downloadtarget_new(NULL, url, NULL, -1, NULL, NULL, 0, 0,
+                               NULL, NULL, NULL, NULL, NULL, 0, 0);
+    fail_if(!t2);
+
+    list = g_slist_append(list, t1);
+    list = g_slist_append(list, t2);
+
+    ret = lr_download(list, TRUE, &err);
+    fail_if(!ret);
+    fail_if(err);
+
+    // Check results
+
+    fail_if(t1->rcode != LRE_CANCELLED);
+    fail_if(!t1->err);
+    fail_if(t1->data);
+    fail_if(t2->rcode != LRE_OK);
+    fail_if(t2->err);
+    fail_if(!t2->data);
+
+    g_slist_free_full(list, (GDestroyNotify) lr_downloadtarget_free);
+    g_free(url);
+    lr_free(path);
+}
+END_TEST
+
+typedef struct {
+    LrDownloadAsync *ctx;
+    LrDownloadTarget *next;
+} AddFromCbData;
+
+static int
+add_from_endcb(void *data,
+               G_GNUC_UNUSED LrTransferStatus status,
+               G_GNUC_UNUSED const char *msg)
+{
+    AddFromCbData *cbdata = data;
+    if (cbdata->next)
+        fail_if(!lr_download_async_add(cbdata->ctx, cbdata->next, NULL));
+    cbdata->next = NULL;
+    return LR_CB_OK;
+}
+
+START_TEST(test_downloader_async_add_from_cb)
+{
+    gboolean ret;
+    gboolean finished = FALSE;
+    GError *err = NULL;
+    gchar *path, *url;
+    LrDownloadTarget *t1, *t2;
+    AddFromCbData cbdata = { NULL, NULL };
+
+    path = lr_pathconcat(test_globals.testdata_dir, "repo_yum_01",
+                         "repodata", "repomd.xml", NULL);
+    url = g_strconcat("file://", path, NULL);
+
+    // The target added by the end callback of the first one
+    // is downloaded by the same download
+
+    t1 = lr_downloadtarget_new(NULL, url, NULL, -1, NULL, NULL, 0, 0,
+                               NULL, &cbdata, add_from_endcb, NULL, NULL,
+                               0, 0);
+    fail_if(!t1);
+    t2 = lr_downloadtarget_new(NULL, url, NULL, -1, NULL, NULL, 0, 0,
+                               NULL, NULL, NULL, NULL, NULL, 0, 0);
+    fail_if(!t2);
+    cbdata.next = t2;
+
+    cbdata.ctx = lr_download_async_start(NULL, FALSE, &err);
+    fail_if(!cbdata.ctx);
+    fail_if(err);
+
+    ret = lr_download_async_add(cbdata.ctx, t1, &err);
+    fail_if(!ret);
+    fail_if(err);
+
+    while (!finished) {
+        int maxfd;
+        long timeout_ms;
+        struct timeval timeout;
+        fd_set fdread, fdwrite, fdexcep;
+
+        FD_ZERO(&fdread);
+        FD_ZERO(&fdwrite);
+        FD_ZERO(&fdexcep);
+
+        ret = lr_download_async_fdset(cbdata.ctx, &fdread, &fdwrite,
+                                      &fdexcep, &maxfd, &timeout_ms, &err);
+        fail_if(!ret);
+        fail_if(err);
+
+        timeout.tv_sec  = timeout_ms / 1000;
+        timeout.tv_usec = (timeout_ms % 1000) * 1000;
+        select(maxfd+1, &fdread, &fdwrite, &fdexcep, &timeout);
+
+        ret = lr_download_async_step(cbdata.ctx, &finished, &err);
+        fail_if(!ret);
+        fail_if(err);
+    }
+
+    ret = lr_download_async_finish(cbdata.ctx, &err);
+    fail_if(!ret);
+    fail_if(err);
+
+    // Check results
+
+    fail_if(cbdata.next);
+    fail_if(t1->rcode != LRE_OK);
+    fail_if(!t1->data);
+    fail_if(t2->rcode != LRE_OK);
+    fail_if(t2->err);
+    fail_if(!t2->data);
+
+    lr_downloadtarget_free(t1);
+    lr_downloadtarget_free(t2);
+    g_free(url);
+    lr_free(path);
+}
+END_TEST
+
 Suite *
 downloader_suite(void)
 {
@@ -300,6 +1358,22 @@ downloader_suite(void)
     tcase_add_test(tc, test_downloader_single_file_2);
     tcase_add_test(tc, test_downloader_two_files);
     tcase_add_test(tc, test_downloader_three_files_with_error);
+    tcase_add_test(tc, test_downloader_async_no_list);
+    tcase_add_test(tc, test_downloader_async_add);
+    tcase_add_test(tc, test_downloader_async_single_file);
+    tcase_add_test(tc, test_downloader_cancelled_handle);
+    tcase_add_test(tc, test_downloader_memory_target);
+    tcase_add_test(tc, test_downloader_cache_sources);
+    tcase_add_test(tc, test_downloader_local_copy);
+    tcase_add_test(tc, test_downloader_durability);
+    tcase_add_test(tc, test_downloader_atomic_download);
+    tcase_add_test(tc, test_downloader_stream);
+    tcase_add_test(tc, test_downloader_decompress_target);
+    tcase_add_test(tc, test_downloader_tee_outputs);
+    tcase_add_test(tc, test_downloader_duplicate_targets);
+    tcase_add_test(tc, test_downloader_deadline);
+    tcase_add_test(tc, test_downloader_cancel_target);
+    tcase_add_test(tc, test_downloader_async_add_from_cb);
     suite_add_tcase(s, tc);
     return s;
 }
@@ -10,6 +10,7 @@
 #include "librepo/rcodes.h"
 #include "librepo/util.h"
 #include "librepo/gpg.h"
+#include "librepo/gpg_internal.h"
 
 #include "fixtures.h"
 #include "testsys.h"
@@ -114,12 +115,265 @@ START_TEST(test_gpg_check_signature)
 }
 END_TEST
 
+START_TEST(test_gpg_verifier)
+{
+    gboolean ret;
+    LrGpgVerifier *verifier;
+    char *key_path, *data_path, *_data_path, *signature_path;
+    char *tmp_home_path;
+    int signature_fd, data_fd;
+    GError *tmp_err = NULL;
+
+    tmp_home_path = lr_gettmpdir();
+    key_path = lr_pathconcat(test_globals.testdata_dir,
+                             "repo_yum_01/repodata/repomd.xml.key", NULL);
+    data_path = lr_pathconcat(test_globals.testdata_dir,
+                             "repo_yum_01/repodata/repomd.xml", NULL);
+    _data_path = lr_pathconcat(test_globals.testdata_dir,
+                             "repo_yum_01/repodata/repomd.xml_bad", NULL);
+    signature_path = lr_pathconcat(test_globals.testdata_dir,
+                             "repo_yum_01/repodata/repomd.xml.asc", NULL);
+
+    verifier = lr_gpg_verifier_new(tmp_home_path, &tmp_err);
+    fail_if(!verifier);
+    fail_if(tmp_err);
+
+    // The key imported after the verifier was created is used
+    ret = lr_gpg_import_key(key_path, tmp_home_path, &tmp_err);
+    fail_if(!ret);
+    fail_if(tmp_err);
+
+    // Valid key and data
+    signature_fd = open(signature_path, O_RDONLY);
+    data_fd = open(data_path, O_RDONLY);
+    fail_if(signature_fd < 0 || data_fd < 0);
+    ret = lr_gpg_verifier_check_signature_fd(verifier, signature_fd,
+                                             data_fd, &tmp_err);
+    fail_if(!ret);
+    fail_if(tmp_err);
+    close(signature_fd);
+    close(data_fd);
+
+    // Bad data by the same verifier
+    signature_fd = open(signature_path, O_RDONLY);
+    data_fd = open(_data_path, O_RDONLY);
+    fail_if(signature_fd < 0 || data_fd < 0);
+    ret = lr_gpg_verifier_check_signature_fd(verifier, signature_fd,
+                                             data_fd, &tmp_err);
+    fail_if(ret);
+    fail_if(!tmp_err);
+    g_error_free(tmp_err);
+    tmp_err = NULL;
+    close(signature_fd);
+    close(data_fd);
+
+    lr_gpg_verifier_free(verifier);
+    lr_remove_dir(tmp_home_path);
+    lr_free(key_path);
+    lr_free(data_path);
+    lr_free(_data_path);
+    lr_free(signature_path);
+    lr_free(tmp_home_path);
+}
+END_TEST
+
+START_TEST(test_gpg_check_signatures)
+{
+    gboolean ret;
+    LrGpgJob jobs[8];
+    LrGpgBatch *batch;
+    LrGpgJob *job;
+    GSList *list = NULL;
+    char *key_path, *data_path, *_data_path, *signature_path;
+    char *tmp_home_path;
+    guint popped = 0;
+    GError *tmp_err = NULL;
+
+    tmp_home_path = lr_gettmpdir();
+    key_path = lr_pathconcat(test_globals.testdata_dir,
+                             "repo_yum_01/repodata/repomd.xml.key", NULL);
+    data_path = lr_pathconcat(test_globals.testdata_dir,
+                             "repo_yum_01/repodata/repomd.xml", NULL);
+    _data_path = lr_pathconcat(test_globals.testdata_dir,
+                             "repo_yum_01/repodata/repomd.xml_bad", NULL);
+    signature_path = lr_pathconcat(test_globals.testdata_dir,
+                             "repo_yum_01/repodata/repomd.xml.asc", NULL);
+
+    ret = lr_gpg_import_key(key_path, tmp_home_path, &tmp_err);
+    fail_if(!ret);
+    fail_if(tmp_err);
+
+    // Every odd job has bad data
+    memset(jobs, 0, sizeof(jobs));
+    for (int i = 0; i < 8; i++) {
+        jobs[i].signature_fn = signature_path;
+        jobs[i].data_fn = (i % 2) ? _data_path : data_path;
+        jobs[i].home_dir = tmp_home_path;
+        list = g_slist_append(list, &jobs[i]);
+    }
+
+    lr_gpg_check_signatures(list, 4);
+    for (int i = 0; i < 8; i++) {
+        fail_if(jobs[i].valid == (i % 2));
+        fail_if(!jobs[i].error != !(i % 2));
+        g_clear_error(&jobs[i].error);
+    }
+
+    // The same by a batch
+    batch = lr_gpg_batch_new(4);
+    for (int i = 0; i < 8; i++)
+        lr_gpg_batch_push(batch, &jobs[i]);
+    while ((job = lr_gpg_batch_pop(batch))) {
+        fail_if(job->valid != (job->data_fn == data_path));
+        g_clear_error(&job->error);
+        popped++;
+    }
+    fail_if(popped != 8);
+    lr_gpg_batch_free(batch);
+
+    g_slist_free(list);
+    lr_remove_dir(tmp_home_path);
+    lr_free(key_path);
+    lr_free(data_path);
+    lr_free(_data_path);
+    lr_free(signature_path);
+    lr_free(tmp_home_path);
+}
+END_TEST
+
+START_TEST(test_gpg_check_signature_builtin)
+{
+    gboolean ret;
+    char *key_path, *data_path, *_data_path;
+    char *signature_path, *_signature_path;
+    char *tmp_home_path;
+    int signature_fd, data_fd;
+    GError *tmp_err = NULL;
+
+    tmp_home_path = lr_gettmpdir();
+    key_path = lr_pathconcat(test_globals.testdata_dir,
+                             "repo_yum_01/repodata/repomd.xml.key", NULL);
+    data_path = lr_pathconcat(test_globals.testdata_dir,
+                             "repo_yum_01/repodata/repomd.xml", NULL);
+    _data_path = lr_pathconcat(test_globals.testdata_dir,
+                             "repo_yum_01/repodata/repomd.xml_bad", NULL);
+    signature_path = lr_pathconcat(test_globals.testdata_dir,
+                             "repo_yum_01/repodata/repomd.xml.asc", NULL);
+    _signature_path = lr_pathconcat(test_globals.testdata_dir,
+                             "repo_yum_01/repodata/repomd.xml_bad.asc", NULL);
+
+    // No keyring yet
+    ret = lr_gpg_check_signature_v2(signature_path, data_path, tmp_home_path,
+                                    LR_GPGBACKEND_BUILTIN, &tmp_err);
+    fail_if(ret);
+    fail_if(!tmp_err);
+    g_clear_error(&tmp_err);
+
+    ret = lr_gpg_import_key(key_path, tmp_home_path, &tmp_err);
+    fail_if(!ret);
+    fail_if(tmp_err);
+
+    // Valid key and data
+    ret = lr_gpg_check_signature_v2(signature_path, data_path, tmp_home_path,
+                                    LR_GPGBACKEND_BUILTIN, &tmp_err);
+    fail_if(!ret);
+    fail_if(tmp_err);
+
+    // Bad data
+    ret = lr_gpg_check_signature_v2(signature_path, _data_path, tmp_home_path,
+                                    LR_GPGBACKEND_BUILTIN, &tmp_err);
+    fail_if(ret);
+    fail_if(!tmp_err);
+    g_clear_error(&tmp_err);
+
+    // Signed with unknown key (verified by GPGME)
+    ret = lr_gpg_check_signature_v2(_signature_path, data_path, tmp_home_path,
+                                    LR_GPGBACKEND_BUILTIN, &tmp_err);
+    fail_if(ret);
+    fail_if(!tmp_err);
+    g_clear_error(&tmp_err);
+
+    // The positions of the fds are kept
+    signature_fd = open(signature_path, O_RDONLY);
+    data_fd = open(data_path, O_RDONLY);
+    fail_if(signature_fd < 0 || data_fd < 0);
+    ret = lr_gpg_check_signature_fd_v2(signature_fd, data_fd, tmp_home_path,
+                                       LR_GPGBACKEND_BUILTIN, &tmp_err);
+    fail_if(!ret);
+    fail_if(tmp_err);
+    fail_if(lseek(signature_fd, 0, SEEK_CUR) != 0);
+    fail_if(lseek(data_fd, 0, SEEK_CUR) != 0);
+    close(signature_fd);
+    close(data_fd);
+
+    lr_remove_dir(tmp_home_path);
+    lr_free(key_path);
+    lr_free(data_path);
+    lr_free(_data_path);
+    lr_free(signature_path);
+    lr_free(_signature_path);
+    lr_free(tmp_home_path);
+}
+END_TEST
+
+START_TEST(test_gpg_check_signature_builtin_subkey)
+{
+    gboolean ret;
+    LrGpgBuiltinResult res;
+    char *key_path, *data_path, *signature_path;
+    char *tmp_home_path;
+    int signature_fd, data_fd;
+    GError *tmp_err = NULL;
+
+    // The primary key can only certify, the signature is made by its
+    // signing subkey
+    tmp_home_path = lr_gettmpdir();
+    key_path = lr_pathconcat(test_globals.testdata_dir,
+                             "repo_yum_01/repodata/repomd.xml_subkey.key", NULL);
+    data_path = lr_pathconcat(test_globals.testdata_dir,
+                             "repo_yum_01/repodata/repomd.xml", NULL);
+    signature_path = lr_pathconcat(test_globals.testdata_dir,
+                             "repo_yum_01/repodata/repomd.xml_subkey.asc", NULL);
+
+    ret = lr_gpg_import_key(key_path, tmp_home_path, &tmp_err);
+    fail_if(!ret);
+    fail_if(tmp_err);
+
+    // The primary key binding of the subkey is not verified in-process
+    signature_fd = open(signature_path, O_RDONLY);
+    data_fd = open(data_path, O_RDONLY);
+    fail_if(signature_fd < 0 || data_fd < 0);
+    res = lr_gpg_builtin_check_signature_fd(signature_fd, data_fd,
+                                            tmp_home_path, &tmp_err);
+    fail_if(res != LR_GPG_BUILTIN_UNKNOWN);
+    fail_if(tmp_err);
+    close(signature_fd);
+    close(data_fd);
+
+    // GPGME decides
+    ret = lr_gpg_check_signature_v2(signature_path, data_path, tmp_home_path,
+                                    LR_GPGBACKEND_BUILTIN, &tmp_err);
+    fail_if(!ret);
+    fail_if(tmp_err);
+
+    lr_remove_dir(tmp_home_path);
+    lr_free(key_path);
+    lr_free(data_path);
+    lr_free(signature_path);
+    lr_free(tmp_home_path);
+}
+END_TEST
+
 Suite *
 gpg_suite(void)
 {
     Suite *s = suite_create("gpg");
     TCase *tc = tcase_create("Main");
     tcase_add_test(tc, test_gpg_check_signature);
+    tcase_add_test(tc, test_gpg_verifier);
+    tcase_add_test(tc, test_gpg_check_signatures);
+    tcase_add_test(tc, test_gpg_check_signature_builtin);
+    tcase_add_test(tc, test_gpg_check_signature_builtin_subkey);
     suite_add_tcase(s, tc);
     return s;
 }
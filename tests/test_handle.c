@@ -11,6 +11,7 @@
 #include "librepo/rcodes.h"
 #include "librepo/handle.h"
 #include "librepo/url_substitution.h"
+#include "librepo/handle_internal.h"
 
 #include "fixtures.h"
 #include "testsys.h"
@@ -54,6 +55,27 @@ START_TEST(test_handle)
 }
 END_TEST
 
+START_TEST(test_handle_lazy_curl)
+{
+    LrHandle *h = lr_handle_init();
+    fail_if(h == NULL);
+
+    // Options which don't configure transfers don't need curl
+    char *urls[] = {"/foo", NULL};
+    fail_if(!lr_handle_setopt(h, NULL, LRO_URLS, urls));
+    fail_if(!lr_handle_setopt(h, NULL, LRO_LOCAL, 1L));
+    fail_if(!lr_handle_setopt(h, NULL, LRO_REPOTYPE, LR_YUMREPO));
+    fail_if(h->curl_handle);
+
+    // The curl handle is created by the first option which needs it
+    fail_if(!lr_handle_setopt(h, NULL, LRO_USERAGENT, "librepo/0.0"));
+    fail_if(!h->curl_handle);
+    fail_if(lr_handle_curl(h) != h->curl_handle);
+
+    lr_handle_free(h);
+}
+END_TEST
+
 START_TEST(test_handle_getinfo)
 {
     long num;
@@ -118,6 +140,15 @@ START_TEST(test_handle_getinfo)
     fail_if(!lr_handle_getinfo(h, NULL, LRI_FASTESTMIRRORMAXAGE, &num));
     fail_if(num != LRO_FASTESTMIRRORMAXAGE_DEFAULT);
 
+    LrStats *stats = NULL;
+    fail_if(!lr_handle_getinfo(h, NULL, LRI_STATS, &stats));
+    fail_if(stats == NULL);
+    fail_if(stats->bytes != 0);
+    fail_if(stats->successful != 0);
+    fail_if(stats->failed != 0);
+    fail_if(stats->mirrors != NULL);
+    lr_stats_free(stats);
+
     lr_handle_free(h);
 }
 END_TEST
@@ -128,6 +159,7 @@ handle_suite(void)
     Suite *s = suite_create("handle");
     TCase *tc = tcase_create("Main");
     tcase_add_test(tc, test_handle);
+    tcase_add_test(tc, test_handle_lazy_curl);
     tcase_add_test(tc, test_handle_getinfo);
     suite_add_tcase(s, tc);
     return s;
@@ -236,6 +236,37 @@ START_TEST(test_lrmirrorlist_append_lrmirrorlist)
 }
 END_TEST
 
+START_TEST(test_lrmirrorlist_remove_duplicates)
+{
+    LrInternalMirrorlist *iml = NULL;
+    LrInternalMirror *mirror = NULL;
+
+    iml = lr_lrmirrorlist_append_url(iml, "http://foo/repo/", NULL);
+    iml = lr_lrmirrorlist_append_url(iml, "ftp://bar/repo", NULL);
+    iml = lr_lrmirrorlist_append_url(iml, "HTTP://Foo/repo", NULL);
+    iml = lr_lrmirrorlist_append_url(iml, "http://foo/Repo", NULL);
+    iml = lr_lrmirrorlist_append_url(iml, "ftp://bar/repo//", NULL);
+
+    iml = lr_lrmirrorlist_remove_duplicates(iml);
+    fail_if(g_slist_length(iml) != 3);
+
+    mirror = lr_lrmirrorlist_nth(iml, 0);
+    fail_if(strcmp(mirror->url, "http://foo/repo/"));
+    fail_if(strcmp(mirror->host, "http://foo"));
+
+    mirror = lr_lrmirrorlist_nth(iml, 1);
+    fail_if(strcmp(mirror->url, "ftp://bar/repo"));
+    fail_if(strcmp(mirror->host, "ftp://bar"));
+
+    mirror = lr_lrmirrorlist_nth(iml, 2);
+    fail_if(strcmp(mirror->url, "http://foo/Repo"));
+
+    lr_lrmirrorlist_free(iml);
+
+    fail_if(lr_lrmirrorlist_remove_duplicates(NULL) != NULL);
+}
+END_TEST
+
 Suite *
 lrmirrorlist_suite(void)
 {
@@ -245,6 +276,7 @@ lrmirrorlist_suite(void)
     tcase_add_test(tc, test_lrmirrorlist_append_mirrorlist);
     tcase_add_test(tc, test_lrmirrorlist_append_metalink);
     tcase_add_test(tc, test_lrmirrorlist_append_lrmirrorlist);
+    tcase_add_test(tc, test_lrmirrorlist_remove_duplicates);
     suite_add_tcase(s, tc);
     return s;
 }
@@ -11,18 +11,23 @@
 
 #include "fixtures.h"
 #include "test_checksum.h"
+#include "test_daemon.h"
 #include "test_downloader.h"
 #include "test_gpg.h"
 #include "test_handle.h"
 #include "test_lrmirrorlist.h"
 #include "test_metalink.h"
 #include "test_mirrorlist.h"
+#include "test_mirrorregistry.h"
+#include "test_multipart.h"
 #include "test_package_downloader.h"
+#include "test_primary.h"
 #include "test_repoconf.h"
 #include "test_repomd.h"
 #include "test_url_substitution.h"
 #include "test_util.h"
 #include "test_version.h"
+#include "test_zchunk.h"
 #include "testsys.h"
 
 
@@ -107,17 +112,22 @@ main(int argc, char **argv)
     if (downloading) {
         srunner_add_suite(sr, downloader_suite());
     }
+    srunner_add_suite(sr, daemon_suite());
     srunner_add_suite(sr, gpg_suite());
     srunner_add_suite(sr, handle_suite());
     srunner_add_suite(sr, lrmirrorlist_suite());
     srunner_add_suite(sr, metalink_suite());
     srunner_add_suite(sr, mirrorlist_suite());
+    srunner_add_suite(sr, mirrorregistry_suite());
+    srunner_add_suite(sr, multipart_suite());
     srunner_add_suite(sr, package_downloader_suite());
+    srunner_add_suite(sr, primary_suite());
     srunner_add_suite(sr, repoconf_suite());
     srunner_add_suite(sr, repomd_suite());
     srunner_add_suite(sr, url_substitution_suite());
     srunner_add_suite(sr, util_suite());
     srunner_add_suite(sr, version_suite());
+    srunner_add_suite(sr, zchunk_suite());
     srunner_run_all(sr, CK_NORMAL);
     number_failed = srunner_ntests_failed(sr);
     srunner_free(sr);
@@ -1,3 +1,4 @@
+#include <string.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <unistd.h>
@@ -513,6 +514,155 @@ START_TEST(test_metalink_with_alternates)
 }
 END_TEST
 
+START_TEST(test_metalink_with_pieces)
+{
+    int fd;
+    gboolean ret;
+    char *path;
+    LrMetalink *ml = NULL;
+    LrMetalinkPieces *mlpieces = NULL;
+    GError *tmp_err = NULL;
+    int call_counter = 0;
+
+    path = lr_pathconcat(test_globals.testdata_dir, METALINK_DIR,
+                         "metalink_with_pieces", NULL);
+    fd = open(path, O_RDONLY);
+    lr_free(path);
+    fail_if(fd < 0);
+    ml = lr_metalink_init();
+    fail_if(ml == NULL);
+    ret = lr_metalink_parse_file(ml, fd, REPOMD, warning_cb,
+                                 &call_counter, &tmp_err);
+    fail_if(!ret);
+    fail_if(tmp_err);
+    fail_if(call_counter != 2);
+    close(fd);
+
+    fail_if(g_slist_length(ml->hashes) != 1);
+    fail_if(g_slist_length(ml->urls) != 2);
+
+    // Pieces out of order and pieces without length are ignored
+    fail_if(g_slist_length(ml->pieces) != 1);
+    mlpieces = ml->pieces->data;
+    fail_if(!mlpieces);
+    fail_if(strcmp(mlpieces->type, "sha1"));
+    fail_if(mlpieces->length != 2048);
+    fail_if(mlpieces->count != 3);
+    fail_if(g_slist_length(mlpieces->hashes) != 3);
+    fail_if(strcmp(g_slist_nth_data(mlpieces->hashes, 0),
+                   "5e9e5b1c1f0a6e4b6a7c5d3b2e1f0a9b8c7d6e5f"));
+    fail_if(strcmp(g_slist_nth_data(mlpieces->hashes, 2),
+                   "fedcba98765432100123456789abcdef01234567"));
+
+    lr_metalink_free(ml);
+}
+END_TEST
+
+START_TEST(test_metalink_parse_buffer)
+{
+    gboolean ret;
+    char *path, *content;
+    gsize len;
+    LrMetalink *ml = NULL;
+    LrMetalinkParser *parser;
+    GError *tmp_err = NULL;
+
+    path = lr_pathconcat(test_globals.testdata_dir, METALINK_DIR,
+                         "metalink_good_01", NULL);
+    fail_if(!g_file_get_contents(path, &content, &len, NULL));
+    lr_free(path);
+
+    // Whole buffer
+    ml = lr_metalink_init();
+    ret = lr_metalink_parse_buffer(ml, content, len, REPOMD, NULL, NULL, &tmp_err);
+    fail_if(!ret);
+    fail_if(tmp_err);
+    fail_if(ml->size != 4309);
+    fail_if(g_slist_length(ml->hashes) != 4);
+    fail_if(g_slist_length(ml->urls) != 106);
+    lr_metalink_free(ml);
+
+    // Fed by small parts
+    ml = lr_metalink_init();
+    parser = lr_metalink_parser_new(ml, REPOMD, NULL, NULL);
+    for (gsize offset = 0; offset < len; offset += 13) {
+        ret = lr_metalink_parser_feed(parser, content + offset,
+                                      MIN(13, len - offset), &tmp_err);
+        fail_if(!ret);
+        fail_if(tmp_err);
+    }
+    ret = lr_metalink_parser_finish(parser, &tmp_err);
+    fail_if(!ret);
+    fail_if(tmp_err);
+    lr_metalink_parser_free(parser);
+    fail_if(ml->timestamp != 1337942396);
+    fail_if(g_slist_length(ml->hashes) != 4);
+    fail_if(g_slist_length(ml->urls) != 106);
+    lr_metalink_free(ml);
+
+    // The wanted file is not in the metalink
+    ml = lr_metalink_init();
+    ret = lr_metalink_parse_buffer(ml, content, len, "foo", NULL, NULL, &tmp_err);
+    fail_if(ret);
+    fail_if(!tmp_err);
+    g_error_free(tmp_err);
+    lr_metalink_free(ml);
+
+    g_free(content);
+}
+END_TEST
+
+START_TEST(test_metalink_early_stop)
+{
+    int fd;
+    gboolean ret;
+    char *path, *content, *end, *broken;
+    gsize len;
+    LrMetalink *ml = NULL;
+    LrMetalinkUrl *url, *first_url;
+    GError *tmp_err = NULL;
+
+    path = lr_pathconcat(test_globals.testdata_dir, METALINK_DIR,
+                         "metalink_good_01", NULL);
+    fail_if(!g_file_get_contents(path, &content, &len, NULL));
+
+    // Anything after the wanted file is not parsed
+    end = strstr(content, "</file>");
+    fail_if(!end);
+    end += strlen("</file>");
+    broken = g_strdup_printf("%.*s<this is <not xml", (int) (end - content),
+                             content);
+    ml = lr_metalink_init();
+    ret = lr_metalink_parse_buffer(ml, broken, strlen(broken), REPOMD,
+                                   NULL, NULL, &tmp_err);
+    fail_if(!ret);
+    fail_if(tmp_err);
+    fail_if(g_slist_length(ml->hashes) != 4);
+    fail_if(g_slist_length(ml->urls) != 106);
+    first_url = g_slist_nth_data(ml->urls, 0);
+    g_free(broken);
+
+    // Limited number of urls
+    LrMetalink *ml_limited = lr_metalink_init();
+    fd = open(path, O_RDONLY);
+    fail_if(fd < 0);
+    ret = lr_metalink_parse_file_maxurls(ml_limited, fd, REPOMD, 5,
+                                         NULL, NULL, &tmp_err);
+    fail_if(!ret);
+    fail_if(tmp_err);
+    close(fd);
+    fail_if(g_slist_length(ml_limited->hashes) != 4);
+    fail_if(g_slist_length(ml_limited->urls) != 5);
+    url = g_slist_nth_data(ml_limited->urls, 0);
+    fail_if(g_strcmp0(url->url, first_url->url));
+    lr_metalink_free(ml_limited);
+    lr_metalink_free(ml);
+
+    lr_free(path);
+    g_free(content);
+}
+END_TEST
+
 Suite *
 metalink_suite(void)
 {
@@ -528,6 +678,9 @@ metalink_suite(void)
     tcase_add_test(tc, test_metalink_really_bad_02);
     tcase_add_test(tc, test_metalink_really_bad_03);
     tcase_add_test(tc, test_metalink_with_alternates);
+    tcase_add_test(tc, test_metalink_with_pieces);
+    tcase_add_test(tc, test_metalink_parse_buffer);
+    tcase_add_test(tc, test_metalink_early_stop);
     suite_add_tcase(s, tc);
     return s;
 }
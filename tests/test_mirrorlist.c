@@ -105,6 +105,79 @@ START_TEST(test_mirrorlist_03)
 }
 END_TEST
 
+START_TEST(test_mirrorlist_pipe)
+{
+    // Not mapable file descriptor is read
+    int fds[2];
+    gboolean ret;
+    char *path, *content;
+    gsize len;
+    LrMirrorlist *ml = NULL;
+    GError *tmp_err = NULL;
+
+    path = lr_pathconcat(test_globals.testdata_dir, MIRRORLIST_DIR,
+                         "mirrorlist_01", NULL);
+    fail_if(!g_file_get_contents(path, &content, &len, NULL));
+    lr_free(path);
+    fail_if(pipe(fds) != 0);
+    fail_if(write(fds[1], content, len) != (ssize_t) len);
+    close(fds[1]);
+    g_free(content);
+
+    ml = lr_mirrorlist_init();
+    ret = lr_mirrorlist_parse_file(ml, fds[0], &tmp_err);
+    close(fds[0]);
+    fail_if(!ret);
+    fail_if(tmp_err);
+    fail_if(g_slist_length(ml->urls) != 2);
+    fail_if(g_strcmp0(g_slist_nth_data(ml->urls, 0), "http://foo.bar/fedora/linux/"));
+    fail_if(g_strcmp0(g_slist_nth_data(ml->urls, 1), "ftp://ftp.bar.foo/Fedora/17/"));
+    lr_mirrorlist_free(ml);
+}
+END_TEST
+
+START_TEST(test_mirrorlist_parser)
+{
+    gboolean ret;
+    const char *content = "# comment\n"
+                          "  http://foo.bar/fedora/linux/  \n"
+                          "\n"
+                          "ftp://ftp.bar.foo/Fedora/17/";
+    size_t len = strlen(content);
+    LrMirrorlist *ml;
+    LrMirrorlistParser *parser;
+    GError *tmp_err = NULL;
+
+    // Whole buffer
+    ml = lr_mirrorlist_init();
+    ret = lr_mirrorlist_parse_buffer(ml, content, len, &tmp_err);
+    fail_if(!ret);
+    fail_if(tmp_err);
+    fail_if(g_slist_length(ml->urls) != 2);
+    fail_if(g_strcmp0(g_slist_nth_data(ml->urls, 0), "http://foo.bar/fedora/linux/"));
+    fail_if(g_strcmp0(g_slist_nth_data(ml->urls, 1), "ftp://ftp.bar.foo/Fedora/17/"));
+    lr_mirrorlist_free(ml);
+
+    // Fed by small parts
+    ml = lr_mirrorlist_init();
+    parser = lr_mirrorlist_parser_new(ml);
+    for (size_t offset = 0; offset < len; offset += 5) {
+        ret = lr_mirrorlist_parser_feed(parser, content + offset,
+                                        MIN(5, len - offset), &tmp_err);
+        fail_if(!ret);
+        fail_if(tmp_err);
+    }
+    ret = lr_mirrorlist_parser_finish(parser, &tmp_err);
+    fail_if(!ret);
+    fail_if(tmp_err);
+    lr_mirrorlist_parser_free(parser);
+    fail_if(g_slist_length(ml->urls) != 2);
+    fail_if(g_strcmp0(g_slist_nth_data(ml->urls, 0), "http://foo.bar/fedora/linux/"));
+    fail_if(g_strcmp0(g_slist_nth_data(ml->urls, 1), "ftp://ftp.bar.foo/Fedora/17/"));
+    lr_mirrorlist_free(ml);
+}
+END_TEST
+
 Suite *
 mirrorlist_suite(void)
 {
@@ -114,6 +187,8 @@ mirrorlist_suite(void)
     tcase_add_test(tc, test_mirrorlist_01);
     tcase_add_test(tc, test_mirrorlist_02);
     tcase_add_test(tc, test_mirrorlist_03);
+    tcase_add_test(tc, test_mirrorlist_pipe);
+    tcase_add_test(tc, test_mirrorlist_parser);
     suite_add_tcase(s, tc);
     return s;
 }
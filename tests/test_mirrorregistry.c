@@ -0,0 +1,160 @@
+#include <math.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "testsys.h"
+#include "fixtures.h"
+#include "test_mirrorregistry.h"
+#include "librepo/handle.h"
+#include "librepo/mirrorhealth.h"
+#include "librepo/mirrorregistry.h"
+#include "librepo/mirrorregistry_internal.h"
+#include "librepo/util.h"
+
+#define HOST    "http://mirror.example.com"
+
+START_TEST(test_mirrorregistry_measurement)
+{
+    LrMirrorMeasurement measurement = { 0 };
+    LrMirrorMeasurement registered;
+
+    lr_mirrorregistry_clear();
+    fail_if(lr_mirrorregistry_get_measurement(HOST, &registered));
+
+    measurement.ts = 100;
+    measurement.connecttime = 0.5;
+    measurement.ttfb = -1.0;
+    measurement.throughput = -1.0;
+    lr_mirrorregistry_set_measurement(HOST, &measurement);
+    fail_if(!lr_mirrorregistry_get_measurement(HOST, &registered));
+    fail_if(registered.ts != 100);
+    fail_if(registered.connecttime != 0.5);
+    fail_if(registered.probed);
+
+    // An older measurement doesn't replace a newer one
+    measurement.ts = 50;
+    measurement.connecttime = 2.0;
+    lr_mirrorregistry_set_measurement(HOST, &measurement);
+    fail_if(!lr_mirrorregistry_get_measurement(HOST, &registered));
+    fail_if(registered.ts != 100);
+
+    measurement.ts = 200;
+    measurement.probed = TRUE;
+    measurement.ttfb = 0.1;
+    measurement.throughput = 1e6;
+    lr_mirrorregistry_set_measurement(HOST, &measurement);
+    fail_if(!lr_mirrorregistry_get_measurement(HOST, &registered));
+    fail_if(registered.ts != 200);
+    fail_if(!registered.probed);
+    fail_if(registered.throughput != 1e6);
+
+    lr_mirrorregistry_clear();
+    fail_if(lr_mirrorregistry_get_measurement(HOST, &registered));
+}
+END_TEST
+
+static gdouble
+stored_successful(const char *path, gint64 now)
+{
+    LrMirrorHealth health;
+    GKeyFile *store = lr_mirrorhealth_load(path);
+    gdouble successful = -1.0;
+
+    if (lr_mirrorhealth_lookup(store, HOST, now, &health))
+        successful = health.successful;
+    lr_mirrorhealth_clear(&health);
+    g_key_file_free(store);
+    return successful;
+}
+
+START_TEST(test_mirrorregistry_health)
+{
+    LrMirrorHealth delta = { 0 };
+    LrMirrorHealth health;
+    GError *tmp_err = NULL;
+    gint64 now = g_get_real_time() / G_USEC_PER_SEC;
+    char *path = lr_pathconcat(test_globals.tmpdir, "/mirrorhealth", NULL);
+
+    lr_mirrorregistry_clear();
+    unlink(path);
+
+    // The first results are written immediately
+    delta.successful = 1.0;
+    lr_mirrorregistry_record_health(path, HOST, now, &delta);
+    fail_if(!lr_mirrorregistry_flush_health(path, FALSE, &tmp_err));
+    fail_if(fabs(stored_successful(path, now) - 1.0) > 0.01);
+
+    // The next ones wait for the flush interval
+    delta.failed = 1.0;
+    delta.lasterror = "Connection refused";
+    lr_mirrorregistry_record_health(path, HOST, now, &delta);
+    fail_if(!lr_mirrorregistry_flush_health(path, FALSE, &tmp_err));
+    fail_if(fabs(stored_successful(path, now) - 1.0) > 0.01);
+
+    // But the handles of the process see them
+    fail_if(!lr_mirrorregistry_get_health(path, HOST, now, &health));
+    fail_if(fabs(health.successful - 2.0) > 0.01);
+    fail_if(fabs(health.failed - 1.0) > 0.01);
+    fail_if(g_strcmp0(health.lasterror, "Connection refused"));
+    lr_mirrorhealth_clear(&health);
+
+    fail_if(!lr_mirrorregistry_flush(&tmp_err));
+    fail_if(fabs(stored_successful(path, now) - 2.0) > 0.01);
+
+    lr_mirrorregistry_clear();
+    fail_if(!lr_mirrorregistry_get_health(path, HOST, now, &health));
+    fail_if(fabs(health.successful - 2.0) > 0.01);
+    lr_mirrorhealth_clear(&health);
+
+    lr_mirrorregistry_clear();
+    unlink(path);
+    lr_free(path);
+}
+END_TEST
+
+START_TEST(test_mirrorregistry_health_last_handle)
+{
+    LrMirrorHealth delta = { 0 };
+    GError *tmp_err = NULL;
+    gint64 now = g_get_real_time() / G_USEC_PER_SEC;
+    char *path = lr_pathconcat(test_globals.tmpdir, "/mirrorhealth", NULL);
+    LrHandle *h1 = lr_handle_init();
+    LrHandle *h2 = lr_handle_init();
+
+    lr_mirrorregistry_clear();
+    unlink(path);
+    fail_if(!lr_handle_setopt(h1, NULL, LRO_MIRRORHEALTHCACHE, path));
+    fail_if(!lr_handle_setopt(h2, NULL, LRO_MIRRORHEALTHCACHE, path));
+
+    delta.successful = 1.0;
+    lr_mirrorregistry_record_health(path, HOST, now, &delta);
+    fail_if(!lr_mirrorregistry_flush_health(path, FALSE, &tmp_err));
+    lr_mirrorregistry_record_health(path, HOST, now, &delta);
+    fail_if(!lr_mirrorregistry_flush_health(path, FALSE, &tmp_err));
+    fail_if(fabs(stored_successful(path, now) - 1.0) > 0.01);
+
+    // Another handle still uses the store
+    lr_handle_free(h1);
+    fail_if(fabs(stored_successful(path, now) - 1.0) > 0.01);
+
+    // The pending results are written with the last handle
+    lr_handle_free(h2);
+    fail_if(fabs(stored_successful(path, now) - 2.0) > 0.01);
+
+    lr_mirrorregistry_clear();
+    unlink(path);
+    lr_free(path);
+}
+END_TEST
+
+Suite *
+mirrorregistry_suite(void)
+{
+    Suite *s = suite_create("mirrorregistry");
+    TCase *tc = tcase_create("Main");
+    tcase_add_test(tc, test_mirrorregistry_measurement);
+    tcase_add_test(tc, test_mirrorregistry_health);
+    tcase_add_test(tc, test_mirrorregistry_health_last_handle);
+    suite_add_tcase(s, tc);
+    return s;
+}
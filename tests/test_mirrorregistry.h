@@ -0,0 +1,8 @@
+#ifndef LR_TEST_MIRRORREGISTRY_H
+#define LR_TEST_MIRRORREGISTRY_H
+
+#include <check.h>
+
+Suite *mirrorregistry_suite(void);
+
+#endif
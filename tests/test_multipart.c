@@ -0,0 +1,140 @@
+#include <string.h>
+
+#include "testsys.h"
+#include "fixtures.h"
+#include "test_multipart.h"
+#include "librepo/rcodes.h"
+#include "librepo/multipart.h"
+
+#define BODY \
+    "--THIS_STRING_SEPARATES\r\n" \
+    "Content-Type: application/octet-stream\r\n" \
+    "Content-Range: bytes 0-4/20\r\n" \
+    "\r\n" \
+    "01234\r\n" \
+    "--THIS_STRING_SEPARATES\r\n" \
+    "Content-Range: bytes 10-14/20\r\n" \
+    "\r\n" \
+    "ab\r\nc\r\n" \
+    "--THIS_STRING_SEPARATES--\r\n"
+
+static gboolean
+collect_cb(void *userdata, gint64 offset, const char *data, size_t len)
+{
+    char *file = userdata;
+    if (offset < 0 || offset + len > 20)
+        return FALSE;
+    memcpy(file + offset, data, len);
+    return TRUE;
+}
+
+START_TEST(test_multipart_boundary)
+{
+    gchar *boundary;
+
+    boundary = lr_multipart_boundary("multipart/byteranges; "
+                                     "boundary=THIS_STRING_SEPARATES");
+    ck_assert_str_eq(boundary, "THIS_STRING_SEPARATES");
+    g_free(boundary);
+
+    boundary = lr_multipart_boundary("multipart/byteranges;charset=utf-8;"
+                                     "boundary=\"quoted; string\"");
+    ck_assert_str_eq(boundary, "quoted; string");
+    g_free(boundary);
+
+    fail_if(lr_multipart_boundary("text/plain; boundary=foo"));
+    fail_if(lr_multipart_boundary("multipart/byteranges"));
+    fail_if(lr_multipart_boundary(NULL));
+}
+END_TEST
+
+START_TEST(test_multipart_content_range)
+{
+    gint64 start = -1, end = -1;
+
+    fail_if(!lr_multipart_parse_content_range(" bytes 500-999/8000",
+                                              &start, &end));
+    fail_if(start != 500 || end != 999);
+    fail_if(!lr_multipart_parse_content_range("bytes 0-0/*", &start, &end));
+    fail_if(start != 0 || end != 0);
+    fail_if(lr_multipart_parse_content_range("bytes */8000", &start, &end));
+    fail_if(lr_multipart_parse_content_range("bytes 9-1/8000", &start, &end));
+    fail_if(lr_multipart_parse_content_range("items 0-1/2", &start, &end));
+}
+END_TEST
+
+START_TEST(test_multipart_parse)
+{
+    const char *body = BODY;
+    GError *tmp_err = NULL;
+    char file[21];
+
+    // The body is parsed the same whatever parts it comes by
+    for (size_t chunk = 1; chunk <= strlen(body); chunk++) {
+        LrMultipart *mp;
+
+        memset(file, '.', sizeof(file) - 1);
+        file[sizeof(file) - 1] = '\0';
+
+        mp = lr_multipart_new("THIS_STRING_SEPARATES", collect_cb, file);
+        for (size_t x = 0; x < strlen(body); x += chunk) {
+            size_t len = MIN(chunk, strlen(body) - x);
+            fail_if(!lr_multipart_feed(mp, body + x, len, &tmp_err));
+            fail_if(tmp_err);
+        }
+        fail_if(!lr_multipart_finish(mp, &tmp_err));
+        fail_if(tmp_err);
+        lr_multipart_free(mp);
+
+        ck_assert_str_eq(file, "01234.....ab\r\nc.....");
+    }
+}
+END_TEST
+
+START_TEST(test_multipart_bad)
+{
+    GError *tmp_err = NULL;
+    char file[20];
+    LrMultipart *mp;
+
+    // Part without Content-Range
+    mp = lr_multipart_new("B", collect_cb, file);
+    fail_if(lr_multipart_feed(mp, "--B\r\nContent-Type: text/plain\r\n\r\nx",
+                              34, &tmp_err));
+    fail_if(!tmp_err);
+    fail_if(tmp_err->code != LRE_BADSTATUS);
+    g_clear_error(&tmp_err);
+    lr_multipart_free(mp);
+
+    // Part longer than its Content-Range
+    mp = lr_multipart_new("B", collect_cb, file);
+    fail_if(lr_multipart_feed(mp, "--B\r\nContent-Range: bytes 0-1/20\r\n\r\n"
+                              "xyz\r\n--B--\r\n", 48, &tmp_err));
+    fail_if(!tmp_err);
+    g_clear_error(&tmp_err);
+    lr_multipart_free(mp);
+
+    // Truncated response
+    mp = lr_multipart_new("B", collect_cb, file);
+    fail_if(!lr_multipart_feed(mp, "--B\r\nContent-Range: bytes 0-1/20\r\n\r\n"
+                               "x", 37, &tmp_err));
+    fail_if(tmp_err);
+    fail_if(lr_multipart_finish(mp, &tmp_err));
+    fail_if(!tmp_err);
+    g_clear_error(&tmp_err);
+    lr_multipart_free(mp);
+}
+END_TEST
+
+Suite *
+multipart_suite(void)
+{
+    Suite *s = suite_create("multipart");
+    TCase *tc = tcase_create("Main");
+    tcase_add_test(tc, test_multipart_boundary);
+    tcase_add_test(tc, test_multipart_content_range);
+    tcase_add_test(tc, test_multipart_parse);
+    tcase_add_test(tc, test_multipart_bad);
+    suite_add_tcase(s, tc);
+    return s;
+}
@@ -0,0 +1,8 @@
+#ifndef LR_TEST_MULTIPART_H
+#define LR_TEST_MULTIPART_H
+
+#include <check.h>
+
+Suite *multipart_suite(void);
+
+#endif
@@ -15,6 +15,7 @@
 #include "librepo/librepo.h"
 #include "librepo/rcodes.h"
 #include "librepo/package_downloader.h"
+#include "librepo/packagestore.h"
 
 START_TEST(test_package_downloader_new_and_free)
 {
@@ -67,12 +68,201 @@ START_TEST(test_package_downloader_new_and_free)
 }
 END_TEST
 
+START_TEST(test_package_downloader_set_delta)
+{
+    LrPackageTarget *target;
+    GError *err = NULL;
+
+    target = lr_packagetarget_new(NULL, "foo.rpm", NULL, 0, NULL, 0, NULL,
+                                  FALSE, NULL, NULL, &err);
+    fail_if(!target);
+    fail_if(target->delta_url);
+
+    fail_if(!lr_packagetarget_set_delta(target, "foo.drpm",
+                                        LR_CHECKSUM_SHA256, "xxx", 10,
+                                        "old.rpm", &err));
+    fail_if(err);
+    fail_if(strcmp(target->delta_url, "foo.drpm"));
+    fail_if(target->delta_checksum_type != LR_CHECKSUM_SHA256);
+    fail_if(strcmp(target->delta_checksum, "xxx"));
+    fail_if(target->delta_size != 10);
+    fail_if(strcmp(target->delta_base, "old.rpm"));
+    lr_packagetarget_free(target);
+
+    // Part of a package cannot be reconstructed
+    target = lr_packagetarget_new_v3(NULL, "foo.rpm", NULL, 0, NULL, 0, NULL,
+                                     FALSE, NULL, NULL, NULL, NULL, 10, 20,
+                                     &err);
+    fail_if(!target);
+    fail_if(lr_packagetarget_set_delta(target, "foo.drpm", 0, NULL, 0, NULL,
+                                       &err));
+    fail_if(!err);
+    fail_if(err->code != LRE_BADFUNCARG);
+    fail_if(target->delta_url);
+    g_error_free(err);
+    lr_packagetarget_free(target);
+}
+END_TEST
+
+START_TEST(test_package_downloader_packagestore)
+{
+    // sha256 of "hello"
+    const char *checksum = "2cf24dba5fb0a30e26e83b2ac5b9e29e"
+                           "1b161e5c1fa7425e73043362938b9824";
+    gchar *store, *src, *dest, *content = NULL;
+
+    store = lr_pathconcat(test_globals.tmpdir, "packagestore", NULL);
+    src = lr_pathconcat(test_globals.tmpdir, "packagestore_src", NULL);
+    dest = lr_pathconcat(test_globals.tmpdir, "packagestore_dest", NULL);
+    fail_if(!g_file_set_contents(src, "hello", -1, NULL));
+
+    // Miss
+
+    fail_if(lr_packagestore_get(store, LR_CHECKSUM_SHA256, checksum, dest));
+    fail_if(g_file_test(dest, G_FILE_TEST_EXISTS));
+
+    // Checksum which isn't a file name is refused
+
+    lr_packagestore_put(store, LR_CHECKSUM_SHA256, "../../x", src);
+    fail_if(lr_packagestore_get(store, LR_CHECKSUM_SHA256, "../../x", dest));
+
+    // Hit after put
+
+    lr_packagestore_put(store, LR_CHECKSUM_SHA256, checksum, src);
+    fail_if(!lr_packagestore_get(store, LR_CHECKSUM_SHA256, checksum, dest));
+    fail_if(!g_file_get_contents(dest, &content, NULL, NULL));
+    fail_if(strcmp(content, "hello"));
+    g_free(content);
+
+    // Other checksum type is other package
+
+    fail_if(lr_packagestore_get(store, LR_CHECKSUM_SHA512, checksum, dest));
+
+    // Size limit evicts the package
+
+    lr_packagestore_evict(store, 0);
+    fail_if(!lr_packagestore_get(store, LR_CHECKSUM_SHA256, checksum, dest));
+    lr_packagestore_evict(store, 1);
+    fail_if(lr_packagestore_get(store, LR_CHECKSUM_SHA256, checksum, dest));
+
+    lr_free(store);
+    lr_free(src);
+    lr_free(dest);
+}
+END_TEST
+
+START_TEST(test_package_downloader_nospace)
+{
+    LrPackageTarget *target;
+    GSList *targets = NULL;
+    GError *err = NULL;
+    gchar *dest;
+
+    // Nothing is downloaded if the packages cannot fit to the disk
+
+    dest = lr_pathconcat(test_globals.tmpdir, "nospace.rpm", NULL);
+    target = lr_packagetarget_new(NULL, "file:///nonexistent/nospace.rpm",
+                                  dest, 0, NULL, G_MAXINT64 / 2, NULL, FALSE,
+                                  NULL, NULL, &err);
+    fail_if(!target);
+    targets = g_slist_append(targets, target);
+
+    fail_if(lr_download_packages(targets, LR_PACKAGEDOWNLOAD_FAILFAST, &err));
+    fail_if(!err);
+    fail_if(err->code != LRE_NOSPACE);
+    fail_if(g_file_test(dest, G_FILE_TEST_EXISTS));
+    g_error_free(err);
+
+    g_slist_free_full(targets, (GDestroyNotify) lr_packagetarget_free);
+    lr_free(dest);
+}
+END_TEST
+
+static int
+iter_endcb(void *data, G_GNUC_UNUSED LrTransferStatus status,
+           G_GNUC_UNUSED const char *msg)
+{
+    int *ended = data;
+    (*ended)++;
+    return LR_CB_OK;
+}
+
+START_TEST(test_package_downloader_iter)
+{
+    LrPackageDownloadIter *iter;
+    LrPackageTarget *target;
+    LrTransferStatus status;
+    GSList *targets = NULL;
+    GError *err = NULL;
+    gchar *url, *dest, *missing_dest;
+    int ended = 0;
+    int successful = 0, failed = 0;
+
+    // Every target is returned once with the status of its end
+
+    url = g_strconcat("file://", test_globals.testdata_dir,
+                      "/repo_yum_01/repodata/repomd.xml", NULL);
+    dest = lr_pathconcat(test_globals.tmpdir, "iter_repomd.xml", NULL);
+    missing_dest = lr_pathconcat(test_globals.tmpdir, "iter_missing", NULL);
+
+    target = lr_packagetarget_new_v2(NULL, url, dest, 0, NULL, 0, NULL,
+                                     FALSE, NULL, &ended, iter_endcb, NULL,
+                                     &err);
+    fail_if(!target);
+    targets = g_slist_append(targets, target);
+    target = lr_packagetarget_new_v2(NULL, "file:///nonexistent/iter.rpm",
+                                     missing_dest, 0, NULL, 0, NULL,
+                                     FALSE, NULL, &ended, iter_endcb, NULL,
+                                     &err);
+    fail_if(!target);
+    targets = g_slist_append(targets, target);
+
+    iter = lr_download_packages_iter(targets, 0, &err);
+    fail_if(!iter);
+    fail_if(err);
+
+    while ((target = lr_packagedownloaditer_next(iter, &status, &err))) {
+        if (status == LR_TRANSFER_SUCCESSFUL) {
+            fail_if(strcmp(target->local_path, dest));
+            fail_if(!g_file_test(dest, G_FILE_TEST_IS_REGULAR));
+            successful++;
+        } else {
+            fail_if(status != LR_TRANSFER_ERROR);
+            failed++;
+        }
+    }
+    fail_if(err);
+    fail_if(successful != 1);
+    fail_if(failed != 1);
+    lr_packagedownloaditer_free(iter);
+
+    // The end callbacks of the user are called and restored
+    fail_if(ended != 2);
+    for (GSList *elem = targets; elem; elem = g_slist_next(elem)) {
+        target = elem->data;
+        fail_if(target->endcb != iter_endcb);
+        fail_if(target->cbdata != &ended);
+    }
+    fail_if(((LrPackageTarget *) targets->data)->err);
+    fail_if(!((LrPackageTarget *) targets->next->data)->err);
+
+    g_slist_free_full(targets, (GDestroyNotify) lr_packagetarget_free);
+    g_free(url);
+    lr_free(dest);
+    lr_free(missing_dest);
+}
+END_TEST
+
 Suite *
 package_downloader_suite(void)
 {
     Suite *s = suite_create("package_downloader");
     TCase *tc = tcase_create("Main");
     tcase_add_test(tc, test_package_downloader_new_and_free);
+    tcase_add_test(tc, test_package_downloader_set_delta);
+    tcase_add_test(tc, test_package_downloader_packagestore);
+    tcase_add_test(tc, test_package_downloader_nospace);
+    tcase_add_test(tc, test_package_downloader_iter);
     suite_add_tcase(s, tc);
     return s;
 }
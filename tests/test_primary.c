@@ -0,0 +1,206 @@
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+
+#include "testsys.h"
+#include "fixtures.h"
+#include "test_primary.h"
+#include "librepo/rcodes.h"
+#include "librepo/types.h"
+#include "librepo/primary.h"
+#include "librepo/decompressor.h"
+#include "librepo/util.h"
+
+#define PRIMARY_XML \
+    "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n" \
+    "<metadata xmlns=\"http://linux.duke.edu/metadata/common\" " \
+    "xmlns:rpm=\"http://linux.duke.edu/metadata/rpm\" packages=\"3\">\n" \
+    "<package type=\"rpm\">\n" \
+    "  <name>foo</name>\n" \
+    "  <checksum type=\"sha256\" pkgid=\"YES\">abcdef</checksum>\n" \
+    "  <size package=\"123\" installed=\"456\" archive=\"789\"/>\n" \
+    "  <location href=\"Packages/f/foo-1-1.noarch.rpm\"/>\n" \
+    "  <format><rpm:license>MIT</rpm:license></format>\n" \
+    "</package>\n" \
+    "<package type=\"rpm\">\n" \
+    "  <name>nolocation</name>\n" \
+    "</package>\n" \
+    "<package type=\"rpm\">\n" \
+    "  <name>bar</name>\n" \
+    "  <location xml:base=\"http://example.com/\" href=\"bar.rpm\"/>\n" \
+    "</package>\n" \
+    "</metadata>\n"
+
+static GSList *
+packages_append(GSList *list, const LrYumPackage *package)
+{
+    LrYumPackage *copy = g_new0(LrYumPackage, 1);
+    copy->location_href = g_strdup(package->location_href);
+    copy->location_base = g_strdup(package->location_base);
+    copy->checksum      = g_strdup(package->checksum);
+    copy->checksum_type = g_strdup(package->checksum_type);
+    copy->size          = package->size;
+    return g_slist_append(list, copy);
+}
+
+static void
+package_free(LrYumPackage *package)
+{
+    g_free(package->location_href);
+    g_free(package->location_base);
+    g_free(package->checksum);
+    g_free(package->checksum_type);
+    g_free(package);
+}
+
+static int
+package_cb(const LrYumPackage *package, void *cbdata)
+{
+    GSList **list = cbdata;
+    *list = packages_append(*list, package);
+    return LR_CB_OK;
+}
+
+static int
+package_abort_cb(G_GNUC_UNUSED const LrYumPackage *package,
+                 G_GNUC_UNUSED void *cbdata)
+{
+    return LR_CB_ERROR;
+}
+
+static int
+content_fd(const char *content)
+{
+    int fd = lr_gettmpfile();
+    fail_if(fd < 0);
+    fail_if(write(fd, content, strlen(content)) != (ssize_t) strlen(content));
+    fail_if(lseek(fd, 0, SEEK_SET) != 0);
+    return fd;
+}
+
+START_TEST(test_primary_parsing)
+{
+    int fd, primary_fd;
+    gboolean ret;
+    char *path;
+    GSList *packages = NULL;
+    LrYumPackage *package;
+    GError *tmp_err = NULL;
+
+    path = lr_pathconcat(test_globals.testdata_dir,
+                         "repo_yum_01/repodata/"
+                         "4543ad62e4d86337cd1949346f9aec976b847b58-primary.xml.gz",
+                         NULL);
+    fd = open(path, O_RDONLY);
+    fail_if(fd < 0);
+    primary_fd = lr_gettmpfile();
+    fail_if(primary_fd < 0);
+    fail_if(!lr_decompress_fd(fd, primary_fd, &tmp_err));
+    fail_if(tmp_err);
+    close(fd);
+    fail_if(lseek(primary_fd, 0, SEEK_SET) != 0);
+
+    ret = lr_yum_primary_parse_file(primary_fd, package_cb, &packages,
+                                    NULL, NULL, &tmp_err);
+    close(primary_fd);
+    fail_if(!ret);
+    fail_if(tmp_err);
+
+    fail_if(g_slist_length(packages) != 1);
+    package = packages->data;
+    ck_assert_str_eq(package->location_href,
+                     "filesystem-2.4.44-1.fc16.i686.rpm");
+    fail_if(package->location_base);
+    ck_assert_str_eq(package->checksum_type, "sha1");
+    ck_assert_str_eq(package->checksum,
+                     "1687a3a01942475aeeddbf36a4a9b0ff714c046d");
+    fail_if(package->size != 1057084);
+
+    g_slist_free_full(packages, (GDestroyNotify) package_free);
+    lr_free(path);
+}
+END_TEST
+
+START_TEST(test_primary_parsing_content)
+{
+    int fd;
+    gboolean ret;
+    GSList *packages = NULL;
+    LrYumPackage *package;
+    GError *tmp_err = NULL;
+
+    fd = content_fd(PRIMARY_XML);
+    ret = lr_yum_primary_parse_file(fd, package_cb, &packages,
+                                    NULL, NULL, &tmp_err);
+    close(fd);
+    fail_if(!ret);
+    fail_if(tmp_err);
+
+    // The package without a location is skipped
+    fail_if(g_slist_length(packages) != 2);
+
+    package = g_slist_nth_data(packages, 0);
+    ck_assert_str_eq(package->location_href, "Packages/f/foo-1-1.noarch.rpm");
+    fail_if(package->location_base);
+    ck_assert_str_eq(package->checksum_type, "sha256");
+    ck_assert_str_eq(package->checksum, "abcdef");
+    fail_if(package->size != 123);
+
+    package = g_slist_nth_data(packages, 1);
+    ck_assert_str_eq(package->location_href, "bar.rpm");
+    ck_assert_str_eq(package->location_base, "http://example.com/");
+    fail_if(package->checksum);
+    fail_if(package->checksum_type);
+    fail_if(package->size != -1);
+
+    g_slist_free_full(packages, (GDestroyNotify) package_free);
+}
+END_TEST
+
+START_TEST(test_primary_parsing_interrupted)
+{
+    int fd;
+    gboolean ret;
+    GError *tmp_err = NULL;
+
+    fd = content_fd(PRIMARY_XML);
+    ret = lr_yum_primary_parse_file(fd, package_abort_cb, NULL,
+                                    NULL, NULL, &tmp_err);
+    close(fd);
+    fail_if(ret);
+    fail_if(!tmp_err);
+    fail_if(tmp_err->code != LRE_CBINTERRUPTED);
+    g_error_free(tmp_err);
+}
+END_TEST
+
+START_TEST(test_primary_parsing_bad)
+{
+    int fd;
+    gboolean ret;
+    GSList *packages = NULL;
+    GError *tmp_err = NULL;
+
+    fd = content_fd("<?xml version=\"1.0\"?>\n<repomd></repomd>\n");
+    ret = lr_yum_primary_parse_file(fd, package_cb, &packages,
+                                    NULL, NULL, &tmp_err);
+    close(fd);
+    fail_if(ret);
+    fail_if(!tmp_err);
+    fail_if(packages);
+    g_error_free(tmp_err);
+}
+END_TEST
+
+Suite *
+primary_suite(void)
+{
+    Suite *s = suite_create("primary");
+    TCase *tc = tcase_create("Main");
+    tcase_add_test(tc, test_primary_parsing);
+    tcase_add_test(tc, test_primary_parsing_content);
+    tcase_add_test(tc, test_primary_parsing_interrupted);
+    tcase_add_test(tc, test_primary_parsing_bad);
+    suite_add_tcase(s, tc);
+    return s;
+}
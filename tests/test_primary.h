@@ -0,0 +1,8 @@
+#ifndef LR_TEST_PRIMARY_H
+#define LR_TEST_PRIMARY_H
+
+#include <check.h>
+
+Suite *primary_suite(void);
+
+#endif
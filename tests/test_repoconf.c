@@ -205,6 +205,149 @@ START_TEST(test_repoconf_big)
 }
 END_TEST
 
+START_TEST(test_repoconf_lazy)
+{
+    gboolean ret;
+    LrYumRepoConf *conf, *big;
+    LrYumRepoConfs *confs;
+    GSList *list;
+    _cleanup_free_ gchar *path = NULL;
+    _cleanup_free_ gchar *big_path = NULL;
+    _cleanup_error_free_ GError *tmp_err = NULL;
+
+    path = lr_pathconcat(test_globals.testdata_dir, "repo-minimal.repo", NULL);
+    big_path = lr_pathconcat(test_globals.testdata_dir, "repo-big.repo", NULL);
+
+    confs = lr_yum_repoconfs_init_lazy();
+    fail_if(!confs);
+
+    ret = lr_yum_repoconfs_parse(confs, path, &tmp_err);
+    fail_if(!ret);
+    ret = lr_yum_repoconfs_parse(confs, big_path, &tmp_err);
+    fail_if(!ret);
+
+    // Only the requested repos are parsed
+    big = lr_yum_repoconfs_get(confs, "big-repo", &tmp_err);
+    fail_if(!big);
+    fail_if(tmp_err);
+    ck_assert_str_eq(big->_source, big_path);
+    lr_assert_strv_eq(big->baseurl,
+                      "http://foo1.org/pub/linux/$releasever/$basearch/os/",
+                      "ftp://ftp.foo2/pub/linux/$releasever/$basearch/os/",
+                      "https://foo3.org/pub/linux/",
+                      NULL);
+    ck_assert_int_eq(big->bandwidth, 1024*1024);
+    fail_if(lr_yum_repoconfs_get(confs, "big-repo", NULL) != big);
+
+    fail_if(lr_yum_repoconfs_get(confs, "no-such-repo", &tmp_err));
+    fail_if(tmp_err);
+
+    // The rest is parsed by the listing, in order of the files
+    list = lr_yum_repoconfs_get_list(confs, &tmp_err);
+    fail_if(tmp_err);
+    fail_if(g_slist_length(list) != 3);
+    conf = list->data;
+    ck_assert_str_eq(conf->id, "minimal-repo-1");
+    ck_assert_str_eq(conf->name, "Minimal repo 1 - $basearch");
+    lr_assert_strv_eq(conf->baseurl, "http://m1.com/linux/$basearch", NULL);
+    conf = list->next->data;
+    ck_assert_str_eq(conf->id, "minimal-repo-2");
+    fail_if(list->next->next->data != big);
+    fail_if(lr_yum_repoconfs_get(confs, "minimal-repo-2", NULL) != conf);
+
+    lr_yum_repoconfs_free(confs);
+}
+END_TEST
+
+/** Copy a file from the test data to the directory.
+ */
+static void
+copy_testdata(const char *name, const char *dir, const char *dest)
+{
+    _cleanup_free_ gchar *src = NULL;
+    _cleanup_free_ gchar *dst = NULL;
+    _cleanup_free_ gchar *content = NULL;
+    gsize len;
+
+    src = lr_pathconcat(test_globals.testdata_dir, name, NULL);
+    dst = lr_pathconcat(dir, dest, NULL);
+    fail_if(!g_file_get_contents(src, &content, &len, NULL));
+    fail_if(!g_file_set_contents(dst, content, len, NULL));
+}
+
+/** Find the repo with the id in the list.
+ */
+static LrYumRepoConf *
+find_repoconf(GSList *list, const char *id)
+{
+    for (GSList *elem = list; elem; elem = g_slist_next(elem)) {
+        LrYumRepoConf *conf = elem->data;
+        if (!g_strcmp0(conf->id, id))
+            return conf;
+    }
+    return NULL;
+}
+
+START_TEST(test_repoconf_load_dir_cached)
+{
+    gboolean ret;
+    LrYumRepoConf *conf;
+    LrYumRepoConfs *confs;
+    _cleanup_free_ gchar *tmpdir = NULL;
+    _cleanup_free_ gchar *cachepath = NULL;
+    _cleanup_error_free_ GError *tmp_err = NULL;
+
+    tmpdir = lr_gettmpdir();
+    cachepath = lr_pathconcat(tmpdir, "repoconf.cache", NULL);
+    copy_testdata("repo-minimal.repo", tmpdir, "minimal.repo");
+    copy_testdata("repo-big.repo", tmpdir, "big.repo");
+
+    // Parsed (and cached), then loaded from the cache
+    for (int i = 0; i < 2; i++) {
+        confs = lr_yum_repoconfs_init();
+        ret = lr_yum_repoconfs_load_dir_cached(confs, tmpdir, cachepath,
+                                               2, &tmp_err);
+        fail_if(!ret);
+        fail_if(tmp_err);
+        fail_if(g_slist_length(lr_yum_repoconfs_get_list(confs, NULL)) != 3);
+        fail_if(!g_file_test(cachepath, G_FILE_TEST_IS_REGULAR));
+
+        conf = find_repoconf(lr_yum_repoconfs_get_list(confs, NULL),
+                             "minimal-repo-2");
+        fail_if(!conf);
+        ck_assert_str_eq(conf->name, "Minimal repo 2 - $basearch");
+        ck_assert(conf->enabled);
+        ck_assert_int_eq(conf->priority, LR_YUMREPOCONF_PRIORITY_DEFAULT);
+        fail_if(!g_str_has_suffix(conf->_source, "minimal.repo"));
+
+        conf = find_repoconf(lr_yum_repoconfs_get_list(confs, NULL),
+                             "big-repo");
+        fail_if(!conf);
+        lr_assert_strv_eq(conf->exclude, "package_1", "package_2", NULL);
+        ck_assert_str_eq(conf->throttle, "50%");
+        ck_assert_int_eq(conf->bandwidth, 1024*1024);
+        ck_assert_int_eq(conf->ip_resolve, LR_IPRESOLVE_V6);
+        ck_assert_int_eq(conf->metadata_expire, 60*60*24*5);
+        ck_assert_int_eq(conf->cost, 500);
+        fail_if(conf->mirrorlist == NULL || conf->gpgcakey == NULL);
+        lr_yum_repoconfs_free(confs);
+    }
+
+    // Changed file is parsed again, removed one is dropped
+    copy_testdata("repo-big.repo", tmpdir, "minimal.repo");
+    confs = lr_yum_repoconfs_init();
+    ret = lr_yum_repoconfs_load_dir_cached(confs, tmpdir, cachepath,
+                                           0, &tmp_err);
+    fail_if(!ret);
+    fail_if(g_slist_length(lr_yum_repoconfs_get_list(confs, NULL)) != 2);
+    fail_if(find_repoconf(lr_yum_repoconfs_get_list(confs, NULL),
+                          "minimal-repo-1"));
+    lr_yum_repoconfs_free(confs);
+
+    lr_remove_dir(tmpdir);
+}
+END_TEST
+
 Suite *
 repoconf_suite(void)
 {
@@ -212,6 +355,8 @@ repoconf_suite(void)
     TCase *tc = tcase_create("Main");
     tcase_add_test(tc, test_repoconf_minimal);
     tcase_add_test(tc, test_repoconf_big);
+    tcase_add_test(tc, test_repoconf_lazy);
+    tcase_add_test(tc, test_repoconf_load_dir_cached);
     suite_add_tcase(s, tc);
     return s;
 }
@@ -1,3 +1,5 @@
+#define _GNU_SOURCE
+#include <string.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <unistd.h>
@@ -9,6 +11,8 @@
 #include "librepo/rcodes.h"
 #include "librepo/types.h"
 #include "librepo/repomd.h"
+#include "librepo/handle.h"
+#include "librepo/parsecache.h"
 #include "librepo/util.h"
 
 START_TEST(test_repomd_parsing)
@@ -54,12 +58,251 @@ START_TEST(test_repomd_parsing)
 }
 END_TEST
 
+START_TEST(test_repomd_parsing_buffer)
+{
+    gboolean ret;
+    LrYumRepoMd *repomd;
+    LrYumRepoMdParser *parser;
+    char *repomd_path, *content;
+    gsize len;
+    GError *tmp_err = NULL;
+
+    repomd_path = lr_pathconcat(test_globals.testdata_dir,
+                                "repo_yum_02/repodata/repomd.xml",
+                                NULL);
+    fail_if(!g_file_get_contents(repomd_path, &content, &len, NULL));
+    lr_free(repomd_path);
+
+    // Whole buffer
+    repomd = lr_yum_repomd_init();
+    ret = lr_yum_repomd_parse_buffer(repomd, content, len, NULL, NULL, &tmp_err);
+    fail_if(!ret);
+    fail_if(tmp_err);
+    fail_if(g_slist_length(repomd->records) != 12);
+    fail_if(!lr_yum_repomd_get_record(repomd, "primary"));
+    lr_yum_repomd_free(repomd);
+
+    // Fed by small parts
+    repomd = lr_yum_repomd_init();
+    parser = lr_yum_repomd_parser_new(repomd, NULL, NULL);
+    for (gsize offset = 0; offset < len; offset += 7) {
+        ret = lr_yum_repomd_parser_feed(parser, content + offset,
+                                        MIN(7, len - offset), &tmp_err);
+        fail_if(!ret);
+        fail_if(tmp_err);
+    }
+    ret = lr_yum_repomd_parser_finish(parser, &tmp_err);
+    fail_if(!ret);
+    fail_if(tmp_err);
+    lr_yum_repomd_parser_free(parser);
+    fail_if(g_slist_length(repomd->records) != 12);
+    fail_if(!lr_yum_repomd_get_record(repomd, "deltainfo"));
+    lr_yum_repomd_free(repomd);
+
+    // Incomplete document
+    repomd = lr_yum_repomd_init();
+    parser = lr_yum_repomd_parser_new(repomd, NULL, NULL);
+    ret = lr_yum_repomd_parser_feed(parser, content, len / 2, &tmp_err);
+    fail_if(!ret);
+    ret = lr_yum_repomd_parser_finish(parser, &tmp_err);
+    fail_if(ret);
+    fail_if(!tmp_err);
+    g_error_free(tmp_err);
+    lr_yum_repomd_parser_free(parser);
+    lr_yum_repomd_free(repomd);
+
+    g_free(content);
+}
+END_TEST
+
+START_TEST(test_repomd_duplicate_record)
+{
+    gboolean ret;
+    LrYumRepoMd *repomd;
+    LrYumRepoMdRecord *record;
+    GError *tmp_err = NULL;
+    const char *content =
+        "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n"
+        "<repomd xmlns=\"http://linux.duke.edu/metadata/repo\">\n"
+        "  <data type=\"primary\">\n"
+        "    <location href=\"repodata/first-primary.xml.gz\"/>\n"
+        "  </data>\n"
+        "  <data type=\"primary\">\n"
+        "    <location href=\"repodata/second-primary.xml.gz\"/>\n"
+        "  </data>\n"
+        "</repomd>\n";
+
+    repomd = lr_yum_repomd_init();
+    ret = lr_yum_repomd_parse_buffer(repomd, content, strlen(content),
+                                     NULL, NULL, &tmp_err);
+    fail_if(!ret);
+    fail_if(tmp_err);
+    fail_if(g_slist_length(repomd->records) != 2);
+
+    // The first record of the type wins
+    record = lr_yum_repomd_get_record(repomd, "primary");
+    fail_if(!record);
+    fail_if(record != repomd->records->data);
+    fail_if(strcmp(record->location_href, "repodata/first-primary.xml.gz"));
+    lr_yum_repomd_free(repomd);
+}
+END_TEST
+
+START_TEST(test_repomd_diff)
+{
+    gboolean ret;
+    LrYumRepoMd *old_repomd, *new_repomd;
+    LrYumRepoMdDiff *diff;
+    GError *tmp_err = NULL;
+    const char *old_content =
+        "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n"
+        "<repomd xmlns=\"http://linux.duke.edu/metadata/repo\">\n"
+        "  <data type=\"primary\">\n"
+        "    <checksum type=\"sha256\">aaa</checksum>\n"
+        "    <timestamp>100</timestamp>\n"
+        "    <size>10</size>\n"
+        "  </data>\n"
+        "  <data type=\"filelists\">\n"
+        "    <checksum type=\"sha256\">bbb</checksum>\n"
+        "    <timestamp>100</timestamp>\n"
+        "    <size>20</size>\n"
+        "  </data>\n"
+        "  <data type=\"other\">\n"
+        "    <checksum type=\"sha256\">ccc</checksum>\n"
+        "  </data>\n"
+        "</repomd>\n";
+    const char *new_content =
+        "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n"
+        "<repomd xmlns=\"http://linux.duke.edu/metadata/repo\">\n"
+        "  <data type=\"primary\">\n"
+        "    <checksum type=\"sha256\">aaa</checksum>\n"
+        "    <timestamp>100</timestamp>\n"
+        "    <size>10</size>\n"
+        "  </data>\n"
+        "  <data type=\"filelists\">\n"
+        "    <checksum type=\"sha256\">ddd</checksum>\n"
+        "    <timestamp>200</timestamp>\n"
+        "    <size>20</size>\n"
+        "  </data>\n"
+        "  <data type=\"updateinfo\">\n"
+        "    <checksum type=\"sha256\">eee</checksum>\n"
+        "  </data>\n"
+        "</repomd>\n";
+
+    old_repomd = lr_yum_repomd_init();
+    ret = lr_yum_repomd_parse_buffer(old_repomd, old_content,
+                                     strlen(old_content), NULL, NULL,
+                                     &tmp_err);
+    fail_if(!ret);
+    new_repomd = lr_yum_repomd_init();
+    ret = lr_yum_repomd_parse_buffer(new_repomd, new_content,
+                                     strlen(new_content), NULL, NULL,
+                                     &tmp_err);
+    fail_if(!ret);
+    fail_if(tmp_err);
+
+    diff = lr_yum_repomd_diff(old_repomd, new_repomd);
+    fail_if(!diff);
+    fail_if(g_slist_length(diff->added) != 1);
+    fail_if(strcmp(diff->added->data, "updateinfo"));
+    fail_if(g_slist_length(diff->removed) != 1);
+    fail_if(strcmp(diff->removed->data, "other"));
+    fail_if(g_slist_length(diff->changed) != 1);
+    fail_if(strcmp(diff->changed->data, "filelists"));
+    fail_if(lr_yum_repomd_diff_modified(diff, "primary"));
+    fail_if(!lr_yum_repomd_diff_modified(diff, "filelists"));
+    fail_if(!lr_yum_repomd_diff_modified(diff, "updateinfo"));
+    lr_yum_repomd_diff_free(diff);
+
+    // No differences against itself
+    diff = lr_yum_repomd_diff(new_repomd, new_repomd);
+    fail_if(diff->added || diff->removed || diff->changed);
+    lr_yum_repomd_diff_free(diff);
+
+    lr_yum_repomd_free(old_repomd);
+    lr_yum_repomd_free(new_repomd);
+}
+END_TEST
+
+START_TEST(test_repomd_parsecache)
+{
+    gboolean ret;
+    int fd;
+    char *content, *path, *cachepath;
+    gsize len;
+    LrYumRepoMd *repomd, *cached;
+    LrYumRepoMdRecord *record, *cached_record;
+    struct stat st;
+    struct timespec times[2];
+    GError *tmp_err = NULL;
+
+    path = lr_pathconcat(test_globals.testdata_dir,
+                         "repo_yum_02/repodata/repomd.xml",
+                         NULL);
+    fail_if(!g_file_get_contents(path, &content, &len, NULL));
+    lr_free(path);
+
+    path = lr_pathconcat(test_globals.tmpdir, "/parsecache_repomd.xml", NULL);
+    cachepath = g_strconcat(path, LR_PARSECACHE_SUFFIX, NULL);
+    fail_if(!g_file_set_contents(path, content, len, NULL));
+    g_free(content);
+
+    fd = open(path, O_RDONLY);
+    fail_if(fd < 0);
+
+    // No cache yet
+    cached = lr_yum_repomd_init();
+    fail_if(lr_parsecache_load_repomd(cached, path, fd));
+
+    repomd = lr_yum_repomd_init();
+    ret = lr_yum_repomd_parse_file(repomd, fd, NULL, NULL, &tmp_err);
+    fail_if(!ret);
+    fail_if(tmp_err);
+    lr_parsecache_store_repomd(repomd, path, fd);
+    fail_if(access(cachepath, F_OK) != 0);
+
+    fail_if(!lr_parsecache_load_repomd(cached, path, fd));
+    fail_if(g_strcmp0(cached->revision, repomd->revision));
+    fail_if(g_slist_length(cached->records) != g_slist_length(repomd->records));
+    record = lr_yum_repomd_get_record(repomd, "primary");
+    cached_record = lr_yum_repomd_get_record(cached, "primary");
+    fail_if(!cached_record);
+    fail_if(g_strcmp0(cached_record->location_href, record->location_href));
+    fail_if(g_strcmp0(cached_record->checksum, record->checksum));
+    fail_if(cached_record->timestamp != record->timestamp);
+    fail_if(cached_record->size != record->size);
+    lr_yum_repomd_free(cached);
+
+    // The cache is not valid after the mtime changed
+    fail_if(fstat(fd, &st) != 0);
+    times[0] = st.st_atim;
+    times[1] = st.st_mtim;
+    times[1].tv_nsec = (times[1].tv_nsec + 1) % 1000000000;
+    fail_if(futimens(fd, times) != 0);
+    cached = lr_yum_repomd_init();
+    fail_if(lr_parsecache_load_repomd(cached, path, fd));
+    fail_if(cached->records);
+    lr_yum_repomd_free(cached);
+
+    lr_yum_repomd_free(repomd);
+    close(fd);
+    unlink(cachepath);
+    unlink(path);
+    g_free(cachepath);
+    lr_free(path);
+}
+END_TEST
+
 Suite *
 repomd_suite(void)
 {
     Suite *s = suite_create("repomd");
     TCase *tc = tcase_create("Main");
     tcase_add_test(tc, test_repomd_parsing);
+    tcase_add_test(tc, test_repomd_parsing_buffer);
+    tcase_add_test(tc, test_repomd_duplicate_record);
+    tcase_add_test(tc, test_repomd_diff);
+    tcase_add_test(tc, test_repomd_parsecache);
     suite_add_tcase(s, tc);
     return s;
 }
@@ -128,6 +128,44 @@ START_TEST(test_url_substitute_empty_var)
 }
 END_TEST
 
+START_TEST(test_url_template)
+{
+    char *url;
+    LrUrlVars *urlvars = NULL;
+    LrUrlVarsTable *table;
+    LrUrlTemplate *tmpl;
+
+    urlvars = lr_urlvars_set(urlvars, "arch", "x86_64");
+    urlvars = lr_urlvars_set(urlvars, "releasever", "20");
+    urlvars = lr_urlvars_set(urlvars, "release", "foo");
+    table = lr_urlvars_table_new(urlvars);
+
+    tmpl = lr_url_template_compile("http://foo/$releasever/$arch/$x", table);
+    url = lr_url_template_render(tmpl);
+    fail_if(strcmp(url, "http://foo/foover/x86_64/$x"));
+    lr_free(url);
+    url = lr_url_template_render(tmpl);
+    fail_if(strcmp(url, "http://foo/foover/x86_64/$x"));
+    lr_free(url);
+    lr_url_template_free(tmpl);
+
+    url = lr_url_substitute_table("$arch$arch", table);
+    fail_if(strcmp(url, "x86_64x86_64"));
+    lr_free(url);
+
+    url = lr_url_substitute_table("http://$", table);
+    fail_if(strcmp(url, "http://$"));
+    lr_free(url);
+
+    url = lr_url_substitute_table("http://foo", NULL);
+    fail_if(strcmp(url, "http://foo"));
+    lr_free(url);
+
+    lr_urlvars_table_free(table);
+    lr_urlvars_free(urlvars);
+}
+END_TEST
+
 Suite *
 url_substitution_suite(void)
 {
@@ -137,6 +175,7 @@ url_substitution_suite(void)
     tcase_add_test(tc, test_url_substitute_without_urlvars);
     tcase_add_test(tc, test_url_substitute);
     tcase_add_test(tc, test_url_substitute_empty_var);
+    tcase_add_test(tc, test_url_template);
     suite_add_tcase(s, tc);
     return s;
 }
@@ -40,6 +40,48 @@ START_TEST(test_free)
 }
 END_TEST
 
+static void
+count_hook(void *data,
+           G_GNUC_UNUSED LrAllocTag tag,
+           G_GNUC_UNUSED void *ptr,
+           G_GNUC_UNUSED void *old_ptr,
+           G_GNUC_UNUSED size_t size)
+{
+    (*((int *) data))++;
+}
+
+START_TEST(test_alloc_accounting)
+{
+    LrAllocStats start, end, tags_start[LR_ALLOC_SENTINEL],
+                 tags_end[LR_ALLOC_SENTINEL];
+    int calls = 0;
+    char *mem;
+
+    lr_alloc_accounting(TRUE);
+    lr_alloc_set_hook(count_hook, &calls);
+    LrAllocTag prev_tag = lr_alloc_tag_set(LR_ALLOC_CHECKSUM);
+    lr_alloc_stats_get(&start, tags_start);
+
+    mem = lr_malloc(16);
+    mem = lr_realloc(mem, 4096);
+    lr_free(mem);
+
+    lr_alloc_stats_get(&end, tags_end);
+    lr_alloc_tag_set(prev_tag);
+    lr_alloc_set_hook(NULL, NULL);
+    lr_alloc_accounting(FALSE);
+
+    fail_if(calls != 3);
+    fail_if(end.count - start.count != 2);
+    fail_if(end.frees - start.frees != 1);
+    fail_if(end.bytes - start.bytes < 16 + 4096);
+    fail_if(end.peak < start.live + 4096);
+    fail_if(tags_end[LR_ALLOC_CHECKSUM].count
+            - tags_start[LR_ALLOC_CHECKSUM].count != 2);
+    fail_if(lr_alloc_tag_set(LR_ALLOC_OTHER) != prev_tag);
+}
+END_TEST
+
 START_TEST(test_gettmpfile)
 {
     int fd = 0;
@@ -119,6 +161,51 @@ START_TEST(test_remove_dir)
 }
 END_TEST
 
+START_TEST(test_copy_content)
+{
+    char *tmp_dir, *src_file, *dst_file;
+    char *content = NULL;
+    gsize length = 0;
+    GString *data = g_string_new(NULL);
+    int src, dst, rc;
+
+    // More than one buffer of the copy loop
+    for (int x = 0; x < 20000; x++)
+        g_string_append_printf(data, "line %d\n", x);
+
+    tmp_dir = lr_gettmpdir();
+    fail_if(tmp_dir == NULL);
+    src_file = lr_pathconcat(tmp_dir, "source", NULL);
+    dst_file = lr_pathconcat(tmp_dir, "dest", NULL);
+    fail_if(!g_file_set_contents(src_file, data->str, data->len, NULL));
+
+    src = open(src_file, O_RDONLY);
+    fail_if(src < 0);
+    dst = open(dst_file, O_CREAT|O_TRUNC|O_RDWR, 0660);
+    fail_if(dst < 0);
+
+    // The copy starts at the beginning of both files
+    lseek(src, 100, SEEK_SET);
+    fail_if(write(dst, "garbage", 7) != 7);
+    rc = lr_copy_content(src, dst);
+    fail_if(rc != 0);
+    fail_if(lseek(dst, 0, SEEK_CUR) != (off_t) data->len);
+    close(src);
+    close(dst);
+
+    fail_if(!g_file_get_contents(dst_file, &content, &length, NULL));
+    fail_if(length != data->len);
+    fail_if(memcmp(content, data->str, length));
+
+    g_free(content);
+    g_string_free(data, TRUE);
+    lr_remove_dir(tmp_dir);
+    lr_free(src_file);
+    lr_free(dst_file);
+    lr_free(tmp_dir);
+}
+END_TEST
+
 START_TEST(test_url_without_path)
 {
     char *new_url = NULL;
@@ -217,10 +304,12 @@ util_suite(void)
     tcase_add_test(tc, test_malloc);
     tcase_add_test(tc, test_malloc0);
     tcase_add_test(tc, test_free);
+    tcase_add_test(tc, test_alloc_accounting);
     tcase_add_test(tc, test_gettmpfile);
     tcase_add_test(tc, test_gettmpdir);
     tcase_add_test(tc, test_pathconcat);
     tcase_add_test(tc, test_remove_dir);
+    tcase_add_test(tc, test_copy_content);
     tcase_add_test(tc, test_url_without_path);
     tcase_add_test(tc, test_strv_dup);
     suite_add_tcase(s, tc);
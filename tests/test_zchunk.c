@@ -0,0 +1,112 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "librepo/rcodes.h"
+#include "librepo/zchunk.h"
+
+#include "fixtures.h"
+#include "testsys.h"
+#include "test_zchunk.h"
+
+#define LEAD_SIZE       39      // Magic, 2 compressed ints, SHA-256
+#define HEADER_SIZE     74
+
+/** Build a zchunk header with a sha256 header checksum and two chunks
+ * with sha512/128 checksums (10 and 300 bytes long).
+ */
+static gsize
+build_header(unsigned char *buf)
+{
+    unsigned char *p = buf;
+
+    memcpy(p, "\0ZCK1", 5);         p += 5;
+    *p++ = 0x81;                    // Header checksum type (sha256)
+    *p++ = 0x80 | HEADER_SIZE;      // Header size
+    memset(p, 0xaa, 32);            p += 32;
+
+    // Preface
+    memset(p, 0xbb, 32);            p += 32;
+    *p++ = 0x80;                    // Flags
+    *p++ = 0x80;                    // Compression type
+
+    // Index
+    *p++ = 0x80 | 40;               // Index size
+    *p++ = 0x83;                    // Chunk checksum type (sha512/128)
+    *p++ = 0x82;                    // Chunk count
+    memset(p, 0x11, 16);            p += 16;
+    *p++ = 0x8a;                    // Length 10
+    *p++ = 0x8a;
+    memset(p, 0x22, 16);            p += 16;
+    *p++ = 0x2c;                    // Length 300
+    *p++ = 0x82;
+    *p++ = 0x81;
+
+    return (gsize) (p - buf);
+}
+
+START_TEST(test_zck_header_size)
+{
+    unsigned char buf[256];
+    gsize len = build_header(buf);
+    gint64 size = 0;
+
+    fail_if(len != LEAD_SIZE + HEADER_SIZE);
+    fail_if(!lr_zck_header_size(buf, len, &size));
+    ck_assert_int_eq(size, LEAD_SIZE + HEADER_SIZE);
+
+    // Only the lead is needed
+    fail_if(!lr_zck_header_size(buf, LEAD_SIZE, &size));
+    ck_assert_int_eq(size, LEAD_SIZE + HEADER_SIZE);
+
+    fail_if(lr_zck_header_size(buf, 10, &size));
+    fail_if(lr_zck_header_size((const unsigned char *) "<?xml version", 13,
+                               &size));
+}
+END_TEST
+
+START_TEST(test_zck_index_parse)
+{
+    unsigned char buf[256];
+    gsize len = build_header(buf);
+    GError *tmp_err = NULL;
+    LrZckIndex *index;
+    LrZckChunk *chunk;
+
+    index = lr_zck_index_parse(buf, len, &tmp_err);
+    fail_if(!index);
+    fail_if(tmp_err);
+    ck_assert_int_eq(index->header_size, LEAD_SIZE + HEADER_SIZE);
+    ck_assert_int_eq(index->checksum_type, 3);
+    ck_assert_int_eq(index->chunks->len, 2);
+
+    chunk = &g_array_index(index->chunks, LrZckChunk, 0);
+    ck_assert_int_eq(chunk->offset, LEAD_SIZE + HEADER_SIZE);
+    ck_assert_int_eq(chunk->length, 10);
+    ck_assert_str_eq(chunk->checksum, "11111111111111111111111111111111");
+
+    chunk = &g_array_index(index->chunks, LrZckChunk, 1);
+    ck_assert_int_eq(chunk->offset, LEAD_SIZE + HEADER_SIZE + 10);
+    ck_assert_int_eq(chunk->length, 300);
+    ck_assert_str_eq(chunk->checksum, "22222222222222222222222222222222");
+
+    lr_zck_index_free(index);
+
+    // Incomplete header
+    index = lr_zck_index_parse(buf, len - 1, &tmp_err);
+    fail_if(index);
+    fail_if(!tmp_err);
+    g_error_free(tmp_err);
+}
+END_TEST
+
+Suite *
+zchunk_suite(void)
+{
+    Suite *s = suite_create("zchunk");
+    TCase *tc = tcase_create("Main");
+    tcase_add_test(tc, test_zck_header_size);
+    tcase_add_test(tc, test_zck_index_parse);
+    suite_add_tcase(s, tc);
+    return s;
+}
@@ -0,0 +1,8 @@
+#ifndef LR_TEST_ZCHUNK_H
+#define LR_TEST_ZCHUNK_H
+
+#include <check.h>
+
+Suite *zchunk_suite(void);
+
+#endif